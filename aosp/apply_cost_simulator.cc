@@ -0,0 +1,248 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+// Estimates the time and memory it takes a device to apply a payload, by
+// partition, from the throughputs measured on devices of the same class.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include <cstdio>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <android-base/strings.h>
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/logging.h>
+#include <gflags/gflags.h>
+#include <xz.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/apply_stats.h"
+#include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_consumer/install_operation_executor.h"
+#include "update_engine/payload_consumer/payload_metadata.h"
+#include "update_engine/payload_generator/apply_cost_model.h"
+#include "update_engine/update_metadata.pb.h"
+
+DEFINE_string(payload, "", "Path to payload.bin");
+DEFINE_int64(payload_offset,
+             0,
+             "Offset to start of payload.bin. Useful if payload path actually "
+             "points to a .zip file containing payload.bin");
+DEFINE_string(profile,
+              "",
+              "Path to the throughputs of the device class: lines of "
+              "\"download|verify|merge|<operation type> <MiB/s>\", or the "
+              "apply stats and partition throughputs logged by update_engine "
+              "on such devices.");
+DEFINE_string(partitions,
+              "",
+              "Comma separated list of partitions to estimate, leave empty "
+              "for all partitions");
+DEFINE_bool(measure,
+            false,
+            "Apply the operations on the host and print the throughputs "
+            "measured, as a profile, rather than estimating the cost on the "
+            "device.");
+DEFINE_string(input_dir,
+              "",
+              "Directory to read the source images from when measuring an "
+              "incremental OTA");
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Applies the operations of |partition| to a temporary image and records
+// them in |stats|.
+bool MeasurePartition(const PartitionUpdate& partition,
+                      const unsigned char* data,
+                      size_t block_size,
+                      const base::FilePath& input_dir_path,
+                      ApplyStats* stats) {
+  InstallOperationExecutor executor(block_size);
+  TEST_AND_RETURN_FALSE(
+      executor.SetZstdDictionary(partition.zstd_dictionary()));
+  ScopedTempFile output("apply_cost_simulator.XXXXXX");
+  FileDescriptorPtr out_fd = std::make_shared<EintrSafeFileDescriptor>();
+  TEST_AND_RETURN_FALSE_ERRNO(out_fd->Open(output.path().c_str(), O_RDWR));
+  FileDescriptorPtr in_fd = std::make_shared<EintrSafeFileDescriptor>();
+  if (partition.has_old_partition_info()) {
+    const auto input_path =
+        input_dir_path.Append(partition.partition_name() + ".img").value();
+    TEST_AND_RETURN_FALSE_ERRNO(in_fd->Open(input_path.c_str(), O_RDONLY));
+  }
+  for (const auto& op : partition.operations()) {
+    ApplyStats::ScopedOperation scoped_operation(stats, op, block_size);
+    const unsigned char* op_data = data + op.data_offset();
+    auto writer = std::make_unique<DirectExtentWriter>(out_fd);
+    bool success = false;
+    switch (op.type()) {
+      case InstallOperation::ZERO:
+      case InstallOperation::DISCARD:
+        success =
+            executor.ExecuteZeroOrDiscardOperation(op, std::move(writer));
+        break;
+      case InstallOperation::REPLACE:
+      case InstallOperation::REPLACE_BZ:
+      case InstallOperation::REPLACE_XZ:
+      case InstallOperation::REPLACE_ZSTD:
+        success =
+            executor.ExecuteReplaceOperation(op, std::move(writer), op_data);
+        break;
+      case InstallOperation::SOURCE_COPY:
+        success =
+            executor.ExecuteSourceCopyOperation(op, std::move(writer), in_fd);
+        break;
+      case InstallOperation::TARGET_COPY:
+        success =
+            executor.ExecuteSourceCopyOperation(op, std::move(writer), out_fd);
+        break;
+      default:
+        success = executor.ExecuteDiffOperation(
+            op, std::move(writer), in_fd, op_data, op.data_length());
+        break;
+    }
+    TEST_AND_RETURN_FALSE(success);
+  }
+  return true;
+}
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+using chromeos_update_engine::ApplyStats;
+using chromeos_update_engine::DeltaArchiveManifest;
+using chromeos_update_engine::DeviceProfile;
+using chromeos_update_engine::PartitionCostEstimate;
+using chromeos_update_engine::PartitionUpdate;
+using chromeos_update_engine::PayloadMetadata;
+
+int main(int argc, char* argv[]) {
+  gflags::SetUsageMessage(
+      "A tool to estimate the cost of applying an Android OTA payload on a "
+      "class of devices");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  xz_crc32_init();
+  if (FLAGS_payload.empty()) {
+    LOG(ERROR) << "--payload <payload path> is required";
+    return 1;
+  }
+  DeviceProfile profile;
+  if (!FLAGS_measure) {
+    std::string profile_text;
+    if (FLAGS_profile.empty() ||
+        !base::ReadFileToString(base::FilePath(FLAGS_profile),
+                                &profile_text) ||
+        !chromeos_update_engine::ParseDeviceProfile(profile_text, &profile)) {
+      LOG(ERROR) << "A valid --profile <profile path> is required";
+      return 1;
+    }
+  }
+  auto tokens = android::base::Tokenize(FLAGS_partitions, ",");
+  const std::set<std::string> partitions(
+      std::make_move_iterator(tokens.begin()),
+      std::make_move_iterator(tokens.end()));
+
+  int payload_fd = open(FLAGS_payload.c_str(), O_RDONLY | O_CLOEXEC);
+  if (payload_fd < 0) {
+    PLOG(ERROR) << "Failed to open payload file";
+    return 1;
+  }
+  chromeos_update_engine::ScopedFdCloser closer{&payload_fd};
+  const auto payload_size = chromeos_update_engine::utils::FileSize(payload_fd);
+  if (payload_size <= FLAGS_payload_offset) {
+    PLOG(ERROR)
+        << "Couldn't determine size of payload file, or payload file is empty";
+    return 1;
+  }
+  auto payload = static_cast<unsigned char*>(
+      mmap(nullptr, payload_size, PROT_READ, MAP_PRIVATE, payload_fd, 0));
+  if (payload == MAP_FAILED) {
+    PLOG(ERROR) << "Failed to mmap() payload file";
+    return 1;
+  }
+  auto munmap_deleter = [payload_size](auto payload) {
+    munmap(payload, payload_size);
+  };
+  std::unique_ptr<unsigned char, decltype(munmap_deleter)> munmapper{
+      payload, munmap_deleter};
+  const unsigned char* payload_begin = payload + FLAGS_payload_offset;
+  const size_t size = payload_size - FLAGS_payload_offset;
+
+  PayloadMetadata payload_metadata;
+  DeltaArchiveManifest manifest;
+  if (payload_metadata.ParsePayloadHeader(payload_begin, size, nullptr) !=
+          chromeos_update_engine::MetadataParseResult::kSuccess ||
+      !payload_metadata.GetManifest(payload_begin, size, &manifest)) {
+    LOG(ERROR) << "Failed to parse the payload metadata";
+    return 1;
+  }
+  const size_t data_begin = payload_metadata.GetMetadataSize() +
+                            payload_metadata.GetMetadataSignatureSize();
+  const bool snapshot_enabled =
+      manifest.dynamic_partition_metadata().snapshot_enabled();
+
+  ApplyStats stats;
+  std::vector<PartitionCostEstimate> estimates;
+  for (PartitionUpdate partition : manifest.partitions()) {
+    if (!partitions.empty() && !partitions.count(partition.partition_name())) {
+      continue;
+    }
+    if (partition.has_operations_segment()) {
+      const auto& segment = partition.operations_segment();
+      if (data_begin + segment.data_offset() + segment.data_length() > size ||
+          !PayloadMetadata::ParseOperationsSegment(
+              payload_begin + data_begin + segment.data_offset(),
+              segment.data_length(),
+              &partition)) {
+        LOG(ERROR) << "Failed to parse the operations of "
+                   << partition.partition_name();
+        return 1;
+      }
+    }
+    if (FLAGS_measure) {
+      if (!chromeos_update_engine::MeasurePartition(
+              partition,
+              payload_begin + data_begin,
+              manifest.block_size(),
+              base::FilePath(FLAGS_input_dir),
+              &stats)) {
+        LOG(ERROR) << "Failed to apply " << partition.partition_name();
+        return 1;
+      }
+      continue;
+    }
+    estimates.push_back(chromeos_update_engine::EstimatePartitionCost(
+        partition, manifest.block_size(), snapshot_enabled, profile));
+  }
+
+  if (FLAGS_measure) {
+    LOG(INFO) << "Apply stats:\n" << stats.ToString();
+    printf("%s", chromeos_update_engine::ApplyStatsToProfile(stats).c_str());
+  } else {
+    printf("%s",
+           chromeos_update_engine::FormatCostEstimates(estimates).c_str());
+  }
+  return 0;
+}
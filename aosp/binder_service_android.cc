@@ -16,11 +16,16 @@
 
 #include "update_engine/aosp/binder_service_android.h"
 
+#include <unistd.h>
+
 #include <memory>
+#include <utility>
 
+#include <android-base/properties.h>
 #include <base/bind.h>
 #include <base/logging.h>
 #include <binderwrapper/binder_wrapper.h>
+#include <brillo/message_loops/message_loop.h>
 #include <utils/String8.h>
 
 #include "update_engine/aosp/binder_service_android_common.h"
@@ -34,16 +39,38 @@ using update_engine::UpdateEngineStatus;
 
 namespace chromeos_update_engine {
 
+namespace {
+// The shortest interval between two progress updates sent to a callback, and
+// the smallest change of progress worth sending.
+constexpr char kStatusMinIntervalMsProp[] =
+    "ro.update_engine.status_min_interval_ms";
+constexpr int kDefaultStatusMinIntervalMs = 1000;
+constexpr char kStatusMinProgressPermilleProp[] =
+    "ro.update_engine.status_min_progress_permille";
+constexpr int kDefaultStatusMinProgressPermille = 10;
+}  // namespace
+
 BinderUpdateEngineAndroidService::BinderUpdateEngineAndroidService(
     ServiceDelegateAndroidInterface* service_delegate)
-    : service_delegate_(service_delegate) {}
+    : status_min_interval_(base::TimeDelta::FromMilliseconds(
+          android::base::GetIntProperty(kStatusMinIntervalMsProp,
+                                        kDefaultStatusMinIntervalMs,
+                                        0))),
+      status_min_progress_delta_(
+          android::base::GetIntProperty(kStatusMinProgressPermilleProp,
+                                        kDefaultStatusMinProgressPermille,
+                                        0,
+                                        1000) /
+          1000.0),
+      service_delegate_(service_delegate) {}
 
 void BinderUpdateEngineAndroidService::SendStatusUpdate(
     const UpdateEngineStatus& update_engine_status) {
   last_status_ = static_cast<int>(update_engine_status.status);
   last_progress_ = update_engine_status.progress;
   for (auto& callback : callbacks_) {
-    callback->onStatusUpdate(last_status_, last_progress_);
+    status_coalescers_[IUpdateEngineCallback::asBinder(callback).get()]
+        ->Update(last_status_, last_progress_);
   }
 }
 
@@ -71,6 +98,16 @@ Status BinderUpdateEngineAndroidService::bind(
   }
 
   callbacks_.emplace_back(callback);
+  status_coalescers_[IUpdateEngineCallback::asBinder(callback).get()] =
+      std::make_unique<StatusCoalescer>(
+          &clock_,
+          status_min_interval_,
+          status_min_progress_delta_,
+          base::BindRepeating(
+              [](IUpdateEngineCallback* callback, int status, double progress) {
+                callback->onStatusUpdate(status, progress);
+              },
+              base::Unretained(callback.get())));
 
   const android::sp<IBinder>& callback_binder =
       IUpdateEngineCallback::asBinder(callback);
@@ -125,6 +162,26 @@ Status BinderUpdateEngineAndroidService::applyPayloadFd(
   return Status::ok();
 }
 
+Status BinderUpdateEngineAndroidService::applyPayloadStream(
+    const ParcelFileDescriptor& ring,
+    const ParcelFileDescriptor& socket,
+    int64_t payload_offset,
+    int64_t payload_size,
+    const vector<android::String16>& header_kv_pairs) {
+  vector<string> str_headers = ToVecString(header_kv_pairs);
+
+  Error error;
+  if (!service_delegate_->ApplyPayloadStream(ring.get(),
+                                             socket.get(),
+                                             payload_offset,
+                                             payload_size,
+                                             str_headers,
+                                             &error)) {
+    return ErrorPtrToStatus(error);
+  }
+  return Status::ok();
+}
+
 Status BinderUpdateEngineAndroidService::suspend() {
   Error error;
   if (!service_delegate_->SuspendUpdate(&error))
@@ -197,6 +254,7 @@ bool BinderUpdateEngineAndroidService::UnbindCallback(const IBinder* callback) {
     return false;
   }
   callbacks_.erase(it);
+  status_coalescers_.erase(callback);
   return true;
 }
 
@@ -218,6 +276,134 @@ Status BinderUpdateEngineAndroidService::allocateSpaceForPayload(
   return Status::ok();
 }
 
+Status BinderUpdateEngineAndroidService::applyPayloadAsync(
+    const android::String16& url,
+    int64_t payload_offset,
+    int64_t payload_size,
+    const vector<android::String16>& header_kv_pairs) {
+  return PostTask(
+      base::BindOnce(&BinderUpdateEngineAndroidService::ApplyPayloadTask,
+                     base::Unretained(this),
+                     string{android::String8{url}.c_str()},
+                     payload_offset,
+                     payload_size,
+                     ToVecString(header_kv_pairs)));
+}
+
+Status BinderUpdateEngineAndroidService::applyPayloadFdAsync(
+    const ParcelFileDescriptor& pfd,
+    int64_t payload_offset,
+    int64_t payload_size,
+    const vector<android::String16>& header_kv_pairs) {
+  // |pfd| is closed once the call returns.
+  android::base::unique_fd fd(dup(pfd.get()));
+  if (!fd.ok()) {
+    Error error{ErrorCode::kError, "Failed to duplicate the payload fd."};
+    return ErrorPtrToStatus(error);
+  }
+  return PostTask(
+      base::BindOnce(&BinderUpdateEngineAndroidService::ApplyPayloadFdTask,
+                     base::Unretained(this),
+                     std::move(fd),
+                     payload_offset,
+                     payload_size,
+                     ToVecString(header_kv_pairs)));
+}
+
+Status BinderUpdateEngineAndroidService::verifyPayloadApplicableAsync(
+    const android::String16& metadata_filename,
+    const android::sp<IUpdateEngineCallback>& callback) {
+  return PostTask(base::BindOnce(
+      &BinderUpdateEngineAndroidService::VerifyPayloadApplicableTask,
+      base::Unretained(this),
+      string{android::String8{metadata_filename}.c_str()},
+      callback));
+}
+
+Status BinderUpdateEngineAndroidService::allocateSpaceForPayloadAsync(
+    const android::String16& metadata_filename,
+    const vector<android::String16>& header_kv_pairs,
+    const android::sp<IUpdateEngineCallback>& callback) {
+  return PostTask(base::BindOnce(
+      &BinderUpdateEngineAndroidService::AllocateSpaceForPayloadTask,
+      base::Unretained(this),
+      string{android::String8{metadata_filename}.c_str()},
+      ToVecString(header_kv_pairs),
+      callback));
+}
+
+void BinderUpdateEngineAndroidService::ApplyPayloadTask(
+    const string& url,
+    int64_t payload_offset,
+    int64_t payload_size,
+    const vector<string>& headers) {
+  Error error;
+  if (!service_delegate_->ApplyPayload(
+          url, payload_offset, payload_size, headers, &error)) {
+    LOG(ERROR) << "Failed to apply the payload asynchronously: "
+               << error.message;
+    SendPayloadApplicationComplete(error.error_code);
+  }
+}
+
+void BinderUpdateEngineAndroidService::ApplyPayloadFdTask(
+    android::base::unique_fd fd,
+    int64_t payload_offset,
+    int64_t payload_size,
+    const vector<string>& headers) {
+  Error error;
+  if (!service_delegate_->ApplyPayload(
+          fd.get(), payload_offset, payload_size, headers, &error)) {
+    LOG(ERROR) << "Failed to apply the payload fd asynchronously: "
+               << error.message;
+    SendPayloadApplicationComplete(error.error_code);
+  }
+}
+
+void BinderUpdateEngineAndroidService::VerifyPayloadApplicableTask(
+    const string& metadata_filename,
+    const android::sp<IUpdateEngineCallback>& callback) {
+  LOG(INFO) << "Verifying payload metadata in " << metadata_filename
+            << " asynchronously.";
+  Error error{ErrorCode::kSuccess};
+  ErrorCode result = ErrorCode::kSuccess;
+  if (!service_delegate_->VerifyPayloadApplicable(metadata_filename, &error)) {
+    // A source partition which doesn't match leaves no error code.
+    result = error.error_code != ErrorCode::kSuccess ? error.error_code
+                                                     : ErrorCode::kError;
+  }
+  ignore_result(
+      callback->onPayloadApplicationComplete(static_cast<int>(result)));
+}
+
+void BinderUpdateEngineAndroidService::AllocateSpaceForPayloadTask(
+    const string& metadata_filename,
+    const vector<string>& headers,
+    const android::sp<IUpdateEngineCallback>& callback) {
+  LOG(INFO) << "Allocating space for " << metadata_filename
+            << " asynchronously.";
+  Error error{ErrorCode::kSuccess};
+  const uint64_t required_size = service_delegate_->AllocateSpaceForPayload(
+      metadata_filename, headers, &error);
+  ErrorCode result = error.error_code;
+  if (result == ErrorCode::kSuccess && required_size > 0) {
+    LOG(ERROR) << "Insufficient space, " << required_size
+               << " bytes are required.";
+    result = ErrorCode::kNotEnoughSpace;
+  }
+  ignore_result(
+      callback->onPayloadApplicationComplete(static_cast<int>(result)));
+}
+
+Status BinderUpdateEngineAndroidService::PostTask(base::OnceClosure task) {
+  if (brillo::MessageLoop::current()->PostTask(FROM_HERE, std::move(task)) ==
+      brillo::MessageLoop::kTaskIdNull) {
+    Error error{ErrorCode::kError, "Failed to post the task."};
+    return ErrorPtrToStatus(error);
+  }
+  return Status::ok();
+}
+
 class CleanupSuccessfulUpdateCallback
     : public CleanupSuccessfulUpdateCallbackInterface {
  public:
@@ -261,4 +447,18 @@ Status BinderUpdateEngineAndroidService::setPerformanceMode(bool enable) {
   return Status::ok();
 }
 
+Status BinderUpdateEngineAndroidService::setThrottlePolicy(int32_t policy) {
+  Error error;
+  if (!service_delegate_->SetThrottlePolicy(policy, &error))
+    return ErrorPtrToStatus(error);
+  return Status::ok();
+}
+
+Status BinderUpdateEngineAndroidService::setMergePolicy(int32_t policy) {
+  Error error;
+  if (!service_delegate_->SetMergePolicy(policy, &error))
+    return ErrorPtrToStatus(error);
+  return Status::ok();
+}
+
 }  // namespace chromeos_update_engine
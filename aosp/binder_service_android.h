@@ -19,9 +19,12 @@
 
 #include <stdint.h>
 
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include <android-base/unique_fd.h>
 #include <utils/Errors.h>
 #include <utils/String16.h>
 #include <utils/StrongPointer.h>
@@ -29,6 +32,8 @@
 #include "android/os/BnUpdateEngine.h"
 #include "android/os/IUpdateEngineCallback.h"
 #include "update_engine/aosp/service_delegate_android_interface.h"
+#include "update_engine/aosp/status_coalescer.h"
+#include "update_engine/common/clock.h"
 #include "update_engine/common/service_observer_interface.h"
 
 namespace chromeos_update_engine {
@@ -58,6 +63,12 @@ class BinderUpdateEngineAndroidService : public android::os::BnUpdateEngine,
       int64_t payload_offset,
       int64_t payload_size,
       const std::vector<android::String16>& header_kv_pairs) override;
+  android::binder::Status applyPayloadStream(
+      const ::android::os::ParcelFileDescriptor& ring,
+      const ::android::os::ParcelFileDescriptor& socket,
+      int64_t payload_offset,
+      int64_t payload_size,
+      const std::vector<android::String16>& header_kv_pairs) override;
   android::binder::Status bind(
       const android::sp<android::os::IUpdateEngineCallback>& callback,
       bool* return_value) override;
@@ -77,9 +88,28 @@ class BinderUpdateEngineAndroidService : public android::os::BnUpdateEngine,
       const android::String16& metadata_filename,
       const std::vector<android::String16>& header_kv_pairs,
       int64_t* return_value) override;
+  android::binder::Status applyPayloadAsync(
+      const android::String16& url,
+      int64_t payload_offset,
+      int64_t payload_size,
+      const std::vector<android::String16>& header_kv_pairs) override;
+  android::binder::Status applyPayloadFdAsync(
+      const ::android::os::ParcelFileDescriptor& pfd,
+      int64_t payload_offset,
+      int64_t payload_size,
+      const std::vector<android::String16>& header_kv_pairs) override;
+  android::binder::Status verifyPayloadApplicableAsync(
+      const android::String16& metadata_filename,
+      const android::sp<android::os::IUpdateEngineCallback>& callback) override;
+  android::binder::Status allocateSpaceForPayloadAsync(
+      const android::String16& metadata_filename,
+      const std::vector<android::String16>& header_kv_pairs,
+      const android::sp<android::os::IUpdateEngineCallback>& callback) override;
   android::binder::Status cleanupSuccessfulUpdate(
       const android::sp<android::os::IUpdateEngineCallback>& callback) override;
   android::binder::Status setPerformanceMode(bool enable) override;
+  android::binder::Status setThrottlePolicy(int32_t policy) override;
+  android::binder::Status setMergePolicy(int32_t policy) override;
 
  private:
   // Remove the passed |callback| from the list of registered callbacks. Called
@@ -87,9 +117,38 @@ class BinderUpdateEngineAndroidService : public android::os::BnUpdateEngine,
   // Returns true on success.
   bool UnbindCallback(const IBinder* callback);
 
+  // The work of the asynchronous calls, posted to the main loop so that the
+  // binder call returns right away. The service delegate is only used from
+  // the main loop, so the work can't move to another thread.
+  void ApplyPayloadTask(const std::string& url,
+                        int64_t payload_offset,
+                        int64_t payload_size,
+                        const std::vector<std::string>& headers);
+  void ApplyPayloadFdTask(android::base::unique_fd fd,
+                          int64_t payload_offset,
+                          int64_t payload_size,
+                          const std::vector<std::string>& headers);
+  void VerifyPayloadApplicableTask(
+      const std::string& metadata_filename,
+      const android::sp<android::os::IUpdateEngineCallback>& callback);
+  void AllocateSpaceForPayloadTask(
+      const std::string& metadata_filename,
+      const std::vector<std::string>& headers,
+      const android::sp<android::os::IUpdateEngineCallback>& callback);
+  // Returns an error status if |task| couldn't be posted.
+  android::binder::Status PostTask(base::OnceClosure task);
+
   // List of currently bound callbacks.
   std::vector<android::sp<android::os::IUpdateEngineCallback>> callbacks_;
 
+  // Limits the status updates sent to each of the bound callbacks, see
+  // StatusCoalescer.
+  Clock clock_;
+  std::map<const IBinder*, std::unique_ptr<StatusCoalescer>>
+      status_coalescers_;
+  base::TimeDelta status_min_interval_;
+  double status_min_progress_delta_;
+
   // Cached copy of the last status update sent. Used to send an initial
   // notification when bind() is called from the client.
   int last_status_{-1};
@@ -42,13 +42,27 @@ using brillo::MessageLoop;
 constexpr char kBootCompletedProp[] = "sys.boot_completed";
 constexpr auto&& kMergeDelaySecondsProp = "ro.virtual_ab.merge_delay_seconds";
 constexpr size_t kMaxMergeDelaySeconds = 600;
-// Interval to check sys.boot_completed.
+// Interval to check whether the I/O pressure allows starting the merge.
+constexpr int kCheckMergeWindowIntervalSeconds = 5;
+// The I/O pressure, in percent of the time tasks stalled on I/O, below which
+// the merge starts, and the longest the merge waits for it, in checks, with
+// the balanced and background merge policies.
+constexpr double kBalancedMergeIoPressure = 10;
+constexpr int kBalancedMergeWindowChecks = 12;
+constexpr double kBackgroundMergeIoPressure = 2;
+constexpr int kBackgroundMergeWindowChecks =
+    kMaxMergeDelaySeconds / kCheckMergeWindowIntervalSeconds;
+// Interval to check sys.boot_completed when it can't be watched.
 constexpr auto kCheckBootCompletedInterval = base::TimeDelta::FromSeconds(2);
+// Longest wait for a change of sys.boot_completed before checking it again.
+constexpr std::chrono::seconds kWatchBootCompletedTimeout{30};
 // Interval to check IBootControl::isSlotMarkedSuccessful
 constexpr auto kCheckSlotMarkedSuccessfulInterval =
     base::TimeDelta::FromSeconds(2);
-// Interval to call SnapshotManager::ProcessUpdateState
+// Bounds of the interval to call SnapshotManager::ProcessUpdateState. Within
+// them, the merge is polled about once per percent of progress.
 constexpr auto kWaitForMergeInterval = base::TimeDelta::FromSeconds(2);
+constexpr auto kMaxWaitForMergeInterval = base::TimeDelta::FromSeconds(10);
 
 #ifdef __ANDROID_RECOVERY__
 static constexpr bool kIsRecovery = true;
@@ -70,7 +84,8 @@ CleanupPreviousUpdateAction::CleanupPreviousUpdateAction(
       running_(false),
       cancel_failed_(false),
       last_percentage_(0),
-      merge_stats_(nullptr) {}
+      merge_stats_(nullptr),
+      load_sampler_(std::make_unique<PressureLoadSampler>()) {}
 
 CleanupPreviousUpdateAction::~CleanupPreviousUpdateAction() {
   StopActionInternal();
@@ -95,6 +110,7 @@ void CleanupPreviousUpdateAction::SuspendAction() {
 void CleanupPreviousUpdateAction::ActionCompleted(ErrorCode error_code) {
   StopActionInternal();
   ReportMergeStats();
+  ReportMergeTelemetry();
   metadata_device_ = nullptr;
 }
 
@@ -132,6 +148,7 @@ void CleanupPreviousUpdateAction::CheckTaskScheduled(std::string_view name) {
 void CleanupPreviousUpdateAction::StopActionInternal() {
   LOG(INFO) << "Stopping/suspending/completing CleanupPreviousUpdateAction";
   running_ = false;
+  boot_completed_watcher_.Cancel();
 
   if (scheduled_task_.IsScheduled()) {
     if (scheduled_task_.Cancel()) {
@@ -161,11 +178,22 @@ void CleanupPreviousUpdateAction::StartActionInternal() {
   CHECK(snapshot_ != nullptr);
   merge_stats_ = snapshot_->GetSnapshotMergeStatsInstance();
   CHECK(merge_stats_ != nullptr);
+  merge_telemetry_.OnActionStarted(base::TimeTicks::Now());
   WaitBootCompletedOrSchedule();
 }
 
 void CleanupPreviousUpdateAction::ScheduleWaitBootCompleted() {
   TEST_AND_RETURN(running_);
+  // Wake up as soon as the property changes rather than polling it.
+  if (boot_completed_watcher_.Watch(
+          kBootCompletedProp,
+          "1",
+          kWatchBootCompletedTimeout,
+          base::BindOnce(
+              &CleanupPreviousUpdateAction::WaitBootCompletedOrSchedule,
+              base::Unretained(this)))) {
+    return;
+  }
   if (!scheduled_task_.PostTask(
           FROM_HERE,
           base::Bind(&CleanupPreviousUpdateAction::WaitBootCompletedOrSchedule,
@@ -188,6 +216,7 @@ void CleanupPreviousUpdateAction::WaitBootCompletedOrSchedule() {
   auto boot_time = std::chrono::duration_cast<std::chrono::milliseconds>(
       android::base::boot_clock::now().time_since_epoch());
   merge_stats_->set_boot_complete_time_ms(boot_time.count());
+  merge_telemetry_.OnBootCompleted(base::TimeTicks::Now());
 
   LOG(INFO) << "Boot completed, waiting on markBootSuccessful()";
   CheckSlotMarkedSuccessfulOrSchedule();
@@ -205,11 +234,21 @@ void CleanupPreviousUpdateAction::ScheduleWaitMarkBootSuccessful() {
   }
 }
 
+ThrottlePolicy CleanupPreviousUpdateAction::GetMergePolicy() {
+  return delegate_ ? delegate_->GetMergePolicy() : ThrottlePolicy::kBalanced;
+}
+
 void CleanupPreviousUpdateAction::CheckForMergeDelay() {
   if (!android::snapshot::SnapshotManager::IsSnapshotManagerNeeded()) {
     StartMerge();
     return;
   }
+  if (IsHighResourcePolicy(GetMergePolicy())) {
+    LOG(INFO) << "Merge policy is " << ThrottlePolicyToString(GetMergePolicy())
+              << ", starting the merge now.";
+    StartMerge();
+    return;
+  }
   const auto merge_delay_seconds =
       std::clamp<int>(android::base::GetIntProperty(kMergeDelaySecondsProp, 0),
                       0,
@@ -219,15 +258,47 @@ void CleanupPreviousUpdateAction::CheckForMergeDelay() {
               << " is set, delaying merge by " << merge_delay_seconds
               << " seconds";
   }
+  merge_window_checks_ = 0;
   if (!scheduled_task_.PostTask(
           FROM_HERE,
-          [this]() { StartMerge(); },
+          [this]() { WaitForMergeWindowOrSchedule(); },
           base::TimeDelta::FromSeconds(merge_delay_seconds))) {
     LOG(ERROR) << "Unable to schedule " << __FUNCTION__;
     processor_->ActionComplete(this, ErrorCode::kError);
   }
 }
 
+void CleanupPreviousUpdateAction::WaitForMergeWindowOrSchedule() {
+  AcknowledgeTaskExecuted();
+  TEST_AND_RETURN(running_);
+  const ThrottlePolicy policy = GetMergePolicy();
+  const bool background = policy == ThrottlePolicy::kBackground;
+  const double io_pressure_limit =
+      background ? kBackgroundMergeIoPressure : kBalancedMergeIoPressure;
+  const int max_checks =
+      background ? kBackgroundMergeWindowChecks : kBalancedMergeWindowChecks;
+  LoadSample sample;
+  if (IsHighResourcePolicy(policy) || !load_sampler_->Sample(&sample) ||
+      sample.io_pressure <= io_pressure_limit ||
+      merge_window_checks_ >= max_checks) {
+    LOG(INFO) << "Starting the merge with the "
+              << ThrottlePolicyToString(policy) << " merge policy, I/O "
+              << "pressure is " << sample.io_pressure << "% after "
+              << merge_window_checks_ << " checks.";
+    StartMerge();
+    return;
+  }
+  merge_window_checks_++;
+  if (!scheduled_task_.PostTask(
+          FROM_HERE,
+          base::Bind(
+              &CleanupPreviousUpdateAction::WaitForMergeWindowOrSchedule,
+              base::Unretained(this)),
+          base::TimeDelta::FromSeconds(kCheckMergeWindowIntervalSeconds))) {
+    CheckTaskScheduled("WaitForMergeWindow");
+  }
+}
+
 void CleanupPreviousUpdateAction::CheckSlotMarkedSuccessfulOrSchedule() {
   AcknowledgeTaskExecuted();
   TEST_AND_RETURN(running_);
@@ -236,6 +307,7 @@ void CleanupPreviousUpdateAction::CheckSlotMarkedSuccessfulOrSchedule() {
     ScheduleWaitMarkBootSuccessful();
     return;
   }
+  merge_telemetry_.OnSlotMarkedSuccessful(base::TimeTicks::Now());
   CheckForMergeDelay();
 }
 
@@ -283,6 +355,7 @@ void CleanupPreviousUpdateAction::StartMerge() {
     }
   }
 
+  merge_telemetry_.OnMergeStarted(base::TimeTicks::Now());
   if (!merge_stats_->Start()) {
     // Not an error because CleanupPreviousUpdateAction may be paused and
     // resumed while kernel continues merging snapshots in the background.
@@ -295,11 +368,26 @@ void CleanupPreviousUpdateAction::StartMerge() {
 
 void CleanupPreviousUpdateAction::ScheduleWaitForMerge() {
   TEST_AND_RETURN(running_);
+  const auto now = std::chrono::steady_clock::now();
+  if (merge_wait_start_ == std::chrono::steady_clock::time_point{}) {
+    merge_wait_start_ = now;
+  }
+  // Poll about as often as the merge progresses by one percent.
+  auto interval = kWaitForMergeInterval;
+  if (last_percentage_ > 0) {
+    const auto per_percent = base::TimeDelta::FromMilliseconds(
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            now - merge_wait_start_)
+            .count() /
+        last_percentage_);
+    interval = std::clamp(
+        per_percent, kWaitForMergeInterval, kMaxWaitForMergeInterval);
+  }
   if (!scheduled_task_.PostTask(
           FROM_HERE,
           base::Bind(&CleanupPreviousUpdateAction::WaitForMergeOrSchedule,
                      base::Unretained(this)),
-          kWaitForMergeInterval)) {
+          interval)) {
     CheckTaskScheduled("WaitForMerge");
   }
 }
@@ -392,6 +480,13 @@ void CleanupPreviousUpdateAction::WaitForMergeOrSchedule() {
 bool CleanupPreviousUpdateAction::OnMergePercentageUpdate() {
   double percentage = 0.0;
   snapshot_->GetUpdateState(&percentage);
+  // The I/O pressure tells how much the merge competes with the foreground.
+  LoadSample load;
+  merge_telemetry_.AddSample(base::TimeTicks::Now(),
+                             percentage,
+                             merge_stats_->total_cow_size_bytes(),
+                             load_sampler_->Sample(&load) ? load.io_pressure
+                                                          : -1);
   if (delegate_) {
     // libsnapshot uses [0, 100] percentage but update_engine uses [0, 1].
     delegate_->OnCleanupProgressUpdate(percentage / 100);
@@ -492,6 +587,16 @@ void CleanupPreviousUpdateAction::InitiateMergeAndWait() {
   return;
 }
 
+void CleanupPreviousUpdateAction::ReportMergeTelemetry() {
+  if (!merge_telemetry_.merge_started()) {
+    return;
+  }
+  merge_telemetry_.OnMergeFinished(base::TimeTicks::Now());
+  if (delegate_) {
+    delegate_->OnMergeTelemetry(merge_telemetry_);
+  }
+}
+
 void CleanupPreviousUpdateAction::ReportMergeStats() {
   auto result = merge_stats_->Finish();
   if (result == nullptr) {
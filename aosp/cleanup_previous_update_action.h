@@ -17,20 +17,25 @@
 #ifndef UPDATE_ENGINE_AOSP_CLEANUP_PREVIOUS_UPDATE_ACTION_H_
 #define UPDATE_ENGINE_AOSP_CLEANUP_PREVIOUS_UPDATE_ACTION_H_
 
+#include <chrono>
 #include <memory>
 #include <string>
 #include <string_view>
+#include <utility>
 
 #include <brillo/message_loops/message_loop.h>
 #include <libsnapshot/snapshot.h>
 #include <libsnapshot/snapshot_stats.h>
 
+#include "update_engine/aosp/property_watcher.h"
 #include "update_engine/common/action.h"
 #include "update_engine/common/boot_control_interface.h"
 #include "update_engine/common/cleanup_previous_update_action_delegate.h"
 #include "update_engine/common/error_code.h"
+#include "update_engine/common/merge_telemetry.h"
 #include "update_engine/common/prefs_interface.h"
 #include "update_engine/common/scoped_task_id.h"
+#include "update_engine/common/throttle_controller.h"
 
 namespace chromeos_update_engine {
 
@@ -66,6 +71,11 @@ class CleanupPreviousUpdateAction : public Action<CleanupPreviousUpdateAction> {
   typedef ActionTraits<CleanupPreviousUpdateAction>::OutputObjectType
       OutputObjectType;
 
+  void set_load_sampler_for_testing(
+      std::unique_ptr<LoadSamplerInterface> load_sampler) {
+    load_sampler_ = std::move(load_sampler);
+  }
+
  private:
   PrefsInterface* prefs_;
   BootControlInterface* boot_control_;
@@ -77,6 +87,15 @@ class CleanupPreviousUpdateAction : public Action<CleanupPreviousUpdateAction> {
   unsigned int last_percentage_{0};
   android::snapshot::ISnapshotMergeStats* merge_stats_;
   ScopedTaskId scheduled_task_;
+  PropertyWatcher boot_completed_watcher_;
+  // Samples the I/O pressure the merge waits to settle before starting.
+  std::unique_ptr<LoadSamplerInterface> load_sampler_;
+  // How many times the I/O pressure was found too high to start the merge.
+  int merge_window_checks_{0};
+  // When the merge was found in progress first, to pace the merge polls.
+  std::chrono::steady_clock::time_point merge_wait_start_;
+  // Reported to |delegate_| once the action completes.
+  MergeTelemetry merge_telemetry_;
 
   // Helpers for task management.
   void AcknowledgeTaskExecuted();
@@ -89,11 +108,14 @@ class CleanupPreviousUpdateAction : public Action<CleanupPreviousUpdateAction> {
   void ScheduleWaitMarkBootSuccessful();
   void CheckSlotMarkedSuccessfulOrSchedule();
   void CheckForMergeDelay();
+  ThrottlePolicy GetMergePolicy();
+  void WaitForMergeWindowOrSchedule();
   void StartMerge();
   void ScheduleWaitForMerge();
   void WaitForMergeOrSchedule();
   void InitiateMergeAndWait();
   void ReportMergeStats();
+  void ReportMergeTelemetry();
 
   // Callbacks to ProcessUpdateState.
   bool OnMergePercentageUpdate();
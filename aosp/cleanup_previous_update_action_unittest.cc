@@ -15,6 +15,9 @@
 //
 
 #include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
 
 #include <brillo/message_loops/fake_message_loop.h>
 #include <gtest/gtest.h>
@@ -40,6 +43,33 @@ using testing::Return;
 class MockCleanupPreviousUpdateActionDelegate final
     : public CleanupPreviousUpdateActionDelegateInterface {
   MOCK_METHOD(void, OnCleanupProgressUpdate, (double), (override));
+  MOCK_METHOD(void, OnMergeTelemetry, (const MergeTelemetry&), (override));
+};
+
+class BackgroundMergeDelegate final
+    : public CleanupPreviousUpdateActionDelegateInterface {
+ public:
+  void OnCleanupProgressUpdate(double progress) override {}
+  ThrottlePolicy GetMergePolicy() override {
+    return ThrottlePolicy::kBackground;
+  }
+};
+
+// Reports the I/O pressures of |io_pressures| in turn, then the last one.
+class FakeLoadSampler : public LoadSamplerInterface {
+ public:
+  FakeLoadSampler(std::vector<double> io_pressures, size_t* samples)
+      : io_pressures_(std::move(io_pressures)), samples_(samples) {}
+  bool Sample(LoadSample* sample) override {
+    sample->io_pressure =
+        io_pressures_[std::min(*samples_, io_pressures_.size() - 1)];
+    (*samples_)++;
+    return true;
+  }
+
+ private:
+  std::vector<double> io_pressures_;
+  size_t* samples_;
 };
 
 class MockActionProcessor : public ActionProcessor {
@@ -124,6 +154,46 @@ TEST_F(CleanupPreviousUpdateActionTest, VABSlotSuccessful) {
   }
 }
 
+TEST_F(CleanupPreviousUpdateActionTest, ReportsMergeTelemetry) {
+  size_t samples = 0;
+  action_.set_load_sampler_for_testing(
+      std::make_unique<FakeLoadSampler>(std::vector<double>{0}, &samples));
+  EXPECT_CALL(mock_snapshot_, EnsureMetadataMounted())
+      .Times(AtLeast(1))
+      .WillRepeatedly(
+          []() { return std::make_unique<MockAutoDevice>("mock_device"); });
+  EXPECT_CALL(dynamic_control_, GetVirtualAbFeatureFlag())
+      .Times(AtLeast(1))
+      .WillRepeatedly(Return(LAUNCH));
+  EXPECT_CALL(boot_control_, IsSlotMarkedSuccessful(_))
+      .Times(AtLeast(1))
+      .WillRepeatedly(Return(true));
+  EXPECT_CALL(mock_stats_, Start()).WillRepeatedly(Return(true));
+  // The merge progresses on the first two polls.
+  auto merging = [](const std::function<bool()>& callback,
+                    const std::function<bool()>&) {
+    callback();
+    return UpdateState::Merging;
+  };
+  EXPECT_CALL(mock_snapshot_, ProcessUpdateState(_, _))
+      .Times(3)
+      .WillOnce(merging)
+      .WillOnce(merging)
+      .WillOnce(Return(UpdateState::MergeCompleted));
+  EXPECT_CALL(mock_delegate_, OnMergeTelemetry(_))
+      .WillOnce([](const MergeTelemetry& telemetry) {
+        EXPECT_TRUE(telemetry.merge_started());
+        ASSERT_EQ(telemetry.samples().size(), 2U);
+        EXPECT_DOUBLE_EQ(telemetry.average_io_pressure(), 0);
+      });
+  EXPECT_CALL(mock_processor_, ActionComplete(&action_, ErrorCode::kSuccess))
+      .Times(1);
+  action_.PerformAction();
+  while (loop_.PendingTasks()) {
+    ASSERT_TRUE(loop_.RunOnce(true));
+  }
+}
+
 TEST_F(CleanupPreviousUpdateActionTest, VabSlotNotReady) {
   // Cleanup action should repeatly query boot control until the slot is marked
   // successful.
@@ -171,4 +241,41 @@ TEST_F(CleanupPreviousUpdateActionTest, VabSlotNotReady) {
       << "Merge should not be started until slot is marked successful";
 }
 
+TEST_F(CleanupPreviousUpdateActionTest, BackgroundMergeWaitsForLowIoPressure) {
+  if (!android::snapshot::SnapshotManager::IsSnapshotManagerNeeded()) {
+    GTEST_SKIP() << "The merge starts right away without snapshots.";
+  }
+  BackgroundMergeDelegate delegate;
+  CleanupPreviousUpdateAction action{
+      &mock_prefs_, &boot_control_, &mock_snapshot_, &delegate};
+  action.SetProcessor(&mock_processor_);
+  size_t samples = 0;
+  action.set_load_sampler_for_testing(
+      std::make_unique<FakeLoadSampler>(std::vector<double>{50, 20, 1},
+                                        &samples));
+  EXPECT_CALL(mock_snapshot_, EnsureMetadataMounted())
+      .Times(AtLeast(1))
+      .WillRepeatedly(
+          []() { return std::make_unique<MockAutoDevice>("mock_device"); });
+  EXPECT_CALL(dynamic_control_, GetVirtualAbFeatureFlag())
+      .Times(AtLeast(1))
+      .WillRepeatedly(Return(LAUNCH));
+  EXPECT_CALL(boot_control_, IsSlotMarkedSuccessful(_))
+      .Times(AtLeast(1))
+      .WillRepeatedly(Return(true));
+  EXPECT_CALL(mock_stats_, Start()).Times(1).WillOnce([&samples]() {
+    EXPECT_EQ(samples, 3U) << "Merge should wait for the I/O pressure to drop";
+    return true;
+  });
+  EXPECT_CALL(mock_snapshot_, ProcessUpdateState(_, _))
+      .Times(AtLeast(1))
+      .WillRepeatedly(Return(UpdateState::MergeCompleted));
+  EXPECT_CALL(mock_processor_, ActionComplete(&action, ErrorCode::kSuccess))
+      .Times(1);
+  action.PerformAction();
+  while (loop_.PendingTasks()) {
+    ASSERT_TRUE(loop_.RunOnce(true));
+  }
+}
+
 }  // namespace chromeos_update_engine
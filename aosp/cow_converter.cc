@@ -18,9 +18,13 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
 #include <memory>
+#include <thread>
+#include <vector>
 
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -47,13 +51,31 @@ DEFINE_string(vabc_compression_param,
               "",
               "Compression parameter for VABC. Default is use what's specified "
               "in OTA package");
+DEFINE_int32(threads,
+             0,
+             "Number of partitions converted concurrently. 0 uses one thread "
+             "per CPU.");
 
 namespace chromeos_update_engine {
 
+// The number of threads compressing the COW of a partition when the payload
+// enables threaded compression, as used by libsnapshot on device.
+constexpr uint32_t kCowCompressThreads = 2;
+
 bool ProcessPartition(
     const chromeos_update_engine::DeltaArchiveManifest& manifest,
-    const chromeos_update_engine::PartitionUpdate& partition,
+    const chromeos_update_engine::PayloadMetadata& metadata,
+    const unsigned char* payload,
+    chromeos_update_engine::PartitionUpdate partition,
     const char* image_dir) {
+  if (partition.has_operations_segment()) {
+    const OperationsSegment& segment = partition.operations_segment();
+    TEST_AND_RETURN_FALSE(PayloadMetadata::ParseOperationsSegment(
+        payload + metadata.GetMetadataSize() +
+            metadata.GetMetadataSignatureSize() + segment.data_offset(),
+        segment.data_length(),
+        &partition));
+  }
   base::FilePath img_dir{image_dir};
   auto target_img = img_dir.Append(partition.partition_name() + ".img");
   auto output_cow = img_dir.Append(partition.partition_name() + ".cow");
@@ -77,6 +99,9 @@ bool ProcessPartition(
       .batch_write = true,
       .op_count_max = static_cast<uint32_t>(
           partition.new_partition_info().size() / manifest.block_size())};
+  if (dap.vabc_feature_set().threaded()) {
+    options.num_compress_threads = kCowCompressThreads;
+  }
   if (!FLAGS_vabc_compression_param.empty()) {
     options.compression = FLAGS_vabc_compression_param;
   }
@@ -161,9 +186,7 @@ int main(int argc, char* argv[]) {
     return 5;
   }
 
-  size_t estimated_total_cow_size = 0;
-  size_t actual_total_cow_size = 0;
-
+  std::vector<const chromeos_update_engine::PartitionUpdate*> selected;
   for (const auto& partition : manifest.partitions()) {
     if (partition.estimate_cow_size() == 0) {
       continue;
@@ -172,10 +195,52 @@ int main(int argc, char* argv[]) {
         partitions.count(partition.partition_name()) == 0) {
       continue;
     }
-    LOG(INFO) << partition.partition_name();
-    if (!ProcessPartition(manifest, partition, images_dir)) {
-      return 6;
+    selected.push_back(&partition);
+  }
+
+  // The partitions are converted concurrently, each through its own writer,
+  // reading the operations from the mapped payload.
+  if (FLAGS_threads < 0) {
+    LOG(ERROR) << "Invalid --threads " << FLAGS_threads;
+    return 1;
+  }
+  const size_t num_threads = std::max<size_t>(
+      1,
+      std::min<size_t>(FLAGS_threads > 0 ? FLAGS_threads
+                                         : std::thread::hardware_concurrency(),
+                       selected.size()));
+  std::atomic<size_t> next_partition{0};
+  std::atomic<bool> success{true};
+  auto thread_main = [&] {
+    while (success) {
+      const size_t i = next_partition++;
+      if (i >= selected.size()) {
+        return;
+      }
+      LOG(INFO) << selected[i]->partition_name();
+      if (!chromeos_update_engine::ProcessPartition(
+              manifest, payload_metadata, payload, *selected[i], images_dir)) {
+        success = false;
+      }
     }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; i++) {
+    threads.emplace_back(thread_main);
+  }
+  thread_main();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  if (!success) {
+    return 6;
+  }
+
+  size_t estimated_total_cow_size = 0;
+  size_t actual_total_cow_size = 0;
+
+  for (const auto* partition_ptr : selected) {
+    const auto& partition = *partition_ptr;
     base::FilePath img_dir{images_dir};
     const auto output_cow =
         img_dir.Append(partition.partition_name() + ".cow").value();
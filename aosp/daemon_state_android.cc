@@ -16,7 +16,11 @@
 
 #include "update_engine/aosp/daemon_state_android.h"
 
+#include <string>
+
+#include <android-base/properties.h>
 #include <base/logging.h>
+#include <base/time/time.h>
 
 #include "update_engine/aosp/apex_handler_interface.h"
 #include "update_engine/aosp/update_attempter_android.h"
@@ -24,10 +28,25 @@
 #include "update_engine/common/boot_control_stub.h"
 #include "update_engine/common/hardware.h"
 #include "update_engine/common/prefs.h"
+#include "update_engine/common/utils.h"
 
 namespace chromeos_update_engine {
 
+namespace {
+// Stores the prefs in a single log file instead of one file per key. The
+// existing prefs are imported when it is first enabled.
+constexpr char kLogPrefsProperty[] = "ro.update_engine.log_prefs";
+
+void LogStartupCost(const char* step, base::TimeTicks start) {
+  LOG(INFO) << step << " took "
+            << (base::TimeTicks::Now() - start).InMilliseconds()
+            << " ms, resident set is " << utils::GetResidentSetKiB()
+            << " KiB.";
+}
+}  // namespace
+
 bool DaemonStateAndroid::Initialize() {
+  const auto start = base::TimeTicks::Now();
   boot_control_ = boot_control::CreateBootControl();
   if (!boot_control_) {
     LOG(WARNING) << "Unable to create BootControl instance, using stub "
@@ -50,6 +69,14 @@ bool DaemonStateAndroid::Initialize() {
     prefs_.reset(new MemoryPrefs());
     LOG(WARNING)
         << "Could not get a non-volatile directory, fall back to memory prefs";
+  } else if (android::base::GetBoolProperty(kLogPrefsProperty, false)) {
+    LogPrefs* prefs = new LogPrefs();
+    prefs_.reset(prefs);
+    if (!prefs->Init(non_volatile_path.Append(kPrefsLogFile),
+                     non_volatile_path.Append(kPrefsSubDirectory))) {
+      LOG(ERROR) << "Failed to initialize preferences.";
+      return false;
+    }
   } else {
     Prefs* prefs = new Prefs();
     prefs_.reset(prefs);
@@ -72,13 +99,16 @@ bool DaemonStateAndroid::Initialize() {
                                  hardware_.get(),
                                  ApexHandlerInterface::CreateApexHandler()));
 
+  LogStartupCost("Initializing the daemon state", start);
   return true;
 }
 
 bool DaemonStateAndroid::StartUpdater() {
   // The DaemonState in Android is a passive daemon. It will only start applying
   // an update when instructed to do so from the exposed binder API.
+  const auto start = base::TimeTicks::Now();
   update_attempter_->Init();
+  LogStartupCost("Starting the updater", start);
   return true;
 }
 
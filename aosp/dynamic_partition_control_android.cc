@@ -21,6 +21,7 @@
 #include <cstdint>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <string_view>
@@ -175,8 +176,8 @@ bool DynamicPartitionControlAndroid::OptimizeOperation(
     case InstallOperation::SOURCE_COPY:
       return target_supports_snapshot_ &&
              GetVirtualAbFeatureFlag().IsEnabled() &&
-             mapped_devices_.count(partition_name +
-                                   SlotSuffixForSlotNumber(target_slot_)) > 0 &&
+             IsMappedByUs(partition_name +
+                          SlotSuffixForSlotNumber(target_slot_)) &&
              OptimizeSourceCopyOperation(operation, optimized);
       break;
     default:
@@ -198,6 +199,7 @@ bool DynamicPartitionControlAndroid::MapPartitionInternal(
       .force_writable = force_writable,
   };
   bool success = false;
+  const auto start = std::chrono::steady_clock::now();
   if (GetVirtualAbFeatureFlag().IsEnabled() && target_supports_snapshot_ &&
       force_writable && ExpectMetadataMounted()) {
     // Only target partitions are mapped with force_writable. On Virtual
@@ -219,8 +221,14 @@ bool DynamicPartitionControlAndroid::MapPartitionInternal(
   }
   LOG(INFO) << "Succesfully mapped " << target_partition_name
             << " to device mapper (force_writable = " << force_writable
-            << "); device path at " << *path;
+            << "); device path at " << *path << ", took "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << " ms";
+  std::lock_guard<std::mutex> lock(mapped_devices_mutex_);
   mapped_devices_.insert(target_partition_name);
+  device_paths_[target_partition_name] = *path;
   return true;
 }
 
@@ -232,8 +240,9 @@ bool DynamicPartitionControlAndroid::MapPartitionOnDeviceMapper(
     std::string* path) {
   DmDeviceState state = GetState(target_partition_name);
   if (state == DmDeviceState::ACTIVE) {
-    if (mapped_devices_.find(target_partition_name) != mapped_devices_.end()) {
-      if (GetDmDevicePathByName(target_partition_name, path)) {
+    if (IsMappedByUs(target_partition_name)) {
+      if (GetCachedDevicePath(target_partition_name, path) ||
+          GetDmDevicePathByName(target_partition_name, path)) {
         LOG(INFO) << target_partition_name
                   << " is mapped on device mapper: " << *path;
         return true;
@@ -296,18 +305,49 @@ bool DynamicPartitionControlAndroid::UnmapPartitionOnDeviceMapper(
     LOG(INFO) << "Successfully unmapped " << target_partition_name
               << " from device mapper.";
   }
+  std::lock_guard<std::mutex> lock(mapped_devices_mutex_);
   mapped_devices_.erase(target_partition_name);
+  device_paths_.erase(target_partition_name);
   return true;
 }
 
-bool DynamicPartitionControlAndroid::UnmapAllPartitions() {
-  snapshot_->UnmapAllSnapshots();
-  if (mapped_devices_.empty()) {
+bool DynamicPartitionControlAndroid::GetCachedDevicePath(
+    const std::string& name, std::string* path) {
+  std::lock_guard<std::mutex> lock(mapped_devices_mutex_);
+  const auto it = device_paths_.find(name);
+  if (it == device_paths_.end()) {
     return false;
   }
+  *path = it->second;
+  return true;
+}
+
+void DynamicPartitionControlAndroid::CacheDevicePath(const std::string& name,
+                                                     const std::string& path) {
+  std::lock_guard<std::mutex> lock(mapped_devices_mutex_);
+  device_paths_[name] = path;
+}
+
+bool DynamicPartitionControlAndroid::IsMappedByUs(
+    const std::string& target_partition_name) {
+  std::lock_guard<std::mutex> lock(mapped_devices_mutex_);
+  return mapped_devices_.count(target_partition_name) > 0;
+}
+
+bool DynamicPartitionControlAndroid::UnmapAllPartitions() {
+  snapshot_->UnmapAllSnapshots();
+  all_snapshots_mapped_ = false;
   // UnmapPartitionOnDeviceMapper removes objects from mapped_devices_, hence
   // a copy is needed for the loop.
-  std::set<std::string> mapped = mapped_devices_;
+  std::set<std::string> mapped;
+  {
+    std::lock_guard<std::mutex> lock(mapped_devices_mutex_);
+    mapped = mapped_devices_;
+    device_paths_.clear();
+  }
+  if (mapped.empty()) {
+    return false;
+  }
   LOG(INFO) << "Destroying [" << Join(mapped, ", ") << "] from device mapper";
   for (const auto& partition_name : mapped) {
     ignore_result(UnmapPartitionOnDeviceMapper(partition_name));
@@ -317,6 +357,7 @@ bool DynamicPartitionControlAndroid::UnmapAllPartitions() {
 
 void DynamicPartitionControlAndroid::Cleanup() {
   UnmapAllPartitions();
+  InvalidateMetadataCache();
   metadata_device_.reset();
   if (GetVirtualAbFeatureFlag().IsEnabled()) {
     snapshot_ = SnapshotManager::New();
@@ -377,6 +418,26 @@ DynamicPartitionControlAndroid::LoadMetadataBuilder(
   return builder;
 }
 
+std::shared_ptr<MetadataBuilder>
+DynamicPartitionControlAndroid::LoadCachedMetadataBuilder(
+    const std::string& super_device, uint32_t slot) {
+  std::lock_guard<std::mutex> lock(metadata_cache_mutex_);
+  if (!metadata_cache_enabled_) {
+    return LoadMetadataBuilder(super_device, slot);
+  }
+  auto& builder = metadata_cache_[{super_device, slot}];
+  if (builder == nullptr) {
+    builder = LoadMetadataBuilder(super_device, slot);
+  }
+  return builder;
+}
+
+void DynamicPartitionControlAndroid::InvalidateMetadataCache() {
+  std::lock_guard<std::mutex> lock(metadata_cache_mutex_);
+  metadata_cache_enabled_ = false;
+  metadata_cache_.clear();
+}
+
 bool DynamicPartitionControlAndroid::StoreMetadata(
     const std::string& super_device,
     MetadataBuilder* builder,
@@ -452,6 +513,25 @@ bool DynamicPartitionControlAndroid::PreparePartitionsForUpdate(
     bool update,
     uint64_t* required_size,
     ErrorCode* error) {
+  // The metadata may change until the partitions are prepared, e.g. when a
+  // merge of the previous update completes.
+  InvalidateMetadataCache();
+  if (!PreparePartitionsForUpdateInternal(
+          source_slot, target_slot, manifest, update, required_size, error)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(metadata_cache_mutex_);
+  metadata_cache_enabled_ = true;
+  return true;
+}
+
+bool DynamicPartitionControlAndroid::PreparePartitionsForUpdateInternal(
+    uint32_t source_slot,
+    uint32_t target_slot,
+    const DeltaArchiveManifest& manifest,
+    bool update,
+    uint64_t* required_size,
+    ErrorCode* error) {
   source_slot_ = source_slot;
   target_slot_ = target_slot;
   if (required_size != nullptr) {
@@ -973,11 +1053,24 @@ bool DynamicPartitionControlAndroid::PrepareSnapshotPartitionsForUpdate(
   TEST_AND_RETURN_FALSE(
       CheckSuperPartitionAllocatableSpace(builder.get(), manifest, true));
 
+  all_snapshots_mapped_ = false;
+  auto start = std::chrono::steady_clock::now();
   if (!snapshot_->BeginUpdate()) {
     LOG(ERROR) << "Cannot begin new update.";
     return false;
   }
+  LOG(INFO) << "BeginUpdate took "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << " ms";
+  start = std::chrono::steady_clock::now();
   auto ret = snapshot_->CreateUpdateSnapshots(manifest);
+  LOG(INFO) << "CreateUpdateSnapshots took "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << " ms";
   if (!ret) {
     LOG(ERROR) << "Cannot create update snapshots: " << ret.string();
     if (required_size != nullptr &&
@@ -1195,7 +1288,8 @@ bool DynamicPartitionControlAndroid::IsSuperBlockDevice(
     const std::string& partition_name_suffix) {
   std::string source_device =
       device_dir.Append(GetSuperPartitionName(current_slot)).value();
-  auto source_metadata = LoadMetadataBuilder(source_device, current_slot);
+  auto source_metadata =
+      LoadCachedMetadataBuilder(source_device, current_slot);
   return source_metadata->HasBlockDevice(partition_name_suffix);
 }
 
@@ -1210,7 +1304,7 @@ DynamicPartitionControlAndroid::GetDynamicPartitionDevice(
   std::string super_device =
       device_dir.Append(GetSuperPartitionName(slot)).value();
 
-  auto builder = LoadMetadataBuilder(super_device, slot);
+  auto builder = LoadCachedMetadataBuilder(super_device, slot);
   if (builder == nullptr) {
     LOG(ERROR) << "No metadata in slot "
                << BootControlInterface::SlotName(slot);
@@ -1231,6 +1325,9 @@ DynamicPartitionControlAndroid::GetDynamicPartitionDevice(
   }
 
   if (slot == current_slot) {
+    if (GetCachedDevicePath(partition_name_suffix, device)) {
+      return DynamicPartitionDeviceStatus::SUCCESS;
+    }
     if (GetState(partition_name_suffix) != DmDeviceState::ACTIVE) {
       LOG(WARNING) << partition_name_suffix << " is at current slot but it is "
                    << "not mapped. Now try to map it.";
@@ -1238,6 +1335,7 @@ DynamicPartitionControlAndroid::GetDynamicPartitionDevice(
       if (GetDmDevicePathByName(partition_name_suffix, device)) {
         LOG(INFO) << partition_name_suffix
                   << " is mapped on device mapper: " << *device;
+        CacheDevicePath(partition_name_suffix, *device);
         return DynamicPartitionDeviceStatus::SUCCESS;
       }
       LOG(ERROR) << partition_name_suffix << "is mapped but path is unknown.";
@@ -1255,6 +1353,7 @@ DynamicPartitionControlAndroid::GetDynamicPartitionDevice(
 
 void DynamicPartitionControlAndroid::set_fake_mapped_devices(
     const std::set<std::string>& fake) {
+  std::lock_guard<std::mutex> lock(mapped_devices_mutex_);
   mapped_devices_ = fake;
 }
 
@@ -1307,6 +1406,7 @@ DynamicPartitionControlAndroid::GetCleanupPreviousUpdateAction(
 }
 
 bool DynamicPartitionControlAndroid::ResetUpdate(PrefsInterface* prefs) {
+  InvalidateMetadataCache();
   if (!GetVirtualAbFeatureFlag().IsEnabled()) {
     return true;
   }
@@ -1324,6 +1424,7 @@ bool DynamicPartitionControlAndroid::ResetUpdate(PrefsInterface* prefs) {
   TEST_AND_RETURN_FALSE(DeltaPerformer::ResetUpdateProgress(
       prefs, false /* quick */, false /* skip dynamic partitions metadata */));
 
+  all_snapshots_mapped_ = false;
   if (ExpectMetadataMounted()) {
     TEST_AND_RETURN_FALSE(snapshot_->CancelUpdate());
   } else {
@@ -1364,7 +1465,7 @@ bool DynamicPartitionControlAndroid::ListDynamicPartitionsForSlot(
   TEST_AND_RETURN_FALSE(GetDeviceDir(&device_dir_str));
   base::FilePath device_dir(device_dir_str);
   auto super_device = device_dir.Append(GetSuperPartitionName(slot)).value();
-  auto builder = LoadMetadataBuilder(super_device, slot);
+  auto builder = LoadCachedMetadataBuilder(super_device, slot);
   TEST_AND_RETURN_FALSE(builder != nullptr);
 
   std::vector<std::string> result;
@@ -1392,12 +1493,14 @@ bool DynamicPartitionControlAndroid::VerifyExtentsForUntouchedPartitions(
 
   auto source_super_device =
       device_dir.Append(GetSuperPartitionName(source_slot)).value();
-  auto source_builder = LoadMetadataBuilder(source_super_device, source_slot);
+  auto source_builder =
+      LoadCachedMetadataBuilder(source_super_device, source_slot);
   TEST_AND_RETURN_FALSE(source_builder != nullptr);
 
   auto target_super_device =
       device_dir.Append(GetSuperPartitionName(target_slot)).value();
-  auto target_builder = LoadMetadataBuilder(target_super_device, target_slot);
+  auto target_builder =
+      LoadCachedMetadataBuilder(target_super_device, target_slot);
   TEST_AND_RETURN_FALSE(target_builder != nullptr);
 
   return MetadataBuilder::VerifyExtentsAgainstSourceMetadata(
@@ -1484,7 +1587,12 @@ std::optional<base::FilePath> DynamicPartitionControlAndroid::GetSuperDevice() {
 }
 
 bool DynamicPartitionControlAndroid::MapAllPartitions() {
-  return snapshot_->MapAllSnapshots(kMapSnapshotTimeout);
+  if (all_snapshots_mapped_) {
+    LOG(INFO) << "All snapshots are already mapped.";
+    return true;
+  }
+  all_snapshots_mapped_ = snapshot_->MapAllSnapshots(kMapSnapshotTimeout);
+  return all_snapshots_mapped_;
 }
 
 bool DynamicPartitionControlAndroid::IsDynamicPartition(
@@ -1494,6 +1602,7 @@ bool DynamicPartitionControlAndroid::IsDynamicPartition(
                << dynamic_partition_list_.size() << " slots";
     return false;
   }
+  std::lock_guard<std::mutex> lock(mapped_devices_mutex_);
   auto& dynamic_partition_list = dynamic_partition_list_[slot];
   if (dynamic_partition_list.empty() &&
       GetDynamicPartitionsFeatureFlag().IsEnabled()) {
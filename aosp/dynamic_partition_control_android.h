@@ -18,10 +18,13 @@
 #define UPDATE_ENGINE_AOSP_DYNAMIC_PARTITION_CONTROL_ANDROID_H_
 
 #include <array>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 #include <base/files/file_util.h>
@@ -239,6 +242,23 @@ class DynamicPartitionControlAndroid : public DynamicPartitionControlInterface {
   friend class DynamicPartitionControlAndroidTest;
   friend class SnapshotPartitionTestP;
 
+  // Returns the metadata of |slot| in |super_device| for reading only. Once
+  // PreparePartitionsForUpdate() succeeded the metadata doesn't change until
+  // Cleanup() or ResetUpdate(), so it is loaded once per slot and shared by
+  // the partition lookups and the verification of the update attempt.
+  std::shared_ptr<android::fs_mgr::MetadataBuilder> LoadCachedMetadataBuilder(
+      const std::string& super_device, uint32_t slot);
+  void InvalidateMetadataCache();
+
+  // Prepares the partitions; PreparePartitionsForUpdate() wraps this to
+  // start caching the metadata on success.
+  bool PreparePartitionsForUpdateInternal(uint32_t source_slot,
+                                          uint32_t target_slot,
+                                          const DeltaArchiveManifest& manifest,
+                                          bool update,
+                                          uint64_t* required_size,
+                                          ErrorCode* error);
+
   bool MapPartitionInternal(const std::string& super_device,
                             const std::string& target_partition_name,
                             uint32_t slot,
@@ -338,7 +358,27 @@ class DynamicPartitionControlAndroid : public DynamicPartitionControlInterface {
   // target_supports_snapshot_ and is_target_dynamic_.
   bool SetTargetBuildVars(const DeltaArchiveManifest& manifest);
 
+  // Returns whether |target_partition_name| is in |mapped_devices_|.
+  bool IsMappedByUs(const std::string& target_partition_name);
+
+  // Returns the path of the device mapper device |name| from
+  // |device_paths_|, if it was looked up or mapped before.
+  bool GetCachedDevicePath(const std::string& name, std::string* path);
+  void CacheDevicePath(const std::string& name, const std::string& path);
+
+  // Partition devices may be looked up and mapped from several threads, see
+  // InstallPlan::LoadPartitionsFromSlots(). This guards |mapped_devices_|,
+  // |device_paths_| and the lazy loads of |dynamic_partition_list_|.
+  std::mutex mapped_devices_mutex_;
   std::set<std::string> mapped_devices_;
+  // The paths of the device mapper devices mapped by us or found active in
+  // the current slot, by name, so that the actions of an update attempt don't
+  // query device mapper for them again. Entries are dropped when the devices
+  // are unmapped, and all of them by UnmapAllPartitions().
+  std::map<std::string, std::string> device_paths_;
+  // Whether MapAllPartitions() mapped the snapshots, which then stay mapped
+  // across actions until UnmapAllPartitions().
+  bool all_snapshots_mapped_ = false;
   const FeatureFlag dynamic_partitions_;
   const FeatureFlag virtual_ab_;
   const FeatureFlag virtual_ab_compression_;
@@ -357,6 +397,18 @@ class DynamicPartitionControlAndroid : public DynamicPartitionControlInterface {
   // to change in the future. And certaintly won't change at runtime.
   std::array<std::vector<std::string>, 2> dynamic_partition_list_{};
 
+  // Guards |metadata_cache_enabled_| and |metadata_cache_|. This isn't
+  // |mapped_devices_mutex_| because the lazy loads of
+  // |dynamic_partition_list_| read the metadata while holding that.
+  std::mutex metadata_cache_mutex_;
+  // Whether the metadata is final for the current update attempt.
+  bool metadata_cache_enabled_ = false;
+  // The metadata loaded by LoadCachedMetadataBuilder(), by super device and
+  // slot.
+  std::map<std::pair<std::string, uint32_t>,
+           std::shared_ptr<android::fs_mgr::MetadataBuilder>>
+      metadata_cache_;
+
   DISALLOW_COPY_AND_ASSIGN(DynamicPartitionControlAndroid);
 };
 
@@ -119,6 +119,7 @@ class DynamicPartitionControlAndroidTest : public ::testing::Test {
                    const PartitionSuffixSizes& sizes,
                    uint32_t partition_attr = 0,
                    uint64_t super_size = kDefaultSuperSize) {
+    dynamicControl().InvalidateMetadataCache();
     EXPECT_CALL(dynamicControl(),
                 LoadMetadataBuilder(GetSuperDevice(slot), slot))
         .Times(AnyNumber())
@@ -342,6 +343,27 @@ TEST_P(DynamicPartitionControlAndroidTestP, NotEnoughSpaceForSlot) {
       << "Should not be able to grow over size of super / 2";
 }
 
+// The device mapper path of a source partition is looked up once per update.
+TEST_P(DynamicPartitionControlAndroidTestP, CachesSourceDevicePath) {
+  ON_CALL(dynamicControl(), GetDynamicPartitionsFeatureFlag())
+      .WillByDefault(Return(FeatureFlag(FeatureFlag::Value::RETROFIT)));
+  SetMetadata(source(), {{S("system"), 2_GiB}, {T("system"), 2_GiB}});
+  EXPECT_TRUE(dynamicControl().PreparePartitionsForUpdate(
+      source(), target(), {}, true, nullptr, nullptr));
+
+  EXPECT_CALL(dynamicControl(), GetState(S("system")))
+      .Times(1)
+      .WillOnce(Return(DmDeviceState::ACTIVE));
+  EXPECT_CALL(dynamicControl(), GetDmDevicePathByName(S("system"), _))
+      .Times(1);
+  for (int i = 0; i < 2; i++) {
+    string system_device;
+    EXPECT_TRUE(dynamicControl().GetPartitionDevice(
+        "system", source(), source(), &system_device));
+    EXPECT_EQ(GetDmDevice(S("system")), system_device);
+  }
+}
+
 TEST_P(DynamicPartitionControlAndroidTestP,
        ApplyRetrofitUpdateOnDynamicPartitionsEnabledBuild) {
   ON_CALL(dynamicControl(), GetDynamicPartitionsFeatureFlag())
@@ -749,6 +771,42 @@ TEST_F(DynamicPartitionControlAndroidTest, SimulatedSecondUpdate) {
                                           {"deleted", 64_MiB}}));
 }
 
+// Once the partitions are prepared, the metadata of a slot is loaded once for
+// the rest of the update attempt.
+TEST_F(DynamicPartitionControlAndroidTest, MetadataIsLoadedOncePerUpdate) {
+  SetSlots({0, 1});
+
+  SetMetadata(source(), update_sizes_0());
+  SetMetadata(target(), update_sizes_0());
+  ExpectStoreMetadata(update_sizes_1());
+  ExpectUnmap({"grown_b", "shrunk_b", "same_b", "added_b"});
+  ASSERT_TRUE(PreparePartitionsForUpdate({{"grown", 3_GiB},
+                                          {"shrunk", 150_MiB},
+                                          {"same", 100_MiB},
+                                          {"added", 150_MiB}}));
+
+  auto load_target = [](auto, auto) {
+    return NewFakeMetadata(PartitionSuffixSizesToManifest(update_sizes_1()));
+  };
+  EXPECT_CALL(dynamicControl(),
+              LoadMetadataBuilder(GetSuperDevice(target()), target()))
+      .WillOnce(Invoke(load_target));
+  std::vector<std::string> partitions;
+  for (int i = 0; i < 2; i++) {
+    ASSERT_TRUE(dynamicControl().ListDynamicPartitionsForSlot(
+        target(), source(), &partitions));
+    ASSERT_EQ(4U, partitions.size());
+  }
+
+  // The next update attempt loads the metadata again.
+  ASSERT_TRUE(dynamicControl().ResetUpdate(nullptr));
+  EXPECT_CALL(dynamicControl(),
+              LoadMetadataBuilder(GetSuperDevice(target()), target()))
+      .WillOnce(Invoke(load_target));
+  ASSERT_TRUE(dynamicControl().ListDynamicPartitionsForSlot(
+      target(), source(), &partitions));
+}
+
 TEST_F(DynamicPartitionControlAndroidTest, ApplyingToCurrentSlot) {
   SetSlots({1, 1});
   EXPECT_FALSE(PreparePartitionsForUpdate({}))
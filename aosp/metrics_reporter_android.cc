@@ -147,6 +147,12 @@ void MetricsReporterAndroid::ReportUpdateAttemptMetrics(
       super_free_space,
       vab_compression_enabled,
       vab_compression_used);
+  // The statsd atom has no field for them yet.
+  for (const auto& [phase, rss_kib] :
+       install_plan_->resident_set_kib_by_phase) {
+    LOG(INFO) << "Resident set after the " << phase << " phase: " << rss_kib
+              << " KiB";
+  }
 }
 
 void MetricsReporterAndroid::ReportUpdateAttemptDownloadMetrics(
@@ -187,6 +193,41 @@ void MetricsReporterAndroid::ReportSuccessfulUpdateMetrics(
                       static_cast<int32_t>(reboot_count),
                       IsHashTreeEnabled(install_plan_),
                       IsFECEnabled(install_plan_));
+  // The statsd atom has no field for it yet.
+  if (install_plan_->source_cache_saved_bytes > 0) {
+    LOG(INFO) << "The source cache saved reading "
+              << install_plan_->source_cache_saved_bytes / kNumBytesInOneMiB
+              << " MiB of the source partitions";
+  }
+  if (install_plan_->page_cache_bytes > 0) {
+    LOG(INFO) << "The partitions held "
+              << install_plan_->page_cache_bytes / kNumBytesInOneMiB
+              << " MiB of page cache once the payload was applied"
+              << (install_plan_->drop_page_cache ? ", dropping their pages"
+                                                 : "");
+  }
+  if (install_plan_->memory_peak_bytes > 0) {
+    LOG(INFO) << "Applying the payload held at most "
+              << install_plan_->memory_peak_bytes / kNumBytesInOneMiB
+              << " MiB of payload blobs and operation buffers";
+  }
+}
+
+void MetricsReporterAndroid::ReportApplyStats(
+    const std::string& partition_name,
+    const ApplyStats& stats,
+    const PartitionThroughputStats& throughput_stats) {
+  // The statsd atoms have no field for them yet.
+  LOG(INFO) << "Applied the operations of " << partition_name << ":\n"
+            << stats.ToString();
+  LOG(INFO) << "Throughput of " << partition_name << ": "
+            << throughput_stats.ToString(stats);
+}
+
+void MetricsReporterAndroid::ReportMergeTelemetry(
+    const MergeTelemetry& telemetry) {
+  // SNAPSHOT_MERGE_REPORTED has no field for them yet.
+  LOG(INFO) << "Snapshot merge telemetry: " << telemetry.ToString();
 }
 
 void MetricsReporterAndroid::ReportAbnormallyTerminatedUpdateAttemptMetrics() {
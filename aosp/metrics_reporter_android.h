@@ -63,6 +63,13 @@ class MetricsReporterAndroid : public MetricsReporterInterface {
       metrics::DownloadErrorCode payload_download_error_code,
       metrics::ConnectionType connection_type) override;
 
+  void ReportApplyStats(
+      const std::string& partition_name,
+      const ApplyStats& stats,
+      const PartitionThroughputStats& throughput_stats) override;
+
+  void ReportMergeTelemetry(const MergeTelemetry& telemetry) override;
+
   void ReportAbnormallyTerminatedUpdateAttemptMetrics() override;
 
   void ReportSuccessfulUpdateMetrics(
@@ -43,4 +43,13 @@ bool NetworkSelectorAndroid::SetProcessNetwork(NetworkId network_id) {
   return true;
 }
 
+bool NetworkSelectorAndroid::BindSocket(NetworkId network_id, int socket_fd) {
+  if (android_setsocknetwork(network_id, socket_fd) < 0) {
+    PLOG(ERROR) << "Binding socket " << socket_fd << " to network "
+                << network_id;
+    return false;
+  }
+  return true;
+}
+
 }  // namespace chromeos_update_engine
@@ -14,11 +14,16 @@
 // limitations under the License.
 //
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
+#include <functional>
 #include <iterator>
 #include <memory>
+#include <thread>
+#include <vector>
 
 #include <fcntl.h>
 #include <sys/mman.h>
@@ -27,6 +32,7 @@
 #include <android-base/strings.h>
 #include <base/files/file_path.h>
 #include <gflags/gflags.h>
+#include <sparse/sparse.h>
 #include <unistd.h>
 #include <xz.h>
 
@@ -53,6 +59,15 @@ DEFINE_string(partitions,
               "",
               "Comma separated list of partitions to extract, leave empty for "
               "extracting all partitions");
+DEFINE_int32(threads,
+             1,
+             "Number of threads extracting the partitions concurrently and "
+             "applying the operations of each partition in parallel. 0 uses "
+             "one thread per CPU.");
+DEFINE_bool(sparse,
+            false,
+            "Write the images in the Android sparse format, as flashed by "
+            "fastboot, instead of raw images.");
 
 using chromeos_update_engine::DeltaArchiveManifest;
 using chromeos_update_engine::PayloadMetadata;
@@ -93,104 +108,303 @@ void WriteVerity(const PartitionUpdate& partition,
   return;
 }
 
+namespace {
+
+// Runs |task| with the indexes 0 to |num_tasks| - 1 on up to |num_threads|
+// threads, the calling one included, passing it the index of the thread
+// running it too. No task is started after one failed. Returns whether all
+// of them succeeded.
+bool RunOnThreads(size_t num_tasks,
+                  size_t num_threads,
+                  const std::function<bool(size_t, size_t)>& task) {
+  num_threads = std::max<size_t>(1, std::min(num_threads, num_tasks));
+  std::atomic<size_t> next_task{0};
+  std::atomic<bool> success{true};
+  auto thread_main = [&](size_t thread_index) {
+    while (success) {
+      const size_t task_index = next_task++;
+      if (task_index >= num_tasks) {
+        return;
+      }
+      if (!task(thread_index, task_index)) {
+        success = false;
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; i++) {
+    threads.emplace_back(thread_main, i);
+  }
+  thread_main(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return success;
+}
+
+// The file descriptors of a thread applying operations, which seek before
+// every read and write, and its executor. |skip_zeros| is set when the
+// output is a regular file written from scratch, whose blocks never written
+// are holes reading as zeros.
+struct OperationWorker {
+  FileDescriptorPtr out_fd;
+  FileDescriptorPtr in_fd;
+  InstallOperationExecutor executor;
+  bool skip_zeros;
+};
+
+bool OpenWorker(const std::string& output_path,
+                const std::string& input_path,
+                int extra_flags,
+                OperationWorker* worker) {
+  worker->out_fd = std::make_shared<EintrSafeFileDescriptor>();
+  TEST_AND_RETURN_FALSE_ERRNO(worker->out_fd->Open(
+      output_path.c_str(), O_RDWR | O_CREAT | extra_flags, 0644));
+  worker->in_fd = std::make_shared<EintrSafeFileDescriptor>();
+  if (!input_path.empty()) {
+    CHECK(worker->in_fd->Open(input_path.c_str(), O_RDONLY))
+        << " failed to open " << input_path;
+  }
+  return true;
+}
+
+bool ApplyOperation(const InstallOperation& op,
+                    int payload_fd,
+                    size_t data_begin,
+                    size_t block_size,
+                    OperationWorker* worker) {
+  const bool is_zero = op.type() == InstallOperation::ZERO ||
+                       op.type() == InstallOperation::DISCARD;
+  if (is_zero && worker->skip_zeros) {
+    return true;
+  }
+  const FileDescriptorPtr& in_fd = worker->in_fd;
+  InstallOperationExecutor& executor = worker->executor;
+  if (op.has_src_sha256_hash()) {
+    brillo::Blob actual_hash;
+    TEST_AND_RETURN_FALSE(fd_utils::ReadAndHashExtents(
+        in_fd, op.src_extents(), block_size, &actual_hash));
+    CHECK_EQ(HexEncode(ToStringView(actual_hash)),
+             HexEncode(op.src_sha256_hash()));
+  }
+
+  brillo::Blob blob(op.data_length());
+  const auto op_data_offset = data_begin + op.data_offset();
+  ssize_t bytes_read = 0;
+  TEST_AND_RETURN_FALSE(utils::PReadAll(
+      payload_fd, blob.data(), blob.size(), op_data_offset, &bytes_read));
+  if (op.has_data_sha256_hash()) {
+    brillo::Blob actual_hash;
+    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(blob, &actual_hash));
+    CHECK_EQ(HexEncode(ToStringView(actual_hash)),
+             HexEncode(op.data_sha256_hash()));
+  }
+  auto direct_writer = std::make_unique<DirectExtentWriter>(worker->out_fd);
+  if (is_zero) {
+    return executor.ExecuteZeroOrDiscardOperation(op,
+                                                  std::move(direct_writer));
+  } else if (op.type() == InstallOperation::REPLACE ||
+             op.type() == InstallOperation::REPLACE_BZ ||
+             op.type() == InstallOperation::REPLACE_XZ ||
+             op.type() == InstallOperation::REPLACE_ZSTD) {
+    return executor.ExecuteReplaceOperation(
+        op, std::move(direct_writer), blob.data());
+  } else if (op.type() == InstallOperation::SOURCE_COPY) {
+    CHECK(in_fd->IsOpen());
+    return executor.ExecuteSourceCopyOperation(
+        op, std::move(direct_writer), in_fd);
+  } else if (op.type() == InstallOperation::TARGET_COPY) {
+    return executor.ExecuteSourceCopyOperation(
+        op, std::move(direct_writer), worker->out_fd);
+  }
+  CHECK(in_fd->IsOpen());
+  return executor.ExecuteDiffOperation(
+      op, std::move(direct_writer), in_fd, blob.data(), blob.size());
+}
+
+// Converts the raw image at |path| to an Android sparse image in place. The
+// zero blocks, holes included, are left out of it.
+bool ConvertToSparseImage(const std::string& path,
+                          size_t block_size,
+                          uint64_t size) {
+  const std::string sparse_path = path + ".sparse";
+  int raw_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  TEST_AND_RETURN_FALSE_ERRNO(raw_fd >= 0);
+  ScopedFdCloser raw_closer(&raw_fd);
+  int sparse_fd =
+      open(sparse_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  TEST_AND_RETURN_FALSE_ERRNO(sparse_fd >= 0);
+  ScopedFdCloser sparse_closer(&sparse_fd);
+  std::unique_ptr<sparse_file, decltype(&sparse_file_destroy)> s(
+      sparse_file_new(block_size, size), sparse_file_destroy);
+  TEST_AND_RETURN_FALSE(s != nullptr);
+  if (sparse_file_read(s.get(), raw_fd, SPARSE_READ_MODE_HOLE, false) != 0 ||
+      sparse_file_write(s.get(), sparse_fd, false, true, false) != 0) {
+    LOG(ERROR) << "Failed to convert " << path << " to a sparse image";
+    unlink(sparse_path.c_str());
+    return false;
+  }
+  TEST_AND_RETURN_FALSE_ERRNO(rename(sparse_path.c_str(), path.c_str()) == 0);
+  return true;
+}
+
+// Extracts |partition| to |output_dir|, applying its operations on up to
+// |num_threads| threads, as a sparse image if |sparse|.
+bool ExtractPartition(const DeltaArchiveManifest& manifest,
+                      const PayloadMetadata& metadata,
+                      PartitionUpdate partition,
+                      int payload_fd,
+                      size_t payload_offset,
+                      const base::FilePath& input_dir_path,
+                      const base::FilePath& output_dir_path,
+                      size_t num_threads,
+                      bool sparse) {
+  const size_t data_begin = metadata.GetMetadataSize() +
+                            metadata.GetMetadataSignatureSize() +
+                            payload_offset;
+  LOG(INFO) << "Extracting partition " << partition.partition_name()
+            << " size: " << partition.new_partition_info().size();
+  // Start reading the data of the partition ahead in one go, rather than
+  // one operation at a time.
+  uint64_t data_offset = 0;
+  uint64_t data_length = 0;
+  metadata.GetPartitionDataRange(partition, &data_offset, &data_length);
+  if (data_length > 0) {
+    posix_fadvise(payload_fd,
+                  payload_offset + data_offset,
+                  data_length,
+                  POSIX_FADV_WILLNEED);
+  }
+  const auto output_path =
+      output_dir_path.Append(partition.partition_name() + ".img").value();
+  std::string input_path;
+  if (partition.has_old_partition_info()) {
+    input_path =
+        input_dir_path.Append(partition.partition_name() + ".img").value();
+    LOG(INFO) << "Incremental OTA detected for partition "
+              << partition.partition_name() << " opening source image "
+              << input_path;
+  }
+  InstallOperationExecutor executor(manifest.block_size());
+  TEST_AND_RETURN_FALSE(
+      executor.SetZstdDictionary(partition.zstd_dictionary()));
+  if (partition.has_operations_segment()) {
+    const OperationsSegment& segment = partition.operations_segment();
+    brillo::Blob blob(segment.data_length());
+    ssize_t bytes_read = 0;
+    TEST_AND_RETURN_FALSE(utils::PReadAll(payload_fd,
+                                          blob.data(),
+                                          blob.size(),
+                                          data_begin + segment.data_offset(),
+                                          &bytes_read));
+    TEST_AND_RETURN_FALSE(PayloadMetadata::ParseOperationsSegment(
+        blob.data(), blob.size(), &partition));
+  }
+
+  // The operations write disjoint blocks, so they are applied in any order,
+  // except for the TARGET_COPY ones which read the blocks written by the
+  // others.
+  std::vector<const InstallOperation*> ops;
+  std::vector<const InstallOperation*> target_copy_ops;
+  for (const auto& op : partition.operations()) {
+    (op.type() == InstallOperation::TARGET_COPY ? target_copy_ops : ops)
+        .push_back(&op);
+  }
+  const size_t num_workers = std::max<size_t>(
+      1, std::min<size_t>(num_threads, partition.operations_size()));
+  // The first worker truncates the output, so that the ZERO and DISCARD
+  // operations are skipped rather than written when it is a regular file.
+  std::vector<OperationWorker> workers;
+  for (size_t i = 0; i < num_workers; i++) {
+    workers.push_back({nullptr, nullptr, executor, false});
+    TEST_AND_RETURN_FALSE(OpenWorker(
+        output_path, input_path, i == 0 ? O_TRUNC : 0, &workers.back()));
+  }
+  struct stat output_stat;
+  const bool output_is_file =
+      fstat(workers[0].out_fd->Fd(), &output_stat) == 0 &&
+      S_ISREG(output_stat.st_mode);
+  for (auto& worker : workers) {
+    worker.skip_zeros = output_is_file;
+  }
+  for (const auto* phase_ops : {&ops, &target_copy_ops}) {
+    TEST_AND_RETURN_FALSE(RunOnThreads(
+        phase_ops->size(), workers.size(), [&](size_t thread, size_t i) {
+          return ApplyOperation(*(*phase_ops)[i],
+                                payload_fd,
+                                data_begin,
+                                manifest.block_size(),
+                                &workers[thread]);
+        }));
+  }
+  WriteVerity(partition, workers[0].out_fd, manifest.block_size());
+  int err =
+      truncate64(output_path.c_str(), partition.new_partition_info().size());
+  if (err) {
+    PLOG(ERROR) << "Failed to truncate " << output_path << " to "
+                << partition.new_partition_info().size();
+  }
+  brillo::Blob actual_hash;
+  TEST_AND_RETURN_FALSE(
+      HashCalculator::RawHashOfFile(output_path, &actual_hash));
+  CHECK_EQ(HexEncode(ToStringView(actual_hash)),
+           HexEncode(partition.new_partition_info().hash()))
+      << " Partition " << partition.partition_name()
+      << " hash mismatches. Either the source image or OTA package is "
+         "corrupted.";
+  if (sparse) {
+    TEST_AND_RETURN_FALSE(
+        ConvertToSparseImage(output_path,
+                             manifest.block_size(),
+                             partition.new_partition_info().size()));
+  }
+  return true;
+}
+
+}  // namespace
+
 bool ExtractImagesFromOTA(const DeltaArchiveManifest& manifest,
                           const PayloadMetadata& metadata,
                           int payload_fd,
                           size_t payload_offset,
                           std::string_view input_dir,
                           std::string_view output_dir,
-                          const std::set<std::string>& partitions) {
-  InstallOperationExecutor executor(manifest.block_size());
-  const size_t data_begin = metadata.GetMetadataSize() +
-                            metadata.GetMetadataSignatureSize() +
-                            payload_offset;
+                          const std::set<std::string>& partitions,
+                          size_t num_threads,
+                          bool sparse) {
   const base::FilePath output_dir_path(
       base::StringPiece(output_dir.data(), output_dir.size()));
   const base::FilePath input_dir_path(
       base::StringPiece(input_dir.data(), input_dir.size()));
-  std::vector<unsigned char> blob;
+  std::vector<const PartitionUpdate*> selected;
   for (const auto& partition : manifest.partitions()) {
-    if (!partitions.empty() &&
-        partitions.count(partition.partition_name()) == 0) {
-      continue;
-    }
-    LOG(INFO) << "Extracting partition " << partition.partition_name()
-              << " size: " << partition.new_partition_info().size();
-    const auto output_path =
-        output_dir_path.Append(partition.partition_name() + ".img").value();
-    auto out_fd =
-        std::make_shared<chromeos_update_engine::EintrSafeFileDescriptor>();
-    TEST_AND_RETURN_FALSE_ERRNO(
-        out_fd->Open(output_path.c_str(), O_RDWR | O_CREAT, 0644));
-    auto in_fd =
-        std::make_shared<chromeos_update_engine::EintrSafeFileDescriptor>();
-    if (partition.has_old_partition_info()) {
-      const auto input_path =
-          input_dir_path.Append(partition.partition_name() + ".img").value();
-      LOG(INFO) << "Incremental OTA detected for partition "
-                << partition.partition_name() << " opening source image "
-                << input_path;
-      CHECK(in_fd->Open(input_path.c_str(), O_RDONLY))
-          << " failed to open " << input_path;
-    }
-
-    for (const auto& op : partition.operations()) {
-      if (op.has_src_sha256_hash()) {
-        brillo::Blob actual_hash;
-        TEST_AND_RETURN_FALSE(fd_utils::ReadAndHashExtents(
-            in_fd, op.src_extents(), manifest.block_size(), &actual_hash));
-        CHECK_EQ(HexEncode(ToStringView(actual_hash)),
-                 HexEncode(op.src_sha256_hash()));
-      }
-
-      blob.resize(op.data_length());
-      const auto op_data_offset = data_begin + op.data_offset();
-      ssize_t bytes_read = 0;
-      TEST_AND_RETURN_FALSE(utils::PReadAll(
-          payload_fd, blob.data(), blob.size(), op_data_offset, &bytes_read));
-      if (op.has_data_sha256_hash()) {
-        brillo::Blob actual_hash;
-        TEST_AND_RETURN_FALSE(
-            HashCalculator::RawHashOfData(blob, &actual_hash));
-        CHECK_EQ(HexEncode(ToStringView(actual_hash)),
-                 HexEncode(op.data_sha256_hash()));
-      }
-      auto direct_writer = std::make_unique<DirectExtentWriter>(out_fd);
-      if (op.type() == InstallOperation::ZERO) {
-        TEST_AND_RETURN_FALSE(executor.ExecuteZeroOrDiscardOperation(
-            op, std::move(direct_writer)));
-      } else if (op.type() == InstallOperation::REPLACE ||
-                 op.type() == InstallOperation::REPLACE_BZ ||
-                 op.type() == InstallOperation::REPLACE_XZ) {
-        TEST_AND_RETURN_FALSE(executor.ExecuteReplaceOperation(
-            op, std::move(direct_writer), blob.data()));
-      } else if (op.type() == InstallOperation::SOURCE_COPY) {
-        CHECK(in_fd->IsOpen());
-        TEST_AND_RETURN_FALSE(executor.ExecuteSourceCopyOperation(
-            op, std::move(direct_writer), in_fd));
-      } else {
-        CHECK(in_fd->IsOpen());
-        TEST_AND_RETURN_FALSE(executor.ExecuteDiffOperation(
-            op, std::move(direct_writer), in_fd, blob.data(), blob.size()));
-      }
+    if (partitions.empty() || partitions.count(partition.partition_name())) {
+      selected.push_back(&partition);
     }
-    WriteVerity(partition, out_fd, manifest.block_size());
-    int err =
-        truncate64(output_path.c_str(), partition.new_partition_info().size());
-    if (err) {
-      PLOG(ERROR) << "Failed to truncate " << output_path << " to "
-                  << partition.new_partition_info().size();
-    }
-    brillo::Blob actual_hash;
-    TEST_AND_RETURN_FALSE(
-        HashCalculator::RawHashOfFile(output_path, &actual_hash));
-    CHECK_EQ(HexEncode(ToStringView(actual_hash)),
-             HexEncode(partition.new_partition_info().hash()))
-        << " Partition " << partition.partition_name()
-        << " hash mismatches. Either the source image or OTA package is "
-           "corrupted.";
   }
-  return true;
+  // The threads are split between the partitions extracted at once, the
+  // remaining ones apply the operations of each partition in parallel.
+  const size_t partition_threads =
+      std::max<size_t>(1, std::min(num_threads, selected.size()));
+  const size_t op_threads =
+      std::max<size_t>(1, num_threads / partition_threads);
+  if (num_threads > 1) {
+    LOG(INFO) << "Extracting " << partition_threads
+              << " partitions at once with " << op_threads
+              << " threads each.";
+  }
+  return RunOnThreads(
+      selected.size(), partition_threads, [&](size_t, size_t i) {
+        return ExtractPartition(manifest,
+                                metadata,
+                                *selected[i],
+                                payload_fd,
+                                payload_offset,
+                                input_dir_path,
+                                output_dir_path,
+                                op_threads,
+                                sparse);
+      });
 }
 
 }  // namespace chromeos_update_engine
@@ -265,6 +479,12 @@ int main(int argc, char* argv[]) {
     LOG(ERROR) << "Failed to parse manifest!";
     return 1;
   }
+  if (FLAGS_threads < 0) {
+    LOG(ERROR) << "Invalid --threads " << FLAGS_threads;
+    return 1;
+  }
+  const size_t num_threads =
+      FLAGS_threads > 0 ? FLAGS_threads : std::thread::hardware_concurrency();
   if (IsIncrementalOTA(manifest) && FLAGS_input_dir.empty()) {
     LOG(ERROR) << FLAGS_payload
                << " is an incremental OTA, --input_dir parameter is required.";
@@ -276,5 +496,7 @@ int main(int argc, char* argv[]) {
                                FLAGS_payload_offset,
                                FLAGS_input_dir,
                                FLAGS_output_dir,
-                               partitions);
+                               partitions,
+                               num_threads,
+                               FLAGS_sparse);
 }
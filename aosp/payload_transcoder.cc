@@ -0,0 +1,128 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+// Rewrites the data of the full operations of a payload with a compression
+// which is faster to decode, for the payloads which can't be regenerated.
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <base/logging.h>
+#include <gflags/gflags.h>
+#include <xz.h>
+
+#include "update_engine/payload_generator/payload_transcoder.h"
+#include "update_engine/payload_generator/xz.h"
+#include "update_engine/payload_generator/zstd.h"
+
+DEFINE_string(payload, "", "Path to the payload.bin to transcode");
+DEFINE_string(output, "", "Path to write the transcoded payload to");
+DEFINE_string(type,
+              "zstd",
+              "The compression of the data rewritten: \"zstd\", \"xz\" or "
+              "\"none\". The data which doesn't compress is stored "
+              "uncompressed.");
+DEFINE_string(from,
+              "bz,xz",
+              "Comma separated list of the compressions of the operations "
+              "rewritten, among \"none\", \"bz\", \"xz\" and \"zstd\".");
+DEFINE_int64(xz_block_size,
+             0,
+             "Split the data of REPLACE_XZ operations into independent xz "
+             "blocks of this many uncompressed bytes, which can be decoded in "
+             "parallel. 0 uses a single block.");
+DEFINE_int64(zstd_frame_size,
+             0,
+             "Split the data of REPLACE_ZSTD operations into independent zstd "
+             "frames of this many uncompressed bytes, which can be decoded in "
+             "parallel. 0 uses a single frame.");
+DEFINE_string(private_key, "", "Path to the private key to sign with");
+DEFINE_string(signature_size,
+              "",
+              "Without --private_key, colon-separated list of the sizes of "
+              "the signatures to reserve, to sign the payload afterwards with "
+              "delta_generator.");
+
+namespace {
+
+using chromeos_update_engine::InstallOperation;
+
+bool ParseType(const std::string& name, InstallOperation::Type* type) {
+  if (name == "none") {
+    *type = InstallOperation::REPLACE;
+  } else if (name == "bz") {
+    *type = InstallOperation::REPLACE_BZ;
+  } else if (name == "xz") {
+    *type = InstallOperation::REPLACE_XZ;
+  } else if (name == "zstd") {
+    *type = InstallOperation::REPLACE_ZSTD;
+  } else {
+    LOG(ERROR) << "Unknown compression " << name;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  gflags::SetUsageMessage(
+      "A tool to recompress the data of an Android OTA payload");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  xz_crc32_init();
+  if (FLAGS_payload.empty() || FLAGS_output.empty()) {
+    LOG(ERROR) << "--payload <payload path> and --output <output path> are "
+               << "required";
+    return 1;
+  }
+  chromeos_update_engine::PayloadTranscodeOptions options;
+  if (!ParseType(FLAGS_type, &options.type) ||
+      options.type == InstallOperation::REPLACE_BZ) {
+    LOG(ERROR) << "Invalid --type " << FLAGS_type;
+    return 1;
+  }
+  options.from_types.clear();
+  for (const auto& name : android::base::Tokenize(FLAGS_from, ",")) {
+    InstallOperation::Type type;
+    if (!ParseType(name, &type)) {
+      return 1;
+    }
+    options.from_types.insert(type);
+  }
+  options.private_key_path = FLAGS_private_key;
+  for (const auto& size : android::base::Tokenize(FLAGS_signature_size, ":")) {
+    size_t signature_size = 0;
+    if (!android::base::ParseUint(size, &signature_size)) {
+      LOG(ERROR) << "Invalid signature size " << size;
+      return 1;
+    }
+    options.signature_sizes.push_back(signature_size);
+  }
+
+  chromeos_update_engine::XzCompressInit();
+  chromeos_update_engine::XzCompressSetBlockSize(FLAGS_xz_block_size);
+  chromeos_update_engine::ZstdCompressSetFrameSize(FLAGS_zstd_frame_size);
+  if (!chromeos_update_engine::TranscodePayload(
+          FLAGS_payload, FLAGS_output, options)) {
+    LOG(ERROR) << "Failed to transcode " << FLAGS_payload;
+    return 1;
+  }
+  return 0;
+}
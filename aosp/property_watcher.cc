@@ -0,0 +1,74 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/aosp/property_watcher.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <thread>
+#include <utility>
+
+#include <android-base/properties.h>
+#include <base/bind.h>
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+
+namespace chromeos_update_engine {
+
+bool PropertyWatcher::Watch(const std::string& name,
+                            const std::string& value,
+                            std::chrono::milliseconds timeout,
+                            base::OnceClosure callback) {
+  Cancel();
+  auto event_fd = std::make_shared<android::base::unique_fd>(
+      eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+  if (!event_fd->ok()) {
+    PLOG(ERROR) << "Failed to create an eventfd to watch " << name;
+    return false;
+  }
+  event_fd_ = event_fd;
+  callback_ = std::move(callback);
+  controller_ = base::FileDescriptorWatcher::WatchReadable(
+      event_fd_->get(),
+      base::BindRepeating(&PropertyWatcher::OnEvent, base::Unretained(this)));
+  std::thread([event_fd, name, value, timeout] {
+    android::base::WaitForProperty(name, value, timeout);
+    const uint64_t one = 1;
+    if (HANDLE_EINTR(write(event_fd->get(), &one, sizeof(one))) < 0) {
+      PLOG(ERROR) << "Failed to signal the eventfd watching " << name;
+    }
+  }).detach();
+  return true;
+}
+
+void PropertyWatcher::Cancel() {
+  controller_.reset();
+  event_fd_.reset();
+  callback_.Reset();
+}
+
+void PropertyWatcher::OnEvent() {
+  uint64_t count = 0;
+  if (HANDLE_EINTR(read(event_fd_->get(), &count, sizeof(count))) < 0) {
+    PLOG(WARNING) << "Failed to read the eventfd";
+  }
+  auto callback = std::move(callback_);
+  Cancel();
+  std::move(callback).Run();
+}
+
+}  // namespace chromeos_update_engine
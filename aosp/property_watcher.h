@@ -0,0 +1,67 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_AOSP_PROPERTY_WATCHER_H_
+#define UPDATE_ENGINE_AOSP_PROPERTY_WATCHER_H_
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <android-base/unique_fd.h>
+#include <base/callback.h>
+#include <base/files/file_descriptor_watcher_posix.h>
+
+namespace chromeos_update_engine {
+
+// Waits for a system property to take a value without polling it from the
+// message loop: a helper thread blocks in android::base::WaitForProperty()
+// and wakes the message loop through an eventfd once the property changes or
+// a timeout expires.
+class PropertyWatcher {
+ public:
+  PropertyWatcher() = default;
+  PropertyWatcher(const PropertyWatcher&) = delete;
+  PropertyWatcher& operator=(const PropertyWatcher&) = delete;
+  ~PropertyWatcher() { Cancel(); }
+
+  // Runs |callback| on the current message loop once |name| is |value|, or
+  // after |timeout| at the latest, so that callers re-check the property as
+  // a fallback. Cancels any previous watch. Returns false if the watch could
+  // not be started, in which case |callback| is never run.
+  bool Watch(const std::string& name,
+             const std::string& value,
+             std::chrono::milliseconds timeout,
+             base::OnceClosure callback);
+
+  // Stops watching; the callback of the current watch won't run. The helper
+  // thread exits on its own when its wait ends.
+  void Cancel();
+
+  bool IsWatching() const { return controller_ != nullptr; }
+
+ private:
+  void OnEvent();
+
+  // Shared with the helper thread, which may outlive the watch.
+  std::shared_ptr<android::base::unique_fd> event_fd_;
+  std::unique_ptr<base::FileDescriptorWatcher::Controller> controller_;
+  base::OnceClosure callback_;
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_AOSP_PROPERTY_WATCHER_H_
@@ -0,0 +1,94 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/aosp/property_watcher.h"
+
+#include <android-base/properties.h>
+#include <base/bind.h>
+#include <base/message_loop/message_loop.h>
+#include <base/task/single_thread_task_executor.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr char kTestProperty[] = "debug.update_engine.property_watcher_test";
+}  // namespace
+
+class PropertyWatcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    loop_.SetAsCurrent();
+    android::base::SetProperty(kTestProperty, "0");
+  }
+
+#if BASE_VER < 780000  // Android
+  base::MessageLoopForIO base_loop_;
+  brillo::BaseMessageLoop loop_{&base_loop_};
+#else   // CrOS
+  base::SingleThreadTaskExecutor base_loop_{base::MessagePumpType::IO};
+  brillo::BaseMessageLoop loop_{base_loop_.task_runner()};
+#endif  // BASE_VER < 780000
+  PropertyWatcher property_watcher_;
+};
+
+TEST_F(PropertyWatcherTest, RunsCallbackOnChange) {
+  bool called = false;
+  ASSERT_TRUE(property_watcher_.Watch(
+      kTestProperty,
+      "1",
+      std::chrono::seconds(10),
+      base::BindOnce([](bool* called) { *called = true; }, &called)));
+  ASSERT_TRUE(property_watcher_.IsWatching());
+  android::base::SetProperty(kTestProperty, "1");
+  brillo::MessageLoopRunUntil(
+      &loop_,
+      base::TimeDelta::FromSeconds(5),
+      base::Bind([](bool* called) { return *called; }, &called));
+  ASSERT_TRUE(called);
+  ASSERT_FALSE(property_watcher_.IsWatching());
+}
+
+TEST_F(PropertyWatcherTest, RunsCallbackOnTimeout) {
+  bool called = false;
+  ASSERT_TRUE(property_watcher_.Watch(
+      kTestProperty,
+      "1",
+      std::chrono::milliseconds(10),
+      base::BindOnce([](bool* called) { *called = true; }, &called)));
+  brillo::MessageLoopRunUntil(
+      &loop_,
+      base::TimeDelta::FromSeconds(5),
+      base::Bind([](bool* called) { return *called; }, &called));
+  ASSERT_TRUE(called);
+}
+
+TEST_F(PropertyWatcherTest, CancelDropsCallback) {
+  bool called = false;
+  ASSERT_TRUE(property_watcher_.Watch(
+      kTestProperty,
+      "1",
+      std::chrono::milliseconds(10),
+      base::BindOnce([](bool* called) { *called = true; }, &called)));
+  property_watcher_.Cancel();
+  ASSERT_FALSE(property_watcher_.IsWatching());
+  brillo::MessageLoopRunMaxIterations(&loop_, 10);
+  ASSERT_FALSE(called);
+}
+
+}  // namespace chromeos_update_engine
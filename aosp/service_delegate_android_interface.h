@@ -68,6 +68,17 @@ class ServiceDelegateAndroidInterface {
       const std::vector<std::string>& key_value_pair_headers,
       Error* error) = 0;
 
+  // Same as above, but the payload is streamed by the caller through the
+  // ring buffer in the shared memory |ring_fd|, waking update_engine up
+  // through the socket |socket_fd|. See SharedMemoryFetcher.
+  virtual bool ApplyPayloadStream(
+      int ring_fd,
+      int socket_fd,
+      int64_t payload_offset,
+      int64_t payload_size,
+      const std::vector<std::string>& key_value_pair_headers,
+      Error* error) = 0;
+
   // Suspend an ongoing update. Returns true if there was an update ongoing and
   // it was suspended. In case of failure, it returns false and sets |error|
   // accordingly.
@@ -132,6 +143,14 @@ class ServiceDelegateAndroidInterface {
 
   virtual bool SetPerformanceMode(bool enable, Error* error) = 0;
 
+  // Selects how the update throttles itself for the foreground, |policy|
+  // being one of ThrottlePolicy.
+  virtual bool SetThrottlePolicy(int policy, Error* error) = 0;
+
+  // Selects how the merge of the previous update competes with the
+  // foreground, |policy| being one of ThrottlePolicy.
+  virtual bool SetMergePolicy(int policy, Error* error) = 0;
+
  protected:
   ServiceDelegateAndroidInterface() = default;
 };
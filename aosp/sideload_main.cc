@@ -16,7 +16,9 @@
 
 #include <xz.h>
 
+#include <algorithm>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <base/command_line.h>
@@ -30,6 +32,7 @@
 
 #include "update_engine/aosp/update_attempter_android.h"
 #include "update_engine/common/boot_control.h"
+#include "update_engine/common/constants.h"
 #include "update_engine/common/error_code_utils.h"
 #include "update_engine/common/hardware.h"
 #include "update_engine/common/logging.h"
@@ -46,6 +49,50 @@ using update_engine::UpdateStatus;
 namespace chromeos_update_engine {
 namespace {
 
+// Sizes of the buffers of the sideload profile.
+constexpr unsigned int kSideloadReadSize = 4 * 1024 * 1024;
+constexpr unsigned int kSideloadWriteCacheSize = 16 * 1024 * 1024;
+constexpr unsigned int kSideloadWriteBehindBuffers = 2;
+constexpr unsigned int kSideloadVerifyReadAheadBuffers = 4;
+
+// Nothing else runs while sideloading, so the sideload profile maps the local
+// payload and applies it with all the cores and large buffers instead of the
+// defaults meant for updates in the background. Headers passed explicitly
+// take precedence.
+void AddSideloadProfileHeaders(vector<string>* headers) {
+  const string threads =
+      std::to_string(std::max(1U, std::thread::hardware_concurrency()));
+  const vector<std::pair<string, string>> defaults{
+      {kPayloadMmapLocalPayload, "1"},
+      {kPayloadReceiveBufferSize, std::to_string(kSideloadReadSize)},
+      {kPayloadApplyThreads, threads},
+      {kPayloadBzipThreads, threads},
+      {kPayloadXzThreads, threads},
+      {kPayloadZstdThreads, threads},
+      {kPayloadZucchiniThreads, threads},
+      {kPayloadWriteCacheSize, std::to_string(kSideloadWriteCacheSize)},
+      {kPayloadWriteBehindBuffers,
+       std::to_string(kSideloadWriteBehindBuffers)},
+      {kPayloadAsyncPayloadHash, "1"},
+      {kPayloadVerifyReadAheadBuffers,
+       std::to_string(kSideloadVerifyReadAheadBuffers)},
+      {kPayloadVerifyConcurrentPartitions, threads},
+      {kPayloadVerityHashTreeThreads, threads},
+  };
+  const vector<string> explicit_headers = *headers;
+  for (const auto& [key, value] : defaults) {
+    const bool is_set = std::any_of(
+        explicit_headers.begin(),
+        explicit_headers.end(),
+        [&key = key](const string& header) {
+          return header.compare(0, key.size() + 1, key + "=") == 0;
+        });
+    if (!is_set) {
+      headers->push_back(key + "=" + value);
+    }
+  }
+}
+
 class SideloadDaemonState : public DaemonStateInterface,
                             public ServiceObserverInterface {
  public:
@@ -185,6 +232,11 @@ int main(int argc, char** argv) {
                 "",
                 "A list of key-value pairs, one element of the list per line.");
   DEFINE_int64(status_fd, -1, "A file descriptor to notify the update status.");
+  DEFINE_string(profile,
+                "sideload",
+                "The profile to apply the payload with: \"sideload\" uses all "
+                "the cores and large buffers, \"default\" the defaults of "
+                "updates in the background.");
 
   chromeos_update_engine::Terminator::Init();
   chromeos_update_engine::SetupLogging(true /* stderr */, false /* file */);
@@ -197,6 +249,14 @@ int main(int argc, char** argv) {
 
   vector<string> headers = base::SplitString(
       FLAGS_headers, "\n", base::KEEP_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+  if (FLAGS_profile == "sideload") {
+    chromeos_update_engine::AddSideloadProfileHeaders(&headers);
+  } else if (FLAGS_profile != "default") {
+    LOG(ERROR) << "Unknown profile " << FLAGS_profile;
+    return 1;
+  }
+  LOG(INFO) << "Applying the payload with the " << FLAGS_profile
+            << " profile.";
 
   if (!chromeos_update_engine::ApplyUpdatePayload(
           FLAGS_payload, FLAGS_offset, FLAGS_size, headers, FLAGS_status_fd))
@@ -0,0 +1,76 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/aosp/status_coalescer.h"
+
+#include <cmath>
+#include <utility>
+
+#include <base/bind.h>
+
+namespace chromeos_update_engine {
+
+StatusCoalescer::StatusCoalescer(ClockInterface* clock,
+                                 base::TimeDelta min_interval,
+                                 double min_progress_delta,
+                                 DeliverCallback deliver)
+    : clock_(clock),
+      min_interval_(min_interval),
+      min_progress_delta_(min_progress_delta),
+      deliver_(std::move(deliver)) {}
+
+StatusCoalescer::~StatusCoalescer() {
+  brillo::MessageLoop::current()->CancelTask(pending_task_);
+}
+
+void StatusCoalescer::Update(int status, double progress) {
+  if (status != last_status_ || progress >= 1.0) {
+    Deliver(status, progress);
+    return;
+  }
+  if (std::abs(progress - last_progress_) < min_progress_delta_) {
+    return;
+  }
+  const base::Time now = clock_->GetMonotonicTime();
+  if (now - last_delivery_time_ >= min_interval_) {
+    Deliver(status, progress);
+    return;
+  }
+  pending_status_ = status;
+  pending_progress_ = progress;
+  if (pending_task_ == brillo::MessageLoop::kTaskIdNull) {
+    pending_task_ = brillo::MessageLoop::current()->PostDelayedTask(
+        FROM_HERE,
+        base::Bind(&StatusCoalescer::DeliverPending, base::Unretained(this)),
+        last_delivery_time_ + min_interval_ - now);
+  }
+}
+
+void StatusCoalescer::Deliver(int status, double progress) {
+  brillo::MessageLoop::current()->CancelTask(pending_task_);
+  pending_task_ = brillo::MessageLoop::kTaskIdNull;
+  last_status_ = status;
+  last_progress_ = progress;
+  last_delivery_time_ = clock_->GetMonotonicTime();
+  deliver_.Run(status, progress);
+}
+
+void StatusCoalescer::DeliverPending() {
+  pending_task_ = brillo::MessageLoop::kTaskIdNull;
+  Deliver(pending_status_, pending_progress_);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,71 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_AOSP_STATUS_COALESCER_H_
+#define UPDATE_ENGINE_AOSP_STATUS_COALESCER_H_
+
+#include <base/callback.h>
+#include <base/time/time.h>
+#include <brillo/message_loops/message_loop.h>
+
+#include "update_engine/common/clock_interface.h"
+
+namespace chromeos_update_engine {
+
+// Coalesces the status updates sent to one observer. A change of status and
+// the end of a progress are delivered right away. Other progress updates are
+// dropped until the progress moved by |min_progress_delta|, and delivered at
+// most once per |min_interval|: an update arriving sooner is held back until
+// |min_interval| elapsed, replaced by any newer one in the meantime.
+class StatusCoalescer {
+ public:
+  using DeliverCallback =
+      base::RepeatingCallback<void(int status, double progress)>;
+
+  StatusCoalescer(ClockInterface* clock,
+                  base::TimeDelta min_interval,
+                  double min_progress_delta,
+                  DeliverCallback deliver);
+  StatusCoalescer(const StatusCoalescer&) = delete;
+  StatusCoalescer& operator=(const StatusCoalescer&) = delete;
+  ~StatusCoalescer();
+
+  // Delivers or holds back the update to |status| and |progress|.
+  void Update(int status, double progress);
+
+ private:
+  void Deliver(int status, double progress);
+  void DeliverPending();
+
+  ClockInterface* clock_;
+  const base::TimeDelta min_interval_;
+  const double min_progress_delta_;
+  DeliverCallback deliver_;
+
+  // The last update delivered, |last_status_| is -1 before the first one.
+  int last_status_{-1};
+  double last_progress_{0};
+  base::Time last_delivery_time_;
+
+  // The update held back, delivered by |pending_task_|.
+  int pending_status_{-1};
+  double pending_progress_{0};
+  brillo::MessageLoop::TaskId pending_task_{brillo::MessageLoop::kTaskIdNull};
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_AOSP_STATUS_COALESCER_H_
@@ -0,0 +1,101 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/aosp/status_coalescer.h"
+
+#include <utility>
+#include <vector>
+
+#include <base/bind.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/fake_clock.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr int kIdle = 0;
+constexpr int kDownloading = 3;
+}  // namespace
+
+class StatusCoalescerTest : public ::testing::Test {
+ protected:
+  void SetUp() override { loop_.SetAsCurrent(); }
+
+  void AdvanceTime(base::TimeDelta delta) {
+    clock_.SetMonotonicTime(clock_.GetMonotonicTime() + delta);
+  }
+
+  brillo::FakeMessageLoop loop_{nullptr};
+  FakeClock clock_;
+  std::vector<std::pair<int, double>> delivered_;
+  StatusCoalescer coalescer_{
+      &clock_,
+      base::TimeDelta::FromSeconds(1),
+      0.01,
+      base::BindRepeating(
+          [](std::vector<std::pair<int, double>>* delivered,
+             int status,
+             double progress) { delivered->emplace_back(status, progress); },
+          &delivered_)};
+};
+
+TEST_F(StatusCoalescerTest, StatusChangesAreDeliveredRightAway) {
+  coalescer_.Update(kDownloading, 0.5);
+  coalescer_.Update(kIdle, 0.5);
+  coalescer_.Update(kDownloading, 0.5);
+  ASSERT_EQ(delivered_.size(), 3U);
+  ASSERT_EQ(delivered_.back(), std::make_pair(kDownloading, 0.5));
+}
+
+TEST_F(StatusCoalescerTest, SmallProgressIsDropped) {
+  coalescer_.Update(kDownloading, 0.5);
+  AdvanceTime(base::TimeDelta::FromSeconds(10));
+  coalescer_.Update(kDownloading, 0.505);
+  ASSERT_EQ(delivered_.size(), 1U);
+  // The end of the progress is always delivered.
+  coalescer_.Update(kDownloading, 1.0);
+  ASSERT_EQ(delivered_.size(), 2U);
+  ASSERT_FALSE(loop_.PendingTasks());
+}
+
+TEST_F(StatusCoalescerTest, FrequentProgressIsHeldBack) {
+  coalescer_.Update(kDownloading, 0.1);
+  coalescer_.Update(kDownloading, 0.2);
+  coalescer_.Update(kDownloading, 0.3);
+  ASSERT_EQ(delivered_.size(), 1U);
+  ASSERT_TRUE(loop_.PendingTasks());
+  // The latest held back progress is delivered after the interval.
+  ASSERT_TRUE(loop_.RunOnce(true));
+  ASSERT_EQ(delivered_.size(), 2U);
+  ASSERT_EQ(delivered_.back(), std::make_pair(kDownloading, 0.3));
+
+  AdvanceTime(base::TimeDelta::FromSeconds(1));
+  coalescer_.Update(kDownloading, 0.4);
+  ASSERT_EQ(delivered_.size(), 3U);
+}
+
+TEST_F(StatusCoalescerTest, StatusChangeReplacesHeldBackProgress) {
+  coalescer_.Update(kDownloading, 0.1);
+  coalescer_.Update(kDownloading, 0.2);
+  coalescer_.Update(kIdle, 0);
+  ASSERT_FALSE(loop_.PendingTasks());
+  ASSERT_EQ(delivered_.size(), 2U);
+  ASSERT_EQ(delivered_.back(), std::make_pair(kIdle, 0.0));
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,117 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/aosp/throttle_actuator_android.h"
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <base/logging.h>
+#include <processgroup/processgroup.h>
+
+#include "update_engine/common/cpu_topology.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/delta_performer.h"
+#include "update_engine/payload_consumer/parallel_operation_applier.h"
+#include "update_engine/payload_consumer/partition_writer.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+struct ThrottleLevel {
+  std::vector<std::string> task_profiles;
+  size_t apply_threads;
+  uint32_t io_priority;
+};
+
+// Indexed by level, the last one being the profiles update_engine always ran
+// with outside of the performance mode, the first one those of the
+// performance mode.
+const ThrottleLevel* GetThrottleLevels() {
+  static const ThrottleLevel kLevels[ThrottleController::kMaxLevel + 1] = {
+      {{"ProcessCapacityMax", "HighIoPriority", "MaxPerformance"},
+       std::numeric_limits<size_t>::max(),
+       0},
+      {{"ProcessCapacityHigh", "NormalIoPriority", "HighPerformance"}, 4, 2},
+      {{"ProcessCapacityNormal", "NormalIoPriority", "NormalPerformance"},
+       2,
+       4},
+      {{"OtaProfiles"}, 1, 7},
+  };
+  return kLevels;
+}
+
+// The settings which depend on the policy rather than on the level. A device
+// unlikely to reboot mid-update checkpoints less often and writes in larger
+// batches. The workers stay off the big cores in the background and off the
+// little ones when nothing else runs.
+struct PolicySettings {
+  // Bounds of the interval between the checkpoints, see CheckpointScheduler.
+  int64_t min_checkpoint_interval_seconds;
+  int64_t max_checkpoint_interval_seconds;
+  size_t write_cache_size;
+  CpuPlacement cpu_placement;
+};
+
+PolicySettings GetPolicySettings(ThrottlePolicy policy) {
+  switch (policy) {
+    case ThrottlePolicy::kBackground:
+      return {static_cast<int64_t>(DeltaPerformer::kCheckpointFrequencySeconds),
+              10,
+              1024 * 1024,
+              CpuPlacement::kEfficiency};
+    case ThrottlePolicy::kChargingIdle:
+      return {5, 30, 4 * 1024 * 1024, CpuPlacement::kAny};
+    case ThrottlePolicy::kFactory:
+      return {30, 120, 16 * 1024 * 1024, CpuPlacement::kPerformance};
+    default:
+      return {static_cast<int64_t>(DeltaPerformer::kCheckpointFrequencySeconds),
+              10,
+              1024 * 1024,
+              CpuPlacement::kAny};
+  }
+}
+
+}  // namespace
+
+void ThrottleActuatorAndroid::Apply(int level) {
+  CHECK_GE(level, 0);
+  CHECK_LE(level, ThrottleController::kMaxLevel);
+  const ThrottleLevel& throttle_level = GetThrottleLevels()[level];
+  if (!SetTaskProfiles(0, throttle_level.task_profiles)) {
+    LOG(ERROR) << "Could not set the task profiles of throttle level "
+               << level;
+  }
+  // Only the threads applying the operations: this one, which applies them
+  // unless the workers of a ParallelOperationApplier or a
+  // ConcurrentPartitionApplier do.
+  utils::SetThreadIoPriority(throttle_level.io_priority);
+  ParallelOperationApplier::SetIoPriority(throttle_level.io_priority);
+  ParallelOperationApplier::SetThreadLimit(throttle_level.apply_threads);
+}
+
+void ThrottleActuatorAndroid::ApplyPolicy(ThrottlePolicy policy) {
+  const PolicySettings settings = GetPolicySettings(policy);
+  DeltaPerformer::SetCheckpointIntervalBounds(
+      base::TimeDelta::FromSeconds(settings.min_checkpoint_interval_seconds),
+      base::TimeDelta::FromSeconds(settings.max_checkpoint_interval_seconds));
+  PartitionWriter::SetDefaultWriteCacheSize(settings.write_cache_size);
+  SetWorkerCpuPlacement(settings.cpu_placement);
+}
+
+}  // namespace chromeos_update_engine
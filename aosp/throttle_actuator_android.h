@@ -0,0 +1,44 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_AOSP_THROTTLE_ACTUATOR_ANDROID_H_
+#define UPDATE_ENGINE_AOSP_THROTTLE_ACTUATOR_ANDROID_H_
+
+#include <base/macros.h>
+
+#include "update_engine/common/throttle_controller.h"
+
+namespace chromeos_update_engine {
+
+// Throttles update_engine with the task profiles setting its cgroups, the
+// best-effort I/O priority of the threads applying the operations and their
+// number. The policy sets how often the progress is checkpointed, the
+// size of the write cache and the cores the worker threads run on.
+class ThrottleActuatorAndroid : public ThrottleActuatorInterface {
+ public:
+  ThrottleActuatorAndroid() = default;
+
+  void Apply(int level) override;
+  void ApplyPolicy(ThrottlePolicy policy) override;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(ThrottleActuatorAndroid);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_AOSP_THROTTLE_ACTUATOR_ANDROID_H_
@@ -17,9 +17,13 @@
 #include "update_engine/aosp/update_attempter_android.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <ostream>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -27,30 +31,38 @@
 #include <android-base/properties.h>
 #include <android-base/unique_fd.h>
 #include <base/bind.h>
+#include <base/files/file_util.h>
 #include <base/logging.h>
 #include <base/strings/string_number_conversions.h>
+#include <base/strings/string_split.h>
 #include <brillo/data_encoding.h>
 #include <brillo/message_loops/message_loop.h>
 #include <brillo/strings/string_utils.h>
 #include <log/log_safetynet.h>
-#include <processgroup/processgroup.h>
 
 #include "update_engine/aosp/cleanup_previous_update_action.h"
+#include "update_engine/aosp/throttle_actuator_android.h"
 #include "update_engine/common/clock.h"
 #include "update_engine/common/constants.h"
+#include "update_engine/common/cpu_topology.h"
 #include "update_engine/common/daemon_state_interface.h"
 #include "update_engine/common/download_action.h"
 #include "update_engine/common/error_code.h"
 #include "update_engine/common/error_code_utils.h"
 #include "update_engine/common/file_fetcher.h"
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/metrics_reporter_interface.h"
 #include "update_engine/common/network_selector.h"
+#include "update_engine/common/parallel_range_http_fetcher.h"
+#include "update_engine/common/shared_memory_fetcher.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/metrics_utils.h"
 #include "update_engine/payload_consumer/delta_performer.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/payload_consumer/file_descriptor_utils.h"
 #include "update_engine/payload_consumer/filesystem_verifier_action.h"
+#include "update_engine/payload_consumer/local_payload_download_action.h"
+#include "update_engine/payload_consumer/parallel_operation_applier.h"
 #include "update_engine/payload_consumer/partition_writer.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_consumer/payload_metadata.h"
@@ -83,6 +95,35 @@ namespace {
 const double kBroadcastThresholdProgress = 0.01;  // 1%
 const int kBroadcastThresholdSeconds = 10;
 
+// Maximum number of source partitions hashed concurrently when verifying that
+// a payload is applicable.
+const size_t kMaxVerifyApplicableThreads = 4;
+
+// The most the numeric headers may ask for, so that a bad value can't have the
+// daemon start threads or allocate memory until it fails.
+constexpr uint64_t kMaxHeaderThreads = 64;
+constexpr uint64_t kMaxHeaderCount = 64;
+// Sizes of single buffers.
+constexpr uint64_t kMaxHeaderBufferSize = 64 * 1024 * 1024;
+// Sizes of caches and budgets shared by the whole apply.
+constexpr uint64_t kMaxHeaderMemorySize = 4ULL * 1024 * 1024 * 1024;
+// Sizes of data on disk.
+constexpr uint64_t kMaxHeaderFileSize = 64ULL * 1024 * 1024 * 1024;
+// The lowest best-effort I/O priority.
+constexpr uint64_t kMaxIoPriority = 7;
+
+constexpr char kBootCompletedProp[] = "sys.boot_completed";
+// Longest wait for a change of sys.boot_completed before checking it again.
+constexpr std::chrono::seconds kWatchBootCompletedTimeout{60};
+
+// Name of the payload downloaded before it is applied, in the non-volatile
+// directory.
+constexpr char kStoredPayloadFileName[] = "stored_payload";
+
+// Name of the trace recorded with RECORD_APPLY_TRACE, in the non-volatile
+// directory.
+constexpr char kApplyTraceFileName[] = "apply_trace";
+
 // Log and set the error on the passed ErrorPtr.
 bool LogAndSetGenericError(Error* error,
                            int line_number,
@@ -112,6 +153,42 @@ bool LogAndSetError(Error* error,
   return false;
 }
 
+// Hashes the source extents of the operations of |partition| at
+// |partition_path| and checks them against the manifest. Gives up early once
+// |failed| is set by another partition. On failure, sets |reason| unless the
+// source hash mismatched, which PartitionWriter already logs.
+bool VerifySourcePartition(const PartitionUpdate& partition,
+                           const string& partition_path,
+                           size_t block_size,
+                           const std::atomic<bool>& failed,
+                           string* reason) {
+  FileDescriptorPtr fd(new EintrSafeFileDescriptor);
+  if (!fd->Open(partition_path.c_str(), O_RDONLY)) {
+    *reason = "Failed to open " + partition_path;
+    return false;
+  }
+  ErrorCode errorcode{};
+  for (const InstallOperation& operation : partition.operations()) {
+    if (failed) {
+      return false;
+    }
+    if (!operation.has_src_sha256_hash())
+      continue;
+    brillo::Blob source_hash;
+    if (!fd_utils::ReadAndHashExtents(
+            fd, operation.src_extents(), block_size, &source_hash)) {
+      *reason = "Failed to hash " + partition_path;
+      return false;
+    }
+    if (!PartitionWriter::ValidateSourceHash(
+            source_hash, operation, fd, &errorcode)) {
+      return false;
+    }
+  }
+  fd->Close();
+  return true;
+}
+
 bool GetHeaderAsBool(const string& header, bool default_value) {
   int value = 0;
   if (base::StringToInt(header, &value) && (value == 0 || value == 1))
@@ -158,6 +235,23 @@ std::string GetCurrentBuildVersion() {
 
 }  // namespace
 
+std::optional<uint64_t> UpdateAttempterAndroid::GetHeaderAsUint64(
+    const std::map<string, string>& headers, const string& key, uint64_t max) {
+  auto it = headers.find(key);
+  if (it == headers.end() || it->second.empty())
+    return std::nullopt;
+  uint64_t value = 0;
+  if (!base::StringToUint64(it->second, &value)) {
+    LOG(WARNING) << "Ignoring invalid " << key << ": " << it->second;
+    return std::nullopt;
+  }
+  if (value > max) {
+    LOG(WARNING) << "Limiting " << key << " from " << value << " to " << max;
+    return max;
+  }
+  return value;
+}
+
 UpdateAttempterAndroid::UpdateAttempterAndroid(
     DaemonStateInterface* daemon_state,
     PrefsInterface* prefs,
@@ -176,7 +270,15 @@ UpdateAttempterAndroid::UpdateAttempterAndroid(
   metrics_reporter_ = metrics::CreateMetricsReporter(
       boot_control_->GetDynamicPartitionControl(), &install_plan_);
   network_selector_ = network::CreateNetworkSelector();
-  SetTaskProfiles(0, {"OtaProfiles"});
+  throttle_controller_ = std::make_unique<ThrottleController>(
+      std::make_unique<PressureLoadSampler>(),
+      std::make_unique<ThrottleActuatorAndroid>());
+#ifdef _UE_SIDELOAD
+  // Nothing else runs while sideloading in recovery.
+  throttle_controller_->SetPolicy(ThrottlePolicy::kFactory);
+#else
+  throttle_controller_->SetPolicy(ThrottlePolicy::kBalanced);
+#endif  // _UE_SIDELOAD
 }
 
 UpdateAttempterAndroid::~UpdateAttempterAndroid() {
@@ -233,7 +335,7 @@ void UpdateAttempterAndroid::Init() {
     LOG(INFO) << "Skip ScheduleCleanupPreviousUpdate in sideload because "
               << "ApplyPayload will call it later.";
 #else
-    ScheduleCleanupPreviousUpdate();
+    ScheduleCleanupPreviousUpdateAfterBoot();
 #endif
   }
 }
@@ -251,6 +353,11 @@ bool UpdateAttempterAndroid::ApplyPayload(
                           "An update already applied, waiting for reboot",
                           ErrorCode::kUpdateAlreadyInstalled);
   }
+  if (boot_completed_watcher_.IsWatching()) {
+    // The cleanup must run before another update, as it would have if it
+    // wasn't deferred.
+    ScheduleCleanupPreviousUpdate();
+  }
   if (processor_->IsRunning()) {
     return LogAndSetError(error,
                           __LINE__,
@@ -357,43 +464,116 @@ bool UpdateAttempterAndroid::ApplyPayload(
     }
     LOG(INFO) << "Using network ID: " << network_id;
   }
+  std::vector<NetworkId> download_networks;
+  for (const auto& id :
+       base::SplitString(headers[kPayloadPropertyNetworkIds],
+                         ",",
+                         base::TRIM_WHITESPACE,
+                         base::SPLIT_WANT_NONEMPTY)) {
+    NetworkId download_network = kDefaultNetworkId;
+    if (!base::StringToUint64(id, &download_network)) {
+      return LogAndSetGenericError(
+          error,
+          __LINE__,
+          __FILE__,
+          "Invalid network_ids: " + headers[kPayloadPropertyNetworkIds]);
+    }
+    download_networks.push_back(download_network);
+  }
 
   LOG(INFO) << "Using this install plan:";
   install_plan_.Dump();
 
   HttpFetcher* fetcher = nullptr;
-  if (FileFetcher::SupportedUrl(payload_url)) {
+  HttpFetcher* prefetch_fetcher = nullptr;
+  const unsigned int receive_buffer_size =
+      GetHeaderAsUint64(
+          headers, kPayloadReceiveBufferSize, kMaxHeaderBufferSize)
+          .value_or(0);
+  if (SharedMemoryFetcher::SupportedUrl(payload_url)) {
+    DLOG(INFO) << "Using SharedMemoryFetcher for streamed payload.";
+    fetcher = new SharedMemoryFetcher();
+  } else if (FileFetcher::SupportedUrl(payload_url)) {
     DLOG(INFO) << "Using FileFetcher for file URL.";
-    fetcher = new FileFetcher();
+    auto file_fetcher = new FileFetcher();
+    file_fetcher->set_use_mmap(
+        GetHeaderAsBool(headers[kPayloadMmapLocalPayload], false));
+    file_fetcher->set_read_size(receive_buffer_size);
+    fetcher = file_fetcher;
   } else {
 #ifdef _UE_SIDELOAD
     LOG(FATAL) << "Unsupported sideload URI: " << payload_url;
     return false;  // NOLINT, unreached but analyzer might not know.
                    // Suppress warnings about null 'fetcher' after this.
 #else
-    LibcurlHttpFetcher* libcurl_fetcher = new LibcurlHttpFetcher(hardware_);
-    if (!headers[kPayloadDownloadRetry].empty()) {
-      libcurl_fetcher->set_max_retry_count(
-          atoi(headers[kPayloadDownloadRetry].c_str()));
+    auto new_libcurl_fetcher =
+        [this,
+         retry = headers[kPayloadDownloadRetry],
+         receive_buffer_size,
+         reuse = GetHeaderAsBool(headers[kPayloadReuseConnections], false),
+         http2 = GetHeaderAsBool(headers[kPayloadHttp2], false),
+         download_networks](size_t connection) -> std::unique_ptr<HttpFetcher> {
+      auto libcurl_fetcher = std::make_unique<LibcurlHttpFetcher>(hardware_);
+      if (!download_networks.empty()) {
+        libcurl_fetcher->set_network(
+            network_selector_.get(),
+            download_networks[connection % download_networks.size()]);
+      }
+      if (!retry.empty()) {
+        libcurl_fetcher->set_max_retry_count(atoi(retry.c_str()));
+      }
+      libcurl_fetcher->set_server_to_check(ServerToCheck::kDownload);
+      libcurl_fetcher->set_reuse_connections(reuse);
+      libcurl_fetcher->set_http2(http2);
+      libcurl_fetcher->set_receive_buffer_size(receive_buffer_size);
+      return libcurl_fetcher;
+    };
+    unsigned int connections =
+        GetHeaderAsUint64(
+            headers, kPayloadDownloadConnections, kMaxHeaderThreads)
+            .value_or(0);
+    if (download_networks.size() > 1) {
+      LOG(INFO) << "Downloading over " << download_networks.size()
+                << " networks.";
+      connections = std::max<unsigned int>(connections,
+                                           download_networks.size());
+    }
+    if (connections > 1) {
+      LOG(INFO) << "Downloading over up to " << connections << " connections.";
+      fetcher = new ParallelRangeHttpFetcher(connections, new_libcurl_fetcher);
+    } else {
+      fetcher = new_libcurl_fetcher(0).release();
+      if (GetHeaderAsBool(headers[kPayloadPipelineRanges], false)) {
+        LOG(INFO) << "Pipelining the range requests.";
+        prefetch_fetcher = new_libcurl_fetcher(1).release();
+      }
     }
-    libcurl_fetcher->set_server_to_check(ServerToCheck::kDownload);
-    fetcher = libcurl_fetcher;
 #endif  // _UE_SIDELOAD
   }
   // Setup extra headers.
-  if (!headers[kPayloadPropertyAuthorization].empty())
-    fetcher->SetHeader("Authorization", headers[kPayloadPropertyAuthorization]);
-  if (!headers[kPayloadPropertyUserAgent].empty())
-    fetcher->SetHeader("User-Agent", headers[kPayloadPropertyUserAgent]);
+  for (HttpFetcher* http_fetcher : {fetcher, prefetch_fetcher}) {
+    if (!http_fetcher)
+      continue;
+    if (!headers[kPayloadPropertyAuthorization].empty()) {
+      http_fetcher->SetHeader("Authorization",
+                              headers[kPayloadPropertyAuthorization]);
+    }
+    if (!headers[kPayloadPropertyUserAgent].empty())
+      http_fetcher->SetHeader("User-Agent", headers[kPayloadPropertyUserAgent]);
+  }
 
   if (!headers[kPayloadPropertyNetworkProxy].empty()) {
     LOG(INFO) << "Using proxy url from payload headers: "
               << headers[kPayloadPropertyNetworkProxy];
     fetcher->SetProxies({headers[kPayloadPropertyNetworkProxy]});
+    if (prefetch_fetcher)
+      prefetch_fetcher->SetProxies({headers[kPayloadPropertyNetworkProxy]});
   }
   if (!headers[kPayloadVABCNone].empty()) {
     install_plan_.vabc_none = true;
   }
+  install_plan_.vabc_auto_compression =
+      GetHeaderAsBool(headers[kPayloadVabcAutoCompression], false);
   if (!headers[kPayloadEnableThreading].empty()) {
     const auto res = android::base::ParseBool(headers[kPayloadEnableThreading]);
     if (res != android::base::ParseBoolResult::kError) {
@@ -404,8 +584,161 @@ bool UpdateAttempterAndroid::ApplyPayload(
   if (!headers[kPayloadBatchedWrites].empty()) {
     install_plan_.batched_writes = true;
   }
+  install_plan_.use_io_uring =
+      GetHeaderAsBool(headers[kPayloadUseIoUring], false);
+  // The thread counts stay within the limit of the throttle, which the
+  // threads of the apply are held to anyway.
+  const uint64_t max_threads = std::min<uint64_t>(
+      ParallelOperationApplier::GetThreadLimit(), kMaxHeaderThreads);
+  if (auto value =
+          GetHeaderAsUint64(headers, kPayloadApplyThreads, max_threads)) {
+    install_plan_.apply_threads = *value;
+  }
+  if (auto value = GetHeaderAsUint64(
+          headers, kPayloadSourcePrefetchOps, kMaxHeaderCount)) {
+    install_plan_.source_prefetch_ops = *value;
+  }
+  if (auto value =
+          GetHeaderAsUint64(headers, kPayloadSourceReadThreads, max_threads)) {
+    install_plan_.source_read_threads = *value;
+  }
+  if (auto value = GetHeaderAsUint64(
+          headers, kPayloadBsdiffMemoryLimit, kMaxHeaderMemorySize)) {
+    install_plan_.bsdiff_memory_limit = *value;
+  }
+  if (auto value = GetHeaderAsUint64(
+          headers, kPayloadMemoryBudget, kMaxHeaderMemorySize)) {
+    install_plan_.memory_budget = *value;
+  }
+  if (auto value =
+          GetHeaderAsUint64(headers, kPayloadLz4diffThreads, max_threads)) {
+    install_plan_.lz4diff_threads = *value;
+  }
+  if (auto value =
+          GetHeaderAsUint64(headers, kPayloadBzipThreads, max_threads)) {
+    install_plan_.bzip_threads = *value;
+  }
+  if (auto value = GetHeaderAsUint64(headers, kPayloadXzThreads, max_threads)) {
+    install_plan_.xz_threads = *value;
+  }
+  if (auto value =
+          GetHeaderAsUint64(headers, kPayloadZstdThreads, max_threads)) {
+    install_plan_.zstd_threads = *value;
+  }
+  if (auto value =
+          GetHeaderAsUint64(headers, kPayloadZucchiniThreads, max_threads)) {
+    install_plan_.zucchini_threads = *value;
+  }
+  install_plan_.checkpoint_record =
+      GetHeaderAsBool(headers[kPayloadCheckpointRecord], false);
+  if (auto value = GetHeaderAsUint64(
+          headers, kPayloadWriteBehindBuffers, kMaxHeaderCount)) {
+    install_plan_.write_behind_buffers = *value;
+  }
+  if (auto value = GetHeaderAsUint64(
+          headers, kPayloadWriteCacheSize, kMaxHeaderBufferSize)) {
+    install_plan_.write_cache_size = *value;
+  }
+  if (auto value = GetHeaderAsUint64(
+          headers, kPayloadConcurrentPartitions, max_threads)) {
+    install_plan_.concurrent_partitions = *value;
+  }
+  install_plan_.async_payload_hash =
+      GetHeaderAsBool(headers[kPayloadAsyncPayloadHash], false);
+  if (auto value = GetHeaderAsUint64(
+          headers, kPayloadVerifyReadAheadBuffers, kMaxHeaderCount)) {
+    install_plan_.verify_read_ahead_buffers = *value;
+  }
+  install_plan_.verify_direct_io =
+      GetHeaderAsBool(headers[kPayloadVerifyDirectIo], false);
+  if (auto value =
+          GetHeaderAsUint64(headers, kPayloadVerifyCowReaders, max_threads)) {
+    install_plan_.verify_cow_readers = *value;
+  }
+  install_plan_.drop_page_cache =
+      GetHeaderAsBool(headers[kPayloadDropPageCache], false);
+  if (auto value = GetHeaderAsUint64(
+          headers, kPayloadVerifyConcurrentPartitions, max_threads)) {
+    install_plan_.verify_concurrent_partitions = *value;
+  }
+  if (auto value = GetHeaderAsUint64(
+          headers, kPayloadVerifyIoPriority, kMaxIoPriority)) {
+    install_plan_.verify_io_priority = *value;
+  }
+  if (auto value = GetHeaderAsUint64(
+          headers, kPayloadVerityHashTreeThreads, max_threads)) {
+    install_plan_.verity_hash_tree_threads = *value;
+  }
+  if (auto value =
+          GetHeaderAsUint64(headers, kPayloadVerityFecThreads, max_threads)) {
+    install_plan_.verity_fec_threads = *value;
+  }
+  install_plan_.trusted_write_path_hash =
+      GetHeaderAsBool(headers[kPayloadTrustedWritePathHash], false);
+  install_plan_.touched_blocks_verification =
+      GetHeaderAsBool(headers[kPayloadTouchedBlocksVerification], false);
+  install_plan_.early_source_verification =
+      GetHeaderAsBool(headers[kPayloadEarlySourceVerification], false);
+  if (auto value = GetHeaderAsUint64(
+          headers, kPayloadSourceCacheSize, kMaxHeaderMemorySize)) {
+    install_plan_.source_cache_size = *value;
+  }
+  if (auto value = GetHeaderAsUint64(
+          headers, kPayloadPuffdiffCacheSize, kMaxHeaderBufferSize)) {
+    install_plan_.puffdiff_cache_size = *value;
+  }
+  if (auto value = GetHeaderAsUint64(
+          headers, kPayloadSourceReadaheadSize, kMaxHeaderBufferSize)) {
+    install_plan_.source_readahead_size = *value;
+  }
+  if (auto value = GetHeaderAsUint64(
+          headers, kPayloadPostinstallConcurrency, max_threads)) {
+    install_plan_.postinstall_concurrency = *value;
+  }
+  if (auto value = GetHeaderAsUint64(
+          headers, kPayloadDownloadStagingSize, kMaxHeaderFileSize)) {
+    install_plan_.download_staging_size = *value;
+  }
+  if (auto value = GetHeaderAsUint64(
+          headers, kPayloadOperationDataCheckpointSize, kMaxHeaderFileSize)) {
+    install_plan_.operation_data_checkpoint_size = *value;
+  }
+  install_plan_.skip_satisfied_operations =
+      GetHeaderAsBool(headers[kPayloadSkipSatisfiedOperations], false);
+  install_plan_.reorder_operations =
+      GetHeaderAsBool(headers[kPayloadReorderOperations], false);
+  install_plan_.serial_postinstall_partitions = brillo::string_utils::Split(
+      headers[kPayloadSerialPostinstallPartitions], ",");
+  install_plan_.early_postinstall =
+      GetHeaderAsBool(headers[kPayloadEarlyPostinstall], false);
+  if (GetHeaderAsBool(headers[kPayloadDownloadThenApply], false)) {
+    if (SharedMemoryFetcher::SupportedUrl(payload_url) ||
+        FileFetcher::SupportedUrl(payload_url)) {
+      LOG(INFO) << "Ignoring " << kPayloadDownloadThenApply
+                << " for a local payload.";
+    } else if (GetStoredPayloadPath().empty()) {
+      delete fetcher;
+      delete prefetch_fetcher;
+      return LogAndSetGenericError(
+          error,
+          __LINE__,
+          __FILE__,
+          "No non-volatile directory to download the payload to.");
+    } else {
+      install_plan_.download_then_apply = true;
+    }
+  }
+  if (GetHeaderAsBool(headers[kPayloadRecordApplyTrace], false)) {
+    if (IsProductionBuild()) {
+      LOG(WARNING) << "Ignoring " << kPayloadRecordApplyTrace
+                   << " on a production build.";
+    } else {
+      apply_trace_ = std::make_unique<ApplyTrace>();
+      ApplyTrace::Set(apply_trace_.get());
+    }
+  }
 
-  BuildUpdateActions(fetcher);
+  BuildUpdateActions(fetcher, prefetch_fetcher);
 
   SetStatusAndNotify(UpdateStatus::UPDATE_AVAILABLE);
 
@@ -442,12 +775,46 @@ bool UpdateAttempterAndroid::ApplyPayload(
   DCHECK_EQ(status_, UpdateStatus::IDLE);
 
   payload_fd_.reset(dup(fd));
+  payload_socket_fd_.reset();
   const string payload_url = "fd://" + std::to_string(payload_fd_.get());
 
   return ApplyPayload(
       payload_url, payload_offset, payload_size, key_value_pair_headers, error);
 }
 
+bool UpdateAttempterAndroid::ApplyPayloadStream(
+    int ring_fd,
+    int socket_fd,
+    int64_t payload_offset,
+    int64_t payload_size,
+    const vector<string>& key_value_pair_headers,
+    Error* error) {
+  // Same as above, the file descriptors of a running update must stay open.
+  if (status_ == UpdateStatus::UPDATED_NEED_REBOOT) {
+    return LogAndSetGenericError(
+        error,
+        __LINE__,
+        __FILE__,
+        "An update already applied, waiting for reboot");
+  }
+  if (processor_->IsRunning()) {
+    return LogAndSetGenericError(
+        error,
+        __LINE__,
+        __FILE__,
+        "Already processing an update, cancel it first.");
+  }
+  DCHECK_EQ(status_, UpdateStatus::IDLE);
+
+  payload_fd_.reset(dup(ring_fd));
+  payload_socket_fd_.reset(dup(socket_fd));
+  const string payload_url = "shm://" + std::to_string(payload_fd_.get()) +
+                             "/" + std::to_string(payload_socket_fd_.get());
+
+  return ApplyPayload(
+      payload_url, payload_offset, payload_size, key_value_pair_headers, error);
+}
+
 bool UpdateAttempterAndroid::SuspendUpdate(Error* error) {
   if (!processor_->IsRunning())
     return LogAndSetGenericError(
@@ -518,6 +885,11 @@ bool UpdateAttempterAndroid::ResetStatus(Error* error) {
     LOG(WARNING) << "Failed to reset snapshots. UpdateStatus is IDLE but"
                  << "space might not be freed.";
   }
+  const string stored_payload_path = GetStoredPayloadPath();
+  if (!stored_payload_path.empty()) {
+    LocalPayloadDownloadAction::DeleteStoredPayload(prefs_,
+                                                    stored_payload_path);
+  }
   return true;
 }
 
@@ -642,8 +1014,24 @@ bool UpdateAttempterAndroid::VerifyPayloadApplicable(
   TEST_AND_RETURN_FALSE(
       VerifyPayloadParseManifest(metadata_filename, &manifest, error));
 
-  FileDescriptorPtr fd(new EintrSafeFileDescriptor);
-  ErrorCode errorcode{};
+  // The source partitions don't change until the next boot, so a payload
+  // found applicable stays applicable for the rest of the boot.
+  string boot_id;
+  brillo::Blob manifest_hash;
+  string applicable_key;
+  if (utils::GetBootId(&boot_id) &&
+      HashCalculator::RawHashOfBytes(manifest.SerializeAsString().data(),
+                                     manifest.ByteSizeLong(),
+                                     &manifest_hash)) {
+    applicable_key = boot_id + ":" + base::HexEncode(manifest_hash.data(),
+                                                     manifest_hash.size());
+    string verified_key;
+    if (prefs_->GetString(kPrefsPayloadApplicable, &verified_key) &&
+        verified_key == applicable_key) {
+      LOG(INFO) << "Payload was already verified applicable in this boot.";
+      return true;
+    }
+  }
 
   BootControlInterface::Slot current_slot = GetCurrentSlot();
   if (current_slot < 0) {
@@ -654,6 +1042,7 @@ bool UpdateAttempterAndroid::VerifyPayloadApplicable(
         "Failed to get current slot " + std::to_string(current_slot),
         ErrorCode::kDownloadStateInitializationError);
   }
+  vector<std::pair<const PartitionUpdate*, string>> sources;
   for (const PartitionUpdate& partition : manifest.partitions()) {
     if (!partition.has_old_partition_info())
       continue;
@@ -666,27 +1055,56 @@ bool UpdateAttempterAndroid::VerifyPayloadApplicable(
           __FILE__,
           "Failed to get partition device for " + partition.partition_name());
     }
-    if (!fd->Open(partition_path.c_str(), O_RDONLY)) {
-      return LogAndSetGenericError(
-          error, __LINE__, __FILE__, "Failed to open " + partition_path);
-    }
-    for (const InstallOperation& operation : partition.operations()) {
-      if (!operation.has_src_sha256_hash())
-        continue;
-      brillo::Blob source_hash;
-      if (!fd_utils::ReadAndHashExtents(fd,
-                                        operation.src_extents(),
-                                        manifest.block_size(),
-                                        &source_hash)) {
-        return LogAndSetGenericError(
-            error, __LINE__, __FILE__, "Failed to hash " + partition_path);
+    sources.emplace_back(&partition, partition_path);
+  }
+
+  // Hash the partitions concurrently, stopping all of them on the first
+  // failure.
+  const auto start = TimeTicks::Now();
+  const size_t num_threads = std::min(
+      {kMaxVerifyApplicableThreads,
+       std::max<size_t>(std::thread::hardware_concurrency(), 1),
+       sources.size()});
+  std::atomic<size_t> next{0};
+  std::atomic<bool> failed{false};
+  std::mutex reason_mutex;
+  string reason;
+  vector<std::thread> threads;
+  threads.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; i++) {
+    threads.emplace_back([&] {
+      PlaceWorkerThread();
+      for (size_t index = next++; index < sources.size() && !failed;
+           index = next++) {
+        string partition_reason;
+        if (!VerifySourcePartition(*sources[index].first,
+                                   sources[index].second,
+                                   manifest.block_size(),
+                                   failed,
+                                   &partition_reason)) {
+          std::lock_guard<std::mutex> lock(reason_mutex);
+          if (reason.empty()) {
+            reason = partition_reason;
+          }
+          failed = true;
+        }
       }
-      if (!PartitionWriter::ValidateSourceHash(
-              source_hash, operation, fd, &errorcode)) {
-        return false;
-      }
-    }
-    fd->Close();
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  LOG(INFO) << "Verified " << sources.size() << " source partitions with "
+            << num_threads << " threads, took "
+            << (TimeTicks::Now() - start).InMilliseconds() << " ms";
+  if (failed) {
+    // A mismatching source hash was already logged.
+    if (reason.empty())
+      return false;
+    return LogAndSetGenericError(error, __LINE__, __FILE__, reason);
+  }
+  if (!applicable_key.empty()) {
+    prefs_->SetString(kPrefsPayloadApplicable, applicable_key);
   }
   return true;
 }
@@ -695,16 +1113,40 @@ bool UpdateAttempterAndroid::SetPerformanceMode(bool enable,
                                                 Error* error) {
   LOG(INFO) << (enable ? "Enabling" : "Disabling") << " performance mode.";
 
-  if (performance_mode_ == enable)
+  const bool performance_mode =
+      throttle_controller_->policy() == ThrottlePolicy::kPerformance;
+  if (performance_mode == enable)
     return true;
-  bool ret;
-  if (enable)
-    ret = SetTaskProfiles(0, {"ProcessCapacityMax", "HighIoPriority", "MaxPerformance"});
-  else
-    ret = SetTaskProfiles(0, {"OtaProfiles"});
-  if (!ret)
-    return LogAndSetGenericError(error, __LINE__, __FILE__, "Could not change profiles");
-  performance_mode_ = enable;
+  throttle_controller_->SetPolicy(enable ? ThrottlePolicy::kPerformance
+                                         : ThrottlePolicy::kBalanced);
+  return true;
+}
+
+bool UpdateAttempterAndroid::SetThrottlePolicy(int policy, Error* error) {
+  ThrottlePolicy throttle_policy;
+  if (!ThrottlePolicyFromInt(policy, &throttle_policy)) {
+    return LogAndSetGenericError(
+        error,
+        __LINE__,
+        __FILE__,
+        "Invalid throttle policy " + std::to_string(policy));
+  }
+  throttle_controller_->SetPolicy(throttle_policy);
+  return true;
+}
+
+bool UpdateAttempterAndroid::SetMergePolicy(int policy, Error* error) {
+  ThrottlePolicy merge_policy;
+  if (!ThrottlePolicyFromInt(policy, &merge_policy)) {
+    return LogAndSetGenericError(
+        error,
+        __LINE__,
+        __FILE__,
+        "Invalid merge policy " + std::to_string(policy));
+  }
+  LOG(INFO) << "Setting the merge policy to "
+            << ThrottlePolicyToString(merge_policy);
+  merge_policy_ = merge_policy;
   return true;
 }
 
@@ -719,6 +1161,15 @@ void UpdateAttempterAndroid::ProcessingDone(const ActionProcessor* processor,
     return;
   }
 
+  // The stored payload is deleted once applied, or if it was altered since
+  // it was downloaded.
+  if (install_plan_.download_then_apply &&
+      (code == ErrorCode::kSuccess ||
+       code == ErrorCode::kPayloadHashMismatchError)) {
+    LocalPayloadDownloadAction::DeleteStoredPayload(prefs_,
+                                                    GetStoredPayloadPath());
+  }
+
   switch (code) {
     case ErrorCode::kSuccess:
       // Update succeeded.
@@ -774,6 +1225,7 @@ void UpdateAttempterAndroid::ActionCompleted(ActionProcessor* processor,
   // download_progress_ is actually used by other actions, such as
   // filesystem_verify_action. Therefore we always clear it.
   download_progress_ = 0;
+  apply_progress_.reset();
   if (type == PostinstallRunnerAction::StaticType()) {
     bool succeeded =
         code == ErrorCode::kSuccess || code == ErrorCode::kUpdatedButNotActive;
@@ -786,22 +1238,52 @@ void UpdateAttempterAndroid::ActionCompleted(ActionProcessor* processor,
   if (type == UpdateBootFlagsAction::StaticType()) {
     SetStatusAndNotify(UpdateStatus::CLEANUP_PREVIOUS_UPDATE);
   }
-  if (type == DownloadAction::StaticType()) {
+  if (type == LocalPayloadDownloadAction::StaticType()) {
+    // The payload is applied from the local file now.
+    install_plan_ =
+        *static_cast<LocalPayloadDownloadAction*>(action)->install_plan();
+    ReleaseMemoryAfterPhase("download");
+  } else if (type == DownloadAction::StaticType()) {
     auto download_action = static_cast<DownloadAction*>(action);
     install_plan_ = *download_action->install_plan();
+    ReleaseMemoryAfterPhase("apply");
     SetStatusAndNotify(UpdateStatus::VERIFYING);
   } else if (type == FilesystemVerifierAction::StaticType()) {
+    // Keep the time spent verifying the partitions for the metrics.
+    const auto& verified_partitions =
+        static_cast<FilesystemVerifierAction*>(action)
+            ->install_plan()
+            ->partitions;
+    if (verified_partitions.size() == install_plan_.partitions.size()) {
+      for (size_t i = 0; i < verified_partitions.size(); i++) {
+        install_plan_.partitions[i].throughput_stats =
+            verified_partitions[i].throughput_stats;
+      }
+    }
+    ReleaseMemoryAfterPhase("verification");
     SetStatusAndNotify(UpdateStatus::FINALIZING);
     prefs_->SetBoolean(kPrefsVerityWritten, true);
+  } else if (type == PostinstallRunnerAction::StaticType()) {
+    ReleaseMemoryAfterPhase("postinstall");
   }
 }
 
+void UpdateAttempterAndroid::ReleaseMemoryAfterPhase(const string& phase) {
+  utils::ReleaseFreeMemory();
+  const int64_t rss_kib = utils::GetResidentSetKiB();
+  LOG(INFO) << "Resident set after the " << phase << " phase: " << rss_kib
+            << " KiB";
+  install_plan_.resident_set_kib_by_phase.emplace_back(phase, rss_kib);
+}
+
 void UpdateAttempterAndroid::BytesReceived(uint64_t bytes_progressed,
                                            uint64_t bytes_received,
                                            uint64_t total) {
   double progress = 0;
   if (total)
     progress = static_cast<double>(bytes_received) / static_cast<double>(total);
+  if (apply_progress_)
+    progress = std::min(progress, *apply_progress_);
   if (status_ != UpdateStatus::DOWNLOADING || bytes_received == total) {
     download_progress_ = progress;
     SetStatusAndNotify(UpdateStatus::DOWNLOADING);
@@ -824,6 +1306,12 @@ void UpdateAttempterAndroid::DownloadComplete() {
   // Nothing needs to be done when the download completes.
 }
 
+void UpdateAttempterAndroid::ApplyProgress(double progress) {
+  apply_progress_ = progress;
+  if (status_ == UpdateStatus::DOWNLOADING)
+    ProgressUpdate(progress);
+}
+
 void UpdateAttempterAndroid::ProgressUpdate(double progress) {
   // Self throttle based on progress. Also send notifications if progress is
   // too slow.
@@ -843,6 +1331,7 @@ void UpdateAttempterAndroid::OnVerifyProgressUpdate(double progress) {
 
 void UpdateAttempterAndroid::ScheduleProcessingStart() {
   LOG(INFO) << "Scheduling an action processor start.";
+  throttle_controller_->Start();
   processor_->set_delegate(this);
   brillo::MessageLoop::current()->PostTask(
       FROM_HERE,
@@ -855,6 +1344,7 @@ void UpdateAttempterAndroid::TerminateUpdateAndNotify(ErrorCode error_code) {
     LOG(ERROR) << "No ongoing update, but TerminatedUpdate() called.";
     return;
   }
+  throttle_controller_->Stop();
 
   if (status_ == UpdateStatus::CLEANUP_PREVIOUS_UPDATE) {
     ClearUpdateCompletedMarker();
@@ -868,11 +1358,23 @@ void UpdateAttempterAndroid::TerminateUpdateAndNotify(ErrorCode error_code) {
   boot_control_->GetDynamicPartitionControl()->Cleanup();
 
   download_progress_ = 0;
+  apply_progress_.reset();
   UpdateStatus new_status =
       (error_code == ErrorCode::kSuccess ? UpdateStatus::UPDATED_NEED_REBOOT
                                          : UpdateStatus::IDLE);
   SetStatusAndNotify(new_status);
   payload_fd_.reset();
+  payload_socket_fd_.reset();
+  if (apply_trace_) {
+    ApplyTrace::Set(nullptr);
+    base::FilePath non_volatile_path;
+    if (!hardware_->GetNonVolatileDirectory(&non_volatile_path) ||
+        !apply_trace_->Save(
+            non_volatile_path.Append(kApplyTraceFileName).value())) {
+      LOG(WARNING) << "Failed to save the apply trace.";
+    }
+    apply_trace_.reset();
+  }
 
   // The network id is only applicable to one download attempt and once it's
   // done the network id should not be re-used anymore.
@@ -893,6 +1395,8 @@ void UpdateAttempterAndroid::TerminateUpdateAndNotify(ErrorCode error_code) {
     // Clear the total bytes downloaded if and only if the update succeeds.
     metric_total_bytes_downloaded_.Delete();
   }
+  // Don't stay resident with the peak of the update while idle.
+  utils::ReleaseFreeMemory();
 }
 
 void UpdateAttempterAndroid::SetStatusAndNotify(UpdateStatus status) {
@@ -909,7 +1413,8 @@ void UpdateAttempterAndroid::SetStatusAndNotify(UpdateStatus status) {
   last_notify_time_ = TimeTicks::Now();
 }
 
-void UpdateAttempterAndroid::BuildUpdateActions(HttpFetcher* fetcher) {
+void UpdateAttempterAndroid::BuildUpdateActions(
+    HttpFetcher* fetcher, HttpFetcher* prefetch_fetcher) {
   CHECK(!processor_->IsRunning());
 
   // Actions:
@@ -919,6 +1424,28 @@ void UpdateAttempterAndroid::BuildUpdateActions(HttpFetcher* fetcher) {
       boot_control_->GetDynamicPartitionControl()
           ->GetCleanupPreviousUpdateAction(boot_control_, prefs_, this);
   auto install_plan_action = std::make_unique<InstallPlanAction>(install_plan_);
+  // The payload is downloaded to a local file, then applied from it by the
+  // DownloadAction once the throttle policy lets the update use the most
+  // resources.
+  std::unique_ptr<LocalPayloadDownloadAction> local_payload_download_action;
+  if (install_plan_.download_then_apply) {
+    local_payload_download_action =
+        std::make_unique<LocalPayloadDownloadAction>(
+            prefs_, fetcher, GetStoredPayloadPath());
+    local_payload_download_action->set_delegate(this);
+    local_payload_download_action->set_base_offset(base_offset_);
+    if (prefetch_fetcher)
+      local_payload_download_action->set_prefetch_fetcher(prefetch_fetcher);
+    local_payload_download_action->set_apply_gate(base::BindRepeating(
+        [](const ThrottleController* throttle_controller) {
+          return IsHighResourcePolicy(throttle_controller->policy());
+        },
+        base::Unretained(throttle_controller_.get())));
+    auto file_fetcher = new FileFetcher();
+    file_fetcher->set_use_mmap(true);
+    fetcher = file_fetcher;
+    prefetch_fetcher = nullptr;
+  }
   auto download_action =
       std::make_unique<DownloadAction>(prefs_,
                                        boot_control_,
@@ -927,17 +1454,29 @@ void UpdateAttempterAndroid::BuildUpdateActions(HttpFetcher* fetcher) {
                                        true /* interactive */,
                                        update_certificates_path_);
   download_action->set_delegate(this);
-  download_action->set_base_offset(base_offset_);
+  // The stored payload starts at the beginning of its file.
+  download_action->set_base_offset(
+      local_payload_download_action ? 0 : base_offset_);
+  if (prefetch_fetcher)
+    download_action->set_prefetch_fetcher(prefetch_fetcher);
   auto filesystem_verifier_action = std::make_unique<FilesystemVerifierAction>(
       boot_control_->GetDynamicPartitionControl());
   auto postinstall_runner_action =
       std::make_unique<PostinstallRunnerAction>(boot_control_, hardware_);
   filesystem_verifier_action->set_delegate(this);
+  filesystem_verifier_action->set_postinstall_runner(
+      postinstall_runner_action.get());
   postinstall_runner_action->set_delegate(this);
 
   // Bond them together. We have to use the leaf-types when calling
   // BondActions().
-  BondActions(install_plan_action.get(), download_action.get());
+  if (local_payload_download_action) {
+    BondActions(install_plan_action.get(),
+                local_payload_download_action.get());
+    BondActions(local_payload_download_action.get(), download_action.get());
+  } else {
+    BondActions(install_plan_action.get(), download_action.get());
+  }
   BondActions(download_action.get(), filesystem_verifier_action.get());
   BondActions(filesystem_verifier_action.get(),
               postinstall_runner_action.get());
@@ -945,11 +1484,20 @@ void UpdateAttempterAndroid::BuildUpdateActions(HttpFetcher* fetcher) {
   processor_->EnqueueAction(std::move(update_boot_flags_action));
   processor_->EnqueueAction(std::move(cleanup_previous_update_action));
   processor_->EnqueueAction(std::move(install_plan_action));
+  if (local_payload_download_action)
+    processor_->EnqueueAction(std::move(local_payload_download_action));
   processor_->EnqueueAction(std::move(download_action));
   processor_->EnqueueAction(std::move(filesystem_verifier_action));
   processor_->EnqueueAction(std::move(postinstall_runner_action));
 }
 
+string UpdateAttempterAndroid::GetStoredPayloadPath() const {
+  base::FilePath non_volatile_path;
+  if (!hardware_->GetNonVolatileDirectory(&non_volatile_path))
+    return "";
+  return non_volatile_path.Append(kStoredPayloadFileName).value();
+}
+
 bool UpdateAttempterAndroid::WriteUpdateCompletedMarker() {
   string boot_id;
   TEST_AND_RETURN_FALSE(utils::GetBootId(&boot_id));
@@ -1028,6 +1576,14 @@ void UpdateAttempterAndroid::CollectAndReportUpdateMetricsOnUpdateFinished(
       metrics::DownloadErrorCode::kUnset,
       metrics::ConnectionType::kUnset);
 
+  for (const auto& partition : install_plan_.partitions) {
+    if (!partition.apply_stats.empty()) {
+      metrics_reporter_->ReportApplyStats(partition.name,
+                                          partition.apply_stats,
+                                          partition.throughput_stats);
+    }
+  }
+
   if (error_code == ErrorCode::kSuccess) {
     int64_t reboot_count =
         metrics_utils::GetPersistedValue(kPrefsNumReboots, prefs_);
@@ -1228,41 +1784,85 @@ uint64_t UpdateAttempterAndroid::AllocateSpaceForPayload(
   if (!ParseKeyValuePairHeaders(key_value_pair_headers, &headers, error)) {
     return 0;
   }
-  DeltaArchiveManifest manifest;
-  brillo::Blob metadata_hash;
-  if (!brillo::data_encoding::Base64Decode(
-          headers[kPayloadPropertyMetadataHash], &metadata_hash)) {
-    metadata_hash.clear();
-  }
-  if (!VerifyPayloadParseManifest(
-          metadata_filename, ToStringView(metadata_hash), &manifest, error)) {
-    return 0;
-  }
-
-  std::vector<ApexInfo> apex_infos(manifest.apex_info().begin(),
-                                   manifest.apex_info().end());
-  uint64_t apex_size_required = 0;
-  if (apex_handler_android_ != nullptr) {
-    auto result = apex_handler_android_->CalculateSize(apex_infos);
-    if (!result.ok()) {
-      LogAndSetGenericError(
-          error,
-          __LINE__,
-          __FILE__,
-          "Failed to calculate size required for compressed APEX");
+  string payload_id = GetPayloadId(headers);
+  const BootControlInterface::Slot target_slot = GetTargetSlot();
+
+  // Clients call this repeatedly while the user frees space, so the manifest
+  // and the APEX sizes are kept until the payload, its metadata file or the
+  // target slot change.
+  base::File::Info metadata_info;
+  if (!base::GetFileInfo(base::FilePath(metadata_filename), &metadata_info)) {
+    metadata_info = base::File::Info();
+  }
+  const string& metadata_hash_header = headers[kPayloadPropertyMetadataHash];
+  PayloadSpaceCache* cache = payload_space_cache_.get();
+  if (cache && cache->payload_id == payload_id &&
+      cache->metadata_filename == metadata_filename &&
+      cache->metadata_hash == metadata_hash_header &&
+      cache->metadata_size == metadata_info.size &&
+      cache->metadata_modified == metadata_info.last_modified &&
+      cache->target_slot == target_slot) {
+    LOG(INFO) << "Using the manifest and APEX sizes of payload " << payload_id
+              << " computed earlier.";
+  } else {
+    payload_space_cache_.reset();
+    auto new_cache = std::make_unique<PayloadSpaceCache>();
+    brillo::Blob metadata_hash;
+    if (!brillo::data_encoding::Base64Decode(metadata_hash_header,
+                                             &metadata_hash)) {
+      metadata_hash.clear();
+    }
+    if (!VerifyPayloadParseManifest(metadata_filename,
+                                    ToStringView(metadata_hash),
+                                    &new_cache->manifest,
+                                    error)) {
+      return 0;
+    }
+    new_cache->apex_infos.assign(new_cache->manifest.apex_info().begin(),
+                                 new_cache->manifest.apex_info().end());
+    if (apex_handler_android_ != nullptr) {
+      auto result = apex_handler_android_->CalculateSize(new_cache->apex_infos);
+      if (!result.ok()) {
+        LogAndSetGenericError(
+            error,
+            __LINE__,
+            __FILE__,
+            "Failed to calculate size required for compressed APEX");
+        return 0;
+      }
+      new_cache->apex_size_required = *result;
+    }
+    new_cache->payload_id = payload_id;
+    new_cache->metadata_filename = metadata_filename;
+    new_cache->metadata_hash = metadata_hash_header;
+    new_cache->metadata_size = metadata_info.size;
+    new_cache->metadata_modified = metadata_info.last_modified;
+    new_cache->target_slot = target_slot;
+    payload_space_cache_ = std::move(new_cache);
+    cache = payload_space_cache_.get();
+  }
+
+  // The partitions stay prepared for the payload until the update progress is
+  // reset, e.g. by another payload or by ResetStatus().
+  if (cache->allocated) {
+    string prepared_payload_id;
+    if (prefs_->GetString(kPrefsDynamicPartitionMetadataUpdated,
+                          &prepared_payload_id) &&
+        prepared_payload_id == payload_id) {
+      LOG(INFO) << "Space is already allocated for payload " << payload_id;
       return 0;
     }
-    apex_size_required = *result;
+    cache->allocated = false;
   }
 
-  string payload_id = GetPayloadId(headers);
+  const uint64_t apex_size_required = cache->apex_size_required;
   uint64_t required_size = 0;
   ErrorCode error_code{};
 
   if (!DeltaPerformer::PreparePartitionsForUpdate(prefs_,
                                                   boot_control_,
-                                                  GetTargetSlot(),
-                                                  manifest,
+                                                  target_slot,
+                                                  cache->manifest,
                                                   payload_id,
                                                   &required_size,
                                                   &error_code)) {
@@ -1287,12 +1887,15 @@ uint64_t UpdateAttempterAndroid::AllocateSpaceForPayload(
   }
 
   if (apex_size_required > 0 && apex_handler_android_ != nullptr &&
-      !apex_handler_android_->AllocateSpace(apex_infos)) {
+      !apex_handler_android_->AllocateSpace(cache->apex_infos)) {
     LOG(ERROR) << "Insufficient space for apex decompression: "
                << apex_size_required << " bytes";
     return apex_size_required;
   }
 
+  // Without a payload id, PreparePartitionsForUpdate() doesn't keep the
+  // partitions prepared either.
+  cache->allocated = !payload_id.empty();
   LOG(INFO) << "Successfully allocated space for payload.";
   return 0;
 }
@@ -1434,7 +2037,30 @@ bool UpdateAttempterAndroid::resetShouldSwitchSlotOnReboot(Error* error) {
   return true;
 }
 
+void UpdateAttempterAndroid::ScheduleCleanupPreviousUpdateAfterBoot() {
+  if (android::base::GetBoolProperty(kBootCompletedProp, false)) {
+    ScheduleCleanupPreviousUpdate();
+    return;
+  }
+  LOG(INFO) << "Deferring CleanupPreviousUpdateAction until "
+            << kBootCompletedProp << " is set.";
+  if (!boot_completed_watcher_.Watch(
+          kBootCompletedProp,
+          "1",
+          kWatchBootCompletedTimeout,
+          base::BindOnce(&UpdateAttempterAndroid::OnBootCompletedChanged,
+                         base::Unretained(this)))) {
+    ScheduleCleanupPreviousUpdate();
+  }
+}
+
+void UpdateAttempterAndroid::OnBootCompletedChanged() {
+  // Checks the property again after a timeout.
+  ScheduleCleanupPreviousUpdateAfterBoot();
+}
+
 void UpdateAttempterAndroid::ScheduleCleanupPreviousUpdate() {
+  boot_completed_watcher_.Cancel();
   // If a previous CleanupSuccessfulUpdate call has not finished, or an update
   // is in progress, skip enqueueing the action.
   if (processor_->IsRunning()) {
@@ -1458,6 +2084,11 @@ void UpdateAttempterAndroid::OnCleanupProgressUpdate(double progress) {
   }
 }
 
+void UpdateAttempterAndroid::OnMergeTelemetry(
+    const MergeTelemetry& telemetry) {
+  metrics_reporter_->ReportMergeTelemetry(telemetry);
+}
+
 void UpdateAttempterAndroid::NotifyCleanupPreviousUpdateCallbacksAndClear() {
   CHECK(cleanup_previous_update_code_.has_value());
   for (auto&& callback : cleanup_previous_update_callbacks_) {
@@ -19,7 +19,9 @@
 
 #include <stdint.h>
 
+#include <map>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -27,6 +29,7 @@
 #include <base/time/time.h>
 
 #include "update_engine/aosp/apex_handler_interface.h"
+#include "update_engine/aosp/property_watcher.h"
 #include "update_engine/aosp/service_delegate_android_interface.h"
 #include "update_engine/client_library/include/update_engine/update_status.h"
 #include "update_engine/common/action_processor.h"
@@ -39,7 +42,9 @@
 #include "update_engine/common/metrics_reporter_interface.h"
 #include "update_engine/common/network_selector_interface.h"
 #include "update_engine/common/prefs_interface.h"
+#include "update_engine/common/throttle_controller.h"
 #include "update_engine/metrics_utils.h"
+#include "update_engine/payload_consumer/apply_trace.h"
 #include "update_engine/payload_consumer/filesystem_verifier_action.h"
 #include "update_engine/payload_consumer/postinstall_runner_action.h"
 
@@ -83,6 +88,13 @@ class UpdateAttempterAndroid
                     int64_t payload_size,
                     const std::vector<std::string>& key_value_pair_headers,
                     Error* error) override;
+  bool ApplyPayloadStream(
+      int ring_fd,
+      int socket_fd,
+      int64_t payload_offset,
+      int64_t payload_size,
+      const std::vector<std::string>& key_value_pair_headers,
+      Error* error) override;
   bool SuspendUpdate(Error* error) override;
   bool ResumeUpdate(Error* error) override;
   bool CancelUpdate(Error* error) override;
@@ -101,6 +113,8 @@ class UpdateAttempterAndroid
   bool resetShouldSwitchSlotOnReboot(Error* error) override;
 
   bool SetPerformanceMode(bool enable, Error* error) override;
+  bool SetThrottlePolicy(int policy, Error* error) override;
+  bool SetMergePolicy(int policy, Error* error) override;
 
   // ActionProcessorDelegate methods:
   void ProcessingDone(const ActionProcessor* processor,
@@ -116,6 +130,7 @@ class UpdateAttempterAndroid
                      uint64_t total) override;
   bool ShouldCancel(ErrorCode* cancel_reason) override;
   void DownloadComplete() override;
+  void ApplyProgress(double progress) override;
 
   // FilesystemVerifyDelegate overrides
   void OnVerifyProgressUpdate(double progress) override;
@@ -125,6 +140,8 @@ class UpdateAttempterAndroid
 
   // CleanupPreviousUpdateActionDelegateInterface
   void OnCleanupProgressUpdate(double progress) override;
+  ThrottlePolicy GetMergePolicy() override { return merge_policy_; }
+  void OnMergeTelemetry(const MergeTelemetry& telemetry) override;
 
   // Check the result of an OTA update. Intended to be called after reboot, this
   // will use prefs on disk to determine if OTA was installed, or rolledback.
@@ -157,14 +174,22 @@ class UpdateAttempterAndroid
   // observers.
   void TerminateUpdateAndNotify(ErrorCode error_code);
 
+  // Returns the memory freed once the action of |phase| completed to the
+  // system, and records the resident set size left in |install_plan_|.
+  void ReleaseMemoryAfterPhase(const std::string& phase);
+
   // Sets the status to the given |status| and notifies a status update to
   // all observers.
   void SetStatusAndNotify(UpdateStatus status);
 
   // Helper method to construct the sequence of actions to be performed for
-  // applying an update using a given HttpFetcher. The ownership of |fetcher| is
-  // passed to this function.
-  void BuildUpdateActions(HttpFetcher* fetcher);
+  // applying an update using a given HttpFetcher. The ownership of |fetcher|,
+  // and of |prefetch_fetcher| if not null, is passed to this function.
+  void BuildUpdateActions(HttpFetcher* fetcher, HttpFetcher* prefetch_fetcher);
+
+  // Returns the path of the payload downloaded before it is applied, or an
+  // empty string if the non-volatile directory is unknown.
+  std::string GetStoredPayloadPath() const;
 
   // Writes to the processing completed marker. Does nothing if
   // |update_completed_marker_| is empty.
@@ -232,9 +257,22 @@ class UpdateAttempterAndroid
     return VerifyPayloadParseManifest(metadata_filename, "", manifest, error);
   }
 
+  // Returns the value of the numeric header |key| of |headers|, limited to
+  // |max|, or nothing if the header is missing or invalid.
+  static std::optional<uint64_t> GetHeaderAsUint64(
+      const std::map<std::string, std::string>& headers,
+      const std::string& key,
+      uint64_t max);
+
   // Enqueue and run a CleanupPreviousUpdateAction.
   void ScheduleCleanupPreviousUpdate();
 
+  // Schedules the CleanupPreviousUpdateAction once the boot completed, so that
+  // it doesn't compete with the boot. A call to ScheduleCleanupPreviousUpdate()
+  // in the meantime schedules it right away.
+  void ScheduleCleanupPreviousUpdateAfterBoot();
+  void OnBootCompletedChanged();
+
   // Notify and clear |cleanup_previous_update_callbacks_|.
   void NotifyCleanupPreviousUpdateCallbacksAndClear();
 
@@ -244,6 +282,25 @@ class UpdateAttempterAndroid
 
   bool IsProductionBuild();
 
+  // What AllocateSpaceForPayload() computed for a payload, valid as long as
+  // the payload, its metadata file and the target slot are the same.
+  struct PayloadSpaceCache {
+    std::string payload_id;
+    std::string metadata_filename;
+    // The metadata hash header, and the size and modification time of
+    // |metadata_filename|.
+    std::string metadata_hash;
+    int64_t metadata_size{0};
+    base::Time metadata_modified;
+    BootControlInterface::Slot target_slot{BootControlInterface::kInvalidSlot};
+
+    DeltaArchiveManifest manifest;
+    std::vector<ApexInfo> apex_infos;
+    uint64_t apex_size_required{0};
+    // Whether the space was allocated for the payload.
+    bool allocated{false};
+  };
+
   DaemonStateInterface* daemon_state_;
 
   // DaemonStateAndroid pointers.
@@ -267,6 +324,9 @@ class UpdateAttempterAndroid
   // For status:
   UpdateStatus status_{UpdateStatus::IDLE};
   double download_progress_{0.0};
+  // The ratio of the payloads applied, set while they are applied behind the
+  // download, which the progress reported doesn't get ahead of.
+  std::optional<double> apply_progress_;
 
   // The offset in the payload file where the CrAU part starts.
   int64_t base_offset_{0};
@@ -279,6 +339,8 @@ class UpdateAttempterAndroid
   std::unique_ptr<MetricsReporterInterface> metrics_reporter_;
 
   ::android::base::unique_fd payload_fd_;
+  // The socket of a payload streamed through shared memory in |payload_fd_|.
+  ::android::base::unique_fd payload_socket_fd_;
 
   std::vector<std::unique_ptr<CleanupSuccessfulUpdateCallbackInterface>>
       cleanup_previous_update_callbacks_;
@@ -293,7 +355,21 @@ class UpdateAttempterAndroid
   metrics_utils::PersistedValue<int64_t> metric_bytes_downloaded_;
   metrics_utils::PersistedValue<int64_t> metric_total_bytes_downloaded_;
 
-  bool performance_mode_ = false;
+  // Adjusts the resources of the update to the load of the device while it
+  // runs.
+  std::unique_ptr<ThrottleController> throttle_controller_;
+
+  // How the merge of the previous update competes with the foreground.
+  ThrottlePolicy merge_policy_{ThrottlePolicy::kBalanced};
+
+  // Watches sys.boot_completed while the CleanupPreviousUpdateAction is
+  // deferred until the boot completed.
+  PropertyWatcher boot_completed_watcher_;
+
+  std::unique_ptr<PayloadSpaceCache> payload_space_cache_;
+
+  // The trace recorded for the current update, if requested.
+  std::unique_ptr<ApplyTrace> apply_trace_;
 
   DISALLOW_COPY_AND_ASSIGN(UpdateAttempterAndroid);
 };
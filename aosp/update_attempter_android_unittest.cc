@@ -16,7 +16,9 @@
 
 #include "update_engine/aosp/update_attempter_android.h"
 
+#include <map>
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 
@@ -80,6 +82,13 @@ class UpdateAttempterAndroidTest : public ::testing::Test {
         std::move(payload));
   }
 
+  static std::optional<uint64_t> GetHeaderAsUint64(
+      const std::map<std::string, std::string>& headers,
+      const std::string& key,
+      uint64_t max) {
+    return UpdateAttempterAndroid::GetHeaderAsUint64(headers, key, max);
+  }
+
   DaemonStateAndroid daemon_state_;
   FakePrefs prefs_;
   FakeBootControl boot_control_;
@@ -238,6 +247,29 @@ TEST_F(UpdateAttempterAndroidTest, ReportMetricsForBytesDownloaded) {
       0, metrics_utils::GetPersistedValue(kPrefsTotalBytesDownloaded, &prefs_));
 }
 
+TEST_F(UpdateAttempterAndroidTest, GetHeaderAsUint64LimitsValuesTest) {
+  const std::map<std::string, std::string> headers = {
+      {"IN_RANGE", "12"},
+      {"AT_MAX", "64"},
+      {"OUT_OF_RANGE", "100000"},
+      {"OVERFLOW", "100000000000000000000"},
+      {"NEGATIVE", "-1"},
+      {"INVALID", "12threads"},
+      {"EMPTY", ""},
+  };
+  EXPECT_EQ(std::optional<uint64_t>(12),
+            GetHeaderAsUint64(headers, "IN_RANGE", 64));
+  EXPECT_EQ(std::optional<uint64_t>(64),
+            GetHeaderAsUint64(headers, "AT_MAX", 64));
+  EXPECT_EQ(std::optional<uint64_t>(64),
+            GetHeaderAsUint64(headers, "OUT_OF_RANGE", 64));
+  EXPECT_EQ(std::nullopt, GetHeaderAsUint64(headers, "OVERFLOW", 64));
+  EXPECT_EQ(std::nullopt, GetHeaderAsUint64(headers, "NEGATIVE", 64));
+  EXPECT_EQ(std::nullopt, GetHeaderAsUint64(headers, "INVALID", 64));
+  EXPECT_EQ(std::nullopt, GetHeaderAsUint64(headers, "EMPTY", 64));
+  EXPECT_EQ(std::nullopt, GetHeaderAsUint64(headers, "MISSING", 64));
+}
+
 }  // namespace
 
 }  // namespace chromeos_update_engine
@@ -170,6 +170,14 @@ int UpdateEngineClientAndroid::OnInit() {
               "Wait for previous update to merge. "
               "Only available after rebooting to new slot.");
   DEFINE_bool(perf_mode, false, "Enable perf mode.");
+  DEFINE_int32(throttle_policy,
+               -1,
+               "Set the throttle policy: 0 background, 1 balanced, 2 "
+               "performance, 3 charging-idle, 4 factory.");
+  DEFINE_int32(merge_policy,
+               -1,
+               "Set the merge policy: 0 background, 1 balanced, 2 "
+               "performance.");
   // Boilerplate init commands.
   base::CommandLine::Init(argc_, argv_);
   brillo::FlagHelper::Init(argc_, argv_, "Android Update Engine Client");
@@ -297,6 +305,14 @@ int UpdateEngineClientAndroid::OnInit() {
     return ExitWhenIdle(service_->setPerformanceMode(true));
   }
 
+  if (FLAGS_throttle_policy >= 0) {
+    return ExitWhenIdle(service_->setThrottlePolicy(FLAGS_throttle_policy));
+  }
+
+  if (FLAGS_merge_policy >= 0) {
+    return ExitWhenIdle(service_->setMergePolicy(FLAGS_merge_policy));
+  }
+
   if (FLAGS_update) {
     auto and_headers = ParseHeaders(FLAGS_headers);
     Status status = service_->applyPayload(
@@ -160,6 +160,15 @@ bool CertificateChecker::CheckCertificateChange(int preverify_ok,
   // prefs.
   string digest_string = base::HexEncode(digest, digest_length);
 
+  // Every handshake with the server checks the same certificates, the prefs
+  // already hold them.
+  string& checked_digest = checked_digests_[{server_to_check, depth}];
+  if (checked_digest == digest_string) {
+    NotifyCertificateChecked(server_to_check, CertificateCheckResult::kValid);
+    return true;
+  }
+  checked_digest = digest_string;
+
   string storage_key = base::StringPrintf("%s-%d-%d",
                                           kPrefsUpdateServerCertificate,
                                           static_cast<int>(server_to_check),
@@ -20,7 +20,9 @@
 #include <curl/curl.h>
 #include <openssl/ssl.h>
 
+#include <map>
 #include <string>
+#include <utility>
 
 #include <base/macros.h>
 #include <gtest/gtest_prod.h>  // for FRIEND_TEST
@@ -125,6 +127,7 @@ class CertificateChecker {
   FRIEND_TEST(CertificateCheckerTest, SameCertificate);
   FRIEND_TEST(CertificateCheckerTest, ChangedCertificate);
   FRIEND_TEST(CertificateCheckerTest, FailedCertificate);
+  FRIEND_TEST(CertificateCheckerTest, CachedCertificate);
 
   // These callbacks are asynchronously called by openssl after initial SSL
   // verification. They are used to perform any additional security verification
@@ -146,7 +149,8 @@ class CertificateChecker {
   // connection to that same server, specified by |server_to_check|.
   // This is called by the callbacks defined above. The result of the
   // certificate check is passed to the observer, if any. Returns true on
-  // success and false otherwise.
+  // success and false otherwise. The prefs are only accessed the first time a
+  // certificate is seen by this instance.
   bool CheckCertificateChange(int preverify_ok,
                               X509_STORE_CTX* x509_ctx,
                               ServerToCheck server_to_check);
@@ -167,6 +171,10 @@ class CertificateChecker {
   // The observer called whenever a certificate is checked, if not null.
   Observer* observer_{nullptr};
 
+  // The hex digests of the certificates last checked, by server and depth in
+  // the certificate chain, as stored in the prefs.
+  std::map<std::pair<ServerToCheck, int>, std::string> checked_digests_;
+
   DISALLOW_COPY_AND_ASSIGN(CertificateChecker);
 };
 
@@ -122,6 +122,26 @@ TEST_F(CertificateCheckerTest, ChangedCertificate) {
       cert_checker.CheckCertificateChange(1, nullptr, server_to_check_));
 }
 
+// check certificate change, unchanged since the last check
+TEST_F(CertificateCheckerTest, CachedCertificate) {
+  EXPECT_CALL(openssl_wrapper_, GetCertificateDigest(nullptr, _, _, _))
+      .Times(2)
+      .WillRepeatedly(DoAll(SetArgPointee<1>(depth_),
+                            SetArgPointee<2>(length_),
+                            SetArrayArgument<3>(digest_, digest_ + 4),
+                            Return(true)));
+  EXPECT_CALL(prefs_, GetString(cert_key_, _)).WillOnce(Return(false));
+  EXPECT_CALL(prefs_, SetString(cert_key_, digest_hex_)).WillOnce(Return(true));
+  EXPECT_CALL(
+      observer_,
+      CertificateChecked(server_to_check_, CertificateCheckResult::kValid))
+      .Times(2);
+  ASSERT_TRUE(
+      cert_checker.CheckCertificateChange(1, nullptr, server_to_check_));
+  ASSERT_TRUE(
+      cert_checker.CheckCertificateChange(1, nullptr, server_to_check_));
+}
+
 // check certificate change, failed
 TEST_F(CertificateCheckerTest, FailedCertificate) {
   EXPECT_CALL(
@@ -110,11 +110,12 @@ class AbstractAction {
     processor_ = processor;
   }
 
-  // Returns true iff the action is the current action of its ActionProcessor.
+  // Returns true iff the action is one of the actions its ActionProcessor is
+  // processing.
   bool IsRunning() const {
     if (!processor_)
       return false;
-    return processor_->current_action() == this;
+    return processor_->IsActionRunning(this);
   }
 
   // Called on asynchronous actions if canceled. Actions may implement if
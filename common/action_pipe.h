@@ -64,17 +64,18 @@ class ActionPipe {
   // Stores a copy of the passed object in this pipe.
   void set_contents(const ObjectType& contents) { contents_ = contents; }
 
-  // Bonds two Actions together with a new ActionPipe. The ActionPipe is
-  // jointly owned by the two Actions and will be automatically destroyed
-  // when the last Action is destroyed.
-  template <typename FromAction, typename ToAction>
-  static void Bond(FromAction* from, ToAction* to) {
+  // Bonds an Action to one or more Actions with a new ActionPipe, so that all
+  // of them read what |from| outputs. The ActionPipe is jointly owned by the
+  // Actions and will be automatically destroyed when the last Action is
+  // destroyed.
+  template <typename FromAction, typename... ToActions>
+  static void Bond(FromAction* from, ToActions*... to) {
     std::shared_ptr<ActionPipe<ObjectType>> pipe(new ActionPipe<ObjectType>);
     from->set_out_pipe(pipe);
 
-    to->set_in_pipe(pipe);  // If you get an error on this line, then
+    (to->set_in_pipe(pipe), ...);  // If you get an error on this line, then
     // it most likely means that the From object's OutputObjectType is
-    // different from the To object's InputObjectType.
+    // different from a To object's InputObjectType.
   }
 
  private:
@@ -88,14 +89,16 @@ class ActionPipe {
   DISALLOW_COPY_AND_ASSIGN(ActionPipe);
 };
 
-// Utility function
-template <typename FromAction, typename ToAction>
-void BondActions(FromAction* from, ToAction* to) {
+// Utility function. Bonding an Action to several ones lets them all run
+// concurrently on its output once it completed.
+template <typename FromAction, typename... ToActions>
+void BondActions(FromAction* from, ToActions*... to) {
   static_assert(
-      std::is_same<typename FromAction::OutputObjectType,
-                   typename ToAction::InputObjectType>::value,
+      (std::is_same<typename FromAction::OutputObjectType,
+                    typename ToActions::InputObjectType>::value &&
+       ...),
       "FromAction::OutputObjectType doesn't match ToAction::InputObjectType");
-  ActionPipe<typename FromAction::OutputObjectType>::Bond(from, to);
+  ActionPipe<typename FromAction::OutputObjectType>::Bond(from, to...);
 }
 
 }  // namespace chromeos_update_engine
@@ -16,6 +16,7 @@
 
 #include "update_engine/common/action_processor.h"
 
+#include <algorithm>
 #include <string>
 #include <utility>
 
@@ -23,9 +24,11 @@
 
 #include "update_engine/common/action.h"
 #include "update_engine/common/error_code_utils.h"
+#include "update_engine/common/tracing.h"
 
 using std::string;
 using std::unique_ptr;
+using std::vector;
 
 namespace chromeos_update_engine {
 
@@ -35,53 +38,89 @@ ActionProcessor::~ActionProcessor() {
 }
 
 void ActionProcessor::EnqueueAction(unique_ptr<AbstractAction> action) {
+  vector<AbstractAction*> dependencies;
+  for (const auto& running : running_)
+    dependencies.push_back(running.get());
+  for (const auto& queued : actions_)
+    dependencies.push_back(queued.get());
+  EnqueueActionAfter(std::move(action), dependencies);
+}
+
+void ActionProcessor::EnqueueActionAfter(
+    unique_ptr<AbstractAction> action,
+    const vector<AbstractAction*>& dependencies) {
   action->SetProcessor(this);
+  vector<uint64_t> dependency_ids;
+  for (const AbstractAction* dependency : dependencies) {
+    const auto it = ids_.find(dependency);
+    if (it != ids_.end())
+      dependency_ids.push_back(it->second);
+  }
+  const uint64_t id = next_id_++;
+  ids_[action.get()] = id;
+  dependencies_[id] = std::move(dependency_ids);
   actions_.push_back(std::move(action));
 }
 
 bool ActionProcessor::IsRunning() const {
-  return current_action_ != nullptr || suspended_;
+  return !running_.empty() || suspended_;
+}
+
+bool ActionProcessor::IsActionRunning(const AbstractAction* action) const {
+  return std::any_of(
+      running_.begin(), running_.end(), [action](const auto& running) {
+        return running.get() == action;
+      });
 }
 
 void ActionProcessor::StartProcessing() {
   CHECK(!IsRunning());
   if (!actions_.empty()) {
-    current_action_ = std::move(actions_.front());
-    actions_.pop_front();
-    LOG(INFO) << "ActionProcessor: starting " << current_action_->Type();
-    current_action_->PerformAction();
+    done_code_ = ErrorCode::kSuccess;
+    StartReadyActionsOrFinish();
   }
 }
 
 void ActionProcessor::StopProcessing() {
   CHECK(IsRunning());
-  if (current_action_) {
-    current_action_->TerminateProcessing();
+  string types;
+  for (const auto& action : running_) {
+    action->TerminateProcessing();
+    UE_TRACE_ASYNC_END(action->Type().c_str(), action.get());
+    types += (types.empty() ? "" : ", ") + action->Type();
   }
-  LOG(INFO) << "ActionProcessor: aborted "
-            << (current_action_ ? current_action_->Type() : "")
+  LOG(INFO) << "ActionProcessor: aborted " << types
             << (suspended_ ? " while suspended" : "");
-  current_action_.reset();
+  running_.clear();
   suspended_ = false;
   // Delete all the actions before calling the delegate.
   actions_.clear();
+  ids_.clear();
+  dependencies_.clear();
   if (delegate_)
     delegate_->ProcessingStopped(this);
 }
 
 void ActionProcessor::SuspendProcessing() {
-  // No current_action_ when not suspended means that the action processor was
+  // No running actions when not suspended means that the action processor was
   // never started or already finished.
-  if (suspended_ || !current_action_) {
+  if (suspended_ || running_.empty()) {
     LOG(WARNING) << "Called SuspendProcessing while not processing.";
     return;
   }
   suspended_ = true;
 
-  // If there's a current action we should notify it that it should suspend, but
-  // the action can ignore that and terminate at any point.
-  LOG(INFO) << "ActionProcessor: suspending " << current_action_->Type();
-  current_action_->SuspendAction();
+  // We should notify the running actions that they should suspend, but they
+  // can ignore that and terminate at any point, even from SuspendAction().
+  vector<AbstractAction*> running;
+  for (const auto& action : running_)
+    running.push_back(action.get());
+  for (AbstractAction* action : running) {
+    if (IsActionRunning(action)) {
+      LOG(INFO) << "ActionProcessor: suspending " << action->Type();
+      action->SuspendAction();
+    }
+  }
 }
 
 void ActionProcessor::ResumeProcessing() {
@@ -90,58 +129,105 @@ void ActionProcessor::ResumeProcessing() {
     return;
   }
   suspended_ = false;
-  if (current_action_) {
-    // The current_action_ did not call ActionComplete while suspended, so we
-    // should notify it of the resume operation.
-    LOG(INFO) << "ActionProcessor: resuming " << current_action_->Type();
-    current_action_->ResumeAction();
-  } else {
-    // The last action called ActionComplete while suspended, so there is
-    // already a log message with the type of the finished action. We simply
+  if (running_.empty()) {
+    // The last actions called ActionComplete while suspended, so there is
+    // already a log message with the type of the finished actions. We simply
     // state that we are resuming processing and the next function will log the
-    // start of the next action or processing completion.
+    // start of the next actions or processing completion.
     LOG(INFO) << "ActionProcessor: resuming processing";
-    StartNextActionOrFinish(suspended_error_code_);
   }
+  // The running actions did not call ActionComplete while suspended, so we
+  // should notify them of the resume operation. Those completing right away
+  // don't start the next actions before all of them are resumed.
+  vector<AbstractAction*> running;
+  for (const auto& action : running_)
+    running.push_back(action.get());
+  starting_actions_ = true;
+  for (AbstractAction* action : running) {
+    if (IsActionRunning(action)) {
+      LOG(INFO) << "ActionProcessor: resuming " << action->Type();
+      action->ResumeAction();
+    }
+  }
+  starting_actions_ = false;
+  StartReadyActionsOrFinish();
 }
 
 void ActionProcessor::ActionComplete(AbstractAction* actionptr,
                                      ErrorCode code) {
-  CHECK_EQ(actionptr, current_action_.get());
+  CHECK(IsActionRunning(actionptr));
   if (delegate_)
     delegate_->ActionCompleted(this, actionptr, code);
-  string old_type = current_action_->Type();
-  current_action_->ActionCompleted(code);
-  current_action_.reset();
-  LOG(INFO) << "ActionProcessor: finished "
-            << (actions_.empty() ? "last action " : "") << old_type
-            << (suspended_ ? " while suspended" : "") << " with code "
-            << utils::ErrorCodeToString(code);
-  if (!actions_.empty() && code != ErrorCode::kSuccess) {
+  string old_type = actionptr->Type();
+  UE_TRACE_ASYNC_END(old_type.c_str(), actionptr);
+  actionptr->ActionCompleted(code);
+  running_.erase(std::find_if(
+      running_.begin(), running_.end(), [actionptr](const auto& running) {
+        return running.get() == actionptr;
+      }));
+  ids_.erase(actionptr);
+  done_code_ = code;
+  const bool last = actions_.empty() && running_.empty();
+  LOG(INFO) << "ActionProcessor: finished " << (last ? "last action " : "")
+            << old_type << (suspended_ ? " while suspended" : "")
+            << " with code " << utils::ErrorCodeToString(code);
+  if (!last && code != ErrorCode::kSuccess) {
     LOG(INFO) << "ActionProcessor: Aborting processing due to failure.";
+    for (const auto& action : running_) {
+      LOG(INFO) << "ActionProcessor: terminating " << action->Type();
+      action->TerminateProcessing();
+      UE_TRACE_ASYNC_END(action->Type().c_str(), action.get());
+    }
+    running_.clear();
     actions_.clear();
+    ids_.clear();
+    dependencies_.clear();
   }
   if (suspended_) {
-    // If an action finished while suspended we don't start the next action (or
-    // terminate the processing) until the processor is resumed. This condition
-    // will be flagged by a nullptr current_action_ while suspended_ is true.
-    suspended_error_code_ = code;
+    // If an action finished while suspended we don't start the next actions
+    // (or terminate the processing) until the processor is resumed.
     return;
   }
-  StartNextActionOrFinish(code);
+  StartReadyActionsOrFinish();
 }
 
-void ActionProcessor::StartNextActionOrFinish(ErrorCode code) {
-  if (actions_.empty()) {
-    if (delegate_) {
-      delegate_->ProcessingDone(this, code);
+bool ActionProcessor::IsReady(const AbstractAction* action) const {
+  for (uint64_t dependency : dependencies_.at(ids_.at(action))) {
+    if (std::any_of(ids_.begin(), ids_.end(), [dependency](const auto& id) {
+          return id.second == dependency;
+        })) {
+      return false;
     }
+  }
+  return true;
+}
+
+void ActionProcessor::StartReadyActionsOrFinish() {
+  // Actions completing while the others are started are taken care of by the
+  // outermost call.
+  if (starting_actions_)
     return;
+  starting_actions_ = true;
+  while (!suspended_) {
+    const auto it =
+        std::find_if(actions_.begin(), actions_.end(), [this](const auto& a) {
+          return IsReady(a.get());
+        });
+    if (it == actions_.end())
+      break;
+    running_.push_back(std::move(*it));
+    actions_.erase(it);
+    AbstractAction* action = running_.back().get();
+    dependencies_.erase(ids_[action]);
+    LOG(INFO) << "ActionProcessor: starting " << action->Type();
+    UE_TRACE_ASYNC_BEGIN(action->Type().c_str(), action);
+    action->PerformAction();
   }
-  current_action_ = std::move(actions_.front());
-  actions_.pop_front();
-  LOG(INFO) << "ActionProcessor: starting " << current_action_->Type();
-  current_action_->PerformAction();
+  starting_actions_ = false;
+  // The first queued action is always ready once no action runs, since it only
+  // depends on actions enqueued before it.
+  if (running_.empty() && !suspended_ && delegate_)
+    delegate_->ProcessingDone(this, done_code_);
 }
 
 }  // namespace chromeos_update_engine
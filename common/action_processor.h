@@ -17,7 +17,10 @@
 #ifndef UPDATE_ENGINE_COMMON_ACTION_PROCESSOR_H_
 #define UPDATE_ENGINE_COMMON_ACTION_PROCESSOR_H_
 
+#include <stdint.h>
+
 #include <deque>
+#include <map>
 #include <memory>
 #include <vector>
 
@@ -35,7 +38,12 @@
 
 // See action.h for an overview of this class and other Action* classes.
 
-// An ActionProcessor keeps a queue of Actions and processes them in order.
+// An ActionProcessor keeps a queue of Actions and processes them in order. By
+// default each Action waits for all the Actions enqueued before it, but an
+// Action may instead wait only for the Actions it depends on, in which case it
+// runs concurrently with the others once they completed. The Actions and their
+// dependencies form a graph, with no cycles since an Action can only depend on
+// Actions enqueued before it.
 
 namespace chromeos_update_engine {
 
@@ -48,19 +56,19 @@ class ActionProcessor {
 
   virtual ~ActionProcessor();
 
-  // Starts processing the first Action in the queue. If there's a delegate,
-  // when all processing is complete, ProcessingDone() will be called on the
-  // delegate.
+  // Starts processing the Actions in the queue which don't wait for another
+  // one. If there's a delegate, when all processing is complete,
+  // ProcessingDone() will be called on the delegate.
   virtual void StartProcessing();
 
-  // Aborts processing. If an Action is running, it will have
-  // TerminateProcessing() called on it. The Action that was running and all the
-  // remaining actions will be lost and must be re-enqueued if this Processor is
-  // to use it.
+  // Aborts processing. The running Actions will have TerminateProcessing()
+  // called on them. The Actions that were running and all the remaining
+  // actions will be lost and must be re-enqueued if this Processor is to use
+  // them.
   void StopProcessing();
 
-  // Suspend the processing. If an Action is running, it will have the
-  // SuspendProcessing() called on it, and it should suspend operations until
+  // Suspend the processing. The running Actions will have SuspendProcessing()
+  // called on them, and they should suspend operations until
   // ResumeProcessing() is called on this class to continue. While suspended,
   // no new actions will be started. Calling SuspendProcessing while the
   // processing is suspended or not running this method performs no action.
@@ -74,15 +82,29 @@ class ActionProcessor {
   // stopped.
   bool IsRunning() const;
 
-  // Adds another Action to the end of the queue.
+  // Adds another Action to the end of the queue. It starts once all the
+  // Actions enqueued before it completed.
   virtual void EnqueueAction(std::unique_ptr<AbstractAction> action);
 
+  // Adds another Action to the end of the queue, starting as soon as all the
+  // |dependencies| completed, possibly while other Actions are running. The
+  // |dependencies| must have been enqueued before; those which already
+  // completed are ignored.
+  void EnqueueActionAfter(std::unique_ptr<AbstractAction> action,
+                          const std::vector<AbstractAction*>& dependencies);
+
   // Sets/gets the current delegate. Set to null to remove a delegate.
   ActionProcessorDelegate* delegate() const { return delegate_; }
   void set_delegate(ActionProcessorDelegate* delegate) { delegate_ = delegate; }
 
-  // Returns a pointer to the current Action that's processing.
-  AbstractAction* current_action() const { return current_action_.get(); }
+  // Returns a pointer to the current Action that's processing, the one
+  // started first if several are.
+  AbstractAction* current_action() const {
+    return running_.empty() ? nullptr : running_.front().get();
+  }
+
+  // Returns whether |action| is one of the Actions processing.
+  bool IsActionRunning(const AbstractAction* action) const;
 
   // Called by an action to notify processor that it's done. Caller passes self.
   // But this call deletes the action if there no other object has a reference
@@ -92,23 +114,39 @@ class ActionProcessor {
 
  private:
   FRIEND_TEST(ActionProcessorTest, ChainActionsTest);
+  FRIEND_TEST(ActionProcessorTest, ConcurrentActionsTest);
 
-  // Continue processing actions (if any) after the last action terminated with
-  // the passed error code. If there are no more actions to process, the
-  // processing will terminate.
-  void StartNextActionOrFinish(ErrorCode code);
+  // Starts the actions (if any) whose dependencies completed. If there are no
+  // more actions to process, the processing will terminate.
+  void StartReadyActionsOrFinish();
+
+  // Whether none of the dependencies of the queued |action| is queued or
+  // running.
+  bool IsReady(const AbstractAction* action) const;
 
   // Actions that have not yet begun processing, in the order in which
-  // they'll be processed.
+  // they'll be processed when they don't depend on each other.
   std::deque<std::unique_ptr<AbstractAction>> actions_;
 
-  // A pointer to the currently processing Action, if any.
-  std::unique_ptr<AbstractAction> current_action_;
-
-  // The ErrorCode reported by an action that was suspended but finished while
-  // being suspended. This error code is stored here to be reported back to the
-  // delegate once the processor is resumed.
-  ErrorCode suspended_error_code_{ErrorCode::kSuccess};
+  // The currently processing Actions, in the order they were started.
+  std::vector<std::unique_ptr<AbstractAction>> running_;
+
+  // Ids of the queued and running Actions, and the ids of the Actions each
+  // queued one waits for. Ids are never reused, unlike the addresses of the
+  // Actions.
+  std::map<const AbstractAction*, uint64_t> ids_;
+  std::map<uint64_t, std::vector<uint64_t>> dependencies_;
+  uint64_t next_id_{0};
+
+  // The ErrorCode reported to the delegate once all the actions finished: the
+  // code of the first failed action, if any, otherwise of the last one. An
+  // action that finished while the processing was suspended has its code
+  // reported once the processor is resumed.
+  ErrorCode done_code_{ErrorCode::kSuccess};
+
+  // Whether actions are being started, in which case the actions completing
+  // synchronously don't start the next ones.
+  bool starting_actions_{false};
 
   // Whether the action processor is or should be suspended.
   bool suspended_{false};
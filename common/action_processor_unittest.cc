@@ -185,6 +185,69 @@ TEST_F(ActionProcessorTest, ChainActionsTest) {
   EXPECT_FALSE(action_processor_.IsRunning());
 }
 
+TEST_F(ActionProcessorTest, ConcurrentActionsTest) {
+  // This test doesn't use a delegate since it completes several actions.
+  action_processor_.set_delegate(nullptr);
+
+  // |action0| feeds both |action1| and |action2|, which run concurrently
+  // before |action3|.
+  auto action0 = std::make_unique<ActionProcessorTestAction>();
+  auto action1 = std::make_unique<ActionProcessorTestAction>();
+  auto action2 = std::make_unique<ActionProcessorTestAction>();
+  auto action3 = std::make_unique<ActionProcessorTestAction>();
+  auto action0_ptr = action0.get();
+  auto action1_ptr = action1.get();
+  auto action2_ptr = action2.get();
+  auto action3_ptr = action3.get();
+  BondActions(action0_ptr, action1_ptr, action2_ptr);
+  action_processor_.EnqueueAction(std::move(action0));
+  action_processor_.EnqueueActionAfter(std::move(action1), {action0_ptr});
+  action_processor_.EnqueueActionAfter(std::move(action2), {action0_ptr});
+  action_processor_.EnqueueActionAfter(std::move(action3),
+                                       {action1_ptr, action2_ptr});
+
+  action_processor_.StartProcessing();
+  EXPECT_TRUE(action0_ptr->IsRunning());
+  EXPECT_FALSE(action1_ptr->IsRunning());
+  action0_ptr->out_pipe()->set_contents("output");
+  action0_ptr->CompleteAction();
+  EXPECT_TRUE(action1_ptr->IsRunning());
+  EXPECT_TRUE(action2_ptr->IsRunning());
+  EXPECT_FALSE(action3_ptr->IsRunning());
+  EXPECT_EQ(action1_ptr->in_pipe()->contents(), "output");
+  EXPECT_EQ(action2_ptr->in_pipe()->contents(), "output");
+
+  action2_ptr->CompleteAction();
+  EXPECT_EQ(action1_ptr, action_processor_.current_action());
+  EXPECT_FALSE(action3_ptr->IsRunning());
+  action1_ptr->CompleteAction();
+  EXPECT_TRUE(action3_ptr->IsRunning());
+  action3_ptr->CompleteAction();
+  EXPECT_TRUE(action_processor_.actions_.empty());
+  EXPECT_FALSE(action_processor_.IsRunning());
+}
+
+TEST_F(ActionProcessorTest, FailureTerminatesConcurrentActionsTest) {
+  auto mock_action1 = std::make_unique<testing::StrictMock<MockAction>>();
+  auto mock_action1_ptr = mock_action1.get();
+  EXPECT_CALL(*mock_action1, Type()).Times(testing::AnyNumber());
+  action_processor_.EnqueueAction(std::move(mock_action_));
+  action_processor_.EnqueueActionAfter(std::move(mock_action1), {});
+  action_processor_.EnqueueAction(std::move(action_));
+
+  EXPECT_CALL(*mock_action_ptr_, PerformAction());
+  EXPECT_CALL(*mock_action1_ptr, PerformAction());
+  action_processor_.StartProcessing();
+  EXPECT_TRUE(mock_action_ptr_->IsRunning());
+  EXPECT_TRUE(mock_action1_ptr->IsRunning());
+
+  EXPECT_CALL(*mock_action1_ptr, TerminateProcessing());
+  action_processor_.ActionComplete(mock_action_ptr_, ErrorCode::kError);
+  EXPECT_TRUE(delegate_.processing_done_called_);
+  EXPECT_EQ(delegate_.action_exit_code_, ErrorCode::kError);
+  EXPECT_FALSE(action_processor_.IsRunning());
+}
+
 TEST_F(ActionProcessorTest, DefaultDelegateTest) {
   // Just make sure it doesn't crash.
   action_processor_.EnqueueAction(std::move(action_));
@@ -63,6 +63,7 @@ class BootControlInterface {
   // The handling may be different based on whether the partition is included
   // in the update payload. On success, returns true; and stores the block
   // device in |device|, if the partition is dynamic in |is_dynamic|.
+  // It may be called for different partitions from several threads at once.
   virtual bool GetPartitionDevice(const std::string& partition_name,
                                   Slot slot,
                                   bool not_in_payload,
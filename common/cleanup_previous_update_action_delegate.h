@@ -17,6 +17,9 @@
 #ifndef UPDATE_ENGINE_COMMON_CLEANUP_PREVIOUS_UPDATE_ACTION_DELEGETE_H_
 #define UPDATE_ENGINE_COMMON_CLEANUP_PREVIOUS_UPDATE_ACTION_DELEGETE_H_
 
+#include "update_engine/common/merge_telemetry.h"
+#include "update_engine/common/throttle_controller.h"
+
 namespace chromeos_update_engine {
 
 // Delegate interface for CleanupPreviousUpdateAction.
@@ -25,6 +28,11 @@ class CleanupPreviousUpdateActionDelegateInterface {
   virtual ~CleanupPreviousUpdateActionDelegateInterface() {}
   // |progress| is within [0, 1]
   virtual void OnCleanupProgressUpdate(double progress) = 0;
+  // Returns how the merge competes with the foreground for I/O. It is read
+  // again on every check, so that changes apply to a pending merge.
+  virtual ThrottlePolicy GetMergePolicy() { return ThrottlePolicy::kBalanced; }
+  // Called once the action completes after having started a merge.
+  virtual void OnMergeTelemetry(const MergeTelemetry& telemetry) {}
 };
 
 }  // namespace chromeos_update_engine
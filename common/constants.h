@@ -32,6 +32,8 @@ static constexpr const auto& kPowerwashSafePrefsSubDirectory =
 
 // The location where we store the AU preferences (state etc).
 static constexpr const auto& kPrefsSubDirectory = "prefs";
+// The log file of the prefs, when stored by LogPrefs.
+static constexpr const auto& kPrefsLogFile = "prefs.log";
 
 // Path to the stateful partition on the root filesystem.
 static constexpr const auto& kStatefulPartition = "/mnt/stateful_partition";
@@ -100,6 +102,11 @@ static constexpr const auto& kPrefsResumedUpdateFailures =
 static constexpr const auto& kPrefsRollbackHappened = "rollback-happened";
 static constexpr const auto& kPrefsRollbackVersion = "rollback-version";
 static constexpr const auto& kPrefsChannelOnSlotPrefix = "channel-on-slot-";
+static constexpr const auto& kPrefsStoredPayloadId = "stored-payload-id";
+static constexpr const auto& kPrefsStoredPayloadOffset =
+    "stored-payload-offset";
+static constexpr const auto& kPrefsStoredPayloadSHA256Context =
+    "stored-payload-sha-256-context";
 static constexpr const auto& kPrefsSystemUpdatedMarker =
     "system-updated-marker";
 static constexpr const auto& kPrefsTargetVersionAttempt =
@@ -128,20 +135,30 @@ static constexpr const auto& kPrefsUpdateOverCellularTargetSize =
     "update-over-cellular-target-size";
 static constexpr const auto& kPrefsUpdateServerCertificate =
     "update-server-cert";
+static constexpr const auto& kPrefsUpdateStateCheckpoint =
+    "update-state-checkpoint";
 static constexpr const auto& kPrefsUpdateStateNextDataLength =
     "update-state-next-data-length";
 static constexpr const auto& kPrefsUpdateStateNextDataOffset =
     "update-state-next-data-offset";
 static constexpr const auto& kPrefsUpdateStateNextOperation =
     "update-state-next-operation";
+static constexpr const auto& kPrefsUpdateStateOperationsSegment =
+    "update-state-operations-segment";
 static constexpr const auto& kPrefsUpdateStatePayloadIndex =
     "update-state-payload-index";
 static constexpr const auto& kPrefsUpdateStateSHA256Context =
     "update-state-sha-256-context";
+static constexpr const auto& kPrefsUpdateStatePayloadDataSkipped =
+    "update-state-payload-data-skipped";
+static constexpr const auto& kPrefsUpdateStateReorderedOperations =
+    "update-state-reordered-operations";
 static constexpr const auto& kPrefsUpdateStateSignatureBlob =
     "update-state-signature-blob";
 static constexpr const auto& kPrefsUpdateStateSignedSHA256Context =
     "update-state-signed-sha-256-context";
+static constexpr const auto& kPrefsUpdateStateWritePathHashContext =
+    "update-state-write-path-hash-context";
 static constexpr const auto& kPrefsUpdateBootTimestampStart =
     "update-boot-timestamp-start";
 static constexpr const auto& kPrefsUpdateTimestampStart =
@@ -153,7 +170,11 @@ static constexpr const auto& kPrefsWallClockScatteringWaitPeriod =
 static constexpr const auto& kPrefsWallClockStagingWaitPeriod =
     "wall-clock-staging-wait-period";
 static constexpr const auto& kPrefsManifestBytes = "manifest-bytes";
+static constexpr const auto& kPrefsManifestVerified = "manifest-verified";
+static constexpr const auto& kPrefsPayloadApplicable = "payload-applicable";
 static constexpr const auto& kPrefsPreviousSlot = "previous-slot";
+static constexpr const auto& kPrefsVabcCompressionBenchmarks =
+    "vabc-compression-benchmarks";
 
 // Keys used when storing and loading payload properties.
 // These four fields are generated by scripts/brillo_update_payload.
@@ -173,6 +194,11 @@ static constexpr const auto& kPayloadPropertySplDowngrade = "SPL_DOWNGRADE";
 // This can be used to zero-rate OTA traffic by sending it over the correct
 // network.
 static constexpr const auto& kPayloadPropertyNetworkId = "NETWORK_ID";
+// Comma separated network ids to download over at once, e.g. Wi-Fi and
+// Ethernet. The client only lists the networks its metering policy allows.
+// Every download connection goes over one of them in turn, see
+// DOWNLOAD_CONNECTIONS, and the chunks favor the fastest ones.
+static constexpr const auto& kPayloadPropertyNetworkIds = "NETWORK_IDS";
 
 // Proxy URL to use for downloading OTA. This will be forwarded to libcurl
 static constexpr const auto& kPayloadPropertyNetworkProxy = "NETWORK_PROXY";
@@ -180,15 +206,177 @@ static constexpr const auto& kPayloadPropertyNetworkProxy = "NETWORK_PROXY";
 // Set Virtual AB Compression's compression algorithm to "none", but still use
 // userspace snapshots and snapuserd for update installation.
 static constexpr const auto& kPayloadVABCNone = "VABC_NONE";
+// Benchmark the COW compressions on the device and write the COWs with the
+// one best fitting its speed and free space, instead of the payload's.
+static constexpr const auto& kPayloadVabcAutoCompression =
+    "VABC_AUTO_COMPRESSION";
 // Enable/Disable VABC, falls back on plain VAB
 static constexpr const auto& kPayloadDisableVABC = "DISABLE_VABC";
 // Enable multi-threaded compression for VABC
 static constexpr const auto& kPayloadEnableThreading = "ENABLE_THREADING";
 // Enable batched writes for VABC
 static constexpr const auto& kPayloadBatchedWrites = "BATCHED_WRITES";
+// Number of threads used to apply independent operations of a partition
+// concurrently. Values of 0 or 1 keep the default serial apply.
+static constexpr const auto& kPayloadApplyThreads = "APPLY_THREADS";
+// Submit reads and writes of the source and target partitions via io_uring.
+static constexpr const auto& kPayloadUseIoUring = "USE_IO_URING";
+// Number of operations ahead of the current one whose source extents are
+// prefetched into the page cache. 0 disables the read-ahead.
+static constexpr const auto& kPayloadSourcePrefetchOps = "SOURCE_PREFETCH_OPS";
+// Number of threads reading the source of an operation into memory, where it
+// is hashed and then consumed by the operation. 0 reads the source twice.
+static constexpr const auto& kPayloadSourceReadThreads = "SOURCE_READ_THREADS";
+// Maximum number of bytes buffered while applying a bsdiff operation, for the
+// source window and the output chunks. 0 reads and writes through directly.
+static constexpr const auto& kPayloadBsdiffMemoryLimit = "BSDIFF_MEMORY_LIMIT";
+// Bytes of payload blobs and operation buffers held at once while applying the
+// payload, above which operations wait or stream. 0 doesn't limit them.
+static constexpr const auto& kPayloadMemoryBudget = "MEMORY_BUDGET";
+// Number of threads decoding the blocks of REPLACE_BZ operations.
+static constexpr const auto& kPayloadBzipThreads = "BZIP_THREADS";
+// Number of threads recompressing the output blocks of lz4diff operations.
+static constexpr const auto& kPayloadLz4diffThreads = "LZ4DIFF_THREADS";
+// Number of threads decoding the blocks of REPLACE_XZ operations.
+static constexpr const auto& kPayloadXzThreads = "XZ_THREADS";
+// Number of threads decoding the frames of REPLACE_ZSTD operations.
+static constexpr const auto& kPayloadZstdThreads = "ZSTD_THREADS";
+// Number of threads applying the elements of ZUCCHINI operations.
+static constexpr const auto& kPayloadZucchiniThreads = "ZUCCHINI_THREADS";
+// Checkpoint the update progress as a single record instead of one pref per
+// field.
+static constexpr const auto& kPayloadCheckpointRecord = "CHECKPOINT_RECORD";
+// Number of write caches of a target partition, written in the background
+// while the next one fills up.
+static constexpr const auto& kPayloadWriteBehindBuffers =
+    "WRITE_BEHIND_BUFFERS";
+// Size in bytes of the write caches of a target partition, gathering the
+// written extents before they are written out.
+static constexpr const auto& kPayloadWriteCacheSize = "WRITE_CACHE_SIZE";
+// Number of partitions applied at the same time, each by its own thread,
+// behind the payload stream.
+static constexpr const auto& kPayloadConcurrentPartitions =
+    "CONCURRENT_PARTITIONS";
+// Hash the payload on a dedicated thread while it is being applied.
+static constexpr const auto& kPayloadAsyncPayloadHash = "ASYNC_PAYLOAD_HASH";
+// Number of buffers of the partitions read ahead of the hashing, by a
+// dedicated thread, while verifying them. 0 reads and hashes in turn.
+static constexpr const auto& kPayloadVerifyReadAheadBuffers =
+    "VERIFY_READ_AHEAD_BUFFERS";
+// Read the partitions with O_DIRECT while verifying them, bypassing the page
+// cache, when no verity data is written.
+static constexpr const auto& kPayloadVerifyDirectIo = "VERIFY_DIRECT_IO";
+// Number of readers of the COW of each VABC partition hashing it directly,
+// rather than through snapuserd, each decompressing and reading the source
+// of the chunks read ahead on its own thread. 0 reads through snapuserd.
+static constexpr const auto& kPayloadVerifyCowReaders = "VERIFY_COW_READERS";
+// Drop the pages of the partitions read and written from the page cache, so
+// that a background update doesn't evict the pages of the apps in use.
+static constexpr const auto& kPayloadDropPageCache = "DROP_PAGE_CACHE";
+// Number of partitions verified at the same time, by as many threads, when no
+// verity data is written.
+static constexpr const auto& kPayloadVerifyConcurrentPartitions =
+    "VERIFY_CONCURRENT_PARTITIONS";
+// Best-effort I/O priority level, from 0 (highest) to 7, of the threads
+// verifying partitions concurrently.
+static constexpr const auto& kPayloadVerifyIoPriority = "VERIFY_IO_PRIORITY";
+// Number of threads building the verity hash trees.
+static constexpr const auto& kPayloadVerityHashTreeThreads =
+    "VERITY_HASH_TREE_THREADS";
+// Number of threads encoding the verity FEC data, with the vectorized encoder.
+// 0 encodes it with libfec on the verifying thread.
+static constexpr const auto& kPayloadVerityFecThreads = "VERITY_FEC_THREADS";
+// Trust the hash of the target partitions computed while writing them, when
+// the payload writes them in order, instead of reading them back to verify
+// them.
+static constexpr const auto& kPayloadTrustedWritePathHash =
+    "TRUSTED_WRITE_PATH_HASH";
+// Verify the target partitions of delta payloads by reading back only the
+// blocks written by operations other than copies, when the payload has the
+// hashes of the data written by each operation.
+static constexpr const auto& kPayloadTouchedBlocksVerification =
+    "TOUCHED_BLOCKS_VERIFICATION";
+// Verify the source partitions of delta payloads in the background while the
+// payload downloads, and fail as soon as one doesn't match.
+static constexpr const auto& kPayloadEarlySourceVerification =
+    "EARLY_SOURCE_VERIFICATION";
+// Size in bytes of the cache of source blocks read by several operations of a
+// partition. 0 disables it.
+static constexpr const auto& kPayloadSourceCacheSize = "SOURCE_CACHE_SIZE";
+// Size in bytes of the cache of the inflated source of a PUFFDIFF operation,
+// used as far as the memory budget allows. 0 uses 5 MiB.
+static constexpr const auto& kPayloadPuffdiffCacheSize = "PUFFDIFF_CACHE_SIZE";
+// Size in bytes of the source read ahead of bsdiff and puffdiff patches on a
+// background thread, used as far as the memory budget allows. 0 disables it.
+static constexpr const auto& kPayloadSourceReadaheadSize =
+    "SOURCE_READAHEAD_SIZE";
+// Number of postinstall programs run at the same time, each with the partition
+// mounted on its own mount point. 0 or 1 runs them one after another.
+static constexpr const auto& kPayloadPostinstallConcurrency =
+    "POSTINSTALL_CONCURRENCY";
+// Comma separated names of the partitions whose postinstall program must run
+// alone, e.g. because it expects its partition on the default mount point or
+// depends on the programs before it.
+static constexpr const auto& kPayloadSerialPostinstallPartitions =
+    "SERIAL_POSTINSTALL_PARTITIONS";
+// Mount the partitions and run their postinstall programs as soon as they and
+// the partitions before them are verified, while the next ones are verified.
+static constexpr const auto& kPayloadEarlyPostinstall = "EARLY_POSTINSTALL";
+// Download the payload of an http(s) URL to a local file first, resuming
+// across attempts, and apply it from that file once the client lets the
+// update use the most resources, see ThrottlePolicy, e.g. while the device is
+// charging and idle.
+static constexpr const auto& kPayloadDownloadThenApply = "DOWNLOAD_THEN_APPLY";
+
+// Set "MMAP_LOCAL_PAYLOAD=1" to read the payloads of file:// and fd:// URLs
+// through a memory mapping rather than a stream of small reads.
+static constexpr const auto& kPayloadMmapLocalPayload = "MMAP_LOCAL_PAYLOAD";
 
 // Max retry count for download
 static constexpr const auto& kPayloadDownloadRetry = "DOWNLOAD_RETRY";
+// Max number of concurrent connections the payload is downloaded over. The
+// payload is fetched in chunks, reassembled in order; 0 or 1 downloads it over
+// a single connection.
+static constexpr const auto& kPayloadDownloadConnections =
+    "DOWNLOAD_CONNECTIONS";
+// Set "REUSE_CONNECTIONS=1" to keep the download connections and TLS sessions
+// open across the transfers of the range requests, and "HTTP2=1" to negotiate
+// HTTP/2 with the server.
+static constexpr const auto& kPayloadReuseConnections = "REUSE_CONNECTIONS";
+static constexpr const auto& kPayloadHttp2 = "HTTP2";
+// Set "PIPELINE_RANGES=1" to request the next range of the payload over a
+// second connection while the current one is downloading, which saves a round
+// trip per range when only parts of the payload are downloaded.
+static constexpr const auto& kPayloadPipelineRanges = "PIPELINE_RANGES";
+// Number of bytes the received payload data is aggregated into before being
+// applied, e.g. "RECEIVE_BUFFER_SIZE=262144". The default, 0, applies every
+// write of the connection as it arrives. Local payloads read as a stream are
+// read in chunks of this size, 16 KiB by default.
+static constexpr const auto& kPayloadReceiveBufferSize = "RECEIVE_BUFFER_SIZE";
+// Size in bytes of the file on /data the downloaded bytes are staged in, so
+// that the download doesn't wait for the apply. Capped to half of the free
+// space; 0 applies the bytes as they are downloaded.
+static constexpr const auto& kPayloadDownloadStagingSize =
+    "DOWNLOAD_STAGING_SIZE";
+// Minimum size in bytes of the data of the operations whose data downloaded
+// so far is saved on /data, so that a resumed update doesn't download it
+// again, e.g. "OPERATION_DATA_CHECKPOINT_SIZE=16777216". 0 disables it.
+static constexpr const auto& kPayloadOperationDataCheckpointSize =
+    "OPERATION_DATA_CHECKPOINT_SIZE";
+// Set "SKIP_SATISFIED_OPERATIONS=1" to compare the target partitions with the
+// operations of a new attempt before applying them, and skip the operations,
+// and the download of their data when possible, already applied by a previous
+// attempt. Only payloads generated with the destination hashes support it.
+static constexpr const auto& kPayloadSkipSatisfiedOperations =
+    "SKIP_SATISFIED_OPERATIONS";
+// Set "REORDER_OPERATIONS=1" to apply the operations of each partition in an
+// order following their source reads instead of the manifest order, for
+// storage where seeks are expensive. VABC partitions keep the manifest order.
+static constexpr const auto& kPayloadReorderOperations = "REORDER_OPERATIONS";
+// Set "RECORD_APPLY_TRACE=1" on non-production builds to record the chunks of
+// payload received and the latency of the target writes to "apply_trace" in
+// the non-volatile directory, for delta_generator --replay_apply_trace.
+static constexpr const auto& kPayloadRecordApplyTrace = "RECORD_APPLY_TRACE";
 
 // Set "SWITCH_SLOT_ON_REBOOT=0" to skip marking the updated partitions active.
 // The default is 1 (always switch slot if update succeeded).
@@ -16,6 +16,8 @@
 
 #include "update_engine/common/cow_operation_convert.h"
 
+#include <algorithm>
+
 #include <base/logging.h>
 
 #include "update_engine/payload_generator/extent_ranges.h"
@@ -32,6 +34,62 @@ void push_back(std::vector<CowOperation>* converted, const CowOperation& op) {
   }
 }
 
+bool ForEachSourceCopyRun(const InstallOperation& operation,
+                          const ExtentRanges& dst_ranges,
+                          const SourceCopyRunVisitor& visit) {
+  const auto& src_extents = operation.src_extents();
+  const auto& dst_extents = operation.dst_extents();
+  int src_index = 0;
+  int dst_index = 0;
+  uint64_t src_offset = 0;
+  uint64_t dst_offset = 0;
+  while (src_index < src_extents.size() && dst_index < dst_extents.size()) {
+    const Extent& src_extent = src_extents[src_index];
+    const Extent& dst_extent = dst_extents[dst_index];
+    const uint64_t num_blocks =
+        std::min(src_extent.num_blocks() - src_offset,
+                 dst_extent.num_blocks() - dst_offset);
+    const uint64_t src_start = src_extent.start_block() + src_offset;
+    const uint64_t dst_start = dst_extent.start_block() + dst_offset;
+    // The parts of the run in |dst_ranges| are looked up at once, in
+    // logarithmic time, and the gaps between them are the rest.
+    const std::vector<Extent> overlaps = dst_ranges.GetIntersectingExtents(
+        ExtentForRange(dst_start, num_blocks));
+    uint64_t done = 0;
+    for (const Extent& overlap : overlaps) {
+      const uint64_t overlap_offset = overlap.start_block() - dst_start;
+      if (overlap_offset > done && !visit(src_start + done,
+                                          dst_start + done,
+                                          overlap_offset - done,
+                                          false)) {
+        return false;
+      }
+      if (!visit(src_start + overlap_offset,
+                 overlap.start_block(),
+                 overlap.num_blocks(),
+                 true)) {
+        return false;
+      }
+      done = overlap_offset + overlap.num_blocks();
+    }
+    if (num_blocks > done &&
+        !visit(src_start + done, dst_start + done, num_blocks - done, false)) {
+      return false;
+    }
+    src_offset += num_blocks;
+    dst_offset += num_blocks;
+    if (src_offset == src_extent.num_blocks()) {
+      src_index++;
+      src_offset = 0;
+    }
+    if (dst_offset == dst_extent.num_blocks()) {
+      dst_index++;
+      dst_offset = 0;
+    }
+  }
+  return true;
+}
+
 std::vector<CowOperation> ConvertToCowOperations(
     const ::google::protobuf::RepeatedPtrField<
         ::chromeos_update_engine::InstallOperation>& operations,
@@ -69,20 +127,20 @@ std::vector<CowOperation> ConvertToCowOperations(
     if (operation.type() != InstallOperation::SOURCE_COPY) {
       continue;
     }
-    const auto& src_extents = operation.src_extents();
-    const auto& dst_extents = operation.dst_extents();
-    BlockIterator it1{src_extents};
-    BlockIterator it2{dst_extents};
-    while (!it1.is_end() && !it2.is_end()) {
-      const auto src_block = *it1;
-      const auto dst_block = *it2;
-      if (!merge_extents.ContainsBlock(dst_block)) {
-        push_back(&converted,
-                  {CowOperation::CowReplace, src_block, dst_block, 1});
-      }
-      ++it1;
-      ++it2;
-    }
+    ForEachSourceCopyRun(
+        operation,
+        merge_extents,
+        [&converted](uint64_t src_block,
+                     uint64_t dst_block,
+                     uint64_t num_blocks,
+                     bool in_merge_extents) {
+          if (!in_merge_extents) {
+            push_back(
+                &converted,
+                {CowOperation::CowReplace, src_block, dst_block, num_blocks});
+          }
+          return true;
+        });
   }
   return converted;
 }
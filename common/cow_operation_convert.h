@@ -17,10 +17,12 @@
 #ifndef __COW_OPERATION_CONVERT_H
 #define __COW_OPERATION_CONVERT_H
 
+#include <functional>
 #include <vector>
 
 #include <libsnapshot/cow_format.h>
 
+#include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -61,5 +63,17 @@ constexpr bool IsConsecutive(const CowOperation& op1, const CowOperation& op2) {
 
 void push_back(std::vector<CowOperation>* converted, const CowOperation& op);
 
+// Calls |visit| with the runs of blocks of |operation| copying contiguous
+// source blocks to contiguous destination blocks, in the order of the
+// operation's blocks, split where they enter or leave |dst_ranges|. Its
+// arguments are the first source and destination blocks, the number of blocks
+// and whether they are in |dst_ranges|. Stops and returns false as soon as
+// |visit| does.
+using SourceCopyRunVisitor =
+    std::function<bool(uint64_t, uint64_t, uint64_t, bool)>;
+bool ForEachSourceCopyRun(const InstallOperation& operation,
+                          const ExtentRanges& dst_ranges,
+                          const SourceCopyRunVisitor& visit);
+
 }  // namespace chromeos_update_engine
 #endif
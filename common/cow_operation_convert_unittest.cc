@@ -297,4 +297,41 @@ TEST_F(CowOperationConvertTest, CowReplaceDifferenceSrc) {
   VerifyCowMergeOp(cow_ops);
 }
 
+TEST_F(CowOperationConvertTest, SourceCopyRunsSplitAtRanges) {
+  AddOperation(&operations_,
+               InstallOperation::SOURCE_COPY,
+               {{100, 6}, {200, 4}},
+               {{0, 4}, {10, 6}});
+  ExtentRanges ranges;
+  ranges.AddExtent(ExtentForRange(2, 1));
+  ranges.AddExtent(ExtentForRange(12, 10));
+
+  struct Run {
+    uint64_t src_block;
+    uint64_t dst_block;
+    uint64_t num_blocks;
+    bool in_ranges;
+  };
+  std::vector<Run> runs;
+  ASSERT_TRUE(ForEachSourceCopyRun(
+      operations_[0],
+      ranges,
+      [&runs](uint64_t src, uint64_t dst, uint64_t num_blocks, bool in) {
+        runs.push_back({src, dst, num_blocks, in});
+        return true;
+      }));
+  const std::vector<Run> expected = {{100, 0, 2, false},
+                                     {102, 2, 1, true},
+                                     {103, 3, 1, false},
+                                     {104, 10, 2, false},
+                                     {200, 12, 4, true}};
+  ASSERT_EQ(runs.size(), expected.size());
+  for (size_t i = 0; i < runs.size(); i++) {
+    EXPECT_EQ(runs[i].src_block, expected[i].src_block) << i;
+    EXPECT_EQ(runs[i].dst_block, expected[i].dst_block) << i;
+    EXPECT_EQ(runs[i].num_blocks, expected[i].num_blocks) << i;
+    EXPECT_EQ(runs[i].in_ranges, expected[i].in_ranges) << i;
+  }
+}
+
 }  // namespace chromeos_update_engine
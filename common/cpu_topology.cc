@@ -0,0 +1,166 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/cpu_topology.h"
+
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+#include <base/files/file_enumerator.h>
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_util.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr char kSysfsCpuDir[] = "/sys/devices/system/cpu";
+
+std::atomic<CpuPlacement> worker_placement{CpuPlacement::kAny};
+// Incremented with every change of |worker_placement|, for the workers to
+// apply it once. Workers start at 0, placed as their creator.
+std::atomic<uint64_t> placement_generation{0};
+thread_local uint64_t thread_placement_generation = 0;
+
+bool ReadUint64(const base::FilePath& path, uint64_t* value) {
+  std::string content;
+  return base::ReadFileToString(path, &content) &&
+         base::StringToUint64(
+             base::TrimWhitespaceASCII(content, base::TRIM_ALL), value);
+}
+
+// The topology doesn't change while update_engine runs; CPUs going offline
+// are left out of the affinity by the kernel.
+const std::map<int, uint64_t>& GetCpuCapacities() {
+  static const std::map<int, uint64_t> capacities =
+      ReadCpuCapacities(kSysfsCpuDir);
+  return capacities;
+}
+}  // namespace
+
+const char* CpuPlacementToString(CpuPlacement placement) {
+  switch (placement) {
+    case CpuPlacement::kAny:
+      return "any";
+    case CpuPlacement::kEfficiency:
+      return "efficiency";
+    case CpuPlacement::kPerformance:
+      return "performance";
+  }
+  return "unknown";
+}
+
+std::map<int, uint64_t> ReadCpuCapacities(const std::string& sysfs_cpu_dir) {
+  std::map<int, uint64_t> capacities;
+  std::map<int, uint64_t> frequencies;
+  bool has_capacities = true;
+  bool has_frequencies = true;
+  base::FileEnumerator cpus(base::FilePath(sysfs_cpu_dir),
+                            false,
+                            base::FileEnumerator::DIRECTORIES,
+                            "cpu*");
+  for (base::FilePath cpu = cpus.Next(); !cpu.empty(); cpu = cpus.Next()) {
+    // Skips cpufreq, cpuidle and the like.
+    int index = 0;
+    if (!base::StringToInt(cpu.BaseName().value().substr(3), &index)) {
+      continue;
+    }
+    uint64_t value = 0;
+    if (ReadUint64(cpu.Append("cpu_capacity"), &value)) {
+      capacities[index] = value;
+    } else {
+      has_capacities = false;
+    }
+    if (ReadUint64(cpu.Append("cpufreq/cpuinfo_max_freq"), &value)) {
+      frequencies[index] = value;
+    } else {
+      has_frequencies = false;
+    }
+  }
+  if (has_capacities && !capacities.empty()) {
+    return capacities;
+  }
+  if (has_frequencies) {
+    return frequencies;
+  }
+  return {};
+}
+
+std::vector<int> SelectCpus(const std::map<int, uint64_t>& capacities,
+                            CpuPlacement placement) {
+  uint64_t min_capacity = std::numeric_limits<uint64_t>::max();
+  uint64_t max_capacity = 0;
+  for (const auto& [cpu, capacity] : capacities) {
+    min_capacity = std::min(min_capacity, capacity);
+    max_capacity = std::max(max_capacity, capacity);
+  }
+  const bool uniform = min_capacity >= max_capacity;
+  std::vector<int> cpus;
+  for (const auto& [cpu, capacity] : capacities) {
+    if (placement == CpuPlacement::kAny || uniform ||
+        (placement == CpuPlacement::kEfficiency) ==
+            (capacity == min_capacity)) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+void SetWorkerCpuPlacement(CpuPlacement placement) {
+  if (worker_placement.exchange(placement) != placement) {
+    LOG(INFO) << "Placing the worker threads on "
+              << CpuPlacementToString(placement) << " cores.";
+    placement_generation++;
+  }
+}
+
+CpuPlacement GetWorkerCpuPlacement() {
+  return worker_placement;
+}
+
+void PlaceWorkerThread() {
+  const uint64_t generation = placement_generation;
+  if (generation == thread_placement_generation) {
+    return;
+  }
+  thread_placement_generation = generation;
+  const std::vector<int> cpus =
+      SelectCpus(GetCpuCapacities(), worker_placement);
+  if (cpus.empty()) {
+    return;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  // Fails if the cgroups of the process allow none of the CPUs, in which
+  // case the thread stays where it is.
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+    PLOG(WARNING) << "Failed to place the thread on "
+                  << CpuPlacementToString(worker_placement) << " cores";
+  }
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,66 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_COMMON_CPU_TOPOLOGY_H_
+#define UPDATE_ENGINE_COMMON_CPU_TOPOLOGY_H_
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace chromeos_update_engine {
+
+// The CPUs the worker threads of the parallel stages run on, on devices with
+// cores of different capacities (big.LITTLE).
+enum class CpuPlacement {
+  // Wherever the scheduler and the cgroups put them.
+  kAny,
+  // The cores of the lowest capacity only.
+  kEfficiency,
+  // Every core but those of the lowest capacity.
+  kPerformance,
+};
+
+const char* CpuPlacementToString(CpuPlacement placement);
+
+// Returns the capacity of every CPU under |sysfs_cpu_dir|, normally
+// /sys/devices/system/cpu, keyed by CPU number. The scheduler's cpu_capacity
+// is used if every CPU has it, otherwise the maximum cpufreq frequency. Empty
+// if neither is available for every CPU.
+std::map<int, uint64_t> ReadCpuCapacities(const std::string& sysfs_cpu_dir);
+
+// Returns the CPUs of |capacities| matching |placement|, all of them for
+// kAny or when they all have the same capacity.
+std::vector<int> SelectCpus(const std::map<int, uint64_t>& capacities,
+                            CpuPlacement placement);
+
+// Sets the placement of the worker threads of the whole process. This is
+// process wide, like the thread limit of ParallelOperationApplier, and set
+// along with the throttle policy, see ThrottleActuatorAndroid.
+void SetWorkerCpuPlacement(CpuPlacement placement);
+CpuPlacement GetWorkerCpuPlacement();
+
+// Moves the calling worker thread to the CPUs of the current placement if it
+// changed since the thread last called it, and is cheap otherwise, so that
+// workers call it before every unit of work. Threads which never call it keep
+// the affinity of the thread which created them.
+void PlaceWorkerThread();
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_CPU_TOPOLOGY_H_
@@ -0,0 +1,83 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/cpu_topology.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+bool WriteCpuFile(const base::FilePath& dir,
+                  int cpu,
+                  const std::string& name,
+                  const std::string& value) {
+  const base::FilePath path =
+      dir.Append("cpu" + std::to_string(cpu)).Append(name);
+  return base::CreateDirectory(path.DirName()) &&
+         base::WriteFile(path, value.data(), value.size()) ==
+             static_cast<int>(value.size());
+}
+}  // namespace
+
+TEST(CpuTopologyTest, ReadCpuCapacitiesTest) {
+  base::ScopedTempDir sysfs_dir;
+  ASSERT_TRUE(sysfs_dir.CreateUniqueTempDir());
+  const base::FilePath dir = sysfs_dir.GetPath();
+  ASSERT_TRUE(base::CreateDirectory(dir.Append("cpufreq")));
+  ASSERT_TRUE(WriteCpuFile(dir, 0, "cpufreq/cpuinfo_max_freq", "1800000\n"));
+  ASSERT_TRUE(WriteCpuFile(dir, 1, "cpufreq/cpuinfo_max_freq", "1800000\n"));
+  ASSERT_TRUE(WriteCpuFile(dir, 2, "cpufreq/cpuinfo_max_freq", "2800000\n"));
+  // Without the capacity of every CPU, the frequencies are used.
+  ASSERT_TRUE(WriteCpuFile(dir, 0, "cpu_capacity", "160\n"));
+  std::map<int, uint64_t> expected{{0, 1800000}, {1, 1800000}, {2, 2800000}};
+  EXPECT_EQ(expected, ReadCpuCapacities(dir.value()));
+
+  ASSERT_TRUE(WriteCpuFile(dir, 1, "cpu_capacity", "160\n"));
+  ASSERT_TRUE(WriteCpuFile(dir, 2, "cpu_capacity", "1024\n"));
+  expected = {{0, 160}, {1, 160}, {2, 1024}};
+  EXPECT_EQ(expected, ReadCpuCapacities(dir.value()));
+
+  ASSERT_TRUE(base::CreateDirectory(dir.Append("cpu3")));
+  EXPECT_TRUE(ReadCpuCapacities(dir.value()).empty());
+}
+
+TEST(CpuTopologyTest, SelectCpusTest) {
+  const std::map<int, uint64_t> capacities{
+      {0, 160}, {1, 160}, {2, 512}, {3, 1024}};
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 3}),
+            SelectCpus(capacities, CpuPlacement::kAny));
+  EXPECT_EQ(std::vector<int>({0, 1}),
+            SelectCpus(capacities, CpuPlacement::kEfficiency));
+  EXPECT_EQ(std::vector<int>({2, 3}),
+            SelectCpus(capacities, CpuPlacement::kPerformance));
+
+  const std::map<int, uint64_t> uniform{{0, 1024}, {1, 1024}};
+  EXPECT_EQ(std::vector<int>({0, 1}),
+            SelectCpus(uniform, CpuPlacement::kEfficiency));
+  EXPECT_EQ(std::vector<int>({0, 1}),
+            SelectCpus(uniform, CpuPlacement::kPerformance));
+  EXPECT_TRUE(SelectCpus({}, CpuPlacement::kPerformance).empty());
+}
+
+}  // namespace chromeos_update_engine
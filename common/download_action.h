@@ -21,19 +21,34 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <atomic>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
+#include <vector>
+
+#include <brillo/message_loops/message_loop.h>
 
 #include "update_engine/common/boot_control_interface.h"
 #include "update_engine/common/http_fetcher.h"
 #include "update_engine/common/multi_range_http_fetcher.h"
 #include "update_engine/payload_consumer/delta_performer.h"
 #include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/payload_staging_ring.h"
+#include "update_engine/payload_consumer/progress_counter.h"
 
 // The Download Action downloads a specified url to disk. The url should point
 // to an update in a delta payload format. The payload will be piped into a
 // DeltaPerformer that will apply the delta to the disk.
+//
+// When the install plan sets a |download_staging_size|, the downloaded bytes
+// are staged in a ring file in the non-volatile directory and applied by a
+// dedicated thread, so that the download runs at the speed of the network
+// while the payload is applied at its own speed. The download only waits
+// for the apply when the ring is full. The resume checkpoints still only
+// cover the applied operations: the bytes staged but not applied yet when
+// the update is interrupted are downloaded again when it resumes.
 
 namespace chromeos_update_engine {
 
@@ -55,6 +70,11 @@ class DownloadActionDelegate {
   // canceled.
   virtual bool ShouldCancel(ErrorCode* cancel_reason) = 0;
 
+  // Called periodically while the downloaded bytes are staged and applied
+  // behind the download, with |progress| the ratio of all the payloads
+  // applied so far.
+  virtual void ApplyProgress(double progress) {}
+
   // Called once the complete payload has been downloaded. Note that any errors
   // while applying or downloading the partial payload will result in this
   // method not being called.
@@ -110,6 +130,12 @@ class DownloadAction : public InstallPlanAction, public HttpFetcherDelegate {
 
   HttpFetcher* http_fetcher() { return http_fetcher_.get(); }
 
+  // Takes ownership of |prefetch_fetcher|, used to request the next range of
+  // the payload while the current one is downloading.
+  void set_prefetch_fetcher(HttpFetcher* prefetch_fetcher) {
+    http_fetcher_->set_prefetch_fetcher(prefetch_fetcher);
+  }
+
  private:
   // Attempt to load cached manifest data from prefs
   // return true on success, false otherwise.
@@ -118,6 +144,26 @@ class DownloadAction : public InstallPlanAction, public HttpFetcherDelegate {
   // Start downloading the current payload using delta_performer.
   void StartDownloading();
 
+  // Starts applying the staged bytes on |apply_thread_|, if the install plan
+  // asks for staging and the space is available.
+  void StartStaging();
+  void ApplyStagedBytes();
+  // Stops the apply thread and drops the bytes staged.
+  void StopStaging();
+  // Waits for the apply thread to drain the ring after the end of the
+  // transfer, then completes it.
+  void WaitForStagedBytes(bool successful);
+  // Reports the ratio |fraction| of the current payload applied.
+  void ReportApplyProgress(double fraction);
+
+  // Completes the action once the payload was downloaded and applied, with
+  // |code| the error of the download or of the apply.
+  void FinishTransfer(ErrorCode code);
+
+  // Downloads the rest of the payload as the |sparse_ranges_| asked by
+  // |delta_performer_|, once the previous transfer terminated.
+  void StartSparseTransfer();
+
   // Pointer to the current payload in install_plan_.payloads.
   InstallPlan::Payload* payload_{nullptr};
 
@@ -156,6 +202,23 @@ class DownloadAction : public InstallPlanAction, public HttpFetcherDelegate {
   // The path to the zip file with X509 certificates.
   const std::string update_certificates_path_;
 
+  // Set while the downloaded bytes are staged, see StartStaging(). Only
+  // |apply_thread_| uses |delta_performer_| while it runs.
+  std::unique_ptr<PayloadStagingRing> staging_ring_;
+  std::thread apply_thread_;
+  std::atomic<bool> apply_done_{false};
+  std::atomic<ErrorCode> apply_error_{ErrorCode::kSuccess};
+  // Samples the apply progress of |delta_performer_| while it is staged.
+  std::unique_ptr<ProgressSampler> apply_progress_sampler_;
+  brillo::MessageLoop::TaskId staging_wait_task_{
+      brillo::MessageLoop::kTaskIdNull};
+
+  // The ranges of the payload to download once the current transfer
+  // terminated, see DeltaPerformer::TakeSparseDownloadRanges().
+  std::vector<std::pair<uint64_t, uint64_t>> sparse_ranges_;
+  brillo::MessageLoop::TaskId sparse_transfer_task_{
+      brillo::MessageLoop::kTaskIdNull};
+
   DISALLOW_COPY_AND_ASSIGN(DownloadAction);
 };
 
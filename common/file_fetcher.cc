@@ -16,13 +16,20 @@
 
 #include "update_engine/common/file_fetcher.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <limits>
 #include <string>
 
 #include <base/bind.h>
 #include <base/format_macros.h>
 #include <base/location.h>
 #include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
 #include <brillo/streams/file_stream.h>
@@ -30,11 +37,19 @@
 #include "update_engine/common/hardware_interface.h"
 #include "update_engine/common/platform_constants.h"
 
+using brillo::MessageLoop;
 using std::string;
 
 namespace {
 
-size_t kReadBufferSize = 16 * 1024;
+// Calls madvise() on the pages holding the |size| bytes at |data|.
+void Advise(const uint8_t* data, size_t size, int advice) {
+  static const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(data);
+  const uintptr_t page_begin = begin / page_size * page_size;
+  madvise(reinterpret_cast<void*>(page_begin), begin - page_begin + size,
+          advice);
+}
 
 }  // namespace
 
@@ -73,17 +88,28 @@ void FileFetcher::BeginTransfer(const string& url) {
   if (base::StartsWith(url, "fd://", base::CompareCase::INSENSITIVE_ASCII)) {
     int fd = std::stoi(url.substr(strlen("fd://")));
     file_path = url;
-    stream_ = brillo::FileStream::FromFileDescriptor(fd, false, nullptr);
+    if (!use_mmap_ || !MapFile(fd))
+      stream_ = brillo::FileStream::FromFileDescriptor(fd, false, nullptr);
   } else {
     file_path = url.substr(strlen("file://"));
-    stream_ =
-        brillo::FileStream::Open(base::FilePath(file_path),
-                                 brillo::Stream::AccessMode::READ,
-                                 brillo::FileStream::Disposition::OPEN_EXISTING,
-                                 nullptr);
+    if (use_mmap_) {
+      int fd = HANDLE_EINTR(open(file_path.c_str(), O_RDONLY | O_CLOEXEC));
+      if (fd >= 0) {
+        // The mapping stays valid once the file is closed.
+        MapFile(fd);
+        IGNORE_EINTR(close(fd));
+      }
+    }
+    if (!mapping_) {
+      stream_ = brillo::FileStream::Open(
+          base::FilePath(file_path),
+          brillo::Stream::AccessMode::READ,
+          brillo::FileStream::Disposition::OPEN_EXISTING,
+          nullptr);
+    }
   }
 
-  if (!stream_) {
+  if (!stream_ && !mapping_) {
     LOG(ERROR) << "Couldn't open " << file_path;
     http_response_code_ = kHttpResponseNotFound;
     CleanUp();
@@ -93,7 +119,7 @@ void FileFetcher::BeginTransfer(const string& url) {
   }
   http_response_code_ = kHttpResponseOk;
 
-  if (offset_)
+  if (offset_ && stream_)
     stream_->SetPosition(offset_, nullptr);
   bytes_copied_ = 0;
   transfer_in_progress_ = true;
@@ -112,7 +138,17 @@ void FileFetcher::ScheduleRead() {
   if (transfer_paused_ || ongoing_read_ || !transfer_in_progress_)
     return;
 
-  buffer_.resize(kReadBufferSize);
+  if (mapping_) {
+    if (mapped_read_task_ == MessageLoop::kTaskIdNull) {
+      mapped_read_task_ = MessageLoop::current()->PostTask(
+          FROM_HERE,
+          base::Bind(&FileFetcher::OnMappedReadCallback,
+                     base::Unretained(this)));
+    }
+    return;
+  }
+
+  buffer_.resize(read_size_);
   size_t bytes_to_read = buffer_.size();
   if (data_length_ >= 0) {
     bytes_to_read = std::min(static_cast<uint64_t>(bytes_to_read),
@@ -161,6 +197,63 @@ void FileFetcher::OnReadErrorCallback(const brillo::Error* error) {
     delegate_->TransferComplete(this, false);
 }
 
+bool FileFetcher::MapFile(int fd) {
+  struct stat st {};
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    return false;
+  const uint64_t file_size = st.st_size;
+  if (offset_ >= file_size)
+    return false;
+  uint64_t length = file_size - offset_;
+  if (data_length_ >= 0)
+    length = std::min(length, static_cast<uint64_t>(data_length_));
+  const uint64_t page_size = sysconf(_SC_PAGESIZE);
+  const uint64_t map_offset = offset_ / page_size * page_size;
+  const uint64_t map_size = offset_ - map_offset + length;
+  if (length == 0 || map_size > std::numeric_limits<size_t>::max())
+    return false;
+  void* mapping =
+      mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, map_offset);
+  if (mapping == MAP_FAILED) {
+    PLOG(WARNING) << "Failed to map the file, reading it instead";
+    return false;
+  }
+  madvise(mapping, map_size, MADV_SEQUENTIAL);
+  mapping_ = mapping;
+  mapping_size_ = map_size;
+  mapped_data_ = static_cast<const uint8_t*>(mapping) + (offset_ - map_offset);
+  mapped_length_ = length;
+  return true;
+}
+
+void FileFetcher::OnMappedReadCallback() {
+  mapped_read_task_ = MessageLoop::kTaskIdNull;
+  if (transfer_paused_ || !transfer_in_progress_)
+    return;
+  const uint64_t remaining = mapped_length_ - bytes_copied_;
+  if (remaining == 0) {
+    CleanUp();
+    if (delegate_)
+      delegate_->TransferComplete(this, true);
+    return;
+  }
+  const uint8_t* slice = mapped_data_ + bytes_copied_;
+  const size_t size = std::min<uint64_t>(kMappedSliceSize, remaining);
+  // The previous slice was consumed, and the next one is read ahead while
+  // this one is processed.
+  if (bytes_copied_ > 0)
+    Advise(slice - kMappedSliceSize, kMappedSliceSize, MADV_DONTNEED);
+  if (size < remaining) {
+    Advise(slice + size,
+           std::min<uint64_t>(kMappedSliceSize, remaining - size),
+           MADV_WILLNEED);
+  }
+  bytes_copied_ += size;
+  if (delegate_ && !delegate_->ReceivedBytes(this, slice, size))
+    return;
+  ScheduleRead();
+}
+
 void FileFetcher::Pause() {
   if (transfer_paused_) {
     LOG(ERROR) << "Fetcher already paused.";
@@ -189,6 +282,18 @@ void FileFetcher::CleanUp() {
   ongoing_read_ = false;
   buffer_ = brillo::Blob();
 
+  if (mapped_read_task_ != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(mapped_read_task_);
+    mapped_read_task_ = MessageLoop::kTaskIdNull;
+  }
+  if (mapping_) {
+    munmap(mapping_, mapping_size_);
+    mapping_ = nullptr;
+    mapping_size_ = 0;
+    mapped_data_ = nullptr;
+    mapped_length_ = 0;
+  }
+
   transfer_in_progress_ = false;
   transfer_paused_ = false;
 }
@@ -18,15 +18,43 @@
 
 #include <fcntl.h>
 
+#include <utility>
+
 #include <base/logging.h>
 #include <base/posix/eintr_wrapper.h>
 
+#include "update_engine/common/simd_utils.h"
 #include "update_engine/common/utils.h"
 
 using std::string;
 
 namespace chromeos_update_engine {
 
+namespace {
+
+// The context is made of a version byte, the 8 words of the hash state and
+// the number of bytes hashed, big endian, then the bytes of the last partial
+// block which are yet to be hashed.
+constexpr uint8_t kContextVersion = 1;
+constexpr size_t kContextHeaderSize =
+    1 + 8 * sizeof(uint32_t) + sizeof(uint64_t);
+
+void PutBE(uint64_t value, size_t size, uint8_t* out) {
+  for (size_t i = 0; i < size; i++) {
+    out[i] = static_cast<uint8_t>(value >> (8 * (size - 1 - i)));
+  }
+}
+
+uint64_t GetBE(const uint8_t* data, size_t size) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < size; i++) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
+
+}  // namespace
+
 HashCalculator::HashCalculator() : valid_(false) {
   valid_ = (SHA256_Init(&ctx_) == 1);
   LOG_IF(ERROR, !valid_) << "SHA256_Init failed";
@@ -95,6 +123,33 @@ bool HashCalculator::RawHashOfData(const brillo::Blob& data,
   return RawHashOfBytes(data.data(), data.size(), out_hash);
 }
 
+bool HashCalculator::RawHashOfBatch(const std::vector<std::string_view>& inputs,
+                                    std::vector<brillo::Blob>* out_hashes) {
+  std::vector<const uint8_t*> data(inputs.size());
+  std::vector<size_t> sizes(inputs.size());
+  for (size_t i = 0; i < inputs.size(); i++) {
+    data[i] = reinterpret_cast<const uint8_t*>(inputs[i].data());
+    sizes[i] = inputs[i].size();
+  }
+  brillo::Blob digests(inputs.size() * simd_utils::kSha256DigestSize);
+  if (simd_utils::Sha256MultiBuffer(
+          inputs.size(), data.data(), sizes.data(), digests.data())) {
+    out_hashes->resize(inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+      const auto digest = digests.begin() + i * simd_utils::kSha256DigestSize;
+      (*out_hashes)[i].assign(digest, digest + simd_utils::kSha256DigestSize);
+    }
+    return true;
+  }
+  std::vector<brillo::Blob> hashes(inputs.size());
+  for (size_t i = 0; i < inputs.size(); i++) {
+    TEST_AND_RETURN_FALSE(
+        RawHashOfBytes(inputs[i].data(), inputs[i].size(), &hashes[i]));
+  }
+  *out_hashes = std::move(hashes);
+  return true;
+}
+
 bool HashCalculator::RawHashOfFile(const string& name, brillo::Blob* out_hash) {
   const auto file_size = utils::FileSize(name);
   return RawHashOfFile(name, file_size, out_hash) == file_size;
@@ -116,12 +171,50 @@ off_t HashCalculator::RawHashOfFile(const string& name,
 }
 
 string HashCalculator::GetContext() const {
-  return string(reinterpret_cast<const char*>(&ctx_), sizeof(ctx_));
+  uint8_t buffer[kMaxContextSize];
+  const size_t size = GetContext(buffer, sizeof(buffer));
+  return string(reinterpret_cast<const char*>(buffer), size);
 }
 
-bool HashCalculator::SetContext(const string& context) {
-  TEST_AND_RETURN_FALSE(context.size() == sizeof(ctx_));
-  memcpy(&ctx_, context.data(), sizeof(ctx_));
+size_t HashCalculator::GetContext(uint8_t* buffer, size_t size) const {
+  const size_t context_size = kContextHeaderSize + ctx_.num;
+  if (size < context_size) {
+    return 0;
+  }
+  buffer[0] = kContextVersion;
+  for (size_t i = 0; i < 8; i++) {
+    PutBE(ctx_.h[i], sizeof(uint32_t), buffer + 1 + i * sizeof(uint32_t));
+  }
+  // OpenSSL counts the bits hashed.
+  const uint64_t bits = (static_cast<uint64_t>(ctx_.Nh) << 32) | ctx_.Nl;
+  PutBE(bits / 8, sizeof(uint64_t), buffer + 1 + 8 * sizeof(uint32_t));
+  memcpy(buffer + kContextHeaderSize, ctx_.data, ctx_.num);
+  return context_size;
+}
+
+bool HashCalculator::SetContext(std::string_view context) {
+  if (context.size() == sizeof(ctx_)) {
+    // The raw hash state checkpointed by an older version.
+    memcpy(&ctx_, context.data(), sizeof(ctx_));
+    return true;
+  }
+  const auto data = reinterpret_cast<const uint8_t*>(context.data());
+  TEST_AND_RETURN_FALSE(context.size() >= kContextHeaderSize &&
+                        data[0] == kContextVersion);
+  const uint64_t bytes =
+      GetBE(data + 1 + 8 * sizeof(uint32_t), sizeof(uint64_t));
+  const size_t num = context.size() - kContextHeaderSize;
+  TEST_AND_RETURN_FALSE(num < SHA256_CBLOCK && bytes % SHA256_CBLOCK == num);
+  SHA256_CTX ctx;
+  TEST_AND_RETURN_FALSE(SHA256_Init(&ctx) == 1);
+  for (size_t i = 0; i < 8; i++) {
+    ctx.h[i] = GetBE(data + 1 + i * sizeof(uint32_t), sizeof(uint32_t));
+  }
+  ctx.Nl = static_cast<uint32_t>(bytes * 8);
+  ctx.Nh = static_cast<uint32_t>((bytes * 8) >> 32);
+  memcpy(ctx.data, data + kContextHeaderSize, num);
+  ctx.num = num;
+  ctx_ = ctx;
   return true;
 }
 
@@ -21,6 +21,7 @@
 #include <unistd.h>
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <base/logging.h>
@@ -59,14 +60,24 @@ class HashCalculator {
     return raw_hash_;
   }
 
+  // The size of the largest context returned by GetContext().
+  static constexpr size_t kMaxContextSize = 1 + 8 * 4 + 8 + SHA256_CBLOCK - 1;
+
   // Gets the current hash context. Note that the string will contain binary
-  // data (including \0 characters).
+  // data (including \0 characters). The context is versioned and doesn't
+  // depend on the layout of the OpenSSL hash state.
   std::string GetContext() const;
 
+  // Writes the current hash context to |buffer|, which can hold |size| bytes,
+  // without allocating. Returns the size of the context, or 0 if |buffer| is
+  // too small, which can't happen when it holds kMaxContextSize bytes.
+  size_t GetContext(uint8_t* buffer, size_t size) const;
+
   // Sets the current hash context. |context| must the string returned by a
-  // previous HashCalculator::GetContext method call. Returns true on success,
-  // and false otherwise.
-  bool SetContext(const std::string& context);
+  // previous HashCalculator::GetContext method call, or the raw OpenSSL hash
+  // state older versions returned. Returns true on success, and false
+  // otherwise.
+  bool SetContext(std::string_view context);
 
   static bool RawHashOfBytes(const void* data,
                              size_t length,
@@ -76,6 +87,11 @@ class HashCalculator {
                              off_t length,
                              brillo::Blob* out_hash);
   static bool RawHashOfFile(const std::string& name, brillo::Blob* out_hash);
+  // Sets |out_hashes| to the raw hash of each of |inputs|. Hashes several
+  // inputs at once with SIMD instructions when that is faster on this CPU,
+  // which pays off for many small inputs such as blocks.
+  static bool RawHashOfBatch(const std::vector<std::string_view>& inputs,
+                             std::vector<brillo::Blob>* out_hashes);
   static std::string SHA256Digest(std::string_view blob);
 
   static std::string SHA256Digest(std::vector<unsigned char> blob);
@@ -77,6 +77,54 @@ TEST_F(HashCalculatorTest, ContextTest) {
   EXPECT_EQ(raw_hash, calc_next.raw_hash());
 }
 
+TEST_F(HashCalculatorTest, CompactContextTest) {
+  const string data(1000, 'x');
+  brillo::Blob expected;
+  ASSERT_TRUE(HashCalculator::RawHashOfBytes(data.data(), data.size(),
+                                             &expected));
+  // Resume after partial and complete blocks.
+  for (const size_t split : {0, 1, 63, 64, 65, 500}) {
+    HashCalculator calc;
+    ASSERT_TRUE(calc.Update(data.data(), split));
+    uint8_t context[HashCalculator::kMaxContextSize];
+    const size_t size = calc.GetContext(context, sizeof(context));
+    ASSERT_GT(size, 0u);
+    EXPECT_EQ(size, calc.GetContext().size());
+    EXPECT_EQ(0u, calc.GetContext(context, size - 1));
+
+    HashCalculator calc_next;
+    ASSERT_TRUE(calc_next.SetContext(
+        std::string_view(reinterpret_cast<const char*>(context), size)));
+    ASSERT_TRUE(calc_next.Update(data.data() + split, data.size() - split));
+    ASSERT_TRUE(calc_next.Finalize());
+    EXPECT_EQ(expected, calc_next.raw_hash()) << "split " << split;
+  }
+}
+
+TEST_F(HashCalculatorTest, LegacyContextTest) {
+  SHA256_CTX ctx;
+  ASSERT_EQ(1, SHA256_Init(&ctx));
+  ASSERT_EQ(1, SHA256_Update(&ctx, "h", 1));
+  HashCalculator calc;
+  ASSERT_TRUE(calc.SetContext(
+      string(reinterpret_cast<const char*>(&ctx), sizeof(ctx))));
+  calc.Update("i", 1);
+  calc.Finalize();
+  brillo::Blob raw_hash(std::begin(kExpectedRawHash),
+                        std::end(kExpectedRawHash));
+  EXPECT_EQ(raw_hash, calc.raw_hash());
+}
+
+TEST_F(HashCalculatorTest, InvalidContextTest) {
+  HashCalculator calc;
+  calc.Update("h", 1);
+  string context = calc.GetContext();
+  EXPECT_FALSE(calc.SetContext(""));
+  EXPECT_FALSE(calc.SetContext(context.substr(0, context.size() - 1)));
+  context[0]++;
+  EXPECT_FALSE(calc.SetContext(context));
+}
+
 TEST_F(HashCalculatorTest, BigTest) {
   HashCalculator calc;
 
@@ -139,6 +187,29 @@ TEST_F(HashCalculatorTest, RawHashOfFileSimpleTest) {
   }
 }
 
+TEST_F(HashCalculatorTest, RawHashOfBatchTest) {
+  std::vector<string> inputs = {"hi", "", string(4096, 'a')};
+  for (size_t i = 0; i < 20; i++) {
+    inputs.push_back(string(i * 13, static_cast<char>(i)));
+  }
+  const std::vector<std::string_view> views(inputs.begin(), inputs.end());
+  vector<brillo::Blob> hashes;
+  ASSERT_TRUE(HashCalculator::RawHashOfBatch(views, &hashes));
+  ASSERT_EQ(inputs.size(), hashes.size());
+  EXPECT_EQ(brillo::Blob(std::begin(kExpectedRawHash),
+                         std::end(kExpectedRawHash)),
+            hashes[0]);
+  for (size_t i = 0; i < inputs.size(); i++) {
+    brillo::Blob expected;
+    ASSERT_TRUE(HashCalculator::RawHashOfBytes(
+        inputs[i].data(), inputs[i].size(), &expected));
+    EXPECT_EQ(expected, hashes[i]) << "input " << i;
+  }
+
+  ASSERT_TRUE(HashCalculator::RawHashOfBatch({}, &hashes));
+  EXPECT_TRUE(hashes.empty());
+}
+
 TEST_F(HashCalculatorTest, UpdateFileNonexistentTest) {
   HashCalculator calc;
   EXPECT_EQ(-1, calc.UpdateFile("/some/non-existent/file", -1));
@@ -361,6 +361,21 @@ class FileFetcherFactory : public AnyHttpFetcherFactory {
   ScopedTempFile temp_file_{"ue_file_fetcher.XXXXXX"};
 };
 
+class MappedFileFetcherFactory : public FileFetcherFactory {
+ public:
+  // Necessary to unhide the definition in the base class.
+  using AnyHttpFetcherFactory::NewLargeFetcher;
+  HttpFetcher* NewLargeFetcher() override {
+    FileFetcher* ret = new FileFetcher();
+    ret->set_use_mmap(true);
+    return ret;
+  }
+
+  // Necessary to unhide the definition in the base class.
+  using AnyHttpFetcherFactory::NewSmallFetcher;
+  HttpFetcher* NewSmallFetcher() override { return NewLargeFetcher(); }
+};
+
 class MultiRangeHttpFetcherOverFileFetcherFactory : public FileFetcherFactory {
  public:
   // Necessary to unhide the definition in the base class.
@@ -425,6 +440,7 @@ typedef ::testing::Types<LibcurlHttpFetcherFactory,
                          MockHttpFetcherFactory,
                          MultiRangeHttpFetcherFactory,
                          FileFetcherFactory,
+                         MappedFileFetcherFactory,
                          MultiRangeHttpFetcherOverFileFetcherFactory>
     HttpFetcherTestTypes;
 TYPED_TEST_CASE(HttpFetcherTest, HttpFetcherTestTypes);
@@ -490,6 +506,35 @@ TYPED_TEST(HttpFetcherTest, SimpleTest) {
   EXPECT_EQ(0, delegate.times_transfer_terminated_called_);
 }
 
+TYPED_TEST(HttpFetcherTest, ReuseConnectionsTest) {
+  if (this->test_.IsMock() || this->test_.IsMulti() ||
+      this->test_.IsFileFetcher())
+    return;
+  HttpFetcherTestDelegate delegate;
+  unique_ptr<HttpFetcher> fetcher(this->test_.NewSmallFetcher());
+  LibcurlHttpFetcher* libcurl_fetcher =
+      static_cast<LibcurlHttpFetcher*>(fetcher.get());
+  libcurl_fetcher->set_reuse_connections(true);
+  libcurl_fetcher->set_http2(true);
+  fetcher->set_delegate(&delegate);
+
+  unique_ptr<HttpServer> server(this->test_.CreateServer());
+  ASSERT_TRUE(server->started_);
+
+  for (int i = 0; i < 2; i++) {
+    this->loop_.PostTask(FROM_HERE,
+                         base::Bind(StartTransfer,
+                                    fetcher.get(),
+                                    this->test_.SmallUrl(server->GetPort())));
+    this->loop_.Run();
+  }
+  EXPECT_EQ(2, delegate.times_transfer_complete_called_);
+  EXPECT_EQ(0, delegate.times_transfer_terminated_called_);
+  // The test server closes every connection, so none could be reused.
+  EXPECT_EQ(2, libcurl_fetcher->connection_stats().transfers);
+  EXPECT_EQ(2, libcurl_fetcher->connection_stats().new_connections);
+}
+
 TYPED_TEST(HttpFetcherTest, SimpleBigTest) {
   HttpFetcherTestDelegate delegate;
   unique_ptr<HttpFetcher> fetcher(this->test_.NewLargeFetcher());
@@ -785,6 +830,69 @@ TYPED_TEST(HttpFetcherTest, FlakyTest) {
   }
 }
 
+TYPED_TEST(HttpFetcherTest, ShapedDropTest) {
+  if (this->test_.IsMock() || !this->test_.IsHttpSupported())
+    return;
+  // The connection drops halfway through a throttled transfer, the fetcher
+  // resumes from there.
+  FlakyHttpFetcherTestDelegate delegate;
+  unique_ptr<HttpFetcher> fetcher(this->test_.NewSmallFetcher());
+  fetcher->set_delegate(&delegate);
+
+  unique_ptr<HttpServer> server(this->test_.CreateServer());
+  ASSERT_TRUE(server->started_);
+
+  this->loop_.PostTask(FROM_HERE,
+                       base::Bind(&StartTransfer,
+                                  fetcher.get(),
+                                  LocalServerUrlForPath(
+                                      server->GetPort(),
+                                      base::StringPrintf("/shaped/%d/%d/%d/%d",
+                                                         kBigLength,
+                                                         kBigLength * 4,
+                                                         10,
+                                                         kBigLength / 2))));
+  this->loop_.Run();
+
+  ASSERT_EQ(kBigLength, static_cast<int>(delegate.data.size()));
+  for (int i = 0; i < kBigLength; i += 10) {
+    ASSERT_EQ(delegate.data.substr(i, 10), "abcdefghij");
+  }
+}
+
+TYPED_TEST(HttpFetcherTest, ReceiveBufferFlakyTest) {
+  if (this->test_.IsMock() || this->test_.IsMulti() ||
+      this->test_.IsFileFetcher())
+    return;
+  FlakyHttpFetcherTestDelegate delegate;
+  unique_ptr<HttpFetcher> fetcher(this->test_.NewSmallFetcher());
+  // Bytes aggregated when the connection drops must still be delivered, in
+  // order with the ones of the next connection.
+  static_cast<LibcurlHttpFetcher*>(fetcher.get())
+      ->set_receive_buffer_size(16 * 1024);
+  fetcher->set_delegate(&delegate);
+
+  unique_ptr<HttpServer> server(this->test_.CreateServer());
+  ASSERT_TRUE(server->started_);
+
+  this->loop_.PostTask(FROM_HERE,
+                       base::Bind(&StartTransfer,
+                                  fetcher.get(),
+                                  LocalServerUrlForPath(
+                                      server->GetPort(),
+                                      base::StringPrintf("/flaky/%d/%d/%d/%d",
+                                                         kBigLength,
+                                                         kFlakyTruncateLength,
+                                                         kFlakySleepEvery,
+                                                         kFlakySleepSecs))));
+  this->loop_.Run();
+
+  ASSERT_EQ(kBigLength, static_cast<int>(delegate.data.size()));
+  for (int i = 0; i < kBigLength; i += 10) {
+    ASSERT_EQ(delegate.data.substr(i, 10), "abcdefghij");
+  }
+}
+
 // This delegate kills the server attached to it after receiving any bytes.
 // This can be used for testing what happens when you try to fetch data and
 // the server dies.
@@ -0,0 +1,145 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/merge_telemetry.h"
+
+#include <algorithm>
+
+#include <base/strings/stringprintf.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+// |end| - |start|, or 0 if either is unknown.
+base::TimeDelta Elapsed(base::TimeTicks start, base::TimeTicks end) {
+  if (start.is_null() || end.is_null()) {
+    return base::TimeDelta();
+  }
+  return end - start;
+}
+}  // namespace
+
+void MergeTelemetry::OnActionStarted(base::TimeTicks now) {
+  if (action_start_.is_null()) {
+    action_start_ = now;
+  }
+}
+
+void MergeTelemetry::OnBootCompleted(base::TimeTicks now) {
+  if (boot_completed_.is_null()) {
+    boot_completed_ = now;
+  }
+}
+
+void MergeTelemetry::OnSlotMarkedSuccessful(base::TimeTicks now) {
+  if (slot_successful_.is_null()) {
+    slot_successful_ = now;
+  }
+}
+
+void MergeTelemetry::OnMergeStarted(base::TimeTicks now) {
+  if (merge_start_.is_null()) {
+    merge_start_ = now;
+    last_progress_ = now;
+  }
+}
+
+void MergeTelemetry::AddSample(base::TimeTicks now,
+                               double percentage,
+                               uint64_t cow_size,
+                               double io_pressure) {
+  if (!merge_started()) {
+    return;
+  }
+  if (percentage > last_percentage_) {
+    last_percentage_ = percentage;
+    last_progress_ = now;
+  }
+  longest_stall_ = std::max(longest_stall_, now - last_progress_);
+  if (io_pressure >= 0) {
+    io_pressure_sum_ += io_pressure;
+    io_pressure_count_++;
+  }
+  merge_end_ = now;
+
+  if (sample_count_++ % sample_stride_ != 0) {
+    return;
+  }
+  if (samples_.size() == kMaxSamples) {
+    for (size_t i = 1; i < samples_.size() / 2; i++) {
+      samples_[i] = samples_[2 * i];
+    }
+    samples_.resize(samples_.size() / 2);
+    // The samples kept are those of multiples of the new stride, like this
+    // one, as the samples fill up again after as many as were dropped.
+    sample_stride_ *= 2;
+  }
+  samples_.push_back({now - merge_start_,
+                      percentage,
+                      static_cast<uint64_t>(cow_size * percentage / 100),
+                      io_pressure});
+}
+
+void MergeTelemetry::OnMergeFinished(base::TimeTicks now) {
+  if (merge_started()) {
+    merge_end_ = now;
+  }
+}
+
+base::TimeDelta MergeTelemetry::boot_completed_wait() const {
+  return Elapsed(action_start_, boot_completed_);
+}
+
+base::TimeDelta MergeTelemetry::slot_successful_wait() const {
+  return Elapsed(boot_completed_, slot_successful_);
+}
+
+base::TimeDelta MergeTelemetry::merge_delay() const {
+  return Elapsed(slot_successful_, merge_start_);
+}
+
+base::TimeDelta MergeTelemetry::merge_time() const {
+  return Elapsed(merge_start_, merge_end_);
+}
+
+double MergeTelemetry::average_io_pressure() const {
+  return io_pressure_count_ ? io_pressure_sum_ / io_pressure_count_ : -1;
+}
+
+std::string MergeTelemetry::ToString() const {
+  std::string result = base::StringPrintf(
+      "waited %s for boot completion, %s for the slot to be marked "
+      "successful and %s to start merging; merged in %s, longest stall %s, "
+      "average I/O pressure %.1f%%; progress:",
+      utils::FormatTimeDelta(boot_completed_wait()).c_str(),
+      utils::FormatTimeDelta(slot_successful_wait()).c_str(),
+      utils::FormatTimeDelta(merge_delay()).c_str(),
+      utils::FormatTimeDelta(merge_time()).c_str(),
+      utils::FormatTimeDelta(longest_stall_).c_str(),
+      average_io_pressure());
+  for (const auto& sample : samples_) {
+    base::StringAppendF(&result,
+                        " %.1fs:%.0f%%",
+                        sample.time.InSecondsF(),
+                        sample.percentage);
+  }
+  return result;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,104 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_COMMON_MERGE_TELEMETRY_H_
+#define UPDATE_ENGINE_COMMON_MERGE_TELEMETRY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <base/time/time.h>
+
+namespace chromeos_update_engine {
+
+// Records how the snapshot merge of the previous update went: the time spent
+// waiting before it could start, samples of its progress, and the I/O
+// pressure the system was under while it ran. Times are taken by the caller
+// so that tests control them.
+class MergeTelemetry {
+ public:
+  // The samples are thinned out by keeping every other one whenever there
+  // are this many, so that a slow merge doesn't grow them without bound.
+  static constexpr size_t kMaxSamples = 128;
+
+  struct Sample {
+    // Since the merge started.
+    base::TimeDelta time;
+    // Within [0, 100].
+    double percentage{0};
+    // Estimated from the percentage of the COW size, 0 if it's unknown.
+    uint64_t merged_bytes{0};
+    // Percent of the time tasks stalled on I/O, negative if unknown.
+    double io_pressure{-1};
+  };
+
+  // Only the first call counts, as the action restarts when resumed.
+  void OnActionStarted(base::TimeTicks now);
+  void OnBootCompleted(base::TimeTicks now);
+  void OnSlotMarkedSuccessful(base::TimeTicks now);
+  void OnMergeStarted(base::TimeTicks now);
+  // |cow_size| is the size of the COW images being merged, 0 if unknown.
+  void AddSample(base::TimeTicks now,
+                 double percentage,
+                 uint64_t cow_size,
+                 double io_pressure);
+  void OnMergeFinished(base::TimeTicks now);
+
+  bool merge_started() const { return !merge_start_.is_null(); }
+
+  // From the start of the action to sys.boot_completed.
+  base::TimeDelta boot_completed_wait() const;
+  // From sys.boot_completed to the slot being marked successful.
+  base::TimeDelta slot_successful_wait() const;
+  // From the slot being marked successful to the start of the merge, which
+  // waits for the merge delay and a window of low I/O pressure.
+  base::TimeDelta merge_delay() const;
+  // From the start of the merge to its end, or to the last sample if it
+  // isn't finished.
+  base::TimeDelta merge_time() const;
+  // Longest time between samples without any progress.
+  base::TimeDelta longest_stall() const { return longest_stall_; }
+  // Average over the samples with a known I/O pressure, negative if none.
+  double average_io_pressure() const;
+  const std::vector<Sample>& samples() const { return samples_; }
+
+  // For the logs.
+  std::string ToString() const;
+
+ private:
+  base::TimeTicks action_start_;
+  base::TimeTicks boot_completed_;
+  base::TimeTicks slot_successful_;
+  base::TimeTicks merge_start_;
+  base::TimeTicks merge_end_;
+  base::TimeTicks last_progress_;
+  double last_percentage_{0};
+  base::TimeDelta longest_stall_;
+  double io_pressure_sum_{0};
+  size_t io_pressure_count_{0};
+  std::vector<Sample> samples_;
+  // Only every |sample_stride_|-th sample is kept, once thinned out.
+  size_t sample_stride_{1};
+  size_t sample_count_{0};
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_MERGE_TELEMETRY_H_
@@ -0,0 +1,81 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/merge_telemetry.h"
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+base::TimeTicks At(int seconds) {
+  return base::TimeTicks() + base::TimeDelta::FromSeconds(seconds + 1);
+}
+}  // namespace
+
+TEST(MergeTelemetryTest, RecordsPhasesAndStalls) {
+  MergeTelemetry telemetry;
+  telemetry.OnActionStarted(At(0));
+  telemetry.OnBootCompleted(At(10));
+  // Resuming the action doesn't restart the clock.
+  telemetry.OnActionStarted(At(12));
+  telemetry.OnSlotMarkedSuccessful(At(15));
+  telemetry.AddSample(At(16), 1, 1000, 50);
+  EXPECT_FALSE(telemetry.merge_started());
+  telemetry.OnMergeStarted(At(20));
+  telemetry.AddSample(At(22), 10, 1000, 4);
+  telemetry.AddSample(At(24), 10, 1000, -1);
+  telemetry.AddSample(At(30), 10, 1000, 8);
+  telemetry.AddSample(At(31), 50, 1000, -1);
+  telemetry.OnMergeFinished(At(40));
+
+  EXPECT_TRUE(telemetry.merge_started());
+  EXPECT_EQ(telemetry.boot_completed_wait().InSeconds(), 10);
+  EXPECT_EQ(telemetry.slot_successful_wait().InSeconds(), 5);
+  EXPECT_EQ(telemetry.merge_delay().InSeconds(), 5);
+  EXPECT_EQ(telemetry.merge_time().InSeconds(), 20);
+  EXPECT_EQ(telemetry.longest_stall().InSeconds(), 8);
+  EXPECT_DOUBLE_EQ(telemetry.average_io_pressure(), 6);
+  ASSERT_EQ(telemetry.samples().size(), 4U);
+  EXPECT_EQ(telemetry.samples()[0].time.InSeconds(), 2);
+  EXPECT_EQ(telemetry.samples()[3].merged_bytes, 500U);
+  EXPECT_LT(telemetry.samples()[1].io_pressure, 0);
+  EXPECT_FALSE(telemetry.ToString().empty());
+}
+
+TEST(MergeTelemetryTest, ThinsOutSamples) {
+  MergeTelemetry telemetry;
+  telemetry.OnMergeStarted(At(0));
+  constexpr size_t kNumSamples = 5 * MergeTelemetry::kMaxSamples;
+  for (size_t i = 0; i < kNumSamples; i++) {
+    telemetry.AddSample(At(i), 100.0 * i / kNumSamples, 0, -1);
+  }
+  const auto& samples = telemetry.samples();
+  ASSERT_LE(samples.size(), MergeTelemetry::kMaxSamples);
+  ASSERT_GE(samples.size(), MergeTelemetry::kMaxSamples / 2);
+  // The samples kept are evenly spaced over the whole merge.
+  EXPECT_EQ(samples[0].time.InSeconds(), 0);
+  const int64_t stride = samples[1].time.InSeconds();
+  for (size_t i = 1; i < samples.size(); i++) {
+    EXPECT_EQ(samples[i].time - samples[i - 1].time,
+              base::TimeDelta::FromSeconds(stride));
+  }
+  EXPECT_GE(samples.back().time.InSeconds() + stride,
+            static_cast<int64_t>(kNumSamples));
+}
+
+}  // namespace chromeos_update_engine
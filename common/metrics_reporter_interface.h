@@ -25,7 +25,9 @@
 #include "update_engine/common/constants.h"
 #include "update_engine/common/dynamic_partition_control_interface.h"
 #include "update_engine/common/error_code.h"
+#include "update_engine/common/merge_telemetry.h"
 #include "update_engine/common/metrics_constants.h"
+#include "update_engine/payload_consumer/apply_stats.h"
 #include "update_engine/payload_consumer/install_plan.h"
 
 namespace chromeos_update_engine {
@@ -137,6 +139,18 @@ class MetricsReporterInterface {
       metrics::DownloadErrorCode payload_download_error_code,
       metrics::ConnectionType connection_type) = 0;
 
+  // Reports the time and I/O spent applying the operations of the partition
+  // |partition_name| during the attempt, by operation type, and the
+  // throughput of its download, apply and verify phases.
+  virtual void ReportApplyStats(
+      const std::string& partition_name,
+      const ApplyStats& stats,
+      const PartitionThroughputStats& throughput_stats) = 0;
+
+  // Reports how the snapshot merge of the previous update progressed, and
+  // how long it waited to start.
+  virtual void ReportMergeTelemetry(const MergeTelemetry& telemetry) = 0;
+
   // Reports the |kAbnormalTermination| for the |kMetricAttemptResult|
   // metric. No other metrics in the UpdateEngine.Attempt.* namespace
   // will be reported.
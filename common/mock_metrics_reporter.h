@@ -57,6 +57,13 @@ class MockMetricsReporter : public MetricsReporterInterface {
                     metrics::DownloadErrorCode payload_download_error_code,
                     metrics::ConnectionType connection_type));
 
+  MOCK_METHOD3(ReportApplyStats,
+               void(const std::string& partition_name,
+                    const ApplyStats& stats,
+                    const PartitionThroughputStats& throughput_stats));
+
+  MOCK_METHOD1(ReportMergeTelemetry, void(const MergeTelemetry& telemetry));
+
   MOCK_METHOD0(ReportAbnormallyTerminatedUpdateAttemptMetrics, void());
 
   MOCK_METHOD10(ReportSuccessfulUpdateMetrics,
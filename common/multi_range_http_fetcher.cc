@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <string>
+#include <utility>
 
 namespace chromeos_update_engine {
 
@@ -80,13 +81,102 @@ void MultiRangeHttpFetcher::StartTransfer() {
   if (delegate_)
     delegate_->SeekToOffset(range.offset());
   base_fetcher_active_ = true;
+  // Started first since this object may be destroyed once the transfer began.
+  StartPrefetch();
   base_fetcher_->BeginTransfer(url_);
 }
 
+void MultiRangeHttpFetcher::StartPrefetch() {
+  const RangesVect::size_type index = current_index_ + 1;
+  if (!prefetch_fetcher_ || prefetch_state_ != PrefetchState::kIdle ||
+      index >= ranges_.size() || !ranges_[index].HasLength() ||
+      ranges_[index].length() > kMaxPrefetchBytes) {
+    return;
+  }
+  const Range& range = ranges_[index];
+  LOG(INFO) << "prefetching range " << range.ToString();
+  prefetch_index_ = index;
+  prefetch_data_.clear();
+  prefetch_data_.reserve(range.length());
+  prefetch_state_ = PrefetchState::kActive;
+  prefetch_fetcher_->set_delegate(this);
+  prefetch_fetcher_->SetOffset(range.offset());
+  prefetch_fetcher_->SetLength(range.length());
+  prefetch_fetcher_->BeginTransfer(url_);
+}
+
+void MultiRangeHttpFetcher::ContinuePrefetchedTransfer() {
+  const Range range = ranges_[current_index_];
+  std::swap(base_fetcher_, prefetch_fetcher_);
+  const bool ended = prefetch_state_ == PrefetchState::kEnded;
+  // The transfer has no more bytes, TerminateTransfer() must not terminate it
+  // again.
+  pending_transfer_ended_ = prefetch_state_ != PrefetchState::kActive;
+  prefetch_state_ = PrefetchState::kIdle;
+  brillo::Blob data = std::move(prefetch_data_);
+  prefetch_data_.clear();
+  bytes_received_this_range_ = data.size();
+  if (delegate_)
+    delegate_->SeekToOffset(range.offset());
+  StartPrefetch();
+  if (delegate_ && !data.empty())
+    delegate_->ReceivedBytes(this, data.data(), data.size());
+  // Unless the prefetch ended, the rest of the range streams through
+  // ReceivedBytes(), and this object may be destroyed already if the delegate
+  // terminated the transfer.
+  if (ended)
+    TransferEnded(base_fetcher_.get(), true);
+}
+
+void MultiRangeHttpFetcher::AbortPrefetch() {
+  const bool active = prefetch_state_ == PrefetchState::kActive;
+  prefetch_state_ = PrefetchState::kIdle;
+  prefetch_data_.clear();
+  if (active) {
+    // The callbacks of the terminated transfer are ignored.
+    prefetch_fetcher_->TerminateTransfer();
+  }
+}
+
+bool MultiRangeHttpFetcher::PrefetchReceivedBytes(const void* bytes,
+                                                  size_t length) {
+  if (prefetch_state_ != PrefetchState::kActive) {
+    return false;
+  }
+  const Range& range = ranges_[prefetch_index_];
+  const size_t size = std::min(length, range.length() - prefetch_data_.size());
+  const uint8_t* data = static_cast<const uint8_t*>(bytes);
+  prefetch_data_.insert(prefetch_data_.end(), data, data + size);
+  if (prefetch_data_.size() < range.length()) {
+    return true;
+  }
+  prefetch_state_ = PrefetchState::kEnding;
+  prefetch_fetcher_->TerminateTransfer();
+  return false;
+}
+
+void MultiRangeHttpFetcher::PrefetchEnded() {
+  if (prefetch_state_ == PrefetchState::kIdle) {
+    return;
+  }
+  if (prefetch_data_.size() < ranges_[prefetch_index_].length()) {
+    // The range is fetched again once it's its turn.
+    LOG(INFO) << "Prefetch of range "
+              << ranges_[prefetch_index_].ToString() << " failed.";
+    prefetch_state_ = PrefetchState::kIdle;
+    prefetch_data_.clear();
+    return;
+  }
+  prefetch_state_ = PrefetchState::kEnded;
+}
+
 // State change: Downloading -> Downloading or Pending transfer ended
 bool MultiRangeHttpFetcher::ReceivedBytes(HttpFetcher* fetcher,
                                           const void* bytes,
                                           size_t length) {
+  if (fetcher == prefetch_fetcher_.get()) {
+    return PrefetchReceivedBytes(bytes, length);
+  }
   CHECK_LT(current_index_, ranges_.size());
   CHECK_EQ(fetcher, base_fetcher_.get());
   CHECK(!pending_transfer_ended_);
@@ -153,6 +243,13 @@ void MultiRangeHttpFetcher::TransferEnded(HttpFetcher* fetcher,
   // If we have another transfer, do that.
   if (current_index_ + 1 < ranges_.size()) {
     current_index_++;
+    if (prefetch_state_ != PrefetchState::kIdle &&
+        prefetch_index_ == current_index_) {
+      LOG(INFO) << "Continuing prefetched transfer (" << current_index_
+                << ").";
+      ContinuePrefetchedTransfer();
+      return;
+    }
     LOG(INFO) << "Starting next transfer (" << current_index_ << ").";
     StartTransfer();
     return;
@@ -167,16 +264,25 @@ void MultiRangeHttpFetcher::TransferEnded(HttpFetcher* fetcher,
 
 void MultiRangeHttpFetcher::TransferComplete(HttpFetcher* fetcher,
                                              bool successful) {
+  if (fetcher == prefetch_fetcher_.get()) {
+    PrefetchEnded();
+    return;
+  }
   LOG(INFO) << "Received transfer complete.";
   TransferEnded(fetcher, successful);
 }
 
 void MultiRangeHttpFetcher::TransferTerminated(HttpFetcher* fetcher) {
+  if (fetcher == prefetch_fetcher_.get()) {
+    PrefetchEnded();
+    return;
+  }
   LOG(INFO) << "Received transfer terminated.";
   TransferEnded(fetcher, false);
 }
 
 void MultiRangeHttpFetcher::Reset() {
+  AbortPrefetch();
   base_fetcher_active_ = pending_transfer_ended_ = terminating_ = false;
   current_index_ = 0;
   bytes_received_this_range_ = 0;
@@ -23,6 +23,8 @@
 #include <utility>
 #include <vector>
 
+#include <brillo/secure_blob.h>
+
 #include "update_engine/common/http_fetcher.h"
 
 // This class is a simple wrapper around an HttpFetcher. The client
@@ -32,6 +34,11 @@
 // as a length to specify unlimited length. It really only would make sense
 // for the last range specified to have unlimited length, tho it is legal for
 // other entries to have unlimited length.
+//
+// With a prefetch fetcher, a second connection, the next range is requested
+// while the current one is downloading and buffered until the current one
+// ends, so that no round trip is spent idle between the ranges. Only ranges of
+// at most kMaxPrefetchBytes are prefetched, which bounds the memory used.
 
 // There are three states a MultiRangeHttpFetcher object will be in:
 // - Stopped (start state)
@@ -55,6 +62,14 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
         bytes_received_this_range_(0) {}
   ~MultiRangeHttpFetcher() override {}
 
+  static constexpr size_t kMaxPrefetchBytes = 2 * 1024 * 1024;
+
+  // Takes ownership of the passed in fetcher, which must fetch from the same
+  // server as the base fetcher.
+  void set_prefetch_fetcher(HttpFetcher* prefetch_fetcher) {
+    prefetch_fetcher_.reset(prefetch_fetcher);
+  }
+
   void ClearRanges() { ranges_.clear(); }
 
   void AddRange(off_t offset, size_t size) {
@@ -81,6 +96,8 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
   void SetHeader(const std::string& header_name,
                  const std::string& header_value) override {
     base_fetcher_->SetHeader(header_name, header_value);
+    if (prefetch_fetcher_)
+      prefetch_fetcher_->SetHeader(header_name, header_value);
   }
 
   bool GetHeader(const std::string& header_name,
@@ -88,6 +105,7 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
     return base_fetcher_->GetHeader(header_name, header_value);
   }
 
+  // A range being prefetched keeps downloading while paused.
   void Pause() override { base_fetcher_->Pause(); }
 
   void Unpause() override { base_fetcher_->Unpause(); }
@@ -95,31 +113,44 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
   // These functions are overloaded in LibcurlHttp fetcher for testing purposes.
   void set_idle_seconds(int seconds) override {
     base_fetcher_->set_idle_seconds(seconds);
+    if (prefetch_fetcher_)
+      prefetch_fetcher_->set_idle_seconds(seconds);
   }
   void set_retry_seconds(int seconds) override {
     base_fetcher_->set_retry_seconds(seconds);
+    if (prefetch_fetcher_)
+      prefetch_fetcher_->set_retry_seconds(seconds);
   }
   // TODO(deymo): Determine if this method should be virtual in HttpFetcher so
   // this call is sent to the base_fetcher_.
   void SetProxies(const std::deque<std::string>& proxies) override {
     HttpFetcher::SetProxies(proxies);
     base_fetcher_->SetProxies(proxies);
+    if (prefetch_fetcher_)
+      prefetch_fetcher_->SetProxies(proxies);
   }
 
   inline size_t GetBytesDownloaded() override {
-    return base_fetcher_->GetBytesDownloaded();
+    return base_fetcher_->GetBytesDownloaded() +
+           (prefetch_fetcher_ ? prefetch_fetcher_->GetBytesDownloaded() : 0);
   }
 
   void set_low_speed_limit(int low_speed_bps, int low_speed_sec) override {
     base_fetcher_->set_low_speed_limit(low_speed_bps, low_speed_sec);
+    if (prefetch_fetcher_)
+      prefetch_fetcher_->set_low_speed_limit(low_speed_bps, low_speed_sec);
   }
 
   void set_connect_timeout(int connect_timeout_seconds) override {
     base_fetcher_->set_connect_timeout(connect_timeout_seconds);
+    if (prefetch_fetcher_)
+      prefetch_fetcher_->set_connect_timeout(connect_timeout_seconds);
   }
 
   void set_max_retry_count(int max_retry_count) override {
     base_fetcher_->set_max_retry_count(max_retry_count);
+    if (prefetch_fetcher_)
+      prefetch_fetcher_->set_max_retry_count(max_retry_count);
   }
 
  private:
@@ -145,9 +176,35 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
 
   typedef std::vector<Range> RangesVect;
 
+  // The states of the prefetch of a range.
+  enum class PrefetchState {
+    kIdle,
+    kActive,
+    // All the bytes were received, the transfer is being terminated.
+    kEnding,
+    kEnded,
+  };
+
   // State change: Stopped or Downloading -> Downloading
   void StartTransfer();
 
+  // Starts prefetching the range after the current one, if there's a prefetch
+  // fetcher and the range is small enough.
+  void StartPrefetch();
+
+  // Makes the prefetch fetcher the base fetcher, passes the bytes prefetched
+  // to the delegate and continues the transfer of the current range from
+  // there.
+  // State change: Pending transfer ended -> Downloading or Stopped
+  void ContinuePrefetchedTransfer();
+
+  // Drops the bytes prefetched, terminating the prefetch if still active.
+  void AbortPrefetch();
+
+  // Handle the callbacks of |prefetch_fetcher_|.
+  bool PrefetchReceivedBytes(const void* bytes, size_t length);
+  void PrefetchEnded();
+
   // HttpFetcherDelegate overrides.
   // State change: Downloading -> Downloading or Pending transfer ended
   bool ReceivedBytes(HttpFetcher* fetcher,
@@ -180,6 +237,12 @@ class MultiRangeHttpFetcher : public HttpFetcher, public HttpFetcherDelegate {
   RangesVect::size_type current_index_;  // index into ranges_
   size_t bytes_received_this_range_;
 
+  // The fetcher of the next range, if any, and the bytes it fetched.
+  std::unique_ptr<HttpFetcher> prefetch_fetcher_;
+  PrefetchState prefetch_state_{PrefetchState::kIdle};
+  RangesVect::size_type prefetch_index_{0};
+  brillo::Blob prefetch_data_;
+
   DISALLOW_COPY_AND_ASSIGN(MultiRangeHttpFetcher);
 };
 
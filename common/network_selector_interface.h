@@ -39,6 +39,11 @@ class NetworkSelectorInterface {
   // kNetworkId to use the default network.
   virtual bool SetProcessNetwork(NetworkId network_id) = 0;
 
+  // Binds the socket |socket_fd| to the network |network_id|, regardless of
+  // the process network, so that the connections of a single process go over
+  // different networks.
+  virtual bool BindSocket(NetworkId network_id, int socket_fd) = 0;
+
  protected:
   NetworkSelectorInterface() = default;
 };
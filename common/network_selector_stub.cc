@@ -42,4 +42,12 @@ bool NetworkSelectorStub::SetProcessNetwork(NetworkId network_id) {
   return true;
 }
 
+bool NetworkSelectorStub::BindSocket(NetworkId network_id, int socket_fd) {
+  if (network_id != kDefaultNetworkId) {
+    LOG(ERROR) << "BindSocket not implemented.";
+    return false;
+  }
+  return true;
+}
+
 }  // namespace chromeos_update_engine
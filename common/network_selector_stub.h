@@ -30,6 +30,7 @@ class NetworkSelectorStub final : public NetworkSelectorInterface {
 
   // NetworkSelectorInterface overrides.
   bool SetProcessNetwork(NetworkId network_id) override;
+  bool BindSocket(NetworkId network_id, int socket_fd) override;
 
  private:
   DISALLOW_COPY_AND_ASSIGN(NetworkSelectorStub);
@@ -0,0 +1,466 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/parallel_range_http_fetcher.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <base/logging.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+// Number of connections used before any throughput is observed.
+constexpr size_t kInitialConnections = 2;
+// Period over which the throughput is measured.
+constexpr auto kAdaptInterval = base::TimeDelta::FromSeconds(2);
+// Relative throughput change considered significant.
+constexpr double kAdaptThreshold = 0.1;
+}  // namespace
+
+ParallelRangeHttpFetcher::ParallelRangeHttpFetcher(size_t max_connections,
+                                                   FetcherFactory factory,
+                                                   size_t chunk_size)
+    : max_connections_(std::max<size_t>(max_connections, 1)),
+      factory_(std::move(factory)),
+      chunk_size_(chunk_size),
+      connections_(max_connections_),
+      target_connections_(std::min(max_connections_, kInitialConnections)) {
+  CHECK_GT(chunk_size_, 0u);
+}
+
+ParallelRangeHttpFetcher::~ParallelRangeHttpFetcher() {
+  // The connections must not call back into this object while destroyed.
+  for (Connection& connection : connections_) {
+    if (connection.fetcher) {
+      connection.fetcher->set_delegate(nullptr);
+    }
+  }
+}
+
+void ParallelRangeHttpFetcher::BeginTransfer(const std::string& url) {
+  CHECK(!transfer_active_) << "BeginTransfer but already active.";
+  url_ = url;
+  num_chunks_ = length_ > 0 ? (length_ + chunk_size_ - 1) / chunk_size_ : 1;
+  window_start_ = base::TimeTicks::Now();
+  window_bytes_ = 0;
+  transfer_active_ = true;
+  LOG(INFO) << "Fetching " << num_chunks_ << " chunks from offset " << offset_
+            << " over up to " << max_connections_ << " connections.";
+  ScheduleChunks();
+}
+
+void ParallelRangeHttpFetcher::TerminateTransfer() {
+  if (in_delivery_) {
+    // Handled once the delegate returns.
+    terminate_requested_ = true;
+    return;
+  }
+  if (!transfer_active_) {
+    LOG(INFO) << "Called TerminateTransfer but not active.";
+    // Note that after the callback returns this object may be destroyed.
+    if (delegate_)
+      delegate_->TransferTerminated(this);
+    return;
+  }
+  terminating_ = true;
+  Stop();
+}
+
+void ParallelRangeHttpFetcher::SetHeader(const std::string& header_name,
+                                         const std::string& header_value) {
+  headers_[header_name] = header_value;
+  for (Connection& connection : connections_) {
+    if (connection.fetcher) {
+      connection.fetcher->SetHeader(header_name, header_value);
+    }
+  }
+}
+
+bool ParallelRangeHttpFetcher::GetHeader(const std::string& header_name,
+                                         std::string* header_value) const {
+  header_value->clear();
+  auto it = headers_.find(header_name);
+  if (it == headers_.end()) {
+    return false;
+  }
+  *header_value = it->second;
+  return true;
+}
+
+void ParallelRangeHttpFetcher::Pause() {
+  paused_ = true;
+  for (Connection& connection : connections_) {
+    if (connection.active && !connection.paused) {
+      connection.paused = true;
+      connection.fetcher->Pause();
+    }
+  }
+}
+
+void ParallelRangeHttpFetcher::Unpause() {
+  paused_ = false;
+  // The time spent paused must not count against the throughput.
+  window_start_ = base::TimeTicks::Now();
+  window_bytes_ = 0;
+  for (Connection& connection : connections_) {
+    if (connection.active && connection.paused) {
+      connection.paused = false;
+      connection.fetcher->Unpause();
+    }
+  }
+  ScheduleChunks();
+}
+
+void ParallelRangeHttpFetcher::set_idle_seconds(int seconds) {
+  idle_seconds_ = seconds;
+  for (Connection& connection : connections_) {
+    if (connection.fetcher) {
+      connection.fetcher->set_idle_seconds(seconds);
+    }
+  }
+}
+
+void ParallelRangeHttpFetcher::set_retry_seconds(int seconds) {
+  retry_seconds_ = seconds;
+  for (Connection& connection : connections_) {
+    if (connection.fetcher) {
+      connection.fetcher->set_retry_seconds(seconds);
+    }
+  }
+}
+
+void ParallelRangeHttpFetcher::SetProxies(
+    const std::deque<std::string>& proxies) {
+  HttpFetcher::SetProxies(proxies);
+  for (Connection& connection : connections_) {
+    if (connection.fetcher) {
+      connection.fetcher->SetProxies(proxies);
+    }
+  }
+}
+
+void ParallelRangeHttpFetcher::set_low_speed_limit(int low_speed_bps,
+                                                   int low_speed_sec) {
+  low_speed_bps_ = low_speed_bps;
+  low_speed_sec_ = low_speed_sec;
+  for (Connection& connection : connections_) {
+    if (connection.fetcher) {
+      connection.fetcher->set_low_speed_limit(low_speed_bps, low_speed_sec);
+    }
+  }
+}
+
+void ParallelRangeHttpFetcher::set_connect_timeout(
+    int connect_timeout_seconds) {
+  connect_timeout_seconds_ = connect_timeout_seconds;
+  for (Connection& connection : connections_) {
+    if (connection.fetcher) {
+      connection.fetcher->set_connect_timeout(connect_timeout_seconds);
+    }
+  }
+}
+
+void ParallelRangeHttpFetcher::set_max_retry_count(int max_retry_count) {
+  max_retry_count_ = max_retry_count;
+  for (Connection& connection : connections_) {
+    if (connection.fetcher) {
+      connection.fetcher->set_max_retry_count(max_retry_count);
+    }
+  }
+}
+
+bool ParallelRangeHttpFetcher::ReceivedBytes(HttpFetcher* fetcher,
+                                             const void* bytes,
+                                             size_t length) {
+  Connection* connection = FindConnection(fetcher);
+  CHECK(connection);
+  if (!connection->active || terminating_ || failed_) {
+    return false;
+  }
+  Chunk& chunk = chunks_[connection->chunk - next_deliver_];
+  size_t size = length;
+  if (chunk.length > 0) {
+    size = std::min(size, chunk.length - chunk.received);
+  }
+  LOG_IF(WARNING, size < length) << "Ignoring bytes past the chunk end.";
+  chunk.received += size;
+  bytes_received_ += size;
+  window_bytes_ += size;
+  if (size == 0) {
+    return true;
+  }
+  if (connection->chunk != next_deliver_) {
+    const uint8_t* data = static_cast<const uint8_t*>(bytes);
+    chunk.buffer.insert(chunk.buffer.end(), data, data + size);
+    return true;
+  }
+  if (!Deliver(bytes, size)) {
+    Stop();
+    return false;
+  }
+  return true;
+}
+
+void ParallelRangeHttpFetcher::TransferComplete(HttpFetcher* fetcher,
+                                                bool successful) {
+  Connection* connection = FindConnection(fetcher);
+  CHECK(connection);
+  if (!connection->active) {
+    return;
+  }
+  connection->active = false;
+  // The fetcher clears its paused state when the transfer ends.
+  connection->paused = false;
+  if (terminating_ || failed_) {
+    MaybeNotifyStopped();
+    return;
+  }
+  // Keeps the codes of the connection which failed, if any.
+  http_response_code_ = fetcher->http_response_code();
+  auxiliary_error_code_ = fetcher->GetAuxiliaryErrorCode();
+
+  Chunk& chunk = chunks_[connection->chunk - next_deliver_];
+  const bool complete =
+      chunk.length > 0 ? chunk.received >= chunk.length : successful;
+  if (!complete) {
+    LOG(ERROR) << "Failed to fetch the chunk at offset " << chunk.offset
+               << ", got " << chunk.received << " of " << chunk.length
+               << " bytes.";
+    failed_ = true;
+    Stop();
+    return;
+  }
+  chunk.done = true;
+  const double seconds =
+      (base::TimeTicks::Now() - connection->chunk_start).InSecondsF();
+  if (seconds > 0) {
+    const double throughput = chunk.received / seconds;
+    connection->throughput =
+        connection->throughput > 0
+            ? (connection->throughput + throughput) / 2
+            : throughput;
+  }
+  Adapt();
+  if (!AdvanceHead()) {
+    Stop();
+    return;
+  }
+  if (next_deliver_ == num_chunks_) {
+    LOG(INFO) << "Done with all chunks.";
+    Reset();
+    // Note that after the callback returns this object may be destroyed.
+    if (delegate_)
+      delegate_->TransferComplete(this, true);
+    return;
+  }
+  ScheduleChunks();
+}
+
+void ParallelRangeHttpFetcher::TransferTerminated(HttpFetcher* fetcher) {
+  TransferComplete(fetcher, false);
+}
+
+ParallelRangeHttpFetcher::Connection* ParallelRangeHttpFetcher::FindConnection(
+    HttpFetcher* fetcher) {
+  for (Connection& connection : connections_) {
+    if (connection.fetcher.get() == fetcher) {
+      return &connection;
+    }
+  }
+  return nullptr;
+}
+
+size_t ParallelRangeHttpFetcher::ActiveConnections() const {
+  return std::count_if(
+      connections_.begin(), connections_.end(), [](const Connection& c) {
+        return c.active;
+      });
+}
+
+void ParallelRangeHttpFetcher::Configure(HttpFetcher* fetcher) {
+  for (const auto& [name, value] : headers_) {
+    fetcher->SetHeader(name, value);
+  }
+  fetcher->SetProxies(proxies_);
+  if (idle_seconds_ >= 0)
+    fetcher->set_idle_seconds(idle_seconds_);
+  if (retry_seconds_ >= 0)
+    fetcher->set_retry_seconds(retry_seconds_);
+  if (low_speed_bps_ >= 0)
+    fetcher->set_low_speed_limit(low_speed_bps_, low_speed_sec_);
+  if (connect_timeout_seconds_ >= 0)
+    fetcher->set_connect_timeout(connect_timeout_seconds_);
+  if (max_retry_count_ >= 0)
+    fetcher->set_max_retry_count(max_retry_count_);
+}
+
+void ParallelRangeHttpFetcher::ScheduleChunks() {
+  while (transfer_active_ && !paused_ && !terminating_ && !failed_ &&
+         next_chunk_ < num_chunks_ &&
+         next_chunk_ - next_deliver_ < kReorderWindowChunks &&
+         ActiveConnections() < target_connections_) {
+    Connection* idle = PickIdleConnection();
+    CHECK(idle);
+    StartChunk(idle);
+  }
+}
+
+ParallelRangeHttpFetcher::Connection*
+ParallelRangeHttpFetcher::PickIdleConnection() {
+  Connection* fastest = nullptr;
+  for (Connection& connection : connections_) {
+    if (connection.active) {
+      continue;
+    }
+    // Measures every connection once.
+    if (connection.throughput <= 0) {
+      return &connection;
+    }
+    if (!fastest || connection.throughput > fastest->throughput) {
+      fastest = &connection;
+    }
+  }
+  return fastest;
+}
+
+void ParallelRangeHttpFetcher::StartChunk(Connection* connection) {
+  Chunk chunk;
+  chunk.offset = offset_ + next_chunk_ * chunk_size_;
+  if (length_ > 0) {
+    chunk.length = std::min(chunk_size_, length_ - next_chunk_ * chunk_size_);
+  }
+  if (!connection->fetcher) {
+    connection->fetcher = factory_(connection - connections_.data());
+    Configure(connection->fetcher.get());
+  }
+  HttpFetcher* fetcher = connection->fetcher.get();
+  fetcher->set_delegate(this);
+  fetcher->SetOffset(chunk.offset);
+  if (chunk.length > 0)
+    fetcher->SetLength(chunk.length);
+  else
+    fetcher->UnsetLength();
+  connection->active = true;
+  connection->chunk = next_chunk_++;
+  connection->chunk_start = base::TimeTicks::Now();
+  chunks_.push_back(std::move(chunk));
+  fetcher->BeginTransfer(url_);
+}
+
+bool ParallelRangeHttpFetcher::Deliver(const void* bytes, size_t length) {
+  if (delegate_) {
+    in_delivery_ = true;
+    const bool keep_going = delegate_->ReceivedBytes(this, bytes, length);
+    in_delivery_ = false;
+    if (!keep_going || terminate_requested_) {
+      terminating_ = true;
+    }
+  }
+  return !terminating_ && !failed_;
+}
+
+bool ParallelRangeHttpFetcher::AdvanceHead() {
+  while (!chunks_.empty()) {
+    Chunk& chunk = chunks_.front();
+    if (!chunk.buffer.empty()) {
+      brillo::Blob data;
+      data.swap(chunk.buffer);
+      if (!Deliver(data.data(), data.size())) {
+        return false;
+      }
+    }
+    if (!chunk.done) {
+      break;
+    }
+    chunks_.pop_front();
+    next_deliver_++;
+  }
+  return true;
+}
+
+void ParallelRangeHttpFetcher::Adapt() {
+  const base::TimeTicks now = base::TimeTicks::Now();
+  const base::TimeDelta elapsed = now - window_start_;
+  if (elapsed < kAdaptInterval) {
+    return;
+  }
+  const double throughput = window_bytes_ / elapsed.InSecondsF();
+  bool step = false;
+  if (last_throughput_ <= 0 ||
+      throughput > last_throughput_ * (1 + kAdaptThreshold)) {
+    // Keep going in the same direction while it helps.
+    step = true;
+  } else if (throughput < last_throughput_ * (1 - kAdaptThreshold)) {
+    adapt_direction_ = -adapt_direction_;
+    step = true;
+  }
+  if (step) {
+    const size_t target =
+        adapt_direction_ > 0
+            ? std::min(target_connections_ + 1, max_connections_)
+            : std::max<size_t>(target_connections_ - 1, 1);
+    if (target != target_connections_) {
+      LOG(INFO) << "Throughput " << static_cast<size_t>(throughput / 1024)
+                << " KiB/s, using " << target << " connections.";
+      target_connections_ = target;
+    }
+  }
+  last_throughput_ = throughput;
+  window_start_ = now;
+  window_bytes_ = 0;
+}
+
+void ParallelRangeHttpFetcher::Stop() {
+  // Connections may report their end synchronously; the delegate is only
+  // notified once all of them did.
+  terminating_connections_ = true;
+  for (Connection& connection : connections_) {
+    if (connection.active) {
+      connection.fetcher->TerminateTransfer();
+    }
+  }
+  terminating_connections_ = false;
+  MaybeNotifyStopped();
+}
+
+void ParallelRangeHttpFetcher::MaybeNotifyStopped() {
+  if (terminating_connections_ || in_delivery_ || ActiveConnections() > 0) {
+    return;
+  }
+  const bool terminated = terminating_;
+  Reset();
+  // Note that after the callback returns this object may be destroyed.
+  if (delegate_) {
+    if (terminated)
+      delegate_->TransferTerminated(this);
+    else
+      delegate_->TransferComplete(this, false);
+  }
+}
+
+void ParallelRangeHttpFetcher::Reset() {
+  transfer_active_ = false;
+  terminating_ = failed_ = false;
+  terminate_requested_ = false;
+  chunks_.clear();
+  num_chunks_ = next_chunk_ = next_deliver_ = 0;
+  // Like the connections, a new transfer starts unpaused.
+  paused_ = false;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,206 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_PARALLEL_RANGE_HTTP_FETCHER_H_
+#define UPDATE_ENGINE_COMMON_PARALLEL_RANGE_HTTP_FETCHER_H_
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/time/time.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/http_fetcher.h"
+
+// This class is a wrapper around several HttpFetchers downloading the range
+// set with SetOffset() and SetLength() over concurrent connections. The range
+// is split in chunks, each fetched by one connection, and the bytes are passed
+// to the delegate in order: the oldest chunk not delivered yet streams through
+// while the following ones are buffered. At most kReorderWindowChunks chunks
+// are in flight or buffered, which bounds the memory used.
+//
+// The number of connections in use adapts to the observed throughput, between
+// 1 and |max_connections|: a connection is added as long as it improves the
+// throughput, and removed when the throughput drops.
+//
+// The connections may go over different networks, see FetcherFactory. The
+// throughput of every connection is measured on the chunks it fetched, and
+// the next chunk goes to the fastest idle connection, after each connection
+// fetched one chunk. So the transfer sticks to the fastest networks while it
+// uses few connections, and spreads over all of them as it uses more.
+//
+// It is meant to be used as the base fetcher of a MultiRangeHttpFetcher,
+// which keeps handling the resume offset. When no length is set, a single
+// connection is used.
+
+namespace chromeos_update_engine {
+
+class ParallelRangeHttpFetcher : public HttpFetcher,
+                                 public HttpFetcherDelegate {
+ public:
+  // Creates a new fetcher, used for the connection of index |connection|,
+  // from 0 to |max_connections| - 1.
+  using FetcherFactory =
+      std::function<std::unique_ptr<HttpFetcher>(size_t connection)>;
+
+  static constexpr size_t kDefaultChunkSize = 4 * 1024 * 1024;
+  static constexpr size_t kReorderWindowChunks = 8;
+
+  ParallelRangeHttpFetcher(size_t max_connections,
+                           FetcherFactory factory,
+                           size_t chunk_size = kDefaultChunkSize);
+  ~ParallelRangeHttpFetcher() override;
+
+  // HttpFetcher overrides.
+  void SetOffset(off_t offset) override {
+    offset_ = offset;
+    bytes_received_ = 0;
+  }
+  void SetLength(size_t length) override { length_ = length; }
+  void UnsetLength() override { length_ = 0; }
+
+  void BeginTransfer(const std::string& url) override;
+  void TerminateTransfer() override;
+
+  void SetHeader(const std::string& header_name,
+                 const std::string& header_value) override;
+  bool GetHeader(const std::string& header_name,
+                 std::string* header_value) const override;
+
+  void Pause() override;
+  void Unpause() override;
+
+  void set_idle_seconds(int seconds) override;
+  void set_retry_seconds(int seconds) override;
+  void SetProxies(const std::deque<std::string>& proxies) override;
+  void set_low_speed_limit(int low_speed_bps, int low_speed_sec) override;
+  void set_connect_timeout(int connect_timeout_seconds) override;
+  void set_max_retry_count(int max_retry_count) override;
+
+  size_t GetBytesDownloaded() override { return offset_ + bytes_received_; }
+
+  // Number of connections the transfer currently aims to use.
+  size_t target_connections() const { return target_connections_; }
+
+ private:
+  struct Chunk {
+    off_t offset{0};
+    // Zero when unbounded.
+    size_t length{0};
+    size_t received{0};
+    // Bytes received while an earlier chunk was not delivered yet.
+    brillo::Blob buffer;
+    bool done{false};
+  };
+
+  struct Connection {
+    // Created on first use.
+    std::unique_ptr<HttpFetcher> fetcher;
+    bool active{false};
+    bool paused{false};
+    // Index of the chunk being fetched.
+    size_t chunk{0};
+    base::TimeTicks chunk_start;
+    // Average bytes per second of the chunks fetched, 0 until one is.
+    double throughput{0};
+  };
+
+  // HttpFetcherDelegate overrides, called by the connections.
+  bool ReceivedBytes(HttpFetcher* fetcher,
+                     const void* bytes,
+                     size_t length) override;
+  void TransferComplete(HttpFetcher* fetcher, bool successful) override;
+  void TransferTerminated(HttpFetcher* fetcher) override;
+
+  Connection* FindConnection(HttpFetcher* fetcher);
+  size_t ActiveConnections() const;
+  // Applies the settings received so far to |fetcher|.
+  void Configure(HttpFetcher* fetcher);
+
+  // Starts fetching the next chunks on idle connections.
+  void ScheduleChunks();
+  // The idle connection to fetch the next chunk.
+  Connection* PickIdleConnection();
+  void StartChunk(Connection* connection);
+
+  // Passes |length| bytes to the delegate. Returns false if the transfer
+  // must stop.
+  bool Deliver(const void* bytes, size_t length);
+  // Delivers the buffered bytes from the oldest chunks, and drops the
+  // completed ones. Returns false if the transfer must stop.
+  bool AdvanceHead();
+
+  // Updates |target_connections_| once per kAdaptInterval.
+  void Adapt();
+
+  // Terminates the active connections, then notifies the delegate.
+  void Stop();
+  // Notifies the delegate of the end of a stopped transfer once no
+  // connection is active.
+  void MaybeNotifyStopped();
+  void Reset();
+
+  const size_t max_connections_;
+  const FetcherFactory factory_;
+  const size_t chunk_size_;
+
+  // Settings forwarded to every connection, -1 when unset.
+  std::map<std::string, std::string> headers_;
+  int idle_seconds_{-1};
+  int retry_seconds_{-1};
+  int low_speed_bps_{-1};
+  int low_speed_sec_{-1};
+  int connect_timeout_seconds_{-1};
+  int max_retry_count_{-1};
+
+  off_t offset_{0};
+  size_t length_{0};
+
+  // Sized to |max_connections_| so that pointers to the elements stay valid.
+  std::vector<Connection> connections_;
+  // The chunks from |next_deliver_| to |next_chunk_|.
+  std::deque<Chunk> chunks_;
+  size_t num_chunks_{0};
+  size_t next_chunk_{0};
+  size_t next_deliver_{0};
+  size_t bytes_received_{0};
+
+  bool transfer_active_{false};
+  bool paused_{false};
+  // Set when the delegate asked to terminate, or a connection failed. The
+  // delegate is notified once every connection stopped.
+  bool terminating_{false};
+  bool failed_{false};
+  bool in_delivery_{false};
+  bool terminate_requested_{false};
+  bool terminating_connections_{false};
+
+  size_t target_connections_{1};
+  int adapt_direction_{1};
+  base::TimeTicks window_start_;
+  size_t window_bytes_{0};
+  double last_throughput_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelRangeHttpFetcher);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_PARALLEL_RANGE_HTTP_FETCHER_H_
@@ -0,0 +1,353 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/parallel_range_http_fetcher.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#include <base/bind.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <brillo/message_loops/message_loop.h>
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/multi_range_http_fetcher.h"
+
+using brillo::MessageLoop;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr size_t kChunkSize = 1000;
+constexpr size_t kPieceSize = 100;
+constexpr char kUrl[] = "http://fake/payload";
+
+// Serves the requested range of |data| in small pieces, each from its own
+// MessageLoop task so that the transfers of several fetchers interleave.
+class FakeRangeFetcher : public HttpFetcher {
+ public:
+  FakeRangeFetcher(const brillo::Blob& data, size_t fail_offset)
+      : data_(data), fail_offset_(fail_offset) {}
+  ~FakeRangeFetcher() override { MessageLoop::current()->CancelTask(task_); }
+
+  void SetOffset(off_t offset) override { offset_ = offset; }
+  void SetLength(size_t length) override { length_ = length; }
+  void UnsetLength() override { length_ = 0; }
+
+  void BeginTransfer(const std::string& url) override {
+    transfers_++;
+    position_ = offset_;
+    end_ = length_ > 0 ? offset_ + length_ : data_.size();
+    http_response_code_ = 206;
+    ScheduleSend();
+  }
+
+  void TerminateTransfer() override {
+    if (in_callback_) {
+      terminate_requested_ = true;
+      return;
+    }
+    MessageLoop::current()->CancelTask(task_);
+    task_ = MessageLoop::kTaskIdNull;
+    if (delegate_)
+      delegate_->TransferTerminated(this);
+  }
+
+  void SetHeader(const std::string& header_name,
+                 const std::string& header_value) override {}
+  bool GetHeader(const std::string& header_name,
+                 std::string* header_value) const override {
+    return false;
+  }
+  void Pause() override {}
+  void Unpause() override {}
+  void set_low_speed_limit(int low_speed_bps, int low_speed_sec) override {}
+  void set_connect_timeout(int connect_timeout_seconds) override {}
+  void set_max_retry_count(int max_retry_count) override {}
+  size_t GetBytesDownloaded() override { return position_; }
+
+  size_t transfers() const { return transfers_; }
+
+ private:
+  void ScheduleSend() {
+    task_ = MessageLoop::current()->PostTask(
+        FROM_HERE,
+        base::Bind(&FakeRangeFetcher::Send, base::Unretained(this)));
+  }
+
+  void Send() {
+    task_ = MessageLoop::kTaskIdNull;
+    if (fail_offset_ >= position_ && fail_offset_ < end_) {
+      http_response_code_ = 500;
+      delegate_->TransferComplete(this, false);
+      return;
+    }
+    const size_t size = std::min(kPieceSize, end_ - position_);
+    in_callback_ = true;
+    const bool keep_going =
+        delegate_->ReceivedBytes(this, data_.data() + position_, size);
+    in_callback_ = false;
+    position_ += size;
+    if (terminate_requested_) {
+      terminate_requested_ = false;
+      delegate_->TransferTerminated(this);
+      return;
+    }
+    if (!keep_going) {
+      return;
+    }
+    if (position_ == end_) {
+      delegate_->TransferComplete(this, true);
+      return;
+    }
+    ScheduleSend();
+  }
+
+  const brillo::Blob& data_;
+  const size_t fail_offset_;
+  size_t offset_{0};
+  size_t length_{0};
+  size_t position_{0};
+  size_t end_{0};
+  bool in_callback_{false};
+  bool terminate_requested_{false};
+  size_t transfers_{0};
+  MessageLoop::TaskId task_{MessageLoop::kTaskIdNull};
+};
+
+class CollectingDelegate : public HttpFetcherDelegate {
+ public:
+  bool ReceivedBytes(HttpFetcher* fetcher,
+                     const void* bytes,
+                     size_t length) override {
+    const uint8_t* data = static_cast<const uint8_t*>(bytes);
+    data_.insert(data_.end(), data, data + length);
+    if (terminate_after_ > 0 && data_.size() >= terminate_after_) {
+      fetcher->TerminateTransfer();
+      return false;
+    }
+    return true;
+  }
+
+  void TransferComplete(HttpFetcher* fetcher, bool successful) override {
+    completed_++;
+    successful_ = successful;
+  }
+
+  void TransferTerminated(HttpFetcher* fetcher) override { terminated_++; }
+
+  brillo::Blob data_;
+  size_t terminate_after_{0};
+  int completed_{0};
+  int terminated_{0};
+  bool successful_{false};
+};
+
+}  // namespace
+
+class ParallelRangeHttpFetcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    loop_.SetAsCurrent();
+    for (size_t i = 0; i < 10 * kChunkSize + 500; i++) {
+      data_.push_back(static_cast<uint8_t>(i * 7 % 251));
+    }
+  }
+
+  void TearDown() override { EXPECT_FALSE(loop_.PendingTasks()); }
+
+  std::unique_ptr<ParallelRangeHttpFetcher> NewFetcher(size_t fail_offset) {
+    auto factory =
+        [this, fail_offset](size_t connection) -> std::unique_ptr<HttpFetcher> {
+      EXPECT_EQ(created_fetchers_, connection);
+      created_fetchers_++;
+      return std::make_unique<FakeRangeFetcher>(data_, fail_offset);
+    };
+    return std::make_unique<ParallelRangeHttpFetcher>(4, factory, kChunkSize);
+  }
+
+  void RunLoop() {
+    while (loop_.RunOnce(false)) {
+    }
+  }
+
+  brillo::Blob Slice(size_t offset, size_t length) const {
+    return brillo::Blob(data_.begin() + offset,
+                        data_.begin() + offset + length);
+  }
+
+  brillo::FakeMessageLoop loop_{nullptr};
+  brillo::Blob data_;
+  size_t created_fetchers_{0};
+  CollectingDelegate delegate_;
+};
+
+TEST_F(ParallelRangeHttpFetcherTest, ReassemblesInOrderTest) {
+  auto fetcher = NewFetcher(SIZE_MAX);
+  fetcher->set_delegate(&delegate_);
+  fetcher->SetOffset(300);
+  fetcher->SetLength(data_.size() - 300);
+  fetcher->BeginTransfer(kUrl);
+  RunLoop();
+
+  EXPECT_EQ(1, delegate_.completed_);
+  EXPECT_TRUE(delegate_.successful_);
+  EXPECT_EQ(Slice(300, data_.size() - 300), delegate_.data_);
+  EXPECT_EQ(data_.size(), fetcher->GetBytesDownloaded());
+  // The chunks were fetched concurrently.
+  EXPECT_GT(created_fetchers_, 1u);
+}
+
+TEST_F(ParallelRangeHttpFetcherTest, MultiRangeTest) {
+  // The way DownloadAction resumes: a range starting at the resume offset.
+  MultiRangeHttpFetcher fetcher(NewFetcher(SIZE_MAX).release());
+  fetcher.set_delegate(&delegate_);
+  fetcher.AddRange(2500, data_.size() - 2500);
+  fetcher.AddRange(100, 2 * kChunkSize);
+  fetcher.BeginTransfer(kUrl);
+  RunLoop();
+
+  brillo::Blob expected = Slice(2500, data_.size() - 2500);
+  const brillo::Blob second = Slice(100, 2 * kChunkSize);
+  expected.insert(expected.end(), second.begin(), second.end());
+  EXPECT_EQ(1, delegate_.completed_);
+  EXPECT_TRUE(delegate_.successful_);
+  EXPECT_EQ(expected, delegate_.data_);
+}
+
+TEST_F(ParallelRangeHttpFetcherTest, MultiRangePrefetchTest) {
+  // The way DownloadAction downloads the data of the operations left.
+  auto base_fetcher = new FakeRangeFetcher(data_, SIZE_MAX);
+  auto prefetch_fetcher = new FakeRangeFetcher(data_, SIZE_MAX);
+  MultiRangeHttpFetcher fetcher(base_fetcher);
+  fetcher.set_prefetch_fetcher(prefetch_fetcher);
+  fetcher.set_delegate(&delegate_);
+  brillo::Blob expected;
+  for (size_t offset : {7000, 100, 5000, 5250, 9000, 300}) {
+    fetcher.AddRange(offset, 250);
+    const brillo::Blob range = Slice(offset, 250);
+    expected.insert(expected.end(), range.begin(), range.end());
+  }
+  fetcher.BeginTransfer(kUrl);
+  RunLoop();
+
+  EXPECT_EQ(1, delegate_.completed_);
+  EXPECT_TRUE(delegate_.successful_);
+  EXPECT_EQ(expected, delegate_.data_);
+  // Every range was fetched once, alternating between the fetchers.
+  EXPECT_EQ(3u, base_fetcher->transfers());
+  EXPECT_EQ(3u, prefetch_fetcher->transfers());
+}
+
+TEST_F(ParallelRangeHttpFetcherTest, MultiRangeFailedPrefetchTest) {
+  // The prefetch of the second range fails, it's fetched again after the
+  // first one.
+  auto base_fetcher = new FakeRangeFetcher(data_, SIZE_MAX);
+  auto prefetch_fetcher = new FakeRangeFetcher(data_, 2100);
+  MultiRangeHttpFetcher fetcher(base_fetcher);
+  fetcher.set_prefetch_fetcher(prefetch_fetcher);
+  fetcher.set_delegate(&delegate_);
+  fetcher.AddRange(0, 1000);
+  fetcher.AddRange(2000, 1000);
+  fetcher.AddRange(4000, 1000);
+  fetcher.BeginTransfer(kUrl);
+  RunLoop();
+
+  brillo::Blob expected = Slice(0, 1000);
+  for (size_t offset : {2000, 4000}) {
+    const brillo::Blob range = Slice(offset, 1000);
+    expected.insert(expected.end(), range.begin(), range.end());
+  }
+  EXPECT_EQ(1, delegate_.completed_);
+  EXPECT_TRUE(delegate_.successful_);
+  EXPECT_EQ(expected, delegate_.data_);
+  EXPECT_EQ(2u, base_fetcher->transfers());
+  EXPECT_EQ(2u, prefetch_fetcher->transfers());
+}
+
+TEST_F(ParallelRangeHttpFetcherTest, MultiRangePrefetchTerminateTest) {
+  MultiRangeHttpFetcher fetcher(new FakeRangeFetcher(data_, SIZE_MAX));
+  fetcher.set_prefetch_fetcher(new FakeRangeFetcher(data_, SIZE_MAX));
+  fetcher.set_delegate(&delegate_);
+  delegate_.terminate_after_ = 1500;
+  for (size_t offset = 0; offset < 5000; offset += 1000) {
+    fetcher.AddRange(offset, 500);
+  }
+  fetcher.BeginTransfer(kUrl);
+  RunLoop();
+
+  EXPECT_EQ(0, delegate_.completed_);
+  EXPECT_EQ(1, delegate_.terminated_);
+  brillo::Blob expected;
+  for (size_t offset = 0; offset < 4000; offset += 1000) {
+    const brillo::Blob range = Slice(offset, 500);
+    expected.insert(expected.end(), range.begin(), range.end());
+  }
+  expected.resize(delegate_.data_.size());
+  EXPECT_EQ(expected, delegate_.data_);
+  EXPECT_LT(delegate_.data_.size(), 2500u);
+}
+
+TEST_F(ParallelRangeHttpFetcherTest, UnboundedRangeTest) {
+  auto fetcher = NewFetcher(SIZE_MAX);
+  fetcher->set_delegate(&delegate_);
+  fetcher->SetOffset(9000);
+  fetcher->UnsetLength();
+  fetcher->BeginTransfer(kUrl);
+  RunLoop();
+
+  EXPECT_EQ(1, delegate_.completed_);
+  EXPECT_TRUE(delegate_.successful_);
+  EXPECT_EQ(Slice(9000, data_.size() - 9000), delegate_.data_);
+  EXPECT_EQ(1u, created_fetchers_);
+}
+
+TEST_F(ParallelRangeHttpFetcherTest, FailedChunkTest) {
+  auto fetcher = NewFetcher(5 * kChunkSize + 10);
+  fetcher->set_delegate(&delegate_);
+  fetcher->SetOffset(0);
+  fetcher->SetLength(data_.size());
+  fetcher->BeginTransfer(kUrl);
+  RunLoop();
+
+  EXPECT_EQ(1, delegate_.completed_);
+  EXPECT_FALSE(delegate_.successful_);
+  EXPECT_EQ(0, delegate_.terminated_);
+  EXPECT_EQ(500, fetcher->http_response_code());
+  // Only the bytes before the failed chunk may be delivered, in order.
+  ASSERT_LE(delegate_.data_.size(), 5 * kChunkSize);
+  EXPECT_EQ(Slice(0, delegate_.data_.size()), delegate_.data_);
+}
+
+TEST_F(ParallelRangeHttpFetcherTest, TerminateTest) {
+  auto fetcher = NewFetcher(SIZE_MAX);
+  fetcher->set_delegate(&delegate_);
+  delegate_.terminate_after_ = 2 * kChunkSize + 50;
+  fetcher->SetOffset(0);
+  fetcher->SetLength(data_.size());
+  fetcher->BeginTransfer(kUrl);
+  RunLoop();
+
+  EXPECT_EQ(0, delegate_.completed_);
+  EXPECT_EQ(1, delegate_.terminated_);
+  EXPECT_EQ(Slice(0, delegate_.data_.size()), delegate_.data_);
+  EXPECT_LT(delegate_.data_.size(), data_.size());
+}
+
+}  // namespace chromeos_update_engine
@@ -16,14 +16,19 @@
 
 #include "update_engine/common/prefs.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
 #include <algorithm>
 #include <filesystem>
-#include <unistd.h>
+#include <utility>
 
 #include <android-base/file.h>
 #include <base/files/file_enumerator.h>
 #include <base/files/file_util.h>
 #include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_split.h>
 #include <base/strings/string_util.h>
@@ -54,18 +59,42 @@ void DeleteEmptyDirectories(const base::FilePath& path) {
 
 }  // namespace
 
+PrefsBase::PrefsBase(StorageInterface* storage) : storage_(storage) {
+  observer_snapshots_.push_back(std::make_unique<ObserverMap>());
+  observers_ = observer_snapshots_.back().get();
+}
+
+std::shared_mutex& PrefsBase::KeyLock(std::string_view key) const {
+  return key_locks_[std::hash<std::string_view>{}(key) % kKeyLockShards];
+}
+
+void PrefsBase::NotifyObservers(std::string_view key, bool deleted) const {
+  // The snapshot never changes, so observers may add or remove observers.
+  const ObserverMap* observers = observers_.load(std::memory_order_acquire);
+  const auto observers_for_key = observers->find(key);
+  if (observers_for_key == observers->end())
+    return;
+  for (ObserverInterface* observer : observers_for_key->second) {
+    if (deleted)
+      observer->OnPrefDeleted(key);
+    else
+      observer->OnPrefSet(key);
+  }
+}
+
 bool PrefsBase::GetString(const std::string_view key, string* value) const {
+  std::shared_lock transaction_lock(transaction_lock_);
+  std::shared_lock key_lock(KeyLock(key));
   return storage_->GetKey(key, value);
 }
 
 bool PrefsBase::SetString(std::string_view key, std::string_view value) {
-  TEST_AND_RETURN_FALSE(storage_->SetKey(key, value));
-  const auto observers_for_key = observers_.find(key);
-  if (observers_for_key != observers_.end()) {
-    std::vector<ObserverInterface*> copy_observers(observers_for_key->second);
-    for (ObserverInterface* observer : copy_observers)
-      observer->OnPrefSet(key);
+  {
+    std::shared_lock transaction_lock(transaction_lock_);
+    std::unique_lock key_lock(KeyLock(key));
+    TEST_AND_RETURN_FALSE(storage_->SetKey(key, value));
   }
+  NotifyObservers(key, false);
   return true;
 }
 
@@ -112,17 +141,18 @@ bool PrefsBase::SetBoolean(std::string_view key, const bool value) {
 }
 
 bool PrefsBase::Exists(std::string_view key) const {
+  std::shared_lock transaction_lock(transaction_lock_);
+  std::shared_lock key_lock(KeyLock(key));
   return storage_->KeyExists(key);
 }
 
 bool PrefsBase::Delete(std::string_view key) {
-  TEST_AND_RETURN_FALSE(storage_->DeleteKey(key));
-  const auto observers_for_key = observers_.find(key);
-  if (observers_for_key != observers_.end()) {
-    std::vector<ObserverInterface*> copy_observers(observers_for_key->second);
-    for (ObserverInterface* observer : copy_observers)
-      observer->OnPrefDeleted(key);
+  {
+    std::shared_lock transaction_lock(transaction_lock_);
+    std::unique_lock key_lock(KeyLock(key));
+    TEST_AND_RETURN_FALSE(storage_->DeleteKey(key));
   }
+  NotifyObservers(key, true);
   return true;
 }
 
@@ -145,21 +175,31 @@ bool PrefsBase::Delete(std::string_view pref_key, const vector<string>& nss) {
 }
 
 bool PrefsBase::GetSubKeys(std::string_view ns, vector<string>* keys) const {
+  std::shared_lock transaction_lock(transaction_lock_);
   return storage_->GetSubKeys(ns, keys);
 }
 
 void PrefsBase::AddObserver(std::string_view key, ObserverInterface* observer) {
-  observers_[std::string{key}].push_back(observer);
+  std::lock_guard lock(observers_lock_);
+  auto observers = std::make_unique<ObserverMap>(*observers_.load());
+  (*observers)[std::string{key}].push_back(observer);
+  observers_.store(observers.get(), std::memory_order_release);
+  observer_snapshots_.push_back(std::move(observers));
 }
 
 void PrefsBase::RemoveObserver(std::string_view key,
                                ObserverInterface* observer) {
+  std::lock_guard lock(observers_lock_);
+  auto observers = std::make_unique<ObserverMap>(*observers_.load());
   std::vector<ObserverInterface*>& observers_for_key =
-      observers_[std::string{key}];
+      (*observers)[std::string{key}];
   auto observer_it =
       std::find(observers_for_key.begin(), observers_for_key.end(), observer);
-  if (observer_it != observers_for_key.end())
-    observers_for_key.erase(observer_it);
+  if (observer_it == observers_for_key.end())
+    return;
+  observers_for_key.erase(observer_it);
+  observers_.store(observers.get(), std::memory_order_release);
+  observer_snapshots_.push_back(std::move(observers));
 }
 
 string PrefsInterface::CreateSubKey(const vector<string>& ns_and_key) {
@@ -173,14 +213,17 @@ bool Prefs::Init(const base::FilePath& prefs_dir) {
 }
 
 bool PrefsBase::StartTransaction() {
+  std::unique_lock transaction_lock(transaction_lock_);
   return storage_->CreateTemporaryPrefs();
 }
 
 bool PrefsBase::CancelTransaction() {
+  std::unique_lock transaction_lock(transaction_lock_);
   return storage_->DeleteTemporaryPrefs();
 }
 
 bool PrefsBase::SubmitTransaction() {
+  std::unique_lock transaction_lock(transaction_lock_);
   return storage_->SwapPrefs();
 }
 
@@ -324,6 +367,7 @@ bool Prefs::FileStorage::GetFileNameForKey(std::string_view key,
 
 bool MemoryPrefs::MemoryStorage::GetKey(std::string_view key,
                                         string* value) const {
+  std::shared_lock lock(values_lock_);
   auto it = values_.find(key);
   if (it == values_.end())
     return false;
@@ -333,6 +377,7 @@ bool MemoryPrefs::MemoryStorage::GetKey(std::string_view key,
 
 bool MemoryPrefs::MemoryStorage::GetSubKeys(std::string_view ns,
                                             vector<string>* keys) const {
+  std::shared_lock lock(values_lock_);
   auto lower_comp = [](const auto& pr, const auto& ns) {
     return std::string_view{pr.first.data(), ns.length()} < ns;
   };
@@ -349,19 +394,417 @@ bool MemoryPrefs::MemoryStorage::GetSubKeys(std::string_view ns,
 
 bool MemoryPrefs::MemoryStorage::SetKey(std::string_view key,
                                         std::string_view value) {
+  std::unique_lock lock(values_lock_);
   values_[std::string{key}] = value;
   return true;
 }
 
 bool MemoryPrefs::MemoryStorage::KeyExists(std::string_view key) const {
+  std::shared_lock lock(values_lock_);
   return values_.find(key) != values_.end();
 }
 
 bool MemoryPrefs::MemoryStorage::DeleteKey(std::string_view key) {
+  std::unique_lock lock(values_lock_);
   auto it = values_.find(key);
   if (it != values_.end())
     values_.erase(it);
   return true;
 }
 
+// LogPrefs
+
+namespace {
+
+// The log starts with a header made of a magic and a version, followed by
+// records made of, all integers in little endian:
+//   uint32 payload size, uint32 CRC32 of the payload, and the payload made of
+//   uint8 type, uint8 flags, uint32 key size, the key and the value.
+// The records of a transaction are applied once its last record, which has
+// kLogRecordCommit set, is read.
+constexpr char kLogHeader[] = {'U', 'E', 'P', 'L', 1, 0, 0, 0};
+constexpr size_t kLogRecordHeaderSize = 2 * sizeof(uint32_t);
+constexpr size_t kLogPayloadHeaderSize = 2 + sizeof(uint32_t);
+
+constexpr uint8_t kLogRecordSet = 1;
+constexpr uint8_t kLogRecordDelete = 2;
+constexpr uint8_t kLogRecordCommit = 1 << 0;
+
+// The log is compacted once it is larger than this size and than
+// |kLogCompactionRatio| times the size of the current values.
+constexpr uint64_t kLogCompactionMinSize = 64 * 1024;
+constexpr uint64_t kLogCompactionRatio = 4;
+
+void AppendLE32(uint32_t value, string* out) {
+  for (size_t i = 0; i < sizeof(value); i++) {
+    out->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+uint32_t ReadLE32(const char* data) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < sizeof(value); i++) {
+    value |= static_cast<uint32_t>(static_cast<uint8_t>(data[i])) << (8 * i);
+  }
+  return value;
+}
+
+uint32_t Crc32(std::string_view data) {
+  return crc32(0,
+               reinterpret_cast<const Bytef*>(data.data()),
+               static_cast<uInt>(data.size()));
+}
+
+size_t LogRecordSize(std::string_view key, std::string_view value) {
+  return kLogRecordHeaderSize + kLogPayloadHeaderSize + key.size() +
+         value.size();
+}
+
+void AppendLogRecord(uint8_t type,
+                     std::string_view key,
+                     std::string_view value,
+                     string* out) {
+  string payload;
+  payload.reserve(kLogPayloadHeaderSize + key.size() + value.size());
+  payload.push_back(static_cast<char>(type));
+  payload.push_back(0);
+  AppendLE32(key.size(), &payload);
+  payload.append(key);
+  payload.append(value);
+  AppendLE32(payload.size(), out);
+  AppendLE32(Crc32(payload), out);
+  out->append(payload);
+}
+
+// Sets kLogRecordCommit on the last of the records in |records|.
+void CommitLogRecords(string* records, size_t last_record_offset) {
+  (*records)[last_record_offset + kLogRecordHeaderSize + 1] |=
+      static_cast<char>(kLogRecordCommit);
+  // The flags are covered by the CRC, recompute it.
+  const std::string_view payload =
+      std::string_view(*records).substr(last_record_offset +
+                                        kLogRecordHeaderSize);
+  string crc;
+  AppendLE32(Crc32(payload), &crc);
+  records->replace(last_record_offset + sizeof(uint32_t), crc.size(), crc);
+}
+
+}  // namespace
+
+bool LogPrefs::Init(const base::FilePath& log_path,
+                    const base::FilePath& legacy_prefs_dir) {
+  return log_storage_.Init(log_path, legacy_prefs_dir);
+}
+
+LogPrefs::LogStorage::~LogStorage() {
+  if (log_fd_ >= 0) {
+    IGNORE_EINTR(close(log_fd_));
+  }
+}
+
+bool LogPrefs::LogStorage::Init(const base::FilePath& log_path,
+                                const base::FilePath& legacy_prefs_dir) {
+  log_path_ = log_path;
+  if (base::PathExists(log_path_)) {
+    TEST_AND_RETURN_FALSE(ReadLog());
+  } else if (!legacy_prefs_dir.empty() &&
+             (base::PathExists(legacy_prefs_dir) ||
+              base::PathExists(base::FilePath(legacy_prefs_dir.value() +
+                                              "_tmp")))) {
+    TEST_AND_RETURN_FALSE(ImportPrefsDir(legacy_prefs_dir));
+  }
+  // Start from a clean log, holding the current values only.
+  TEST_AND_RETURN_FALSE(Compact());
+  if (!legacy_prefs_dir.empty() && base::PathExists(legacy_prefs_dir)) {
+    LOG(INFO) << "Deleting " << legacy_prefs_dir << " imported into "
+              << log_path_;
+    LOG_IF(WARNING, !utils::DeleteDirectory(legacy_prefs_dir.value().c_str()))
+        << "Failed to delete " << legacy_prefs_dir;
+  }
+  return true;
+}
+
+bool LogPrefs::LogStorage::IsValidKey(std::string_view key) {
+  // Allows only non-empty keys containing [A-Za-z0-9_-/], as Prefs does.
+  TEST_AND_RETURN_FALSE(!key.empty());
+  for (char c : key)
+    TEST_AND_RETURN_FALSE(base::IsAsciiAlpha(c) || base::IsAsciiDigit(c) ||
+                          c == '_' || c == '-' || c == kKeySeparator);
+  return true;
+}
+
+bool LogPrefs::LogStorage::ReadLog() {
+  string log;
+  TEST_AND_RETURN_FALSE(utils::ReadFile(log_path_.value(), &log));
+  if (log.compare(0, sizeof(kLogHeader), kLogHeader, sizeof(kLogHeader)) !=
+      0) {
+    LOG(ERROR) << "Invalid prefs log header in " << log_path_
+               << ", starting from empty prefs.";
+    return true;
+  }
+  std::string_view data = std::string_view(log).substr(sizeof(kLogHeader));
+  // Changes of the transaction being read, applied on commit.
+  vector<std::pair<string, std::optional<string>>> batch;
+  size_t records = 0;
+  while (data.size() >= kLogRecordHeaderSize) {
+    const uint32_t payload_size = ReadLE32(data.data());
+    const uint32_t crc = ReadLE32(data.data() + sizeof(uint32_t));
+    if (payload_size < kLogPayloadHeaderSize ||
+        data.size() - kLogRecordHeaderSize < payload_size) {
+      break;
+    }
+    const std::string_view payload =
+        data.substr(kLogRecordHeaderSize, payload_size);
+    if (Crc32(payload) != crc) {
+      break;
+    }
+    const uint8_t type = payload[0];
+    const uint8_t flags = payload[1];
+    const uint32_t key_size = ReadLE32(payload.data() + 2);
+    if (payload_size - kLogPayloadHeaderSize < key_size ||
+        (type != kLogRecordSet && type != kLogRecordDelete)) {
+      break;
+    }
+    const std::string_view key =
+        payload.substr(kLogPayloadHeaderSize, key_size);
+    if (type == kLogRecordSet) {
+      batch.emplace_back(
+          key, string(payload.substr(kLogPayloadHeaderSize + key_size)));
+    } else {
+      batch.emplace_back(key, std::nullopt);
+    }
+    data.remove_prefix(kLogRecordHeaderSize + payload_size);
+    records++;
+    if (flags & kLogRecordCommit) {
+      for (auto& [batch_key, value] : batch) {
+        if (value) {
+          values_[batch_key] = std::move(*value);
+        } else {
+          values_.erase(batch_key);
+        }
+      }
+      batch.clear();
+    }
+  }
+  LOG_IF(WARNING, !data.empty() || !batch.empty())
+      << "Dropped an incomplete transaction at the end of " << log_path_;
+  LOG(INFO) << "Loaded " << values_.size() << " prefs from " << records
+            << " records of " << log_path_;
+  return true;
+}
+
+bool LogPrefs::LogStorage::ImportPrefsDir(const base::FilePath& prefs_dir) {
+  // Prefs::Init() completes a transaction interrupted while swapping the
+  // directories.
+  Prefs legacy_prefs;
+  TEST_AND_RETURN_FALSE(legacy_prefs.Init(prefs_dir));
+  base::FileEnumerator prefs_enum(prefs_dir, true, base::FileEnumerator::FILES);
+  for (base::FilePath f = prefs_enum.Next(); !f.empty();
+       f = prefs_enum.Next()) {
+    const string key =
+        f.value().substr(prefs_dir.AsEndingWithSeparator().value().length());
+    string value;
+    if (!IsValidKey(key) || !legacy_prefs.GetString(key, &value)) {
+      LOG(WARNING) << "Not importing " << f;
+      continue;
+    }
+    values_[key] = std::move(value);
+  }
+  LOG(INFO) << "Imported " << values_.size() << " prefs from " << prefs_dir;
+  return true;
+}
+
+bool LogPrefs::LogStorage::GetKey(std::string_view key, string* value) const {
+  std::lock_guard lock(lock_);
+  auto it = values_.find(key);
+  if (it == values_.end())
+    return false;
+  *value = it->second;
+  return true;
+}
+
+bool LogPrefs::LogStorage::GetSubKeys(std::string_view ns,
+                                      vector<string>* keys) const {
+  TEST_AND_RETURN_FALSE(IsValidKey(ns));
+  std::lock_guard lock(lock_);
+  for (auto it = values_.lower_bound(ns);
+       it != values_.end() && it->first.compare(0, ns.size(), ns) == 0;
+       it++) {
+    keys->push_back(it->first);
+  }
+  return true;
+}
+
+bool LogPrefs::LogStorage::SetKey(std::string_view key,
+                                  std::string_view value) {
+  std::lock_guard lock(lock_);
+  return UpdateKey(key, &value);
+}
+
+bool LogPrefs::LogStorage::KeyExists(std::string_view key) const {
+  std::lock_guard lock(lock_);
+  return values_.find(key) != values_.end();
+}
+
+bool LogPrefs::LogStorage::DeleteKey(std::string_view key) {
+  TEST_AND_RETURN_FALSE(IsValidKey(key));
+  std::lock_guard lock(lock_);
+  if (values_.find(key) == values_.end()) {
+    return true;
+  }
+  return UpdateKey(key, nullptr);
+}
+
+bool LogPrefs::LogStorage::UpdateKey(std::string_view key,
+                                     const std::string_view* value) {
+  TEST_AND_RETURN_FALSE(IsValidKey(key));
+  auto it = values_.find(key);
+  if (in_transaction_) {
+    // Only the first change of a key needs to be undone.
+    if (transaction_undo_.find(key) == transaction_undo_.end()) {
+      transaction_undo_.emplace(
+          key,
+          it == values_.end() ? std::nullopt
+                              : std::optional<string>(it->second));
+    }
+  } else {
+    string record;
+    AppendLogRecord(value ? kLogRecordSet : kLogRecordDelete,
+                    key,
+                    value ? *value : "",
+                    &record);
+    CommitLogRecords(&record, 0);
+    TEST_AND_RETURN_FALSE(AppendToLog(record));
+  }
+
+  if (it != values_.end()) {
+    live_size_ -= LogRecordSize(key, it->second);
+  }
+  if (value) {
+    live_size_ += LogRecordSize(key, *value);
+    if (it != values_.end()) {
+      it->second = *value;
+    } else {
+      values_.emplace(key, *value);
+    }
+  } else {
+    values_.erase(it);
+  }
+  if (in_transaction_) {
+    AppendLogRecord(value ? kLogRecordSet : kLogRecordDelete,
+                    key,
+                    value ? *value : "",
+                    &transaction_records_);
+    return true;
+  }
+  return MaybeCompact();
+}
+
+bool LogPrefs::LogStorage::CreateTemporaryPrefs() {
+  // Like Prefs, starting a transaction discards any pending one.
+  DeleteTemporaryPrefs();
+  in_transaction_ = true;
+  return true;
+}
+
+bool LogPrefs::LogStorage::DeleteTemporaryPrefs() {
+  if (!in_transaction_) {
+    return true;
+  }
+  for (auto& [key, value] : transaction_undo_) {
+    auto it = values_.find(key);
+    if (it != values_.end()) {
+      live_size_ -= LogRecordSize(key, it->second);
+      values_.erase(it);
+    }
+    if (value) {
+      live_size_ += LogRecordSize(key, *value);
+      values_.emplace(key, std::move(*value));
+    }
+  }
+  in_transaction_ = false;
+  transaction_records_.clear();
+  transaction_undo_.clear();
+  return true;
+}
+
+bool LogPrefs::LogStorage::SwapPrefs() {
+  TEST_AND_RETURN_FALSE(in_transaction_);
+  if (!transaction_records_.empty()) {
+    // Find the last record, to mark the end of the transaction.
+    size_t last_record_offset = 0;
+    for (size_t offset = 0; offset < transaction_records_.size();) {
+      last_record_offset = offset;
+      offset += kLogRecordHeaderSize +
+                ReadLE32(transaction_records_.data() + offset);
+    }
+    CommitLogRecords(&transaction_records_, last_record_offset);
+    if (!AppendToLog(transaction_records_)) {
+      LOG(ERROR) << "Failed to write the transaction to " << log_path_;
+      DeleteTemporaryPrefs();
+      return false;
+    }
+  }
+  in_transaction_ = false;
+  transaction_records_.clear();
+  transaction_undo_.clear();
+  return MaybeCompact();
+}
+
+bool LogPrefs::LogStorage::AppendToLog(const string& records) {
+  TEST_AND_RETURN_FALSE(log_fd_ >= 0);
+  if (!utils::WriteAll(log_fd_, records.data(), records.size())) {
+    PLOG(ERROR) << "Failed to append to " << log_path_;
+    // Drop the partially written records, so that the next ones can be read.
+    if (ftruncate(log_fd_, log_size_) != 0) {
+      PLOG(ERROR) << "Failed to truncate " << log_path_;
+    }
+    return false;
+  }
+  if (fdatasync(log_fd_) != 0) {
+    PLOG(ERROR) << "Failed to sync " << log_path_;
+    return false;
+  }
+  log_size_ += records.size();
+  return true;
+}
+
+bool LogPrefs::LogStorage::MaybeCompact() {
+  if (log_size_ < kLogCompactionMinSize ||
+      log_size_ < kLogCompactionRatio * (sizeof(kLogHeader) + live_size_)) {
+    return true;
+  }
+  // The changes are already in the log, a failure to compact is not fatal.
+  LOG_IF(WARNING, !Compact()) << "Failed to compact " << log_path_;
+  return true;
+}
+
+bool LogPrefs::LogStorage::Compact() {
+  string log(kLogHeader, sizeof(kLogHeader));
+  size_t last_record_offset = 0;
+  live_size_ = 0;
+  for (const auto& [key, value] : values_) {
+    last_record_offset = log.size();
+    AppendLogRecord(kLogRecordSet, key, value, &log);
+    live_size_ += LogRecordSize(key, value);
+  }
+  if (!values_.empty()) {
+    CommitLogRecords(&log, last_record_offset);
+  }
+  // WriteStringToFileAtomic() syncs the new log before renaming it over the
+  // old one, and then syncs the directory.
+  TEST_AND_RETURN_FALSE(utils::WriteStringToFileAtomic(log_path_.value(), log));
+  if (log_fd_ >= 0) {
+    IGNORE_EINTR(close(log_fd_));
+  }
+  log_fd_ = HANDLE_EINTR(
+      open(log_path_.value().c_str(), O_WRONLY | O_APPEND | O_CLOEXEC));
+  if (log_fd_ < 0) {
+    PLOG(ERROR) << "Failed to open " << log_path_;
+    return false;
+  }
+  log_size_ = log.size();
+  return true;
+}
+
 }  // namespace chromeos_update_engine
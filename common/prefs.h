@@ -17,8 +17,14 @@
 #ifndef UPDATE_ENGINE_COMMON_PREFS_H_
 #define UPDATE_ENGINE_COMMON_PREFS_H_
 
+#include <array>
+#include <atomic>
 #include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -32,6 +38,12 @@ namespace chromeos_update_engine {
 
 // Implements a preference store by storing the value associated with a key
 // in a given storage passed during construction.
+//
+// PrefsBase may be used from several threads at once. Operations on a key are
+// serialized by the lock of the shard the key hashes to, so that threads
+// working on different keys rarely wait on each other, and the transaction
+// operations exclude all the others. Observers are called without any lock
+// held, from an immutable snapshot of the registered observers.
 class PrefsBase : public PrefsInterface {
  public:
   // Storage interface used to set and retrieve keys.
@@ -51,6 +63,9 @@ class PrefsBase : public PrefsInterface {
 
     // Set the value of the key named |key| to |value| regardless of the
     // previous value. Returns whether the operation succeeded.
+    //
+    // The key operations may be called concurrently for different keys, but
+    // never concurrently with the transaction operations below.
     virtual bool SetKey(std::string_view key, std::string_view value) = 0;
 
     // Returns whether the key named |key| exists.
@@ -75,7 +90,7 @@ class PrefsBase : public PrefsInterface {
     DISALLOW_COPY_AND_ASSIGN(StorageInterface);
   };
 
-  explicit PrefsBase(StorageInterface* storage) : storage_(storage) {}
+  explicit PrefsBase(StorageInterface* storage);
 
   // PrefsInterface methods.
   bool GetString(std::string_view key, std::string* value) const override;
@@ -101,9 +116,29 @@ class PrefsBase : public PrefsInterface {
                       ObserverInterface* observer) override;
 
  private:
-  // The registered observers watching for changes.
-  std::map<std::string, std::vector<ObserverInterface*>, std::less<>>
-      observers_;
+  using ObserverMap =
+      std::map<std::string, std::vector<ObserverInterface*>, std::less<>>;
+
+  static constexpr size_t kKeyLockShards = 16;
+
+  // Returns the lock serializing the operations on |key|.
+  std::shared_mutex& KeyLock(std::string_view key) const;
+
+  // Calls OnPrefDeleted() or OnPrefSet() on the observers of |key|.
+  void NotifyObservers(std::string_view key, bool deleted) const;
+
+  // Held shared by the key operations and exclusively by the transaction
+  // operations, so that a transaction starts and ends atomically.
+  mutable std::shared_mutex transaction_lock_;
+  mutable std::array<std::shared_mutex, kKeyLockShards> key_locks_;
+
+  // The current snapshot of the registered observers watching for changes.
+  // AddObserver() and RemoveObserver() publish a new snapshot, and keep the
+  // previous ones alive in |observer_snapshots_| since a notification may
+  // still be walking them.
+  std::atomic<const ObserverMap*> observers_;
+  std::vector<std::unique_ptr<const ObserverMap>> observer_snapshots_;
+  std::mutex observers_lock_;
 
   // The concrete implementation of the storage used for the keys.
   StorageInterface* storage_;
@@ -190,8 +225,9 @@ class MemoryPrefs : public PrefsBase {
     bool DeleteKey(std::string_view key) override;
 
    private:
-    // The std::map holding the values in memory.
+    // The std::map holding the values in memory, and its lock.
     std::map<std::string, std::string, std::less<>> values_;
+    mutable std::shared_mutex values_lock_;
   };
 
   // The concrete memory storage implementation.
@@ -199,6 +235,101 @@ class MemoryPrefs : public PrefsBase {
 
   DISALLOW_COPY_AND_ASSIGN(MemoryPrefs);
 };
+
+// Implements a preference store in a single append-only log file. All the
+// values are kept in memory, every change is appended to the log as a CRC
+// protected record, and the log is compacted once it mostly holds stale
+// records. Changes made within a transaction are appended and synced together
+// when it is submitted, and are discarded on replay if they weren't all
+// written.
+
+class LogPrefs : public PrefsBase {
+ public:
+  LogPrefs() : PrefsBase(&log_storage_) {}
+
+  // Initializes the store by associating this object with |log_path|. If the
+  // log doesn't exist yet and |legacy_prefs_dir| holds a Prefs store, its
+  // keys are imported and the directory is deleted. Returns true on success,
+  // false otherwise.
+  bool Init(const base::FilePath& log_path,
+            const base::FilePath& legacy_prefs_dir);
+
+ private:
+  FRIEND_TEST(LogPrefsTest, CompactionTest);
+
+  class LogStorage : public PrefsBase::StorageInterface {
+   public:
+    LogStorage() = default;
+    ~LogStorage() override;
+
+    bool Init(const base::FilePath& log_path,
+              const base::FilePath& legacy_prefs_dir);
+
+    // PrefsBase::StorageInterface overrides.
+    bool GetKey(std::string_view key, std::string* value) const override;
+    bool GetSubKeys(std::string_view ns,
+                    std::vector<std::string>* keys) const override;
+    bool SetKey(std::string_view key, std::string_view value) override;
+    bool KeyExists(std::string_view key) const override;
+    bool DeleteKey(std::string_view key) override;
+    bool CreateTemporaryPrefs() override;
+    bool DeleteTemporaryPrefs() override;
+    bool SwapPrefs() override;
+
+    // Returns the size of the log file.
+    uint64_t log_size() const { return log_size_; }
+
+   private:
+    // Returns whether |key| is a valid key name.
+    static bool IsValidKey(std::string_view key);
+
+    // Replays the records of the log into |values_|, dropping any incomplete
+    // transaction at its end.
+    bool ReadLog();
+
+    // Imports the keys of the Prefs store in |prefs_dir|.
+    bool ImportPrefsDir(const base::FilePath& prefs_dir);
+
+    // Sets or deletes, when |value| is null, the key named |key|.
+    bool UpdateKey(std::string_view key, const std::string_view* value);
+
+    // Appends |records| to the log and syncs it.
+    bool AppendToLog(const std::string& records);
+
+    // Rewrites the log with only the current values, if the stale records
+    // take most of it.
+    bool MaybeCompact();
+    bool Compact();
+
+    // Guards the members below against concurrent key operations. The
+    // transaction operations run alone and don't need it.
+    mutable std::mutex lock_;
+
+    // Path of the log file.
+    base::FilePath log_path_;
+    // File descriptor of the log opened for appending, or -1.
+    int log_fd_{-1};
+    // The size of the log, and the size the current values take in it.
+    uint64_t log_size_{0};
+    uint64_t live_size_{0};
+
+    // The current values, including the changes of a pending transaction.
+    std::map<std::string, std::string, std::less<>> values_;
+
+    // While a transaction is pending, its records and the values the keys it
+    // changed had when it started, which are restored if it is cancelled.
+    bool in_transaction_{false};
+    std::string transaction_records_;
+    std::map<std::string, std::optional<std::string>, std::less<>>
+        transaction_undo_;
+  };
+
+  // The concrete log storage implementation.
+  LogStorage log_storage_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogPrefs);
+};
+
 }  // namespace chromeos_update_engine
 
 #endif  // UPDATE_ENGINE_COMMON_PREFS_H_
@@ -18,8 +18,11 @@
 
 #include <inttypes.h>
 
+#include <atomic>
 #include <limits>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <base/files/file_util.h>
@@ -44,8 +47,68 @@ const char kKey[] = "test-key";
 
 namespace chromeos_update_engine {
 
+class CountingPrefsObserver : public PrefsInterface::ObserverInterface {
+ public:
+  void OnPrefSet(std::string_view) override { set_count_++; }
+  void OnPrefDeleted(std::string_view) override {}
+
+  std::atomic<int> set_count_{0};
+};
+
 class BasePrefsTest : public ::testing::Test {
  protected:
+  // Sets, reads and deletes keys from several threads, while another one
+  // changes the observers and, if |with_transactions|, runs transactions.
+  void ConcurrentAccessTest(bool with_transactions) {
+    ASSERT_TRUE(common_prefs_);
+    constexpr int kThreads = 4;
+    constexpr int kIterations = 50;
+    CountingPrefsObserver observer, other_observer;
+    common_prefs_->AddObserver(kKey, &observer);
+
+    std::atomic<bool> done{false};
+    std::thread churn([&] {
+      while (!done) {
+        common_prefs_->AddObserver(kKey, &other_observer);
+        common_prefs_->RemoveObserver(kKey, &other_observer);
+        if (with_transactions) {
+          EXPECT_TRUE(common_prefs_->StartTransaction());
+          EXPECT_TRUE(common_prefs_->SubmitTransaction());
+        }
+      }
+    });
+    vector<std::thread> workers;
+    for (int i = 0; i < kThreads; i++) {
+      workers.emplace_back([this, i] {
+        const string key = "worker" + std::to_string(i);
+        for (int j = 0; j < kIterations; j++) {
+          EXPECT_TRUE(common_prefs_->SetInt64(key, j));
+          int64_t value = -1;
+          EXPECT_TRUE(common_prefs_->GetInt64(key, &value));
+          EXPECT_EQ(value, j);
+          EXPECT_TRUE(common_prefs_->SetInt64(kKey, j));
+          EXPECT_TRUE(common_prefs_->Delete("deleted-key"));
+        }
+      });
+    }
+    for (auto& worker : workers)
+      worker.join();
+    done = true;
+    churn.join();
+
+    EXPECT_EQ(observer.set_count_, kThreads * kIterations);
+    vector<string> keys;
+    EXPECT_TRUE(common_prefs_->GetSubKeys("worker", &keys));
+    EXPECT_EQ(keys.size(), static_cast<size_t>(kThreads));
+    for (int i = 0; i < kThreads; i++) {
+      int64_t value = -1;
+      EXPECT_TRUE(
+          common_prefs_->GetInt64("worker" + std::to_string(i), &value));
+      EXPECT_EQ(value, kIterations - 1);
+    }
+    common_prefs_->RemoveObserver(kKey, &observer);
+  }
+
   void MultiNamespaceKeyTest() {
     ASSERT_TRUE(common_prefs_);
     auto key0 = common_prefs_->CreateSubKey({"ns1", "key"});
@@ -584,6 +647,10 @@ TEST_F(PrefsTest, MultiNamespaceKeyTest) {
   MultiNamespaceKeyTest();
 }
 
+TEST_F(PrefsTest, ConcurrentAccessTest) {
+  ConcurrentAccessTest(true);
+}
+
 class MemoryPrefsTest : public BasePrefsTest {
  protected:
   void SetUp() override { common_prefs_ = &prefs_; }
@@ -615,4 +682,149 @@ TEST_F(MemoryPrefsTest, MultiNamespaceKeyTest) {
   MultiNamespaceKeyTest();
 }
 
+TEST_F(MemoryPrefsTest, ConcurrentAccessTest) {
+  ConcurrentAccessTest(false);
+}
+
+class LogPrefsTest : public BasePrefsTest {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    log_path_ = temp_dir_.GetPath().Append("prefs.log");
+    legacy_dir_ = temp_dir_.GetPath().Append("prefs");
+    ResetPrefs();
+  }
+
+  // Reopens the store, as after a restart.
+  void ResetPrefs() {
+    prefs_ = std::make_unique<LogPrefs>();
+    ASSERT_TRUE(prefs_->Init(log_path_, legacy_dir_));
+    common_prefs_ = prefs_.get();
+  }
+
+  base::ScopedTempDir temp_dir_;
+  base::FilePath log_path_;
+  base::FilePath legacy_dir_;
+  std::unique_ptr<LogPrefs> prefs_;
+};
+
+TEST_F(LogPrefsTest, PersistenceTest) {
+  EXPECT_TRUE(prefs_->SetInt64(kKey, 1234));
+  EXPECT_TRUE(prefs_->SetString("binary", string("a\0b", 3)));
+  EXPECT_TRUE(prefs_->SetString("deleted", "value"));
+  EXPECT_TRUE(prefs_->Delete("deleted"));
+  EXPECT_FALSE(prefs_->SetString("bad.key", "value"));
+
+  ResetPrefs();
+  int64_t value = 0;
+  EXPECT_TRUE(prefs_->GetInt64(kKey, &value));
+  EXPECT_EQ(1234, value);
+  string str;
+  EXPECT_TRUE(prefs_->GetString("binary", &str));
+  EXPECT_EQ(string("a\0b", 3), str);
+  EXPECT_FALSE(prefs_->Exists("deleted"));
+}
+
+TEST_F(LogPrefsTest, TransactionTest) {
+  EXPECT_TRUE(prefs_->SetString(kKey, "before"));
+  EXPECT_TRUE(prefs_->StartTransaction());
+  EXPECT_TRUE(prefs_->SetString(kKey, "cancelled"));
+  EXPECT_TRUE(prefs_->SetString("other", "cancelled"));
+  string value;
+  EXPECT_TRUE(prefs_->GetString(kKey, &value));
+  EXPECT_EQ("cancelled", value);
+  EXPECT_TRUE(prefs_->CancelTransaction());
+  EXPECT_TRUE(prefs_->GetString(kKey, &value));
+  EXPECT_EQ("before", value);
+  EXPECT_FALSE(prefs_->Exists("other"));
+
+  EXPECT_TRUE(prefs_->StartTransaction());
+  EXPECT_TRUE(prefs_->SetString(kKey, "submitted"));
+  EXPECT_TRUE(prefs_->Delete(kKey));
+  EXPECT_TRUE(prefs_->SetString("other", "submitted"));
+  EXPECT_TRUE(prefs_->SubmitTransaction());
+  // Cancelling after submitting, as DeltaPerformer does, is a no-op.
+  EXPECT_TRUE(prefs_->CancelTransaction());
+
+  ResetPrefs();
+  EXPECT_FALSE(prefs_->Exists(kKey));
+  EXPECT_TRUE(prefs_->GetString("other", &value));
+  EXPECT_EQ("submitted", value);
+}
+
+TEST_F(LogPrefsTest, IncompleteTransactionDroppedTest) {
+  EXPECT_TRUE(prefs_->SetString(kKey, "committed"));
+  prefs_.reset();
+  string log;
+  ASSERT_TRUE(base::ReadFileToString(log_path_, &log));
+  const size_t committed_size = log.size();
+
+  ResetPrefs();
+  EXPECT_TRUE(prefs_->StartTransaction());
+  EXPECT_TRUE(prefs_->SetString(kKey, "first"));
+  EXPECT_TRUE(prefs_->SetString("other", "second"));
+  EXPECT_TRUE(prefs_->SubmitTransaction());
+  prefs_.reset();
+  ASSERT_TRUE(base::ReadFileToString(log_path_, &log));
+  ASSERT_GT(log.size(), committed_size + 1);
+
+  // Cut the last record of the transaction short, as if interrupted while it
+  // was written.
+  log.resize(log.size() - 1);
+  ASSERT_EQ(static_cast<int>(log.size()),
+            base::WriteFile(log_path_, log.data(), log.size()));
+  ResetPrefs();
+  string value;
+  EXPECT_TRUE(prefs_->GetString(kKey, &value));
+  EXPECT_EQ("committed", value);
+  EXPECT_FALSE(prefs_->Exists("other"));
+
+  // The log is usable after dropping the incomplete transaction.
+  EXPECT_TRUE(prefs_->SetString("other", "third"));
+  ResetPrefs();
+  EXPECT_TRUE(prefs_->GetString("other", &value));
+  EXPECT_EQ("third", value);
+}
+
+TEST_F(LogPrefsTest, ImportLegacyPrefsTest) {
+  // Start from a new log, next to an existing Prefs store.
+  log_path_ = temp_dir_.GetPath().Append("imported.log");
+  {
+    Prefs legacy_prefs;
+    ASSERT_TRUE(legacy_prefs.Init(legacy_dir_));
+    ASSERT_TRUE(legacy_prefs.SetInt64(kKey, 42));
+    ASSERT_TRUE(legacy_prefs.SetString("ns/sub-key", "value"));
+  }
+
+  ResetPrefs();
+  EXPECT_FALSE(base::PathExists(legacy_dir_));
+  int64_t value = 0;
+  EXPECT_TRUE(prefs_->GetInt64(kKey, &value));
+  EXPECT_EQ(42, value);
+  vector<string> keys;
+  EXPECT_TRUE(prefs_->GetSubKeys("ns/", &keys));
+  EXPECT_THAT(keys, ElementsAre("ns/sub-key"));
+}
+
+TEST_F(LogPrefsTest, CompactionTest) {
+  const string value(1024, 'x');
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_TRUE(prefs_->SetString(kKey, value));
+  }
+  // The log holds a few copies of the value only.
+  EXPECT_LT(prefs_->log_storage_.log_size(), 100 * value.size());
+  ResetPrefs();
+  string read_value;
+  EXPECT_TRUE(prefs_->GetString(kKey, &read_value));
+  EXPECT_EQ(value, read_value);
+}
+
+TEST_F(LogPrefsTest, MultiNamespaceKeyTest) {
+  MultiNamespaceKeyTest();
+}
+
+TEST_F(LogPrefsTest, ConcurrentAccessTest) {
+  ConcurrentAccessTest(true);
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,300 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/shared_memory_fetcher.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <base/bind.h>
+#include <base/location.h>
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_split.h>
+#include <base/strings/string_util.h>
+
+using brillo::MessageLoop;
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr char kSharedMemoryScheme[] = "shm://";
+
+// Parses the file descriptors of a "shm://<memfd>/<socket fd>" URL.
+bool ParseUrl(const string& url, int* ring_fd, int* socket_fd) {
+  const std::vector<string> fds =
+      base::SplitString(url.substr(strlen(kSharedMemoryScheme)),
+                        "/",
+                        base::KEEP_WHITESPACE,
+                        base::SPLIT_WANT_ALL);
+  return fds.size() == 2 && base::StringToInt(fds[0], ring_fd) &&
+         base::StringToInt(fds[1], socket_fd) && *ring_fd >= 0 &&
+         *socket_fd >= 0;
+}
+
+}  // namespace
+
+// static
+bool SharedMemoryFetcher::SupportedUrl(const string& url) {
+  return base::StartsWith(
+      url, kSharedMemoryScheme, base::CompareCase::INSENSITIVE_ASCII);
+}
+
+SharedMemoryFetcher::~SharedMemoryFetcher() {
+  LOG_IF(ERROR, transfer_in_progress_)
+      << "Destroying the fetcher while a transfer is in progress.";
+  CleanUp();
+}
+
+void SharedMemoryFetcher::BeginTransfer(const string& url) {
+  CHECK(!transfer_in_progress_);
+
+  int ring_fd = -1;
+  int socket_fd = -1;
+  if (!SupportedUrl(url) || !ParseUrl(url, &ring_fd, &socket_fd) ||
+      !MapRing(ring_fd)) {
+    LOG(ERROR) << "Unsupported shared memory URL: " << url;
+    // No HTTP error code when the URL is not supported.
+    http_response_code_ = 0;
+    CleanUp();
+    if (delegate_)
+      delegate_->TransferComplete(this, false);
+    return;
+  }
+  http_response_code_ = kHttpResponseOk;
+
+  // Let the client know where to stream from. The previous transfer may have
+  // left data in the ring, which is ignored until the client acknowledges the
+  // new |transfer_id|.
+  transfer_id_ = header_->transfer_id.load(std::memory_order_acquire) + 1;
+  header_->read_offset.store(offset_, std::memory_order_release);
+  header_->start_offset.store(offset_, std::memory_order_release);
+  header_->end_offset.store(data_length_ >= 0
+                                ? offset_ + data_length_
+                                : std::numeric_limits<uint64_t>::max(),
+                            std::memory_order_release);
+  header_->transfer_id.store(transfer_id_, std::memory_order_release);
+
+  socket_fd_ = socket_fd;
+  client_closed_ = false;
+  bytes_copied_ = 0;
+  transfer_in_progress_ = true;
+  socket_controller_ = base::FileDescriptorWatcher::WatchReadable(
+      socket_fd_,
+      base::BindRepeating(&SharedMemoryFetcher::OnSocketReadable,
+                          base::Unretained(this)));
+  NotifyClient();
+  ScheduleConsume();
+}
+
+void SharedMemoryFetcher::TerminateTransfer() {
+  CleanUp();
+  if (delegate_) {
+    // Note that after the callback returns this object may be destroyed.
+    delegate_->TransferTerminated(this);
+  }
+}
+
+bool SharedMemoryFetcher::MapRing(int fd) {
+  struct stat st {};
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    LOG(ERROR) << "The shared memory isn't a memfd.";
+    return false;
+  }
+  // The client could otherwise truncate the memfd under the mapping.
+  const int seals = fcntl(fd, F_GET_SEALS);
+  if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+    LOG(ERROR) << "The shared memory must be sealed with F_SEAL_SHRINK.";
+    return false;
+  }
+  const uint64_t size = st.st_size;
+  if (size < sizeof(SharedMemoryRingHeader) ||
+      size > std::numeric_limits<size_t>::max()) {
+    LOG(ERROR) << "Invalid shared memory size " << size;
+    return false;
+  }
+  void* mapping =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    PLOG(ERROR) << "Failed to map the shared memory";
+    return false;
+  }
+  mapping_ = mapping;
+  mapping_size_ = size;
+  header_ = static_cast<SharedMemoryRingHeader*>(mapping);
+
+  // The client could change these at any time, only read them once.
+  const uint32_t magic = header_->magic;
+  const uint64_t ring_offset = header_->ring_offset;
+  capacity_ = header_->capacity;
+  if (magic != kSharedMemoryRingMagic ||
+      ring_offset < sizeof(SharedMemoryRingHeader) || ring_offset > size ||
+      capacity_ == 0 || capacity_ > size - ring_offset) {
+    LOG(ERROR) << "Invalid shared memory ring header: magic " << magic
+               << ", ring offset " << ring_offset << ", capacity " << capacity_
+               << ", size " << size;
+    return false;
+  }
+  ring_ = static_cast<const uint8_t*>(mapping) + ring_offset;
+  return true;
+}
+
+void SharedMemoryFetcher::Complete(bool successful) {
+  CleanUp();
+  if (delegate_)
+    delegate_->TransferComplete(this, successful);
+}
+
+void SharedMemoryFetcher::ScheduleConsume() {
+  if (transfer_paused_ || !transfer_in_progress_ ||
+      consume_task_ != MessageLoop::kTaskIdNull)
+    return;
+  consume_task_ = MessageLoop::current()->PostTask(
+      FROM_HERE,
+      base::Bind(&SharedMemoryFetcher::ConsumeRing, base::Unretained(this)));
+}
+
+void SharedMemoryFetcher::ConsumeRing() {
+  consume_task_ = MessageLoop::kTaskIdNull;
+  if (transfer_paused_ || !transfer_in_progress_)
+    return;
+
+  const uint64_t read_offset = offset_ + bytes_copied_;
+  const uint64_t remaining = data_length_ >= 0
+                                 ? data_length_ - bytes_copied_
+                                 : std::numeric_limits<uint64_t>::max();
+  if (remaining == 0) {
+    Complete(true);
+    return;
+  }
+  uint64_t available = 0;
+  if (header_->writer_transfer_id.load(std::memory_order_acquire) ==
+      transfer_id_) {
+    const uint64_t write_offset =
+        header_->write_offset.load(std::memory_order_acquire);
+    if (write_offset < read_offset || write_offset - read_offset > capacity_) {
+      LOG(ERROR) << "Invalid write offset " << write_offset
+                 << " in the shared memory, at read offset " << read_offset;
+      Complete(false);
+      return;
+    }
+    available = write_offset - read_offset;
+  }
+  if (available == 0) {
+    if (client_closed_) {
+      LOG_IF(ERROR, data_length_ >= 0)
+          << "The client stopped streaming at offset " << read_offset << ", "
+          << remaining << " bytes short.";
+      Complete(data_length_ < 0);
+    }
+    // Otherwise wait for the client to write more.
+    return;
+  }
+
+  const uint64_t position = read_offset % capacity_;
+  const size_t size = std::min<uint64_t>(
+      {available, remaining, capacity_ - position, kMaxSliceSize});
+  buffer_.assign(ring_ + position, ring_ + position + size);
+  bytes_copied_ += size;
+  // The slice was copied, so the client may overwrite it already.
+  header_->read_offset.store(offset_ + bytes_copied_,
+                             std::memory_order_release);
+  NotifyClient();
+  if (delegate_ && !delegate_->ReceivedBytes(this, buffer_.data(), size))
+    return;
+  ScheduleConsume();
+}
+
+void SharedMemoryFetcher::OnSocketReadable() {
+  char buf[64];
+  const ssize_t rc =
+      HANDLE_EINTR(recv(socket_fd_, buf, sizeof(buf), MSG_DONTWAIT));
+  if (rc == 0 || (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    PLOG_IF(WARNING, rc < 0 && errno != ECONNRESET)
+        << "Failed to read from the client's socket";
+    // Consume what's left in the ring, then end the transfer.
+    client_closed_ = true;
+    socket_controller_.reset();
+  }
+  ScheduleConsume();
+}
+
+void SharedMemoryFetcher::NotifyClient() {
+  if (client_closed_)
+    return;
+  const char byte = 0;
+  // A full socket already has wake-ups pending for the client, and a closed
+  // one is noticed by OnSocketReadable().
+  const ssize_t rc =
+      HANDLE_EINTR(send(socket_fd_, &byte, 1, MSG_DONTWAIT | MSG_NOSIGNAL));
+  if (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EPIPE &&
+      errno != ECONNRESET) {
+    PLOG(WARNING) << "Failed to notify the client";
+  }
+}
+
+void SharedMemoryFetcher::Pause() {
+  if (transfer_paused_) {
+    LOG(ERROR) << "Fetcher already paused.";
+    return;
+  }
+  transfer_paused_ = true;
+}
+
+void SharedMemoryFetcher::Unpause() {
+  if (!transfer_paused_) {
+    LOG(ERROR) << "Resume attempted when fetcher not paused.";
+    return;
+  }
+  transfer_paused_ = false;
+  ScheduleConsume();
+}
+
+void SharedMemoryFetcher::CleanUp() {
+  if (consume_task_ != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(consume_task_);
+    consume_task_ = MessageLoop::kTaskIdNull;
+  }
+  socket_controller_.reset();
+  socket_fd_ = -1;
+  client_closed_ = false;
+  if (mapping_) {
+    munmap(mapping_, mapping_size_);
+    mapping_ = nullptr;
+    mapping_size_ = 0;
+    header_ = nullptr;
+    ring_ = nullptr;
+    capacity_ = 0;
+  }
+  buffer_ = brillo::Blob();
+
+  transfer_in_progress_ = false;
+  transfer_paused_ = false;
+}
+
+}  // namespace chromeos_update_engine
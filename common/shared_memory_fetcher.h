@@ -0,0 +1,191 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_COMMON_SHARED_MEMORY_FETCHER_H_
+#define UPDATE_ENGINE_COMMON_SHARED_MEMORY_FETCHER_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include <base/files/file_descriptor_watcher_posix.h>
+#include <base/macros.h>
+#include <brillo/message_loops/message_loop.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/http_fetcher.h"
+
+// This is a concrete implementation of HttpFetcher that reads the payload a
+// client streams into a ring buffer in shared memory, so that the client
+// doesn't need to store the payload before update_engine reads it back.
+//
+// The client shares a memfd, sealed with F_SEAL_SHRINK, starting with a
+// SharedMemoryRingHeader and followed by the ring, and one end of a socket
+// pair. Each side sends a byte over the socket after updating its offsets in
+// the header to wake up the other one. The byte at payload offset |offset| is
+// at |offset % capacity| in the ring. For each transfer:
+//  1. update_engine sets |read_offset| and |start_offset| to the payload
+//     offset the transfer starts at, |end_offset| to the one it ends at, or
+//     UINT64_MAX if it ends with the payload, then increments |transfer_id|.
+//  2. The client sets |write_offset| to |start_offset|, then
+//     |writer_transfer_id| to |transfer_id|, which acknowledges the transfer.
+//  3. The client writes the payload from |start_offset| to |end_offset|,
+//     increasing |write_offset| after each write, while
+//     |write_offset - read_offset| stays at most |capacity|.
+//  4. update_engine increases |read_offset| as it consumes the data.
+// The transfer fails if the client closes its end of the socket before
+// streaming all of the requested data, and can be resumed by applying the
+// payload again.
+
+namespace chromeos_update_engine {
+
+// The header at the start of the shared memory. The offsets are 64-bit atomic
+// integers in native byte order, written only by the side noted.
+struct SharedMemoryRingHeader {
+  // kSharedMemoryRingMagic, set by the client.
+  uint32_t magic;
+  // The offset of the ring in the shared memory, set by the client.
+  uint32_t ring_offset;
+  // The size of the ring, set by the client.
+  uint64_t capacity;
+  // Set by update_engine.
+  std::atomic<uint64_t> transfer_id;
+  std::atomic<uint64_t> start_offset;
+  std::atomic<uint64_t> end_offset;
+  std::atomic<uint64_t> read_offset;
+  // Set by the client.
+  std::atomic<uint64_t> writer_transfer_id;
+  std::atomic<uint64_t> write_offset;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "The ring offsets are shared across processes");
+
+// "UEsm" in memory.
+constexpr uint32_t kSharedMemoryRingMagic = 0x6d734555;
+
+class SharedMemoryFetcher : public HttpFetcher {
+ public:
+  // Returns whether the passed url is supported, that is of the form
+  // "shm://<memfd>/<socket fd>".
+  static bool SupportedUrl(const std::string& url);
+
+  // The most bytes passed to the delegate at once.
+  static constexpr size_t kMaxSliceSize = 1024 * 1024;
+
+  SharedMemoryFetcher() : HttpFetcher() {}
+
+  // Cleans up all internal state. Does not notify delegate.
+  ~SharedMemoryFetcher() override;
+
+  // HttpFetcher overrides.
+  void SetOffset(off_t offset) override { offset_ = offset; }
+  void SetLength(size_t length) override { data_length_ = length; }
+  void UnsetLength() override { data_length_ = -1; }
+
+  // Begins the transfer if it hasn't already begun. The file descriptors in
+  // |url| must stay open until the transfer completes.
+  void BeginTransfer(const std::string& url) override;
+
+  // If the transfer is in progress, aborts the transfer early. The transfer
+  // cannot be resumed.
+  void TerminateTransfer() override;
+
+  // Ignore all extra headers for shared memory.
+  void SetHeader(const std::string& header_name,
+                 const std::string& header_value) override {}
+
+  bool GetHeader(const std::string& header_name,
+                 std::string* header_value) const override {
+    header_value->clear();
+    return false;
+  }
+
+  // Stops consuming the ring, which eventually blocks the client.
+  void Pause() override;
+
+  // Resume consuming the ring.
+  void Unpause() override;
+
+  size_t GetBytesDownloaded() override {
+    return static_cast<size_t>(bytes_copied_);
+  }
+
+  // Ignore all the time limits for shared memory.
+  void set_low_speed_limit(int low_speed_bps, int low_speed_sec) override {}
+  void set_connect_timeout(int connect_timeout_seconds) override {}
+  void set_max_retry_count(int max_retry_count) override {}
+
+ private:
+  // Maps the shared memory of |fd| and checks its header.
+  bool MapRing(int fd);
+
+  // Cleans up the fetcher, resetting its status to a newly constructed one.
+  void CleanUp();
+
+  // Ends the transfer and notifies the delegate.
+  void Complete(bool successful);
+
+  // Schedules a call to ConsumeRing() if the transfer is not paused.
+  void ScheduleConsume();
+
+  // Passes the data available in the ring to the delegate, one slice per
+  // MessageLoop task.
+  void ConsumeRing();
+
+  // Called when the client wrote to the socket or closed it.
+  void OnSocketReadable();
+
+  // Wakes up the client.
+  void NotifyClient();
+
+  bool transfer_in_progress_{false};
+  bool transfer_paused_{false};
+
+  // Total number of bytes passed to the delegate.
+  uint64_t bytes_copied_{0};
+
+  // The payload offset where the transfer starts.
+  uint64_t offset_{0};
+
+  // The length of the data or -1 if unknown (will read until the client
+  // closes the socket).
+  int64_t data_length_{-1};
+
+  void* mapping_{nullptr};
+  size_t mapping_size_{0};
+  SharedMemoryRingHeader* header_{nullptr};
+  const uint8_t* ring_{nullptr};
+  uint64_t capacity_{0};
+  uint64_t transfer_id_{0};
+
+  int socket_fd_{-1};
+  bool client_closed_{false};
+  std::unique_ptr<base::FileDescriptorWatcher::Controller> socket_controller_;
+
+  // The client may change the shared memory at any time, so the data is
+  // copied before the delegate verifies it.
+  brillo::Blob buffer_;
+
+  brillo::MessageLoop::TaskId consume_task_{brillo::MessageLoop::kTaskIdNull};
+
+  DISALLOW_COPY_AND_ASSIGN(SharedMemoryFetcher);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_SHARED_MEMORY_FETCHER_H_
@@ -0,0 +1,205 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/shared_memory_fetcher.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+
+#include <android-base/unique_fd.h>
+#include <base/bind.h>
+#include <base/message_loop/message_loop.h>
+#include <base/task/single_thread_task_executor.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+#include <gtest/gtest.h>
+
+using android::base::unique_fd;
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr size_t kRingOffset = 4096;
+constexpr size_t kCapacity = 1000;
+
+class CollectingDelegate : public HttpFetcherDelegate {
+ public:
+  bool ReceivedBytes(HttpFetcher* fetcher,
+                     const void* bytes,
+                     size_t length) override {
+    const uint8_t* data = static_cast<const uint8_t*>(bytes);
+    data_.insert(data_.end(), data, data + length);
+    return true;
+  }
+  void TransferComplete(HttpFetcher* fetcher, bool successful) override {
+    completed_ = true;
+    successful_ = successful;
+  }
+  void TransferTerminated(HttpFetcher* fetcher) override {}
+
+  brillo::Blob data_;
+  bool completed_{false};
+  bool successful_{false};
+};
+
+// Streams |payload| into the ring like a client would, up to |stop_offset|,
+// then closes |socket|.
+void StreamPayload(int ring_fd,
+                   unique_fd socket,
+                   const brillo::Blob& payload,
+                   uint64_t stop_offset) {
+  void* mapping = mmap(nullptr,
+                       kRingOffset + kCapacity,
+                       PROT_READ | PROT_WRITE,
+                       MAP_SHARED,
+                       ring_fd,
+                       0);
+  ASSERT_NE(mapping, MAP_FAILED);
+  auto header = static_cast<SharedMemoryRingHeader*>(mapping);
+  uint8_t* ring = static_cast<uint8_t*>(mapping) + kRingOffset;
+  char byte;
+  while (header->transfer_id == 0) {
+    ASSERT_EQ(recv(socket.get(), &byte, 1, 0), 1);
+  }
+  uint64_t offset = header->start_offset;
+  const uint64_t end = std::min<uint64_t>(header->end_offset, stop_offset);
+  header->write_offset = offset;
+  header->writer_transfer_id = header->transfer_id.load();
+  while (offset < end) {
+    const uint64_t space = kCapacity - (offset - header->read_offset);
+    if (space == 0) {
+      ASSERT_EQ(recv(socket.get(), &byte, 1, 0), 1);
+      continue;
+    }
+    const uint64_t size = std::min<uint64_t>({space, end - offset, 77});
+    for (uint64_t i = offset; i < offset + size; i++) {
+      ring[i % kCapacity] = payload[i];
+    }
+    offset += size;
+    header->write_offset = offset;
+    send(socket.get(), &byte, 1, MSG_NOSIGNAL);
+  }
+  munmap(mapping, kRingOffset + kCapacity);
+}
+
+}  // namespace
+
+class SharedMemoryFetcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    loop_.SetAsCurrent();
+    ring_fd_.reset(memfd_create("ring", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+    ASSERT_TRUE(ring_fd_.ok());
+    ASSERT_EQ(ftruncate(ring_fd_.get(), kRingOffset + kCapacity), 0);
+    SharedMemoryRingHeader header{};
+    header.magic = kSharedMemoryRingMagic;
+    header.ring_offset = kRingOffset;
+    header.capacity = kCapacity;
+    ASSERT_EQ(pwrite(ring_fd_.get(), &header, sizeof(header), 0),
+              static_cast<ssize_t>(sizeof(header)));
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds), 0);
+    client_socket_.reset(fds[0]);
+    socket_.reset(fds[1]);
+    payload_.resize(100000);
+    for (size_t i = 0; i < payload_.size(); i++) {
+      payload_[i] = i * 7 + i / 300;
+    }
+    fetcher_.set_delegate(&delegate_);
+  }
+
+  string Url() const {
+    return "shm://" + std::to_string(ring_fd_.get()) + "/" +
+           std::to_string(socket_.get());
+  }
+
+  // Runs the transfer while a client thread streams the payload.
+  void RunTransfer(uint64_t stop_offset) {
+    ASSERT_EQ(fcntl(ring_fd_.get(), F_ADD_SEALS, F_SEAL_SHRINK), 0);
+    std::thread client(StreamPayload,
+                       ring_fd_.get(),
+                       std::move(client_socket_),
+                       std::cref(payload_),
+                       stop_offset);
+    fetcher_.BeginTransfer(Url());
+    brillo::MessageLoopRunUntil(
+        &loop_,
+        base::TimeDelta::FromSeconds(10),
+        base::Bind([](bool* completed) { return *completed; },
+                   &delegate_.completed_));
+    client.join();
+    ASSERT_TRUE(delegate_.completed_);
+  }
+
+#if BASE_VER < 780000  // Android
+  base::MessageLoopForIO base_loop_;
+  brillo::BaseMessageLoop loop_{&base_loop_};
+#else   // CrOS
+  base::SingleThreadTaskExecutor base_loop_{base::MessagePumpType::IO};
+  brillo::BaseMessageLoop loop_{base_loop_.task_runner()};
+#endif  // BASE_VER < 780000
+  unique_fd ring_fd_;
+  unique_fd client_socket_;
+  unique_fd socket_;
+  brillo::Blob payload_;
+  CollectingDelegate delegate_;
+  SharedMemoryFetcher fetcher_;
+};
+
+TEST_F(SharedMemoryFetcherTest, SupportedUrlTest) {
+  EXPECT_TRUE(SharedMemoryFetcher::SupportedUrl("shm://3/4"));
+  EXPECT_FALSE(SharedMemoryFetcher::SupportedUrl("fd://3"));
+}
+
+TEST_F(SharedMemoryFetcherTest, StreamsWholePayload) {
+  RunTransfer(payload_.size());
+  EXPECT_TRUE(delegate_.successful_);
+  EXPECT_EQ(delegate_.data_, payload_);
+}
+
+TEST_F(SharedMemoryFetcherTest, StreamsRange) {
+  fetcher_.SetOffset(12345);
+  fetcher_.SetLength(50000);
+  RunTransfer(payload_.size());
+  EXPECT_TRUE(delegate_.successful_);
+  EXPECT_EQ(delegate_.data_,
+            brillo::Blob(payload_.begin() + 12345,
+                         payload_.begin() + 12345 + 50000));
+}
+
+TEST_F(SharedMemoryFetcherTest, ClientClosingEarlyFails) {
+  fetcher_.SetLength(payload_.size());
+  RunTransfer(payload_.size() / 2);
+  EXPECT_FALSE(delegate_.successful_);
+  EXPECT_EQ(delegate_.data_.size(), payload_.size() / 2);
+}
+
+TEST_F(SharedMemoryFetcherTest, RejectsUnsealedMemory) {
+  fetcher_.BeginTransfer(Url());
+  EXPECT_TRUE(delegate_.completed_);
+  EXPECT_FALSE(delegate_.successful_);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,713 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/simd_utils.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace chromeos_update_engine {
+
+namespace simd_utils {
+
+namespace {
+
+using XorFunction = void (*)(uint8_t*, const uint8_t*, size_t);
+using IsZeroFunction = bool (*)(const uint8_t*, size_t);
+using EqualFunction = bool (*)(const uint8_t*, const uint8_t*, size_t);
+// Multiplies, and XORs the product into |dst| if |accumulate|.
+using GfMulFunction =
+    void (*)(uint8_t* dst, const uint8_t*, uint8_t, size_t, bool accumulate);
+using Sha256MultiBufferFunction = void (*)(size_t,
+                                           const uint8_t* const*,
+                                           const size_t*,
+                                           uint8_t*);
+
+struct Implementation {
+  const char* name;
+  XorFunction xor_function;
+  IsZeroFunction is_zero_function;
+  EqualFunction equal_function;
+  GfMulFunction gf_mul_function;
+  // Null if not vectorized for this CPU.
+  Sha256MultiBufferFunction sha256_multi_buffer_function{nullptr};
+  // Whether |sha256_multi_buffer_function| beats hashing one buffer at a time.
+  bool prefer_sha256_multi_buffer{false};
+};
+
+// Returns the product of |a| and |b| in GF(2^8).
+uint8_t GfMultiply(uint8_t a, uint8_t b) {
+  uint8_t product = 0;
+  while (b != 0) {
+    if (b & 1) {
+      product ^= a;
+    }
+    // Multiply |a| by x, reducing by x^8 + x^4 + x^3 + x^2 + 1.
+    a = static_cast<uint8_t>((a << 1) ^ ((a & 0x80) ? 0x1d : 0));
+    b >>= 1;
+  }
+  return product;
+}
+
+// Sets the products of |factor| with the 16 values of the low and of the high
+// nibble of a byte. The product with a byte is the XOR of the products with its
+// nibbles.
+void GfNibbleTables(uint8_t factor, uint8_t low[16], uint8_t high[16]) {
+  for (uint8_t i = 0; i < 16; i++) {
+    low[i] = GfMultiply(factor, i);
+    high[i] = GfMultiply(factor, static_cast<uint8_t>(i << 4));
+  }
+}
+
+void GfMulWithTables(uint8_t* dst,
+                     const uint8_t* src,
+                     const uint8_t low[16],
+                     const uint8_t high[16],
+                     size_t size,
+                     bool accumulate) {
+  for (size_t i = 0; i < size; i++) {
+    const uint8_t product = low[src[i] & 0x0f] ^ high[src[i] >> 4];
+    dst[i] = accumulate ? dst[i] ^ product : product;
+  }
+}
+
+void GfMulPortable(uint8_t* dst,
+                   const uint8_t* src,
+                   uint8_t factor,
+                   size_t size,
+                   bool accumulate) {
+  uint8_t low[16], high[16];
+  GfNibbleTables(factor, low, high);
+  GfMulWithTables(dst, src, low, high, size, accumulate);
+}
+
+#if defined(__aarch64__)
+
+// NEON is mandatory on arm64, so no runtime check is needed.
+void XorNeon(uint8_t* dst, const uint8_t* src, size_t size) {
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    uint8x16x4_t a = vld1q_u8_x4(dst + i);
+    const uint8x16x4_t b = vld1q_u8_x4(src + i);
+    a.val[0] = veorq_u8(a.val[0], b.val[0]);
+    a.val[1] = veorq_u8(a.val[1], b.val[1]);
+    a.val[2] = veorq_u8(a.val[2], b.val[2]);
+    a.val[3] = veorq_u8(a.val[3], b.val[3]);
+    vst1q_u8_x4(dst + i, a);
+  }
+  for (; i + 16 <= size; i += 16) {
+    vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+  }
+  XorScalar(dst + i, src + i, size - i);
+}
+
+bool IsZeroNeon(const uint8_t* data, size_t size) {
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    const uint8x16x4_t v = vld1q_u8_x4(data + i);
+    const uint8x16_t acc = vorrq_u8(vorrq_u8(v.val[0], v.val[1]),
+                                    vorrq_u8(v.val[2], v.val[3]));
+    if (vmaxvq_u8(acc) != 0) {
+      return false;
+    }
+  }
+  for (; i + 16 <= size; i += 16) {
+    if (vmaxvq_u8(vld1q_u8(data + i)) != 0) {
+      return false;
+    }
+  }
+  return IsZeroScalar(data + i, size - i);
+}
+
+bool EqualNeon(const uint8_t* a, const uint8_t* b, size_t size) {
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    const uint8x16x4_t x = vld1q_u8_x4(a + i);
+    const uint8x16x4_t y = vld1q_u8_x4(b + i);
+    const uint8x16_t acc =
+        vorrq_u8(vorrq_u8(veorq_u8(x.val[0], y.val[0]),
+                          veorq_u8(x.val[1], y.val[1])),
+                 vorrq_u8(veorq_u8(x.val[2], y.val[2]),
+                          veorq_u8(x.val[3], y.val[3])));
+    if (vmaxvq_u8(acc) != 0) {
+      return false;
+    }
+  }
+  for (; i + 16 <= size; i += 16) {
+    if (vmaxvq_u8(veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i))) != 0) {
+      return false;
+    }
+  }
+  return EqualScalar(a + i, b + i, size - i);
+}
+
+void GfMulNeon(uint8_t* dst,
+               const uint8_t* src,
+               uint8_t factor,
+               size_t size,
+               bool accumulate) {
+  uint8_t low[16], high[16];
+  GfNibbleTables(factor, low, high);
+  const uint8x16_t low_table = vld1q_u8(low);
+  const uint8x16_t high_table = vld1q_u8(high);
+  const uint8x16_t mask = vdupq_n_u8(0x0f);
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const uint8x16_t v = vld1q_u8(src + i);
+    uint8x16_t product =
+        veorq_u8(vqtbl1q_u8(low_table, vandq_u8(v, mask)),
+                 vqtbl1q_u8(high_table, vshrq_n_u8(v, 4)));
+    if (accumulate) {
+      product = veorq_u8(product, vld1q_u8(dst + i));
+    }
+    vst1q_u8(dst + i, product);
+  }
+  GfMulWithTables(dst + i, src + i, low, high, size - i, accumulate);
+}
+
+Implementation SelectImplementation() {
+  return {"neon", XorNeon, IsZeroNeon, EqualNeon, GfMulNeon};
+}
+
+#elif defined(__x86_64__) || defined(__i386__)
+
+constexpr size_t kSha256BlockSize = 64;
+constexpr size_t kSha256Lanes = 8;
+
+constexpr uint32_t kSha256InitialState[8] = {0x6a09e667,
+                                             0xbb67ae85,
+                                             0x3c6ef372,
+                                             0xa54ff53a,
+                                             0x510e527f,
+                                             0x9b05688c,
+                                             0x1f83d9ab,
+                                             0x5be0cd19};
+
+constexpr uint32_t kSha256RoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+// Runs the SHA-256 compression function on one block per lane.
+// |state[i * kSha256Lanes + lane]| is word i of the state of |lane|.
+using Sha256CompressFunction = void (*)(uint32_t* state,
+                                        const uint8_t* const* blocks);
+
+// The input assigned to a lane: its full blocks are read in place, the
+// padded remainder from |tail|.
+struct Sha256Lane {
+  size_t input{0};
+  const uint8_t* data{nullptr};
+  size_t full_blocks{0};
+  size_t num_blocks{0};
+  size_t next_block{0};
+  uint8_t tail[2 * kSha256BlockSize];
+  bool active{false};
+};
+
+void StartSha256Lane(size_t input,
+                     const uint8_t* data,
+                     size_t size,
+                     Sha256Lane* lane) {
+  lane->input = input;
+  lane->data = data;
+  lane->full_blocks = size / kSha256BlockSize;
+  lane->next_block = 0;
+  lane->active = true;
+
+  const size_t remainder = size % kSha256BlockSize;
+  memset(lane->tail, 0, sizeof(lane->tail));
+  if (remainder > 0) {
+    memcpy(lane->tail, data + lane->full_blocks * kSha256BlockSize, remainder);
+  }
+  lane->tail[remainder] = 0x80;
+  // The padding ends with the message length in bits, as 8 big-endian bytes.
+  const size_t tail_blocks =
+      remainder + 1 + sizeof(uint64_t) <= kSha256BlockSize ? 1 : 2;
+  const uint64_t bit_size = static_cast<uint64_t>(size) * 8;
+  uint8_t* end = lane->tail + tail_blocks * kSha256BlockSize;
+  for (size_t i = 0; i < sizeof(uint64_t); i++) {
+    *(end - 1 - i) = static_cast<uint8_t>(bit_size >> (8 * i));
+  }
+  lane->num_blocks = lane->full_blocks + tail_blocks;
+}
+
+// Hashes the inputs kSha256Lanes at a time with |compress|. A lane picks up
+// the next input as soon as it's done with the previous one.
+void Sha256MultiBufferWith(Sha256CompressFunction compress,
+                           size_t count,
+                           const uint8_t* const* data,
+                           const size_t* sizes,
+                           uint8_t* digests) {
+  // Longest inputs first, so that the lanes run out of work at about the same
+  // time instead of one lane hashing a long input on its own.
+  std::vector<size_t> order(count);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [sizes](size_t a, size_t b) {
+    return sizes[a] > sizes[b];
+  });
+
+  static const uint8_t kIdleBlock[kSha256BlockSize] = {};
+  alignas(32) uint32_t state[8 * kSha256Lanes];
+  Sha256Lane lanes[kSha256Lanes];
+  size_t next_input = 0;
+  size_t active_lanes = 0;
+  auto assign_next_input = [&](size_t lane) {
+    if (next_input == count) {
+      lanes[lane].active = false;
+      return;
+    }
+    const size_t input = order[next_input++];
+    StartSha256Lane(input, data[input], sizes[input], &lanes[lane]);
+    for (size_t i = 0; i < 8; i++) {
+      state[i * kSha256Lanes + lane] = kSha256InitialState[i];
+    }
+    active_lanes++;
+  };
+  for (size_t lane = 0; lane < kSha256Lanes; lane++) {
+    assign_next_input(lane);
+  }
+
+  const uint8_t* blocks[kSha256Lanes];
+  while (active_lanes > 0) {
+    for (size_t i = 0; i < kSha256Lanes; i++) {
+      const Sha256Lane& lane = lanes[i];
+      if (!lane.active) {
+        blocks[i] = kIdleBlock;
+      } else if (lane.next_block < lane.full_blocks) {
+        blocks[i] = lane.data + lane.next_block * kSha256BlockSize;
+      } else {
+        blocks[i] =
+            lane.tail + (lane.next_block - lane.full_blocks) * kSha256BlockSize;
+      }
+    }
+    compress(state, blocks);
+    for (size_t i = 0; i < kSha256Lanes; i++) {
+      Sha256Lane& lane = lanes[i];
+      if (!lane.active || ++lane.next_block < lane.num_blocks) {
+        continue;
+      }
+      uint8_t* digest = digests + lane.input * kSha256DigestSize;
+      for (size_t word = 0; word < 8; word++) {
+        const uint32_t value = state[word * kSha256Lanes + i];
+        digest[4 * word] = value >> 24;
+        digest[4 * word + 1] = value >> 16;
+        digest[4 * word + 2] = value >> 8;
+        digest[4 * word + 3] = value;
+      }
+      active_lanes--;
+      assign_next_input(i);
+    }
+  }
+}
+
+template <int n>
+__attribute__((target("avx2"))) inline __m256i RotateRight(__m256i x) {
+  return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+// Turns |rows[i]|, 8 words of lane i, into |rows[i]|, word i of the 8 lanes.
+__attribute__((target("avx2"))) inline void Transpose8x8(__m256i rows[8]) {
+  const __m256i t0 = _mm256_unpacklo_epi32(rows[0], rows[1]);
+  const __m256i t1 = _mm256_unpackhi_epi32(rows[0], rows[1]);
+  const __m256i t2 = _mm256_unpacklo_epi32(rows[2], rows[3]);
+  const __m256i t3 = _mm256_unpackhi_epi32(rows[2], rows[3]);
+  const __m256i t4 = _mm256_unpacklo_epi32(rows[4], rows[5]);
+  const __m256i t5 = _mm256_unpackhi_epi32(rows[4], rows[5]);
+  const __m256i t6 = _mm256_unpacklo_epi32(rows[6], rows[7]);
+  const __m256i t7 = _mm256_unpackhi_epi32(rows[6], rows[7]);
+  const __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+  const __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+  const __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+  const __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+  const __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+  const __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+  const __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+  const __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+  rows[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+  rows[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+  rows[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+  rows[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+  rows[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+  rows[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+  rows[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+  rows[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+__attribute__((target("avx2"))) void Sha256CompressAvx2(
+    uint32_t* state, const uint8_t* const* blocks) {
+  // Converts the big-endian message words.
+  const __m256i byte_swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+                                             11, 10, 9, 8, 15, 14, 13, 12,
+                                             3, 2, 1, 0, 7, 6, 5, 4,
+                                             11, 10, 9, 8, 15, 14, 13, 12);
+  __m256i w[64];
+  for (size_t half = 0; half < 2; half++) {
+    __m256i rows[8];
+    for (size_t lane = 0; lane < kSha256Lanes; lane++) {
+      rows[lane] = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i*>(blocks[lane] + 32 * half));
+    }
+    Transpose8x8(rows);
+    for (size_t i = 0; i < 8; i++) {
+      w[8 * half + i] = _mm256_shuffle_epi8(rows[i], byte_swap);
+    }
+  }
+  for (size_t t = 16; t < 64; t++) {
+    const __m256i s0 =
+        _mm256_xor_si256(_mm256_xor_si256(RotateRight<7>(w[t - 15]),
+                                          RotateRight<18>(w[t - 15])),
+                         _mm256_srli_epi32(w[t - 15], 3));
+    const __m256i s1 =
+        _mm256_xor_si256(_mm256_xor_si256(RotateRight<17>(w[t - 2]),
+                                          RotateRight<19>(w[t - 2])),
+                         _mm256_srli_epi32(w[t - 2], 10));
+    w[t] = _mm256_add_epi32(_mm256_add_epi32(w[t - 16], s0),
+                            _mm256_add_epi32(w[t - 7], s1));
+  }
+
+  __m256i v[8];
+  for (size_t i = 0; i < 8; i++) {
+    v[i] = _mm256_load_si256(
+        reinterpret_cast<const __m256i*>(state + i * kSha256Lanes));
+  }
+  __m256i a = v[0], b = v[1], c = v[2], d = v[3];
+  __m256i e = v[4], f = v[5], g = v[6], h = v[7];
+  for (size_t t = 0; t < 64; t++) {
+    const __m256i big_sigma1 = _mm256_xor_si256(
+        _mm256_xor_si256(RotateRight<6>(e), RotateRight<11>(e)),
+        RotateRight<25>(e));
+    const __m256i choice = _mm256_xor_si256(_mm256_and_si256(e, f),
+                                            _mm256_andnot_si256(e, g));
+    const __m256i t1 = _mm256_add_epi32(
+        _mm256_add_epi32(_mm256_add_epi32(h, big_sigma1),
+                         _mm256_add_epi32(choice, w[t])),
+        _mm256_set1_epi32(static_cast<int>(kSha256RoundConstants[t])));
+    const __m256i big_sigma0 = _mm256_xor_si256(
+        _mm256_xor_si256(RotateRight<2>(a), RotateRight<13>(a)),
+        RotateRight<22>(a));
+    const __m256i majority =
+        _mm256_or_si256(_mm256_and_si256(a, b),
+                        _mm256_and_si256(c, _mm256_or_si256(a, b)));
+    const __m256i t2 = _mm256_add_epi32(big_sigma0, majority);
+    h = g;
+    g = f;
+    f = e;
+    e = _mm256_add_epi32(d, t1);
+    d = c;
+    c = b;
+    b = a;
+    a = _mm256_add_epi32(t1, t2);
+  }
+  const __m256i result[8] = {a, b, c, d, e, f, g, h};
+  for (size_t i = 0; i < 8; i++) {
+    _mm256_store_si256(reinterpret_cast<__m256i*>(state + i * kSha256Lanes),
+                       _mm256_add_epi32(v[i], result[i]));
+  }
+}
+
+void Sha256MultiBufferAvx2(size_t count,
+                           const uint8_t* const* data,
+                           const size_t* sizes,
+                           uint8_t* digests) {
+  Sha256MultiBufferWith(Sha256CompressAvx2, count, data, sizes, digests);
+}
+
+// Whether the CPU has the SHA extensions, which OpenSSL uses to hash a single
+// buffer faster than the AVX2 lanes hash eight.
+bool HasShaExtensions() {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  return (ebx & bit_SHA) != 0;
+}
+
+__attribute__((target("avx2"))) void XorAvx2(uint8_t* dst,
+                                             const uint8_t* src,
+                                             size_t size) {
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    const __m256i a =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+    const __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                        _mm256_xor_si256(a, b));
+  }
+  XorScalar(dst + i, src + i, size - i);
+}
+
+__attribute__((target("avx2"))) bool IsZeroAvx2(const uint8_t* data,
+                                                size_t size) {
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    const __m256i a =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    const __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+    const __m256i acc = _mm256_or_si256(a, b);
+    if (!_mm256_testz_si256(acc, acc)) {
+      return false;
+    }
+  }
+  return IsZeroScalar(data + i, size - i);
+}
+
+__attribute__((target("avx2"))) bool EqualAvx2(const uint8_t* a,
+                                               const uint8_t* b,
+                                               size_t size) {
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    const __m256i x0 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    const __m256i x1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + 32));
+    const __m256i y0 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    const __m256i y1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i + 32));
+    const __m256i acc =
+        _mm256_or_si256(_mm256_xor_si256(x0, y0), _mm256_xor_si256(x1, y1));
+    if (!_mm256_testz_si256(acc, acc)) {
+      return false;
+    }
+  }
+  return EqualScalar(a + i, b + i, size - i);
+}
+
+__attribute__((target("avx2"))) void GfMulAvx2(uint8_t* dst,
+                                               const uint8_t* src,
+                                               uint8_t factor,
+                                               size_t size,
+                                               bool accumulate) {
+  uint8_t low[16], high[16];
+  GfNibbleTables(factor, low, high);
+  const __m256i low_table = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(low)));
+  const __m256i high_table = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(high)));
+  const __m256i mask = _mm256_set1_epi8(0x0f);
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    const __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    __m256i product = _mm256_xor_si256(
+        _mm256_shuffle_epi8(low_table, _mm256_and_si256(v, mask)),
+        _mm256_shuffle_epi8(high_table,
+                            _mm256_and_si256(_mm256_srli_epi64(v, 4), mask)));
+    if (accumulate) {
+      product = _mm256_xor_si256(
+          product,
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i)));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), product);
+  }
+  GfMulWithTables(dst + i, src + i, low, high, size - i, accumulate);
+}
+
+__attribute__((target("sse2"))) void XorSse2(uint8_t* dst,
+                                             const uint8_t* src,
+                                             size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const __m128i a =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(a, b));
+  }
+  XorScalar(dst + i, src + i, size - i);
+}
+
+__attribute__((target("sse2"))) bool IsZeroSse2(const uint8_t* data,
+                                                size_t size) {
+  size_t i = 0;
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= size; i += 16) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xFFFF) {
+      return false;
+    }
+  }
+  return IsZeroScalar(data + i, size - i);
+}
+
+__attribute__((target("sse2"))) bool EqualSse2(const uint8_t* a,
+                                               const uint8_t* b,
+                                               size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF) {
+      return false;
+    }
+  }
+  return EqualScalar(a + i, b + i, size - i);
+}
+
+Implementation SelectImplementation() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {"avx2",
+            XorAvx2,
+            IsZeroAvx2,
+            EqualAvx2,
+            GfMulAvx2,
+            Sha256MultiBufferAvx2,
+            !HasShaExtensions()};
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return {"sse2", XorSse2, IsZeroSse2, EqualSse2, GfMulPortable};
+  }
+  return {"scalar", XorScalar, IsZeroScalar, EqualScalar, GfMulPortable};
+}
+
+#else
+
+Implementation SelectImplementation() {
+  return {"scalar", XorScalar, IsZeroScalar, EqualScalar, GfMulPortable};
+}
+
+#endif
+
+const Implementation& GetImplementation() {
+  static const Implementation implementation = SelectImplementation();
+  return implementation;
+}
+
+}  // namespace
+
+void XorScalar(uint8_t* dst, const uint8_t* src, size_t size) {
+  size_t i = 0;
+  // Word at a time; memcpy() keeps unaligned accesses well defined and is
+  // lowered to plain loads and stores.
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t a, b;
+    memcpy(&a, dst + i, sizeof(a));
+    memcpy(&b, src + i, sizeof(b));
+    a ^= b;
+    memcpy(dst + i, &a, sizeof(a));
+  }
+  for (; i < size; i++) {
+    dst[i] ^= src[i];
+  }
+}
+
+bool IsZeroScalar(const uint8_t* data, size_t size) {
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    if (word != 0) {
+      return false;
+    }
+  }
+  for (; i < size; i++) {
+    if (data[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool EqualScalar(const uint8_t* a, const uint8_t* b, size_t size) {
+  return memcmp(a, b, size) == 0;
+}
+
+void GfMulScalar(uint8_t* dst,
+                 const uint8_t* src,
+                 uint8_t factor,
+                 size_t size) {
+  GfMulPortable(dst, src, factor, size, false);
+}
+
+void GfMulXorScalar(uint8_t* dst,
+                    const uint8_t* src,
+                    uint8_t factor,
+                    size_t size) {
+  GfMulPortable(dst, src, factor, size, true);
+}
+
+void Xor(uint8_t* dst, const uint8_t* src, size_t size) {
+  GetImplementation().xor_function(dst, src, size);
+}
+
+bool IsZero(const uint8_t* data, size_t size) {
+  return GetImplementation().is_zero_function(data, size);
+}
+
+bool Equal(const uint8_t* a, const uint8_t* b, size_t size) {
+  return GetImplementation().equal_function(a, b, size);
+}
+
+void GfMul(uint8_t* dst, const uint8_t* src, uint8_t factor, size_t size) {
+  GetImplementation().gf_mul_function(dst, src, factor, size, false);
+}
+
+void GfMulXor(uint8_t* dst, const uint8_t* src, uint8_t factor, size_t size) {
+  GetImplementation().gf_mul_function(dst, src, factor, size, true);
+}
+
+bool Sha256MultiBuffer(size_t count,
+                       const uint8_t* const* data,
+                       const size_t* sizes,
+                       uint8_t* digests) {
+  if (!GetImplementation().prefer_sha256_multi_buffer) {
+    return false;
+  }
+  return Sha256MultiBufferSimd(count, data, sizes, digests);
+}
+
+bool Sha256MultiBufferSimd(size_t count,
+                           const uint8_t* const* data,
+                           const size_t* sizes,
+                           uint8_t* digests) {
+  const Implementation& implementation = GetImplementation();
+  if (!implementation.sha256_multi_buffer_function) {
+    return false;
+  }
+  implementation.sha256_multi_buffer_function(count, data, sizes, digests);
+  return true;
+}
+
+const char* ImplementationName() {
+  return GetImplementation().name;
+}
+
+}  // namespace simd_utils
+
+}  // namespace chromeos_update_engine
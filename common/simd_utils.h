@@ -0,0 +1,92 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_COMMON_SIMD_UTILS_H_
+#define UPDATE_ENGINE_COMMON_SIMD_UTILS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Vectorized kernels for bulk block data processing, used by both the payload
+// consumer and generator. The best implementation for the CPU is selected at
+// runtime: NEON on arm64, AVX2 or SSE2 on x86, with a portable fallback.
+// Multi-buffer SHA-256 is only vectorized with AVX2: arm64 CPUs are expected to
+// have the SHA-256 instructions, which OpenSSL already uses for every buffer.
+// GF(2^8) multiplications are table lookups, vectorized with byte shuffles,
+// which SSE2 lacks, so the SSE2 implementation uses the portable ones.
+
+namespace chromeos_update_engine {
+
+namespace simd_utils {
+
+// Sets |dst[i] ^= src[i]| for the |size| bytes of the buffers, which may not
+// overlap unless they are the same.
+void Xor(uint8_t* dst, const uint8_t* src, size_t size);
+
+// Returns whether all |size| bytes of |data| are zero.
+bool IsZero(const uint8_t* data, size_t size);
+
+// Returns whether the |size| bytes of |a| and |b| are equal.
+bool Equal(const uint8_t* a, const uint8_t* b, size_t size);
+
+// Sets |dst[i] = factor * src[i]| for the |size| bytes of the buffers, in the
+// GF(2^8) of Reed-Solomon codes, whose polynomial is x^8 + x^4 + x^3 + x^2 + 1.
+// The buffers may not overlap unless they are the same.
+void GfMul(uint8_t* dst, const uint8_t* src, uint8_t factor, size_t size);
+
+// Same as GfMul(), but sets |dst[i] ^= factor * src[i]|.
+void GfMulXor(uint8_t* dst, const uint8_t* src, uint8_t factor, size_t size);
+
+// Size in bytes of a SHA-256 digest.
+constexpr size_t kSha256DigestSize = 32;
+
+// Computes the SHA-256 digest of each of the |count| buffers of |sizes[i]|
+// bytes at |data[i]|, storing it at |digests + i * kSha256DigestSize|.
+// Several buffers are hashed in each pass, one per vector lane. Returns false,
+// without computing anything, on CPUs where hashing the buffers one at a time
+// is faster: without wide enough vectors, or with SHA instructions.
+bool Sha256MultiBuffer(size_t count,
+                       const uint8_t* const* data,
+                       const size_t* sizes,
+                       uint8_t* digests);
+
+// Portable implementations of the functions above, exposed for tests and
+// benchmarks.
+void XorScalar(uint8_t* dst, const uint8_t* src, size_t size);
+bool IsZeroScalar(const uint8_t* data, size_t size);
+bool EqualScalar(const uint8_t* a, const uint8_t* b, size_t size);
+void GfMulScalar(uint8_t* dst, const uint8_t* src, uint8_t factor, size_t size);
+void GfMulXorScalar(uint8_t* dst,
+                    const uint8_t* src,
+                    uint8_t factor,
+                    size_t size);
+
+// Same as Sha256MultiBuffer(), but uses the vectorized implementation whenever
+// the CPU supports it, even if hashing one buffer at a time would be faster.
+// Exposed for tests and benchmarks.
+bool Sha256MultiBufferSimd(size_t count,
+                           const uint8_t* const* data,
+                           const size_t* sizes,
+                           uint8_t* digests);
+
+// Returns the name of the implementation selected for this CPU.
+const char* ImplementationName();
+
+}  // namespace simd_utils
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_SIMD_UTILS_H_
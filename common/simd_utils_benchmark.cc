@@ -0,0 +1,133 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <openssl/sha.h>
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/simd_utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr size_t kBlockSize = 4096;
+
+brillo::Blob MakeData(size_t size) {
+  brillo::Blob data(size);
+  for (size_t i = 0; i < size; i++) {
+    data[i] = i * 31 + 7;
+  }
+  return data;
+}
+
+template <void (*XorFunction)(uint8_t*, const uint8_t*, size_t)>
+void BM_Xor(benchmark::State& state) {
+  const size_t size = state.range(0);
+  brillo::Blob dst = MakeData(size);
+  const brillo::Blob src = MakeData(size);
+  for (auto _ : state) {
+    XorFunction(dst.data(), src.data(), size);
+    benchmark::DoNotOptimize(dst.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+}
+
+template <bool (*IsZeroFunction)(const uint8_t*, size_t)>
+void BM_IsZero(benchmark::State& state) {
+  // All zero data, the worst case where every byte must be checked.
+  const brillo::Blob data(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(IsZeroFunction(data.data(), data.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+template <bool (*EqualFunction)(const uint8_t*, const uint8_t*, size_t)>
+void BM_Equal(benchmark::State& state) {
+  // Equal data, the worst case where every byte must be compared.
+  const brillo::Blob a = MakeData(state.range(0));
+  const brillo::Blob b = a;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(EqualFunction(a.data(), b.data(), a.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * a.size());
+}
+
+// Hashes state.range(0) blocks, as done for the source hashes of the diff
+// operations, through the vector lanes or one block at a time with OpenSSL.
+template <bool kMultiBuffer>
+void BM_Sha256Blocks(benchmark::State& state) {
+  const size_t count = state.range(0);
+  const brillo::Blob data = MakeData(count * kBlockSize);
+  std::vector<const uint8_t*> blocks(count);
+  const std::vector<size_t> sizes(count, kBlockSize);
+  for (size_t i = 0; i < count; i++) {
+    blocks[i] = data.data() + i * kBlockSize;
+  }
+  brillo::Blob digests(count * simd_utils::kSha256DigestSize);
+  if (kMultiBuffer && !simd_utils::Sha256MultiBufferSimd(
+                          count, blocks.data(), sizes.data(), digests.data())) {
+    state.SkipWithError("No multi-buffer SHA-256 on this CPU");
+    return;
+  }
+  for (auto _ : state) {
+    if (kMultiBuffer) {
+      simd_utils::Sha256MultiBufferSimd(
+          count, blocks.data(), sizes.data(), digests.data());
+    } else {
+      for (size_t i = 0; i < count; i++) {
+        SHA256(blocks[i],
+               kBlockSize,
+               digests.data() + i * simd_utils::kSha256DigestSize);
+      }
+    }
+    benchmark::DoNotOptimize(digests.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_Sha256Blocks, true)->Arg(8)->Arg(256);
+BENCHMARK_TEMPLATE(BM_Sha256Blocks, false)->Arg(8)->Arg(256);
+BENCHMARK_TEMPLATE(BM_Xor, simd_utils::Xor)
+    ->Arg(kBlockSize)
+    ->Arg(256 * kBlockSize);
+BENCHMARK_TEMPLATE(BM_Xor, simd_utils::XorScalar)
+    ->Arg(kBlockSize)
+    ->Arg(256 * kBlockSize);
+BENCHMARK_TEMPLATE(BM_IsZero, simd_utils::IsZero)
+    ->Arg(kBlockSize)
+    ->Arg(256 * kBlockSize);
+BENCHMARK_TEMPLATE(BM_IsZero, simd_utils::IsZeroScalar)
+    ->Arg(kBlockSize)
+    ->Arg(256 * kBlockSize);
+BENCHMARK_TEMPLATE(BM_Equal, simd_utils::Equal)
+    ->Arg(kBlockSize)
+    ->Arg(256 * kBlockSize);
+BENCHMARK_TEMPLATE(BM_Equal, simd_utils::EqualScalar)
+    ->Arg(kBlockSize)
+    ->Arg(256 * kBlockSize);
+
+}  // namespace chromeos_update_engine
+
+BENCHMARK_MAIN();
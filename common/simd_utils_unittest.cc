@@ -0,0 +1,229 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/common/simd_utils.h"
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+#include <base/logging.h>
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/test_utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+// Sizes around the vector widths, to cover the scalar tails.
+constexpr size_t kSizes[] = {0, 1, 7, 8, 15, 16, 31, 32, 33, 63, 64, 65, 4096};
+// Start offsets, to exercise unaligned buffers.
+constexpr size_t kOffsets[] = {0, 1, 3};
+// Sizes around the SHA-256 block and padding boundaries.
+constexpr size_t kSha256Sizes[] = {0, 1, 55, 56, 63, 64, 65, 119, 120, 4096};
+
+// Checks Sha256MultiBufferSimd() against OpenSSL for |count| buffers of
+// varying sizes, so that lanes finish and pick up new buffers at different
+// times.
+void ExpectSha256MultiBufferMatches(size_t count) {
+  std::vector<brillo::Blob> buffers;
+  for (size_t i = 0; i < count; i++) {
+    brillo::Blob buffer(kSha256Sizes[i % std::size(kSha256Sizes)] + i);
+    test_utils::FillWithData(&buffer);
+    buffers.push_back(buffer);
+  }
+  std::vector<const uint8_t*> data;
+  std::vector<size_t> sizes;
+  for (const auto& buffer : buffers) {
+    data.push_back(buffer.data());
+    sizes.push_back(buffer.size());
+  }
+  brillo::Blob digests(count * simd_utils::kSha256DigestSize);
+  if (!simd_utils::Sha256MultiBufferSimd(
+          count, data.data(), sizes.data(), digests.data())) {
+    LOG(INFO) << "No multi-buffer SHA-256 on this CPU.";
+    return;
+  }
+  for (size_t i = 0; i < count; i++) {
+    brillo::Blob expected;
+    ASSERT_TRUE(HashCalculator::RawHashOfData(buffers[i], &expected));
+    const auto digest = digests.begin() + i * simd_utils::kSha256DigestSize;
+    EXPECT_EQ(expected,
+              brillo::Blob(digest, digest + simd_utils::kSha256DigestSize))
+        << "count " << count << " buffer " << i << " size " << sizes[i];
+  }
+}
+}  // namespace
+
+TEST(SimdUtilsTest, XorMatchesScalarTest) {
+  for (size_t size : kSizes) {
+    for (size_t offset : kOffsets) {
+      brillo::Blob src(size + offset);
+      brillo::Blob dst(size + offset);
+      test_utils::FillWithData(&src);
+      for (size_t i = 0; i < dst.size(); i++) {
+        dst[i] = i * 7;
+      }
+      brillo::Blob expected = dst;
+      simd_utils::XorScalar(
+          expected.data() + offset, src.data() + offset, size);
+      simd_utils::Xor(dst.data() + offset, src.data() + offset, size);
+      EXPECT_EQ(expected, dst) << "size " << size << " offset " << offset;
+    }
+  }
+}
+
+TEST(SimdUtilsTest, XorWithItselfClearsTest) {
+  brillo::Blob data(4096 + 5);
+  test_utils::FillWithData(&data);
+  simd_utils::Xor(data.data(), data.data(), data.size());
+  EXPECT_EQ(brillo::Blob(data.size()), data);
+}
+
+TEST(SimdUtilsTest, IsZeroTest) {
+  for (size_t size : kSizes) {
+    for (size_t offset : kOffsets) {
+      brillo::Blob data(size + offset);
+      EXPECT_TRUE(simd_utils::IsZero(data.data() + offset, size));
+      // A single non-zero byte at any position must be found.
+      for (size_t i = 0; i < size; i++) {
+        data[offset + i] = 0x80;
+        EXPECT_FALSE(simd_utils::IsZero(data.data() + offset, size))
+            << "size " << size << " offset " << offset << " byte " << i;
+        EXPECT_FALSE(simd_utils::IsZeroScalar(data.data() + offset, size));
+        data[offset + i] = 0;
+      }
+      // Bytes outside the range are ignored.
+      if (offset > 0) {
+        data[offset - 1] = 1;
+        EXPECT_TRUE(simd_utils::IsZero(data.data() + offset, size));
+      }
+    }
+  }
+}
+
+TEST(SimdUtilsTest, EqualTest) {
+  for (size_t size : kSizes) {
+    for (size_t offset : kOffsets) {
+      brillo::Blob a(size + offset);
+      test_utils::FillWithData(&a);
+      brillo::Blob b = a;
+      const uint8_t* a_data = a.data() + offset;
+      const uint8_t* b_data = b.data() + offset;
+      EXPECT_TRUE(simd_utils::Equal(a_data, b_data, size));
+      // A single different byte at any position must be found.
+      for (size_t i = 0; i < size; i++) {
+        b[offset + i] ^= 0x80;
+        EXPECT_FALSE(simd_utils::Equal(a_data, b_data, size))
+            << "size " << size << " offset " << offset << " byte " << i;
+        EXPECT_FALSE(simd_utils::EqualScalar(a_data, b_data, size));
+        b[offset + i] = a[offset + i];
+      }
+      // Bytes outside the range are ignored.
+      if (offset > 0) {
+        b[offset - 1] ^= 1;
+        EXPECT_TRUE(simd_utils::Equal(a_data, b_data, size));
+      }
+    }
+  }
+}
+
+TEST(SimdUtilsTest, GfMulKnownProductsTest) {
+  const brillo::Blob src = {0x00, 0x01, 0x07, 0x80, 0xff};
+  brillo::Blob dst(src.size());
+  simd_utils::GfMulScalar(dst.data(), src.data(), 1, src.size());
+  EXPECT_EQ(src, dst);
+  simd_utils::GfMulScalar(dst.data(), src.data(), 0, src.size());
+  EXPECT_EQ(brillo::Blob(src.size()), dst);
+  // x^7 * x wraps around to x^4 + x^3 + x^2 + 1.
+  simd_utils::GfMulScalar(dst.data(), src.data(), 2, src.size());
+  EXPECT_EQ((brillo::Blob{0x00, 0x02, 0x0e, 0x1d, 0xe3}), dst);
+  simd_utils::GfMulXorScalar(dst.data(), src.data(), 3, src.size());
+  EXPECT_EQ((brillo::Blob{0x00, 0x01, 0x07, 0x80, 0xff}), dst);
+}
+
+TEST(SimdUtilsTest, GfMulMatchesScalarTest) {
+  for (uint8_t factor : {0x00, 0x01, 0x02, 0x1d, 0x8e, 0xff}) {
+    for (size_t size : kSizes) {
+      for (size_t offset : kOffsets) {
+        brillo::Blob src(size + offset);
+        brillo::Blob dst(size + offset);
+        test_utils::FillWithData(&src);
+        for (size_t i = 0; i < dst.size(); i++) {
+          dst[i] = i * 7;
+        }
+        brillo::Blob expected = dst;
+        simd_utils::GfMulXorScalar(
+            expected.data() + offset, src.data() + offset, factor, size);
+        simd_utils::GfMulXor(
+            dst.data() + offset, src.data() + offset, factor, size);
+        EXPECT_EQ(expected, dst) << "factor " << static_cast<int>(factor)
+                                 << " size " << size << " offset " << offset;
+
+        simd_utils::GfMulScalar(
+            expected.data() + offset, src.data() + offset, factor, size);
+        simd_utils::GfMul(
+            dst.data() + offset, src.data() + offset, factor, size);
+        EXPECT_EQ(expected, dst) << "factor " << static_cast<int>(factor)
+                                 << " size " << size << " offset " << offset;
+      }
+    }
+  }
+}
+
+TEST(SimdUtilsTest, GfMulInPlaceTest) {
+  brillo::Blob data(4096 + 5);
+  test_utils::FillWithData(&data);
+  brillo::Blob expected(data.size());
+  simd_utils::GfMulScalar(expected.data(), data.data(), 0x8e, data.size());
+  simd_utils::GfMul(data.data(), data.data(), 0x8e, data.size());
+  EXPECT_EQ(expected, data);
+}
+
+TEST(SimdUtilsTest, Sha256MultiBufferTest) {
+  // Fewer buffers than lanes, exactly as many, and several rounds of them.
+  for (size_t count : {0, 1, 3, 8, 9, 16, 37}) {
+    ExpectSha256MultiBufferMatches(count);
+  }
+}
+
+TEST(SimdUtilsTest, Sha256MultiBufferSameSizesTest) {
+  // All lanes finishing in the same pass, with the padding in a second block.
+  std::vector<brillo::Blob> buffers(8, brillo::Blob(120));
+  std::vector<const uint8_t*> data;
+  std::vector<size_t> sizes;
+  for (size_t i = 0; i < buffers.size(); i++) {
+    buffers[i][i] = i + 1;
+    data.push_back(buffers[i].data());
+    sizes.push_back(buffers[i].size());
+  }
+  brillo::Blob digests(buffers.size() * simd_utils::kSha256DigestSize);
+  if (!simd_utils::Sha256MultiBufferSimd(
+          buffers.size(), data.data(), sizes.data(), digests.data())) {
+    return;
+  }
+  for (size_t i = 0; i < buffers.size(); i++) {
+    brillo::Blob expected;
+    ASSERT_TRUE(HashCalculator::RawHashOfData(buffers[i], &expected));
+    EXPECT_TRUE(std::equal(expected.begin(),
+                           expected.end(),
+                           digests.begin() + i * expected.size()));
+  }
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,288 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/spawned_process.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <utility>
+
+#include <base/files/scoped_file.h>
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+#include <base/strings/string_split.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr size_t kChildStackSize = 64 * 1024;
+// Highest file descriptor closed one by one when close_range() is missing.
+constexpr rlim_t kMaxClosedFd = 64 * 1024;
+
+// Everything the child uses, prepared by the parent since the child must not
+// allocate.
+struct ChildArgs {
+  const char* path;
+  char* const* argv;
+  char* const* envp;
+  // The write ends of the pipes and the child fds to move them to.
+  const std::pair<int, int>* redirects;
+  size_t num_redirects;
+  // The child fds above stderr to keep open, sorted.
+  const int* kept_fds;
+  size_t num_kept_fds;
+  int max_fd;
+  bool redirect_stderr_to_stdout;
+  sigset_t parent_mask;
+  // Set by the child on failure, read by the parent once it resumes.
+  int error;
+  const char* failed_step;
+};
+
+// Closes the file descriptors from |first| to |last|, included.
+void CloseFds(unsigned int first, unsigned int last, int max_fd) {
+  if (first > last) {
+    return;
+  }
+#ifdef __NR_close_range
+  if (syscall(__NR_close_range, first, last, 0) == 0) {
+    return;
+  }
+#endif  // __NR_close_range
+  for (unsigned int fd = first;
+       fd <= last && fd <= static_cast<unsigned int>(max_fd);
+       fd++) {
+    close(fd);
+  }
+}
+
+[[noreturn]] void ChildFail(ChildArgs* args, const char* step) {
+  args->error = errno;
+  args->failed_step = step;
+  _exit(SpawnedProcess::kErrorExitStatus);
+}
+
+int ChildMain(void* data) {
+  ChildArgs* args = static_cast<ChildArgs*>(data);
+  // The handlers of the parent must not run in the child, which shares its
+  // memory until it executes the command.
+  struct sigaction default_action = {};
+  default_action.sa_handler = SIG_DFL;
+  for (int sig = 1; sig < NSIG; sig++) {
+    struct sigaction action = {};
+    if (sigaction(sig, nullptr, &action) == 0 &&
+        action.sa_handler != SIG_IGN && action.sa_handler != SIG_DFL) {
+      sigaction(sig, &default_action, nullptr);
+    }
+  }
+
+  if (setpgid(0, 0) != 0) {
+    ChildFail(args, "setpgid");
+  }
+  for (size_t i = 0; i < args->num_redirects; i++) {
+    const auto& [from, to] = args->redirects[i];
+    if (dup2(from, to) != to) {
+      ChildFail(args, "dup2");
+    }
+  }
+  if (args->redirect_stderr_to_stdout &&
+      dup2(STDOUT_FILENO, STDERR_FILENO) != STDERR_FILENO) {
+    ChildFail(args, "dup2");
+  }
+  const int null_fd = open("/dev/null", O_RDONLY);
+  if (null_fd < 0) {
+    ChildFail(args, "open /dev/null");
+  }
+  if (null_fd != STDIN_FILENO) {
+    if (dup2(null_fd, STDIN_FILENO) != STDIN_FILENO) {
+      ChildFail(args, "dup2");
+    }
+    close(null_fd);
+  }
+
+  unsigned int first = STDERR_FILENO + 1;
+  for (size_t i = 0; i < args->num_kept_fds; i++) {
+    CloseFds(first, args->kept_fds[i] - 1, args->max_fd);
+    first = args->kept_fds[i] + 1;
+  }
+  CloseFds(first, UINT_MAX, args->max_fd);
+
+  sigprocmask(SIG_SETMASK, &args->parent_mask, nullptr);
+  execve(args->path, args->argv, args->envp);
+  ChildFail(args, "execute");
+}
+}  // namespace
+
+SpawnedProcess::~SpawnedProcess() {
+  Reset(0);
+}
+
+bool SpawnedProcess::Start() {
+  CHECK(!args_.empty());
+  CHECK_EQ(pid_, 0);
+  std::string path = args_[0];
+  if (search_path_ && path.find('/') == std::string::npos) {
+    const char* env_path = getenv("PATH");
+    for (const auto& dir : base::SplitString(env_path ? env_path : "",
+                                             ":",
+                                             base::KEEP_WHITESPACE,
+                                             base::SPLIT_WANT_NONEMPTY)) {
+      const std::string candidate = dir + "/" + path;
+      if (access(candidate.c_str(), X_OK) == 0) {
+        path = candidate;
+        break;
+      }
+    }
+  }
+
+  std::vector<char*> argv;
+  for (auto& arg : args_) {
+    argv.push_back(arg.data());
+  }
+  argv.push_back(nullptr);
+  std::vector<std::string> env_strings;
+  for (const auto& [key, value] : env_) {
+    env_strings.push_back(key + "=" + value);
+  }
+  std::vector<char*> envp;
+  for (auto& env_string : env_strings) {
+    envp.push_back(env_string.data());
+  }
+  envp.push_back(nullptr);
+
+  // The write ends go above every child fd, so that moving one of them
+  // doesn't overwrite another.
+  int max_child_fd = STDERR_FILENO;
+  std::vector<int> kept_fds;
+  for (const auto& [child_fd, read_fd] : pipes_) {
+    max_child_fd = std::max(max_child_fd, child_fd);
+    if (child_fd > STDERR_FILENO) {
+      kept_fds.push_back(child_fd);
+    }
+  }
+  std::vector<base::ScopedFD> write_fds;
+  std::vector<std::pair<int, int>> redirects;
+  for (auto& [child_fd, read_fd] : pipes_) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+      PLOG(ERROR) << "Failed to create a pipe";
+      Reset(0);
+      return false;
+    }
+    read_fd = fds[0];
+    base::ScopedFD write_fd(fds[1]);
+    if (write_fd.get() <= max_child_fd) {
+      write_fd.reset(fcntl(fds[1], F_DUPFD_CLOEXEC, max_child_fd + 1));
+      if (!write_fd.is_valid()) {
+        PLOG(ERROR) << "Failed to move a pipe";
+        Reset(0);
+        return false;
+      }
+    }
+    redirects.emplace_back(write_fd.get(), child_fd);
+    write_fds.push_back(std::move(write_fd));
+  }
+
+  struct rlimit limit = {};
+  int max_fd = static_cast<int>(kMaxClosedFd);
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < kMaxClosedFd) {
+    max_fd = static_cast<int>(limit.rlim_cur);
+  }
+
+  ChildArgs child_args = {};
+  child_args.path = path.c_str();
+  child_args.argv = argv.data();
+  child_args.envp = envp.data();
+  child_args.redirects = redirects.data();
+  child_args.num_redirects = redirects.size();
+  child_args.kept_fds = kept_fds.data();
+  child_args.num_kept_fds = kept_fds.size();
+  child_args.max_fd = max_fd;
+  child_args.redirect_stderr_to_stdout = redirect_stderr_to_stdout_;
+
+  // No signal handler may run in the child before it resets them.
+  std::vector<uint8_t> stack(kChildStackSize);
+  sigset_t all_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &child_args.parent_mask);
+  const pid_t pid = clone(ChildMain,
+                          stack.data() + stack.size(),
+                          CLONE_VM | CLONE_VFORK | SIGCHLD,
+                          &child_args);
+  const int clone_errno = errno;
+  pthread_sigmask(SIG_SETMASK, &child_args.parent_mask, nullptr);
+  write_fds.clear();
+
+  if (pid < 0) {
+    LOG(ERROR) << "Failed to start " << path << ": " << strerror(clone_errno);
+    Reset(0);
+    return false;
+  }
+  if (child_args.error != 0) {
+    // The child exits with kErrorExitStatus, reaped by the caller.
+    LOG(ERROR) << "Failed to " << child_args.failed_step << " " << path << ": "
+               << strerror(child_args.error);
+  }
+  pid_ = pid;
+  return true;
+}
+
+int SpawnedProcess::GetPipe(int child_fd) const {
+  const auto it = pipes_.find(child_fd);
+  return it == pipes_.end() ? -1 : it->second;
+}
+
+int SpawnedProcess::Wait() {
+  if (pid_ == 0) {
+    return kErrorExitStatus;
+  }
+  const pid_t pid = pid_;
+  pid_ = 0;
+  int status = 0;
+  if (HANDLE_EINTR(waitpid(pid, &status, 0)) < 0) {
+    PLOG(ERROR) << "Failed to wait for process " << pid;
+    return kErrorExitStatus;
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : kErrorExitStatus;
+}
+
+void SpawnedProcess::Reset(pid_t pid) {
+  if (pid_ > 0) {
+    kill(pid_, SIGKILL);
+    HANDLE_EINTR(waitpid(pid_, nullptr, 0));
+  }
+  for (auto& [child_fd, read_fd] : pipes_) {
+    if (read_fd >= 0) {
+      IGNORE_EINTR(close(read_fd));
+      read_fd = -1;
+    }
+  }
+  pid_ = pid;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,96 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_COMMON_SPAWNED_PROCESS_H_
+#define UPDATE_ENGINE_COMMON_SPAWNED_PROCESS_H_
+
+#include <sys/types.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+
+namespace chromeos_update_engine {
+
+// A child process started without copying the page tables of update_engine,
+// which maps the payload and the manifest while it updates: like
+// posix_spawn(), the child is a clone(CLONE_VM | CLONE_VFORK) sharing the
+// memory of the parent, which is suspended until the child executes the
+// command. The child only runs async-signal-safe code working on data
+// prepared beforehand: it redirects the pipes, reads stdin from /dev/null,
+// moves to its own process group and closes the other file descriptors.
+//
+// Mirrors the parts of brillo::Process which Subprocess uses.
+class SpawnedProcess {
+ public:
+  // The exit status of the child when it fails to execute the command.
+  static constexpr int kErrorExitStatus = 127;
+
+  SpawnedProcess() = default;
+  // Kills the process if it still runs.
+  ~SpawnedProcess();
+
+  void AddArg(const std::string& arg) { args_.push_back(arg); }
+  // Looks up the command in the PATH when it has no slash.
+  void SetSearchPath(bool search_path) { search_path_ = search_path; }
+  // The only environment variables of the child.
+  void SetEnvironment(const std::map<std::string, std::string>& env) {
+    env_ = env;
+  }
+  void SetRedirectStderrToStdout(bool redirect) {
+    redirect_stderr_to_stdout_ = redirect;
+  }
+  // Makes |child_fd| the write end of a pipe in the child, whose read end is
+  // GetPipe(|child_fd|).
+  void RedirectUsingPipe(int child_fd) { pipes_[child_fd] = -1; }
+
+  // Starts the process. Returns false if it couldn't be started; failing to
+  // execute the command exits the child with kErrorExitStatus instead.
+  bool Start();
+
+  pid_t pid() const { return pid_; }
+
+  // Returns the read end of the pipe redirected to |child_fd|, or -1.
+  int GetPipe(int child_fd) const;
+
+  // Waits for the process to exit and returns its exit status, or
+  // kErrorExitStatus if it didn't exit normally.
+  int Wait();
+
+  // Forgets the process without killing it, e.g. once it was reaped.
+  void Release() { pid_ = 0; }
+
+  // Kills the current process, if any, closes the pipes and tracks |pid|.
+  void Reset(pid_t pid);
+
+ private:
+  std::vector<std::string> args_;
+  bool search_path_{false};
+  std::map<std::string, std::string> env_;
+  bool redirect_stderr_to_stdout_{false};
+  // Child fd to the read end of its pipe in the parent.
+  std::map<int, int> pipes_;
+  pid_t pid_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(SpawnedProcess);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_SPAWNED_PROCESS_H_
@@ -46,32 +46,6 @@ namespace chromeos_update_engine {
 
 namespace {
 
-bool SetupChild(const std::map<string, string>& env, uint32_t flags) {
-  // Setup the environment variables.
-  clearenv();
-  if (setpgid(0, 0) != 0) {
-    PLOG(ERROR) << "Failed to setpgid on subprocess " << getpid();
-    return false;
-  }
-  for (const auto& key_value : env) {
-    setenv(key_value.first.c_str(), key_value.second.c_str(), 0);
-  }
-
-  if ((flags & Subprocess::kRedirectStderrToStdout) != 0) {
-    if (HANDLE_EINTR(dup2(STDOUT_FILENO, STDERR_FILENO)) != STDERR_FILENO)
-      return false;
-  }
-
-  int fd = HANDLE_EINTR(open("/dev/null", O_RDONLY));
-  if (fd < 0)
-    return false;
-  if (HANDLE_EINTR(dup2(fd, STDIN_FILENO)) != STDIN_FILENO)
-    return false;
-  IGNORE_EINTR(close(fd));
-
-  return true;
-}
-
 // Helper function to launch a process with the given Subprocess::Flags.
 // This function only sets up and starts the process according to the |flags|.
 // The caller is responsible for watching the termination of the subprocess.
@@ -80,7 +54,7 @@ bool SetupChild(const std::map<string, string>& env, uint32_t flags) {
 bool LaunchProcess(const vector<string>& cmd,
                    uint32_t flags,
                    const vector<int>& output_pipes,
-                   brillo::Process* proc) {
+                   SpawnedProcess* proc) {
   for (const string& arg : cmd)
     proc->AddArg(arg);
   proc->SetSearchPath((flags & Subprocess::kSearchPath) != 0);
@@ -93,12 +67,13 @@ bool LaunchProcess(const vector<string>& cmd,
       env.emplace(key, value);
   }
 
+  proc->SetEnvironment(env);
+  proc->SetRedirectStderrToStdout(
+      (flags & Subprocess::kRedirectStderrToStdout) != 0);
   for (const int fd : output_pipes) {
-    proc->RedirectUsingPipe(fd, false);
+    proc->RedirectUsingPipe(fd);
   }
-  proc->SetCloseUnusedFileDescriptors(true);
-  proc->RedirectUsingPipe(STDOUT_FILENO, false);
-  proc->SetPreExecCallback(base::Bind(&SetupChild, env, flags));
+  proc->RedirectUsingPipe(STDOUT_FILENO);
 
   LOG(INFO) << "Running \"" << base::JoinString(cmd, " ") << "\"";
   return proc->Start();
@@ -283,7 +258,7 @@ bool Subprocess::SynchronousExecFlags(const vector<string>& cmd,
                                       int* return_code,
                                       string* stdout_str,
                                       string* stderr_str) {
-  brillo::ProcessImpl proc;
+  SpawnedProcess proc;
   if (!LaunchProcess(cmd, flags, {STDERR_FILENO}, &proc)) {
     LOG(ERROR) << "Failed to launch subprocess";
     return false;
@@ -330,7 +305,7 @@ bool Subprocess::SynchronousExecFlags(const vector<string>& cmd,
   int proc_return_code = proc.Wait();
   if (return_code)
     *return_code = proc_return_code;
-  return proc_return_code != brillo::Process::kErrorExitStatus;
+  return proc_return_code != SpawnedProcess::kErrorExitStatus;
 }
 
 void Subprocess::FlushBufferedLogsAtExit() {
@@ -220,6 +220,13 @@ TEST_F(SubprocessTest, SynchronousEchoTest) {
   EXPECT_EQ("stderr-there", stderr);
 }
 
+TEST_F(SubprocessTest, SynchronousMissingCommandTest) {
+  int rc = -1;
+  EXPECT_FALSE(Subprocess::SynchronousExec(
+      {"/nonexistent/command"}, &rc, nullptr, nullptr));
+  EXPECT_EQ(SpawnedProcess::kErrorExitStatus, rc);
+}
+
 TEST_F(SubprocessTest, SynchronousEchoNoOutputTest) {
   int rc = -1;
   ASSERT_TRUE(Subprocess::SynchronousExec(
@@ -0,0 +1,278 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/throttle_controller.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <utility>
+
+#include <base/bind.h>
+#include <base/files/file_enumerator.h>
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_util.h>
+#include <base/time/time.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr auto kSampleInterval = base::TimeDelta::FromSeconds(2);
+
+// Pressure, in percent of stalled time, above which kBalanced backs off. It
+// only lowers the level again once the pressure is below half of it for
+// kCalmSamples consecutive samples.
+constexpr double kCpuPressureLimit = 10;
+constexpr double kIoPressureLimit = 20;
+constexpr int kCalmSamples = 3;
+
+constexpr int kThermalPassive = 1;
+constexpr int kThermalHot = 2;
+
+bool ReadInt64(const base::FilePath& path, int64_t* value) {
+  std::string contents;
+  return base::ReadFileToString(path, &contents) &&
+         base::StringToInt64(
+             base::TrimWhitespaceASCII(contents, base::TRIM_ALL), value);
+}
+}  // namespace
+
+bool ThrottlePolicyFromInt(int value, ThrottlePolicy* policy) {
+  switch (static_cast<ThrottlePolicy>(value)) {
+    case ThrottlePolicy::kBackground:
+    case ThrottlePolicy::kBalanced:
+    case ThrottlePolicy::kPerformance:
+    case ThrottlePolicy::kChargingIdle:
+    case ThrottlePolicy::kFactory:
+      *policy = static_cast<ThrottlePolicy>(value);
+      return true;
+  }
+  return false;
+}
+
+bool IsHighResourcePolicy(ThrottlePolicy policy) {
+  return policy == ThrottlePolicy::kPerformance ||
+         policy == ThrottlePolicy::kChargingIdle ||
+         policy == ThrottlePolicy::kFactory;
+}
+
+std::string ThrottlePolicyToString(ThrottlePolicy policy) {
+  switch (policy) {
+    case ThrottlePolicy::kBackground:
+      return "background";
+    case ThrottlePolicy::kBalanced:
+      return "balanced";
+    case ThrottlePolicy::kPerformance:
+      return "performance";
+    case ThrottlePolicy::kChargingIdle:
+      return "charging-idle";
+    case ThrottlePolicy::kFactory:
+      return "factory";
+  }
+  return "unknown";
+}
+
+PressureLoadSampler::PressureLoadSampler(const std::string& pressure_dir,
+                                         const std::string& thermal_dir)
+    : pressure_dir_(pressure_dir) {
+  // The trip points don't change, only the temperatures are read with each
+  // sample.
+  base::FileEnumerator zones(base::FilePath(thermal_dir),
+                             false,
+                             base::FileEnumerator::DIRECTORIES,
+                             "thermal_zone*");
+  for (base::FilePath zone = zones.Next(); !zone.empty();
+       zone = zones.Next()) {
+    ThermalZone thermal_zone{zone.Append("temp").value(),
+                             std::numeric_limits<int64_t>::max(),
+                             std::numeric_limits<int64_t>::max()};
+    for (int i = 0;; i++) {
+      const std::string trip = "trip_point_" + std::to_string(i);
+      std::string type;
+      int64_t temp = 0;
+      if (!base::ReadFileToString(zone.Append(trip + "_type"), &type) ||
+          !ReadInt64(zone.Append(trip + "_temp"), &temp)) {
+        break;
+      }
+      const auto trimmed_type = base::TrimWhitespaceASCII(type, base::TRIM_ALL);
+      if (trimmed_type == "passive") {
+        thermal_zone.passive_temp = std::min(thermal_zone.passive_temp, temp);
+      } else if (trimmed_type == "hot" || trimmed_type == "critical") {
+        thermal_zone.hot_temp = std::min(thermal_zone.hot_temp, temp);
+      }
+    }
+    if (thermal_zone.passive_temp != std::numeric_limits<int64_t>::max() ||
+        thermal_zone.hot_temp != std::numeric_limits<int64_t>::max()) {
+      thermal_zones_.push_back(std::move(thermal_zone));
+    }
+  }
+}
+
+bool PressureLoadSampler::ParsePressure(const std::string& contents,
+                                        double* avg10) {
+  return sscanf(contents.c_str(), "some avg10=%lf", avg10) == 1;
+}
+
+bool PressureLoadSampler::Sample(LoadSample* sample) {
+  const base::FilePath pressure_dir(pressure_dir_);
+  std::string cpu;
+  std::string io;
+  if (!base::ReadFileToString(pressure_dir.Append("cpu"), &cpu) ||
+      !ParsePressure(cpu, &sample->cpu_pressure) ||
+      !base::ReadFileToString(pressure_dir.Append("io"), &io) ||
+      !ParsePressure(io, &sample->io_pressure)) {
+    return false;
+  }
+  sample->thermal_status = 0;
+  for (const auto& zone : thermal_zones_) {
+    int64_t temp = 0;
+    if (!ReadInt64(base::FilePath(zone.temp_path), &temp)) {
+      continue;
+    }
+    if (temp >= zone.hot_temp) {
+      sample->thermal_status = kThermalHot;
+      break;
+    }
+    if (temp >= zone.passive_temp) {
+      sample->thermal_status = kThermalPassive;
+    }
+  }
+  return true;
+}
+
+ThrottleController::ThrottleController(
+    std::unique_ptr<LoadSamplerInterface> sampler,
+    std::unique_ptr<ThrottleActuatorInterface> actuator)
+    : sampler_(std::move(sampler)), actuator_(std::move(actuator)) {
+  actuator_->ApplyPolicy(policy_);
+  actuator_->Apply(level_);
+}
+
+ThrottleController::~ThrottleController() {
+  if (sample_task_id_ != brillo::MessageLoop::kTaskIdNull) {
+    brillo::MessageLoop::current()->CancelTask(sample_task_id_);
+  }
+}
+
+void ThrottleController::SetPolicy(ThrottlePolicy policy) {
+  LOG(INFO) << "Setting the throttle policy to "
+            << ThrottlePolicyToString(policy);
+  policy_ = policy;
+  calm_samples_ = 0;
+  actuator_->ApplyPolicy(policy_);
+  SetLevel(sample_task_id_ != brillo::MessageLoop::kTaskIdNull
+               ? InitialLevel()
+               : RestingLevel());
+}
+
+void ThrottleController::Start() {
+  if (sample_task_id_ != brillo::MessageLoop::kTaskIdNull) {
+    return;
+  }
+  calm_samples_ = 0;
+  SetLevel(InitialLevel());
+  sample_task_id_ = brillo::MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&ThrottleController::SampleCallback, base::Unretained(this)),
+      kSampleInterval);
+}
+
+void ThrottleController::Stop() {
+  if (sample_task_id_ != brillo::MessageLoop::kTaskIdNull) {
+    brillo::MessageLoop::current()->CancelTask(sample_task_id_);
+    sample_task_id_ = brillo::MessageLoop::kTaskIdNull;
+  }
+  SetLevel(RestingLevel());
+}
+
+void ThrottleController::Update(const LoadSample& sample) {
+  if (policy_ == ThrottlePolicy::kBackground) {
+    return;
+  }
+  if (sample.thermal_status >= kThermalHot) {
+    calm_samples_ = 0;
+    SetLevel(kMaxLevel);
+    return;
+  }
+  // The factory floor only cares about the hot trip points.
+  const int thermal_status =
+      policy_ == ThrottlePolicy::kFactory ? 0 : sample.thermal_status;
+  const bool balanced = policy_ == ThrottlePolicy::kBalanced;
+  const bool pressured =
+      thermal_status > 0 ||
+      (balanced && (sample.cpu_pressure > kCpuPressureLimit ||
+                    sample.io_pressure > kIoPressureLimit));
+  const bool calm =
+      thermal_status == 0 &&
+      (!balanced || (sample.cpu_pressure < kCpuPressureLimit / 2 &&
+                     sample.io_pressure < kIoPressureLimit / 2));
+  if (pressured) {
+    calm_samples_ = 0;
+    SetLevel(std::min(level_ + 1, kMaxLevel));
+  } else if (!calm) {
+    calm_samples_ = 0;
+  } else if (++calm_samples_ >= kCalmSamples) {
+    calm_samples_ = 0;
+    SetLevel(std::max(level_ - 1, 0));
+  }
+}
+
+void ThrottleController::SampleCallback() {
+  LoadSample sample;
+  if (sampler_->Sample(&sample)) {
+    Update(sample);
+  }
+  sample_task_id_ = brillo::MessageLoop::current()->PostDelayedTask(
+      FROM_HERE,
+      base::Bind(&ThrottleController::SampleCallback, base::Unretained(this)),
+      kSampleInterval);
+}
+
+void ThrottleController::SetLevel(int level) {
+  if (level == level_) {
+    return;
+  }
+  LOG(INFO) << "Changing the throttle level from " << level_ << " to "
+            << level;
+  level_ = level;
+  actuator_->Apply(level_);
+}
+
+int ThrottleController::InitialLevel() const {
+  switch (policy_) {
+    case ThrottlePolicy::kBackground:
+      return kMaxLevel;
+    case ThrottlePolicy::kBalanced:
+      return kMaxLevel / 2;
+    case ThrottlePolicy::kPerformance:
+    case ThrottlePolicy::kChargingIdle:
+    case ThrottlePolicy::kFactory:
+      return 0;
+  }
+  return kMaxLevel;
+}
+
+int ThrottleController::RestingLevel() const {
+  return IsHighResourcePolicy(policy_) ? 0 : kMaxLevel;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,170 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_COMMON_THROTTLE_CONTROLLER_H_
+#define UPDATE_ENGINE_COMMON_THROTTLE_CONTROLLER_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/message_loops/message_loop.h>
+
+namespace chromeos_update_engine {
+
+// How the update trades its throughput against the responsiveness of the
+// foreground. The values are part of the binder interface.
+enum class ThrottlePolicy : int {
+  // Always run with the lowest resources, the historical behavior.
+  kBackground = 0,
+  // Take the resources the foreground leaves, backing off on its pressure.
+  kBalanced = 1,
+  // Run with the highest resources unless the device overheats.
+  kPerformance = 2,
+  // Like kPerformance, for a device idle and charging: a reboot is unlikely,
+  // so the progress is checkpointed less often.
+  kChargingIdle = 3,
+  // Run with the highest resources until the device is about to overheat,
+  // checkpointing the progress rarely, for devices updated on the factory
+  // floor.
+  kFactory = 4,
+};
+
+// Returns whether |policy| runs the update with the highest resources rather
+// than adapting them to the foreground.
+bool IsHighResourcePolicy(ThrottlePolicy policy);
+
+// Converts |value| to a ThrottlePolicy, returns false if it is none.
+bool ThrottlePolicyFromInt(int value, ThrottlePolicy* policy);
+
+std::string ThrottlePolicyToString(ThrottlePolicy policy);
+
+// The load of the system, as the percentage of the last 10 seconds some
+// tasks stalled on the resource, see Documentation/accounting/psi.rst.
+struct LoadSample {
+  double cpu_pressure{0};
+  double io_pressure{0};
+  // 0 when no thermal zone crossed a trip point, 1 when one crossed a
+  // passive trip point, at which the kernel starts throttling, 2 when one
+  // crossed a hot or critical trip point.
+  int thermal_status{0};
+};
+
+class LoadSamplerInterface {
+ public:
+  virtual ~LoadSamplerInterface() = default;
+
+  // Returns false if the load is unknown.
+  virtual bool Sample(LoadSample* sample) = 0;
+};
+
+// Samples the load from the pressure stall information under |pressure_dir|
+// and the trip points of the thermal zones under |thermal_dir|.
+class PressureLoadSampler : public LoadSamplerInterface {
+ public:
+  PressureLoadSampler(const std::string& pressure_dir = "/proc/pressure",
+                      const std::string& thermal_dir = "/sys/class/thermal");
+
+  bool Sample(LoadSample* sample) override;
+
+  // Parses the "some avg10" value of a pressure file.
+  static bool ParsePressure(const std::string& contents, double* avg10);
+
+ private:
+  struct ThermalZone {
+    std::string temp_path;
+    // The lowest temperatures, in millidegree Celsius, of the passive and of
+    // the hot or critical trip points.
+    int64_t passive_temp;
+    int64_t hot_temp;
+  };
+
+  const std::string pressure_dir_;
+  std::vector<ThermalZone> thermal_zones_;
+
+  DISALLOW_COPY_AND_ASSIGN(PressureLoadSampler);
+};
+
+// Adjusts the resources of the update to a throttle level.
+class ThrottleActuatorInterface {
+ public:
+  virtual ~ThrottleActuatorInterface() = default;
+
+  // Level 0 gives the update the most resources and
+  // ThrottleController::kMaxLevel the least.
+  virtual void Apply(int level) = 0;
+
+  // Adjusts the settings which depend on the policy rather than on the level,
+  // like how often the progress is checkpointed.
+  virtual void ApplyPolicy(ThrottlePolicy policy) {}
+};
+
+// Periodically samples the load while an update runs and moves the throttle
+// level towards the most resources the policy lets the update use without
+// stalling the foreground: a level up on every sample above the pressure
+// limits, a level down after a few samples well below them.
+class ThrottleController {
+ public:
+  static constexpr int kMaxLevel = 3;
+
+  // Starts with the kBackground policy, applying kMaxLevel.
+  ThrottleController(std::unique_ptr<LoadSamplerInterface> sampler,
+                     std::unique_ptr<ThrottleActuatorInterface> actuator);
+  ~ThrottleController();
+
+  // Changes the policy and applies the level it starts from.
+  void SetPolicy(ThrottlePolicy policy);
+  ThrottlePolicy policy() const { return policy_; }
+
+  // Starts and stops sampling the load. Stopping goes back to the resting
+  // level of the policy: 0 with the high resource policies, kMaxLevel
+  // otherwise.
+  void Start();
+  void Stop();
+
+  // Updates the level for |sample|.
+  void Update(const LoadSample& sample);
+
+  int level() const { return level_; }
+
+ private:
+  void SampleCallback();
+  void SetLevel(int level);
+
+  // The level the policy starts sampling from, and the one it rests at.
+  int InitialLevel() const;
+  int RestingLevel() const;
+
+  std::unique_ptr<LoadSamplerInterface> sampler_;
+  std::unique_ptr<ThrottleActuatorInterface> actuator_;
+
+  ThrottlePolicy policy_{ThrottlePolicy::kBackground};
+  int level_{kMaxLevel};
+  // Consecutive samples allowing to lower the level.
+  int calm_samples_{0};
+
+  brillo::MessageLoop::TaskId sample_task_id_{brillo::MessageLoop::kTaskIdNull};
+
+  DISALLOW_COPY_AND_ASSIGN(ThrottleController);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_COMMON_THROTTLE_CONTROLLER_H_
@@ -0,0 +1,207 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/common/throttle_controller.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+class FakeLoadSampler : public LoadSamplerInterface {
+ public:
+  explicit FakeLoadSampler(LoadSample* sample) : sample_(sample) {}
+
+  bool Sample(LoadSample* sample) override {
+    *sample = *sample_;
+    return true;
+  }
+
+ private:
+  LoadSample* sample_;
+};
+
+class FakeThrottleActuator : public ThrottleActuatorInterface {
+ public:
+  explicit FakeThrottleActuator(std::vector<int>* levels) : levels_(levels) {}
+
+  void Apply(int level) override { levels_->push_back(level); }
+
+ private:
+  std::vector<int>* levels_;
+};
+
+constexpr LoadSample kCalm{1, 2, 0};
+constexpr LoadSample kPressured{40, 2, 0};
+constexpr LoadSample kPassive{1, 2, 1};
+constexpr LoadSample kHot{1, 2, 2};
+}  // namespace
+
+class ThrottleControllerTest : public ::testing::Test {
+ protected:
+  void SetUp() override { loop_.SetAsCurrent(); }
+
+  void TearDown() override { EXPECT_FALSE(loop_.PendingTasks()); }
+
+  brillo::FakeMessageLoop loop_{nullptr};
+  LoadSample sample_{kCalm};
+  std::vector<int> levels_;
+  ThrottleController controller_{
+      std::make_unique<FakeLoadSampler>(&sample_),
+      std::make_unique<FakeThrottleActuator>(&levels_)};
+};
+
+TEST_F(ThrottleControllerTest, PolicyFromIntTest) {
+  ThrottlePolicy policy;
+  EXPECT_TRUE(ThrottlePolicyFromInt(2, &policy));
+  EXPECT_EQ(ThrottlePolicy::kPerformance, policy);
+  EXPECT_TRUE(ThrottlePolicyFromInt(4, &policy));
+  EXPECT_EQ(ThrottlePolicy::kFactory, policy);
+  EXPECT_FALSE(ThrottlePolicyFromInt(5, &policy));
+  EXPECT_FALSE(ThrottlePolicyFromInt(-1, &policy));
+}
+
+TEST_F(ThrottleControllerTest, BackgroundKeepsMaxLevelTest) {
+  EXPECT_EQ(std::vector<int>{ThrottleController::kMaxLevel}, levels_);
+  controller_.Start();
+  for (int i = 0; i < 10; i++) {
+    controller_.Update(kCalm);
+  }
+  EXPECT_EQ(ThrottleController::kMaxLevel, controller_.level());
+  controller_.Stop();
+}
+
+TEST_F(ThrottleControllerTest, BalancedFollowsPressureTest) {
+  controller_.SetPolicy(ThrottlePolicy::kBalanced);
+  controller_.Start();
+  EXPECT_EQ(1, controller_.level());
+  controller_.Update(kPressured);
+  EXPECT_EQ(2, controller_.level());
+  controller_.Update(kPassive);
+  controller_.Update(kPressured);
+  EXPECT_EQ(3, controller_.level());
+
+  // A sample in between the limits resets the calm samples.
+  controller_.Update(kCalm);
+  controller_.Update(kCalm);
+  controller_.Update({7, 2, 0});
+  controller_.Update(kCalm);
+  controller_.Update(kCalm);
+  EXPECT_EQ(3, controller_.level());
+  controller_.Update(kCalm);
+  EXPECT_EQ(2, controller_.level());
+  for (int i = 0; i < 6; i++) {
+    controller_.Update(kCalm);
+  }
+  EXPECT_EQ(0, controller_.level());
+
+  controller_.Update(kHot);
+  EXPECT_EQ(3, controller_.level());
+  controller_.Stop();
+  EXPECT_EQ((std::vector<int>{3, 1, 2, 3, 2, 1, 0, 3}), levels_);
+}
+
+TEST_F(ThrottleControllerTest, PerformanceIgnoresPressureTest) {
+  controller_.SetPolicy(ThrottlePolicy::kPerformance);
+  EXPECT_EQ(0, controller_.level());
+  controller_.Start();
+  controller_.Update(kPressured);
+  EXPECT_EQ(0, controller_.level());
+  controller_.Update(kPassive);
+  EXPECT_EQ(1, controller_.level());
+  controller_.Update(kHot);
+  EXPECT_EQ(3, controller_.level());
+  controller_.Stop();
+  EXPECT_EQ(0, controller_.level());
+}
+
+TEST_F(ThrottleControllerTest, FactoryOnlyBacksOffWhenHotTest) {
+  controller_.SetPolicy(ThrottlePolicy::kFactory);
+  controller_.Start();
+  controller_.Update(kPressured);
+  controller_.Update(kPassive);
+  EXPECT_EQ(0, controller_.level());
+  controller_.Update(kHot);
+  EXPECT_EQ(3, controller_.level());
+  controller_.Stop();
+  EXPECT_EQ(0, controller_.level());
+}
+
+TEST_F(ThrottleControllerTest, SamplesWhileStartedTest) {
+  controller_.SetPolicy(ThrottlePolicy::kBalanced);
+  controller_.Start();
+  sample_ = kPressured;
+  EXPECT_TRUE(loop_.RunOnce(false));
+  EXPECT_EQ(2, controller_.level());
+  EXPECT_TRUE(loop_.RunOnce(false));
+  EXPECT_EQ(3, controller_.level());
+  controller_.Stop();
+  EXPECT_FALSE(loop_.RunOnce(false));
+}
+
+TEST(PressureLoadSamplerTest, SampleTest) {
+  base::ScopedTempDir pressure_dir;
+  base::ScopedTempDir thermal_dir;
+  ASSERT_TRUE(pressure_dir.CreateUniqueTempDir());
+  ASSERT_TRUE(thermal_dir.CreateUniqueTempDir());
+  const std::string cpu =
+      "some avg10=12.50 avg60=3.00 avg300=1.00 total=1234\n"
+      "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n";
+  const std::string io = "some avg10=0.25 avg60=0.00 avg300=0.00 total=1\n";
+  auto write = [](const base::FilePath& path, const std::string& value) {
+    return base::WriteFile(path, value.data(), value.size()) ==
+           static_cast<int>(value.size());
+  };
+  ASSERT_TRUE(write(pressure_dir.GetPath().Append("cpu"), cpu));
+  ASSERT_TRUE(write(pressure_dir.GetPath().Append("io"), io));
+
+  const base::FilePath zone = thermal_dir.GetPath().Append("thermal_zone0");
+  ASSERT_TRUE(base::CreateDirectory(zone));
+  ASSERT_TRUE(write(zone.Append("trip_point_0_type"), "passive\n"));
+  ASSERT_TRUE(write(zone.Append("trip_point_0_temp"), "60000\n"));
+  ASSERT_TRUE(write(zone.Append("trip_point_1_type"), "critical\n"));
+  ASSERT_TRUE(write(zone.Append("trip_point_1_temp"), "90000\n"));
+  ASSERT_TRUE(write(zone.Append("temp"), "45000\n"));
+
+  PressureLoadSampler sampler(pressure_dir.GetPath().value(),
+                              thermal_dir.GetPath().value());
+  LoadSample sample;
+  ASSERT_TRUE(sampler.Sample(&sample));
+  EXPECT_DOUBLE_EQ(12.5, sample.cpu_pressure);
+  EXPECT_DOUBLE_EQ(0.25, sample.io_pressure);
+  EXPECT_EQ(0, sample.thermal_status);
+
+  ASSERT_TRUE(write(zone.Append("temp"), "61000\n"));
+  ASSERT_TRUE(sampler.Sample(&sample));
+  EXPECT_EQ(1, sample.thermal_status);
+  ASSERT_TRUE(write(zone.Append("temp"), "95000\n"));
+  ASSERT_TRUE(sampler.Sample(&sample));
+  EXPECT_EQ(2, sample.thermal_status);
+
+  ASSERT_TRUE(base::DeleteFile(pressure_dir.GetPath().Append("io"), false));
+  EXPECT_FALSE(sampler.Sample(&sample));
+}
+
+}  // namespace chromeos_update_engine
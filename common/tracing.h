@@ -0,0 +1,85 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_COMMON_TRACING_H_
+#define UPDATE_ENGINE_COMMON_TRACING_H_
+
+// Trace spans and counters of the update pipeline, recorded with atrace and
+// so visible in Perfetto traces. Built with USE_TRACING=0, the macros expand
+// to nothing and their arguments aren't evaluated.
+
+#include <stdint.h>
+
+#if USE_TRACING
+#ifndef ATRACE_TAG
+#define ATRACE_TAG ATRACE_TAG_ALWAYS
+#endif  // ATRACE_TAG
+#include <cutils/trace.h>
+#endif  // USE_TRACING
+
+#if USE_TRACING
+
+namespace chromeos_update_engine {
+
+// Traces a span from construction to destruction on the calling thread.
+class ScopedTrace {
+ public:
+  explicit ScopedTrace(const char* name) { atrace_begin(ATRACE_TAG, name); }
+  ~ScopedTrace() { atrace_end(ATRACE_TAG); }
+
+  ScopedTrace(const ScopedTrace&) = delete;
+  ScopedTrace& operator=(const ScopedTrace&) = delete;
+};
+
+// Returns a cookie identifying |object| in asynchronous spans.
+inline int32_t TraceCookie(const void* object) {
+  return static_cast<int32_t>(reinterpret_cast<uintptr_t>(object));
+}
+
+}  // namespace chromeos_update_engine
+
+#define UE_TRACE_CONCAT_INNER(a, b) a##b
+#define UE_TRACE_CONCAT(a, b) UE_TRACE_CONCAT_INNER(a, b)
+
+// Traces the rest of the enclosing scope as a span named |name|.
+#define UE_TRACE_SCOPE(name)                     \
+  ::chromeos_update_engine::ScopedTrace          \
+  UE_TRACE_CONCAT(ue_trace_scope_, __LINE__)(name)
+
+// Sets the counter named |name| to |value|.
+#define UE_TRACE_COUNTER(name, value) \
+  atrace_int64(ATRACE_TAG, name, static_cast<int64_t>(value))
+
+// Begins and ends a span named |name| which may end on another call stack,
+// or overlap another span of the same name with a different |object|.
+#define UE_TRACE_ASYNC_BEGIN(name, object) \
+  atrace_async_begin(                      \
+      ATRACE_TAG, name, ::chromeos_update_engine::TraceCookie(object))
+#define UE_TRACE_ASYNC_END(name, object) \
+  atrace_async_end(                      \
+      ATRACE_TAG, name, ::chromeos_update_engine::TraceCookie(object))
+
+#else  // USE_TRACING
+
+#define UE_TRACE_SCOPE(name) static_assert(true, "")
+#define UE_TRACE_COUNTER(name, value) static_cast<void>(0)
+#define UE_TRACE_ASYNC_BEGIN(name, object) static_cast<void>(0)
+#define UE_TRACE_ASYNC_END(name, object) static_cast<void>(0)
+
+#endif  // USE_TRACING
+
+#endif  // UPDATE_ENGINE_COMMON_TRACING_H_
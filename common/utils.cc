@@ -23,14 +23,19 @@
 #include <endian.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <malloc.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/resource.h>
 #include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -219,6 +224,47 @@ bool PReadAll(
   return true;
 }
 
+bool CopyFileRange(int in_fd,
+                   off_t in_offset,
+                   int out_fd,
+                   off_t out_offset,
+                   size_t length,
+                   bool* use_copy_file_range) {
+#ifdef __NR_copy_file_range
+  while (*use_copy_file_range && length > 0) {
+    loff_t off_in = in_offset, off_out = out_offset;
+    ssize_t rc = syscall(
+        __NR_copy_file_range, in_fd, &off_in, out_fd, &off_out, length, 0);
+    if (rc > 0) {
+      in_offset += rc;
+      out_offset += rc;
+      length -= rc;
+      continue;
+    }
+    TEST_AND_RETURN_FALSE_ERRNO(rc < 0 && (errno == ENOSYS || errno == EXDEV ||
+                                           errno == EINVAL ||
+                                           errno == EOPNOTSUPP));
+    LOG(INFO) << "copy_file_range() not supported, copying the data.";
+    *use_copy_file_range = false;
+  }
+#else
+  *use_copy_file_range = false;
+#endif  // __NR_copy_file_range
+  brillo::Blob buf(std::min<size_t>(length, 1024 * 1024));
+  while (length > 0) {
+    size_t chunk = std::min(length, buf.size());
+    ssize_t bytes_read;
+    TEST_AND_RETURN_FALSE(
+        PReadAll(in_fd, buf.data(), chunk, in_offset, &bytes_read));
+    TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(chunk));
+    TEST_AND_RETURN_FALSE(PWriteAll(out_fd, buf.data(), chunk, out_offset));
+    in_offset += chunk;
+    out_offset += chunk;
+    length -= chunk;
+  }
+  return true;
+}
+
 bool ReadAll(FileDescriptor* fd,
              void* buf,
              size_t count,
@@ -700,6 +746,64 @@ bool SetBlockDeviceReadOnly(const string& device, bool read_only) {
   return true;
 }
 
+// <sys/mount.h> doesn't define it with every libc.
+#ifndef BLKIOOPT
+#define BLKIOOPT _IO(0x12, 121)
+#endif
+
+size_t GetBlockDeviceOptimalIoSize(const string& device) {
+  android::base::unique_fd fd(
+      HANDLE_EINTR(open(device.c_str(), O_RDONLY | O_CLOEXEC)));
+  unsigned int optimal_io_size = 0;
+  if (fd < 0 || ioctl(fd, BLKIOOPT, &optimal_io_size) != 0) {
+    return 0;
+  }
+  return optimal_io_size;
+}
+
+// From linux/ioprio.h, which isn't exported by every libc.
+constexpr int kIoprioWhoProcess = 1;
+constexpr int kIoprioClassBestEffort = 2;
+constexpr int kIoprioClassShift = 13;
+constexpr uint32_t kMaxIoprioLevel = 7;
+
+void SetThreadIoPriority(uint32_t level) {
+  const int priority = (kIoprioClassBestEffort << kIoprioClassShift) |
+                       static_cast<int>(std::min(level, kMaxIoprioLevel));
+  // With IOPRIO_WHO_PROCESS, 0 is the calling thread.
+  if (syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, priority) != 0) {
+    PLOG(WARNING) << "Failed to set the I/O priority to " << level;
+  }
+}
+
+int64_t GetResidentSetKiB() {
+  string status;
+  if (!base::ReadFileToString(base::FilePath("/proc/self/status"), &status)) {
+    return -1;
+  }
+  for (const auto& line : android::base::Split(status, "\n")) {
+    if (!android::base::StartsWith(line, "VmRSS:")) {
+      continue;
+    }
+    // "VmRSS:      1234 kB"
+    const auto fields =
+        android::base::Tokenize(line.substr(sizeof("VmRSS:") - 1), " \t");
+    int64_t rss = -1;
+    if (!fields.empty() && base::StringToInt64(fields[0], &rss)) {
+      return rss;
+    }
+  }
+  return -1;
+}
+
+void ReleaseFreeMemory() {
+#ifdef __BIONIC__
+  mallopt(M_PURGE, 0);
+#else
+  malloc_trim(0);
+#endif  // __BIONIC__
+}
+
 bool MountFilesystem(const string& device,
                      const string& mountpoint,
                      unsigned long mountflags,  // NOLINT(runtime/int)
@@ -1092,28 +1196,152 @@ bool ReadExtents(FileDescriptorPtr fd,
                      block_size);
 }
 
+namespace {
+
+// The part of the output of ReadExtents() coming from one extent.
+struct ExtentRead {
+  uint64_t file_offset;
+  size_t out_offset;
+  size_t size;
+};
+
+// Reads the |count| |reads|, which follow each other in the file, into |out|
+// with as few preadv() calls as possible.
+bool PReadvAll(int fd, const ExtentRead* reads, size_t count, uint8_t* out) {
+  vector<iovec> iov(count);
+  for (size_t i = 0; i < count; i++) {
+    iov[i].iov_base = out + reads[i].out_offset;
+    iov[i].iov_len = reads[i].size;
+  }
+  off_t offset = reads[0].file_offset;
+  size_t first = 0;
+  while (first < count) {
+    const int iovcnt = min<size_t>(count - first, IOV_MAX);
+    ssize_t rc = HANDLE_EINTR(preadv(fd, &iov[first], iovcnt, offset));
+    TEST_AND_RETURN_FALSE_ERRNO(rc >= 0);
+    // The extents go past the end of the file.
+    TEST_AND_RETURN_FALSE(rc > 0);
+    offset += rc;
+    // Skip the buffers filled and trim the one partially filled.
+    while (rc > 0) {
+      const size_t filled = min<size_t>(rc, iov[first].iov_len);
+      iov[first].iov_base = static_cast<uint8_t*>(iov[first].iov_base) + filled;
+      iov[first].iov_len -= filled;
+      rc -= filled;
+      if (iov[first].iov_len == 0) {
+        first++;
+      }
+    }
+  }
+  return true;
+}
+
+// Same as PReadvAll() for descriptors which don't expose their fd, e.g. an
+// IoUringFileDescriptor, which submits the single read as a batch.
+bool PReadRunAll(FileDescriptor* fd,
+                 const ExtentRead* reads,
+                 size_t count,
+                 uint8_t* out) {
+  size_t size = 0;
+  bool contiguous_output = true;
+  for (size_t i = 0; i < count; i++) {
+    contiguous_output &= reads[i].out_offset == reads[0].out_offset + size;
+    size += reads[i].size;
+  }
+  brillo::Blob scratch;
+  uint8_t* buf = out + reads[0].out_offset;
+  if (!contiguous_output) {
+    scratch.resize(size);
+    buf = scratch.data();
+  }
+  ssize_t bytes_read = 0;
+  TEST_AND_RETURN_FALSE(
+      utils::PReadAll(fd, buf, size, reads[0].file_offset, &bytes_read));
+  TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(size));
+  if (!contiguous_output) {
+    for (size_t i = 0, offset = 0; i < count; offset += reads[i++].size) {
+      memcpy(out + reads[i].out_offset, buf + offset, reads[i].size);
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
 bool ReadExtents(FileDescriptorPtr fd,
                  const vector<Extent>& extents,
                  brillo::Blob* out_data,
                  ssize_t out_data_size,
                  size_t block_size) {
+  vector<ExtentRead> reads;
+  reads.reserve(extents.size());
+  ssize_t total_size = 0;
+  for (const Extent& extent : extents) {
+    const ssize_t bytes = extent.num_blocks() * block_size;
+    TEST_LE(total_size + bytes, out_data_size);
+    if (bytes > 0) {
+      reads.push_back({extent.start_block() * block_size,
+                       static_cast<size_t>(total_size),
+                       static_cast<size_t>(bytes)});
+    }
+    total_size += bytes;
+  }
+  TEST_AND_RETURN_FALSE(out_data_size == total_size);
+
+  // Fragmented extent lists often have neighbouring extents in the file which
+  // aren't next to each other in the list, so read them in file order: every
+  // run of adjacent extents takes a single read, scattered into the output.
+  std::stable_sort(reads.begin(),
+                   reads.end(),
+                   [](const ExtentRead& a, const ExtentRead& b) {
+                     return a.file_offset < b.file_offset;
+                   });
   brillo::Blob data(out_data_size);
-  ssize_t bytes_read = 0;
+  const int raw_fd = fd->Fd();
+  for (size_t begin = 0; begin < reads.size();) {
+    size_t end = begin + 1;
+    while (end < reads.size() &&
+           reads[end].file_offset ==
+               reads[end - 1].file_offset + reads[end - 1].size) {
+      end++;
+    }
+    if (raw_fd >= 0) {
+      TEST_AND_RETURN_FALSE(
+          PReadvAll(raw_fd, &reads[begin], end - begin, data.data()));
+    } else {
+      TEST_AND_RETURN_FALSE(
+          PReadRunAll(fd.get(), &reads[begin], end - begin, data.data()));
+    }
+    begin = end;
+  }
+  *out_data = std::move(data);
+  return true;
+}
 
-  for (const Extent& extent : extents) {
-    ssize_t bytes_read_this_iteration = 0;
-    ssize_t bytes = extent.num_blocks() * block_size;
-    TEST_LE(bytes_read + bytes, out_data_size);
-    TEST_AND_RETURN_FALSE(utils::PReadAll(fd,
-                                          &data[bytes_read],
-                                          bytes,
-                                          extent.start_block() * block_size,
-                                          &bytes_read_this_iteration));
-    TEST_AND_RETURN_FALSE(bytes_read_this_iteration == bytes);
-    bytes_read += bytes_read_this_iteration;
-  }
-  TEST_AND_RETURN_FALSE(out_data_size == bytes_read);
-  *out_data = data;
+bool GetPageCacheResidentBytes(const string& path,
+                               uint64_t size,
+                               uint64_t* resident_bytes) {
+  // Mapping the file in windows bounds the size of the mincore() vector.
+  constexpr uint64_t kWindowSize = 64 * 1024 * 1024;
+  base::ScopedFD fd(HANDLE_EINTR(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+  TEST_AND_RETURN_FALSE_ERRNO(fd.is_valid());
+  const uint64_t page_size = sysconf(_SC_PAGESIZE);
+  vector<unsigned char> pages(kWindowSize / page_size);
+  uint64_t resident_pages = 0;
+  for (uint64_t offset = 0; offset < size; offset += kWindowSize) {
+    const size_t length = min(kWindowSize, size - offset);
+    void* addr =
+        mmap(nullptr, length, PROT_READ, MAP_SHARED, fd.get(), offset);
+    TEST_AND_RETURN_FALSE_ERRNO(addr != MAP_FAILED);
+    const bool success = mincore(addr, length, pages.data()) == 0;
+    munmap(addr, length);
+    TEST_AND_RETURN_FALSE_ERRNO(success);
+    const size_t num_pages = (length + page_size - 1) / page_size;
+    for (size_t i = 0; i < num_pages; i++) {
+      resident_pages += pages[i] & 1;
+    }
+  }
+  *resident_bytes = min(resident_pages * page_size, size);
   return true;
 }
 
@@ -98,6 +98,17 @@ bool ReadAll(
 bool PReadAll(
     int fd, void* buf, size_t count, off_t offset, ssize_t* out_bytes_read);
 
+// Copies |length| bytes at |in_offset| of |in_fd| to |out_offset| of
+// |out_fd|. Uses copy_file_range(), which shares the extents on the file
+// systems supporting it, unless |*use_copy_file_range| is false, and clears it
+// if it isn't supported between the two files.
+bool CopyFileRange(int in_fd,
+                   off_t in_offset,
+                   int out_fd,
+                   off_t out_offset,
+                   size_t length,
+                   bool* use_copy_file_range);
+
 // Reads data at specified offset, this function does change file position.
 
 bool ReadAll(FileDescriptor* fd,
@@ -210,6 +221,23 @@ std::string MakePartitionName(const std::string& disk_name, int partition_num);
 // in |read_only|. Return whether the operation succeeded.
 bool SetBlockDeviceReadOnly(const std::string& device, bool read_only);
 
+// Returns the optimal I/O size of the block device |device|, in bytes, as in
+// /sys/block/<device>/queue/optimal_io_size. Returns 0 if the device doesn't
+// report one or |device| isn't a block device.
+size_t GetBlockDeviceOptimalIoSize(const std::string& device);
+
+// Sets the best-effort I/O priority of the calling thread to |level|, from 0
+// (highest) to 7.
+void SetThreadIoPriority(uint32_t level);
+
+// Returns the resident set size of the calling process in KiB, or -1 if it's
+// unknown.
+int64_t GetResidentSetKiB();
+
+// Returns the free memory the allocator holds on to to the system, so that a
+// phase of the update doesn't keep the peak of the previous one resident.
+void ReleaseFreeMemory();
+
 // Synchronously mount or unmount a filesystem. Return true on success.
 // When mounting, it will attempt to mount the device as the passed filesystem
 // type |type|, with the passed |flags| options. If |type| is empty, "ext2",
@@ -328,7 +356,8 @@ bool GetMinorVersion(const brillo::KeyValueStore& store,
 // This function reads the specified data in |extents| into |out_data|. The
 // extents are read from the file at |path|. |out_data_size| is the size of
 // |out_data|. Returns false if the number of bytes to read given in
-// |extents| does not equal |out_data_size|.
+// |extents| does not equal |out_data_size|. Extents adjacent in the file are
+// read together, with preadv() when the descriptor exposes its fd.
 bool ReadExtents(const std::string& path,
                  const std::vector<Extent>& extents,
                  brillo::Blob* out_data,
@@ -367,6 +396,12 @@ bool ReadExtents(FileDescriptorPtr path,
                  brillo::Blob* out_data,
                  size_t block_size);
 
+// Sets |resident_bytes| to the number of bytes of the first |size| bytes of
+// the file at |path| which are in the page cache. Returns false on failure.
+bool GetPageCacheResidentBytes(const std::string& path,
+                               uint64_t size,
+                               uint64_t* resident_bytes);
+
 // Read the current boot identifier and store it in |boot_id|. This identifier
 // is constants during the same boot of the kernel and is regenerated after
 // reboot. Returns whether it succeeded getting the boot_id.
@@ -32,6 +32,7 @@
 #include <gtest/gtest.h>
 
 #include "update_engine/common/test_utils.h"
+#include "update_engine/payload_generator/extent_ranges.h"
 
 using std::numeric_limits;
 using std::string;
@@ -77,6 +78,38 @@ TEST(UtilsTest, ReadFileChunk) {
   EXPECT_EQ(brillo::Blob(data.begin() + 10, data.begin() + 10 + 20), in_data);
 }
 
+TEST(UtilsTest, ReadExtentsCoalescesAdjacentExtents) {
+  constexpr size_t kBlockSize = 4096;
+  ScopedTempFile file;
+  brillo::Blob data(20 * kBlockSize);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = i / kBlockSize * 7 + i % 13;
+  }
+  EXPECT_TRUE(test_utils::WriteFileVector(file.path(), data));
+
+  // Out of order, adjacent, overlapping and empty extents.
+  const vector<Extent> extents = {ExtentForRange(10, 2),
+                                  ExtentForRange(3, 1),
+                                  ExtentForRange(12, 1),
+                                  ExtentForRange(0, 3),
+                                  ExtentForRange(4, 0),
+                                  ExtentForRange(15, 5),
+                                  ExtentForRange(1, 1)};
+  brillo::Blob expected;
+  for (const auto& extent : extents) {
+    const auto begin = data.begin() + extent.start_block() * kBlockSize;
+    expected.insert(
+        expected.end(), begin, begin + extent.num_blocks() * kBlockSize);
+  }
+  brillo::Blob out;
+  EXPECT_TRUE(utils::ReadExtents(file.path(), extents, &out, kBlockSize));
+  EXPECT_EQ(expected, out);
+
+  // Past the end of the file.
+  EXPECT_FALSE(utils::ReadExtents(
+      file.path(), {ExtentForRange(19, 2)}, &out, kBlockSize));
+}
+
 TEST(UtilsTest, IsSymlinkTest) {
   base::ScopedTempDir temp_dir;
   ASSERT_TRUE(temp_dir.CreateUniqueTempDir());
@@ -474,4 +507,15 @@ TEST(UtilsTest, ValidatePerPartitionTimestamp) {
   ASSERT_EQ(ErrorCode::kSuccess, utils::IsTimestampNewer("10", ""));
 }
 
+TEST(UtilsTest, GetResidentSetKiBTest) {
+  const int64_t before = utils::GetResidentSetKiB();
+  ASSERT_GT(before, 0);
+  // Touch 16 MiB so that they become resident.
+  std::vector<uint8_t> data(16 * 1024 * 1024, 1);
+  ASSERT_GE(utils::GetResidentSetKiB(), before + 8 * 1024);
+  std::vector<uint8_t>().swap(data);
+  utils::ReleaseFreeMemory();
+  ASSERT_GT(utils::GetResidentSetKiB(), 0);
+}
+
 }  // namespace chromeos_update_engine
@@ -17,10 +17,12 @@
 #include "update_engine/common/download_action.h"
 
 #include <errno.h>
+#include <sys/statvfs.h>
 
 #include <algorithm>
 #include <string>
 
+#include <base/bind.h>
 #include <base/files/file_path.h>
 #include <base/metrics/statistics_recorder.h>
 #include <base/strings/stringprintf.h>
@@ -29,13 +31,28 @@
 #include "update_engine/common/error_code_utils.h"
 #include "update_engine/common/multi_range_http_fetcher.h"
 #include "update_engine/common/prefs_interface.h"
+#include "update_engine/common/tracing.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/operation_data_checkpoint.h"
+#include "update_engine/payload_consumer/update_checkpoint.h"
 
 using base::FilePath;
+using brillo::MessageLoop;
 using std::string;
 
 namespace chromeos_update_engine {
 
+namespace {
+// Name of the staging ring file, in the non-volatile directory.
+constexpr char kStagingFileName[] = "payload_staging";
+// Size of the writes of the staged bytes into the DeltaPerformer.
+constexpr size_t kStagingApplySize = 1024 * 1024;
+// Interval between the checks of the apply thread, once the transfer ended.
+constexpr int kStagingWaitIntervalMs = 100;
+// Interval between the reports of the progress of the apply thread.
+constexpr int kStagingProgressIntervalMs = 500;
+}  // namespace
+
 DownloadAction::DownloadAction(PrefsInterface* prefs,
                                BootControlInterface* boot_control,
                                HardwareInterface* hardware,
@@ -51,7 +68,11 @@ DownloadAction::DownloadAction(PrefsInterface* prefs,
       delegate_(nullptr),
       update_certificates_path_(std::move(update_certificates_path)) {}
 
-DownloadAction::~DownloadAction() {}
+DownloadAction::~DownloadAction() {
+  StopStaging();
+  if (sparse_transfer_task_ != MessageLoop::kTaskIdNull)
+    MessageLoop::current()->CancelTask(sparse_transfer_task_);
+}
 
 void DownloadAction::PerformAction() {
   http_fetcher_->set_delegate(this);
@@ -105,6 +126,9 @@ bool DownloadAction::LoadCachedManifest(int64_t manifest_size) {
     return false;
   }
 
+  if (delta_performer_->TrustCachedManifest()) {
+    LOG(INFO) << "Cached manifest was verified before it was cached.";
+  }
   ErrorCode error{};
   const bool success =
       delta_performer_->Write(
@@ -166,10 +190,21 @@ void DownloadAction::StartDownloading() {
     // If there're remaining unprocessed data blobs, fetch them. Be careful
     // not to request data beyond the end of the payload to avoid 416 HTTP
     // response error codes.
-    int64_t next_data_offset = 0;
-    prefs_->GetInt64(kPrefsUpdateStateNextDataOffset, &next_data_offset);
+    UpdateCheckpoint checkpoint;
+    LoadUpdateCheckpoint(prefs_, &checkpoint);
+    const int64_t next_data_offset =
+        std::max<int64_t>(checkpoint.next_data_offset, 0);
     uint64_t resume_offset =
         manifest_metadata_size + manifest_signature_size + next_data_offset;
+    // The DeltaPerformer loads the data of the next operation it saved.
+    FilePath dir;
+    if (install_plan_.operation_data_checkpoint_size > 0 &&
+        hardware_->GetNonVolatileDirectory(&dir)) {
+      resume_offset +=
+          OperationDataCheckpoint(
+              dir.Append(kOperationDataCheckpointFileName).value())
+              .SavedSize(next_data_offset);
+    }
     if (!payload_->size) {
       http_fetcher_->AddRange(base_offset_ + resume_offset);
     } else if (resume_offset < payload_->size) {
@@ -186,18 +221,136 @@ void DownloadAction::StartDownloading() {
     }
   }
 
+  StartStaging();
+  // The staged bytes are applied after they are downloaded, too late to
+  // change what is downloaded.
+  if (delta_performer_) {
+    delta_performer_->set_allow_sparse_download(!staging_ring_ &&
+                                                payload_->size > 0);
+  }
   http_fetcher_->BeginTransfer(install_plan_.download_url);
 }
 
+void DownloadAction::StartStaging() {
+  if (install_plan_.download_staging_size == 0 || !delta_performer_)
+    return;
+  base::FilePath dir;
+  if (!hardware_->GetNonVolatileDirectory(&dir))
+    return;
+  uint64_t capacity = install_plan_.download_staging_size;
+  struct statvfs fs {};
+  if (statvfs(dir.value().c_str(), &fs) == 0) {
+    // Leave at least half of the free space to the rest of the system.
+    capacity = std::min<uint64_t>(capacity, fs.f_bavail * fs.f_frsize / 2);
+  }
+  auto ring = std::make_unique<PayloadStagingRing>();
+  if (capacity == 0 ||
+      !ring->Open(dir.Append(kStagingFileName).value(), capacity)) {
+    LOG(WARNING) << "Failed to set up the download staging, applying the "
+                 << "payload as it is downloaded.";
+    return;
+  }
+  LOG(INFO) << "Staging up to " << capacity << " downloaded bytes.";
+  staging_ring_ = std::move(ring);
+  apply_done_ = false;
+  apply_error_ = ErrorCode::kSuccess;
+  apply_thread_ = std::thread(&DownloadAction::ApplyStagedBytes, this);
+  apply_progress_sampler_ = std::make_unique<ProgressSampler>(
+      &delta_performer_->apply_progress(),
+      base::TimeDelta::FromMilliseconds(kStagingProgressIntervalMs),
+      base::BindRepeating(&DownloadAction::ReportApplyProgress,
+                          base::Unretained(this)));
+  apply_progress_sampler_->Start();
+}
+
+void DownloadAction::ApplyStagedBytes() {
+  brillo::Blob buffer(kStagingApplySize);
+  while (true) {
+    size_t size = 0;
+    if (!staging_ring_->Read(buffer.data(), buffer.size(), &size)) {
+      // Either closed by StopStaging() or a read error.
+      apply_error_ = ErrorCode::kDownloadWriteError;
+      break;
+    }
+    if (size == 0)
+      break;
+    UE_TRACE_SCOPE("DownloadAction::ApplyStagedBytes");
+    ErrorCode error = ErrorCode::kSuccess;
+    if (!delta_performer_->Write(buffer.data(), size, &error)) {
+      LOG(ERROR) << "Error " << utils::ErrorCodeToString(error) << " ("
+                 << error << ") in DeltaPerformer's Write method when "
+                 << "processing the staged payload";
+      apply_error_ = error == ErrorCode::kSuccess
+                         ? ErrorCode::kDownloadWriteError
+                         : error;
+      break;
+    }
+  }
+  // Fails the pending and next Append() calls of the download.
+  if (apply_error_ != ErrorCode::kSuccess)
+    staging_ring_->Close();
+  apply_done_ = true;
+}
+
+void DownloadAction::StopStaging() {
+  if (staging_wait_task_ != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(staging_wait_task_);
+    staging_wait_task_ = MessageLoop::kTaskIdNull;
+  }
+  apply_progress_sampler_.reset();
+  if (!staging_ring_)
+    return;
+  staging_ring_->Close();
+  if (apply_thread_.joinable())
+    apply_thread_.join();
+  staging_ring_.reset();
+}
+
+void DownloadAction::WaitForStagedBytes(bool successful) {
+  staging_wait_task_ = MessageLoop::kTaskIdNull;
+  if (!apply_done_) {
+    staging_wait_task_ = MessageLoop::current()->PostDelayedTask(
+        FROM_HERE,
+        base::Bind(&DownloadAction::WaitForStagedBytes,
+                   base::Unretained(this),
+                   successful),
+        base::TimeDelta::FromMilliseconds(kStagingWaitIntervalMs));
+    return;
+  }
+  ErrorCode code = apply_error_;
+  StopStaging();
+  if (code == ErrorCode::kSuccess && !successful)
+    code = ErrorCode::kDownloadTransferError;
+  FinishTransfer(code);
+}
+
+void DownloadAction::ReportApplyProgress(double fraction) {
+  if (!delegate_ || !download_active_ || bytes_total_ == 0)
+    return;
+  const double applied =
+      bytes_received_previous_payloads_ + fraction * payload_->size;
+  delegate_->ApplyProgress(std::min(1.0, applied / bytes_total_));
+}
+
 void DownloadAction::SuspendAction() {
   http_fetcher_->Pause();
+  if (staging_ring_)
+    staging_ring_->Pause();
 }
 
 void DownloadAction::ResumeAction() {
   http_fetcher_->Unpause();
+  if (staging_ring_)
+    staging_ring_->Unpause();
 }
 
 void DownloadAction::TerminateProcessing() {
+  StopStaging();
+  sparse_ranges_.clear();
+  if (sparse_transfer_task_ != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(sparse_transfer_task_);
+    sparse_transfer_task_ = MessageLoop::kTaskIdNull;
+  }
   if (delta_performer_) {
     delta_performer_->Close();
     delta_performer_.reset();
@@ -215,6 +368,7 @@ void DownloadAction::SeekToOffset(off_t offset) {
 bool DownloadAction::ReceivedBytes(HttpFetcher* fetcher,
                                    const void* bytes,
                                    size_t length) {
+  UE_TRACE_SCOPE("DownloadAction::ReceivedBytes");
   bytes_received_ += length;
   uint64_t bytes_downloaded_total =
       bytes_received_previous_payloads_ + bytes_received_;
@@ -222,7 +376,24 @@ bool DownloadAction::ReceivedBytes(HttpFetcher* fetcher,
     delegate_->BytesReceived(
         length, bytes_downloaded_total - base_offset_, bytes_total_);
   }
-  if (delta_performer_ && !delta_performer_->Write(bytes, length, &code_)) {
+  bool written = true;
+  if (staging_ring_) {
+    // The apply thread closes the ring when it fails.
+    written = staging_ring_->Append(bytes, length);
+    UE_TRACE_COUNTER("DownloadAction staged bytes", staging_ring_->used());
+    if (!written)
+      code_ = apply_error_;
+  } else if (delta_performer_) {
+    written = delta_performer_->Write(bytes, length, &code_);
+    if (written &&
+        delta_performer_->TakeSparseDownloadRanges(&sparse_ranges_)) {
+      // The rest of the payload is downloaded again, sparsely, once this
+      // transfer is terminated.
+      http_fetcher_->TerminateTransfer();
+      return false;
+    }
+  }
+  if (!written) {
     if (code_ != ErrorCode::kSuccess) {
       LOG(ERROR) << "Error " << utils::ErrorCodeToString(code_) << " (" << code_
                  << ") in DeltaPerformer's Write method when "
@@ -243,13 +414,23 @@ bool DownloadAction::ReceivedBytes(HttpFetcher* fetcher,
 }
 
 void DownloadAction::TransferComplete(HttpFetcher* fetcher, bool successful) {
+  if (staging_ring_) {
+    // The bytes staged are applied before closing the writer, even if the
+    // transfer failed, so that a resume starts from the last of them.
+    staging_ring_->Finish();
+    WaitForStagedBytes(successful);
+    return;
+  }
+  FinishTransfer(successful ? ErrorCode::kSuccess
+                            : ErrorCode::kDownloadTransferError);
+}
+
+void DownloadAction::FinishTransfer(ErrorCode code) {
   if (delta_performer_) {
     LOG_IF(WARNING, delta_performer_->Close() != 0)
         << "Error closing the writer.";
   }
   download_active_ = false;
-  ErrorCode code =
-      successful ? ErrorCode::kSuccess : ErrorCode::kDownloadTransferError;
   if (code == ErrorCode::kSuccess) {
     if (delta_performer_ && !payload_->already_applied)
       code = delta_performer_->VerifyPayload(payload_->hash, payload_->size);
@@ -271,15 +452,36 @@ void DownloadAction::TransferComplete(HttpFetcher* fetcher, bool successful) {
     }
   }
 
+  // The manifest, the buffers and the decoders aren't needed anymore, don't
+  // keep them through the next actions.
+  delta_performer_.reset();
+
   // Write the path to the output pipe if we're successful.
   if (code == ErrorCode::kSuccess && HasOutputPipe())
     SetOutputObject(install_plan_);
   processor_->ActionComplete(this, code);
 }
 
+void DownloadAction::StartSparseTransfer() {
+  sparse_transfer_task_ = MessageLoop::kTaskIdNull;
+  LOG(INFO) << "Downloading the " << sparse_ranges_.size()
+            << " ranges of the payload still needed.";
+  http_fetcher_->ClearRanges();
+  for (const auto& [offset, length] : sparse_ranges_) {
+    http_fetcher_->AddRange(base_offset_ + offset, length);
+  }
+  sparse_ranges_.clear();
+  http_fetcher_->BeginTransfer(install_plan_.download_url);
+}
+
 void DownloadAction::TransferTerminated(HttpFetcher* fetcher) {
   if (code_ != ErrorCode::kSuccess) {
     processor_->ActionComplete(this, code_);
+  } else if (!sparse_ranges_.empty()) {
+    sparse_transfer_task_ = MessageLoop::current()->PostTask(
+        FROM_HERE,
+        base::Bind(&DownloadAction::StartSparseTransfer,
+                   base::Unretained(this)));
   } else if (payload_->already_applied) {
     LOG(INFO) << "TransferTerminated with ErrorCode::kSuccess when the current "
                  "payload has already applied, treating as TransferComplete.";
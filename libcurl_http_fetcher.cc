@@ -22,6 +22,8 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <initializer_list>
+#include <set>
 #include <string>
 
 #include <base/bind.h>
@@ -41,6 +43,7 @@
 #include "update_engine/certificate_checker.h"
 #include "update_engine/common/hardware_interface.h"
 #include "update_engine/common/platform_constants.h"
+#include "update_engine/common/tracing.h"
 #include "update_engine/common/utils.h"
 
 using base::TimeDelta;
@@ -57,23 +60,63 @@ namespace {
 
 const int kNoNetworkRetrySeconds = 10;
 
-// libcurl's CURLOPT_SOCKOPTFUNCTION callback function. Called after the socket
-// is created but before it is connected. This callback tags the created socket
-// so the network usage can be tracked in Android.
-int LibcurlSockoptCallback(void* /* clientp */,
-                           curl_socket_t curlfd,
-                           curlsocktype /* purpose */) {
+CURLSH* NewSharedCurlHandle(std::initializer_list<curl_lock_data> shared) {
+  CURLSH* handle = curl_share_init();
+  CHECK(handle);
+  for (curl_lock_data data : shared) {
+    CHECK_EQ(curl_share_setopt(handle, CURLSHOPT_SHARE, data), CURLSHE_OK);
+  }
+  return handle;
+}
+
+// Returns the handle sharing the connection cache, the TLS sessions and the
+// DNS cache between the fetchers reusing connections. They all run on the same
+// thread, so no lock is needed. It is never freed since the cached connections
+// may outlive every fetcher.
+CURLSH* GetSharedCurlHandle() {
+  static CURLSH* share = NewSharedCurlHandle({CURL_LOCK_DATA_CONNECT,
+                                              CURL_LOCK_DATA_SSL_SESSION,
+                                              CURL_LOCK_DATA_DNS});
+  return share;
+}
+
+// Returns the handle sharing only the TLS sessions between the other
+// fetchers, so that their transfers resume the session of a previous one
+// instead of doing a full handshake, whatever network they go over.
+CURLSH* GetSharedSslSessionHandle() {
+  static CURLSH* share = NewSharedCurlHandle({CURL_LOCK_DATA_SSL_SESSION});
+  return share;
+}
+
+// The fetchers alive. A cached connection may be closed by another fetcher
+// than the one which opened it, possibly destroyed since, so the sockets of
+// shared connections are looked up in all of them.
+std::set<LibcurlHttpFetcher*>& LiveFetchers() {
+  static auto* fetchers = new std::set<LibcurlHttpFetcher*>();
+  return *fetchers;
+}
+
+}  // namespace
+
+// static
+int LibcurlHttpFetcher::LibcurlSockoptCallback(void* clientp,
+                                               curl_socket_t curlfd,
+                                               curlsocktype /* purpose */) {
 #ifdef __ANDROID__
   // Socket tag used by all network sockets. See qtaguid kernel module for
   // stats.
   const int kUpdateEngineSocketTag = 0x55417243;  // "CrAU" in little-endian.
   qtaguid_tagSocket(curlfd, kUpdateEngineSocketTag, AID_OTA_UPDATE);
 #endif  // __ANDROID__
+  LibcurlHttpFetcher* fetcher = static_cast<LibcurlHttpFetcher*>(clientp);
+  if (fetcher && fetcher->network_selector_ &&
+      !fetcher->network_selector_->BindSocket(fetcher->network_id_, curlfd)) {
+    // Rather than going over a network the client didn't pick.
+    return CURL_SOCKOPT_ERROR;
+  }
   return CURL_SOCKOPT_OK;
 }
 
-}  // namespace
-
 // static
 int LibcurlHttpFetcher::LibcurlCloseSocketCallback(void* clientp,
                                                    curl_socket_t item) {
@@ -81,10 +124,15 @@ int LibcurlHttpFetcher::LibcurlCloseSocketCallback(void* clientp,
   qtaguid_untagSocket(item);
 #endif  // __ANDROID__
 
-  LibcurlHttpFetcher* fetcher = static_cast<LibcurlHttpFetcher*>(clientp);
-  // Stop watching the socket before closing it.
-  for (size_t t = 0; t < base::size(fetcher->fd_controller_maps_); ++t) {
-    fetcher->fd_controller_maps_[t].erase(item);
+  // Stop watching the socket before closing it. |clientp| is null for the
+  // shared connections.
+  LibcurlHttpFetcher* owner = static_cast<LibcurlHttpFetcher*>(clientp);
+  for (LibcurlHttpFetcher* fetcher : LiveFetchers()) {
+    if (owner && fetcher != owner)
+      continue;
+    for (size_t t = 0; t < base::size(fetcher->fd_controller_maps_); ++t) {
+      fetcher->fd_controller_maps_[t].erase(item);
+    }
   }
 
   // Documentation for this callback says to return 0 on success or 1 on error.
@@ -101,12 +149,20 @@ LibcurlHttpFetcher::LibcurlHttpFetcher(HardwareInterface* hardware)
     low_speed_time_seconds_ = kDownloadDevModeLowSpeedTimeSeconds;
   if (hardware_->IsOOBEEnabled() && !hardware_->IsOOBEComplete(nullptr))
     max_retry_count_ = kDownloadMaxRetryCountOobeNotComplete;
+  LiveFetchers().insert(this);
 }
 
 LibcurlHttpFetcher::~LibcurlHttpFetcher() {
   LOG_IF(ERROR, transfer_in_progress_)
       << "Destroying the fetcher while a transfer is in progress.";
   CleanUp();
+  LiveFetchers().erase(this);
+  if (connection_stats_.transfers > 0) {
+    LOG(INFO) << connection_stats_.transfers << " transfers opened "
+              << connection_stats_.new_connections << " connections, spent "
+              << connection_stats_.handshake_time.InMilliseconds()
+              << " ms connecting.";
+  }
 }
 
 bool LibcurlHttpFetcher::GetProxyType(const string& proxy,
@@ -152,9 +208,20 @@ void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
   // Tag and untag the socket for network usage stats.
   curl_easy_setopt(
       curl_handle_, CURLOPT_SOCKOPTFUNCTION, LibcurlSockoptCallback);
+  curl_easy_setopt(curl_handle_, CURLOPT_SOCKOPTDATA, this);
   curl_easy_setopt(
       curl_handle_, CURLOPT_CLOSESOCKETFUNCTION, LibcurlCloseSocketCallback);
-  curl_easy_setopt(curl_handle_, CURLOPT_CLOSESOCKETDATA, this);
+  // The shared cache would hand the connections to fetchers bound to other
+  // networks.
+  const bool share_connections = reuse_connections_ && !network_selector_;
+  curl_easy_setopt(curl_handle_,
+                   CURLOPT_CLOSESOCKETDATA,
+                   share_connections ? nullptr : this);
+  CHECK_EQ(curl_easy_setopt(curl_handle_,
+                            CURLOPT_SHARE,
+                            share_connections ? GetSharedCurlHandle()
+                                              : GetSharedSslSessionHandle()),
+           CURLE_OK);
 
   CHECK(HasProxy());
   bool is_direct = (GetCurrentProxy() == kNoProxy);
@@ -234,6 +301,13 @@ void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
   CHECK_EQ(
       curl_easy_setopt(curl_handle_, CURLOPT_WRITEFUNCTION, StaticLibcurlWrite),
       CURLE_OK);
+  if (receive_buffer_size_ > 0) {
+    // Larger writes from libcurl, up to what it supports.
+    const long buffer_size =  // NOLINT(runtime/int) - curl needs long.
+        std::min<size_t>(receive_buffer_size_, CURL_MAX_READ_SIZE);
+    CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_BUFFERSIZE, buffer_size),
+             CURLE_OK);
+  }
   CHECK_EQ(curl_easy_setopt(curl_handle_, CURLOPT_URL, url_.c_str()), CURLE_OK);
 
   // If the connection drops under |low_speed_limit_bps_| (10
@@ -256,6 +330,13 @@ void LibcurlHttpFetcher::ResumeTransfer(const string& url) {
       curl_easy_setopt(curl_handle_, CURLOPT_MAXREDIRS, kDownloadMaxRedirects),
       CURLE_OK);
 
+  if (http2_ &&
+      curl_easy_setopt(
+          curl_handle_, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS) !=
+          CURLE_OK) {
+    LOG(WARNING) << "libcurl doesn't support HTTP/2, using HTTP/1.1.";
+  }
+
   // Lock down the appropriate curl options for HTTP or HTTPS depending on
   // the url.
   if (hardware_->IsOfficialBuild()) {
@@ -470,6 +551,13 @@ void LibcurlHttpFetcher::CurlPerformOnce() {
   // At this point, the transfer was completed in some way (error, connection
   // closed or download finished).
 
+  // The aggregated bytes are delivered before the end of the transfer.
+  FlushReceiveBuffer();
+  if (terminate_requested_) {
+    ForceTransferTermination();
+    return;
+  }
+
   GetHttpResponseCode();
   if (http_response_code_) {
     LOG(INFO) << "HTTP response code: " << http_response_code_;
@@ -584,6 +672,7 @@ void LibcurlHttpFetcher::CurlPerformOnce() {
 }
 
 size_t LibcurlHttpFetcher::LibcurlWrite(void* ptr, size_t size, size_t nmemb) {
+  UE_TRACE_SCOPE("LibcurlHttpFetcher::LibcurlWrite");
   // Update HTTP response first.
   GetHttpResponseCode();
   const size_t payload_size = size * nmemb;
@@ -608,21 +697,79 @@ size_t LibcurlHttpFetcher::LibcurlWrite(void* ptr, size_t size, size_t nmemb) {
     }
   }
   bytes_downloaded_ += payload_size;
-  if (delegate_) {
-    in_write_callback_ = true;
-    auto should_terminate = !delegate_->ReceivedBytes(this, ptr, payload_size);
-    in_write_callback_ = false;
-    if (should_terminate) {
-      LOG(INFO) << "Requesting libcurl to terminate transfer.";
-      // Returning an amount that differs from the received size signals an
-      // error condition to libcurl, which will cause the transfer to be
-      // aborted.
-      return 0;
+  UE_TRACE_COUNTER("LibcurlHttpFetcher bytes downloaded", bytes_downloaded_);
+  if (!delegate_) {
+    return payload_size;
+  }
+  bool should_terminate = false;
+  if (receive_buffer_size_ == 0 ||
+      (receive_buffer_.empty() && payload_size >= receive_buffer_size_)) {
+    should_terminate = !DeliverBytes(ptr, payload_size);
+  } else {
+    if (receive_buffer_.capacity() < receive_buffer_size_) {
+      receive_buffer_.reserve(receive_buffer_size_);
+    }
+    const uint8_t* data = static_cast<const uint8_t*>(ptr);
+    receive_buffer_.insert(receive_buffer_.end(), data, data + payload_size);
+    UE_TRACE_COUNTER("LibcurlHttpFetcher receive buffer bytes",
+                     receive_buffer_.size());
+    if (receive_buffer_.size() >= receive_buffer_size_) {
+      should_terminate = !FlushReceiveBuffer();
+    } else if (receive_flush_task_id_ == MessageLoop::kTaskIdNull) {
+      receive_flush_task_id_ = MessageLoop::current()->PostDelayedTask(
+          FROM_HERE,
+          base::Bind(&LibcurlHttpFetcher::ReceiveFlushTimeoutCallback,
+                     base::Unretained(this)),
+          TimeDelta::FromMilliseconds(kReceiveFlushTimeoutMs));
     }
   }
+  if (should_terminate) {
+    LOG(INFO) << "Requesting libcurl to terminate transfer.";
+    // Returning an amount that differs from the received size signals an
+    // error condition to libcurl, which will cause the transfer to be
+    // aborted.
+    return 0;
+  }
   return payload_size;
 }
 
+bool LibcurlHttpFetcher::DeliverBytes(const void* bytes, size_t length) {
+  const bool was_in_write_callback = in_write_callback_;
+  in_write_callback_ = true;
+  const bool keep_going = delegate_->ReceivedBytes(this, bytes, length);
+  in_write_callback_ = was_in_write_callback;
+  return keep_going;
+}
+
+bool LibcurlHttpFetcher::FlushReceiveBuffer() {
+  MessageLoop::current()->CancelTask(receive_flush_task_id_);
+  receive_flush_task_id_ = MessageLoop::kTaskIdNull;
+  if (receive_buffer_.empty() || !delegate_) {
+    receive_buffer_.clear();
+    return true;
+  }
+  const bool keep_going =
+      DeliverBytes(receive_buffer_.data(), receive_buffer_.size());
+  // Keeps the capacity for the next bytes.
+  receive_buffer_.clear();
+  UE_TRACE_COUNTER("LibcurlHttpFetcher receive buffer bytes", 0);
+  return keep_going;
+}
+
+void LibcurlHttpFetcher::ReceiveFlushTimeoutCallback() {
+  receive_flush_task_id_ = MessageLoop::kTaskIdNull;
+  if (transfer_paused_) {
+    // Unpause() flushes the bytes.
+    return;
+  }
+  // The delegate requests the termination when returning false.
+  FlushReceiveBuffer();
+  if (terminate_requested_) {
+    // Note that after the callback returns this object may be destroyed.
+    ForceTransferTermination();
+  }
+}
+
 void LibcurlHttpFetcher::Pause() {
   if (transfer_paused_) {
     LOG(ERROR) << "Fetcher already paused.";
@@ -644,6 +791,13 @@ void LibcurlHttpFetcher::Unpause() {
     return;
   }
   transfer_paused_ = false;
+  if (!receive_buffer_.empty() &&
+      receive_flush_task_id_ == MessageLoop::kTaskIdNull) {
+    receive_flush_task_id_ = MessageLoop::current()->PostTask(
+        FROM_HERE,
+        base::Bind(&LibcurlHttpFetcher::ReceiveFlushTimeoutCallback,
+                   base::Unretained(this)));
+  }
   if (restart_transfer_on_unpause_) {
     restart_transfer_on_unpause_ = false;
     ResumeTransfer(url_);
@@ -782,6 +936,10 @@ void LibcurlHttpFetcher::CleanUp() {
   MessageLoop::current()->CancelTask(timeout_id_);
   timeout_id_ = MessageLoop::kTaskIdNull;
 
+  MessageLoop::current()->CancelTask(receive_flush_task_id_);
+  receive_flush_task_id_ = MessageLoop::kTaskIdNull;
+  receive_buffer_.clear();
+
   for (size_t t = 0; t < base::size(fd_controller_maps_); ++t) {
     fd_controller_maps_[t].clear();
   }
@@ -791,6 +949,8 @@ void LibcurlHttpFetcher::CleanUp() {
     curl_http_headers_ = nullptr;
   }
   if (curl_handle_) {
+    if (transfer_in_progress_)
+      RecordConnectionStats();
     if (curl_multi_handle_) {
       CHECK_EQ(curl_multi_remove_handle(curl_multi_handle_, curl_handle_),
                CURLM_OK);
@@ -807,6 +967,34 @@ void LibcurlHttpFetcher::CleanUp() {
   restart_transfer_on_unpause_ = false;
 }
 
+void LibcurlHttpFetcher::RecordConnectionStats() {
+  long connects = 0;  // NOLINT(runtime/int) - curl needs long.
+  curl_off_t connect_us = 0;
+  curl_off_t app_connect_us = 0;
+  if (curl_easy_getinfo(curl_handle_, CURLINFO_NUM_CONNECTS, &connects) !=
+          CURLE_OK ||
+      curl_easy_getinfo(curl_handle_, CURLINFO_CONNECT_TIME_T, &connect_us) !=
+          CURLE_OK ||
+      curl_easy_getinfo(
+          curl_handle_, CURLINFO_APPCONNECT_TIME_T, &app_connect_us) !=
+          CURLE_OK) {
+    LOG(WARNING) << "Unable to get the connection info from curl_easy_getinfo";
+    return;
+  }
+  connection_stats_.transfers++;
+  if (connects == 0) {
+    LOG(INFO) << "The transfer reused an existing connection.";
+    return;
+  }
+  // The TLS handshake completes after the TCP one, if any.
+  const TimeDelta handshake_time =
+      TimeDelta::FromMicroseconds(std::max(connect_us, app_connect_us));
+  connection_stats_.new_connections += connects;
+  connection_stats_.handshake_time += handshake_time;
+  LOG(INFO) << "The transfer opened " << connects << " connections in "
+            << handshake_time.InMilliseconds() << " ms.";
+}
+
 void LibcurlHttpFetcher::GetHttpResponseCode() {
   long http_response_code = 0;  // NOLINT(runtime/int) - curl needs long.
   if (base::StartsWith(url_, "file://", base::CompareCase::INSENSITIVE_ASCII)) {
@@ -27,11 +27,14 @@
 #include <base/files/file_descriptor_watcher_posix.h>
 #include <base/logging.h>
 #include <base/macros.h>
+#include <base/time/time.h>
 #include <brillo/message_loops/message_loop.h>
+#include <brillo/secure_blob.h>
 
 #include "update_engine/certificate_checker.h"
 #include "update_engine/common/hardware_interface.h"
 #include "update_engine/common/http_fetcher.h"
+#include "update_engine/common/network_selector_interface.h"
 
 // This is a concrete implementation of HttpFetcher that uses libcurl to do the
 // http work.
@@ -82,6 +85,10 @@ class UnresolvedHostStateMachine {
 
 class LibcurlHttpFetcher : public HttpFetcher {
  public:
+  // Longest time received bytes wait to be aggregated with the next ones, see
+  // set_receive_buffer_size().
+  static constexpr int kReceiveFlushTimeoutMs = 100;
+
   explicit LibcurlHttpFetcher(HardwareInterface* hardware);
 
   // Cleans up all internal state. Does not notify delegate
@@ -157,9 +164,57 @@ class LibcurlHttpFetcher : public HttpFetcher {
     is_update_check_ = is_update_check;
   }
 
+  // Keeps the connections, TLS sessions and DNS entries in a cache shared by
+  // all the fetchers doing so, so that the following transfers, e.g. of the
+  // next range or from another fetcher, skip the TCP and TLS handshakes. All
+  // these fetchers must be used from the same thread. The other fetchers
+  // still share the TLS sessions, and only skip the full TLS handshakes.
+  void set_reuse_connections(bool reuse_connections) {
+    reuse_connections_ = reuse_connections;
+  }
+
+  // Negotiates HTTP/2 for HTTPS transfers, falling back to HTTP/1.1 if the
+  // server or libcurl doesn't support it.
+  void set_http2(bool http2) { http2_ = http2; }
+
+  // Binds the sockets of the transfers to |network_id| with |selector|, so
+  // that fetchers of the same process download over different networks. The
+  // connections are then not shared with set_reuse_connections(), whose cache
+  // doesn't know about the networks.
+  void set_network(NetworkSelectorInterface* selector, NetworkId network_id) {
+    network_selector_ = selector;
+    network_id_ = network_id;
+  }
+
+  // Aggregates the received bytes into chunks of |size| bytes before passing
+  // them to the delegate, which amortizes the cost of its ReceivedBytes() over
+  // many libcurl writes. libcurl is asked for writes of up to |size| bytes too.
+  // Bytes waiting for more are still delivered kReceiveFlushTimeoutMs after
+  // the first one arrived, and when the transfer ends. Zero, the default,
+  // passes every libcurl write through.
+  void set_receive_buffer_size(size_t size) { receive_buffer_size_ = size; }
+
+  struct ConnectionStats {
+    // Transfers started, including the retries.
+    int transfers{0};
+    // Connections opened by these transfers; the others reused one.
+    int new_connections{0};
+    // Time spent connecting, including the TLS handshakes.
+    base::TimeDelta handshake_time;
+  };
+  const ConnectionStats& connection_stats() const { return connection_stats_; }
+
  private:
   FRIEND_TEST(LibcurlHttpFetcherTest, HostResolvedTest);
 
+  // libcurl's CURLOPT_SOCKOPTFUNCTION callback function. Called after the
+  // socket is created but before it is connected, with the fetcher as
+  // |clientp|. Tags the socket so the network usage can be tracked in
+  // Android, and binds it to the network of the fetcher, if any.
+  static int LibcurlSockoptCallback(void* clientp,
+                                    curl_socket_t curlfd,
+                                    curlsocktype purpose);
+
   // libcurl's CURLOPT_CLOSESOCKETFUNCTION callback function. Called when
   // closing a socket created with the CURLOPT_OPENSOCKETFUNCTION callback.
   static int LibcurlCloseSocketCallback(void* clientp, curl_socket_t item);
@@ -167,6 +222,9 @@ class LibcurlHttpFetcher : public HttpFetcher {
   // Asks libcurl for the http response code and stores it in the object.
   virtual void GetHttpResponseCode();
 
+  // Adds the connection info of the current transfer to |connection_stats_|.
+  void RecordConnectionStats();
+
   // Returns the last |CURLcode|.
   CURLcode GetCurlCode();
 
@@ -204,6 +262,15 @@ class LibcurlHttpFetcher : public HttpFetcher {
 
   // Callback called by libcurl when new data has arrived on the transfer
   size_t LibcurlWrite(void* ptr, size_t size, size_t nmemb);
+
+  // Passes |length| bytes to the delegate, as from the write callback. Returns
+  // false if the transfer must stop.
+  bool DeliverBytes(const void* bytes, size_t length);
+
+  // Delivers the bytes aggregated in |receive_buffer_|, if any. Returns false
+  // if the transfer must stop.
+  bool FlushReceiveBuffer();
+  void ReceiveFlushTimeoutCallback();
   static size_t StaticLibcurlWrite(void* ptr,
                                    size_t size,
                                    size_t nmemb,
@@ -324,6 +391,21 @@ class LibcurlHttpFetcher : public HttpFetcher {
   // Internal state machine.
   UnresolvedHostStateMachine unresolved_host_state_machine_;
 
+  // Bytes received but not passed to the delegate yet, see
+  // set_receive_buffer_size().
+  size_t receive_buffer_size_{0};
+  brillo::Blob receive_buffer_;
+  brillo::MessageLoop::TaskId receive_flush_task_id_{
+      brillo::MessageLoop::kTaskIdNull};
+
+  bool reuse_connections_{false};
+  bool http2_{false};
+  ConnectionStats connection_stats_;
+
+  // Set by set_network().
+  NetworkSelectorInterface* network_selector_{nullptr};
+  NetworkId network_id_{0};
+
   int low_speed_limit_bps_{kDownloadLowSpeedLimitBps};
   int low_speed_time_seconds_{kDownloadLowSpeedTimeSeconds};
   int connect_timeout_seconds_{kDownloadConnectTimeoutSeconds};
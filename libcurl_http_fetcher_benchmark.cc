@@ -0,0 +1,255 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Downloads from a local test_http_server with LibcurlHttpFetcher, with and
+// without aggregation of the received bytes, and reports the number of
+// ReceivedBytes() calls each download costs the delegate. Also downloads
+// through the emulated network links of the server, to measure the throughput
+// and the cost of resuming dropped connections.
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/logging.h>
+#if BASE_VER < 780000  // Android
+#include <base/message_loop/message_loop.h>
+#endif  // BASE_VER < 780000
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/stringprintf.h>
+#if BASE_VER >= 780000  // CrOS
+#include <base/task/single_thread_task_executor.h>
+#endif  // BASE_VER >= 780000
+#include <benchmark/benchmark.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <brillo/message_loops/message_loop.h>
+#ifdef __CHROMEOS__
+#include <brillo/process/process.h>
+#else
+#include <brillo/process.h>
+#endif  // __CHROMEOS__
+#include <brillo/streams/file_stream.h>
+
+#include "update_engine/common/fake_hardware.h"
+#include "update_engine/libcurl_http_fetcher.h"
+
+using brillo::MessageLoop;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr size_t kDownloadSize = 32 * 1024 * 1024;
+constexpr size_t kShapedDownloadSize = 8 * 1024 * 1024;
+constexpr char kListeningMsgPrefix[] = "listening on port ";
+
+// Runs the test_http_server found next to this binary.
+class TestHttpServer {
+ public:
+  TestHttpServer() {
+    base::FilePath exe_path;
+    base::ReadSymbolicLink(base::FilePath("/proc/self/exe"), &exe_path);
+    process_.AddArg(exe_path.DirName().Append("test_http_server").value());
+    process_.RedirectUsingPipe(STDOUT_FILENO, false);
+    if (!process_.Start()) {
+      LOG(ERROR) << "Failed to start test_http_server.";
+      return;
+    }
+    brillo::StreamPtr stdout = brillo::FileStream::FromFileDescriptor(
+        process_.GetPipe(STDOUT_FILENO), false /* own */, nullptr);
+    std::string line;
+    std::vector<char> buf(128);
+    while (stdout && line.find('\n') == std::string::npos) {
+      size_t read = 0;
+      if (!stdout->ReadBlocking(buf.data(), buf.size(), &read, nullptr) ||
+          read == 0) {
+        break;
+      }
+      line.append(buf.data(), read);
+    }
+    const size_t prefix_len = strlen(kListeningMsgPrefix);
+    if (line.compare(0, prefix_len, kListeningMsgPrefix) != 0 ||
+        line.find('\n') == std::string::npos) {
+      LOG(ERROR) << "Unexpected test_http_server output: " << line;
+      return;
+    }
+    std::string port = line.substr(prefix_len);
+    port.resize(port.find('\n'));
+    started_ = base::StringToUint(port, &port_);
+  }
+
+  ~TestHttpServer() {
+    if (started_)
+      process_.Kill(SIGTERM, 10);
+  }
+
+  bool started() const { return started_; }
+
+  std::string DownloadUrl(size_t size) const {
+    return base::StringPrintf("http://127.0.0.1:%u/download/%zu", port_, size);
+  }
+
+  std::string ShapedUrl(size_t size,
+                        size_t bytes_per_second,
+                        int rtt_ms,
+                        size_t drop_offset) const {
+    return base::StringPrintf("http://127.0.0.1:%u/shaped/%zu/%zu/%d/%zu",
+                              port_,
+                              size,
+                              bytes_per_second,
+                              rtt_ms,
+                              drop_offset);
+  }
+
+ private:
+  brillo::ProcessImpl process_;
+  unsigned int port_{0};
+  bool started_{false};
+};
+
+class CountingDelegate : public HttpFetcherDelegate {
+ public:
+  bool ReceivedBytes(HttpFetcher* fetcher,
+                     const void* bytes,
+                     size_t length) override {
+    calls_++;
+    bytes_ += length;
+    benchmark::DoNotOptimize(bytes);
+    return true;
+  }
+
+  void TransferComplete(HttpFetcher* fetcher, bool successful) override {
+    successful_ = successful;
+    MessageLoop::current()->BreakLoop();
+  }
+
+  void TransferTerminated(HttpFetcher* fetcher) override {
+    MessageLoop::current()->BreakLoop();
+  }
+
+  size_t calls_{0};
+  size_t bytes_{0};
+  bool successful_{false};
+};
+
+TestHttpServer* GetServer() {
+  static TestHttpServer* server = new TestHttpServer();
+  return server;
+}
+
+void BM_LibcurlDownload(benchmark::State& state) {
+  TestHttpServer* server = GetServer();
+  if (!server->started()) {
+    state.SkipWithError("test_http_server is not running");
+    return;
+  }
+#if BASE_VER < 780000  // Android
+  base::MessageLoopForIO base_loop;
+  brillo::BaseMessageLoop loop(&base_loop);
+#else   // Chrome OS
+  base::SingleThreadTaskExecutor base_loop{base::MessagePumpType::IO};
+  brillo::BaseMessageLoop loop(base_loop.task_runner());
+#endif  // BASE_VER < 780000
+  loop.SetAsCurrent();
+  FakeHardware hardware;
+  hardware.SetIsOfficialBuild(false);
+
+  const std::string url = server->DownloadUrl(kDownloadSize);
+  size_t calls = 0;
+  for (auto _ : state) {
+    LibcurlHttpFetcher fetcher(&hardware);
+    fetcher.set_receive_buffer_size(state.range(0));
+    CountingDelegate delegate;
+    fetcher.set_delegate(&delegate);
+    fetcher.BeginTransfer(url);
+    loop.Run();
+    if (!delegate.successful_ || delegate.bytes_ != kDownloadSize) {
+      state.SkipWithError("The download failed");
+      return;
+    }
+    calls += delegate.calls_;
+  }
+  state.SetBytesProcessed(state.iterations() * kDownloadSize);
+  state.counters["calls"] =
+      benchmark::Counter(calls, benchmark::Counter::kAvgIterations);
+}
+
+// Downloads at state.range(0) KiB/s at most with a round-trip time of
+// state.range(1) ms, the connection dropping halfway if state.range(2) is set.
+void BM_LibcurlShapedDownload(benchmark::State& state) {
+  TestHttpServer* server = GetServer();
+  if (!server->started()) {
+    state.SkipWithError("test_http_server is not running");
+    return;
+  }
+#if BASE_VER < 780000  // Android
+  base::MessageLoopForIO base_loop;
+  brillo::BaseMessageLoop loop(&base_loop);
+#else   // Chrome OS
+  base::SingleThreadTaskExecutor base_loop{base::MessagePumpType::IO};
+  brillo::BaseMessageLoop loop(base_loop.task_runner());
+#endif  // BASE_VER < 780000
+  loop.SetAsCurrent();
+  FakeHardware hardware;
+  hardware.SetIsOfficialBuild(false);
+
+  const std::string url =
+      server->ShapedUrl(kShapedDownloadSize,
+                        state.range(0) * 1024,
+                        state.range(1),
+                        state.range(2) ? kShapedDownloadSize / 2 : 0);
+  for (auto _ : state) {
+    LibcurlHttpFetcher fetcher(&hardware);
+    // Resume right away, the retry delay would dominate the measurement.
+    fetcher.set_retry_seconds(0);
+    CountingDelegate delegate;
+    fetcher.set_delegate(&delegate);
+    fetcher.BeginTransfer(url);
+    loop.Run();
+    if (!delegate.successful_ || delegate.bytes_ != kShapedDownloadSize) {
+      state.SkipWithError("The download failed");
+      return;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * kShapedDownloadSize);
+}
+
+}  // namespace
+
+BENCHMARK(BM_LibcurlShapedDownload)
+    ->Args({16 * 1024, 0, 0})
+    ->Args({16 * 1024, 100, 0})
+    ->Args({16 * 1024, 100, 1})
+    ->Args({4 * 1024, 300, 1})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_LibcurlDownload)
+    ->Arg(0)
+    ->Arg(256 * 1024)
+    ->Arg(1024 * 1024)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace chromeos_update_engine
+
+BENCHMARK_MAIN();
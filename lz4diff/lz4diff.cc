@@ -17,6 +17,12 @@
 #include "lz4diff.h"
 #include "lz4diff_compress.h"
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
 #include <bsdiff/bsdiff.h>
 #include <bsdiff/constants.h>
 #include <bsdiff/patch_writer_factory.h>
@@ -35,50 +41,88 @@
 
 namespace chromeos_update_engine {
 
+// Sets |output| to the BSDIFF patch from the recompressed block |s1| to the
+// target block |s2|, or to an empty string if they are the same.
+bool PostfixBspatch(std::string_view s1,
+                    std::string_view s2,
+                    std::string* output) {
+  output->clear();
+  if (s1 == s2) {
+    return true;
+  }
+  ScopedTempFile patch;
+  int err = bsdiff::bsdiff(reinterpret_cast<const unsigned char*>(s1.data()),
+                           s1.size(),
+                           reinterpret_cast<const unsigned char*>(s2.data()),
+                           s2.size(),
+                           patch.path().c_str(),
+                           nullptr);
+  CHECK_EQ(err, 0);
+  LOG(WARNING) << "Recompress Postfix patch size: "
+               << utils::FileSize(patch.path());
+  TEST_AND_RETURN_FALSE(utils::ReadFile(patch.path(), output));
+  return true;
+}
+
 bool StoreDstCompressedFileInfo(std::string_view recompressed_blob,
                                 std::string_view target_blob,
                                 const CompressedFile& dst_file_info,
+                                size_t num_tasks,
+                                const RunTasksFunc& run_tasks,
                                 Lz4diffHeader* output) {
   *output->mutable_dst_info()->mutable_algo() = dst_file_info.algo;
   output->mutable_dst_info()->set_zero_padding_enabled(
       dst_file_info.zero_padding_enabled);
   const auto& block_info = dst_file_info.blocks;
-  auto& dst_block_info = *output->mutable_dst_info()->mutable_block_info();
-  dst_block_info.Clear();
+  std::vector<size_t> offsets;
+  offsets.reserve(block_info.size());
   size_t offset = 0;
   for (const auto& block : block_info) {
+    CHECK_LT(offset, recompressed_blob.size());
+    offsets.push_back(offset);
+    offset += block.compressed_length;
+  }
+
+  // The blocks are independent, so their patches and hashes are computed by
+  // the tasks, each picking the next block.
+  std::vector<std::string> patches(block_info.size());
+  std::vector<Blob> hashes(block_info.size());
+  std::atomic<size_t> next_block{0};
+  std::atomic<bool> failed{false};
+  auto process_blocks = [&] {
+    for (size_t i = next_block++; i < block_info.size() && !failed;
+         i = next_block++) {
+      auto s1 = recompressed_blob.substr(offsets[i],
+                                         block_info[i].compressed_length);
+      auto s2 = target_blob.substr(offsets[i], block_info[i].compressed_length);
+      // Include recompressed blob hash, so we can determine if the device
+      // produces same compressed output
+      if (!PostfixBspatch(s1, s2, &patches[i]) ||
+          !HashCalculator::RawHashOfBytes(s1.data(), s1.length(), &hashes[i])) {
+        failed = true;
+      }
+    }
+  };
+  num_tasks = std::max<size_t>(1, std::min(num_tasks, block_info.size()));
+  if (num_tasks == 1) {
+    process_blocks();
+  } else {
+    run_tasks(std::vector<std::function<void()>>(num_tasks, process_blocks));
+  }
+  TEST_AND_RETURN_FALSE(!failed);
+
+  auto& dst_block_info = *output->mutable_dst_info()->mutable_block_info();
+  dst_block_info.Clear();
+  for (size_t i = 0; i < block_info.size(); i++) {
+    const auto& block = block_info[i];
     auto& pb_block = *dst_block_info.Add();
     pb_block.set_uncompressed_offset(block.uncompressed_offset);
     pb_block.set_uncompressed_length(block.uncompressed_length);
     pb_block.set_compressed_length(block.compressed_length);
-    CHECK_LT(offset, recompressed_blob.size());
-    auto s1 = recompressed_blob.substr(offset, block.compressed_length);
-    auto s2 = target_blob.substr(offset, block.compressed_length);
-    if (s1 != s2) {
-      ScopedTempFile patch;
-      int err =
-          bsdiff::bsdiff(reinterpret_cast<const unsigned char*>(s1.data()),
-                         s1.size(),
-                         reinterpret_cast<const unsigned char*>(s2.data()),
-                         s2.size(),
-                         patch.path().c_str(),
-                         nullptr);
-      CHECK_EQ(err, 0);
-      LOG(WARNING) << "Recompress Postfix patch size: "
-                   << utils::FileSize(patch.path());
-      std::string patch_content;
-      TEST_AND_RETURN_FALSE(utils::ReadFile(patch.path(), &patch_content));
-      pb_block.set_postfix_bspatch(std::move(patch_content));
+    if (!patches[i].empty()) {
+      pb_block.set_postfix_bspatch(std::move(patches[i]));
     }
-    // Include recompressed blob hash, so we can determine if the device
-    // produces same compressed output
-    Blob recompressed_blob_hash;
-    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfBytes(
-        s1.data(), s1.length(), &recompressed_blob_hash));
-    pb_block.set_sha256_hash(recompressed_blob_hash.data(),
-                             recompressed_blob_hash.size());
-
-    offset += block.compressed_length;
+    pb_block.set_sha256_hash(hashes[i].data(), hashes[i].size());
   }
   return true;
 }
@@ -183,11 +227,33 @@ bool Lz4Diff(std::string_view src,
              const CompressedFile& dst_file_info,
              Blob* output,
              InstallOperation::Type* op_type) noexcept {
-  const auto& src_block_info = src_file_info.blocks;
+  const auto decompressed_src = TryDecompressBlob(
+      src, src_file_info.blocks, src_file_info.zero_padding_enabled);
+  return Lz4DiffDecompressedSource(
+      decompressed_src,
+      dst,
+      src_file_info,
+      dst_file_info,
+      1,
+      [](std::vector<std::function<void()>> tasks) {
+        for (auto& task : tasks) {
+          task();
+        }
+      },
+      output,
+      op_type);
+}
+
+bool Lz4DiffDecompressedSource(const Blob& decompressed_src,
+                               std::string_view dst,
+                               const CompressedFile& src_file_info,
+                               const CompressedFile& dst_file_info,
+                               size_t num_tasks,
+                               const RunTasksFunc& run_tasks,
+                               Blob* output,
+                               InstallOperation::Type* op_type) noexcept {
   const auto& dst_block_info = dst_file_info.blocks;
 
-  auto decompressed_src = TryDecompressBlob(
-      src, src_block_info, src_file_info.zero_padding_enabled);
   auto decompressed_dst = TryDecompressBlob(
       dst, dst_block_info, dst_file_info.zero_padding_enabled);
   if (decompressed_src.empty() || decompressed_dst.empty()) {
@@ -215,18 +281,23 @@ bool Lz4Diff(std::string_view src,
       *op_type = InstallOperation::LZ4DIFF_PUFFDIFF;
     }
   }
-  // Free up memory used by |decompressed_src| , as we don't need it anymore.
-  decompressed_src = {};
 
   auto recompressed_blob = TryCompressBlob(ToStringView(decompressed_dst),
                                            dst_block_info,
                                            dst_file_info.zero_padding_enabled,
-                                           dst_file_info.algo);
+                                           dst_file_info.algo,
+                                           num_tasks,
+                                           run_tasks);
   TEST_AND_RETURN_FALSE(recompressed_blob.size() > 0);
 
   StoreSrcCompressedFileInfo(src_file_info, &header);
-  StoreDstCompressedFileInfo(
-      ToStringView(recompressed_blob), dst, dst_file_info, &header);
+  TEST_AND_RETURN_FALSE(
+      StoreDstCompressedFileInfo(ToStringView(recompressed_blob),
+                                 dst,
+                                 dst_file_info,
+                                 num_tasks,
+                                 run_tasks,
+                                 &header));
   return ConstructLz4diffPatch(std::move(patch_data), header, output);
 }
 
@@ -21,6 +21,7 @@
 #include <string_view>
 
 #include "lz4diff/lz4diff.pb.h"
+#include "update_engine/lz4diff/lz4diff_compress.h"
 #include "update_engine/lz4diff/lz4diff_format.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -40,6 +41,19 @@ bool Lz4Diff(const Blob& src,
              Blob* output,
              InstallOperation::Type* op_type = nullptr) noexcept;
 
+// Same as above, but from the source already decompressed by
+// TryDecompressBlob(), so that a source diffed against several targets is only
+// decompressed once. The blocks of the target are recompressed and compared by
+// |num_tasks| tasks run by |run_tasks|.
+bool Lz4DiffDecompressedSource(const Blob& decompressed_src,
+                               std::string_view dst,
+                               const CompressedFile& src_file_info,
+                               const CompressedFile& dst_file_info,
+                               size_t num_tasks,
+                               const RunTasksFunc& run_tasks,
+                               Blob* output,
+                               InstallOperation::Type* op_type) noexcept;
+
 }  // namespace chromeos_update_engine
 
 #endif
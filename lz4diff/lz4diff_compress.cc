@@ -21,95 +21,179 @@
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
 
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
 #include <base/logging.h>
 #include <lz4.h>
 #include <lz4hc.h>
 
 namespace chromeos_update_engine {
 
+namespace {
+
+// Number of blocks compressed by each thread between two writes to the sink.
+constexpr size_t kBlocksPerThreadBatch = 16;
+
+// Compresses |block| of |blob| into |output|. The first |uncompressed_size|
+// bytes of |blob| are covered by compressed blocks. |hc| is the state used by
+// LZ4HC, which is reset for every block.
+bool CompressBlock(LZ4_streamHC_t* hc,
+                   std::string_view blob,
+                   size_t uncompressed_size,
+                   const CompressedBlock& block,
+                   const bool zero_padding_enabled,
+                   const CompressionAlgorithm& compression_algo,
+                   Blob* output) {
+  const auto uncompressed_block =
+      blob.substr(block.uncompressed_offset, block.uncompressed_length);
+  if (!block.IsCompressed()) {
+    output->assign(uncompressed_block.begin(), uncompressed_block.end());
+    return true;
+  }
+  Blob& block_buffer = *output;
+  block_buffer.resize(block.compressed_length);
+
+  int ret = 0;
+  // LZ4 spec enforces that last op of a compressed block must be an insert op
+  // of at least 5 bytes. Compressors will try to conform to that requirement
+  // if the input size is just right. We don't want that. So always give a
+  // little bit more data.
+  switch (int src_size = uncompressed_size - block.uncompressed_offset;
+          compression_algo.type()) {
+    case CompressionAlgorithm::LZ4HC:
+      ret = LZ4_compress_HC_destSize(
+          hc,
+          uncompressed_block.data(),
+          reinterpret_cast<char*>(block_buffer.data()),
+          &src_size,
+          block.compressed_length,
+          compression_algo.level());
+      break;
+    case CompressionAlgorithm::LZ4:
+      ret = LZ4_compress_destSize(uncompressed_block.data(),
+                                  reinterpret_cast<char*>(block_buffer.data()),
+                                  &src_size,
+                                  block.compressed_length);
+      break;
+    default:
+      LOG(ERROR) << "Unrecognized compression algorithm: "
+                 << compression_algo.type();
+      return false;
+  }
+  TEST_GT(ret, 0);
+  const uint64_t bytes_written = ret;
+  // Last block may have trailing zeros
+  TEST_LE(bytes_written, block.compressed_length);
+  if (bytes_written < block.compressed_length) {
+    if (zero_padding_enabled) {
+      const auto padding = block.compressed_length - bytes_written;
+      std::memmove(
+          block_buffer.data() + padding, block_buffer.data(), bytes_written);
+      std::fill(block_buffer.data(), block_buffer.data() + padding, 0);
+
+    } else {
+      std::fill(block_buffer.data() + bytes_written,
+                block_buffer.data() + block.compressed_length,
+                0);
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
 bool TryCompressBlob(std::string_view blob,
                      const std::vector<CompressedBlock>& block_info,
                      const bool zero_padding_enabled,
                      const CompressionAlgorithm compression_algo,
                      const SinkFunc& sink) {
+  return TryCompressBlob(blob,
+                         block_info,
+                         zero_padding_enabled,
+                         compression_algo,
+                         sink,
+                         1,
+                         {},
+                         {});
+}
+
+bool TryCompressBlob(std::string_view blob,
+                     const std::vector<CompressedBlock>& block_info,
+                     const bool zero_padding_enabled,
+                     const CompressionAlgorithm compression_algo,
+                     const SinkFunc& sink,
+                     size_t num_tasks,
+                     const RunTasksFunc& run_tasks,
+                     const BlockFixupFunc& fixup) {
   size_t uncompressed_size = 0;
   for (const auto& block : block_info) {
     CHECK_EQ(uncompressed_size, block.uncompressed_offset)
         << "Compressed block info is expected to be sorted.";
     uncompressed_size += block.uncompressed_length;
   }
-  auto hc = LZ4_createStreamHC();
+  if (!run_tasks) {
+    num_tasks = 1;
+  }
+  num_tasks =
+      std::max<size_t>(1, std::min<size_t>(num_tasks, block_info.size()));
+  std::vector<LZ4_streamHC_t*> hc_states(num_tasks);
   DEFER {
-    if (hc) {
-      LZ4_freeStreamHC(hc);
-      hc = nullptr;
+    for (auto hc : hc_states) {
+      if (hc) {
+        LZ4_freeStreamHC(hc);
+      }
     }
   };
-  size_t compressed_offset = 0;
-  Blob block_buffer;
-  for (const auto& block : block_info) {
-    const auto uncompressed_block =
-        blob.substr(block.uncompressed_offset, block.uncompressed_length);
-    if (!block.IsCompressed()) {
-      TEST_EQ(sink(reinterpret_cast<const uint8_t*>(uncompressed_block.data()),
-                   uncompressed_block.size()),
-              uncompressed_block.size());
-      continue;
-    }
-    block_buffer.resize(block.compressed_length);
-    // Execute the increment at end of each loop
-    DEFER {
-      compressed_offset += block.compressed_length;
-      block_buffer.clear();
-    };
-
-    int ret = 0;
-    // LZ4 spec enforces that last op of a compressed block must be an insert op
-    // of at least 5 bytes. Compressors will try to conform to that requirement
-    // if the input size is just right. We don't want that. So always give a
-    // little bit more data.
-    switch (int src_size = uncompressed_size - block.uncompressed_offset;
-            compression_algo.type()) {
-      case CompressionAlgorithm::LZ4HC:
-        ret = LZ4_compress_HC_destSize(
-            hc,
-            uncompressed_block.data(),
-            reinterpret_cast<char*>(block_buffer.data()),
-            &src_size,
-            block.compressed_length,
-            compression_algo.level());
-        break;
-      case CompressionAlgorithm::LZ4:
-        ret =
-            LZ4_compress_destSize(uncompressed_block.data(),
-                                  reinterpret_cast<char*>(block_buffer.data()),
-                                  &src_size,
-                                  block.compressed_length);
-        break;
-      default:
-        LOG(ERROR) << "Unrecognized compression algorithm: "
-                   << compression_algo.type();
-        return {};
-    }
-    TEST_GT(ret, 0);
-    const uint64_t bytes_written = ret;
-    // Last block may have trailing zeros
-    TEST_LE(bytes_written, block.compressed_length);
-    if (bytes_written < block.compressed_length) {
-      if (zero_padding_enabled) {
-        const auto padding = block.compressed_length - bytes_written;
-        std::memmove(
-            block_buffer.data() + padding, block_buffer.data(), bytes_written);
-        std::fill(block_buffer.data(), block_buffer.data() + padding, 0);
+  for (auto& hc : hc_states) {
+    hc = LZ4_createStreamHC();
+    TEST_AND_RETURN_FALSE(hc != nullptr);
+  }
 
-      } else {
-        std::fill(block_buffer.data() + bytes_written,
-                  block_buffer.data() + block.compressed_length,
-                  0);
+  // Blocks are compressed by batches, each task picking the next block of the
+  // batch to compress. Once the whole batch is done, the blocks are passed to
+  // |sink| in order.
+  const size_t batch_size =
+      num_tasks == 1 ? 1 : num_tasks * kBlocksPerThreadBatch;
+  std::vector<Blob> block_buffers(std::min(batch_size, block_info.size()));
+  for (size_t batch_start = 0; batch_start < block_info.size();
+       batch_start += batch_size) {
+    const size_t batch_end =
+        std::min(batch_start + batch_size, block_info.size());
+    std::atomic<size_t> next_block{batch_start};
+    std::atomic<bool> failed{false};
+    auto compress_blocks = [&](LZ4_streamHC_t* hc) {
+      for (size_t i = next_block++; i < batch_end && !failed;
+           i = next_block++) {
+        Blob* block_buffer = &block_buffers[i - batch_start];
+        if (!CompressBlock(hc,
+                           blob,
+                           uncompressed_size,
+                           block_info[i],
+                           zero_padding_enabled,
+                           compression_algo,
+                           block_buffer) ||
+            (fixup && !fixup(i, block_buffer))) {
+          failed = true;
+        }
+      }
+    };
+    if (num_tasks == 1) {
+      compress_blocks(hc_states[0]);
+    } else {
+      std::vector<std::function<void()>> tasks;
+      for (LZ4_streamHC_t* hc : hc_states) {
+        tasks.push_back([&compress_blocks, hc] { compress_blocks(hc); });
       }
+      run_tasks(std::move(tasks));
+    }
+    TEST_AND_RETURN_FALSE(!failed);
+    for (size_t i = batch_start; i < batch_end; i++) {
+      const Blob& block_buffer = block_buffers[i - batch_start];
+      TEST_EQ(sink(block_buffer.data(), block_buffer.size()),
+              block_buffer.size());
     }
-    TEST_EQ(sink(block_buffer.data(), block_buffer.size()),
-            block_buffer.size());
   }
   // Any trailing data will be copied to the output buffer.
   TEST_EQ(
@@ -123,6 +207,16 @@ Blob TryCompressBlob(std::string_view blob,
                      const std::vector<CompressedBlock>& block_info,
                      const bool zero_padding_enabled,
                      const CompressionAlgorithm compression_algo) {
+  return TryCompressBlob(
+      blob, block_info, zero_padding_enabled, compression_algo, 1, {});
+}
+
+Blob TryCompressBlob(std::string_view blob,
+                     const std::vector<CompressedBlock>& block_info,
+                     const bool zero_padding_enabled,
+                     const CompressionAlgorithm compression_algo,
+                     size_t num_tasks,
+                     const RunTasksFunc& run_tasks) {
   size_t uncompressed_size = 0;
   size_t compressed_size = 0;
   for (const auto& block : block_info) {
@@ -141,7 +235,10 @@ Blob TryCompressBlob(std::string_view blob,
                        [&output](const uint8_t* data, size_t size) {
                          output.insert(output.end(), data, data + size);
                          return size;
-                       })) {
+                       },
+                       num_tasks,
+                       run_tasks,
+                       {})) {
     return {};
   }
 
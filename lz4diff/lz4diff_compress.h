@@ -23,6 +23,11 @@
 namespace chromeos_update_engine {
 
 using SinkFunc = std::function<size_t(const uint8_t*, size_t)>;
+// Called on the |index|th block of the block info after it is compressed, and
+// before it is passed to the sink. May modify |block|, returns false on error.
+using BlockFixupFunc = std::function<bool(size_t index, Blob* block)>;
+// Runs |tasks|, possibly concurrently, and returns once all of them completed.
+using RunTasksFunc = std::function<void(std::vector<std::function<void()>>)>;
 
 // |TryCompressBlob| and |TryDecompressBlob| are inverse function of each other.
 // One compresses data into fixed size output chunks, one decompresses fixed
@@ -42,6 +47,26 @@ bool TryCompressBlob(std::string_view blob,
                      const bool zero_padding_enabled,
                      const CompressionAlgorithm compression_algo,
                      const SinkFunc& sink);
+// Same as above, but compresses the blocks of |block_info| by up to
+// |num_tasks| tasks run by |run_tasks|, and calls |fixup|, if set, on each of
+// them. Blocks are independent, so the output is the same as with a single
+// task. Without |run_tasks|, the blocks are compressed on the calling thread.
+bool TryCompressBlob(std::string_view blob,
+                     const std::vector<CompressedBlock>& block_info,
+                     const bool zero_padding_enabled,
+                     const CompressionAlgorithm compression_algo,
+                     const SinkFunc& sink,
+                     size_t num_tasks,
+                     const RunTasksFunc& run_tasks,
+                     const BlockFixupFunc& fixup);
+// Same as the first one, compressing the blocks by |num_tasks| tasks run by
+// |run_tasks|.
+Blob TryCompressBlob(std::string_view blob,
+                     const std::vector<CompressedBlock>& block_info,
+                     const bool zero_padding_enabled,
+                     const CompressionAlgorithm compression_algo,
+                     size_t num_tasks,
+                     const RunTasksFunc& run_tasks);
 
 Blob TryDecompressBlob(std::string_view blob,
                        const std::vector<CompressedBlock>& block_info,
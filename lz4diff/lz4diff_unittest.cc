@@ -19,6 +19,7 @@
 #include <algorithm>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <base/format_macros.h>
@@ -103,6 +104,27 @@ TEST_F(Lz4diffTest, DiffElfBinary) {
   Blob patched_new_data;
   ASSERT_TRUE(Lz4Patch(old_data, diff_blob, &patched_new_data));
   ASSERT_EQ(patched_new_data, new_data);
+
+  // Recompressing by several tasks on threads produces the same output.
+  Blob threaded_new_data;
+  ASSERT_TRUE(Lz4Patch(
+      ToStringView(old_data),
+      ToStringView(diff_blob),
+      [&threaded_new_data](const uint8_t* data, size_t size) -> size_t {
+        threaded_new_data.insert(threaded_new_data.end(), data, data + size);
+        return size;
+      },
+      4,
+      [](std::vector<std::function<void()>> tasks) {
+        std::vector<std::thread> threads;
+        for (auto& task : tasks) {
+          threads.emplace_back(std::move(task));
+        }
+        for (auto& thread : threads) {
+          thread.join();
+        }
+      }));
+  ASSERT_EQ(threaded_new_data, new_data);
 }
 
 }  // namespace
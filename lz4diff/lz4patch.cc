@@ -245,7 +245,9 @@ bool ApplyInnerPatch(Blob decompressed_src,
 // Hand coding CPS is not fun.
 bool Lz4Patch(std::string_view src_data,
               const Lz4diffPatch& patch,
-              const SinkFunc& sink) {
+              const SinkFunc& sink,
+              size_t num_tasks,
+              const RunTasksFunc& run_tasks) {
   auto decompressed_src = TryDecompressBlob(
       src_data,
       ToCompressedBlockVec(patch.pb_header.src_info().block_info()),
@@ -264,26 +266,24 @@ bool Lz4Patch(std::string_view src_data,
         ToCompressedBlockVec(patch.pb_header.dst_info().block_info()),
         patch.pb_header.dst_info().zero_padding_enabled(),
         patch.pb_header.dst_info().algo(),
-        sink);
+        sink,
+        num_tasks,
+        run_tasks,
+        {});
   }
+  // Blocks are fixed up independently, possibly by several tasks.
   auto postfix_patcher =
-      [&sink,
-       block_idx = 0,
-       &dst_block_info = patch.pb_header.dst_info().block_info()](
-          const uint8_t* data, size_t size) mutable -> size_t {
-    if (block_idx >= dst_block_info.size()) {
-      return sink(data, size);
-    }
+      [&dst_block_info = patch.pb_header.dst_info().block_info()](
+          size_t block_idx, Blob* block) -> bool {
     const auto& block_info = dst_block_info[block_idx];
-    TEST_EQ(size, block_info.compressed_length());
-    DEFER { block_idx++; };
+    TEST_EQ(block->size(), block_info.compressed_length());
     if (block_info.postfix_bspatch().empty()) {
-      return sink(data, size);
+      return true;
     }
     if (!block_info.sha256_hash().empty()) {
       Blob actual_hash;
-      TEST_AND_RETURN_FALSE(
-          HashCalculator::RawHashOfBytes(data, size, &actual_hash));
+      TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfBytes(
+          block->data(), block->size(), &actual_hash));
       if (ToStringView(actual_hash) != block_info.sha256_hash()) {
         LOG(ERROR) << "Block " << block_info
                    << " is corrupted. This usually means the patch generator "
@@ -292,15 +292,14 @@ bool Lz4Patch(std::string_view src_data,
                       "output on different platforms. Expected hash: "
                    << HexEncode(block_info.sha256_hash())
                    << ", actual hash: " << HexEncode(actual_hash);
-        return 0;
+        return false;
       }
     }
     Blob fixed_block;
-    TEST_AND_RETURN_FALSE(
-        bspatch(std::string_view(reinterpret_cast<const char*>(data), size),
-                block_info.postfix_bspatch(),
-                &fixed_block));
-    return sink(fixed_block.data(), fixed_block.size());
+    TEST_AND_RETURN_FALSE(bspatch(
+        ToStringView(*block), block_info.postfix_bspatch(), &fixed_block));
+    *block = std::move(fixed_block);
+    return true;
   };
 
   return TryCompressBlob(
@@ -308,6 +307,9 @@ bool Lz4Patch(std::string_view src_data,
       ToCompressedBlockVec(patch.pb_header.dst_info().block_info()),
       patch.pb_header.dst_info().zero_padding_enabled(),
       patch.pb_header.dst_info().algo(),
+      sink,
+      num_tasks,
+      run_tasks,
       postfix_patcher);
 }
 
@@ -319,7 +321,9 @@ bool Lz4Patch(std::string_view src_data,
       GetCompressedSize(patch.pb_header.dst_info().block_info());
   blob.reserve(output_size);
   TEST_AND_RETURN_FALSE(Lz4Patch(
-      src_data, patch, [&blob](const uint8_t* data, size_t size) -> size_t {
+      src_data,
+      patch,
+      [&blob](const uint8_t* data, size_t size) -> size_t {
         blob.insert(blob.end(), data, data + size);
         return size;
       }));
@@ -339,10 +343,12 @@ bool Lz4Patch(std::string_view src_data,
 
 bool Lz4Patch(std::string_view src_data,
               std::string_view patch_data,
-              const SinkFunc& sink) {
+              const SinkFunc& sink,
+              size_t num_tasks,
+              const RunTasksFunc& run_tasks) {
   Lz4diffPatch patch;
   TEST_AND_RETURN_FALSE(ParseLz4DifffPatch(patch_data, &patch));
-  return Lz4Patch(src_data, patch, sink);
+  return Lz4Patch(src_data, patch, sink, num_tasks, run_tasks);
 }
 
 bool Lz4Patch(const Blob& src_data, const Blob& patch_data, Blob* output) {
@@ -22,9 +22,13 @@
 
 namespace chromeos_update_engine {
 
+// The output blocks are recompressed, and fixed up, by up to |num_tasks| tasks
+// run by |run_tasks|. They are passed to |sink| in order.
 bool Lz4Patch(std::string_view src_data,
               std::string_view patch_data,
-              const SinkFunc& sink);
+              const SinkFunc& sink,
+              size_t num_tasks = 1,
+              const RunTasksFunc& run_tasks = {});
 
 bool Lz4Patch(std::string_view src_data,
               std::string_view patch_data,
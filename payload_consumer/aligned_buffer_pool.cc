@@ -0,0 +1,131 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/aligned_buffer_pool.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <base/logging.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+size_t RoundUp(size_t size, size_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+}  // namespace
+
+AlignedBuffer& AlignedBuffer::operator=(AlignedBuffer&& other) {
+  if (this != &other) {
+    Reset();
+    pool_ = std::exchange(other.pool_, nullptr);
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    capacity_ = std::exchange(other.capacity_, 0);
+  }
+  return *this;
+}
+
+void AlignedBuffer::Reset() {
+  if (data_) {
+    pool_->Release(data_, capacity_);
+  }
+  pool_ = nullptr;
+  data_ = nullptr;
+  size_ = 0;
+  capacity_ = 0;
+}
+
+AlignedBufferPool* AlignedBufferPool::Get() {
+  // Never destroyed, the buffers may be released by threads still running at
+  // exit.
+  static auto* pool = new AlignedBufferPool(kDefaultMaxPooledBytes, true);
+  return pool;
+}
+
+AlignedBufferPool::AlignedBufferPool(size_t max_pooled_bytes,
+                                     bool use_huge_pages)
+    : max_pooled_bytes_(max_pooled_bytes), use_huge_pages_(use_huge_pages) {}
+
+AlignedBufferPool::~AlignedBufferPool() {
+  for (const auto& [data, capacity] : free_) {
+    munmap(data, capacity);
+  }
+}
+
+AlignedBuffer AlignedBufferPool::Acquire(size_t size) {
+  if (size == 0) {
+    return {};
+  }
+  const bool huge = use_huge_pages_ && size >= kHugePageSize;
+  const size_t capacity =
+      RoundUp(size, huge ? kHugePageSize : sysconf(_SC_PAGESIZE));
+  {
+    // The smallest pooled mapping large enough, as long as it isn't more than
+    // twice as large as needed.
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto best = free_.end();
+    for (auto it = free_.begin(); it != free_.end(); ++it) {
+      if (it->second >= capacity && it->second <= 2 * capacity &&
+          (best == free_.end() || it->second < best->second)) {
+        best = it;
+      }
+    }
+    if (best != free_.end()) {
+      const auto [data, pooled_capacity] = *best;
+      *best = free_.back();
+      free_.pop_back();
+      pooled_bytes_ -= pooled_capacity;
+      return AlignedBuffer(this, data, size, pooled_capacity);
+    }
+  }
+  void* data = mmap(nullptr,
+                    capacity,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1,
+                    0);
+  PCHECK(data != MAP_FAILED) << "Failed to map a buffer of " << capacity
+                             << " bytes";
+  if (huge && madvise(data, capacity, MADV_HUGEPAGE) != 0) {
+    PLOG(INFO) << "Huge pages aren't available for the I/O buffers";
+  }
+  return AlignedBuffer(this, static_cast<uint8_t*>(data), size, capacity);
+}
+
+size_t AlignedBufferPool::pooled_bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pooled_bytes_;
+}
+
+void AlignedBufferPool::Release(uint8_t* data, size_t capacity) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pooled_bytes_ + capacity <= max_pooled_bytes_) {
+      free_.emplace_back(data, capacity);
+      pooled_bytes_ += capacity;
+      return;
+    }
+  }
+  munmap(data, capacity);
+}
+
+}  // namespace chromeos_update_engine
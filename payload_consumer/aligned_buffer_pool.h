@@ -0,0 +1,109 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_ALIGNED_BUFFER_POOL_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_ALIGNED_BUFFER_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <base/macros.h>
+
+namespace chromeos_update_engine {
+
+// Alignment of the offsets, sizes and buffers of O_DIRECT I/O which works for
+// devices with logical blocks of up to a page.
+constexpr size_t kDirectIoAlignment = 4096;
+
+class AlignedBufferPool;
+
+// A page-aligned buffer, usable for O_DIRECT I/O, handed out by an
+// AlignedBufferPool. Its memory returns to the pool when it is destroyed.
+class AlignedBuffer {
+ public:
+  AlignedBuffer() = default;
+  AlignedBuffer(AlignedBuffer&& other) { *this = std::move(other); }
+  AlignedBuffer& operator=(AlignedBuffer&& other);
+  ~AlignedBuffer() { Reset(); }
+
+  uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Returns the memory to the pool, leaving the buffer empty.
+  void Reset();
+
+ private:
+  friend class AlignedBufferPool;
+  AlignedBuffer(AlignedBufferPool* pool,
+                uint8_t* data,
+                size_t size,
+                size_t capacity)
+      : pool_(pool), data_(data), size_(size), capacity_(capacity) {}
+
+  AlignedBufferPool* pool_{nullptr};
+  uint8_t* data_{nullptr};
+  size_t size_{0};
+  // The size of the mapping at |data_|.
+  size_t capacity_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(AlignedBuffer);
+};
+
+// Keeps the memory of the AlignedBuffers released, up to a total size, for the
+// next buffers acquired, so that the large I/O buffers of the update aren't
+// mapped and unmapped for every partition or every chunk. Thread-safe.
+class AlignedBufferPool {
+ public:
+  static constexpr size_t kDefaultMaxPooledBytes = 32 * 1024 * 1024;
+
+  // The pool shared by the whole process.
+  static AlignedBufferPool* Get();
+
+  // Buffers of at least 2 MiB are backed by transparent huge pages if
+  // |use_huge_pages| is set. The buffers acquired must not outlive the pool.
+  AlignedBufferPool(size_t max_pooled_bytes, bool use_huge_pages);
+  ~AlignedBufferPool();
+
+  // Returns a buffer of |size| bytes, reusing pooled memory when possible.
+  // The content of the buffer is undefined. Aborts if out of memory, like
+  // allocating a brillo::Blob would.
+  AlignedBuffer Acquire(size_t size);
+
+  // The size of the memory kept for the next buffers.
+  size_t pooled_bytes() const;
+
+ private:
+  friend class AlignedBuffer;
+  void Release(uint8_t* data, size_t capacity);
+
+  const size_t max_pooled_bytes_;
+  const bool use_huge_pages_;
+
+  mutable std::mutex mutex_;
+  // The released mappings, as address and size.
+  std::vector<std::pair<uint8_t*, size_t>> free_;
+  size_t pooled_bytes_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(AlignedBufferPool);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_ALIGNED_BUFFER_POOL_H_
@@ -0,0 +1,69 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/aligned_buffer_pool.h"
+
+#include <string.h>
+
+#include <utility>
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+TEST(AlignedBufferPoolTest, BuffersArePageAligned) {
+  AlignedBufferPool pool(1024 * 1024, false);
+  for (size_t size : {1, 4096, 10000}) {
+    AlignedBuffer buffer = pool.Acquire(size);
+    ASSERT_EQ(buffer.size(), size);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(buffer.data()) % kDirectIoAlignment,
+              0U);
+    memset(buffer.data(), 0xaa, size);
+  }
+  EXPECT_TRUE(pool.Acquire(0).empty());
+}
+
+TEST(AlignedBufferPoolTest, ReusesReleasedBuffers) {
+  AlignedBufferPool pool(1024 * 1024, false);
+  AlignedBuffer buffer = pool.Acquire(64 * 1024);
+  const uint8_t* data = buffer.data();
+  buffer.Reset();
+  EXPECT_TRUE(buffer.empty());
+  EXPECT_EQ(pool.pooled_bytes(), 64U * 1024);
+
+  // Much smaller buffers don't take the memory, slightly smaller ones do.
+  EXPECT_NE(pool.Acquire(16 * 1024).data(), data);
+  EXPECT_EQ(pool.pooled_bytes(), 80U * 1024);
+  AlignedBuffer reused = pool.Acquire(40 * 1024);
+  EXPECT_EQ(reused.data(), data);
+  EXPECT_EQ(reused.size(), 40U * 1024);
+  EXPECT_EQ(pool.pooled_bytes(), 16U * 1024);
+
+  AlignedBuffer moved = std::move(reused);
+  EXPECT_EQ(moved.data(), data);
+  EXPECT_TRUE(reused.empty());
+}
+
+TEST(AlignedBufferPoolTest, KeepsAtMostMaxPooledBytes) {
+  AlignedBufferPool pool(128 * 1024, false);
+  {
+    AlignedBuffer first = pool.Acquire(96 * 1024);
+    AlignedBuffer second = pool.Acquire(96 * 1024);
+  }
+  EXPECT_EQ(pool.pooled_bytes(), 96U * 1024);
+}
+
+}  // namespace chromeos_update_engine
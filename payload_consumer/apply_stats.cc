@@ -0,0 +1,165 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/apply_stats.h"
+
+#include <inttypes.h>
+
+#include <algorithm>
+
+#include <base/strings/stringprintf.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+base::ThreadTicks ThreadNow() {
+  return base::ThreadTicks::IsSupported() ? base::ThreadTicks::Now()
+                                          : base::ThreadTicks();
+}
+
+size_t DurationBucket(base::TimeDelta wall_time) {
+  size_t bucket = 0;
+  for (int64_t ms = wall_time.InMilliseconds(); ms > 0; ms >>= 1) {
+    bucket++;
+  }
+  return std::min(bucket, OperationTypeStats::kNumDurationBuckets - 1);
+}
+
+// In MiB/s, 0 if nothing was measured.
+double Throughput(uint64_t bytes, base::TimeDelta time) {
+  if (time <= base::TimeDelta()) {
+    return 0;
+  }
+  return bytes / time.InSecondsF() / (1024 * 1024);
+}
+}  // namespace
+
+void OperationTypeStats::Merge(const OperationTypeStats& other) {
+  count += other.count;
+  wall_time += other.wall_time;
+  cpu_time += other.cpu_time;
+  data_bytes += other.data_bytes;
+  bytes_read += other.bytes_read;
+  bytes_written += other.bytes_written;
+  for (size_t i = 0; i < kNumDurationBuckets; i++) {
+    wall_time_buckets[i] += other.wall_time_buckets[i];
+  }
+  max_wall_time = std::max(max_wall_time, other.max_wall_time);
+}
+
+ApplyStats::ScopedOperation::ScopedOperation(ApplyStats* stats,
+                                             const InstallOperation& operation,
+                                             size_t block_size)
+    : stats_(stats),
+      operation_(operation),
+      block_size_(block_size),
+      start_time_(stats ? base::TimeTicks::Now() : base::TimeTicks()),
+      start_thread_time_(stats ? ThreadNow() : base::ThreadTicks()) {}
+
+ApplyStats::ScopedOperation::~ScopedOperation() {
+  if (stats_) {
+    stats_->Record(operation_,
+                   block_size_,
+                   base::TimeTicks::Now() - start_time_,
+                   ThreadNow() - start_thread_time_);
+  }
+}
+
+void ApplyStats::Record(const InstallOperation& operation,
+                        size_t block_size,
+                        base::TimeDelta wall_time,
+                        base::TimeDelta cpu_time) {
+  OperationTypeStats& stats = by_type_[operation.type()];
+  stats.count++;
+  stats.wall_time += wall_time;
+  stats.cpu_time += cpu_time;
+  stats.data_bytes += operation.data_length();
+  stats.bytes_read +=
+      utils::BlocksInExtents(operation.src_extents()) * block_size;
+  stats.bytes_written +=
+      utils::BlocksInExtents(operation.dst_extents()) * block_size;
+  stats.wall_time_buckets[DurationBucket(wall_time)]++;
+  stats.max_wall_time = std::max(stats.max_wall_time, wall_time);
+}
+
+void ApplyStats::Merge(const ApplyStats& other) {
+  for (const auto& [type, stats] : other.by_type_) {
+    by_type_[type].Merge(stats);
+  }
+}
+
+OperationTypeStats ApplyStats::Total() const {
+  OperationTypeStats total;
+  for (const auto& [type, stats] : by_type_) {
+    total.Merge(stats);
+  }
+  return total;
+}
+
+std::string ApplyStats::ToString() const {
+  std::string result;
+  for (const auto& [type, stats] : by_type_) {
+    base::StringAppendF(
+        &result,
+        "%s: %" PRIu64 " operations, %" PRId64 " ms wall time, %" PRId64
+        " ms cpu time, %" PRIu64 " bytes of data, %" PRIu64
+        " bytes read, %" PRIu64 " bytes written, by duration:",
+        InstallOperationTypeName(static_cast<InstallOperation::Type>(type)),
+        stats.count,
+        stats.wall_time.InMilliseconds(),
+        stats.cpu_time.InMilliseconds(),
+        stats.data_bytes,
+        stats.bytes_read,
+        stats.bytes_written);
+    // The buckets past the last operation are left out.
+    size_t num_buckets = OperationTypeStats::kNumDurationBuckets;
+    while (num_buckets > 1 && stats.wall_time_buckets[num_buckets - 1] == 0) {
+      num_buckets--;
+    }
+    for (size_t i = 0; i < num_buckets; i++) {
+      base::StringAppendF(&result, " %" PRIu64, stats.wall_time_buckets[i]);
+    }
+    result += "\n";
+  }
+  return result;
+}
+
+std::string PartitionThroughputStats::ToString(
+    const ApplyStats& apply_stats) const {
+  // Whatever the applying threads didn't spend on CPU, they mostly spent
+  // blocked on storage.
+  const OperationTypeStats total = apply_stats.Total();
+  const base::TimeDelta storage_time =
+      std::max(total.wall_time - total.cpu_time, base::TimeDelta());
+  return base::StringPrintf(
+      "download %.2f MiB/s (%" PRId64 " ms waiting for the network), apply "
+      "%.2f MiB/s (%" PRId64 " ms on cpu, %" PRId64 " ms on storage, slowest "
+      "operation %" PRId64 " ms), verify %.2f MiB/s",
+      Throughput(download_bytes, download_time),
+      network_wait_time.InMilliseconds(),
+      Throughput(total.bytes_written, total.wall_time),
+      total.cpu_time.InMilliseconds(),
+      storage_time.InMilliseconds(),
+      total.max_wall_time.InMilliseconds(),
+      Throughput(verify_bytes, verify_time));
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,122 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_APPLY_STATS_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_APPLY_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <map>
+#include <string>
+
+#include <base/macros.h>
+#include <base/time/time.h>
+
+namespace chromeos_update_engine {
+
+class InstallOperation;
+
+// Time and I/O spent applying the operations of one type.
+struct OperationTypeStats {
+  // Operations by wall time: the first bucket counts those applied in less
+  // than 1 ms, bucket i those applied in [2^(i-1), 2^i) ms, and the last one
+  // every longer one.
+  static constexpr size_t kNumDurationBuckets = 16;
+
+  uint64_t count{0};
+  base::TimeDelta wall_time;
+  // CPU time of the applying thread.
+  base::TimeDelta cpu_time;
+  // Bytes of the operations' blobs, source extents and target extents.
+  uint64_t data_bytes{0};
+  uint64_t bytes_read{0};
+  uint64_t bytes_written{0};
+  std::array<uint64_t, kNumDurationBuckets> wall_time_buckets{};
+  // Wall time of the slowest operation.
+  base::TimeDelta max_wall_time;
+
+  void Merge(const OperationTypeStats& other);
+};
+
+// Time and I/O spent applying the operations of a partition, by operation
+// type. Not thread safe: every thread applying operations records them in
+// its own instance, merged once it's done.
+class ApplyStats {
+ public:
+  // Measures the operation applied by the calling thread during its lifetime.
+  class ScopedOperation {
+   public:
+    // |stats| may be null to measure nothing.
+    ScopedOperation(ApplyStats* stats,
+                    const InstallOperation& operation,
+                    size_t block_size);
+    ~ScopedOperation();
+
+   private:
+    ApplyStats* stats_;
+    const InstallOperation& operation_;
+    const size_t block_size_;
+    const base::TimeTicks start_time_;
+    const base::ThreadTicks start_thread_time_;
+
+    DISALLOW_COPY_AND_ASSIGN(ScopedOperation);
+  };
+
+  void Record(const InstallOperation& operation,
+              size_t block_size,
+              base::TimeDelta wall_time,
+              base::TimeDelta cpu_time);
+
+  void Merge(const ApplyStats& other);
+
+  bool empty() const { return by_type_.empty(); }
+
+  // The stats of all the operation types together.
+  OperationTypeStats Total() const;
+
+  // Keyed by InstallOperation::Type.
+  const std::map<int, OperationTypeStats>& by_type() const { return by_type_; }
+
+  // One line per operation type, for the logs.
+  std::string ToString() const;
+
+ private:
+  std::map<int, OperationTypeStats> by_type_;
+};
+
+// Throughput of the update of a partition, by phase, and what it waited on.
+struct PartitionThroughputStats {
+  // Payload bytes received while the partition was the one being applied,
+  // the time it was, and how much of that time was spent waiting for the
+  // network.
+  uint64_t download_bytes{0};
+  base::TimeDelta download_time;
+  base::TimeDelta network_wait_time;
+  // Bytes hashed by FilesystemVerifierAction and the time it took.
+  uint64_t verify_bytes{0};
+  base::TimeDelta verify_time;
+
+  // Download, apply and verify throughputs, the time the applier spent on CPU
+  // and blocked on storage and the slowest operation, for the logs.
+  std::string ToString(const ApplyStats& apply_stats) const;
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_APPLY_STATS_H_
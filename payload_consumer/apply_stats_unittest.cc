@@ -0,0 +1,146 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/apply_stats.h"
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr size_t kBlockSize = 4096;
+
+InstallOperation MakeOperation(InstallOperation::Type type,
+                               uint64_t src_blocks,
+                               uint64_t dst_blocks) {
+  InstallOperation op;
+  op.set_type(type);
+  if (src_blocks > 0) {
+    *op.add_src_extents() = ExtentForRange(0, src_blocks);
+  }
+  *op.add_dst_extents() = ExtentForRange(100, dst_blocks);
+  op.set_data_length(123);
+  return op;
+}
+}  // namespace
+
+TEST(ApplyStatsTest, RecordTest) {
+  ApplyStats stats;
+  EXPECT_TRUE(stats.empty());
+  const InstallOperation diff =
+      MakeOperation(InstallOperation::SOURCE_BSDIFF, 2, 3);
+  stats.Record(diff,
+               kBlockSize,
+               base::TimeDelta::FromMicroseconds(500),
+               base::TimeDelta::FromMicroseconds(400));
+  stats.Record(diff,
+               kBlockSize,
+               base::TimeDelta::FromMilliseconds(5),
+               base::TimeDelta::FromMilliseconds(4));
+  stats.Record(MakeOperation(InstallOperation::ZERO, 0, 8),
+               kBlockSize,
+               base::TimeDelta::FromHours(1),
+               base::TimeDelta());
+
+  ASSERT_EQ(2U, stats.by_type().size());
+  const OperationTypeStats& diff_stats =
+      stats.by_type().at(InstallOperation::SOURCE_BSDIFF);
+  EXPECT_EQ(2U, diff_stats.count);
+  EXPECT_EQ(base::TimeDelta::FromMicroseconds(5500), diff_stats.wall_time);
+  EXPECT_EQ(base::TimeDelta::FromMicroseconds(4400), diff_stats.cpu_time);
+  EXPECT_EQ(246U, diff_stats.data_bytes);
+  EXPECT_EQ(4 * kBlockSize, diff_stats.bytes_read);
+  EXPECT_EQ(6 * kBlockSize, diff_stats.bytes_written);
+  // Below 1 ms, then in [4, 8) ms.
+  EXPECT_EQ(1U, diff_stats.wall_time_buckets[0]);
+  EXPECT_EQ(1U, diff_stats.wall_time_buckets[3]);
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(5), diff_stats.max_wall_time);
+
+  const OperationTypeStats& zero_stats =
+      stats.by_type().at(InstallOperation::ZERO);
+  EXPECT_EQ(0U, zero_stats.bytes_read);
+  EXPECT_EQ(8 * kBlockSize, zero_stats.bytes_written);
+  EXPECT_EQ(1U, zero_stats.wall_time_buckets.back());
+}
+
+TEST(ApplyStatsTest, MergeTest) {
+  const InstallOperation replace =
+      MakeOperation(InstallOperation::REPLACE_XZ, 0, 1);
+  ApplyStats first;
+  ApplyStats second;
+  first.Record(replace,
+               kBlockSize,
+               base::TimeDelta::FromMilliseconds(1),
+               base::TimeDelta::FromMilliseconds(1));
+  second.Record(replace,
+                kBlockSize,
+                base::TimeDelta::FromMilliseconds(2),
+                base::TimeDelta::FromMilliseconds(1));
+  second.Record(MakeOperation(InstallOperation::SOURCE_COPY, 1, 1),
+                kBlockSize,
+                base::TimeDelta(),
+                base::TimeDelta());
+  first.Merge(second);
+
+  ASSERT_EQ(2U, first.by_type().size());
+  const OperationTypeStats& replace_stats =
+      first.by_type().at(InstallOperation::REPLACE_XZ);
+  EXPECT_EQ(2U, replace_stats.count);
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(3), replace_stats.wall_time);
+  EXPECT_EQ(1U, replace_stats.wall_time_buckets[1]);
+  EXPECT_EQ(1U, replace_stats.wall_time_buckets[2]);
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(2), replace_stats.max_wall_time);
+  EXPECT_EQ(1U, first.by_type().at(InstallOperation::SOURCE_COPY).count);
+
+  const OperationTypeStats total = first.Total();
+  EXPECT_EQ(3U, total.count);
+  EXPECT_EQ(3 * kBlockSize, total.bytes_written);
+  EXPECT_EQ(base::TimeDelta::FromMilliseconds(2), total.max_wall_time);
+}
+
+TEST(ApplyStatsTest, ThroughputTest) {
+  ApplyStats apply_stats;
+  apply_stats.Record(MakeOperation(InstallOperation::REPLACE, 0, 256),
+                     kBlockSize,
+                     base::TimeDelta::FromMilliseconds(500),
+                     base::TimeDelta::FromMilliseconds(200));
+  PartitionThroughputStats stats;
+  stats.download_bytes = 4 * 1024 * 1024;
+  stats.download_time = base::TimeDelta::FromSeconds(2);
+  stats.network_wait_time = base::TimeDelta::FromSeconds(1);
+  EXPECT_EQ(
+      "download 2.00 MiB/s (1000 ms waiting for the network), apply 2.00 "
+      "MiB/s (200 ms on cpu, 300 ms on storage, slowest operation 500 ms), "
+      "verify 0.00 MiB/s",
+      stats.ToString(apply_stats));
+}
+
+TEST(ApplyStatsTest, ScopedOperationTest) {
+  const InstallOperation replace =
+      MakeOperation(InstallOperation::REPLACE, 0, 1);
+  ApplyStats stats;
+  { ApplyStats::ScopedOperation measure(nullptr, replace, kBlockSize); }
+  EXPECT_TRUE(stats.empty());
+  { ApplyStats::ScopedOperation measure(&stats, replace, kBlockSize); }
+  ASSERT_EQ(1U, stats.by_type().size());
+  EXPECT_EQ(1U, stats.by_type().at(InstallOperation::REPLACE).count);
+}
+
+}  // namespace chromeos_update_engine
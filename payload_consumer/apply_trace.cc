@@ -0,0 +1,217 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/apply_trace.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <android-base/file.h>
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
+#include <base/logging.h>
+
+#include "update_engine/common/error_code_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/delta_performer.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+std::atomic<ApplyTrace*> g_apply_trace{nullptr};
+
+constexpr char kTraceHeader[] = "apply_trace 1";
+constexpr char kReceivedBytesTag[] = "r";
+constexpr char kWriteLatencyTag[] = "w";
+
+void SleepFor(base::TimeDelta delay) {
+  if (delay > base::TimeDelta()) {
+    std::this_thread::sleep_for(
+        std::chrono::microseconds(delay.InMicroseconds()));
+  }
+}
+
+}  // namespace
+
+ApplyTrace* ApplyTrace::Get() {
+  return g_apply_trace;
+}
+
+void ApplyTrace::Set(ApplyTrace* trace) {
+  g_apply_trace = trace;
+}
+
+void ApplyTrace::OnReceivedBytes(size_t count) {
+  if (!replaying_) {
+    Append(EventType::kReceivedBytes, count);
+  }
+}
+
+void ApplyTrace::OnWrite(base::TimeDelta latency) {
+  if (!replaying_) {
+    Append(EventType::kWriteLatency, latency.InMicroseconds());
+    return;
+  }
+  base::TimeDelta recorded;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    while (next_write_ < events_.size() &&
+           events_[next_write_].type != EventType::kWriteLatency) {
+      next_write_++;
+    }
+    if (next_write_ == events_.size()) {
+      return;
+    }
+    recorded = base::TimeDelta::FromMicroseconds(events_[next_write_++].value);
+  }
+  SleepFor(recorded - latency);
+}
+
+void ApplyTrace::Append(EventType type, uint64_t value) {
+  const base::TimeTicks now = base::TimeTicks::Now();
+  std::lock_guard<std::mutex> guard(lock_);
+  if (events_.size() == kMaxEvents) {
+    LOG_IF(WARNING, dropped_events_++ == 0)
+        << "The apply trace is full, dropping the later events.";
+    return;
+  }
+  if (events_.empty()) {
+    start_time_ = now;
+  }
+  events_.push_back({type, now - start_time_, value});
+}
+
+bool ApplyTrace::Save(const std::string& path) const {
+  std::string content = kTraceHeader;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    for (const Event& event : events_) {
+      content += android::base::StringPrintf(
+          "\n%s %" PRId64 " %" PRIu64,
+          event.type == EventType::kReceivedBytes ? kReceivedBytesTag
+                                                  : kWriteLatencyTag,
+          event.time.InMicroseconds(),
+          event.value);
+    }
+  }
+  content += "\n";
+  TEST_AND_RETURN_FALSE(android::base::WriteStringToFile(content, path));
+  LOG(INFO) << "Wrote the apply trace to " << path;
+  return true;
+}
+
+bool ApplyTrace::Load(const std::string& path) {
+  std::string content;
+  TEST_AND_RETURN_FALSE(android::base::ReadFileToString(path, &content));
+  const std::vector<std::string> lines =
+      android::base::Split(android::base::Trim(content), "\n");
+  if (lines[0] != kTraceHeader) {
+    LOG(ERROR) << path << " isn't an apply trace.";
+    return false;
+  }
+  std::vector<Event> events;
+  for (size_t i = 1; i < lines.size(); i++) {
+    const std::vector<std::string> fields = android::base::Split(lines[i], " ");
+    int64_t time = 0;
+    Event event{};
+    if (fields.size() != 3 ||
+        (fields[0] != kReceivedBytesTag && fields[0] != kWriteLatencyTag) ||
+        !android::base::ParseInt(fields[1], &time, int64_t{0}) ||
+        !android::base::ParseUint(fields[2], &event.value)) {
+      LOG(ERROR) << "Invalid line " << i + 1 << " of the apply trace " << path
+                 << ": " << lines[i];
+      return false;
+    }
+    event.type = fields[0] == kReceivedBytesTag ? EventType::kReceivedBytes
+                                                : EventType::kWriteLatency;
+    event.time = base::TimeDelta::FromMicroseconds(time);
+    events.push_back(event);
+  }
+  std::lock_guard<std::mutex> guard(lock_);
+  events_ = std::move(events);
+  next_write_ = 0;
+  replaying_ = true;
+  return true;
+}
+
+bool ApplyTrace::Replay(const std::string& payload_path,
+                        double time_scale,
+                        DeltaPerformer* performer) {
+  android::base::unique_fd fd(open(payload_path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (!fd.ok()) {
+    PLOG(ERROR) << "Failed to open " << payload_path;
+    return false;
+  }
+  std::vector<size_t> chunks;
+  std::vector<base::TimeDelta> times;
+  for (const Event& event : events()) {
+    if (event.type == EventType::kReceivedBytes && event.value > 0) {
+      chunks.push_back(event.value);
+      times.push_back(event.time);
+    }
+  }
+  if (chunks.empty()) {
+    LOG(ERROR) << "The apply trace has no payload chunk to replay.";
+    return false;
+  }
+
+  const base::TimeTicks start_time = base::TimeTicks::Now();
+  std::vector<uint8_t> buffer;
+  off_t offset = 0;
+  for (size_t i = 0;; i++) {
+    const size_t chunk = chunks[std::min(i, chunks.size() - 1)];
+    if (i < times.size() && time_scale > 0) {
+      const auto time = base::TimeDelta::FromMicroseconds(
+          times[i].InMicroseconds() * time_scale);
+      SleepFor(start_time + time - base::TimeTicks::Now());
+    }
+    buffer.resize(chunk);
+    ssize_t bytes_read = 0;
+    TEST_AND_RETURN_FALSE(
+        utils::PReadAll(fd.get(), buffer.data(), chunk, offset, &bytes_read));
+    if (bytes_read == 0) {
+      break;
+    }
+    offset += bytes_read;
+    ErrorCode error = ErrorCode::kSuccess;
+    if (!performer->Write(buffer.data(), bytes_read, &error)) {
+      LOG(ERROR) << "Replaying the chunk " << i << " failed with "
+                 << utils::ErrorCodeToString(error);
+      return false;
+    }
+  }
+  const base::TimeDelta replay_time = base::TimeTicks::Now() - start_time;
+  TEST_AND_RETURN_FALSE(performer->Close() == 0);
+  LOG(INFO) << "Replayed " << offset << " payload bytes in "
+            << replay_time.InMillisecondsF() << " ms, the recorded chunks "
+            << "arrived over " << times.back().InMillisecondsF() << " ms.";
+  return true;
+}
+
+std::vector<ApplyTrace::Event> ApplyTrace::events() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return events_;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,110 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_APPLY_TRACE_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_APPLY_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <base/time/time.h>
+
+namespace chromeos_update_engine {
+
+class DeltaPerformer;
+
+// The timing of an update which matters to the performance of the apply: the
+// size and time of every chunk of payload handed to DeltaPerformer::Write()
+// and the latency of the writes to the target partitions. A trace recorded on
+// a device during a real update is replayed on a test device or on host loop
+// images to reproduce and bisect performance regressions of the apply.
+class ApplyTrace {
+ public:
+  enum class EventType {
+    // |value| is the number of payload bytes received.
+    kReceivedBytes,
+    // |value| is the latency of a write to a target partition in µs.
+    kWriteLatency,
+  };
+
+  struct Event {
+    EventType type;
+    // Since the first event of the trace.
+    base::TimeDelta time;
+    uint64_t value;
+
+    bool operator==(const Event& other) const {
+      return type == other.type && time == other.time && value == other.value;
+    }
+  };
+
+  // Traces longer than this drop their later events, to bound the memory of
+  // a recording.
+  static constexpr size_t kMaxEvents = 1 << 20;
+
+  // The trace the update engine records to or replays, null when there's
+  // none. Not owned.
+  static ApplyTrace* Get();
+  static void Set(ApplyTrace* trace);
+
+  ApplyTrace() = default;
+  ApplyTrace(const ApplyTrace&) = delete;
+  ApplyTrace& operator=(const ApplyTrace&) = delete;
+
+  // Called as the payload bytes arrive and as target writes complete, from
+  // any thread. A recording trace appends them. A replayed trace delays the
+  // write by the time it took less than its recorded sample, so that the
+  // host storage behaves like the one of the device.
+  void OnReceivedBytes(size_t count);
+  void OnWrite(base::TimeDelta latency);
+
+  // Writes the trace as text, one event per line.
+  bool Save(const std::string& path) const;
+  // Loads a trace saved by Save() to replay it.
+  bool Load(const std::string& path);
+
+  // Hands the payload at |payload_path| to |performer| in the chunks of the
+  // trace, each one at its recorded time scaled by |time_scale|, or as fast
+  // as possible if 0, and closes |performer|. The bytes past the chunks of
+  // the trace are handed in chunks of the size of its last one. The trace
+  // must be Set() for the write latencies to be replayed too. Returns false
+  // if |performer| fails.
+  bool Replay(const std::string& payload_path,
+              double time_scale,
+              DeltaPerformer* performer);
+
+  std::vector<Event> events() const;
+  bool replaying() const { return replaying_; }
+
+ private:
+  void Append(EventType type, uint64_t value);
+
+  mutable std::mutex lock_;
+  std::vector<Event> events_;
+  base::TimeTicks start_time_;
+  size_t dropped_events_{0};
+  bool replaying_{false};
+  // The next write latency sample to replay.
+  size_t next_write_{0};
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_APPLY_TRACE_H_
@@ -0,0 +1,98 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/apply_trace.h"
+
+#include <string>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+TEST(ApplyTraceTest, SaveAndLoad) {
+  ApplyTrace trace;
+  trace.OnReceivedBytes(100);
+  trace.OnWrite(base::TimeDelta::FromMicroseconds(250));
+  trace.OnReceivedBytes(200);
+  const auto events = trace.events();
+  ASSERT_EQ(events.size(), 3U);
+  ASSERT_EQ(events[0].type, ApplyTrace::EventType::kReceivedBytes);
+  ASSERT_EQ(events[0].time, base::TimeDelta());
+  ASSERT_EQ(events[1].type, ApplyTrace::EventType::kWriteLatency);
+  ASSERT_EQ(events[1].value, 250U);
+  ASSERT_EQ(events[2].value, 200U);
+  ASSERT_FALSE(trace.replaying());
+
+  ScopedTempFile file("ApplyTraceTest-XXXXXX");
+  ASSERT_TRUE(trace.Save(file.path()));
+  ApplyTrace loaded;
+  ASSERT_TRUE(loaded.Load(file.path()));
+  ASSERT_TRUE(loaded.replaying());
+  // The times are saved in µs.
+  ASSERT_EQ(loaded.events().size(), events.size());
+  for (size_t i = 0; i < events.size(); i++) {
+    ASSERT_EQ(loaded.events()[i].type, events[i].type);
+    ASSERT_EQ(loaded.events()[i].time.InMicroseconds(),
+              events[i].time.InMicroseconds());
+    ASSERT_EQ(loaded.events()[i].value, events[i].value);
+  }
+
+  // A replayed trace doesn't record.
+  loaded.OnReceivedBytes(300);
+  ASSERT_EQ(loaded.events().size(), events.size());
+}
+
+TEST(ApplyTraceTest, LoadRejectsInvalidTraces) {
+  ScopedTempFile file("ApplyTraceTest-XXXXXX");
+  ApplyTrace trace;
+  ASSERT_TRUE(android::base::WriteStringToFile("r 0 100\n", file.path()));
+  ASSERT_FALSE(trace.Load(file.path()));
+  ASSERT_TRUE(android::base::WriteStringToFile("apply_trace 1\nx 0 100\n",
+                                               file.path()));
+  ASSERT_FALSE(trace.Load(file.path()));
+  ASSERT_TRUE(android::base::WriteStringToFile("apply_trace 1\nr -1 100\n",
+                                               file.path()));
+  ASSERT_FALSE(trace.Load(file.path()));
+  ASSERT_TRUE(android::base::WriteStringToFile("apply_trace 1\n", file.path()));
+  ASSERT_TRUE(trace.Load(file.path()));
+  ASSERT_TRUE(trace.events().empty());
+}
+
+TEST(ApplyTraceTest, ReplayDelaysWrites) {
+  ScopedTempFile file("ApplyTraceTest-XXXXXX");
+  ASSERT_TRUE(android::base::WriteStringToFile(
+      "apply_trace 1\nr 0 4096\nw 10 20000\nw 20 10\n", file.path()));
+  ApplyTrace trace;
+  ASSERT_TRUE(trace.Load(file.path()));
+
+  // The first write takes at least the 20 ms it took on the device.
+  auto start = base::TimeTicks::Now();
+  trace.OnWrite(base::TimeDelta::FromMilliseconds(5));
+  ASSERT_GE(base::TimeTicks::Now() - start,
+            base::TimeDelta::FromMilliseconds(15));
+  // The writes slower than on the device, and those past the recorded ones,
+  // aren't delayed.
+  start = base::TimeTicks::Now();
+  trace.OnWrite(base::TimeDelta::FromMilliseconds(5));
+  trace.OnWrite(base::TimeDelta::FromMilliseconds(5));
+  ASSERT_LT(base::TimeTicks::Now() - start,
+            base::TimeDelta::FromMilliseconds(15));
+}
+
+}  // namespace chromeos_update_engine
@@ -14,17 +14,215 @@
 // limitations under the License.
 //
 
-#include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/bzip_extent_writer.h"
 
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/decoder_pool.h"
+
 using google::protobuf::RepeatedPtrField;
 
 namespace chromeos_update_engine {
 
 namespace {
 const brillo::Blob::size_type kOutputBufferLength = 16 * 1024;
+// The most decoded at once into the buffer of the next writer.
+const size_t kMaxInPlaceOutputLength = 1024 * 1024;
+
+// Size of the "BZh" signature and block size digit starting a bzip2 stream.
+constexpr size_t kBzipStreamHeaderSize = 4;
+constexpr uint8_t kBzipHeaderMagic[] = {'B', 'Z', 'h'};
+// The markers starting each block and ending the stream. Only the first block
+// starts on a byte boundary.
+constexpr uint64_t kBzipBlockMagic = 0x314159265359;
+constexpr uint64_t kBzipEndOfStreamMagic = 0x177245385090;
+constexpr size_t kBzipMagicBits = 48;
+constexpr uint64_t kBzipMagicMask = (1ULL << kBzipMagicBits) - 1;
+constexpr size_t kBzipCrcBits = 32;
+
+// Returns the bit of |data| at bit offset |pos|, most significant bit first.
+inline uint8_t ReadBit(const uint8_t* data, uint64_t pos) {
+  return (data[pos / 8] >> (7 - pos % 8)) & 1;
+}
+
+uint64_t ReadBits(const uint8_t* data, uint64_t pos, size_t num_bits) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < num_bits; i++) {
+    value = value << 1 | ReadBit(data, pos + i);
+  }
+  return value;
 }
 
+// Appends bits to a blob, most significant bit first.
+class BitWriter {
+ public:
+  explicit BitWriter(brillo::Blob* out) : out_(out) {}
+
+  // Appends the |num_bits| low bits of |value|, up to 48.
+  void Append(uint64_t value, size_t num_bits) {
+    bits_ = bits_ << num_bits | (value & ((1ULL << num_bits) - 1));
+    num_bits_ += num_bits;
+    while (num_bits_ >= 8) {
+      num_bits_ -= 8;
+      out_->push_back(bits_ >> num_bits_);
+    }
+    bits_ &= (1ULL << num_bits_) - 1;
+  }
+
+  // Appends |num_bits| bits of |data| from bit offset |pos|.
+  void Copy(const uint8_t* data, uint64_t pos, uint64_t num_bits) {
+    const uint8_t* byte = data + pos / 8;
+    const size_t shift = pos % 8;
+    for (; num_bits >= 8; num_bits -= 8, pos += 8, byte++) {
+      Append(shift ? (byte[0] << shift | byte[1] >> (8 - shift)) : byte[0], 8);
+    }
+    Append(ReadBits(data, pos, num_bits), num_bits);
+  }
+
+  // Pads the last byte with zeros.
+  void Flush() {
+    if (num_bits_ > 0) {
+      Append(0, 8 - num_bits_);
+    }
+  }
+
+ private:
+  brillo::Blob* out_;
+  uint64_t bits_{0};
+  size_t num_bits_{0};
+};
+
+// A block of a bzip2 stream.
+struct BzipBlock {
+  // Bit offsets of the block marker, and of the marker following the block.
+  uint64_t start;
+  uint64_t end;
+  uint32_t crc;
+};
+
+// Finds the blocks of the single bzip2 stream in |data|. The block markers may
+// also appear by chance in the compressed data, so the blocks found are only
+// trusted if their CRCs add up to the combined CRC of the stream. Returns false
+// otherwise, or if |data| isn't exactly one complete stream.
+bool FindBzipBlocks(const uint8_t* data,
+                    size_t size,
+                    std::vector<BzipBlock>* blocks) {
+  if (size < kBzipStreamHeaderSize ||
+      memcmp(data, kBzipHeaderMagic, sizeof(kBzipHeaderMagic)) != 0 ||
+      data[3] < '1' || data[3] > '9') {
+    return false;
+  }
+  blocks->clear();
+  const uint64_t first_marker = kBzipStreamHeaderSize * 8;
+  const uint64_t size_bits = static_cast<uint64_t>(size) * 8;
+  uint64_t marker = 0;
+  for (uint64_t pos = first_marker; pos < size_bits; pos++) {
+    marker = (marker << 1 | ReadBit(data, pos)) & kBzipMagicMask;
+    if (pos + 1 < first_marker + kBzipMagicBits ||
+        (marker != kBzipBlockMagic && marker != kBzipEndOfStreamMagic)) {
+      continue;
+    }
+    const uint64_t start = pos + 1 - kBzipMagicBits;
+    if (start + kBzipMagicBits + kBzipCrcBits > size_bits ||
+        (blocks->empty() && start != first_marker)) {
+      return false;
+    }
+    const uint32_t crc = ReadBits(data, start + kBzipMagicBits, kBzipCrcBits);
+    if (!blocks->empty()) {
+      blocks->back().end = start;
+    }
+    if (marker == kBzipBlockMagic) {
+      blocks->push_back({start, 0, crc});
+      continue;
+    }
+    // The end of stream marker is followed by the combined CRC and the
+    // padding of the last byte.
+    if ((start + kBzipMagicBits + kBzipCrcBits + 7) / 8 != size) {
+      return false;
+    }
+    uint32_t combined_crc = 0;
+    for (const auto& block : *blocks) {
+      combined_crc = (combined_crc << 1 | combined_crc >> 31) ^ block.crc;
+    }
+    return combined_crc == crc;
+  }
+  return false;
+}
+
+// Decodes |block| of the bzip2 stream in |data| into |output|. libbz2 doesn't
+// decode individual blocks, so the block is wrapped in a stream of its own,
+// with the header of the original stream and the CRC of the block as the
+// combined CRC.
+bool DecodeBzipBlock(const uint8_t* data,
+                     const BzipBlock& block,
+                     brillo::Blob* output) {
+  brillo::Blob stream(data, data + kBzipStreamHeaderSize);
+  BitWriter stream_writer(&stream);
+  stream_writer.Copy(data, block.start, block.end - block.start);
+  stream_writer.Append(kBzipEndOfStreamMagic, kBzipMagicBits);
+  stream_writer.Append(block.crc, kBzipCrcBits);
+  stream_writer.Flush();
+
+  bz_stream decoder{};
+  decoder.bzalloc = DecoderPool::BzipAlloc;
+  decoder.bzfree = DecoderPool::BzipFree;
+  TEST_AND_RETURN_FALSE(BZ2_bzDecompressInit(&decoder, 0, 0) == BZ_OK);
+  decoder.next_in = reinterpret_cast<char*>(stream.data());
+  decoder.avail_in = stream.size();
+  output->clear();
+  int rc = BZ_OK;
+  while (rc == BZ_OK) {
+    const size_t decoded = output->size();
+    output->resize(std::max(2 * decoded, decoded + kOutputBufferLength));
+    decoder.next_out = reinterpret_cast<char*>(output->data() + decoded);
+    decoder.avail_out = output->size() - decoded;
+    rc = BZ2_bzDecompress(&decoder);
+    output->resize(output->size() - decoder.avail_out);
+    if (rc == BZ_OK && decoder.avail_in == 0 && output->size() == decoded) {
+      break;  // The stream is truncated.
+    }
+  }
+  BZ2_bzDecompressEnd(&decoder);
+  if (rc != BZ_STREAM_END) {
+    LOG(ERROR) << "BZ2_bzDecompress returned " << rc
+               << " decoding the block at bit " << block.start;
+    return false;
+  }
+  return true;
+}
+
+// Decodes |blocks| of the bzip2 stream in |data| on up to |num_threads|
+// threads of |pool|, and writes them in order to |writer|.
+bool DecodeBzipBlocks(const uint8_t* data,
+                      const std::vector<BzipBlock>& blocks,
+                      WorkerPool* pool,
+                      size_t num_threads,
+                      ExtentWriter* writer) {
+  // Blocks are decoded by batches of one block per thread, and written once
+  // the whole batch is decoded.
+  num_threads = std::min({num_threads, pool->num_threads(), blocks.size()});
+  std::vector<brillo::Blob> outputs(num_threads);
+  for (size_t batch_start = 0; batch_start < blocks.size();
+       batch_start += num_threads) {
+    const size_t batch_size =
+        std::min(num_threads, blocks.size() - batch_start);
+    TEST_AND_RETURN_FALSE(pool->ParallelFor(batch_size, [&](size_t i) {
+      return DecodeBzipBlock(data, blocks[batch_start + i], &outputs[i]);
+    }));
+    for (size_t i = 0; i < batch_size; i++) {
+      TEST_AND_RETURN_FALSE(
+          writer->Write(outputs[i].data(), outputs[i].size()));
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
 BzipExtentWriter::~BzipExtentWriter() {
   TEST_AND_RETURN(BZ2_bzDecompressEnd(&stream_) == BZ_OK);
   TEST_AND_RETURN(input_buffer_.empty());
@@ -32,7 +230,9 @@ BzipExtentWriter::~BzipExtentWriter() {
 
 bool BzipExtentWriter::Init(const RepeatedPtrField<Extent>& extents,
                             uint32_t block_size) {
-  // Init bzip2 stream
+  // Init bzip2 stream, with its state cached across operations.
+  stream_.bzalloc = DecoderPool::BzipAlloc;
+  stream_.bzfree = DecoderPool::BzipFree;
   int rc = BZ2_bzDecompressInit(&stream_,
                                 0,   // verbosity. (0 == silent)
                                 0);  // 0 = faster algo, more memory
@@ -43,7 +243,28 @@ bool BzipExtentWriter::Init(const RepeatedPtrField<Extent>& extents,
 }
 
 bool BzipExtentWriter::Write(const void* bytes, size_t count) {
-  brillo::Blob output_buffer(kOutputBufferLength);
+  if (first_write_) {
+    first_write_ = false;
+    std::vector<BzipBlock> blocks;
+    // Blocks can only be found with the whole stream at hand, which is the
+    // case when the operation data is written at once.
+    if (num_threads_ > 1 &&
+        FindBzipBlocks(static_cast<const uint8_t*>(bytes), count, &blocks) &&
+        blocks.size() > 1) {
+      decoded_in_parallel_ = true;
+      return DecodeBzipBlocks(static_cast<const uint8_t*>(bytes),
+                              blocks,
+                              pool_,
+                              num_threads_,
+                              next_.get());
+    }
+  }
+  if (decoded_in_parallel_) {
+    LOG(ERROR) << "Unexpected data after the end of the bzip2 stream.";
+    return false;
+  }
+
+  DecoderPool::ScopedBuffer output_buffer(kOutputBufferLength);
 
   // Copy the input data into |input_buffer_| only if |input_buffer_| already
   // contains unconsumed data. Otherwise, process the data directly from the
@@ -59,21 +280,33 @@ bool BzipExtentWriter::Write(const void* bytes, size_t count) {
   stream_.avail_in = input_end - input;
 
   for (;;) {
-    stream_.next_out = reinterpret_cast<char*>(output_buffer.data());
-    stream_.avail_out = output_buffer.size();
+    // Decode in place when the next writer has a buffer.
+    size_t out_size = kMaxInPlaceOutputLength;
+    uint8_t* out = next_->GetBuffer(&out_size);
+    const bool in_place = out != nullptr;
+    if (!in_place) {
+      out = output_buffer->data();
+      out_size = output_buffer->size();
+    }
+    stream_.next_out = reinterpret_cast<char*>(out);
+    stream_.avail_out = out_size;
 
     int rc = BZ2_bzDecompress(&stream_);
     TEST_AND_RETURN_FALSE(rc == BZ_OK || rc == BZ_STREAM_END);
 
-    if (stream_.avail_out == output_buffer.size())
+    if (stream_.avail_out == out_size)
       break;  // got no new bytes
 
-    TEST_AND_RETURN_FALSE(next_->Write(
-        output_buffer.data(), output_buffer.size() - stream_.avail_out));
+    const size_t produced = out_size - stream_.avail_out;
+    TEST_AND_RETURN_FALSE(in_place ? next_->CommitBuffer(produced)
+                                   : next_->Write(out, produced));
 
     if (rc == BZ_STREAM_END)
       CHECK_EQ(stream_.avail_in, 0u);
-    if (stream_.avail_in == 0)
+    // A full buffer, possibly a small one in place, may leave decoded data
+    // behind even once the input is consumed.
+    if (rc == BZ_STREAM_END ||
+        (stream_.avail_in == 0 && stream_.avail_out > 0))
       break;  // no more input to process
   }
 
@@ -24,6 +24,7 @@
 #include <brillo/secure_blob.h>
 
 #include "update_engine/payload_consumer/extent_writer.h"
+#include "update_engine/payload_consumer/worker_pool.h"
 
 // BzipExtentWriter is a concrete ExtentWriter subclass that bzip-decompresses
 // what it's given in Write. It passes the decompressed data to an underlying
@@ -34,7 +35,16 @@ namespace chromeos_update_engine {
 class BzipExtentWriter : public ExtentWriter {
  public:
   explicit BzipExtentWriter(std::unique_ptr<ExtentWriter> next)
-      : next_(std::move(next)) {
+      : BzipExtentWriter(std::move(next), nullptr, 1) {}
+  // When the whole stream is passed to the first Write() and it is made of
+  // several blocks, the blocks are decoded on up to |num_threads| threads of
+  // |pool|, which must outlive this writer.
+  BzipExtentWriter(std::unique_ptr<ExtentWriter> next,
+                   WorkerPool* pool,
+                   size_t num_threads)
+      : next_(std::move(next)),
+        pool_(pool),
+        num_threads_(pool ? num_threads : 1) {
     memset(&stream_, 0, sizeof(stream_));
   }
   ~BzipExtentWriter() override;
@@ -47,6 +57,11 @@ class BzipExtentWriter : public ExtentWriter {
   std::unique_ptr<ExtentWriter> next_;  // The underlying ExtentWriter.
   bz_stream stream_{};                  // the libbz2 stream
   brillo::Blob input_buffer_;
+  WorkerPool* pool_;
+  size_t num_threads_;
+  bool first_write_{true};
+  // Whether the whole stream was decoded by blocks in the first Write().
+  bool decoded_in_parallel_{false};
 };
 
 }  // namespace chromeos_update_engine
@@ -16,7 +16,9 @@
 
 #include "update_engine/payload_consumer/bzip_extent_writer.h"
 
+#include <bzlib.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <memory>
@@ -111,4 +113,71 @@ TEST_F(BzipExtentWriterTest, ChunkedTest) {
   test_utils::ExpectVectorsEq(decompressed_data, output);
 }
 
+TEST_F(BzipExtentWriterTest, ParallelTest) {
+  // Enough pseudo-random text for several blocks of 100 KB.
+  brillo::Blob data(1024 * 1024);
+  uint32_t seed = 1;
+  for (size_t i = 0; i < data.size(); i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = "abcdefgh \n"[(seed >> 16) % 10];
+  }
+  brillo::Blob compressed(data.size() + data.size() / 100 + 600);
+  unsigned int compressed_size = compressed.size();
+  ASSERT_EQ(BZ_OK,
+            BZ2_bzBuffToBuffCompress(reinterpret_cast<char*>(compressed.data()),
+                                     &compressed_size,
+                                     reinterpret_cast<char*>(data.data()),
+                                     data.size(),
+                                     1,    // 100 KB blocks.
+                                     0,    // verbosity
+                                     0));  // default work factor
+  compressed.resize(compressed_size);
+
+  vector<Extent> extents = {ExtentForBytes(kBlockSize, 0, data.size())};
+  for (size_t num_threads : {1, 3, 16}) {
+    // Written at once, or in chunks which are decoded serially.
+    for (size_t chunk_size : {compressed.size(), size_t{1000}}) {
+      ASSERT_EQ(0, ftruncate(fd_->Fd(), 0));
+      WorkerPool pool(num_threads);
+      BzipExtentWriter bzip_writer(
+          std::make_unique<DirectExtentWriter>(fd_), &pool, num_threads);
+      ASSERT_TRUE(
+          bzip_writer.Init({extents.begin(), extents.end()}, kBlockSize));
+      for (size_t i = 0; i < compressed.size(); i += chunk_size) {
+        ASSERT_TRUE(bzip_writer.Write(
+            &compressed[i], min(chunk_size, compressed.size() - i)));
+      }
+      brillo::Blob output;
+      ASSERT_TRUE(utils::ReadFile(temp_file_.path(), &output));
+      test_utils::ExpectVectorsEq(data, output);
+    }
+  }
+}
+
+TEST_F(BzipExtentWriterTest, ParallelCorruptedTest) {
+  brillo::Blob data(512 * 1024);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = (i * i) >> 7;
+  }
+  brillo::Blob compressed(data.size() + data.size() / 100 + 600);
+  unsigned int compressed_size = compressed.size();
+  ASSERT_EQ(BZ_OK,
+            BZ2_bzBuffToBuffCompress(reinterpret_cast<char*>(compressed.data()),
+                                     &compressed_size,
+                                     reinterpret_cast<char*>(data.data()),
+                                     data.size(),
+                                     1,
+                                     0,
+                                     0));
+  compressed.resize(compressed_size);
+  compressed[compressed.size() / 2] ^= 0x10;
+
+  vector<Extent> extents = {ExtentForBytes(kBlockSize, 0, data.size())};
+  WorkerPool pool(4);
+  BzipExtentWriter bzip_writer(
+      std::make_unique<DirectExtentWriter>(fd_), &pool, 4);
+  ASSERT_TRUE(bzip_writer.Init({extents.begin(), extents.end()}, kBlockSize));
+  ASSERT_FALSE(bzip_writer.Write(compressed.data(), compressed.size()));
+}
+
 }  // namespace chromeos_update_engine
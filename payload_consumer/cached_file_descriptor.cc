@@ -16,6 +16,7 @@
 
 #include "update_engine/payload_consumer/cached_file_descriptor.h"
 
+#include <string.h>
 #include <unistd.h>
 
 #include <algorithm>
@@ -26,76 +27,254 @@
 
 namespace chromeos_update_engine {
 
+CachedFileDescriptorBase::~CachedFileDescriptorBase() {
+  StopWriter();
+}
+
 off64_t CachedFileDescriptorBase::Seek(off64_t offset, int whence) {
   // Only support SEEK_SET and SEEK_CUR. I think these two would be enough. If
   // we want to support SEEK_END then we have to figure out the size of the
   // underlying file descriptor each time and it may not be a very good idea.
   CHECK(whence == SEEK_SET || whence == SEEK_CUR);
-  off64_t next_offset = whence == SEEK_SET ? offset : offset_ + offset;
+  // The following writes start a new range of the cache, the underlying
+  // descriptor is positioned when the cache is written.
+  offset_ = whence == SEEK_SET ? offset : offset_ + offset;
+  return offset_;
+}
 
-  if (next_offset != offset_) {
-    // We sought somewhere other than what we are now. So we have to flush and
-    // move to the new offset.
-    if (!FlushCache()) {
-      return -1;
-    }
-    // Then we have to seek there.
-    if (GetFd()->Seek(next_offset, SEEK_SET) < 0) {
-      return -1;
-    }
-    offset_ = next_offset;
+ssize_t CachedFileDescriptorBase::Read(void* buf, size_t count) {
+  // The cache may hold newer data for the range read.
+  if (!FlushCache() || GetFd()->Seek(offset_, SEEK_SET) < 0) {
+    return -1;
   }
-  return offset_;
+  ssize_t bytes_read = GetFd()->Read(buf, count);
+  if (bytes_read > 0) {
+    offset_ += bytes_read;
+  }
+  return bytes_read;
 }
 
 ssize_t CachedFileDescriptorBase::Write(const void* buf, size_t count) {
+  if (!CheckWriteError()) {
+    return -1;
+  }
   auto bytes = static_cast<const uint8_t*>(buf);
   size_t total_bytes_wrote = 0;
   while (total_bytes_wrote < count) {
     auto bytes_to_cache =
         std::min(count - total_bytes_wrote, cache_.size() - bytes_cached_);
-    if (bytes_to_cache > 0) {  // Which means |cache_| is still have some space.
-      memcpy(cache_.data() + bytes_cached_,
-             bytes + total_bytes_wrote,
-             bytes_to_cache);
-      total_bytes_wrote += bytes_to_cache;
-      bytes_cached_ += bytes_to_cache;
-    }
-    if (bytes_cached_ == cache_.size()) {
-      // Cache is full; write it to the |fd_| as long as you can.
-      if (!FlushCache()) {
-        return -1;
-      }
+    memcpy(cache_.data() + bytes_cached_,
+           bytes + total_bytes_wrote,
+           bytes_to_cache);
+    if (!AddCached(bytes_to_cache)) {
+      return -1;
     }
+    total_bytes_wrote += bytes_to_cache;
   }
-  offset_ += total_bytes_wrote;
   return total_bytes_wrote;
 }
 
+uint8_t* CachedFileDescriptorBase::GetWriteBuffer(size_t* size) {
+  if (!CheckWriteError()) {
+    return nullptr;
+  }
+  *size = std::min(*size, cache_.size() - bytes_cached_);
+  return *size > 0 ? cache_.data() + bytes_cached_ : nullptr;
+}
+
+bool CachedFileDescriptorBase::CommitWriteBuffer(size_t count) {
+  DCHECK_LE(count, cache_.size() - bytes_cached_);
+  return AddCached(count);
+}
+
+bool CachedFileDescriptorBase::AddCached(size_t count) {
+  if (count > 0) {
+    if (ranges_.empty() ||
+        ranges_.back().offset + static_cast<off64_t>(ranges_.back().size) !=
+            offset_) {
+      ranges_.push_back({offset_, 0});
+    }
+    bytes_cached_ += count;
+    ranges_.back().size += count;
+    offset_ += count;
+  }
+  // Once full, the cache is written, leaving room for the next bytes.
+  return bytes_cached_ < cache_.size() || WriteFullCache();
+}
+
+void CachedFileDescriptorBase::SetWriteUnit(size_t write_unit) {
+  DCHECK_EQ(bytes_cached_, 0U);
+  write_unit_ = write_unit <= cache_.size() / 2 ? write_unit : 0;
+}
+
 bool CachedFileDescriptorBase::Flush() {
   return FlushCache() && GetFd()->Flush();
 }
 
 bool CachedFileDescriptorBase::Close() {
   offset_ = 0;
-  return FlushCache() && GetFd()->Close();
+  const bool flushed = FlushCache();
+  StopWriter();
+  // Start afresh if the descriptor is reopened.
+  bytes_cached_ = 0;
+  ranges_.clear();
+  write_failed_ = false;
+  return flushed && GetFd()->Close();
 }
 
 bool CachedFileDescriptorBase::FlushCache() {
-  size_t begin = 0;
-  while (begin < bytes_cached_) {
-    auto bytes_wrote =
-        GetFd()->Write(cache_.data() + begin, bytes_cached_ - begin);
-    if (bytes_wrote < 0) {
+  if (num_buffers_ > 1) {
+    return (bytes_cached_ == 0 || SubmitCache()) && WaitForWrites();
+  }
+  if (!WriteCache(cache_.data(), ranges_)) {
+    return false;
+  }
+  bytes_cached_ = 0;
+  ranges_.clear();
+  return true;
+}
+
+bool CachedFileDescriptorBase::WriteCache(
+    const uint8_t* data, const std::vector<CachedRange>& ranges) {
+  FileDescriptor* fd = GetFd();
+  const int raw_fd = fd->Fd();
+  for (const auto& range : ranges) {
+    // pwrite() saves seeking the descriptor for every range.
+    const bool success =
+        raw_fd >= 0
+            ? utils::PWriteAll(raw_fd, data, range.size, range.offset)
+            : fd->Seek(range.offset, SEEK_SET) >= 0 &&
+                  utils::WriteAll(fd, data, range.size);
+    if (!success) {
       PLOG(ERROR) << "Failed to flush cached data!";
       return false;
     }
-    begin += bytes_wrote;
+    data += range.size;
   }
+  return true;
+}
+
+bool CachedFileDescriptorBase::WriteFullCache() {
+  // The write ending the cache ended at |offset_|.
+  const size_t keep =
+      write_unit_ > 1
+          ? std::min<size_t>(offset_ % write_unit_, ranges_.back().size)
+          : 0;
+  if (keep == 0) {
+    return num_buffers_ > 1 ? SubmitCache() : FlushCache();
+  }
+  ranges_.back().size -= keep;
+  if (ranges_.back().size == 0) {
+    ranges_.pop_back();
+  }
+  bytes_cached_ -= keep;
+  if (num_buffers_ > 1) {
+    TEST_AND_RETURN_FALSE(SubmitCache(keep));
+  } else {
+    TEST_AND_RETURN_FALSE(WriteCache(cache_.data(), ranges_));
+    memmove(cache_.data(), cache_.data() + bytes_cached_, keep);
+  }
+  ranges_.assign(1, {offset_ - static_cast<off64_t>(keep), keep});
+  bytes_cached_ = keep;
+  return true;
+}
+
+bool CachedFileDescriptorBase::SubmitCache(size_t keep) {
+  const size_t cache_size = cache_.size();
+  std::unique_lock<std::mutex> lock(mutex_);
+  AlignedBuffer next_cache;
+  if (free_buffers_.empty() && num_buffers_allocated_ < num_buffers_) {
+    num_buffers_allocated_++;
+    next_cache = AlignedBufferPool::Get()->Acquire(cache_size);
+  } else {
+    // All the buffers are queued, wait for the oldest one to be written.
+    cond_.wait(lock,
+               [this] { return !free_buffers_.empty() || write_failed_; });
+    if (write_failed_) {
+      errno = write_errno_;
+      return false;
+    }
+    next_cache = std::move(free_buffers_.back());
+    free_buffers_.pop_back();
+  }
+  if (!writer_.joinable()) {
+    writer_ = std::thread(&CachedFileDescriptorBase::WriterLoop, this);
+  }
+  memcpy(next_cache.data(), cache_.data() + bytes_cached_, keep);
+  pending_writes_.push_back({std::move(cache_), std::move(ranges_)});
+  cache_ = std::move(next_cache);
   bytes_cached_ = 0;
+  ranges_.clear();
+  cond_.notify_all();
   return true;
 }
 
+bool CachedFileDescriptorBase::WaitForWrites() {
+  if (num_buffers_ == 1) {
+    return true;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait(lock, [this] { return pending_writes_.empty() && !writing_; });
+  if (write_failed_) {
+    errno = write_errno_;
+    return false;
+  }
+  return true;
+}
+
+bool CachedFileDescriptorBase::CheckWriteError() {
+  if (num_buffers_ == 1) {
+    return true;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (write_failed_) {
+    errno = write_errno_;
+    return false;
+  }
+  return true;
+}
+
+void CachedFileDescriptorBase::WriterLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cond_.wait(lock,
+               [this] { return stop_writer_ || !pending_writes_.empty(); });
+    if (pending_writes_.empty()) {
+      return;
+    }
+    PendingWrite write = std::move(pending_writes_.front());
+    pending_writes_.pop_front();
+    // The data following a failed write is dropped, the file content is wrong
+    // anyway.
+    const bool skip = write_failed_;
+    writing_ = true;
+    lock.unlock();
+    const bool success = skip || WriteCache(write.data.data(), write.ranges);
+    const int write_errno = errno;
+    lock.lock();
+    writing_ = false;
+    if (!success) {
+      write_failed_ = true;
+      write_errno_ = write_errno;
+    }
+    free_buffers_.push_back(std::move(write.data));
+    cond_.notify_all();
+  }
+}
+
+void CachedFileDescriptorBase::StopWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!writer_.joinable()) {
+      return;
+    }
+    stop_writer_ = true;
+  }
+  cond_.notify_all();
+  writer_.join();
+  stop_writer_ = false;
+}
+
 void UnownedCachedFileDescriptor::SetFD(FileDescriptor* fd) {
   fd_ = fd;
 }
@@ -20,19 +20,45 @@
 #include <errno.h>
 #include <sys/types.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
-#include <brillo/secure_blob.h>
-
+#include "update_engine/payload_consumer/aligned_buffer_pool.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
 
 namespace chromeos_update_engine {
 
+// Caches the writes to a FileDescriptor, writing them once the cache is full
+// or the content of the file is needed. Seeking doesn't write the cache: the
+// writes to different offsets are gathered as separate ranges of the cache,
+// and writes continuing the previous one extend its range, so that written
+// extents that are adjacent in the file, e.g. from consecutive operations, are
+// written at once. Each range is written with a single pwrite() when the
+// underlying descriptor exposes its fd.
+//
+// With |num_buffers| > 1, a full cache is handed to a background thread
+// writing it while the next of the |num_buffers| caches fills up, so that
+// producing the data overlaps with writing it. A failure of a background write
+// is returned by the following calls, and the file content past it isn't
+// written. The caches come from the AlignedBufferPool.
+//
+// With a write unit set, e.g. the optimal I/O size of a flash device, a full
+// cache is written without the end of its last range past a boundary of the
+// unit, which stays cached: the next writes likely continue that range, so
+// that the device gets written in whole units instead of writes straddling
+// the boundaries of its program units. The cache is still fully written
+// whenever the content of the file is needed.
 class CachedFileDescriptorBase : public FileDescriptor {
  public:
-  explicit CachedFileDescriptorBase(size_t cache_size) : cache_(cache_size) {}
-  ~CachedFileDescriptorBase() override = default;
+  explicit CachedFileDescriptorBase(size_t cache_size, size_t num_buffers = 1)
+      : cache_(AlignedBufferPool::Get()->Acquire(cache_size)),
+        num_buffers_(std::max<size_t>(num_buffers, 1)) {}
+  ~CachedFileDescriptorBase() override;
 
   bool Open(const char* path, int flags, mode_t mode) override {
     return GetFd()->Open(path, flags, mode);
@@ -40,9 +66,7 @@ class CachedFileDescriptorBase : public FileDescriptor {
   bool Open(const char* path, int flags) override {
     return GetFd()->Open(path, flags);
   }
-  ssize_t Read(void* buf, size_t count) override {
-    return GetFd()->Read(buf, count);
-  }
+  ssize_t Read(void* buf, size_t count) override;
   ssize_t Write(const void* buf, size_t count) override;
   off64_t Seek(off64_t offset, int whence) override;
   uint64_t BlockDevSize() override { return GetFd()->BlockDevSize(); }
@@ -50,31 +74,101 @@ class CachedFileDescriptorBase : public FileDescriptor {
                 uint64_t start,
                 uint64_t length,
                 int* result) override {
-    return GetFd()->BlkIoctl(request, start, length, result);
+    return FlushCache() && GetFd()->BlkIoctl(request, start, length, result);
   }
   bool Flush() override;
+  bool StartFlush() override { return FlushCache() && GetFd()->StartFlush(); }
+  // The buffer is the free space of the cache.
+  uint8_t* GetWriteBuffer(size_t* size) override;
+  bool CommitWriteBuffer(size_t count) override;
   bool Close() override;
   bool IsSettingErrno() override { return GetFd()->IsSettingErrno(); }
   bool IsOpen() override { return GetFd()->IsOpen(); }
 
+  // Sets the write unit, in bytes, before anything is written. Units larger
+  // than half the cache are ignored.
+  void SetWriteUnit(size_t write_unit);
+
  protected:
   virtual FileDescriptor* GetFd() = 0;
 
+  // Writes the pending background writes and stops the background thread.
+  // Classes defining GetFd() must call it before destroying the descriptor it
+  // returns.
+  void StopWriter();
+
  private:
+  // A range of the file, cached contiguously after the previous range.
+  struct CachedRange {
+    off64_t offset;
+    size_t size;
+  };
+
+  struct PendingWrite {
+    AlignedBuffer data;
+    std::vector<CachedRange> ranges;
+  };
+
+  // Records the |count| bytes copied past the |bytes_cached_| ones as written
+  // at |offset_|, and writes the cache once full.
+  bool AddCached(size_t count);
+
   // Internal flush without the need to call |fd_->Flush()|.
   bool FlushCache();
 
-  brillo::Blob cache_;
+  // Writes the |ranges| of the file cached in |data| to the file descriptor.
+  bool WriteCache(const uint8_t* data, const std::vector<CachedRange>& ranges);
+
+  // Writes the full |cache_|, keeping its end past the last boundary of the
+  // write unit cached.
+  bool WriteFullCache();
+
+  // Hands |cache_| over to the background thread, replacing it with a free
+  // buffer. The |keep| bytes following the |bytes_cached_| ones are copied to
+  // the start of the new buffer.
+  bool SubmitCache(size_t keep = 0);
+
+  // Waits for the background writes to complete. Returns false, with errno
+  // set, if one of them failed.
+  bool WaitForWrites();
+
+  // Returns false, with errno set, if a background write failed.
+  bool CheckWriteError();
+
+  void WriterLoop();
+
+  AlignedBuffer cache_;
   size_t bytes_cached_{0};
+  // The ranges of the file cached in |cache_|, in order.
+  std::vector<CachedRange> ranges_;
   off64_t offset_{0};
+  size_t write_unit_{0};
+
+  // The caches handed over to the background thread |writer_|, in order, and
+  // the buffers written since.
+  const size_t num_buffers_;
+  size_t num_buffers_allocated_{1};
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<PendingWrite> pending_writes_;
+  std::vector<AlignedBuffer> free_buffers_;
+  bool writing_{false};
+  bool stop_writer_{false};
+  // Set, with the errno of the failure, once a background write failed.
+  bool write_failed_{false};
+  int write_errno_{0};
+  std::thread writer_;
 
   DISALLOW_COPY_AND_ASSIGN(CachedFileDescriptorBase);
 };
 
 class CachedFileDescriptor final : public CachedFileDescriptorBase {
  public:
-  CachedFileDescriptor(FileDescriptorPtr fd, size_t cache_size)
-      : CachedFileDescriptorBase(cache_size), fd_(fd) {}
+  CachedFileDescriptor(FileDescriptorPtr fd,
+                       size_t cache_size,
+                       size_t num_buffers = 1)
+      : CachedFileDescriptorBase(cache_size, num_buffers), fd_(fd) {}
+  ~CachedFileDescriptor() override { StopWriter(); }
 
  protected:
   virtual FileDescriptor* GetFd() { return fd_.get(); }
@@ -85,6 +179,7 @@ class UnownedCachedFileDescriptor final : public CachedFileDescriptorBase {
  public:
   UnownedCachedFileDescriptor(FileDescriptor* fd, size_t cache_size)
       : CachedFileDescriptorBase(cache_size), fd_(fd) {}
+  ~UnownedCachedFileDescriptor() override { StopWriter(); }
   // used for EnocdeFEC
   void SetFD(FileDescriptor* fd);
 
@@ -43,7 +43,7 @@ const size_t kRandomIterations = 1000;
 class CachedFileDescriptorTest : public ::testing::Test {
  public:
   void Open() {
-    cfd_.reset(new CachedFileDescriptor(fd_, kCacheSize));
+    cfd_.reset(new CachedFileDescriptor(fd_, kCacheSize, num_buffers_));
     EXPECT_TRUE(cfd_->Open(temp_file_.path().c_str(), O_RDWR, 0600));
   }
 
@@ -75,9 +75,16 @@ class CachedFileDescriptorTest : public ::testing::Test {
   FileDescriptorPtr fd_{new EintrSafeFileDescriptor};
   ScopedTempFile temp_file_{"CachedFileDescriptor-file.XXXXXX"};
   int value_{1};
+  size_t num_buffers_{1};
   FileDescriptorPtr cfd_;
 };
 
+// Writes full caches in the background.
+class AsyncCachedFileDescriptorTest : public CachedFileDescriptorTest {
+ public:
+  AsyncCachedFileDescriptorTest() { num_buffers_ = 3; }
+};
+
 TEST_F(CachedFileDescriptorTest, IsOpenTest) {
   EXPECT_TRUE(cfd_->IsOpen());
 }
@@ -168,6 +175,31 @@ TEST_F(CachedFileDescriptorTest, CacheSizeWriteTest) {
   EXPECT_EQ(blob_in, blob_out);
 }
 
+TEST_F(CachedFileDescriptorTest, WriteUnitTest) {
+  const size_t kWriteUnit = 32;
+  static_cast<CachedFileDescriptor*>(cfd_.get())->SetWriteUnit(kWriteUnit);
+  off64_t seek = 10;
+  brillo::Blob blob_in(kFileSize, 0);
+  std::fill_n(&blob_in[seek], kCacheSize, value_);
+  EXPECT_EQ(cfd_->Seek(seek, SEEK_SET), seek);
+  Write(&blob_in[seek], kCacheSize);
+
+  // The end of the cache past the last boundary of the write unit is kept.
+  const size_t written_end = (seek + kCacheSize) / kWriteUnit * kWriteUnit;
+  brillo::Blob blob_expected(kFileSize, 0);
+  std::fill(&blob_expected[seek], &blob_expected[written_end], value_);
+  brillo::Blob blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_expected, blob_out);
+
+  // Continuing the write starts from that boundary.
+  std::fill_n(&blob_in[seek + kCacheSize], kCacheSize, value_);
+  Write(&blob_in[seek + kCacheSize], kCacheSize);
+  EXPECT_TRUE(cfd_->Flush());
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+}
+
 TEST_F(CachedFileDescriptorTest, UnderCacheSizeWriteTest) {
   off64_t seek = 100;
   size_t less_than_cache_size = kCacheSize - 1;
@@ -184,6 +216,19 @@ TEST_F(CachedFileDescriptorTest, UnderCacheSizeWriteTest) {
   EXPECT_EQ(blob_in, blob_out);
 }
 
+TEST_F(CachedFileDescriptorTest, StartFlushTest) {
+  off64_t seek = 100;
+  EXPECT_EQ(cfd_->Seek(seek, SEEK_SET), seek);
+  brillo::Blob blob_in(kFileSize, 0);
+  std::fill_n(&blob_in[seek], kCacheSize / 2, value_);
+  Write(&blob_in[seek], kCacheSize / 2);
+  // Starting the flush writes the cache.
+  EXPECT_TRUE(cfd_->StartFlush());
+  brillo::Blob blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+}
+
 TEST_F(CachedFileDescriptorTest, SeekAfterWriteTest) {
   off64_t seek = 100;
   size_t less_than_cache_size = kCacheSize - 3;
@@ -193,12 +238,129 @@ TEST_F(CachedFileDescriptorTest, SeekAfterWriteTest) {
   // We are writing less than  one cache size; then it should not be committed.
   Write(&blob_in[seek], less_than_cache_size);
 
-  // Then we seek, it should've written the cache after seek.
-  EXPECT_EQ(cfd_->Seek(200, SEEK_SET), 200);
+  // Seeking doesn't commit the cache either.
+  EXPECT_EQ(cfd_->Seek(500, SEEK_SET), 500);
+  brillo::Blob blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(brillo::Blob(kFileSize, 0), blob_out);
+
+  // Filling the cache at the new offset commits both ranges.
+  std::fill_n(&blob_in[500], 3, value_);
+  Write(&blob_in[500], 3);
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+}
+
+TEST_F(CachedFileDescriptorTest, WriteBufferTest) {
+  brillo::Blob blob_in(kFileSize);
+  test_utils::FillWithData(&blob_in);
+  EXPECT_EQ(cfd_->Seek(0, SEEK_SET), 0);
+  size_t offset = 0;
+  while (offset < blob_in.size()) {
+    // Buffers never span past the end of the cache.
+    size_t size = std::min<size_t>(7, blob_in.size() - offset);
+    uint8_t* buffer = cfd_->GetWriteBuffer(&size);
+    ASSERT_NE(buffer, nullptr);
+    ASSERT_GT(size, 0U);
+    ASSERT_LE(size, kCacheSize);
+    memcpy(buffer, blob_in.data() + offset, size);
+    ASSERT_TRUE(cfd_->CommitWriteBuffer(size));
+    offset += size;
+  }
+  EXPECT_TRUE(cfd_->Flush());
+
+  brillo::Blob blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+}
+
+TEST_F(CachedFileDescriptorTest, ReadAfterWriteTest) {
+  brillo::Blob blob_in(kCacheSize / 2, value_);
+  EXPECT_EQ(cfd_->Seek(10, SEEK_SET), 10);
+  Write(blob_in.data(), blob_in.size());
+  EXPECT_EQ(cfd_->Seek(500, SEEK_SET), 500);
+  Write(blob_in.data(), 1);
+
+  // Reads see the cached data, and move the position.
+  brillo::Blob blob_out(blob_in.size());
+  EXPECT_EQ(cfd_->Seek(10, SEEK_SET), 10);
+  EXPECT_EQ(cfd_->Read(blob_out.data(), blob_out.size()),
+            static_cast<ssize_t>(blob_out.size()));
+  EXPECT_EQ(blob_in, blob_out);
+  EXPECT_EQ(cfd_->Seek(0, SEEK_CUR),
+            static_cast<off64_t>(10 + blob_out.size()));
+}
+
+TEST_F(AsyncCachedFileDescriptorTest, RandomWriteTest) {
+  brillo::Blob blob_in(kFileSize, 0);
+  uint32_t rand_seed = time(nullptr);
+  for (size_t idx = 0; idx < kRandomIterations; idx++) {
+    size_t start = rand_r(&rand_seed) % blob_in.size();
+    size_t size = rand_r(&rand_seed) % (blob_in.size() - start);
+    std::fill_n(&blob_in[start], size, idx % 256);
+    EXPECT_EQ(cfd_->Seek(start, SEEK_SET), static_cast<off64_t>(start));
+    Write(&blob_in[start], size);
+  }
+  EXPECT_TRUE(cfd_->Flush());
+
+  brillo::Blob blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+}
+
+TEST_F(AsyncCachedFileDescriptorTest, SequentialWriteTest) {
+  EXPECT_EQ(cfd_->Seek(0, SEEK_SET), 0);
+  brillo::Blob blob_in(kFileSize);
+  test_utils::FillWithData(&blob_in);
+  // Writes of odd sizes, spanning several caches.
+  for (size_t idx = 0; idx < blob_in.size(); idx += 7) {
+    Write(&blob_in[idx], min<size_t>(7, blob_in.size() - idx));
+  }
+  // Reads see the data written so far.
+  brillo::Blob read_back(1);
+  EXPECT_EQ(cfd_->Seek(0, SEEK_SET), 0);
+  EXPECT_EQ(cfd_->Read(read_back.data(), read_back.size()), 1);
+  EXPECT_EQ(blob_in[0], read_back[0]);
+  EXPECT_TRUE(cfd_->Flush());
 
   brillo::Blob blob_out;
   EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
   EXPECT_EQ(blob_in, blob_out);
 }
 
+TEST_F(AsyncCachedFileDescriptorTest, WriteUnitTest) {
+  static_cast<CachedFileDescriptor*>(cfd_.get())->SetWriteUnit(32);
+  brillo::Blob blob_in(kFileSize, 0);
+  for (size_t i = 0; i < kFileSize; i++) {
+    blob_in[i] = i % 251 + 1;
+  }
+  // Writes of various sizes, ending the caches anywhere in the write units.
+  off64_t seek = 3;
+  EXPECT_EQ(cfd_->Seek(seek, SEEK_SET), seek);
+  for (size_t size = 1; seek < static_cast<off64_t>(kFileSize); size += 7) {
+    size = min<size_t>(size, kFileSize - seek);
+    Write(&blob_in[seek], size);
+    seek += size;
+  }
+  EXPECT_TRUE(cfd_->Flush());
+  std::fill_n(blob_in.begin(), 3, 0);
+  brillo::Blob blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+}
+
+TEST_F(AsyncCachedFileDescriptorTest, WriteErrorTest) {
+  FileDescriptorPtr read_only_fd(new EintrSafeFileDescriptor);
+  CachedFileDescriptor cfd(read_only_fd, kCacheSize, num_buffers_);
+  ASSERT_TRUE(cfd.Open(temp_file_.path().c_str(), O_RDONLY));
+  brillo::Blob blob_in(kCacheSize, value_);
+  // The first full cache is written in the background.
+  EXPECT_EQ(cfd.Write(blob_in.data(), blob_in.size()),
+            static_cast<ssize_t>(blob_in.size()));
+  EXPECT_FALSE(cfd.Flush());
+  // The failure is reported until the descriptor is closed.
+  EXPECT_EQ(cfd.Write(blob_in.data(), blob_in.size()), -1);
+  EXPECT_FALSE(cfd.Close());
+}
+
 }  // namespace chromeos_update_engine
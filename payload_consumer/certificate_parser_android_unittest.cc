@@ -58,4 +58,19 @@ TEST(CertificateParserAndroidTest, VerifySignature) {
   ASSERT_TRUE(verifier->VerifyRawSignature(sig_blob, hash_blob, nullptr));
 }
 
+TEST(CertificateParserAndroidTest, CachedKeysFollowZipChanges) {
+  brillo::Blob zip;
+  ASSERT_TRUE(utils::ReadFile(
+      test_utils::GetBuildArtifactsPath(kUnittestOtacertsPath), &zip));
+  ScopedTempFile zip_file("otacerts.XXXXXX");
+  const std::string& path = zip_file.path();
+  ASSERT_TRUE(utils::WriteFile(path.c_str(), zip.data(), zip.size()));
+  ASSERT_NE(nullptr, PayloadVerifier::CreateInstanceFromZipPath(path));
+  ASSERT_NE(nullptr, PayloadVerifier::CreateInstanceFromZipPath(path));
+
+  // The keys kept from the previous zip file aren't used anymore.
+  ASSERT_TRUE(utils::WriteFile(path.c_str(), "not a zip", 9));
+  ASSERT_EQ(nullptr, PayloadVerifier::CreateInstanceFromZipPath(path));
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,69 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/checkpoint_scheduler.h"
+
+#include <algorithm>
+
+namespace chromeos_update_engine {
+
+namespace {
+// Weight of the latest measurement in the moving averages.
+constexpr double kSmoothing = 0.25;
+
+void UpdateAverage(double value, double* average) {
+  *average =
+      *average < 0 ? value : kSmoothing * value + (1 - kSmoothing) * *average;
+}
+}  // namespace
+
+constexpr double CheckpointScheduler::kMaxOverhead;
+constexpr uint64_t CheckpointScheduler::kMaxRedoBytes;
+
+void CheckpointScheduler::SetBounds(base::TimeDelta min_interval,
+                                    base::TimeDelta max_interval) {
+  min_interval_ = min_interval;
+  max_interval_ = std::max(min_interval, max_interval);
+}
+
+void CheckpointScheduler::OnCheckpoint(base::TimeDelta latency,
+                                       base::TimeDelta elapsed,
+                                       uint64_t data_bytes) {
+  UpdateAverage(latency.InSecondsF(), &latency_);
+  // Without data applied in between there is nothing to learn about the
+  // throughput, e.g. for the checkpoints forced at the end of the update.
+  if (data_bytes > 0 && elapsed > base::TimeDelta()) {
+    UpdateAverage(data_bytes / elapsed.InSecondsF(), &throughput_);
+  }
+}
+
+base::TimeDelta CheckpointScheduler::interval() const {
+  if (latency_ < 0) {
+    return min_interval_;
+  }
+  double seconds = max_interval_.InSecondsF();
+  if (throughput_ > 0) {
+    seconds = std::min(seconds, kMaxRedoBytes / throughput_);
+  }
+  // The overhead bound wins over the redo one, the checkpoints mustn't slow
+  // down the update much on slow storage.
+  seconds = std::max(seconds, latency_ / kMaxOverhead);
+  return std::clamp(base::TimeDelta::FromSecondsD(seconds),
+                    min_interval_,
+                    max_interval_);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,66 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_CHECKPOINT_SCHEDULER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_CHECKPOINT_SCHEDULER_H_
+
+#include <stdint.h>
+
+#include <base/macros.h>
+#include <base/time/time.h>
+
+namespace chromeos_update_engine {
+
+// Picks the interval between the checkpoints of the update progress from
+// how long storing them takes and how fast the payload data is applied on
+// this device: as long as an interruption redoes at most kMaxRedoBytes of
+// payload data, but long enough for the checkpoints to take at most
+// kMaxOverhead of the apply time, within the bounds of the performance
+// profile.
+class CheckpointScheduler {
+ public:
+  static constexpr double kMaxOverhead = 0.01;
+  static constexpr uint64_t kMaxRedoBytes = 32 * 1024 * 1024;
+
+  CheckpointScheduler() = default;
+
+  // Bounds the interval to [|min_interval|, |max_interval|].
+  void SetBounds(base::TimeDelta min_interval, base::TimeDelta max_interval);
+
+  // Records a checkpoint which took |latency| to store, |elapsed| after the
+  // previous one, with |data_bytes| more payload data applied in between.
+  void OnCheckpoint(base::TimeDelta latency,
+                    base::TimeDelta elapsed,
+                    uint64_t data_bytes);
+
+  // The minimum interval until the first checkpoint is measured.
+  base::TimeDelta interval() const;
+
+ private:
+  base::TimeDelta min_interval_{base::TimeDelta::FromSeconds(1)};
+  base::TimeDelta max_interval_{base::TimeDelta::FromSeconds(1)};
+
+  // Moving averages of the checkpoint latency in seconds and of the applied
+  // bytes per second, negative until measured.
+  double latency_{-1};
+  double throughput_{-1};
+
+  DISALLOW_COPY_AND_ASSIGN(CheckpointScheduler);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_CHECKPOINT_SCHEDULER_H_
@@ -0,0 +1,88 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/checkpoint_scheduler.h"
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr uint64_t kMiB = 1024 * 1024;
+}  // namespace
+
+class CheckpointSchedulerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    scheduler_.SetBounds(base::TimeDelta::FromSeconds(1),
+                         base::TimeDelta::FromSeconds(60));
+  }
+
+  CheckpointScheduler scheduler_;
+};
+
+TEST_F(CheckpointSchedulerTest, MinIntervalUntilMeasuredTest) {
+  EXPECT_EQ(base::TimeDelta::FromSeconds(1), scheduler_.interval());
+}
+
+TEST_F(CheckpointSchedulerTest, BoundsRedoTest) {
+  // Fast checkpoints, 8 MiB/s applied: 32 MiB are redone at most.
+  scheduler_.OnCheckpoint(base::TimeDelta::FromMilliseconds(1),
+                          base::TimeDelta::FromSeconds(1),
+                          8 * kMiB);
+  EXPECT_EQ(base::TimeDelta::FromSeconds(4), scheduler_.interval());
+}
+
+TEST_F(CheckpointSchedulerTest, BoundsOverheadTest) {
+  // 100 ms checkpoints take at most 1% of the time, even if more is redone.
+  scheduler_.OnCheckpoint(base::TimeDelta::FromMilliseconds(100),
+                          base::TimeDelta::FromSeconds(1),
+                          32 * kMiB);
+  EXPECT_EQ(base::TimeDelta::FromSeconds(10), scheduler_.interval());
+}
+
+TEST_F(CheckpointSchedulerTest, ClampsToBoundsTest) {
+  scheduler_.OnCheckpoint(base::TimeDelta::FromSeconds(1),
+                          base::TimeDelta::FromSeconds(1),
+                          kMiB);
+  EXPECT_EQ(base::TimeDelta::FromSeconds(60), scheduler_.interval());
+  scheduler_.SetBounds(base::TimeDelta::FromSeconds(1),
+                       base::TimeDelta::FromSeconds(5));
+  EXPECT_EQ(base::TimeDelta::FromSeconds(5), scheduler_.interval());
+  // Without data applied, the throughput isn't known: the longest interval
+  // the overhead allows.
+  CheckpointScheduler scheduler;
+  scheduler.SetBounds(base::TimeDelta::FromSeconds(1),
+                      base::TimeDelta::FromSeconds(5));
+  scheduler.OnCheckpoint(base::TimeDelta::FromMilliseconds(1),
+                         base::TimeDelta::FromSeconds(1),
+                         0);
+  EXPECT_EQ(base::TimeDelta::FromSeconds(5), scheduler.interval());
+}
+
+TEST_F(CheckpointSchedulerTest, AveragesMeasurementsTest) {
+  scheduler_.OnCheckpoint(base::TimeDelta::FromMilliseconds(1),
+                          base::TimeDelta::FromSeconds(1),
+                          8 * kMiB);
+  // A single stall doesn't double the interval.
+  scheduler_.OnCheckpoint(base::TimeDelta::FromMilliseconds(1),
+                          base::TimeDelta::FromSeconds(2),
+                          8 * kMiB);
+  EXPECT_GT(base::TimeDelta::FromSeconds(8), scheduler_.interval());
+  EXPECT_LT(base::TimeDelta::FromSeconds(4), scheduler_.interval());
+}
+
+}  // namespace chromeos_update_engine
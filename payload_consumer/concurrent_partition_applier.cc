@@ -0,0 +1,294 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/concurrent_partition_applier.h"
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/common/cpu_topology.h"
+#include "update_engine/common/tracing.h"
+#include "update_engine/payload_consumer/parallel_operation_applier.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+
+namespace chromeos_update_engine {
+
+ConcurrentPartitionApplier::ConcurrentPartitionApplier(size_t max_partitions,
+                                                       size_t block_size)
+    : max_partitions_(std::max<size_t>(max_partitions, 1)),
+      block_size_(block_size) {}
+
+ConcurrentPartitionApplier::~ConcurrentPartitionApplier() {
+  Close();
+}
+
+bool ConcurrentPartitionApplier::StartPartition(
+    const std::string& name,
+    std::unique_ptr<PartitionWriterInterface> writer,
+    ErrorCode* error) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  CHECK(partitions_.empty() || partitions_.back()->finish_queued);
+  cv_.wait(lock, [this] {
+    ReapPartitionsLocked();
+    return failed_ || static_cast<size_t>(std::count_if(
+                          partitions_.begin(),
+                          partitions_.end(),
+                          [](const auto& partition) {
+                            return !partition->done;
+                          })) < max_partitions_;
+  });
+  if (failed_) {
+    *error = error_;
+    return false;
+  }
+  auto partition = std::make_unique<Partition>();
+  partition->name = name;
+  partition->writer = std::move(writer);
+  Partition* started = partition.get();
+  partitions_.push_back(std::move(partition));
+  started->thread =
+      std::thread(&ConcurrentPartitionApplier::PartitionMain, this, started);
+  return true;
+}
+
+bool ConcurrentPartitionApplier::Enqueue(const InstallOperation& operation,
+                                         SharedBuffer data,
+                                         ErrorCode* error) {
+  UE_TRACE_SCOPE("ConcurrentPartitionApplier::Enqueue");
+  std::unique_lock<std::mutex> lock(mutex_);
+  // A single blob larger than the limits is still let through once nothing
+  // else is pending.
+  cv_.wait(lock, [this, &data] {
+    return failed_ || pending_data_bytes_ == 0 ||
+           (pending_data_bytes_ + data.size() <= kMaxPendingDataBytes &&
+            MemoryBudget::Get()->Fits(data.size()));
+  });
+  if (failed_) {
+    *error = error_;
+    return false;
+  }
+  CHECK(!partitions_.empty() && !partitions_.back()->finish_queued);
+  pending_data_bytes_ += data.size();
+  UE_TRACE_COUNTER("ConcurrentPartitionApplier pending bytes",
+                   pending_data_bytes_);
+  Task task;
+  task.type = Task::Type::kOperation;
+  task.operation = &operation;
+  task.data_reservation = MemoryBudget::Get()->Acquire(data.size());
+  task.data = std::move(data);
+  partitions_.back()->tasks.push_back(std::move(task));
+  cv_.notify_all();
+  return true;
+}
+
+uint64_t ConcurrentPartitionApplier::EnqueueCheckpoint(size_t next_op_index) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  const uint64_t id = ++next_checkpoint_id_;
+  if (partitions_.empty() || partitions_.back()->finish_queued) {
+    trailing_checkpoint_ = id;
+    return id;
+  }
+  Task task;
+  task.type = Task::Type::kCheckpoint;
+  task.next_op_index = next_op_index;
+  task.checkpoint_id = id;
+  partitions_.back()->tasks.push_back(std::move(task));
+  cv_.notify_all();
+  return id;
+}
+
+void ConcurrentPartitionApplier::FinishPartition() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (partitions_.empty() || partitions_.back()->finish_queued) {
+    return;
+  }
+  Task task;
+  task.type = Task::Type::kFinish;
+  partitions_.back()->tasks.push_back(std::move(task));
+  partitions_.back()->finish_queued = true;
+  cv_.notify_all();
+}
+
+uint64_t ConcurrentPartitionApplier::ReachedCheckpoint() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  ReapPartitionsLocked();
+  uint64_t reached = reaped_checkpoint_;
+  for (const auto& partition : partitions_) {
+    reached = std::max(reached, partition->reached_checkpoint);
+    if (!partition->done) {
+      return reached;
+    }
+  }
+  return std::max(reached, trailing_checkpoint_);
+}
+
+bool ConcurrentPartitionApplier::Wait(ErrorCode* error) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] {
+    return failed_ ||
+           std::all_of(partitions_.begin(),
+                       partitions_.end(),
+                       [](const auto& partition) {
+                         return partition->done ||
+                                (partition->tasks.empty() && !partition->busy);
+                       });
+  });
+  ReapPartitionsLocked();
+  if (failed_) {
+    *error = error_;
+    return false;
+  }
+  return true;
+}
+
+int ConcurrentPartitionApplier::Close() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+    cv_.notify_all();
+  }
+  int err = 0;
+  for (auto& partition : partitions_) {
+    if (partition->thread.joinable()) {
+      partition->thread.join();
+    }
+    apply_stats_[partition->name].Merge(partition->apply_stats);
+    if (partition->writer) {
+      source_cache_saved_bytes_ += partition->writer->SourceCacheSavedBytes();
+      int writer_err = partition->writer->Close();
+      if (writer_err && !err) {
+        err = writer_err;
+      }
+      partition->writer = nullptr;
+    }
+  }
+  partitions_.clear();
+  pending_data_bytes_ = 0;
+  return err;
+}
+
+void ConcurrentPartitionApplier::PartitionMain(Partition* partition) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this, partition] {
+      return stopping_ || failed_ || !partition->tasks.empty();
+    });
+    if (stopping_ || failed_) {
+      return;
+    }
+    Task task = std::move(partition->tasks.front());
+    partition->tasks.pop_front();
+    partition->busy = true;
+    lock.unlock();
+    PlaceWorkerThread();
+    ParallelOperationApplier::ApplyIoPriority();
+
+    ErrorCode error = ErrorCode::kSuccess;
+    const bool success = RunTask(partition, task, &error);
+    const size_t data_size = task.data.size();
+    // Release the blob before letting the main thread queue more.
+    task.data.Reset();
+    task.data_reservation.Reset();
+
+    lock.lock();
+    partition->busy = false;
+    pending_data_bytes_ -= data_size;
+    cv_.notify_all();
+    if (!success) {
+      if (!failed_) {
+        failed_ = true;
+        error_ = error;
+      }
+      return;
+    }
+    if (task.type == Task::Type::kCheckpoint) {
+      partition->reached_checkpoint = task.checkpoint_id;
+    } else if (task.type == Task::Type::kFinish) {
+      partition->done = true;
+      return;
+    }
+  }
+}
+
+bool ConcurrentPartitionApplier::RunTask(Partition* partition,
+                                         const Task& task,
+                                         ErrorCode* error) {
+  switch (task.type) {
+    case Task::Type::kOperation: {
+      ApplyStats::ScopedOperation measure(
+          &partition->apply_stats, *task.operation, block_size_);
+      if (!ParallelOperationApplier::ApplyOperation(partition->writer.get(),
+                                                    block_size_,
+                                                    *task.operation,
+                                                    task.data,
+                                                    error)) {
+        LOG(ERROR) << "Failed to perform "
+                   << InstallOperationTypeName(task.operation->type())
+                   << " operation " << partition->applied_ops
+                   << " in partition \"" << partition->name << "\"";
+        if (*error == ErrorCode::kSuccess)
+          *error = ErrorCode::kDownloadOperationExecutionError;
+        return false;
+      }
+      partition->applied_ops++;
+      return true;
+    }
+    case Task::Type::kCheckpoint:
+      if (!partition->writer->CheckpointUpdateProgress(task.next_op_index)) {
+        LOG(ERROR) << "Failed to checkpoint partition \"" << partition->name
+                   << "\"";
+        *error = ErrorCode::kDownloadWriteError;
+        return false;
+      }
+      return true;
+    case Task::Type::kFinish: {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        apply_stats_[partition->name].Merge(partition->apply_stats);
+        partition->apply_stats = ApplyStats();
+      }
+      const bool finished = partition->writer->FinishedInstallOps();
+      source_cache_saved_bytes_ += partition->writer->SourceCacheSavedBytes();
+      const int err = partition->writer->Close();
+      partition->writer = nullptr;
+      if (!finished || err) {
+        LOG(ERROR) << "Failed to finish partition \"" << partition->name
+                   << "\"";
+        *error = ErrorCode::kDownloadWriteError;
+        return false;
+      }
+      LOG(INFO) << "Applied " << partition->applied_ops
+                << " operations to partition \"" << partition->name << "\"";
+      return true;
+    }
+  }
+  return false;
+}
+
+void ConcurrentPartitionApplier::ReapPartitionsLocked() {
+  while (!partitions_.empty() && partitions_.front()->done) {
+    Partition* partition = partitions_.front().get();
+    partition->thread.join();
+    reaped_checkpoint_ =
+        std::max(reaped_checkpoint_, partition->reached_checkpoint);
+    partitions_.pop_front();
+  }
+}
+
+}  // namespace chromeos_update_engine
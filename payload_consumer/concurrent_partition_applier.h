@@ -0,0 +1,176 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_CONCURRENT_PARTITION_APPLIER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_CONCURRENT_PARTITION_APPLIER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <base/macros.h>
+
+#include "update_engine/common/error_code.h"
+#include "update_engine/payload_consumer/apply_stats.h"
+#include "update_engine/payload_consumer/memory_budget.h"
+#include "update_engine/payload_consumer/partition_writer_interface.h"
+#include "update_engine/payload_consumer/shared_buffer.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Applies the InstallOperations of several partitions at the same time. The
+// payload is still streamed in manifest order, but instead of waiting for a
+// partition to be fully written before moving on to the next one, every
+// partition gets its own worker thread, owning the partition's writer, which
+// applies the partition's operations in order behind the stream. Partitions
+// are distinct devices, so they never depend on each other.
+//
+// Checkpoints are queued along with the operations. A checkpoint is reached
+// once all the work queued before it completed, in its partition and in every
+// earlier partition, which is the completion watermark DeltaPerformer relies
+// on before persisting it.
+class ConcurrentPartitionApplier {
+ public:
+  // Upper bound of blob bytes kept alive by queued operations, across all
+  // partitions.
+  static constexpr size_t kMaxPendingDataBytes = 64 * 1024 * 1024;
+
+  // At most |max_partitions| partitions are applied at the same time.
+  ConcurrentPartitionApplier(size_t max_partitions, size_t block_size);
+  ~ConcurrentPartitionApplier();
+
+  // Starts applying a new partition, named |name|, with |writer|, which must
+  // be initialized. Waits while |max_partitions| partitions are in flight. The
+  // previous partition must have been finished with FinishPartition(). Returns
+  // false, with |error| set, if an earlier partition failed.
+  [[nodiscard]] bool StartPartition(
+      const std::string& name,
+      std::unique_ptr<PartitionWriterInterface> writer,
+      ErrorCode* error);
+
+  // Queues |operation| of the partition last started. |data| holds the
+  // operation's blob, already validated against the operation hash. The
+  // caller must keep |operation| alive until Wait() or Close(). Waits while
+  // the queued blobs exceed kMaxPendingDataBytes or |data| doesn't fit in the
+  // MemoryBudget. Returns false, with |error| set, if a partition failed.
+  [[nodiscard]] bool Enqueue(const InstallOperation& operation,
+                             SharedBuffer data,
+                             ErrorCode* error);
+
+  // Queues a call to CheckpointUpdateProgress(|next_op_index|) on the writer
+  // of the partition last started, if not finished yet. Returns an id,
+  // increasing with every call, to be compared with ReachedCheckpoint().
+  uint64_t EnqueueCheckpoint(size_t next_op_index);
+
+  // Queues the end of the partition last started: its writer's
+  // FinishedInstallOps() and Close().
+  void FinishPartition();
+
+  // Returns the id of the last reached checkpoint, 0 if none.
+  uint64_t ReachedCheckpoint();
+
+  // Waits for all the queued work to complete. Returns false, with |error|
+  // set, if a partition failed.
+  [[nodiscard]] bool Wait(ErrorCode* error);
+
+  // Stops the workers, dropping the work still queued, and closes the writers
+  // of the partitions not finished. Returns the first error of their Close().
+  int Close();
+
+  // Sum of PartitionWriterInterface::SourceCacheSavedBytes() of the writers
+  // closed so far.
+  uint64_t SourceCacheSavedBytes() const { return source_cache_saved_bytes_; }
+
+  // The stats of the operations applied, by partition name. Must only be
+  // called after Close().
+  const std::map<std::string, ApplyStats>& apply_stats() const {
+    return apply_stats_;
+  }
+
+ private:
+  struct Task {
+    enum class Type { kOperation, kCheckpoint, kFinish };
+    Type type{Type::kOperation};
+    const InstallOperation* operation{nullptr};
+    SharedBuffer data;
+    // Accounts for |data| until the task ran.
+    MemoryBudget::Reservation data_reservation;
+    size_t next_op_index{0};
+    uint64_t checkpoint_id{0};
+  };
+
+  struct Partition {
+    std::string name;
+    // Only used by |thread| while it runs.
+    std::unique_ptr<PartitionWriterInterface> writer;
+    size_t applied_ops{0};
+    // Only used by |thread| while it runs, merged into |apply_stats_| once the
+    // partition is finished.
+    ApplyStats apply_stats;
+    std::thread thread;
+    // The fields below are protected by |mutex_|.
+    std::deque<Task> tasks;
+    // Whether |thread| is running a task taken from |tasks|.
+    bool busy{false};
+    // Whether the kFinish task was queued, and whether it completed.
+    bool finish_queued{false};
+    bool done{false};
+    uint64_t reached_checkpoint{0};
+  };
+
+  void PartitionMain(Partition* partition);
+  bool RunTask(Partition* partition, const Task& task, ErrorCode* error);
+
+  // Joins the threads of the completed partitions at the front of
+  // |partitions_| and drops them. Requires |mutex_| to be held.
+  void ReapPartitionsLocked();
+
+  const size_t max_partitions_;
+  const size_t block_size_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // The partitions in flight, in manifest order.
+  std::list<std::unique_ptr<Partition>> partitions_;
+  size_t pending_data_bytes_{0};
+  uint64_t next_checkpoint_id_{0};
+  // Last checkpoint reached by the partitions dropped from |partitions_|.
+  uint64_t reaped_checkpoint_{0};
+  // Last checkpoint queued while no partition was open, reached once every
+  // partition completed.
+  uint64_t trailing_checkpoint_{0};
+  bool failed_{false};
+  ErrorCode error_{ErrorCode::kSuccess};
+  bool stopping_{false};
+  std::atomic<uint64_t> source_cache_saved_bytes_{0};
+  // Protected by |mutex_| until Close().
+  std::map<std::string, ApplyStats> apply_stats_;
+
+  DISALLOW_COPY_AND_ASSIGN(ConcurrentPartitionApplier);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_CONCURRENT_PARTITION_APPLIER_H_
@@ -0,0 +1,158 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/concurrent_partition_applier.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/dynamic_partition_control_stub.h"
+#include "update_engine/common/error_code.h"
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/partition_writer.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr size_t kNumBlocks = 16;
+constexpr size_t kNumPartitions = 3;
+}  // namespace
+
+class ConcurrentPartitionApplierTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    for (size_t i = 0; i < kNumPartitions; i++) {
+      ASSERT_EQ(0,
+                truncate(target_partitions_[i].path().c_str(),
+                         kNumBlocks * kBlockSize));
+      install_parts_[i].name = "part" + std::to_string(i);
+      install_parts_[i].target_path = target_partitions_[i].path();
+      install_parts_[i].target_size = kNumBlocks * kBlockSize;
+    }
+  }
+
+  std::unique_ptr<PartitionWriterInterface> CreateWriter(size_t index) {
+    auto writer = std::make_unique<PartitionWriter>(partition_update_,
+                                                    install_parts_[index],
+                                                    &dynamic_control_,
+                                                    kBlockSize,
+                                                    true);
+    if (!writer->Init(&install_plan_, false, 0)) {
+      return nullptr;
+    }
+    return writer;
+  }
+
+  static InstallOperation ReplaceOp(uint64_t start_block, uint64_t num_blocks) {
+    InstallOperation op;
+    op.set_type(InstallOperation::REPLACE);
+    *op.add_dst_extents() = ExtentForRange(start_block, num_blocks);
+    op.set_data_length(num_blocks * kBlockSize);
+    return op;
+  }
+
+  InstallPlan install_plan_{};
+  DynamicPartitionControlStub dynamic_control_{};
+  ScopedTempFile target_partitions_[kNumPartitions]{
+      ScopedTempFile{"target-part-XXXXXX"},
+      ScopedTempFile{"target-part-XXXXXX"},
+      ScopedTempFile{"target-part-XXXXXX"}};
+  PartitionUpdate partition_update_{};
+  InstallPlan::Partition install_parts_[kNumPartitions]{};
+  ConcurrentPartitionApplier applier_{2, kBlockSize};
+};
+
+TEST_F(ConcurrentPartitionApplierTest, AppliesAllPartitionsTest) {
+  std::vector<InstallOperation> ops;
+  for (size_t i = 0; i < kNumBlocks; i++) {
+    ops.push_back(ReplaceOp(i, 1));
+  }
+  ErrorCode error = ErrorCode::kSuccess;
+  uint64_t last_checkpoint = 0;
+  for (size_t part = 0; part < kNumPartitions; part++) {
+    auto writer = CreateWriter(part);
+    ASSERT_NE(nullptr, writer);
+    ASSERT_TRUE(applier_.StartPartition(
+        install_parts_[part].name, std::move(writer), &error));
+    for (size_t i = 0; i < ops.size(); i++) {
+      const uint8_t value = part * kNumBlocks + i;
+      ASSERT_TRUE(applier_.Enqueue(
+          ops[i], SharedBuffer(brillo::Blob(kBlockSize, value)), &error));
+    }
+    last_checkpoint = applier_.EnqueueCheckpoint(ops.size());
+    applier_.FinishPartition();
+  }
+  ASSERT_TRUE(applier_.Wait(&error));
+  ASSERT_EQ(last_checkpoint, applier_.ReachedCheckpoint());
+  ASSERT_EQ(0, applier_.Close());
+
+  for (size_t part = 0; part < kNumPartitions; part++) {
+    brillo::Blob expected;
+    for (size_t i = 0; i < kNumBlocks; i++) {
+      const uint8_t value = part * kNumBlocks + i;
+      expected.insert(expected.end(), kBlockSize, value);
+    }
+    brillo::Blob output;
+    ASSERT_TRUE(utils::ReadFile(target_partitions_[part].path(), &output));
+    ASSERT_EQ(expected, output) << install_parts_[part].name;
+  }
+}
+
+TEST_F(ConcurrentPartitionApplierTest, TrailingCheckpointTest) {
+  const InstallOperation op = ReplaceOp(0, 1);
+  ErrorCode error = ErrorCode::kSuccess;
+  ASSERT_TRUE(applier_.StartPartition("part0", CreateWriter(0), &error));
+  ASSERT_TRUE(applier_.Enqueue(
+      op, SharedBuffer(brillo::Blob(kBlockSize, 'a')), &error));
+  const uint64_t first = applier_.EnqueueCheckpoint(1);
+  applier_.FinishPartition();
+  // No partition is open, the checkpoint only waits for the earlier ones.
+  const uint64_t second = applier_.EnqueueCheckpoint(0);
+  ASSERT_LT(first, second);
+  ASSERT_TRUE(applier_.Wait(&error));
+  ASSERT_EQ(second, applier_.ReachedCheckpoint());
+}
+
+TEST_F(ConcurrentPartitionApplierTest, FailedOperationReportsErrorTest) {
+  ErrorCode error = ErrorCode::kSuccess;
+  ASSERT_TRUE(applier_.StartPartition("part0", CreateWriter(0), &error));
+  // The destination is past the end of the blob supplied, so the write fails.
+  InstallOperation op = ReplaceOp(0, 2);
+  op.set_data_length(4 * kBlockSize);
+  ASSERT_TRUE(applier_.Enqueue(
+      op, SharedBuffer(brillo::Blob(4 * kBlockSize, 'b')), &error));
+  const uint64_t checkpoint = applier_.EnqueueCheckpoint(1);
+  applier_.FinishPartition();
+
+  ASSERT_FALSE(applier_.Wait(&error));
+  ASSERT_EQ(ErrorCode::kDownloadOperationExecutionError, error);
+  ASSERT_LT(applier_.ReachedCheckpoint(), checkpoint);
+  // The failure is sticky.
+  error = ErrorCode::kSuccess;
+  ASSERT_FALSE(applier_.StartPartition("part1", CreateWriter(1), &error));
+  ASSERT_EQ(ErrorCode::kDownloadOperationExecutionError, error);
+}
+
+}  // namespace chromeos_update_engine
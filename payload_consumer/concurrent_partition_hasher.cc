@@ -0,0 +1,160 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/concurrent_partition_hasher.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/common/cpu_topology.h"
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_consumer/io_uring_file_descriptor.h"
+
+namespace chromeos_update_engine {
+
+ConcurrentPartitionHasher::ConcurrentPartitionHasher(
+    std::vector<Partition> partitions,
+    size_t max_threads,
+    size_t buffer_size,
+    bool use_io_uring,
+    std::optional<uint32_t> io_priority)
+    : partitions_(std::move(partitions)),
+      max_threads_(std::max<size_t>(max_threads, 1)),
+      buffer_size_(buffer_size),
+      use_io_uring_(use_io_uring),
+      io_priority_(io_priority),
+      hashes_(partitions_.size()),
+      hash_times_(partitions_.size()) {
+  CHECK_GT(buffer_size_, 0U);
+  uint64_t total_size = 0;
+  for (const auto& partition : partitions_) {
+    total_size += partition.size;
+  }
+  progress_.Reset(total_size);
+}
+
+ConcurrentPartitionHasher::~ConcurrentPartitionHasher() {
+  stopping_ = true;
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ConcurrentPartitionHasher::Start() {
+  CHECK(threads_.empty());
+  const size_t num_threads = std::min(max_threads_, partitions_.size());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_threads_ = num_threads;
+  }
+  for (size_t i = 0; i < num_threads; i++) {
+    threads_.emplace_back(&ConcurrentPartitionHasher::WorkerMain, this);
+  }
+}
+
+bool ConcurrentPartitionHasher::Done() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return running_threads_ == 0;
+}
+
+bool ConcurrentPartitionHasher::GetHashes(std::vector<brillo::Blob>* hashes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK_EQ(running_threads_, 0U);
+  if (failed_) {
+    return false;
+  }
+  *hashes = hashes_;
+  return true;
+}
+
+std::vector<base::TimeDelta> ConcurrentPartitionHasher::GetHashTimes() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK_EQ(running_threads_, 0U);
+  return hash_times_;
+}
+
+void ConcurrentPartitionHasher::WorkerMain() {
+  if (io_priority_) {
+    utils::SetThreadIoPriority(*io_priority_);
+  }
+  while (true) {
+    size_t index = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (failed_ || stopping_ || next_partition_ == partitions_.size()) {
+        running_threads_--;
+        return;
+      }
+      index = next_partition_++;
+    }
+    PlaceWorkerThread();
+    brillo::Blob hash;
+    const base::TimeTicks start_time = base::TimeTicks::Now();
+    const bool success = HashPartition(partitions_[index], &hash);
+    const base::TimeDelta hash_time = base::TimeTicks::Now() - start_time;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (success) {
+      hashes_[index] = std::move(hash);
+      hash_times_[index] = hash_time;
+    } else {
+      failed_ = true;
+    }
+  }
+}
+
+bool ConcurrentPartitionHasher::HashPartition(const Partition& partition,
+                                              brillo::Blob* hash) {
+  std::unique_ptr<FileDescriptor> fd = CreateFileDescriptor(use_io_uring_);
+  if (!fd->Open(partition.path.c_str(), O_RDONLY)) {
+    PLOG(ERROR) << "Unable to open " << partition.path << " for reading.";
+    return false;
+  }
+  HashCalculator hasher;
+  brillo::Blob buffer(buffer_size_);
+  for (uint64_t offset = 0; offset < partition.size;) {
+    if (stopping_) {
+      return false;
+    }
+    const size_t size =
+        std::min<uint64_t>(buffer_size_, partition.size - offset);
+    ssize_t bytes_read = 0;
+    if (!utils::ReadAll(fd.get(), buffer.data(), size, offset, &bytes_read) ||
+        static_cast<size_t>(bytes_read) != size) {
+      LOG(ERROR) << "Failed to read offset " << offset << " of "
+                 << partition.path << " expected " << size
+                 << " bytes, actual: " << bytes_read;
+      return false;
+    }
+    TEST_AND_RETURN_FALSE(hasher.Update(buffer.data(), size));
+    progress_.Add(size);
+    offset += size;
+  }
+  fd->Close();
+  TEST_AND_RETURN_FALSE(hasher.Finalize());
+  *hash = hasher.raw_hash();
+  return true;
+}
+
+}  // namespace chromeos_update_engine
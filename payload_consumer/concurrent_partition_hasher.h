@@ -0,0 +1,108 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_CONCURRENT_PARTITION_HASHER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_CONCURRENT_PARTITION_HASHER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/time/time.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_consumer/progress_counter.h"
+
+namespace chromeos_update_engine {
+
+// Computes the SHA-256 of several partitions at the same time, each read
+// sequentially by one of a bounded number of threads, for storage which
+// sustains more throughput than a single stream of reads.
+class ConcurrentPartitionHasher {
+ public:
+  struct Partition {
+    std::string path;
+    // Number of bytes hashed from the start of |path|.
+    uint64_t size{0};
+  };
+
+  // Reads |partitions| with up to |max_threads| threads, in reads of
+  // |buffer_size| bytes, through io_uring if |use_io_uring|. If set,
+  // |io_priority| is the best-effort I/O priority level of the threads, from 0
+  // (highest) to 7.
+  ConcurrentPartitionHasher(std::vector<Partition> partitions,
+                            size_t max_threads,
+                            size_t buffer_size,
+                            bool use_io_uring,
+                            std::optional<uint32_t> io_priority);
+  // Cancels the hashing, after waiting for the reads in progress.
+  ~ConcurrentPartitionHasher();
+
+  void Start();
+
+  // Returns the number of bytes hashed so far, across all partitions.
+  uint64_t BytesHashed() const { return progress_.done(); }
+
+  // The bytes hashed out of the size of all the partitions.
+  const ProgressCounter& progress() const { return progress_; }
+
+  // Returns whether all the partitions are hashed, or hashing one failed.
+  bool Done();
+
+  // Once Done(), sets |hashes| to the hash of every partition, in order.
+  // Returns false if a partition couldn't be read.
+  bool GetHashes(std::vector<brillo::Blob>* hashes);
+
+  // Once Done(), the time it took to hash every partition, in order.
+  std::vector<base::TimeDelta> GetHashTimes();
+
+ private:
+  void WorkerMain();
+  bool HashPartition(const Partition& partition, brillo::Blob* hash);
+
+  const std::vector<Partition> partitions_;
+  const size_t max_threads_;
+  const size_t buffer_size_;
+  const bool use_io_uring_;
+  const std::optional<uint32_t> io_priority_;
+
+  ProgressCounter progress_;
+  std::atomic<bool> stopping_{false};
+
+  // The fields below are protected by |mutex_|.
+  std::mutex mutex_;
+  // Index of the next partition to be picked up by a thread.
+  size_t next_partition_{0};
+  size_t running_threads_{0};
+  std::vector<brillo::Blob> hashes_;
+  std::vector<base::TimeDelta> hash_times_;
+  bool failed_{false};
+
+  std::vector<std::thread> threads_;
+
+  DISALLOW_COPY_AND_ASSIGN(ConcurrentPartitionHasher);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_CONCURRENT_PARTITION_HASHER_H_
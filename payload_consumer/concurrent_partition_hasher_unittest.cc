@@ -0,0 +1,102 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/concurrent_partition_hasher.h"
+
+#include <string>
+#include <vector>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr size_t kNumPartitions = 5;
+constexpr size_t kBufferSize = 4096;
+}  // namespace
+
+class ConcurrentPartitionHasherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    for (size_t i = 0; i < kNumPartitions; i++) {
+      brillo::Blob data(i * 3 * kBufferSize + i * 100);
+      test_utils::FillWithData(&data);
+      ASSERT_TRUE(test_utils::WriteFileVector(files_[i].path(), data));
+      partitions_.push_back({files_[i].path(), data.size()});
+      expected_.emplace_back();
+      ASSERT_TRUE(HashCalculator::RawHashOfData(data, &expected_.back()));
+      total_size_ += data.size();
+    }
+  }
+
+  static void WaitForHasher(ConcurrentPartitionHasher* hasher) {
+    while (!hasher->Done()) {
+      usleep(1000);
+    }
+  }
+
+  ScopedTempFile files_[kNumPartitions];
+  std::vector<ConcurrentPartitionHasher::Partition> partitions_;
+  std::vector<brillo::Blob> expected_;
+  uint64_t total_size_{0};
+};
+
+TEST_F(ConcurrentPartitionHasherTest, HashesAllPartitionsTest) {
+  for (size_t threads : {1, 2, 8}) {
+    ConcurrentPartitionHasher hasher(
+        partitions_, threads, kBufferSize, false, std::nullopt);
+    hasher.Start();
+    WaitForHasher(&hasher);
+    std::vector<brillo::Blob> hashes;
+    ASSERT_TRUE(hasher.GetHashes(&hashes)) << "threads " << threads;
+    EXPECT_EQ(expected_, hashes) << "threads " << threads;
+    EXPECT_EQ(total_size_, hasher.BytesHashed());
+  }
+}
+
+TEST_F(ConcurrentPartitionHasherTest, IoPriorityTest) {
+  ConcurrentPartitionHasher hasher(partitions_, 2, kBufferSize, false, 7);
+  hasher.Start();
+  WaitForHasher(&hasher);
+  std::vector<brillo::Blob> hashes;
+  ASSERT_TRUE(hasher.GetHashes(&hashes));
+  EXPECT_EQ(expected_, hashes);
+}
+
+TEST_F(ConcurrentPartitionHasherTest, ShortPartitionFailsTest) {
+  partitions_[2].size++;
+  ConcurrentPartitionHasher hasher(
+      partitions_, 2, kBufferSize, false, std::nullopt);
+  hasher.Start();
+  WaitForHasher(&hasher);
+  std::vector<brillo::Blob> hashes;
+  EXPECT_FALSE(hasher.GetHashes(&hashes));
+}
+
+TEST_F(ConcurrentPartitionHasherTest, CancelTest) {
+  ConcurrentPartitionHasher hasher(
+      partitions_, 2, kBufferSize, false, std::nullopt);
+  hasher.Start();
+  // The destructor stops the threads before they're done.
+}
+
+}  // namespace chromeos_update_engine
@@ -98,6 +98,14 @@ ssize_t CowWriterFileDescriptor::Write(const void* buf, size_t count) {
   return -1;
 }
 
+std::unique_ptr<FileDescriptor>
+CowWriterFileDescriptor::OpenConcurrentReader() {
+  if (dirty_ || !cow_writer_) {
+    return nullptr;
+  }
+  return cow_writer_->OpenFileDescriptor(source_device_);
+}
+
 off64_t CowWriterFileDescriptor::Seek(const off64_t offset, int whence) {
   return cow_reader_->Seek(offset, whence);
 }
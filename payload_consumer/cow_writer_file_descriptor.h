@@ -63,6 +63,11 @@ class CowWriterFileDescriptor final : public FileDescriptor {
 
   bool IsOpen() override;
 
+  // Opens another reader of the COW, which doesn't see the writes made
+  // through this descriptor afterwards. Not supported after writes which
+  // aren't finalized yet.
+  std::unique_ptr<FileDescriptor> OpenConcurrentReader() override;
+
  private:
   std::unique_ptr<android::snapshot::ICowWriter> cow_writer_;
   FileDescriptorPtr cow_reader_;
@@ -113,4 +113,28 @@ TEST_F(CowWriterFileDescriptorUnittest, ReadAfterWrite) {
          "is open, Finalize() should not be called.";
 }
 
+TEST_F(CowWriterFileDescriptorUnittest, OpenConcurrentReader) {
+  std::vector<unsigned char> buffer(BLOCK_SIZE, 234);
+  auto cow_writer = GetCowWriter();
+  ASSERT_TRUE(cow_writer->AddRawBlocks(2, buffer.data(), buffer.size()));
+  ASSERT_TRUE(cow_writer->Finalize());
+
+  auto cow_fd = GetCowFd();
+  auto reader = cow_fd->OpenConcurrentReader();
+  ASSERT_NE(reader, nullptr);
+  // The readers have their own offsets.
+  ASSERT_EQ(0, cow_fd->Seek(0, SEEK_SET));
+  ASSERT_EQ((ssize_t)BLOCK_SIZE * 2, reader->Seek(BLOCK_SIZE * 2, SEEK_SET));
+  std::vector<unsigned char> read_back(BLOCK_SIZE);
+  ASSERT_EQ((ssize_t)read_back.size(),
+            reader->Read(read_back.data(), read_back.size()));
+  ASSERT_EQ(buffer, read_back);
+  ASSERT_EQ(0, cow_fd->Seek(0, SEEK_CUR));
+
+  // Not after writes which aren't finalized yet.
+  ASSERT_EQ((ssize_t)buffer.size(),
+            cow_fd->Write(buffer.data(), buffer.size()));
+  ASSERT_EQ(cow_fd->OpenConcurrentReader(), nullptr);
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,200 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/decoder_pool.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The memory of an xz-embedded decoder besides its dictionary.
+constexpr size_t kXzDecoderStateSize = 32 * 1024;
+// The most decoders, buffers or allocations each pool caches.
+constexpr size_t kMaxCachedEntries = 8;
+// The size prefix of the libbz2 allocations, which keeps them aligned.
+constexpr size_t kAllocationHeaderSize = alignof(max_align_t);
+
+}  // namespace
+
+std::atomic<size_t> DecoderPool::max_cached_bytes_{kDefaultMaxCachedBytes};
+std::atomic<uint64_t> DecoderPool::allocation_count_{0};
+std::atomic<uint64_t> DecoderPool::reuse_count_{0};
+
+DecoderPool::DecoderPool() : reservation_(MemoryBudget::Get()->Acquire(0)) {}
+
+DecoderPool::~DecoderPool() {
+  for (const auto& xz_decoder : xz_decoders_) {
+    xz_dec_end(xz_decoder.decoder);
+  }
+  for (void* allocation : allocations_) {
+    free(allocation);
+  }
+}
+
+// static
+DecoderPool* DecoderPool::Get() {
+  static thread_local DecoderPool pool;
+  return &pool;
+}
+
+// static
+size_t DecoderPool::max_cached_bytes() {
+  return max_cached_bytes_;
+}
+
+// static
+void DecoderPool::set_max_cached_bytes(size_t bytes) {
+  max_cached_bytes_ = bytes;
+}
+
+// static
+uint64_t DecoderPool::allocations() {
+  return allocation_count_;
+}
+
+// static
+uint64_t DecoderPool::reuses() {
+  return reuse_count_;
+}
+
+bool DecoderPool::Cache(size_t bytes) {
+  const size_t max_bytes = max_cached_bytes();
+  if (cached_bytes_ > max_bytes || bytes > max_bytes - cached_bytes_ ||
+      !MemoryBudget::Get()->Fits(bytes)) {
+    return false;
+  }
+  cached_bytes_ += bytes;
+  reservation_.Resize(cached_bytes_);
+  return true;
+}
+
+void DecoderPool::Uncache(size_t bytes) {
+  cached_bytes_ -= bytes;
+  reservation_.Resize(cached_bytes_);
+}
+
+xz_dec* DecoderPool::AcquireXzDecoder(uint32_t dict_max, size_t* dict_size) {
+  auto it = std::find_if(xz_decoders_.begin(),
+                         xz_decoders_.end(),
+                         [dict_max](const XzDecoder& xz_decoder) {
+                           return xz_decoder.dict_max == dict_max;
+                         });
+  if (it != xz_decoders_.end()) {
+    xz_dec* decoder = it->decoder;
+    *dict_size = it->dict_size;
+    Uncache(kXzDecoderStateSize + it->dict_size);
+    xz_decoders_.erase(it);
+    // Keeps the dictionary, which is only reallocated for larger ones.
+    xz_dec_reset(decoder);
+    reuse_count_++;
+    return decoder;
+  }
+  *dict_size = 0;
+  allocation_count_++;
+  return xz_dec_init(XZ_DYNALLOC, dict_max);
+}
+
+void DecoderPool::ReleaseXzDecoder(xz_dec* decoder,
+                                   uint32_t dict_max,
+                                   size_t dict_size) {
+  if (!decoder)
+    return;
+  dict_size = std::min<size_t>(dict_size, dict_max);
+  if (xz_decoders_.size() >= kMaxCachedEntries ||
+      !Cache(kXzDecoderStateSize + dict_size)) {
+    xz_dec_end(decoder);
+    return;
+  }
+  xz_decoders_.push_back({decoder, dict_max, dict_size});
+}
+
+brillo::Blob DecoderPool::AcquireBuffer(size_t size) {
+  auto best = buffers_.end();
+  for (auto it = buffers_.begin(); it != buffers_.end(); it++) {
+    if (it->capacity() >= size &&
+        (best == buffers_.end() || it->capacity() < best->capacity())) {
+      best = it;
+    }
+  }
+  if (best == buffers_.end()) {
+    allocation_count_++;
+    return brillo::Blob(size);
+  }
+  brillo::Blob buffer = std::move(*best);
+  buffers_.erase(best);
+  Uncache(buffer.capacity());
+  buffer.resize(size);
+  reuse_count_++;
+  return buffer;
+}
+
+void DecoderPool::ReleaseBuffer(brillo::Blob buffer) {
+  if (buffer.capacity() == 0 || buffers_.size() >= kMaxCachedEntries ||
+      !Cache(buffer.capacity())) {
+    return;
+  }
+  buffers_.push_back(std::move(buffer));
+}
+
+void* DecoderPool::Allocate(size_t size) {
+  auto it = std::find_if(
+      allocations_.begin(), allocations_.end(), [size](void* allocation) {
+        return *static_cast<size_t*>(allocation) == size;
+      });
+  void* allocation = nullptr;
+  if (it != allocations_.end()) {
+    allocation = *it;
+    allocations_.erase(it);
+    Uncache(kAllocationHeaderSize + size);
+    reuse_count_++;
+  } else {
+    allocation = malloc(kAllocationHeaderSize + size);
+    if (!allocation)
+      return nullptr;
+    *static_cast<size_t*>(allocation) = size;
+    allocation_count_++;
+  }
+  return static_cast<uint8_t*>(allocation) + kAllocationHeaderSize;
+}
+
+void DecoderPool::Free(void* address) {
+  void* allocation = static_cast<uint8_t*>(address) - kAllocationHeaderSize;
+  const size_t size = *static_cast<size_t*>(allocation);
+  if (allocations_.size() >= kMaxCachedEntries ||
+      !Cache(kAllocationHeaderSize + size)) {
+    free(allocation);
+    return;
+  }
+  allocations_.push_back(allocation);
+}
+
+// static
+void* DecoderPool::BzipAlloc(void* opaque, int items, int size) {
+  return Get()->Allocate(static_cast<size_t>(items) * size);
+}
+
+// static
+void DecoderPool::BzipFree(void* opaque, void* address) {
+  if (address)
+    Get()->Free(address);
+}
+
+}  // namespace chromeos_update_engine
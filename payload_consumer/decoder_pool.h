@@ -0,0 +1,131 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_DECODER_POOL_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_DECODER_POOL_H_
+
+#include <xz.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_consumer/memory_budget.h"
+
+namespace chromeos_update_engine {
+
+// Caches the decoder contexts and scratch buffers of the operations of a
+// thread, so that the next operations on the thread reuse them instead of
+// allocating and faulting them in again. Each thread has its own pool, freed
+// when the thread exits; memory released on another thread than the one
+// which acquired it goes to the pool of the releasing thread.
+//
+// The cached memory, unused until acquired again, is accounted for in the
+// MemoryBudget. Memory which doesn't fit in the budget, or would take the
+// pool over max_cached_bytes(), is freed instead.
+class DecoderPool {
+ public:
+  // The default max_cached_bytes(), enough for the dictionary of an xz stream
+  // of the payload generator and the state of a bzip2 -9 stream.
+  static constexpr size_t kDefaultMaxCachedBytes = 16 * 1024 * 1024;
+
+  // Returns the pool of the calling thread.
+  static DecoderPool* Get();
+
+  // The most bytes each thread caches, 0 disables the pools.
+  static size_t max_cached_bytes();
+  static void set_max_cached_bytes(size_t bytes);
+
+  // The allocations of the pools, and the acquisitions served from them
+  // instead, for all the threads since the start of the process.
+  static uint64_t allocations();
+  static uint64_t reuses();
+
+  // Returns an xz-embedded decoder in XZ_DYNALLOC mode with a dictionary of
+  // up to |dict_max| bytes, ready to decode a new stream. |dict_size| is set
+  // to the size of the dictionary it already allocated.
+  xz_dec* AcquireXzDecoder(uint32_t dict_max, size_t* dict_size);
+  // Caches |decoder|, whose dictionary holds up to |dict_size| bytes, for the
+  // next AcquireXzDecoder() with the same |dict_max|.
+  void ReleaseXzDecoder(xz_dec* decoder, uint32_t dict_max, size_t dict_size);
+
+  // Returns a buffer of |size| bytes, with unspecified contents.
+  brillo::Blob AcquireBuffer(size_t size);
+  void ReleaseBuffer(brillo::Blob buffer);
+
+  // The bzalloc and bzfree hooks of a bz_stream, with a null opaque pointer,
+  // which cache the allocations of libbz2.
+  static void* BzipAlloc(void* opaque, int items, int size);
+  static void BzipFree(void* opaque, void* address);
+
+  // A buffer acquired from the pool of the current thread, released to the
+  // pool of the thread destroying it.
+  class ScopedBuffer {
+   public:
+    explicit ScopedBuffer(size_t size)
+        : buffer_(DecoderPool::Get()->AcquireBuffer(size)) {}
+    ~ScopedBuffer() { DecoderPool::Get()->ReleaseBuffer(std::move(buffer_)); }
+
+    brillo::Blob* get() { return &buffer_; }
+    brillo::Blob* operator->() { return &buffer_; }
+
+   private:
+    brillo::Blob buffer_;
+
+    DISALLOW_COPY_AND_ASSIGN(ScopedBuffer);
+  };
+
+  ~DecoderPool();
+
+ private:
+  DecoderPool();
+
+  // Accounts for |bytes| more cached bytes. Returns false if they don't fit.
+  bool Cache(size_t bytes);
+  void Uncache(size_t bytes);
+
+  void* Allocate(size_t size);
+  void Free(void* address);
+
+  struct XzDecoder {
+    xz_dec* decoder;
+    uint32_t dict_max;
+    size_t dict_size;
+  };
+  std::vector<XzDecoder> xz_decoders_;
+  std::vector<brillo::Blob> buffers_;
+  // The allocations of libbz2, each prefixed with its size.
+  std::vector<void*> allocations_;
+
+  size_t cached_bytes_{0};
+  MemoryBudget::Reservation reservation_;
+
+  static std::atomic<size_t> max_cached_bytes_;
+  static std::atomic<uint64_t> allocation_count_;
+  static std::atomic<uint64_t> reuse_count_;
+
+  DISALLOW_COPY_AND_ASSIGN(DecoderPool);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_DECODER_POOL_H_
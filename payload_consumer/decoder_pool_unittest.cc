@@ -0,0 +1,111 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/decoder_pool.h"
+
+#include <bzlib.h>
+
+#include <functional>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+class DecoderPoolTest : public ::testing::Test {
+ protected:
+  void TearDown() override {
+    DecoderPool::set_max_cached_bytes(DecoderPool::kDefaultMaxCachedBytes);
+  }
+
+  // Runs |test| on a new thread, with an empty pool.
+  void RunWithNewPool(std::function<void(DecoderPool*)> test) {
+    std::thread([&test] { test(DecoderPool::Get()); }).join();
+  }
+};
+
+TEST_F(DecoderPoolTest, ReusesBuffers) {
+  RunWithNewPool([](DecoderPool* pool) {
+    pool->ReleaseBuffer(pool->AcquireBuffer(4096));
+    const uint64_t allocations = DecoderPool::allocations();
+    const uint64_t reuses = DecoderPool::reuses();
+    brillo::Blob buffer = pool->AcquireBuffer(1024);
+    ASSERT_EQ(buffer.size(), 1024U);
+    ASSERT_EQ(DecoderPool::allocations(), allocations);
+    ASSERT_EQ(DecoderPool::reuses(), reuses + 1);
+    pool->ReleaseBuffer(std::move(buffer));
+
+    // A larger buffer than the cached ones is allocated.
+    {
+      DecoderPool::ScopedBuffer larger(1024 * 1024);
+      ASSERT_EQ(larger->size(), 1024U * 1024);
+      ASSERT_EQ(DecoderPool::allocations(), allocations + 1);
+    }
+    DecoderPool::ScopedBuffer reused(1024 * 1024);
+    ASSERT_EQ(DecoderPool::allocations(), allocations + 1);
+  });
+}
+
+TEST_F(DecoderPoolTest, ReusesXzDecoders) {
+  RunWithNewPool([](DecoderPool* pool) {
+    size_t dict_size;
+    xz_dec* decoder = pool->AcquireXzDecoder(1024 * 1024, &dict_size);
+    ASSERT_NE(decoder, nullptr);
+    ASSERT_EQ(dict_size, 0U);
+    pool->ReleaseXzDecoder(decoder, 1024 * 1024, 64 * 1024);
+    const uint64_t reuses = DecoderPool::reuses();
+    ASSERT_EQ(pool->AcquireXzDecoder(1024 * 1024, &dict_size), decoder);
+    ASSERT_EQ(dict_size, 64U * 1024);
+    ASSERT_EQ(DecoderPool::reuses(), reuses + 1);
+    pool->ReleaseXzDecoder(decoder, 1024 * 1024, dict_size);
+
+    // Decoders with another dictionary limit aren't mixed up.
+    xz_dec* other = pool->AcquireXzDecoder(2 * 1024 * 1024, &dict_size);
+    ASSERT_NE(other, decoder);
+    ASSERT_EQ(dict_size, 0U);
+    pool->ReleaseXzDecoder(other, 2 * 1024 * 1024, dict_size);
+  });
+}
+
+TEST_F(DecoderPoolTest, BzipHooksReuseAllocations) {
+  RunWithNewPool([](DecoderPool* pool) {
+    bz_stream stream{};
+    stream.bzalloc = DecoderPool::BzipAlloc;
+    stream.bzfree = DecoderPool::BzipFree;
+    ASSERT_EQ(BZ2_bzDecompressInit(&stream, 0, 0), BZ_OK);
+    ASSERT_EQ(BZ2_bzDecompressEnd(&stream), BZ_OK);
+
+    const uint64_t allocations = DecoderPool::allocations();
+    stream = {};
+    stream.bzalloc = DecoderPool::BzipAlloc;
+    stream.bzfree = DecoderPool::BzipFree;
+    ASSERT_EQ(BZ2_bzDecompressInit(&stream, 0, 0), BZ_OK);
+    ASSERT_EQ(BZ2_bzDecompressEnd(&stream), BZ_OK);
+    ASSERT_EQ(DecoderPool::allocations(), allocations);
+  });
+}
+
+TEST_F(DecoderPoolTest, ZeroMaxCachedBytesDisablesPool) {
+  DecoderPool::set_max_cached_bytes(0);
+  RunWithNewPool([](DecoderPool* pool) {
+    pool->ReleaseBuffer(pool->AcquireBuffer(4096));
+    const uint64_t allocations = DecoderPool::allocations();
+    pool->ReleaseBuffer(pool->AcquireBuffer(4096));
+    ASSERT_EQ(DecoderPool::allocations(), allocations + 1);
+  });
+}
+
+}  // namespace chromeos_update_engine
@@ -16,9 +16,12 @@
 
 #include "update_engine/payload_consumer/delta_performer.h"
 
+#include <fcntl.h>
 #include <linux/fs.h>
+#include <sys/statvfs.h>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstring>
 #include <memory>
@@ -29,6 +32,7 @@
 
 #include <android-base/properties.h>
 #include <android-base/strings.h>
+#include <base/files/file_path.h>
 #include <base/files/file_util.h>
 #include <base/format_macros.h>
 #include <base/metrics/histogram_macros.h>
@@ -48,9 +52,15 @@
 #include "update_engine/common/hardware_interface.h"
 #include "update_engine/common/prefs_interface.h"
 #include "update_engine/common/terminator.h"
+#include "update_engine/common/tracing.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/apply_trace.h"
 #include "update_engine/payload_consumer/partition_update_generator_interface.h"
 #include "update_engine/payload_consumer/partition_writer.h"
+#include "update_engine/payload_consumer/touched_blocks_verification.h"
+#include "update_engine/payload_consumer/update_checkpoint.h"
+#include "update_engine/payload_consumer/vabc_compression_chooser.h"
+#include "update_engine/payload_consumer/vabc_partition_writer.h"
 #include "update_engine/update_metadata.pb.h"
 #if USE_FEC
 #include "update_engine/payload_consumer/fec_file_descriptor.h"
@@ -73,7 +83,26 @@ const uint64_t DeltaPerformer::kCheckpointFrequencySeconds = 1;
 namespace {
 const int kUpdateStateOperationInvalid = -1;
 const int kMaxResumedUpdateFailures = 10;
-
+// Gaps between the parts of the payload data to download which are smaller
+// than this are downloaded as well, rather than costing one more request.
+const uint64_t kSparseDownloadMinGap = 1024 * 1024;
+// The data of an operation being downloaded is saved each time this much
+// more of it was downloaded, see SaveOperationData().
+const uint64_t kOperationDataSaveInterval = 4 * 1024 * 1024;
+// The data of REPLACE operations at least this large is hashed while it is
+// written, rather than before.
+const uint64_t kMinConcurrentOperationHashBytes = 256 * 1024;
+
+const int64_t kDefaultMaxCheckpointIntervalSeconds = 10;
+
+// The lowest best-effort I/O priority, so that the early source verification
+// yields to the reads of the operations.
+const uint32_t kSourceVerificationIoPriority = 7;
+
+std::atomic<int64_t> checkpoint_min_interval_ms{
+    DeltaPerformer::kCheckpointFrequencySeconds * 1000};
+std::atomic<int64_t> checkpoint_max_interval_ms{
+    kDefaultMaxCheckpointIntervalSeconds * 1000};
 }  // namespace
 
 // Computes the ratio of |part| and |total|, scaled to |norm|, using integer
@@ -142,9 +171,22 @@ void DeltaPerformer::UpdateOverallProgress(bool force_log,
   // Only add completed operations if their total number is known; we definitely
   // expect an update to have at least one operation, so the expectation is that
   // this will eventually reach |actual_operations_weight|.
-  if (num_total_operations_)
-    new_overall_progress += IntRatio(
-        next_operation_num_, num_total_operations_, actual_operations_weight);
+  uint64_t applied = next_operation_num_;
+  uint64_t total = num_total_operations_;
+  if (!acc_apply_costs_.empty() && acc_apply_costs_.back() > 0) {
+    applied = acc_apply_costs_[next_operation_num_];
+    total = acc_apply_costs_.back();
+  }
+  if (total) {
+    new_overall_progress += IntRatio(applied, total, actual_operations_weight);
+  }
+  // Only this thread updates |apply_progress_|.
+  if (apply_progress_.total() != total) {
+    apply_progress_.Reset(total);
+  }
+  if (applied > apply_progress_.done()) {
+    apply_progress_.Add(applied - apply_progress_.done());
+  }
 
   // Progress ratio cannot recede, unless our assumptions about the total
   // payload size, total number of operations, or the monotonicity of progress
@@ -180,11 +222,33 @@ size_t DeltaPerformer::CopyDataToBuffer(const char** bytes_p,
   const char* bytes_end = bytes_start + read_len;
   buffer_.reserve(max);
   buffer_.insert(buffer_.end(), bytes_start, bytes_end);
+  buffer_reservation_.Resize(buffer_.capacity());
   *bytes_p = bytes_end;
   *count_p = count - read_len;
   return read_len;
 }
 
+void DeltaPerformer::SaveOperationData(const InstallOperation& op) {
+  if (!operation_data_checkpoint_ ||
+      op.data_length() < install_plan_->operation_data_checkpoint_size) {
+    return;
+  }
+  const uint64_t saved_size =
+      operation_data_checkpoint_->data_offset() ==
+              static_cast<int64_t>(buffer_offset_)
+          ? operation_data_checkpoint_->size()
+          : 0;
+  if (buffer_.size() < saved_size + kOperationDataSaveInterval) {
+    return;
+  }
+  if (!operation_data_checkpoint_->Save(buffer_offset_, buffer_)) {
+    LOG(WARNING) << "Failed to save the data of operation "
+                 << next_operation_num_ << ", not saving it anymore.";
+    operation_data_checkpoint_->Clear();
+    operation_data_checkpoint_.reset();
+  }
+}
+
 bool DeltaPerformer::HandleOpResult(bool op_result,
                                     const char* op_type_name,
                                     ErrorCode* error) {
@@ -202,9 +266,44 @@ bool DeltaPerformer::HandleOpResult(bool op_result,
 
 int DeltaPerformer::Close() {
   // Checkpoint update progress before canceling, so that subsequent attempts
-  // can resume from exactly where update_engine left last time.
-  CheckpointUpdateProgress(true);
+  // can resume from exactly where update_engine left last time. Pending
+  // parallel operations must complete first, otherwise the checkpoint would
+  // cover operations which were never applied.
+  ErrorCode flush_error = ErrorCode::kSuccess;
+  if (FlushPendingOperations(&flush_error)) {
+    CheckpointUpdateProgress(true);
+  } else {
+    LOG(ERROR) << "Failed to apply pending operations, not checkpointing: "
+               << utils::ErrorCodeToString(flush_error);
+    if (partition_applier_) {
+      // The checkpoints reached before the failure are still valid.
+      StoreReachedCheckpoint(true);
+    }
+  }
   int err = -CloseCurrentPartition();
+  payload_hasher_.Wait();
+  if (partition_applier_) {
+    const int applier_err = -partition_applier_->Close();
+    install_plan_->source_cache_saved_bytes +=
+        partition_applier_->SourceCacheSavedBytes();
+    for (auto& install_part : install_plan_->partitions) {
+      const auto it = partition_applier_->apply_stats().find(install_part.name);
+      if (it != partition_applier_->apply_stats().end()) {
+        install_part.apply_stats.Merge(it->second);
+      }
+    }
+    partition_applier_ = nullptr;
+    pending_checkpoints_.clear();
+    if (!err)
+      err = applier_err;
+  }
+  // After the writers, which look the sources up in it.
+  source_verifier_ = nullptr;
+  install_plan_->memory_peak_bytes = std::max<uint64_t>(
+      install_plan_->memory_peak_bytes, MemoryBudget::Get()->peak());
+  if (!partitions_.empty()) {
+    install_plan_->page_cache_bytes = GetPartitionsPageCacheBytes();
+  }
   LOG_IF(ERROR,
          !payload_hash_calculator_.Finalize() ||
              !signed_hash_calculator_.Finalize())
@@ -217,17 +316,86 @@ int DeltaPerformer::Close() {
   return -err;
 }
 
+uint64_t DeltaPerformer::GetPartitionsPageCacheBytes() const {
+  uint64_t total = 0;
+  const auto add_resident_bytes = [&total](const std::string& path,
+                                           uint64_t size) {
+    uint64_t resident_bytes = 0;
+    if (!path.empty() && size > 0 &&
+        utils::GetPageCacheResidentBytes(path, size, &resident_bytes)) {
+      total += resident_bytes;
+    }
+  };
+  for (const auto& partition : install_plan_->partitions) {
+    add_resident_bytes(partition.source_path, partition.source_size);
+    add_resident_bytes(partition.target_path, partition.target_size);
+  }
+  return total;
+}
+
+InstallPlan::Partition* DeltaPerformer::CurrentInstallPartition() {
+  return &install_plan_->partitions[install_plan_->partitions.size() -
+                                    partitions_.size() + current_partition_];
+}
+
+void DeltaPerformer::ReleaseCurrentPartitionMemory() {
+  buffer_.shrink_to_fit();
+  if (partition_applier_ || source_verifier_) {
+    return;
+  }
+  // Clear() would keep the operations allocated for reuse.
+  RepeatedPtrField<InstallOperation>().Swap(
+      partitions_[current_partition_].mutable_operations());
+}
+
 int DeltaPerformer::CloseCurrentPartition() {
+  if (source_prefetcher_) {
+    source_prefetcher_->LogStats();
+    source_prefetcher_ = nullptr;
+  }
   if (!partition_writer_) {
     return 0;
   }
-  int err = partition_writer_->Close();
+  int err = 0;
+  install_plan_->source_cache_saved_bytes +=
+      partition_writer_->SourceCacheSavedBytes();
+  if (parallel_applier_) {
+    install_plan_->source_cache_saved_bytes +=
+        parallel_applier_->SourceCacheSavedBytes();
+    CurrentInstallPartition()->apply_stats.Merge(
+        parallel_applier_->GetApplyStats());
+    err = parallel_applier_->Close();
+    parallel_applier_ = nullptr;
+  }
+  int writer_err = partition_writer_->Close();
   partition_writer_ = nullptr;
-  return err;
+  if (write_path_hasher_ && !err && !writer_err &&
+      next_operation_num_ >= acc_num_operations_[current_partition_]) {
+    InstallPlan::Partition* install_part = CurrentInstallPartition();
+    if (write_path_hasher_->Finalize(&install_part->write_path_hash)) {
+      LOG(INFO) << "Hashed " << install_part->name << " while writing it.";
+    } else {
+      LOG(INFO) << "Only " << write_path_hasher_->next_offset() << " bytes of "
+                << install_part->name << " were written in order, it will be "
+                << "read back to be verified.";
+    }
+  }
+  write_path_hasher_ = nullptr;
+  if (written_blocks_ && !err && !writer_err &&
+      next_operation_num_ >= acc_num_operations_[current_partition_]) {
+    CurrentInstallPartition()->written_blocks = std::move(*written_blocks_);
+  }
+  written_blocks_ = nullptr;
+  if (install_plan_->touched_blocks_verification && !err && !writer_err &&
+      next_operation_num_ >= acc_num_operations_[current_partition_]) {
+    PlanTouchedBlocksVerification(partitions_[current_partition_],
+                                  CurrentInstallPartition());
+  }
+  return err ? err : writer_err;
 }
 
 bool DeltaPerformer::OpenCurrentPartition() {
-  if (current_partition_ >= partitions_.size())
+  if (current_partition_ >= static_cast<size_t>(partitions_.size()))
     return false;
 
   const PartitionUpdate& partition = partitions_[current_partition_];
@@ -243,6 +411,14 @@ bool DeltaPerformer::OpenCurrentPartition() {
       block_size_,
       interactive_,
       IsDynamicPartition(install_part.name, install_plan_->target_slot));
+  if (next_cow_plan_.valid() &&
+      next_cow_plan_partition_ == current_partition_) {
+    partition_writer_->SetCowPlan(next_cow_plan_.get());
+  }
+  partition_writer_->SetSourceVerifier(source_verifier_.get());
+  partition_writer_->SetSatisfiedOperations(
+      &satisfied_operations_,
+      current_partition_ ? acc_num_operations_[current_partition_ - 1] : 0);
   // Open source fds if we have a delta payload, or for partitions in the
   // partial update.
   const bool source_may_exist = manifest_.partial_update() ||
@@ -251,10 +427,210 @@ bool DeltaPerformer::OpenCurrentPartition() {
 
   TEST_AND_RETURN_FALSE(partition_writer_->Init(
       install_plan_, source_may_exist, partition_operation_num));
-  CheckpointUpdateProgress(true);
+  if (install_plan_->concurrent_partitions > 1) {
+    if (!partition_applier_) {
+      partition_applier_ = std::make_unique<ConcurrentPartitionApplier>(
+          install_plan_->concurrent_partitions, block_size_);
+    }
+    ErrorCode error = ErrorCode::kSuccess;
+    if (!partition_applier_->StartPartition(
+            install_part.name, std::move(partition_writer_), &error)) {
+      LOG(ERROR) << "Failed to start applying " << install_part.name << ": "
+                 << utils::ErrorCodeToString(error);
+      return false;
+    }
+  } else {
+    MaybeStartParallelApply(
+        install_part, source_may_exist, partition_operation_num);
+    MaybeStartWritePathHash(install_part, partition_operation_num);
+    MaybeStartWrittenBlocks(install_part, partition_operation_num);
+  }
+  MaybeStartSourcePrefetch(install_part, source_may_exist);
+  MaybePrepareNextCowPlan();
+  // Forcing the checkpoint would wait for the partitions still being applied.
+  CheckpointUpdateProgress(!partition_applier_);
   return true;
 }
 
+void DeltaPerformer::MaybeStartSourcePrefetch(
+    const InstallPlan::Partition& install_part, bool source_may_exist) {
+  if (install_plan_->source_prefetch_ops == 0 || !source_may_exist ||
+      install_part.source_size == 0 || install_part.source_path.empty()) {
+    return;
+  }
+  source_prefetcher_ =
+      std::make_unique<SourcePrefetcher>(partitions_[current_partition_],
+                                         block_size_,
+                                         install_plan_->source_prefetch_ops);
+  if (!source_prefetcher_->Open(install_part.source_path)) {
+    LOG(WARNING) << "Source read-ahead disabled for " << install_part.name;
+    source_prefetcher_ = nullptr;
+  }
+}
+
+void DeltaPerformer::MaybeStartSourceVerification() {
+  if (!install_plan_->early_source_verification ||
+      payload_->type != InstallPayloadType::kDelta) {
+    return;
+  }
+  const size_t num_previous_partitions =
+      install_plan_->partitions.size() - partitions_.size();
+  std::vector<SourceVerifier::Partition> partitions;
+  for (size_t i = current_partition_;
+       i < static_cast<size_t>(partitions_.size());
+       i++) {
+    const PartitionUpdate& partition = partitions_[i];
+    const InstallPlan::Partition& install_part =
+        install_plan_->partitions[num_previous_partitions + i];
+    // Partitions updated in place change under the verification.
+    if (!partition.has_old_partition_info() ||
+        partition.old_partition_info().size() == 0 ||
+        install_part.source_path.empty() ||
+        install_part.source_path == install_part.target_path) {
+      continue;
+    }
+    SourceVerifier::Partition source;
+    source.path = install_part.source_path;
+    source.size = partition.old_partition_info().size();
+    source.hash.assign(partition.old_partition_info().hash().begin(),
+                       partition.old_partition_info().hash().end());
+    // The operations loaded from their segment are replaced when their
+    // partition is reached.
+    if (!has_operations_segments_) {
+      source.update = &partition;
+      source.first_operation =
+          i == current_partition_ ? GetPartitionOperationNum() : 0;
+    }
+    partitions.push_back(std::move(source));
+  }
+  if (partitions.empty()) {
+    return;
+  }
+  source_verifier_ = std::make_unique<SourceVerifier>(
+      std::move(partitions), block_size_, kSourceVerificationIoPriority);
+  source_verifier_->Start();
+}
+
+void DeltaPerformer::MaybePrepareNextCowPlan() {
+  const size_t next_partition = current_partition_ + 1;
+  if (next_partition >= static_cast<size_t>(partitions_.size())) {
+    return;
+  }
+  const PartitionUpdate& partition = partitions_[next_partition];
+  const InstallPlan::Partition& install_part =
+      install_plan_->partitions[install_plan_->partitions.size() -
+                                partitions_.size() + next_partition];
+  auto dynamic_control = boot_control_->GetDynamicPartitionControl();
+  if (partition.merge_operations().empty() || !dynamic_control ||
+      !dynamic_control->UpdateUsesSnapshotCompression() ||
+      !IsDynamicPartition(install_part.name, install_plan_->target_slot)) {
+    return;
+  }
+  // Replacing the plan of a partition skipped since waits for it. The merge
+  // operations are left alone once the manifest is parsed, so the thread
+  // reads them without a lock.
+  const bool supports_xor =
+      dynamic_control->GetVirtualAbCompressionXorFeatureFlag().IsEnabled();
+  next_cow_plan_partition_ = next_partition;
+  next_cow_plan_ = std::async(std::launch::async, [&partition, supports_xor] {
+    return std::shared_ptr<VABCCowPlan>(
+        VABCPartitionWriter::ComputeCowPlan(partition, supports_xor));
+  });
+}
+
+void DeltaPerformer::MaybeStartWritePathHash(
+    const InstallPlan::Partition& install_part,
+    size_t partition_operation_num) {
+  std::string resumed_context;
+  resumed_context.swap(resumed_write_path_hash_context_);
+  if (!install_plan_->trusted_write_path_hash) {
+    return;
+  }
+  // The operations applied in parallel complete out of order.
+  if (parallel_applier_) {
+    LOG(INFO) << "Not hashing " << install_part.name
+              << " while writing it, operations are applied in parallel.";
+    return;
+  }
+  auto hasher = std::make_unique<WritePathHasher>(install_part.target_size);
+  if (partition_operation_num > 0 &&
+      (resumed_context.empty() || !hasher->SetContext(resumed_context))) {
+    LOG(INFO) << "Unable to resume hashing " << install_part.name
+              << " while writing it.";
+    return;
+  }
+  if (!partition_writer_->EnableWritePathHash(hasher.get())) {
+    LOG(INFO) << "Partition writer of " << install_part.name
+              << " doesn't support hashing while writing.";
+    return;
+  }
+  write_path_hasher_ = std::move(hasher);
+}
+
+void DeltaPerformer::MaybeStartWrittenBlocks(
+    const InstallPlan::Partition& install_part,
+    size_t partition_operation_num) {
+  std::string resumed_blocks;
+  resumed_blocks.swap(resumed_written_blocks_);
+  // The writers applying operations in parallel would share the bitmap.
+  if (parallel_applier_) {
+    return;
+  }
+  auto written_blocks = std::make_unique<BlockBitmap>();
+  if (partition_operation_num > 0 && !written_blocks->Parse(resumed_blocks)) {
+    LOG(INFO) << "Unable to resume recording the blocks written to "
+              << install_part.name << ".";
+    return;
+  }
+  if (!partition_writer_->EnableWrittenBlocks(written_blocks.get())) {
+    return;
+  }
+  written_blocks_ = std::move(written_blocks);
+}
+
+void DeltaPerformer::MaybeStartParallelApply(
+    const InstallPlan::Partition& install_part,
+    bool source_may_exist,
+    size_t partition_operation_num) {
+  if (install_plan_->apply_threads <= 1) {
+    return;
+  }
+  if (!partition_writer_->SupportsConcurrentInstances()) {
+    LOG(INFO) << "Partition writer of " << install_part.name
+              << " doesn't support concurrent apply, applying serially.";
+    return;
+  }
+  const PartitionUpdate& partition = partitions_[current_partition_];
+  auto dynamic_control = boot_control_->GetDynamicPartitionControl();
+  const bool is_dynamic =
+      IsDynamicPartition(install_part.name, install_plan_->target_slot);
+  const bool source_is_target = !install_part.source_path.empty() &&
+                                install_part.source_path ==
+                                    install_part.target_path;
+  parallel_applier_ = std::make_unique<ParallelOperationApplier>(
+      install_plan_->apply_threads, block_size_, source_is_target);
+  if (!parallel_applier_->Init(
+          [&]() {
+            auto writer = CreatePartitionWriter(partition,
+                                                install_part,
+                                                dynamic_control,
+                                                block_size_,
+                                                interactive_,
+                                                is_dynamic);
+            writer->SetSourceVerifier(source_verifier_.get());
+            writer->SetZeroedBlocks(partition_writer_->ZeroedBlocks());
+            return writer;
+          },
+          install_plan_,
+          source_may_exist,
+          partition_operation_num)) {
+    LOG(WARNING) << "Failed to start parallel apply for " << install_part.name
+                 << ", applying serially.";
+    parallel_applier_->Close();
+    parallel_applier_ = nullptr;
+  }
+}
+
 size_t DeltaPerformer::GetPartitionOperationNum() {
   return next_operation_num_ -
          (current_partition_ ? acc_num_operations_[current_partition_ - 1] : 0);
@@ -268,7 +644,14 @@ void LogPartitionInfoHash(const PartitionInfo& info, const string& tag) {
             << " size: " << info.size();
 }
 
-void LogPartitionInfo(const vector<PartitionUpdate>& partitions) {
+// Returns the number of operations of |partition|, loaded or not.
+size_t NumOperations(const PartitionUpdate& partition) {
+  return partition.has_operations_segment()
+             ? partition.operations_segment().num_operations()
+             : partition.operations_size();
+}
+
+void LogPartitionInfo(const RepeatedPtrField<PartitionUpdate>& partitions) {
   for (const PartitionUpdate& partition : partitions) {
     if (partition.has_old_partition_info()) {
       LogPartitionInfoHash(partition.old_partition_info(),
@@ -329,6 +712,20 @@ MetadataParseResult DeltaPerformer::ParsePayloadMetadata(
     }
   }
 
+  // Hash the metadata as it arrives, so that only the signature is left to
+  // check once the metadata and its signature are received. |payload| grows
+  // from one call to the next.
+  const uint64_t metadata_received =
+      std::min<uint64_t>(payload.size(), metadata_size_);
+  if (!manifest_trusted_ && metadata_received > metadata_bytes_hashed_) {
+    if (!metadata_hasher_.Update(payload.data() + metadata_bytes_hashed_,
+                                 metadata_received - metadata_bytes_hashed_)) {
+      *error = ErrorCode::kDownloadMetadataSignatureVerificationError;
+      return MetadataParseResult::kError;
+    }
+    metadata_bytes_hashed_ = metadata_received;
+  }
+
   // Now that we have validated the metadata size, we should wait for the full
   // metadata and its signature (if exist) to be read in before we can parse it.
   if (payload.size() < metadata_size_ + metadata_signature_size_)
@@ -349,34 +746,48 @@ MetadataParseResult DeltaPerformer::ParsePayloadMetadata(
                  << "Trusting metadata size in payload = " << metadata_size_;
   }
 
-  // NOLINTNEXTLINE(whitespace/braces)
-  auto [payload_verifier, perform_verification] = CreatePayloadVerifier();
-  if (!payload_verifier) {
-    LOG(ERROR) << "Failed to create payload verifier.";
-    *error = ErrorCode::kDownloadMetadataSignatureVerificationError;
-    if (perform_verification) {
-      return MetadataParseResult::kError;
+  if (manifest_trusted_) {
+    LOG(INFO) << "Skipping the metadata signature verification of the cached "
+                 "manifest, it was verified before.";
+  } else {
+    // NOLINTNEXTLINE(whitespace/braces)
+    auto [payload_verifier, perform_verification] = CreatePayloadVerifier();
+    if (!payload_verifier) {
+      LOG(ERROR) << "Failed to create payload verifier.";
+      *error = ErrorCode::kDownloadMetadataSignatureVerificationError;
+      if (perform_verification) {
+        return MetadataParseResult::kError;
+      }
     }
-  }
 #ifndef __ANDROID_RECOVERY__
-  else {
-    // We have the full metadata in |payload|. Verify its integrity
-    // and authenticity based on the information we have in Omaha response.
-    *error = payload_metadata_.ValidateMetadataSignature(
-        payload, payload_->metadata_signature, *payload_verifier);
-  }
-#endif
-  if (*error != ErrorCode::kSuccess) {
-    if (install_plan_->hash_checks_mandatory) {
-      // The autoupdate_CatchBadSignatures test checks for this string
-      // in log-files. Keep in sync.
-      LOG(ERROR) << "Mandatory metadata signature validation failed";
-      return MetadataParseResult::kError;
+    else {
+      // We have the full metadata in |payload|. Verify its integrity
+      // and authenticity based on the information we have in Omaha response.
+      *error = metadata_hasher_.Finalize()
+                   ? payload_metadata_.ValidateMetadataSignature(
+                         payload,
+                         payload_->metadata_signature,
+                         *payload_verifier,
+                         metadata_hasher_.raw_hash())
+                   : ErrorCode::kDownloadMetadataSignatureVerificationError;
+      if (*error == ErrorCode::kSuccess) {
+        // Lets a resumed update skip verifying the cached manifest again.
+        prefs_->SetString(kPrefsManifestVerified, GetManifestVerifiedValue());
+      }
     }
+#endif
+    if (*error != ErrorCode::kSuccess) {
+      if (install_plan_->hash_checks_mandatory) {
+        // The autoupdate_CatchBadSignatures test checks for this string
+        // in log-files. Keep in sync.
+        LOG(ERROR) << "Mandatory metadata signature validation failed";
+        return MetadataParseResult::kError;
+      }
 
-    // For non-mandatory cases, just send a UMA stat.
-    LOG(WARNING) << "Ignoring metadata signature validation failures";
-    *error = ErrorCode::kSuccess;
+      // For non-mandatory cases, just send a UMA stat.
+      LOG(WARNING) << "Ignoring metadata signature validation failures";
+      *error = ErrorCode::kSuccess;
+    }
   }
 
   // The payload metadata is deemed valid, it's safe to parse the protobuf.
@@ -447,7 +858,40 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
     return false;
   }
   *error = ErrorCode::kSuccess;
+  UE_TRACE_SCOPE("DeltaPerformer::Write");
+  UE_TRACE_COUNTER("DeltaPerformer buffered bytes", buffer_.size());
+  if (ApplyTrace* trace = ApplyTrace::Get()) {
+    trace->OnReceivedBytes(count);
+  }
   const char* c_bytes = reinterpret_cast<const char*>(bytes);
+  // The partition being applied when the bytes arrive is charged with them,
+  // the wait for them and the time spent on them.
+  const base::TimeTicks write_start_time = base::TimeTicks::Now();
+  PartitionThroughputStats* throughput_stats =
+      manifest_valid_ && current_partition_ < partitions_.size()
+          ? &CurrentInstallPartition()->throughput_stats
+          : nullptr;
+  if (throughput_stats) {
+    throughput_stats->download_bytes += count;
+    if (!last_write_end_time_.is_null()) {
+      throughput_stats->network_wait_time +=
+          write_start_time - last_write_end_time_;
+      throughput_stats->download_time +=
+          write_start_time - last_write_end_time_;
+    }
+  }
+  DEFER {
+    last_write_end_time_ = base::TimeTicks::Now();
+    if (throughput_stats) {
+      throughput_stats->download_time +=
+          last_write_end_time_ - write_start_time;
+    }
+  };
+  // Operation blobs used in place are part of |bytes|, which is only valid
+  // during this call.
+  DEFER {
+    payload_hasher_.WaitForBorrowed();
+  };
 
   // Update the total byte downloaded count and the progress logs.
   total_bytes_received_ += count;
@@ -463,6 +907,10 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
       return true;
     }
   }
+  // The rest of the payload is downloaded again, sparsely.
+  if (!sparse_download_ranges_.empty()) {
+    return true;
+  }
 
   while (next_operation_num_ < num_total_operations_) {
     // Check if we should cancel the current attempt for any reason.
@@ -471,10 +919,29 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
     if (download_delegate_ && download_delegate_->ShouldCancel(error))
       return false;
 
+    // A source which can't be fixed fails the update before its operations
+    // are reached.
+    if (source_verifier_ && source_verifier_->failed()) {
+      LOG(ERROR) << "A source partition doesn't match the payload.";
+      *error = ErrorCode::kDownloadOperationHashMismatch;
+      return false;
+    }
+
     // We know there are more operations to perform because we didn't reach the
     // |num_total_operations_| limit yet.
     if (next_operation_num_ >= acc_num_operations_[current_partition_]) {
+      if (partition_applier_) {
+        // The partition completes in the background while the next one is
+        // applied.
+        partition_applier_->FinishPartition();
+      } else if (!FlushPendingOperations(error)) {
+        return false;
+      }
       if (partition_writer_) {
+        if (parallel_applier_ && !parallel_applier_->FinishedInstallOps()) {
+          *error = ErrorCode::kDownloadWriteError;
+          return false;
+        }
         if (!partition_writer_->FinishedInstallOps()) {
           *error = ErrorCode::kDownloadWriteError;
           return false;
@@ -487,36 +954,139 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
                    << strerror(-err);
         return false;
       }
+      ReleaseCurrentPartitionMemory();
       // Skip until there are operations for current_partition_.
       while (next_operation_num_ >= acc_num_operations_[current_partition_]) {
         current_partition_++;
       }
-      if (!OpenCurrentPartition()) {
-        *error = ErrorCode::kInstallDeviceOpenError;
+      partition_open_pending_ = true;
+    }
+    if (partition_open_pending_) {
+      if (!OpenCurrentPartitionWhenLoaded(&c_bytes, &count, error)) {
         return false;
       }
+      if (partition_open_pending_) {
+        return true;
+      }
     }
 
     const InstallOperation& op =
         partitions_[current_partition_].operations(GetPartitionOperationNum());
+    const auto skip = satisfied_operations_.Get(next_operation_num_);
+    if (skip != SatisfiedOperations::Skip::kNone) {
+      if (!SkipSatisfiedOperation(op, skip, &c_bytes, &count)) {
+        return true;
+      }
+      next_operation_num_++;
+      UpdateOverallProgress(false, "Completed ");
+      if (!parallel_applier_) {
+        CheckpointUpdateProgress(false);
+      }
+      continue;
+    }
+    // Start the read-ahead before waiting for the operation's data, so that
+    // the download hides the source read latency as well.
+    if (source_prefetcher_) {
+      source_prefetcher_->OnOperationStart(GetPartitionOperationNum());
+    }
 
-    CopyDataToBuffer(&c_bytes, &count, op.data_length());
+    // The blob an operation shares with an earlier one was kept when the
+    // earlier one was downloaded.
+    const SharedBuffer* shared_blob = nullptr;
+    if (shared_blobs_.IsReference(next_operation_num_)) {
+      shared_blob = shared_blobs_.Find(op);
+      if (!shared_blob) {
+        LOG(ERROR) << "The blob at offset " << op.data_offset()
+                   << " of operation " << next_operation_num_
+                   << " isn't available anymore.";
+        *error = ErrorCode::kDownloadOperationExecutionError;
+        return false;
+      }
+    }
 
-    // Check whether we received all of the next operation's data payload.
-    if (!CanPerformInstallOperation(op))
-      return true;
-    if (!ProcessOperation(&op, error)) {
-      LOG(ERROR) << "unable to process operation: "
-                 << InstallOperationTypeName(op.type())
-                 << " Error: " << utils::ErrorCodeToString(*error);
-      return false;
+    // If the whole data blob of the operation is contained in the chunk we
+    // were given, hand it to the partition writer in place instead of copying
+    // it to |buffer_| first. Operations applied in parallel outlive this call,
+    // so their blob is always buffered.
+    const bool in_place = !shared_blob && !parallel_applier_ &&
+                          !partition_applier_ &&
+                          CanPerformInstallOperationInPlace(op, count);
+    const uint8_t* op_data = nullptr;
+    if (shared_blob) {
+      op_data = shared_blob->data();
+    } else if (in_place) {
+      op_data = reinterpret_cast<const uint8_t*>(c_bytes);
+      c_bytes += op.data_length();
+      count -= op.data_length();
+    } else {
+      CopyDataToBuffer(&c_bytes, &count, op.data_length());
+
+      // Check whether we received all of the next operation's data payload.
+      if (!CanPerformInstallOperation(op)) {
+        SaveOperationData(op);
+        return true;
+      }
+      op_data = buffer_.data();
+    }
+    shared_blobs_.Store(next_operation_num_, op, op_data);
+    if (parallel_applier_ || partition_applier_) {
+      if (!EnqueueOperation(op, shared_blob, error)) {
+        LOG(ERROR) << "unable to enqueue operation: "
+                   << InstallOperationTypeName(op.type())
+                   << " Error: " << utils::ErrorCodeToString(*error);
+        return false;
+      }
+    } else {
+      if (!ProcessOperation(&op, op_data, error)) {
+        // The operation may be partially written.
+        if (write_path_hasher_) {
+          write_path_hasher_->Invalidate();
+        }
+        LOG(ERROR) << "unable to process operation: "
+                   << InstallOperationTypeName(op.type())
+                   << " Error: " << utils::ErrorCodeToString(*error);
+        return false;
+      }
+      if (in_place) {
+        ConsumeOperationData(op_data, op.data_length());
+      } else {
+        DiscardBuffer(true, buffer_.size());
+      }
     }
+    shared_blobs_.Release(next_operation_num_, op);
 
     next_operation_num_++;
     UpdateOverallProgress(false, "Completed ");
-    CheckpointUpdateProgress(false);
+    if (parallel_applier_) {
+      // Only checkpoint once the batch completed, so that the checkpoint never
+      // covers an operation still in flight.
+      if (parallel_applier_->IsBatchFull()) {
+        if (!FlushPendingOperations(error)) {
+          return false;
+        }
+        CheckpointUpdateProgress(false);
+      }
+    } else {
+      CheckpointUpdateProgress(false);
+    }
   }
 
+  if (partition_applier_) {
+    partition_applier_->FinishPartition();
+  }
+  if (!FlushPendingOperations(error)) {
+    return false;
+  }
+  if (partition_applier_) {
+    // All partitions are applied, the rest of the payload is handled as if
+    // they were applied serially.
+    StoreReachedCheckpoint(false);
+    partition_applier_ = nullptr;
+    pending_checkpoints_.clear();
+  }
+  if (parallel_applier_) {
+    TEST_AND_RETURN_FALSE(parallel_applier_->FinishedInstallOps());
+  }
   if (partition_writer_) {
     TEST_AND_RETURN_FALSE(partition_writer_->FinishedInstallOps());
   }
@@ -597,6 +1167,7 @@ bool DeltaPerformer::ParseManifest(const char** c_bytes,
     return false;
   }
 
+  MaybeChooseVabcCompression();
   // update estimate_cow_size if VABC is disabled
   // new_cow_size per partition = partition_size - (#blocks in Copy
   // operations part of the partition)
@@ -610,13 +1181,8 @@ bool DeltaPerformer::ParseManifest(const char** c_bytes,
       if (!partition.has_estimate_cow_size()) {
         continue;
       }
-      auto new_cow_size = partition.new_partition_info().size();
-      for (const auto& operation : partition.merge_operations()) {
-        if (operation.type() == CowMergeOperation::COW_COPY) {
-          new_cow_size -=
-              operation.dst_extent().num_blocks() * manifest_.block_size();
-        }
-      }
+      const auto new_cow_size =
+          UncompressedCowSize(partition, manifest_.block_size());
       // Remove all COW_XOR merge ops, as XOR without compression is useless.
       // It increases CPU usage but does not reduce space usage at all.
       auto&& merge_ops = *partition.mutable_merge_operations();
@@ -637,7 +1203,7 @@ bool DeltaPerformer::ParseManifest(const char** c_bytes,
       // whichever one is longer. In the worst case, we add 1 label per
       // InstallOp. So take size of label ops into account.
       const auto label_ops_size =
-          partition.operations_size() * sizeof(android::snapshot::CowOperation);
+          NumOperations(partition) * sizeof(android::snapshot::CowOperation);
       // Adding extra 2MB headroom just for any unexpected space usage.
       // If we overrun reserved COW size, entire OTA will fail
       // and no way for user to retry OTA
@@ -682,9 +1248,29 @@ bool DeltaPerformer::ParseManifest(const char** c_bytes,
 
   num_total_operations_ = 0;
   for (const auto& partition : partitions_) {
-    num_total_operations_ += partition.operations_size();
+    if (partition.has_operations_segment()) {
+      if (partition.operations_size() > 0 ||
+          partition.operations_segment().num_operations() == 0) {
+        LOG(ERROR) << "Invalid operations segment for "
+                   << partition.partition_name();
+        *error = ErrorCode::kDownloadManifestParseError;
+        return false;
+      }
+      has_operations_segments_ = true;
+    }
+    num_total_operations_ += NumOperations(partition);
     acc_num_operations_.push_back(num_total_operations_);
   }
+  // The blobs shared with the operations of a segment would only be known
+  // once they were downloaded.
+  if (manifest_.shared_blobs_size() > kMaxSharedBlobsSize ||
+      (has_operations_segments_ && manifest_.shared_blobs_size() > 0) ||
+      !shared_blobs_.Init(partitions_, manifest_.shared_blobs_size())) {
+    LOG(ERROR) << "The operations share " << manifest_.shared_blobs_size()
+               << " bytes of blobs in a way that isn't supported.";
+    *error = ErrorCode::kDownloadManifestParseError;
+    return false;
+  }
 
   LOG_IF(WARNING, !prefs_->SetInt64(kPrefsManifestMetadataSize, metadata_size_))
       << "Unable to save the manifest metadata size.";
@@ -698,10 +1284,14 @@ bool DeltaPerformer::ParseManifest(const char** c_bytes,
     LOG(ERROR) << "Unable to prime the update state.";
     return false;
   }
+  MaybeReorderOperations();
+  FindSatisfiedOperations();
+  LoadApplyHints();
+  MaybeStartSourceVerification();
 
   if (next_operation_num_ < acc_num_operations_[current_partition_]) {
-    if (!OpenCurrentPartition()) {
-      *error = ErrorCode::kInstallDeviceOpenError;
+    partition_open_pending_ = true;
+    if (!OpenCurrentPartitionWhenLoaded(c_bytes, count, error)) {
       return false;
     }
   }
@@ -711,7 +1301,287 @@ bool DeltaPerformer::ParseManifest(const char** c_bytes,
   LOG(INFO) << "Starting to apply update payload operations";
   return true;
 }
+
+bool DeltaPerformer::LoadOperationsSegment(const char** c_bytes,
+                                           size_t* count,
+                                           ErrorCode* error) {
+  PartitionUpdate& partition = partitions_[current_partition_];
+  if (!partition.has_operations_segment() || partition.operations_size() > 0) {
+    return true;
+  }
+  const OperationsSegment& segment = partition.operations_segment();
+  const string pref_key = PrefsInterface::CreateSubKey(
+      {kPrefsUpdateStateOperationsSegment, partition.partition_name()});
+  if (buffer_offset_ != segment.data_offset()) {
+    // The attempt resumed is past the segment, which it stored.
+    string data;
+    if (buffer_offset_ < segment.data_offset() ||
+        !prefs_->GetString(pref_key, &data) ||
+        !PayloadMetadata::ParseOperationsSegment(
+            reinterpret_cast<const unsigned char*>(data.data()),
+            data.size(),
+            &partition)) {
+      LOG(ERROR) << "The operations of " << partition.partition_name()
+                 << " at offset " << segment.data_offset()
+                 << " aren't available at offset " << buffer_offset_;
+      *error = ErrorCode::kDownloadStateInitializationError;
+      return false;
+    }
+    return true;
+  }
+  CopyDataToBuffer(c_bytes, count, segment.data_length());
+  if (buffer_.size() < segment.data_length()) {
+    return true;
+  }
+  if (!PayloadMetadata::ParseOperationsSegment(
+          buffer_.data(), buffer_.size(), &partition)) {
+    *error = ErrorCode::kDownloadManifestParseError;
+    return false;
+  }
+  // A resumed attempt starting after the segment needs it again.
+  if (!prefs_->SetString(pref_key, ToStringView(buffer_))) {
+    LOG(ERROR) << "Unable to store the operations of "
+               << partition.partition_name();
+    *error = ErrorCode::kDownloadStateInitializationError;
+    return false;
+  }
+  LOG(INFO) << "Loaded the " << partition.operations_size()
+            << " operations of " << partition.partition_name() << ".";
+  DiscardBuffer(true, buffer_.size());
+  return true;
+}
+
+bool DeltaPerformer::OpenCurrentPartitionWhenLoaded(const char** c_bytes,
+                                                    size_t* count,
+                                                    ErrorCode* error) {
+  if (!LoadOperationsSegment(c_bytes, count, error)) {
+    return false;
+  }
+  const PartitionUpdate& partition = partitions_[current_partition_];
+  if (partition.has_operations_segment() && partition.operations_size() == 0) {
+    return true;
+  }
+  partition_open_pending_ = false;
+  if (!OpenCurrentPartition()) {
+    *error = ErrorCode::kInstallDeviceOpenError;
+    return false;
+  }
+  return true;
+}
+
+void DeltaPerformer::MaybeReorderOperations() {
+  // A resumed attempt keeps the order its checkpoint refers to.
+  if (next_operation_num_ == 0) {
+    reordered_operations_ = install_plan_->reorder_operations;
+  }
+  if (!reordered_operations_) {
+    return;
+  }
+  // The blobs shared by the operations are downloaded with the first one.
+  if (shared_blobs_.has_references()) {
+    LOG(INFO) << "Not reordering the operations, they share blobs.";
+    reordered_operations_ = false;
+    return;
+  }
+  if (has_operations_segments_) {
+    LOG(INFO) << "Not reordering the operations, they are in segments.";
+    reordered_operations_ = false;
+    return;
+  }
+  auto dynamic_control = boot_control_->GetDynamicPartitionControl();
+  const size_t num_previous_partitions =
+      install_plan_->partitions.size() - partitions_.size();
+  SeekDistance total_before;
+  SeekDistance total_after;
+  for (int i = 0; i < partitions_.size(); i++) {
+    PartitionUpdate& partition = partitions_[i];
+    const InstallPlan::Partition& install_part =
+        install_plan_->partitions[num_previous_partitions + i];
+    // The COW of VABC partitions is labelled with the index of the
+    // operations, and its merge sequence follows their order.
+    if (dynamic_control->UpdateUsesSnapshotCompression() &&
+        IsDynamicPartition(install_part.name, install_plan_->target_slot)) {
+      continue;
+    }
+    // Operations reading the partition they write depend on each other.
+    if (!install_part.source_path.empty() &&
+        install_part.source_path == install_part.target_path) {
+      continue;
+    }
+    if (!HaveDisjointTargets(partition.operations())) {
+      LOG(INFO) << "Not reordering the operations of " << install_part.name
+                << ", some of them write the same blocks.";
+      continue;
+    }
+    if (std::any_of(partition.operations().begin(),
+                    partition.operations().end(),
+                    [](const InstallOperation& op) {
+                      return op.type() == InstallOperation::TARGET_COPY;
+                    })) {
+      LOG(INFO) << "Not reordering the operations of " << install_part.name
+                << ", some of them read the blocks written by others.";
+      continue;
+    }
+    const SeekDistance before = ComputeSeekDistance(partition.operations());
+    ReorderOperations(partition.mutable_operations());
+    const SeekDistance after = ComputeSeekDistance(partition.operations());
+    LOG(INFO) << "Reordered the operations of " << install_part.name
+              << ", seek distance of the source reads " << before.source
+              << " -> " << after.source << " blocks, of the target writes "
+              << before.target << " -> " << after.target << " blocks.";
+    total_before.source += before.source;
+    total_before.target += before.target;
+    total_after.source += after.source;
+    total_after.target += after.target;
+  }
+  // In percent of the seek distance in the manifest order.
+  if (total_before.source > 0) {
+    LOCAL_HISTOGRAM_CUSTOM_COUNTS(
+        "UpdateEngine.DownloadAction.ReorderedSourceSeekDistance",
+        IntRatio(total_after.source, total_before.source, 100),
+        1,
+        1000,
+        50);
+  }
+  if (total_before.target > 0) {
+    LOCAL_HISTOGRAM_CUSTOM_COUNTS(
+        "UpdateEngine.DownloadAction.ReorderedTargetSeekDistance",
+        IntRatio(total_after.target, total_before.target, 100),
+        1,
+        1000,
+        50);
+  }
+}
+
+void DeltaPerformer::LoadApplyHints() {
+  acc_apply_costs_.clear();
+  if (has_operations_segments_) {
+    return;
+  }
+  uint64_t max_apply_memory_bytes = 0;
+  vector<uint64_t> acc_apply_costs{0};
+  acc_apply_costs.reserve(num_total_operations_ + 1);
+  for (const PartitionUpdate& partition : partitions_) {
+    for (const InstallOperation& op : partition.operations()) {
+      if (!op.has_apply_cost())
+        return;
+      acc_apply_costs.push_back(acc_apply_costs.back() + op.apply_cost());
+      max_apply_memory_bytes =
+          std::max(max_apply_memory_bytes, op.apply_memory_bytes());
+    }
+  }
+  acc_apply_costs_ = std::move(acc_apply_costs);
+  LOG(INFO) << "The operations cost an estimated "
+            << acc_apply_costs_.back() / 1000
+            << " ms to apply and need up to " << max_apply_memory_bytes
+            << " bytes of memory besides their data.";
+}
+
+void DeltaPerformer::FindSatisfiedOperations() {
+  // The operations in segments are only known once reached.
+  if (!install_plan_->skip_satisfied_operations || next_operation_num_ > 0 ||
+      has_operations_segments_) {
+    return;
+  }
+  const base::TimeTicks start_time = base::TimeTicks::Now();
+  auto dynamic_control = boot_control_->GetDynamicPartitionControl();
+  const size_t num_previous_partitions =
+      install_plan_->partitions.size() - partitions_.size();
+  for (int i = 0; i < partitions_.size(); i++) {
+    const PartitionUpdate& partition = partitions_[i];
+    const InstallPlan::Partition& install_part =
+        install_plan_->partitions[num_previous_partitions + i];
+    // VABC partitions are only written through their COW, the target can't
+    // be read back before the merge.
+    if (dynamic_control->UpdateUsesSnapshotCompression() &&
+        IsDynamicPartition(install_part.name, install_plan_->target_slot)) {
+      continue;
+    }
+    FileDescriptorPtr target = std::make_shared<EintrSafeFileDescriptor>();
+    if (install_part.target_path.empty() ||
+        !target->Open(install_part.target_path.c_str(), O_RDONLY)) {
+      LOG(WARNING) << "Unable to read " << install_part.name
+                   << " to find the operations already applied.";
+      continue;
+    }
+    const size_t satisfied = satisfied_operations_.CheckPartition(
+        partition, i > 0 ? acc_num_operations_[i - 1] : 0, target, block_size_);
+    target->Close();
+    LOG_IF(INFO, satisfied > 0)
+        << satisfied << " of the " << partition.operations_size()
+        << " operations of " << install_part.name << " are already applied.";
+  }
+  LOG(INFO) << "Found " << satisfied_operations_.count()
+            << " operations already applied in "
+            << utils::FormatTimeDelta(base::TimeTicks::Now() - start_time);
+
+  // Without signature of the whole payload, the hashes of the operations
+  // are only trusted when the metadata signature is mandatory.
+  const uint64_t data_start = metadata_size_ + metadata_signature_size_;
+  if (satisfied_operations_.count() == 0 || !allow_sparse_download_ ||
+      shared_blobs_.has_references() ||
+      !install_plan_->hash_checks_mandatory || payload_->size <= data_start) {
+    return;
+  }
+  auto ranges =
+      satisfied_operations_.PlanDownload(partitions_,
+                                         manifest_.signatures_offset(),
+                                         manifest_.signatures_size(),
+                                         kSparseDownloadMinGap);
+  uint64_t download_size = 0;
+  for (auto& [offset, length] : ranges) {
+    offset += data_start;
+    download_size += length;
+  }
+  if (download_size >= payload_->size - data_start) {
+    return;
+  }
+  LOG(INFO) << "Downloading " << download_size << " of the "
+            << payload_->size - data_start << " bytes of payload data, in "
+            << ranges.size() << " ranges.";
+  sparse_download_ranges_ = std::move(ranges);
+  payload_data_skipped_ = true;
+  prefs_->SetBoolean(kPrefsUpdateStatePayloadDataSkipped, true);
+}
+
+bool DeltaPerformer::SkipSatisfiedOperation(const InstallOperation& op,
+                                            SatisfiedOperations::Skip skip,
+                                            const char** c_bytes,
+                                            size_t* count) {
+  if (shared_blobs_.IsReference(next_operation_num_)) {
+    // The data was downloaded with the operation it references.
+    shared_blobs_.Release(next_operation_num_, op);
+  } else if (skip == SatisfiedOperations::Skip::kDownload) {
+    // The data was left out of the download, but counts as downloaded.
+    buffer_offset_ += op.data_length();
+    total_bytes_received_ += op.data_length();
+  } else if (op.data_length() > 0) {
+    CopyDataToBuffer(c_bytes, count, op.data_length());
+    if (!CanPerformInstallOperation(op)) {
+      return false;
+    }
+    shared_blobs_.Store(next_operation_num_, op, buffer_.data());
+    DiscardBuffer(true, buffer_.size());
+  }
+  // The partition isn't written in order anymore.
+  if (write_path_hasher_) {
+    write_path_hasher_->Invalidate();
+  }
+  return true;
+}
+
+bool DeltaPerformer::TakeSparseDownloadRanges(
+    vector<std::pair<uint64_t, uint64_t>>* ranges) {
+  if (sparse_download_ranges_.empty()) {
+    return false;
+  }
+  *ranges = std::move(sparse_download_ranges_);
+  sparse_download_ranges_.clear();
+  return true;
+}
+
 bool DeltaPerformer::ProcessOperation(const InstallOperation* op,
+                                      const uint8_t* data,
                                       ErrorCode* error) {
   // Validate the operation unconditionally. This helps prevent the
   // exploitation of vulnerabilities in the patching libraries, e.g. bspatch.
@@ -721,23 +1591,28 @@ bool DeltaPerformer::ProcessOperation(const InstallOperation* op,
   // Note: Validate must be called only if CanPerformInstallOperation is
   // called. Otherwise, we might be failing operations before even if there
   // isn't sufficient data to compute the proper hash.
-  *error = ValidateOperationHash(*op);
-  if (*error != ErrorCode::kSuccess) {
-    if (install_plan_->hash_checks_mandatory) {
-      LOG(ERROR) << "Mandatory operation hash check failed";
+  // The data of REPLACE operations is written as is, without going through
+  // any parser, so it can be hashed while it's written: a mismatch fails the
+  // operation before it's checkpointed, and a resumed update applies the
+  // operation again over the blocks written.
+  const bool validate_hash_concurrently =
+      op->type() == InstallOperation::REPLACE &&
+      op->data_length() >= kMinConcurrentOperationHashBytes;
+  if (!validate_hash_concurrently) {
+    *error = ValidateOperationHash(*op, data);
+    if (!HandleOperationHashResult(error)) {
       return false;
     }
-
-    // For non-mandatory cases, just send a UMA stat.
-    LOG(WARNING) << "Ignoring operation validation errors";
-    *error = ErrorCode::kSuccess;
   }
 
   // Makes sure we unblock exit when this operation completes.
   ScopedTerminatorExitUnblocker exit_unblocker =
       ScopedTerminatorExitUnblocker();  // Avoids a compiler unused var bug.
 
+  UE_TRACE_SCOPE(InstallOperationTypeName(op->type()));
   base::TimeTicks op_start_time = base::TimeTicks::Now();
+  ApplyStats::ScopedOperation measure(
+      &CurrentInstallPartition()->apply_stats, *op, block_size_);
 
   bool op_result{};
   const string op_name = InstallOperationTypeName(op->type());
@@ -745,7 +1620,15 @@ bool DeltaPerformer::ProcessOperation(const InstallOperation* op,
     case InstallOperation::REPLACE:
     case InstallOperation::REPLACE_BZ:
     case InstallOperation::REPLACE_XZ:
-      op_result = PerformReplaceOperation(*op);
+    case InstallOperation::REPLACE_ZSTD:
+      if (validate_hash_concurrently) {
+        op_result = PerformReplaceOperationValidatingHash(*op, data, error);
+        if (*error != ErrorCode::kSuccess) {
+          return false;
+        }
+      } else {
+        op_result = PerformReplaceOperation(*op, data);
+      }
       OP_DURATION_HISTOGRAM("REPLACE", op_start_time);
       break;
     case InstallOperation::ZERO:
@@ -763,9 +1646,13 @@ bool DeltaPerformer::ProcessOperation(const InstallOperation* op,
     case InstallOperation::ZUCCHINI:
     case InstallOperation::LZ4DIFF_PUFFDIFF:
     case InstallOperation::LZ4DIFF_BSDIFF:
-      op_result = PerformDiffOperation(*op, error);
+      op_result = PerformDiffOperation(*op, data, error);
       OP_DURATION_HISTOGRAM(op_name, op_start_time);
       break;
+    case InstallOperation::TARGET_COPY:
+      op_result = PerformTargetCopyOperation(*op);
+      OP_DURATION_HISTOGRAM("TARGET_COPY", op_start_time);
+      break;
     default:
       op_result = false;
   }
@@ -775,14 +1662,155 @@ bool DeltaPerformer::ProcessOperation(const InstallOperation* op,
   return true;
 }
 
+bool DeltaPerformer::EnqueueOperation(const InstallOperation& op,
+                                      const SharedBuffer* shared_blob,
+                                      ErrorCode* error) {
+  // Same validation as ProcessOperation(). The hash is computed on this
+  // thread, as |buffer_| is handed over to the worker afterwards.
+  *error = ValidateOperationHash(
+      op, shared_blob ? shared_blob->data() : buffer_.data());
+  TEST_AND_RETURN_FALSE(HandleOperationHashResult(error));
+
+  const size_t partition_op = GetPartitionOperationNum();
+  if (parallel_applier_ && op.type() == InstallOperation::TARGET_COPY &&
+      partition_op > 0 &&
+      partitions_[current_partition_].operations(partition_op - 1).type() !=
+          InstallOperation::TARGET_COPY) {
+    // The blocks read by the TARGET_COPY operations, written by the previous
+    // ones, may be pending or in the write cache of another writer.
+    TEST_AND_RETURN_FALSE(FlushPendingOperations(error));
+    if (!CheckpointPartitionWriters()) {
+      *error = ErrorCode::kDownloadWriteError;
+      return false;
+    }
+  } else if (parallel_applier_ && !parallel_applier_->CanEnqueue(op)) {
+    TEST_AND_RETURN_FALSE(FlushPendingOperations(error));
+  }
+
+  // The operations sharing a blob reference it instead of copying it.
+  SharedBuffer data;
+  if (shared_blob) {
+    data = *shared_blob;
+  } else if (op.data_length() > 0) {
+    TEST_AND_RETURN_FALSE(buffer_offset_ == op.data_offset());
+    TEST_AND_RETURN_FALSE(buffer_.size() >= op.data_length());
+    data = SharedBuffer(TakeBuffer());
+  }
+  if (partition_applier_) {
+    return partition_applier_->Enqueue(op, std::move(data), error);
+  }
+  parallel_applier_->Enqueue(op, std::move(data));
+  return true;
+}
+
+bool DeltaPerformer::FlushPendingOperations(ErrorCode* error) {
+  UE_TRACE_SCOPE("DeltaPerformer::FlushPendingOperations");
+  if (partition_applier_) {
+    // Makes sure we unblock exit when the pending operations complete.
+    ScopedTerminatorExitUnblocker exit_unblocker =
+        ScopedTerminatorExitUnblocker();  // Avoids a compiler unused var bug.
+    if (!partition_applier_->Wait(error)) {
+      LOG(ERROR) << "Failed to apply pending operations of the partitions";
+      return false;
+    }
+    return true;
+  }
+  if (!parallel_applier_ || !parallel_applier_->HasPendingOperations()) {
+    return true;
+  }
+  // Makes sure we unblock exit when the pending operations complete.
+  ScopedTerminatorExitUnblocker exit_unblocker =
+      ScopedTerminatorExitUnblocker();  // Avoids a compiler unused var bug.
+  if (!parallel_applier_->Flush(error)) {
+    LOG(ERROR) << "Failed to apply pending operations of partition \""
+               << partitions_[current_partition_].partition_name() << "\"";
+    return false;
+  }
+  return true;
+}
+
 bool DeltaPerformer::IsManifestValid() {
   return manifest_valid_;
 }
 
-bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
-  partitions_.assign(manifest_.partitions().begin(),
-                     manifest_.partitions().end());
+bool DeltaPerformer::TrustCachedManifest() {
+  std::string verified;
+  manifest_trusted_ = install_plan_->is_resume &&
+                      prefs_->GetString(kPrefsManifestVerified, &verified) &&
+                      verified == GetManifestVerifiedValue();
+  return manifest_trusted_;
+}
 
+void DeltaPerformer::MaybeChooseVabcCompression() {
+  auto& dap = *manifest_.mutable_dynamic_partition_metadata();
+  const std::string payload_compression = dap.vabc_compression_param();
+  if (!install_plan_->vabc_auto_compression || install_plan_->vabc_none ||
+      !dap.vabc_enabled() || payload_compression.empty() ||
+      payload_compression == "none") {
+    return;
+  }
+  uint64_t estimated_cow_size = 0;
+  uint64_t uncompressed_cow_size = 0;
+  for (const auto& partition : manifest_.partitions()) {
+    if (partition.has_estimate_cow_size()) {
+      estimated_cow_size += partition.estimate_cow_size();
+      uncompressed_cow_size +=
+          UncompressedCowSize(partition, manifest_.block_size());
+    }
+  }
+  // The COWs which don't fit in super are allocated on /data.
+  struct statvfs fs {};
+  if (statvfs("/data", &fs) != 0) {
+    PLOG(WARNING) << "Failed to get the free space of /data, keeping the "
+                     "COW compression.";
+    return;
+  }
+  const uint64_t space_budget =
+      static_cast<uint64_t>(fs.f_bavail) * fs.f_frsize / kVabcFreeSpaceDivisor;
+
+  std::vector<std::string> compressions(std::begin(kVabcCompressionCandidates),
+                                        std::end(kVabcCompressionCandidates));
+  if (std::find(compressions.begin(),
+                compressions.end(),
+                payload_compression) == compressions.end()) {
+    compressions.push_back(payload_compression);
+  }
+  const auto benchmarks = LoadOrRunCowCompressionBenchmarks(
+      prefs_, compressions, manifest_.block_size());
+  const std::string compression = ChooseCowCompression(benchmarks,
+                                                       payload_compression,
+                                                       estimated_cow_size,
+                                                       uncompressed_cow_size,
+                                                       space_budget);
+  LOG(INFO) << "Chose COW compression " << compression << " over the "
+            << "payload's " << payload_compression << ", COW space budget is "
+            << space_budget << " bytes.";
+  if (compression == payload_compression) {
+    return;
+  }
+  if (compression == "none") {
+    install_plan_->vabc_none = true;
+    return;
+  }
+  const auto ratio = [&benchmarks](const std::string& compression) {
+    return std::find_if(benchmarks.begin(),
+                        benchmarks.end(),
+                        [&compression](const auto& benchmark) {
+                          return benchmark.compression == compression;
+                        })
+        ->ratio;
+  };
+  const double scale = ratio(compression) / ratio(payload_compression) *
+                       kProjectedCowSizeHeadroom;
+  dap.set_vabc_compression_param(compression);
+  for (auto& partition : *manifest_.mutable_partitions()) {
+    if (partition.has_estimate_cow_size()) {
+      partition.set_estimate_cow_size(partition.estimate_cow_size() * scale);
+    }
+  }
+}
+
+bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
   // For VAB and partial updates, the partition preparation will copy the
   // dynamic partitions metadata to the target metadata slot, and rename the
   // slot suffix of the partitions in the metadata.
@@ -800,8 +1828,6 @@ bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
     }
   }
 
-  // Partitions in manifest are no longer needed after preparing partitions.
-  manifest_.clear_partitions();
   // TODO(xunchang) TBD: allow partial update only on devices with dynamic
   // partition.
   if (manifest_.partial_update()) {
@@ -824,9 +1850,9 @@ bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
       *error = ErrorCode::kDownloadStateInitializationError;
       return false;
     }
-    partitions_.insert(partitions_.end(),
-                       untouched_static_partitions.begin(),
-                       untouched_static_partitions.end());
+    for (auto& partition_update : untouched_static_partitions) {
+      *partitions_.Add() = std::move(partition_update);
+    }
 
     // Save the untouched dynamic partitions in install plan.
     std::vector<std::string> dynamic_partitions;
@@ -858,8 +1884,9 @@ bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
       << " ms";
 
   auto&& has_verity = [](const auto& part) {
-    return part.fec_extent().num_blocks() > 0 ||
-           part.hash_tree_extent().num_blocks() > 0;
+    return (part.fec_extent().num_blocks() > 0 && !part.fec_in_payload()) ||
+           (part.hash_tree_extent().num_blocks() > 0 &&
+            !part.hash_tree_in_payload());
   };
   if (!std::any_of(partitions_.begin(), partitions_.end(), has_verity)) {
     install_plan_->write_verity = false;
@@ -951,23 +1978,45 @@ bool DeltaPerformer::CanPerformInstallOperation(
           buffer_offset_ + buffer_.size());
 }
 
-bool DeltaPerformer::PerformReplaceOperation(
-    const InstallOperation& operation) {
+bool DeltaPerformer::CanPerformInstallOperationInPlace(
+    const InstallOperation& operation, size_t count) const {
+  // Only blobs starting exactly at the current offset can be taken from the
+  // incoming chunk, anything already partially buffered must stay in
+  // |buffer_|.
+  return operation.data_length() > 0 && buffer_.empty() &&
+         operation.data_offset() == buffer_offset_ &&
+         operation.data_length() <= count;
+}
+
+bool DeltaPerformer::PerformReplaceOperation(const InstallOperation& operation,
+                                             const uint8_t* data) {
   CHECK(operation.type() == InstallOperation::REPLACE ||
         operation.type() == InstallOperation::REPLACE_BZ ||
-        operation.type() == InstallOperation::REPLACE_XZ);
-
-  // Since we delete data off the beginning of the buffer as we use it,
-  // the data we need should be exactly at the beginning of the buffer.
-  TEST_AND_RETURN_FALSE(buffer_.size() >= operation.data_length());
+        operation.type() == InstallOperation::REPLACE_XZ ||
+        operation.type() == InstallOperation::REPLACE_ZSTD);
 
   TEST_AND_RETURN_FALSE(partition_writer_->PerformReplaceOperation(
-      operation, buffer_.data(), buffer_.size()));
-  // Update buffer
-  DiscardBuffer(true, buffer_.size());
+      operation, data, operation.data_length()));
   return true;
 }
 
+bool DeltaPerformer::PerformReplaceOperationValidatingHash(
+    const InstallOperation& operation, const uint8_t* data, ErrorCode* error) {
+  // The hash runs first when the writer's pool gives the two tasks a single
+  // thread.
+  ErrorCode hash_error = ErrorCode::kSuccess;
+  const bool result = partition_writer_->ParallelFor(2, [&](size_t task) {
+    if (task == 0) {
+      hash_error = ValidateOperationHash(operation, data);
+      return true;
+    }
+    return PerformReplaceOperation(operation, data);
+  });
+  *error = hash_error;
+  TEST_AND_RETURN_FALSE(HandleOperationHashResult(error));
+  return result;
+}
+
 bool DeltaPerformer::PerformZeroOrDiscardOperation(
     const InstallOperation& operation) {
   CHECK(operation.type() == InstallOperation::DISCARD ||
@@ -989,6 +2038,14 @@ bool DeltaPerformer::PerformSourceCopyOperation(
   return partition_writer_->PerformSourceCopyOperation(operation, error);
 }
 
+bool DeltaPerformer::PerformTargetCopyOperation(
+    const InstallOperation& operation) {
+  // These operations have no blob.
+  TEST_AND_RETURN_FALSE(!operation.has_data_offset());
+  TEST_AND_RETURN_FALSE(!operation.has_data_length());
+  return partition_writer_->PerformTargetCopyOperation(operation);
+}
+
 bool DeltaPerformer::ExtentsToBsdiffPositionsString(
     const RepeatedPtrField<Extent>& extents,
     uint64_t block_size,
@@ -1012,19 +2069,18 @@ bool DeltaPerformer::ExtentsToBsdiffPositionsString(
 }
 
 bool DeltaPerformer::PerformDiffOperation(const InstallOperation& operation,
+                                          const uint8_t* data,
                                           ErrorCode* error) {
-  // Since we delete data off the beginning of the buffer as we use it,
-  // the data we need should be exactly at the beginning of the buffer.
+  // Since we consume data off the beginning of the blobs section as we use it,
+  // the data we need should start exactly at the current offset.
   TEST_AND_RETURN_FALSE(buffer_offset_ == operation.data_offset());
-  TEST_AND_RETURN_FALSE(buffer_.size() >= operation.data_length());
   if (operation.has_src_length())
     TEST_AND_RETURN_FALSE(operation.src_length() % block_size_ == 0);
   if (operation.has_dst_length())
     TEST_AND_RETURN_FALSE(operation.dst_length() % block_size_ == 0);
 
   TEST_AND_RETURN_FALSE(partition_writer_->PerformDiffOperation(
-      operation, error, buffer_.data(), buffer_.size()));
-  DiscardBuffer(true, buffer_.size());
+      operation, error, data, operation.data_length()));
   return true;
 }
 
@@ -1083,6 +2139,20 @@ DeltaPerformer::CreatePayloadVerifier() {
   return {PayloadVerifier::CreateInstance(public_key), true};
 }
 
+std::string DeltaPerformer::GetManifestVerifiedValue() const {
+  // The manifest bytes themselves are trusted like the rest of the update
+  // state in |prefs_|; hashing them again would cost as much as verifying
+  // their signature.
+  brillo::Blob hash;
+  const std::string data =
+      base::HexEncode(payload_->hash.data(), payload_->hash.size()) + ":" +
+      std::to_string(payload_->size) + ":" + payload_->metadata_signature;
+  if (!HashCalculator::RawHashOfBytes(data.data(), data.size(), &hash)) {
+    return "";
+  }
+  return base::HexEncode(hash.data(), hash.size());
+}
+
 ErrorCode DeltaPerformer::ValidateManifest() {
   // Perform assorted checks to validation check the manifest, make sure it
   // matches data from other sources, and that it is a supported version.
@@ -1246,8 +2316,22 @@ ErrorCode DeltaPerformer::CheckTimestampError() const {
   return ErrorCode::kSuccess;
 }
 
+bool DeltaPerformer::HandleOperationHashResult(ErrorCode* error) {
+  if (*error == ErrorCode::kSuccess) {
+    return true;
+  }
+  if (install_plan_->hash_checks_mandatory) {
+    LOG(ERROR) << "Mandatory operation hash check failed";
+    return false;
+  }
+  // For non-mandatory cases, just send a UMA stat.
+  LOG(WARNING) << "Ignoring operation validation errors";
+  *error = ErrorCode::kSuccess;
+  return true;
+}
+
 ErrorCode DeltaPerformer::ValidateOperationHash(
-    const InstallOperation& operation) {
+    const InstallOperation& operation, const uint8_t* data) {
   if (!operation.data_sha256_hash().size()) {
     if (!operation.data_length()) {
       // Operations that do not have any data blob won't have any operation
@@ -1291,7 +2375,7 @@ ErrorCode DeltaPerformer::ValidateOperationHash(
 
   brillo::Blob calculated_op_hash;
   if (!HashCalculator::RawHashOfBytes(
-          buffer_.data(), operation.data_length(), &calculated_op_hash)) {
+          data, operation.data_length(), &calculated_op_hash)) {
     LOG(ERROR) << "Unable to compute actual hash of operation "
                << next_operation_num_;
     return ErrorCode::kDownloadOperationHashVerificationError;
@@ -1321,6 +2405,8 @@ ErrorCode DeltaPerformer::ValidateOperationHash(
 ErrorCode DeltaPerformer::VerifyPayload(
     const brillo::Blob& update_check_response_hash,
     const uint64_t update_check_response_size) {
+  UE_TRACE_SCOPE("DeltaPerformer::VerifyPayload");
+  payload_hasher_.Wait();
   // Verifies the download size.
   if (update_check_response_size !=
       metadata_size_ + metadata_signature_size_ + buffer_offset_) {
@@ -1331,6 +2417,12 @@ ErrorCode DeltaPerformer::VerifyPayload(
     return ErrorCode::kPayloadSizeMismatchError;
   }
 
+  if (payload_data_skipped_) {
+    LOG(INFO) << "Not verifying the payload hash and signature, part of the "
+              << "payload data wasn't downloaded.";
+    return ErrorCode::kSuccess;
+  }
+
   // Verifies the payload hash.
   TEST_AND_RETURN_VAL(ErrorCode::kDownloadPayloadVerificationError,
                       !payload_hash_calculator_.raw_hash().empty());
@@ -1377,21 +2469,38 @@ void DeltaPerformer::DiscardBuffer(bool do_advance_offset,
   if (do_advance_offset)
     buffer_offset_ += buffer_.size();
 
-  // Hash the content.
-  payload_hash_calculator_.Update(buffer_.data(), buffer_.size());
-  signed_hash_calculator_.Update(buffer_.data(), signed_hash_buffer_size);
+  // Hash the content. The buffer is handed over to |payload_hasher_|, which
+  // releases its memory once hashed.
+  payload_hasher_.Update(std::move(buffer_), signed_hash_buffer_size);
+  buffer_ = brillo::Blob();
+  buffer_reservation_.Reset();
+}
+
+void DeltaPerformer::ConsumeOperationData(const uint8_t* data, size_t count) {
+  buffer_offset_ += count;
+  payload_hasher_.UpdateBorrowed(data, count, count);
+}
 
-  // Swap content with an empty vector to ensure that all memory is released.
-  brillo::Blob().swap(buffer_);
+brillo::Blob DeltaPerformer::TakeBuffer() {
+  buffer_offset_ += buffer_.size();
+  // The blob may be released by the operation appliers at any time, so it is
+  // hashed right away.
+  payload_hasher_.UpdateNow(buffer_.data(), buffer_.size(), buffer_.size());
+  brillo::Blob data;
+  data.swap(buffer_);
+  // The operation appliers account for the blob from now on.
+  buffer_reservation_.Reset();
+  return data;
 }
 
 bool DeltaPerformer::CanResumeUpdate(PrefsInterface* prefs,
                                      const string& update_check_response_hash) {
-  int64_t next_operation = kUpdateStateOperationInvalid;
-  if (!(prefs->GetInt64(kPrefsUpdateStateNextOperation, &next_operation) &&
-        next_operation != kUpdateStateOperationInvalid && next_operation > 0)) {
+  UpdateCheckpoint checkpoint;
+  if (!(LoadUpdateCheckpoint(prefs, &checkpoint) &&
+        checkpoint.next_operation != kUpdateStateOperationInvalid &&
+        checkpoint.next_operation > 0)) {
     LOG(WARNING) << "Failed to resume update " << kPrefsUpdateStateNextOperation
-                 << " invalid: " << next_operation;
+                 << " invalid: " << checkpoint.next_operation;
     return false;
   }
 
@@ -1417,18 +2526,14 @@ bool DeltaPerformer::CanResumeUpdate(PrefsInterface* prefs,
   }
 
   // Validation check the rest.
-  int64_t next_data_offset = -1;
-  if (!(prefs->GetInt64(kPrefsUpdateStateNextDataOffset, &next_data_offset) &&
-        next_data_offset >= 0)) {
+  if (checkpoint.next_data_offset < 0) {
     LOG(WARNING) << "Failed to resume update "
                  << kPrefsUpdateStateNextDataOffset
-                 << " invalid: " << next_data_offset;
+                 << " invalid: " << checkpoint.next_data_offset;
     return false;
   }
 
-  string sha256_context;
-  if (!(prefs->GetString(kPrefsUpdateStateSHA256Context, &sha256_context) &&
-        !sha256_context.empty())) {
+  if (checkpoint.sha256_context.empty()) {
     LOG(WARNING) << "Failed to resume update " << kPrefsUpdateStateSHA256Context
                  << " is empty.";
     return false;
@@ -1460,14 +2565,25 @@ bool DeltaPerformer::ResetUpdateProgress(
     bool skip_dynamic_partititon_metadata_updated) {
   TEST_AND_RETURN_FALSE(prefs->SetInt64(kPrefsUpdateStateNextOperation,
                                         kUpdateStateOperationInvalid));
+  prefs->Delete(kPrefsUpdateStateCheckpoint);
   if (!quick) {
     prefs->SetInt64(kPrefsUpdateStateNextDataOffset, -1);
     prefs->SetInt64(kPrefsUpdateStateNextDataLength, 0);
     prefs->SetString(kPrefsUpdateStateSHA256Context, "");
     prefs->SetString(kPrefsUpdateStateSignedSHA256Context, "");
     prefs->SetString(kPrefsUpdateStateSignatureBlob, "");
+    prefs->Delete(kPrefsUpdateStateWritePathHashContext);
+    prefs->Delete(kPrefsUpdateStatePayloadDataSkipped);
+    prefs->Delete(kPrefsUpdateStateReorderedOperations);
+    vector<string> segment_keys;
+    if (prefs->GetSubKeys(kPrefsUpdateStateOperationsSegment, &segment_keys)) {
+      for (const string& key : segment_keys) {
+        prefs->Delete(key);
+      }
+    }
     prefs->SetInt64(kPrefsManifestMetadataSize, -1);
     prefs->SetInt64(kPrefsManifestSignatureSize, -1);
+    prefs->Delete(kPrefsManifestVerified);
     prefs->SetInt64(kPrefsResumedUpdateFailures, 0);
     prefs->Delete(kPrefsPostInstallSucceeded);
     prefs->Delete(kPrefsVerityWritten);
@@ -1479,27 +2595,161 @@ bool DeltaPerformer::ResetUpdateProgress(
   return true;
 }
 
+void DeltaPerformer::SetCheckpointIntervalBounds(
+    base::TimeDelta min_interval, base::TimeDelta max_interval) {
+  checkpoint_min_interval_ms = min_interval.InMilliseconds();
+  checkpoint_max_interval_ms = max_interval.InMilliseconds();
+}
+
 bool DeltaPerformer::ShouldCheckpoint() {
   base::TimeTicks curr_time = base::TimeTicks::Now();
   if (curr_time > update_checkpoint_time_) {
-    update_checkpoint_time_ = curr_time + update_checkpoint_wait_;
+    checkpoint_scheduler_.SetBounds(
+        base::TimeDelta::FromMilliseconds(checkpoint_min_interval_ms),
+        base::TimeDelta::FromMilliseconds(checkpoint_max_interval_ms));
+    update_checkpoint_time_ = curr_time + checkpoint_scheduler_.interval();
     return true;
   }
   return false;
 }
 
+int64_t DeltaPerformer::GetNextOperationDataLength() {
+  if (next_operation_num_ >= num_total_operations_) {
+    return 0;
+  }
+  size_t partition_index = current_partition_;
+  while (next_operation_num_ >= acc_num_operations_[partition_index]) {
+    partition_index++;
+  }
+  const size_t partition_operation_num =
+      next_operation_num_ -
+      (partition_index ? acc_num_operations_[partition_index - 1] : 0);
+  const PartitionUpdate& partition = partitions_[partition_index];
+  // The operations of the next partition may not be loaded yet.
+  if (partition_operation_num >=
+      static_cast<size_t>(partition.operations_size())) {
+    return 0;
+  }
+  return partition.operations(partition_operation_num).data_length();
+}
+
+bool DeltaPerformer::CheckpointPartitionWriters() {
+  if (partition_writer_) {
+    // The writers write back their data at the same time, before the flushes
+    // wait for it.
+    TEST_AND_RETURN_FALSE(partition_writer_->StartCheckpoint());
+    if (parallel_applier_) {
+      TEST_AND_RETURN_FALSE(parallel_applier_->CheckpointUpdateProgress(
+          GetPartitionOperationNum()));
+    }
+    TEST_AND_RETURN_FALSE(partition_writer_->CheckpointUpdateProgress(
+        GetPartitionOperationNum()));
+  } else if (!partition_open_pending_) {
+    // Unless the next partition waits for its operations segment, after the
+    // previous one was finished.
+    CHECK_EQ(next_operation_num_, num_total_operations_)
+        << "Partition writer is null, we are expected to finish all "
+           "operations: "
+        << next_operation_num_ << "/" << num_total_operations_;
+  }
+  return true;
+}
+
 bool DeltaPerformer::CheckpointUpdateProgress(bool force) {
   if (!force && !ShouldCheckpoint()) {
     return false;
   }
+  // A resumed update wouldn't have the blobs held for the next operations.
+  if (!shared_blobs_.empty()) {
+    return false;
+  }
   Terminator::set_exit_blocked(true);
+  const base::TimeTicks start_time = base::TimeTicks::Now();
+  bool stored = false;
+  if (partition_applier_) {
+    stored = CheckpointConcurrentApply(force);
+  } else {
+    // The partitions must hold the data of all applied operations before
+    // the checkpoint claims so.
+    if ((last_updated_operation_num_ != next_operation_num_ || force) &&
+        !CheckpointPartitionWriters()) {
+      LOG(ERROR) << "Not checkpointing operations whose data wasn't written.";
+      return false;
+    }
+    stored = StoreCheckpoint(CurrentCheckpoint(), force);
+  }
+  // The checkpoints which had nothing new to store don't tell their cost.
+  if (stored && buffer_offset_ > last_checkpoint_data_offset_) {
+    const base::TimeTicks end_time = base::TimeTicks::Now();
+    if (!last_checkpoint_time_.is_null()) {
+      checkpoint_scheduler_.OnCheckpoint(
+          end_time - start_time,
+          end_time - last_checkpoint_time_,
+          buffer_offset_ - last_checkpoint_data_offset_);
+    }
+    last_checkpoint_time_ = end_time;
+    last_checkpoint_data_offset_ = buffer_offset_;
+  }
+  return stored;
+}
+
+UpdateCheckpoint DeltaPerformer::CurrentCheckpoint() {
+  // The hash contexts must cover all the data before |buffer_offset_|.
+  payload_hasher_.Wait();
+  UpdateCheckpoint checkpoint;
+  checkpoint.next_operation = next_operation_num_;
+  checkpoint.next_data_offset = buffer_offset_;
+  checkpoint.next_data_length = GetNextOperationDataLength();
+  checkpoint.sha256_context = payload_hash_calculator_.GetContext();
+  checkpoint.signed_sha256_context = signed_hash_calculator_.GetContext();
+  checkpoint.signature_blob = signatures_message_data_;
+  if (write_path_hasher_) {
+    checkpoint.write_path_hash_context = write_path_hasher_->GetContext();
+  }
+  if (written_blocks_) {
+    checkpoint.written_blocks = written_blocks_->Serialize();
+  }
+  checkpoint.reordered_operations = reordered_operations_;
+  return checkpoint;
+}
+
+bool DeltaPerformer::StoreCheckpoint(const UpdateCheckpoint& checkpoint,
+                                     bool force) {
+  UE_TRACE_SCOPE("DeltaPerformer::StoreCheckpoint");
+  const uint64_t next_operation = checkpoint.next_operation;
+  const bool changed = last_updated_operation_num_ != next_operation || force;
+  if (install_plan_->checkpoint_record) {
+    if (!changed) {
+      return true;
+    }
+    TEST_AND_RETURN_FALSE(StoreUpdateCheckpoint(prefs_, checkpoint));
+    last_updated_operation_num_ = next_operation;
+    if (!checkpoint_format_migrated_) {
+      // Once the record is in place, make sure falling back to the keys of an
+      // older attempt, should the record get corrupted, can't resume the
+      // update from an earlier operation.
+      LOG_IF(WARNING,
+             !prefs_->SetInt64(kPrefsUpdateStateNextOperation,
+                               kUpdateStateOperationInvalid))
+          << "Unable to invalidate " << kPrefsUpdateStateNextOperation;
+      checkpoint_format_migrated_ = true;
+    }
+    return true;
+  }
+
   LOG_IF(WARNING, !prefs_->StartTransaction())
       << "unable to start transaction in checkpointing";
   DEFER {
     prefs_->CancelTransaction();
   };
-  if (last_updated_operation_num_ != next_operation_num_ || force) {
-    if (!signatures_message_data_.empty()) {
+  if (!checkpoint_format_migrated_) {
+    // A record left by an attempt checkpointing with it would take precedence
+    // over the keys written below.
+    prefs_->Delete(kPrefsUpdateStateCheckpoint);
+    checkpoint_format_migrated_ = true;
+  }
+  if (changed) {
+    if (!checkpoint.signature_blob.empty()) {
       // Save the signature blob because if the update is interrupted after the
       // download phase we don't go through this path anymore. Some alternatives
       // to consider:
@@ -1511,84 +2761,113 @@ bool DeltaPerformer::CheckpointUpdateProgress(bool force) {
       // the blob and the signed sha-256 context.
       LOG_IF(WARNING,
              !prefs_->SetString(kPrefsUpdateStateSignatureBlob,
-                                signatures_message_data_))
+                                checkpoint.signature_blob))
           << "Unable to store the signature blob.";
     }
-    TEST_AND_RETURN_FALSE(prefs_->SetString(
-        kPrefsUpdateStateSHA256Context, payload_hash_calculator_.GetContext()));
+    TEST_AND_RETURN_FALSE(prefs_->SetString(kPrefsUpdateStateSHA256Context,
+                                            checkpoint.sha256_context));
     TEST_AND_RETURN_FALSE(
         prefs_->SetString(kPrefsUpdateStateSignedSHA256Context,
-                          signed_hash_calculator_.GetContext()));
+                          checkpoint.signed_sha256_context));
+    TEST_AND_RETURN_FALSE(prefs_->SetInt64(kPrefsUpdateStateNextDataOffset,
+                                           checkpoint.next_data_offset));
+    last_updated_operation_num_ = next_operation;
+    TEST_AND_RETURN_FALSE(prefs_->SetInt64(kPrefsUpdateStateNextDataLength,
+                                           checkpoint.next_data_length));
+    // Losing it only means reading the partition back.
+    LOG_IF(WARNING,
+           install_plan_->trusted_write_path_hash &&
+               !prefs_->SetString(kPrefsUpdateStateWritePathHashContext,
+                                  checkpoint.write_path_hash_context))
+        << "Unable to store the write path hash context.";
     TEST_AND_RETURN_FALSE(
-        prefs_->SetInt64(kPrefsUpdateStateNextDataOffset, buffer_offset_));
-    last_updated_operation_num_ = next_operation_num_;
-
-    if (next_operation_num_ < num_total_operations_) {
-      size_t partition_index = current_partition_;
-      while (next_operation_num_ >= acc_num_operations_[partition_index]) {
-        partition_index++;
-      }
-      const size_t partition_operation_num =
-          next_operation_num_ -
-          (partition_index ? acc_num_operations_[partition_index - 1] : 0);
-      const InstallOperation& op =
-          partitions_[partition_index].operations(partition_operation_num);
-      TEST_AND_RETURN_FALSE(
-          prefs_->SetInt64(kPrefsUpdateStateNextDataLength, op.data_length()));
-    } else {
-      TEST_AND_RETURN_FALSE(
-          prefs_->SetInt64(kPrefsUpdateStateNextDataLength, 0));
-    }
-    if (partition_writer_) {
-      partition_writer_->CheckpointUpdateProgress(GetPartitionOperationNum());
-    } else {
-      CHECK_EQ(next_operation_num_, num_total_operations_)
-          << "Partition writer is null, we are expected to finish all "
-             "operations: "
-          << next_operation_num_ << "/" << num_total_operations_;
-    }
+        prefs_->SetBoolean(kPrefsUpdateStateReorderedOperations,
+                           checkpoint.reordered_operations));
   }
-  TEST_AND_RETURN_FALSE(
-      prefs_->SetInt64(kPrefsUpdateStateNextOperation, next_operation_num_));
+  TEST_AND_RETURN_FALSE(prefs_->SetInt64(kPrefsUpdateStateNextOperation,
+                                         checkpoint.next_operation));
   if (!prefs_->SubmitTransaction()) {
     LOG(ERROR) << "Failed to submit transaction in checkpointing";
   }
   return true;
 }
 
+bool DeltaPerformer::CheckpointConcurrentApply(bool force) {
+  // The payload position and hashes are captured now, but the operations
+  // before it may still be applied in the background: the marker queued
+  // along with them tells when the checkpoint can be persisted.
+  pending_checkpoints_.emplace_back(
+      partition_applier_->EnqueueCheckpoint(GetPartitionOperationNum()),
+      CurrentCheckpoint());
+  if (force) {
+    ErrorCode error = ErrorCode::kSuccess;
+    LOG_IF(ERROR, !FlushPendingOperations(&error))
+        << "Checkpointing the progress made before the failure: "
+        << utils::ErrorCodeToString(error);
+  }
+  return StoreReachedCheckpoint(force);
+}
+
+bool DeltaPerformer::StoreReachedCheckpoint(bool force) {
+  const uint64_t reached = partition_applier_->ReachedCheckpoint();
+  size_t num_reached = 0;
+  while (num_reached < pending_checkpoints_.size() &&
+         pending_checkpoints_[num_reached].first <= reached) {
+    num_reached++;
+  }
+  if (num_reached == 0) {
+    return false;
+  }
+  const bool stored =
+      StoreCheckpoint(pending_checkpoints_[num_reached - 1].second, force);
+  pending_checkpoints_.erase(pending_checkpoints_.begin(),
+                             pending_checkpoints_.begin() + num_reached);
+  return stored;
+}
+
 bool DeltaPerformer::PrimeUpdateState() {
   CHECK(manifest_valid_);
 
-  int64_t next_operation = kUpdateStateOperationInvalid;
-  if (!prefs_->GetInt64(kPrefsUpdateStateNextOperation, &next_operation) ||
-      next_operation == kUpdateStateOperationInvalid || next_operation <= 0) {
-    // Initiating a new update, no more state needs to be initialized.
+  base::FilePath non_volatile_dir;
+  if (install_plan_->operation_data_checkpoint_size > 0 &&
+      hardware_->GetNonVolatileDirectory(&non_volatile_dir)) {
+    operation_data_checkpoint_ = std::make_unique<OperationDataCheckpoint>(
+        non_volatile_dir.Append(kOperationDataCheckpointFileName).value());
+  }
+
+  UpdateCheckpoint checkpoint;
+  if (!LoadUpdateCheckpoint(prefs_, &checkpoint) ||
+      checkpoint.next_operation == kUpdateStateOperationInvalid ||
+      checkpoint.next_operation <= 0) {
+    // Initiating a new update, no more state needs to be initialized. The
+    // data saved by an earlier update isn't for this one.
+    if (operation_data_checkpoint_) {
+      operation_data_checkpoint_->Clear();
+    }
     return true;
   }
-  next_operation_num_ = next_operation;
+  next_operation_num_ = checkpoint.next_operation;
+  reordered_operations_ = checkpoint.reordered_operations;
 
   // Resuming an update -- load the rest of the update state.
-  int64_t next_data_offset = -1;
-  TEST_AND_RETURN_FALSE(
-      prefs_->GetInt64(kPrefsUpdateStateNextDataOffset, &next_data_offset) &&
-      next_data_offset >= 0);
-  buffer_offset_ = next_data_offset;
+  TEST_AND_RETURN_FALSE(checkpoint.next_data_offset >= 0);
+  buffer_offset_ = checkpoint.next_data_offset;
 
   // The signed hash context and the signature blob may be empty if the
   // interrupted update didn't reach the signature.
-  string signed_hash_context;
-  if (prefs_->GetString(kPrefsUpdateStateSignedSHA256Context,
-                        &signed_hash_context)) {
+  payload_hasher_.Wait();
+  if (!checkpoint.signed_sha256_context.empty()) {
     TEST_AND_RETURN_FALSE(
-        signed_hash_calculator_.SetContext(signed_hash_context));
+        signed_hash_calculator_.SetContext(checkpoint.signed_sha256_context));
   }
 
-  prefs_->GetString(kPrefsUpdateStateSignatureBlob, &signatures_message_data_);
+  signatures_message_data_ = std::move(checkpoint.signature_blob);
+  resumed_write_path_hash_context_ =
+      std::move(checkpoint.write_path_hash_context);
+  resumed_written_blocks_ = std::move(checkpoint.written_blocks);
 
-  string hash_context;
   TEST_AND_RETURN_FALSE(
-      prefs_->GetString(kPrefsUpdateStateSHA256Context, &hash_context) &&
-      payload_hash_calculator_.SetContext(hash_context));
+      payload_hash_calculator_.SetContext(checkpoint.sha256_context));
 
   int64_t manifest_metadata_size = 0;
   TEST_AND_RETURN_FALSE(
@@ -1602,9 +2881,23 @@ bool DeltaPerformer::PrimeUpdateState() {
       manifest_signature_size >= 0);
   metadata_signature_size_ = manifest_signature_size;
 
+  // The data of the next operation downloaded before the interruption isn't
+  // downloaded again, see DownloadAction.
+  if (operation_data_checkpoint_) {
+    TEST_AND_RETURN_FALSE(
+        operation_data_checkpoint_->Load(buffer_offset_, &buffer_));
+    buffer_reservation_.Resize(buffer_.capacity());
+  }
+
   // Advance the download progress to reflect what doesn't need to be
   // re-downloaded.
-  total_bytes_received_ += buffer_offset_;
+  total_bytes_received_ += buffer_offset_ + buffer_.size();
+
+  bool payload_data_skipped = false;
+  if (prefs_->GetBoolean(kPrefsUpdateStatePayloadDataSkipped,
+                         &payload_data_skipped)) {
+    payload_data_skipped_ = payload_data_skipped;
+  }
 
   // Speculatively count the resume as a failure.
   int64_t resumed_update_failures{};
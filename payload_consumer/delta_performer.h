@@ -20,6 +20,8 @@
 #include <inttypes.h>
 
 #include <limits>
+#include <deque>
+#include <future>
 #include <memory>
 #include <string>
 #include <utility>
@@ -27,16 +29,31 @@
 
 #include <base/time/time.h>
 #include <brillo/secure_blob.h>
+#include <google/protobuf/arena.h>
 #include <google/protobuf/repeated_field.h>
 #include <gtest/gtest_prod.h>  // for FRIEND_TEST
 
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/platform_constants.h"
+#include "update_engine/payload_consumer/checkpoint_scheduler.h"
+#include "update_engine/payload_consumer/concurrent_partition_applier.h"
 #include "update_engine/payload_consumer/file_writer.h"
 #include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/memory_budget.h"
+#include "update_engine/payload_consumer/operation_data_checkpoint.h"
+#include "update_engine/payload_consumer/operation_schedule.h"
+#include "update_engine/payload_consumer/parallel_operation_applier.h"
 #include "update_engine/payload_consumer/partition_writer_interface.h"
+#include "update_engine/payload_consumer/payload_hasher.h"
 #include "update_engine/payload_consumer/payload_metadata.h"
 #include "update_engine/payload_consumer/payload_verifier.h"
+#include "update_engine/payload_consumer/progress_counter.h"
+#include "update_engine/payload_consumer/satisfied_operations.h"
+#include "update_engine/payload_consumer/shared_blobs.h"
+#include "update_engine/payload_consumer/source_prefetcher.h"
+#include "update_engine/payload_consumer/source_verifier.h"
+#include "update_engine/payload_consumer/update_checkpoint.h"
+#include "update_engine/payload_consumer/write_path_hasher.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -82,6 +99,11 @@ class DeltaPerformer : public FileWriter {
         update_certificates_path_(std::move(update_certificates_path)),
         interactive_(interactive) {
     CHECK(install_plan_);
+    MemoryBudget::Get()->SetLimit(install_plan_->memory_budget);
+    MemoryBudget::Get()->ResetPeak();
+    if (install_plan_->async_payload_hash) {
+      payload_hasher_.Start();
+    }
   }
 
   // FileWriter's Write implementation where caller doesn't care about
@@ -111,6 +133,25 @@ class DeltaPerformer : public FileWriter {
   // Returns |true| only if the manifest has been processed and it's valid.
   bool IsManifestValid();
 
+  // The ratio of the operations applied, weighted by their apply cost if the
+  // payload has them. Sampled by the message loop while Write() runs on
+  // another thread.
+  const ProgressCounter& apply_progress() const { return apply_progress_; }
+
+  // Bounds the interval between the checkpoints of the progress, which is
+  // adapted to their cost in between, see CheckpointScheduler. At least
+  // kCheckpointFrequencySeconds by default. This is process wide, like the
+  // thread limit of the appliers it is adjusted along with, see
+  // ThrottleController.
+  static void SetCheckpointIntervalBounds(base::TimeDelta min_interval,
+                                          base::TimeDelta max_interval);
+
+  // Lets the manifest cached in kPrefsManifestBytes skip the metadata
+  // signature verification if its signature was verified when it was cached
+  // for the same payload. Call before writing the cached manifest. Returns
+  // whether the verification will be skipped.
+  bool TrustCachedManifest();
+
   // Verifies the downloaded payload against the signed hash included in the
   // payload, against the update check hash and size using the public key and
   // returns ErrorCode::kSuccess on success, an error code on failure.
@@ -164,6 +205,21 @@ class DeltaPerformer : public FileWriter {
     public_key_path_ = public_key_path;
   }
 
+  // Whether the data of the operations whose target is already correct may be
+  // left out of the bytes passed to Write(), see TakeSparseDownloadRanges().
+  // Must be set before the manifest is parsed.
+  void set_allow_sparse_download(bool allow) {
+    allow_sparse_download_ = allow;
+  }
+
+  // Once the manifest is parsed, returns whether only part of the rest of the
+  // payload is needed, and if so sets |ranges| to the offsets and lengths of
+  // these parts from the start of the payload. The bytes passed to Write()
+  // after the ones which completed the manifest must then be their
+  // concatenation.
+  bool TakeSparseDownloadRanges(
+      std::vector<std::pair<uint64_t, uint64_t>>* ranges);
+
   // Return true if header parsing is finished and no errors occurred.
   bool IsHeaderParsed() const;
 
@@ -212,6 +268,7 @@ class DeltaPerformer : public FileWriter {
   FRIEND_TEST(DeltaPerformerTest, BrilloMetadataSignatureSizeTest);
   FRIEND_TEST(DeltaPerformerTest, BrilloParsePayloadMetadataTest);
   FRIEND_TEST(DeltaPerformerTest, UsePublicKeyFromResponse);
+  FRIEND_TEST(DeltaPerformerTest, TrustCachedManifestTest);
 
   // Obtain the operation index for current partition. If all operations for
   // current partition is are finished, return # of operations. This is mostly
@@ -219,6 +276,32 @@ class DeltaPerformer : public FileWriter {
   // needs to know the current operation number to properly checkpoint update.
   size_t GetPartitionOperationNum();
 
+  // Returns the data length of the next operation to apply, or 0 once all
+  // operations are applied.
+  int64_t GetNextOperationDataLength();
+
+  // Checkpoints the partition writers at the next operation to apply. Returns
+  // false if the data of the applied operations couldn't be written.
+  [[nodiscard]] bool CheckpointPartitionWriters();
+
+  // Returns the update progress to checkpoint, as of the next operation to
+  // apply.
+  UpdateCheckpoint CurrentCheckpoint();
+
+  // Persists |checkpoint|, either as a single record, see
+  // update_checkpoint.h, or as separate keys. Unless |force| is set, does
+  // nothing but the next operation if it didn't change since last time.
+  bool StoreCheckpoint(const UpdateCheckpoint& checkpoint, bool force);
+
+  // CheckpointUpdateProgress() when applying partitions with
+  // |partition_applier_|. The current progress is queued as a checkpoint
+  // marker and only persisted once every operation it covers was applied.
+  bool CheckpointConcurrentApply(bool force);
+
+  // Persists the last checkpoint of |pending_checkpoints_| reached by
+  // |partition_applier_|, if any.
+  bool StoreReachedCheckpoint(bool force);
+
   // Parse and move the update instructions of all partitions into our local
   // |partitions_| variable based on the version of the payload. Requires the
   // manifest to be parsed and valid.
@@ -230,6 +313,10 @@ class DeltaPerformer : public FileWriter {
   // and returns this number.
   size_t CopyDataToBuffer(const char** bytes_p, size_t* count_p, size_t max);
 
+  // Saves the data of |op| in |buffer_| with |operation_data_checkpoint_|,
+  // if it's large enough and enough of it was downloaded since last saved.
+  void SaveOperationData(const InstallOperation& op);
+
   // If |op_result| is false, emits an error message using |op_type_name| and
   // sets |*error| accordingly. Otherwise does nothing. Returns |op_result|.
   bool HandleOpResult(bool op_result,
@@ -246,21 +333,136 @@ class DeltaPerformer : public FileWriter {
   // to be able to perform a given install operation.
   bool CanPerformInstallOperation(const InstallOperation& operation);
 
+  // Returns true if the whole data blob of |operation| is contained in the
+  // next |count| bytes passed to Write() and nothing is buffered, in which case
+  // the blob can be used in place without copying it to |buffer_|.
+  bool CanPerformInstallOperationInPlace(const InstallOperation& operation,
+                                         size_t count) const;
+
   bool ParseManifest(const char** c_bytes,
                      size_t* count,
                      ErrorCode* error,
                      bool* should_return);
 
-  // Process one InstallOperation
-  bool ProcessOperation(const InstallOperation* op, ErrorCode* error);
+  // Loads the operations of |current_partition_| from its operations segment,
+  // if it has one and they aren't loaded yet: from |*c_bytes| where the
+  // segment starts in the payload, or from the copy stored when resuming past
+  // it. Returns false on error, and true without loading them while the
+  // segment isn't fully downloaded.
+  bool LoadOperationsSegment(const char** c_bytes,
+                             size_t* count,
+                             ErrorCode* error);
+
+  // Opens |current_partition_| once its operations are loaded, or keeps
+  // |partition_open_pending_| set until then.
+  bool OpenCurrentPartitionWhenLoaded(const char** c_bytes,
+                                      size_t* count,
+                                      ErrorCode* error);
+
+  // Reorders the operations of the partitions for the locality of their
+  // source reads, see operation_schedule.h, if
+  // |install_plan_->reorder_operations| or the resumed attempt did.
+  void MaybeReorderOperations();
+
+  // Finds the operations whose target is already correct before the first
+  // operation of a new attempt, if |install_plan_->skip_satisfied_operations|,
+  // and plans a sparse download of the payload data if allowed.
+  void FindSatisfiedOperations();
+
+  // Fills |acc_apply_costs_| from the apply cost hints of the operations, if
+  // all of them have one, and logs the memory they need.
+  void LoadApplyHints();
+
+  // Skips the operation |op| as told by |skip|, consuming its data from
+  // |*c_bytes| unless it isn't downloaded. Returns false if more data is
+  // needed.
+  bool SkipSatisfiedOperation(const InstallOperation& op,
+                              SatisfiedOperations::Skip skip,
+                              const char** c_bytes,
+                              size_t* count);
+
+  // Process one InstallOperation. |data| points to its data blob, which is
+  // either the content of |buffer_| or part of the chunk passed to Write().
+  bool ProcessOperation(const InstallOperation* op,
+                        const uint8_t* data,
+                        ErrorCode* error);
+
+  // Validates |op| and hands it, along with its data blob, to
+  // |parallel_applier_| or |partition_applier_|. Flushes the pending batch of
+  // |parallel_applier_| first if |op| depends on one of the pending
+  // operations. The blob is taken from |buffer_|, or referenced from
+  // |shared_blob| if the operation shares the blob of an earlier one.
+  bool EnqueueOperation(const InstallOperation& op,
+                        const SharedBuffer* shared_blob,
+                        ErrorCode* error);
+
+  // Waits for all operations pending in |parallel_applier_| or
+  // |partition_applier_| to be applied. Does nothing if operations are applied
+  // serially.
+  bool FlushPendingOperations(ErrorCode* error);
+
+  // The partition of |install_plan_| being applied.
+  InstallPlan::Partition* CurrentInstallPartition();
+
+  // Returns the number of bytes of the source and target partitions of
+  // |install_plan_| in the page cache.
+  uint64_t GetPartitionsPageCacheBytes() const;
+
+  // Frees the operations of the current partition once it's closed, unless
+  // the background applier or verifier still refer to them, and the capacity
+  // |buffer_| grew to for its largest operation.
+  void ReleaseCurrentPartitionMemory();
+
+  // Creates |parallel_applier_| for the current partition if the install plan
+  // asks for a parallel apply and |partition_writer_| supports it.
+  void MaybeStartParallelApply(const InstallPlan::Partition& install_part,
+                               bool source_may_exist,
+                               size_t partition_operation_num);
+
+  // Creates |source_prefetcher_| for the current partition if the install plan
+  // asks for source read-ahead and the partition is read from a source.
+  void MaybeStartSourcePrefetch(const InstallPlan::Partition& install_part,
+                                bool source_may_exist);
+
+  // Starts computing |next_cow_plan_| for the partition after the current one
+  // if it is written to a COW.
+  void MaybePrepareNextCowPlan();
+
+  // Starts |source_verifier_| on the source partitions not applied yet if the
+  // install plan asks for the early source verification.
+  void MaybeStartSourceVerification();
+
+  // Creates |write_path_hasher_| for the current partition if the install plan
+  // trusts the write path hash and the operations are applied in order.
+  void MaybeStartWritePathHash(const InstallPlan::Partition& install_part,
+                               size_t partition_operation_num);
+  // Creates |written_blocks_| for the current partition unless its operations
+  // are applied in parallel.
+  void MaybeStartWrittenBlocks(const InstallPlan::Partition& install_part,
+                               size_t partition_operation_num);
   // Checks the integrity of the payload manifest. Returns true upon success,
   // false otherwise.
   ErrorCode ValidateManifest();
 
-  // Validates that the hash of the blobs corresponding to the given |operation|
-  // matches what's specified in the manifest in the payload.
+  // Returns the value of kPrefsManifestVerified binding a manifest whose
+  // metadata signature was verified to |payload_|.
+  std::string GetManifestVerifiedValue() const;
+
+  // Validates that the hash of the blob |data| corresponding to the given
+  // |operation| matches what's specified in the manifest in the payload.
   // Returns ErrorCode::kSuccess on match or a suitable error code otherwise.
-  ErrorCode ValidateOperationHash(const InstallOperation& operation);
+  ErrorCode ValidateOperationHash(const InstallOperation& operation,
+                                  const uint8_t* data);
+
+  // Handles the |*error| of ValidateOperationHash(): returns false if it
+  // fails the operation, otherwise resets it to ErrorCode::kSuccess.
+  bool HandleOperationHashResult(ErrorCode* error);
+
+  // Applies the REPLACE |operation| while the hash of its |data| is
+  // validated on another thread of the partition writer's WorkerPool, see
+  // ProcessOperation().
+  bool PerformReplaceOperationValidatingHash(
+      const InstallOperation& operation, const uint8_t* data, ErrorCode* error);
 
   // Returns true on success.
   bool PerformInstallOperation(const InstallOperation& operation);
@@ -268,12 +470,15 @@ class DeltaPerformer : public FileWriter {
   // These perform a specific type of operation and return true on success.
   // |error| will be set if source hash mismatch, otherwise |error| might not be
   // set even if it fails.
-  bool PerformReplaceOperation(const InstallOperation& operation);
+  bool PerformReplaceOperation(const InstallOperation& operation,
+                               const uint8_t* data);
   bool PerformZeroOrDiscardOperation(const InstallOperation& operation);
   bool PerformSourceCopyOperation(const InstallOperation& operation,
                                   ErrorCode* error = nullptr);
   bool PerformDiffOperation(const InstallOperation& operation,
+                            const uint8_t* data,
                             ErrorCode* error = nullptr);
+  bool PerformTargetCopyOperation(const InstallOperation& operation);
 
   // Extracts the payload signature message from the current |buffer_| if the
   // offset matches the one specified by the manifest. Returns whether the
@@ -287,6 +492,14 @@ class DeltaPerformer : public FileWriter {
   // accordingly.
   void DiscardBuffer(bool do_advance_offset, size_t signed_hash_buffer_size);
 
+  // Same as DiscardBuffer(true, count) for |count| bytes of |data| which were
+  // used in place from the chunk passed to Write() and never buffered.
+  void ConsumeOperationData(const uint8_t* data, size_t count);
+
+  // Same as DiscardBuffer(true, buffer_.size()), but hands the content of
+  // |buffer_| over to the caller instead of releasing it.
+  brillo::Blob TakeBuffer();
+
   // Primes the required update state. Returns true if the update state was
   // successfully initialized to a saved resume state or if the update is a new
   // update. Returns false otherwise.
@@ -325,6 +538,11 @@ class DeltaPerformer : public FileWriter {
 
   bool CheckSPLDowngrade();
 
+  // If the install plan asks for an automatic COW compression, replaces the
+  // payload's one with the one ChooseCowCompression() picks for this device,
+  // setting |install_plan_->vabc_none| for "none".
+  void MaybeChooseVabcCompression();
+
   // Update Engine preference store.
   PrefsInterface* prefs_;
 
@@ -345,10 +563,18 @@ class DeltaPerformer : public FileWriter {
   PayloadMetadata payload_metadata_;
 
   // Parsed manifest. Set after enough bytes to parse the manifest were
-  // downloaded.
-  DeltaArchiveManifest manifest_;
+  // downloaded. The manifest and its many operations and extents are
+  // allocated on |manifest_arena_|, instead of one heap allocation each, and
+  // released together with the DeltaPerformer.
+  google::protobuf::Arena manifest_arena_;
+  DeltaArchiveManifest& manifest_{
+      *google::protobuf::Arena::CreateMessage<DeltaArchiveManifest>(
+          &manifest_arena_)};
   bool manifest_parsed_{false};
   bool manifest_valid_{false};
+  // Whether the manifest being parsed was cached after its metadata signature
+  // was verified, see TrustCachedManifest().
+  bool manifest_trusted_{false};
   uint64_t metadata_size_{0};
   uint32_t metadata_signature_size_{0};
   uint64_t major_payload_version_{0};
@@ -362,10 +588,17 @@ class DeltaPerformer : public FileWriter {
   // otherwise 0.
   size_t num_total_operations_{0};
 
+  // Accumulated apply cost hints of the operations. The i-th element is the
+  // sum of the |apply_cost| of the first i operations, so the progress of the
+  // operations is weighted by their cost. Empty if some operations have none.
+  std::vector<uint64_t> acc_apply_costs_;
+
   // The list of partitions to update as found in the manifest major
   // version 2. When parsing an older manifest format, the information is
-  // converted over to this format instead.
-  std::vector<PartitionUpdate> partitions_;
+  // converted over to this format instead. These are the partitions of
+  // |manifest_|, used in place instead of being copied out of it.
+  google::protobuf::RepeatedPtrField<PartitionUpdate>& partitions_{
+      *manifest_.mutable_partitions()};
 
   // Index in the list of partitions (|partitions_| member) of the current
   // partition being processed.
@@ -379,12 +612,23 @@ class DeltaPerformer : public FileWriter {
   // payload metadata; once that's downloaded and parsed, it stores data for
   // the next update operation.
   brillo::Blob buffer_;
+  // Accounts for the capacity of |buffer_| in the MemoryBudget.
+  MemoryBudget::Reservation buffer_reservation_{
+      MemoryBudget::Get()->Acquire(0)};
   // Offset of buffer_ in the binary blobs section of the update.
   uint64_t buffer_offset_{0};
 
+  // Saves the data of the next operation as it is downloaded, if the install
+  // plan enables it.
+  std::unique_ptr<OperationDataCheckpoint> operation_data_checkpoint_;
+
   // Last |next_operation_num_| value updated as part of the progress update.
   uint64_t last_updated_operation_num_{std::numeric_limits<uint64_t>::max()};
 
+  // Whether the checkpoint left in the other format, record or separate keys,
+  // by a previous attempt has been invalidated.
+  bool checkpoint_format_migrated_{false};
+
   // The block size (parsed from the manifest).
   uint32_t block_size_{0};
 
@@ -396,6 +640,17 @@ class DeltaPerformer : public FileWriter {
   // the metadata and doesn't include the payload signature itself.
   HashCalculator signed_hash_calculator_;
 
+  // Hashes the payload metadata as it is received, to check the metadata
+  // signature, and the number of bytes of the metadata hashed so far.
+  HashCalculator metadata_hasher_;
+  uint64_t metadata_bytes_hashed_{0};
+
+  // Feeds the payload to |payload_hash_calculator_| and
+  // |signed_hash_calculator_|, possibly from another thread: they must only be
+  // accessed after waiting for it.
+  PayloadHasher payload_hasher_{&payload_hash_calculator_,
+                                &signed_hash_calculator_};
+
   // Signatures message blob extracted directly from the payload.
   std::string signatures_message_data_;
 
@@ -413,6 +668,8 @@ class DeltaPerformer : public FileWriter {
   // and the ratio of applied operations. Range is 0-100.
   unsigned overall_progress_{0};
 
+  ProgressCounter apply_progress_;
+
   // The last progress chunk recorded.
   unsigned last_progress_chunk_{0};
 
@@ -426,14 +683,90 @@ class DeltaPerformer : public FileWriter {
       base::TimeDelta::FromSeconds(kProgressLogTimeoutSeconds)};
   base::TimeTicks forced_progress_log_time_;
 
-  // The frequency that we should write an update checkpoint (constant), and
-  // the point in time at which the next checkpoint should be written.
-  const base::TimeDelta update_checkpoint_wait_{
-      base::TimeDelta::FromSeconds(kCheckpointFrequencySeconds)};
+  // The point in time at which the next checkpoint should be written, and
+  // what picks it from the cost of the previous ones.
   base::TimeTicks update_checkpoint_time_;
+  CheckpointScheduler checkpoint_scheduler_;
+  // When the previous checkpoint was stored and the data offset it had.
+  base::TimeTicks last_checkpoint_time_;
+  uint64_t last_checkpoint_data_offset_{0};
+
+  // When the last call to Write() returned, to measure the time spent waiting
+  // for the next bytes.
+  base::TimeTicks last_write_end_time_;
+
+  // Hashes the current partition as it is written, see write_path_hasher.h.
+  // The hash is stored in the InstallPlan once the partition is complete.
+  std::unique_ptr<WritePathHasher> write_path_hasher_;
+  // The write path hash context checkpointed by the interrupted update, used
+  // by the first partition opened.
+  std::string resumed_write_path_hash_context_;
+
+  // The blocks of the current partition written so far, stored in the
+  // InstallPlan once the partition is complete.
+  std::unique_ptr<BlockBitmap> written_blocks_;
+  // The written blocks checkpointed by the interrupted update, used by the
+  // first partition opened.
+  std::string resumed_written_blocks_;
+
+  // Verifies the source partitions ahead of the operations reading them, see
+  // InstallPlan::early_source_verification. Declared before the writers, which
+  // look the sources up in it.
+  std::unique_ptr<SourceVerifier> source_verifier_;
 
   std::unique_ptr<PartitionWriterInterface> partition_writer_;
 
+  // Applies operations of the current partition on worker threads. Only set
+  // when |install_plan_->apply_threads| > 1 and |partition_writer_| supports
+  // concurrent instances. Checkpoints are only taken once every operation
+  // handed to it has completed.
+  std::unique_ptr<ParallelOperationApplier> parallel_applier_;
+
+  // Reads ahead the source extents of upcoming operations of the current
+  // partition. Null if the read-ahead is disabled.
+  std::unique_ptr<SourcePrefetcher> source_prefetcher_;
+
+  // The COW plan of the partition |next_cow_plan_partition_|, computed on
+  // another thread while the partition before it is applied, so that opening
+  // it doesn't stall on it.
+  std::future<std::shared_ptr<VABCCowPlan>> next_cow_plan_;
+  size_t next_cow_plan_partition_{0};
+
+  // Applies the operations of up to |install_plan_->concurrent_partitions|
+  // partitions at the same time, behind the payload stream. Only set while
+  // operations are applied, when more than one partition is allowed. It owns
+  // the partition writers, |partition_writer_| stays null.
+  std::unique_ptr<ConcurrentPartitionApplier> partition_applier_;
+
+  // Checkpoints queued in |partition_applier_| and not persisted yet, with
+  // the id of their marker.
+  std::deque<std::pair<uint64_t, UpdateCheckpoint>> pending_checkpoints_;
+
+  // Whether the operations are applied, and checkpointed, in the order of
+  // MaybeReorderOperations().
+  bool reordered_operations_{false};
+
+  // The operations found already applied by FindSatisfiedOperations().
+  SatisfiedOperations satisfied_operations_;
+  bool allow_sparse_download_{false};
+  // The ranges returned by TakeSparseDownloadRanges().
+  std::vector<std::pair<uint64_t, uint64_t>> sparse_download_ranges_;
+
+  // The blobs of the operations referenced again by later operations.
+  SharedBlobs shared_blobs_;
+
+  // Whether the operations of some partitions are stored in operations
+  // segments, and only known once their partition is reached.
+  bool has_operations_segments_{false};
+  // Whether |current_partition_| is waiting for its operations segment to be
+  // opened.
+  bool partition_open_pending_{false};
+  // Whether part of the payload data wasn't downloaded, by this attempt or
+  // the one it resumes. The payload hash and signature can't be verified
+  // then, the metadata signature and the partition hashes still cover the
+  // update.
+  bool payload_data_skipped_{false};
+
   DISALLOW_COPY_AND_ASSIGN(DeltaPerformer);
 };
 
@@ -208,6 +208,8 @@ class DeltaPerformerTest : public ::testing::Test {
     PayloadGenerationConfig config;
     config.version.major = major_version;
     config.version.minor = minor_version;
+    config.max_shared_blobs_size = max_shared_blobs_size_;
+    config.operations_segments = operations_segments_;
 
     PayloadFile payload;
     EXPECT_TRUE(payload.Init(config));
@@ -434,6 +436,10 @@ class DeltaPerformerTest : public ::testing::Test {
   FakeHardware fake_hardware_;
   MockDownloadActionDelegate mock_delegate_;
   FileDescriptorPtr fake_ecc_fd_;
+  // The |max_shared_blobs_size| of the payloads generated.
+  uint64_t max_shared_blobs_size_{0};
+  // The |operations_segments| of the payloads generated.
+  bool operations_segments_{false};
   DeltaPerformer performer_{&prefs_,
                             &fake_boot_control_,
                             &fake_hardware_,
@@ -466,6 +472,52 @@ TEST_F(DeltaPerformerTest, FullPayloadWriteTest) {
   EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
 }
 
+TEST_F(DeltaPerformerTest, FullPayloadSmallChunksWriteTest) {
+  payload_.type = InstallPayloadType::kFull;
+  brillo::Blob expected_data(2 * 4096);  // 2 blocks
+  test_utils::FillWithData(&expected_data);
+  vector<AnnotatedOperation> aops;
+  for (uint64_t i = 0; i < 2; i++) {
+    AnnotatedOperation aop;
+    *(aop.op.add_dst_extents()) = ExtentForRange(i, 1);
+    aop.op.set_data_offset(i * 4096);
+    aop.op.set_data_length(4096);
+    aop.op.set_type(InstallOperation::REPLACE);
+    aops.push_back(aop);
+  }
+
+  brillo::Blob payload_data = GeneratePayload(expected_data,
+                                              aops,
+                                              false,
+                                              kBrilloMajorPayloadVersion,
+                                              kFullPayloadMinorVersion);
+
+  ScopedTempFile new_part("Partition-XXXXXX");
+  payload_.size = payload_data.size();
+  fake_boot_control_.SetPartitionDevice(
+      kPartitionNameRoot, install_plan_.target_slot, new_part.path());
+  fake_boot_control_.SetPartitionDevice(
+      kPartitionNameRoot, install_plan_.source_slot, "/dev/null");
+  fake_boot_control_.SetPartitionDevice(
+      kPartitionNameKernel, install_plan_.target_slot, "/dev/null");
+  fake_boot_control_.SetPartitionDevice(
+      kPartitionNameKernel, install_plan_.source_slot, "/dev/null");
+
+  // Chunks which are not aligned to the operation blobs, so some of them are
+  // used in place and others straddle two chunks and have to be buffered.
+  constexpr size_t kChunkSize = 3000;
+  for (size_t offset = 0; offset < payload_data.size(); offset += kChunkSize) {
+    EXPECT_TRUE(performer_.Write(
+        payload_data.data() + offset,
+        std::min(kChunkSize, payload_data.size() - offset)));
+  }
+  EXPECT_EQ(0, performer_.Close());
+
+  brillo::Blob partition_data;
+  EXPECT_TRUE(utils::ReadFile(new_part.path(), &partition_data));
+  EXPECT_EQ(expected_data, partition_data);
+}
+
 TEST_F(DeltaPerformerTest, ShouldCancelTest) {
   payload_.type = InstallPayloadType::kFull;
   brillo::Blob expected_data =
@@ -510,6 +562,105 @@ TEST_F(DeltaPerformerTest, ReplaceOperationTest) {
   EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
 }
 
+TEST_F(DeltaPerformerTest, LargeReplaceOperationTest) {
+  // Large enough for the hash to be validated while the data is written.
+  brillo::Blob expected_data(1024 * 1024);
+  test_utils::FillWithData(&expected_data);
+  vector<AnnotatedOperation> aops(1);
+  *(aops[0].op.add_dst_extents()) =
+      ExtentForRange(0, expected_data.size() / 4096);
+  aops[0].op.set_data_offset(0);
+  aops[0].op.set_data_length(expected_data.size());
+  aops[0].op.set_type(InstallOperation::REPLACE);
+
+  brillo::Blob payload_data = GeneratePayload(expected_data, aops, false);
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+}
+
+TEST_F(DeltaPerformerTest, LargeReplaceOperationHashMismatchTest) {
+  brillo::Blob blob_data(1024 * 1024);
+  test_utils::FillWithData(&blob_data);
+  vector<AnnotatedOperation> aops(1);
+  *(aops[0].op.add_dst_extents()) = ExtentForRange(0, blob_data.size() / 4096);
+  aops[0].op.set_data_offset(0);
+  aops[0].op.set_data_length(blob_data.size());
+  aops[0].op.set_type(InstallOperation::REPLACE);
+  const brillo::Blob bogus_hash(32, 0x55);
+  aops[0].op.set_data_sha256_hash(bogus_hash.data(), bogus_hash.size());
+
+  brillo::Blob payload_data = GeneratePayload(blob_data, aops, true);
+  ASSERT_TRUE(PayloadSigner::GetMetadataSignature(
+      payload_data.data(),
+      payload_.metadata_size,
+      GetBuildArtifactsPath(kUnittestPrivateKeyPath),
+      &payload_.metadata_signature));
+  install_plan_.hash_checks_mandatory = true;
+  ApplyPayload(payload_data, "/dev/null", false);
+  // The operation isn't checkpointed as done.
+  EXPECT_EQ(0U, performer_.next_operation_num_);
+}
+
+TEST_F(DeltaPerformerTest, SharedReplaceBlobsTest) {
+  brillo::Blob block =
+      brillo::Blob(std::begin(kRandomString), std::end(kRandomString));
+  block.resize(4096);
+  brillo::Blob other_block(4096, 'x');
+  // The first block is written three times, with the same blob.
+  brillo::Blob blob_data = block;
+  blob_data.insert(blob_data.end(), other_block.begin(), other_block.end());
+  blob_data.insert(blob_data.end(), block.begin(), block.end());
+  vector<AnnotatedOperation> aops(4);
+  for (size_t i = 0; i < aops.size(); i++) {
+    aops[i].op.set_type(InstallOperation::REPLACE);
+    *aops[i].op.add_dst_extents() = ExtentForRange(i, 1);
+    aops[i].op.set_data_offset(i == 1 ? 4096 : (i == 2 ? 8192 : 0));
+    aops[i].op.set_data_length(4096);
+  }
+  brillo::Blob expected_data = block;
+  expected_data.insert(
+      expected_data.end(), other_block.begin(), other_block.end());
+  expected_data.insert(expected_data.end(), block.begin(), block.end());
+  expected_data.insert(expected_data.end(), block.begin(), block.end());
+
+  max_shared_blobs_size_ = 4096;
+  brillo::Blob payload_data = GeneratePayload(blob_data, aops, false);
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+  EXPECT_EQ(4096u, performer_.manifest_.shared_blobs_size());
+  EXPECT_EQ(0u, performer_.manifest_.partitions(0).operations(2).data_offset());
+  EXPECT_EQ(0u, performer_.manifest_.partitions(0).operations(3).data_offset());
+}
+
+TEST_F(DeltaPerformerTest, OperationsSegmentsTest) {
+  brillo::Blob block =
+      brillo::Blob(std::begin(kRandomString), std::end(kRandomString));
+  block.resize(4096);
+  brillo::Blob blob_data = block;
+  blob_data.resize(8192, 'x');
+  vector<AnnotatedOperation> aops(2);
+  for (size_t i = 0; i < aops.size(); i++) {
+    aops[i].op.set_type(InstallOperation::REPLACE);
+    *aops[i].op.add_dst_extents() = ExtentForRange(i, 1);
+    aops[i].op.set_data_offset(i * 4096);
+    aops[i].op.set_data_length(4096);
+  }
+
+  operations_segments_ = true;
+  brillo::Blob payload_data = GeneratePayload(blob_data, aops, false);
+  EXPECT_EQ(blob_data, ApplyPayload(payload_data, "/dev/null", true));
+  const PartitionUpdate& partition = performer_.manifest_.partitions(0);
+  EXPECT_EQ(0, partition.operations_size());
+  EXPECT_EQ(2u, partition.operations_segment().num_operations());
+  EXPECT_EQ(0u, partition.operations_segment().data_offset());
+  // The data of the partition starts with its segment.
+  EXPECT_EQ(0u, partition.data_range().data_offset());
+  EXPECT_EQ(partition.operations_segment().data_length() + blob_data.size(),
+            partition.data_range().data_length());
+  EXPECT_EQ(2u, partition.data_range().num_operations());
+  // The segment is stored for a resumed update.
+  EXPECT_TRUE(prefs_.Exists(PrefsInterface::CreateSubKey(
+      {kPrefsUpdateStateOperationsSegment, kPartitionNameRoot})));
+}
+
 TEST_F(DeltaPerformerTest, ReplaceBzOperationTest) {
   brillo::Blob expected_data =
       brillo::Blob(std::begin(kRandomString), std::end(kRandomString));
@@ -597,6 +748,27 @@ TEST_F(DeltaPerformerTest, SourceCopyOperationTest) {
   EXPECT_EQ(expected_data, ApplyPayload(payload_data, source.path(), true));
 }
 
+TEST_F(DeltaPerformerTest, TargetCopyOperationTest) {
+  brillo::Blob block_data(std::begin(kRandomString), std::end(kRandomString));
+  block_data.resize(4096);  // block size
+  vector<AnnotatedOperation> aops(2);
+  *(aops[0].op.add_dst_extents()) = ExtentForRange(0, 1);
+  aops[0].op.set_data_offset(0);
+  aops[0].op.set_data_length(block_data.size());
+  aops[0].op.set_type(InstallOperation::REPLACE);
+  // Copies the block written by the REPLACE operation.
+  *(aops[1].op.add_src_extents()) = ExtentForRange(0, 1);
+  *(aops[1].op.add_dst_extents()) = ExtentForRange(1, 1);
+  aops[1].op.set_type(InstallOperation::TARGET_COPY);
+
+  brillo::Blob payload_data = GeneratePayload(block_data, aops, false);
+
+  brillo::Blob expected_data = block_data;
+  expected_data.insert(
+      expected_data.end(), block_data.begin(), block_data.end());
+  EXPECT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+}
+
 TEST_F(DeltaPerformerTest, PuffdiffOperationTest) {
   AnnotatedOperation aop;
   *(aop.op.add_src_extents()) = ExtentForRange(0, 1);
@@ -1109,6 +1281,56 @@ TEST_F(DeltaPerformerTest, FullPayloadCanResumeTest) {
   ASSERT_TRUE(DeltaPerformer::CanResumeUpdate(&prefs_, payload_id));
 }
 
+TEST_F(DeltaPerformerTest, FullPayloadCanResumeFromCheckpointRecordTest) {
+  payload_.type = InstallPayloadType::kFull;
+  install_plan_.checkpoint_record = true;
+  brillo::Blob expected_data =
+      brillo::Blob(std::begin(kRandomString), std::end(kRandomString));
+  expected_data.resize(4096);  // block size
+  vector<AnnotatedOperation> aops;
+  AnnotatedOperation aop;
+  *(aop.op.add_dst_extents()) = ExtentForRange(0, 1);
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(expected_data.size());
+  aop.op.set_type(InstallOperation::REPLACE);
+  aops.push_back(aop);
+
+  brillo::Blob payload_data = GeneratePayload(expected_data,
+                                              aops,
+                                              false,
+                                              kBrilloMajorPayloadVersion,
+                                              kFullPayloadMinorVersion);
+
+  ASSERT_EQ(expected_data, ApplyPayload(payload_data, "/dev/null", true));
+  performer_.CheckpointUpdateProgress(true);
+  ASSERT_TRUE(prefs_.Exists(kPrefsUpdateStateCheckpoint));
+  const std::string payload_id = "12345";
+  prefs_.SetString(kPrefsUpdateCheckResponseHash, payload_id);
+  ASSERT_TRUE(DeltaPerformer::CanResumeUpdate(&prefs_, payload_id));
+
+  ASSERT_TRUE(DeltaPerformer::ResetUpdateProgress(&prefs_, true));
+  ASSERT_FALSE(prefs_.Exists(kPrefsUpdateStateCheckpoint));
+  ASSERT_FALSE(DeltaPerformer::CanResumeUpdate(&prefs_, payload_id));
+}
+
+TEST_F(DeltaPerformerTest, TrustCachedManifestTest) {
+  payload_.hash = {1, 2, 3};
+  payload_.metadata_signature = "signature";
+  prefs_.SetString(kPrefsManifestVerified,
+                   performer_.GetManifestVerifiedValue());
+  // Only a resumed update loads the manifest from the cache.
+  ASSERT_FALSE(performer_.TrustCachedManifest());
+  install_plan_.is_resume = true;
+  ASSERT_TRUE(performer_.TrustCachedManifest());
+
+  // The verification is bound to the payload.
+  payload_.metadata_signature = "other signature";
+  ASSERT_FALSE(performer_.TrustCachedManifest());
+  payload_.metadata_signature = "signature";
+  ASSERT_TRUE(DeltaPerformer::ResetUpdateProgress(&prefs_, false));
+  ASSERT_FALSE(performer_.TrustCachedManifest());
+}
+
 class TestDeltaPerformer : public DeltaPerformer {
  public:
   using DeltaPerformer::DeltaPerformer;
@@ -1174,8 +1396,10 @@ TEST_F(DeltaPerformerTest, SetNextOpIndex) {
   Sequence seq;
   std::vector<size_t> indices;
   EXPECT_CALL(writer1, CheckpointUpdateProgress(_))
-      .WillRepeatedly(
-          [&indices](size_t index) mutable { indices.emplace_back(index); });
+      .WillRepeatedly([&indices](size_t index) mutable {
+        indices.emplace_back(index);
+        return true;
+      });
   EXPECT_CALL(writer1, Init(_, true, _)).Times(1).WillOnce(Return(true));
   EXPECT_CALL(writer1, PerformSourceCopyOperation(_, _))
       .Times(2)
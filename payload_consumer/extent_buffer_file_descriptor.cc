@@ -0,0 +1,117 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/extent_buffer_file_descriptor.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+ExtentBufferFileDescriptor::ExtentBufferFileDescriptor(
+    FileDescriptorPtr fd,
+    const google::protobuf::RepeatedPtrField<Extent>& extents,
+    size_t block_size,
+    brillo::Blob data)
+    : fd_(std::move(fd)), data_(std::move(data)) {
+  size_t data_offset = 0;
+  for (const auto& extent : extents) {
+    const uint64_t length = extent.num_blocks() * block_size;
+    // A range listed twice holds the same data both times, keep the first.
+    ranges_.emplace(extent.start_block() * block_size,
+                    BufferRange{length, data_offset});
+    data_offset += length;
+  }
+  CHECK_EQ(data_offset, data_.size());
+}
+
+ssize_t ExtentBufferFileDescriptor::Read(void* buf, size_t count) {
+  CHECK(IsOpen());
+  if (count == 0) {
+    return 0;
+  }
+  // Find the last range starting at or before |offset_|.
+  auto it = ranges_.upper_bound(offset_);
+  if (it != ranges_.begin()) {
+    const auto& [start, range] = *std::prev(it);
+    const uint64_t range_offset = offset_ - start;
+    if (range_offset < range.length) {
+      const size_t bytes =
+          std::min<uint64_t>(count, range.length - range_offset);
+      memcpy(buf, data_.data() + range.data_offset + range_offset, bytes);
+      offset_ += bytes;
+      return bytes;
+    }
+  }
+  // Not buffered, read from |fd_| up to the start of the next range.
+  if (it != ranges_.end()) {
+    count = std::min<uint64_t>(count, it->first - offset_);
+  }
+  ssize_t bytes_read = 0;
+  if (!utils::PReadAll(fd_, buf, count, offset_, &bytes_read)) {
+    return -1;
+  }
+  offset_ += bytes_read;
+  return bytes_read;
+}
+
+ssize_t ExtentBufferFileDescriptor::Write(const void* buf, size_t count) {
+  errno = EBADF;
+  return -1;
+}
+
+off64_t ExtentBufferFileDescriptor::Seek(off64_t offset, int whence) {
+  CHECK(IsOpen());
+  off64_t base = 0;
+  switch (whence) {
+    case SEEK_SET:
+      break;
+    case SEEK_CUR:
+      base = offset_;
+      break;
+    default:
+      // SEEK_END isn't needed to read extents, and would move |fd_|.
+      errno = EINVAL;
+      return -1;
+  }
+  if (base + offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  offset_ = base + offset;
+  return offset_;
+}
+
+bool ExtentBufferFileDescriptor::Close() {
+  if (!IsOpen()) {
+    return false;
+  }
+  // |fd_| is shared with other users, it is only released here.
+  fd_.reset();
+  brillo::Blob().swap(data_);
+  ranges_.clear();
+  return true;
+}
+
+}  // namespace chromeos_update_engine
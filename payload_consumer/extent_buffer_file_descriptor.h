@@ -0,0 +1,83 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_EXTENT_BUFFER_FILE_DESCRIPTOR_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_EXTENT_BUFFER_FILE_DESCRIPTOR_H_
+
+#include <sys/types.h>
+
+#include <map>
+
+#include <brillo/secure_blob.h>
+#include <google/protobuf/repeated_field.h>
+
+#include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// A read-only FileDescriptor serving the content of a set of extents of |fd|
+// from memory. |data| holds the content of |extents|, concatenated in order,
+// e.g. as read while verifying the source hash of an operation. Reads of
+// ranges outside |extents| are forwarded to |fd|.
+class ExtentBufferFileDescriptor final : public FileDescriptor {
+ public:
+  ExtentBufferFileDescriptor(
+      FileDescriptorPtr fd,
+      const google::protobuf::RepeatedPtrField<Extent>& extents,
+      size_t block_size,
+      brillo::Blob data);
+  ~ExtentBufferFileDescriptor() override = default;
+
+  // The descriptor is created open, and can't be reopened.
+  bool Open(const char* path, int flags, mode_t mode) override {
+    return false;
+  }
+  bool Open(const char* path, int flags) override { return false; }
+  ssize_t Read(void* buf, size_t count) override;
+  ssize_t Write(const void* buf, size_t count) override;
+  off64_t Seek(off64_t offset, int whence) override;
+  uint64_t BlockDevSize() override { return fd_->BlockDevSize(); }
+  bool BlkIoctl(int request,
+                uint64_t start,
+                uint64_t length,
+                int* result) override {
+    return false;
+  }
+  bool Flush() override { return true; }
+  bool Close() override;
+  bool IsSettingErrno() override { return true; }
+  bool IsOpen() override { return fd_ != nullptr; }
+
+ private:
+  struct BufferRange {
+    uint64_t length;
+    size_t data_offset;
+  };
+
+  FileDescriptorPtr fd_;
+  brillo::Blob data_;
+  // Byte ranges of the file present in |data_|, keyed by their file offset.
+  std::map<uint64_t, BufferRange> ranges_;
+  // The current file position.
+  off64_t offset_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(ExtentBufferFileDescriptor);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_EXTENT_BUFFER_FILE_DESCRIPTOR_H_
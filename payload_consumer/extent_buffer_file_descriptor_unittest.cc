@@ -0,0 +1,97 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/extent_buffer_file_descriptor.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <memory>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr size_t kBlockSize = 16;
+constexpr size_t kFileBlocks = 8;
+}  // namespace
+
+class ExtentBufferFileDescriptorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    file_data_.resize(kFileBlocks * kBlockSize);
+    test_utils::FillWithData(&file_data_);
+    ASSERT_TRUE(test_utils::WriteFileVector(temp_file_.path(), file_data_));
+    ASSERT_TRUE(fd_->Open(temp_file_.path().c_str(), O_RDONLY));
+
+    *extents_.Add() = ExtentForRange(4, 2);
+    *extents_.Add() = ExtentForRange(1, 1);
+    // Fill the buffer with data which differs from the file, so that reads
+    // served from memory can be told apart.
+    buffer_data_.assign(3 * kBlockSize, 0xAA);
+  }
+
+  ScopedTempFile temp_file_{"ExtentBufferFileDescriptor-file.XXXXXX"};
+  FileDescriptorPtr fd_{new EintrSafeFileDescriptor};
+  brillo::Blob file_data_;
+  brillo::Blob buffer_data_;
+  google::protobuf::RepeatedPtrField<Extent> extents_;
+};
+
+TEST_F(ExtentBufferFileDescriptorTest, ReadsBufferedExtentsFromMemoryTest) {
+  ExtentBufferFileDescriptor buffer_fd(fd_, extents_, kBlockSize, buffer_data_);
+  brillo::Blob data(kFileBlocks * kBlockSize);
+  ssize_t bytes_read = 0;
+  ASSERT_TRUE(
+      utils::ReadAll(&buffer_fd, data.data(), data.size(), 0, &bytes_read));
+  ASSERT_EQ(static_cast<ssize_t>(data.size()), bytes_read);
+
+  brillo::Blob expected = file_data_;
+  std::fill(expected.begin() + kBlockSize,
+            expected.begin() + 2 * kBlockSize,
+            0xAA);
+  std::fill(expected.begin() + 4 * kBlockSize,
+            expected.begin() + 6 * kBlockSize,
+            0xAA);
+  ASSERT_EQ(expected, data);
+}
+
+TEST_F(ExtentBufferFileDescriptorTest, ReadStopsAtRangeBoundaryTest) {
+  ExtentBufferFileDescriptor buffer_fd(fd_, extents_, kBlockSize, buffer_data_);
+  brillo::Blob data(kFileBlocks * kBlockSize);
+  ASSERT_EQ(static_cast<off64_t>(kBlockSize / 2),
+            buffer_fd.Seek(kBlockSize / 2, SEEK_SET));
+  // Unbuffered data up to the start of block 1.
+  ASSERT_EQ(static_cast<ssize_t>(kBlockSize / 2),
+            buffer_fd.Read(data.data(), data.size()));
+  // Block 1 comes from memory.
+  ASSERT_EQ(static_cast<ssize_t>(kBlockSize),
+            buffer_fd.Read(data.data(), data.size()));
+  ASSERT_EQ(0xAA, data[0]);
+  ASSERT_EQ(-1, buffer_fd.Write(data.data(), 1));
+  ASSERT_TRUE(buffer_fd.Close());
+  ASSERT_FALSE(buffer_fd.IsOpen());
+  // The wrapped descriptor is left open.
+  ASSERT_TRUE(fd_->IsOpen());
+}
+
+}  // namespace chromeos_update_engine
@@ -16,18 +16,26 @@
 
 #include "update_engine/payload_consumer/extent_reader.h"
 
-#include <algorithm>
-
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+
+#include "update_engine/common/cpu_topology.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/parallel_operation_applier.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 
 using google::protobuf::RepeatedPtrField;
 
 namespace chromeos_update_engine {
 
+namespace {
+// The most PrefetchingExtentReader reads at once.
+constexpr size_t kPrefetchReadSize = 128 * 1024;
+}  // namespace
+
 bool DirectExtentReader::Init(FileDescriptorPtr fd,
                               const RepeatedPtrField<Extent>& extents,
                               uint32_t block_size) {
@@ -98,4 +106,99 @@ bool DirectExtentReader::Read(void* buffer, size_t count) {
   return true;
 }
 
+PrefetchingExtentReader::~PrefetchingExtentReader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+bool PrefetchingExtentReader::Init(FileDescriptorPtr fd,
+                                   const RepeatedPtrField<Extent>& extents,
+                                   uint32_t block_size) {
+  TEST_AND_RETURN_FALSE(!thread_.joinable());
+  TEST_AND_RETURN_FALSE(reader_.Init(fd, extents, block_size));
+  total_size_ = utils::BlocksInExtents(extents) * block_size;
+  ring_.resize(std::min<uint64_t>(window_size_, total_size_));
+  if (!ring_.empty()) {
+    thread_ = std::thread(&PrefetchingExtentReader::Prefetch, this);
+  }
+  return true;
+}
+
+bool PrefetchingExtentReader::Seek(uint64_t offset) {
+  TEST_AND_RETURN_FALSE(offset <= total_size_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (offset >= begin_ && offset <= end_) {
+      begin_ = offset;
+    } else {
+      generation_++;
+      begin_ = end_ = offset;
+      failed_ = false;
+    }
+  }
+  cv_.notify_all();
+  return true;
+}
+
+bool PrefetchingExtentReader::Read(void* buffer, size_t count) {
+  auto bytes = reinterpret_cast<uint8_t*>(buffer);
+  std::unique_lock<std::mutex> lock(mutex_);
+  TEST_AND_RETURN_FALSE(count <= total_size_ - begin_);
+  while (count > 0) {
+    cv_.wait(lock, [this] { return end_ > begin_ || failed_; });
+    TEST_AND_RETURN_FALSE(end_ > begin_);
+    // The read-ahead doesn't write to the data between |begin_| and |end_|.
+    const size_t ring_offset = begin_ % ring_.size();
+    const size_t size = std::min<uint64_t>(
+        {count, end_ - begin_, ring_.size() - ring_offset});
+    memcpy(bytes, ring_.data() + ring_offset, size);
+    bytes += size;
+    count -= size;
+    begin_ += size;
+    cv_.notify_all();
+  }
+  return true;
+}
+
+void PrefetchingExtentReader::Prefetch() {
+  PlaceWorkerThread();
+  ParallelOperationApplier::ApplyIoPriority();
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    cv_.wait(lock, [this] {
+      return stopping_ || (!failed_ && end_ < total_size_ &&
+                           end_ - begin_ < ring_.size());
+    });
+    if (stopping_) {
+      return;
+    }
+    const uint64_t generation = generation_;
+    const uint64_t offset = end_;
+    const size_t ring_offset = offset % ring_.size();
+    const size_t size = std::min<uint64_t>({kPrefetchReadSize,
+                                            ring_.size() - (end_ - begin_),
+                                            ring_.size() - ring_offset,
+                                            total_size_ - end_});
+    lock.unlock();
+    const bool result = reader_.Seek(offset) &&
+                        reader_.Read(ring_.data() + ring_offset, size);
+    lock.lock();
+    if (generation != generation_) {
+      continue;
+    }
+    if (result) {
+      end_ += size;
+    } else {
+      failed_ = true;
+    }
+    cv_.notify_all();
+  }
+}
+
 }  // namespace chromeos_update_engine
@@ -17,8 +17,13 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_EXTENT_READER_H_
 #define UPDATE_ENGINE_PAYLOAD_CONSUMER_EXTENT_READER_H_
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <vector>
 
+#include <brillo/secure_blob.h>
+
 #include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -77,6 +82,56 @@ class DirectExtentReader : public ExtentReader {
   DISALLOW_COPY_AND_ASSIGN(DirectExtentReader);
 };
 
+// PrefetchingExtentReader reads the extents ahead of its position on a
+// background thread, into a ring buffer of up to |window_size| bytes, so that
+// the small reads of the patch libraries consuming a source are served from
+// memory instead of each waiting for the storage. Seeking outside of the data
+// read ahead restarts the read-ahead from there.
+//
+// The read-ahead runs on a thread of its own for the operation rather than on
+// the WorkerPool of the partition writer: it has to run alongside the patch
+// consuming it, while WorkerPool::ParallelFor() blocks its caller and may run
+// the tasks on it, one after another. The thread is placed and given the I/O
+// priority like the workers applying the operations.
+class PrefetchingExtentReader : public ExtentReader {
+ public:
+  explicit PrefetchingExtentReader(size_t window_size)
+      : window_size_(window_size) {}
+  ~PrefetchingExtentReader() override;
+
+  bool Init(FileDescriptorPtr fd,
+            const google::protobuf::RepeatedPtrField<Extent>& extents,
+            uint32_t block_size) override;
+  bool Seek(uint64_t offset) override;
+  bool Read(void* bytes, size_t count) override;
+
+ private:
+  // Main function of |thread_|.
+  void Prefetch();
+
+  const size_t window_size_;
+  // Only used by |thread_|.
+  DirectExtentReader reader_;
+  uint64_t total_size_{0};
+  brillo::Blob ring_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // The data of |ring_|, from |begin_|, the position of the reader, to |end_|
+  // in the concatenated extents.
+  uint64_t begin_{0};
+  uint64_t end_{0};
+  // Incremented when the read-ahead restarts from another position, so that
+  // the read in progress is dropped.
+  uint64_t generation_{0};
+  // Whether reading at |end_| failed.
+  bool failed_{false};
+  bool stopping_{false};
+  std::thread thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(PrefetchingExtentReader);
+};
+
 }  // namespace chromeos_update_engine
 
 #endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_EXTENT_READER_H_
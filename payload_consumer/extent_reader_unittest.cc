@@ -167,4 +167,49 @@ TEST_F(ExtentReaderTest, RandomReadTest) {
   }
 }
 
+TEST_F(ExtentReaderTest, PrefetchingRandomReadTest) {
+  vector<Extent> extents = {ExtentForRange(0, 0),
+                            ExtentForRange(100, 300),
+                            ExtentForRange(3, 0),
+                            ExtentForRange(4, 90),
+                            ExtentForRange(1000, 400)};
+  brillo::Blob result;
+  ReadExtents(extents, &result);
+
+  // A window smaller than the extents, so that the ring buffer wraps around.
+  PrefetchingExtentReader reader(100 * kBlockSize);
+  EXPECT_TRUE(reader.Init(fd_, {extents.begin(), extents.end()}, kBlockSize));
+  brillo::Blob blob(result.size());
+  // Sequential reads first, then random ones.
+  EXPECT_TRUE(reader.Seek(0));
+  for (size_t offset = 0; offset < blob.size(); offset += 13) {
+    const size_t size = min<size_t>(13, blob.size() - offset);
+    EXPECT_TRUE(reader.Read(blob.data() + offset, size));
+  }
+  ExpectVectorsEq(blob, result);
+
+  srand(time(nullptr));
+  uint32_t rand_seed;
+  for (size_t idx = 0; idx < kRandomIterations; idx++) {
+    size_t start = rand_r(&rand_seed) % blob.size();
+    size_t size = rand_r(&rand_seed) % (blob.size() - start);
+    EXPECT_TRUE(reader.Seek(start));
+    EXPECT_TRUE(reader.Read(blob.data(), size));
+    for (size_t i = 0; i < size; i++) {
+      ASSERT_EQ(blob[i], result[start + i]);
+    }
+  }
+}
+
+TEST_F(ExtentReaderTest, PrefetchingOverflowTest) {
+  vector<Extent> extents = {ExtentForRange(1, 2)};
+  PrefetchingExtentReader reader(kBlockSize);
+  EXPECT_TRUE(reader.Init(fd_, {extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_FALSE(reader.Seek(2 * kBlockSize + 1));
+  EXPECT_TRUE(reader.Seek(kBlockSize));
+  brillo::Blob blob(kBlockSize + 1);
+  EXPECT_FALSE(reader.Read(blob.data(), blob.size()));
+  EXPECT_TRUE(reader.Read(blob.data(), kBlockSize));
+}
+
 }  // namespace chromeos_update_engine
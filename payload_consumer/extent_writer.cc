@@ -22,7 +22,9 @@
 
 #include <algorithm>
 
+#include "update_engine/common/simd_utils.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/apply_trace.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 
 using std::min;
@@ -45,24 +47,109 @@ bool DirectExtentWriter::Write(const void* bytes, size_t count) {
     TEST_AND_RETURN_FALSE(bytes_to_write > 0);
 
     if (cur_extent_->start_block() != kSparseHole) {
-      const off64_t offset =
+      const uint64_t offset =
           cur_extent_->start_block() * block_size_ + extent_bytes_written_;
-      TEST_AND_RETURN_FALSE_ERRNO(fd_->Seek(offset, SEEK_SET) !=
-                                  static_cast<off64_t>(-1));
       TEST_AND_RETURN_FALSE(
-          utils::WriteAll(fd_, c_bytes + bytes_written, bytes_to_write));
+          WriteAt(offset, c_bytes + bytes_written, bytes_to_write));
+    } else if (hasher_) {
+      hasher_->Invalidate();
     }
     bytes_written += bytes_to_write;
-    extent_bytes_written_ += bytes_to_write;
-    if (bytes_remaining_cur_extent == bytes_to_write) {
-      // We filled this extent
-      CHECK_EQ(extent_bytes_written_, cur_extent_->num_blocks() * block_size_);
-      // move to next extent
-      extent_bytes_written_ = 0;
-      cur_extent_++;
-    }
+    Advance(bytes_to_write);
+  }
+  return true;
+}
+
+uint8_t* DirectExtentWriter::GetBuffer(size_t* size) {
+  // The blocks of zeros are only skipped by Write().
+  if (zeroed_blocks_ || cur_extent_ == extents_.end() ||
+      cur_extent_->start_block() == kSparseHole) {
+    return nullptr;
+  }
+  *size = static_cast<size_t>(
+      min(static_cast<uint64_t>(*size),
+          cur_extent_->num_blocks() * block_size_ - extent_bytes_written_));
+  buffer_ = fd_->GetWriteBuffer(size);
+  return buffer_;
+}
+
+bool DirectExtentWriter::CommitBuffer(size_t count) {
+  TEST_AND_RETURN_FALSE(buffer_ != nullptr);
+  if (count == 0) {
+    return true;
   }
+  const base::TimeTicks start_time = base::TimeTicks::Now();
+  const uint64_t offset =
+      cur_extent_->start_block() * block_size_ + extent_bytes_written_;
+  // The data is hashed before the descriptor may reuse the buffer.
+  if (hasher_) {
+    hasher_->Update(offset, buffer_, count);
+  }
+  buffer_ = nullptr;
+  TEST_AND_RETURN_FALSE_ERRNO(fd_->Seek(offset, SEEK_SET) ==
+                              static_cast<off64_t>(offset));
+  TEST_AND_RETURN_FALSE(fd_->CommitWriteBuffer(count));
+  if (ApplyTrace* trace = ApplyTrace::Get()) {
+    trace->OnWrite(base::TimeTicks::Now() - start_time);
+  }
+  Advance(count);
   return true;
 }
 
+void DirectExtentWriter::Advance(size_t count) {
+  if (written_blocks_ && cur_extent_->start_block() != kSparseHole) {
+    const uint64_t first_block = extent_bytes_written_ / block_size_;
+    const uint64_t end_block = (extent_bytes_written_ + count) / block_size_;
+    written_blocks_->AddRange(cur_extent_->start_block() + first_block,
+                              end_block - first_block);
+  }
+  extent_bytes_written_ += count;
+  if (extent_bytes_written_ == cur_extent_->num_blocks() * block_size_) {
+    // We filled this extent, move to the next one.
+    extent_bytes_written_ = 0;
+    cur_extent_++;
+  }
+}
+
+bool DirectExtentWriter::WriteAt(uint64_t offset,
+                                 const char* bytes,
+                                 size_t count) {
+  // Writes the bytes from |begin| to |end|.
+  const auto write = [this, offset, bytes](size_t begin, size_t end) {
+    if (begin == end) {
+      return true;
+    }
+    const base::TimeTicks start_time = base::TimeTicks::Now();
+    TEST_AND_RETURN_FALSE_ERRNO(fd_->Seek(offset + begin, SEEK_SET) !=
+                                static_cast<off64_t>(-1));
+    TEST_AND_RETURN_FALSE(utils::WriteAll(fd_, bytes + begin, end - begin));
+    if (ApplyTrace* trace = ApplyTrace::Get()) {
+      trace->OnWrite(base::TimeTicks::Now() - start_time);
+    }
+    if (hasher_) {
+      hasher_->Update(offset + begin, bytes + begin, end - begin);
+    }
+    return true;
+  };
+  // The bytes before |pending| are written or skipped.
+  size_t pending = 0;
+  if (zeroed_blocks_) {
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(bytes);
+    for (size_t i = (block_size_ - offset % block_size_) % block_size_;
+         i + block_size_ <= count;
+         i += block_size_) {
+      if (!zeroed_blocks_->ContainsBlock((offset + i) / block_size_) ||
+          !simd_utils::IsZero(data + i, block_size_)) {
+        continue;
+      }
+      TEST_AND_RETURN_FALSE(write(pending, i));
+      if (hasher_) {
+        hasher_->UpdateZeros(offset + i, block_size_);
+      }
+      pending = i + block_size_;
+    }
+  }
+  return write(pending, count);
+}
+
 }  // namespace chromeos_update_engine
@@ -24,6 +24,9 @@
 #include <brillo/secure_blob.h>
 
 #include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_consumer/write_path_hasher.h"
+#include "update_engine/payload_generator/block_bitmap.h"
+#include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/update_metadata.pb.h"
 
 // ExtentWriter is an abstract class which synchronously writes to a given
@@ -42,14 +45,37 @@ class ExtentWriter {
 
   // Returns true on success.
   virtual bool Write(const void* bytes, size_t count) = 0;
+
+  // Returns a buffer in which up to |*size| of the next bytes to write can be
+  // produced in place, reducing |*size| to the room available, or nullptr if
+  // the writer has none. The bytes produced are then passed to CommitBuffer()
+  // instead of Write(), which saves copying them, e.g. from the output buffer
+  // of a decompressor to the write cache of the target partition.
+  virtual uint8_t* GetBuffer(size_t* size) { return nullptr; }
+
+  // Writes the first |count| bytes of the buffer of GetBuffer(). Returns true
+  // on success.
+  virtual bool CommitBuffer(size_t count) { return false; }
 };
 
 // DirectExtentWriter is probably the simplest ExtentWriter implementation.
-// It writes the data directly into the extents.
-
-class DirectExtentWriter : public ExtentWriter {
+// It writes the data directly into the extents. If |hasher| is not null, the
+// data written is also recorded by it. If |zeroed_blocks| is not null, the
+// blocks of zeros written to its blocks, which already read as zeros, are
+// skipped. If |written_blocks| is not null, the blocks are added to it once
+// fully written. The buffer of GetBuffer() is the one of the file descriptor,
+// when it has one.
+
+class DirectExtentWriter final : public ExtentWriter {
  public:
-  explicit DirectExtentWriter(FileDescriptorPtr fd) : fd_(fd) {}
+  explicit DirectExtentWriter(FileDescriptorPtr fd,
+                              WritePathHasher* hasher = nullptr,
+                              const ExtentRanges* zeroed_blocks = nullptr,
+                              BlockBitmap* written_blocks = nullptr)
+      : fd_(fd),
+        hasher_(hasher),
+        zeroed_blocks_(zeroed_blocks),
+        written_blocks_(written_blocks) {}
   ~DirectExtentWriter() override = default;
 
   bool Init(const google::protobuf::RepeatedPtrField<Extent>& extents,
@@ -60,9 +86,22 @@ class DirectExtentWriter : public ExtentWriter {
     return true;
   }
   bool Write(const void* bytes, size_t count) override;
+  uint8_t* GetBuffer(size_t* size) override;
+  bool CommitBuffer(size_t count) override;
 
  private:
+  // Writes the |count| bytes at |bytes| at |offset|, skipping the blocks of
+  // zeros in |zeroed_blocks_|.
+  bool WriteAt(uint64_t offset, const char* bytes, size_t count);
+
+  // Moves past the |count| bytes written to |cur_extent_|, which has room for
+  // them.
+  void Advance(size_t count);
+
   FileDescriptorPtr fd_{nullptr};
+  WritePathHasher* hasher_{nullptr};
+  const ExtentRanges* zeroed_blocks_{nullptr};
+  BlockBitmap* written_blocks_{nullptr};
 
   size_t block_size_{0};
   // Bytes written into |cur_extent_| thus far.
@@ -70,6 +109,8 @@ class DirectExtentWriter : public ExtentWriter {
   google::protobuf::RepeatedPtrField<Extent> extents_;
   // The next call to write should correspond to |cur_extents_|.
   google::protobuf::RepeatedPtrField<Extent>::iterator cur_extent_;
+  // The buffer returned by the last GetBuffer().
+  uint8_t* buffer_{nullptr};
 };
 
 }  // namespace chromeos_update_engine
@@ -26,8 +26,10 @@
 #include <brillo/secure_blob.h>
 #include <gtest/gtest.h>
 
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/test_utils.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/cached_file_descriptor.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 
@@ -176,4 +178,75 @@ TEST_F(ExtentWriterTest, SparseFileTest) {
   ExpectVectorsEq(expected_data, resultant_data);
 }
 
+TEST_F(ExtentWriterTest, WritePathHashTest) {
+  brillo::Blob data(kBlockSize * 3);
+  test_utils::FillWithData(&data);
+  brillo::Blob expected_hash;
+  ASSERT_TRUE(HashCalculator::RawHashOfData(data, &expected_hash));
+
+  vector<Extent> extents = {ExtentForRange(0, 2), ExtentForRange(2, 1)};
+  WritePathHasher hasher(data.size());
+  DirectExtentWriter direct_writer{fd_, &hasher};
+  EXPECT_TRUE(direct_writer.Init({extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(direct_writer.Write(data.data(), 7));
+  EXPECT_TRUE(direct_writer.Write(data.data() + 7, data.size() - 7));
+
+  brillo::Blob hash;
+  ASSERT_TRUE(hasher.Finalize(&hash));
+  EXPECT_EQ(expected_hash, hash);
+}
+
+TEST_F(ExtentWriterTest, WriteInPlaceTest) {
+  brillo::Blob data(kBlockSize * 3);
+  test_utils::FillWithData(&data);
+  brillo::Blob expected_hash;
+  ASSERT_TRUE(HashCalculator::RawHashOfData(data, &expected_hash));
+
+  // Without a write cache, there is no buffer to write in place.
+  vector<Extent> extents = {ExtentForRange(0, 2), ExtentForRange(2, 1)};
+  DirectExtentWriter uncached_writer{fd_};
+  EXPECT_TRUE(
+      uncached_writer.Init({extents.begin(), extents.end()}, kBlockSize));
+  size_t size = data.size();
+  EXPECT_EQ(uncached_writer.GetBuffer(&size), nullptr);
+
+  auto cached_fd = std::make_shared<CachedFileDescriptor>(fd_, kBlockSize);
+  WritePathHasher hasher(data.size());
+  DirectExtentWriter direct_writer{cached_fd, &hasher};
+  EXPECT_TRUE(direct_writer.Init({extents.begin(), extents.end()}, kBlockSize));
+  size_t offset = 0;
+  while (offset < data.size()) {
+    size = data.size();
+    uint8_t* buffer = direct_writer.GetBuffer(&size);
+    ASSERT_NE(buffer, nullptr);
+    ASSERT_LE(size, kBlockSize);
+    memcpy(buffer, data.data() + offset, size);
+    ASSERT_TRUE(direct_writer.CommitBuffer(size));
+    offset += size;
+  }
+  EXPECT_TRUE(cached_fd->Flush());
+
+  brillo::Blob result_file;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &result_file));
+  EXPECT_EQ(data, result_file);
+  brillo::Blob hash;
+  ASSERT_TRUE(hasher.Finalize(&hash));
+  EXPECT_EQ(expected_hash, hash);
+}
+
+TEST_F(ExtentWriterTest, WritePathHashOutOfOrderTest) {
+  brillo::Blob data(kBlockSize * 2);
+  test_utils::FillWithData(&data);
+
+  vector<Extent> extents = {ExtentForRange(1, 1), ExtentForRange(0, 1)};
+  WritePathHasher hasher(data.size());
+  DirectExtentWriter direct_writer{fd_, &hasher};
+  EXPECT_TRUE(direct_writer.Init({extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(direct_writer.Write(data.data(), data.size()));
+
+  EXPECT_FALSE(hasher.trusted());
+  brillo::Blob hash;
+  EXPECT_FALSE(hasher.Finalize(&hash));
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,154 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/fec_encoder.h"
+
+#include <vector>
+
+#include <base/logging.h>
+#include <fec/ecc.h>
+extern "C" {
+#include <fec.h>
+}
+
+#include "update_engine/common/simd_utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+class LibFecEncoder : public FecEncoderInterface {
+ public:
+  LibFecEncoder(void* rs_char, size_t roots, size_t block_size)
+      : rs_char_(rs_char, &free_rs_char),
+        roots_(roots),
+        block_size_(block_size) {}
+
+  void EncodeRound(const uint8_t* data, uint8_t* fec) const override {
+    const size_t rs_n = FEC_RSM - roots_;
+    std::vector<uint8_t> rs_blocks(block_size_ * rs_n);
+    for (size_t j = 0; j < rs_n; j++) {
+      for (size_t k = 0; k < block_size_; k++) {
+        rs_blocks[k * rs_n + j] = data[j * block_size_ + k];
+      }
+    }
+    for (size_t k = 0; k < block_size_; k++) {
+      // Encode [k * rs_n : (k + 1) * rs_n) in |rs_blocks| and write |roots|
+      // number of parity bytes to |k * roots| in |fec|. The rs parameters are
+      // only read, so concurrent calls are safe.
+      encode_rs_char(
+          rs_char_.get(), rs_blocks.data() + k * rs_n, fec + k * roots_);
+    }
+  }
+
+ private:
+  std::unique_ptr<void, decltype(&free_rs_char)> rs_char_;
+  const size_t roots_;
+  const size_t block_size_;
+};
+
+uint8_t GfMultiply(uint8_t a, uint8_t b) {
+  uint8_t product = 0;
+  simd_utils::GfMulScalar(&product, &a, b, 1);
+  return product;
+}
+
+// Runs the shift register of libfec's encoder on every rs block at the same
+// time: register i of rs block k is byte k of row i of the parity, so each
+// step of the encoder is a few GF(2^8) operations on whole rows.
+class VectorizedFecEncoder : public FecEncoderInterface {
+ public:
+  VectorizedFecEncoder(size_t roots, size_t block_size)
+      : roots_(roots), block_size_(block_size) {
+    // The generator polynomial is the product of (x + a^i) for i in
+    // [0, roots), a being the primitive element x, as libfec's FEC_PARAMS()
+    // select.
+    generator_.assign(roots_ + 1, 0);
+    generator_[0] = 1;
+    uint8_t root = 1;
+    for (size_t i = 0; i < roots_; i++) {
+      for (size_t j = i + 1; j > 0; j--) {
+        generator_[j] = generator_[j - 1] ^ GfMultiply(generator_[j], root);
+      }
+      generator_[0] = GfMultiply(generator_[0], root);
+      root = GfMultiply(root, 2);
+    }
+  }
+
+  void EncodeRound(const uint8_t* data, uint8_t* fec) const override {
+    if (roots_ == 0) {
+      return;
+    }
+    std::vector<uint8_t> parity(roots_ * block_size_, 0);
+    // Rather than shifting the rows, register i is the row |(first + i) %
+    // roots_|.
+    size_t first = 0;
+    for (size_t j = 0; j < FEC_RSM - roots_; j++) {
+      uint8_t* feedback = parity.data() + first * block_size_;
+      simd_utils::Xor(feedback, data + j * block_size_, block_size_);
+      for (size_t i = 1; i < roots_; i++) {
+        simd_utils::GfMulXor(
+            parity.data() + (first + i) % roots_ * block_size_,
+            feedback,
+            generator_[roots_ - i],
+            block_size_);
+      }
+      // The feedback row becomes the last register.
+      simd_utils::GfMul(feedback, feedback, generator_[0], block_size_);
+      first = (first + 1) % roots_;
+    }
+    for (size_t i = 0; i < roots_; i++) {
+      const uint8_t* row = parity.data() + (first + i) % roots_ * block_size_;
+      for (size_t k = 0; k < block_size_; k++) {
+        fec[k * roots_ + i] = row[k];
+      }
+    }
+  }
+
+ private:
+  const size_t roots_;
+  const size_t block_size_;
+  // Coefficients of the generator polynomial, from the constant one up.
+  std::vector<uint8_t> generator_;
+};
+
+}  // namespace
+
+std::unique_ptr<FecEncoderInterface> CreateFecEncoder(FecEncoderType type,
+                                                      uint32_t roots,
+                                                      size_t block_size) {
+  if (roots >= FEC_RSM || block_size == 0) {
+    LOG(ERROR) << "Invalid FEC parameters, roots: " << roots
+               << ", block size: " << block_size;
+    return nullptr;
+  }
+  switch (type) {
+    case FecEncoderType::kLibFec: {
+      void* rs_char = init_rs_char(FEC_PARAMS(roots));
+      if (rs_char == nullptr) {
+        LOG(ERROR) << "Failed to initialize the rs parameters for " << roots
+                   << " roots";
+        return nullptr;
+      }
+      return std::make_unique<LibFecEncoder>(rs_char, roots, block_size);
+    }
+    case FecEncoderType::kVectorized:
+      return std::make_unique<VectorizedFecEncoder>(roots, block_size);
+  }
+  return nullptr;
+}
+
+}  // namespace chromeos_update_engine
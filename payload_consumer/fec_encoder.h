@@ -0,0 +1,59 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_FEC_ENCODER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_FEC_ENCODER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace chromeos_update_engine {
+
+// Computes the parity of the rounds of the dm-verity FEC data, with the
+// RS(255, 255 - roots) code of libfec. A round is made of |rs_n| = 255 - roots
+// blocks: byte k of each of them, in order, forms rs block k, whose |roots|
+// parity bytes are stored at |k * roots| in the FEC data of the round.
+class FecEncoderInterface {
+ public:
+  virtual ~FecEncoderInterface() = default;
+
+  // Encodes the |rs_n| blocks stored back to back in |data| and writes the
+  // |block_size * roots| bytes of their FEC data to |fec|. May be called from
+  // several threads at the same time.
+  virtual void EncodeRound(const uint8_t* data, uint8_t* fec) const = 0;
+
+ protected:
+  FecEncoderInterface() = default;
+};
+
+enum class FecEncoderType {
+  // libfec's encode_rs_char(), one rs block after the other.
+  kLibFec,
+  // Encodes all the rs blocks of a round at once, one byte of each per vector
+  // lane, with the GF(2^8) kernels of simd_utils.h.
+  kVectorized,
+};
+
+// Returns an encoder of |type| for |roots| parity bytes per rs block and
+// blocks of |block_size| bytes, or nullptr if the parameters are invalid.
+std::unique_ptr<FecEncoderInterface> CreateFecEncoder(FecEncoderType type,
+                                                      uint32_t roots,
+                                                      size_t block_size);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_FEC_ENCODER_H_
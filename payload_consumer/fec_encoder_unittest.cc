@@ -0,0 +1,105 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/fec_encoder.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <brillo/secure_blob.h>
+#include <fec/ecc.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+
+namespace chromeos_update_engine {
+
+class FecEncoderTest : public ::testing::TestWithParam<uint32_t> {
+ protected:
+  // Checks that both encoders compute the same FEC data for a round of blocks
+  // of |block_size| bytes.
+  void ExpectSameFec(size_t block_size) {
+    const uint32_t roots = GetParam();
+    auto libfec =
+        CreateFecEncoder(FecEncoderType::kLibFec, roots, block_size);
+    auto vectorized =
+        CreateFecEncoder(FecEncoderType::kVectorized, roots, block_size);
+    ASSERT_NE(nullptr, libfec);
+    ASSERT_NE(nullptr, vectorized);
+
+    brillo::Blob data((FEC_RSM - roots) * block_size);
+    test_utils::FillWithData(&data);
+    brillo::Blob expected(roots * block_size);
+    brillo::Blob fec(roots * block_size);
+    libfec->EncodeRound(data.data(), expected.data());
+    vectorized->EncodeRound(data.data(), fec.data());
+    ASSERT_EQ(expected, fec) << "roots " << roots;
+  }
+};
+
+TEST_P(FecEncoderTest, VectorizedMatchesLibFecTest) {
+  ExpectSameFec(4096);
+}
+
+TEST_P(FecEncoderTest, SmallBlocksTest) {
+  // Not a multiple of the vector widths.
+  ExpectSameFec(37);
+}
+
+TEST_P(FecEncoderTest, ConcurrentRoundsTest) {
+  constexpr size_t kBlockSize = 4096;
+  constexpr size_t kRounds = 4;
+  const uint32_t roots = GetParam();
+  auto encoder =
+      CreateFecEncoder(FecEncoderType::kVectorized, roots, kBlockSize);
+  ASSERT_NE(nullptr, encoder);
+  const size_t round_size = (FEC_RSM - roots) * kBlockSize;
+  const size_t fec_size = roots * kBlockSize;
+  brillo::Blob data(kRounds * round_size);
+  test_utils::FillWithData(&data);
+
+  brillo::Blob expected(kRounds * fec_size);
+  for (size_t i = 0; i < kRounds; i++) {
+    encoder->EncodeRound(data.data() + i * round_size,
+                         expected.data() + i * fec_size);
+  }
+  brillo::Blob fec(kRounds * fec_size);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kRounds; i++) {
+    threads.emplace_back([&, i] {
+      encoder->EncodeRound(data.data() + i * round_size,
+                           fec.data() + i * fec_size);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(expected, fec);
+}
+
+INSTANTIATE_TEST_CASE_P(FecEncoderTestInstance,
+                        FecEncoderTest,
+                        ::testing::Values(2, 3, 8, 24));
+
+TEST(FecEncoderInvalidTest, InvalidRootsTest) {
+  EXPECT_EQ(nullptr,
+            CreateFecEncoder(FecEncoderType::kLibFec, FEC_RSM, 4096));
+  EXPECT_EQ(nullptr,
+            CreateFecEncoder(FecEncoderType::kVectorized, FEC_RSM, 4096));
+}
+
+}  // namespace chromeos_update_engine
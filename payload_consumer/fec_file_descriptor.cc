@@ -16,10 +16,18 @@
 
 #include "update_engine/payload_consumer/fec_file_descriptor.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include <base/logging.h>
 
 namespace chromeos_update_engine {
 
+namespace {
+// Maximum number of blocks read through libfec at once.
+constexpr uint64_t kMaxReadBlocks = 256;
+}  // namespace
+
 bool FecFileDescriptor::Open(const char* path, int flags) {
   return Open(path, flags, 0600);
 }
@@ -42,11 +50,92 @@ bool FecFileDescriptor::Open(const char* path, int flags, mode_t mode) {
   }
 
   dev_size_ = status.data_size;
+  offset_ = 0;
   return true;
 }
 
 ssize_t FecFileDescriptor::Read(void* buf, size_t count) {
-  return fh_.read(buf, count);
+  if (count == 0 || offset_ >= dev_size_) {
+    return 0;
+  }
+  count = std::min<uint64_t>(count, dev_size_ - offset_);
+  uint8_t* out = static_cast<uint8_t*>(buf);
+  const uint64_t last_block = (offset_ + count - 1) / FEC_BLOCKSIZE;
+  size_t done = 0;
+  while (done < count) {
+    const uint64_t block = (offset_ + done) / FEC_BLOCKSIZE;
+    const size_t block_offset = (offset_ + done) % FEC_BLOCKSIZE;
+    ssize_t copied =
+        ReadCachedBlock(block, block_offset, out + done, count - done);
+    if (copied < 0) {
+      // Read and cache the blocks up to the next cached one at once.
+      uint64_t end_block = block + 1;
+      while (end_block <= last_block && end_block - block < kMaxReadBlocks &&
+             cache_.find(end_block) == cache_.end()) {
+        end_block++;
+      }
+      const uint64_t start = block * FEC_BLOCKSIZE;
+      const size_t size =
+          std::min<uint64_t>(end_block * FEC_BLOCKSIZE, dev_size_) - start;
+      brillo::Blob data(size);
+      const ssize_t bytes_read = ReadCorrected(data.data(), size, start);
+      if (bytes_read != static_cast<ssize_t>(size)) {
+        if (bytes_read >= 0) {
+          errno = EIO;
+        }
+        break;
+      }
+      cache_misses_ += end_block - block;
+      for (uint64_t i = block; i < end_block; i++) {
+        const size_t data_offset = (i - block) * FEC_BLOCKSIZE;
+        CacheBlock(i,
+                   data.data() + data_offset,
+                   std::min<size_t>(FEC_BLOCKSIZE, size - data_offset));
+      }
+      copied = std::min(count - done, size - block_offset);
+      memcpy(out + done, data.data() + block_offset, copied);
+    }
+    done += copied;
+  }
+  offset_ += done;
+  return done > 0 ? done : -1;
+}
+
+ssize_t FecFileDescriptor::ReadCorrected(void* buf,
+                                         size_t count,
+                                         uint64_t offset) {
+  return fh_.pread(buf, count, offset);
+}
+
+ssize_t FecFileDescriptor::ReadCachedBlock(uint64_t block,
+                                           size_t block_offset,
+                                           void* buf,
+                                           size_t count) {
+  auto it = cache_.find(block);
+  if (it == cache_.end()) {
+    return -1;
+  }
+  cache_hits_++;
+  lru_.splice(lru_.begin(), lru_, it->second.second);
+  const brillo::Blob& data = it->second.first;
+  const size_t size = std::min(count, data.size() - block_offset);
+  memcpy(buf, data.data() + block_offset, size);
+  return size;
+}
+
+void FecFileDescriptor::CacheBlock(uint64_t block,
+                                   const uint8_t* data,
+                                   size_t size) {
+  if (cache_blocks_ == 0 || cache_.find(block) != cache_.end()) {
+    return;
+  }
+  if (cache_.size() == cache_blocks_) {
+    cache_.erase(lru_.back());
+    lru_.pop_back();
+  }
+  lru_.push_front(block);
+  cache_.emplace(block,
+                 std::make_pair(brillo::Blob(data, data + size), lru_.begin()));
 }
 
 ssize_t FecFileDescriptor::Write(const void* buf, size_t count) {
@@ -55,10 +144,27 @@ ssize_t FecFileDescriptor::Write(const void* buf, size_t count) {
 }
 
 off64_t FecFileDescriptor::Seek(off64_t offset, int whence) {
-  if (fh_.seek(offset, whence)) {
-    return offset;
+  // The reads are positioned, the offset is only tracked here.
+  off64_t base = 0;
+  switch (whence) {
+    case SEEK_SET:
+      break;
+    case SEEK_CUR:
+      base = offset_;
+      break;
+    case SEEK_END:
+      base = dev_size_;
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
   }
-  return -1;
+  if (base + offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  offset_ = base + offset;
+  return offset_;
 }
 
 uint64_t FecFileDescriptor::BlockDevSize() {
@@ -74,6 +180,12 @@ bool FecFileDescriptor::BlkIoctl(int request,
 }
 
 bool FecFileDescriptor::Close() {
+  if (cache_hits_ > 0 || cache_misses_ > 0) {
+    LOG(INFO) << "Read " << cache_hits_ << " error corrected blocks from the "
+              << "cache and " << cache_misses_ << " through libfec.";
+  }
+  cache_.clear();
+  lru_.clear();
   return fh_.close();
 }
 
@@ -19,6 +19,12 @@
 
 #include <fec/io.h>
 
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+#include <brillo/secure_blob.h>
+
 #include "update_engine/payload_consumer/file_descriptor.h"
 
 // A FileDescriptor implementation with error correction based on the "libfec"
@@ -29,10 +35,17 @@
 
 namespace chromeos_update_engine {
 
-// An error corrected file based on FEC.
+// An error corrected file based on FEC. Error correction is expensive, and
+// the operations falling back to this file often read the same blocks, so the
+// last corrected blocks read are kept in a LRU cache.
 class FecFileDescriptor : public FileDescriptor {
  public:
-  FecFileDescriptor() = default;
+  // Default number of corrected blocks kept in memory.
+  static constexpr size_t kDefaultCacheBlocks = 256;
+
+  // Caches up to |cache_blocks| corrected blocks, 0 disables the cache.
+  explicit FecFileDescriptor(size_t cache_blocks = kDefaultCacheBlocks)
+      : cache_blocks_(cache_blocks) {}
   ~FecFileDescriptor() = default;
 
   // Interface methods.
@@ -55,9 +68,37 @@ class FecFileDescriptor : public FileDescriptor {
     return static_cast<bool>(fh_);
   }
 
+  // Number of blocks read from the cache, and through libfec.
+  uint64_t cache_hits() const { return cache_hits_; }
+  uint64_t cache_misses() const { return cache_misses_; }
+
  protected:
+  // Reads |count| error corrected bytes at |offset|.
+  virtual ssize_t ReadCorrected(void* buf, size_t count, uint64_t offset);
+
   fec::io fh_;
   uint64_t dev_size_{0};
+
+ private:
+  // Copies the cached block |block| from |block_offset| into |buf|, up to
+  // |count| bytes. Returns the number of bytes copied, or -1 if the block is
+  // not cached.
+  ssize_t ReadCachedBlock(uint64_t block,
+                          size_t block_offset,
+                          void* buf,
+                          size_t count);
+  void CacheBlock(uint64_t block, const uint8_t* data, size_t size);
+
+  const size_t cache_blocks_;
+  // The cached blocks by index, and their indexes from the most to the least
+  // recently used.
+  std::unordered_map<uint64_t,
+                     std::pair<brillo::Blob, std::list<uint64_t>::iterator>>
+      cache_;
+  std::list<uint64_t> lru_;
+  uint64_t cache_hits_{0};
+  uint64_t cache_misses_{0};
+  uint64_t offset_{0};
 };
 
 }  // namespace chromeos_update_engine
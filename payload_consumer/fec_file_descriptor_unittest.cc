@@ -0,0 +1,126 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/fec_file_descriptor.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+// Serves error corrected reads from memory.
+class FakeFecFileDescriptor : public FecFileDescriptor {
+ public:
+  FakeFecFileDescriptor(const brillo::Blob& data, size_t cache_blocks)
+      : FecFileDescriptor(cache_blocks), data_(data) {
+    dev_size_ = data.size();
+  }
+
+  size_t num_reads() const { return num_reads_; }
+
+ protected:
+  ssize_t ReadCorrected(void* buf, size_t count, uint64_t offset) override {
+    num_reads_++;
+    if (offset >= data_.size()) {
+      return 0;
+    }
+    count = std::min<uint64_t>(count, data_.size() - offset);
+    memcpy(buf, data_.data() + offset, count);
+    return count;
+  }
+
+ private:
+  const brillo::Blob& data_;
+  size_t num_reads_{0};
+};
+}  // namespace
+
+class FecFileDescriptorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // The last block is partial.
+    data_.resize(4 * FEC_BLOCKSIZE + 100);
+    for (size_t i = 0; i < data_.size(); i++) {
+      data_[i] = static_cast<uint8_t>(i * 13 + i / FEC_BLOCKSIZE);
+    }
+  }
+
+  void ExpectRead(FecFileDescriptor* fd, uint64_t offset, size_t count) {
+    ASSERT_EQ(static_cast<off64_t>(offset), fd->Seek(offset, SEEK_SET));
+    brillo::Blob buf(count);
+    ASSERT_EQ(static_cast<ssize_t>(count), fd->Read(buf.data(), count));
+    EXPECT_EQ(brillo::Blob(data_.begin() + offset,
+                           data_.begin() + offset + count),
+              buf);
+  }
+
+  brillo::Blob data_;
+};
+
+TEST_F(FecFileDescriptorTest, CachesCorrectedBlocksTest) {
+  FakeFecFileDescriptor fd(data_, 8);
+  ExpectRead(&fd, 0, 3 * FEC_BLOCKSIZE);
+  EXPECT_EQ(1u, fd.num_reads());
+  EXPECT_EQ(3u, fd.cache_misses());
+
+  // Unaligned, within the cached blocks.
+  ExpectRead(&fd, FEC_BLOCKSIZE + 10, FEC_BLOCKSIZE);
+  EXPECT_EQ(1u, fd.num_reads());
+  EXPECT_EQ(2u, fd.cache_hits());
+
+  // Only the blocks not cached are read, up to the partial last block.
+  ExpectRead(&fd, 2 * FEC_BLOCKSIZE + 1, data_.size() - 2 * FEC_BLOCKSIZE - 1);
+  EXPECT_EQ(2u, fd.num_reads());
+  EXPECT_EQ(5u, fd.cache_misses());
+  EXPECT_EQ(3u, fd.cache_hits());
+}
+
+TEST_F(FecFileDescriptorTest, EvictsLeastRecentlyUsedTest) {
+  FakeFecFileDescriptor fd(data_, 2);
+  ExpectRead(&fd, 0, 1);
+  ExpectRead(&fd, FEC_BLOCKSIZE, 1);
+  ExpectRead(&fd, 0, 1);
+  // Evicts block 1, the least recently used.
+  ExpectRead(&fd, 2 * FEC_BLOCKSIZE, 1);
+  EXPECT_EQ(3u, fd.num_reads());
+  ExpectRead(&fd, 0, 1);
+  EXPECT_EQ(3u, fd.num_reads());
+  ExpectRead(&fd, FEC_BLOCKSIZE, 1);
+  EXPECT_EQ(4u, fd.num_reads());
+}
+
+TEST_F(FecFileDescriptorTest, DisabledCacheTest) {
+  FakeFecFileDescriptor fd(data_, 0);
+  ExpectRead(&fd, 0, 2 * FEC_BLOCKSIZE);
+  ExpectRead(&fd, 0, 2 * FEC_BLOCKSIZE);
+  EXPECT_EQ(2u, fd.num_reads());
+  EXPECT_EQ(0u, fd.cache_hits());
+}
+
+TEST_F(FecFileDescriptorTest, ReadPastEndTest) {
+  FakeFecFileDescriptor fd(data_, 8);
+  ASSERT_EQ(static_cast<off64_t>(data_.size() - 10), fd.Seek(-10, SEEK_END));
+  brillo::Blob buf(100);
+  EXPECT_EQ(10, fd.Read(buf.data(), buf.size()));
+  EXPECT_EQ(0, fd.Read(buf.data(), buf.size()));
+  EXPECT_EQ(static_cast<off64_t>(data_.size()), fd.Seek(0, SEEK_CUR));
+}
+
+}  // namespace chromeos_update_engine
@@ -138,6 +138,11 @@ bool EintrSafeFileDescriptor::Flush() {
   return true;
 }
 
+bool EintrSafeFileDescriptor::StartFlush() {
+  CHECK_GE(fd_, 0);
+  return sync_file_range(fd_, 0, 0, SYNC_FILE_RANGE_WRITE) == 0;
+}
+
 bool EintrSafeFileDescriptor::Close() {
   if (fd_ < 0) {
     return false;
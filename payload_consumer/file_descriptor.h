@@ -92,6 +92,23 @@ class FileDescriptor {
   // errno accrodingly.
   virtual bool Flush() = 0;
 
+  // Starts writing the data written so far back to the storage, without
+  // waiting for it nor flushing the cache of the device: Flush() is still
+  // needed for the data to be durable, but has less left to wait for.
+  // Returns false on failure.
+  virtual bool StartFlush() { return true; }
+
+  // Returns a buffer in which the caller can produce up to |*size| bytes to
+  // write, reducing |*size| to the room available, or nullptr if not
+  // supported. The bytes produced are then written by CommitWriteBuffer(), at
+  // the offset current then, instead of being copied by Write(). The buffer
+  // is only valid until the next call other than Seek().
+  virtual uint8_t* GetWriteBuffer(size_t* size) { return nullptr; }
+
+  // Writes the first |count| bytes of the buffer of GetWriteBuffer(). Returns
+  // false on failure.
+  virtual bool CommitWriteBuffer(size_t count) { return false; }
+
   // Closes a file descriptor. The descriptor must be open prior to this call.
   // Returns true on success, false otherwise. Specific implementations may set
   // errno accordingly.
@@ -110,6 +127,13 @@ class FileDescriptor {
   // instance.
   virtual int Fd() { return -1; }
 
+  // Opens another read-only descriptor of the same content, with its own
+  // offset, which can be read on another thread at the same time as this one.
+  // Returns nullptr if not supported.
+  virtual std::unique_ptr<FileDescriptor> OpenConcurrentReader() {
+    return nullptr;
+  }
+
  private:
   DISALLOW_COPY_AND_ASSIGN(FileDescriptor);
 };
@@ -132,6 +156,7 @@ class EintrSafeFileDescriptor final : public FileDescriptor {
                 uint64_t length,
                 int* result) override;
   bool Flush() override;
+  bool StartFlush() override;
   bool Close() override;
   bool IsSettingErrno() override { return true; }
   bool IsOpen() override { return (fd_ >= 0); }
@@ -18,6 +18,8 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -29,6 +31,7 @@
 #include <numeric>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <base/bind.h>
 #include <base/strings/string_util.h>
@@ -38,9 +41,17 @@
 #include <brillo/streams/file_stream.h>
 
 #include "update_engine/common/error_code.h"
+#include "update_engine/common/tracing.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/aligned_buffer_pool.h"
+#include "update_engine/payload_consumer/concurrent_partition_hasher.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/io_uring_file_descriptor.h"
+#include "update_engine/payload_consumer/page_cache_dropping_file_descriptor.h"
+#include "update_engine/payload_consumer/postinstall_runner_action.h"
+#include "update_engine/payload_consumer/read_ahead_reader.h"
+#include "update_engine/payload_generator/extent_utils.h"
 
 using brillo::data_encoding::Base64Encode;
 using std::string;
@@ -80,6 +91,12 @@ namespace chromeos_update_engine {
 
 namespace {
 const off_t kReadFileBufferSize = 128 * 1024;
+// Size of the reads when reading ahead, rounded up to a multiple of the
+// optimal I/O size of the device, if any, within the maximum.
+constexpr size_t kReadAheadBufferSize = 1024 * 1024;
+constexpr size_t kMaxReadAheadBufferSize = 8 * 1024 * 1024;
+// Interval between progress updates while verifying partitions concurrently.
+constexpr int kConcurrentProgressIntervalMs = 100;
 constexpr float kVerityProgressPercent = 0.3;
 constexpr float kEncodeFECPercent = 0.3;
 
@@ -133,16 +150,24 @@ void FilesystemVerifierAction::TerminateProcessing() {
 }
 
 void FilesystemVerifierAction::Cleanup(ErrorCode code) {
+  concurrent_hasher_.reset();
+  read_ahead_.reset();
   partition_fd_.reset();
   // This memory is not used anymore.
-  buffer_.clear();
+  buffer_.Reset();
 
-  // If we didn't write verity, partitions were maped. Releaase resource now.
+  // If we didn't write verity, partitions were maped. On success they are
+  // left mapped for PostinstallRunnerAction, which maps them again anyway and
+  // unmaps them when done. Release the resource now otherwise.
   if (!install_plan_.write_verity &&
       dynamic_control_->UpdateUsesSnapshotCompression()) {
-    LOG(INFO) << "Not writing verity and VABC is enabled, unmapping all "
-                 "partitions";
-    dynamic_control_->UnmapAllPartitions();
+    if (cancelled_ || code != ErrorCode::kSuccess) {
+      LOG(INFO) << "Not writing verity and VABC is enabled, unmapping all "
+                   "partitions";
+      dynamic_control_->UnmapAllPartitions();
+    } else {
+      LOG(INFO) << "Keeping all partitions mapped for postinstall.";
+    }
   }
 
   if (cancelled_)
@@ -176,10 +201,19 @@ bool FilesystemVerifierAction::InitializeFdVABC(bool should_write_verity) {
     // means even if we do |partition_fd_.reset()| here, there's a chance that
     // underlying fd isn't closed until we return. This is unacceptable, we need
     // to close |partition_fd| right away.
+    read_ahead_.reset();
     if (partition_fd_) {
       partition_fd_->Close();
       partition_fd_.reset();
     }
+    if (install_plan_.verify_cow_readers > 0) {
+      // Hash the partition from its COW directly, as with verity, rather than
+      // a block at a time through snapuserd. The COW readers see the verity
+      // data written, and several of them decompress it in parallel, see
+      // StartReadAhead().
+      LOG(INFO) << "Verifying " << partition.name << " from its COW.";
+      return InitializeCowFd();
+    }
     // In VABC, if we are not writing verity, just map all partitions,
     // and read using regular fd on |postinstall_mount_device| .
     // All read will go through snapuserd, which provides a consistent
@@ -195,6 +229,12 @@ bool FilesystemVerifierAction::InitializeFdVABC(bool should_write_verity) {
     }
     return InitializeFd(partition.readonly_target_path);
   }
+  return InitializeCowFd();
+}
+
+bool FilesystemVerifierAction::InitializeCowFd() {
+  const InstallPlan::Partition& partition =
+      install_plan_.partitions[partition_index_];
   partition_fd_ =
       dynamic_control_->OpenCowFd(partition.name, partition.source_path, true);
   if (!partition_fd_) {
@@ -207,13 +247,27 @@ bool FilesystemVerifierAction::InitializeFdVABC(bool should_write_verity) {
 }
 
 bool FilesystemVerifierAction::InitializeFd(const std::string& part_path) {
-  partition_fd_ = std::make_unique<EintrSafeFileDescriptor>();
+  partition_fd_ = CreateFileDescriptor(install_plan_.use_io_uring);
   const bool write_verity = ShouldWriteVerity();
   int flags = write_verity ? O_RDWR : O_RDONLY;
   if (!utils::SetBlockDeviceReadOnly(part_path, !write_verity)) {
     LOG(WARNING) << "Failed to set block device " << part_path << " as "
                  << (write_verity ? "writable" : "readonly");
   }
+  // The partition is read once, reading it through the page cache would only
+  // evict the pages of the apps in use. The reads are aligned as long as the
+  // partition is, see ReadPartition().
+  if (install_plan_.verify_direct_io && !write_verity &&
+      partition_size_ % kDirectIoAlignment == 0) {
+    if (partition_fd_->Open(part_path.c_str(), flags | O_DIRECT)) {
+      return true;
+    }
+    PLOG(WARNING) << "Unable to open " << part_path << " with O_DIRECT";
+  }
+  if (install_plan_.drop_page_cache) {
+    partition_fd_ = std::make_unique<PageCacheDroppingFileDescriptor>(
+        std::move(partition_fd_));
+  }
   if (!partition_fd_->Open(part_path.c_str(), flags)) {
     LOG(ERROR) << "Unable to open " << part_path << " for reading.";
     return false;
@@ -224,6 +278,7 @@ bool FilesystemVerifierAction::InitializeFd(const std::string& part_path) {
 void FilesystemVerifierAction::WriteVerityData(FileDescriptor* fd,
                                                void* buffer,
                                                const size_t buffer_size) {
+  UE_TRACE_SCOPE("FilesystemVerifierAction::WriteVerityData");
   if (verity_writer_->FECFinished()) {
     LOG(INFO) << "EncodeFEC is completed. Resuming other tasks";
     if (dynamic_control_->UpdateUsesSnapshotCompression()) {
@@ -234,7 +289,7 @@ void FilesystemVerifierAction::WriteVerityData(FileDescriptor* fd,
         return;
       }
     }
-    HashPartition(0, partition_size_, buffer, buffer_size);
+    VerifyPartition(buffer, buffer_size);
     return;
   }
   if (!verity_writer_->IncrementalFinalize(fd, fd)) {
@@ -257,43 +312,37 @@ void FilesystemVerifierAction::WriteVerityAndHashPartition(
     const off64_t end_offset,
     void* buffer,
     const size_t buffer_size) {
+  UE_TRACE_SCOPE("FilesystemVerifierAction::WriteVerityAndHashPartition");
   auto fd = partition_fd_.get();
   TEST_AND_RETURN(fd != nullptr);
   if (start_offset >= end_offset) {
     LOG_IF(WARNING, start_offset > end_offset)
         << "start_offset is greater than end_offset : " << start_offset << " > "
         << end_offset;
+    // The verity data is written to |fd|, which must not be read meanwhile.
+    read_ahead_.reset();
     WriteVerityData(fd, buffer, buffer_size);
     return;
   }
-  const auto cur_offset = fd->Seek(start_offset, SEEK_SET);
-  if (cur_offset != start_offset) {
-    PLOG(ERROR) << "Failed to seek to offset: " << start_offset;
-    Cleanup(ErrorCode::kVerityCalculationError);
-    return;
-  }
   const auto read_size =
       std::min<size_t>(buffer_size, end_offset - start_offset);
-  const auto bytes_read = fd->Read(buffer, read_size);
-  if (bytes_read < 0 || static_cast<size_t>(bytes_read) != read_size) {
-    PLOG(ERROR) << "Failed to read offset " << start_offset << " expected "
-                << read_size << " bytes, actual: " << bytes_read;
+  const uint8_t* data = ReadPartition(start_offset, read_size, buffer);
+  if (data == nullptr) {
     Cleanup(ErrorCode::kVerityCalculationError);
     return;
   }
-  if (!verity_writer_->Update(
-          start_offset, static_cast<const uint8_t*>(buffer), read_size)) {
+  if (!verity_writer_->Update(start_offset, data, read_size)) {
     LOG(ERROR) << "VerityWriter::Update() failed";
     Cleanup(ErrorCode::kVerityCalculationError);
     return;
   }
-  UpdatePartitionProgress((start_offset + bytes_read) * 1.0f / partition_size_ *
+  UpdatePartitionProgress((start_offset + read_size) * 1.0f / partition_size_ *
                           kVerityProgressPercent);
   CHECK(pending_task_id_.PostTask(
       FROM_HERE,
       base::BindOnce(&FilesystemVerifierAction::WriteVerityAndHashPartition,
                      base::Unretained(this),
-                     start_offset + bytes_read,
+                     start_offset + read_size,
                      end_offset,
                      buffer,
                      buffer_size)));
@@ -303,6 +352,7 @@ void FilesystemVerifierAction::HashPartition(const off64_t start_offset,
                                              const off64_t end_offset,
                                              void* buffer,
                                              const size_t buffer_size) {
+  UE_TRACE_SCOPE("FilesystemVerifierAction::HashPartition");
   auto fd = partition_fd_.get();
   TEST_AND_RETURN(fd != nullptr);
   if (start_offset >= end_offset) {
@@ -312,27 +362,30 @@ void FilesystemVerifierAction::HashPartition(const off64_t start_offset,
     FinishPartitionHashing();
     return;
   }
-  const auto cur_offset = fd->Seek(start_offset, SEEK_SET);
-  if (cur_offset != start_offset) {
-    PLOG(ERROR) << "Failed to seek to offset: " << start_offset;
-    Cleanup(ErrorCode::kFilesystemVerifierError);
-    return;
-  }
   const auto read_size =
       std::min<size_t>(buffer_size, end_offset - start_offset);
-  const auto bytes_read = fd->Read(buffer, read_size);
-  if (bytes_read < 0 || static_cast<size_t>(bytes_read) != read_size) {
-    PLOG(ERROR) << "Failed to read offset " << start_offset << " expected "
-                << read_size << " bytes, actual: " << bytes_read;
+  const uint8_t* data = ReadPartition(start_offset, read_size, buffer);
+  if (data == nullptr) {
     Cleanup(ErrorCode::kFilesystemVerifierError);
     return;
   }
-  if (!hasher_->Update(buffer, read_size)) {
+  if (!hasher_->Update(data, read_size)) {
     LOG(ERROR) << "Hasher updated failed on offset" << start_offset;
     Cleanup(ErrorCode::kFilesystemVerifierError);
     return;
   }
-  const auto progress = (start_offset + bytes_read) * 1.0f / partition_size_;
+  UpdateHashProgress((start_offset + read_size) * 1.0f / partition_size_);
+  CHECK(pending_task_id_.PostTask(
+      FROM_HERE,
+      base::BindOnce(&FilesystemVerifierAction::HashPartition,
+                     base::Unretained(this),
+                     start_offset + read_size,
+                     end_offset,
+                     buffer,
+                     buffer_size)));
+}
+
+void FilesystemVerifierAction::UpdateHashProgress(double progress) {
   // If we are writing verity, then the progress bar will be split between
   // verity writes and partition hashing. Otherwise, the entire progress bar is
   // dedicated to partition hashing for smooth progress.
@@ -343,17 +396,307 @@ void FilesystemVerifierAction::HashPartition(const off64_t start_offset,
   } else {
     UpdatePartitionProgress(progress);
   }
+}
+
+void FilesystemVerifierAction::VerifyPartition(void* buffer,
+                                               const size_t buffer_size) {
+  if (ShouldVerifyTouchedBlocks(install_plan_.partitions[partition_index_])) {
+    read_ahead_.reset();
+    VerifyTouchedRanges(0, buffer, buffer_size);
+    return;
+  }
+  StartReadAhead(0, partition_size_, buffer_size);
+  HashPartition(0, partition_size_, buffer, buffer_size);
+}
+
+void FilesystemVerifierAction::VerifyTouchedRanges(size_t index,
+                                                   void* buffer,
+                                                   const size_t buffer_size) {
+  UE_TRACE_SCOPE("FilesystemVerifierAction::VerifyTouchedRanges");
+  InstallPlan::Partition& partition =
+      install_plan_.partitions[partition_index_];
+  if (index == partition.touched_ranges.size()) {
+    partition.throughput_stats.verify_time +=
+        base::TimeTicks::Now() - partition_hash_start_time_;
+    LOG(INFO) << "Verified " << partition.name
+              << " by reading back the blocks written by its operations.";
+    UpdatePartitionProgress(1.0);
+    partition_index_++;
+    ClosePartition();
+    StartPartitionHashing();
+    return;
+  }
+  const auto& range = partition.touched_ranges[index];
+  if (partition.written_blocks &&
+      !std::all_of(range.extents.begin(),
+                   range.extents.end(),
+                   [&partition](const Extent& extent) {
+                     return partition.written_blocks->ContainsExtent(extent);
+                   })) {
+    LOG(WARNING) << "Blocks " << ExtentsToString(range.extents) << " of "
+                 << partition.name << " weren't all written, hashing the "
+                 << "whole partition.";
+    StartReadAhead(0, partition_size_, buffer_size);
+    HashPartition(0, partition_size_, buffer, buffer_size);
+    return;
+  }
+  HashCalculator hasher;
+  for (const Extent& extent : range.extents) {
+    const off64_t end_offset =
+        (extent.start_block() + extent.num_blocks()) * partition.block_size;
+    for (off64_t offset = extent.start_block() * partition.block_size;
+         offset < end_offset;) {
+      const auto read_size =
+          std::min<size_t>(buffer_size, end_offset - offset);
+      const uint8_t* data = ReadPartition(offset, read_size, buffer);
+      if (data == nullptr || !hasher.Update(data, read_size)) {
+        Cleanup(ErrorCode::kFilesystemVerifierError);
+        return;
+      }
+      partition.throughput_stats.verify_bytes += read_size;
+      offset += read_size;
+    }
+  }
+  if (!hasher.Finalize() || hasher.raw_hash() != range.hash) {
+    LOG(WARNING) << "Blocks " << ExtentsToString(range.extents) << " of "
+                 << partition.name << " don't match, hashing the whole "
+                 << "partition to find out why.";
+    StartReadAhead(0, partition_size_, buffer_size);
+    HashPartition(0, partition_size_, buffer, buffer_size);
+    return;
+  }
+  UpdateHashProgress((index + 1.0) / partition.touched_ranges.size());
   CHECK(pending_task_id_.PostTask(
       FROM_HERE,
-      base::BindOnce(&FilesystemVerifierAction::HashPartition,
+      base::BindOnce(&FilesystemVerifierAction::VerifyTouchedRanges,
                      base::Unretained(this),
-                     start_offset + bytes_read,
-                     end_offset,
+                     index + 1,
                      buffer,
                      buffer_size)));
 }
 
+const uint8_t* FilesystemVerifierAction::ReadPartition(const off64_t offset,
+                                                      const size_t size,
+                                                      void* buffer) {
+  UE_TRACE_SCOPE("FilesystemVerifierAction::ReadPartition");
+  if (read_ahead_) {
+    const uint8_t* data = nullptr;
+    size_t data_size = 0;
+    if (!read_ahead_->Next(&data, &data_size) || data_size != size) {
+      LOG(ERROR) << "Failed to read ahead offset " << offset << " expected "
+                 << size << " bytes";
+      return nullptr;
+    }
+    return data;
+  }
+  auto fd = partition_fd_.get();
+  const auto cur_offset = fd->Seek(offset, SEEK_SET);
+  if (cur_offset != offset) {
+    PLOG(ERROR) << "Failed to seek to offset: " << offset;
+    return nullptr;
+  }
+  const auto bytes_read = fd->Read(buffer, size);
+  if (bytes_read < 0 || static_cast<size_t>(bytes_read) != size) {
+    PLOG(ERROR) << "Failed to read offset " << offset << " expected " << size
+                << " bytes, actual: " << bytes_read;
+    return nullptr;
+  }
+  return static_cast<const uint8_t*>(buffer);
+}
+
+void FilesystemVerifierAction::StartReadAhead(const off64_t start_offset,
+                                              const off64_t end_offset,
+                                              const size_t buffer_size) {
+  read_ahead_.reset();
+  if (install_plan_.verify_read_ahead_buffers == 0) {
+    return;
+  }
+  // The COW readers decompress the chunks on their own threads.
+  std::vector<std::unique_ptr<FileDescriptor>> more_fds;
+  while (more_fds.size() + 1 < install_plan_.verify_cow_readers) {
+    auto fd = partition_fd_->OpenConcurrentReader();
+    if (!fd) {
+      break;
+    }
+    more_fds.push_back(std::move(fd));
+  }
+  read_ahead_ = std::make_unique<ReadAheadReader>(
+      partition_fd_.get(),
+      start_offset,
+      end_offset,
+      buffer_size,
+      install_plan_.verify_read_ahead_buffers,
+      std::move(more_fds));
+}
+
+size_t FilesystemVerifierAction::GetReadBufferSize() const {
+  if (install_plan_.verify_read_ahead_buffers == 0) {
+    return kReadFileBufferSize;
+  }
+  // Not every FileDescriptor is backed by a device, e.g. the COW readers of
+  // VABC, in which case the default size is used.
+  unsigned int optimal_io_size = 0;
+  const int fd = partition_fd_->Fd();
+  if (fd < 0 || ioctl(fd, BLKIOOPT, &optimal_io_size) != 0 ||
+      optimal_io_size == 0) {
+    return kReadAheadBufferSize;
+  }
+  const size_t buffer_size =
+      (kReadAheadBufferSize + optimal_io_size - 1) / optimal_io_size *
+      optimal_io_size;
+  return buffer_size <= kMaxReadAheadBufferSize ? buffer_size
+                                                : kReadAheadBufferSize;
+}
+
+bool FilesystemVerifierAction::ShouldVerifyConcurrently() const {
+  if (install_plan_.verify_concurrent_partitions < 2 ||
+      verifier_step_ != VerifierStep::kVerifyTargetHash ||
+      partition_index_ != 0) {
+    return false;
+  }
+  // The concurrent hashing reads the partitions whole.
+  if (install_plan_.touched_blocks_verification &&
+      std::any_of(install_plan_.partitions.begin(),
+                  install_plan_.partitions.end(),
+                  [](const auto& partition) {
+                    return partition.verify_touched_blocks;
+                  })) {
+    return false;
+  }
+  // Writing verity data requires the VABC partitions to be remapped between
+  // partitions, so those are verified one at a time.
+  if (install_plan_.write_verity) {
+    for (const auto& partition : install_plan_.partitions) {
+      if (partition.hash_tree_size > 0 || partition.fec_size > 0) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool FilesystemVerifierAction::ShouldStartPostinstallEarly() const {
+  if (!postinstall_runner_ || !install_plan_.early_postinstall) {
+    return false;
+  }
+  if (install_plan_.write_verity &&
+      dynamic_control_->UpdateUsesSnapshotCompression()) {
+    for (const auto& partition : install_plan_.partitions) {
+      if (partition.hash_tree_size > 0 || partition.fec_size > 0) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void FilesystemVerifierAction::StartConcurrentHashing() {
+  std::vector<ConcurrentPartitionHasher::Partition> partitions;
+  concurrent_partition_indexes_.clear();
+  for (size_t i = 0; i < install_plan_.partitions.size(); i++) {
+    const InstallPlan::Partition& partition = install_plan_.partitions[i];
+    if (HasTrustedWritePathHash(partition)) {
+      LOG(INFO) << "Skip hashing partition " << i << " (" << partition.name
+                << ") because it was hashed while written.";
+      continue;
+    }
+    const string& part_path = IsVABC(partition) ? partition.readonly_target_path
+                                                : partition.target_path;
+    if (part_path.empty()) {
+      if (partition.target_size == 0) {
+        LOG(INFO) << "Skip hashing partition " << i << " (" << partition.name
+                  << ") because size is 0.";
+        continue;
+      }
+      LOG(ERROR) << "Cannot hash partition " << i << " (" << partition.name
+                 << ") because its device path cannot be determined.";
+      Cleanup(ErrorCode::kFilesystemVerifierError);
+      return;
+    }
+    if (!utils::SetBlockDeviceReadOnly(part_path, true)) {
+      LOG(WARNING) << "Failed to set block device " << part_path
+                   << " as readonly";
+    }
+    LOG(INFO) << "Hashing partition " << i << " (" << partition.name
+              << ") on device " << part_path;
+    partitions.push_back({part_path, partition.target_size});
+    concurrent_partition_indexes_.push_back(i);
+  }
+  LOG(INFO) << "Hashing " << partitions.size() << " partitions with up to "
+            << install_plan_.verify_concurrent_partitions << " threads";
+  concurrent_hasher_ = std::make_unique<ConcurrentPartitionHasher>(
+      std::move(partitions),
+      install_plan_.verify_concurrent_partitions,
+      kReadAheadBufferSize,
+      install_plan_.use_io_uring,
+      install_plan_.verify_io_priority);
+  concurrent_hasher_->Start();
+  MonitorConcurrentHashing();
+}
+
+void FilesystemVerifierAction::MonitorConcurrentHashing() {
+  if (partition_weight_.back() > 0) {
+    UpdateProgress(static_cast<double>(concurrent_hasher_->BytesHashed()) /
+                   partition_weight_.back());
+  }
+  if (concurrent_hasher_->Done()) {
+    FinishConcurrentHashing();
+    return;
+  }
+  CHECK(pending_task_id_.PostTask(
+      FROM_HERE,
+      base::BindOnce(&FilesystemVerifierAction::MonitorConcurrentHashing,
+                     base::Unretained(this)),
+      base::TimeDelta::FromMilliseconds(kConcurrentProgressIntervalMs)));
+}
+
+void FilesystemVerifierAction::FinishConcurrentHashing() {
+  std::vector<brillo::Blob> hashes;
+  const bool success = concurrent_hasher_->GetHashes(&hashes);
+  const std::vector<base::TimeDelta> hash_times =
+      concurrent_hasher_->GetHashTimes();
+  concurrent_hasher_.reset();
+  if (!success) {
+    Cleanup(ErrorCode::kFilesystemVerifierError);
+    return;
+  }
+  for (size_t i = 0; i < hashes.size(); i++) {
+    const size_t index = concurrent_partition_indexes_[i];
+    InstallPlan::Partition& partition = install_plan_.partitions[index];
+    partition.throughput_stats.verify_bytes += partition.target_size;
+    partition.throughput_stats.verify_time += hash_times[i];
+    LOG(INFO) << "Hash of " << partition.name << ": " << HexEncode(hashes[i]);
+    if (partition.target_hash == hashes[i]) {
+      continue;
+    }
+    LOG(ERROR) << "New '" << partition.name
+               << "' partition verification failed.";
+    if (partition.source_hash.empty()) {
+      Cleanup(ErrorCode::kNewRootfsVerificationError);
+      return;
+    }
+    // Same as when verifying the partitions one at a time: check whether the
+    // mismatch comes from the source partition.
+    verifier_step_ = VerifierStep::kVerifySourceHash;
+    partition_index_ = index;
+    StartPartitionHashing();
+    return;
+  }
+  partition_index_ = install_plan_.partitions.size();
+  StartPartitionHashing();
+}
+
 void FilesystemVerifierAction::StartPartitionHashing() {
+  // The partitions before |partition_index_| are verified.
+  if (verifier_step_ == VerifierStep::kVerifyTargetHash &&
+      partition_index_ > 0 && ShouldStartPostinstallEarly()) {
+    postinstall_runner_->StartVerifiedPartitions(install_plan_,
+                                                 partition_index_);
+  }
+  if (ShouldVerifyConcurrently()) {
+    StartConcurrentHashing();
+    return;
+  }
   if (partition_index_ == install_plan_.partitions.size()) {
     if (!install_plan_.untouched_dynamic_partitions.empty()) {
       LOG(INFO) << "Verifying extents of untouched dynamic partitions ["
@@ -374,8 +717,17 @@ void FilesystemVerifierAction::StartPartitionHashing() {
   }
   const InstallPlan::Partition& partition =
       install_plan_.partitions[partition_index_];
+  if (HasTrustedWritePathHash(partition)) {
+    LOG(INFO) << "Skip hashing partition " << partition_index_ << " ("
+              << partition.name << ") because it was hashed while written.";
+    UpdatePartitionProgress(1.0);
+    partition_index_++;
+    StartPartitionHashing();
+    return;
+  }
   const auto& part_path = GetPartitionPath();
   partition_size_ = GetPartitionSize();
+  partition_hash_start_time_ = base::TimeTicks::Now();
 
   LOG(INFO) << "Hashing partition " << partition_index_ << " ("
             << partition.name << ") on device " << part_path;
@@ -403,7 +755,7 @@ void FilesystemVerifierAction::StartPartitionHashing() {
     Cleanup(ErrorCode::kFilesystemVerifierError);
     return;
   }
-  buffer_.resize(kReadFileBufferSize);
+  buffer_ = AlignedBufferPool::Get()->Acquire(GetReadBufferSize());
   hasher_ = std::make_unique<HashCalculator>();
 
   offset_ = 0;
@@ -420,16 +772,19 @@ void FilesystemVerifierAction::StartPartitionHashing() {
   }
   if (ShouldWriteVerity()) {
     LOG(INFO) << "Verity writes enabled on partition " << partition.name;
+    verity_writer_->SetHashTreeThreads(install_plan_.verity_hash_tree_threads);
+    verity_writer_->SetFecThreads(install_plan_.verity_fec_threads);
     if (!verity_writer_->Init(partition)) {
       LOG(INFO) << "Verity writes enabled on partition " << partition.name;
       Cleanup(ErrorCode::kVerityCalculationError);
       return;
     }
+    StartReadAhead(0, filesystem_data_end_, buffer_.size());
     WriteVerityAndHashPartition(
         0, filesystem_data_end_, buffer_.data(), buffer_.size());
   } else {
     LOG(INFO) << "Verity writes disabled on partition " << partition.name;
-    HashPartition(0, partition_size_, buffer_.data(), buffer_.size());
+    VerifyPartition(buffer_.data(), buffer_.size());
   }
 }
 
@@ -475,14 +830,47 @@ bool FilesystemVerifierAction::ShouldWriteVerity() {
          (partition.hash_tree_size > 0 || partition.fec_size > 0);
 }
 
+bool FilesystemVerifierAction::ShouldVerifyTouchedBlocks(
+    const InstallPlan::Partition& partition) const {
+  return install_plan_.touched_blocks_verification &&
+         verifier_step_ == VerifierStep::kVerifyTargetHash &&
+         partition.verify_touched_blocks;
+}
+
+bool FilesystemVerifierAction::HasTrustedWritePathHash(
+    const InstallPlan::Partition& partition) const {
+  if (!install_plan_.trusted_write_path_hash ||
+      verifier_step_ != VerifierStep::kVerifyTargetHash ||
+      partition.write_path_hash.empty()) {
+    return false;
+  }
+  // The verity data is written by this action, after the hash was computed.
+  if (install_plan_.write_verity &&
+      (partition.hash_tree_size > 0 || partition.fec_size > 0)) {
+    return false;
+  }
+  if (partition.write_path_hash != partition.target_hash) {
+    LOG(WARNING) << "The hash of " << partition.name
+                 << " computed while writing it doesn't match, reading it "
+                    "back to verify it.";
+    return false;
+  }
+  return true;
+}
+
 void FilesystemVerifierAction::FinishPartitionHashing() {
   if (!hasher_->Finalize()) {
     LOG(ERROR) << "Unable to finalize the hash.";
     Cleanup(ErrorCode::kError);
     return;
   }
-  const InstallPlan::Partition& partition =
+  InstallPlan::Partition& partition =
       install_plan_.partitions[partition_index_];
+  if (verifier_step_ == VerifierStep::kVerifyTargetHash) {
+    partition.throughput_stats.verify_bytes += partition_size_;
+    partition.throughput_stats.verify_time +=
+        base::TimeTicks::Now() - partition_hash_start_time_;
+  }
   LOG(INFO) << "Hash of " << partition.name << ": "
             << HexEncode(hasher_->raw_hash());
 
@@ -543,12 +931,17 @@ void FilesystemVerifierAction::FinishPartitionHashing() {
       return;
   }
   // Start hashing the next partition, if any.
-  buffer_.clear();
+  ClosePartition();
+  StartPartitionHashing();
+}
+
+void FilesystemVerifierAction::ClosePartition() {
+  buffer_.Reset();
+  read_ahead_.reset();
   if (partition_fd_) {
     partition_fd_->Close();
     partition_fd_.reset();
   }
-  StartPartitionHashing();
 }
 
 }  // namespace chromeos_update_engine
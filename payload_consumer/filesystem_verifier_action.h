@@ -30,8 +30,11 @@
 #include "update_engine/common/action.h"
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/scoped_task_id.h"
+#include "update_engine/payload_consumer/aligned_buffer_pool.h"
+#include "update_engine/payload_consumer/concurrent_partition_hasher.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/read_ahead_reader.h"
 #include "update_engine/payload_consumer/verity_writer_interface.h"
 
 // This action will hash all the partitions of the target slot involved in the
@@ -52,6 +55,8 @@ enum class VerifierStep {
   kVerifySourceHash,
 };
 
+class PostinstallRunnerAction;
+
 class FilesystemVerifyDelegate {
  public:
   virtual ~FilesystemVerifyDelegate() = default;
@@ -80,6 +85,13 @@ class FilesystemVerifierAction : public InstallPlanAction {
     return this->delegate_;
   }
 
+  // The action running the postinstall after this one, which is handed the
+  // partitions as they are verified if the InstallPlan enables it. Must
+  // outlive the processing of this action.
+  void set_postinstall_runner(PostinstallRunnerAction* postinstall_runner) {
+    postinstall_runner_ = postinstall_runner;
+  }
+
   // Debugging/logging
   static std::string StaticType() { return "FilesystemVerifierAction"; }
   std::string Type() const override { return StaticType(); }
@@ -98,13 +110,64 @@ class FilesystemVerifierAction : public InstallPlanAction {
                      const off64_t end_offset,
                      void* buffer,
                      const size_t buffer_size);
+  // Updates the progress of the current partition with the |progress| of its
+  // hashing, after the verity writes if any.
+  void UpdateHashProgress(double progress);
+  // Hashes the current partition, or reads back only its touched ranges if
+  // it allows it, once its verity data is written.
+  void VerifyPartition(void* buffer, const size_t buffer_size);
+  // Compares the hashes of the touched ranges of the current partition from
+  // the one at |index|, then continues with the next partition. Falls back to
+  // hashing the whole partition on a mismatch.
+  void VerifyTouchedRanges(size_t index,
+                           void* buffer,
+                           const size_t buffer_size);
+
+  // Returns the |size| bytes of the current partition at |offset|, read into
+  // |buffer| or taken from |read_ahead_|, or nullptr on error.
+  const uint8_t* ReadPartition(const off64_t offset,
+                               const size_t size,
+                               void* buffer);
+
+  // Starts reading the current partition from |start_offset| to |end_offset|
+  // ahead of the hashing, in chunks of |buffer_size| bytes, if enabled by
+  // the InstallPlan.
+  void StartReadAhead(const off64_t start_offset,
+                      const off64_t end_offset,
+                      const size_t buffer_size);
+
+  // Returns the size of the reads of the current partition.
+  size_t GetReadBufferSize() const;
 
   // Return true if we need to write verity bytes.
   bool ShouldWriteVerity();
+  // Whether |partition| doesn't need to be read back, because the hash
+  // computed while writing it matches and the install plan trusts it.
+  bool HasTrustedWritePathHash(const InstallPlan::Partition& partition) const;
+  // Whether |partition| is verified by reading back only its touched ranges,
+  // see touched_blocks_verification.h.
+  bool ShouldVerifyTouchedBlocks(
+      const InstallPlan::Partition& partition) const;
   // Starts the hashing of the current partition. If there aren't any partitions
   // remaining to be hashed, it finishes the action.
   void StartPartitionHashing();
 
+  // Whether all the target partitions are hashed at the same time, instead of
+  // one at a time, as enabled by the InstallPlan.
+  bool ShouldVerifyConcurrently() const;
+  // Whether the postinstall of the verified partitions may start while the
+  // next ones are verified. Not when writing verity data requires the VABC
+  // partitions to be remapped, which they can't be once mounted.
+  bool ShouldStartPostinstallEarly() const;
+
+  // Starts hashing all the target partitions with |concurrent_hasher_|.
+  void StartConcurrentHashing();
+  // Reports the progress of |concurrent_hasher_| until it's done.
+  void MonitorConcurrentHashing();
+  // Checks the hashes computed by |concurrent_hasher_|, in partition order,
+  // and continues as if they were hashed one at a time.
+  void FinishConcurrentHashing();
+
   const std::string& GetPartitionPath() const;
 
   bool IsVABC(const InstallPlan::Partition& partition) const;
@@ -114,6 +177,8 @@ class FilesystemVerifierAction : public InstallPlanAction {
   // When the read is done, finalize the hash checking of the current partition
   // and continue checking the next one.
   void FinishPartitionHashing();
+  // Releases the buffers and the file descriptor of the current partition.
+  void ClosePartition();
 
   // Cleans up all the variables we use for async operations and tells the
   // ActionProcessor we're done w/ |code| as passed in. |cancelled_| should be
@@ -130,6 +195,8 @@ class FilesystemVerifierAction : public InstallPlanAction {
   // Initialize read_fd_ and write_fd_
   bool InitializeFd(const std::string& part_path);
   bool InitializeFdVABC(bool should_write_verity);
+  // Opens the COW of the current VABC partition as |partition_fd_|.
+  bool InitializeCowFd();
 
   // The type of the partition that we are verifying.
   VerifierStep verifier_step_ = VerifierStep::kVerifyTargetHash;
@@ -138,12 +205,24 @@ class FilesystemVerifierAction : public InstallPlanAction {
   // being hashed.
   size_t partition_index_{0};
 
+  // When the hashing of the current partition started.
+  base::TimeTicks partition_hash_start_time_;
+
   // If not null, the FileDescriptor used to read from the device.
   // verity writer might attempt to write to this fd, if verity is enabled.
   std::unique_ptr<FileDescriptor> partition_fd_;
 
-  // Buffer for storing data we read.
-  brillo::Blob buffer_;
+  // Buffer for storing data we read, aligned for O_DIRECT reads.
+  AlignedBuffer buffer_;
+
+  // If not null, reads |partition_fd_| on a dedicated thread ahead of the
+  // hashing. Must be reset before |partition_fd_| is used otherwise.
+  std::unique_ptr<ReadAheadReader> read_ahead_;
+
+  // If not null, hashes at the same time the target partitions of the
+  // InstallPlan at |concurrent_partition_indexes_|, in that order.
+  std::unique_ptr<ConcurrentPartitionHasher> concurrent_hasher_;
+  std::vector<size_t> concurrent_partition_indexes_;
 
   bool cancelled_{false};  // true if the action has been cancelled.
 
@@ -171,6 +250,7 @@ class FilesystemVerifierAction : public InstallPlanAction {
 
   // An observer that observes progress updates of this action.
   FilesystemVerifyDelegate* delegate_{};
+  PostinstallRunnerAction* postinstall_runner_{};
 
   // Callback that should be cancelled on |TerminateProcessing|. Usually this
   // points to pending read callbacks from async stream.
@@ -106,6 +106,10 @@ class FilesystemVerifierActionTest : public ::testing::Test {
   // Returns true iff test has completed successfully.
   bool DoTest(bool terminate_early, bool hash_fail);
 
+  // Verifies a partition which doesn't exist, with a write path hash
+  // |trusted| or not, and matching the target hash or not.
+  void DoTestWritePathHash(bool trusted, bool match, ErrorCode expected_code);
+
   void BuildActions(const InstallPlan& install_plan);
   void BuildActions(const InstallPlan& install_plan,
                     DynamicPartitionControlInterface* dynamic_control);
@@ -418,6 +422,41 @@ TEST_F(FilesystemVerifierActionTest, NonExistentDriveTest) {
   EXPECT_EQ(ErrorCode::kFilesystemVerifierError, delegate.code_);
 }
 
+void FilesystemVerifierActionTest::DoTestWritePathHash(
+    bool trusted, bool match, ErrorCode expected_code) {
+  // The partition doesn't exist, reading it back fails.
+  InstallPlan::Partition part;
+  part.name = "part";
+  part.target_path = "/no/such/file";
+  part.target_size = 4096;
+  part.target_hash = brillo::Blob(32, 'h');
+  part.write_path_hash = match ? part.target_hash : brillo::Blob(32, 'x');
+  install_plan_.partitions = {part};
+  install_plan_.trusted_write_path_hash = trusted;
+
+  BuildActions(install_plan_);
+
+  FilesystemVerifierActionTest2Delegate delegate;
+  processor_.set_delegate(&delegate);
+
+  processor_.StartProcessing();
+  EXPECT_FALSE(processor_.IsRunning());
+  EXPECT_TRUE(delegate.ran_);
+  EXPECT_EQ(expected_code, delegate.code_);
+}
+
+TEST_F(FilesystemVerifierActionTest, TrustedWritePathHashTest) {
+  DoTestWritePathHash(true, true, ErrorCode::kSuccess);
+}
+
+TEST_F(FilesystemVerifierActionTest, UntrustedWritePathHashTest) {
+  DoTestWritePathHash(false, true, ErrorCode::kFilesystemVerifierError);
+}
+
+TEST_F(FilesystemVerifierActionTest, MismatchedWritePathHashTest) {
+  DoTestWritePathHash(true, false, ErrorCode::kFilesystemVerifierError);
+}
+
 TEST_F(FilesystemVerifierActionTest, RunAsRootVerifyHashTest) {
   ASSERT_EQ(0U, getuid());
   EXPECT_TRUE(DoTest(false, false));
@@ -428,6 +467,38 @@ TEST_F(FilesystemVerifierActionTest, RunAsRootVerifyHashFailTest) {
   EXPECT_TRUE(DoTest(false, true));
 }
 
+TEST_F(FilesystemVerifierActionTest, RunAsRootVerifyHashReadAheadTest) {
+  ASSERT_EQ(0U, getuid());
+  install_plan_.verify_read_ahead_buffers = 4;
+  EXPECT_TRUE(DoTest(false, false));
+}
+
+TEST_F(FilesystemVerifierActionTest, RunAsRootVerifyHashFailReadAheadTest) {
+  ASSERT_EQ(0U, getuid());
+  install_plan_.verify_read_ahead_buffers = 4;
+  EXPECT_TRUE(DoTest(false, true));
+}
+
+TEST_F(FilesystemVerifierActionTest, RunAsRootVerifyHashConcurrentTest) {
+  ASSERT_EQ(0U, getuid());
+  install_plan_.verify_concurrent_partitions = 2;
+  EXPECT_TRUE(DoTest(false, false));
+}
+
+TEST_F(FilesystemVerifierActionTest, RunAsRootVerifyHashFailConcurrentTest) {
+  ASSERT_EQ(0U, getuid());
+  install_plan_.verify_concurrent_partitions = 2;
+  EXPECT_TRUE(DoTest(false, true));
+}
+
+TEST_F(FilesystemVerifierActionTest, RunAsRootTerminateEarlyConcurrentTest) {
+  ASSERT_EQ(0U, getuid());
+  install_plan_.verify_concurrent_partitions = 2;
+  EXPECT_TRUE(DoTest(true, false));
+  while (loop_.RunOnce(false)) {
+  }
+}
+
 TEST_F(FilesystemVerifierActionTest, RunAsRootTerminateEarlyTest) {
   ASSERT_EQ(0U, getuid());
   EXPECT_TRUE(DoTest(true, false));
@@ -578,7 +649,7 @@ void FilesystemVerifierActionTest::DoTestVABC(bool clear_target_hash,
     return;
   }
 
-  if (enable_verity) {
+  if (enable_verity || install_plan_.verify_cow_readers > 0) {
     ON_CALL(dynamic_control, OpenCowFd(part.name, {part.source_path}, _))
         .WillByDefault(open_cow);
     EXPECT_CALL(dynamic_control, OpenCowFd(part.name, {part.source_path}, _))
@@ -646,6 +717,27 @@ TEST_F(FilesystemVerifierActionTest, VABC_NoVerity_Target_Mismatch) {
   DoTestVABC(true, false);
 }
 
+TEST_F(FilesystemVerifierActionTest, VABC_NoVerity_Concurrent_Success) {
+  install_plan_.verify_concurrent_partitions = 2;
+  DoTestVABC(false, false);
+}
+
+TEST_F(FilesystemVerifierActionTest, VABC_NoVerity_Concurrent_Target_Mismatch) {
+  install_plan_.verify_concurrent_partitions = 2;
+  DoTestVABC(true, false);
+}
+
+TEST_F(FilesystemVerifierActionTest, VABC_NoVerity_CowReaders_Success) {
+  install_plan_.verify_cow_readers = 2;
+  install_plan_.verify_read_ahead_buffers = 4;
+  DoTestVABC(false, false);
+}
+
+TEST_F(FilesystemVerifierActionTest, VABC_NoVerity_CowReaders_Target_Mismatch) {
+  install_plan_.verify_cow_readers = 2;
+  DoTestVABC(true, false);
+}
+
 TEST_F(FilesystemVerifierActionTest, VABC_Verity_Success) {
   DoTestVABC(false, true);
 }
@@ -0,0 +1,159 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_FLAT_EXTENT_MAP_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_FLAT_EXTENT_MAP_H_
+
+#include <algorithm>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <base/logging.h>
+
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// An immutable ExtentMap: the extents are given at once when it is built and
+// kept in a vector sorted by start block, which the lookups binary search.
+// They are cheaper than ExtentMap ones and ForEachPart() allocates nothing,
+// which suits maps built once per partition and queried for every write, like
+// the XOR map of VABCPartitionWriter.
+template <typename T>
+class FlatExtentMap {
+ public:
+  FlatExtentMap() = default;
+
+  // Builds the map of |entries|. As with ExtentMap::AddExtent(), an entry
+  // overlapping one kept before it, in the order of their start blocks, is
+  // dropped.
+  explicit FlatExtentMap(std::vector<std::pair<Extent, T>> entries) {
+    std::stable_sort(entries.begin(),
+                     entries.end(),
+                     [](const auto& a, const auto& b) {
+                       return a.first.start_block() < b.first.start_block();
+                     });
+    entries_.reserve(entries.size());
+    size_t dropped = 0;
+    for (auto& [extent, value] : entries) {
+      if (extent.num_blocks() == 0) {
+        continue;
+      }
+      if (!entries_.empty() && extent.start_block() < entries_.back().end) {
+        dropped++;
+        continue;
+      }
+      entries_.push_back({extent.start_block(),
+                          extent.start_block() + extent.num_blocks(),
+                          std::move(value)});
+    }
+    if (dropped > 0) {
+      LOG(WARNING) << "Dropped " << dropped
+                   << " extents overlapping others from the extent map.";
+    }
+  }
+
+  size_t size() const { return entries_.size(); }
+
+  // Returns the value of the entry containing |extent|, if any.
+  std::optional<T> Get(const Extent& extent) const {
+    const auto it = FirstEndingAfter(extent.start_block());
+    if (it == entries_.end() || it->start > extent.start_block() ||
+        it->end < extent.start_block() + extent.num_blocks()) {
+      return {};
+    }
+    return {it->value};
+  }
+
+  // Calls |visit(part, value)| for the parts of |extent| in order, each either
+  // in the entry of which |value| points to the value, or in none of them with
+  // |value| set to nullptr. Stops and returns false as soon as |visit| does.
+  template <typename Visitor>
+  bool ForEachPart(const Extent& extent, Visitor&& visit) const {
+    uint64_t block = extent.start_block();
+    const uint64_t end = extent.start_block() + extent.num_blocks();
+    for (auto it = FirstEndingAfter(block);
+         it != entries_.end() && it->start < end;
+         it++) {
+      if (it->start > block) {
+        if (!visit(ExtentForRange(block, it->start - block),
+                   static_cast<const T*>(nullptr))) {
+          return false;
+        }
+        block = it->start;
+      }
+      const uint64_t part_end = std::min(it->end, end);
+      if (!visit(ExtentForRange(block, part_end - block), &it->value)) {
+        return false;
+      }
+      block = part_end;
+    }
+    if (block < end) {
+      return visit(ExtentForRange(block, end - block),
+                   static_cast<const T*>(nullptr));
+    }
+    return true;
+  }
+
+  // See ExtentMap::GetIntersectingExtents().
+  std::vector<Extent> GetIntersectingExtents(const Extent& extent) const {
+    std::vector<Extent> result;
+    ForEachPart(extent, [&result](const Extent& part, const T* value) {
+      if (value) {
+        result.push_back(part);
+      }
+      return true;
+    });
+    return result;
+  }
+
+  // See ExtentMap::GetNonIntersectingExtents().
+  std::vector<Extent> GetNonIntersectingExtents(const Extent& extent) const {
+    std::vector<Extent> result;
+    ForEachPart(extent, [&result](const Extent& part, const T* value) {
+      if (!value) {
+        result.push_back(part);
+      }
+      return true;
+    });
+    return result;
+  }
+
+ private:
+  // The blocks [start, end).
+  struct Entry {
+    uint64_t start;
+    uint64_t end;
+    T value;
+  };
+
+  // Returns the first entry ending after |block|.
+  typename std::vector<Entry>::const_iterator FirstEndingAfter(
+      uint64_t block) const {
+    return std::partition_point(
+        entries_.begin(), entries_.end(), [block](const Entry& entry) {
+          return entry.end <= block;
+        });
+  }
+
+  std::vector<Entry> entries_;
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_FLAT_EXTENT_MAP_H_
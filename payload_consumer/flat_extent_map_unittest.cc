@@ -0,0 +1,100 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <gtest/gtest.h>
+#include <optional>
+#include <vector>
+
+#include "update_engine/payload_consumer/extent_map.h"
+#include "update_engine/payload_consumer/flat_extent_map.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+namespace chromeos_update_engine {
+
+TEST(FlatExtentMapTest, Get) {
+  FlatExtentMap<int> map(
+      {{ExtentForRange(10, 5), 1}, {ExtentForRange(0, 5), 7}});
+  ASSERT_EQ(map.size(), 2U);
+  EXPECT_EQ(map.Get(ExtentForRange(0, 5)), 7);
+  EXPECT_EQ(map.Get(ExtentForRange(1, 2)), 7);
+  EXPECT_EQ(map.Get(ExtentForRange(14, 1)), 1);
+  EXPECT_EQ(map.Get(ExtentForRange(4, 2)), std::nullopt);
+  EXPECT_EQ(map.Get(ExtentForRange(5, 5)), std::nullopt);
+  EXPECT_EQ(map.Get(ExtentForRange(15, 1)), std::nullopt);
+}
+
+TEST(FlatExtentMapTest, TouchingExtentsAreNotMerged) {
+  FlatExtentMap<int> map(
+      {{ExtentForRange(0, 5), 7}, {ExtentForRange(5, 5), 1}});
+  EXPECT_EQ(map.Get(ExtentForRange(0, 10)), std::nullopt);
+  EXPECT_EQ(map.Get(ExtentForRange(4, 3)), std::nullopt);
+  auto ret = map.GetIntersectingExtents(ExtentForRange(3, 4));
+  ASSERT_EQ(ret.size(), 2U);
+  EXPECT_EQ(ret[0], ExtentForRange(3, 2));
+  EXPECT_EQ(ret[1], ExtentForRange(5, 2));
+}
+
+TEST(FlatExtentMapTest, OverlappingExtentsAreDropped) {
+  FlatExtentMap<int> map({{ExtentForRange(0, 5), 7},
+                          {ExtentForRange(0, 1), 2},
+                          {ExtentForRange(4, 3), 3}});
+  ASSERT_EQ(map.size(), 1U);
+  EXPECT_EQ(map.Get(ExtentForRange(0, 1)), 7);
+}
+
+TEST(FlatExtentMapTest, ForEachPart) {
+  FlatExtentMap<int> map(
+      {{ExtentForRange(0, 5), 7}, {ExtentForRange(10, 5), 1}});
+  std::vector<Extent> parts;
+  std::vector<int> values;
+  ASSERT_TRUE(map.ForEachPart(ExtentForRange(2, 15),
+                              [&](const Extent& part, const int* value) {
+                                parts.push_back(part);
+                                values.push_back(value ? *value : -1);
+                                return true;
+                              }));
+  ASSERT_EQ(parts,
+            (std::vector<Extent>{ExtentForRange(2, 3),
+                                 ExtentForRange(5, 5),
+                                 ExtentForRange(10, 5),
+                                 ExtentForRange(15, 2)}));
+  ASSERT_EQ(values, (std::vector<int>{7, -1, 1, -1}));
+}
+
+TEST(FlatExtentMapTest, MatchesExtentMap) {
+  ExtentMap<int> map;
+  std::vector<std::pair<Extent, int>> entries;
+  for (int i = 0; i < 20; i++) {
+    const Extent extent = ExtentForRange(i * 7 + i % 3, 1 + i % 5);
+    ASSERT_TRUE(map.AddExtent(extent, int{i}));
+    entries.emplace_back(extent, i);
+  }
+  const FlatExtentMap<int> flat_map(std::move(entries));
+  for (uint64_t start = 0; start < 150; start += 3) {
+    for (uint64_t num_blocks = 1; num_blocks < 12; num_blocks += 4) {
+      const Extent extent = ExtentForRange(start, num_blocks);
+      EXPECT_EQ(flat_map.Get(extent), map.Get(extent)) << extent;
+      EXPECT_EQ(flat_map.GetIntersectingExtents(extent),
+                map.GetIntersectingExtents(extent))
+          << extent;
+      EXPECT_EQ(flat_map.GetNonIntersectingExtents(extent),
+                map.GetNonIntersectingExtents(extent))
+          << extent;
+    }
+  }
+}
+
+}  // namespace chromeos_update_engine
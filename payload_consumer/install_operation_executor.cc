@@ -19,7 +19,10 @@
 #include <fcntl.h>
 #include <glob.h>
 #include <linux/fs.h>
+#include <string.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <utility>
 #include <vector>
@@ -29,6 +32,7 @@
 #include <bsdiff/bspatch.h>
 #include <puffin/brotli_util.h>
 #include <puffin/puffpatch.h>
+#include <zucchini/apply.h>
 #include <zucchini/patch_reader.h>
 #include <zucchini/zucchini.h>
 
@@ -37,11 +41,15 @@
 #include "update_engine/lz4diff/lz4diff_compress.h"
 #include "update_engine/payload_consumer/bzip_extent_writer.h"
 #include "update_engine/payload_consumer/cached_file_descriptor.h"
+#include "update_engine/payload_consumer/decoder_pool.h"
 #include "update_engine/payload_consumer/extent_reader.h"
 #include "update_engine/payload_consumer/extent_writer.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/payload_consumer/file_descriptor_utils.h"
+#include "update_engine/payload_consumer/memory_budget.h"
+#include "update_engine/payload_consumer/parallel_operation_applier.h"
 #include "update_engine/payload_consumer/xz_extent_writer.h"
+#include "update_engine/payload_consumer/zstd_extent_writer.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -104,6 +112,156 @@ class BsdiffExtentFile : public bsdiff::FileInterface {
 
   DISALLOW_COPY_AND_ASSIGN(BsdiffExtentFile);
 };
+
+// The source of a bsdiff patch, read through a window of at most
+// |window_size| bytes. bspatch issues many small reads close to each other,
+// which are served from the window without holding the whole source range.
+class WindowedBsdiffSourceFile : public bsdiff::FileInterface {
+ public:
+  WindowedBsdiffSourceFile(std::unique_ptr<ExtentReader> reader,
+                           uint64_t size,
+                           size_t window_size)
+      : reader_(std::move(reader)), size_(size), window_size_(window_size) {
+    window_.reserve(window_size_);
+  }
+  ~WindowedBsdiffSourceFile() override = default;
+
+  bool Read(void* buf, size_t count, size_t* bytes_read) override {
+    auto* out = static_cast<uint8_t*>(buf);
+    size_t done = 0;
+    while (done < count) {
+      if (offset_ < window_offset_ ||
+          offset_ >= window_offset_ + window_.size()) {
+        if (count - done >= window_size_) {
+          // The rest doesn't fit in the window, read it directly.
+          TEST_AND_RETURN_FALSE(reader_->Seek(offset_));
+          TEST_AND_RETURN_FALSE(reader_->Read(out + done, count - done));
+          offset_ += count - done;
+          break;
+        }
+        TEST_AND_RETURN_FALSE(FillWindow());
+      }
+      const size_t window_pos = offset_ - window_offset_;
+      const size_t bytes = std::min(count - done, window_.size() - window_pos);
+      memcpy(out + done, window_.data() + window_pos, bytes);
+      done += bytes;
+      offset_ += bytes;
+    }
+    *bytes_read = count;
+    return true;
+  }
+
+  bool Write(const void* buf, size_t count, size_t* bytes_written) override {
+    return false;
+  }
+
+  bool Seek(off_t pos) override {
+    TEST_AND_RETURN_FALSE(pos >= 0 && static_cast<uint64_t>(pos) <= size_);
+    offset_ = pos;
+    return true;
+  }
+
+  bool Close() override { return true; }
+
+  bool GetSize(uint64_t* size) override {
+    *size = size_;
+    return true;
+  }
+
+ private:
+  // Reads the window starting at |offset_|.
+  bool FillWindow() {
+    TEST_AND_RETURN_FALSE(offset_ < size_);
+    window_.resize(std::min<uint64_t>(window_size_, size_ - offset_));
+    TEST_AND_RETURN_FALSE(reader_->Seek(offset_));
+    TEST_AND_RETURN_FALSE(reader_->Read(window_.data(), window_.size()));
+    window_offset_ = offset_;
+    return true;
+  }
+
+  std::unique_ptr<ExtentReader> reader_;
+  uint64_t size_;
+  size_t window_size_;
+  brillo::Blob window_;
+  // Offset of |window_| in the source.
+  uint64_t window_offset_{0};
+  uint64_t offset_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(WindowedBsdiffSourceFile);
+};
+
+// The target of a bsdiff patch, which coalesces the output of bspatch into
+// chunks of |chunk_size| bytes before passing them to the ExtentWriter. Close()
+// must be called to write the last chunk.
+class ChunkedBsdiffTargetFile : public bsdiff::FileInterface {
+ public:
+  ChunkedBsdiffTargetFile(std::unique_ptr<ExtentWriter> writer,
+                          uint64_t size,
+                          size_t chunk_size)
+      : writer_(std::move(writer)), size_(size), chunk_size_(chunk_size) {
+    buffer_.reserve(chunk_size_);
+  }
+  ~ChunkedBsdiffTargetFile() override = default;
+
+  bool Read(void* buf, size_t count, size_t* bytes_read) override {
+    return false;
+  }
+
+  bool Write(const void* buf, size_t count, size_t* bytes_written) override {
+    const auto* data = static_cast<const uint8_t*>(buf);
+    size_t done = 0;
+    while (done < count) {
+      if (buffer_.empty() && count - done >= chunk_size_) {
+        // A whole chunk is available, don't copy it.
+        TEST_AND_RETURN_FALSE(writer_->Write(data + done, count - done));
+        done = count;
+        break;
+      }
+      const size_t bytes =
+          std::min(count - done, chunk_size_ - buffer_.size());
+      buffer_.insert(buffer_.end(), data + done, data + done + bytes);
+      done += bytes;
+      if (buffer_.size() == chunk_size_) {
+        TEST_AND_RETURN_FALSE(Flush());
+      }
+    }
+    *bytes_written = count;
+    offset_ += count;
+    return true;
+  }
+
+  bool Seek(off_t pos) override {
+    // For writes technically there should be no change of position, or it
+    // should be equivalent of current offset.
+    TEST_AND_RETURN_FALSE(offset_ == static_cast<uint64_t>(pos));
+    return true;
+  }
+
+  bool Close() override { return Flush(); }
+
+  bool GetSize(uint64_t* size) override {
+    *size = size_;
+    return true;
+  }
+
+ private:
+  bool Flush() {
+    if (!buffer_.empty()) {
+      TEST_AND_RETURN_FALSE(writer_->Write(buffer_.data(), buffer_.size()));
+      buffer_.clear();
+    }
+    return true;
+  }
+
+  std::unique_ptr<ExtentWriter> writer_;
+  uint64_t size_;
+  size_t chunk_size_;
+  brillo::Blob buffer_;
+  uint64_t offset_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(ChunkedBsdiffTargetFile);
+};
+
 // A class to be passed to |puffpatch| for reading from |source_fd_| and writing
 // into |target_fd_|.
 class PuffinExtentStream : public puffin::StreamInterface {
@@ -175,18 +333,77 @@ class PuffinExtentStream : public puffin::StreamInterface {
   DISALLOW_COPY_AND_ASSIGN(PuffinExtentStream);
 };
 
+bool InstallOperationExecutor::SetZstdDictionary(
+    const std::string& dictionary) {
+  if (dictionary.empty()) {
+    zstd_dictionary_.reset();
+    return true;
+  }
+  ZSTD_DDict* ddict = ZSTD_createDDict(dictionary.data(), dictionary.size());
+  if (ddict == nullptr) {
+    LOG(ERROR) << "Failed to load the zstd dictionary of "
+               << dictionary.size() << " bytes.";
+    return false;
+  }
+  zstd_dictionary_.reset(ddict, [](const ZSTD_DDict* p) {
+    ZSTD_freeDDict(const_cast<ZSTD_DDict*>(p));
+  });
+  return true;
+}
+
+size_t InstallOperationExecutor::PoolThreads(size_t num_threads) const {
+  if (worker_pool_ == nullptr) {
+    return 1;
+  }
+  const size_t limit = std::min({num_threads,
+                                 worker_pool_->num_threads(),
+                                 ParallelOperationApplier::GetThreadLimit()});
+  return std::max<size_t>(limit, 1);
+}
+
+bool InstallOperationExecutor::ParallelFor(
+    size_t count, const std::function<bool(size_t)>& task) {
+  const size_t num_threads = PoolThreads(count);
+  if (num_threads <= 1) {
+    bool success = true;
+    for (size_t i = 0; i < count; i++) {
+      success = task(i) && success;
+    }
+    return success;
+  }
+  std::atomic<size_t> next_task{0};
+  std::atomic<bool> success{true};
+  worker_pool_->ParallelFor(num_threads, [&](size_t) {
+    for (size_t i = next_task++; i < count; i = next_task++) {
+      if (!task(i)) {
+        success = false;
+      }
+    }
+    return true;
+  });
+  return success;
+}
+
 bool InstallOperationExecutor::ExecuteReplaceOperation(
     const InstallOperation& operation,
     std::unique_ptr<ExtentWriter> writer,
     const void* data) {
   TEST_AND_RETURN_FALSE(operation.type() == InstallOperation::REPLACE ||
                         operation.type() == InstallOperation::REPLACE_BZ ||
-                        operation.type() == InstallOperation::REPLACE_XZ);
+                        operation.type() == InstallOperation::REPLACE_XZ ||
+                        operation.type() == InstallOperation::REPLACE_ZSTD);
   // Setup the ExtentWriter stack based on the operation type.
   if (operation.type() == InstallOperation::REPLACE_BZ) {
-    writer.reset(new BzipExtentWriter(std::move(writer)));
+    writer.reset(new BzipExtentWriter(
+        std::move(writer), worker_pool_, PoolThreads(bzip_threads_)));
   } else if (operation.type() == InstallOperation::REPLACE_XZ) {
-    writer.reset(new XzExtentWriter(std::move(writer)));
+    writer.reset(new XzExtentWriter(
+        std::move(writer), worker_pool_, PoolThreads(xz_threads_)));
+  } else if (operation.type() == InstallOperation::REPLACE_ZSTD) {
+    writer.reset(new ZstdExtentWriter(std::move(writer),
+                                      zstd_dictionary_.get(),
+                                      worker_pool_,
+                                      PoolThreads(zstd_threads_)));
   }
   TEST_AND_RETURN_FALSE(writer->Init(operation.dst_extents(), block_size_));
   TEST_AND_RETURN_FALSE(writer->Write(data, operation.data_length()));
@@ -201,7 +418,7 @@ bool InstallOperationExecutor::ExecuteZeroOrDiscardOperation(
   using base::MemoryMappedFile;
   using Access = base::MemoryMappedFile::Access;
   using Region = base::MemoryMappedFile::Region;
-  writer->Init(operation.dst_extents(), block_size_);
+  TEST_AND_RETURN_FALSE(writer->Init(operation.dst_extents(), block_size_));
   // Mmap a region of /dev/zero, as we don't need any actual memory to store
   // these 0s, so mmap a region of "free memory".
   base::File dev_zero(base::FilePath("/dev/zero"),
@@ -214,15 +431,15 @@ bool InstallOperationExecutor::ExecuteZeroOrDiscardOperation(
           static_cast<size_t>(utils::BlocksInExtents(operation.dst_extents()) *
                               block_size_)},
       Access::READ_ONLY));
-  writer->Write(buffer.data(), buffer.length());
-  return true;
+  return writer->Write(buffer.data(), buffer.length());
 }
 
 bool InstallOperationExecutor::ExecuteSourceCopyOperation(
     const InstallOperation& operation,
     std::unique_ptr<ExtentWriter> writer,
     FileDescriptorPtr source_fd) {
-  TEST_AND_RETURN_FALSE(operation.type() == InstallOperation::SOURCE_COPY);
+  TEST_AND_RETURN_FALSE(operation.type() == InstallOperation::SOURCE_COPY ||
+                        operation.type() == InstallOperation::TARGET_COPY);
   TEST_AND_RETURN_FALSE(writer->Init(operation.dst_extents(), block_size_));
   return fd_utils::CommonHashExtents(
       source_fd, operation.src_extents(), writer.get(), block_size_, nullptr);
@@ -266,10 +483,27 @@ bool InstallOperationExecutor::ExecuteLz4diffOperation(
     FileDescriptorPtr source_fd,
     const void* data,
     size_t count) {
+  // The source is read whole and patched into the whole decompressed target,
+  // there is no streaming mode to fall back to.
+  const uint64_t src_size =
+      utils::BlocksInExtents(operation.src_extents()) * block_size_;
+  const uint64_t dst_size =
+      utils::BlocksInExtents(operation.dst_extents()) * block_size_;
+  MemoryBudget::Reservation reservation =
+      MemoryBudget::Get()->Acquire(src_size + dst_size);
   brillo::Blob src_data;
 
   TEST_AND_RETURN_FALSE(utils::ReadExtents(
       source_fd, operation.src_extents(), &src_data, block_size_));
+  // Each task recompresses blocks with its own LZ4 state, so every one of them
+  // has to run. There is more than one task only with a pool.
+  auto run_tasks = [pool(worker_pool_)](
+                       std::vector<std::function<void()>> tasks) {
+    pool->ParallelFor(tasks.size(), [&tasks](size_t i) {
+      tasks[i]();
+      return true;
+    });
+  };
   TEST_AND_RETURN_FALSE(Lz4Patch(
       ToStringView(src_data),
       ToStringView(data, count),
@@ -278,31 +512,84 @@ bool InstallOperationExecutor::ExecuteLz4diffOperation(
           return 0;
         }
         return size;
-      }));
+      },
+      PoolThreads(lz4diff_threads_),
+      run_tasks));
   return true;
 }
 
+std::unique_ptr<ExtentReader> InstallOperationExecutor::CreateSourceReader(
+    const InstallOperation& operation,
+    FileDescriptorPtr source_fd,
+    MemoryBudget::Reservation* reservation) {
+  // Smaller sources take few enough reads not to need a thread, and the
+  // throttle doesn't leave room for one when it limits the apply to a single
+  // thread.
+  constexpr uint64_t kMinReadaheadSourceSize = 256 * 1024;
+  const uint64_t src_size =
+      utils::BlocksInExtents(operation.src_extents()) * block_size_;
+  const uint64_t window_size = std::min(source_readahead_size_, src_size);
+  std::unique_ptr<ExtentReader> reader;
+  if (window_size > 0 && src_size >= kMinReadaheadSourceSize &&
+      ParallelOperationApplier::GetThreadLimit() > 1 &&
+      MemoryBudget::Get()->TryAcquire(window_size, reservation)) {
+    reader = std::make_unique<PrefetchingExtentReader>(window_size);
+  } else {
+    reader = std::make_unique<DirectExtentReader>();
+  }
+  if (!reader->Init(source_fd, operation.src_extents(), block_size_)) {
+    LOG(ERROR) << "Failed to initialize the source reader.";
+    return nullptr;
+  }
+  return reader;
+}
+
 bool InstallOperationExecutor::ExecuteSourceBsdiffOperation(
     const InstallOperation& operation,
     std::unique_ptr<ExtentWriter> writer,
     FileDescriptorPtr source_fd,
     const void* data,
     size_t count) {
-  auto reader = std::make_unique<DirectExtentReader>();
-  TEST_AND_RETURN_FALSE(
-      reader->Init(source_fd, operation.src_extents(), block_size_));
-  auto src_file = std::make_unique<BsdiffExtentFile>(
-      std::move(reader),
-      utils::BlocksInExtents(operation.src_extents()) * block_size_);
-
-  auto dst_file = std::make_unique<BsdiffExtentFile>(
-      std::move(writer),
-      utils::BlocksInExtents(operation.dst_extents()) * block_size_);
+  MemoryBudget::Reservation readahead_reservation;
+  std::unique_ptr<ExtentReader> reader =
+      CreateSourceReader(operation, source_fd, &readahead_reservation);
+  TEST_AND_RETURN_FALSE(reader != nullptr);
+  const uint64_t src_size =
+      utils::BlocksInExtents(operation.src_extents()) * block_size_;
+  const uint64_t dst_size =
+      utils::BlocksInExtents(operation.dst_extents()) * block_size_;
+
+  std::unique_ptr<bsdiff::FileInterface> src_file;
+  std::unique_ptr<bsdiff::FileInterface> dst_file;
+  MemoryBudget::Reservation reservation;
+  if (bsdiff_memory_limit_ > 0) {
+    // Split the limit between the source window and the output chunk, in
+    // whole blocks and no larger than needed for this operation.
+    const uint64_t blocks =
+        std::max<uint64_t>(bsdiff_memory_limit_ / block_size_, 2);
+    const uint64_t window_size =
+        std::min(blocks / 2 * block_size_, std::max<uint64_t>(src_size, 1));
+    const uint64_t chunk_size = std::min(
+        (blocks - blocks / 2) * block_size_, std::max<uint64_t>(dst_size, 1));
+    // Without room for the buffers, read and write through directly.
+    if (MemoryBudget::Get()->TryAcquire(window_size + chunk_size,
+                                        &reservation)) {
+      src_file = std::make_unique<WindowedBsdiffSourceFile>(
+          std::move(reader), src_size, window_size);
+      dst_file = std::make_unique<ChunkedBsdiffTargetFile>(
+          std::move(writer), dst_size, chunk_size);
+    }
+  }
+  if (!src_file) {
+    src_file = std::make_unique<BsdiffExtentFile>(std::move(reader), src_size);
+    dst_file = std::make_unique<BsdiffExtentFile>(std::move(writer), dst_size);
+  }
 
-  TEST_AND_RETURN_FALSE(bsdiff::bspatch(std::move(src_file),
-                                        std::move(dst_file),
+  TEST_AND_RETURN_FALSE(bsdiff::bspatch(src_file,
+                                        dst_file,
                                         reinterpret_cast<const uint8_t*>(data),
                                         count) == 0);
+  TEST_AND_RETURN_FALSE(dst_file->Close());
   return true;
 }
 
@@ -312,48 +599,181 @@ bool InstallOperationExecutor::ExecutePuffDiffOperation(
     FileDescriptorPtr source_fd,
     const void* data,
     size_t count) {
-  auto reader = std::make_unique<DirectExtentReader>();
-  TEST_AND_RETURN_FALSE(
-      reader->Init(source_fd, operation.src_extents(), block_size_));
-  puffin::UniqueStreamPtr src_stream(new PuffinExtentStream(
-      std::move(reader),
-      utils::BlocksInExtents(operation.src_extents()) * block_size_));
+  MemoryBudget::Reservation readahead_reservation;
+  std::unique_ptr<ExtentReader> reader =
+      CreateSourceReader(operation, source_fd, &readahead_reservation);
+  TEST_AND_RETURN_FALSE(reader != nullptr);
+  const uint64_t src_size =
+      utils::BlocksInExtents(operation.src_extents()) * block_size_;
+  puffin::UniqueStreamPtr src_stream(
+      new PuffinExtentStream(std::move(reader), src_size));
 
   puffin::UniqueStreamPtr dst_stream(new PuffinExtentStream(
       std::move(writer),
       utils::BlocksInExtents(operation.dst_extents()) * block_size_));
 
-  constexpr size_t kMaxCacheSize = 5 * 1024 * 1024;  // Total 5MB cache.
+  constexpr uint64_t kDefaultCacheSize = 5 * 1024 * 1024;
+  // The inflated source is rarely more than this many times its size, so a
+  // larger cache would only hold back the memory budget.
+  constexpr uint64_t kMaxInflateRatio = 8;
+  const uint64_t max_cache_size = std::min(
+      puffdiff_cache_size_ > 0 ? puffdiff_cache_size_ : kDefaultCacheSize,
+      src_size * kMaxInflateRatio);
+  // Without room for the configured cache, fall back to the default one, and
+  // then to inflating the deflate streams again each time they are read.
+  MemoryBudget::Reservation reservation;
+  size_t cache_size = 0;
+  for (uint64_t size : {max_cache_size, kDefaultCacheSize}) {
+    if (size <= max_cache_size &&
+        MemoryBudget::Get()->TryAcquire(size, &reservation)) {
+      cache_size = size;
+      break;
+    }
+  }
   TEST_AND_RETURN_FALSE(
       puffin::PuffPatch(std::move(src_stream),
                         std::move(dst_stream),
                         reinterpret_cast<const uint8_t*>(data),
                         count,
-                        kMaxCacheSize));
+                        cache_size));
   return true;
 }
 
-bool InstallOperationExecutor::ExecuteZucchiniOperation(
+namespace {
+
+// Applies the elements of |patch_reader| on up to |num_threads| threads of
+// |pool|. The elements patch distinct parts of |new_image|, which
+// zucchini::ApplyBuffer() patches one after another.
+bool ApplyZucchiniElements(zucchini::ConstBufferView old_image,
+                           const zucchini::EnsemblePatchReader& patch_reader,
+                           zucchini::MutableBufferView new_image,
+                           WorkerPool* pool,
+                           size_t num_threads) {
+  if (!patch_reader.CheckOldFile(old_image)) {
+    LOG(ERROR) << "Invalid source for the zucchini patch.";
+    return false;
+  }
+  const auto& elements = patch_reader.elements();
+  std::vector<zucchini::BufferRegion> new_regions;
+  for (const auto& element : elements) {
+    const zucchini::ElementMatch match = element.element_match();
+    if (!old_image.covers(match.old_element.region()) ||
+        !new_image.covers(match.new_element.region())) {
+      LOG(ERROR) << "Invalid element in the zucchini patch.";
+      return false;
+    }
+    new_regions.push_back(match.new_element.region());
+  }
+  std::sort(new_regions.begin(),
+            new_regions.end(),
+            [](const auto& a, const auto& b) { return a.offset < b.offset; });
+  for (size_t i = 1; i < new_regions.size(); i++) {
+    if (new_regions[i - 1].hi() > new_regions[i].offset) {
+      LOG(ERROR) << "Overlapping elements in the zucchini patch.";
+      return false;
+    }
+  }
+
+  // Each of the |num_threads| tasks applies the next element until none is
+  // left, as the elements vary a lot in size.
+  num_threads = std::min({num_threads, pool->num_threads(), elements.size()});
+  std::atomic<size_t> next_element{0};
+  std::atomic<bool> success{true};
+  pool->ParallelFor(num_threads, [&](size_t) {
+    for (size_t i = next_element++; i < elements.size() && success;
+         i = next_element++) {
+      const zucchini::ElementMatch match = elements[i].element_match();
+      if (!zucchini::ApplyElement(match.exe_type(),
+                                  old_image[match.old_element.region()],
+                                  elements[i],
+                                  new_image[match.new_element.region()])) {
+        LOG(ERROR) << "Failed to apply element " << i
+                   << " of the zucchini patch.";
+        success = false;
+      }
+    }
+    return true;
+  });
+  if (!success) {
+    return false;
+  }
+  if (!patch_reader.CheckNewFile(zucchini::ConstBufferView(new_image))) {
+    LOG(ERROR) << "Invalid output of the zucchini patch.";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+std::shared_ptr<const brillo::Blob>
+InstallOperationExecutor::ReadZucchiniSource(
     const InstallOperation& operation,
-    std::unique_ptr<ExtentWriter> writer,
     FileDescriptorPtr source_fd,
-    const void* data,
-    size_t count) {
-  uint64_t src_size =
-      utils::BlocksInExtents(operation.src_extents()) * block_size_;
-  brillo::Blob source_bytes(src_size);
+    MemoryBudget::Reservation* reservation) {
+  const auto same_extents = [&operation](const auto& extents) {
+    return std::equal(extents.begin(),
+                      extents.end(),
+                      operation.src_extents().begin(),
+                      operation.src_extents().end(),
+                      [](const Extent& a, const Extent& b) {
+                        return a.start_block() == b.start_block() &&
+                               a.num_blocks() == b.num_blocks();
+                      });
+  };
+  {
+    std::lock_guard<std::mutex> lock(zucchini_source_mutex_);
+    if (zucchini_source_ && same_extents(zucchini_source_extents_)) {
+      return zucchini_source_;
+    }
+    // Only one source is kept, drop it before reading another one.
+    zucchini_source_.reset();
+    zucchini_source_reservation_.Reset();
+  }
 
+  const uint64_t src_size =
+      utils::BlocksInExtents(operation.src_extents()) * block_size_;
+  *reservation = MemoryBudget::Get()->Acquire(src_size);
+  auto source_bytes = std::make_shared<brillo::Blob>(src_size);
   // TODO(197361113) either make zucchini stream the read, or use memory mapped
   // files.
   auto reader = std::make_unique<DirectExtentReader>();
-  TEST_AND_RETURN_FALSE(
-      reader->Init(source_fd, operation.src_extents(), block_size_));
-  TEST_AND_RETURN_FALSE(reader->Seek(0));
-  TEST_AND_RETURN_FALSE(reader->Read(source_bytes.data(), src_size));
+  if (!reader->Init(source_fd, operation.src_extents(), block_size_) ||
+      !reader->Seek(0) || !reader->Read(source_bytes->data(), src_size)) {
+    LOG(ERROR) << "Failed to read the source of the zucchini operation.";
+    return nullptr;
+  }
+
+  // Keep the source for the next operations patching the same file, e.g. the
+  // parts of a large native library, as long as the budget has room for it.
+  std::lock_guard<std::mutex> lock(zucchini_source_mutex_);
+  if (!zucchini_source_ && MemoryBudget::Get()->TryAcquire(
+                               src_size, &zucchini_source_reservation_)) {
+    reservation->Reset();
+    zucchini_source_ = source_bytes;
+    zucchini_source_extents_ = operation.src_extents();
+  }
+  return source_bytes;
+}
+
+bool InstallOperationExecutor::ExecuteZucchiniOperation(
+    const InstallOperation& operation,
+    std::unique_ptr<ExtentWriter> writer,
+    FileDescriptorPtr source_fd,
+    const void* data,
+    size_t count) {
+  // zucchini needs the whole source and target in memory.
+  MemoryBudget::Reservation reservation = MemoryBudget::Get()->Acquire(
+      utils::BlocksInExtents(operation.dst_extents()) * block_size_);
+  MemoryBudget::Reservation source_reservation;
+  const std::shared_ptr<const brillo::Blob> source_bytes =
+      ReadZucchiniSource(operation, source_fd, &source_reservation);
+  TEST_AND_RETURN_FALSE(source_bytes != nullptr);
 
   brillo::Blob zucchini_patch;
   TEST_AND_RETURN_FALSE(puffin::BrotliDecode(
       static_cast<const uint8_t*>(data), count, &zucchini_patch));
+  reservation.Resize(reservation.size() + zucchini_patch.size());
   auto patch_reader = zucchini::EnsemblePatchReader::Create(
       {zucchini_patch.data(), zucchini_patch.size()});
   if (!patch_reader.has_value()) {
@@ -366,18 +786,28 @@ bool InstallOperationExecutor::ExecuteZucchiniOperation(
                         utils::BlocksInExtents(operation.dst_extents()) *
                             block_size_);
 
-  brillo::Blob patched_data(dst_size);
-  auto status =
-      zucchini::ApplyBuffer({source_bytes.data(), source_bytes.size()},
-                            *patch_reader,
-                            {patched_data.data(), patched_data.size()});
-  if (status != zucchini::status::kStatusSuccess) {
-    LOG(ERROR) << "Failed to apply the zucchini patch: " << status;
-    return false;
+  DecoderPool::ScopedBuffer patched_data(dst_size);
+  const size_t zucchini_threads = PoolThreads(zucchini_threads_);
+  if (zucchini_threads > 1 && patch_reader->elements().size() > 1) {
+    TEST_AND_RETURN_FALSE(
+        ApplyZucchiniElements({source_bytes->data(), source_bytes->size()},
+                              *patch_reader,
+                              {patched_data->data(), patched_data->size()},
+                              worker_pool_,
+                              zucchini_threads));
+  } else {
+    auto status =
+        zucchini::ApplyBuffer({source_bytes->data(), source_bytes->size()},
+                              *patch_reader,
+                              {patched_data->data(), patched_data->size()});
+    if (status != zucchini::status::kStatusSuccess) {
+      LOG(ERROR) << "Failed to apply the zucchini patch: " << status;
+      return false;
+    }
   }
 
   TEST_AND_RETURN_FALSE(
-      writer->Write(patched_data.data(), patched_data.size()));
+      writer->Write(patched_data->data(), patched_data->size()));
   return true;
 }
 
@@ -17,10 +17,20 @@
 #ifndef UPDATE_ENGINE_INSTALL_OPERATION_EXECUTOR_H
 #define UPDATE_ENGINE_INSTALL_OPERATION_EXECUTOR_H
 
+#include <zstd.h>
+
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <string>
+
+#include <brillo/secure_blob.h>
 
+#include "update_engine/payload_consumer/extent_reader.h"
 #include "update_engine/payload_consumer/extent_writer.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_consumer/memory_budget.h"
+#include "update_engine/payload_consumer/worker_pool.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -30,12 +40,68 @@ class InstallOperationExecutor {
   explicit InstallOperationExecutor(size_t block_size)
       : block_size_(block_size) {}
 
+  // Caps the memory used to buffer the source and target of bsdiff
+  // operations to |limit| bytes, split between a window over the source and
+  // chunks of output. 0, the default, reads and writes through directly.
+  void set_bsdiff_memory_limit(uint64_t limit) {
+    bsdiff_memory_limit_ = limit;
+  }
+
+  // Decodes the blocks of multi-block REPLACE_BZ operations on up to
+  // |num_threads| threads.
+  void set_bzip_threads(size_t num_threads) { bzip_threads_ = num_threads; }
+
+  // Recompresses the output of lz4diff operations on up to |num_threads|
+  // threads.
+  void set_lz4diff_threads(size_t num_threads) {
+    lz4diff_threads_ = num_threads;
+  }
+
+  // Runs the steps of an operation that use several threads on |pool|, which
+  // must outlive this executor and its copies and not be used by others while
+  // they execute an operation. Without a pool, these steps run on the calling
+  // thread.
+  void set_worker_pool(WorkerPool* pool) { worker_pool_ = pool; }
+
+  // Decodes the blocks of multi-block REPLACE_XZ operations on up to
+  // |num_threads| threads.
+  void set_xz_threads(size_t num_threads) { xz_threads_ = num_threads; }
+
+  // Decodes the frames of multi-frame REPLACE_ZSTD operations on up to
+  // |num_threads| threads.
+  void set_zstd_threads(size_t num_threads) { zstd_threads_ = num_threads; }
+
+  // Applies the elements of ZUCCHINI patches made of several elements, e.g.
+  // the sections of a native library, on up to |num_threads| threads.
+  void set_zucchini_threads(size_t num_threads) {
+    zucchini_threads_ = num_threads;
+  }
+
+  // Caps the memory puffin uses to cache the inflated source deflate streams
+  // of PUFFDIFF operations, which it otherwise inflates again each time the
+  // patch reads them. The cache is only used as far as the MemoryBudget has
+  // room for it. 0 uses a 5 MiB cache.
+  void set_puffdiff_cache_size(uint64_t size) { puffdiff_cache_size_ = size; }
+
+  // Reads the source of SOURCE_BSDIFF, BROTLI_BSDIFF and PUFFDIFF operations
+  // up to |size| bytes ahead of the patch, on a background thread, as far as
+  // the MemoryBudget has room for it. 0, the default, reads the source as the
+  // patch needs it.
+  void set_source_readahead_size(uint64_t size) {
+    source_readahead_size_ = size;
+  }
+
+  // Loads the |dictionary| used by the REPLACE_ZSTD operations of the
+  // partition. An empty |dictionary| clears it.
+  bool SetZstdDictionary(const std::string& dictionary);
+
   // data should point to the memory of operation.data_length() bytes
   bool ExecuteReplaceOperation(const InstallOperation& operation,
                                std::unique_ptr<ExtentWriter> writer,
                                const void* data);
   bool ExecuteZeroOrDiscardOperation(const InstallOperation& operation,
                                      std::unique_ptr<ExtentWriter> writer);
+  // Also executes TARGET_COPY operations, with the target as |source_fd|.
   bool ExecuteSourceCopyOperation(const InstallOperation& operation,
                                   std::unique_ptr<ExtentWriter> writer,
                                   FileDescriptorPtr source_fd);
@@ -46,7 +112,16 @@ class InstallOperationExecutor {
                             const void* data,
                             size_t count);
 
+  // Runs |task(i)| for every |i| in [0, |count|) on up to |count| threads of
+  // the WorkerPool, on the calling thread without one. Returns whether all the
+  // calls returned true. Must not be called while an operation is executed.
+  bool ParallelFor(size_t count, const std::function<bool(size_t)>& task);
+
  private:
+  // Number of threads of |worker_pool_| a step given |num_threads| threads
+  // runs on, within the thread limit of the throttle.
+  size_t PoolThreads(size_t num_threads) const;
+
   bool ExecuteSourceBsdiffOperation(const InstallOperation& operation,
                                     std::unique_ptr<ExtentWriter> writer,
                                     FileDescriptorPtr source_fd,
@@ -62,6 +137,22 @@ class InstallOperationExecutor {
                                 FileDescriptorPtr source_fd,
                                 const void* data,
                                 size_t count);
+
+  // Returns a reader of the source of |operation|, reading ahead when enabled
+  // with |reservation| accounting for the read-ahead. Returns null on error.
+  std::unique_ptr<ExtentReader> CreateSourceReader(
+      const InstallOperation& operation,
+      FileDescriptorPtr source_fd,
+      MemoryBudget::Reservation* reservation);
+
+  // Returns the source of the ZUCCHINI |operation|, which is kept for the
+  // next operations with the same source extents when the memory budget has
+  // room for it. Otherwise |reservation| accounts for it.
+  std::shared_ptr<const brillo::Blob> ReadZucchiniSource(
+      const InstallOperation& operation,
+      FileDescriptorPtr source_fd,
+      MemoryBudget::Reservation* reservation);
+
   bool ExecuteLz4diffOperation(const InstallOperation& operation,
                                std::unique_ptr<ExtentWriter> writer,
                                FileDescriptorPtr source_fd,
@@ -69,6 +160,23 @@ class InstallOperationExecutor {
                                size_t count);
 
   size_t block_size_;
+  WorkerPool* worker_pool_{nullptr};
+  uint64_t bsdiff_memory_limit_{0};
+  size_t bzip_threads_{1};
+  size_t lz4diff_threads_{1};
+  size_t xz_threads_{1};
+  size_t zstd_threads_{1};
+  uint64_t puffdiff_cache_size_{0};
+  uint64_t source_readahead_size_{0};
+  size_t zucchini_threads_{1};
+  std::shared_ptr<const ZSTD_DDict> zstd_dictionary_;
+
+  // The ZUCCHINI operations of the partition may be applied from several
+  // threads, this guards the last source read for them.
+  std::mutex zucchini_source_mutex_;
+  std::shared_ptr<const brillo::Blob> zucchini_source_;
+  google::protobuf::RepeatedPtrField<Extent> zucchini_source_extents_;
+  MemoryBudget::Reservation zucchini_source_reservation_;
 };
 
 }  // namespace chromeos_update_engine
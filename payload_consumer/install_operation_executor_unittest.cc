@@ -130,6 +130,7 @@ class InstallOperationExecutorTest : public ::testing::Test {
   std::vector<uint8_t> target_data_;
 
   InstallOperationExecutor executor_{BLOCK_SIZE};
+  WorkerPool pool_{4};
 };
 
 TEST_F(InstallOperationExecutorTest, ReplaceOpTest) {
@@ -252,20 +253,80 @@ TEST_F(InstallOperationExecutorTest, ZucchiniOpTest) {
       {{InstallOperation::ZUCCHINI, 1024 * BLOCK_SIZE}}, &aop, &patch_data));
   ASSERT_EQ(InstallOperation::ZUCCHINI, aop.op.type());
 
-  // Call the executor
-  ScopedTempFile patched{"patched.XXXXXXXX", true};
-  FileDescriptorPtr patched_fd = std::make_shared<EintrSafeFileDescriptor>();
-  patched_fd->Open(patched.path().c_str(), O_RDWR);
-  std::unique_ptr<ExtentWriter> writer(new DirectExtentWriter(patched_fd));
-  writer->Init(op.dst_extents(), BLOCK_SIZE);
-  ASSERT_TRUE(executor_.ExecuteDiffOperation(
-      op, std::move(writer), source_fd_, patch_data.data(), patch_data.size()));
-
-  // Compare the result
-  std::vector<uint8_t> patched_data;
-  ASSERT_TRUE(utils::ReadFile(patched.path(), &patched_data));
-  ASSERT_EQ(NUM_BLOCKS * BLOCK_SIZE, patched_data.size());
-  ASSERT_EQ(target_data_, patched_data);
+  // Call the executor, the second time with the source kept from the first
+  // one and with the elements applied concurrently.
+  executor_.set_worker_pool(&pool_);
+  for (size_t threads : {1, 4}) {
+    executor_.set_zucchini_threads(threads);
+    ScopedTempFile patched{"patched.XXXXXXXX", true};
+    FileDescriptorPtr patched_fd = std::make_shared<EintrSafeFileDescriptor>();
+    patched_fd->Open(patched.path().c_str(), O_RDWR);
+    std::unique_ptr<ExtentWriter> writer(new DirectExtentWriter(patched_fd));
+    writer->Init(op.dst_extents(), BLOCK_SIZE);
+    ASSERT_TRUE(executor_.ExecuteDiffOperation(op,
+                                               std::move(writer),
+                                               source_fd_,
+                                               patch_data.data(),
+                                               patch_data.size()));
+
+    // Compare the result
+    std::vector<uint8_t> patched_data;
+    ASSERT_TRUE(utils::ReadFile(patched.path(), &patched_data));
+    ASSERT_EQ(NUM_BLOCKS * BLOCK_SIZE, patched_data.size());
+    ASSERT_EQ(target_data_, patched_data);
+  }
+}
+
+TEST_F(InstallOperationExecutorTest, SourceBsdiffOpTest) {
+  InstallOperation op;
+  op.set_type(InstallOperation::SOURCE_BSDIFF);
+  *op.mutable_src_extents()->Add() = ExtentForRange(5, 5);
+  *op.mutable_src_extents()->Add() = ExtentForRange(0, 5);
+  *op.mutable_dst_extents()->Add() = ExtentForRange(0, NUM_BLOCKS);
+
+  // Make a bsdiff patch
+  brillo::Blob src_data;
+  ASSERT_TRUE(utils::ReadExtents(
+      source_.path(), op.src_extents(), &src_data, BLOCK_SIZE));
+  std::vector<Extent> src_extents{ExtentForRange(0, NUM_BLOCKS)};
+  std::vector<Extent> dst_extents{ExtentForRange(0, NUM_BLOCKS)};
+  PayloadGenerationConfig config{
+      .version = PayloadVersion(kBrilloMajorPayloadVersion,
+                                kSourceMinorPayloadVersion)};
+  const FilesystemInterface::File empty;
+  diff_utils::BestDiffGenerator best_diff_generator(src_data,
+                                                    target_data_,
+                                                    src_extents,
+                                                    dst_extents,
+                                                    empty,
+                                                    empty,
+                                                    config);
+  std::vector<uint8_t> patch_data = target_data_;  // Fake the full operation
+  AnnotatedOperation aop;
+  ASSERT_TRUE(best_diff_generator.GenerateBestDiffOperation(
+      {{InstallOperation::SOURCE_BSDIFF, 1024 * BLOCK_SIZE}},
+      &aop,
+      &patch_data));
+  ASSERT_EQ(InstallOperation::SOURCE_BSDIFF, aop.op.type());
+
+  // Apply it reading and writing directly, then with a limit of two blocks,
+  // so that reads and writes span several windows and chunks.
+  for (uint64_t limit : {uint64_t{0}, uint64_t{2 * BLOCK_SIZE}}) {
+    executor_.set_bsdiff_memory_limit(limit);
+    ScopedTempFile patched{"patched.XXXXXXXX", true};
+    FileDescriptorPtr patched_fd = std::make_shared<EintrSafeFileDescriptor>();
+    patched_fd->Open(patched.path().c_str(), O_RDWR);
+    std::unique_ptr<ExtentWriter> writer(new DirectExtentWriter(patched_fd));
+    ASSERT_TRUE(executor_.ExecuteDiffOperation(op,
+                                               std::move(writer),
+                                               source_fd_,
+                                               patch_data.data(),
+                                               patch_data.size()));
+
+    std::vector<uint8_t> patched_data;
+    ASSERT_TRUE(utils::ReadFile(patched.path(), &patched_data));
+    ASSERT_EQ(target_data_, patched_data) << "limit " << limit;
+  }
 }
 
 TEST_F(InstallOperationExecutorTest, GetNthBlockTest) {
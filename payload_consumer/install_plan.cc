@@ -17,6 +17,9 @@
 #include "update_engine/payload_consumer/install_plan.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <utility>
 
 #include <base/format_macros.h>
@@ -103,6 +106,59 @@ string InstallPlan::ToString() const {
           {"rollback_data_save_requested",
            utils::ToString(rollback_data_save_requested)},
           {"write_verity", utils::ToString(write_verity)},
+          {"apply_threads", base::NumberToString(apply_threads)},
+          {"use_io_uring", utils::ToString(use_io_uring)},
+          {"source_prefetch_ops", base::NumberToString(source_prefetch_ops)},
+          {"source_read_threads", base::NumberToString(source_read_threads)},
+          {"bsdiff_memory_limit", base::NumberToString(bsdiff_memory_limit)},
+          {"memory_budget", base::NumberToString(memory_budget)},
+          {"bzip_threads", base::NumberToString(bzip_threads)},
+          {"lz4diff_threads", base::NumberToString(lz4diff_threads)},
+          {"xz_threads", base::NumberToString(xz_threads)},
+          {"zstd_threads", base::NumberToString(zstd_threads)},
+          {"zucchini_threads", base::NumberToString(zucchini_threads)},
+          {"checkpoint_record", utils::ToString(checkpoint_record)},
+          {"write_behind_buffers", base::NumberToString(write_behind_buffers)},
+          {"write_cache_size", base::NumberToString(write_cache_size)},
+          {"concurrent_partitions",
+           base::NumberToString(concurrent_partitions)},
+          {"async_payload_hash", utils::ToString(async_payload_hash)},
+          {"verify_read_ahead_buffers",
+           base::NumberToString(verify_read_ahead_buffers)},
+          {"verify_direct_io", utils::ToString(verify_direct_io)},
+          {"verify_cow_readers", base::NumberToString(verify_cow_readers)},
+          {"drop_page_cache", utils::ToString(drop_page_cache)},
+          {"verify_concurrent_partitions",
+           base::NumberToString(verify_concurrent_partitions)},
+          {"verify_io_priority",
+           verify_io_priority ? base::NumberToString(*verify_io_priority)
+                              : "default"},
+          {"verity_hash_tree_threads",
+           base::NumberToString(verity_hash_tree_threads)},
+          {"verity_fec_threads", base::NumberToString(verity_fec_threads)},
+          {"trusted_write_path_hash",
+           utils::ToString(trusted_write_path_hash)},
+          {"touched_blocks_verification",
+           utils::ToString(touched_blocks_verification)},
+          {"early_source_verification",
+           utils::ToString(early_source_verification)},
+          {"source_cache_size", base::NumberToString(source_cache_size)},
+          {"puffdiff_cache_size", base::NumberToString(puffdiff_cache_size)},
+          {"source_readahead_size",
+           base::NumberToString(source_readahead_size)},
+          {"postinstall_concurrency",
+           base::NumberToString(postinstall_concurrency)},
+          {"download_staging_size",
+           base::NumberToString(download_staging_size)},
+          {"operation_data_checkpoint_size",
+           base::NumberToString(operation_data_checkpoint_size)},
+          {"skip_satisfied_operations",
+           utils::ToString(skip_satisfied_operations)},
+          {"reorder_operations", utils::ToString(reorder_operations)},
+          {"serial_postinstall_partitions",
+           base::JoinString(serial_postinstall_partitions, ",")},
+          {"early_postinstall", utils::ToString(early_postinstall)},
+          {"download_then_apply", utils::ToString(download_then_apply)},
       },
       "\n"));
 
@@ -149,28 +205,83 @@ string InstallPlan::ToString() const {
   return base::JoinString(result_str, "\n");
 }
 
+size_t InstallPlan::OperationPoolThreads() const {
+  return std::max<size_t>({1,
+                           source_read_threads,
+                           bzip_threads,
+                           lz4diff_threads,
+                           xz_threads,
+                           zstd_threads,
+                           zucchini_threads});
+}
+
+namespace {
+
+bool LoadPartitionFromSlots(BootControlInterface* boot_control,
+                            BootControlInterface::Slot source_slot,
+                            BootControlInterface::Slot target_slot,
+                            InstallPlan::Partition* partition) {
+  if (source_slot != BootControlInterface::kInvalidSlot &&
+      partition->source_size > 0) {
+    TEST_AND_RETURN_FALSE(boot_control->GetPartitionDevice(
+        partition->name, source_slot, &partition->source_path));
+  } else {
+    partition->source_path.clear();
+  }
+
+  if (target_slot != BootControlInterface::kInvalidSlot &&
+      partition->target_size > 0) {
+    auto device = boot_control->GetPartitionDevice(
+        partition->name, target_slot, source_slot);
+    TEST_AND_RETURN_FALSE(device.has_value());
+    partition->target_path = device->rw_device_path;
+    partition->readonly_target_path = device->readonly_device_path;
+  } else {
+    partition->target_path.clear();
+  }
+  return true;
+}
+
+}  // namespace
+
 bool InstallPlan::LoadPartitionsFromSlots(BootControlInterface* boot_control) {
+  const auto start = std::chrono::steady_clock::now();
+  const size_t num_threads =
+      std::min<size_t>(concurrent_partitions, partitions.size());
   bool result = true;
-  for (Partition& partition : partitions) {
-    if (source_slot != BootControlInterface::kInvalidSlot &&
-        partition.source_size > 0) {
-      TEST_AND_RETURN_FALSE(boot_control->GetPartitionDevice(
-          partition.name, source_slot, &partition.source_path));
-    } else {
-      partition.source_path.clear();
+  if (num_threads < 2) {
+    for (Partition& partition : partitions) {
+      TEST_AND_RETURN_FALSE(LoadPartitionFromSlots(
+          boot_control, source_slot, target_slot, &partition));
     }
-
-    if (target_slot != BootControlInterface::kInvalidSlot &&
-        partition.target_size > 0) {
-      auto device = boot_control->GetPartitionDevice(
-          partition.name, target_slot, source_slot);
-      TEST_AND_RETURN_FALSE(device.has_value());
-      partition.target_path = device->rw_device_path;
-      partition.readonly_target_path = device->readonly_device_path;
-    } else {
-      partition.target_path.clear();
+  } else {
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; i++) {
+      threads.emplace_back([&] {
+        for (size_t index = next++; index < partitions.size() && !failed;
+             index = next++) {
+          if (!LoadPartitionFromSlots(
+                  boot_control, source_slot, target_slot, &partitions[index])) {
+            failed = true;
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
     }
+    result = !failed;
   }
+  LOG(INFO) << "Loaded the devices of " << partitions.size()
+            << " partitions with " << std::max<size_t>(num_threads, 1)
+            << " threads, took "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << " ms";
   return result;
 }
 
@@ -188,7 +299,9 @@ bool InstallPlan::Partition::operator==(
 
 bool InstallPlan::Partition::ParseVerityConfig(
     const PartitionUpdate& partition) {
-  if (partition.has_hash_tree_extent()) {
+  // The hash tree and FEC data written by the operations are verified with
+  // the rest of the partition, as if the partition had none.
+  if (partition.has_hash_tree_extent() && !partition.hash_tree_in_payload()) {
     Extent extent = partition.hash_tree_data_extent();
     hash_tree_data_offset = extent.start_block() * block_size;
     hash_tree_data_size = extent.num_blocks() * block_size;
@@ -206,7 +319,7 @@ bool InstallPlan::Partition::ParseVerityConfig(
     hash_tree_salt.assign(partition.hash_tree_salt().begin(),
                           partition.hash_tree_salt().end());
   }
-  if (partition.has_fec_extent()) {
+  if (partition.has_fec_extent() && !partition.fec_in_payload()) {
     Extent extent = partition.fec_data_extent();
     fec_data_offset = extent.start_block() * block_size;
     fec_data_size = extent.num_blocks() * block_size;
@@ -17,7 +17,9 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_INSTALL_PLAN_H_
 #define UPDATE_ENGINE_PAYLOAD_CONSUMER_INSTALL_PLAN_H_
 
+#include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <base/macros.h>
@@ -25,6 +27,8 @@
 
 #include "update_engine/common/action.h"
 #include "update_engine/common/boot_control_interface.h"
+#include "update_engine/payload_consumer/apply_stats.h"
+#include "update_engine/payload_generator/block_bitmap.h"
 
 // InstallPlan is a simple struct that contains relevant info for many
 // parts of the update system about the install that should happen.
@@ -47,10 +51,16 @@ struct InstallPlan {
   void Dump() const;
   std::string ToString() const;
 
+  // Number of threads of the WorkerPool a partition writer shares between the
+  // steps of the operations it applies: the most any of them is given.
+  size_t OperationPoolThreads() const;
+
  private:
   // Loads the |source_path| and |target_path| of all |partitions| based on the
   // |source_slot| and |target_slot| if available. Returns whether it succeeded
-  // to load all the partitions for the valid slots.
+  // to load all the partitions for the valid slots. Up to
+  // |concurrent_partitions| partitions are loaded at the same time, as mapping
+  // a partition waits for its device node to appear.
   bool LoadPartitionsFromSlots(BootControlInterface* boot_control);
   template <typename PartitinoUpdateArray>
   static bool ParseManifestToInstallPlan(const PartitinoUpdateArray& partitions,
@@ -74,6 +84,9 @@ struct InstallPlan {
 
   bool is_resume{false};
   bool vabc_none{false};
+  // Whether to replace the payload's COW compression with the one best
+  // fitting the speed and free space of this device.
+  bool vabc_auto_compression{false};
   bool disable_vabc{false};
   std::string download_url;  // url to download from
   std::string version;       // version we are installing.
@@ -134,6 +147,25 @@ struct InstallPlan {
     std::string readonly_target_path;
     uint64_t target_size{0};
     brillo::Blob target_hash;
+    // The hash of the target partition computed while writing it, if every
+    // byte was written in order, see write_path_hasher.h.
+    brillo::Blob write_path_hash;
+    // With |touched_blocks_verification|, whether reading back |touched_ranges|
+    // verifies the target partition, see touched_blocks_verification.h.
+    struct TouchedRange {
+      std::vector<Extent> extents;
+      brillo::Blob hash;
+    };
+    bool verify_touched_blocks{false};
+    std::vector<TouchedRange> touched_ranges;
+    // The blocks of the target partition written by its operations, if they
+    // were recorded while applying all of them.
+    std::optional<BlockBitmap> written_blocks;
+    // The time and I/O spent by DeltaPerformer applying the operations of
+    // the partition in this attempt.
+    ApplyStats apply_stats;
+    // The download and verify throughput of the partition in this attempt.
+    PartitionThroughputStats throughput_stats;
 
     uint32_t block_size{0};
 
@@ -205,6 +237,185 @@ struct InstallPlan {
 
   // Whether to enable multi-threaded compression on COW writes
   std::optional<bool> enable_threading;
+
+  // Number of worker threads used to apply the operations of a partition. Only
+  // honored by partition writers which support concurrent instances; 0 or 1
+  // applies operations serially.
+  uint32_t apply_threads{0};
+
+  // Whether partitions are read and written through io_uring, both while
+  // applying the payload and while verifying the partitions afterwards.
+  bool use_io_uring{false};
+
+  // Number of operations ahead of the current one whose source extents are
+  // read ahead into the page cache during a delta update. 0 disables it.
+  uint32_t source_prefetch_ops{0};
+
+  // Number of threads reading the source of an operation into memory for
+  // verification, from where the operation consumes it. 0 verifies the source
+  // and lets the operation read it again.
+  uint32_t source_read_threads{0};
+
+  // Maximum number of bytes buffered for the source and target of a bsdiff
+  // operation. 0 reads and writes them through directly.
+  uint64_t bsdiff_memory_limit{0};
+
+  // Bytes of payload blobs and operation buffers held at once while applying
+  // the payload, see memory_budget.h. 0 doesn't limit them.
+  uint64_t memory_budget{0};
+
+  // Number of threads decoding the blocks of REPLACE_BZ operations made of
+  // several bzip2 blocks. 0 or 1 decodes them on the applying thread.
+  uint32_t bzip_threads{0};
+
+  // Number of threads recompressing the output blocks of lz4diff operations.
+  // 0 or 1 recompresses them on the applying thread.
+  uint32_t lz4diff_threads{0};
+
+  // Number of threads decoding the blocks of REPLACE_XZ operations made of
+  // several xz blocks. 0 or 1 decodes them on the applying thread.
+  uint32_t xz_threads{0};
+
+  // Number of threads decoding the frames of REPLACE_ZSTD operations made of
+  // several zstd frames. 0 or 1 decodes them on the applying thread.
+  uint32_t zstd_threads{0};
+
+  // Number of threads applying the elements of ZUCCHINI operations made of
+  // several elements. 0 or 1 applies them on the applying thread.
+  uint32_t zucchini_threads{0};
+
+  // Whether the update progress is checkpointed as a single record, see
+  // update_checkpoint.h.
+  bool checkpoint_record{false};
+
+  // Number of write caches of the target partitions. Above 1, full caches are
+  // written by a background thread while the next one fills up.
+  uint32_t write_behind_buffers{0};
+
+  // Size in bytes of the write caches of the target partitions, where the
+  // writes are gathered into ranges of the partition. 0 uses 1 MiB.
+  uint64_t write_cache_size{0};
+
+  // Number of partitions applied at the same time. Above 1, every partition
+  // is applied by its own thread while the next ones are streamed, and as
+  // many partition devices are looked up and mapped at the same time.
+  uint32_t concurrent_partitions{0};
+
+  // Whether the payload hashes are computed on a dedicated thread, see
+  // payload_hasher.h.
+  bool async_payload_hash{false};
+
+  // Number of buffers read ahead of the hashing by a dedicated thread while
+  // verifying the partitions, in reads sized for the device. 0 reads and
+  // hashes each buffer in turn.
+  uint32_t verify_read_ahead_buffers{0};
+
+  // Whether the partitions are read with O_DIRECT while verifying them when
+  // no verity data is written, so that they don't fill the page cache.
+  bool verify_direct_io{false};
+
+  // Number of readers of the COW hashing each VABC partition directly instead
+  // of through snapuserd, all reading ahead of the hashing when
+  // |verify_read_ahead_buffers| is set. 0 reads through snapuserd, as do
+  // the partitions verified concurrently.
+  uint32_t verify_cow_readers{0};
+
+  // Whether the pages of the partitions read and written while applying and
+  // verifying the payload are dropped from the page cache, see
+  // page_cache_dropping_file_descriptor.h.
+  bool drop_page_cache{false};
+
+  // Number of partitions verified at the same time, see
+  // concurrent_partition_hasher.h. Only honored when no verity data is
+  // written; 0 or 1 verifies one partition at a time.
+  uint32_t verify_concurrent_partitions{0};
+
+  // If set, the best-effort I/O priority level of the threads verifying
+  // partitions concurrently, from 0 (highest) to 7.
+  std::optional<uint32_t> verify_io_priority;
+
+  // Number of threads building the verity hash trees, see
+  // parallel_hash_tree_builder.h. 0 or 1 builds them on the verifying thread.
+  uint32_t verity_hash_tree_threads{0};
+
+  // Number of threads encoding the verity FEC data, see
+  // IncrementalEncodeFEC::Init(). 0 encodes it with libfec.
+  uint32_t verity_fec_threads{0};
+
+  // Whether FilesystemVerifierAction trusts the |write_path_hash| of the
+  // partitions which have one instead of reading them back.
+  bool trusted_write_path_hash{false};
+
+  // Whether FilesystemVerifierAction only reads back the blocks written by
+  // the operations other than copies of the partitions which allow it.
+  bool touched_blocks_verification{false};
+
+  // Whether the source partitions of a delta payload are verified on a
+  // background thread while the payload downloads, failing the update as soon
+  // as a source doesn't match, see source_verifier.h.
+  bool early_source_verification{false};
+
+  // Size in bytes of the cache of the source blocks read by several operations
+  // of a partition, see source_cache_file_descriptor.h. 0 disables it.
+  uint64_t source_cache_size{0};
+
+  // Size in bytes of the cache of the inflated source deflate streams of a
+  // PUFFDIFF operation, within the |memory_budget|. 0 uses 5 MiB.
+  uint64_t puffdiff_cache_size{0};
+
+  // Size in bytes of the source read ahead of the bsdiff and puffdiff patches,
+  // within the |memory_budget|. 0 disables the read-ahead.
+  uint64_t source_readahead_size{0};
+
+  // Number of bytes the source caches served instead of the source
+  // partitions, reported with the update metrics.
+  uint64_t source_cache_saved_bytes{0};
+
+  // Highest number of bytes accounted for by the MemoryBudget while applying
+  // the payloads, reported with the update metrics.
+  uint64_t memory_peak_bytes{0};
+
+  // Number of bytes of the source and target partitions in the page cache once
+  // the payloads are applied, reported with the update metrics.
+  uint64_t page_cache_bytes{0};
+
+  // Resident set size of the daemon in KiB once each phase of the update
+  // completed and released its memory, reported with the attempt metrics.
+  std::vector<std::pair<std::string, int64_t>> resident_set_kib_by_phase;
+
+  // Number of postinstall programs run at the same time, see
+  // PostinstallRunnerAction. 0 or 1 runs them one after another.
+  uint32_t postinstall_concurrency{0};
+
+  // Size in bytes of the ring file the downloaded bytes are staged in before
+  // being applied, see DownloadAction. 0 applies them as they are downloaded.
+  uint64_t download_staging_size{0};
+
+  // Minimum size in bytes of the data of the operations whose data downloaded
+  // so far is saved, see OperationDataCheckpoint. 0 disables it.
+  uint64_t operation_data_checkpoint_size{0};
+
+  // Whether to skip the operations whose target data is already correct, as
+  // checked against their |dst_sha256_hash| before the first operation of a
+  // new attempt. See DeltaPerformer::TakeSparseDownloadRanges().
+  bool skip_satisfied_operations{false};
+
+  // Whether to apply the operations of the partitions in the order of
+  // ScheduleOperations(), see operation_schedule.h.
+  bool reorder_operations{false};
+
+  // The name of the partitions whose postinstall program runs alone, after
+  // the programs of the previous partitions completed and before the ones of
+  // the next partitions start.
+  std::vector<std::string> serial_postinstall_partitions;
+
+  // Whether the postinstall of the partitions starts as they are verified,
+  // see PostinstallRunnerAction::StartVerifiedPartitions().
+  bool early_postinstall{false};
+
+  // Whether the payload is downloaded to a local file before it is applied,
+  // see LocalPayloadDownloadAction.
+  bool download_then_apply{false};
 };
 
 class InstallPlanAction;
@@ -0,0 +1,216 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/io_uring_file_descriptor.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+
+namespace chromeos_update_engine {
+
+IoUringFileDescriptor::~IoUringFileDescriptor() {
+  if (IsOpen()) {
+    Close();
+  }
+}
+
+bool IoUringFileDescriptor::Open(const char* path, int flags, mode_t mode) {
+  if (!fd_.Open(path, flags, mode)) {
+    return false;
+  }
+  offset_ = 0;
+  InitRing();
+  return true;
+}
+
+bool IoUringFileDescriptor::Open(const char* path, int flags) {
+  if (!fd_.Open(path, flags)) {
+    return false;
+  }
+  offset_ = 0;
+  InitRing();
+  return true;
+}
+
+void IoUringFileDescriptor::InitRing() {
+  if (ring_) {
+    return;
+  }
+  ring_ = io_uring_cpp::IoUringInterface::CreateLinuxIoUring(kQueueDepth, 0);
+  if (!ring_) {
+    PLOG(WARNING) << "Failed to create io_uring, falling back to pread/pwrite";
+  }
+}
+
+ssize_t IoUringFileDescriptor::Read(void* buf, size_t count) {
+  const ssize_t ret = SubmitIo(false, buf, count, offset_);
+  if (ret > 0) {
+    offset_ += ret;
+  }
+  return ret;
+}
+
+ssize_t IoUringFileDescriptor::Write(const void* buf, size_t count) {
+  // Attempt repeated writes, as long as some progress is being made.
+  char* char_buf = const_cast<char*>(static_cast<const char*>(buf));
+  ssize_t written = 0;
+  while (count > 0) {
+    const ssize_t ret = SubmitIo(true, char_buf, count, offset_);
+
+    // Fail on either an error or no progress.
+    if (ret <= 0)
+      return (written ? written : ret);
+    offset_ += ret;
+    written += ret;
+    count -= ret;
+    char_buf += ret;
+  }
+  return written;
+}
+
+off64_t IoUringFileDescriptor::Seek(off64_t offset, int whence) {
+  CHECK(IsOpen());
+  off64_t base = 0;
+  switch (whence) {
+    case SEEK_SET:
+      break;
+    case SEEK_CUR:
+      base = offset_;
+      break;
+    case SEEK_END:
+      base = fd_.Seek(0, SEEK_END);
+      if (base < 0) {
+        return -1;
+      }
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+  if (base + offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  offset_ = base + offset;
+  return offset_;
+}
+
+bool IoUringFileDescriptor::Close() {
+  offset_ = 0;
+  return fd_.Close();
+}
+
+ssize_t IoUringFileDescriptor::SubmitIo(bool write,
+                                        void* buf,
+                                        size_t count,
+                                        off64_t offset) {
+  CHECK(IsOpen());
+  const int fd = fd_.Fd();
+  if (!ring_) {
+    return write ? HANDLE_EINTR(pwrite64(fd, buf, count, offset))
+                 : HANDLE_EINTR(pread64(fd, buf, count, offset));
+  }
+  if (count == 0) {
+    return 0;
+  }
+
+  char* c_buf = static_cast<char*>(buf);
+  const size_t num_chunks =
+      std::min<size_t>((count + kChunkSize - 1) / kChunkSize, kQueueDepth);
+  for (size_t i = 0; i < num_chunks; i++) {
+    const size_t chunk_offset = i * kChunkSize;
+    const size_t chunk_size = std::min(kChunkSize, count - chunk_offset);
+    auto sqe = write ? ring_->PrepWrite(fd,
+                                        c_buf + chunk_offset,
+                                        chunk_size,
+                                        offset + chunk_offset)
+                     : ring_->PrepRead(fd,
+                                       c_buf + chunk_offset,
+                                       chunk_size,
+                                       offset + chunk_offset);
+    // The ring is as deep as the maximum number of chunks, and every previous
+    // batch was fully reaped, so there is always room.
+    CHECK(sqe.IsOk());
+    sqe.SetData(i);
+  }
+
+  const auto submit = ring_->SubmitAndWait(num_chunks);
+  if (static_cast<size_t>(submit.EntriesSubmitted()) != num_chunks) {
+    // Entries left in the submission queue would be submitted along with the
+    // next request, so give up on io_uring for this file descriptor.
+    LOG(ERROR) << "Submitted " << submit.EntriesSubmitted() << " of "
+               << num_chunks << " io_uring requests: " << submit.ErrMsg()
+               << ", falling back to pread/pwrite";
+    if (submit.EntriesSubmitted() > 0) {
+      (void)ring_->PopCQE(submit.EntriesSubmitted());
+    }
+    ring_.reset();
+    errno = EIO;
+    return -1;
+  }
+
+  std::array<ssize_t, kQueueDepth> results{};
+  for (size_t reaped = 0; reaped < num_chunks;) {
+    auto cqe = ring_->PopCQE();
+    if (cqe.IsErr()) {
+      if (cqe.GetError().ErrCode() == EINTR) {
+        continue;
+      }
+      // Completions still owed by the kernel would be mistaken for those of
+      // the next request, so give up on io_uring here as well.
+      errno = cqe.GetError().ErrCode();
+      PLOG(ERROR) << "Failed to wait for io_uring completion, falling back to "
+                  << "pread/pwrite";
+      ring_.reset();
+      return -1;
+    }
+    results[cqe.GetResult().GetData<size_t>()] = cqe.GetResult().res;
+    reaped++;
+  }
+
+  // Only the bytes transferred contiguously from |offset| count, anything
+  // after a short or failed chunk is retried by the caller.
+  ssize_t transferred = 0;
+  for (size_t i = 0; i < num_chunks; i++) {
+    if (results[i] < 0) {
+      if (transferred == 0) {
+        errno = -results[i];
+        return -1;
+      }
+      break;
+    }
+    transferred += results[i];
+    if (static_cast<size_t>(results[i]) <
+        std::min(kChunkSize, count - i * kChunkSize)) {
+      break;
+    }
+  }
+  return transferred;
+}
+
+std::unique_ptr<FileDescriptor> CreateFileDescriptor(bool use_io_uring) {
+  if (use_io_uring) {
+    return std::make_unique<IoUringFileDescriptor>();
+  }
+  return std::make_unique<EintrSafeFileDescriptor>();
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,94 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_IO_URING_FILE_DESCRIPTOR_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_IO_URING_FILE_DESCRIPTOR_H_
+
+#include <sys/types.h>
+
+#include <memory>
+
+#include <liburing_cpp/IoUring.h>
+
+#include "update_engine/payload_consumer/file_descriptor.h"
+
+namespace chromeos_update_engine {
+
+// A FileDescriptor which submits reads and writes through io_uring. Large
+// requests are split into chunks which are submitted to the kernel as a single
+// batch, so the storage sees a queue depth above one instead of one blocking
+// syscall per chunk. The file position is tracked in userspace, which also
+// makes Seek() free; for that reason the underlying fd isn't exposed by Fd().
+// If no io_uring can be created, e.g. on kernels without io_uring support,
+// falls back to pread()/pwrite().
+class IoUringFileDescriptor final : public FileDescriptor {
+ public:
+  // Size of the chunks a request is split into.
+  static constexpr size_t kChunkSize = 128 * 1024;
+  // Maximum number of chunks in flight at once.
+  static constexpr unsigned int kQueueDepth = 32;
+
+  IoUringFileDescriptor() = default;
+  ~IoUringFileDescriptor() override;
+
+  // Interface methods.
+  bool Open(const char* path, int flags, mode_t mode) override;
+  bool Open(const char* path, int flags) override;
+  ssize_t Read(void* buf, size_t count) override;
+  ssize_t Write(const void* buf, size_t count) override;
+  off64_t Seek(off64_t offset, int whence) override;
+  uint64_t BlockDevSize() override { return fd_.BlockDevSize(); }
+  bool BlkIoctl(int request,
+                uint64_t start,
+                uint64_t length,
+                int* result) override {
+    return fd_.BlkIoctl(request, start, length, result);
+  }
+  bool Flush() override { return fd_.Flush(); }
+  bool StartFlush() override { return fd_.StartFlush(); }
+  bool Close() override;
+  bool IsSettingErrno() override { return true; }
+  bool IsOpen() override { return fd_.IsOpen(); }
+
+  // Whether requests go through io_uring, as opposed to the pread()/pwrite()
+  // fallback.
+  bool UsesIoUring() const { return ring_ != nullptr; }
+
+ private:
+  // Creates |ring_| unless it already exists. Failing to do so isn't fatal.
+  void InitRing();
+
+  // Transfers up to |count| bytes between |buf| and |offset| in the file,
+  // submitting up to |kQueueDepth| chunks at once. Returns the number of bytes
+  // transferred contiguously from |offset|, or -1 with errno set if nothing
+  // was transferred.
+  ssize_t SubmitIo(bool write, void* buf, size_t count, off64_t offset);
+
+  EintrSafeFileDescriptor fd_;
+  std::unique_ptr<io_uring_cpp::IoUringInterface> ring_;
+  // The current file position.
+  off64_t offset_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(IoUringFileDescriptor);
+};
+
+// Returns a new, closed, IoUringFileDescriptor if |use_io_uring| is set, or an
+// EintrSafeFileDescriptor otherwise.
+std::unique_ptr<FileDescriptor> CreateFileDescriptor(bool use_io_uring);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_IO_URING_FILE_DESCRIPTOR_H_
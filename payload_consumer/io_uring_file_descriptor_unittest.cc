@@ -0,0 +1,82 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/io_uring_file_descriptor.h"
+
+#include <fcntl.h>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+// Spans more chunks than the queue depth, so requests need several batches.
+constexpr size_t kFileSize = (IoUringFileDescriptor::kQueueDepth + 3) *
+                                 IoUringFileDescriptor::kChunkSize +
+                             123;
+}  // namespace
+
+class IoUringFileDescriptorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    data_.resize(kFileSize);
+    test_utils::FillWithData(&data_);
+    ASSERT_TRUE(fd_.Open(temp_file_.path().c_str(), O_RDWR, 0600));
+  }
+
+  IoUringFileDescriptor fd_;
+  ScopedTempFile temp_file_{"IoUringFileDescriptor-file.XXXXXX"};
+  brillo::Blob data_;
+};
+
+TEST_F(IoUringFileDescriptorTest, WriteReadTest) {
+  ASSERT_TRUE(utils::WriteAll(&fd_, data_.data(), data_.size()));
+  ASSERT_EQ(static_cast<off64_t>(kFileSize), fd_.Seek(0, SEEK_CUR));
+
+  brillo::Blob output(kFileSize);
+  ssize_t bytes_read = 0;
+  ASSERT_TRUE(
+      utils::ReadAll(&fd_, output.data(), output.size(), 0, &bytes_read));
+  ASSERT_EQ(static_cast<ssize_t>(kFileSize), bytes_read);
+  ASSERT_EQ(data_, output);
+  ASSERT_TRUE(fd_.Close());
+
+  brillo::Blob file_data;
+  ASSERT_TRUE(utils::ReadFile(temp_file_.path(), &file_data));
+  ASSERT_EQ(data_, file_data);
+}
+
+TEST_F(IoUringFileDescriptorTest, ReadPastEndTest) {
+  ASSERT_TRUE(utils::WriteAll(&fd_, data_.data(), data_.size()));
+  ASSERT_EQ(static_cast<off64_t>(kFileSize - 10), fd_.Seek(-10, SEEK_END));
+
+  brillo::Blob output(100);
+  ASSERT_EQ(10, fd_.Read(output.data(), output.size()));
+  ASSERT_EQ(0, fd_.Read(output.data(), output.size()));
+}
+
+TEST_F(IoUringFileDescriptorTest, SeekTest) {
+  ASSERT_EQ(100, fd_.Seek(100, SEEK_SET));
+  ASSERT_EQ(150, fd_.Seek(50, SEEK_CUR));
+  ASSERT_EQ(-1, fd_.Seek(-200, SEEK_CUR));
+  ASSERT_EQ(150, fd_.Seek(0, SEEK_CUR));
+}
+
+}  // namespace chromeos_update_engine
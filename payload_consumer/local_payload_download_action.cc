@@ -0,0 +1,263 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/local_payload_download_action.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <utility>
+
+#include <base/bind.h>
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+#include <base/strings/string_number_conversions.h>
+
+#include "update_engine/common/constants.h"
+#include "update_engine/common/utils.h"
+
+using brillo::MessageLoop;
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+// Bytes stored between two checkpoints.
+constexpr uint64_t kCheckpointInterval = 16 * 1024 * 1024;
+// Interval between the polls of the apply gate.
+constexpr int kApplyGateIntervalSeconds = 10;
+}  // namespace
+
+LocalPayloadDownloadAction::LocalPayloadDownloadAction(
+    PrefsInterface* prefs, HttpFetcher* http_fetcher, const string& path)
+    : prefs_(prefs),
+      http_fetcher_(new MultiRangeHttpFetcher(http_fetcher)),
+      path_(path) {}
+
+LocalPayloadDownloadAction::~LocalPayloadDownloadAction() {
+  if (apply_gate_task_ != MessageLoop::kTaskIdNull)
+    MessageLoop::current()->CancelTask(apply_gate_task_);
+}
+
+void LocalPayloadDownloadAction::DeleteStoredPayload(PrefsInterface* prefs,
+                                                     const string& path) {
+  if (unlink(path.c_str()) != 0 && errno != ENOENT)
+    PLOG(WARNING) << "Failed to delete " << path;
+  prefs->Delete(kPrefsStoredPayloadOffset);
+  prefs->Delete(kPrefsStoredPayloadSHA256Context);
+  prefs->Delete(kPrefsStoredPayloadId);
+}
+
+void LocalPayloadDownloadAction::PerformAction() {
+  http_fetcher_->set_delegate(this);
+  CHECK(HasInputObject());
+  install_plan_ = GetInputObject();
+  CHECK_EQ(install_plan_.payloads.size(), 1UL);
+  const InstallPlan::Payload& payload = install_plan_.payloads[0];
+  if (payload.size == 0 || payload.hash.empty()) {
+    LOG(ERROR) << "The size and hash of the payload are needed to store it.";
+    Complete(ErrorCode::kDownloadStateInitializationError);
+    return;
+  }
+  if (!OpenStoredPayload(
+          base::HexEncode(payload.hash.data(), payload.hash.size()))) {
+    Complete(ErrorCode::kDownloadStateInitializationError);
+    return;
+  }
+  if (bytes_stored_ == payload.size) {
+    FinishDownload();
+    return;
+  }
+  LOG(INFO) << "Storing the payload at " << path_ << " from byte "
+            << bytes_stored_ << " of " << payload.size;
+  http_fetcher_->ClearRanges();
+  http_fetcher_->AddRange(base_offset_ + bytes_stored_,
+                          payload.size - bytes_stored_);
+  transfer_active_ = true;
+  http_fetcher_->BeginTransfer(install_plan_.download_url);
+}
+
+bool LocalPayloadDownloadAction::OpenStoredPayload(const string& payload_id) {
+  fd_.reset(
+      HANDLE_EINTR(open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600)));
+  if (!fd_.ok()) {
+    PLOG(ERROR) << "Failed to open " << path_;
+    return false;
+  }
+  string stored_id;
+  int64_t offset = 0;
+  string context;
+  struct stat stat_buf;
+  hash_calculator_ = std::make_unique<HashCalculator>();
+  if (prefs_->GetString(kPrefsStoredPayloadId, &stored_id) &&
+      stored_id == payload_id &&
+      prefs_->GetInt64(kPrefsStoredPayloadOffset, &offset) &&
+      prefs_->GetString(kPrefsStoredPayloadSHA256Context, &context) &&
+      fstat(fd_.get(), &stat_buf) == 0 && offset >= 0 &&
+      offset <= stat_buf.st_size &&
+      static_cast<uint64_t>(offset) <= install_plan_.payloads[0].size &&
+      hash_calculator_->SetContext(context)) {
+    bytes_stored_ = offset;
+  } else {
+    // The checkpoint is removed before the id changes, so that it never
+    // applies to another payload.
+    hash_calculator_ = std::make_unique<HashCalculator>();
+    bytes_stored_ = 0;
+    prefs_->Delete(kPrefsStoredPayloadOffset);
+    TEST_AND_RETURN_FALSE(
+        prefs_->SetString(kPrefsStoredPayloadSHA256Context,
+                          hash_calculator_->GetContext()));
+    TEST_AND_RETURN_FALSE(prefs_->SetString(kPrefsStoredPayloadId, payload_id));
+    TEST_AND_RETURN_FALSE(prefs_->SetInt64(kPrefsStoredPayloadOffset, 0));
+  }
+  // The bytes past the checkpoint may not have reached the storage.
+  TEST_AND_RETURN_FALSE_ERRNO(ftruncate(fd_.get(), bytes_stored_) == 0);
+  bytes_checkpointed_ = bytes_stored_;
+  return true;
+}
+
+void LocalPayloadDownloadAction::Checkpoint() {
+  if (!fd_.ok() || bytes_stored_ == bytes_checkpointed_)
+    return;
+  if (fdatasync(fd_.get()) != 0) {
+    PLOG(WARNING) << "Failed to sync " << path_;
+    return;
+  }
+  // Without the offset, a checkpoint interrupted half way is ignored.
+  prefs_->Delete(kPrefsStoredPayloadOffset);
+  if (!prefs_->SetString(kPrefsStoredPayloadSHA256Context,
+                         hash_calculator_->GetContext()) ||
+      !prefs_->SetInt64(kPrefsStoredPayloadOffset, bytes_stored_)) {
+    LOG(WARNING) << "Failed to checkpoint the payload stored at " << path_;
+    return;
+  }
+  bytes_checkpointed_ = bytes_stored_;
+}
+
+void LocalPayloadDownloadAction::SuspendAction() {
+  http_fetcher_->Pause();
+}
+
+void LocalPayloadDownloadAction::ResumeAction() {
+  http_fetcher_->Unpause();
+}
+
+void LocalPayloadDownloadAction::TerminateProcessing() {
+  if (apply_gate_task_ != MessageLoop::kTaskIdNull) {
+    MessageLoop::current()->CancelTask(apply_gate_task_);
+    apply_gate_task_ = MessageLoop::kTaskIdNull;
+  }
+  if (transfer_active_) {
+    Checkpoint();
+    http_fetcher_->TerminateTransfer();
+  }
+}
+
+void LocalPayloadDownloadAction::AbortTransfer(ErrorCode code) {
+  code_ = code;
+  // The action completes from TransferTerminated(), once the fetcher is done
+  // with it.
+  http_fetcher_->TerminateTransfer();
+}
+
+bool LocalPayloadDownloadAction::ReceivedBytes(HttpFetcher* fetcher,
+                                               const void* bytes,
+                                               size_t length) {
+  const uint64_t payload_size = install_plan_.payloads[0].size;
+  ErrorCode cancel_reason = ErrorCode::kSuccess;
+  if (delegate_ && delegate_->ShouldCancel(&cancel_reason)) {
+    AbortTransfer(cancel_reason);
+    return false;
+  }
+  if (bytes_stored_ + length > payload_size) {
+    LOG(ERROR) << "Received more than the " << payload_size
+               << " bytes of the payload.";
+    AbortTransfer(ErrorCode::kPayloadSizeMismatchError);
+    return false;
+  }
+  if (!utils::PWriteAll(fd_.get(), bytes, length, bytes_stored_) ||
+      !hash_calculator_->Update(bytes, length)) {
+    LOG(ERROR) << "Failed to store the payload at " << path_;
+    AbortTransfer(ErrorCode::kDownloadWriteError);
+    return false;
+  }
+  bytes_stored_ += length;
+  if (delegate_)
+    delegate_->BytesReceived(length, bytes_stored_, payload_size);
+  if (bytes_stored_ - bytes_checkpointed_ >= kCheckpointInterval)
+    Checkpoint();
+  return true;
+}
+
+void LocalPayloadDownloadAction::TransferComplete(HttpFetcher* fetcher,
+                                                  bool successful) {
+  transfer_active_ = false;
+  Checkpoint();
+  if (!successful || bytes_stored_ != install_plan_.payloads[0].size) {
+    LOG(ERROR) << "Failed to download the payload, stored " << bytes_stored_
+               << " of its " << install_plan_.payloads[0].size << " bytes.";
+    Complete(ErrorCode::kDownloadTransferError);
+    return;
+  }
+  FinishDownload();
+}
+
+void LocalPayloadDownloadAction::TransferTerminated(HttpFetcher* fetcher) {
+  transfer_active_ = false;
+  Checkpoint();
+  if (code_ != ErrorCode::kSuccess)
+    Complete(code_);
+}
+
+void LocalPayloadDownloadAction::FinishDownload() {
+  fd_.reset();
+  if (!hash_calculator_->Finalize() ||
+      hash_calculator_->raw_hash() != install_plan_.payloads[0].hash) {
+    LOG(ERROR) << "The payload stored at " << path_
+               << " doesn't match its hash, deleting it.";
+    DeleteStoredPayload(prefs_, path_);
+    Complete(ErrorCode::kPayloadHashMismatchError);
+    return;
+  }
+  LOG(INFO) << "The payload is stored at " << path_ << ".";
+  if (apply_gate_ && !apply_gate_.Run())
+    LOG(INFO) << "Waiting for the apply gate to open to apply it.";
+  WaitForApplyGate();
+}
+
+void LocalPayloadDownloadAction::WaitForApplyGate() {
+  apply_gate_task_ = MessageLoop::kTaskIdNull;
+  if (apply_gate_ && !apply_gate_.Run()) {
+    apply_gate_task_ = MessageLoop::current()->PostDelayedTask(
+        FROM_HERE,
+        base::BindOnce(&LocalPayloadDownloadAction::WaitForApplyGate,
+                       base::Unretained(this)),
+        base::TimeDelta::FromSeconds(kApplyGateIntervalSeconds));
+    return;
+  }
+  install_plan_.download_url = "file://" + path_;
+  Complete(ErrorCode::kSuccess);
+}
+
+void LocalPayloadDownloadAction::Complete(ErrorCode code) {
+  if (code == ErrorCode::kSuccess && HasOutputPipe())
+    SetOutputObject(install_plan_);
+  processor_->ActionComplete(this, code);
+}
+
+}  // namespace chromeos_update_engine
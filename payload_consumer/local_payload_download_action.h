@@ -0,0 +1,140 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_LOCAL_PAYLOAD_DOWNLOAD_ACTION_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_LOCAL_PAYLOAD_DOWNLOAD_ACTION_H_
+
+#include <memory>
+#include <string>
+
+#include <android-base/unique_fd.h>
+#include <base/callback.h>
+#include <brillo/message_loops/message_loop.h>
+
+#include "update_engine/common/download_action.h"
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/http_fetcher.h"
+#include "update_engine/common/multi_range_http_fetcher.h"
+#include "update_engine/common/prefs_interface.h"
+#include "update_engine/payload_consumer/install_plan.h"
+
+namespace chromeos_update_engine {
+
+// Downloads the payload of the install plan to a local file rather than
+// applying it as it arrives, then waits for the apply gate to open before
+// passing the install plan on, with the download URL pointing to the file.
+// The DownloadAction after it applies the payload at the speed of the local
+// storage, at a time the update may use the resources it takes.
+//
+// The download resumes across attempts: the bytes stored are checkpointed
+// once they are on the storage, with the hash context covering them, so that
+// the hash of the whole payload is checked against the one of the install
+// plan without reading it back. A file shorter than the checkpoint is
+// downloaded from scratch, and the bytes stored past it are dropped. The
+// DownloadAction checks the hash again as it reads the file.
+class LocalPayloadDownloadAction : public InstallPlanAction,
+                                   public HttpFetcherDelegate {
+ public:
+  static std::string StaticType() { return "LocalPayloadDownloadAction"; }
+
+  // Takes ownership of |http_fetcher|. The payload is stored at |path|.
+  LocalPayloadDownloadAction(PrefsInterface* prefs,
+                             HttpFetcher* http_fetcher,
+                             const std::string& path);
+  ~LocalPayloadDownloadAction() override;
+
+  // InstallPlanAction overrides.
+  void PerformAction() override;
+  void SuspendAction() override;
+  void ResumeAction() override;
+  void TerminateProcessing() override;
+  std::string Type() const override { return StaticType(); }
+
+  // HttpFetcherDelegate methods (see http_fetcher.h)
+  bool ReceivedBytes(HttpFetcher* fetcher,
+                     const void* bytes,
+                     size_t length) override;
+  void TransferComplete(HttpFetcher* fetcher, bool successful) override;
+  void TransferTerminated(HttpFetcher* fetcher) override;
+
+  // Reports the bytes stored with BytesReceived() and asks whether to cancel.
+  void set_delegate(DownloadActionDelegate* delegate) { delegate_ = delegate; }
+
+  void set_base_offset(int64_t base_offset) { base_offset_ = base_offset; }
+
+  // Takes ownership of |prefetch_fetcher|, see DownloadAction.
+  void set_prefetch_fetcher(HttpFetcher* prefetch_fetcher) {
+    http_fetcher_->set_prefetch_fetcher(prefetch_fetcher);
+  }
+
+  // Once the payload is stored, |apply_gate| is polled until it returns true
+  // before the install plan is passed on. Not set, it is passed on at once.
+  void set_apply_gate(base::RepeatingCallback<bool()> apply_gate) {
+    apply_gate_ = std::move(apply_gate);
+  }
+
+  // Deletes the payload stored at |path| and the progress of its download.
+  static void DeleteStoredPayload(PrefsInterface* prefs,
+                                  const std::string& path);
+
+ private:
+  // Opens the file at |path_| and resumes from the bytes checkpointed in it,
+  // if they are the ones of the payload with |payload_id|. Returns false on
+  // failure.
+  bool OpenStoredPayload(const std::string& payload_id);
+
+  // Saves the bytes stored and the hash context covering them, once they are
+  // on the storage.
+  void Checkpoint();
+
+  // Checks the hash of the complete payload, then waits for the apply gate.
+  void FinishDownload();
+
+  // Stops the transfer, to complete the action with |code| once terminated.
+  void AbortTransfer(ErrorCode code);
+
+  // Passes the install plan on once the apply gate opens.
+  void WaitForApplyGate();
+
+  void Complete(ErrorCode code);
+
+  PrefsInterface* prefs_;
+  std::unique_ptr<MultiRangeHttpFetcher> http_fetcher_;
+  const std::string path_;
+  DownloadActionDelegate* delegate_{nullptr};
+  int64_t base_offset_{0};
+  base::RepeatingCallback<bool()> apply_gate_;
+
+  android::base::unique_fd fd_;
+  // The hash of the bytes stored so far.
+  std::unique_ptr<HashCalculator> hash_calculator_;
+  uint64_t bytes_stored_{0};
+  uint64_t bytes_checkpointed_{0};
+
+  // The error to complete the action with once the transfer is terminated.
+  ErrorCode code_{ErrorCode::kSuccess};
+  bool transfer_active_{false};
+
+  brillo::MessageLoop::TaskId apply_gate_task_{
+      brillo::MessageLoop::kTaskIdNull};
+
+  DISALLOW_COPY_AND_ASSIGN(LocalPayloadDownloadAction);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_LOCAL_PAYLOAD_DOWNLOAD_ACTION_H_
@@ -0,0 +1,179 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/local_payload_download_action.h"
+
+#include <memory>
+#include <string>
+
+#include <base/strings/string_number_conversions.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <brillo/message_loops/message_loop_utils.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/action_pipe.h"
+#include "update_engine/common/constants.h"
+#include "update_engine/common/fake_prefs.h"
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/mock_action_processor.h"
+#include "update_engine/common/mock_http_fetcher.h"
+#include "update_engine/common/utils.h"
+
+using testing::_;
+
+namespace chromeos_update_engine {
+
+class LocalPayloadDownloadActionTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    loop_.SetAsCurrent();
+    payload_.resize(100000);
+    for (size_t i = 0; i < payload_.size(); i++) {
+      payload_[i] = i * 7 % 251;
+    }
+    brillo::Blob hash;
+    ASSERT_TRUE(HashCalculator::RawHashOfBytes(
+        payload_.data(), payload_.size(), &hash));
+    InstallPlan install_plan;
+    install_plan.download_url = "http://fake_url.invalid";
+    auto& payload = install_plan.payloads.emplace_back();
+    payload.size = payload_.size();
+    payload.hash = hash;
+    action_pipe_->set_contents(install_plan);
+  }
+
+  // Creates the action storing the payload, with a fetcher sending |data|.
+  std::unique_ptr<LocalPayloadDownloadAction> MakeAction(
+      const std::string& data) {
+    auto action = std::make_unique<LocalPayloadDownloadAction>(
+        &prefs_,
+        new MockHttpFetcher(data.data(), data.size()),
+        stored_file_.path());
+    action->set_in_pipe(action_pipe_);
+    action->SetProcessor(&processor_);
+    return action;
+  }
+
+  void RunLoop() {
+    while (loop_.PendingTasks() && loop_.RunOnce(true)) {
+    }
+  }
+
+  std::string PayloadId() const {
+    const brillo::Blob& hash = action_pipe_->contents().payloads[0].hash;
+    return base::HexEncode(hash.data(), hash.size());
+  }
+
+  std::string StoredPayload() const {
+    std::string stored;
+    EXPECT_TRUE(utils::ReadFile(stored_file_.path(), &stored));
+    return stored;
+  }
+
+  brillo::FakeMessageLoop loop_{nullptr};
+  FakePrefs prefs_;
+  MockActionProcessor processor_;
+  std::shared_ptr<ActionPipe<InstallPlan>> action_pipe_{
+      new ActionPipe<InstallPlan>()};
+  ScopedTempFile stored_file_{"stored_payload.XXXXXX"};
+  std::string payload_;
+};
+
+TEST_F(LocalPayloadDownloadActionTest, StoresPayload) {
+  auto action = MakeAction(payload_);
+  EXPECT_CALL(processor_, ActionComplete(action.get(), ErrorCode::kSuccess));
+  action->PerformAction();
+  RunLoop();
+  ASSERT_EQ(action->install_plan()->download_url,
+            "file://" + stored_file_.path());
+  ASSERT_EQ(StoredPayload(), payload_);
+  int64_t offset = 0;
+  ASSERT_TRUE(prefs_.GetInt64(kPrefsStoredPayloadOffset, &offset));
+  ASSERT_EQ(offset, static_cast<int64_t>(payload_.size()));
+}
+
+TEST_F(LocalPayloadDownloadActionTest, ResumesFromCheckpoint) {
+  const size_t half = payload_.size() / 2;
+  // The bytes past the checkpoint are dropped.
+  ASSERT_TRUE(utils::WriteFile(stored_file_.path().c_str(),
+                               (payload_.substr(0, half) + "garbage").data(),
+                               half + 7));
+  HashCalculator hash_calculator;
+  ASSERT_TRUE(hash_calculator.Update(payload_.data(), half));
+  ASSERT_TRUE(prefs_.SetString(kPrefsStoredPayloadId, PayloadId()));
+  ASSERT_TRUE(prefs_.SetInt64(kPrefsStoredPayloadOffset, half));
+  ASSERT_TRUE(prefs_.SetString(kPrefsStoredPayloadSHA256Context,
+                               hash_calculator.GetContext()));
+
+  // The first half is not downloaded again.
+  auto action = MakeAction(std::string(half, 'x') + payload_.substr(half));
+  EXPECT_CALL(processor_, ActionComplete(action.get(), ErrorCode::kSuccess));
+  action->PerformAction();
+  RunLoop();
+  ASSERT_EQ(StoredPayload(), payload_);
+}
+
+TEST_F(LocalPayloadDownloadActionTest, RestartsForAnotherPayload) {
+  ASSERT_TRUE(utils::WriteFile(stored_file_.path().c_str(), "garbage", 7));
+  ASSERT_TRUE(prefs_.SetString(kPrefsStoredPayloadId, "another"));
+  ASSERT_TRUE(prefs_.SetInt64(kPrefsStoredPayloadOffset, 7));
+  ASSERT_TRUE(prefs_.SetString(kPrefsStoredPayloadSHA256Context,
+                               HashCalculator().GetContext()));
+
+  auto action = MakeAction(payload_);
+  EXPECT_CALL(processor_, ActionComplete(action.get(), ErrorCode::kSuccess));
+  action->PerformAction();
+  RunLoop();
+  ASSERT_EQ(StoredPayload(), payload_);
+  std::string payload_id;
+  ASSERT_TRUE(prefs_.GetString(kPrefsStoredPayloadId, &payload_id));
+  ASSERT_EQ(payload_id, PayloadId());
+}
+
+TEST_F(LocalPayloadDownloadActionTest, DeletesPayloadOnHashMismatch) {
+  std::string corrupted = payload_;
+  corrupted[1234] ^= 1;
+  auto action = MakeAction(corrupted);
+  EXPECT_CALL(processor_,
+              ActionComplete(action.get(),
+                             ErrorCode::kPayloadHashMismatchError));
+  action->PerformAction();
+  RunLoop();
+  ASSERT_FALSE(utils::FileExists(stored_file_.path().c_str()));
+  ASSERT_FALSE(prefs_.Exists(kPrefsStoredPayloadId));
+  ASSERT_FALSE(prefs_.Exists(kPrefsStoredPayloadOffset));
+}
+
+TEST_F(LocalPayloadDownloadActionTest, WaitsForApplyGate) {
+  bool gate_open = false;
+  auto action = MakeAction(payload_);
+  action->set_apply_gate(
+      base::BindRepeating([](bool* gate_open) { return *gate_open; },
+                          &gate_open));
+  EXPECT_CALL(processor_, ActionComplete(_, _)).Times(0);
+  action->PerformAction();
+  brillo::MessageLoopRunMaxIterations(&loop_, 1000);
+  ASSERT_EQ(StoredPayload(), payload_);
+  testing::Mock::VerifyAndClearExpectations(&processor_);
+
+  gate_open = true;
+  EXPECT_CALL(processor_, ActionComplete(action.get(), ErrorCode::kSuccess));
+  RunLoop();
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,121 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/memory_budget.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <base/logging.h>
+
+namespace chromeos_update_engine {
+
+MemoryBudget::Reservation::Reservation(Reservation&& other) noexcept
+    : budget_(other.budget_), size_(other.size_) {
+  other.budget_ = nullptr;
+  other.size_ = 0;
+}
+
+MemoryBudget::Reservation& MemoryBudget::Reservation::operator=(
+    Reservation&& other) {
+  if (this != &other) {
+    Reset();
+    budget_ = std::exchange(other.budget_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+  return *this;
+}
+
+void MemoryBudget::Reservation::Resize(size_t size) {
+  if (!budget_) {
+    // Reservations not coming from a budget are always empty.
+    CHECK_EQ(size, 0u);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(budget_->mutex_);
+  if (size >= size_) {
+    budget_->AddLocked(size - size_);
+  } else {
+    CHECK_GE(budget_->used_, size_ - size);
+    budget_->used_ -= size_ - size;
+  }
+  size_ = size;
+}
+
+MemoryBudget* MemoryBudget::Get() {
+  static MemoryBudget* budget = new MemoryBudget();
+  return budget;
+}
+
+void MemoryBudget::SetLimit(size_t limit) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  limit_ = limit;
+}
+
+size_t MemoryBudget::limit() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return limit_;
+}
+
+bool MemoryBudget::Fits(size_t bytes) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return FitsLocked(bytes);
+}
+
+MemoryBudget::Reservation MemoryBudget::Acquire(size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  AddLocked(bytes);
+  return Reservation(this, bytes);
+}
+
+bool MemoryBudget::TryAcquire(size_t bytes, Reservation* reservation) {
+  reservation->Reset();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!FitsLocked(bytes)) {
+    return false;
+  }
+  AddLocked(bytes);
+  // |reservation| is empty, its assignment doesn't take |mutex_|.
+  *reservation = Reservation(this, bytes);
+  return true;
+}
+
+size_t MemoryBudget::used() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return used_;
+}
+
+size_t MemoryBudget::peak() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return peak_;
+}
+
+void MemoryBudget::ResetPeak() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  peak_ = used_;
+}
+
+bool MemoryBudget::FitsLocked(size_t bytes) const {
+  return limit_ == 0 || used_ == 0 || used_ + bytes <= limit_;
+}
+
+void MemoryBudget::AddLocked(size_t bytes) {
+  used_ += bytes;
+  peak_ = std::max(peak_, used_);
+}
+
+}  // namespace chromeos_update_engine
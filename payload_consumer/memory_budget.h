@@ -0,0 +1,107 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_MEMORY_BUDGET_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_MEMORY_BUDGET_H_
+
+#include <cstddef>
+#include <mutex>
+
+#include <base/macros.h>
+
+namespace chromeos_update_engine {
+
+// Accounts for the large buffers held while applying an update: the blobs of
+// the operations downloaded and not applied yet, and the scratch buffers of
+// InstallOperationExecutor. With a limit, the operation appliers wait for
+// room before queuing more blobs, and the executor falls back to its
+// streaming modes when its buffers don't fit. The peak usage is reported with
+// the update metrics.
+//
+// Buffers which are needed to make progress are always granted, and a single
+// buffer larger than the limit is still granted when nothing else is held, so
+// the limit is a target rather than a hard cap.
+class MemoryBudget {
+ public:
+  // A number of bytes accounted for until the Reservation is destroyed or
+  // resized.
+  class Reservation {
+   public:
+    Reservation() = default;
+    Reservation(Reservation&& other) noexcept;
+    Reservation& operator=(Reservation&& other);
+    ~Reservation() { Reset(); }
+
+    size_t size() const { return size_; }
+
+    // Accounts for |size| bytes instead of size(), even above the limit.
+    void Resize(size_t size);
+    void Reset() { Resize(0); }
+
+   private:
+    friend class MemoryBudget;
+    Reservation(MemoryBudget* budget, size_t size)
+        : budget_(budget), size_(size) {}
+
+    MemoryBudget* budget_{nullptr};
+    size_t size_{0};
+
+    DISALLOW_COPY_AND_ASSIGN(Reservation);
+  };
+
+  MemoryBudget() = default;
+
+  // The budget of the update being applied. This is process wide, as the
+  // buffers of all partitions and threads share the device memory.
+  static MemoryBudget* Get();
+
+  // Limits the accounted bytes to |limit|, 0 only accounts for them.
+  void SetLimit(size_t limit);
+  size_t limit() const;
+
+  // Whether |bytes| more can be held within the limit, or no bytes are held.
+  bool Fits(size_t bytes) const;
+
+  // Accounts for |bytes| unconditionally, for buffers the update can't do
+  // without.
+  Reservation Acquire(size_t bytes);
+
+  // Releases |reservation|, then accounts for |bytes| into it if
+  // Fits(|bytes|). Otherwise returns false and the caller is expected to do
+  // without the buffer.
+  bool TryAcquire(size_t bytes, Reservation* reservation);
+
+  size_t used() const;
+  // The highest used() since the last ResetPeak().
+  size_t peak() const;
+  void ResetPeak();
+
+ private:
+  bool FitsLocked(size_t bytes) const;
+  void AddLocked(size_t bytes);
+
+  mutable std::mutex mutex_;
+  size_t limit_{0};
+  size_t used_{0};
+  size_t peak_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(MemoryBudget);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_MEMORY_BUDGET_H_
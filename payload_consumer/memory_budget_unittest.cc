@@ -0,0 +1,102 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/memory_budget.h"
+
+#include <utility>
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+class MemoryBudgetTest : public ::testing::Test {
+ protected:
+  MemoryBudget budget_;
+};
+
+TEST_F(MemoryBudgetTest, AcquireAccountsUntilReleasedTest) {
+  {
+    MemoryBudget::Reservation first = budget_.Acquire(100);
+    MemoryBudget::Reservation second = budget_.Acquire(50);
+    EXPECT_EQ(150u, budget_.used());
+    second.Reset();
+    EXPECT_EQ(100u, budget_.used());
+  }
+  EXPECT_EQ(0u, budget_.used());
+  EXPECT_EQ(150u, budget_.peak());
+}
+
+TEST_F(MemoryBudgetTest, ResizeTest) {
+  MemoryBudget::Reservation reservation = budget_.Acquire(0);
+  reservation.Resize(300);
+  reservation.Resize(200);
+  EXPECT_EQ(200u, reservation.size());
+  EXPECT_EQ(200u, budget_.used());
+  EXPECT_EQ(300u, budget_.peak());
+  budget_.ResetPeak();
+  EXPECT_EQ(200u, budget_.peak());
+}
+
+TEST_F(MemoryBudgetTest, MoveTransfersTheReservationTest) {
+  MemoryBudget::Reservation moved;
+  {
+    MemoryBudget::Reservation reservation = budget_.Acquire(10);
+    moved = std::move(reservation);
+    EXPECT_EQ(0u, reservation.size());
+  }
+  EXPECT_EQ(10u, moved.size());
+  EXPECT_EQ(10u, budget_.used());
+  moved = budget_.Acquire(20);
+  EXPECT_EQ(20u, budget_.used());
+}
+
+TEST_F(MemoryBudgetTest, NoLimitAlwaysFitsTest) {
+  MemoryBudget::Reservation held = budget_.Acquire(1000);
+  MemoryBudget::Reservation reservation;
+  EXPECT_TRUE(budget_.Fits(1000));
+  EXPECT_TRUE(budget_.TryAcquire(1000, &reservation));
+  EXPECT_EQ(2000u, budget_.used());
+}
+
+TEST_F(MemoryBudgetTest, TryAcquireRespectsTheLimitTest) {
+  budget_.SetLimit(100);
+  MemoryBudget::Reservation held = budget_.Acquire(60);
+  MemoryBudget::Reservation reservation;
+  EXPECT_TRUE(budget_.TryAcquire(40, &reservation));
+  EXPECT_FALSE(budget_.Fits(1));
+  // The previous reservation is released first.
+  EXPECT_TRUE(budget_.TryAcquire(30, &reservation));
+  EXPECT_FALSE(budget_.TryAcquire(50, &reservation));
+  EXPECT_EQ(0u, reservation.size());
+  EXPECT_EQ(60u, budget_.used());
+}
+
+TEST_F(MemoryBudgetTest, AcquireExceedsTheLimitTest) {
+  budget_.SetLimit(100);
+  MemoryBudget::Reservation held = budget_.Acquire(150);
+  EXPECT_EQ(150u, budget_.used());
+  EXPECT_FALSE(budget_.Fits(0));
+}
+
+TEST_F(MemoryBudgetTest, LargeBufferFitsWhenNothingIsHeldTest) {
+  budget_.SetLimit(100);
+  MemoryBudget::Reservation reservation;
+  EXPECT_TRUE(budget_.TryAcquire(500, &reservation));
+  EXPECT_EQ(500u, budget_.peak());
+}
+
+}  // namespace chromeos_update_engine
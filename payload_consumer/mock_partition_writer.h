@@ -36,7 +36,7 @@ class MockPartitionWriter : public PartitionWriter {
   // |CheckpointUpdateProgress| will be called after SetNextOpIndex(), but it's
   // optional. DeltaPerformer may or may not call this everytime an operation is
   // applied.
-  MOCK_METHOD(void, CheckpointUpdateProgress, (size_t), (override));
+  MOCK_METHOD(bool, CheckpointUpdateProgress, (size_t), (override));
 
   // These perform a specific type of operation and return true on success.
   // |error| will be set if source hash mismatch, otherwise |error| might not be
@@ -57,6 +57,10 @@ class MockPartitionWriter : public PartitionWriter {
               PerformDiffOperation,
               (const InstallOperation&, ErrorCode*, const void*, size_t),
               (override));
+  MOCK_METHOD(bool,
+              PerformTargetCopyOperation,
+              (const InstallOperation&),
+              (override));
 };
 
 }  // namespace chromeos_update_engine
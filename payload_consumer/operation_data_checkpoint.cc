@@ -0,0 +1,129 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/operation_data_checkpoint.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <base/files/scoped_file.h>
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr size_t kHeaderSize = sizeof(uint64_t);
+
+// Reads the data offset in the header of the file |fd| of |file_size| bytes.
+bool ReadHeader(int fd, off_t file_size, uint64_t* data_offset) {
+  if (file_size < static_cast<off_t>(kHeaderSize))
+    return false;
+  uint8_t header[kHeaderSize];
+  ssize_t bytes_read = 0;
+  if (!utils::PReadAll(fd, header, kHeaderSize, 0, &bytes_read) ||
+      bytes_read != kHeaderSize) {
+    return false;
+  }
+  *data_offset = 0;
+  for (size_t i = 0; i < kHeaderSize; i++)
+    *data_offset |= static_cast<uint64_t>(header[i]) << (8 * i);
+  return true;
+}
+
+}  // namespace
+
+uint64_t OperationDataCheckpoint::SavedSize(uint64_t data_offset) const {
+  base::ScopedFD fd(
+      HANDLE_EINTR(open(path_.c_str(), O_RDONLY | O_CLOEXEC)));
+  struct stat st {};
+  uint64_t saved_offset = 0;
+  if (!fd.is_valid() || fstat(fd.get(), &st) != 0 ||
+      !ReadHeader(fd.get(), st.st_size, &saved_offset) ||
+      saved_offset != data_offset) {
+    return 0;
+  }
+  return st.st_size - kHeaderSize;
+}
+
+bool OperationDataCheckpoint::Load(uint64_t data_offset, brillo::Blob* data) {
+  data->clear();
+  const uint64_t size = SavedSize(data_offset);
+  if (size > 0) {
+    base::ScopedFD fd(
+        HANDLE_EINTR(open(path_.c_str(), O_RDONLY | O_CLOEXEC)));
+    TEST_AND_RETURN_FALSE_ERRNO(fd.is_valid());
+    data->resize(size);
+    ssize_t bytes_read = 0;
+    TEST_AND_RETURN_FALSE(
+        utils::PReadAll(
+            fd.get(), data->data(), size, kHeaderSize, &bytes_read) &&
+        static_cast<uint64_t>(bytes_read) == size);
+    LOG(INFO) << "Loaded " << size << " bytes of the data at offset "
+              << data_offset << " downloaded before the interruption.";
+  }
+  data_offset_ = data_offset;
+  size_ = size;
+  return true;
+}
+
+bool OperationDataCheckpoint::Save(uint64_t data_offset,
+                                   const brillo::Blob& data) {
+  const bool restart = data_offset_ != static_cast<int64_t>(data_offset);
+  base::ScopedFD fd(HANDLE_EINTR(
+      open(path_.c_str(),
+           O_WRONLY | O_CREAT | O_CLOEXEC | (restart ? O_TRUNC : 0),
+           0600)));
+  if (!fd.is_valid()) {
+    PLOG(ERROR) << "Failed to open " << path_;
+    return false;
+  }
+  if (restart) {
+    data_offset_ = -1;
+    size_ = 0;
+    uint8_t header[kHeaderSize];
+    for (size_t i = 0; i < kHeaderSize; i++)
+      header[i] = static_cast<uint8_t>(data_offset >> (8 * i));
+    TEST_AND_RETURN_FALSE(utils::PWriteAll(fd.get(), header, kHeaderSize, 0));
+  }
+  if (data.size() > size_) {
+    TEST_AND_RETURN_FALSE(utils::PWriteAll(fd.get(),
+                                           data.data() + size_,
+                                           data.size() - size_,
+                                           kHeaderSize + size_));
+  }
+  // The bytes are only counted once they are on the disk.
+  TEST_AND_RETURN_FALSE_ERRNO(fsync(fd.get()) == 0);
+  data_offset_ = data_offset;
+  size_ = std::max<uint64_t>(size_, data.size());
+  return true;
+}
+
+void OperationDataCheckpoint::Clear() {
+  if (unlink(path_.c_str()) != 0 && errno != ENOENT)
+    PLOG(WARNING) << "Failed to delete " << path_;
+  data_offset_ = -1;
+  size_ = 0;
+}
+
+}  // namespace chromeos_update_engine
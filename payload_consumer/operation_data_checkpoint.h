@@ -0,0 +1,72 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_OPERATION_DATA_CHECKPOINT_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_OPERATION_DATA_CHECKPOINT_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+namespace chromeos_update_engine {
+
+// The name of the file, in the non-volatile directory, holding the data of
+// the next operation downloaded so far.
+constexpr char kOperationDataCheckpointFileName[] = "operation_data_checkpoint";
+
+// Keeps in a file the data downloaded so far for the next operation, so that
+// an update interrupted while downloading the data of a large operation
+// resumes the download where it stopped, rather than from the start of the
+// operation. The file starts with the offset of the data in the payload
+// blobs, as a little-endian uint64_t, followed by the data saved.
+class OperationDataCheckpoint {
+ public:
+  explicit OperationDataCheckpoint(const std::string& path) : path_(path) {}
+
+  // Returns the number of bytes of the data at |data_offset| in the file, or
+  // 0 if it holds the data of another offset or doesn't exist.
+  uint64_t SavedSize(uint64_t data_offset) const;
+
+  // Reads the data at |data_offset| saved in the file into |data|, which is
+  // left empty if there is none. The next Save() calls append to it.
+  bool Load(uint64_t data_offset, brillo::Blob* data);
+
+  // Saves the bytes of |data|, the data at |data_offset|, not saved yet. The
+  // file is started again if it held the data of another offset.
+  bool Save(uint64_t data_offset, const brillo::Blob& data);
+
+  // Deletes the file.
+  void Clear();
+
+  // The offset and the number of bytes of the data saved or loaded by this
+  // object, or -1 and 0 if none.
+  int64_t data_offset() const { return data_offset_; }
+  uint64_t size() const { return size_; }
+
+ private:
+  std::string path_;
+  int64_t data_offset_{-1};
+  uint64_t size_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(OperationDataCheckpoint);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_OPERATION_DATA_CHECKPOINT_H_
@@ -0,0 +1,90 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/operation_data_checkpoint.h"
+
+#include <string>
+
+#include <base/files/scoped_temp_dir.h>
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+
+namespace chromeos_update_engine {
+
+class OperationDataCheckpointTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    path_ =
+        temp_dir_.GetPath().Append(kOperationDataCheckpointFileName).value();
+    data_.resize(10000);
+    test_utils::FillWithData(&data_);
+  }
+
+  base::ScopedTempDir temp_dir_;
+  std::string path_;
+  brillo::Blob data_;
+};
+
+TEST_F(OperationDataCheckpointTest, SaveAndLoadTest) {
+  OperationDataCheckpoint checkpoint(path_);
+  EXPECT_EQ(0u, checkpoint.SavedSize(1234));
+  ASSERT_TRUE(checkpoint.Save(1234, {data_.begin(), data_.begin() + 4000}));
+  ASSERT_TRUE(checkpoint.Save(1234, data_));
+  EXPECT_EQ(data_.size(), checkpoint.SavedSize(1234));
+  EXPECT_EQ(0u, checkpoint.SavedSize(1235));
+
+  // The data of another offset is never loaded.
+  OperationDataCheckpoint resumed(path_);
+  brillo::Blob data;
+  ASSERT_TRUE(resumed.Load(1235, &data));
+  EXPECT_TRUE(data.empty());
+  ASSERT_TRUE(resumed.Load(1234, &data));
+  EXPECT_EQ(data_, data);
+
+  // The loaded data is appended to.
+  data.insert(data.end(), data_.begin(), data_.end());
+  ASSERT_TRUE(resumed.Save(1234, data));
+  brillo::Blob loaded;
+  ASSERT_TRUE(OperationDataCheckpoint(path_).Load(1234, &loaded));
+  EXPECT_EQ(data, loaded);
+}
+
+TEST_F(OperationDataCheckpointTest, AnotherOffsetRestartsTest) {
+  OperationDataCheckpoint checkpoint(path_);
+  ASSERT_TRUE(checkpoint.Save(1234, data_));
+  ASSERT_TRUE(checkpoint.Save(5678, {data_.begin(), data_.begin() + 100}));
+  EXPECT_EQ(0u, checkpoint.SavedSize(1234));
+  EXPECT_EQ(100u, checkpoint.SavedSize(5678));
+  EXPECT_EQ(5678, checkpoint.data_offset());
+  EXPECT_EQ(100u, checkpoint.size());
+
+  checkpoint.Clear();
+  EXPECT_EQ(0u, checkpoint.SavedSize(5678));
+  EXPECT_EQ(-1, checkpoint.data_offset());
+}
+
+TEST_F(OperationDataCheckpointTest, StaleFileIsRestartedTest) {
+  ASSERT_TRUE(OperationDataCheckpoint(path_).Save(1234, data_));
+  // A new object doesn't trust the file it didn't load.
+  OperationDataCheckpoint checkpoint(path_);
+  ASSERT_TRUE(checkpoint.Save(1234, {data_.begin(), data_.begin() + 100}));
+  EXPECT_EQ(100u, checkpoint.SavedSize(1234));
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,161 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/operation_schedule.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "update_engine/payload_consumer/payload_constants.h"
+
+using google::protobuf::RepeatedPtrField;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Adds to |*distance| the seeks from |*position| through |extents|.
+void AddSeekDistance(const RepeatedPtrField<Extent>& extents,
+                     bool* has_position,
+                     uint64_t* position,
+                     uint64_t* distance) {
+  for (const Extent& extent : extents) {
+    if (extent.start_block() == kSparseHole) {
+      continue;
+    }
+    if (*has_position) {
+      *distance += extent.start_block() > *position
+                       ? extent.start_block() - *position
+                       : *position - extent.start_block();
+    }
+    *has_position = true;
+    *position = extent.start_block() + extent.num_blocks();
+  }
+}
+
+}  // namespace
+
+SeekDistance ComputeSeekDistance(
+    const RepeatedPtrField<InstallOperation>& operations) {
+  SeekDistance distance;
+  bool has_source_position = false;
+  bool has_target_position = false;
+  uint64_t source_position = 0;
+  uint64_t target_position = 0;
+  for (const InstallOperation& op : operations) {
+    AddSeekDistance(op.src_extents(),
+                    &has_source_position,
+                    &source_position,
+                    &distance.source);
+    AddSeekDistance(op.dst_extents(),
+                    &has_target_position,
+                    &target_position,
+                    &distance.target);
+  }
+  return distance;
+}
+
+bool HaveDisjointTargets(const RepeatedPtrField<InstallOperation>& operations) {
+  vector<std::pair<uint64_t, uint64_t>> extents;
+  for (const InstallOperation& op : operations) {
+    for (const Extent& extent : op.dst_extents()) {
+      if (extent.start_block() == kSparseHole) {
+        continue;
+      }
+      extents.emplace_back(extent.start_block(), extent.num_blocks());
+    }
+  }
+  std::sort(extents.begin(), extents.end());
+  for (size_t i = 1; i < extents.size(); i++) {
+    if (extents[i - 1].first + extents[i - 1].second > extents[i].first) {
+      return false;
+    }
+  }
+  return true;
+}
+
+vector<size_t> ScheduleOperations(
+    const RepeatedPtrField<InstallOperation>& operations) {
+  vector<size_t> with_data;
+  vector<size_t> copies;
+  vector<size_t> others;
+  for (int i = 0; i < operations.size(); i++) {
+    const InstallOperation& op = operations[i];
+    if (op.data_length() > 0) {
+      with_data.push_back(i);
+    } else if (op.src_extents_size() > 0) {
+      copies.push_back(i);
+    } else {
+      others.push_back(i);
+    }
+  }
+  auto first_block = [](const RepeatedPtrField<Extent>& extents) {
+    return extents.empty() ? kSparseHole : extents[0].start_block();
+  };
+  std::stable_sort(copies.begin(), copies.end(), [&](size_t a, size_t b) {
+    return first_block(operations[a].src_extents()) <
+           first_block(operations[b].src_extents());
+  });
+  std::stable_sort(others.begin(), others.end(), [&](size_t a, size_t b) {
+    return first_block(operations[a].dst_extents()) <
+           first_block(operations[b].dst_extents());
+  });
+
+  vector<size_t> order;
+  order.reserve(operations.size());
+  auto next_copy = copies.begin();
+  for (size_t index : with_data) {
+    const InstallOperation& op = operations[index];
+    if (op.src_extents_size() > 0) {
+      const uint64_t source_block = first_block(op.src_extents());
+      for (; next_copy != copies.end() &&
+             first_block(operations[*next_copy].src_extents()) < source_block;
+           next_copy++) {
+        order.push_back(*next_copy);
+      }
+    }
+    order.push_back(index);
+  }
+  order.insert(order.end(), next_copy, copies.end());
+  order.insert(order.end(), others.begin(), others.end());
+  return order;
+}
+
+void ReorderOperations(RepeatedPtrField<InstallOperation>* operations) {
+  const vector<size_t> order = ScheduleOperations(*operations);
+  // |at[i]| is the index in the manifest of the operation now at |i|, and
+  // |position[j]| the current index of the operation at |j| in the manifest.
+  vector<size_t> at(order.size());
+  vector<size_t> position(order.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    at[i] = i;
+    position[i] = i;
+  }
+  for (size_t i = 0; i < order.size(); i++) {
+    const size_t from = position[order[i]];
+    if (from == i) {
+      continue;
+    }
+    operations->SwapElements(i, from);
+    at[from] = at[i];
+    position[at[from]] = from;
+    at[i] = order[i];
+    position[order[i]] = i;
+  }
+}
+
+}  // namespace chromeos_update_engine
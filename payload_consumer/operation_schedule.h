@@ -0,0 +1,67 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_OPERATION_SCHEDULE_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_OPERATION_SCHEDULE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <google/protobuf/repeated_field.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+// The generator orders the operations of a partition by destination, which
+// can make their source reads jump around the source partition. As long as
+// the operations read from another partition than the one they write and
+// write disjoint blocks, they can be applied in any order, except for the
+// ones with data which must follow the order of the payload stream.
+
+namespace chromeos_update_engine {
+
+// Total distance in blocks between consecutive extents, from the end of one
+// to the start of the next.
+struct SeekDistance {
+  uint64_t source{0};
+  uint64_t target{0};
+};
+
+// Returns the seek distance of the source reads and of the target writes
+// when applying |operations| in order.
+SeekDistance ComputeSeekDistance(
+    const google::protobuf::RepeatedPtrField<InstallOperation>& operations);
+
+// Returns whether no two of |operations| write the same block, which allows
+// reordering them when they read another partition than the one they write.
+bool HaveDisjointTargets(
+    const google::protobuf::RepeatedPtrField<InstallOperation>& operations);
+
+// Returns the indices of |operations| in the order to apply them: the
+// operations with data keep their relative order, the others are moved
+// before the first operation with data reading after them in the source, in
+// the order of their source. The operations reading no source and carrying
+// no data, e.g. ZERO, come last, in the order of their target.
+std::vector<size_t> ScheduleOperations(
+    const google::protobuf::RepeatedPtrField<InstallOperation>& operations);
+
+// Reorders |operations| as returned by ScheduleOperations().
+void ReorderOperations(
+    google::protobuf::RepeatedPtrField<InstallOperation>* operations);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_OPERATION_SCHEDULE_H_
@@ -0,0 +1,109 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/operation_schedule.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_generator/extent_ranges.h"
+
+using google::protobuf::RepeatedPtrField;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+class OperationScheduleTest : public ::testing::Test {
+ protected:
+  // Adds an operation reading |src_block|, unless it is negative, writing
+  // |dst_block|, with |data_length| bytes of data.
+  void AddOperation(int64_t src_block,
+                    uint64_t dst_block,
+                    uint64_t data_length) {
+    InstallOperation* op = operations_.Add();
+    if (src_block >= 0) {
+      op->set_type(data_length > 0 ? InstallOperation::SOURCE_BSDIFF
+                                   : InstallOperation::SOURCE_COPY);
+      *op->add_src_extents() = ExtentForRange(src_block, 1);
+    } else {
+      op->set_type(data_length > 0 ? InstallOperation::REPLACE
+                                   : InstallOperation::ZERO);
+    }
+    *op->add_dst_extents() = ExtentForRange(dst_block, 1);
+    if (data_length > 0) {
+      op->set_data_offset(data_offset_);
+      op->set_data_length(data_length);
+      data_offset_ += data_length;
+    }
+  }
+
+  RepeatedPtrField<InstallOperation> operations_;
+  uint64_t data_offset_{0};
+};
+
+TEST_F(OperationScheduleTest, ComputeSeekDistanceTest) {
+  AddOperation(10, 0, 0);
+  AddOperation(2, 1, 0);
+  AddOperation(-1, 5, 0);
+  const SeekDistance distance = ComputeSeekDistance(operations_);
+  // Source: 11 -> 2. Target: 1 -> 1, 2 -> 5.
+  EXPECT_EQ(9u, distance.source);
+  EXPECT_EQ(3u, distance.target);
+}
+
+TEST_F(OperationScheduleTest, HaveDisjointTargetsTest) {
+  AddOperation(0, 3, 0);
+  AddOperation(1, 1, 0);
+  EXPECT_TRUE(HaveDisjointTargets(operations_));
+  *operations_[0].add_dst_extents() = ExtentForRange(0, 2);
+  EXPECT_FALSE(HaveDisjointTargets(operations_));
+}
+
+TEST_F(OperationScheduleTest, ScheduleOperationsTest) {
+  AddOperation(50, 0, 0);   // 0: copy
+  AddOperation(-1, 1, 0);   // 1: zero
+  AddOperation(20, 2, 10);  // 2: diff
+  AddOperation(10, 3, 0);   // 3: copy
+  AddOperation(-1, 4, 10);  // 4: replace
+  AddOperation(30, 5, 10);  // 5: diff
+  AddOperation(25, 6, 0);   // 6: copy
+  AddOperation(-1, 7, 0);   // 7: zero
+
+  // The copies reading before each diff come first, sorted by source.
+  EXPECT_EQ(vector<size_t>({3, 2, 4, 6, 5, 0, 1, 7}),
+            ScheduleOperations(operations_));
+
+  const SeekDistance before = ComputeSeekDistance(operations_);
+  ReorderOperations(&operations_);
+  const SeekDistance after = ComputeSeekDistance(operations_);
+  EXPECT_LT(after.source, before.source);
+  EXPECT_TRUE(HaveDisjointTargets(operations_));
+
+  // The operations with data still follow the payload order.
+  uint64_t data_offset = 0;
+  vector<uint64_t> dst_blocks;
+  for (const InstallOperation& op : operations_) {
+    if (op.data_length() > 0) {
+      EXPECT_EQ(data_offset, op.data_offset());
+      data_offset += op.data_length();
+    }
+    dst_blocks.push_back(op.dst_extents(0).start_block());
+  }
+  EXPECT_EQ(vector<uint64_t>({3, 2, 4, 6, 5, 0, 1, 7}), dst_blocks);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,130 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/page_cache_dropping_file_descriptor.h"
+
+#include <fcntl.h>
+
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+
+namespace chromeos_update_engine {
+
+PageCacheDroppingFileDescriptor::~PageCacheDroppingFileDescriptor() {
+  DropWrittenPages();
+}
+
+bool PageCacheDroppingFileDescriptor::Open(const char* path,
+                                           int flags,
+                                           mode_t mode) {
+  if (!fd_->Open(path, flags, mode)) {
+    return false;
+  }
+  OpenAdviceFd(path);
+  return true;
+}
+
+bool PageCacheDroppingFileDescriptor::Open(const char* path, int flags) {
+  if (!fd_->Open(path, flags)) {
+    return false;
+  }
+  OpenAdviceFd(path);
+  return true;
+}
+
+void PageCacheDroppingFileDescriptor::OpenAdviceFd(const char* path) {
+  offset_ = 0;
+  advice_fd_.reset(HANDLE_EINTR(open(path, O_RDONLY | O_CLOEXEC)));
+  PLOG_IF(WARNING, !advice_fd_.ok())
+      << "Failed to open " << path << ", its pages stay in the page cache";
+}
+
+ssize_t PageCacheDroppingFileDescriptor::Read(void* buf, size_t count) {
+  const ssize_t bytes_read = fd_->Read(buf, count);
+  if (bytes_read > 0) {
+    if (advice_fd_.ok()) {
+      posix_fadvise(
+          advice_fd_.get(), offset_, bytes_read, POSIX_FADV_DONTNEED);
+    }
+    offset_ += bytes_read;
+  }
+  return bytes_read;
+}
+
+ssize_t PageCacheDroppingFileDescriptor::Write(const void* buf,
+                                               size_t count) {
+  const ssize_t bytes_written = fd_->Write(buf, count);
+  if (bytes_written > 0) {
+    if (!written_.empty() &&
+        written_.back().offset +
+                static_cast<off64_t>(written_.back().size) ==
+            offset_) {
+      written_.back().size += bytes_written;
+    } else {
+      written_.push_back({offset_, static_cast<uint64_t>(bytes_written)});
+    }
+    offset_ += bytes_written;
+    bytes_written_ += bytes_written;
+    if (bytes_written_ >= kWriteBehindBytes) {
+      DropWrittenPages();
+    }
+  }
+  return bytes_written;
+}
+
+off64_t PageCacheDroppingFileDescriptor::Seek(off64_t offset, int whence) {
+  const off64_t new_offset = fd_->Seek(offset, whence);
+  if (new_offset >= 0) {
+    offset_ = new_offset;
+  }
+  return new_offset;
+}
+
+bool PageCacheDroppingFileDescriptor::Flush() {
+  const bool success = fd_->Flush();
+  DropWrittenPages();
+  return success;
+}
+
+bool PageCacheDroppingFileDescriptor::Close() {
+  DropWrittenPages();
+  advice_fd_.reset();
+  offset_ = 0;
+  return fd_->Close();
+}
+
+void PageCacheDroppingFileDescriptor::DropWrittenPages() {
+  if (advice_fd_.ok()) {
+    // Only clean pages are dropped, so the writes must reach the device
+    // first.
+    for (const auto& range : written_) {
+      if (sync_file_range(advice_fd_.get(),
+                          range.offset,
+                          range.size,
+                          SYNC_FILE_RANGE_WAIT_BEFORE |
+                              SYNC_FILE_RANGE_WRITE |
+                              SYNC_FILE_RANGE_WAIT_AFTER) != 0) {
+        PLOG(WARNING) << "sync_file_range failed";
+      }
+      posix_fadvise(
+          advice_fd_.get(), range.offset, range.size, POSIX_FADV_DONTNEED);
+    }
+  }
+  written_.clear();
+  bytes_written_ = 0;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,94 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_PAGE_CACHE_DROPPING_FILE_DESCRIPTOR_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_PAGE_CACHE_DROPPING_FILE_DESCRIPTOR_H_
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+
+#include "update_engine/payload_consumer/file_descriptor.h"
+
+namespace chromeos_update_engine {
+
+// A FileDescriptor over |fd| which drops the pages it reads and writes from
+// the page cache, so that streaming a partition doesn't evict the working
+// set of the apps in use. The pages read are dropped right after the read.
+// The pages written are synced to the device and dropped once
+// |kWriteBehindBytes| of them accumulate, and on Flush() and Close().
+//
+// The advice goes through a separate read-only descriptor of the same file,
+// so that it works whatever |fd| is. For the same reason the underlying fd
+// isn't exposed by Fd(): the reads and writes must go through this class.
+class PageCacheDroppingFileDescriptor final : public FileDescriptor {
+ public:
+  static constexpr uint64_t kWriteBehindBytes = 8 * 1024 * 1024;
+
+  explicit PageCacheDroppingFileDescriptor(FileDescriptorPtr fd)
+      : fd_(std::move(fd)) {}
+  ~PageCacheDroppingFileDescriptor() override;
+
+  // Interface methods.
+  bool Open(const char* path, int flags, mode_t mode) override;
+  bool Open(const char* path, int flags) override;
+  ssize_t Read(void* buf, size_t count) override;
+  ssize_t Write(const void* buf, size_t count) override;
+  off64_t Seek(off64_t offset, int whence) override;
+  uint64_t BlockDevSize() override { return fd_->BlockDevSize(); }
+  bool BlkIoctl(int request,
+                uint64_t start,
+                uint64_t length,
+                int* result) override {
+    return fd_->BlkIoctl(request, start, length, result);
+  }
+  bool Flush() override;
+  bool StartFlush() override { return fd_->StartFlush(); }
+  bool Close() override;
+  bool IsSettingErrno() override { return fd_->IsSettingErrno(); }
+  bool IsOpen() override { return fd_->IsOpen(); }
+
+ private:
+  // Opens |advice_fd_| after |fd_| was opened.
+  void OpenAdviceFd(const char* path);
+
+  // Writes back the ranges written and drops them from the page cache.
+  void DropWrittenPages();
+
+  struct Range {
+    off64_t offset;
+    uint64_t size;
+  };
+
+  FileDescriptorPtr fd_;
+  android::base::unique_fd advice_fd_;
+  // The position of |fd_|.
+  off64_t offset_{0};
+  // The ranges written since the last DropWrittenPages(), adjacent writes
+  // extending the last range.
+  std::vector<Range> written_;
+  uint64_t bytes_written_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(PageCacheDroppingFileDescriptor);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_PAGE_CACHE_DROPPING_FILE_DESCRIPTOR_H_
@@ -0,0 +1,80 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/page_cache_dropping_file_descriptor.h"
+
+#include <fcntl.h>
+
+#include <memory>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+class PageCacheDroppingFileDescriptorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    data_.resize(kFileSize);
+    test_utils::FillWithData(&data_);
+    ASSERT_TRUE(fd_.Open(file_.path().c_str(), O_RDWR | O_CREAT, 0644));
+  }
+
+  static constexpr size_t kFileSize = 1024 * 1024;
+
+  ScopedTempFile file_{"PageCacheDroppingFileDescriptor.XXXXXX"};
+  PageCacheDroppingFileDescriptor fd_{
+      std::make_shared<EintrSafeFileDescriptor>()};
+  brillo::Blob data_;
+};
+
+TEST_F(PageCacheDroppingFileDescriptorTest, WriteReadTest) {
+  EXPECT_EQ(fd_.Fd(), -1);
+  ASSERT_EQ(fd_.Seek(kFileSize / 2, SEEK_SET),
+            static_cast<off64_t>(kFileSize / 2));
+  ASSERT_TRUE(utils::WriteAll(&fd_, data_.data() + kFileSize / 2,
+                              kFileSize / 2));
+  ASSERT_EQ(fd_.Seek(0, SEEK_SET), 0);
+  ASSERT_TRUE(utils::WriteAll(&fd_, data_.data(), kFileSize / 2));
+  ASSERT_TRUE(fd_.Flush());
+
+  brillo::Blob read_data(kFileSize);
+  ssize_t bytes_read = 0;
+  ASSERT_TRUE(utils::PReadAll(
+      &fd_, read_data.data(), read_data.size(), 0, &bytes_read));
+  EXPECT_EQ(bytes_read, static_cast<ssize_t>(kFileSize));
+  EXPECT_EQ(data_, read_data);
+  EXPECT_TRUE(fd_.Close());
+}
+
+TEST_F(PageCacheDroppingFileDescriptorTest, GetPageCacheResidentBytesTest) {
+  ASSERT_TRUE(utils::WriteAll(&fd_, data_.data(), data_.size()));
+  uint64_t resident_bytes = 0;
+  ASSERT_TRUE(utils::GetPageCacheResidentBytes(
+      file_.path(), kFileSize, &resident_bytes));
+  EXPECT_LE(resident_bytes, kFileSize);
+  EXPECT_TRUE(fd_.Close());
+  // Whether the pages were dropped depends on the filesystem, e.g. not on
+  // tmpfs, so only the bounds are checked.
+  ASSERT_TRUE(utils::GetPageCacheResidentBytes(
+      file_.path(), kFileSize, &resident_bytes));
+  EXPECT_LE(resident_bytes, kFileSize);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,207 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/parallel_hash_tree_builder.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+ParallelHashTreeBuilder::ParallelHashTreeBuilder(size_t block_size,
+                                                 const EVP_MD* md,
+                                                 size_t num_threads)
+    : block_size_(block_size), md_(md), worker_pool_(num_threads) {
+  CHECK(md_ != nullptr);
+  digest_size_ = EVP_MD_size(md_);
+  digest_slot_size_ = 1;
+  while (digest_slot_size_ < digest_size_) {
+    digest_slot_size_ <<= 1;
+  }
+  CHECK_LE(digest_slot_size_, block_size_);
+}
+
+ParallelHashTreeBuilder::~ParallelHashTreeBuilder() {
+  EVP_MD_CTX_free(salted_ctx_);
+}
+
+uint64_t ParallelHashTreeBuilder::CalculateSize(uint64_t data_size) const {
+  uint64_t level_blocks = utils::DivRoundUp(data_size, block_size_);
+  uint64_t tree_blocks = 0;
+  do {
+    level_blocks =
+        utils::DivRoundUp(level_blocks * digest_slot_size_, block_size_);
+    tree_blocks += level_blocks;
+  } while (level_blocks > 1);
+  return tree_blocks * block_size_;
+}
+
+bool ParallelHashTreeBuilder::Initialize(uint64_t data_size,
+                                         const std::vector<uint8_t>& salt) {
+  if (data_size == 0 || data_size % block_size_ != 0) {
+    LOG(ERROR) << "Invalid hash tree data size " << data_size
+               << " for block size " << block_size_;
+    return false;
+  }
+  EVP_MD_CTX_free(salted_ctx_);
+  salted_ctx_ = EVP_MD_CTX_new();
+  TEST_AND_RETURN_FALSE(salted_ctx_ != nullptr);
+  TEST_AND_RETURN_FALSE(EVP_DigestInit_ex(salted_ctx_, md_, nullptr) == 1);
+  TEST_AND_RETURN_FALSE(
+      EVP_DigestUpdate(salted_ctx_, salt.data(), salt.size()) == 1);
+
+  data_size_ = data_size;
+  data_hashed_ = 0;
+  leftover_.clear();
+  levels_.clear();
+  levels_.emplace_back();
+  levels_[0].reserve(utils::DivRoundUp(
+                         data_size / block_size_ * digest_slot_size_,
+                         block_size_) *
+                     block_size_);
+  root_hash_.clear();
+  return true;
+}
+
+bool ParallelHashTreeBuilder::Update(const uint8_t* data, size_t size) {
+  TEST_AND_RETURN_FALSE(salted_ctx_ != nullptr);
+  if (data_hashed_ + leftover_.size() + size > data_size_) {
+    LOG(ERROR) << "Hashing past the end of the hash tree data, hashed: "
+               << data_hashed_ + leftover_.size() << ", size: " << size
+               << ", expected: " << data_size_;
+    return false;
+  }
+  if (!leftover_.empty()) {
+    const size_t copy_size = std::min(size, block_size_ - leftover_.size());
+    leftover_.insert(leftover_.end(), data, data + copy_size);
+    data += copy_size;
+    size -= copy_size;
+    if (leftover_.size() < block_size_) {
+      return true;
+    }
+    TEST_AND_RETURN_FALSE(HashLeftover());
+  }
+  const size_t num_blocks = size / block_size_;
+  if (num_blocks > 0) {
+    std::vector<uint8_t>& level = levels_[0];
+    const size_t level_size = level.size();
+    level.resize(level_size + num_blocks * digest_slot_size_);
+    TEST_AND_RETURN_FALSE(
+        HashBlocks(data, num_blocks, level.data() + level_size));
+    data_hashed_ += num_blocks * block_size_;
+  }
+  leftover_.assign(data + num_blocks * block_size_, data + size);
+  return true;
+}
+
+bool ParallelHashTreeBuilder::BuildHashTree() {
+  TEST_AND_RETURN_FALSE(salted_ctx_ != nullptr);
+  if (!leftover_.empty()) {
+    // Zero pad the last partial block, like HashTreeBuilder.
+    leftover_.resize(block_size_, 0);
+    TEST_AND_RETURN_FALSE(HashLeftover());
+  }
+  if (data_hashed_ != data_size_) {
+    LOG(ERROR) << "Hashed " << data_hashed_ << " bytes, expected "
+               << data_size_;
+    return false;
+  }
+  PadLevel(&levels_.back());
+  while (levels_.back().size() > block_size_) {
+    const std::vector<uint8_t>& previous = levels_.back();
+    const size_t num_blocks = previous.size() / block_size_;
+    std::vector<uint8_t> level(num_blocks * digest_slot_size_);
+    TEST_AND_RETURN_FALSE(
+        HashBlocks(previous.data(), num_blocks, level.data()));
+    PadLevel(&level);
+    levels_.push_back(std::move(level));
+  }
+  std::vector<uint8_t> root_hash(digest_slot_size_);
+  TEST_AND_RETURN_FALSE(
+      HashBlocksSerially(levels_.back().data(), 1, root_hash.data()));
+  root_hash.resize(digest_size_);
+  root_hash_ = std::move(root_hash);
+  return true;
+}
+
+bool ParallelHashTreeBuilder::WriteHashTree(
+    const std::function<bool(const uint8_t*, size_t)>& callback) const {
+  if (root_hash_.empty()) {
+    LOG(ERROR) << "The hash tree was not built";
+    return false;
+  }
+  for (auto level = levels_.rbegin(); level != levels_.rend(); level++) {
+    if (!callback(level->data(), level->size())) {
+      LOG(ERROR) << "Failed to write the hash tree";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ParallelHashTreeBuilder::HashLeftover() {
+  std::vector<uint8_t>& level = levels_[0];
+  level.resize(level.size() + digest_slot_size_);
+  TEST_AND_RETURN_FALSE(HashBlocksSerially(
+      leftover_.data(), 1, level.data() + level.size() - digest_slot_size_));
+  data_hashed_ += block_size_;
+  leftover_.clear();
+  return true;
+}
+
+bool ParallelHashTreeBuilder::HashBlocks(const uint8_t* data,
+                                         size_t num_blocks,
+                                         uint8_t* out) {
+  const size_t num_tasks = utils::DivRoundUp(num_blocks, kBlocksPerTask);
+  return worker_pool_.ParallelFor(
+      num_tasks, [this, data, num_blocks, out](size_t task) {
+        const size_t begin = task * kBlocksPerTask;
+        return HashBlocksSerially(data + begin * block_size_,
+                                  std::min(kBlocksPerTask, num_blocks - begin),
+                                  out + begin * digest_slot_size_);
+      });
+}
+
+bool ParallelHashTreeBuilder::HashBlocksSerially(const uint8_t* data,
+                                                 size_t num_blocks,
+                                                 uint8_t* out) const {
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(),
+                                                              EVP_MD_CTX_free);
+  TEST_AND_RETURN_FALSE(ctx != nullptr);
+  for (size_t i = 0; i < num_blocks; i++) {
+    TEST_AND_RETURN_FALSE(EVP_MD_CTX_copy_ex(ctx.get(), salted_ctx_) == 1);
+    TEST_AND_RETURN_FALSE(
+        EVP_DigestUpdate(ctx.get(), data + i * block_size_, block_size_) == 1);
+    uint8_t* digest = out + i * digest_slot_size_;
+    TEST_AND_RETURN_FALSE(EVP_DigestFinal_ex(ctx.get(), digest, nullptr) == 1);
+    memset(digest + digest_size_, 0, digest_slot_size_ - digest_size_);
+  }
+  return true;
+}
+
+void ParallelHashTreeBuilder::PadLevel(std::vector<uint8_t>* level) const {
+  level->resize(utils::DivRoundUp(level->size(), block_size_) * block_size_,
+                0);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,107 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_PARALLEL_HASH_TREE_BUILDER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_PARALLEL_HASH_TREE_BUILDER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <base/macros.h>
+#include <openssl/evp.h>
+
+#include "update_engine/payload_consumer/worker_pool.h"
+
+namespace chromeos_update_engine {
+
+// Builds the same dm-verity hash tree as libverity's HashTreeBuilder, but
+// hashes the blocks of every level on a pool of worker threads. The blocks of
+// a level are independent, so each thread hashes its own ranges of blocks
+// straight into their slots of the level; only the levels are built in turn.
+class ParallelHashTreeBuilder {
+ public:
+  // Number of blocks hashed by a thread each time it picks up work.
+  static constexpr size_t kBlocksPerTask = 64;
+
+  // Hashes blocks of |block_size| bytes with |md|, on |num_threads| threads,
+  // the calling one included.
+  ParallelHashTreeBuilder(size_t block_size,
+                          const EVP_MD* md,
+                          size_t num_threads);
+  ~ParallelHashTreeBuilder();
+
+  // Returns the size of the hash tree of |data_size| bytes of data.
+  uint64_t CalculateSize(uint64_t data_size) const;
+
+  // Prepares to hash |data_size| bytes of data, a multiple of the block size,
+  // each block salted with |salt|.
+  bool Initialize(uint64_t data_size, const std::vector<uint8_t>& salt);
+
+  // Hashes the next |size| bytes of data, of any size. The full blocks of
+  // |data| are hashed in parallel before returning.
+  bool Update(const uint8_t* data, size_t size);
+
+  // Builds the upper levels of the tree and the root hash, once all the data
+  // was passed to Update().
+  bool BuildHashTree();
+
+  // Passes the tree to |callback|, top level first, as the dm-verity on-disk
+  // format expects.
+  bool WriteHashTree(
+      const std::function<bool(const uint8_t*, size_t)>& callback) const;
+
+  const std::vector<uint8_t>& root_hash() const { return root_hash_; }
+
+ private:
+  // Hashes |leftover_|, a full block, to the first level.
+  bool HashLeftover();
+  // Hashes |num_blocks| blocks of |data| to |out|, every digest padded to
+  // |digest_slot_size_| bytes, on all the threads.
+  bool HashBlocks(const uint8_t* data, size_t num_blocks, uint8_t* out);
+  // Hashes |num_blocks| blocks of |data| to |out| on the calling thread.
+  bool HashBlocksSerially(const uint8_t* data,
+                          size_t num_blocks,
+                          uint8_t* out) const;
+  // Zero pads |level| to a multiple of the block size.
+  void PadLevel(std::vector<uint8_t>* level) const;
+
+  const size_t block_size_;
+  const EVP_MD* const md_;
+  // Digests are stored in slots sized to the digest size rounded up to a
+  // power of 2.
+  size_t digest_size_{0};
+  size_t digest_slot_size_{0};
+
+  // Context already fed with the salt, copied to hash each block.
+  EVP_MD_CTX* salted_ctx_{nullptr};
+  uint64_t data_size_{0};
+  uint64_t data_hashed_{0};
+  // Bytes of the last partial block passed to Update().
+  std::vector<uint8_t> leftover_;
+  // The levels of the tree, from the one hashing the data up.
+  std::vector<std::vector<uint8_t>> levels_;
+  std::vector<uint8_t> root_hash_;
+
+  WorkerPool worker_pool_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelHashTreeBuilder);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_PARALLEL_HASH_TREE_BUILDER_H_
@@ -0,0 +1,124 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/parallel_hash_tree_builder.h"
+
+#include <algorithm>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+#include <verity/hash_tree_builder.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr size_t kBlockSize = 4096;
+// Enough blocks for two levels of sha256 digests, split in several tasks.
+constexpr size_t kNumBlocks = 300;
+
+bool AppendTo(brillo::Blob* tree, const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  tree->insert(tree->end(), bytes, bytes + size);
+  return true;
+}
+}  // namespace
+
+class ParallelHashTreeBuilderTest
+    : public ::testing::TestWithParam<std::tuple<std::string, size_t>> {
+ protected:
+  void SetUp() override {
+    md_ = HashTreeBuilder::HashFunction(std::get<0>(GetParam()));
+    ASSERT_NE(nullptr, md_);
+    data_.resize(kNumBlocks * kBlockSize);
+    for (size_t i = 0; i < data_.size(); i++) {
+      data_[i] = (i * 31 + i / kBlockSize) & 0xff;
+    }
+  }
+
+  const EVP_MD* md_{nullptr};
+  const std::vector<uint8_t> salt_{1, 2, 3, 4, 5, 6, 7, 8};
+  brillo::Blob data_;
+};
+
+TEST_P(ParallelHashTreeBuilderTest, MatchesHashTreeBuilderTest) {
+  HashTreeBuilder expected(kBlockSize, md_);
+  ASSERT_TRUE(expected.Initialize(data_.size(), salt_));
+  ASSERT_TRUE(expected.Update(data_.data(), data_.size()));
+  ASSERT_TRUE(expected.BuildHashTree());
+
+  ParallelHashTreeBuilder builder(kBlockSize, md_, std::get<1>(GetParam()));
+  ASSERT_EQ(expected.CalculateSize(data_.size()),
+            builder.CalculateSize(data_.size()));
+  ASSERT_TRUE(builder.Initialize(data_.size(), salt_));
+  // Feed the data in chunks not aligned to blocks.
+  size_t offset = 0;
+  for (size_t chunk_size = 100; offset < data_.size(); chunk_size *= 3) {
+    const size_t size = std::min(chunk_size, data_.size() - offset);
+    ASSERT_TRUE(builder.Update(data_.data() + offset, size));
+    offset += size;
+  }
+  ASSERT_TRUE(builder.BuildHashTree());
+
+  brillo::Blob expected_tree;
+  ASSERT_TRUE(
+      expected.WriteHashTree([&expected_tree](const void* data, size_t size) {
+        return AppendTo(&expected_tree, data, size);
+      }));
+  brillo::Blob tree;
+  ASSERT_TRUE(builder.WriteHashTree([&tree](const uint8_t* data, size_t size) {
+    return AppendTo(&tree, data, size);
+  }));
+  ASSERT_EQ(builder.CalculateSize(data_.size()), tree.size());
+  ASSERT_EQ(expected_tree, tree);
+  // HashTreeBuilder may pad the root hash like the other digests.
+  const auto& root_hash = builder.root_hash();
+  ASSERT_EQ(static_cast<size_t>(EVP_MD_size(md_)), root_hash.size());
+  ASSERT_LE(root_hash.size(), expected.root_hash().size());
+  ASSERT_TRUE(std::equal(
+      root_hash.begin(), root_hash.end(), expected.root_hash().begin()));
+}
+
+TEST_P(ParallelHashTreeBuilderTest, MissingDataTest) {
+  ParallelHashTreeBuilder builder(kBlockSize, md_, std::get<1>(GetParam()));
+  ASSERT_TRUE(builder.Initialize(data_.size(), salt_));
+  ASSERT_TRUE(builder.Update(data_.data(), data_.size() - kBlockSize));
+  ASSERT_FALSE(builder.BuildHashTree());
+  ASSERT_FALSE(builder.WriteHashTree(
+      [](const uint8_t* /* data */, size_t /* size */) { return true; }));
+}
+
+TEST_P(ParallelHashTreeBuilderTest, TooMuchDataTest) {
+  ParallelHashTreeBuilder builder(kBlockSize, md_, std::get<1>(GetParam()));
+  ASSERT_TRUE(builder.Initialize(data_.size() - kBlockSize, salt_));
+  ASSERT_FALSE(builder.Update(data_.data(), data_.size()));
+}
+
+TEST_P(ParallelHashTreeBuilderTest, UnalignedDataSizeTest) {
+  ParallelHashTreeBuilder builder(kBlockSize, md_, std::get<1>(GetParam()));
+  ASSERT_FALSE(builder.Initialize(data_.size() - 1, salt_));
+  ASSERT_FALSE(builder.Update(data_.data(), kBlockSize));
+}
+
+INSTANTIATE_TEST_CASE_P(
+    ParallelHashTreeBuilderTestInstance,
+    ParallelHashTreeBuilderTest,
+    ::testing::Combine(::testing::Values("sha1", "sha256"),
+                       ::testing::Values(1, 4)));
+
+}  // namespace chromeos_update_engine
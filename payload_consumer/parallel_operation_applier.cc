@@ -0,0 +1,329 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/parallel_operation_applier.h"
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <base/logging.h>
+
+#include "update_engine/common/cpu_topology.h"
+#include "update_engine/common/tracing.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+// Number of operations per worker thread allowed in a single batch.
+constexpr size_t kOperationsPerThread = 4;
+
+std::atomic<size_t> thread_limit{std::numeric_limits<size_t>::max()};
+
+// Set by SetIoPriority(), the generation is incremented with every call and 0
+// until the first one.
+std::atomic<uint32_t> io_priority{0};
+std::atomic<uint64_t> io_priority_generation{0};
+thread_local uint64_t thread_io_priority_generation = 0;
+}  // namespace
+
+ParallelOperationApplier::ParallelOperationApplier(size_t num_threads,
+                                                   size_t block_size,
+                                                   bool source_is_target)
+    : num_threads_(num_threads),
+      block_size_(block_size),
+      source_is_target_(source_is_target) {
+  CHECK_GT(num_threads_, 0U);
+}
+
+ParallelOperationApplier::~ParallelOperationApplier() {
+  StopWorkers();
+}
+
+bool ParallelOperationApplier::Init(const WriterFactory& factory,
+                                    const InstallPlan* install_plan,
+                                    bool source_may_exist,
+                                    size_t next_op_index) {
+  TEST_AND_RETURN_FALSE(writers_.empty());
+  for (size_t i = 0; i < num_threads_; i++) {
+    auto writer = factory();
+    TEST_AND_RETURN_FALSE(writer != nullptr);
+    TEST_AND_RETURN_FALSE(
+        writer->Init(install_plan, source_may_exist, next_op_index));
+    writers_.push_back(std::move(writer));
+  }
+  worker_stats_.resize(num_threads_);
+  for (size_t i = 0; i < num_threads_; i++) {
+    workers_.emplace_back(&ParallelOperationApplier::WorkerMain, this, i);
+  }
+  LOG(INFO) << "Applying operations with " << num_threads_ << " threads.";
+  return true;
+}
+
+bool ParallelOperationApplier::CanEnqueue(
+    const InstallOperation& operation) const {
+  for (const auto& extent : operation.dst_extents()) {
+    if (pending_dst_blocks_.OverlapsWithExtent(extent)) {
+      return false;
+    }
+  }
+  if (!source_is_target_) {
+    // Source extents live on the source slot, which no operation writes to.
+    return true;
+  }
+  for (const auto& extent : operation.src_extents()) {
+    if (pending_dst_blocks_.OverlapsWithExtent(extent)) {
+      return false;
+    }
+  }
+  for (const auto& extent : operation.dst_extents()) {
+    if (pending_src_blocks_.OverlapsWithExtent(extent)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ParallelOperationApplier::Enqueue(const InstallOperation& operation,
+                                       SharedBuffer data) {
+  pending_dst_blocks_.AddRepeatedExtents(operation.dst_extents());
+  if (source_is_target_) {
+    pending_src_blocks_.AddRepeatedExtents(operation.src_extents());
+  }
+  pending_data_bytes_ += data.size();
+  MemoryBudget::Reservation reservation =
+      MemoryBudget::Get()->Acquire(data.size());
+  pending_ops_.push_back(
+      {&operation, std::move(data), std::move(reservation)});
+}
+
+bool ParallelOperationApplier::IsBatchFull() const {
+  return pending_ops_.size() >= num_threads_ * kOperationsPerThread ||
+         pending_data_bytes_ >= kMaxPendingDataBytes ||
+         (!pending_ops_.empty() && !MemoryBudget::Get()->Fits(0));
+}
+
+bool ParallelOperationApplier::Flush(ErrorCode* error) {
+  if (pending_ops_.empty()) {
+    return true;
+  }
+  UE_TRACE_SCOPE("ParallelOperationApplier::Flush");
+  UE_TRACE_COUNTER("ParallelOperationApplier pending bytes",
+                   pending_data_bytes_);
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    next_op_ = 0;
+    completed_ops_ = 0;
+    published_ops_ = pending_ops_.size();
+    work_cv_.notify_all();
+    done_cv_.wait(lock, [this] { return completed_ops_ == published_ops_; });
+    published_ops_ = 0;
+  }
+
+  bool success = true;
+  for (const auto& op : pending_ops_) {
+    if (op.result) {
+      continue;
+    }
+    LOG(ERROR) << "Failed to perform "
+               << InstallOperationTypeName(op.operation->type())
+               << " operation writing to " << op.operation->dst_extents();
+    *error = op.error == ErrorCode::kSuccess
+                 ? ErrorCode::kDownloadOperationExecutionError
+                 : op.error;
+    success = false;
+    break;
+  }
+  // The operations a worker held back, e.g. ZERO ones, must be applied before
+  // the operations of the next batches write to their blocks on other workers.
+  for (auto& writer : writers_) {
+    if (!writer->FlushQueuedOperations() && success) {
+      LOG(ERROR) << "Failed to apply the operations held back by a worker";
+      *error = ErrorCode::kDownloadWriteError;
+      success = false;
+    }
+  }
+  pending_ops_.clear();
+  pending_data_bytes_ = 0;
+  pending_src_blocks_ = ExtentRanges();
+  pending_dst_blocks_ = ExtentRanges();
+  return success;
+}
+
+void ParallelOperationApplier::SetThreadLimit(size_t limit) {
+  thread_limit = std::max<size_t>(limit, 1);
+}
+
+size_t ParallelOperationApplier::GetThreadLimit() {
+  return thread_limit;
+}
+
+void ParallelOperationApplier::SetIoPriority(uint32_t level) {
+  io_priority = level;
+  io_priority_generation++;
+}
+
+void ParallelOperationApplier::ApplyIoPriority() {
+  // The generation is read first, a level set meanwhile is applied next time.
+  const uint64_t generation = io_priority_generation;
+  if (generation == thread_io_priority_generation) {
+    return;
+  }
+  thread_io_priority_generation = generation;
+  utils::SetThreadIoPriority(io_priority);
+}
+
+void ParallelOperationApplier::WorkerMain(size_t worker_index) {
+  PartitionWriterInterface* writer = writers_[worker_index].get();
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    // Workers beyond the limit sit out until a later batch, the first one
+    // always runs so the batch completes.
+    work_cv_.wait(lock, [this, worker_index] {
+      return stopping_ ||
+             (next_op_ < published_ops_ && worker_index < thread_limit);
+    });
+    if (stopping_) {
+      return;
+    }
+    PendingOperation* op = &pending_ops_[next_op_++];
+    lock.unlock();
+    PlaceWorkerThread();
+    ApplyIoPriority();
+    {
+      ApplyStats::ScopedOperation measure(
+          &worker_stats_[worker_index], *op->operation, block_size_);
+      op->result = ApplyOperation(
+          writer, block_size_, *op->operation, op->data, &op->error);
+    }
+    // Release the blob before the rest of the batch completes.
+    op->data.Reset();
+    op->data_reservation.Reset();
+    lock.lock();
+    if (++completed_ops_ == published_ops_) {
+      done_cv_.notify_one();
+    }
+  }
+}
+
+bool ParallelOperationApplier::ApplyOperation(
+    PartitionWriterInterface* writer,
+    size_t block_size,
+    const InstallOperation& operation,
+    const SharedBuffer& data,
+    ErrorCode* error) {
+  UE_TRACE_SCOPE(InstallOperationTypeName(operation.type()));
+  if (operation.has_src_length())
+    TEST_AND_RETURN_FALSE(operation.src_length() % block_size == 0);
+  if (operation.has_dst_length())
+    TEST_AND_RETURN_FALSE(operation.dst_length() % block_size == 0);
+
+  switch (operation.type()) {
+    case InstallOperation::REPLACE:
+    case InstallOperation::REPLACE_BZ:
+    case InstallOperation::REPLACE_XZ:
+    case InstallOperation::REPLACE_ZSTD:
+      return writer->PerformReplaceOperation(
+          operation, data.data(), data.size());
+    case InstallOperation::ZERO:
+    case InstallOperation::DISCARD:
+      return writer->PerformZeroOrDiscardOperation(operation);
+    case InstallOperation::SOURCE_COPY:
+      return writer->PerformSourceCopyOperation(operation, error);
+    case InstallOperation::SOURCE_BSDIFF:
+    case InstallOperation::BROTLI_BSDIFF:
+    case InstallOperation::PUFFDIFF:
+    case InstallOperation::ZUCCHINI:
+    case InstallOperation::LZ4DIFF_PUFFDIFF:
+    case InstallOperation::LZ4DIFF_BSDIFF:
+      return writer->PerformDiffOperation(
+          operation, error, data.data(), data.size());
+    case InstallOperation::TARGET_COPY:
+      return writer->PerformTargetCopyOperation(operation);
+    default:
+      return false;
+  }
+}
+
+void ParallelOperationApplier::StopWorkers() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+    work_cv_.notify_all();
+  }
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+}
+
+bool ParallelOperationApplier::CheckpointUpdateProgress(size_t next_op_index) {
+  CHECK(pending_ops_.empty())
+      << "Checkpointing with " << pending_ops_.size() << " pending operations";
+  bool success = true;
+  for (auto& writer : writers_) {
+    success = writer->StartCheckpoint() && success;
+  }
+  TEST_AND_RETURN_FALSE(success);
+  for (auto& writer : writers_) {
+    TEST_AND_RETURN_FALSE(writer->CheckpointUpdateProgress(next_op_index));
+  }
+  return true;
+}
+
+bool ParallelOperationApplier::FinishedInstallOps() {
+  bool success = true;
+  for (auto& writer : writers_) {
+    success = writer->FinishedInstallOps() && success;
+  }
+  return success;
+}
+
+uint64_t ParallelOperationApplier::SourceCacheSavedBytes() const {
+  uint64_t bytes = 0;
+  for (const auto& writer : writers_) {
+    bytes += writer->SourceCacheSavedBytes();
+  }
+  return bytes;
+}
+
+ApplyStats ParallelOperationApplier::GetApplyStats() const {
+  ApplyStats stats;
+  for (const auto& worker_stats : worker_stats_) {
+    stats.Merge(worker_stats);
+  }
+  return stats;
+}
+
+int ParallelOperationApplier::Close() {
+  StopWorkers();
+  int err = 0;
+  for (auto& writer : writers_) {
+    const int ret = writer->Close();
+    if (err == 0) {
+      err = ret;
+    }
+  }
+  writers_.clear();
+  pending_ops_.clear();
+  return err;
+}
+
+}  // namespace chromeos_update_engine
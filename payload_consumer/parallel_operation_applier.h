@@ -0,0 +1,183 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_PARALLEL_OPERATION_APPLIER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_PARALLEL_OPERATION_APPLIER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <base/macros.h>
+
+#include "update_engine/common/error_code.h"
+#include "update_engine/payload_consumer/apply_stats.h"
+#include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/memory_budget.h"
+#include "update_engine/payload_consumer/partition_writer_interface.h"
+#include "update_engine/payload_consumer/shared_buffer.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Applies the InstallOperations of a single partition on a pool of worker
+// threads. Every worker owns a dedicated PartitionWriterInterface instance, so
+// file descriptors and their seek positions are never shared across threads.
+//
+// Operations are collected into a batch as long as they are independent of the
+// operations already pending: their dst_extents must not overlap any pending
+// dst_extents. When the source and target are the same device, src_extents
+// must not overlap pending dst_extents, and vice versa, either. Flush() applies
+// the whole batch and only returns once every pending operation completed,
+// which is the completion watermark DeltaPerformer relies on before persisting
+// a checkpoint.
+class ParallelOperationApplier {
+ public:
+  using WriterFactory =
+      std::function<std::unique_ptr<PartitionWriterInterface>()>;
+
+  // Upper bound of blob bytes kept alive by pending operations.
+  static constexpr size_t kMaxPendingDataBytes = 32 * 1024 * 1024;
+
+  // |source_is_target| must be set if src_extents and dst_extents refer to the
+  // same device, in which case reads of pending operations are also tracked.
+  ParallelOperationApplier(size_t num_threads,
+                           size_t block_size,
+                           bool source_is_target);
+  ~ParallelOperationApplier();
+
+  // Creates and initializes one partition writer per worker thread using
+  // |factory|, then starts the workers.
+  [[nodiscard]] bool Init(const WriterFactory& factory,
+                          const InstallPlan* install_plan,
+                          bool source_may_exist,
+                          size_t next_op_index);
+
+  // Returns whether |operation| can join the pending batch without depending
+  // on the result of another pending operation.
+  bool CanEnqueue(const InstallOperation& operation) const;
+
+  // Adds |operation| to the pending batch. |data| holds the operation's blob,
+  // already validated against the operation hash. The caller must keep
+  // |operation| alive until the next Flush().
+  void Enqueue(const InstallOperation& operation, SharedBuffer data);
+
+  // Whether the pending batch reached its size or memory limit, or the
+  // MemoryBudget is used up, and should be flushed before more operations are
+  // enqueued.
+  bool IsBatchFull() const;
+
+  bool HasPendingOperations() const { return !pending_ops_.empty(); }
+
+  // Applies all pending operations and waits for them to complete. On failure,
+  // |error| is set to the error of the first failed operation.
+  [[nodiscard]] bool Flush(ErrorCode* error);
+
+  // Forwards to every worker's partition writer, after starting the
+  // checkpoints of all of them. Must only be called when no operations are
+  // pending. Returns false if any of them failed.
+  [[nodiscard]] bool CheckpointUpdateProgress(size_t next_op_index);
+  [[nodiscard]] bool FinishedInstallOps();
+  int Close();
+
+  // Limits the workers of every applier running operations to the first
+  // |limit| ones, at least one, for the apply to be throttled while it runs.
+  // This is process wide, like the cgroup and I/O priority it is adjusted
+  // along with, see ThrottleController.
+  static void SetThreadLimit(size_t limit);
+  // The limit set by SetThreadLimit(), which the threads an operation is
+  // applied with also stay within.
+  static size_t GetThreadLimit();
+
+  // Sets the best-effort I/O priority |level| of the threads applying the
+  // operations, which they pick up with ApplyIoPriority(). Process wide, like
+  // SetThreadLimit(). The other threads, e.g. those verifying the source
+  // partitions ahead, keep their own priority.
+  static void SetIoPriority(uint32_t level);
+  // Gives the calling thread the level of SetIoPriority() if it changed since
+  // the thread last called it, and is cheap otherwise, so that the applying
+  // threads call it before every operation.
+  static void ApplyIoPriority();
+
+  // Sum of the workers' PartitionWriterInterface::SourceCacheSavedBytes().
+  uint64_t SourceCacheSavedBytes() const;
+
+  // The workers' stats of the operations applied. Must only be called when no
+  // operations are pending.
+  ApplyStats GetApplyStats() const;
+
+  // Applies |operation| with |writer|, |data| holding the operation's blob.
+  // |error| is set on source hash mismatches.
+  static bool ApplyOperation(PartitionWriterInterface* writer,
+                             size_t block_size,
+                             const InstallOperation& operation,
+                             const SharedBuffer& data,
+                             ErrorCode* error);
+
+ private:
+  struct PendingOperation {
+    const InstallOperation* operation;
+    SharedBuffer data;
+    // Accounts for |data| until the operation is applied.
+    MemoryBudget::Reservation data_reservation;
+    bool result{false};
+    ErrorCode error{ErrorCode::kSuccess};
+  };
+
+  void WorkerMain(size_t worker_index);
+  void StopWorkers();
+
+  const size_t num_threads_;
+  const size_t block_size_;
+  const bool source_is_target_;
+
+  std::vector<std::unique_ptr<PartitionWriterInterface>> writers_;
+  // Only used by their worker while a batch runs.
+  std::vector<ApplyStats> worker_stats_;
+  std::vector<std::thread> workers_;
+
+  // Operations of the current batch, in manifest order.
+  std::vector<PendingOperation> pending_ops_;
+  size_t pending_data_bytes_{0};
+  ExtentRanges pending_src_blocks_;
+  ExtentRanges pending_dst_blocks_;
+
+  // Protects the fields below, which hand the batch over to the workers.
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  // Number of operations of |pending_ops_| handed over to the workers. Zero
+  // while the main thread is still filling the batch.
+  size_t published_ops_{0};
+  // Index of the next operation in |pending_ops_| to be picked up.
+  size_t next_op_{0};
+  // Number of published operations that finished executing.
+  size_t completed_ops_{0};
+  bool stopping_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelOperationApplier);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_PARALLEL_OPERATION_APPLIER_H_
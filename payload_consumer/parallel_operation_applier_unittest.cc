@@ -0,0 +1,178 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/parallel_operation_applier.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/dynamic_partition_control_stub.h"
+#include "update_engine/common/error_code.h"
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/partition_writer.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr size_t kNumBlocks = 64;
+constexpr size_t kThreads = 4;
+}  // namespace
+
+class ParallelOperationApplierTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    install_part_.target_size = kNumBlocks * kBlockSize;
+    ASSERT_EQ(0,
+              truncate(target_partition_.path().c_str(),
+                       kNumBlocks * kBlockSize));
+    ASSERT_TRUE(applier_.Init(
+        [this]() {
+          return std::make_unique<PartitionWriter>(partition_update_,
+                                                   install_part_,
+                                                   &dynamic_control_,
+                                                   kBlockSize,
+                                                   true);
+        },
+        &install_plan_,
+        false,
+        0));
+  }
+
+  static InstallOperation ReplaceOp(uint64_t start_block, uint64_t num_blocks) {
+    InstallOperation op;
+    op.set_type(InstallOperation::REPLACE);
+    *op.add_dst_extents() = ExtentForRange(start_block, num_blocks);
+    op.set_data_length(num_blocks * kBlockSize);
+    return op;
+  }
+
+  InstallPlan install_plan_{};
+  DynamicPartitionControlStub dynamic_control_{};
+  ScopedTempFile target_partition_{"target-part-XXXXXX"};
+  PartitionUpdate partition_update_{};
+  InstallPlan::Partition install_part_{.target_path = target_partition_.path()};
+  ParallelOperationApplier applier_{kThreads, kBlockSize, false};
+};
+
+TEST_F(ParallelOperationApplierTest, AppliesIndependentOperationsTest) {
+  std::vector<InstallOperation> ops;
+  for (size_t i = 0; i < kNumBlocks; i++) {
+    ops.push_back(ReplaceOp(i, 1));
+  }
+  brillo::Blob expected;
+  for (size_t i = 0; i < ops.size(); i++) {
+    ASSERT_TRUE(applier_.CanEnqueue(ops[i]));
+    brillo::Blob data(kBlockSize, static_cast<uint8_t>(i));
+    expected.insert(expected.end(), data.begin(), data.end());
+    applier_.Enqueue(ops[i], SharedBuffer(std::move(data)));
+    if (applier_.IsBatchFull()) {
+      ErrorCode error = ErrorCode::kSuccess;
+      ASSERT_TRUE(applier_.Flush(&error));
+      ASSERT_FALSE(applier_.HasPendingOperations());
+    }
+  }
+  ErrorCode error = ErrorCode::kSuccess;
+  ASSERT_TRUE(applier_.Flush(&error));
+  ASSERT_TRUE(applier_.CheckpointUpdateProgress(ops.size()));
+  ASSERT_TRUE(applier_.FinishedInstallOps());
+  ASSERT_EQ(0, applier_.Close());
+
+  brillo::Blob output;
+  ASSERT_TRUE(utils::ReadFile(target_partition_.path(), &output));
+  ASSERT_EQ(expected, output);
+}
+
+TEST_F(ParallelOperationApplierTest, FlushAppliesHeldBackZerosTest) {
+  applier_.Enqueue(ReplaceOp(0, 4),
+                   SharedBuffer(brillo::Blob(4 * kBlockSize, 'a')));
+  ErrorCode error = ErrorCode::kSuccess;
+  ASSERT_TRUE(applier_.Flush(&error));
+  InstallOperation zero_op;
+  zero_op.set_type(InstallOperation::ZERO);
+  *zero_op.add_dst_extents() = ExtentForRange(0, 2);
+  applier_.Enqueue(zero_op, SharedBuffer());
+  ASSERT_TRUE(applier_.Flush(&error));
+  // Written by any of the workers, after the blocks were zeroed.
+  applier_.Enqueue(ReplaceOp(0, 1),
+                   SharedBuffer(brillo::Blob(kBlockSize, 'b')));
+  ASSERT_TRUE(applier_.Flush(&error));
+  ASSERT_EQ(0, applier_.Close());
+
+  brillo::Blob expected(kNumBlocks * kBlockSize, 0);
+  std::fill_n(expected.begin(), kBlockSize, 'b');
+  std::fill_n(expected.begin() + 2 * kBlockSize, 2 * kBlockSize, 'a');
+  brillo::Blob output;
+  ASSERT_TRUE(utils::ReadFile(target_partition_.path(), &output));
+  EXPECT_EQ(expected, output);
+}
+
+TEST_F(ParallelOperationApplierTest, ThreadLimitTest) {
+  // With a single worker running operations, batches still complete.
+  ParallelOperationApplier::SetThreadLimit(1);
+  std::vector<InstallOperation> ops;
+  for (size_t i = 0; i < kNumBlocks; i++) {
+    ops.push_back(ReplaceOp(i, 1));
+  }
+  for (const auto& op : ops) {
+    applier_.Enqueue(op, SharedBuffer(brillo::Blob(kBlockSize, 'c')));
+  }
+  ErrorCode error = ErrorCode::kSuccess;
+  EXPECT_TRUE(applier_.Flush(&error));
+  ParallelOperationApplier::SetThreadLimit(kThreads);
+  ASSERT_EQ(0, applier_.Close());
+
+  brillo::Blob output;
+  ASSERT_TRUE(utils::ReadFile(target_partition_.path(), &output));
+  EXPECT_EQ(brillo::Blob(kNumBlocks * kBlockSize, 'c'), output);
+}
+
+TEST_F(ParallelOperationApplierTest, OverlappingOperationsNotBatchedTest) {
+  const InstallOperation first = ReplaceOp(0, 4);
+  const InstallOperation overlapping = ReplaceOp(3, 2);
+  const InstallOperation disjoint = ReplaceOp(4, 2);
+
+  ASSERT_TRUE(applier_.CanEnqueue(first));
+  applier_.Enqueue(first, SharedBuffer(brillo::Blob(4 * kBlockSize, 'a')));
+  ASSERT_FALSE(applier_.CanEnqueue(overlapping));
+  ASSERT_TRUE(applier_.CanEnqueue(disjoint));
+
+  ErrorCode error = ErrorCode::kSuccess;
+  ASSERT_TRUE(applier_.Flush(&error));
+  ASSERT_TRUE(applier_.CanEnqueue(overlapping));
+}
+
+TEST_F(ParallelOperationApplierTest, FailedOperationReportsErrorTest) {
+  // The destination is past the end of the blob supplied, so the write fails.
+  InstallOperation op = ReplaceOp(0, 2);
+  op.set_data_length(4 * kBlockSize);
+  applier_.Enqueue(op, brillo::Blob(4 * kBlockSize, 'b'));
+
+  ErrorCode error = ErrorCode::kSuccess;
+  ASSERT_FALSE(applier_.Flush(&error));
+  ASSERT_EQ(ErrorCode::kDownloadOperationExecutionError, error);
+  ASSERT_FALSE(applier_.HasPendingOperations());
+}
+
+}  // namespace chromeos_update_engine
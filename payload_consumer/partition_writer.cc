@@ -16,18 +16,22 @@
 #include <update_engine/payload_consumer/partition_writer.h>
 
 #include <fcntl.h>
+#include <linux/falloc.h>
 #include <linux/fs.h>
 #include <sys/mman.h>
 
 #include <inttypes.h>
 
 #include <algorithm>
+#include <atomic>
 #include <initializer_list>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <base/files/scoped_file.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
@@ -39,13 +43,22 @@
 #include "update_engine/payload_consumer/file_descriptor_utils.h"
 #include "update_engine/payload_consumer/install_operation_executor.h"
 #include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/io_uring_file_descriptor.h"
 #include "update_engine/payload_consumer/mount_history.h"
+#include "update_engine/payload_consumer/page_cache_dropping_file_descriptor.h"
 #include "update_engine/payload_generator/extent_utils.h"
 
 namespace chromeos_update_engine {
 
 namespace {
-constexpr uint64_t kCacheSize = 1024 * 1024;  // 1MB
+constexpr uint64_t kDefaultCacheSize = 1024 * 1024;  // 1MB
+
+// Without O_DSYNC, the target data is written back every time this many bytes
+// were written, so that the checkpoints' flushes don't stall on all the data
+// written since the previous one.
+constexpr uint64_t kWriteOutBytes = 16 * 1024 * 1024;
+
+std::atomic<size_t> default_write_cache_size{kDefaultCacheSize};
 
 // Discard the tail of the block device referenced by |fd|, from the offset
 // |data_size| until the end of the block device. Returns whether the data was
@@ -84,19 +97,39 @@ bool DiscardPartitionTail(const FileDescriptorPtr& fd, uint64_t data_size) {
 
 // Opens path for read/write. On success returns an open FileDescriptor
 // and sets *err to 0. On failure, sets *err to errno and returns nullptr.
+// If |use_io_uring|, I/O is submitted through io_uring. If |cache_writes|, the
+// writes are gathered in caches of |cache_size| bytes, written in the
+// background with more than one |cache_buffers|, in units of the optimal I/O
+// size of the device. If |drop_page_cache|, the pages read and written are
+// dropped from the page cache.
 FileDescriptorPtr OpenFile(const char* path,
                            int mode,
                            bool cache_writes,
+                           size_t cache_size,
+                           size_t cache_buffers,
+                           bool use_io_uring,
+                           bool drop_page_cache,
                            int* err) {
   // Try to mark the block device read-only based on the mode. Ignore any
   // failure since this won't work when passing regular files.
   bool read_only = (mode & O_ACCMODE) == O_RDONLY;
   utils::SetBlockDeviceReadOnly(path, read_only);
 
-  FileDescriptorPtr fd(new EintrSafeFileDescriptor());
+  FileDescriptorPtr fd = CreateFileDescriptor(use_io_uring);
+  if (drop_page_cache) {
+    fd = std::make_shared<PageCacheDroppingFileDescriptor>(std::move(fd));
+  }
   if (cache_writes && !read_only) {
-    fd = FileDescriptorPtr(new CachedFileDescriptor(fd, kCacheSize));
-    LOG(INFO) << "Caching writes.";
+    auto cached_fd =
+        std::make_shared<CachedFileDescriptor>(fd, cache_size, cache_buffers);
+    const size_t write_unit = utils::GetBlockDeviceOptimalIoSize(path);
+    if (write_unit > 0) {
+      cached_fd->SetWriteUnit(write_unit);
+      LOG(INFO) << "Writing in units of " << write_unit << " bytes.";
+    }
+    fd = std::move(cached_fd);
+    LOG(INFO) << "Caching writes" << (cache_buffers > 1 ? " in the background."
+                                                        : ".");
   }
   if (!fd->Open(path, mode, 000)) {
     *err = errno;
@@ -126,14 +159,15 @@ PartitionWriter::~PartitionWriter() {
 }
 
 bool PartitionWriter::OpenSourcePartition(uint32_t source_slot,
-                                          bool source_may_exist) {
+                                          bool source_may_exist,
+                                          bool use_io_uring) {
   source_path_.clear();
   if (!source_may_exist) {
     return true;
   }
   if (install_part_.source_size > 0 && !install_part_.source_path.empty()) {
     source_path_ = install_part_.source_path;
-    if (!verified_source_fd_.Open()) {
+    if (!verified_source_fd_.Open(use_io_uring)) {
       LOG(ERROR) << "Unable to open source partition " << install_part_.name
                  << " on slot " << BootControlInterface::SlotName(source_slot)
                  << ", file " << source_path_;
@@ -149,7 +183,32 @@ bool PartitionWriter::Init(const InstallPlan* install_plan,
   const PartitionUpdate& partition = partition_update_;
   uint32_t source_slot = install_plan->source_slot;
   uint32_t target_slot = install_plan->target_slot;
-  TEST_AND_RETURN_FALSE(OpenSourcePartition(source_slot, source_may_exist));
+  worker_pool_ =
+      std::make_unique<WorkerPool>(install_plan->OperationPoolThreads());
+  verified_source_fd_.set_worker_pool(worker_pool_.get());
+  verified_source_fd_.set_source_read_threads(
+      install_plan->source_read_threads);
+  verified_source_fd_.set_drop_page_cache(install_plan->drop_page_cache);
+  if (install_plan->source_cache_size > 0) {
+    verified_source_fd_.EnableSourceCache(partition_update_,
+                                          install_plan->source_cache_size);
+  }
+  install_op_executor_.set_worker_pool(worker_pool_.get());
+  install_op_executor_.set_bsdiff_memory_limit(
+      install_plan->bsdiff_memory_limit);
+  install_op_executor_.set_bzip_threads(install_plan->bzip_threads);
+  install_op_executor_.set_lz4diff_threads(install_plan->lz4diff_threads);
+  install_op_executor_.set_xz_threads(install_plan->xz_threads);
+  install_op_executor_.set_zstd_threads(install_plan->zstd_threads);
+  install_op_executor_.set_zucchini_threads(install_plan->zucchini_threads);
+  install_op_executor_.set_puffdiff_cache_size(
+      install_plan->puffdiff_cache_size);
+  install_op_executor_.set_source_readahead_size(
+      install_plan->source_readahead_size);
+  TEST_AND_RETURN_FALSE(install_op_executor_.SetZstdDictionary(
+      partition_update_.zstd_dictionary()));
+  TEST_AND_RETURN_FALSE(OpenSourcePartition(
+      source_slot, source_may_exist, install_plan->use_io_uring));
 
   // We shouldn't open the source partition in certain cases, e.g. some dynamic
   // partitions in delta payload, partitions included in the full payload for
@@ -165,7 +224,16 @@ bool PartitionWriter::Init(const InstallPlan* install_plan,
   LOG(INFO) << "Opening " << target_path_ << " partition with"
             << (interactive_ ? "out" : "") << " O_DSYNC";
 
-  target_fd_ = OpenFile(target_path_.c_str(), flags, true, &err);
+  target_fd_ = OpenFile(target_path_.c_str(),
+                        flags,
+                        true,
+                        install_plan->write_cache_size
+                            ? install_plan->write_cache_size
+                            : default_write_cache_size.load(),
+                        install_plan->write_behind_buffers,
+                        install_plan->use_io_uring,
+                        install_plan->drop_page_cache,
+                        &err);
   if (!target_fd_) {
     LOG(ERROR) << "Unable to open target partition "
                << partition.partition_name() << " on slot "
@@ -181,44 +249,196 @@ bool PartitionWriter::Init(const InstallPlan* install_plan,
   // Discard the end of the partition, but ignore failures.
   DiscardPartitionTail(target_fd_, install_part_.target_size);
 
+  // A partition written from its start doesn't need the zeros of its
+  // operations written. Not on Virtual A/B, where the target is a snapshot of
+  // the source, nor when the target is the source. The other instances
+  // applying the partition skip the zeros of the one which zeroed it.
+  if (!zeroed_blocks_shared_) {
+    zeroed_blocks_ = nullptr;
+    if (next_op_index == 0 && target_path_ != install_part_.source_path &&
+        !dynamic_control_->GetVirtualAbFeatureFlag().IsEnabled()) {
+      ZeroTargetBlocks();
+    }
+  }
+
   return true;
 }
 
 bool PartitionWriter::PerformReplaceOperation(const InstallOperation& operation,
                                               const void* data,
                                               size_t count) {
+  TEST_AND_RETURN_FALSE(FlushZeroOrDiscardBlocks(&operation));
   // Setup the ExtentWriter stack based on the operation type.
   std::unique_ptr<ExtentWriter> writer = CreateBaseExtentWriter();
-  return install_op_executor_.ExecuteReplaceOperation(
-      operation, std::move(writer), data);
+  TEST_AND_RETURN_FALSE(install_op_executor_.ExecuteReplaceOperation(
+      operation, std::move(writer), data));
+  StartWriteOut(operation);
+  return true;
+}
+
+void PartitionWriter::ZeroTargetBlocks() {
+  ExtentRanges written;
+  ExtentRanges written_twice;
+  // The blocks of the operations already applied, which aren't applied again.
+  ExtentRanges satisfied_blocks;
+  for (int i = 0; i < partition_update_.operations_size(); i++) {
+    const InstallOperation& operation = partition_update_.operations(i);
+    const bool satisfied =
+        satisfied_operations_ &&
+        satisfied_operations_->Get(first_operation_ + i) !=
+            SatisfiedOperations::Skip::kNone;
+    for (const Extent& extent : operation.dst_extents()) {
+      if (extent.start_block() == kSparseHole) {
+        continue;
+      }
+      if (satisfied) {
+        satisfied_blocks.AddExtent(extent);
+        continue;
+      }
+      for (const Extent& overlap : written.GetIntersectingExtents(extent)) {
+        written_twice.AddExtent(overlap);
+      }
+      written.AddExtent(extent);
+    }
+  }
+  written.SubtractRanges(satisfied_blocks);
+  if (written.blocks() == 0) {
+    return;
+  }
+  // Unlike BLKZEROOUT, punching a hole in a block device fails rather than
+  // writing the zeros if the device can't zero the blocks by unmapping them.
+  base::ScopedFD fd(
+      HANDLE_EINTR(open(target_path_.c_str(), O_WRONLY | O_CLOEXEC)));
+  if (!fd.is_valid()) {
+    return;
+  }
+  for (const Extent& extent : written.extent_set()) {
+    if (fallocate(fd.get(),
+                  FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  extent.start_block() * block_size_,
+                  extent.num_blocks() * block_size_) != 0) {
+      PLOG(INFO) << "Unable to zero " << target_path_
+                 << " without writing, writing the zeros of its operations";
+      return;
+    }
+  }
+  written.SubtractRanges(written_twice);
+  LOG(INFO) << "Zeroed " << target_path_ << ", skipping the zeros written to "
+            << written.blocks() << " of its blocks";
+  if (written.blocks() > 0) {
+    zeroed_blocks_ = std::make_shared<const ExtentRanges>(std::move(written));
+  }
+}
+
+bool PartitionWriter::IsZeroed(const Extent& extent) const {
+  if (!zeroed_blocks_) {
+    return false;
+  }
+  uint64_t blocks = 0;
+  for (const Extent& zeroed : zeroed_blocks_->GetIntersectingExtents(extent)) {
+    blocks += zeroed.num_blocks();
+  }
+  return blocks == extent.num_blocks();
 }
 
 bool PartitionWriter::PerformZeroOrDiscardOperation(
     const InstallOperation& operation) {
+  if (operation.type() == InstallOperation::ZERO &&
+      std::all_of(operation.dst_extents().begin(),
+                  operation.dst_extents().end(),
+                  [this](const Extent& extent) { return IsZeroed(extent); })) {
+    if (write_path_hasher_) {
+      for (const Extent& extent : operation.dst_extents()) {
+        write_path_hasher_->UpdateZeros(extent.start_block() * block_size_,
+                                        extent.num_blocks() * block_size_);
+      }
+    }
+    if (written_blocks_) {
+      written_blocks_->AddExtents(operation.dst_extents());
+    }
+    return true;
+  }
 #ifdef BLKZEROOUT
-  int request =
-      (operation.type() == InstallOperation::ZERO ? BLKZEROOUT : BLKDISCARD);
+  TEST_AND_RETURN_FALSE(operation.type() == InstallOperation::ZERO ||
+                        operation.type() == InstallOperation::DISCARD);
+  // Applied with the following ones, see FlushZeroOrDiscardBlocks().
+  auto& pending_blocks = operation.type() == InstallOperation::ZERO
+                             ? pending_zero_blocks_
+                             : pending_discard_blocks_;
+  pending_blocks.AddRepeatedExtents(operation.dst_extents());
+  if (write_path_hasher_ && operation.type() == InstallOperation::DISCARD) {
+    // Discarded blocks may not read back as zeros.
+    write_path_hasher_->Invalidate();
+  } else if (write_path_hasher_) {
+    for (const Extent& extent : operation.dst_extents()) {
+      write_path_hasher_->UpdateZeros(extent.start_block() * block_size_,
+                                      extent.num_blocks() * block_size_);
+    }
+  }
+  return true;
 #else   // !defined(BLKZEROOUT)
   auto writer = CreateBaseExtentWriter();
   return install_op_executor_.ExecuteZeroOrDiscardOperation(operation,
-                                                            writer.get());
+                                                            std::move(writer));
 #endif  // !defined(BLKZEROOUT)
+}
 
-  for (const Extent& extent : operation.dst_extents()) {
-    const uint64_t start = extent.start_block() * block_size_;
-    const uint64_t length = extent.num_blocks() * block_size_;
-    int result = 0;
-    if (target_fd_->BlkIoctl(request, start, length, &result) && result == 0) {
-      continue;
+bool PartitionWriter::FlushZeroOrDiscardBlocks(
+    const InstallOperation* operation) {
+#ifdef BLKZEROOUT
+  if (operation) {
+    // Operations write disjoint blocks, but don't rely on it for ordering.
+    const bool overlaps = std::any_of(
+        operation->dst_extents().begin(),
+        operation->dst_extents().end(),
+        [this](const Extent& extent) {
+          return pending_zero_blocks_.OverlapsWithExtent(extent) ||
+                 pending_discard_blocks_.OverlapsWithExtent(extent);
+        });
+    if (!overlaps) {
+      return true;
     }
-    // In case of failure, we fall back to writing 0 for the entire operation.
-    PLOG(WARNING) << "BlkIoctl failed. Falling back to write 0s for remainder "
-                     "of this operation.";
-    auto writer = CreateBaseExtentWriter();
-    return install_op_executor_.ExecuteZeroOrDiscardOperation(
-        operation, std::move(writer));
   }
+  // Unlike the discarded blocks, the zeroed ones have known content.
+  if (written_blocks_) {
+    written_blocks_->AddExtents(pending_zero_blocks_.extent_set());
+  }
+  return ZeroOrDiscardRanges(BLKZEROOUT, &pending_zero_blocks_) &&
+         ZeroOrDiscardRanges(BLKDISCARD, &pending_discard_blocks_);
+#else   // !defined(BLKZEROOUT)
   return true;
+#endif  // !defined(BLKZEROOUT)
+}
+
+bool PartitionWriter::ZeroOrDiscardRanges(int request, ExtentRanges* ranges) {
+  if (ranges->blocks() == 0) {
+    return true;
+  }
+  InstallOperation fallback;
+  fallback.set_type(InstallOperation::ZERO);
+  for (const Extent& extent : ranges->extent_set()) {
+    if (fallback.dst_extents_size() == 0) {
+      const uint64_t start = extent.start_block() * block_size_;
+      const uint64_t length = extent.num_blocks() * block_size_;
+      int result = 0;
+      if (target_fd_->BlkIoctl(request, start, length, &result) &&
+          result == 0) {
+        continue;
+      }
+      // In case of failure, we fall back to writing 0 for the remaining
+      // ranges.
+      PLOG(WARNING) << "BlkIoctl failed. Falling back to write 0s for "
+                       "remainder of the pending operations.";
+    }
+    *fallback.add_dst_extents() = extent;
+  }
+  *ranges = ExtentRanges();
+  if (fallback.dst_extents_size() == 0) {
+    return true;
+  }
+  // These blocks were recorded by |write_path_hasher_| when queued.
+  return install_op_executor_.ExecuteZeroOrDiscardOperation(
+      fallback, std::make_unique<DirectExtentWriter>(target_fd_));
 }
 
 bool PartitionWriter::PerformSourceCopyOperation(
@@ -245,9 +465,23 @@ bool PartitionWriter::PerformSourceCopyOperation(
       partition.partition_name(), operation, &buf);
   const InstallOperation& optimized = should_optimize ? buf : operation;
 
+  TEST_AND_RETURN_FALSE(FlushZeroOrDiscardBlocks(&optimized));
+  auto writer = CreateBaseExtentWriter();
+  TEST_AND_RETURN_FALSE(install_op_executor_.ExecuteSourceCopyOperation(
+      optimized, std::move(writer), source_fd));
+  StartWriteOut(optimized);
+  return true;
+}
+
+bool PartitionWriter::PerformTargetCopyOperation(
+    const InstallOperation& operation) {
+  // The blocks copied must be on the target, including the zeroed ones.
+  TEST_AND_RETURN_FALSE(FlushZeroOrDiscardBlocks());
   auto writer = CreateBaseExtentWriter();
-  return install_op_executor_.ExecuteSourceCopyOperation(
-      optimized, std::move(writer), source_fd);
+  TEST_AND_RETURN_FALSE(install_op_executor_.ExecuteSourceCopyOperation(
+      operation, std::move(writer), target_fd_));
+  StartWriteOut(operation);
+  return true;
 }
 
 bool PartitionWriter::PerformDiffOperation(const InstallOperation& operation,
@@ -257,9 +491,12 @@ bool PartitionWriter::PerformDiffOperation(const InstallOperation& operation,
   FileDescriptorPtr source_fd = ChooseSourceFD(operation, error);
   TEST_AND_RETURN_FALSE(source_fd != nullptr);
 
+  TEST_AND_RETURN_FALSE(FlushZeroOrDiscardBlocks(&operation));
   auto writer = CreateBaseExtentWriter();
-  return install_op_executor_.ExecuteDiffOperation(
-      operation, std::move(writer), source_fd, data, count);
+  TEST_AND_RETURN_FALSE(install_op_executor_.ExecuteDiffOperation(
+      operation, std::move(writer), source_fd, data, count));
+  StartWriteOut(operation);
+  return true;
 }
 
 FileDescriptorPtr PartitionWriter::ChooseSourceFD(
@@ -267,11 +504,20 @@ FileDescriptorPtr PartitionWriter::ChooseSourceFD(
   return verified_source_fd_.ChooseSourceFD(operation, error);
 }
 
+bool PartitionWriter::FinishedInstallOps() {
+  return FlushZeroOrDiscardBlocks();
+}
+
 int PartitionWriter::Close() {
   int err = 0;
 
   source_path_.clear();
 
+  // The pending blocks belong to operations already reported as applied.
+  if (target_fd_ && !FlushZeroOrDiscardBlocks()) {
+    err = errno ? errno : 1;
+    LOG(ERROR) << "Error zeroing or discarding the pending blocks";
+  }
   if (target_fd_ && !target_fd_->Close()) {
     err = errno;
     PLOG(ERROR) << "Error closing target partition";
@@ -284,14 +530,55 @@ int PartitionWriter::Close() {
   return -err;
 }
 
-void PartitionWriter::CheckpointUpdateProgress(size_t next_op_index) {
+bool PartitionWriter::CheckpointUpdateProgress(size_t next_op_index) {
   if (target_fd_) {
+    // The checkpoint can't claim the ZERO and DISCARD operations not applied.
+    TEST_AND_RETURN_FALSE(FlushZeroOrDiscardBlocks());
+    // The only barrier: the checkpoint stored next claims the data written.
     target_fd_->Flush();
+    bytes_since_write_out_ = 0;
   }
+  return true;
+}
+
+bool PartitionWriter::StartCheckpoint() {
+  if (target_fd_) {
+    TEST_AND_RETURN_FALSE(FlushZeroOrDiscardBlocks());
+    PLOG_IF(WARNING, !target_fd_->StartFlush())
+        << "Failed to start writing back " << target_path_;
+  }
+  return true;
+}
+
+bool PartitionWriter::FlushQueuedOperations() {
+  return FlushZeroOrDiscardBlocks();
+}
+
+void PartitionWriter::StartWriteOut(const InstallOperation& operation) {
+  // With O_DSYNC, the writes already reached the storage.
+  if (!interactive_) {
+    return;
+  }
+  bytes_since_write_out_ +=
+      utils::BlocksInExtents(operation.dst_extents()) * block_size_;
+  if (bytes_since_write_out_ < kWriteOutBytes) {
+    return;
+  }
+  bytes_since_write_out_ = 0;
+  PLOG_IF(WARNING, !target_fd_->StartFlush())
+      << "Failed to start writing back " << target_path_;
 }
 
 std::unique_ptr<ExtentWriter> PartitionWriter::CreateBaseExtentWriter() {
-  return std::make_unique<DirectExtentWriter>(target_fd_);
+  return std::make_unique<DirectExtentWriter>(
+      target_fd_,
+      write_path_hasher_,
+      zeroed_blocks_.get(),
+      written_blocks_);
+}
+
+void PartitionWriter::SetDefaultWriteCacheSize(size_t size) {
+  default_write_cache_size = size;
 }
 
 bool PartitionWriter::ValidateSourceHash(const InstallOperation& operation,
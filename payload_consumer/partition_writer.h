@@ -30,7 +30,10 @@
 #include "update_engine/payload_consumer/install_operation_executor.h"
 #include "update_engine/payload_consumer/install_plan.h"
 #include "update_engine/payload_consumer/partition_writer_interface.h"
+#include "update_engine/payload_consumer/satisfied_operations.h"
 #include "update_engine/payload_consumer/verified_source_fd.h"
+#include "update_engine/payload_consumer/worker_pool.h"
+#include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -42,6 +45,12 @@ class PartitionWriter : public PartitionWriterInterface {
                   size_t block_size,
                   bool is_interactive);
   ~PartitionWriter();
+
+  // Sets the size of the write cache of the target partitions opened from
+  // now on, unless the InstallPlan sets one. This is process wide, see
+  // ThrottleController.
+  static void SetDefaultWriteCacheSize(size_t size);
+
   static bool ValidateSourceHash(const brillo::Blob& calculated_hash,
                                  const InstallOperation& operation,
                                  const FileDescriptorPtr source_fd,
@@ -62,7 +71,9 @@ class PartitionWriter : public PartitionWriterInterface {
   // applied.
   //   |next_op_index| is index of next operation that should be applied.
   // |next_op_index-1| is the last operation that is already applied.
-  void CheckpointUpdateProgress(size_t next_op_index) override;
+  [[nodiscard]] bool CheckpointUpdateProgress(size_t next_op_index) override;
+  [[nodiscard]] bool StartCheckpoint() override;
+  [[nodiscard]] bool FlushQueuedOperations() override;
 
   // Close partition writer, when calling this function there's no guarantee
   // that all |InstallOperations| are sent to |PartitionWriter|. This function
@@ -84,28 +95,95 @@ class PartitionWriter : public PartitionWriterInterface {
                                           ErrorCode* error,
                                           const void* data,
                                           size_t count) override;
+  [[nodiscard]] bool PerformTargetCopyOperation(
+      const InstallOperation& operation) override;
 
   // |DeltaPerformer| calls this when all Install Ops are sent to partition
   // writer. No |Perform*Operation| methods will be called in the future, and
   // the partition writer is expected to be closed soon.
-  [[nodiscard]] bool FinishedInstallOps() override { return true; }
+  [[nodiscard]] bool FinishedInstallOps() override;
+
+  // Every instance opens its own source and target file descriptors, so
+  // operations writing disjoint target blocks can run concurrently.
+  bool SupportsConcurrentInstances() const override { return true; }
+
+  bool EnableWritePathHash(WritePathHasher* hasher) override {
+    write_path_hasher_ = hasher;
+    return true;
+  }
+
+  bool EnableWrittenBlocks(BlockBitmap* written_blocks) override {
+    written_blocks_ = written_blocks;
+    return true;
+  }
+
+  uint64_t SourceCacheSavedBytes() const override {
+    return verified_source_fd_.source_cache_saved_bytes();
+  }
+
+  void SetSourceVerifier(SourceVerifier* verifier) override {
+    verified_source_fd_.set_source_verifier(verifier);
+  }
+
+  bool ParallelFor(size_t count,
+                   const std::function<bool(size_t)>& task) override {
+    return install_op_executor_.ParallelFor(count, task);
+  }
+
+  void SetSatisfiedOperations(const SatisfiedOperations* satisfied,
+                              size_t first_operation) override {
+    satisfied_operations_ = satisfied;
+    first_operation_ = first_operation;
+  }
+
+  std::shared_ptr<const ExtentRanges> ZeroedBlocks() const override {
+    return zeroed_blocks_;
+  }
+  void SetZeroedBlocks(std::shared_ptr<const ExtentRanges> blocks) override {
+    zeroed_blocks_ = std::move(blocks);
+    zeroed_blocks_shared_ = true;
+  }
 
  private:
   friend class PartitionWriterTest;
   FRIEND_TEST(PartitionWriterTest, ChooseSourceFDTest);
+  FRIEND_TEST(PartitionWriterTest, ChooseSourceFDFromMemoryTest);
 
   [[nodiscard]] bool OpenSourcePartition(uint32_t source_slot,
-                                         bool source_may_exist);
+                                         bool source_may_exist,
+                                         bool use_io_uring);
   FileDescriptorPtr ChooseSourceFD(const InstallOperation& op,
                                    ErrorCode* error);
 
   [[nodiscard]] std::unique_ptr<ExtentWriter> CreateBaseExtentWriter();
 
+  // Starts writing back the target data once |kWriteOutBytes| of it were
+  // written by operations since the last time, including |operation|.
+  void StartWriteOut(const InstallOperation& operation);
+
+  // Zeroes the blocks written by the operations of the partition without
+  // writing them, if the device supports it, and records in |zeroed_blocks_|
+  // the ones only one operation writes. The blocks of the satisfied
+  // operations are left alone.
+  void ZeroTargetBlocks();
+  // Returns whether all the blocks of |extent| are in |zeroed_blocks_|.
+  bool IsZeroed(const Extent& extent) const;
+
+  // Zeroes or discards the pending ZERO and DISCARD blocks. If |operation| is
+  // given, only does so if it writes some of them.
+  [[nodiscard]] bool FlushZeroOrDiscardBlocks(
+      const InstallOperation* operation = nullptr);
+  // Runs the |request| ioctl over the merged |ranges|, falling back to writing
+  // zeros once it fails, and clears them.
+  [[nodiscard]] bool ZeroOrDiscardRanges(int request, ExtentRanges* ranges);
+
   const PartitionUpdate& partition_update_;
   const InstallPlan::Partition& install_part_;
   DynamicPartitionControlInterface* dynamic_control_;
   // Path to source partition
   std::string source_path_;
+  // Shared by the steps of the operations applied, created by Init().
+  std::unique_ptr<WorkerPool> worker_pool_;
   VerifiedSourceFd verified_source_fd_;
   // Path to target partition
   std::string target_path_;
@@ -117,6 +195,31 @@ class PartitionWriter : public PartitionWriterInterface {
   // constructing data which should be written to target partition, actual
   // "writing" is handled by |PartitionWriter|
   InstallOperationExecutor install_op_executor_;
+
+  // The blocks of the ZERO and DISCARD operations not applied yet. These
+  // operations are usually small and many, so they are merged into maximal
+  // ranges and applied with a few ioctls on checkpoints.
+  ExtentRanges pending_zero_blocks_;
+  ExtentRanges pending_discard_blocks_;
+
+  // The blocks which read as zeros since Init() and that only one operation
+  // writes, so the zeros it writes to them are skipped. Null if none.
+  std::shared_ptr<const ExtentRanges> zeroed_blocks_;
+  // Whether |zeroed_blocks_| was set by SetZeroedBlocks().
+  bool zeroed_blocks_shared_{false};
+
+  // The operations already applied, see SetSatisfiedOperations().
+  const SatisfiedOperations* satisfied_operations_{nullptr};
+  size_t first_operation_{0};
+
+  // If not null, records the data written to the target partition.
+  WritePathHasher* write_path_hasher_{nullptr};
+  // If not null, records the blocks written to the target partition.
+  BlockBitmap* written_blocks_{nullptr};
+
+  // The bytes written by the operations since the target data was last
+  // written back.
+  uint64_t bytes_since_write_out_{0};
 };
 
 namespace partition_writer {
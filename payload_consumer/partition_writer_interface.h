@@ -18,15 +18,25 @@
 #define UPDATE_ENGINE_PARTITION_WRITER_INTERFACE_H_
 
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
 
 #include <brillo/secure_blob.h>
 #include <gtest/gtest_prod.h>
 
 #include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/write_path_hasher.h"
+#include "update_engine/payload_generator/block_bitmap.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
+
+class ExtentRanges;
+class SatisfiedOperations;
+class SourceVerifier;
+struct VABCCowPlan;
+
 class PartitionWriterInterface {
  public:
   virtual ~PartitionWriterInterface() = default;
@@ -37,12 +47,51 @@ class PartitionWriterInterface {
                                   bool source_may_exist,
                                   size_t next_op_index) = 0;
 
+  // Hands the writer the plan of its COW computed ahead of time, see
+  // VABCPartitionWriter::ComputeCowPlan(), before Init() is called. Writers
+  // which don't write a COW ignore it.
+  virtual void SetCowPlan(std::shared_ptr<VABCCowPlan> /* cow_plan */) {}
+
+  // Tells the writer, before Init() is called, which operations of the
+  // partition are already applied and won't be, see
+  // InstallPlan::skip_satisfied_operations. The operations of the partition
+  // start at index |first_operation| of |satisfied|, which must outlive the
+  // writer.
+  virtual void SetSatisfiedOperations(
+      const SatisfiedOperations* /* satisfied */,
+      size_t /* first_operation */) {}
+
+  // The blocks of the target which Init() zeroed without writing them, and
+  // whose zeros the operations skip, or null.
+  virtual std::shared_ptr<const ExtentRanges> ZeroedBlocks() const {
+    return nullptr;
+  }
+  // Makes Init() skip the zeros of |blocks|, the ZeroedBlocks() of the writer
+  // of the partition initialized first, instead of zeroing the target again.
+  // Used by the concurrent instances applying the same partition.
+  virtual void SetZeroedBlocks(
+      std::shared_ptr<const ExtentRanges> /* blocks */) {}
+
   // |CheckpointUpdateProgress| will be called after SetNextOpIndex(), but it's
   // optional. DeltaPerformer may or may not call this everytime an operation is
   // applied.
   //   |next_op_index| is index of next operation that should be applied.
   // |next_op_index-1| is the last operation that is already applied.
-  virtual void CheckpointUpdateProgress(size_t next_op_index) = 0;
+  // Returns false if the data of the applied operations couldn't be written,
+  // in which case no checkpoint may claim them.
+  [[nodiscard]] virtual bool CheckpointUpdateProgress(size_t next_op_index) = 0;
+
+  // Starts writing back the data of the operations applied so far, without
+  // waiting for it, before CheckpointUpdateProgress() is called. Checkpointing
+  // several writers at once starts them all first, so that they write back
+  // their data at the same time instead of in turn. Returns false like
+  // CheckpointUpdateProgress().
+  [[nodiscard]] virtual bool StartCheckpoint() { return true; }
+
+  // Applies the operations held back to be merged with the following ones,
+  // e.g. ZERO operations, before another writer of the same partition writes
+  // to their blocks. Returns whether they were applied.
+  [[nodiscard]] virtual bool FlushQueuedOperations() { return true; }
 
   // Close partition writer, when calling this function there's no guarantee
   // that all |InstallOperations| are sent to |PartitionWriter|. This function
@@ -64,11 +113,59 @@ class PartitionWriterInterface {
       ErrorCode* error,
       const void* data,
       size_t count) = 0;
+  // Copies blocks of the target partition written by earlier operations.
+  // Writers which can't read the target back don't support it.
+  [[nodiscard]] virtual bool PerformTargetCopyOperation(
+      const InstallOperation& /* operation */) {
+    return false;
+  }
 
   // |DeltaPerformer| calls this when all Install Ops are sent to partition
   // writer. No |Perform*Operation| methods will be called in the future, and
   // the partition writer is expected to be closed soon.
   [[nodiscard]] virtual bool FinishedInstallOps() = 0;
+
+  // Whether several instances of this writer may be opened on the same
+  // partition and fed non-overlapping operations from different threads.
+  virtual bool SupportsConcurrentInstances() const { return false; }
+
+  // Records the data written to the target partition from now on with
+  // |hasher|, which must outlive the writer. Returns false if the writer
+  // doesn't write the data itself, in which case |hasher| isn't used.
+  virtual bool EnableWritePathHash(WritePathHasher* /* hasher */) {
+    return false;
+  }
+
+  // Adds the blocks of the target partition written from now on to
+  // |written_blocks|, which must outlive the writer. Returns false if the
+  // writer doesn't write the blocks itself, in which case |written_blocks|
+  // isn't used.
+  virtual bool EnableWrittenBlocks(BlockBitmap* /* written_blocks */) {
+    return false;
+  }
+
+  // Number of bytes of the source partition served from the source cache
+  // instead of being read from the device, see
+  // InstallPlan::source_cache_size.
+  virtual uint64_t SourceCacheSavedBytes() const { return 0; }
+
+  // Lets the writer skip hashing the sources |verifier| verified ahead, see
+  // InstallPlan::early_source_verification. |verifier| must outlive the
+  // writer.
+  virtual void SetSourceVerifier(SourceVerifier* /* verifier */) {}
+
+  // Runs |task(i)| for every |i| in [0, |count|), on the WorkerPool the writer
+  // applies the operations with if it has one, see
+  // InstallOperationExecutor::ParallelFor(). Returns whether all the calls
+  // returned true. Must not be called while an operation is applied.
+  virtual bool ParallelFor(size_t count,
+                           const std::function<bool(size_t)>& task) {
+    bool success = true;
+    for (size_t i = 0; i < count; i++) {
+      success = task(i) && success;
+    }
+    return success;
+  }
 };
 }  // namespace chromeos_update_engine
 
@@ -14,9 +14,14 @@
 // limitations under the License.
 //
 
+#include <fcntl.h>
+
+#include <algorithm>
 #include <memory>
 #include <vector>
 
+#include <base/files/file_util.h>
+#include <base/files/scoped_file.h>
 #include <brillo/secure_blob.h>
 #include <gtest/gtest.h>
 
@@ -32,6 +37,8 @@
 #include "update_engine/payload_consumer/install_plan.h"
 #include "update_engine/payload_consumer/partition_writer.h"
 #include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_consumer/satisfied_operations.h"
+#include "update_engine/payload_consumer/worker_pool.h"
 #include "update_engine/payload_generator/annotated_operation.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/extent_ranges.h"
@@ -107,7 +114,7 @@ class PartitionWriterTest : public testing::Test {
       return {};
     }
     EXPECT_TRUE(writer_.PerformSourceCopyOperation(op, &error));
-    writer_.CheckpointUpdateProgress(1);
+    EXPECT_TRUE(writer_.CheckpointUpdateProgress(1));
 
     brillo::Blob output_data;
     EXPECT_TRUE(utils::ReadFile(target_partition.path(), &output_data));
@@ -217,4 +224,257 @@ TEST_F(PartitionWriterTest, ChooseSourceFDTest) {
   ASSERT_EQ(1U, GetSourceEccRecoveredFailures());
 }
 
+TEST_F(PartitionWriterTest, ChooseSourceFDFromMemoryTest) {
+  // Large enough to be read by several threads.
+  constexpr size_t kSourceBlocks = 2048;
+  ScopedTempFile source("Source-XXXXXX");
+  brillo::Blob source_data(kSourceBlocks * 4096);
+  test_utils::FillWithData(&source_data);
+  ASSERT_TRUE(test_utils::WriteFileVector(source.path(), source_data));
+
+  auto& verified_source_fd = writer_.verified_source_fd_;
+  WorkerPool worker_pool(2);
+  verified_source_fd.set_worker_pool(&worker_pool);
+  verified_source_fd.source_read_threads_ = 2;
+  for (size_t i = 0; i < 2; i++) {
+    auto fd = std::make_shared<EintrSafeFileDescriptor>();
+    ASSERT_TRUE(fd->Open(source.path().c_str(), O_RDONLY));
+    verified_source_fd.reader_fds_.push_back(fd);
+  }
+  verified_source_fd.source_fd_ = verified_source_fd.reader_fds_[0];
+
+  // Out of order extents, reading the second half of the source first.
+  InstallOperation op;
+  *(op.add_src_extents()) =
+      ExtentForRange(kSourceBlocks / 2, kSourceBlocks / 2);
+  *(op.add_src_extents()) = ExtentForRange(0, kSourceBlocks / 2);
+  brillo::Blob expected_data;
+  ASSERT_TRUE(utils::ReadExtents(
+      source.path(), op.src_extents(), &expected_data, 4096));
+  brillo::Blob src_hash;
+  ASSERT_TRUE(HashCalculator::RawHashOfData(expected_data, &src_hash));
+  op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+
+  ErrorCode error = ErrorCode::kSuccess;
+  FileDescriptorPtr fd = writer_.ChooseSourceFD(op, &error);
+  ASSERT_NE(fd, nullptr);
+  ASSERT_EQ(ErrorCode::kSuccess, error);
+  // The operation reads its source from memory, not from the partition.
+  ASSERT_NE(fd, verified_source_fd.source_fd_);
+  brillo::Blob read_data;
+  ASSERT_TRUE(utils::ReadExtents(fd, op.src_extents(), &read_data, 4096));
+  ASSERT_EQ(expected_data, read_data);
+}
+
+TEST_F(PartitionWriterTest, ChooseSourceFDVerifiesSourceOnceTest) {
+  brillo::Blob source_data(4 * kBlockSize);
+  test_utils::FillWithData(&source_data);
+  ASSERT_TRUE(
+      test_utils::WriteFileVector(source_partition.path(), source_data));
+  auto& verified_source_fd = writer_.verified_source_fd_;
+  ASSERT_TRUE(verified_source_fd.Open());
+
+  InstallOperation op;
+  *(op.add_src_extents()) = ExtentForRange(0, 4);
+  brillo::Blob src_hash;
+  ASSERT_TRUE(HashCalculator::RawHashOfData(source_data, &src_hash));
+  op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+
+  ErrorCode error = ErrorCode::kSuccess;
+  ASSERT_EQ(writer_.ChooseSourceFD(op, &error), verified_source_fd.source_fd_);
+  ASSERT_EQ(verified_source_fd.verified_source_hits_, 0U);
+  ASSERT_EQ(writer_.ChooseSourceFD(op, &error), verified_source_fd.source_fd_);
+  ASSERT_EQ(verified_source_fd.verified_source_hits_, 1U);
+
+  // Once the source partition changes, its hash is verified again.
+  SetFakeECCFile(source_data.size());
+  brillo::Blob invalid_data(source_data.size(), 0x55);
+  ASSERT_TRUE(
+      test_utils::WriteFileVector(source_partition.path(), invalid_data));
+  const base::Time mtime = base::Time::Now() + base::TimeDelta::FromHours(1);
+  ASSERT_TRUE(
+      base::TouchFile(base::FilePath(source_partition.path()), mtime, mtime));
+  ASSERT_EQ(writer_.ChooseSourceFD(op, &error), nullptr);
+  ASSERT_EQ(verified_source_fd.verified_source_hits_, 1U);
+}
+
+TEST_F(PartitionWriterTest, ZeroOperationsAreBatchedTest) {
+  constexpr size_t kTargetBlocks = 8;
+  brillo::Blob expected_data(kTargetBlocks * kBlockSize, 'a');
+  ASSERT_TRUE(
+      test_utils::WriteFileVector(target_partition.path(), expected_data));
+  install_part_.target_size = expected_data.size();
+  ASSERT_TRUE(writer_.Init(&install_plan_, false, 0));
+
+  InstallOperation zero_op;
+  zero_op.set_type(InstallOperation::ZERO);
+  *zero_op.add_dst_extents() = ExtentForRange(1, 1);
+  *zero_op.add_dst_extents() = ExtentForRange(5, 1);
+  ASSERT_TRUE(writer_.PerformZeroOrDiscardOperation(zero_op));
+  InstallOperation discard_op;
+  discard_op.set_type(InstallOperation::DISCARD);
+  *discard_op.add_dst_extents() = ExtentForRange(2, 2);
+  ASSERT_TRUE(writer_.PerformZeroOrDiscardOperation(discard_op));
+
+  // Nothing is zeroed until the next checkpoint.
+  brillo::Blob output_data;
+  ASSERT_TRUE(utils::ReadFile(target_partition.path(), &output_data));
+  ASSERT_EQ(expected_data, output_data);
+
+  // An operation writing pending blocks is applied after them.
+  zero_op.clear_dst_extents();
+  *zero_op.add_dst_extents() = ExtentForRange(6, 1);
+  ASSERT_TRUE(writer_.PerformZeroOrDiscardOperation(zero_op));
+  brillo::Blob replace_data(kBlockSize, 'b');
+  InstallOperation replace_op;
+  replace_op.set_type(InstallOperation::REPLACE);
+  replace_op.set_data_length(replace_data.size());
+  *replace_op.add_dst_extents() = ExtentForRange(6, 1);
+  ASSERT_TRUE(writer_.PerformReplaceOperation(
+      replace_op, replace_data.data(), replace_data.size()));
+  ASSERT_TRUE(writer_.CheckpointUpdateProgress(4));
+
+  // Regular files don't support the ioctls, zeros are written instead.
+  std::fill_n(expected_data.begin() + kBlockSize, 3 * kBlockSize, 0);
+  std::fill_n(expected_data.begin() + 5 * kBlockSize, kBlockSize, 0);
+  std::fill_n(expected_data.begin() + 6 * kBlockSize, kBlockSize, 'b');
+  ASSERT_TRUE(utils::ReadFile(target_partition.path(), &output_data));
+  ASSERT_EQ(expected_data, output_data);
+}
+
+TEST_F(PartitionWriterTest, ZerosOfZeroedTargetAreSkippedTest) {
+  constexpr size_t kTargetBlocks = 6;
+  brillo::Blob expected_data(kTargetBlocks * kBlockSize, 'a');
+  ASSERT_TRUE(
+      test_utils::WriteFileVector(target_partition.path(), expected_data));
+  install_part_.target_size = expected_data.size();
+
+  brillo::Blob replace_data(2 * kBlockSize, 0);
+  std::fill_n(replace_data.begin() + kBlockSize, kBlockSize, 'b');
+  InstallOperation* replace_op = partition_update_.add_operations();
+  replace_op->set_type(InstallOperation::REPLACE);
+  replace_op->set_data_length(replace_data.size());
+  *replace_op->add_dst_extents() = ExtentForRange(0, 2);
+  InstallOperation* zero_op = partition_update_.add_operations();
+  zero_op->set_type(InstallOperation::ZERO);
+  *zero_op->add_dst_extents() = ExtentForRange(2, 1);
+  // Block 3 is written twice, its zeros must be written.
+  InstallOperation* twice_zero_op = partition_update_.add_operations();
+  twice_zero_op->set_type(InstallOperation::ZERO);
+  *twice_zero_op->add_dst_extents() = ExtentForRange(3, 1);
+  brillo::Blob twice_data(kBlockSize, 'c');
+  InstallOperation* twice_replace_op = partition_update_.add_operations();
+  twice_replace_op->set_type(InstallOperation::REPLACE);
+  twice_replace_op->set_data_length(twice_data.size());
+  *twice_replace_op->add_dst_extents() = ExtentForRange(3, 1);
+  ASSERT_TRUE(writer_.Init(&install_plan_, false, 0));
+
+  // The blocks the operations write are zeroed, the others are left alone.
+  std::fill_n(expected_data.begin(), 4 * kBlockSize, 0);
+  brillo::Blob output_data;
+  ASSERT_TRUE(utils::ReadFile(target_partition.path(), &output_data));
+  ASSERT_EQ(expected_data, output_data);
+
+  // Mark the zeroed blocks to tell whether the operations write them.
+  const brillo::Blob marker(kBlockSize, 'x');
+  base::ScopedFD fd(open(target_partition.path().c_str(), O_WRONLY));
+  ASSERT_TRUE(fd.is_valid());
+  ASSERT_TRUE(utils::PWriteAll(fd.get(), marker.data(), marker.size(), 0));
+  ASSERT_TRUE(utils::PWriteAll(
+      fd.get(), marker.data(), marker.size(), 2 * kBlockSize));
+  ASSERT_TRUE(writer_.PerformReplaceOperation(
+      *replace_op, replace_data.data(), replace_data.size()));
+  ASSERT_TRUE(writer_.PerformZeroOrDiscardOperation(*zero_op));
+  ASSERT_TRUE(writer_.PerformZeroOrDiscardOperation(*twice_zero_op));
+  ASSERT_TRUE(writer_.PerformReplaceOperation(
+      *twice_replace_op, twice_data.data(), twice_data.size()));
+  ASSERT_TRUE(writer_.CheckpointUpdateProgress(4));
+
+  std::fill_n(expected_data.begin(), kBlockSize, 'x');
+  std::fill_n(expected_data.begin() + kBlockSize, kBlockSize, 'b');
+  std::fill_n(expected_data.begin() + 2 * kBlockSize, kBlockSize, 'x');
+  std::fill_n(expected_data.begin() + 3 * kBlockSize, kBlockSize, 'c');
+  ASSERT_TRUE(utils::ReadFile(target_partition.path(), &output_data));
+  ASSERT_EQ(expected_data, output_data);
+}
+
+TEST_F(PartitionWriterTest, BlocksOfSatisfiedOperationsAreNotZeroedTest) {
+  constexpr size_t kTargetBlocks = 4;
+  brillo::Blob expected_data(kTargetBlocks * kBlockSize, 'a');
+  // Blocks 0 and 1 already hold the data of the REPLACE operation.
+  const brillo::Blob replace_data(2 * kBlockSize, 'b');
+  std::copy(replace_data.begin(), replace_data.end(), expected_data.begin());
+  ASSERT_TRUE(
+      test_utils::WriteFileVector(target_partition.path(), expected_data));
+  install_part_.target_size = expected_data.size();
+
+  brillo::Blob replace_hash;
+  ASSERT_TRUE(HashCalculator::RawHashOfData(replace_data, &replace_hash));
+  InstallOperation* replace_op = partition_update_.add_operations();
+  replace_op->set_type(InstallOperation::REPLACE);
+  replace_op->set_data_length(replace_data.size());
+  *replace_op->add_dst_extents() = ExtentForRange(0, 2);
+  replace_op->set_dst_sha256_hash(replace_hash.data(), replace_hash.size());
+  InstallOperation* zero_op = partition_update_.add_operations();
+  zero_op->set_type(InstallOperation::ZERO);
+  *zero_op->add_dst_extents() = ExtentForRange(2, 1);
+
+  SatisfiedOperations satisfied;
+  FileDescriptorPtr target_fd = std::make_shared<EintrSafeFileDescriptor>();
+  ASSERT_TRUE(target_fd->Open(target_partition.path().c_str(), O_RDONLY));
+  ASSERT_EQ(1U,
+            satisfied.CheckPartition(
+                partition_update_, 0, target_fd, kBlockSize));
+  target_fd->Close();
+  writer_.SetSatisfiedOperations(&satisfied, 0);
+  ASSERT_TRUE(writer_.Init(&install_plan_, false, 0));
+
+  // The REPLACE operation is skipped, so only the block of the ZERO operation
+  // is zeroed.
+  std::fill_n(expected_data.begin() + 2 * kBlockSize, kBlockSize, 0);
+  brillo::Blob output_data;
+  ASSERT_TRUE(utils::ReadFile(target_partition.path(), &output_data));
+  ASSERT_EQ(expected_data, output_data);
+
+  ASSERT_TRUE(writer_.PerformZeroOrDiscardOperation(*zero_op));
+  ASSERT_TRUE(writer_.CheckpointUpdateProgress(2));
+  ASSERT_TRUE(utils::ReadFile(target_partition.path(), &output_data));
+  ASSERT_EQ(expected_data, output_data);
+}
+
+TEST_F(PartitionWriterTest, ConcurrentInstancesShareZeroedBlocksTest) {
+  constexpr size_t kTargetBlocks = 2;
+  brillo::Blob expected_data(kTargetBlocks * kBlockSize, 'a');
+  ASSERT_TRUE(
+      test_utils::WriteFileVector(target_partition.path(), expected_data));
+  install_part_.target_size = expected_data.size();
+
+  InstallOperation* zero_op = partition_update_.add_operations();
+  zero_op->set_type(InstallOperation::ZERO);
+  *zero_op->add_dst_extents() = ExtentForRange(0, 1);
+  ASSERT_TRUE(writer_.Init(&install_plan_, false, 0));
+  std::shared_ptr<const ExtentRanges> zeroed_blocks = writer_.ZeroedBlocks();
+  ASSERT_NE(nullptr, zeroed_blocks);
+  EXPECT_TRUE(zeroed_blocks->ContainsBlock(0));
+
+  // Mark the zeroed block to tell whether another instance zeroes it again.
+  const brillo::Blob marker(kBlockSize, 'x');
+  base::ScopedFD fd(open(target_partition.path().c_str(), O_WRONLY));
+  ASSERT_TRUE(fd.is_valid());
+  ASSERT_TRUE(utils::PWriteAll(fd.get(), marker.data(), marker.size(), 0));
+
+  PartitionWriter other_writer{
+      partition_update_, install_part_, &dynamic_control_, kBlockSize, false};
+  other_writer.SetZeroedBlocks(zeroed_blocks);
+  ASSERT_TRUE(other_writer.Init(&install_plan_, false, 0));
+  EXPECT_EQ(zeroed_blocks, other_writer.ZeroedBlocks());
+  ASSERT_TRUE(other_writer.PerformZeroOrDiscardOperation(*zero_op));
+  ASSERT_TRUE(other_writer.CheckpointUpdateProgress(1));
+
+  std::fill_n(expected_data.begin(), kBlockSize, 'x');
+  brillo::Blob output_data;
+  ASSERT_TRUE(utils::ReadFile(target_partition.path(), &output_data));
+  ASSERT_EQ(expected_data, output_data);
+}
+
 }  // namespace chromeos_update_engine
@@ -37,7 +37,8 @@ const uint32_t kPartialUpdateMinorPayloadVersion = 7;
 const uint32_t kZucchiniMinorPayloadVersion = 8;
 
 const uint32_t kMinSupportedMinorPayloadVersion = kSourceMinorPayloadVersion;
-const uint32_t kMaxSupportedMinorPayloadVersion = kLZ4DIFFMinorPayloadVersion;
+const uint32_t kMaxSupportedMinorPayloadVersion =
+    kTargetCopyMinorPayloadVersion;
 
 const uint64_t kMaxPayloadHeaderSize = 24;
 
@@ -72,6 +73,10 @@ const char* InstallOperationTypeName(InstallOperation::Type op_type) {
       return "LZ4DIFF_BSDIFF";
     case InstallOperation::LZ4DIFF_PUFFDIFF:
       return "LZ4DIFF_PUFFIDFF";
+    case InstallOperation::REPLACE_ZSTD:
+      return "REPLACE_ZSTD";
+    case InstallOperation::TARGET_COPY:
+      return "TARGET_COPY";
     case InstallOperation::BSDIFF:
     case InstallOperation::MOVE:
       NOTREACHED();
@@ -65,6 +65,12 @@ extern const uint32_t kZucchiniMinorPayloadVersion;
 // THe minor version that allows LZ4DIFF operation
 constexpr uint32_t kLZ4DIFFMinorPayloadVersion = 9;
 
+// The minor version that allows REPLACE_ZSTD operation.
+constexpr uint32_t kZstdMinorPayloadVersion = 10;
+
+// The minor version that allows TARGET_COPY operation.
+constexpr uint32_t kTargetCopyMinorPayloadVersion = 11;
+
 // The minimum and maximum supported minor version.
 extern const uint32_t kMinSupportedMinorPayloadVersion;
 extern const uint32_t kMaxSupportedMinorPayloadVersion;
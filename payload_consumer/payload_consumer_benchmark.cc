@@ -0,0 +1,785 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Benchmarks of the payload_consumer hot paths over synthetic partitions:
+// DeltaPerformer::Write and InstallOperationExecutor per operation type, the
+// ExtentWriter variants, HashCalculator and FilesystemVerifierAction. The
+// partitions are temporary files, so point TMPDIR at a tmpfs to leave the
+// storage out of the numbers. The loop device cases need root.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+#include <base/bind.h>
+#include <base/logging.h>
+#if BASE_VER < 780000  // Android
+#include <base/message_loop/message_loop.h>
+#endif  // BASE_VER < 780000
+#if BASE_VER >= 780000  // CrOS
+#include <base/task/single_thread_task_executor.h>
+#endif  // BASE_VER >= 780000
+#include <benchmark/benchmark.h>
+#include <brillo/message_loops/base_message_loop.h>
+#include <brillo/message_loops/message_loop.h>
+#include <brillo/secure_blob.h>
+#include <libsnapshot/cow_writer.h>
+
+#include "update_engine/common/action_processor.h"
+#include "update_engine/common/dynamic_partition_control_stub.h"
+#include "update_engine/common/fake_boot_control.h"
+#include "update_engine/common/fake_hardware.h"
+#include "update_engine/common/fake_prefs.h"
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/cached_file_descriptor.h"
+#include "update_engine/payload_consumer/decoder_pool.h"
+#include "update_engine/payload_consumer/delta_performer.h"
+#include "update_engine/payload_consumer/extent_map.h"
+#include "update_engine/payload_consumer/extent_writer.h"
+#include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_consumer/filesystem_verifier_action.h"
+#include "update_engine/payload_consumer/flat_extent_map.h"
+#include "update_engine/payload_consumer/install_operation_executor.h"
+#include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_consumer/snapshot_extent_writer.h"
+#include "update_engine/payload_consumer/xor_extent_writer.h"
+#include "update_engine/payload_generator/bzip.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/merge_sequence_generator.h"
+#include "update_engine/payload_generator/payload_file.h"
+#include "update_engine/payload_generator/xz.h"
+#include "update_engine/payload_generator/zstd.h"
+
+using brillo::MessageLoop;
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr size_t kBlockSize = 4096;
+// The blocks of each operation, and of the partitions the operations and the
+// extent writers are measured on.
+constexpr size_t kOperationBlocks = 256;
+constexpr size_t kPartitionBlocks = 16 * kOperationBlocks;
+constexpr size_t kPartitionSize = kPartitionBlocks * kBlockSize;
+// The size of the partition hashed by FilesystemVerifierAction.
+constexpr size_t kVerifyPartitionSize = 64 * 1024 * 1024;
+// The size of the writes into DeltaPerformer, as if from the HTTP fetcher.
+constexpr size_t kPayloadChunkSize = 256 * 1024;
+constexpr size_t kCacheSize = 1024 * 1024;
+constexpr uint32_t kCowVersion = 2;
+
+// Returns |size| bytes, half of each block random and half constant, so that
+// the data compresses about as well as a typical partition.
+brillo::Blob GenerateData(size_t size, uint32_t seed) {
+  std::mt19937 gen(seed);
+  brillo::Blob data(size);
+  for (size_t i = 0; i < size; i++) {
+    const bool random = i % kBlockSize < kBlockSize / 2;
+    data[i] = random ? gen() : i / kBlockSize;
+  }
+  return data;
+}
+
+// Returns |source| with a few bytes of each block changed, as the target of
+// the diff operations.
+brillo::Blob MutateData(const brillo::Blob& source, uint32_t seed) {
+  constexpr size_t kChangesPerBlock = 64;
+  std::mt19937 gen(seed);
+  brillo::Blob target = source;
+  for (size_t block = 0; block < target.size() / kBlockSize; block++) {
+    for (size_t i = 0; i < kChangesPerBlock; i++)
+      target[block * kBlockSize + gen() % kBlockSize] = gen();
+  }
+  return target;
+}
+
+ScopedTempFile* CreatePartition(const brillo::Blob& data) {
+  auto file = new ScopedTempFile("Partition-XXXXXX", true);
+  CHECK(utils::WriteAll(file->fd(), data.data(), data.size()));
+  return file;
+}
+
+FileDescriptorPtr OpenPartition(const string& path, int flags) {
+  FileDescriptorPtr fd = std::make_shared<EintrSafeFileDescriptor>();
+  CHECK(fd->Open(path.c_str(), flags));
+  return fd;
+}
+
+uint32_t MinorVersionFor(InstallOperation::Type type) {
+  switch (type) {
+    case InstallOperation::BROTLI_BSDIFF:
+      return kBrotliBsdiffMinorPayloadVersion;
+    case InstallOperation::ZUCCHINI:
+      return kZucchiniMinorPayloadVersion;
+    default:
+      return kSourceMinorPayloadVersion;
+  }
+}
+
+// Fills |aop| and |blob| with an operation of |type| writing |target| to the
+// blocks at |start_block| from |source| at the same blocks. ZERO and
+// SOURCE_COPY operations don't produce |target|.
+bool MakeOperation(InstallOperation::Type type,
+                   const brillo::Blob& source,
+                   const brillo::Blob& target,
+                   uint64_t start_block,
+                   AnnotatedOperation* aop,
+                   brillo::Blob* blob) {
+  const vector<Extent> extents{
+      ExtentForRange(start_block, target.size() / kBlockSize)};
+  aop->name = "benchmark.so";
+  aop->op.set_type(type);
+  *aop->op.add_dst_extents() = extents[0];
+  blob->clear();
+  switch (type) {
+    case InstallOperation::REPLACE:
+      *blob = target;
+      break;
+    case InstallOperation::REPLACE_BZ:
+      TEST_AND_RETURN_FALSE(BzipCompress(target, blob));
+      break;
+    case InstallOperation::REPLACE_XZ:
+      TEST_AND_RETURN_FALSE(XzCompress(target, blob));
+      break;
+    case InstallOperation::REPLACE_ZSTD:
+      TEST_AND_RETURN_FALSE(ZstdCompress(target, nullptr, blob));
+      break;
+    case InstallOperation::ZERO:
+      break;
+    case InstallOperation::SOURCE_COPY:
+      *aop->op.add_src_extents() = extents[0];
+      break;
+    default: {
+      *aop->op.add_src_extents() = extents[0];
+      PayloadGenerationConfig config{
+          .version = PayloadVersion(kBrilloMajorPayloadVersion,
+                                    MinorVersionFor(type))};
+      const FilesystemInterface::File empty;
+      diff_utils::BestDiffGenerator generator(
+          source, target, extents, extents, empty, empty, config);
+      // Any patch smaller than the target is chosen over it.
+      *blob = target;
+      TEST_AND_RETURN_FALSE(generator.GenerateBestDiffOperation(
+          {{type, kOperationBlocks * kBlockSize}}, aop, blob));
+      if (aop->op.type() != type) {
+        LOG(ERROR) << "No " << InstallOperationTypeName(type) << " patch";
+        return false;
+      }
+      break;
+    }
+  }
+  if (!blob->empty())
+    aop->op.set_data_length(blob->size());
+  if (aop->op.src_extents_size() > 0) {
+    brillo::Blob src_hash;
+    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(source, &src_hash));
+    aop->op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+  }
+  return true;
+}
+
+// The source and target partitions, and the operation of each type turning
+// one into the other, generated once and shared by the benchmarks.
+class SyntheticUpdate {
+ public:
+  static SyntheticUpdate* Get() {
+    static SyntheticUpdate* update = new SyntheticUpdate();
+    return update;
+  }
+
+  const brillo::Blob& source() const { return source_; }
+  const brillo::Blob& target() const { return target_; }
+  const string& source_path() const { return source_file_->path(); }
+  const string& target_path() const { return target_file_->path(); }
+
+  // Returns the operation of |type| applying the first kOperationBlocks
+  // blocks, and its data, or nullptr on error.
+  const std::pair<InstallOperation, brillo::Blob>* GetOperation(
+      InstallOperation::Type type) {
+    auto it = operations_.find(type);
+    if (it != operations_.end())
+      return &it->second;
+    const size_t size = kOperationBlocks * kBlockSize;
+    AnnotatedOperation aop;
+    brillo::Blob blob;
+    if (!MakeOperation(type,
+                       brillo::Blob(source_.begin(), source_.begin() + size),
+                       brillo::Blob(target_.begin(), target_.begin() + size),
+                       0,
+                       &aop,
+                       &blob)) {
+      return nullptr;
+    }
+    return &(operations_[type] = {aop.op, std::move(blob)});
+  }
+
+  // Returns a payload updating the whole partition with operations of
+  // |type|, or nullptr on error.
+  const brillo::Blob* GetPayload(InstallOperation::Type type,
+                                 uint64_t* metadata_size) {
+    auto it = payloads_.find(type);
+    if (it == payloads_.end()) {
+      brillo::Blob payload;
+      uint64_t size = 0;
+      if (!GeneratePayload(type, &payload, &size))
+        return nullptr;
+      it = payloads_.emplace(type, std::make_pair(std::move(payload), size))
+               .first;
+    }
+    *metadata_size = it->second.second;
+    return &it->second.first;
+  }
+
+ private:
+  SyntheticUpdate()
+      : source_(GenerateData(kPartitionSize, 1)),
+        target_(MutateData(source_, 2)),
+        source_file_(CreatePartition(source_)),
+        target_file_(CreatePartition(target_)) {
+    XzCompressInit();
+  }
+
+  bool GeneratePayload(InstallOperation::Type type,
+                       brillo::Blob* payload,
+                       uint64_t* metadata_size) {
+    vector<AnnotatedOperation> aops;
+    brillo::Blob blobs;
+    for (size_t block = 0; block < kPartitionBlocks;
+         block += kOperationBlocks) {
+      const auto begin = block * kBlockSize;
+      const auto end = begin + kOperationBlocks * kBlockSize;
+      AnnotatedOperation aop;
+      brillo::Blob blob;
+      TEST_AND_RETURN_FALSE(
+          MakeOperation(type,
+                        brillo::Blob(source_.begin() + begin,
+                                     source_.begin() + end),
+                        brillo::Blob(target_.begin() + begin,
+                                     target_.begin() + end),
+                        block,
+                        &aop,
+                        &blob));
+      if (!blob.empty())
+        aop.op.set_data_offset(blobs.size());
+      blobs.insert(blobs.end(), blob.begin(), blob.end());
+      aops.push_back(std::move(aop));
+    }
+    ScopedTempFile blob_file("Blob-XXXXXX");
+    TEST_AND_RETURN_FALSE(test_utils::WriteFileVector(blob_file.path(), blobs));
+
+    PayloadGenerationConfig config;
+    config.version.major = kBrilloMajorPayloadVersion;
+    config.version.minor = kMaxSupportedMinorPayloadVersion;
+    PayloadFile payload_file;
+    TEST_AND_RETURN_FALSE(payload_file.Init(config));
+    PartitionConfig old_part(kPartitionNameRoot);
+    old_part.path = source_path();
+    old_part.size = kPartitionSize;
+    PartitionConfig new_part(kPartitionNameRoot);
+    new_part.path = target_path();
+    new_part.size = kPartitionSize;
+    TEST_AND_RETURN_FALSE(
+        payload_file.AddPartition(old_part, new_part, aops, {}, {}));
+
+    ScopedTempFile file("Payload-XXXXXX");
+    TEST_AND_RETURN_FALSE(payload_file.WritePayload(
+        file.path(), blob_file.path(), "", metadata_size));
+    return utils::ReadFile(file.path(), payload);
+  }
+
+  const brillo::Blob source_;
+  const brillo::Blob target_;
+  std::unique_ptr<ScopedTempFile> source_file_;
+  std::unique_ptr<ScopedTempFile> target_file_;
+  std::map<InstallOperation::Type, std::pair<InstallOperation, brillo::Blob>>
+      operations_;
+  std::map<InstallOperation::Type, std::pair<brillo::Blob, uint64_t>>
+      payloads_;
+};
+
+void BM_DeltaPerformerWrite(benchmark::State& state,
+                            InstallOperation::Type type) {
+  SyntheticUpdate* update = SyntheticUpdate::Get();
+  uint64_t metadata_size = 0;
+  const brillo::Blob* payload = update->GetPayload(type, &metadata_size);
+  if (!payload) {
+    state.SkipWithError("Failed to generate the payload");
+    return;
+  }
+  ScopedTempFile target("Target-XXXXXX", false, kPartitionSize);
+  FakeBootControl boot_control;
+  boot_control.SetPartitionDevice(kPartitionNameRoot, 0, update->source_path());
+  boot_control.SetPartitionDevice(kPartitionNameRoot, 1, target.path());
+  FakeHardware hardware;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    FakePrefs prefs;
+    InstallPlan install_plan;
+    install_plan.source_slot = 0;
+    install_plan.target_slot = 1;
+    InstallPlan::Payload payload_info;
+    payload_info.size = payload->size();
+    payload_info.metadata_size = metadata_size;
+    payload_info.type = InstallPayloadType::kDelta;
+    DeltaPerformer performer(&prefs,
+                             &boot_control,
+                             &hardware,
+                             nullptr,
+                             &install_plan,
+                             &payload_info,
+                             false /* interactive */,
+                             "" /* update_certificates_path */);
+    state.ResumeTiming();
+
+    bool success = true;
+    for (size_t offset = 0; success && offset < payload->size();
+         offset += kPayloadChunkSize) {
+      success = performer.Write(
+          payload->data() + offset,
+          std::min(kPayloadChunkSize, payload->size() - offset));
+    }
+    if (performer.Close() != 0 || !success) {
+      state.SkipWithError("Failed to apply the payload");
+      return;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * kPartitionSize);
+  state.counters["payload_bytes"] = payload->size();
+}
+
+enum class ExtentWriterType { kDirect, kCached, kSnapshot, kXor };
+
+void BM_ExtentWriter(benchmark::State& state, ExtentWriterType type) {
+  SyntheticUpdate* update = SyntheticUpdate::Get();
+  const brillo::Blob& data = update->target();
+  const size_t write_size = state.range(0);
+  ScopedTempFile target("Target-XXXXXX", false, kPartitionSize);
+  FileDescriptorPtr source_fd = OpenPartition(update->source_path(), O_RDONLY);
+
+  InstallOperation op;
+  *op.add_src_extents() = ExtentForRange(0, kPartitionBlocks);
+  *op.add_dst_extents() = ExtentForRange(0, kPartitionBlocks);
+  const CowMergeOperation merge_op = CreateCowMergeOperation(
+      op.src_extents(0), op.dst_extents(0), CowMergeOperation::COW_XOR);
+  const FlatExtentMap<const CowMergeOperation*> xor_map(
+      {{merge_op.dst_extent(), &merge_op}});
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    FileDescriptorPtr target_fd = OpenPartition(target.path(), O_RDWR);
+    std::unique_ptr<android::snapshot::ICowWriter> cow_writer;
+    std::unique_ptr<ExtentWriter> writer;
+    switch (type) {
+      case ExtentWriterType::kDirect:
+        writer = std::make_unique<DirectExtentWriter>(target_fd);
+        break;
+      case ExtentWriterType::kCached:
+        target_fd = std::make_shared<CachedFileDescriptor>(target_fd,
+                                                           kCacheSize);
+        writer = std::make_unique<DirectExtentWriter>(target_fd);
+        break;
+      case ExtentWriterType::kSnapshot:
+      case ExtentWriterType::kXor: {
+        const android::snapshot::CowOptions options{
+            .block_size = kBlockSize, .compression = "lz4"};
+        cow_writer = android::snapshot::CreateCowWriter(
+            kCowVersion,
+            options,
+            android::base::unique_fd{open(target.path().c_str(), O_RDWR)});
+        if (!cow_writer) {
+          state.SkipWithError("Failed to create the COW writer");
+          return;
+        }
+        if (type == ExtentWriterType::kSnapshot) {
+          writer = std::make_unique<SnapshotExtentWriter>(cow_writer.get());
+        } else {
+          writer = std::make_unique<XORExtentWriter>(
+              op, source_fd, cow_writer.get(), xor_map, kPartitionSize);
+        }
+        break;
+      }
+    }
+    state.ResumeTiming();
+
+    bool success = writer->Init(op.dst_extents(), kBlockSize);
+    for (size_t offset = 0; success && offset < data.size();
+         offset += write_size) {
+      success = writer->Write(data.data() + offset,
+                              std::min(write_size, data.size() - offset));
+    }
+    writer.reset();
+    success = success && target_fd->Flush();
+    if (cow_writer)
+      success = success && cow_writer->Finalize();
+    if (!success) {
+      state.SkipWithError("Failed to write the partition");
+      return;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+enum class XorMapType { kExtentMap, kFlat };
+
+// Looks up the XOR extents of operation extents in a map of state.range(0)
+// merge ops, as XORExtentWriter does for every extent it writes.
+void BM_XorMapLookup(benchmark::State& state, XorMapType type) {
+  // Merge ops of 4 blocks separated by 1 block, and operation extents of 16
+  // blocks spanning a few of them.
+  constexpr uint64_t kMergeOpBlocks = 4;
+  constexpr uint64_t kQueryBlocks = 16;
+  const size_t num_merge_ops = state.range(0);
+  vector<CowMergeOperation> merge_ops;
+  for (size_t i = 0; i < num_merge_ops; i++) {
+    const Extent extent =
+        ExtentForRange(i * (kMergeOpBlocks + 1), kMergeOpBlocks);
+    merge_ops.push_back(
+        CreateCowMergeOperation(extent, extent, CowMergeOperation::COW_XOR));
+  }
+  ExtentMap<const CowMergeOperation*> extent_map;
+  vector<std::pair<Extent, const CowMergeOperation*>> entries;
+  for (const auto& merge_op : merge_ops) {
+    extent_map.AddExtent(merge_op.dst_extent(), &merge_op);
+    entries.emplace_back(merge_op.dst_extent(), &merge_op);
+  }
+  const FlatExtentMap<const CowMergeOperation*> flat_map(std::move(entries));
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<uint64_t> start_block(
+      0, num_merge_ops * (kMergeOpBlocks + 1) - kQueryBlocks);
+
+  uint64_t xor_blocks = 0;
+  for (auto _ : state) {
+    const Extent query = ExtentForRange(start_block(gen), kQueryBlocks);
+    if (type == XorMapType::kExtentMap) {
+      for (const auto& xor_ext : extent_map.GetIntersectingExtents(query)) {
+        if (extent_map.Get(xor_ext).has_value())
+          xor_blocks += xor_ext.num_blocks();
+      }
+      for (const auto& ext : extent_map.GetNonIntersectingExtents(query))
+        benchmark::DoNotOptimize(ext);
+    } else {
+      flat_map.ForEachPart(
+          query, [&](const Extent& part, const CowMergeOperation* const* op) {
+            if (op)
+              xor_blocks += part.num_blocks();
+            return true;
+          });
+    }
+  }
+  benchmark::DoNotOptimize(xor_blocks);
+  state.SetItemsProcessed(state.iterations());
+}
+
+bool ExecuteOperation(InstallOperationExecutor* executor,
+                      const InstallOperation& op,
+                      const brillo::Blob& data,
+                      std::unique_ptr<ExtentWriter> writer,
+                      FileDescriptorPtr source_fd) {
+  switch (op.type()) {
+    case InstallOperation::REPLACE:
+    case InstallOperation::REPLACE_BZ:
+    case InstallOperation::REPLACE_XZ:
+    case InstallOperation::REPLACE_ZSTD:
+      return executor->ExecuteReplaceOperation(
+          op, std::move(writer), data.data());
+    case InstallOperation::ZERO:
+      return executor->ExecuteZeroOrDiscardOperation(op, std::move(writer));
+    case InstallOperation::SOURCE_COPY:
+      return executor->ExecuteSourceCopyOperation(
+          op, std::move(writer), source_fd);
+    default:
+      return executor->ExecuteDiffOperation(
+          op, std::move(writer), source_fd, data.data(), data.size());
+  }
+}
+
+void BM_InstallOperationExecutor(benchmark::State& state,
+                                 InstallOperation::Type type,
+                                 size_t zucchini_threads = 1,
+                                 bool pool_decoders = true,
+                                 bool cache_writes = false) {
+  SyntheticUpdate* update = SyntheticUpdate::Get();
+  const auto* operation = update->GetOperation(type);
+  if (!operation) {
+    state.SkipWithError("Failed to generate the operation");
+    return;
+  }
+  const auto& [op, data] = *operation;
+  ScopedTempFile target("Target-XXXXXX", false, kPartitionSize);
+  FileDescriptorPtr source_fd = OpenPartition(update->source_path(), O_RDONLY);
+  FileDescriptorPtr target_fd = OpenPartition(target.path(), O_RDWR);
+  if (cache_writes) {
+    // Decompressors then decode straight into the cache.
+    target_fd = std::make_shared<CachedFileDescriptor>(target_fd, kCacheSize);
+  }
+  InstallOperationExecutor executor(kBlockSize);
+  WorkerPool pool(zucchini_threads);
+  executor.set_worker_pool(&pool);
+  executor.set_zucchini_threads(zucchini_threads);
+  DecoderPool::set_max_cached_bytes(
+      pool_decoders ? DecoderPool::kDefaultMaxCachedBytes : 0);
+  const uint64_t allocations = DecoderPool::allocations();
+
+  bool success = true;
+  for (auto _ : state) {
+    if (!ExecuteOperation(&executor,
+                          op,
+                          data,
+                          std::make_unique<DirectExtentWriter>(target_fd),
+                          source_fd)) {
+      state.SkipWithError("Failed to execute the operation");
+      success = false;
+      break;
+    }
+  }
+  DecoderPool::set_max_cached_bytes(DecoderPool::kDefaultMaxCachedBytes);
+  if (!success) {
+    return;
+  }
+  if (!target_fd->Flush()) {
+    state.SkipWithError("Failed to flush the target");
+    return;
+  }
+  state.SetBytesProcessed(state.iterations() * kOperationBlocks * kBlockSize);
+  state.counters["data_bytes"] = data.size();
+  // The decoder contexts and scratch buffers allocated per operation.
+  state.counters["decoder_allocations"] = benchmark::Counter(
+      DecoderPool::allocations() - allocations,
+      benchmark::Counter::kAvgIterations);
+}
+
+void BM_HashCalculator(benchmark::State& state) {
+  const brillo::Blob data = GenerateData(state.range(0), 1);
+  for (auto _ : state) {
+    HashCalculator hasher;
+    hasher.Update(data.data(), data.size());
+    hasher.Finalize();
+    benchmark::DoNotOptimize(hasher.raw_hash().data());
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+class VerifierDelegate : public ActionProcessorDelegate {
+ public:
+  void ProcessingDone(const ActionProcessor* processor,
+                      ErrorCode code) override {
+    code_ = code;
+    MessageLoop::current()->BreakLoop();
+  }
+  void ProcessingStopped(const ActionProcessor* processor) override {
+    MessageLoop::current()->BreakLoop();
+  }
+
+  ErrorCode code_{ErrorCode::kError};
+};
+
+void BM_FilesystemVerifierAction(benchmark::State& state, bool loop_device) {
+  const brillo::Blob data = GenerateData(kVerifyPartitionSize, 3);
+  std::unique_ptr<ScopedTempFile> file(CreatePartition(data));
+  string path = file->path();
+  if (loop_device &&
+      !test_utils::BindToUnusedLoopDevice(file->path(), false, &path)) {
+    state.SkipWithError("Failed to bind a loop device");
+    return;
+  }
+#if BASE_VER < 780000  // Android
+  base::MessageLoopForIO base_loop;
+  brillo::BaseMessageLoop loop(&base_loop);
+#else   // Chrome OS
+  base::SingleThreadTaskExecutor base_loop{base::MessagePumpType::IO};
+  brillo::BaseMessageLoop loop(base_loop.task_runner());
+#endif  // BASE_VER < 780000
+  loop.SetAsCurrent();
+
+  InstallPlan install_plan;
+  InstallPlan::Partition partition;
+  partition.name = kPartitionNameRoot;
+  partition.target_path = path;
+  partition.readonly_target_path = path;
+  partition.target_size = data.size();
+  CHECK(HashCalculator::RawHashOfData(data, &partition.target_hash));
+  install_plan.partitions = {partition};
+  DynamicPartitionControlStub dynamic_control;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    ActionProcessor processor;
+    VerifierDelegate delegate;
+    processor.set_delegate(&delegate);
+    auto feeder_action = std::make_unique<ObjectFeederAction<InstallPlan>>();
+    feeder_action->set_obj(install_plan);
+    auto verifier_action =
+        std::make_unique<FilesystemVerifierAction>(&dynamic_control);
+    BondActions(feeder_action.get(), verifier_action.get());
+    processor.EnqueueAction(std::move(feeder_action));
+    processor.EnqueueAction(std::move(verifier_action));
+    state.ResumeTiming();
+
+    loop.PostTask(base::Bind(&ActionProcessor::StartProcessing,
+                             base::Unretained(&processor)));
+    loop.Run();
+    if (delegate.code_ != ErrorCode::kSuccess) {
+      state.SkipWithError("Failed to verify the partition");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+  if (loop_device)
+    test_utils::UnbindLoopDevice(path);
+}
+
+}  // namespace
+
+BENCHMARK_CAPTURE(BM_DeltaPerformerWrite, replace, InstallOperation::REPLACE)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_DeltaPerformerWrite,
+                  replace_bz,
+                  InstallOperation::REPLACE_BZ)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_DeltaPerformerWrite,
+                  replace_xz,
+                  InstallOperation::REPLACE_XZ)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_DeltaPerformerWrite,
+                  replace_zstd,
+                  InstallOperation::REPLACE_ZSTD)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_DeltaPerformerWrite, zero, InstallOperation::ZERO)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_DeltaPerformerWrite,
+                  source_copy,
+                  InstallOperation::SOURCE_COPY)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_DeltaPerformerWrite,
+                  source_bsdiff,
+                  InstallOperation::SOURCE_BSDIFF)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_DeltaPerformerWrite,
+                  brotli_bsdiff,
+                  InstallOperation::BROTLI_BSDIFF)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_DeltaPerformerWrite, zucchini, InstallOperation::ZUCCHINI)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_CAPTURE(BM_ExtentWriter, direct, ExtentWriterType::kDirect)
+    ->Arg(kBlockSize)
+    ->Arg(kOperationBlocks * kBlockSize)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_ExtentWriter, cached, ExtentWriterType::kCached)
+    ->Arg(kBlockSize)
+    ->Arg(kOperationBlocks * kBlockSize)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_ExtentWriter, snapshot, ExtentWriterType::kSnapshot)
+    ->Arg(kBlockSize)
+    ->Arg(kOperationBlocks * kBlockSize)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_ExtentWriter, cow_xor, ExtentWriterType::kXor)
+    ->Arg(kBlockSize)
+    ->Arg(kOperationBlocks * kBlockSize)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_CAPTURE(BM_XorMapLookup, extent_map, XorMapType::kExtentMap)
+    ->Arg(1 << 10)
+    ->Arg(1 << 16);
+BENCHMARK_CAPTURE(BM_XorMapLookup, flat, XorMapType::kFlat)
+    ->Arg(1 << 10)
+    ->Arg(1 << 16);
+
+BENCHMARK_CAPTURE(BM_InstallOperationExecutor,
+                  replace,
+                  InstallOperation::REPLACE);
+BENCHMARK_CAPTURE(BM_InstallOperationExecutor,
+                  replace_bz,
+                  InstallOperation::REPLACE_BZ);
+BENCHMARK_CAPTURE(BM_InstallOperationExecutor,
+                  replace_bz_unpooled,
+                  InstallOperation::REPLACE_BZ,
+                  1,
+                  false);
+BENCHMARK_CAPTURE(BM_InstallOperationExecutor,
+                  replace_xz,
+                  InstallOperation::REPLACE_XZ);
+BENCHMARK_CAPTURE(BM_InstallOperationExecutor,
+                  replace_xz_unpooled,
+                  InstallOperation::REPLACE_XZ,
+                  1,
+                  false);
+BENCHMARK_CAPTURE(BM_InstallOperationExecutor,
+                  replace_xz_cached,
+                  InstallOperation::REPLACE_XZ,
+                  1,
+                  true,
+                  true);
+BENCHMARK_CAPTURE(BM_InstallOperationExecutor,
+                  replace_zstd,
+                  InstallOperation::REPLACE_ZSTD);
+BENCHMARK_CAPTURE(BM_InstallOperationExecutor,
+                  replace_zstd_cached,
+                  InstallOperation::REPLACE_ZSTD,
+                  1,
+                  true,
+                  true);
+BENCHMARK_CAPTURE(BM_InstallOperationExecutor, zero, InstallOperation::ZERO);
+BENCHMARK_CAPTURE(BM_InstallOperationExecutor,
+                  source_copy,
+                  InstallOperation::SOURCE_COPY);
+BENCHMARK_CAPTURE(BM_InstallOperationExecutor,
+                  source_bsdiff,
+                  InstallOperation::SOURCE_BSDIFF);
+BENCHMARK_CAPTURE(BM_InstallOperationExecutor,
+                  brotli_bsdiff,
+                  InstallOperation::BROTLI_BSDIFF);
+BENCHMARK_CAPTURE(BM_InstallOperationExecutor,
+                  zucchini,
+                  InstallOperation::ZUCCHINI);
+BENCHMARK_CAPTURE(BM_InstallOperationExecutor,
+                  zucchini_unpooled,
+                  InstallOperation::ZUCCHINI,
+                  1,
+                  false);
+BENCHMARK_CAPTURE(BM_InstallOperationExecutor,
+                  zucchini_4_threads,
+                  InstallOperation::ZUCCHINI,
+                  4);
+
+BENCHMARK(BM_HashCalculator)->Arg(kBlockSize)->Arg(kPartitionSize);
+
+BENCHMARK_CAPTURE(BM_FilesystemVerifierAction, file, false)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_FilesystemVerifierAction, loop_device, true)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace chromeos_update_engine
+
+BENCHMARK_MAIN();
@@ -0,0 +1,147 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/payload_hasher.h"
+
+#include <utility>
+
+#include <base/logging.h>
+
+namespace chromeos_update_engine {
+
+PayloadHasher::PayloadHasher(HashCalculator* payload_hash,
+                             HashCalculator* signed_hash)
+    : payload_hash_(payload_hash), signed_hash_(signed_hash) {}
+
+PayloadHasher::~PayloadHasher() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void PayloadHasher::Start() {
+  CHECK(!thread_.joinable());
+  thread_ = std::thread(&PayloadHasher::HasherMain, this);
+}
+
+void PayloadHasher::Update(brillo::Blob data, size_t signed_size) {
+  Chunk chunk;
+  chunk.data = data.data();
+  chunk.size = data.size();
+  chunk.signed_size = signed_size;
+  // Moving the blob keeps |chunk.data| pointing to its content.
+  chunk.owned = std::move(data);
+  Push(std::move(chunk));
+}
+
+void PayloadHasher::UpdateBorrowed(const uint8_t* data,
+                                   size_t size,
+                                   size_t signed_size) {
+  Chunk chunk;
+  chunk.data = data;
+  chunk.size = size;
+  chunk.signed_size = signed_size;
+  Push(std::move(chunk));
+  borrowed_tail_ = tail_.load(std::memory_order_relaxed);
+}
+
+void PayloadHasher::UpdateNow(const uint8_t* data,
+                              size_t size,
+                              size_t signed_size) {
+  Wait();
+  Chunk chunk;
+  chunk.data = data;
+  chunk.size = size;
+  chunk.signed_size = signed_size;
+  Hash(chunk);
+}
+
+void PayloadHasher::WaitForBorrowed() {
+  WaitForHead(borrowed_tail_);
+}
+
+void PayloadHasher::Wait() {
+  WaitForHead(tail_.load(std::memory_order_relaxed));
+}
+
+void PayloadHasher::WaitForHead(size_t target) {
+  if (!thread_.joinable() ||
+      head_.load(std::memory_order_acquire) >= target) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  producer_waiting_.store(true);
+  cv_.wait(lock, [this, target] { return head_.load() >= target; });
+  producer_waiting_.store(false);
+}
+
+void PayloadHasher::Push(Chunk chunk) {
+  if (!thread_.joinable()) {
+    Hash(chunk);
+    return;
+  }
+  const size_t tail = tail_.load(std::memory_order_relaxed);
+  if (tail - head_.load(std::memory_order_acquire) == kQueueSize) {
+    WaitForHead(tail - kQueueSize + 1);
+  }
+  ring_[tail % kQueueSize] = std::move(chunk);
+  // Publishing |tail_| and checking |consumer_waiting_| are both sequentially
+  // consistent: either the hashing thread sees the new chunk before going to
+  // sleep, or it is woken up below.
+  tail_.store(tail + 1);
+  if (consumer_waiting_.load()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cv_.notify_all();
+  }
+}
+
+void PayloadHasher::Hash(const Chunk& chunk) {
+  payload_hash_->Update(chunk.data, chunk.size);
+  signed_hash_->Update(chunk.data, chunk.signed_size);
+}
+
+void PayloadHasher::HasherMain() {
+  size_t head = head_.load(std::memory_order_relaxed);
+  while (true) {
+    if (head == tail_.load(std::memory_order_acquire)) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      consumer_waiting_.store(true);
+      cv_.wait(lock,
+               [this, head] { return stopping_ || tail_.load() != head; });
+      consumer_waiting_.store(false);
+      if (tail_.load() == head) {
+        return;
+      }
+      continue;
+    }
+    Chunk& chunk = ring_[head % kQueueSize];
+    Hash(chunk);
+    chunk = Chunk();
+    head_.store(++head);
+    if (producer_waiting_.load()) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      cv_.notify_all();
+    }
+  }
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,116 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_HASHER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_HASHER_H_
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/hash_calculator.h"
+
+namespace chromeos_update_engine {
+
+// Feeds the payload bytes, in order, to the payload hash calculator and the
+// first bytes of each chunk to the signed hash calculator. Once Start() is
+// called, the hashing happens on a dedicated thread, fed through a
+// single-producer single-consumer ring of chunks, so that SHA-256 is computed
+// while the previous data is being applied. Otherwise the chunks are hashed on
+// the calling thread.
+//
+// The calculators must only be accessed, e.g. to get their context, after
+// Wait() returned, and until the next Update*() call.
+class PayloadHasher {
+ public:
+  // Maximum number of chunks queued for hashing.
+  static constexpr size_t kQueueSize = 16;
+
+  PayloadHasher(HashCalculator* payload_hash, HashCalculator* signed_hash);
+  ~PayloadHasher();
+
+  // Starts the hashing thread.
+  void Start();
+
+  // Hashes |data|, of which the first |signed_size| bytes are also signed.
+  // The memory of |data| is released once hashed.
+  void Update(brillo::Blob data, size_t signed_size);
+
+  // Same as Update() for |size| bytes of |data|, which the caller keeps valid
+  // until the next WaitForBorrowed() or Wait() call.
+  void UpdateBorrowed(const uint8_t* data, size_t size, size_t signed_size);
+
+  // Hashes |size| bytes of |data| on the calling thread, after the queued
+  // chunks.
+  void UpdateNow(const uint8_t* data, size_t size, size_t signed_size);
+
+  // Waits until the chunks passed to UpdateBorrowed() are hashed.
+  void WaitForBorrowed();
+
+  // Waits until all queued chunks are hashed.
+  void Wait();
+
+ private:
+  struct Chunk {
+    brillo::Blob owned;
+    const uint8_t* data{nullptr};
+    size_t size{0};
+    size_t signed_size{0};
+  };
+
+  // Waits until |head_| reaches |target|.
+  void WaitForHead(size_t target);
+  void Push(Chunk chunk);
+  void Hash(const Chunk& chunk);
+  void HasherMain();
+
+  HashCalculator* const payload_hash_;
+  HashCalculator* const signed_hash_;
+
+  // |ring_[head_ % kQueueSize]| to |ring_[tail_ % kQueueSize]| are queued.
+  // Slots are only written by the producer while outside of that range, and
+  // only read and reset by the hashing thread while inside it, so the indexes
+  // publish them without a lock.
+  std::array<Chunk, kQueueSize> ring_;
+  std::atomic<size_t> head_{0};
+  std::atomic<size_t> tail_{0};
+
+  // Only used to sleep while the ring is full or empty. Each side announces
+  // it's about to sleep, so the other side only takes the lock to wake it up.
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::atomic<bool> producer_waiting_{false};
+  std::atomic<bool> consumer_waiting_{false};
+  bool stopping_{false};
+
+  // Value of |tail_| after the last chunk passed to UpdateBorrowed().
+  size_t borrowed_tail_{0};
+
+  std::thread thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(PayloadHasher);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_HASHER_H_
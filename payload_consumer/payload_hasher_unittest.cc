@@ -0,0 +1,107 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/payload_hasher.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/hash_calculator.h"
+
+namespace chromeos_update_engine {
+
+class PayloadHasherTest : public ::testing::TestWithParam<bool> {
+ protected:
+  void SetUp() override {
+    for (size_t i = 0; i < kNumChunks; i++) {
+      chunks_.emplace_back(1000 + i * 7, static_cast<uint8_t>(i));
+    }
+    for (const auto& chunk : chunks_) {
+      expected_payload_.Update(chunk.data(), chunk.size());
+      expected_signed_.Update(chunk.data(), chunk.size() / 2);
+    }
+    ASSERT_TRUE(expected_payload_.Finalize());
+    ASSERT_TRUE(expected_signed_.Finalize());
+    if (GetParam()) {
+      hasher_.Start();
+    }
+  }
+
+  void ExpectHashes() {
+    hasher_.Wait();
+    ASSERT_TRUE(payload_hash_.Finalize());
+    ASSERT_TRUE(signed_hash_.Finalize());
+    EXPECT_EQ(expected_payload_.raw_hash(), payload_hash_.raw_hash());
+    EXPECT_EQ(expected_signed_.raw_hash(), signed_hash_.raw_hash());
+  }
+
+  // More chunks than fit in the queue.
+  static constexpr size_t kNumChunks = 3 * PayloadHasher::kQueueSize;
+
+  std::vector<brillo::Blob> chunks_;
+  HashCalculator expected_payload_;
+  HashCalculator expected_signed_;
+  HashCalculator payload_hash_;
+  HashCalculator signed_hash_;
+  PayloadHasher hasher_{&payload_hash_, &signed_hash_};
+};
+
+TEST_P(PayloadHasherTest, OwnedChunksTest) {
+  for (auto chunk : chunks_) {
+    const size_t signed_size = chunk.size() / 2;
+    hasher_.Update(std::move(chunk), signed_size);
+  }
+  ExpectHashes();
+}
+
+TEST_P(PayloadHasherTest, MixedChunksTest) {
+  for (size_t i = 0; i < chunks_.size(); i++) {
+    const brillo::Blob& chunk = chunks_[i];
+    switch (i % 3) {
+      case 0:
+        hasher_.Update(chunk, chunk.size() / 2);
+        break;
+      case 1:
+        hasher_.UpdateBorrowed(chunk.data(), chunk.size(), chunk.size() / 2);
+        break;
+      case 2:
+        hasher_.UpdateNow(chunk.data(), chunk.size(), chunk.size() / 2);
+        break;
+    }
+  }
+  hasher_.WaitForBorrowed();
+  ExpectHashes();
+}
+
+TEST_P(PayloadHasherTest, ContextAfterWaitTest) {
+  hasher_.Update(chunks_[0], chunks_[0].size() / 2);
+  hasher_.Wait();
+  const std::string context = payload_hash_.GetContext();
+
+  HashCalculator expected;
+  ASSERT_TRUE(expected.Update(chunks_[0].data(), chunks_[0].size()));
+  EXPECT_EQ(expected.GetContext(), context);
+}
+
+INSTANTIATE_TEST_CASE_P(PayloadHasherTestInstance,
+                        PayloadHasherTest,
+                        ::testing::Bool());
+
+}  // namespace chromeos_update_engine
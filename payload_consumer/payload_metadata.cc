@@ -18,6 +18,8 @@
 
 #include <endian.h>
 
+#include <algorithm>
+
 #include <base/strings/stringprintf.h>
 #include <brillo/data_encoding.h>
 
@@ -153,6 +155,49 @@ bool PayloadMetadata::GetManifest(const unsigned char* payload,
                                       manifest_size_);
 }
 
+bool PayloadMetadata::ParseOperationsSegment(const unsigned char* data,
+                                             size_t size,
+                                             PartitionUpdate* partition) {
+  const OperationsSegment& segment = partition->operations_segment();
+  brillo::Blob hash;
+  TEST_AND_RETURN_FALSE(size == segment.data_length());
+  TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfBytes(data, size, &hash));
+  if (ToStringView(hash) != segment.sha256_hash()) {
+    LOG(ERROR) << "The operations segment of " << partition->partition_name()
+               << " doesn't match its hash.";
+    return false;
+  }
+  PartitionOperations operations;
+  TEST_AND_RETURN_FALSE(operations.ParseFromArray(data, size));
+  TEST_AND_RETURN_FALSE(static_cast<uint64_t>(operations.operations_size()) ==
+                        segment.num_operations());
+  partition->mutable_operations()->Swap(operations.mutable_operations());
+  return true;
+}
+
+void PayloadMetadata::GetPartitionDataRange(const PartitionUpdate& partition,
+                                            uint64_t* offset,
+                                            uint64_t* length) const {
+  uint64_t begin = 0;
+  uint64_t end = 0;
+  if (partition.has_data_range()) {
+    begin = partition.data_range().data_offset();
+    end = begin + partition.data_range().data_length();
+  } else {
+    // Older payloads only tell the range of each operation.
+    bool found = false;
+    for (const InstallOperation& op : partition.operations()) {
+      if (!op.has_data_offset() || op.data_length() == 0)
+        continue;
+      begin = found ? std::min(begin, op.data_offset()) : op.data_offset();
+      end = std::max(end, op.data_offset() + op.data_length());
+      found = true;
+    }
+  }
+  *offset = metadata_size_ + metadata_signature_size_ + begin;
+  *length = end - begin;
+}
+
 ErrorCode PayloadMetadata::ValidateMetadataSignature(
     const brillo::Blob& payload,
     const string& metadata_signature,
@@ -160,6 +205,24 @@ ErrorCode PayloadMetadata::ValidateMetadataSignature(
   if (payload.size() < metadata_size_ + metadata_signature_size_)
     return ErrorCode::kDownloadMetadataSignatureError;
 
+  brillo::Blob metadata_hash;
+  if (!HashCalculator::RawHashOfBytes(
+          payload.data(), metadata_size_, &metadata_hash)) {
+    LOG(ERROR) << "Unable to compute actual hash of manifest";
+    return ErrorCode::kDownloadMetadataSignatureVerificationError;
+  }
+  return ValidateMetadataSignature(
+      payload, metadata_signature, payload_verifier, metadata_hash);
+}
+
+ErrorCode PayloadMetadata::ValidateMetadataSignature(
+    const brillo::Blob& payload,
+    const string& metadata_signature,
+    const PayloadVerifier& payload_verifier,
+    const brillo::Blob& metadata_hash) const {
+  if (payload.size() < metadata_size_ + metadata_signature_size_)
+    return ErrorCode::kDownloadMetadataSignatureError;
+
   // A single signature in raw bytes.
   brillo::Blob metadata_signature_blob;
   // The serialized Signatures protobuf message stored in major version >=2
@@ -185,13 +248,6 @@ ErrorCode PayloadMetadata::ValidateMetadataSignature(
     return ErrorCode::kDownloadMetadataSignatureMissingError;
   }
 
-  brillo::Blob metadata_hash;
-  if (!HashCalculator::RawHashOfBytes(
-          payload.data(), metadata_size_, &metadata_hash)) {
-    LOG(ERROR) << "Unable to compute actual hash of manifest";
-    return ErrorCode::kDownloadMetadataSignatureVerificationError;
-  }
-
   if (metadata_hash.size() != kSHA256Size) {
     LOG(ERROR) << "Computed actual hash of metadata has incorrect size: "
                << metadata_hash.size();
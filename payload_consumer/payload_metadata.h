@@ -73,6 +73,14 @@ class PayloadMetadata {
       const std::string& metadata_signature,
       const PayloadVerifier& payload_verifier) const;
 
+  // Same as above with the SHA-256 |metadata_hash| of the metadata in
+  // |payload|, computed by the caller as the metadata was received.
+  ErrorCode ValidateMetadataSignature(
+      const brillo::Blob& payload,
+      const std::string& metadata_signature,
+      const PayloadVerifier& payload_verifier,
+      const brillo::Blob& metadata_hash) const;
+
   // Returns the major payload version. If the version was not yet parsed,
   // returns zero.
   uint64_t GetMajorVersion() const { return major_payload_version_; }
@@ -94,6 +102,18 @@ class PayloadMetadata {
                    size_t size,
                    DeltaArchiveManifest* out_manifest) const;
 
+  // Sets the operations of |partition| from the |size| bytes of its operations
+  // segment at |data|. Returns false if they don't match the segment.
+  static bool ParseOperationsSegment(const unsigned char* data,
+                                     size_t size,
+                                     PartitionUpdate* partition);
+
+  // Sets |*offset| and |*length| to the range of the payload with the data of
+  // |partition|, from its data range or else from its operations.
+  void GetPartitionDataRange(const PartitionUpdate& partition,
+                             uint64_t* offset,
+                             uint64_t* length) const;
+
   // Parses a payload file |payload_path| and prepares the metadata properties,
   // manifest and metadata signatures. Can be used as an easy to use utility to
   // get the payload information without manually the process.
@@ -0,0 +1,156 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/payload_staging_ring.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+PayloadStagingRing::~PayloadStagingRing() {
+  if (fd_ >= 0)
+    IGNORE_EINTR(close(fd_));
+}
+
+bool PayloadStagingRing::Open(const std::string& path, size_t capacity) {
+  TEST_AND_RETURN_FALSE(fd_ < 0 && capacity > 0);
+  fd_ = HANDLE_EINTR(
+      open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600));
+  if (fd_ < 0) {
+    PLOG(ERROR) << "Failed to create " << path;
+    return false;
+  }
+  if (unlink(path.c_str()) != 0)
+    PLOG(WARNING) << "Failed to unlink " << path;
+  if (fallocate(fd_, 0, 0, capacity) != 0) {
+    PLOG(ERROR) << "Failed to allocate " << capacity << " bytes for " << path;
+    IGNORE_EINTR(close(fd_));
+    fd_ = -1;
+    return false;
+  }
+  capacity_ = capacity;
+  return true;
+}
+
+bool PayloadStagingRing::Append(const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  while (size > 0) {
+    uint64_t tail = 0;
+    size_t length = 0;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return closed_ || tail_ - head_ < capacity_; });
+      if (closed_)
+        return false;
+      tail = tail_;
+      // Up to the free space, without wrapping around the end of the file.
+      length = std::min<uint64_t>(
+          {size, capacity_ - (tail_ - head_), capacity_ - tail_ % capacity_});
+    }
+    // The consumer doesn't read past |tail_|, so the bytes are written
+    // without holding the lock.
+    if (!utils::PWriteAll(fd_, bytes, length, tail % capacity_)) {
+      PLOG(ERROR) << "Failed to write the staging file";
+      return false;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tail_ += length;
+    }
+    cv_.notify_all();
+    bytes += length;
+    size -= length;
+  }
+  return true;
+}
+
+bool PayloadStagingRing::Read(void* data, size_t max_size, size_t* size) {
+  *size = 0;
+  uint64_t head = 0;
+  size_t length = 0;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] {
+      return closed_ || (!paused_ && (tail_ > head_ || finished_));
+    });
+    if (closed_)
+      return false;
+    if (tail_ == head_)
+      return true;
+    head = head_;
+    length = std::min<uint64_t>(
+        {max_size, tail_ - head_, capacity_ - head_ % capacity_});
+  }
+  // The producer doesn't write past |head_|, so the bytes are read without
+  // holding the lock.
+  ssize_t bytes_read = 0;
+  if (!utils::PReadAll(fd_, data, length, head % capacity_, &bytes_read) ||
+      static_cast<size_t>(bytes_read) != length) {
+    PLOG(ERROR) << "Failed to read the staging file";
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    head_ += length;
+  }
+  cv_.notify_all();
+  *size = length;
+  return true;
+}
+
+void PayloadStagingRing::Finish() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+  }
+  cv_.notify_all();
+}
+
+void PayloadStagingRing::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  cv_.notify_all();
+}
+
+void PayloadStagingRing::Pause() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  paused_ = true;
+}
+
+void PayloadStagingRing::Unpause() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    paused_ = false;
+  }
+  cv_.notify_all();
+}
+
+size_t PayloadStagingRing::used() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return tail_ - head_;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,91 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_STAGING_RING_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_STAGING_RING_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include <base/macros.h>
+
+namespace chromeos_update_engine {
+
+// A bounded FIFO of bytes stored in a file, which decouples a producer
+// appending bytes at its own rate from a consumer reading them at its own
+// rate, on another thread. The file is used as a ring: the bytes read are
+// overwritten by the next ones appended. There must be a single producer and
+// a single consumer.
+//
+// The file is unlinked once opened, so nothing is left behind if the process
+// dies: the bytes staged are only meant to be consumed by this process.
+class PayloadStagingRing {
+ public:
+  PayloadStagingRing() = default;
+  ~PayloadStagingRing();
+
+  // Creates the file at |path|, with |capacity| bytes allocated on the disk.
+  // Returns false if the file can't be created or the space isn't available.
+  [[nodiscard]] bool Open(const std::string& path, size_t capacity);
+
+  // Appends |size| bytes, waiting for the consumer to make room when the ring
+  // is full. Returns false if writing the file failed or if the ring was
+  // closed.
+  [[nodiscard]] bool Append(const void* data, size_t size);
+
+  // Waits for bytes to be available and reads up to |max_size| of them into
+  // |data|, setting |size| to the number of bytes read. Once Finish() was
+  // called and all the bytes were read, sets |size| to 0. Returns false if
+  // reading the file failed or if the ring was closed.
+  [[nodiscard]] bool Read(void* data, size_t max_size, size_t* size);
+
+  // No more bytes will be appended.
+  void Finish();
+
+  // Wakes up and fails the pending and next Append() and Read() calls.
+  void Close();
+
+  // While paused, Read() waits even if bytes are available.
+  void Pause();
+  void Unpause();
+
+  size_t capacity() const { return capacity_; }
+  // Number of bytes appended but not read yet.
+  size_t used();
+
+ private:
+  int fd_{-1};
+  size_t capacity_{0};
+
+  // The fields below are protected by |mutex_|. |head_| and |tail_| are the
+  // total number of bytes read and appended.
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  uint64_t head_{0};
+  uint64_t tail_{0};
+  bool finished_{false};
+  bool closed_{false};
+  bool paused_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(PayloadStagingRing);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_STAGING_RING_H_
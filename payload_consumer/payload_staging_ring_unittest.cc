@@ -0,0 +1,124 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/payload_staging_ring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+
+namespace chromeos_update_engine {
+
+class PayloadStagingRingTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    path_ = temp_dir_.GetPath().Append("staging").value();
+    data_.resize(100 * 1000 + 7);
+    test_utils::FillWithData(&data_);
+  }
+
+  // Reads |ring| until the end, in reads of up to |read_size| bytes.
+  static brillo::Blob ReadAll(PayloadStagingRing* ring, size_t read_size) {
+    brillo::Blob result;
+    brillo::Blob buffer(read_size);
+    size_t size = 0;
+    while (ring->Read(buffer.data(), buffer.size(), &size) && size > 0)
+      result.insert(result.end(), buffer.begin(), buffer.begin() + size);
+    return result;
+  }
+
+  base::ScopedTempDir temp_dir_;
+  std::string path_;
+  brillo::Blob data_;
+};
+
+TEST_F(PayloadStagingRingTest, OpenUnlinksFileTest) {
+  PayloadStagingRing ring;
+  ASSERT_TRUE(ring.Open(path_, 4096));
+  EXPECT_EQ(4096u, ring.capacity());
+  EXPECT_FALSE(base::PathExists(base::FilePath(path_)));
+}
+
+TEST_F(PayloadStagingRingTest, WrapsAroundTest) {
+  // The ring is much smaller than the data, and its capacity isn't a multiple
+  // of the sizes appended or read.
+  PayloadStagingRing ring;
+  ASSERT_TRUE(ring.Open(path_, 3000));
+  brillo::Blob result;
+  std::thread consumer([&ring, &result] { result = ReadAll(&ring, 700); });
+  for (size_t offset = 0; offset < data_.size(); offset += 1100) {
+    const size_t size = std::min<size_t>(1100, data_.size() - offset);
+    ASSERT_TRUE(ring.Append(data_.data() + offset, size));
+  }
+  ring.Finish();
+  consumer.join();
+  EXPECT_EQ(data_, result);
+  EXPECT_EQ(0u, ring.used());
+}
+
+TEST_F(PayloadStagingRingTest, AppendLargerThanCapacityTest) {
+  PayloadStagingRing ring;
+  ASSERT_TRUE(ring.Open(path_, 1000));
+  brillo::Blob result;
+  std::thread consumer([&ring, &result] { result = ReadAll(&ring, 4096); });
+  ASSERT_TRUE(ring.Append(data_.data(), data_.size()));
+  ring.Finish();
+  consumer.join();
+  EXPECT_EQ(data_, result);
+}
+
+TEST_F(PayloadStagingRingTest, PauseTest) {
+  PayloadStagingRing ring;
+  ASSERT_TRUE(ring.Open(path_, data_.size()));
+  ring.Pause();
+  brillo::Blob result;
+  std::thread consumer([&ring, &result] { result = ReadAll(&ring, 4096); });
+  ASSERT_TRUE(ring.Append(data_.data(), data_.size()));
+  ring.Finish();
+  // Nothing is read while paused.
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(data_.size(), ring.used());
+  ring.Unpause();
+  consumer.join();
+  EXPECT_EQ(data_, result);
+}
+
+TEST_F(PayloadStagingRingTest, CloseWakesUpProducerTest) {
+  PayloadStagingRing ring;
+  ASSERT_TRUE(ring.Open(path_, 1000));
+  // The ring fills up with nobody reading it, until it's closed.
+  std::thread closer([&ring] {
+    while (ring.used() < ring.capacity())
+      std::this_thread::yield();
+    ring.Close();
+  });
+  EXPECT_FALSE(ring.Append(data_.data(), data_.size()));
+  closer.join();
+  size_t size = 0;
+  EXPECT_FALSE(ring.Read(data_.data(), data_.size(), &size));
+  EXPECT_EQ(0u, size);
+}
+
+}  // namespace chromeos_update_engine
@@ -16,10 +16,14 @@
 
 #include "update_engine/payload_consumer/payload_verifier.h"
 
+#include <sys/stat.h>
+
+#include <mutex>
 #include <utility>
 #include <vector>
 
 #include <base/logging.h>
+#include <openssl/ecdsa.h>
 #include <openssl/pem.h>
 
 #include "update_engine/common/constants.h"
@@ -49,6 +53,20 @@ const uint8_t kSHA256DigestInfoPrefix[] = {
     0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20,
 };
 
+// Returns whether the signatures made with |public_key| may be |size| bytes.
+bool SignatureSizeMatches(const EVP_PKEY* public_key, size_t size) {
+  EVP_PKEY* key = const_cast<EVP_PKEY*>(public_key);
+  switch (EVP_PKEY_id(key)) {
+    case EVP_PKEY_RSA:
+      return static_cast<size_t>(RSA_size(EVP_PKEY_get0_RSA(key))) == size;
+    case EVP_PKEY_EC:
+      return size <=
+             static_cast<size_t>(ECDSA_size(EVP_PKEY_get0_EC_KEY(key)));
+    default:
+      return true;
+  }
+}
+
 }  // namespace
 
 std::unique_ptr<PayloadVerifier> PayloadVerifier::CreateInstance(
@@ -67,13 +85,36 @@ std::unique_ptr<PayloadVerifier> PayloadVerifier::CreateInstance(
     return nullptr;
   }
 
-  std::vector<std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>> keys;
-  keys.emplace_back(std::move(pub_key));
+  auto keys = std::make_shared<PublicKeys>();
+  keys->emplace_back(std::move(pub_key));
   return std::unique_ptr<PayloadVerifier>(new PayloadVerifier(std::move(keys)));
 }
 
 std::unique_ptr<PayloadVerifier> PayloadVerifier::CreateInstanceFromZipPath(
     const std::string& certificate_zip_path) {
+  // Every binder call verifying a payload creates an instance, so the keys
+  // parsed from the zip file are kept until it changes.
+  struct CachedPublicKeys {
+    std::string path;
+    off_t size{0};
+    timespec mtime{};
+    std::shared_ptr<const PublicKeys> keys;
+  };
+  static auto* cache_mutex = new std::mutex();
+  static auto* cache = new CachedPublicKeys();
+
+  struct stat zip_stat {};
+  const bool has_stat = stat(certificate_zip_path.c_str(), &zip_stat) == 0;
+  {
+    std::lock_guard<std::mutex> lock(*cache_mutex);
+    if (has_stat && cache->keys && cache->path == certificate_zip_path &&
+        cache->size == zip_stat.st_size &&
+        cache->mtime.tv_sec == zip_stat.st_mtim.tv_sec &&
+        cache->mtime.tv_nsec == zip_stat.st_mtim.tv_nsec) {
+      return std::unique_ptr<PayloadVerifier>(new PayloadVerifier(cache->keys));
+    }
+  }
+
   auto parser = CreateCertificateParser();
   if (!parser) {
     LOG(ERROR) << "Failed to create certificate parser from "
@@ -81,21 +122,28 @@ std::unique_ptr<PayloadVerifier> PayloadVerifier::CreateInstanceFromZipPath(
     return nullptr;
   }
 
-  std::vector<std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>> public_keys;
+  auto public_keys = std::make_shared<PublicKeys>();
   if (!parser->ReadPublicKeysFromCertificates(certificate_zip_path,
-                                              &public_keys) ||
-      public_keys.empty()) {
+                                              public_keys.get()) ||
+      public_keys->empty()) {
     LOG(ERROR) << "Failed to parse public keys in: " << certificate_zip_path;
     return nullptr;
   }
 
+  if (has_stat) {
+    std::lock_guard<std::mutex> lock(*cache_mutex);
+    *cache = {certificate_zip_path,
+              zip_stat.st_size,
+              zip_stat.st_mtim,
+              public_keys};
+  }
   return std::unique_ptr<PayloadVerifier>(
       new PayloadVerifier(std::move(public_keys)));
 }
 
 bool PayloadVerifier::VerifySignature(
     const string& signature_proto, const brillo::Blob& sha256_hash_data) const {
-  TEST_AND_RETURN_FALSE(!public_keys_.empty());
+  TEST_AND_RETURN_FALSE(public_keys_ && !public_keys_->empty());
 
   Signatures signatures;
   LOG(INFO) << "signature blob size = " << signature_proto.size();
@@ -147,48 +195,79 @@ bool PayloadVerifier::VerifyRawSignature(
     const brillo::Blob& sig_data,
     const brillo::Blob& sha256_hash_data,
     brillo::Blob* decrypted_sig_data) const {
-  TEST_AND_RETURN_FALSE(!public_keys_.empty());
-
-  for (const auto& public_key : public_keys_) {
-    int key_type = EVP_PKEY_id(public_key.get());
-    if (key_type == EVP_PKEY_RSA) {
-      brillo::Blob sig_hash_data;
-      if (!GetRawHashFromSignature(
-              sig_data, public_key.get(), &sig_hash_data)) {
-        LOG(WARNING)
-            << "Failed to get the raw hash with RSA key. Trying other keys.";
-        continue;
+  TEST_AND_RETURN_FALSE(public_keys_ && !public_keys_->empty());
+
+  // The other keys only match signatures padded to a different size.
+  std::vector<const EVP_PKEY*> keys;
+  keys.reserve(public_keys_->size());
+  for (bool matches : {true, false}) {
+    for (const auto& public_key : *public_keys_) {
+      if (SignatureSizeMatches(public_key.get(), sig_data.size()) == matches) {
+        keys.push_back(public_key.get());
       }
+    }
+  }
 
-      if (decrypted_sig_data != nullptr) {
-        *decrypted_sig_data = sig_hash_data;
-      }
+  for (const EVP_PKEY* public_key : keys) {
+    bool fatal = false;
+    if (VerifyRawSignatureWithKey(sig_data,
+                                  sha256_hash_data,
+                                  public_key,
+                                  decrypted_sig_data,
+                                  &fatal)) {
+      return true;
+    }
+    if (fatal) {
+      return false;
+    }
+  }
+  LOG(INFO) << "Failed to verify the signature with " << public_keys_->size()
+            << " keys.";
+  return false;
+}
 
-      brillo::Blob padded_hash_data = sha256_hash_data;
-      TEST_AND_RETURN_FALSE(
-          PadRSASHA256Hash(&padded_hash_data, sig_hash_data.size()));
+bool PayloadVerifier::VerifyRawSignatureWithKey(
+    const brillo::Blob& sig_data,
+    const brillo::Blob& sha256_hash_data,
+    const EVP_PKEY* public_key,
+    brillo::Blob* decrypted_sig_data,
+    bool* fatal) const {
+  EVP_PKEY* key = const_cast<EVP_PKEY*>(public_key);
+  int key_type = EVP_PKEY_id(key);
+  if (key_type == EVP_PKEY_RSA) {
+    brillo::Blob sig_hash_data;
+    if (!GetRawHashFromSignature(sig_data, public_key, &sig_hash_data)) {
+      LOG(WARNING)
+          << "Failed to get the raw hash with RSA key. Trying other keys.";
+      return false;
+    }
 
-      if (padded_hash_data == sig_hash_data) {
-        return true;
-      }
-    } else if (key_type == EVP_PKEY_EC) {
-      EC_KEY* ec_key = EVP_PKEY_get0_EC_KEY(public_key.get());
-      TEST_AND_RETURN_FALSE(ec_key != nullptr);
-      if (ECDSA_verify(0,
-                       sha256_hash_data.data(),
-                       sha256_hash_data.size(),
-                       sig_data.data(),
-                       sig_data.size(),
-                       ec_key) == 1) {
-        return true;
-      }
-    } else {
-      LOG(ERROR) << "Unsupported key type " << key_type;
+    if (decrypted_sig_data != nullptr) {
+      *decrypted_sig_data = sig_hash_data;
+    }
+
+    brillo::Blob padded_hash_data = sha256_hash_data;
+    if (!PadRSASHA256Hash(&padded_hash_data, sig_hash_data.size())) {
+      *fatal = true;
       return false;
     }
+    return padded_hash_data == sig_hash_data;
   }
-  LOG(INFO) << "Failed to verify the signature with " << public_keys_.size()
-            << " keys.";
+  if (key_type == EVP_PKEY_EC) {
+    const EC_KEY* ec_key = EVP_PKEY_get0_EC_KEY(key);
+    if (ec_key == nullptr) {
+      *fatal = true;
+      return false;
+    }
+    return ECDSA_verify(0,
+                        sha256_hash_data.data(),
+                        sha256_hash_data.size(),
+                        sig_data.data(),
+                        sig_data.size(),
+                        ec_key) == 1;
+  }
+  LOG(ERROR) << "Unsupported key type " << key_type;
+  *fatal = true;
   return false;
 }
 
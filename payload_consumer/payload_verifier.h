@@ -49,7 +49,9 @@ class PayloadVerifier {
       const std::string& pem_public_key);
 
   // Extracts the public keys from the certificates contained in the input
-  // zip file. And creates a PayloadVerifier with these public keys.
+  // zip file. And creates a PayloadVerifier with these public keys. The keys
+  // of the last zip file are kept for the next instances, until its size or
+  // modification time change.
   static std::unique_ptr<PayloadVerifier> CreateInstanceFromZipPath(
       const std::string& certificate_zip_path);
 
@@ -64,17 +66,28 @@ class PayloadVerifier {
 
   // Verifies if |sig_data| is a raw signature of the hash |sha256_hash_data|.
   // If PayloadVerifier is using RSA as the public key, further puts the
-  // decrypted data of |sig_data| into |decrypted_sig_data|.
+  // decrypted data of |sig_data| into |decrypted_sig_data|. The keys whose
+  // signatures have the size of |sig_data| are tried first.
   bool VerifyRawSignature(const brillo::Blob& sig_data,
                           const brillo::Blob& sha256_hash_data,
                           brillo::Blob* decrypted_sig_data) const;
 
  private:
-  explicit PayloadVerifier(
-      std::vector<std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>>&&
-          public_keys)
+  using PublicKeys =
+      std::vector<std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>>;
+
+  explicit PayloadVerifier(std::shared_ptr<const PublicKeys> public_keys)
       : public_keys_(std::move(public_keys)) {}
 
+  // Returns whether |sig_data| is a signature of |sha256_hash_data| with
+  // |public_key|, setting |decrypted_sig_data| for RSA keys. Sets |fatal| if
+  // the other keys shouldn't be tried either, e.g. on unsupported keys.
+  bool VerifyRawSignatureWithKey(const brillo::Blob& sig_data,
+                                 const brillo::Blob& sha256_hash_data,
+                                 const EVP_PKEY* public_key,
+                                 brillo::Blob* decrypted_sig_data,
+                                 bool* fatal) const;
+
   // Decrypts |sig_data| with the given |public_key| and populates
   // |out_hash_data| with the decoded raw hash. Returns true if successful,
   // false otherwise.
@@ -82,7 +95,8 @@ class PayloadVerifier {
                                const EVP_PKEY* public_key,
                                brillo::Blob* out_hash_data) const;
 
-  std::vector<std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>> public_keys_;
+  // Shared with the other instances created from the same zip file.
+  std::shared_ptr<const PublicKeys> public_keys_;
 };
 
 }  // namespace chromeos_update_engine
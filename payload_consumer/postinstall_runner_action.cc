@@ -24,8 +24,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cmath>
 #include <fstream>
+#include <iterator>
 #include <string>
 
 #include <base/files/file_path.h>
@@ -40,6 +42,7 @@
 #include "update_engine/common/error_code_utils.h"
 #include "update_engine/common/platform_constants.h"
 #include "update_engine/common/subprocess.h"
+#include "update_engine/common/tracing.h"
 #include "update_engine/common/utils.h"
 
 namespace {
@@ -93,22 +96,71 @@ PostinstallRunnerAction::PostinstallRunnerAction(
   fs_mount_dir_ = temp_dir.value();
 #endif  // __ANDROID__
   CHECK(!fs_mount_dir_.empty());
-  EnsureUnmounted();
+  EnsureUnmounted(fs_mount_dir_);
   LOG(INFO) << "postinstall mount point: " << fs_mount_dir_;
 }
 
-void PostinstallRunnerAction::EnsureUnmounted() {
-  if (utils::IsMountpoint(fs_mount_dir_)) {
-    LOG(INFO) << "Found previously mounted filesystem at " << fs_mount_dir_;
-    utils::UnmountFilesystem(fs_mount_dir_);
+void PostinstallRunnerAction::EnsureUnmounted(const string& mount_dir) {
+  if (utils::IsMountpoint(mount_dir)) {
+    LOG(INFO) << "Found previously mounted filesystem at " << mount_dir;
+    utils::UnmountFilesystem(mount_dir);
   }
 }
 
 void PostinstallRunnerAction::PerformAction() {
   CHECK(HasInputObject());
   CHECK(boot_control_);
+  performing_ = true;
+  if (early_error_) {
+    return CompletePostinstall(*early_error_);
+  }
   install_plan_ = GetInputObject();
+  if (prepared_) {
+    LOG(INFO) << "Postinstall started on " << current_partition_
+              << " partitions while verifying them.";
+    InitializePartitionWeights();
+  } else if (!PreparePostinstall()) {
+    return;
+  }
+
+  // We always powerwash when rolling back, however policy can determine
+  // if this is a full/normal powerwash, or a special rollback powerwash
+  // that retains a small amount of system state such as enrollment and
+  // network configuration. In both cases all user accounts are deleted.
+  if (install_plan_.powerwash_required || install_plan_.is_rollback) {
+    if (hardware_->SchedulePowerwash(
+            install_plan_.rollback_data_save_requested)) {
+      powerwash_scheduled_ = true;
+    } else {
+      StopJobs();
+      return CompletePostinstall(ErrorCode::kPostinstallPowerwashError);
+    }
+  }
+
+  num_verified_partitions_ = install_plan_.partitions.size();
+  ReportProgress();
+  PerformPartitionPostinstall();
+}
+
+void PostinstallRunnerAction::StartVerifiedPartitions(
+    const InstallPlan& install_plan, size_t num_verified) {
+  if (performing_ || early_error_ || install_plan.download_url.empty()) {
+    return;
+  }
+  if (!prepared_) {
+    install_plan_ = install_plan;
+    if (!PreparePostinstall()) {
+      return;
+    }
+  }
+  num_verified_partitions_ =
+      std::max(num_verified_partitions_,
+               std::min(num_verified, install_plan_.partitions.size()));
+  PerformPartitionPostinstall();
+}
 
+bool PostinstallRunnerAction::PreparePostinstall() {
+  prepared_ = true;
   auto dynamic_control = boot_control_->GetDynamicPartitionControl();
   CHECK(dynamic_control);
 
@@ -118,25 +170,31 @@ void PostinstallRunnerAction::PerformAction() {
     // must be closed, and MapAllPartitions() should be called.
     if (!install_plan_.partitions.empty()) {
       if (!dynamic_control->MapAllPartitions()) {
-        return CompletePostinstall(ErrorCode::kPostInstallMountError);
+        CompletePostinstall(ErrorCode::kPostInstallMountError);
+        return false;
       }
     }
   }
 
-  // We always powerwash when rolling back, however policy can determine
-  // if this is a full/normal powerwash, or a special rollback powerwash
-  // that retains a small amount of system state such as enrollment and
-  // network configuration. In both cases all user accounts are deleted.
-  if (install_plan_.powerwash_required || install_plan_.is_rollback) {
-    if (hardware_->SchedulePowerwash(
-            install_plan_.rollback_data_save_requested)) {
-      powerwash_scheduled_ = true;
-    } else {
-      return CompletePostinstall(ErrorCode::kPostinstallPowerwashError);
+  InitializePartitionWeights();
+  accumulated_weight_ = 0;
+
+  free_mount_dirs_ = {fs_mount_dir_};
+  for (uint32_t i = 1; i < install_plan_.postinstall_concurrency; i++) {
+    const string mount_dir = fs_mount_dir_ + "_" + std::to_string(i);
+    if (!base::DirectoryExists(base::FilePath(mount_dir)) &&
+        !base::CreateDirectory(base::FilePath(mount_dir))) {
+      PLOG(WARNING) << "Unable to create mount point " << mount_dir
+                    << ", running " << i << " postinstall programs at most.";
+      break;
     }
+    EnsureUnmounted(mount_dir);
+    free_mount_dirs_.push_back(mount_dir);
   }
+  return true;
+}
 
-  // Initialize all the partition weights.
+void PostinstallRunnerAction::InitializePartitionWeights() {
   partition_weight_.resize(install_plan_.partitions.size());
   total_weight_ = 0;
   for (size_t i = 0; i < install_plan_.partitions.size(); ++i) {
@@ -153,17 +211,10 @@ void PostinstallRunnerAction::PerformAction() {
     partition_weight_[i] = partition.run_postinstall;
     total_weight_ += partition_weight_[i];
   }
-  accumulated_weight_ = 0;
-  ReportProgress(0);
-
-  PerformPartitionPostinstall();
 }
 
 bool PostinstallRunnerAction::MountPartition(
-    const InstallPlan::Partition& partition) noexcept {
-  // Perform post-install for the current_partition_ partition. At this point we
-  // need to call CompletePartitionPostinstall to complete the operation and
-  // cleanup.
+    const InstallPlan::Partition& partition, const string& mount_dir) noexcept {
   const auto mountable_device = partition.readonly_target_path;
   if (!utils::FileExists(mountable_device.c_str())) {
     LOG(ERROR) << "Mountable device " << mountable_device << " for partition "
@@ -171,14 +222,14 @@ bool PostinstallRunnerAction::MountPartition(
     return false;
   }
 
-  if (!utils::FileExists(fs_mount_dir_.c_str())) {
-    LOG(ERROR) << "Mount point " << fs_mount_dir_
+  if (!utils::FileExists(mount_dir.c_str())) {
+    LOG(ERROR) << "Mount point " << mount_dir
                << " does not exist, mount call will fail";
     return false;
   }
-  // Double check that the fs_mount_dir is not busy with a previous mounted
+  // Double check that the mount_dir is not busy with a previous mounted
   // filesystem from a previous crashed postinstall step.
-  EnsureUnmounted();
+  EnsureUnmounted(mount_dir);
 
 #ifdef __ANDROID__
 #if !defined(__ANDROID_RECOVERY__) && defined(RUN_BACKUPTOOL)
@@ -223,7 +274,7 @@ bool PostinstallRunnerAction::MountPartition(
     }
     // Mount the target partition R/W
     LOG(INFO) << "Running backuptool scripts";
-    utils::MountFilesystem(mountable_device, fs_mount_dir_, MS_NOATIME | MS_NODEV | MS_NODIRATIME,
+    utils::MountFilesystem(mountable_device, mount_dir, MS_NOATIME | MS_NODEV | MS_NODIRATIME,
                            partition.filesystem_type, "seclabel");
 
     // Switch to a permissive domain
@@ -247,7 +298,7 @@ bool PostinstallRunnerAction::MountPartition(
     LOG(INFO) << "Skipping backuptool scripts";
   }
 
-  utils::UnmountFilesystem(fs_mount_dir_);
+  utils::UnmountFilesystem(mount_dir);
 #endif  // !__ANDROID_RECOVERY__ && RUN_BACKUPTOOL
 
   // In Chromium OS, the postinstall step is allowed to write to the block
@@ -262,7 +313,7 @@ bool PostinstallRunnerAction::MountPartition(
 
   if (!utils::MountFilesystem(
           mountable_device,
-          fs_mount_dir_,
+          mount_dir,
           MS_RDONLY,
           partition.filesystem_type,
           hardware_->GetPartitionMountOptions(partition.name))) {
@@ -271,71 +322,123 @@ bool PostinstallRunnerAction::MountPartition(
   return true;
 }
 
+bool PostinstallRunnerAction::IsSerialPostinstall(
+    const InstallPlan::Partition& partition) const {
+  const auto& serial = install_plan_.serial_postinstall_partitions;
+  return free_mount_dirs_.size() + jobs_.size() <= 1 ||
+         std::find(serial.begin(), serial.end(), partition.name) !=
+             serial.end();
+}
+
+string PostinstallRunnerAction::TakeMountDir() {
+  auto it = std::find(
+      free_mount_dirs_.begin(), free_mount_dirs_.end(), fs_mount_dir_);
+  if (it == free_mount_dirs_.end()) {
+    it = std::prev(free_mount_dirs_.end());
+  }
+  string mount_dir = std::move(*it);
+  free_mount_dirs_.erase(it);
+  return mount_dir;
+}
+
 void PostinstallRunnerAction::PerformPartitionPostinstall() {
   if (install_plan_.download_url.empty()) {
     LOG(INFO) << "Skipping post-install";
     return CompletePostinstall(ErrorCode::kSuccess);
   }
 
-  // Skip all the partitions that don't have a post-install step.
-  while (current_partition_ < install_plan_.partitions.size() &&
-         !install_plan_.partitions[current_partition_].run_postinstall) {
-    VLOG(1) << "Skipping post-install on partition "
-            << install_plan_.partitions[current_partition_].name;
-    // Attempt to mount a device if it has postinstall script configured, even
-    // if we want to skip running postinstall script.
-    // This is because we've seen bugs like b/198787355 which is only triggered
-    // when you attempt to mount a device. If device fails to mount, it will
-    // likely fail to mount during boot anyway, so it's better to catch any
-    // issues earlier.
-    // It's possible that some of the partitions aren't mountable, but these
-    // partitions shouldn't have postinstall configured. Therefore we guard this
-    // logic with |postinstall_path.empty()|.
+  while (current_partition_ < num_verified_partitions_) {
+    // Wait for a mount point, and for the program running alone to complete.
+    if (free_mount_dirs_.empty() ||
+        (!jobs_.empty() &&
+         IsSerialPostinstall(install_plan_.partitions[jobs_[0]->partition]))) {
+      return;
+    }
     const auto& partition = install_plan_.partitions[current_partition_];
-    if (!partition.postinstall_path.empty()) {
-      const auto mountable_device = partition.readonly_target_path;
-      if (!MountPartition(partition)) {
-        return CompletePostinstall(ErrorCode::kPostInstallMountError);
-      }
-      LogBuildInfoForPartition(fs_mount_dir_);
-      if (!utils::UnmountFilesystem(fs_mount_dir_)) {
-        return CompletePartitionPostinstall(
-            1, "Error unmounting the device " + mountable_device);
+    // Skip all the partitions that don't have a post-install step.
+    if (!partition.run_postinstall) {
+      VLOG(1) << "Skipping post-install on partition " << partition.name;
+      // Attempt to mount a device if it has postinstall script configured,
+      // even if we want to skip running postinstall script.
+      // This is because we've seen bugs like b/198787355 which is only
+      // triggered when you attempt to mount a device. If device fails to
+      // mount, it will likely fail to mount during boot anyway, so it's better
+      // to catch any issues earlier.
+      // It's possible that some of the partitions aren't mountable, but these
+      // partitions shouldn't have postinstall configured. Therefore we guard
+      // this logic with |postinstall_path.empty()|.
+      if (!partition.postinstall_path.empty()) {
+        const string mount_dir = TakeMountDir();
+        free_mount_dirs_.push_back(mount_dir);
+        if (!MountPartition(partition, mount_dir)) {
+          StopJobs();
+          return CompletePostinstall(ErrorCode::kPostInstallMountError);
+        }
+        LogBuildInfoForPartition(mount_dir);
+        if (!utils::UnmountFilesystem(mount_dir)) {
+          LOG(ERROR) << "Error unmounting the device "
+                     << partition.readonly_target_path;
+          if (!partition.postinstall_optional) {
+            StopJobs();
+            return CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+          }
+          LOG(INFO) << "Ignoring postinstall failure since it is optional";
+        }
       }
+      current_partition_++;
+      continue;
+    }
+    // A program running alone waits for the previous ones to complete.
+    if (IsSerialPostinstall(partition) && !jobs_.empty()) {
+      return;
+    }
+    if (!StartPartitionPostinstall(current_partition_++)) {
+      return;
     }
-    current_partition_++;
   }
-  if (current_partition_ == install_plan_.partitions.size())
-    return CompletePostinstall(ErrorCode::kSuccess);
+  if (jobs_.empty() && performing_) {
+    CompletePostinstall(ErrorCode::kSuccess);
+  }
+}
 
+bool PostinstallRunnerAction::StartPartitionPostinstall(
+    size_t partition_index) {
   const InstallPlan::Partition& partition =
-      install_plan_.partitions[current_partition_];
+      install_plan_.partitions[partition_index];
+  jobs_.push_back(std::make_unique<PostinstallJob>());
+  PostinstallJob* job = jobs_.back().get();
+  job->partition = partition_index;
+  job->mount_dir = TakeMountDir();
 
   const string mountable_device = partition.readonly_target_path;
-  // Perform post-install for the current_partition_ partition. At this point we
-  // need to call CompletePartitionPostinstall to complete the operation and
-  // cleanup.
+  // Perform post-install for the partition. At this point we need to call
+  // CompletePartitionPostinstall to complete the operation and cleanup.
 
-  if (!MountPartition(partition)) {
+  if (!MountPartition(partition, job->mount_dir)) {
+    StopJobs();
     CompletePostinstall(ErrorCode::kPostInstallMountError);
-    return;
+    return false;
   }
-  LogBuildInfoForPartition(fs_mount_dir_);
+  LogBuildInfoForPartition(job->mount_dir);
   base::FilePath postinstall_path(partition.postinstall_path);
   if (postinstall_path.IsAbsolute()) {
     LOG(ERROR) << "Invalid absolute path passed to postinstall, use a relative"
                   "path instead: "
                << partition.postinstall_path;
-    return CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+    StopJobs();
+    CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+    return false;
   }
 
   string abs_path =
-      base::FilePath(fs_mount_dir_).Append(postinstall_path).value();
+      base::FilePath(job->mount_dir).Append(postinstall_path).value();
   if (!base::StartsWith(
-          abs_path, fs_mount_dir_, base::CompareCase::SENSITIVE)) {
+          abs_path, job->mount_dir, base::CompareCase::SENSITIVE)) {
     LOG(ERROR) << "Invalid relative postinstall path: "
                << partition.postinstall_path;
-    return CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+    StopJobs();
+    CompletePostinstall(ErrorCode::kPostinstallRunnerError);
+    return false;
   }
 
   LOG(INFO) << "Performing postinst (" << partition.postinstall_path << " at "
@@ -360,112 +463,154 @@ void PostinstallRunnerAction::PerformPartitionPostinstall() {
   command.push_back(partition.target_path);
 #endif  // __ANDROID__
 
-  current_command_ = Subprocess::Get().ExecFlags(
+  UE_TRACE_ASYNC_BEGIN("Postinstall", job);
+  job->command = Subprocess::Get().ExecFlags(
       command,
       Subprocess::kRedirectStderrToStdout,
       {kPostinstallStatusFd},
       base::Bind(&PostinstallRunnerAction::CompletePartitionPostinstall,
-                 base::Unretained(this)));
+                 base::Unretained(this),
+                 base::Unretained(job)));
   // Subprocess::Exec should never return a negative process id.
-  CHECK_GE(current_command_, 0);
+  CHECK_GE(job->command, 0);
 
-  if (!current_command_) {
-    CompletePartitionPostinstall(1, "Postinstall didn't launch");
-    return;
+  if (!job->command) {
+    CompletePartitionPostinstall(job, 1, "Postinstall didn't launch");
+    return false;
   }
 
   // Monitor the status file descriptor.
-  progress_fd_ =
-      Subprocess::Get().GetPipeFd(current_command_, kPostinstallStatusFd);
-  int fd_flags = fcntl(progress_fd_, F_GETFL, 0) | O_NONBLOCK;
-  if (HANDLE_EINTR(fcntl(progress_fd_, F_SETFL, fd_flags)) < 0) {
-    PLOG(ERROR) << "Unable to set non-blocking I/O mode on fd " << progress_fd_;
+  job->progress_fd =
+      Subprocess::Get().GetPipeFd(job->command, kPostinstallStatusFd);
+  int fd_flags = fcntl(job->progress_fd, F_GETFL, 0) | O_NONBLOCK;
+  if (HANDLE_EINTR(fcntl(job->progress_fd, F_SETFL, fd_flags)) < 0) {
+    PLOG(ERROR) << "Unable to set non-blocking I/O mode on fd "
+                << job->progress_fd;
   }
 
-  progress_controller_ = base::FileDescriptorWatcher::WatchReadable(
-      progress_fd_,
+  job->progress_controller = base::FileDescriptorWatcher::WatchReadable(
+      job->progress_fd,
       base::BindRepeating(&PostinstallRunnerAction::OnProgressFdReady,
-                          base::Unretained(this)));
+                          base::Unretained(this),
+                          base::Unretained(job)));
+  return true;
 }
 
-void PostinstallRunnerAction::OnProgressFdReady() {
+void PostinstallRunnerAction::OnProgressFdReady(PostinstallJob* job) {
   char buf[1024];
   size_t bytes_read;
   do {
     bytes_read = 0;
     bool eof;
-    bool ok =
-        utils::ReadAll(progress_fd_, buf, base::size(buf), &bytes_read, &eof);
-    progress_buffer_.append(buf, bytes_read);
+    bool ok = utils::ReadAll(
+        job->progress_fd, buf, base::size(buf), &bytes_read, &eof);
+    job->progress_buffer.append(buf, bytes_read);
     // Process every line.
-    vector<string> lines = base::SplitString(
-        progress_buffer_, "\n", base::KEEP_WHITESPACE, base::SPLIT_WANT_ALL);
+    vector<string> lines = base::SplitString(job->progress_buffer,
+                                             "\n",
+                                             base::KEEP_WHITESPACE,
+                                             base::SPLIT_WANT_ALL);
     if (!lines.empty()) {
-      progress_buffer_ = lines.back();
+      job->progress_buffer = lines.back();
       lines.pop_back();
       for (const auto& line : lines) {
-        ProcessProgressLine(line);
+        ProcessProgressLine(job, line);
       }
     }
     if (!ok || eof) {
       // There was either an error or an EOF condition, so we are done watching
       // the file descriptor.
-      progress_controller_.reset();
+      job->progress_controller.reset();
       return;
     }
   } while (bytes_read);
 }
 
-bool PostinstallRunnerAction::ProcessProgressLine(const string& line) {
+bool PostinstallRunnerAction::ProcessProgressLine(PostinstallJob* job,
+                                                  const string& line) {
   double frac = 0;
   if (sscanf(line.c_str(), "global_progress %lf", &frac) == 1 &&
       !std::isnan(frac)) {
-    ReportProgress(frac);
+    if (!std::isfinite(frac) || frac < 0)
+      frac = 0;
+    if (frac > 1)
+      frac = 1;
+    job->progress = frac;
+    ReportProgress();
     return true;
   }
 
   return false;
 }
 
-void PostinstallRunnerAction::ReportProgress(double frac) {
-  if (!delegate_)
+void PostinstallRunnerAction::ReportProgress() {
+  // The progress of the programs started early is reported with the action.
+  if (!delegate_ || !performing_)
     return;
-  if (current_partition_ >= partition_weight_.size() || total_weight_ == 0) {
+  if ((current_partition_ >= partition_weight_.size() && jobs_.empty()) ||
+      total_weight_ == 0) {
     delegate_->ProgressUpdate(1.);
     return;
   }
-  if (!std::isfinite(frac) || frac < 0)
-    frac = 0;
-  if (frac > 1)
-    frac = 1;
-  double postinst_action_progress =
-      (accumulated_weight_ + partition_weight_[current_partition_] * frac) /
-      total_weight_;
-  delegate_->ProgressUpdate(postinst_action_progress);
+  double weight = accumulated_weight_;
+  for (const auto& job : jobs_) {
+    weight += partition_weight_[job->partition] * job->progress;
+  }
+  delegate_->ProgressUpdate(weight / total_weight_);
 }
 
-void PostinstallRunnerAction::Cleanup() {
-  utils::UnmountFilesystem(fs_mount_dir_);
+void PostinstallRunnerAction::Cleanup(PostinstallJob* job) {
+  utils::UnmountFilesystem(job->mount_dir);
+  free_mount_dirs_.push_back(std::move(job->mount_dir));
+
+  job->progress_fd = -1;
+  job->progress_controller.reset();
+
+  job->progress_buffer.clear();
+}
+
+void PostinstallRunnerAction::StopJobs() {
+  for (auto& job : jobs_) {
+    if (job->command) {
+      // Calling KillExec() will discard the callback we registered and
+      // therefore the unretained reference to this object.
+      Subprocess::Get().KillExec(job->command);
+
+      // If the command has been suspended, resume it after KillExec() so that
+      // the process can process the SIGTERM sent by KillExec().
+      if (job->is_suspended && kill(job->command, SIGCONT) != 0) {
+        PLOG(ERROR) << "Couldn't resume child process " << job->command;
+      }
+      job->command = 0;
+    }
+    Cleanup(job.get());
+  }
+  jobs_.clear();
+}
+
+void PostinstallRunnerAction::RemoveMountDirs() {
 #ifndef __ANDROID__
+  for (const auto& mount_dir : free_mount_dirs_) {
 #if BASE_VER < 800000
-  if (!base::DeleteFile(base::FilePath(fs_mount_dir_), true)) {
+    if (!base::DeleteFile(base::FilePath(mount_dir), true)) {
 #else
-  if (!base::DeleteFile(base::FilePath(fs_mount_dir_))) {
+    if (!base::DeleteFile(base::FilePath(mount_dir))) {
 #endif
-    PLOG(WARNING) << "Not removing temporary mountpoint " << fs_mount_dir_;
+      PLOG(WARNING) << "Not removing temporary mountpoint " << mount_dir;
+    }
   }
 #endif
-
-  progress_fd_ = -1;
-  progress_controller_.reset();
-
-  progress_buffer_.clear();
 }
 
 void PostinstallRunnerAction::CompletePartitionPostinstall(
-    int return_code, const string& output) {
-  current_command_ = 0;
-  Cleanup();
+    PostinstallJob* job, int return_code, const string& output) {
+  UE_TRACE_ASYNC_END("Postinstall", job);
+  job->command = 0;
+  Cleanup(job);
+  const size_t partition_index = job->partition;
+  jobs_.erase(std::find_if(jobs_.begin(), jobs_.end(), [job](const auto& j) {
+    return j.get() == job;
+  }));
 
   if (return_code != 0) {
     LOG(ERROR) << "Postinst command failed with code: " << return_code;
@@ -487,20 +632,24 @@ void PostinstallRunnerAction::CompletePartitionPostinstall(
 
     // If postinstall script for this partition is optional we can ignore the
     // result.
-    if (install_plan_.partitions[current_partition_].postinstall_optional) {
+    if (install_plan_.partitions[partition_index].postinstall_optional) {
       LOG(INFO) << "Ignoring postinstall failure since it is optional";
     } else {
+      StopJobs();
       return CompletePostinstall(error_code);
     }
   }
-  accumulated_weight_ += partition_weight_[current_partition_];
-  current_partition_++;
-  ReportProgress(0);
+  accumulated_weight_ += partition_weight_[partition_index];
+  ReportProgress();
 
   PerformPartitionPostinstall();
 }
 
 PostinstallRunnerAction::~PostinstallRunnerAction() {
+  if (!jobs_.empty()) {
+    StopJobs();
+    RemoveMountDirs();
+  }
   if (!install_plan_.partitions.empty()) {
     auto dynamic_control = boot_control_->GetDynamicPartitionControl();
     CHECK(dynamic_control);
@@ -510,6 +659,12 @@ PostinstallRunnerAction::~PostinstallRunnerAction() {
 }
 
 void PostinstallRunnerAction::CompletePostinstall(ErrorCode error_code) {
+  if (!performing_) {
+    LOG(ERROR) << "Postinstall started while verifying failed, reporting "
+               << utils::ErrorCodeToString(error_code) << " later.";
+    early_error_ = error_code;
+    return;
+  }
   // We only attempt to mark the new slot as active if all the postinstall
   // steps succeeded.
   DEFER {
@@ -549,6 +704,7 @@ void PostinstallRunnerAction::CompletePostinstall(ErrorCode error_code) {
     }
   }
 
+  RemoveMountDirs();
   LOG(INFO) << "All post-install commands succeeded";
   if (HasOutputPipe()) {
     SetOutputObject(install_plan_);
@@ -556,40 +712,34 @@ void PostinstallRunnerAction::CompletePostinstall(ErrorCode error_code) {
 }
 
 void PostinstallRunnerAction::SuspendAction() {
-  if (!current_command_)
-    return;
-  if (kill(current_command_, SIGSTOP) != 0) {
-    PLOG(ERROR) << "Couldn't pause child process " << current_command_;
-  } else {
-    is_current_command_suspended_ = true;
+  for (auto& job : jobs_) {
+    if (!job->command)
+      continue;
+    if (kill(job->command, SIGSTOP) != 0) {
+      PLOG(ERROR) << "Couldn't pause child process " << job->command;
+    } else {
+      job->is_suspended = true;
+    }
   }
 }
 
 void PostinstallRunnerAction::ResumeAction() {
-  if (!current_command_)
-    return;
-  if (kill(current_command_, SIGCONT) != 0) {
-    PLOG(ERROR) << "Couldn't resume child process " << current_command_;
-  } else {
-    is_current_command_suspended_ = false;
+  for (auto& job : jobs_) {
+    if (!job->command)
+      continue;
+    if (kill(job->command, SIGCONT) != 0) {
+      PLOG(ERROR) << "Couldn't resume child process " << job->command;
+    } else {
+      job->is_suspended = false;
+    }
   }
 }
 
 void PostinstallRunnerAction::TerminateProcessing() {
-  if (!current_command_)
+  if (jobs_.empty())
     return;
-  // Calling KillExec() will discard the callback we registered and therefore
-  // the unretained reference to this object.
-  Subprocess::Get().KillExec(current_command_);
-
-  // If the command has been suspended, resume it after KillExec() so that the
-  // process can process the SIGTERM sent by KillExec().
-  if (is_current_command_suspended_) {
-    ResumeAction();
-  }
-
-  current_command_ = 0;
-  Cleanup();
+  StopJobs();
+  RemoveMountDirs();
 }
 
 }  // namespace chromeos_update_engine
@@ -18,6 +18,7 @@
 #define UPDATE_ENGINE_PAYLOAD_CONSUMER_POSTINSTALL_RUNNER_ACTION_H_
 
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
@@ -33,6 +34,15 @@
 
 // The Postinstall Runner Action is responsible for running the postinstall
 // script of a successfully downloaded update.
+//
+// With InstallPlan::postinstall_concurrency above 1, the scripts of several
+// partitions run at the same time, each partition mounted on its own mount
+// point. The partitions listed in InstallPlan::serial_postinstall_partitions
+// are ordering barriers: their script runs alone, on the default mount point.
+//
+// With InstallPlan::early_postinstall, FilesystemVerifierAction hands over the
+// partitions as it verifies them, in order, so that they are mounted and their
+// scripts run while the next partitions are verified.
 
 namespace chromeos_update_engine {
 
@@ -50,6 +60,14 @@ class PostinstallRunnerAction : public InstallPlanAction {
   void ResumeAction() override;
   void TerminateProcessing() override;
 
+  // Starts the postinstall of the first |num_verified| partitions of
+  // |install_plan|, already verified, before the action is performed. Called
+  // again as more partitions are verified. Failures are reported once the
+  // action is performed, and the programs still running when the action is
+  // destroyed without being performed are killed.
+  void StartVerifiedPartitions(const InstallPlan& install_plan,
+                               size_t num_verified);
+
   class DelegateInterface {
    public:
     virtual ~DelegateInterface() = default;
@@ -68,37 +86,90 @@ class PostinstallRunnerAction : public InstallPlanAction {
  private:
   friend class PostinstallRunnerActionTest;
   FRIEND_TEST(PostinstallRunnerActionTest, ProcessProgressLineTest);
+  FRIEND_TEST(PostinstallRunnerActionTest, ConcurrentProgressTest);
+
+  // A postinstall program being run.
+  struct PostinstallJob {
+    // The index of the partition in the InstallPlan.
+    size_t partition{0};
+    // Where the partition is mounted.
+    std::string mount_dir;
+
+    // The process running the program, or 0 if it's not running.
+    pid_t command{0};
+    // True if |command| has been suspended by SuspendAction().
+    bool is_suspended{false};
+
+    // The parent progress file descriptor used to watch for progress reports
+    // from the program and the task watching for them.
+    int progress_fd{-1};
+    std::unique_ptr<base::FileDescriptorWatcher::Controller>
+        progress_controller;
+    // A buffer of a partial read line from |progress_fd|.
+    std::string progress_buffer;
+    // The last progress reported by the program, between 0 and 1.
+    double progress{0};
+  };
 
   // exposed for testing purposes only
   void SetMountDir(std::string dir) { fs_mount_dir_ = std::move(dir); }
-  void EnsureUnmounted();
-
+  pid_t current_command() const {
+    return jobs_.empty() ? 0 : jobs_.front()->command;
+  }
+  void EnsureUnmounted(const std::string& mount_dir);
+
+  // Maps the partitions and sets up the weights and the mount points. Returns
+  // false if it failed, in which case the failure was already handled.
+  bool PreparePostinstall();
+  // Sets the weights of the partitions, skipping the optional postinstall
+  // programs if needed.
+  void InitializePartitionWeights();
+
+  // Starts the postinstall programs of the next partitions, as long as there
+  // is a free mount point and the partitions don't need to run alone.
   void PerformPartitionPostinstall();
-  [[nodiscard]] bool MountPartition(
-      const InstallPlan::Partition& partition) noexcept;
+  // Mounts the partition at |partition_index| and starts its postinstall
+  // program. Returns false if it didn't start, in which case the failure was
+  // already handled.
+  bool StartPartitionPostinstall(size_t partition_index);
+  [[nodiscard]] bool MountPartition(const InstallPlan::Partition& partition,
+                                    const std::string& mount_dir) noexcept;
 
-  // Called whenever the |progress_fd_| has data available to read.
-  void OnProgressFdReady();
+  // Whether the postinstall program of |partition| must run alone.
+  bool IsSerialPostinstall(const InstallPlan::Partition& partition) const;
 
-  // Updates the action progress according to the |line| passed from the
+  // Returns a free mount point, preferably |fs_mount_dir_|.
+  std::string TakeMountDir();
+
+  // Called whenever the |progress_fd| of |job| has data available to read.
+  void OnProgressFdReady(PostinstallJob* job);
+
+  // Updates the progress of |job| according to the |line| passed from the
   // postinstall program. Valid lines are:
   //     global_progress <frac>
   //         <frac> should be between 0.0 and 1.0; sets the progress to the
   //         <frac> value.
-  bool ProcessProgressLine(const std::string& line);
+  bool ProcessProgressLine(PostinstallJob* job, const std::string& line);
+
+  // Report the overall progress to the delegate, from the weight of the
+  // completed partitions and the progress of the running programs.
+  void ReportProgress();
 
-  // Report the progress to the delegate given that the postinstall operation
-  // for |current_partition_| has a current progress of |frac|, a value between
-  // 0 and 1 for that step.
-  void ReportProgress(double frac);
+  // Cleanup the setup made when running postinstall for |job|. Unmount the
+  // partition and cleanup the status file descriptor and message loop task
+  // watching for it.
+  void Cleanup(PostinstallJob* job);
 
-  // Cleanup the setup made when running postinstall for a given partition.
-  // Unmount and remove the mountpoint directory if needed and cleanup the
-  // status file descriptor and message loop task watching for it.
-  void Cleanup();
+  // Kills the running postinstall programs and cleans up their jobs.
+  void StopJobs();
+
+  // Removes the temporary mount points, if any.
+  void RemoveMountDirs();
 
   // Subprocess::Exec callback.
-  void CompletePartitionPostinstall(int return_code, const std::string& output);
+  void CompletePartitionPostinstall(PostinstallJob* job,
+                                    int return_code,
+                                    const std::string& output);
 
   // Complete the Action with the passed |error_code| and mark the new slot as
   // ready. Called when the post-install script was run for all the partitions.
@@ -107,10 +178,30 @@ class PostinstallRunnerAction : public InstallPlanAction {
   // The path where the filesystem will be mounted during post-install.
   std::string fs_mount_dir_;
 
-  // The partition being processed on the list of partitions specified in the
+  // The mount points not used by a running program. Besides |fs_mount_dir_|,
+  // postinstall_concurrency - 1 mount points named after it are used to run
+  // programs concurrently.
+  std::vector<std::string> free_mount_dirs_;
+
+  // The next partition to process on the list of partitions specified in the
   // InstallPlan.
   size_t current_partition_{0};
 
+  // The partitions before this one may be processed: all of them once the
+  // action is performed, the verified ones before that.
+  size_t num_verified_partitions_{0};
+
+  // Whether PreparePostinstall() was called, and whether the action is being
+  // performed.
+  bool prepared_{false};
+  bool performing_{false};
+
+  // The error of the postinstall started before the action was performed.
+  std::optional<ErrorCode> early_error_;
+
+  // The postinstall programs running, in the order they started.
+  std::vector<std::unique_ptr<PostinstallJob>> jobs_;
+
   // A non-negative value representing the estimated weight of each partition
   // passed in the install plan. The weight is used to predict the overall
   // progress from the individual progress of each partition and should
@@ -120,8 +211,8 @@ class PostinstallRunnerAction : public InstallPlanAction {
   // The sum of all the weights in |partition_weight_|.
   double total_weight_{0};
 
-  // The sum of all the weights in |partition_weight_| up to but not including
-  // the |current_partition_|.
+  // The sum of the weights in |partition_weight_| of the partitions whose
+  // postinstall completed.
   double accumulated_weight_{0};
 
   // The delegate used to notify of progress updates, if any.
@@ -137,21 +228,6 @@ class PostinstallRunnerAction : public InstallPlanAction {
   // Used for cleaning up if post-install fails.
   bool powerwash_scheduled_{false};
 
-  // Postinstall command currently running, or 0 if no program running.
-  pid_t current_command_{0};
-
-  // True if |current_command_| has been suspended by SuspendAction().
-  bool is_current_command_suspended_{false};
-
-  // The parent progress file descriptor used to watch for progress reports from
-  // the postinstall program and the task watching for them.
-  int progress_fd_{-1};
-
-  std::unique_ptr<base::FileDescriptorWatcher::Controller> progress_controller_;
-
-  // A buffer of a partial read line from the progress file descriptor.
-  std::string progress_buffer_;
-
   DISALLOW_COPY_AND_ASSIGN(PostinstallRunnerAction);
 };
 
@@ -116,9 +116,9 @@ class PostinstallRunnerActionTest : public ::testing::Test {
   }
 
   void SuspendRunningAction() {
-    if (!postinstall_action_ || !postinstall_action_->current_command_ ||
+    if (!postinstall_action_ || !postinstall_action_->current_command() ||
         test_utils::Readlink(base::StringPrintf(
-            "/proc/%d/fd/0", postinstall_action_->current_command_)) !=
+            "/proc/%d/fd/0", postinstall_action_->current_command())) !=
             "/dev/zero") {
       // We need to wait for the postinstall command to start and flag that it
       // is ready by redirecting its input to /dev/zero.
@@ -139,7 +139,7 @@ class PostinstallRunnerActionTest : public ::testing::Test {
   }
 
   void CancelWhenStarted() {
-    if (!postinstall_action_ || !postinstall_action_->current_command_) {
+    if (!postinstall_action_ || !postinstall_action_->current_command()) {
       // Wait for the postinstall command to run.
       loop_.PostDelayedTask(
           FROM_HERE,
@@ -180,6 +180,10 @@ class PostinstallRunnerActionTest : public ::testing::Test {
   // The PostinstallRunnerAction delegate receiving the progress updates.
   PostinstallRunnerAction::DelegateInterface* setup_action_delegate_{nullptr};
 
+  // If not 0, the number of partitions handed to the action as verified
+  // before it is performed.
+  size_t num_verified_partitions_{0};
+
   // A pointer to the posinstall_runner action and the processor.
   PostinstallRunnerAction* postinstall_action_{nullptr};
   ActionProcessor* processor_{nullptr};
@@ -219,6 +223,10 @@ void PostinstallRunnerActionTest::RunPostinstallActionWithInstallPlan(
   TEST_AND_RETURN(base::CreateNewTempDirectory("postinstall", &temp_dir));
   postinstall_action_->SetMountDir(temp_dir.value());
   runner_action->set_delegate(setup_action_delegate_);
+  if (num_verified_partitions_ > 0) {
+    runner_action->StartVerifiedPartitions(install_plan,
+                                           num_verified_partitions_);
+  }
   BondActions(feeder_action.get(), runner_action.get());
   auto collector_action =
       std::make_unique<ObjectCollectorAction<InstallPlan>>();
@@ -250,28 +258,101 @@ TEST_F(PostinstallRunnerActionTest, ProcessProgressLineTest) {
   testing::StrictMock<MockPostinstallRunnerActionDelegate> mock_delegate_;
   action.set_delegate(&mock_delegate_);
 
-  action.current_partition_ = 1;
+  action.current_partition_ = 2;
   action.partition_weight_ = {1, 2, 5};
   action.accumulated_weight_ = 1;
   action.total_weight_ = 8;
+  action.jobs_.push_back(
+      std::make_unique<PostinstallRunnerAction::PostinstallJob>());
+  auto job = action.jobs_.back().get();
+  job->partition = 1;
 
   // 50% of the second action is 2/8 = 0.25 of the total.
   EXPECT_CALL(mock_delegate_, ProgressUpdate(0.25));
-  action.ProcessProgressLine("global_progress 0.5");
+  action.ProcessProgressLine(job, "global_progress 0.5");
   testing::Mock::VerifyAndClearExpectations(&mock_delegate_);
 
   // 1.5 should be read as 100%, to catch rounding error cases like 1.000001.
   // 100% of the second is 3/8 of the total.
   EXPECT_CALL(mock_delegate_, ProgressUpdate(0.375));
-  action.ProcessProgressLine("global_progress 1.5");
+  action.ProcessProgressLine(job, "global_progress 1.5");
   testing::Mock::VerifyAndClearExpectations(&mock_delegate_);
 
   // None of these should trigger a progress update.
-  action.ProcessProgressLine("foo_bar");
-  action.ProcessProgressLine("global_progress");
-  action.ProcessProgressLine("global_progress ");
-  action.ProcessProgressLine("global_progress NaN");
-  action.ProcessProgressLine("global_progress Exception in ... :)");
+  action.ProcessProgressLine(job, "foo_bar");
+  action.ProcessProgressLine(job, "global_progress");
+  action.ProcessProgressLine(job, "global_progress ");
+  action.ProcessProgressLine(job, "global_progress NaN");
+  action.ProcessProgressLine(job, "global_progress Exception in ... :)");
+}
+
+TEST_F(PostinstallRunnerActionTest, ConcurrentProgressTest) {
+  PostinstallRunnerAction action(&fake_boot_control_, &fake_hardware_);
+  testing::StrictMock<MockPostinstallRunnerActionDelegate> mock_delegate_;
+  action.set_delegate(&mock_delegate_);
+
+  action.current_partition_ = 3;
+  action.partition_weight_ = {1, 2, 5};
+  action.accumulated_weight_ = 1;
+  action.total_weight_ = 8;
+  for (size_t partition : {1, 2}) {
+    action.jobs_.push_back(
+        std::make_unique<PostinstallRunnerAction::PostinstallJob>());
+    action.jobs_.back()->partition = partition;
+  }
+
+  // 50% of the second action is 2/8 = 0.25 of the total.
+  EXPECT_CALL(mock_delegate_, ProgressUpdate(0.25));
+  action.ProcessProgressLine(action.jobs_[0].get(), "global_progress 0.5");
+  testing::Mock::VerifyAndClearExpectations(&mock_delegate_);
+
+  // Adding 40% of the third action makes it 4/8 of the total.
+  EXPECT_CALL(mock_delegate_, ProgressUpdate(0.5));
+  action.ProcessProgressLine(action.jobs_[1].get(), "global_progress 0.4");
+  testing::Mock::VerifyAndClearExpectations(&mock_delegate_);
+  action.jobs_.clear();
+}
+
+// Test that the postinstall programs of the partitions verified can start
+// before the action is performed, and that the action then runs the others.
+TEST_F(PostinstallRunnerActionTest, RunAsRootEarlyPostinstallTest) {
+  ScopedLoopbackDeviceBinder loop(postinstall_image_, false, nullptr);
+  InstallPlan install_plan;
+  for (const char* name : {"part1", "part2"}) {
+    InstallPlan::Partition part;
+    part.name = name;
+    part.target_path = loop.dev();
+    part.readonly_target_path = loop.dev();
+    part.run_postinstall = true;
+    part.postinstall_path = kPostinstallDefaultScript;
+    install_plan.partitions.push_back(part);
+  }
+  install_plan.download_url = "http://127.0.0.1:8080/update";
+  install_plan.early_postinstall = true;
+  num_verified_partitions_ = 1;
+
+  RunPostinstallActionWithInstallPlan(install_plan);
+  EXPECT_EQ(ErrorCode::kSuccess, processor_delegate_.code_);
+  EXPECT_TRUE(processor_delegate_.processing_done_called_);
+}
+
+// Test that a failure of a postinstall program started before the action is
+// performed is reported by the action.
+TEST_F(PostinstallRunnerActionTest, RunAsRootEarlyPostinstallErrorTest) {
+  ScopedLoopbackDeviceBinder loop(postinstall_image_, false, nullptr);
+  InstallPlan::Partition part;
+  part.name = "part";
+  part.target_path = loop.dev();
+  part.readonly_target_path = loop.dev();
+  part.run_postinstall = true;
+  part.postinstall_path = "/etc/../bin/sh";
+  InstallPlan install_plan;
+  install_plan.partitions = {part};
+  install_plan.download_url = "http://127.0.0.1:8080/update";
+  num_verified_partitions_ = 1;
+
+  RunPostinstallActionWithInstallPlan(install_plan);
+  EXPECT_EQ(ErrorCode::kPostinstallRunnerError, processor_delegate_.code_);
 }
 
 // Test that postinstall succeeds in the simple case of running the default
@@ -289,6 +370,29 @@ TEST_F(PostinstallRunnerActionTest, RunAsRootSimpleTest) {
   EXPECT_FALSE(fake_hardware_.GetIsRollbackPowerwashScheduled());
 }
 
+// Test that the postinstall programs of several partitions can run at the
+// same time, on their own mount points.
+TEST_F(PostinstallRunnerActionTest, RunAsRootConcurrentPostinstallTest) {
+  ScopedLoopbackDeviceBinder loop(postinstall_image_, false, nullptr);
+  InstallPlan install_plan;
+  for (const char* name : {"part1", "part2", "part3"}) {
+    InstallPlan::Partition part;
+    part.name = name;
+    part.target_path = loop.dev();
+    part.readonly_target_path = loop.dev();
+    part.run_postinstall = true;
+    part.postinstall_path = kPostinstallDefaultScript;
+    install_plan.partitions.push_back(part);
+  }
+  install_plan.download_url = "http://127.0.0.1:8080/update";
+  install_plan.postinstall_concurrency = 2;
+  install_plan.serial_postinstall_partitions = {"part3"};
+
+  RunPostinstallActionWithInstallPlan(install_plan);
+  EXPECT_EQ(ErrorCode::kSuccess, processor_delegate_.code_);
+  EXPECT_TRUE(processor_delegate_.processing_done_called_);
+}
+
 TEST_F(PostinstallRunnerActionTest, RunAsRootRunSymlinkFileTest) {
   ScopedLoopbackDeviceBinder loop(postinstall_image_, false, nullptr);
   RunPostinstallAction(loop.dev(), "bin/postinst_link", false, false, false);
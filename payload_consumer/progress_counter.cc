@@ -0,0 +1,66 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/progress_counter.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <base/bind.h>
+#include <base/logging.h>
+
+namespace chromeos_update_engine {
+
+double ProgressCounter::Fraction() const {
+  const uint64_t total_units = total();
+  if (total_units == 0) {
+    return 0;
+  }
+  return std::min(1.0, static_cast<double>(done()) / total_units);
+}
+
+ProgressSampler::ProgressSampler(const ProgressCounter* counter,
+                                 base::TimeDelta interval,
+                                 Callback callback)
+    : counter_(counter), interval_(interval), callback_(std::move(callback)) {
+  CHECK(counter_);
+}
+
+void ProgressSampler::Start() {
+  Stop();
+  last_fraction_ = -1;
+  Sample();
+}
+
+void ProgressSampler::Stop() {
+  sample_task_.Cancel();
+}
+
+void ProgressSampler::Sample() {
+  // Scheduled first, so that the callback may stop the sampler.
+  CHECK(sample_task_.PostTask(
+      FROM_HERE,
+      base::BindOnce(&ProgressSampler::Sample, base::Unretained(this)),
+      interval_));
+  const double fraction = counter_->Fraction();
+  if (fraction != last_fraction_) {
+    last_fraction_ = fraction;
+    callback_.Run(fraction);
+  }
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,95 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_PROGRESS_COUNTER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_PROGRESS_COUNTER_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include <base/callback.h>
+#include <base/macros.h>
+#include <base/time/time.h>
+
+#include "update_engine/common/scoped_task_id.h"
+
+namespace chromeos_update_engine {
+
+// Progress of work done on worker threads, which bump it without locks, for
+// the message loop to sample it with a ProgressSampler instead of the workers
+// posting a task for every chunk of work.
+class ProgressCounter {
+ public:
+  ProgressCounter() = default;
+
+  // Starts over with |total| units of work, 0 if unknown. Must not race with
+  // Add().
+  void Reset(uint64_t total) {
+    done_ = 0;
+    total_ = total;
+  }
+
+  // Adds |amount| units of work done; safe from any thread.
+  void Add(uint64_t amount) {
+    done_.fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  uint64_t done() const { return done_.load(std::memory_order_relaxed); }
+  uint64_t total() const { return total_.load(std::memory_order_relaxed); }
+
+  // Returns the ratio of the work done, capped at 1, or 0 if the total is
+  // unknown.
+  double Fraction() const;
+
+ private:
+  std::atomic<uint64_t> done_{0};
+  std::atomic<uint64_t> total_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(ProgressCounter);
+};
+
+// Samples a ProgressCounter on the current message loop every |interval| and
+// runs |callback| with its Fraction() whenever it changed since the previous
+// sample.
+class ProgressSampler {
+ public:
+  using Callback = base::RepeatingCallback<void(double)>;
+
+  ProgressSampler(const ProgressCounter* counter,
+                  base::TimeDelta interval,
+                  Callback callback);
+  ~ProgressSampler() = default;
+
+  void Start();
+  void Stop();
+
+ private:
+  void Sample();
+
+  const ProgressCounter* counter_;
+  const base::TimeDelta interval_;
+  Callback callback_;
+  // The value last reported, negative before the first one.
+  double last_fraction_{-1};
+  ScopedTaskId sample_task_;
+
+  DISALLOW_COPY_AND_ASSIGN(ProgressSampler);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_PROGRESS_COUNTER_H_
@@ -0,0 +1,83 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/progress_counter.h"
+
+#include <thread>
+#include <vector>
+
+#include <base/bind.h>
+#include <brillo/message_loops/fake_message_loop.h>
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+TEST(ProgressCounterTest, FractionTest) {
+  ProgressCounter counter;
+  EXPECT_EQ(0, counter.Fraction());
+  counter.Add(10);
+  // Unknown total.
+  EXPECT_EQ(0, counter.Fraction());
+  counter.Reset(100);
+  EXPECT_EQ(0U, counter.done());
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&counter] {
+      for (int j = 0; j < 10; j++) {
+        counter.Add(1);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(40U, counter.done());
+  EXPECT_DOUBLE_EQ(0.4, counter.Fraction());
+  counter.Add(100);
+  EXPECT_DOUBLE_EQ(1, counter.Fraction());
+}
+
+TEST(ProgressSamplerTest, ReportsChangesTest) {
+  brillo::FakeMessageLoop loop{nullptr};
+  loop.SetAsCurrent();
+  ProgressCounter counter;
+  counter.Reset(4);
+  std::vector<double> reported;
+  ProgressSampler sampler(
+      &counter,
+      base::TimeDelta::FromMilliseconds(100),
+      base::BindRepeating(
+          [](std::vector<double>* reported, double fraction) {
+            reported->push_back(fraction);
+          },
+          &reported));
+  sampler.Start();
+  EXPECT_EQ(std::vector<double>({0}), reported);
+  // Unchanged progress isn't reported again.
+  EXPECT_TRUE(loop.RunOnce(false));
+  EXPECT_EQ(1U, reported.size());
+  counter.Add(1);
+  counter.Add(1);
+  EXPECT_TRUE(loop.RunOnce(false));
+  EXPECT_EQ(std::vector<double>({0, 0.5}), reported);
+  sampler.Stop();
+  counter.Add(2);
+  EXPECT_FALSE(loop.RunOnce(false));
+  EXPECT_EQ(2U, reported.size());
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,123 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/read_ahead_reader.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+ReadAheadReader::ReadAheadReader(
+    FileDescriptor* fd,
+    uint64_t start,
+    uint64_t end,
+    size_t chunk_size,
+    size_t depth,
+    std::vector<std::unique_ptr<FileDescriptor>> more_fds)
+    : more_fds_(std::move(more_fds)),
+      end_(end),
+      chunk_size_(chunk_size),
+      depth_(std::max<size_t>(depth, more_fds_.size() + 1)),
+      next_read_(start),
+      next_return_(start),
+      end_of_chunks_(end) {
+  CHECK_GT(chunk_size_, 0U);
+  threads_.emplace_back(&ReadAheadReader::ReaderMain, this, fd);
+  for (const auto& more_fd : more_fds_) {
+    threads_.emplace_back(&ReadAheadReader::ReaderMain, this, more_fd.get());
+  }
+}
+
+ReadAheadReader::~ReadAheadReader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+bool ReadAheadReader::Next(const uint8_t** data, size_t* size) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  current_.Reset();
+  cv_.wait(lock, [this] {
+    return ready_.count(next_return_) || next_return_ >= end_of_chunks_;
+  });
+  // The chunks before a failed read are still returned, not those after it.
+  if (next_return_ >= end_of_chunks_) {
+    return false;
+  }
+  auto it = ready_.find(next_return_);
+  current_ = std::move(it->second);
+  ready_.erase(it);
+  next_return_ += current_.size();
+  lock.unlock();
+  cv_.notify_all();
+  *data = current_.data();
+  *size = current_.size();
+  return true;
+}
+
+void ReadAheadReader::ReaderMain(FileDescriptor* fd) {
+  while (true) {
+    uint64_t offset = 0;
+    size_t size = 0;
+    {
+      // The chunks are claimed in order, and read by whichever thread is
+      // free, so that a slow chunk doesn't hold up the reads of the next ones.
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] {
+        return stopping_ || next_read_ >= end_of_chunks_ ||
+               next_read_ - next_return_ < depth_ * chunk_size_;
+      });
+      if (stopping_ || next_read_ >= end_of_chunks_) {
+        return;
+      }
+      offset = next_read_;
+      size = std::min<uint64_t>(chunk_size_, end_ - offset);
+      next_read_ += size;
+    }
+    // The buffers of the chunks consumed return to the pool, and are reused
+    // for the next reads.
+    AlignedBuffer buffer = AlignedBufferPool::Get()->Acquire(size);
+    ssize_t bytes_read = 0;
+    const bool success =
+        utils::ReadAll(fd, buffer.data(), size, offset, &bytes_read) &&
+        static_cast<size_t>(bytes_read) == size;
+    LOG_IF(ERROR, !success) << "Failed to read offset " << offset
+                            << " expected " << size
+                            << " bytes, actual: " << bytes_read;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (success) {
+        ready_.emplace(offset, std::move(buffer));
+      } else {
+        end_of_chunks_ = std::min(end_of_chunks_, offset);
+      }
+    }
+    cv_.notify_all();
+  }
+}
+
+}  // namespace chromeos_update_engine
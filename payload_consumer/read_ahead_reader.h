@@ -0,0 +1,97 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_READ_AHEAD_READER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_READ_AHEAD_READER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <base/macros.h>
+
+#include "update_engine/payload_consumer/aligned_buffer_pool.h"
+#include "update_engine/payload_consumer/file_descriptor.h"
+
+namespace chromeos_update_engine {
+
+// Reads a range of a file on a dedicated thread, a few chunks ahead of the
+// consumer, so that the consumer processes a chunk while the next ones are
+// being read. The file must not be used by anyone else while the reader is
+// alive. The chunks are read into buffers of the AlignedBufferPool, so |fd|
+// may be opened with O_DIRECT if the range and the chunk size are aligned to
+// kDirectIoAlignment.
+//
+// Reads which cost CPU, e.g. those decompressing a COW, can be spread over
+// several descriptors reading the same content, each on its own thread.
+class ReadAheadReader {
+ public:
+  // Starts reading the bytes of |fd| from |start| to |end|, in chunks of
+  // |chunk_size| bytes, the last one possibly shorter. At most |depth| chunks
+  // are read ahead of the one returned by Next(). The chunks are also read
+  // from each of |more_fds|, which read the same content as |fd| and are
+  // owned by the reader; |depth| is raised to the number of descriptors.
+  ReadAheadReader(FileDescriptor* fd,
+                  uint64_t start,
+                  uint64_t end,
+                  size_t chunk_size,
+                  size_t depth,
+                  std::vector<std::unique_ptr<FileDescriptor>> more_fds = {});
+  // Stops reading, after waiting for the reads in progress.
+  ~ReadAheadReader();
+
+  // Waits for the next chunk and sets |data| and |size| to it. The chunk stays
+  // valid until the next call. Returns false if reading the chunk failed or if
+  // all the chunks were returned.
+  bool Next(const uint8_t** data, size_t* size);
+
+ private:
+  void ReaderMain(FileDescriptor* fd);
+
+  std::vector<std::unique_ptr<FileDescriptor>> more_fds_;
+  const uint64_t end_;
+  const size_t chunk_size_;
+  const size_t depth_;
+
+  // The chunk last returned by Next().
+  AlignedBuffer current_;
+
+  // The fields below are protected by |mutex_|.
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // The chunks read and not returned yet, by offset.
+  std::map<uint64_t, AlignedBuffer> ready_;
+  // The offset of the next chunk to read, and of the next one to return.
+  uint64_t next_read_;
+  uint64_t next_return_;
+  // The end of the chunks returned, lowered to the offset of a failed read.
+  uint64_t end_of_chunks_;
+  bool stopping_{false};
+
+  std::vector<std::thread> threads_;
+
+  DISALLOW_COPY_AND_ASSIGN(ReadAheadReader);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_READ_AHEAD_READER_H_
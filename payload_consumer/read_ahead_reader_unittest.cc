@@ -0,0 +1,109 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/read_ahead_reader.h"
+
+#include <fcntl.h>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/file_descriptor.h"
+
+namespace chromeos_update_engine {
+
+class ReadAheadReaderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    data_.resize(10 * 1000 + 123);
+    test_utils::FillWithData(&data_);
+    ASSERT_TRUE(test_utils::WriteFileVector(file_.path(), data_));
+    ASSERT_TRUE(fd_.Open(file_.path().c_str(), O_RDONLY));
+  }
+
+  // Reads all the chunks of |reader| and returns them concatenated.
+  static brillo::Blob ReadAll(ReadAheadReader* reader, size_t chunk_size) {
+    brillo::Blob result;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    while (reader->Next(&data, &size)) {
+      EXPECT_LE(size, chunk_size);
+      result.insert(result.end(), data, data + size);
+    }
+    return result;
+  }
+
+  ScopedTempFile file_{"ReadAheadReaderTest.XXXXXX"};
+  EintrSafeFileDescriptor fd_;
+  brillo::Blob data_;
+};
+
+TEST_F(ReadAheadReaderTest, ReadsRangeInOrderTest) {
+  for (size_t depth : {1, 2, 8}) {
+    ReadAheadReader reader(&fd_, 100, data_.size(), 1000, depth);
+    EXPECT_EQ(brillo::Blob(data_.begin() + 100, data_.end()),
+              ReadAll(&reader, 1000))
+        << "depth " << depth;
+  }
+}
+
+TEST_F(ReadAheadReaderTest, ReadsWithMoreDescriptorsInOrderTest) {
+  for (size_t depth : {1, 2, 8}) {
+    std::vector<std::unique_ptr<FileDescriptor>> more_fds;
+    for (int i = 0; i < 3; i++) {
+      more_fds.push_back(std::make_unique<EintrSafeFileDescriptor>());
+      ASSERT_TRUE(more_fds.back()->Open(file_.path().c_str(), O_RDONLY));
+    }
+    ReadAheadReader reader(
+        &fd_, 100, data_.size(), 100, depth, std::move(more_fds));
+    EXPECT_EQ(brillo::Blob(data_.begin() + 100, data_.end()),
+              ReadAll(&reader, 100))
+        << "depth " << depth;
+  }
+}
+
+TEST_F(ReadAheadReaderTest, EmptyRangeTest) {
+  ReadAheadReader reader(&fd_, 10, 10, 1000, 4);
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+  EXPECT_FALSE(reader.Next(&data, &size));
+}
+
+TEST_F(ReadAheadReaderTest, ReadPastEndFailsTest) {
+  // The chunks before the failing read are still returned.
+  ReadAheadReader reader(&fd_, 0, data_.size() + 1, 4096, 4);
+  const brillo::Blob result = ReadAll(&reader, 4096);
+  EXPECT_EQ(brillo::Blob(data_.begin(), data_.begin() + 2 * 4096), result);
+}
+
+TEST_F(ReadAheadReaderTest, StopsBeforeEndTest) {
+  ReadAheadReader reader(&fd_, 0, data_.size(), 16, 2);
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+  ASSERT_TRUE(reader.Next(&data, &size));
+  EXPECT_EQ(brillo::Blob(data_.begin(), data_.begin() + 16),
+            brillo::Blob(data, data + size));
+  // The destructor stops the reads still pending.
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,126 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/satisfied_operations.h"
+
+#include <string.h>
+
+#include <base/logging.h>
+
+#include "update_engine/payload_consumer/file_descriptor_utils.h"
+
+using google::protobuf::RepeatedPtrField;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Adds the range at |offset| of |length| bytes to |ranges|, merged with the
+// last one if no more than |min_gap| bytes separate them.
+void AddRange(vector<SatisfiedOperations::Range>* ranges,
+              uint64_t offset,
+              uint64_t length,
+              uint64_t min_gap) {
+  if (!ranges->empty()) {
+    auto& last = ranges->back();
+    const uint64_t last_end = last.first + last.second;
+    if (offset >= last_end && offset - last_end <= min_gap) {
+      last.second = offset + length - last.first;
+      return;
+    }
+  }
+  ranges->emplace_back(offset, length);
+}
+
+}  // namespace
+
+size_t SatisfiedOperations::CheckPartition(const PartitionUpdate& partition,
+                                           size_t first_operation,
+                                           FileDescriptorPtr target,
+                                           size_t block_size) {
+  const size_t end_operation = first_operation + partition.operations_size();
+  if (skip_.size() < end_operation)
+    skip_.resize(end_operation, Skip::kNone);
+
+  size_t satisfied = 0;
+  for (int i = 0; i < partition.operations_size(); i++) {
+    const InstallOperation& op = partition.operations(i);
+    if (!op.has_dst_sha256_hash() || op.dst_extents_size() == 0)
+      continue;
+    brillo::Blob hash;
+    if (!fd_utils::ReadAndHashExtents(
+            target, op.dst_extents(), block_size, &hash)) {
+      LOG(WARNING) << "Failed to read the target of operation " << i << " of "
+                   << partition.partition_name() << ", not skipping it.";
+      continue;
+    }
+    if (hash.size() != op.dst_sha256_hash().size() ||
+        memcmp(hash.data(), op.dst_sha256_hash().data(), hash.size()) != 0) {
+      continue;
+    }
+    skip_[first_operation + i] = Skip::kApply;
+    satisfied++;
+  }
+  count_ += satisfied;
+  return satisfied;
+}
+
+vector<SatisfiedOperations::Range> SatisfiedOperations::PlanDownload(
+    const RepeatedPtrField<PartitionUpdate>& partitions,
+    uint64_t signatures_offset,
+    uint64_t signatures_size,
+    uint64_t min_gap) {
+  vector<Range> ranges;
+  size_t index = 0;
+  for (const PartitionUpdate& partition : partitions) {
+    for (const InstallOperation& op : partition.operations()) {
+      if (op.data_length() > 0 && Get(index) == Skip::kNone)
+        AddRange(&ranges, op.data_offset(), op.data_length(), min_gap);
+      index++;
+    }
+  }
+  if (signatures_size > 0)
+    AddRange(&ranges, signatures_offset, signatures_size, min_gap);
+
+  // The satisfied operations whose data falls outside of |ranges| don't need
+  // it. Both the operations and the ranges are in the order of the data.
+  auto range = ranges.begin();
+  index = 0;
+  for (const PartitionUpdate& partition : partitions) {
+    for (const InstallOperation& op : partition.operations()) {
+      if (Get(index) != Skip::kNone) {
+        while (range != ranges.end() &&
+               range->first + range->second <= op.data_offset()) {
+          range++;
+        }
+        if (op.data_length() > 0 &&
+            (range == ranges.end() || range->first > op.data_offset())) {
+          skip_[index] = Skip::kDownload;
+        }
+      }
+      index++;
+    }
+  }
+  return ranges;
+}
+
+void SatisfiedOperations::Clear() {
+  skip_.clear();
+  count_ = 0;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,94 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_SATISFIED_OPERATIONS_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_SATISFIED_OPERATIONS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <base/macros.h>
+
+#include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Finds the operations of a payload whose target blocks already hold the data
+// they write, as recorded in their |dst_sha256_hash|, so that re-applying a
+// payload over a partially updated partition doesn't redo them.
+class SatisfiedOperations {
+ public:
+  // How an operation is skipped.
+  enum class Skip : uint8_t {
+    // The operation is applied.
+    kNone,
+    // The operation isn't applied, but its data is still downloaded.
+    kApply,
+    // Neither the operation nor its data are needed.
+    kDownload,
+  };
+
+  // A range of the payload data, as an offset and a length.
+  using Range = std::pair<uint64_t, uint64_t>;
+
+  SatisfiedOperations() = default;
+
+  // Reads from |target| the blocks written by the operations of |partition|
+  // which have a |dst_sha256_hash|, and marks the operations whose hash
+  // matches as satisfied. |first_operation| is the index of the first
+  // operation of |partition| in the payload. Returns the number of satisfied
+  // operations.
+  size_t CheckPartition(const PartitionUpdate& partition,
+                        size_t first_operation,
+                        FileDescriptorPtr target,
+                        size_t block_size);
+
+  // Returns the ranges of the payload data to download, relative to the start
+  // of the data blobs, given the operations of all the |partitions| and the
+  // signatures blob at |signatures_offset|. The data of the operations which
+  // aren't satisfied is downloaded, and gaps shorter than |min_gap| between
+  // two ranges are downloaded too to save requests; the satisfied operations
+  // whose data is still downloaded are only skipped at apply time.
+  std::vector<Range> PlanDownload(
+      const google::protobuf::RepeatedPtrField<PartitionUpdate>& partitions,
+      uint64_t signatures_offset,
+      uint64_t signatures_size,
+      uint64_t min_gap);
+
+  // Returns how the operation at index |operation| of the payload is skipped.
+  Skip Get(size_t operation) const {
+    return operation < skip_.size() ? skip_[operation] : Skip::kNone;
+  }
+
+  // Returns the number of satisfied operations.
+  size_t count() const { return count_; }
+
+  void Clear();
+
+ private:
+  // How each operation is skipped, by index in the payload.
+  std::vector<Skip> skip_;
+  size_t count_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(SatisfiedOperations);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_SATISFIED_OPERATIONS_H_
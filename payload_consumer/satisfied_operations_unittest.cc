@@ -0,0 +1,117 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/satisfied_operations.h"
+
+#include <fcntl.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+using google::protobuf::RepeatedPtrField;
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr size_t kBlockSize = 4;
+using Skip = SatisfiedOperations::Skip;
+using Range = SatisfiedOperations::Range;
+
+}  // namespace
+
+class SatisfiedOperationsTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // Blocks 0 and 2 are up to date, blocks 1 and 3 aren't.
+    EXPECT_TRUE(
+        test_utils::WriteFileString(target_file_.path(), "aaaa....cccc...."));
+    EXPECT_TRUE(target_->Open(target_file_.path().c_str(), O_RDONLY));
+  }
+
+  // Adds to |partition_| an operation writing |data| to |block|, with
+  // |data_length| bytes of data after those of the previous operation.
+  void AddOperation(uint64_t block, const string& data, uint64_t data_length) {
+    InstallOperation* op = partition_.add_operations();
+    op->set_type(InstallOperation::REPLACE);
+    *op->add_dst_extents() = ExtentForRange(block, 1);
+    brillo::Blob hash;
+    EXPECT_TRUE(HashCalculator::RawHashOfData(
+        brillo::Blob(data.begin(), data.end()), &hash));
+    op->set_dst_sha256_hash(hash.data(), hash.size());
+    op->set_data_offset(data_offset_);
+    op->set_data_length(data_length);
+    data_offset_ += data_length;
+  }
+
+  ScopedTempFile target_file_{"satisfied_ops.XXXXXX"};
+  FileDescriptorPtr target_{new EintrSafeFileDescriptor()};
+  PartitionUpdate partition_;
+  uint64_t data_offset_{0};
+  SatisfiedOperations satisfied_;
+};
+
+TEST_F(SatisfiedOperationsTest, CheckPartitionTest) {
+  AddOperation(0, "aaaa", 10);
+  AddOperation(1, "bbbb", 10);
+  AddOperation(2, "cccc", 10);
+  // Without a hash, an operation is always applied.
+  AddOperation(3, "....", 10);
+  partition_.mutable_operations(3)->clear_dst_sha256_hash();
+
+  EXPECT_EQ(2u, satisfied_.CheckPartition(partition_, 5, target_, kBlockSize));
+  EXPECT_EQ(2u, satisfied_.count());
+  EXPECT_EQ(Skip::kNone, satisfied_.Get(0));
+  EXPECT_EQ(Skip::kApply, satisfied_.Get(5));
+  EXPECT_EQ(Skip::kNone, satisfied_.Get(6));
+  EXPECT_EQ(Skip::kApply, satisfied_.Get(7));
+  EXPECT_EQ(Skip::kNone, satisfied_.Get(8));
+  EXPECT_EQ(Skip::kNone, satisfied_.Get(100));
+}
+
+TEST_F(SatisfiedOperationsTest, PlanDownloadTest) {
+  AddOperation(0, "aaaa", 10);
+  AddOperation(1, "bbbb", 10);
+  AddOperation(2, "cccc", 10);
+  AddOperation(3, "dddd", 10);
+  AddOperation(0, "aaaa", 100);
+  AddOperation(1, "bbbb", 10);
+  RepeatedPtrField<PartitionUpdate> partitions;
+  *partitions.Add() = partition_;
+  EXPECT_EQ(3u, satisfied_.CheckPartition(partition_, 0, target_, kBlockSize));
+
+  // The 10 bytes of operation 2 are downloaded between those of operations 1
+  // and 3, the 100 bytes of operation 4 aren't.
+  EXPECT_EQ(vector<Range>({{10, 30}, {140, 30}}),
+            satisfied_.PlanDownload(partitions, 150, 20, 10));
+  EXPECT_EQ(Skip::kDownload, satisfied_.Get(0));
+  EXPECT_EQ(Skip::kNone, satisfied_.Get(1));
+  EXPECT_EQ(Skip::kApply, satisfied_.Get(2));
+  EXPECT_EQ(Skip::kNone, satisfied_.Get(3));
+  EXPECT_EQ(Skip::kDownload, satisfied_.Get(4));
+  EXPECT_EQ(Skip::kNone, satisfied_.Get(5));
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,125 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/shared_blobs.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <base/logging.h>
+
+using google::protobuf::RepeatedPtrField;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+bool IsReplace(InstallOperation::Type type) {
+  return type == InstallOperation::REPLACE ||
+         type == InstallOperation::REPLACE_BZ ||
+         type == InstallOperation::REPLACE_XZ ||
+         type == InstallOperation::REPLACE_ZSTD;
+}
+
+}  // namespace
+
+bool SharedBlobs::Init(const RepeatedPtrField<PartitionUpdate>& partitions,
+                       uint64_t max_size) {
+  Clear();
+  // The blobs which follow each other, as an offset and a length, in order.
+  vector<std::pair<uint64_t, uint64_t>> blobs;
+  uint64_t next_offset = 0;
+  uint64_t shared_size = 0;
+  size_t index = 0;
+  for (const PartitionUpdate& partition : partitions) {
+    for (const InstallOperation& op : partition.operations()) {
+      const size_t operation = index++;
+      if (op.data_length() == 0)
+        continue;
+      if (op.data_offset() >= next_offset) {
+        blobs.emplace_back(op.data_offset(), op.data_length());
+        next_offset = op.data_offset() + op.data_length();
+        continue;
+      }
+      auto blob = std::lower_bound(
+          blobs.begin(),
+          blobs.end(),
+          op.data_offset(),
+          [](const std::pair<uint64_t, uint64_t>& blob, uint64_t offset) {
+            return blob.first < offset;
+          });
+      if (blob == blobs.end() || blob->first != op.data_offset() ||
+          blob->second != op.data_length() || !IsReplace(op.type())) {
+        LOG(ERROR) << "Operation " << operation << " references "
+                   << op.data_length() << " bytes at offset "
+                   << op.data_offset() << " of the payload data, which aren't "
+                   << "the blob of an earlier operation it may share.";
+        Clear();
+        return false;
+      }
+      auto [last_use, inserted] = last_use_.emplace(op.data_offset(), 0);
+      last_use->second = operation;
+      if (inserted)
+        shared_size += op.data_length();
+      if (references_.size() <= operation)
+        references_.resize(operation + 1);
+      references_[operation] = true;
+    }
+  }
+  if (shared_size > max_size) {
+    LOG(ERROR) << "The operations share " << shared_size
+               << " bytes of blobs, more than the " << max_size
+               << " bytes allowed.";
+    Clear();
+    return false;
+  }
+  LOG_IF(INFO, has_references())
+      << "The operations share " << last_use_.size() << " blobs of "
+      << shared_size << " bytes.";
+  return true;
+}
+
+void SharedBlobs::Store(size_t operation,
+                        const InstallOperation& op,
+                        const uint8_t* data) {
+  if (op.data_length() == 0 || IsReference(operation) ||
+      last_use_.count(op.data_offset()) == 0) {
+    return;
+  }
+  blobs_[op.data_offset()] = SharedBuffer::Copy(data, op.data_length());
+}
+
+const SharedBuffer* SharedBlobs::Find(const InstallOperation& op) const {
+  const auto blob = blobs_.find(op.data_offset());
+  return blob == blobs_.end() ? nullptr : &blob->second;
+}
+
+void SharedBlobs::Release(size_t operation, const InstallOperation& op) {
+  if (!IsReference(operation))
+    return;
+  const auto last_use = last_use_.find(op.data_offset());
+  if (last_use != last_use_.end() && last_use->second <= operation)
+    blobs_.erase(op.data_offset());
+}
+
+void SharedBlobs::Clear() {
+  references_.clear();
+  last_use_.clear();
+  blobs_.clear();
+}
+
+}  // namespace chromeos_update_engine
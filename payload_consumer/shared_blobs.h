@@ -0,0 +1,96 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_SHARED_BLOBS_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_SHARED_BLOBS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include <base/macros.h>
+
+#include "update_engine/payload_consumer/shared_buffer.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// The largest |shared_blobs_size| of a payload accepted, as the client holds
+// that much memory at worst.
+constexpr uint64_t kMaxSharedBlobsSize = 64 * 1024 * 1024;
+
+// Keeps the data blobs of a payload which REPLACE operations reference again
+// after the operation they follow, see |shared_blobs_size| in the manifest.
+// The payload data is streamed, so each of these blobs is held from the
+// operation downloading it until the last operation referencing it.
+class SharedBlobs {
+ public:
+  SharedBlobs() = default;
+
+  // Finds the operations of |partitions| referencing the blob of an earlier
+  // operation, by index in the payload. Returns false unless they are REPLACE
+  // operations referencing a whole blob, and the blobs referenced total at
+  // most |max_size| bytes.
+  bool Init(
+      const google::protobuf::RepeatedPtrField<PartitionUpdate>& partitions,
+      uint64_t max_size);
+
+  // Returns whether the operation at index |operation| of the payload
+  // references the blob of an earlier operation instead of its own.
+  bool IsReference(size_t operation) const {
+    return operation < references_.size() && references_[operation];
+  }
+
+  // Keeps a copy of the |data| of |op|, at index |operation| of the payload,
+  // if later operations reference it.
+  void Store(size_t operation, const InstallOperation& op, const uint8_t* data);
+
+  // Returns the blob referenced by |op|, or nullptr if it isn't held, e.g.
+  // because the update resumed after the operation downloading it. The
+  // operations applied in the background keep a reference to it, not a copy.
+  const SharedBuffer* Find(const InstallOperation& op) const;
+
+  // Drops the blob referenced by |op|, at index |operation| of the payload,
+  // if no later operation references it.
+  void Release(size_t operation, const InstallOperation& op);
+
+  // Returns whether any operation references the blob of another.
+  bool has_references() const { return !last_use_.empty(); }
+
+  // Returns whether blobs are held for later operations. The progress can't
+  // be checkpointed meanwhile, as a resumed update wouldn't have them.
+  bool empty() const { return blobs_.empty(); }
+
+  void Clear();
+
+ private:
+  // Whether each operation references the blob of an earlier one, by index
+  // in the payload.
+  std::vector<bool> references_;
+
+  // The index of the last operation referencing each shared blob, by offset.
+  std::map<uint64_t, size_t> last_use_;
+
+  // The shared blobs held, by offset.
+  std::map<uint64_t, SharedBuffer> blobs_;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedBlobs);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_SHARED_BLOBS_H_
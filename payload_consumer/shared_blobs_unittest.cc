@@ -0,0 +1,118 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/shared_blobs.h"
+
+#include <gtest/gtest.h>
+
+using google::protobuf::RepeatedPtrField;
+
+namespace chromeos_update_engine {
+
+class SharedBlobsTest : public ::testing::Test {
+ protected:
+  // Adds to |partition| a REPLACE operation with the |data_length| bytes of
+  // data at |data_offset|.
+  static void AddOperation(PartitionUpdate* partition,
+                           uint64_t data_offset,
+                           uint64_t data_length) {
+    InstallOperation* op = partition->add_operations();
+    op->set_type(InstallOperation::REPLACE);
+    op->set_data_offset(data_offset);
+    op->set_data_length(data_length);
+  }
+
+  RepeatedPtrField<PartitionUpdate> partitions_;
+  SharedBlobs shared_blobs_;
+};
+
+TEST_F(SharedBlobsTest, NoReferencesTest) {
+  PartitionUpdate* partition = partitions_.Add();
+  AddOperation(partition, 0, 4);
+  partition->add_operations()->set_type(InstallOperation::ZERO);
+  AddOperation(partition, 4, 2);
+  EXPECT_TRUE(shared_blobs_.Init(partitions_, 0));
+  EXPECT_FALSE(shared_blobs_.has_references());
+  EXPECT_FALSE(shared_blobs_.IsReference(0));
+  EXPECT_FALSE(shared_blobs_.IsReference(2));
+}
+
+TEST_F(SharedBlobsTest, ReferencesAcrossPartitionsTest) {
+  AddOperation(partitions_.Add(), 0, 4);
+  AddOperation(&partitions_[0], 4, 2);
+  AddOperation(partitions_.Add(), 6, 3);
+  AddOperation(&partitions_[1], 0, 4);
+  AddOperation(&partitions_[1], 4, 2);
+  AddOperation(&partitions_[1], 0, 4);
+  EXPECT_FALSE(shared_blobs_.Init(partitions_, 5));
+  ASSERT_TRUE(shared_blobs_.Init(partitions_, 6));
+  EXPECT_TRUE(shared_blobs_.has_references());
+  EXPECT_FALSE(shared_blobs_.IsReference(0));
+  EXPECT_FALSE(shared_blobs_.IsReference(2));
+  EXPECT_TRUE(shared_blobs_.IsReference(3));
+  EXPECT_TRUE(shared_blobs_.IsReference(5));
+
+  const uint8_t data[] = "abcdefghi";
+  const InstallOperation& op0 = partitions_[0].operations(0);
+  const InstallOperation& op1 = partitions_[0].operations(1);
+  const InstallOperation& op2 = partitions_[1].operations(0);
+  shared_blobs_.Store(0, op0, data);
+  shared_blobs_.Store(1, op1, data + 4);
+  // Blobs not referenced again aren't kept.
+  shared_blobs_.Store(2, op2, data + 6);
+  EXPECT_EQ(nullptr, shared_blobs_.Find(op2));
+
+  const InstallOperation& ref0 = partitions_[1].operations(1);
+  const InstallOperation& ref1 = partitions_[1].operations(2);
+  const SharedBuffer* blob = shared_blobs_.Find(ref0);
+  ASSERT_NE(nullptr, blob);
+  EXPECT_EQ((brillo::Blob{'a', 'b', 'c', 'd'}),
+            brillo::Blob(blob->begin(), blob->end()));
+  shared_blobs_.Release(3, ref0);
+  // The blob is referenced again by the last operation.
+  EXPECT_NE(nullptr, shared_blobs_.Find(ref0));
+  blob = shared_blobs_.Find(ref1);
+  ASSERT_NE(nullptr, blob);
+  EXPECT_EQ((brillo::Blob{'e', 'f'}), brillo::Blob(blob->begin(), blob->end()));
+  shared_blobs_.Release(4, ref1);
+  EXPECT_EQ(nullptr, shared_blobs_.Find(ref1));
+  EXPECT_FALSE(shared_blobs_.empty());
+  shared_blobs_.Release(5, partitions_[1].operations(3));
+  EXPECT_TRUE(shared_blobs_.empty());
+}
+
+TEST_F(SharedBlobsTest, InvalidReferencesTest) {
+  PartitionUpdate* partition = partitions_.Add();
+  AddOperation(partition, 0, 4);
+  AddOperation(partition, 4, 4);
+  // Part of a blob.
+  AddOperation(partition, 2, 2);
+  EXPECT_FALSE(shared_blobs_.Init(partitions_, 100));
+
+  partition->mutable_operations(2)->set_data_offset(0);
+  partition->mutable_operations(2)->set_data_length(8);
+  EXPECT_FALSE(shared_blobs_.Init(partitions_, 100));
+
+  // Only REPLACE operations may share a blob.
+  partition->mutable_operations(2)->set_data_length(4);
+  partition->mutable_operations(2)->set_type(InstallOperation::SOURCE_BSDIFF);
+  EXPECT_FALSE(shared_blobs_.Init(partitions_, 100));
+  partition->mutable_operations(2)->set_type(InstallOperation::REPLACE_XZ);
+  EXPECT_TRUE(shared_blobs_.Init(partitions_, 100));
+  EXPECT_TRUE(shared_blobs_.IsReference(2));
+}
+
+}  // namespace chromeos_update_engine
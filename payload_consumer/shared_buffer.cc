@@ -0,0 +1,62 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/shared_buffer.h"
+
+#include <utility>
+
+#include <base/logging.h>
+
+namespace chromeos_update_engine {
+
+SharedBuffer::SharedBuffer(brillo::Blob blob) : size_(blob.size()) {
+  if (size_ == 0) {
+    return;
+  }
+  auto owner = std::make_shared<brillo::Blob>(std::move(blob));
+  data_ = std::shared_ptr<const uint8_t>(owner, owner->data());
+}
+
+SharedBuffer::SharedBuffer(AlignedBuffer buffer) : size_(buffer.size()) {
+  if (size_ == 0) {
+    return;
+  }
+  auto owner = std::make_shared<AlignedBuffer>(std::move(buffer));
+  data_ = std::shared_ptr<const uint8_t>(owner, owner->data());
+}
+
+SharedBuffer SharedBuffer::Copy(const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  return SharedBuffer(brillo::Blob(bytes, bytes + size));
+}
+
+SharedBuffer SharedBuffer::Slice(size_t offset, size_t size) const {
+  CHECK_LE(offset, size_);
+  CHECK_LE(size, size_ - offset);
+  SharedBuffer slice;
+  if (size > 0) {
+    slice.data_ = std::shared_ptr<const uint8_t>(data_, data() + offset);
+    slice.size_ = size;
+  }
+  return slice;
+}
+
+void SharedBuffer::Reset() {
+  data_.reset();
+  size_ = 0;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,68 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_SHARED_BUFFER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_SHARED_BUFFER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_consumer/aligned_buffer_pool.h"
+
+namespace chromeos_update_engine {
+
+// A read-only slice of a reference-counted buffer, so that the payload data
+// is handed down the apply path and shared between its consumers without
+// being copied. The buffer is freed, or returned to its AlignedBufferPool,
+// once the last slice referencing it is destroyed. Copying a SharedBuffer
+// only copies the reference; the slices of a buffer may be used and
+// destroyed by different threads.
+class SharedBuffer {
+ public:
+  SharedBuffer() = default;
+  explicit SharedBuffer(brillo::Blob blob);
+  explicit SharedBuffer(AlignedBuffer buffer);
+
+  // Returns a buffer holding a copy of the |size| bytes at |data|.
+  static SharedBuffer Copy(const void* data, size_t size);
+
+  const uint8_t* data() const { return data_.get(); }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const uint8_t* begin() const { return data(); }
+  const uint8_t* end() const { return data() + size_; }
+
+  // Returns the |size| bytes at |offset| of this slice, sharing its buffer.
+  SharedBuffer Slice(size_t offset, size_t size) const;
+
+  // The number of slices referencing the buffer, 0 if empty.
+  long use_count() const { return data_.use_count(); }
+
+  // Drops the reference to the buffer, leaving this slice empty.
+  void Reset();
+
+ private:
+  // Aliases the owner of the buffer, pointing at the start of the slice.
+  std::shared_ptr<const uint8_t> data_;
+  size_t size_{0};
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_SHARED_BUFFER_H_
@@ -0,0 +1,71 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/shared_buffer.h"
+
+#include <utility>
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+TEST(SharedBufferTest, SlicesShareTheBuffer) {
+  SharedBuffer buffer(brillo::Blob{'a', 'b', 'c', 'd', 'e'});
+  ASSERT_EQ(buffer.size(), 5U);
+  EXPECT_EQ(buffer.use_count(), 1);
+
+  SharedBuffer slice = buffer.Slice(1, 3);
+  EXPECT_EQ(slice.data(), buffer.data() + 1);
+  EXPECT_EQ(brillo::Blob(slice.begin(), slice.end()),
+            (brillo::Blob{'b', 'c', 'd'}));
+  EXPECT_EQ(buffer.use_count(), 2);
+  SharedBuffer copy = slice;
+  EXPECT_EQ(copy.data(), slice.data());
+  EXPECT_EQ(buffer.use_count(), 3);
+
+  // The slices keep the buffer alive.
+  const uint8_t* data = buffer.data();
+  buffer.Reset();
+  EXPECT_TRUE(buffer.empty());
+  EXPECT_EQ(buffer.use_count(), 0);
+  EXPECT_EQ(copy.data(), data + 1);
+  EXPECT_EQ(copy.use_count(), 2);
+
+  EXPECT_TRUE(copy.Slice(3, 0).empty());
+  EXPECT_TRUE(SharedBuffer(brillo::Blob()).empty());
+}
+
+TEST(SharedBufferTest, CopyTest) {
+  const brillo::Blob blob{'x', 'y'};
+  SharedBuffer buffer = SharedBuffer::Copy(blob.data(), blob.size());
+  EXPECT_NE(buffer.data(), blob.data());
+  EXPECT_EQ(brillo::Blob(buffer.begin(), buffer.end()), blob);
+}
+
+TEST(SharedBufferTest, ReturnsAlignedBufferToPool) {
+  AlignedBufferPool pool(1024 * 1024, false);
+  AlignedBuffer aligned = pool.Acquire(8192);
+  const uint8_t* data = aligned.data();
+  SharedBuffer buffer(std::move(aligned));
+  EXPECT_EQ(buffer.data(), data);
+  SharedBuffer slice = buffer.Slice(4096, 4096);
+  buffer.Reset();
+  EXPECT_EQ(pool.pooled_bytes(), 0U);
+  slice.Reset();
+  EXPECT_EQ(pool.pooled_bytes(), 8192U);
+}
+
+}  // namespace chromeos_update_engine
@@ -21,13 +21,50 @@
 
 #include <libsnapshot/cow_writer.h>
 
+#include "update_engine/common/utils.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
 
+bool PendingRawBlocks::Add(android::snapshot::ICowWriter* cow_writer,
+                           uint64_t start_block,
+                           const void* bytes,
+                           size_t size) {
+  if (!data_.empty() &&
+      (start_block != start_block_ + data_.size() / block_size_ ||
+       data_.size() + size > kMaxSize)) {
+    TEST_AND_RETURN_FALSE(Flush(cow_writer));
+  }
+  if (size >= kMaxSize) {
+    return cow_writer->AddRawBlocks(start_block, bytes, size);
+  }
+  if (data_.empty()) {
+    start_block_ = start_block;
+  }
+  const auto* begin = static_cast<const uint8_t*>(bytes);
+  data_.insert(data_.end(), begin, begin + size);
+  return true;
+}
+
+bool PendingRawBlocks::Flush(android::snapshot::ICowWriter* cow_writer) {
+  if (data_.empty()) {
+    return true;
+  }
+  TEST_AND_RETURN_FALSE(
+      cow_writer->AddRawBlocks(start_block_, data_.data(), data_.size()));
+  data_.clear();
+  return true;
+}
+
 bool SnapshotExtentWriter::WriteExtent(const void* bytes,
                                        const Extent& extent,
                                        size_t block_size) {
+  if (pending_) {
+    return pending_->Add(cow_writer_,
+                         extent.start_block(),
+                         bytes,
+                         extent.num_blocks() * block_size);
+  }
   return cow_writer_->AddRawBlocks(
       extent.start_block(), bytes, extent.num_blocks() * block_size);
 }
@@ -27,16 +27,44 @@
 
 namespace chromeos_update_engine {
 
+// The raw blocks written to contiguous blocks, possibly by several
+// operations, not added to the COW yet. They are added as a single op of up
+// to kMaxSize bytes, rather than one op per extent written.
+class PendingRawBlocks {
+ public:
+  static constexpr size_t kMaxSize = 2 * 1024 * 1024;
+  explicit PendingRawBlocks(size_t block_size) : block_size_(block_size) {}
+
+  // Adds the |size| bytes at |bytes| to the blocks from |start_block|, after
+  // adding the pending ones to |cow_writer| unless they end right before.
+  bool Add(android::snapshot::ICowWriter* cow_writer,
+           uint64_t start_block,
+           const void* bytes,
+           size_t size);
+  // Adds the pending blocks to |cow_writer|.
+  bool Flush(android::snapshot::ICowWriter* cow_writer);
+  bool empty() const { return data_.empty(); }
+
+ private:
+  const size_t block_size_;
+  uint64_t start_block_{0};
+  std::vector<uint8_t> data_;
+};
+
 class SnapshotExtentWriter final : public BlockExtentWriter {
  public:
-  explicit SnapshotExtentWriter(android::snapshot::ICowWriter* cow_writer)
-      : cow_writer_(cow_writer) {}
+  // The extents are added through |pending| if given, which must then be
+  // flushed before the COW is labeled.
+  explicit SnapshotExtentWriter(android::snapshot::ICowWriter* cow_writer,
+                                PendingRawBlocks* pending = nullptr)
+      : cow_writer_(cow_writer), pending_(pending) {}
   bool WriteExtent(const void* bytes,
                    const Extent& extent,
                    size_t block_size) override;
 
  private:
   android::snapshot::ICowWriter* cow_writer_;
+  PendingRawBlocks* pending_;
 };
 
 }  // namespace chromeos_update_engine
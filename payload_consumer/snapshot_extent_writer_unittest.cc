@@ -209,4 +209,32 @@ TEST_F(SnapshotExtentWriterTest, WriteAcrossBlockBoundary) {
                      cow_writer_.operations_[125].data.end());
   ASSERT_EQ(buf, actual_data);
 }
+
+TEST_F(SnapshotExtentWriterTest, PendingRawBlocksMergeContiguousWrites) {
+  PendingRawBlocks pending(kBlockSize);
+  std::vector<uint8_t> buf(kBlockSize * 3);
+  std::iota(buf.begin(), buf.end(), 0);
+
+  // Two operations writing the contiguous blocks 10-11 and 12.
+  google::protobuf::RepeatedPtrField<Extent> first;
+  AddExtent(&first, 10, 2);
+  SnapshotExtentWriter first_writer(&cow_writer_, &pending);
+  ASSERT_TRUE(first_writer.Init(first, kBlockSize));
+  ASSERT_TRUE(first_writer.Write(buf.data(), kBlockSize * 2));
+  google::protobuf::RepeatedPtrField<Extent> second;
+  AddExtent(&second, 12, 1);
+  SnapshotExtentWriter second_writer(&cow_writer_, &pending);
+  ASSERT_TRUE(second_writer.Init(second, kBlockSize));
+  ASSERT_TRUE(second_writer.Write(buf.data() + kBlockSize * 2, kBlockSize));
+  ASSERT_TRUE(cow_writer_.operations_.empty());
+
+  // A write to a block not right after them adds them as a single op.
+  ASSERT_TRUE(pending.Add(&cow_writer_, 20, buf.data(), kBlockSize));
+  ASSERT_EQ(cow_writer_.operations_.size(), 1U);
+  ASSERT_EQ(buf, cow_writer_.operations_[10].data);
+
+  ASSERT_TRUE(pending.Flush(&cow_writer_));
+  ASSERT_TRUE(pending.empty());
+  ASSERT_TRUE(cow_writer_.Contains(20));
+}
 }  // namespace chromeos_update_engine
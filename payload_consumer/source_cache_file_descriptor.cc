@@ -0,0 +1,255 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/source_cache_file_descriptor.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iterator>
+
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+SourceCacheFileDescriptor::SourceCacheFileDescriptor(
+    FileDescriptorPtr fd,
+    const PartitionUpdate& partition,
+    size_t block_size,
+    uint64_t cache_size)
+    : fd_(std::move(fd)),
+      block_size_(block_size),
+      max_blocks_(cache_size / block_size) {
+  // Every (block, operation) read, sorted by block then operation.
+  std::vector<std::pair<uint64_t, size_t>> reads;
+  for (int i = 0; i < partition.operations_size(); i++) {
+    // TARGET_COPY operations read the target partition.
+    if (partition.operations(i).type() == InstallOperation::TARGET_COPY)
+      continue;
+    for (const Extent& extent : partition.operations(i).src_extents()) {
+      for (uint64_t j = 0; j < extent.num_blocks(); j++) {
+        reads.emplace_back(extent.start_block() + j, i);
+      }
+    }
+  }
+  std::sort(reads.begin(), reads.end());
+  reads.erase(std::unique(reads.begin(), reads.end()), reads.end());
+  for (size_t i = 0; i < reads.size();) {
+    size_t end = i + 1;
+    while (end < reads.size() && reads[end].first == reads[i].first) {
+      end++;
+    }
+    if (end - i > 1) {
+      auto& uses = uses_[reads[i].first];
+      for (size_t j = i; j < end; j++) {
+        uses.push_back(reads[j].second);
+      }
+    }
+    i = end;
+  }
+  LOG(INFO) << "Caching up to " << max_blocks_ << " of the " << uses_.size()
+            << " source blocks read by several operations of "
+            << partition.partition_name();
+}
+
+void SourceCacheFileDescriptor::SetCurrentOperation(size_t op_index) {
+  current_op_ = op_index;
+  // Requeue the blocks whose queued next use is behind, dropping the ones no
+  // longer needed.
+  while (!next_uses_.empty() && next_uses_.begin()->first < current_op_) {
+    const uint64_t block = next_uses_.begin()->second;
+    next_uses_.erase(next_uses_.begin());
+    const auto& uses = uses_.at(block);
+    auto it = std::lower_bound(uses.begin(), uses.end(), current_op_);
+    if (it == uses.end()) {
+      blocks_.erase(block);
+      continue;
+    }
+    blocks_[block].next_use = *it;
+    next_uses_.emplace(*it, block);
+  }
+}
+
+void SourceCacheFileDescriptor::Invalidate(
+    const google::protobuf::RepeatedPtrField<Extent>& extents) {
+  for (const Extent& extent : extents) {
+    for (uint64_t i = 0; i < extent.num_blocks(); i++) {
+      Evict(extent.start_block() + i);
+    }
+  }
+}
+
+size_t SourceCacheFileDescriptor::NextUse(uint64_t block) const {
+  auto uses = uses_.find(block);
+  if (uses == uses_.end()) {
+    return kNoUse;
+  }
+  auto it =
+      std::upper_bound(uses->second.begin(), uses->second.end(), current_op_);
+  return it == uses->second.end() ? kNoUse : *it;
+}
+
+void SourceCacheFileDescriptor::Insert(uint64_t block, const uint8_t* data) {
+  const size_t next_use = NextUse(block);
+  if (next_use == kNoUse || max_blocks_ == 0 || blocks_.count(block)) {
+    return;
+  }
+  if (blocks_.size() >= max_blocks_) {
+    // Keep the blocks needed sooner than this one.
+    const auto farthest = std::prev(next_uses_.end());
+    if (farthest->first <= next_use) {
+      return;
+    }
+    Evict(farthest->second);
+  }
+  CachedBlock& cached = blocks_[block];
+  cached.data.assign(data, data + block_size_);
+  cached.next_use = next_use;
+  next_uses_.emplace(next_use, block);
+}
+
+void SourceCacheFileDescriptor::Evict(uint64_t block) {
+  auto it = blocks_.find(block);
+  if (it == blocks_.end()) {
+    return;
+  }
+  next_uses_.erase({it->second.next_use, block});
+  blocks_.erase(it);
+}
+
+ssize_t SourceCacheFileDescriptor::Read(void* buf, size_t count) {
+  CHECK(IsOpen());
+  uint8_t* out = static_cast<uint8_t*>(buf);
+  size_t done = 0;
+  while (done < count) {
+    const uint64_t block = offset_ / block_size_;
+    const size_t block_offset = offset_ % block_size_;
+    auto it = blocks_.find(block);
+    if (it != blocks_.end()) {
+      const size_t bytes =
+          std::min<size_t>(count - done, block_size_ - block_offset);
+      memcpy(out + done, it->second.data.data() + block_offset, bytes);
+      bytes_saved_ += bytes;
+      offset_ += bytes;
+      done += bytes;
+      continue;
+    }
+    // Read up to the next cached block in one go.
+    uint64_t end = offset_ + (count - done);
+    for (uint64_t next = block + 1; next * block_size_ < end; next++) {
+      if (blocks_.count(next)) {
+        end = next * block_size_;
+        break;
+      }
+    }
+    const size_t bytes = end - offset_;
+    const ssize_t bytes_read = ReadThrough(out + done, bytes);
+    if (bytes_read < 0) {
+      return done > 0 ? done : -1;
+    }
+    done += bytes_read;
+    if (static_cast<size_t>(bytes_read) < bytes) {
+      // End of file.
+      break;
+    }
+  }
+  return done;
+}
+
+ssize_t SourceCacheFileDescriptor::ReadThrough(uint8_t* buf, size_t count) {
+  const uint64_t first_block = offset_ / block_size_;
+  const uint64_t end_block = (offset_ + count + block_size_ - 1) / block_size_;
+  bool cacheable = false;
+  for (uint64_t block = first_block; block < end_block && !cacheable;
+       block++) {
+    cacheable = NextUse(block) != kNoUse;
+  }
+  ssize_t bytes_read = 0;
+  if (!cacheable || max_blocks_ == 0) {
+    if (!utils::PReadAll(fd_, buf, count, offset_, &bytes_read)) {
+      return -1;
+    }
+    offset_ += bytes_read;
+    return bytes_read;
+  }
+  // Read whole blocks, so that they can be cached.
+  brillo::Blob blocks((end_block - first_block) * block_size_);
+  if (!utils::PReadAll(fd_,
+                       blocks.data(),
+                       blocks.size(),
+                       first_block * block_size_,
+                       &bytes_read)) {
+    return -1;
+  }
+  const size_t skipped = offset_ - first_block * block_size_;
+  const size_t bytes = std::min<size_t>(
+      count, std::max<ssize_t>(bytes_read - static_cast<ssize_t>(skipped), 0));
+  memcpy(buf, blocks.data() + skipped, bytes);
+  for (size_t i = 0; (i + 1) * block_size_ <= static_cast<size_t>(bytes_read);
+       i++) {
+    Insert(first_block + i, blocks.data() + i * block_size_);
+  }
+  offset_ += bytes;
+  return bytes;
+}
+
+ssize_t SourceCacheFileDescriptor::Write(const void* buf, size_t count) {
+  errno = EBADF;
+  return -1;
+}
+
+off64_t SourceCacheFileDescriptor::Seek(off64_t offset, int whence) {
+  CHECK(IsOpen());
+  off64_t base = 0;
+  switch (whence) {
+    case SEEK_SET:
+      break;
+    case SEEK_CUR:
+      base = offset_;
+      break;
+    default:
+      // SEEK_END isn't needed to read extents.
+      errno = EINVAL;
+      return -1;
+  }
+  if (base + offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  offset_ = base + offset;
+  return offset_;
+}
+
+bool SourceCacheFileDescriptor::Close() {
+  if (!IsOpen()) {
+    return false;
+  }
+  LOG(INFO) << "Source cache saved reading " << bytes_saved_
+            << " bytes of the source partition.";
+  const bool success = fd_->Close();
+  fd_.reset();
+  blocks_.clear();
+  next_uses_.clear();
+  uses_.clear();
+  return success;
+}
+
+}  // namespace chromeos_update_engine
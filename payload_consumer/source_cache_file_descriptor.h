@@ -0,0 +1,127 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_SOURCE_CACHE_FILE_DESCRIPTOR_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_SOURCE_CACHE_FILE_DESCRIPTOR_H_
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <brillo/secure_blob.h>
+#include <google/protobuf/repeated_field.h>
+
+#include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// A read-only FileDescriptor over the source partition |fd| which keeps the
+// blocks read by several operations of |partition| in memory, so that each of
+// them is only read once from the device while it is still needed.
+//
+// The operations reading every block are known from the manifest, so when the
+// cache is full the block whose next use is the farthest away, or the block
+// being inserted if it's needed later than all the cached ones, is evicted.
+// Blocks read by a single operation are never cached. SetCurrentOperation()
+// must be called before the reads of each operation.
+class SourceCacheFileDescriptor final : public FileDescriptor {
+ public:
+  SourceCacheFileDescriptor(FileDescriptorPtr fd,
+                            const PartitionUpdate& partition,
+                            size_t block_size,
+                            uint64_t cache_size);
+  ~SourceCacheFileDescriptor() override = default;
+
+  // The descriptor is created open, and can't be reopened.
+  bool Open(const char* path, int flags, mode_t mode) override {
+    return false;
+  }
+  bool Open(const char* path, int flags) override { return false; }
+  ssize_t Read(void* buf, size_t count) override;
+  ssize_t Write(const void* buf, size_t count) override;
+  off64_t Seek(off64_t offset, int whence) override;
+  uint64_t BlockDevSize() override { return fd_->BlockDevSize(); }
+  bool BlkIoctl(int request,
+                uint64_t start,
+                uint64_t length,
+                int* result) override {
+    return false;
+  }
+  bool Flush() override { return true; }
+  bool Close() override;
+  bool IsSettingErrno() override { return true; }
+  bool IsOpen() override { return fd_ != nullptr; }
+
+  // Sets the index, in |partition|, of the operation the next reads are for.
+  void SetCurrentOperation(size_t op_index);
+
+  // Drops the cached content of |extents|, e.g. after they were rewritten.
+  void Invalidate(const google::protobuf::RepeatedPtrField<Extent>& extents);
+
+  // Number of bytes served from the cache instead of |fd|.
+  uint64_t bytes_saved() const { return bytes_saved_; }
+  size_t cached_blocks() const { return blocks_.size(); }
+
+ private:
+  static constexpr size_t kNoUse = SIZE_MAX;
+
+  // Returns the index of the first operation after |current_op_| reading
+  // |block|, or kNoUse.
+  size_t NextUse(uint64_t block) const;
+
+  // Caches |data|, the content of |block|, if worth it.
+  void Insert(uint64_t block, const uint8_t* data);
+  void Evict(uint64_t block);
+
+  // Reads |count| bytes at |offset_| from |fd_|, rounded to whole blocks to
+  // cache the blocks read again later.
+  ssize_t ReadThrough(uint8_t* buf, size_t count);
+
+  FileDescriptorPtr fd_;
+  const size_t block_size_;
+  const size_t max_blocks_;
+
+  // The indexes of the operations reading each block read by at least two
+  // operations, in increasing order.
+  std::unordered_map<uint64_t, std::vector<size_t>> uses_;
+
+  struct CachedBlock {
+    brillo::Blob data;
+    // The operation reading the block next when it was last queued in
+    // |next_uses_|.
+    size_t next_use;
+  };
+  std::unordered_map<uint64_t, CachedBlock> blocks_;
+  // The cached blocks, ordered by their next use.
+  std::set<std::pair<size_t, uint64_t>> next_uses_;
+
+  size_t current_op_{0};
+  // The current file position.
+  off64_t offset_{0};
+  uint64_t bytes_saved_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(SourceCacheFileDescriptor);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_SOURCE_CACHE_FILE_DESCRIPTOR_H_
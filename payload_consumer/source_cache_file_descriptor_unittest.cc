@@ -0,0 +1,183 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/source_cache_file_descriptor.h"
+
+#include <fcntl.h>
+
+#include <memory>
+#include <vector>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr size_t kBlockSize = 16;
+constexpr size_t kFileBlocks = 8;
+}  // namespace
+
+class SourceCacheFileDescriptorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    file_data_.resize(kFileBlocks * kBlockSize);
+    test_utils::FillWithData(&file_data_);
+    ASSERT_TRUE(test_utils::WriteFileVector(temp_file_.path(), file_data_));
+    ASSERT_TRUE(fd_->Open(temp_file_.path().c_str(), O_RDONLY));
+  }
+
+  void AddOperation(const std::vector<Extent>& src_extents) {
+    InstallOperation* op = partition_.add_operations();
+    op->set_type(InstallOperation::SOURCE_COPY);
+    for (const auto& extent : src_extents) {
+      *op->add_src_extents() = extent;
+    }
+  }
+
+  // Overwrites the file, so that reads served from the cache can be told
+  // apart.
+  void OverwriteFile() {
+    ASSERT_TRUE(test_utils::WriteFileVector(
+        temp_file_.path(), brillo::Blob(file_data_.size(), 0xAA)));
+  }
+
+  brillo::Blob ReadBlocks(SourceCacheFileDescriptor* cache_fd,
+                          uint64_t start_block,
+                          uint64_t num_blocks) {
+    brillo::Blob data(num_blocks * kBlockSize);
+    ssize_t bytes_read = 0;
+    EXPECT_TRUE(utils::PReadAll(cache_fd,
+                                data.data(),
+                                data.size(),
+                                start_block * kBlockSize,
+                                &bytes_read));
+    EXPECT_EQ(static_cast<ssize_t>(data.size()), bytes_read);
+    return data;
+  }
+
+  brillo::Blob FileBlocks(uint64_t start_block, uint64_t num_blocks) {
+    return brillo::Blob(
+        file_data_.begin() + start_block * kBlockSize,
+        file_data_.begin() + (start_block + num_blocks) * kBlockSize);
+  }
+
+  ScopedTempFile temp_file_{"SourceCacheFileDescriptor-file.XXXXXX"};
+  FileDescriptorPtr fd_{new EintrSafeFileDescriptor};
+  brillo::Blob file_data_;
+  PartitionUpdate partition_;
+};
+
+TEST_F(SourceCacheFileDescriptorTest, ServesBlocksReadAgainTest) {
+  AddOperation({ExtentForRange(0, 3)});
+  AddOperation({ExtentForRange(2, 2)});
+  SourceCacheFileDescriptor cache_fd(
+      fd_, partition_, kBlockSize, kFileBlocks * kBlockSize);
+
+  cache_fd.SetCurrentOperation(0);
+  ASSERT_EQ(FileBlocks(0, 3), ReadBlocks(&cache_fd, 0, 3));
+  // Only block 2 is read again.
+  ASSERT_EQ(1u, cache_fd.cached_blocks());
+
+  OverwriteFile();
+  cache_fd.SetCurrentOperation(1);
+  brillo::Blob expected = FileBlocks(2, 1);
+  expected.resize(2 * kBlockSize, 0xAA);
+  ASSERT_EQ(expected, ReadBlocks(&cache_fd, 2, 2));
+  ASSERT_EQ(kBlockSize, cache_fd.bytes_saved());
+}
+
+TEST_F(SourceCacheFileDescriptorTest, DropsBlocksNoLongerNeededTest) {
+  AddOperation({ExtentForRange(1, 1)});
+  AddOperation({ExtentForRange(1, 1)});
+  AddOperation({ExtentForRange(5, 1)});
+  SourceCacheFileDescriptor cache_fd(
+      fd_, partition_, kBlockSize, kFileBlocks * kBlockSize);
+
+  cache_fd.SetCurrentOperation(0);
+  ReadBlocks(&cache_fd, 1, 1);
+  ASSERT_EQ(1u, cache_fd.cached_blocks());
+  cache_fd.SetCurrentOperation(1);
+  ReadBlocks(&cache_fd, 1, 1);
+  cache_fd.SetCurrentOperation(2);
+  ASSERT_EQ(0u, cache_fd.cached_blocks());
+}
+
+TEST_F(SourceCacheFileDescriptorTest, KeepsBlocksNeededSoonestTest) {
+  AddOperation({ExtentForRange(0, 2)});
+  AddOperation({ExtentForRange(1, 1)});
+  AddOperation({ExtentForRange(0, 1)});
+  // Room for a single block.
+  SourceCacheFileDescriptor cache_fd(fd_, partition_, kBlockSize, kBlockSize);
+
+  cache_fd.SetCurrentOperation(0);
+  ReadBlocks(&cache_fd, 0, 2);
+  ASSERT_EQ(1u, cache_fd.cached_blocks());
+
+  OverwriteFile();
+  cache_fd.SetCurrentOperation(1);
+  ASSERT_EQ(FileBlocks(1, 1), ReadBlocks(&cache_fd, 1, 1));
+  // Block 0 was evicted in favor of block 1.
+  cache_fd.SetCurrentOperation(2);
+  ASSERT_EQ(brillo::Blob(kBlockSize, 0xAA), ReadBlocks(&cache_fd, 0, 1));
+}
+
+TEST_F(SourceCacheFileDescriptorTest, UnalignedReadTest) {
+  AddOperation({ExtentForRange(0, 4)});
+  AddOperation({ExtentForRange(0, 4)});
+  SourceCacheFileDescriptor cache_fd(
+      fd_, partition_, kBlockSize, kFileBlocks * kBlockSize);
+
+  cache_fd.SetCurrentOperation(0);
+  for (int i = 0; i < 2; i++) {
+    brillo::Blob data(2 * kBlockSize);
+    ssize_t bytes_read = 0;
+    ASSERT_TRUE(utils::PReadAll(
+        &cache_fd, data.data(), data.size(), kBlockSize / 2, &bytes_read));
+    ASSERT_EQ(static_cast<ssize_t>(data.size()), bytes_read);
+    ASSERT_EQ(brillo::Blob(file_data_.begin() + kBlockSize / 2,
+                           file_data_.begin() + kBlockSize / 2 + data.size()),
+              data);
+    cache_fd.SetCurrentOperation(1);
+  }
+  ASSERT_EQ(2 * kBlockSize, cache_fd.bytes_saved());
+}
+
+TEST_F(SourceCacheFileDescriptorTest, InvalidateTest) {
+  AddOperation({ExtentForRange(0, 2)});
+  AddOperation({ExtentForRange(0, 2)});
+  SourceCacheFileDescriptor cache_fd(
+      fd_, partition_, kBlockSize, kFileBlocks * kBlockSize);
+
+  cache_fd.SetCurrentOperation(0);
+  ReadBlocks(&cache_fd, 0, 2);
+  OverwriteFile();
+  google::protobuf::RepeatedPtrField<Extent> extents;
+  *extents.Add() = ExtentForRange(1, 1);
+  cache_fd.Invalidate(extents);
+
+  cache_fd.SetCurrentOperation(1);
+  brillo::Blob expected = FileBlocks(0, 1);
+  expected.resize(2 * kBlockSize, 0xAA);
+  ASSERT_EQ(expected, ReadBlocks(&cache_fd, 0, 2));
+}
+
+}  // namespace chromeos_update_engine
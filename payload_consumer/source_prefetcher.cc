@@ -0,0 +1,118 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/source_prefetcher.h"
+
+#include <fcntl.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <base/logging.h>
+
+#include "update_engine/payload_generator/extent_utils.h"
+
+namespace chromeos_update_engine {
+
+SourcePrefetcher::SourcePrefetcher(const PartitionUpdate& partition,
+                                   size_t block_size,
+                                   size_t window_ops)
+    : partition_(partition),
+      block_size_(block_size),
+      window_ops_(window_ops) {}
+
+SourcePrefetcher::~SourcePrefetcher() {
+  if (fd_.IsOpen()) {
+    fd_.Close();
+  }
+}
+
+bool SourcePrefetcher::Open(const std::string& source_path) {
+  if (!fd_.Open(source_path.c_str(), O_RDONLY)) {
+    PLOG(ERROR) << "Unable to open " << source_path << " for read-ahead";
+    return false;
+  }
+  return true;
+}
+
+uint64_t SourcePrefetcher::SourceBlocks(const InstallOperation& operation) {
+  // TARGET_COPY operations read the target partition.
+  if (operation.type() == InstallOperation::TARGET_COPY)
+    return 0;
+  uint64_t num_blocks = 0;
+  for (const auto& extent : operation.src_extents()) {
+    num_blocks += extent.num_blocks();
+  }
+  return num_blocks;
+}
+
+void SourcePrefetcher::OnOperationStart(size_t op_index) {
+  if (op_index == current_op_ ||
+      op_index >= static_cast<size_t>(partition_.operations_size())) {
+    return;
+  }
+  current_op_ = op_index;
+  const uint64_t num_blocks = SourceBlocks(partition_.operations(op_index));
+  total_blocks_ += num_blocks;
+  if (op_index < next_prefetch_op_) {
+    prefetched_blocks_ += num_blocks;
+    pending_bytes_ -= std::min(pending_bytes_, num_blocks * block_size_);
+  } else {
+    // Either the first operation or the window fell behind. The current
+    // operation reads its source right away, so start right after it.
+    next_prefetch_op_ = op_index + 1;
+    pending_bytes_ = 0;
+  }
+
+  const size_t num_ops = partition_.operations_size();
+  const size_t end = std::min(op_index + 1 + window_ops_, num_ops);
+  while (next_prefetch_op_ < end && pending_bytes_ < kMaxPrefetchBytes) {
+    const InstallOperation& operation =
+        partition_.operations(next_prefetch_op_);
+    Prefetch(operation);
+    pending_bytes_ += SourceBlocks(operation) * block_size_;
+    next_prefetch_op_++;
+  }
+}
+
+void SourcePrefetcher::Prefetch(const InstallOperation& operation) {
+  if (operation.type() == InstallOperation::TARGET_COPY)
+    return;
+  for (const auto& extent : operation.src_extents()) {
+    // Failing read-ahead only costs performance, there's nothing to recover.
+    const int err = posix_fadvise(fd_.Fd(),
+                                  extent.start_block() * block_size_,
+                                  extent.num_blocks() * block_size_,
+                                  POSIX_FADV_WILLNEED);
+    if (err != 0) {
+      LOG(WARNING) << "posix_fadvise on " << extent
+                   << " failed: " << strerror(err);
+      return;
+    }
+  }
+}
+
+void SourcePrefetcher::LogStats() const {
+  if (total_blocks_ == 0) {
+    return;
+  }
+  LOG(INFO) << "Prefetched " << prefetched_blocks_ << " of " << total_blocks_
+            << " source blocks of partition " << partition_.partition_name()
+            << " (" << prefetched_blocks_ * 100 / total_blocks_
+            << "%) with a window of " << window_ops_ << " operations";
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,94 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_SOURCE_PREFETCHER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_SOURCE_PREFETCHER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <base/macros.h>
+
+#include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Warms the page cache with the source extents of upcoming operations of a
+// partition, so that SOURCE_* operations don't stall on flash latency when
+// they become current. The read-ahead is issued with posix_fadvise(WILLNEED),
+// which the kernel performs asynchronously; the page cache is shared with the
+// file descriptors the partition writer reads from.
+//
+// At most |window_ops| operations ahead of the current one, and at most
+// |kMaxPrefetchBytes| of source data, are prefetched at any time.
+class SourcePrefetcher {
+ public:
+  // Upper bound of source bytes prefetched but not used yet.
+  static constexpr uint64_t kMaxPrefetchBytes = 64 * 1024 * 1024;
+
+  SourcePrefetcher(const PartitionUpdate& partition,
+                   size_t block_size,
+                   size_t window_ops);
+  ~SourcePrefetcher();
+
+  // Opens the source partition at |source_path| for read-ahead.
+  [[nodiscard]] bool Open(const std::string& source_path);
+
+  // Notifies that the operation at |op_index| of the partition is about to be
+  // applied, and issues read-ahead for the operations following it. Calling it
+  // again with the same |op_index| does nothing.
+  void OnOperationStart(size_t op_index);
+
+  // Logs how many of the source blocks used so far were prefetched.
+  void LogStats() const;
+
+  uint64_t total_blocks() const { return total_blocks_; }
+  uint64_t prefetched_blocks() const { return prefetched_blocks_; }
+
+ private:
+  // Returns the number of source blocks read by |operation|.
+  static uint64_t SourceBlocks(const InstallOperation& operation);
+
+  // Issues the read-ahead of the source extents of |operation|.
+  void Prefetch(const InstallOperation& operation);
+
+  const PartitionUpdate& partition_;
+  const size_t block_size_;
+  const size_t window_ops_;
+
+  EintrSafeFileDescriptor fd_;
+
+  // Index of the operation passed to the last OnOperationStart() call.
+  size_t current_op_{SIZE_MAX};
+  // Index of the next operation to prefetch. All operations between the
+  // current one and this were prefetched already.
+  size_t next_prefetch_op_{0};
+  // Source bytes of the operations prefetched but not started yet.
+  uint64_t pending_bytes_{0};
+
+  // Source blocks of all started operations, and how many of them were
+  // prefetched before the operation started.
+  uint64_t total_blocks_{0};
+  uint64_t prefetched_blocks_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(SourcePrefetcher);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_SOURCE_PREFETCHER_H_
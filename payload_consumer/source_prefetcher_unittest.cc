@@ -0,0 +1,75 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/source_prefetcher.h"
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr size_t kNumOps = 8;
+}  // namespace
+
+class SourcePrefetcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_EQ(0,
+              truncate(source_partition_.path().c_str(),
+                       2 * kNumOps * kBlockSize));
+    for (size_t i = 0; i < kNumOps; i++) {
+      InstallOperation* op = partition_.add_operations();
+      op->set_type(InstallOperation::SOURCE_COPY);
+      *op->add_src_extents() = ExtentForRange(2 * i, 2);
+      *op->add_dst_extents() = ExtentForRange(2 * i, 2);
+    }
+  }
+
+  ScopedTempFile source_partition_{"source-part-XXXXXX"};
+  PartitionUpdate partition_;
+};
+
+TEST_F(SourcePrefetcherTest, AllOperationsPrefetchedInOrderTest) {
+  SourcePrefetcher prefetcher(partition_, kBlockSize, 2);
+  ASSERT_TRUE(prefetcher.Open(source_partition_.path()));
+  for (size_t i = 0; i < kNumOps; i++) {
+    prefetcher.OnOperationStart(i);
+    // Repeated notifications for the same operation are not counted.
+    prefetcher.OnOperationStart(i);
+  }
+  ASSERT_EQ(2 * kNumOps, prefetcher.total_blocks());
+  // Only the first operation is read before the read-ahead started.
+  ASSERT_EQ(2 * (kNumOps - 1), prefetcher.prefetched_blocks());
+}
+
+TEST_F(SourcePrefetcherTest, ResumeOutsideWindowTest) {
+  SourcePrefetcher prefetcher(partition_, kBlockSize, 1);
+  ASSERT_TRUE(prefetcher.Open(source_partition_.path()));
+  prefetcher.OnOperationStart(0);
+  // Operation 3 is past the window of operation 0, so it wasn't prefetched.
+  prefetcher.OnOperationStart(3);
+  prefetcher.OnOperationStart(4);
+  ASSERT_EQ(6u, prefetcher.total_blocks());
+  ASSERT_EQ(2u, prefetcher.prefetched_blocks());
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,234 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/source_verifier.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/verified_source_fd.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/extent_utils.h"
+#if USE_FEC
+#include "update_engine/payload_consumer/fec_file_descriptor.h"
+#endif
+
+namespace chromeos_update_engine {
+
+namespace {
+// Size of the reads of the partitions.
+constexpr size_t kReadSize = 1024 * 1024;
+
+// Returns the source partition at |path| opened as an error-corrected device,
+// or null if it isn't one.
+FileDescriptorPtr OpenEccPartition(const std::string& path) {
+#if USE_FEC
+  auto fd = std::make_shared<FecFileDescriptor>();
+  if (fd->Open(path.c_str(), O_RDONLY, 0)) {
+    return fd;
+  }
+  PLOG(WARNING) << "Unable to open ECC source partition " << path;
+#endif  // USE_FEC
+  return nullptr;
+}
+}  // namespace
+
+SourceVerifier::SourceVerifier(std::vector<Partition> partitions,
+                               size_t block_size,
+                               uint32_t io_priority)
+    : partitions_(std::move(partitions)),
+      block_size_(block_size),
+      io_priority_(io_priority) {}
+
+SourceVerifier::~SourceVerifier() {
+  stopping_ = true;
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void SourceVerifier::Start() {
+  CHECK(!thread_.joinable());
+  thread_ = std::thread(&SourceVerifier::ThreadMain, this);
+}
+
+bool SourceVerifier::Done() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return done_;
+}
+
+bool SourceVerifier::IsSourceVerified(const std::string& path,
+                                      const std::string& state,
+                                      const std::string& source_key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = results_.find(path);
+  if (it == results_.end() || it->second.state != state) {
+    return false;
+  }
+  return it->second.matches || it->second.verified_sources.count(source_key);
+}
+
+void SourceVerifier::ThreadMain() {
+  utils::SetThreadIoPriority(io_priority_);
+  buffer_.resize(kReadSize);
+  for (const Partition& partition : partitions_) {
+    if (stopping_) {
+      break;
+    }
+    VerifyPartition(partition);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  done_ = true;
+}
+
+void SourceVerifier::VerifyPartition(const Partition& partition) {
+  Result result;
+  result.state = GetPartitionState(partition.path);
+  if (result.state.empty()) {
+    LOG(INFO) << "Not verifying " << partition.path
+              << " ahead, its changes can't be tracked.";
+    return;
+  }
+  FileDescriptorPtr fd = std::make_shared<EintrSafeFileDescriptor>();
+  if (!fd->Open(partition.path.c_str(), O_RDONLY)) {
+    PLOG(WARNING) << "Unable to open " << partition.path;
+    return;
+  }
+  HashCalculator hasher;
+  if (!HashRange(fd, 0, partition.size, &hasher) || !hasher.Finalize()) {
+    return;
+  }
+  result.matches = hasher.raw_hash() == partition.hash;
+  size_t failures = 0;
+  if (!result.matches) {
+    LOG(WARNING) << "Source partition " << partition.path
+                 << " doesn't match the payload.";
+    if (partition.update) {
+      failures = VerifyOperations(fd, partition, &result);
+    }
+  }
+  fd->Close();
+  if (stopping_) {
+    return;
+  }
+  // The sources verified no longer tell anything once the partition changed.
+  if (GetPartitionState(partition.path) != result.state) {
+    LOG(INFO) << "Source partition " << partition.path
+              << " changed while it was verified.";
+    return;
+  }
+  if (failures > 0) {
+    LOG(ERROR) << "The source of " << failures << " operations reading "
+               << partition.path << " doesn't match, even error corrected.";
+    failed_ = true;
+  } else if (result.matches) {
+    LOG(INFO) << "Verified source partition " << partition.path;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  results_[partition.path] = std::move(result);
+}
+
+size_t SourceVerifier::VerifyOperations(const FileDescriptorPtr& fd,
+                                        const Partition& partition,
+                                        Result* result) {
+  FileDescriptorPtr ecc_fd;
+  bool ecc_opened = false;
+  ExtentRanges corrected_blocks;
+  size_t failures = 0;
+  const auto& operations = partition.update->operations();
+  for (size_t i = partition.first_operation;
+       i < static_cast<size_t>(operations.size()) && !stopping_;
+       i++) {
+    const InstallOperation& operation = operations[i];
+    if (!operation.has_src_sha256_hash()) {
+      continue;
+    }
+    if (ExtentsMatch(
+            fd, operation.src_extents(), operation.src_sha256_hash())) {
+      result->verified_sources.insert(VerifiedSourceKey(operation));
+      continue;
+    }
+    if (!ecc_opened) {
+      ecc_fd = OpenEccPartition(partition.path);
+      ecc_opened = true;
+    }
+    if (ecc_fd && ExtentsMatch(ecc_fd,
+                               operation.src_extents(),
+                               operation.src_sha256_hash())) {
+      corrected_blocks.AddRepeatedExtents(operation.src_extents());
+      continue;
+    }
+    failures++;
+  }
+  if (ecc_fd) {
+    ecc_fd->Close();
+  }
+  if (corrected_blocks.blocks() > 0) {
+    LOG(WARNING) << "Blocks "
+                 << ExtentsToString(corrected_blocks.GetExtentsForBlockCount(
+                        corrected_blocks.blocks()))
+                 << " of " << partition.path << " need error correction.";
+  }
+  return failures;
+}
+
+bool SourceVerifier::HashRange(const FileDescriptorPtr& fd,
+                               uint64_t offset,
+                               uint64_t length,
+                               HashCalculator* hasher) {
+  while (length > 0) {
+    if (stopping_) {
+      return false;
+    }
+    const size_t size = std::min<uint64_t>(buffer_.size(), length);
+    ssize_t bytes_read = 0;
+    if (!utils::PReadAll(fd, buffer_.data(), size, offset, &bytes_read) ||
+        static_cast<size_t>(bytes_read) != size) {
+      LOG(WARNING) << "Failed to read " << size << " bytes at offset "
+                   << offset << ", read " << bytes_read;
+      return false;
+    }
+    TEST_AND_RETURN_FALSE(hasher->Update(buffer_.data(), size));
+    offset += size;
+    length -= size;
+  }
+  return true;
+}
+
+bool SourceVerifier::ExtentsMatch(
+    const FileDescriptorPtr& fd,
+    const google::protobuf::RepeatedPtrField<Extent>& extents,
+    const std::string& expected_hash) {
+  HashCalculator hasher;
+  for (const Extent& extent : extents) {
+    if (!HashRange(fd,
+                   extent.start_block() * block_size_,
+                   extent.num_blocks() * block_size_,
+                   &hasher)) {
+      return false;
+    }
+  }
+  return hasher.Finalize() && ToStringView(hasher.raw_hash()) == expected_hash;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,134 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_SOURCE_VERIFIER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_SOURCE_VERIFIER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Verifies the source partitions of a delta payload on a background thread,
+// at a low I/O priority, while the payload is still downloading, so that a
+// modified or corrupted source is found before the operations reading it are
+// reached. Each partition is hashed whole against its |old_partition_info|;
+// the sources of the operations of a partition which doesn't match are then
+// hashed one by one to find the ones needing error correction, and the ones
+// which even error correction doesn't fix fail the update early. The sources
+// verified aren't hashed again by VerifiedSourceFd.
+class SourceVerifier {
+ public:
+  struct Partition {
+    std::string path;
+    // Number of bytes hashed from the start of |path|, and their hash.
+    uint64_t size{0};
+    brillo::Blob hash;
+    // The operations of the partition checked when it doesn't match, from
+    // |first_operation| on. Null when they aren't known yet, otherwise they
+    // must outlive the verifier and stay unchanged.
+    const PartitionUpdate* update{nullptr};
+    size_t first_operation{0};
+  };
+
+  // Reads the partitions at the best-effort I/O priority |io_priority|.
+  SourceVerifier(std::vector<Partition> partitions,
+                 size_t block_size,
+                 uint32_t io_priority);
+  // Stops the verification, after waiting for the read in progress.
+  ~SourceVerifier();
+
+  void Start();
+
+  // Returns whether all the partitions were verified.
+  bool Done();
+
+  // Returns whether the source with the |source_key| of VerifiedSourceKey(),
+  // read from the partition at |path| in the |state| of GetPartitionState(),
+  // was verified.
+  bool IsSourceVerified(const std::string& path,
+                        const std::string& state,
+                        const std::string& source_key);
+
+  // Whether the source of an operation doesn't match, even error corrected.
+  bool failed() const { return failed_; }
+
+ private:
+  struct Result {
+    // The state of the partition while it was verified.
+    std::string state;
+    // Whether the whole partition matches.
+    bool matches{false};
+    // Otherwise, the keys of the sources of the operations which match.
+    std::unordered_set<std::string> verified_sources;
+  };
+
+  void ThreadMain();
+  void VerifyPartition(const Partition& partition);
+  // Checks the sources of the operations of |partition| read from |fd| and
+  // adds the ones matching to |result|. Returns the number of operations whose
+  // source doesn't match even error corrected.
+  size_t VerifyOperations(const FileDescriptorPtr& fd,
+                          const Partition& partition,
+                          Result* result);
+  // Adds the |length| bytes of |fd| at |offset| to |hasher|. Returns false if
+  // they couldn't be read or the verification stops.
+  bool HashRange(const FileDescriptorPtr& fd,
+                 uint64_t offset,
+                 uint64_t length,
+                 HashCalculator* hasher);
+  // Returns whether the |extents| of |fd| have the SHA-256 |expected_hash|.
+  bool ExtentsMatch(const FileDescriptorPtr& fd,
+                    const google::protobuf::RepeatedPtrField<Extent>& extents,
+                    const std::string& expected_hash);
+
+  const std::vector<Partition> partitions_;
+  const size_t block_size_;
+  const uint32_t io_priority_;
+  brillo::Blob buffer_;
+
+  std::atomic<bool> stopping_{false};
+  std::atomic<bool> failed_{false};
+
+  // The fields below are protected by |mutex_|.
+  std::mutex mutex_;
+  // The partitions verified so far, by path.
+  std::map<std::string, Result> results_;
+  bool done_{false};
+
+  std::thread thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(SourceVerifier);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_SOURCE_VERIFIER_H_
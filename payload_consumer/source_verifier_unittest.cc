@@ -0,0 +1,121 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_consumer/source_verifier.h"
+
+#include <chrono>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/verified_source_fd.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr size_t kNumOps = 4;
+}  // namespace
+
+class SourceVerifierTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    data_.resize(kNumOps * kBlockSize);
+    for (size_t i = 0; i < data_.size(); i++) {
+      data_[i] = i * 31 / kBlockSize + i;
+    }
+    for (size_t i = 0; i < kNumOps; i++) {
+      InstallOperation* op = partition_.add_operations();
+      op->set_type(InstallOperation::SOURCE_COPY);
+      *op->add_src_extents() = ExtentForRange(i, 1);
+      *op->add_dst_extents() = ExtentForRange(i, 1);
+      brillo::Blob hash;
+      ASSERT_TRUE(HashCalculator::RawHashOfBytes(
+          data_.data() + i * kBlockSize, kBlockSize, &hash));
+      op->set_src_sha256_hash(hash.data(), hash.size());
+    }
+    ASSERT_TRUE(HashCalculator::RawHashOfData(data_, &hash_));
+  }
+
+  // Verifies the source partition and waits for the verification to end.
+  void Verify(SourceVerifier* verifier) {
+    verifier->Start();
+    while (!verifier->Done()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  SourceVerifier::Partition MakePartition() {
+    SourceVerifier::Partition partition;
+    partition.path = source_partition_.path();
+    partition.size = data_.size();
+    partition.hash = hash_;
+    partition.update = &partition_;
+    return partition;
+  }
+
+  ScopedTempFile source_partition_{"source-part-XXXXXX"};
+  brillo::Blob data_;
+  brillo::Blob hash_;
+  PartitionUpdate partition_;
+};
+
+TEST_F(SourceVerifierTest, MatchingPartitionTest) {
+  ASSERT_TRUE(utils::WriteFile(
+      source_partition_.path().c_str(), data_.data(), data_.size()));
+  SourceVerifier verifier({MakePartition()}, kBlockSize, 7);
+  Verify(&verifier);
+  ASSERT_FALSE(verifier.failed());
+  const std::string state = GetPartitionState(source_partition_.path());
+  for (const auto& op : partition_.operations()) {
+    ASSERT_TRUE(verifier.IsSourceVerified(
+        source_partition_.path(), state, VerifiedSourceKey(op)));
+  }
+  // Nothing is known about the partition once it changed.
+  ASSERT_FALSE(verifier.IsSourceVerified(
+      source_partition_.path(),
+      state + "-changed",
+      VerifiedSourceKey(partition_.operations(0))));
+}
+
+TEST_F(SourceVerifierTest, CorruptSourceFailsTest) {
+  data_[2 * kBlockSize] ^= 1;
+  ASSERT_TRUE(utils::WriteFile(
+      source_partition_.path().c_str(), data_.data(), data_.size()));
+  SourceVerifier::Partition partition = MakePartition();
+  partition.first_operation = 1;
+  SourceVerifier verifier({partition}, kBlockSize, 7);
+  Verify(&verifier);
+  // Error correction isn't available on the host.
+  ASSERT_TRUE(verifier.failed());
+  const std::string state = GetPartitionState(source_partition_.path());
+  const auto& ops = partition_.operations();
+  // The operations before |first_operation| aren't checked.
+  ASSERT_FALSE(verifier.IsSourceVerified(
+      source_partition_.path(), state, VerifiedSourceKey(ops[0])));
+  ASSERT_TRUE(verifier.IsSourceVerified(
+      source_partition_.path(), state, VerifiedSourceKey(ops[1])));
+  ASSERT_FALSE(verifier.IsSourceVerified(
+      source_partition_.path(), state, VerifiedSourceKey(ops[2])));
+  ASSERT_TRUE(verifier.IsSourceVerified(
+      source_partition_.path(), state, VerifiedSourceKey(ops[3])));
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,93 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/touched_blocks_verification.h"
+
+#include <utility>
+#include <vector>
+
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+namespace chromeos_update_engine {
+
+bool PlanTouchedBlocksVerification(const PartitionUpdate& partition,
+                                   InstallPlan::Partition* install_part) {
+  install_part->verify_touched_blocks = false;
+  install_part->touched_ranges.clear();
+  const uint64_t block_size = install_part->block_size;
+  if (block_size == 0 || install_part->target_size % block_size != 0) {
+    return false;
+  }
+
+  ExtentRanges written;
+  std::vector<InstallPlan::Partition::TouchedRange> ranges;
+  uint64_t touched_blocks = 0;
+  for (const InstallOperation& op : partition.operations()) {
+    if (!op.has_dst_sha256_hash()) {
+      LOG(INFO) << "The operations of " << install_part->name
+                << " have no hash of the data they write.";
+      return false;
+    }
+    for (const Extent& extent : op.dst_extents()) {
+      if (extent.start_block() == kSparseHole ||
+          written.OverlapsWithExtent(extent)) {
+        LOG(INFO) << "Several operations write the same blocks of "
+                  << install_part->name << ".";
+        return false;
+      }
+      written.AddExtent(extent);
+    }
+    if (op.type() == InstallOperation::SOURCE_COPY &&
+        op.src_sha256_hash() == op.dst_sha256_hash()) {
+      continue;
+    }
+    ranges.push_back({{op.dst_extents().begin(), op.dst_extents().end()},
+                      brillo::Blob(op.dst_sha256_hash().begin(),
+                                   op.dst_sha256_hash().end())});
+    touched_blocks += utils::BlocksInExtents(op.dst_extents());
+  }
+  // The verity data computed on the device isn't written by the operations.
+  if (install_part->hash_tree_size > 0) {
+    written.AddExtent(ExtentForBytes(block_size,
+                                     install_part->hash_tree_offset,
+                                     install_part->hash_tree_size));
+  }
+  if (install_part->fec_size > 0) {
+    written.AddExtent(ExtentForBytes(
+        block_size, install_part->fec_offset, install_part->fec_size));
+  }
+
+  const uint64_t num_blocks = install_part->target_size / block_size;
+  ExtentRanges unwritten;
+  unwritten.AddExtent(ExtentForRange(0, num_blocks));
+  unwritten.SubtractRanges(written);
+  if (unwritten.blocks() > 0) {
+    LOG(INFO) << unwritten.blocks() << " blocks of " << install_part->name
+              << " aren't written by its operations.";
+    return false;
+  }
+  LOG(INFO) << "Verifying " << install_part->name << " by reading back "
+            << touched_blocks << " of its " << num_blocks << " blocks.";
+  install_part->touched_ranges = std::move(ranges);
+  install_part->verify_touched_blocks = true;
+  return true;
+}
+
+}  // namespace chromeos_update_engine
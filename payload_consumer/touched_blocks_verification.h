@@ -0,0 +1,41 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_TOUCHED_BLOCKS_VERIFICATION_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_TOUCHED_BLOCKS_VERIFICATION_H_
+
+#include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Plans the verification of the target partition written by the operations of
+// |partition| by reading back only the blocks written by its operations other
+// than copies, each compared with the |dst_sha256_hash| of its operation.
+// Copies need no reading back: the data they write is their source data,
+// verified with their |src_sha256_hash| when they were applied. The verity data
+// computed on the device is trusted like the data it is computed from.
+//
+// Sets the |verify_touched_blocks| and |touched_ranges| of |install_part|.
+// Returns false if the whole partition must be hashed instead: an operation
+// lacks the hashes, several operations write the same blocks, or some blocks
+// aren't written by any operation.
+bool PlanTouchedBlocksVerification(const PartitionUpdate& partition,
+                                   InstallPlan::Partition* install_part);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_TOUCHED_BLOCKS_VERIFICATION_H_
@@ -0,0 +1,113 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/touched_blocks_verification.h"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_generator/extent_ranges.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr size_t kBlockSize = 4096;
+
+InstallOperation* AddOperation(PartitionUpdate* partition,
+                               InstallOperation::Type type,
+                               const Extent& dst_extent,
+                               const std::string& dst_hash) {
+  InstallOperation* op = partition->add_operations();
+  op->set_type(type);
+  *op->add_dst_extents() = dst_extent;
+  op->set_dst_sha256_hash(dst_hash);
+  return op;
+}
+}  // namespace
+
+class TouchedBlocksVerificationTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    install_part_.name = "system";
+    install_part_.block_size = kBlockSize;
+    install_part_.target_size = 10 * kBlockSize;
+    AddOperation(&partition_,
+                 InstallOperation::SOURCE_COPY,
+                 ExtentForRange(0, 4),
+                 "copy")
+        ->set_src_sha256_hash("copy");
+    AddOperation(&partition_,
+                 InstallOperation::REPLACE,
+                 ExtentForRange(4, 2),
+                 "replace");
+    AddOperation(&partition_,
+                 InstallOperation::SOURCE_BSDIFF,
+                 ExtentForRange(6, 2),
+                 "diff")
+        ->set_src_sha256_hash("source");
+  }
+
+  PartitionUpdate partition_;
+  InstallPlan::Partition install_part_;
+};
+
+TEST_F(TouchedBlocksVerificationTest, SkipsCopiesTest) {
+  install_part_.hash_tree_offset = 8 * kBlockSize;
+  install_part_.hash_tree_size = kBlockSize;
+  install_part_.fec_offset = 9 * kBlockSize;
+  install_part_.fec_size = kBlockSize;
+  ASSERT_TRUE(PlanTouchedBlocksVerification(partition_, &install_part_));
+  EXPECT_TRUE(install_part_.verify_touched_blocks);
+  ASSERT_EQ(2u, install_part_.touched_ranges.size());
+  EXPECT_EQ(std::vector<Extent>{ExtentForRange(4, 2)},
+            install_part_.touched_ranges[0].extents);
+  EXPECT_EQ(brillo::Blob({'r', 'e', 'p', 'l', 'a', 'c', 'e'}),
+            install_part_.touched_ranges[0].hash);
+  EXPECT_EQ(std::vector<Extent>{ExtentForRange(6, 2)},
+            install_part_.touched_ranges[1].extents);
+}
+
+TEST_F(TouchedBlocksVerificationTest, UnwrittenBlocksTest) {
+  // Blocks 8 and 9 aren't written, there is no verity data.
+  EXPECT_FALSE(PlanTouchedBlocksVerification(partition_, &install_part_));
+  EXPECT_FALSE(install_part_.verify_touched_blocks);
+  EXPECT_TRUE(install_part_.touched_ranges.empty());
+}
+
+TEST_F(TouchedBlocksVerificationTest, RequiresTrustworthyOperationsTest) {
+  AddOperation(&partition_, InstallOperation::ZERO, ExtentForRange(8, 2), "0");
+  ASSERT_TRUE(PlanTouchedBlocksVerification(partition_, &install_part_));
+
+  // A copy whose source isn't verified is read back.
+  partition_.mutable_operations(0)->clear_src_sha256_hash();
+  ASSERT_TRUE(PlanTouchedBlocksVerification(partition_, &install_part_));
+  EXPECT_EQ(4u, install_part_.touched_ranges.size());
+
+  // Blocks written twice.
+  AddOperation(
+      &partition_, InstallOperation::REPLACE, ExtentForRange(5, 1), "again");
+  EXPECT_FALSE(PlanTouchedBlocksVerification(partition_, &install_part_));
+  partition_.mutable_operations()->RemoveLast();
+
+  // An operation without the hash of the data it writes.
+  partition_.mutable_operations(1)->clear_dst_sha256_hash();
+  EXPECT_FALSE(PlanTouchedBlocksVerification(partition_, &install_part_));
+  EXPECT_FALSE(install_part_.verify_touched_blocks);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,201 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/update_checkpoint.h"
+
+#include <zlib.h>
+
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/common/constants.h"
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The record is made of, all integers in little endian:
+//   magic "UECP", uint32 version, int64 next operation, int64 next data
+//   offset, int64 next data length, then the SHA-256 context, the signed
+//   SHA-256 context, the signature blob and the write path hash context, each
+//   as a uint32 length followed by the data, a uint32 set to 1 if the
+//   operations are reordered, the written blocks as a uint32 length followed
+//   by the data, and the uint32 CRC32 of everything before it.
+constexpr char kMagic[] = {'U', 'E', 'C', 'P'};
+constexpr uint32_t kVersion = 1;
+
+void AppendLE(uint64_t value, size_t size, std::string* out) {
+  for (size_t i = 0; i < size; i++) {
+    out->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+void AppendString(std::string_view value, std::string* out) {
+  AppendLE(value.size(), sizeof(uint32_t), out);
+  out->append(value);
+}
+
+uint32_t Crc32(std::string_view data) {
+  return crc32(0,
+               reinterpret_cast<const Bytef*>(data.data()),
+               static_cast<uInt>(data.size()));
+}
+
+// Consumes the fields of a record from the front of |data_|.
+class RecordReader {
+ public:
+  explicit RecordReader(std::string_view data) : data_(data) {}
+
+  bool ReadLE(size_t size, uint64_t* value) {
+    TEST_AND_RETURN_FALSE(data_.size() >= size);
+    *value = 0;
+    for (size_t i = 0; i < size; i++) {
+      *value |= static_cast<uint64_t>(static_cast<uint8_t>(data_[i]))
+                << (8 * i);
+    }
+    data_.remove_prefix(size);
+    return true;
+  }
+
+  bool ReadInt64(int64_t* value) {
+    uint64_t raw = 0;
+    TEST_AND_RETURN_FALSE(ReadLE(sizeof(raw), &raw));
+    *value = static_cast<int64_t>(raw);
+    return true;
+  }
+
+  bool ReadString(std::string* value) {
+    uint64_t size = 0;
+    TEST_AND_RETURN_FALSE(ReadLE(sizeof(uint32_t), &size));
+    TEST_AND_RETURN_FALSE(data_.size() >= size);
+    value->assign(data_.data(), size);
+    data_.remove_prefix(size);
+    return true;
+  }
+
+  bool empty() const { return data_.empty(); }
+
+ private:
+  std::string_view data_;
+};
+
+}  // namespace
+
+std::string SerializeUpdateCheckpoint(const UpdateCheckpoint& checkpoint) {
+  std::string record;
+  // Allocate the record once, the hash contexts are small.
+  record.reserve(sizeof(kMagic) + 3 * sizeof(int64_t) + 8 * sizeof(uint32_t) +
+                 checkpoint.sha256_context.size() +
+                 checkpoint.signed_sha256_context.size() +
+                 checkpoint.signature_blob.size() +
+                 checkpoint.write_path_hash_context.size() +
+                 checkpoint.written_blocks.size());
+  record.append(kMagic, sizeof(kMagic));
+  AppendLE(kVersion, sizeof(uint32_t), &record);
+  AppendLE(checkpoint.next_operation, sizeof(int64_t), &record);
+  AppendLE(checkpoint.next_data_offset, sizeof(int64_t), &record);
+  AppendLE(checkpoint.next_data_length, sizeof(int64_t), &record);
+  AppendString(checkpoint.sha256_context, &record);
+  AppendString(checkpoint.signed_sha256_context, &record);
+  AppendString(checkpoint.signature_blob, &record);
+  AppendString(checkpoint.write_path_hash_context, &record);
+  AppendLE(checkpoint.reordered_operations ? 1 : 0, sizeof(uint32_t), &record);
+  AppendString(checkpoint.written_blocks, &record);
+  AppendLE(Crc32(record), sizeof(uint32_t), &record);
+  return record;
+}
+
+bool ParseUpdateCheckpoint(std::string_view data,
+                           UpdateCheckpoint* checkpoint) {
+  if (data.size() < sizeof(kMagic) + 2 * sizeof(uint32_t) ||
+      data.substr(0, sizeof(kMagic)) !=
+          std::string_view(kMagic, sizeof(kMagic))) {
+    LOG(ERROR) << "Not an update checkpoint record.";
+    return false;
+  }
+  const std::string_view body = data.substr(0, data.size() - sizeof(uint32_t));
+  uint64_t crc = 0;
+  RecordReader crc_reader(data.substr(body.size()));
+  TEST_AND_RETURN_FALSE(crc_reader.ReadLE(sizeof(uint32_t), &crc));
+  if (crc != Crc32(body)) {
+    LOG(ERROR) << "Update checkpoint record fails the CRC check.";
+    return false;
+  }
+
+  RecordReader reader(body.substr(sizeof(kMagic)));
+  uint64_t version = 0;
+  TEST_AND_RETURN_FALSE(reader.ReadLE(sizeof(uint32_t), &version));
+  if (version != kVersion) {
+    LOG(ERROR) << "Unsupported update checkpoint record version " << version;
+    return false;
+  }
+  UpdateCheckpoint result;
+  TEST_AND_RETURN_FALSE(reader.ReadInt64(&result.next_operation));
+  TEST_AND_RETURN_FALSE(reader.ReadInt64(&result.next_data_offset));
+  TEST_AND_RETURN_FALSE(reader.ReadInt64(&result.next_data_length));
+  TEST_AND_RETURN_FALSE(reader.ReadString(&result.sha256_context));
+  TEST_AND_RETURN_FALSE(reader.ReadString(&result.signed_sha256_context));
+  TEST_AND_RETURN_FALSE(reader.ReadString(&result.signature_blob));
+  TEST_AND_RETURN_FALSE(reader.ReadString(&result.write_path_hash_context));
+  uint64_t reordered = 0;
+  TEST_AND_RETURN_FALSE(reader.ReadLE(sizeof(uint32_t), &reordered));
+  TEST_AND_RETURN_FALSE(reordered <= 1);
+  result.reordered_operations = reordered == 1;
+  TEST_AND_RETURN_FALSE(reader.ReadString(&result.written_blocks));
+  TEST_AND_RETURN_FALSE(reader.empty());
+  *checkpoint = std::move(result);
+  return true;
+}
+
+bool StoreUpdateCheckpoint(PrefsInterface* prefs,
+                           const UpdateCheckpoint& checkpoint) {
+  return prefs->SetString(kPrefsUpdateStateCheckpoint,
+                          SerializeUpdateCheckpoint(checkpoint));
+}
+
+bool LoadUpdateCheckpoint(PrefsInterface* prefs, UpdateCheckpoint* checkpoint) {
+  std::string record;
+  if (prefs->GetString(kPrefsUpdateStateCheckpoint, &record)) {
+    if (ParseUpdateCheckpoint(record, checkpoint)) {
+      return true;
+    }
+    // The legacy keys are invalidated when switching to the record, falling
+    // back to them can't resume from an older position.
+    LOG(WARNING) << "Ignoring invalid " << kPrefsUpdateStateCheckpoint;
+  }
+
+  *checkpoint = UpdateCheckpoint();
+  prefs->GetInt64(kPrefsUpdateStateNextDataOffset,
+                  &checkpoint->next_data_offset);
+  prefs->GetInt64(kPrefsUpdateStateNextDataLength,
+                  &checkpoint->next_data_length);
+  prefs->GetString(kPrefsUpdateStateSHA256Context,
+                   &checkpoint->sha256_context);
+  prefs->GetString(kPrefsUpdateStateSignedSHA256Context,
+                   &checkpoint->signed_sha256_context);
+  prefs->GetString(kPrefsUpdateStateSignatureBlob,
+                   &checkpoint->signature_blob);
+  prefs->GetString(kPrefsUpdateStateWritePathHashContext,
+                   &checkpoint->write_path_hash_context);
+  prefs->GetBoolean(kPrefsUpdateStateReorderedOperations,
+                    &checkpoint->reordered_operations);
+  return prefs->GetInt64(kPrefsUpdateStateNextOperation,
+                         &checkpoint->next_operation);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,68 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_UPDATE_CHECKPOINT_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_UPDATE_CHECKPOINT_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+
+#include "update_engine/common/prefs_interface.h"
+
+namespace chromeos_update_engine {
+
+// The progress of an interrupted update, as checkpointed by the
+// DeltaPerformer.
+struct UpdateCheckpoint {
+  int64_t next_operation{-1};
+  int64_t next_data_offset{-1};
+  int64_t next_data_length{0};
+  std::string sha256_context;
+  std::string signed_sha256_context;
+  std::string signature_blob;
+  // State of the WritePathHasher of the partition being written, if any.
+  std::string write_path_hash_context;
+  // Whether |next_operation| indexes the operations of the partitions in the
+  // order of ScheduleOperations() rather than in the manifest order.
+  bool reordered_operations{false};
+  // The BlockBitmap of the blocks of the partition being written, serialized,
+  // if recorded. Only stored in the record.
+  std::string written_blocks;
+};
+
+// Encodes |checkpoint| as a single binary record, protected by a CRC32.
+std::string SerializeUpdateCheckpoint(const UpdateCheckpoint& checkpoint);
+
+// Decodes a record created by SerializeUpdateCheckpoint(). Returns false if
+// |data| is truncated, of an unknown version or fails the CRC check.
+bool ParseUpdateCheckpoint(std::string_view data, UpdateCheckpoint* checkpoint);
+
+// Stores |checkpoint| as one record in kPrefsUpdateStateCheckpoint, which
+// |prefs| writes atomically. This replaces the separate kPrefsUpdateState*
+// keys, and the prefs transaction needed to keep them consistent.
+bool StoreUpdateCheckpoint(PrefsInterface* prefs,
+                           const UpdateCheckpoint& checkpoint);
+
+// Loads the last checkpoint, from the record if there is a valid one and from
+// the kPrefsUpdateState* keys otherwise. Missing keys keep their default
+// value. Returns whether a next operation was found.
+bool LoadUpdateCheckpoint(PrefsInterface* prefs, UpdateCheckpoint* checkpoint);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_UPDATE_CHECKPOINT_H_
@@ -0,0 +1,151 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/update_checkpoint.h"
+
+#include <zlib.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/constants.h"
+#include "update_engine/common/fake_prefs.h"
+
+namespace chromeos_update_engine {
+
+class UpdateCheckpointTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    checkpoint_.next_operation = 42;
+    checkpoint_.next_data_offset = 1 << 20;
+    checkpoint_.next_data_length = 4096;
+    checkpoint_.sha256_context = std::string("hash\0context", 12);
+    checkpoint_.signed_sha256_context = "signed context";
+    checkpoint_.signature_blob = "signature";
+    checkpoint_.write_path_hash_context = std::string("4096:ctx\0", 9);
+    checkpoint_.reordered_operations = true;
+    checkpoint_.written_blocks = std::string("blocks\0", 7);
+  }
+
+  // Returns the record of |checkpoint_| with a valid CRC, but |version|.
+  std::string RecordWithVersion(char version) {
+    std::string record = SerializeUpdateCheckpoint(checkpoint_);
+    record.resize(record.size() - sizeof(uint32_t));
+    record[4] = version;
+    const uint32_t crc = crc32(
+        0, reinterpret_cast<const Bytef*>(record.data()), record.size());
+    for (size_t i = 0; i < sizeof(crc); i++) {
+      record.push_back(static_cast<char>((crc >> (8 * i)) & 0xff));
+    }
+    return record;
+  }
+
+  void ExpectEqual(const UpdateCheckpoint& expected,
+                   const UpdateCheckpoint& actual) {
+    EXPECT_EQ(expected.next_operation, actual.next_operation);
+    EXPECT_EQ(expected.next_data_offset, actual.next_data_offset);
+    EXPECT_EQ(expected.next_data_length, actual.next_data_length);
+    EXPECT_EQ(expected.sha256_context, actual.sha256_context);
+    EXPECT_EQ(expected.signed_sha256_context, actual.signed_sha256_context);
+    EXPECT_EQ(expected.signature_blob, actual.signature_blob);
+    EXPECT_EQ(expected.write_path_hash_context,
+              actual.write_path_hash_context);
+    EXPECT_EQ(expected.reordered_operations, actual.reordered_operations);
+    EXPECT_EQ(expected.written_blocks, actual.written_blocks);
+  }
+
+  void SetLegacyKeys(const UpdateCheckpoint& checkpoint) {
+    prefs_.SetInt64(kPrefsUpdateStateNextOperation, checkpoint.next_operation);
+    prefs_.SetInt64(kPrefsUpdateStateNextDataOffset,
+                    checkpoint.next_data_offset);
+    prefs_.SetInt64(kPrefsUpdateStateNextDataLength,
+                    checkpoint.next_data_length);
+    prefs_.SetString(kPrefsUpdateStateSHA256Context, checkpoint.sha256_context);
+    prefs_.SetString(kPrefsUpdateStateSignedSHA256Context,
+                     checkpoint.signed_sha256_context);
+    prefs_.SetString(kPrefsUpdateStateSignatureBlob,
+                     checkpoint.signature_blob);
+    prefs_.SetString(kPrefsUpdateStateWritePathHashContext,
+                     checkpoint.write_path_hash_context);
+    prefs_.SetBoolean(kPrefsUpdateStateReorderedOperations,
+                      checkpoint.reordered_operations);
+  }
+
+  UpdateCheckpoint checkpoint_;
+  FakePrefs prefs_;
+};
+
+TEST_F(UpdateCheckpointTest, SerializeParseTest) {
+  UpdateCheckpoint parsed;
+  ASSERT_TRUE(
+      ParseUpdateCheckpoint(SerializeUpdateCheckpoint(checkpoint_), &parsed));
+  ExpectEqual(checkpoint_, parsed);
+}
+
+TEST_F(UpdateCheckpointTest, ParseRejectsUnknownVersionTest) {
+  UpdateCheckpoint parsed;
+  ASSERT_TRUE(ParseUpdateCheckpoint(RecordWithVersion(1), &parsed));
+  ExpectEqual(checkpoint_, parsed);
+  ASSERT_FALSE(ParseUpdateCheckpoint(RecordWithVersion(2), &parsed));
+}
+
+TEST_F(UpdateCheckpointTest, ParseRejectsCorruptRecordTest) {
+  const std::string record = SerializeUpdateCheckpoint(checkpoint_);
+  UpdateCheckpoint parsed;
+  ASSERT_FALSE(ParseUpdateCheckpoint("", &parsed));
+  ASSERT_FALSE(
+      ParseUpdateCheckpoint(record.substr(0, record.size() - 1), &parsed));
+  for (size_t i = 0; i < record.size(); i++) {
+    std::string corrupt = record;
+    corrupt[i] ^= 0x10;
+    ASSERT_FALSE(ParseUpdateCheckpoint(corrupt, &parsed)) << "byte " << i;
+  }
+  // A failed parse leaves the output untouched.
+  ExpectEqual(UpdateCheckpoint(), parsed);
+}
+
+TEST_F(UpdateCheckpointTest, LoadPrefersRecordTest) {
+  UpdateCheckpoint legacy = checkpoint_;
+  legacy.next_operation = 7;
+  SetLegacyKeys(legacy);
+  ASSERT_TRUE(StoreUpdateCheckpoint(&prefs_, checkpoint_));
+
+  UpdateCheckpoint loaded;
+  ASSERT_TRUE(LoadUpdateCheckpoint(&prefs_, &loaded));
+  ExpectEqual(checkpoint_, loaded);
+}
+
+TEST_F(UpdateCheckpointTest, LoadLegacyKeysTest) {
+  SetLegacyKeys(checkpoint_);
+  UpdateCheckpoint loaded;
+  ASSERT_TRUE(LoadUpdateCheckpoint(&prefs_, &loaded));
+  ExpectEqual(checkpoint_, loaded);
+
+  // An invalid record falls back to the legacy keys.
+  prefs_.SetString(kPrefsUpdateStateCheckpoint, "garbage");
+  loaded = UpdateCheckpoint();
+  ASSERT_TRUE(LoadUpdateCheckpoint(&prefs_, &loaded));
+  ExpectEqual(checkpoint_, loaded);
+}
+
+TEST_F(UpdateCheckpointTest, LoadWithoutCheckpointTest) {
+  UpdateCheckpoint loaded;
+  ASSERT_FALSE(LoadUpdateCheckpoint(&prefs_, &loaded));
+  ExpectEqual(UpdateCheckpoint(), loaded);
+}
+
+}  // namespace chromeos_update_engine
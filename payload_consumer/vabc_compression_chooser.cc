@@ -0,0 +1,309 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/vabc_compression_chooser.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <random>
+#include <utility>
+
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <brotli/encode.h>
+#include <lz4.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#include "update_engine/common/constants.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The sample is compressed repeatedly for at least this long, so that the
+// clock resolution doesn't matter, and at most kMaxRounds times.
+constexpr std::chrono::milliseconds kMinMeasureTime{20};
+constexpr size_t kMaxRounds = 64;
+
+// The repeated runs of the sample copy bytes at least this far back, so that
+// they don't degenerate into runs of a single byte.
+constexpr size_t kMinRepeatDistance = 16;
+
+// The levels libsnapshot uses when the compression param has none.
+constexpr int kDefaultZstdLevel = 3;
+constexpr int kDefaultGzLevel = Z_BEST_COMPRESSION;
+constexpr int kDefaultBrotliQuality = BROTLI_DEFAULT_QUALITY;
+
+// Compresses the |size| bytes at |data| into |out|, which is large enough.
+// Returns the compressed size, or 0 on failure.
+using BlockCompressor =
+    std::function<size_t(const uint8_t* data, size_t size, brillo::Blob* out)>;
+
+BlockCompressor GetBlockCompressor(const std::string& compression) {
+  const std::vector<std::string> parts = android::base::Split(compression, ",");
+  const std::string& algorithm = parts[0];
+  int level = -1;
+  if (parts.size() > 1 && !android::base::ParseInt(parts[1], &level)) {
+    LOG(WARNING) << "Invalid compression level in " << compression;
+    level = -1;
+  }
+  if (algorithm == "lz4") {
+    return [](const uint8_t* data, size_t size, brillo::Blob* out) {
+      const int ret = LZ4_compress_default(reinterpret_cast<const char*>(data),
+                                           reinterpret_cast<char*>(out->data()),
+                                           size,
+                                           out->size());
+      return ret > 0 ? static_cast<size_t>(ret) : 0;
+    };
+  }
+  if (algorithm == "zstd") {
+    level = level < 0 ? kDefaultZstdLevel : level;
+    return [level](const uint8_t* data, size_t size, brillo::Blob* out) {
+      const size_t ret =
+          ZSTD_compress(out->data(), out->size(), data, size, level);
+      return ZSTD_isError(ret) ? 0 : ret;
+    };
+  }
+  if (algorithm == "gz") {
+    level = level < 0 ? kDefaultGzLevel : level;
+    return [level](const uint8_t* data, size_t size, brillo::Blob* out) {
+      uLongf out_size = out->size();
+      return compress2(out->data(), &out_size, data, size, level) == Z_OK
+                 ? static_cast<size_t>(out_size)
+                 : 0;
+    };
+  }
+  if (algorithm == "brotli") {
+    level = level < 0 ? kDefaultBrotliQuality : level;
+    return [level](const uint8_t* data, size_t size, brillo::Blob* out) {
+      size_t out_size = out->size();
+      return BrotliEncoderCompress(level,
+                                   BROTLI_DEFAULT_WINDOW,
+                                   BROTLI_DEFAULT_MODE,
+                                   size,
+                                   data,
+                                   &out_size,
+                                   out->data())
+                 ? out_size
+                 : 0;
+    };
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+uint64_t UncompressedCowSize(const PartitionUpdate& partition,
+                             size_t block_size) {
+  uint64_t size = partition.new_partition_info().size();
+  for (const auto& operation : partition.merge_operations()) {
+    if (operation.type() == CowMergeOperation::COW_COPY) {
+      size -= operation.dst_extent().num_blocks() * block_size;
+    }
+  }
+  return size;
+}
+
+brillo::Blob GenerateCompressionSample(size_t size, size_t block_size) {
+  std::mt19937 gen(0);
+  brillo::Blob sample(size);
+  size_t i = 0;
+  while (i < size) {
+    const size_t block_offset = i % block_size;
+    if (block_offset >= kMinRepeatDistance && gen() % 2) {
+      const size_t distance =
+          kMinRepeatDistance + gen() % (block_offset - kMinRepeatDistance + 1);
+      const size_t length = std::min<size_t>(
+          {4 + gen() % 32, block_size - block_offset, size - i});
+      for (size_t j = 0; j < length; j++, i++) {
+        sample[i] = sample[i - distance];
+      }
+    } else {
+      sample[i++] = 'a' + gen() % 16;
+    }
+  }
+  return sample;
+}
+
+bool BenchmarkCowCompression(const std::string& compression,
+                             const brillo::Blob& sample,
+                             size_t block_size,
+                             CowCompressionBenchmark* result) {
+  const BlockCompressor compress = GetBlockCompressor(compression);
+  if (!compress || sample.empty()) {
+    return false;
+  }
+  // Room for incompressible blocks with any of the algorithms.
+  brillo::Blob out(2 * block_size + 1024);
+  uint64_t compressed_size = 0;
+  const auto start = std::chrono::steady_clock::now();
+  auto elapsed = std::chrono::steady_clock::duration::zero();
+  size_t rounds = 0;
+  while (rounds < kMaxRounds && (rounds == 0 || elapsed < kMinMeasureTime)) {
+    for (size_t offset = 0; offset < sample.size(); offset += block_size) {
+      const size_t size = std::min(block_size, sample.size() - offset);
+      const size_t compressed = compress(sample.data() + offset, size, &out);
+      if (compressed == 0) {
+        LOG(WARNING) << "Failed to compress the sample with " << compression;
+        return false;
+      }
+      if (rounds == 0) {
+        // libsnapshot stores the blocks which don't compress as they are.
+        compressed_size += std::min(compressed, size);
+      }
+    }
+    rounds++;
+    elapsed = std::chrono::steady_clock::now() - start;
+  }
+  const double seconds = std::chrono::duration<double>(elapsed).count();
+  result->compression = compression;
+  result->throughput = seconds > 0
+                           ? rounds * sample.size() / seconds
+                           : std::numeric_limits<double>::infinity();
+  result->ratio = static_cast<double>(compressed_size) / sample.size();
+  return true;
+}
+
+std::vector<CowCompressionBenchmark> LoadOrRunCowCompressionBenchmarks(
+    PrefsInterface* prefs,
+    const std::vector<std::string>& compressions,
+    size_t block_size) {
+  // The pref has the block size on the first line, then one benchmark per
+  // line as "<compression> <throughput> <ratio>".
+  std::vector<CowCompressionBenchmark> cached;
+  std::string value;
+  if (prefs->GetString(kPrefsVabcCompressionBenchmarks, &value)) {
+    const auto lines = android::base::Split(value, "\n");
+    if (lines[0] == std::to_string(block_size)) {
+      for (size_t i = 1; i < lines.size(); i++) {
+        const auto fields = android::base::Split(lines[i], " ");
+        CowCompressionBenchmark benchmark;
+        if (fields.size() != 3 ||
+            !base::StringToDouble(fields[1], &benchmark.throughput) ||
+            !base::StringToDouble(fields[2], &benchmark.ratio)) {
+          continue;
+        }
+        benchmark.compression = fields[0];
+        cached.push_back(std::move(benchmark));
+      }
+    }
+  }
+
+  std::vector<CowCompressionBenchmark> result;
+  brillo::Blob sample;
+  bool updated = false;
+  for (const auto& compression : compressions) {
+    const auto it = std::find_if(
+        cached.begin(), cached.end(), [&compression](const auto& benchmark) {
+          return benchmark.compression == compression;
+        });
+    if (it != cached.end()) {
+      result.push_back(*it);
+      continue;
+    }
+    if (sample.empty()) {
+      sample = GenerateCompressionSample(kCompressionSampleSize, block_size);
+    }
+    CowCompressionBenchmark benchmark;
+    if (!BenchmarkCowCompression(compression, sample, block_size, &benchmark)) {
+      continue;
+    }
+    LOG(INFO) << "COW compression " << compression << " runs at "
+              << benchmark.throughput / 1024 / 1024 << " MiB/s with a ratio of " << benchmark.ratio;
+    cached.push_back(benchmark);
+    result.push_back(std::move(benchmark));
+    updated = true;
+  }
+
+  if (updated) {
+    value = std::to_string(block_size);
+    for (const auto& benchmark : cached) {
+      value += android::base::StringPrintf("\n%s %f %f",
+                                           benchmark.compression.c_str(),
+                                           benchmark.throughput,
+                                           benchmark.ratio);
+    }
+    if (!prefs->SetString(kPrefsVabcCompressionBenchmarks, value)) {
+      LOG(WARNING) << "Failed to cache the COW compression benchmarks.";
+    }
+  }
+  return result;
+}
+
+std::string ChooseCowCompression(
+    const std::vector<CowCompressionBenchmark>& benchmarks,
+    const std::string& payload_compression,
+    uint64_t estimated_cow_size,
+    uint64_t uncompressed_cow_size,
+    uint64_t space_budget) {
+  const auto payload_benchmark = std::find_if(
+      benchmarks.begin(),
+      benchmarks.end(),
+      [&payload_compression](const auto& benchmark) {
+        return benchmark.compression == payload_compression;
+      });
+  if (payload_benchmark == benchmarks.end() || payload_benchmark->ratio <= 0) {
+    return payload_compression;
+  }
+
+  struct Candidate {
+    std::string compression;
+    double throughput;
+    uint64_t cow_size;
+  };
+  std::vector<Candidate> candidates{
+      {"none", std::numeric_limits<double>::infinity(), uncompressed_cow_size}};
+  for (const auto& benchmark : benchmarks) {
+    uint64_t cow_size = estimated_cow_size;
+    if (benchmark.compression != payload_compression) {
+      cow_size = estimated_cow_size * benchmark.ratio /
+                 payload_benchmark->ratio * kProjectedCowSizeHeadroom;
+      if (cow_size > space_budget) {
+        continue;
+      }
+    }
+    candidates.push_back(
+        {benchmark.compression, benchmark.throughput, cow_size});
+  }
+  if (uncompressed_cow_size > space_budget) {
+    candidates.erase(candidates.begin());
+  }
+
+  // The smallest COWs among the fast candidates, otherwise the fastest one.
+  const auto is_fast = [](const Candidate& candidate) {
+    return candidate.throughput >= kMinVabcCompressionThroughput;
+  };
+  const Candidate* chosen = nullptr;
+  for (const auto& candidate : candidates) {
+    if (chosen == nullptr) {
+      chosen = &candidate;
+    } else if (is_fast(candidate) != is_fast(*chosen)) {
+      chosen = is_fast(candidate) ? &candidate : chosen;
+    } else if (is_fast(candidate) ? candidate.cow_size < chosen->cow_size
+                                  : candidate.throughput > chosen->throughput) {
+      chosen = &candidate;
+    }
+  }
+  return chosen ? chosen->compression : payload_compression;
+}
+
+}  // namespace chromeos_update_engine
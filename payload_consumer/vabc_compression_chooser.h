@@ -0,0 +1,105 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_VABC_COMPRESSION_CHOOSER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_VABC_COMPRESSION_CHOOSER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/prefs_interface.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// The payload sets one vabc_compression_param for all devices, although on
+// devices with slow CPUs compressing the COWs is what bounds the speed of the
+// VABC writes, and devices with little free space need the smallest COWs.
+// These functions benchmark the COW compressions on this device and choose
+// the one to write the COWs with, which may differ from the payload's.
+
+// The compression throughput, in bytes of input per second on one thread,
+// above which a compression doesn't slow the VABC writes down.
+constexpr double kMinVabcCompressionThroughput = 100.0 * 1024 * 1024;
+
+// The size of the sample the compressions are benchmarked on.
+constexpr size_t kCompressionSampleSize = 1024 * 1024;
+
+// The COWs may take at most this fraction of the free space.
+constexpr uint64_t kVabcFreeSpaceDivisor = 2;
+
+// The COW size of a compression other than the payload's is projected from
+// the payload's estimate and the compression ratios on the sample, then
+// scaled by this factor as the sample only approximates partition data.
+constexpr double kProjectedCowSizeHeadroom = 1.1;
+
+// The compressions benchmarked besides the payload's one.
+constexpr const char* kVabcCompressionCandidates[] = {
+    "lz4", "zstd,1", "zstd,3", "gz,1"};
+
+struct CowCompressionBenchmark {
+  // A vabc_compression_param, such as "lz4" or "gz,9".
+  std::string compression;
+  // In bytes of input per second on one thread.
+  double throughput;
+  // The compressed size over the uncompressed one.
+  double ratio;
+};
+
+// Returns the bytes of COW |partition| needs when written uncompressed: its
+// blocks, except the ones of COW_COPY merge operations.
+uint64_t UncompressedCowSize(const PartitionUpdate& partition,
+                             size_t block_size);
+
+// Returns |size| bytes compressing about as well as typical partition data:
+// runs repeating earlier bytes of the block between literals drawn from a
+// small alphabet, so that entropy coding pays off too.
+brillo::Blob GenerateCompressionSample(size_t size, size_t block_size);
+
+// Benchmarks |compression| compressing |sample| in blocks of |block_size| on
+// the calling thread. Returns false if the algorithm isn't known.
+bool BenchmarkCowCompression(const std::string& compression,
+                             const brillo::Blob& sample,
+                             size_t block_size,
+                             CowCompressionBenchmark* result);
+
+// Returns the benchmarks of |compressions| cached in |prefs| for
+// |block_size|, running and caching the missing ones first.
+std::vector<CowCompressionBenchmark> LoadOrRunCowCompressionBenchmarks(
+    PrefsInterface* prefs,
+    const std::vector<std::string>& compressions,
+    size_t block_size);
+
+// Returns the compression to write the COWs with, "none" included, given the
+// |benchmarks|, the COW size the payload estimates with |payload_compression|,
+// the exact size of uncompressed COWs and the |space_budget| for the COWs.
+// Among the compressions fitting in the budget and not slowing the writes
+// down, chooses the one with the smallest COWs, otherwise the fastest one.
+// The payload's compression is always considered fitting.
+std::string ChooseCowCompression(
+    const std::vector<CowCompressionBenchmark>& benchmarks,
+    const std::string& payload_compression,
+    uint64_t estimated_cow_size,
+    uint64_t uncompressed_cow_size,
+    uint64_t space_budget);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_VABC_COMPRESSION_CHOOSER_H_
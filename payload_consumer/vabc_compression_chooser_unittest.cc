@@ -0,0 +1,107 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/vabc_compression_chooser.h"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/constants.h"
+#include "update_engine/common/fake_prefs.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr size_t kBlockSize = 4096;
+}  // namespace
+
+TEST(VabcCompressionChooserTest, UncompressedCowSizeSkipsCopyOps) {
+  PartitionUpdate partition;
+  partition.mutable_new_partition_info()->set_size(100 * kBlockSize);
+  auto* copy_op = partition.add_merge_operations();
+  copy_op->set_type(CowMergeOperation::COW_COPY);
+  *copy_op->mutable_dst_extent() = ExtentForRange(10, 20);
+  auto* xor_op = partition.add_merge_operations();
+  xor_op->set_type(CowMergeOperation::COW_XOR);
+  *xor_op->mutable_dst_extent() = ExtentForRange(50, 5);
+  ASSERT_EQ(UncompressedCowSize(partition, kBlockSize), 80 * kBlockSize);
+}
+
+TEST(VabcCompressionChooserTest, BenchmarkCowCompression) {
+  const auto sample = GenerateCompressionSample(16 * kBlockSize, kBlockSize);
+  ASSERT_EQ(sample.size(), 16 * kBlockSize);
+  CowCompressionBenchmark lz4;
+  ASSERT_TRUE(BenchmarkCowCompression("lz4", sample, kBlockSize, &lz4));
+  ASSERT_GT(lz4.throughput, 0);
+  CowCompressionBenchmark gz;
+  ASSERT_TRUE(BenchmarkCowCompression("gz,9", sample, kBlockSize, &gz));
+  // The sample must tell the compressions apart.
+  ASSERT_LT(gz.ratio, lz4.ratio);
+  ASSERT_LT(lz4.ratio, 1);
+  CowCompressionBenchmark unknown;
+  ASSERT_FALSE(
+      BenchmarkCowCompression("unknown", sample, kBlockSize, &unknown));
+}
+
+TEST(VabcCompressionChooserTest, BenchmarksAreCached) {
+  FakePrefs prefs;
+  const auto benchmarks =
+      LoadOrRunCowCompressionBenchmarks(&prefs, {"lz4", "bad"}, kBlockSize);
+  ASSERT_EQ(benchmarks.size(), 1U);
+  ASSERT_TRUE(prefs.Exists(kPrefsVabcCompressionBenchmarks));
+
+  std::string value = std::to_string(kBlockSize) + "\nlz4 1000.5 0.25";
+  ASSERT_TRUE(prefs.SetString(kPrefsVabcCompressionBenchmarks, value));
+  const auto cached =
+      LoadOrRunCowCompressionBenchmarks(&prefs, {"lz4"}, kBlockSize);
+  ASSERT_EQ(cached.size(), 1U);
+  ASSERT_EQ(cached[0].compression, "lz4");
+  ASSERT_DOUBLE_EQ(cached[0].throughput, 1000.5);
+  ASSERT_DOUBLE_EQ(cached[0].ratio, 0.25);
+
+  // Benchmarks of another block size are run again.
+  const auto rerun =
+      LoadOrRunCowCompressionBenchmarks(&prefs, {"lz4"}, 2 * kBlockSize);
+  ASSERT_EQ(rerun.size(), 1U);
+  ASSERT_NE(rerun[0].throughput, 1000.5);
+}
+
+TEST(VabcCompressionChooserTest, ChooseCowCompression) {
+  constexpr double kSlow = kMinVabcCompressionThroughput / 2;
+  constexpr double kFast = kMinVabcCompressionThroughput * 2;
+  const std::vector<CowCompressionBenchmark> slow_cpu{
+      {"lz4", kSlow, 0.6}, {"zstd,3", kSlow / 4, 0.4}, {"gz,9", 1, 0.3}};
+  const std::vector<CowCompressionBenchmark> fast_cpu{
+      {"lz4", kFast * 4, 0.6}, {"zstd,3", kFast, 0.4}, {"gz,9", kSlow, 0.3}};
+  // Slow CPU with plenty of space: uncompressed.
+  ASSERT_EQ(ChooseCowCompression(slow_cpu, "gz,9", 300, 1000, 10000), "none");
+  // Slow CPU with less space: the fastest compression fitting.
+  ASSERT_EQ(ChooseCowCompression(slow_cpu, "gz,9", 300, 1000, 700), "lz4");
+  ASSERT_EQ(ChooseCowCompression(slow_cpu, "gz,9", 300, 1000, 500), "zstd,3");
+  // The payload's compression always fits.
+  ASSERT_EQ(ChooseCowCompression(slow_cpu, "gz,9", 300, 1000, 100), "gz,9");
+  // Fast CPU: the smallest COWs among the fast compressions.
+  ASSERT_EQ(ChooseCowCompression(fast_cpu, "lz4", 600, 1000, 10000),
+            "zstd,3");
+  // Unknown payload compression.
+  ASSERT_EQ(ChooseCowCompression(fast_cpu, "brotli", 600, 1000, 10000),
+            "brotli");
+}
+
+}  // namespace chromeos_update_engine
@@ -16,6 +16,7 @@
 
 #include "update_engine/payload_consumer/vabc_partition_writer.h"
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <utility>
@@ -27,7 +28,7 @@
 
 #include "update_engine/common/cow_operation_convert.h"
 #include "update_engine/common/utils.h"
-#include "update_engine/payload_consumer/extent_map.h"
+#include "update_engine/payload_consumer/flat_extent_map.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/payload_consumer/install_plan.h"
 #include "update_engine/payload_consumer/snapshot_extent_writer.h"
@@ -65,15 +66,123 @@ using android::snapshot::ICowWriter;
 using ::google::protobuf::RepeatedPtrField;
 
 // Compute XOR map, a map from dst extent to corresponding merge operation
-static ExtentMap<const CowMergeOperation*, ExtentLess> ComputeXorMap(
+static FlatExtentMap<const CowMergeOperation*> ComputeXorMap(
     const RepeatedPtrField<CowMergeOperation>& merge_ops) {
-  ExtentMap<const CowMergeOperation*, ExtentLess> xor_map;
+  std::vector<std::pair<Extent, const CowMergeOperation*>> entries;
   for (const auto& merge_op : merge_ops) {
     if (merge_op.type() == CowMergeOperation::COW_XOR) {
-      xor_map.AddExtent(merge_op.dst_extent(), &merge_op);
+      entries.emplace_back(merge_op.dst_extent(), &merge_op);
     }
   }
-  return xor_map;
+  return FlatExtentMap<const CowMergeOperation*>(std::move(entries));
+}
+
+// Computes the order in which snapuserd merges the blocks of |merge_ops|.
+static std::vector<uint32_t> ComputeMergeSequence(
+    const RepeatedPtrField<CowMergeOperation>& merge_ops) {
+  size_t num_blocks = 0;
+  for (const auto& merge_op : merge_ops) {
+    num_blocks += merge_op.dst_extent().num_blocks();
+  }
+  std::vector<uint32_t> blocks_merge_order;
+  blocks_merge_order.reserve(num_blocks);
+  // TODO(193863443) Remove this check once this feature
+  // lands on all pixel devices.
+  const bool is_ascending = android::base::GetBoolProperty(
+      "ro.virtual_ab.userspace.snapshots.enabled", false);
+  for (const auto& merge_op : merge_ops) {
+    const auto& dst_extent = merge_op.dst_extent();
+    const auto& src_extent = merge_op.src_extent();
+    // In place copy are basically noops, they do not need to be "merged" at
+    // all, don't include them in merge sequence.
+    if (merge_op.type() == CowMergeOperation::COW_COPY &&
+        merge_op.src_extent() == merge_op.dst_extent()) {
+      continue;
+    }
+
+    const bool extent_overlap =
+        ExtentRanges::ExtentsOverlap(src_extent, dst_extent);
+
+    // If this is a self-overlapping op and |dst_extent| comes after
+    // |src_extent|, we must write in reverse order for correctness.
+    //
+    // If this is self-overlapping op and |dst_extent| comes before
+    // |src_extent|, we must write in ascending order for correctness.
+    //
+    // If this isn't a self overlapping op, write block in ascending order
+    // if userspace snapshots are enabled
+    if (extent_overlap) {
+      if (dst_extent.start_block() <= src_extent.start_block()) {
+        for (size_t i = 0; i < dst_extent.num_blocks(); i++) {
+          blocks_merge_order.push_back(dst_extent.start_block() + i);
+        }
+      } else {
+        for (int i = dst_extent.num_blocks() - 1; i >= 0; i--) {
+          blocks_merge_order.push_back(dst_extent.start_block() + i);
+        }
+      }
+    } else {
+      if (is_ascending) {
+        for (size_t i = 0; i < dst_extent.num_blocks(); i++) {
+          blocks_merge_order.push_back(dst_extent.start_block() + i);
+        }
+      } else {
+        for (int i = dst_extent.num_blocks() - 1; i >= 0; i--) {
+          blocks_merge_order.push_back(dst_extent.start_block() + i);
+        }
+      }
+    }
+  }
+  return blocks_merge_order;
+}
+
+// Computes the COW_COPY ops of |merge_ops| written before the first
+// operation when the device doesn't support the merge sequence op. With
+// |user_snapshots|, consecutive copies of contiguous blocks from contiguous
+// blocks are merged into a single multi-block copy.
+static std::vector<CowOperation> ComputeCopyOps(
+    const RepeatedPtrField<CowMergeOperation>& merge_ops, bool user_snapshots) {
+  std::vector<CowOperation> copy_ops;
+  for (const auto& cow_op : merge_ops) {
+    if (cow_op.type() != CowMergeOperation::COW_COPY ||
+        cow_op.dst_extent() == cow_op.src_extent()) {
+      continue;
+    }
+    const CowOperation copy{CowOperation::CowCopy,
+                            cow_op.src_extent().start_block(),
+                            cow_op.dst_extent().start_block(),
+                            cow_op.src_extent().num_blocks()};
+    // Copies of no blocks are kept apart, to be rejected when written.
+    if (user_snapshots && copy.block_count > 0 && !copy_ops.empty() &&
+        copy_ops.back().block_count > 0 &&
+        IsConsecutive(copy_ops.back(), copy)) {
+      copy_ops.back().block_count += copy.block_count;
+      continue;
+    }
+    copy_ops.push_back(copy);
+  }
+  return copy_ops;
+}
+
+std::unique_ptr<VABCCowPlan> VABCPartitionWriter::ComputeCowPlan(
+    const PartitionUpdate& partition_update, bool supports_xor) {
+  auto cow_plan = std::make_unique<VABCCowPlan>();
+  const auto& merge_ops = partition_update.merge_operations();
+  cow_plan->supports_xor = supports_xor;
+  for (const auto& cow_op : merge_ops) {
+    if (cow_op.type() == CowMergeOperation::COW_COPY) {
+      cow_plan->copy_blocks.AddExtent(cow_op.dst_extent());
+    }
+  }
+  if (supports_xor) {
+    cow_plan->xor_map = ComputeXorMap(merge_ops);
+    cow_plan->merge_sequence = ComputeMergeSequence(merge_ops);
+  } else {
+    cow_plan->user_snapshots = android::base::GetBoolProperty(
+        "ro.virtual_ab.userspace.snapshots.enabled", false);
+    cow_plan->copy_ops = ComputeCopyOps(merge_ops, cow_plan->user_snapshots);
+  }
+  return cow_plan;
 }
 
 VABCPartitionWriter::VABCPartitionWriter(
@@ -86,16 +195,8 @@ VABCPartitionWriter::VABCPartitionWriter(
       dynamic_control_(dynamic_control),
       block_size_(block_size),
       executor_(block_size),
-      verified_source_fd_(block_size, install_part.source_path) {
-  for (const auto& cow_op : partition_update_.merge_operations()) {
-    if (cow_op.type() != CowMergeOperation::COW_COPY) {
-      continue;
-    }
-    copy_blocks_.AddExtent(cow_op.dst_extent());
-  }
-  LOG(INFO) << "Partition `" << partition_update.partition_name() << "` has "
-            << copy_blocks_.blocks() << " copy blocks";
-}
+      verified_source_fd_(block_size, install_part.source_path),
+      pending_raw_blocks_(block_size) {}
 
 bool VABCPartitionWriter::ProcessSourceCopyOperation(
     const InstallOperation& operation,
@@ -109,37 +210,40 @@ bool VABCPartitionWriter::ProcessSourceCopyOperation(
   TEST_AND_RETURN_FALSE(source_fd != nullptr);
   std::vector<CowOperation> converted;
 
-  const auto& src_extents = operation.src_extents();
-  const auto& dst_extents = operation.dst_extents();
-  BlockIterator it1{src_extents};
-  BlockIterator it2{dst_extents};
   const bool userSnapshots = android::base::GetBoolProperty(
       "ro.virtual_ab.userspace.snapshots.enabled", false);
   // For devices not supporting XOR, sequence op is not supported, so all COPY
   // operations are written up front in strict merge order.
-  while (!it1.is_end() && !it2.is_end()) {
-    const auto src_block = *it1;
-    const auto dst_block = *it2;
-    ++it1;
-    ++it2;
-    if (src_block == dst_block) {
-      continue;
-    }
-    if (copy_blocks.ContainsBlock(dst_block)) {
-      if (sequence_op_supported) {
-        push_back(&converted, {CowOperation::CowCopy, src_block, dst_block, 1});
-      }
-    } else {
-      push_back(&converted,
-                {CowOperation::CowReplace, src_block, dst_block, 1});
-    }
-  }
+  ForEachSourceCopyRun(
+      operation,
+      copy_blocks,
+      [&](uint64_t src_block,
+          uint64_t dst_block,
+          uint64_t num_blocks,
+          bool is_copy) {
+        // The blocks of a run are either all copied in place or none is.
+        if (src_block == dst_block) {
+          return true;
+        }
+        if (is_copy) {
+          if (sequence_op_supported) {
+            push_back(
+                &converted,
+                {CowOperation::CowCopy, src_block, dst_block, num_blocks});
+          }
+        } else {
+          push_back(
+              &converted,
+              {CowOperation::CowReplace, src_block, dst_block, num_blocks});
+        }
+        return true;
+      });
   std::vector<uint8_t> buffer;
   for (const auto& cow_op : converted) {
     if (cow_op.op == CowOperation::CowCopy) {
       if (userSnapshots) {
-        cow_writer->AddCopy(
-            cow_op.dst_block, cow_op.src_block, cow_op.block_count);
+        TEST_AND_RETURN_FALSE(cow_writer->AddCopy(
+            cow_op.dst_block, cow_op.src_block, cow_op.block_count));
       } else {
         // Add blocks in reverse order, because snapused specifically prefers
         // this ordering. Since we already eliminated all self-overlapping
@@ -174,29 +278,18 @@ bool VABCPartitionWriter::DoesDeviceSupportsXor() {
 }
 
 bool VABCPartitionWriter::WriteAllCopyOps() {
-  const bool userSnapshots = android::base::GetBoolProperty(
-      "ro.virtual_ab.userspace.snapshots.enabled", false);
-  for (const auto& cow_op : partition_update_.merge_operations()) {
-    if (cow_op.type() != CowMergeOperation::COW_COPY) {
-      continue;
-    }
-    if (cow_op.dst_extent() == cow_op.src_extent()) {
-      continue;
-    }
-    if (userSnapshots) {
-      TEST_AND_RETURN_FALSE(cow_op.src_extent().num_blocks() != 0);
-      TEST_AND_RETURN_FALSE(
-          cow_writer_->AddCopy(cow_op.dst_extent().start_block(),
-                               cow_op.src_extent().start_block(),
-                               cow_op.src_extent().num_blocks()));
+  for (const auto& copy : cow_plan_->copy_ops) {
+    if (cow_plan_->user_snapshots) {
+      TEST_AND_RETURN_FALSE(copy.block_count != 0);
+      TEST_AND_RETURN_FALSE(cow_writer_->AddCopy(
+          copy.dst_block, copy.src_block, copy.block_count));
     } else {
       // Add blocks in reverse order, because snapused specifically prefers
       // this ordering. Since we already eliminated all self-overlapping
       // SOURCE_COPY during delta generation, this should be safe to do.
-      for (size_t i = cow_op.src_extent().num_blocks(); i > 0; i--) {
-        TEST_AND_RETURN_FALSE(
-            cow_writer_->AddCopy(cow_op.dst_extent().start_block() + i - 1,
-                                 cow_op.src_extent().start_block() + i - 1));
+      for (size_t i = copy.block_count; i > 0; i--) {
+        TEST_AND_RETURN_FALSE(cow_writer_->AddCopy(copy.dst_block + i - 1,
+                                                   copy.src_block + i - 1));
       }
     }
   }
@@ -206,8 +299,14 @@ bool VABCPartitionWriter::WriteAllCopyOps() {
 bool VABCPartitionWriter::Init(const InstallPlan* install_plan,
                                bool source_may_exist,
                                size_t next_op_index) {
-  if (dynamic_control_->GetVirtualAbCompressionXorFeatureFlag().IsEnabled()) {
-    xor_map_ = ComputeXorMap(partition_update_.merge_operations());
+  if (!cow_plan_) {
+    cow_plan_ = ComputeCowPlan(partition_update_, DoesDeviceSupportsXor());
+  }
+  copy_blocks_ = std::move(cow_plan_->copy_blocks);
+  LOG(INFO) << "Partition `" << partition_update_.partition_name() << "` has "
+            << copy_blocks_.blocks() << " copy blocks";
+  if (cow_plan_->supports_xor) {
+    xor_map_ = std::move(cow_plan_->xor_map);
     if (xor_map_.size() > 0) {
       LOG(INFO) << "Virtual AB Compression with XOR is enabled";
     } else {
@@ -218,9 +317,31 @@ bool VABCPartitionWriter::Init(const InstallPlan* install_plan,
     LOG(INFO) << "Virtual AB Compression with XOR is disabled.";
   }
   TEST_AND_RETURN_FALSE(install_plan != nullptr);
+  worker_pool_ =
+      std::make_unique<WorkerPool>(install_plan->OperationPoolThreads());
+  verified_source_fd_.set_worker_pool(worker_pool_.get());
+  executor_.set_worker_pool(worker_pool_.get());
+  executor_.set_bsdiff_memory_limit(install_plan->bsdiff_memory_limit);
+  executor_.set_bzip_threads(install_plan->bzip_threads);
+  executor_.set_lz4diff_threads(install_plan->lz4diff_threads);
+  executor_.set_xz_threads(install_plan->xz_threads);
+  executor_.set_zstd_threads(install_plan->zstd_threads);
+  executor_.set_zucchini_threads(install_plan->zucchini_threads);
+  executor_.set_puffdiff_cache_size(install_plan->puffdiff_cache_size);
+  executor_.set_source_readahead_size(install_plan->source_readahead_size);
+  batch_writes_ = install_plan->batched_writes;
+  TEST_AND_RETURN_FALSE(
+      executor_.SetZstdDictionary(partition_update_.zstd_dictionary()));
   if (source_may_exist && install_part_.source_size > 0) {
     TEST_AND_RETURN_FALSE(!install_part_.source_path.empty());
-    TEST_AND_RETURN_FALSE(verified_source_fd_.Open());
+    verified_source_fd_.set_source_read_threads(
+        install_plan->source_read_threads);
+    verified_source_fd_.set_drop_page_cache(install_plan->drop_page_cache);
+    if (install_plan->source_cache_size > 0) {
+      verified_source_fd_.EnableSourceCache(partition_update_,
+                                            install_plan->source_cache_size);
+    }
+    TEST_AND_RETURN_FALSE(verified_source_fd_.Open(install_plan->use_io_uring));
   }
   std::optional<std::string> source_path;
   if (!install_part_.source_path.empty()) {
@@ -245,6 +366,7 @@ bool VABCPartitionWriter::Init(const InstallPlan* install_plan,
   TEST_AND_RETURN_FALSE(cow_writer_ != nullptr);
 
   if (label) {
+    cow_plan_ = nullptr;
     return true;
   }
 
@@ -258,11 +380,12 @@ bool VABCPartitionWriter::Init(const InstallPlan* install_plan,
     // order specified by the merge seuqnece op. Hence we have the freedom of
     // writing COPY operations out of order. Delay processing of copy ops so
     // that update_engine can be more responsive in progress updates.
-    if (DoesDeviceSupportsXor()) {
+    if (cow_plan_->supports_xor) {
       LOG(INFO) << "Snapuserd supports XOR and merge sequence, writing merge "
                    "sequence and delay writing COPY operations";
-      TEST_AND_RETURN_FALSE(WriteMergeSequence(
-          partition_update_.merge_operations(), cow_writer_.get()));
+      TEST_AND_RETURN_FALSE(
+          cow_writer_->AddSequenceData(cow_plan_->merge_sequence.size(),
+                                       cow_plan_->merge_sequence.data()));
     } else {
       LOG(INFO) << "Snapuserd does not support merge sequence, writing all "
                    "COPY operations up front, this may take few "
@@ -271,79 +394,57 @@ bool VABCPartitionWriter::Init(const InstallPlan* install_plan,
     }
     cow_writer_->AddLabel(0);
   }
+  cow_plan_ = nullptr;
   return true;
 }
 
 bool VABCPartitionWriter::WriteMergeSequence(
     const RepeatedPtrField<CowMergeOperation>& merge_sequence,
     ICowWriter* cow_writer) {
-  std::vector<uint32_t> blocks_merge_order;
-  for (const auto& merge_op : merge_sequence) {
-    const auto& dst_extent = merge_op.dst_extent();
-    const auto& src_extent = merge_op.src_extent();
-    // In place copy are basically noops, they do not need to be "merged" at
-    // all, don't include them in merge sequence.
-    if (merge_op.type() == CowMergeOperation::COW_COPY &&
-        merge_op.src_extent() == merge_op.dst_extent()) {
-      continue;
-    }
-
-    const bool extent_overlap =
-        ExtentRanges::ExtentsOverlap(src_extent, dst_extent);
-    // TODO(193863443) Remove this check once this feature
-    // lands on all pixel devices.
-    const bool is_ascending = android::base::GetBoolProperty(
-        "ro.virtual_ab.userspace.snapshots.enabled", false);
-
-    // If this is a self-overlapping op and |dst_extent| comes after
-    // |src_extent|, we must write in reverse order for correctness.
-    //
-    // If this is self-overlapping op and |dst_extent| comes before
-    // |src_extent|, we must write in ascending order for correctness.
-    //
-    // If this isn't a self overlapping op, write block in ascending order
-    // if userspace snapshots are enabled
-    if (extent_overlap) {
-      if (dst_extent.start_block() <= src_extent.start_block()) {
-        for (size_t i = 0; i < dst_extent.num_blocks(); i++) {
-          blocks_merge_order.push_back(dst_extent.start_block() + i);
-        }
-      } else {
-        for (int i = dst_extent.num_blocks() - 1; i >= 0; i--) {
-          blocks_merge_order.push_back(dst_extent.start_block() + i);
-        }
-      }
-    } else {
-      if (is_ascending) {
-        for (size_t i = 0; i < dst_extent.num_blocks(); i++) {
-          blocks_merge_order.push_back(dst_extent.start_block() + i);
-        }
-      } else {
-        for (int i = dst_extent.num_blocks() - 1; i >= 0; i--) {
-          blocks_merge_order.push_back(dst_extent.start_block() + i);
-        }
-      }
-    }
-  }
+  const std::vector<uint32_t> blocks_merge_order =
+      ComputeMergeSequence(merge_sequence);
   return cow_writer->AddSequenceData(blocks_merge_order.size(),
                                      blocks_merge_order.data());
 }
 
 std::unique_ptr<ExtentWriter> VABCPartitionWriter::CreateBaseExtentWriter() {
-  return std::make_unique<SnapshotExtentWriter>(cow_writer_.get());
+  return std::make_unique<SnapshotExtentWriter>(
+      cow_writer_.get(), batch_writes_ ? &pending_raw_blocks_ : nullptr);
 }
 
 [[nodiscard]] bool VABCPartitionWriter::PerformZeroOrDiscardOperation(
     const InstallOperation& operation) {
-  for (const auto& extent : operation.dst_extents()) {
+  // Added with the following ones, see FlushZeroBlocks().
+  pending_zero_blocks_.AddRepeatedExtents(operation.dst_extents());
+  return true;
+}
+
+bool VABCPartitionWriter::FlushZeroBlocks(const InstallOperation* operation) {
+  if (operation &&
+      std::none_of(operation->dst_extents().begin(),
+                   operation->dst_extents().end(),
+                   [this](const Extent& extent) {
+                     return pending_zero_blocks_.OverlapsWithExtent(extent);
+                   })) {
+    return true;
+  }
+  TEST_AND_RETURN_FALSE(cow_writer_ != nullptr);
+  for (const auto& extent : pending_zero_blocks_.extent_set()) {
     TEST_AND_RETURN_FALSE(
         cow_writer_->AddZeroBlocks(extent.start_block(), extent.num_blocks()));
   }
+  pending_zero_blocks_ = ExtentRanges();
   return true;
 }
 
+bool VABCPartitionWriter::FlushPendingBlocks() {
+  TEST_AND_RETURN_FALSE(FlushZeroBlocks());
+  return pending_raw_blocks_.Flush(cow_writer_.get());
+}
+
 [[nodiscard]] bool VABCPartitionWriter::PerformSourceCopyOperation(
     const InstallOperation& operation, ErrorCode* error) {
+  TEST_AND_RETURN_FALSE(FlushZeroBlocks(&operation));
   auto source_fd = verified_source_fd_.ChooseSourceFD(operation, error);
 
   return ProcessSourceCopyOperation(operation,
@@ -357,6 +458,7 @@ std::unique_ptr<ExtentWriter> VABCPartitionWriter::CreateBaseExtentWriter() {
 bool VABCPartitionWriter::PerformReplaceOperation(const InstallOperation& op,
                                                   const void* data,
                                                   size_t count) {
+  TEST_AND_RETURN_FALSE(FlushZeroBlocks(&op));
   // Setup the ExtentWriter stack based on the operation type.
   std::unique_ptr<ExtentWriter> writer = CreateBaseExtentWriter();
 
@@ -372,6 +474,7 @@ bool VABCPartitionWriter::PerformDiffOperation(
       verified_source_fd_.ChooseSourceFD(operation, error);
   TEST_AND_RETURN_FALSE(source_fd != nullptr);
   TEST_AND_RETURN_FALSE(source_fd->IsOpen());
+  TEST_AND_RETURN_FALSE(FlushZeroBlocks(&operation));
 
   std::unique_ptr<ExtentWriter> writer =
       IsXorEnabled() ? std::make_unique<XORExtentWriter>(
@@ -385,19 +488,22 @@ bool VABCPartitionWriter::PerformDiffOperation(
       operation, std::move(writer), source_fd, data, count);
 }
 
-void VABCPartitionWriter::CheckpointUpdateProgress(size_t next_op_index) {
+bool VABCPartitionWriter::CheckpointUpdateProgress(size_t next_op_index) {
   // No need to call fsync/sync, as CowWriter flushes after a label is added
   // added.
   // if cow_writer_ failed, that means Init() failed. This function shouldn't be
   // called if Init() fails.
-  TEST_AND_RETURN(cow_writer_ != nullptr);
-  cow_writer_->AddLabel(next_op_index);
+  TEST_AND_RETURN_FALSE(cow_writer_ != nullptr);
+  // Without the label, a resumed update restarts from the previous one.
+  TEST_AND_RETURN_FALSE(FlushPendingBlocks());
+  return cow_writer_->AddLabel(next_op_index);
 }
 
 [[nodiscard]] bool VABCPartitionWriter::FinishedInstallOps() {
   // Add a hardcoded magic label to indicate end of all install ops. This label
   // is needed by filesystem verification, don't remove.
   TEST_AND_RETURN_FALSE(cow_writer_ != nullptr);
+  TEST_AND_RETURN_FALSE(FlushPendingBlocks());
   TEST_AND_RETURN_FALSE(cow_writer_->AddLabel(kEndOfInstallLabel));
   TEST_AND_RETURN_FALSE(cow_writer_->Finalize());
 
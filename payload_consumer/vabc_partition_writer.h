@@ -20,18 +20,39 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <libsnapshot/cow_writer.h>
 
-#include "update_engine/payload_consumer/extent_map.h"
+#include "update_engine/common/cow_operation_convert.h"
+#include "update_engine/payload_consumer/flat_extent_map.h"
 #include "update_engine/payload_consumer/install_operation_executor.h"
 #include "update_engine/payload_consumer/install_plan.h"
 #include "update_engine/payload_consumer/partition_writer_interface.h"
+#include "update_engine/payload_consumer/snapshot_extent_writer.h"
 #include "update_engine/payload_consumer/verified_source_fd.h"
+#include "update_engine/payload_consumer/worker_pool.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 
 namespace chromeos_update_engine {
+
+// What VABCPartitionWriter::Init() derives from the merge operations of a
+// partition before writing its COW. It doesn't depend on the COW writer, so
+// it can be computed ahead of time, while the previous partition is applied.
+struct VABCCowPlan {
+  // Whether the device supports XOR and the merge sequence op.
+  bool supports_xor{false};
+  FlatExtentMap<const CowMergeOperation*> xor_map;
+  ExtentRanges copy_blocks;
+  // With |supports_xor|, the blocks in the order snapuserd merges them.
+  std::vector<uint32_t> merge_sequence;
+  // Otherwise, the COW_COPY ops written before the first operation, merged
+  // into multi-block copies with |user_snapshots|.
+  bool user_snapshots{false};
+  std::vector<CowOperation> copy_ops;
+};
+
 class VABCPartitionWriter final : public PartitionWriterInterface {
  public:
   static bool ProcessSourceCopyOperation(
@@ -42,10 +63,18 @@ class VABCPartitionWriter final : public PartitionWriterInterface {
       android::snapshot::ICowWriter* cow_writer,
       bool sequence_op_supported);
 
+  // Computes the VABCCowPlan of |partition_update|. Only reads it, so it can
+  // run on any thread.
+  static std::unique_ptr<VABCCowPlan> ComputeCowPlan(
+      const PartitionUpdate& partition_update, bool supports_xor);
+
   VABCPartitionWriter(const PartitionUpdate& partition_update,
                       const InstallPlan::Partition& install_part,
                       DynamicPartitionControlInterface* dynamic_control,
                       size_t block_size);
+  void SetCowPlan(std::shared_ptr<VABCCowPlan> cow_plan) override {
+    cow_plan_ = std::move(cow_plan);
+  }
   [[nodiscard]] bool Init(const InstallPlan* install_plan,
                           bool source_may_exist,
                           size_t next_op_index) override;
@@ -68,10 +97,25 @@ class VABCPartitionWriter final : public PartitionWriterInterface {
                                           const void* data,
                                           size_t count) override;
 
-  void CheckpointUpdateProgress(size_t next_op_index) override;
+  [[nodiscard]] bool CheckpointUpdateProgress(size_t next_op_index) override;
+  [[nodiscard]] bool FlushQueuedOperations() override {
+    return FlushPendingBlocks();
+  }
 
   [[nodiscard]] bool FinishedInstallOps() override;
   int Close() override;
+  uint64_t SourceCacheSavedBytes() const override {
+    return verified_source_fd_.source_cache_saved_bytes();
+  }
+
+  void SetSourceVerifier(SourceVerifier* verifier) override {
+    verified_source_fd_.set_source_verifier(verifier);
+  }
+
+  bool ParallelFor(size_t count,
+                   const std::function<bool(size_t)>& task) override {
+    return executor_.ParallelFor(count, task);
+  }
   // Send merge sequence data to cow writer
   static bool WriteMergeSequence(
       const ::google::protobuf::RepeatedPtrField<CowMergeOperation>& merge_ops,
@@ -85,6 +129,14 @@ class VABCPartitionWriter final : public PartitionWriterInterface {
 
   [[nodiscard]] std::unique_ptr<ExtentWriter> CreateBaseExtentWriter();
 
+  // Adds the COW zero ops of the pending ZERO and DISCARD blocks. If
+  // |operation| is given, only does so if it writes some of them.
+  [[nodiscard]] bool FlushZeroBlocks(
+      const InstallOperation* operation = nullptr);
+  // Adds the pending ZERO and DISCARD blocks and the pending raw blocks, as
+  // needed before labeling the COW.
+  [[nodiscard]] bool FlushPendingBlocks();
+
   const PartitionUpdate& partition_update_;
   const InstallPlan::Partition& install_part_;
   DynamicPartitionControlInterface* const dynamic_control_;
@@ -92,10 +144,21 @@ class VABCPartitionWriter final : public PartitionWriterInterface {
   const std::string source_path_;
 
   const size_t block_size_;
+  // Shared by the steps of the operations applied, created by Init().
+  std::unique_ptr<WorkerPool> worker_pool_;
   InstallOperationExecutor executor_;
   VerifiedSourceFd verified_source_fd_;
-  ExtentMap<const CowMergeOperation*, ExtentLess> xor_map_;
+  // Computed by Init() unless set before, released once used.
+  std::shared_ptr<VABCCowPlan> cow_plan_;
+  FlatExtentMap<const CowMergeOperation*> xor_map_;
   ExtentRanges copy_blocks_;
+  // The blocks of the ZERO and DISCARD operations not written to the COW yet,
+  // merged into maximal ranges so that they take few COW zero ops.
+  ExtentRanges pending_zero_blocks_;
+  // With batched writes, the raw blocks of consecutive operations are added
+  // to the COW together as long as they are contiguous.
+  bool batch_writes_{false};
+  PendingRawBlocks pending_raw_blocks_;
 };
 
 }  // namespace chromeos_update_engine
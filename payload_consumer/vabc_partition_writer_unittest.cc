@@ -136,6 +136,32 @@ TEST_F(VABCPartitionWriterTest, MergeSequenceXorSameBlock) {
   ASSERT_TRUE(writer_.Init(&install_plan_, true, 0));
 }
 
+TEST_F(VABCPartitionWriterTest, CowPlanComputedAheadTest) {
+  AddMergeOp(&partition_update_, {5, 1}, {10, 1}, CowMergeOperation::COW_COPY);
+  AddMergeOp(&partition_update_, {12, 2}, {13, 2}, CowMergeOperation::COW_XOR);
+  AddMergeOp(&partition_update_, {20, 1}, {25, 1}, CowMergeOperation::COW_COPY);
+  VABCPartitionWriter writer_{
+      partition_update_, install_part_, &dynamic_control_, kBlockSize};
+  writer_.SetCowPlan(
+      VABCPartitionWriter::ComputeCowPlan(partition_update_, true));
+  EXPECT_CALL(dynamic_control_, OpenCowWriter(fake_part_name, _, _))
+      .WillOnce(Invoke([](const std::string&,
+                          const std::optional<std::string>&,
+                          std::optional<uint64_t>) {
+        auto cow_writer = std::make_unique<android::snapshot::MockCowWriter>();
+        auto expected_merge_sequence = {10, 14, 13, 25};
+        EXPECT_CALL(*cow_writer, AddSequenceData(_, _))
+            .With(Args<1, 0>(ElementsAreArray(expected_merge_sequence)))
+            .WillOnce(Return(true));
+        ON_CALL(*cow_writer, AddLabel(_)).WillByDefault(Return(true));
+        return cow_writer;
+      }));
+  // The plan computed ahead of time is used as is.
+  EXPECT_CALL(dynamic_control_, GetVirtualAbCompressionXorFeatureFlag())
+      .Times(0);
+  ASSERT_TRUE(writer_.Init(&install_plan_, true, 0));
+}
+
 TEST_F(VABCPartitionWriterTest, AddBlockTestXor) {
   return AddBlockTest(true);
 }
@@ -16,23 +16,33 @@
 #include "update_engine/payload_consumer/verified_source_fd.h"
 
 #include <fcntl.h>
+#include <inttypes.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 
+#include <algorithm>
 #include <memory>
 #include <utility>
 #include <vector>
 
+#include <base/files/file_util.h>
 #include <base/strings/string_number_conversions.h>
+#include <base/strings/string_split.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
 
 #include "update_engine/common/error_code.h"
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/extent_buffer_file_descriptor.h"
 #include "update_engine/payload_consumer/extent_writer.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_consumer/parallel_operation_applier.h"
 #include "update_engine/payload_consumer/file_descriptor_utils.h"
+#include "update_engine/payload_consumer/io_uring_file_descriptor.h"
+#include "update_engine/payload_consumer/page_cache_dropping_file_descriptor.h"
 #include "update_engine/payload_consumer/partition_writer.h"
+#include "update_engine/payload_consumer/source_verifier.h"
 #include "update_engine/update_metadata.pb.h"
 #if USE_FEC
 #include "update_engine/payload_consumer/fec_file_descriptor.h"
@@ -41,6 +51,56 @@
 namespace chromeos_update_engine {
 using std::string;
 
+namespace {
+// Sources of at least this size are read by several threads.
+constexpr uint64_t kMinParallelReadBytes = 4 * 1024 * 1024;
+
+// A byte range of the source partition, and where it goes in the buffer.
+struct SourceReadRange {
+  uint64_t file_offset;
+  uint64_t length;
+  size_t data_offset;
+};
+}  // namespace
+
+string GetPartitionState(const string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return "";
+  }
+  if (S_ISREG(st.st_mode)) {
+    return base::StringPrintf("%" PRId64 "@%" PRId64 ".%09ld",
+                              static_cast<int64_t>(st.st_size),
+                              static_cast<int64_t>(st.st_mtim.tv_sec),
+                              st.st_mtim.tv_nsec);
+  }
+  if (!S_ISBLK(st.st_mode)) {
+    return "";
+  }
+  // The 7th field of the statistics of the device is the sectors written.
+  string stats;
+  if (!base::ReadFileToString(
+          base::FilePath(base::StringPrintf("/sys/dev/block/%u:%u/stat",
+                                            major(st.st_rdev),
+                                            minor(st.st_rdev))),
+          &stats)) {
+    return "";
+  }
+  const std::vector<string> fields = base::SplitString(
+      stats, " \t\n", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+  return fields.size() > 6 ? fields[6] : "";
+}
+
+string VerifiedSourceKey(const InstallOperation& operation) {
+  string key = operation.src_sha256_hash();
+  for (const Extent& extent : operation.src_extents()) {
+    key += base::StringPrintf(":%" PRIu64 "+%" PRIu64,
+                              static_cast<uint64_t>(extent.start_block()),
+                              static_cast<uint64_t>(extent.num_blocks()));
+  }
+  return key;
+}
+
 bool VerifiedSourceFd::OpenCurrentECCPartition() {
   // No support for ECC for full payloads.
   // Full payload should not have any opeartion that requires ECC partitions.
@@ -78,9 +138,32 @@ bool VerifiedSourceFd::WriteBackCorrectedSourceBlocks(
   DirectExtentWriter writer(fd);
   TEST_AND_RETURN_FALSE(writer.Init(extents, block_size_));
   TEST_AND_RETURN_FALSE(writer.Write(source_data.data(), source_data.size()));
+  if (source_cache_fd_) {
+    source_cache_fd_->Invalidate(extents);
+  }
+  verified_sources_.clear();
   return true;
 }
 
+bool VerifiedSourceFd::CheckVerifiedSources() {
+  string state = GetPartitionState(source_path_);
+  if (state != source_state_) {
+    verified_sources_.clear();
+    source_state_ = std::move(state);
+  }
+  return !source_state_.empty();
+}
+
+void VerifiedSourceFd::EnableSourceCache(const PartitionUpdate& partition,
+                                         uint64_t cache_size) {
+  cached_partition_ = &partition;
+  source_cache_size_ = cache_size;
+  op_indexes_.clear();
+  for (int i = 0; i < partition.operations_size(); i++) {
+    op_indexes_[&partition.operations(i)] = i;
+  }
+}
+
 FileDescriptorPtr VerifiedSourceFd::ChooseSourceFD(
     const InstallOperation& operation, ErrorCode* error) {
   if (source_fd_ == nullptr) {
@@ -90,6 +173,12 @@ FileDescriptorPtr VerifiedSourceFd::ChooseSourceFD(
   if (error) {
     *error = ErrorCode::kSuccess;
   }
+  if (source_cache_fd_) {
+    auto it = op_indexes_.find(&operation);
+    if (it != op_indexes_.end()) {
+      source_cache_fd_->SetCurrentOperation(it->second);
+    }
+  }
   if (!operation.has_src_sha256_hash()) {
     // When the operation doesn't include a source hash, we attempt the error
     // corrected device first since we can't verify the block in the raw device
@@ -106,12 +195,51 @@ FileDescriptorPtr VerifiedSourceFd::ChooseSourceFD(
     return source_fd_;
   }
 
+  // Operations reading a source already verified, like the chunks of a large
+  // file, use it as is while the partition is unchanged.
+  const string source_key =
+      CheckVerifiedSources() ? VerifiedSourceKey(operation) : "";
+  if (!source_key.empty() && verified_sources_.count(source_key) > 0) {
+    verified_source_hits_++;
+    return source_fd_;
+  }
+  if (!source_key.empty() && source_verifier_ &&
+      source_verifier_->IsSourceVerified(
+          source_path_, source_state_, source_key)) {
+    verified_sources_.insert(source_key);
+    verified_source_hits_++;
+    return source_fd_;
+  }
+
   brillo::Blob source_hash;
   brillo::Blob expected_source_hash(operation.src_sha256_hash().begin(),
                                     operation.src_sha256_hash().end());
-  if (fd_utils::ReadAndHashExtents(
-          source_fd_, operation.src_extents(), block_size_, &source_hash) &&
-      source_hash == expected_source_hash) {
+  if (source_read_threads_ > 0 &&
+      utils::BlocksInExtents(operation.src_extents()) * block_size_ <=
+          kMaxInMemorySourceBytes) {
+    // Hash the source from memory, and let the operation consume the same
+    // buffer instead of reading the source partition a second time.
+    brillo::Blob source_data;
+    if (ReadSourceExtents(operation.src_extents(), &source_data) &&
+        HashCalculator::RawHashOfData(source_data, &source_hash) &&
+        source_hash == expected_source_hash) {
+      if (!source_key.empty()) {
+        verified_sources_.insert(source_key);
+      }
+      return std::make_shared<ExtentBufferFileDescriptor>(
+          source_fd_,
+          operation.src_extents(),
+          block_size_,
+          std::move(source_data));
+    }
+  } else if (fd_utils::ReadAndHashExtents(source_fd_,
+                                          operation.src_extents(),
+                                          block_size_,
+                                          &source_hash) &&
+             source_hash == expected_source_hash) {
+    if (!source_key.empty()) {
+      verified_sources_.insert(source_key);
+    }
     return source_fd_;
   }
   if (error) {
@@ -155,14 +283,104 @@ FileDescriptorPtr VerifiedSourceFd::ChooseSourceFD(
   return nullptr;
 }
 
-bool VerifiedSourceFd::Open() {
-  source_fd_ = std::make_shared<EintrSafeFileDescriptor>();
+FileDescriptorPtr VerifiedSourceFd::CreateSourceFd(bool use_io_uring) const {
+  FileDescriptorPtr fd = CreateFileDescriptor(use_io_uring);
+  if (drop_page_cache_) {
+    fd = std::make_shared<PageCacheDroppingFileDescriptor>(std::move(fd));
+  }
+  return fd;
+}
+
+bool VerifiedSourceFd::Open(bool use_io_uring) {
+  source_fd_ = CreateSourceFd(use_io_uring);
   if (source_fd_ == nullptr)
     return false;
   if (!source_fd_->Open(source_path_.c_str(), O_RDONLY)) {
     PLOG(ERROR) << "Failed to open " << source_path_;
+  } else if (cached_partition_ && source_cache_size_ > 0) {
+    source_cache_fd_ = std::make_shared<SourceCacheFileDescriptor>(
+        source_fd_, *cached_partition_, block_size_, source_cache_size_);
+    source_fd_ = source_cache_fd_;
+  }
+  reader_fds_ = {source_fd_};
+  // Every extra reader thread gets its own descriptor, so that they don't
+  // share a file position. Failing to open one only costs parallelism.
+  for (size_t i = 1; i < source_read_threads_; i++) {
+    FileDescriptorPtr fd = CreateSourceFd(use_io_uring);
+    if (!fd->Open(source_path_.c_str(), O_RDONLY)) {
+      PLOG(WARNING) << "Failed to open " << source_path_ << " for reader "
+                    << i;
+      break;
+    }
+    reader_fds_.push_back(std::move(fd));
   }
   return true;
 }
 
+bool VerifiedSourceFd::ReadSourceExtents(
+    const google::protobuf::RepeatedPtrField<Extent>& extents,
+    brillo::Blob* data) {
+  const uint64_t total_blocks = utils::BlocksInExtents(extents);
+  data->resize(total_blocks * block_size_);
+  if (total_blocks == 0) {
+    return true;
+  }
+  size_t num_threads = 1;
+  if (worker_pool_ && data->size() >= kMinParallelReadBytes) {
+    num_threads = std::min({reader_fds_.size(),
+                            worker_pool_->num_threads(),
+                            ParallelOperationApplier::GetThreadLimit()});
+  }
+
+  // Split the extents into one contiguous share of the buffer per thread.
+  const uint64_t share_blocks = (total_blocks + num_threads - 1) / num_threads;
+  std::vector<std::vector<SourceReadRange>> shares(num_threads);
+  size_t share = 0;
+  uint64_t share_filled = 0;
+  size_t data_offset = 0;
+  for (const Extent& extent : extents) {
+    uint64_t start_block = extent.start_block();
+    uint64_t num_blocks = extent.num_blocks();
+    while (num_blocks > 0) {
+      if (share_filled == share_blocks) {
+        share++;
+        share_filled = 0;
+      }
+      const uint64_t blocks = std::min(num_blocks, share_blocks - share_filled);
+      shares[share].push_back({start_block * block_size_,
+                               blocks * block_size_,
+                               data_offset});
+      data_offset += blocks * block_size_;
+      start_block += blocks;
+      num_blocks -= blocks;
+      share_filled += blocks;
+    }
+  }
+
+  auto read_share = [data](const FileDescriptorPtr& fd,
+                           const std::vector<SourceReadRange>& ranges) {
+    for (const auto& range : ranges) {
+      ssize_t bytes_read = 0;
+      if (!utils::PReadAll(fd,
+                           data->data() + range.data_offset,
+                           range.length,
+                           range.file_offset,
+                           &bytes_read) ||
+          bytes_read != static_cast<ssize_t>(range.length)) {
+        LOG(ERROR) << "Failed to read " << range.length
+                   << " bytes of source at offset " << range.file_offset;
+        return false;
+      }
+    }
+    return true;
+  };
+
+  if (num_threads == 1) {
+    return read_share(reader_fds_[0], shares[0]);
+  }
+  return worker_pool_->ParallelFor(num_threads, [&](size_t i) {
+    return read_share(reader_fds_[i], shares[i]);
+  });
+}
+
 }  // namespace chromeos_update_engine
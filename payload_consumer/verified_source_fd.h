@@ -18,17 +18,34 @@
 
 #include <cstddef>
 
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
+#include <brillo/secure_blob.h>
 #include <gtest/gtest_prod.h>
 #include <update_engine/update_metadata.pb.h>
 
 #include "update_engine/common/error_code.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_consumer/source_cache_file_descriptor.h"
+#include "update_engine/payload_consumer/worker_pool.h"
 
 namespace chromeos_update_engine {
 
+class SourceVerifier;
+
+// Returns a description of the partition at |path| which changes whenever its
+// content may have: the sectors written to a block device since boot, or the
+// size and modification time of a file. Empty if there is none.
+std::string GetPartitionState(const std::string& path);
+
+// Returns the key of the source of |operation| in the verified sources.
+std::string VerifiedSourceKey(const InstallOperation& operation);
+
 class VerifiedSourceFd {
  public:
   explicit VerifiedSourceFd(size_t block_size, std::string source_path)
@@ -36,20 +53,97 @@ class VerifiedSourceFd {
   FileDescriptorPtr ChooseSourceFD(const InstallOperation& operation,
                                    ErrorCode* error);
 
-  [[nodiscard]] bool Open();
+  // Opens the source partition. If |use_io_uring|, reads of the source
+  // partition are submitted through io_uring.
+  [[nodiscard]] bool Open(bool use_io_uring = false);
+
+  // When |num_threads| is not 0, the source of operations whose source hash is
+  // verified is read into memory once, using up to |num_threads| threads of
+  // the pool set by set_worker_pool() for large ranges, and ChooseSourceFD()
+  // returns a descriptor serving the operation from that buffer instead of
+  // reading the partition again. Must be called before Open().
+  void set_source_read_threads(size_t num_threads) {
+    source_read_threads_ = num_threads;
+  }
+
+  // Reads the large sources on the threads of |pool|, which must outlive this
+  // object and not be used by others while ChooseSourceFD() runs.
+  void set_worker_pool(WorkerPool* pool) { worker_pool_ = pool; }
+
+  // When |cache_size| is not 0, the source blocks read by several operations
+  // of |partition| are kept in a cache of up to |cache_size| bytes, see
+  // source_cache_file_descriptor.h. |partition| must outlive this object, and
+  // must hold the operations passed to ChooseSourceFD(). Must be called before
+  // Open().
+  void EnableSourceCache(const PartitionUpdate& partition,
+                         uint64_t cache_size);
+
+  // When set, the pages of the source partition read are dropped from the
+  // page cache. Must be called before Open().
+  void set_drop_page_cache(bool drop_page_cache) {
+    drop_page_cache_ = drop_page_cache;
+  }
+
+  // Looks the sources up in the ones |verifier| verified ahead before hashing
+  // them. |verifier| must outlive this object.
+  void set_source_verifier(SourceVerifier* verifier) {
+    source_verifier_ = verifier;
+  }
+
+  // Number of bytes of the source partition served by the cache.
+  uint64_t source_cache_saved_bytes() const {
+    return source_cache_fd_ ? source_cache_fd_->bytes_saved() : 0;
+  }
+
+  // Maximum size of the source of an operation read into memory.
+  static constexpr uint64_t kMaxInMemorySourceBytes = 64 * 1024 * 1024;
 
  private:
+  // Reads the content of |extents| of the source partition into |data|.
+  bool ReadSourceExtents(
+      const google::protobuf::RepeatedPtrField<Extent>& extents,
+      brillo::Blob* data);
+
   bool WriteBackCorrectedSourceBlocks(
       const std::vector<unsigned char>& source_data,
       const google::protobuf::RepeatedPtrField<Extent>& extents);
   bool OpenCurrentECCPartition();
+  // Returns a new, closed, descriptor of the source partition.
+  FileDescriptorPtr CreateSourceFd(bool use_io_uring) const;
+  // Returns whether the sources verified so far can be looked up, forgetting
+  // them if the source partition could have changed since they were.
+  bool CheckVerifiedSources();
   const size_t block_size_;
   const std::string source_path_;
   FileDescriptorPtr source_ecc_fd_;
   FileDescriptorPtr source_fd_;
+  // Descriptors used by the threads of ReadSourceExtents(), the first one is
+  // |source_fd_|.
+  std::vector<FileDescriptorPtr> reader_fds_;
+  size_t source_read_threads_{0};
+  WorkerPool* worker_pool_{nullptr};
+  bool drop_page_cache_{false};
+
+  const PartitionUpdate* cached_partition_{nullptr};
+  uint64_t source_cache_size_{0};
+  // Wraps the partition opened by Open() when the cache is enabled, it is then
+  // also |source_fd_|.
+  std::shared_ptr<SourceCacheFileDescriptor> source_cache_fd_;
+  // Index of the operations of |cached_partition_|.
+  std::unordered_map<const InstallOperation*, size_t> op_indexes_;
+
+  // The source extents and hashes of the operations verified on |source_fd_|,
+  // so that operations reading the same source don't hash it again, and the
+  // state of the source partition they were verified in.
+  std::unordered_set<std::string> verified_sources_;
+  std::string source_state_;
+  uint64_t verified_source_hits_{0};
+  SourceVerifier* source_verifier_{nullptr};
 
   friend class PartitionWriterTest;
   FRIEND_TEST(PartitionWriterTest, ChooseSourceFDTest);
+  FRIEND_TEST(PartitionWriterTest, ChooseSourceFDFromMemoryTest);
+  FRIEND_TEST(PartitionWriterTest, ChooseSourceFDVerifiesSourceOnceTest);
   // The total number of operations that failed source hash verification but
   // passed after falling back to the error-corrected |source_ecc_fd_| device.
   uint64_t source_ecc_recovered_failures_{0};
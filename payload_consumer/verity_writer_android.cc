@@ -29,6 +29,7 @@ extern "C" {
 #include <fec.h>
 }
 
+#include "update_engine/common/tracing.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/cached_file_descriptor.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
@@ -41,7 +42,8 @@ bool IncrementalEncodeFEC::Init(const uint64_t _data_offset,
                                 const uint64_t _fec_size,
                                 const uint64_t _fec_roots,
                                 const uint64_t _block_size,
-                                const bool _verify_mode) {
+                                const bool _verify_mode,
+                                const size_t _threads) {
   current_step_ = EncodeFECStep::kInitFDStep;
   data_offset_ = _data_offset;
   data_size_ = _data_size;
@@ -51,83 +53,96 @@ bool IncrementalEncodeFEC::Init(const uint64_t _data_offset,
   block_size_ = _block_size;
   verify_mode_ = _verify_mode;
   current_round_ = 0;
-  // This is the N in RS(M, N), which is the number of bytes for each rs block.
-  rs_n_ = FEC_RSM - fec_roots_;
-  rs_char_.reset(init_rs_char(FEC_PARAMS(fec_roots_)));
-  rs_blocks_.resize(block_size_ * rs_n_);
-  buffer_.resize(block_size_, 0);
-  fec_.resize(block_size_ * fec_roots_);
-  fec_read_.resize(fec_.size());
   TEST_AND_RETURN_FALSE(data_size_ % block_size_ == 0);
   TEST_AND_RETURN_FALSE(fec_roots_ >= 0 && fec_roots_ < FEC_RSM);
+  // This is the N in RS(M, N), which is the number of bytes for each rs block.
+  rs_n_ = FEC_RSM - fec_roots_;
 
   num_rounds_ = utils::DivRoundUp(data_size_ / block_size_, rs_n_);
   TEST_AND_RETURN_FALSE(num_rounds_ * fec_roots_ * block_size_ == fec_size_);
-  TEST_AND_RETURN_FALSE(rs_char_ != nullptr);
+  encoder_ = CreateFecEncoder(
+      _threads == 0 ? FecEncoderType::kLibFec : FecEncoderType::kVectorized,
+      fec_roots_,
+      block_size_);
+  TEST_AND_RETURN_FALSE(encoder_ != nullptr);
+  // Rounds are independent, each step encodes one per thread. This uses about
+  // 1 MiB memory per round for 4K block size.
+  rounds_per_step_ = std::max<size_t>(_threads, 1);
+  if (!worker_pool_ || worker_pool_->num_threads() != rounds_per_step_) {
+    worker_pool_ = std::make_unique<WorkerPool>(rounds_per_step_);
+  }
+  rounds_data_.resize(rounds_per_step_ * rs_n_ * block_size_);
+  fec_.resize(rounds_per_step_ * fec_roots_ * block_size_);
+  fec_read_.resize(fec_.size());
+  return true;
+}
+
+bool IncrementalEncodeFEC::ReadRound(size_t round, uint8_t* data) {
+  // Encodes |block_size| number of rs blocks each round so that we can read
+  // one block each time instead of 1 byte to increase random read
+  // performance.
+  for (size_t j = 0; j < rs_n_; j++) {
+    uint8_t* block = data + j * block_size_;
+    uint64_t offset = fec_ecc_interleave(
+        round * rs_n_ * block_size_ + j, rs_n_, num_rounds_);
+    // Don't read past |data_size|, treat them as 0.
+    if (offset >= data_size_) {
+      std::fill(block, block + block_size_, 0);
+      continue;
+    }
+    ssize_t bytes_read = 0;
+    TEST_AND_RETURN_FALSE(utils::PReadAll(
+        read_fd_, block, block_size_, data_offset_ + offset, &bytes_read));
+    TEST_AND_RETURN_FALSE(bytes_read >= 0);
+    TEST_AND_RETURN_FALSE(static_cast<size_t>(bytes_read) == block_size_);
+  }
   return true;
 }
 
 bool IncrementalEncodeFEC::Compute(FileDescriptor* _read_fd,
                                    FileDescriptor* _write_fd) {
+  UE_TRACE_SCOPE("IncrementalEncodeFEC::Compute");
   if (current_step_ == EncodeFECStep::kInitFDStep) {
     read_fd_ = _read_fd;
     write_fd_ = _write_fd;
     cache_fd_.SetFD(write_fd_);
     write_fd_ = &cache_fd_;
   } else if (current_step_ == EncodeFECStep::kEncodeRoundStep) {
-    // Encodes |block_size| number of rs blocks each round so that we can read
-    // one block each time instead of 1 byte to increase random read
-    // performance. This uses about 1 MiB memory for 4K block size.
-    for (size_t j = 0; j < rs_n_; j++) {
-      uint64_t offset = fec_ecc_interleave(
-          current_round_ * rs_n_ * block_size_ + j, rs_n_, num_rounds_);
-      // Don't read past |data_size|, treat them as 0.
-      if (offset >= data_size_) {
-        std::fill(buffer_.begin(), buffer_.end(), 0);
-      } else {
-        ssize_t bytes_read = 0;
-        TEST_AND_RETURN_FALSE(utils::PReadAll(read_fd_,
-                                              buffer_.data(),
-                                              buffer_.size(),
-                                              data_offset_ + offset,
-                                              &bytes_read));
-        TEST_AND_RETURN_FALSE(bytes_read >= 0);
-        TEST_AND_RETURN_FALSE(static_cast<size_t>(bytes_read) ==
-                              buffer_.size());
-      }
-      for (size_t k = 0; k < buffer_.size(); k++) {
-        rs_blocks_[k * rs_n_ + j] = buffer_[k];
-      }
-    }
-    for (size_t j = 0; j < block_size_; j++) {
-      // Encode [j * rs_n_ : (j + 1) * rs_n_) in |rs_blocks| and write
-      // |fec_roots| number of parity bytes to |j * fec_roots| in |fec|.
-      encode_rs_char(rs_char_.get(),
-                     rs_blocks_.data() + j * rs_n_,
-                     fec_.data() + j * fec_roots_);
+    const size_t rounds =
+        std::min(rounds_per_step_, num_rounds_ - current_round_);
+    const size_t round_data_size = rs_n_ * block_size_;
+    const size_t round_fec_size = fec_roots_ * block_size_;
+    // The reads stay on this thread, |read_fd_| may not be shared.
+    for (size_t i = 0; i < rounds; i++) {
+      TEST_AND_RETURN_FALSE(ReadRound(
+          current_round_ + i, rounds_data_.data() + i * round_data_size));
     }
+    worker_pool_->ParallelFor(
+        rounds, [this, round_data_size, round_fec_size](size_t i) {
+          encoder_->EncodeRound(rounds_data_.data() + i * round_data_size,
+                                fec_.data() + i * round_fec_size);
+          return true;
+        });
+    const size_t fec_size = rounds * round_fec_size;
 
     if (verify_mode_) {
       ssize_t bytes_read = 0;
-      TEST_AND_RETURN_FALSE(utils::PReadAll(read_fd_,
-                                            fec_read_.data(),
-                                            fec_read_.size(),
-                                            fec_offset_,
-                                            &bytes_read));
+      TEST_AND_RETURN_FALSE(utils::PReadAll(
+          read_fd_, fec_read_.data(), fec_size, fec_offset_, &bytes_read));
       TEST_AND_RETURN_FALSE(bytes_read >= 0);
-      TEST_AND_RETURN_FALSE(static_cast<size_t>(bytes_read) ==
-                            fec_read_.size());
-      TEST_AND_RETURN_FALSE(fec_ == fec_read_);
+      TEST_AND_RETURN_FALSE(static_cast<size_t>(bytes_read) == fec_size);
+      TEST_AND_RETURN_FALSE(
+          std::equal(fec_.begin(), fec_.begin() + fec_size, fec_read_.begin()));
     } else {
       CHECK(write_fd_);
       write_fd_->Seek(fec_offset_, SEEK_SET);
-      if (!utils::WriteAll(write_fd_, fec_.data(), fec_.size())) {
+      if (!utils::WriteAll(write_fd_, fec_.data(), fec_size)) {
         PLOG(ERROR) << "EncodeFEC write() failed";
         return false;
       }
     }
-    fec_offset_ += fec_.size();
-    current_round_++;
+    fec_offset_ += fec_size;
+    current_round_ += rounds;
   } else if (current_step_ == EncodeFECStep::kWriteStep) {
     write_fd_->Flush();
   }
@@ -172,7 +187,8 @@ bool VerityWriterAndroid::Init(const InstallPlan::Partition& partition) {
                                         partition_->fec_size,
                                         partition_->fec_roots,
                                         partition_->block_size,
-                                        false /* verify_mode */));
+                                        false /* verify_mode */,
+                                        fec_threads_));
   hash_tree_written_ = false;
   if (partition_->hash_tree_size != 0) {
     auto hash_function =
@@ -182,16 +198,30 @@ bool VerityWriterAndroid::Init(const InstallPlan::Partition& partition) {
                  << partition_->hash_tree_algorithm;
       return false;
     }
-    hash_tree_builder_ = std::make_unique<HashTreeBuilder>(
-        partition_->block_size, hash_function);
-    TEST_AND_RETURN_FALSE(hash_tree_builder_->Initialize(
-        partition_->hash_tree_data_size, partition_->hash_tree_salt));
-    if (hash_tree_builder_->CalculateSize(partition_->hash_tree_data_size) !=
-        partition_->hash_tree_size) {
+    uint64_t hash_tree_size = 0;
+    hash_tree_builder_.reset();
+    parallel_hash_tree_builder_.reset();
+    if (hash_tree_threads_ > 1) {
+      LOG(INFO) << "Building the verity hash tree on " << hash_tree_threads_
+                << " threads";
+      parallel_hash_tree_builder_ = std::make_unique<ParallelHashTreeBuilder>(
+          partition_->block_size, hash_function, hash_tree_threads_);
+      TEST_AND_RETURN_FALSE(parallel_hash_tree_builder_->Initialize(
+          partition_->hash_tree_data_size, partition_->hash_tree_salt));
+      hash_tree_size = parallel_hash_tree_builder_->CalculateSize(
+          partition_->hash_tree_data_size);
+    } else {
+      hash_tree_builder_ = std::make_unique<HashTreeBuilder>(
+          partition_->block_size, hash_function);
+      TEST_AND_RETURN_FALSE(hash_tree_builder_->Initialize(
+          partition_->hash_tree_data_size, partition_->hash_tree_salt));
+      hash_tree_size =
+          hash_tree_builder_->CalculateSize(partition_->hash_tree_data_size);
+    }
+    if (hash_tree_size != partition_->hash_tree_size) {
       LOG(ERROR) << "Verity hash tree size does not match, stored: "
-                 << partition_->hash_tree_size << ", calculated: "
-                 << hash_tree_builder_->CalculateSize(
-                        partition_->hash_tree_data_size);
+                 << partition_->hash_tree_size
+                 << ", calculated: " << hash_tree_size;
       return false;
     }
   }
@@ -221,8 +251,8 @@ bool VerityWriterAndroid::Update(const uint64_t offset,
     }
     const uint64_t end_offset = std::min(offset + size, hash_tree_data_end);
     if (start_offset < end_offset) {
-      TEST_AND_RETURN_FALSE(hash_tree_builder_->Update(
-          buffer + start_offset - offset, end_offset - start_offset));
+      TEST_AND_RETURN_FALSE(UpdateHashTree(buffer + start_offset - offset,
+                                           end_offset - start_offset));
 
       if (end_offset == hash_tree_data_end) {
         LOG(INFO)
@@ -248,18 +278,7 @@ bool VerityWriterAndroid::Finalize(FileDescriptor* read_fd,
   // All hash tree data blocks has been hashed, write hash tree to disk.
   LOG(INFO) << "Writing verity hash tree to "
             << partition_->readonly_target_path;
-  if (hash_tree_builder_) {
-    TEST_AND_RETURN_FALSE(hash_tree_builder_->BuildHashTree());
-    TEST_AND_RETURN_FALSE_ERRNO(
-        write_fd->Seek(partition_->hash_tree_offset, SEEK_SET));
-    auto success =
-        hash_tree_builder_->WriteHashTree([write_fd](auto data, auto size) {
-          return utils::WriteAll(write_fd, data, size);
-        });
-    // hashtree builder already prints error messages.
-    TEST_AND_RETURN_FALSE(success);
-    hash_tree_builder_.reset();
-  }
+  TEST_AND_RETURN_FALSE(WriteHashTree(write_fd));
   if (partition_->fec_size != 0) {
     LOG(INFO) << "Writing verity FEC to " << partition_->readonly_target_path;
     TEST_AND_RETURN_FALSE(EncodeFEC(read_fd,
@@ -270,7 +289,8 @@ bool VerityWriterAndroid::Finalize(FileDescriptor* read_fd,
                                     partition_->fec_size,
                                     partition_->fec_roots,
                                     partition_->block_size,
-                                    false /* verify_mode */));
+                                    false /* verify_mode */,
+                                    fec_threads_));
   }
   return true;
 }
@@ -291,18 +311,7 @@ bool VerityWriterAndroid::IncrementalFinalize(FileDescriptor* read_fd,
     // All hash tree data blocks has been hashed, write hash tree to disk.
     LOG(INFO) << "Writing verity hash tree to "
               << partition_->readonly_target_path;
-    if (hash_tree_builder_) {
-      TEST_AND_RETURN_FALSE(hash_tree_builder_->BuildHashTree());
-      TEST_AND_RETURN_FALSE_ERRNO(
-          write_fd->Seek(partition_->hash_tree_offset, SEEK_SET));
-      auto success =
-          hash_tree_builder_->WriteHashTree([write_fd](auto data, auto size) {
-            return utils::WriteAll(write_fd, data, size);
-          });
-      // hashtree builder already prints error messages.
-      TEST_AND_RETURN_FALSE(success);
-      hash_tree_builder_.reset();
-    }
+    TEST_AND_RETURN_FALSE(WriteHashTree(write_fd));
     hash_tree_written_ = true;
     if (partition_->fec_size != 0) {
       LOG(INFO) << "Writing verity FEC to " << partition_->readonly_target_path;
@@ -313,6 +322,36 @@ bool VerityWriterAndroid::IncrementalFinalize(FileDescriptor* read_fd,
   }
   return true;
 }
+bool VerityWriterAndroid::UpdateHashTree(const uint8_t* data, size_t size) {
+  UE_TRACE_SCOPE("VerityWriterAndroid::UpdateHashTree");
+  if (parallel_hash_tree_builder_) {
+    return parallel_hash_tree_builder_->Update(data, size);
+  }
+  return hash_tree_builder_->Update(data, size);
+}
+
+bool VerityWriterAndroid::WriteHashTree(FileDescriptor* write_fd) {
+  UE_TRACE_SCOPE("VerityWriterAndroid::WriteHashTree");
+  auto write = [write_fd](auto data, auto size) {
+    return utils::WriteAll(write_fd, data, size);
+  };
+  if (hash_tree_builder_) {
+    TEST_AND_RETURN_FALSE(hash_tree_builder_->BuildHashTree());
+    TEST_AND_RETURN_FALSE_ERRNO(
+        write_fd->Seek(partition_->hash_tree_offset, SEEK_SET));
+    // hashtree builder already prints error messages.
+    TEST_AND_RETURN_FALSE(hash_tree_builder_->WriteHashTree(write));
+    hash_tree_builder_.reset();
+  } else if (parallel_hash_tree_builder_) {
+    TEST_AND_RETURN_FALSE(parallel_hash_tree_builder_->BuildHashTree());
+    TEST_AND_RETURN_FALSE_ERRNO(
+        write_fd->Seek(partition_->hash_tree_offset, SEEK_SET));
+    TEST_AND_RETURN_FALSE(parallel_hash_tree_builder_->WriteHashTree(write));
+    parallel_hash_tree_builder_.reset();
+  }
+  return true;
+}
+
 bool VerityWriterAndroid::FECFinished() const {
   if ((encodeFEC_.Finished() || partition_->fec_size == 0) &&
       hash_tree_written_) {
@@ -333,76 +372,23 @@ bool VerityWriterAndroid::EncodeFEC(FileDescriptor* read_fd,
                                     uint64_t fec_size,
                                     uint32_t fec_roots,
                                     uint32_t block_size,
-                                    bool verify_mode) {
-  TEST_AND_RETURN_FALSE(data_size % block_size == 0);
-  TEST_AND_RETURN_FALSE(fec_roots >= 0 && fec_roots < FEC_RSM);
-  // This is the N in RS(M, N), which is the number of bytes for each rs
-  // block.
-  size_t rs_n = FEC_RSM - fec_roots;
-  uint64_t rounds = utils::DivRoundUp(data_size / block_size, rs_n);
-  TEST_AND_RETURN_FALSE(rounds * fec_roots * block_size == fec_size);
-
-  std::unique_ptr<void, decltype(&free_rs_char)> rs_char(
-      init_rs_char(FEC_PARAMS(fec_roots)), &free_rs_char);
-  TEST_AND_RETURN_FALSE(rs_char != nullptr);
-  // Cache at most 1MB of fec data, in VABC, we need to re-open fd if we
-  // perform a read() operation after write(). So reduce the number of writes
-  // can save unnecessary re-opens.
-  UnownedCachedFileDescriptor cache_fd(write_fd, 1 * (1 << 20));
-  write_fd = &cache_fd;
-
-  for (size_t i = 0; i < rounds; i++) {
-    // Encodes |block_size| number of rs blocks each round so that we can read
-    // one block each time instead of 1 byte to increase random read
-    // performance. This uses about 1 MiB memory for 4K block size.
-    brillo::Blob rs_blocks(block_size * rs_n);
-    for (size_t j = 0; j < rs_n; j++) {
-      brillo::Blob buffer(block_size, 0);
-      uint64_t offset =
-          fec_ecc_interleave(i * rs_n * block_size + j, rs_n, rounds);
-      // Don't read past |data_size|, treat them as 0.
-      if (offset < data_size) {
-        ssize_t bytes_read = 0;
-        TEST_AND_RETURN_FALSE(utils::PReadAll(read_fd,
-                                              buffer.data(),
-                                              buffer.size(),
-                                              data_offset + offset,
-                                              &bytes_read));
-        TEST_AND_RETURN_FALSE(bytes_read >= 0);
-        TEST_AND_RETURN_FALSE(static_cast<size_t>(bytes_read) == buffer.size());
-      }
-      for (size_t k = 0; k < buffer.size(); k++) {
-        rs_blocks[k * rs_n + j] = buffer[k];
-      }
-    }
-    brillo::Blob fec(block_size * fec_roots);
-    for (size_t j = 0; j < block_size; j++) {
-      // Encode [j * rs_n : (j + 1) * rs_n) in |rs_blocks| and write
-      // |fec_roots| number of parity bytes to |j * fec_roots| in |fec|.
-      encode_rs_char(rs_char.get(),
-                     rs_blocks.data() + j * rs_n,
-                     fec.data() + j * fec_roots);
-    }
-
-    if (verify_mode) {
-      brillo::Blob fec_read(fec.size());
-      ssize_t bytes_read = 0;
-      TEST_AND_RETURN_FALSE(utils::PReadAll(
-          read_fd, fec_read.data(), fec_read.size(), fec_offset, &bytes_read));
-      TEST_AND_RETURN_FALSE(bytes_read >= 0);
-      TEST_AND_RETURN_FALSE(static_cast<size_t>(bytes_read) == fec_read.size());
-      TEST_AND_RETURN_FALSE(fec == fec_read);
-    } else {
-      CHECK(write_fd);
-      write_fd->Seek(fec_offset, SEEK_SET);
-      if (!utils::WriteAll(write_fd, fec.data(), fec.size())) {
-        PLOG(ERROR) << "EncodeFEC write() failed";
-        return false;
-      }
-    }
-    fec_offset += fec.size();
+                                    bool verify_mode,
+                                    size_t threads) {
+  // IncrementalEncodeFEC caches at most 1MB of fec data, in VABC, we need to
+  // re-open fd if we perform a read() operation after write(). So reduce the
+  // number of writes can save unnecessary re-opens.
+  IncrementalEncodeFEC encode_fec;
+  TEST_AND_RETURN_FALSE(encode_fec.Init(data_offset,
+                                        data_size,
+                                        fec_offset,
+                                        fec_size,
+                                        fec_roots,
+                                        block_size,
+                                        verify_mode,
+                                        threads));
+  while (!encode_fec.Finished()) {
+    TEST_AND_RETURN_FALSE(encode_fec.Compute(read_fd, write_fd));
   }
-  write_fd->Flush();
   return true;
 }
 
@@ -413,7 +399,8 @@ bool VerityWriterAndroid::EncodeFEC(const std::string& path,
                                     uint64_t fec_size,
                                     uint32_t fec_roots,
                                     uint32_t block_size,
-                                    bool verify_mode) {
+                                    bool verify_mode,
+                                    size_t threads) {
   EintrSafeFileDescriptor fd;
   TEST_AND_RETURN_FALSE(fd.Open(path.c_str(), verify_mode ? O_RDONLY : O_RDWR));
   return EncodeFEC(&fd,
@@ -424,6 +411,7 @@ bool VerityWriterAndroid::EncodeFEC(const std::string& path,
                    fec_size,
                    fec_roots,
                    block_size,
-                   verify_mode);
+                   verify_mode,
+                   threads);
 }
 }  // namespace chromeos_update_engine
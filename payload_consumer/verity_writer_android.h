@@ -30,7 +30,10 @@ extern "C" {
 
 #include "payload_consumer/file_descriptor.h"
 #include "update_engine/payload_consumer/cached_file_descriptor.h"
+#include "update_engine/payload_consumer/fec_encoder.h"
+#include "update_engine/payload_consumer/parallel_hash_tree_builder.h"
 #include "update_engine/payload_consumer/verity_writer_interface.h"
+#include "update_engine/payload_consumer/worker_pool.h"
 
 namespace chromeos_update_engine {
 enum class EncodeFECStep {
@@ -41,16 +44,19 @@ enum class EncodeFECStep {
 };
 class IncrementalEncodeFEC {
  public:
-  IncrementalEncodeFEC()
-      : rs_char_(nullptr, &free_rs_char), cache_fd_(nullptr, 1 * (1 << 20)) {}
-  // Initialize all member variables needed to performe FEC Computation
+  IncrementalEncodeFEC() : cache_fd_(nullptr, 1 * (1 << 20)) {}
+  // Initialize all member variables needed to performe FEC Computation. With
+  // |_threads| 0, every round is encoded with libfec, otherwise |_threads|
+  // rounds are encoded at a time, on as many threads, by the vectorized
+  // encoder of fec_encoder.h.
   bool Init(const uint64_t _data_offset,
             const uint64_t _data_size,
             const uint64_t _fec_offset,
             const uint64_t _fec_size,
             const uint64_t _fec_roots,
             const uint64_t _block_size,
-            const bool _verify_mode);
+            const bool _verify_mode,
+            const size_t _threads);
   bool Compute(FileDescriptor* _read_fd, FileDescriptor* _write_fd);
   void UpdateState();
   bool Finished() const;
@@ -58,13 +64,17 @@ class IncrementalEncodeFEC {
   double ReportProgress() const;
 
  private:
-  brillo::Blob rs_blocks_;
-  brillo::Blob buffer_;
+  // Read the |rs_n_| data blocks of |round| to |data|.
+  bool ReadRound(size_t round, uint8_t* data);
+
+  // Data and FEC of the rounds encoded in one step.
+  brillo::Blob rounds_data_;
   brillo::Blob fec_;
   brillo::Blob fec_read_;
   EncodeFECStep current_step_;
   size_t current_round_;
   size_t num_rounds_;
+  size_t rounds_per_step_;
   FileDescriptor* read_fd_;
   FileDescriptor* write_fd_;
   uint64_t data_offset_;
@@ -75,7 +85,8 @@ class IncrementalEncodeFEC {
   uint64_t block_size_;
   size_t rs_n_;
   bool verify_mode_;
-  std::unique_ptr<void, decltype(&free_rs_char)> rs_char_;
+  std::unique_ptr<FecEncoderInterface> encoder_;
+  std::unique_ptr<WorkerPool> worker_pool_;
   UnownedCachedFileDescriptor cache_fd_;
 };
 
@@ -84,6 +95,10 @@ class VerityWriterAndroid : public VerityWriterInterface {
   VerityWriterAndroid() = default;
   ~VerityWriterAndroid() override = default;
 
+  void SetHashTreeThreads(size_t threads) override {
+    hash_tree_threads_ = threads;
+  }
+  void SetFecThreads(size_t threads) override { fec_threads_ = threads; }
   bool Init(const InstallPlan::Partition& partition);
   bool Update(uint64_t offset, const uint8_t* buffer, size_t size) override;
   bool Finalize(FileDescriptor* read_fd, FileDescriptor* write_fd) override;
@@ -96,7 +111,8 @@ class VerityWriterAndroid : public VerityWriterInterface {
   // |path|, otherwise write the encoded FEC to |path|. We can't encode as we go
   // in each Update() like hash tree, because for every rs block, its data are
   // spreaded across entire |data_size|, unless we can cache all data in
-  // memory, we have to re-read them from disk.
+  // memory, we have to re-read them from disk. |threads| is passed to
+  // IncrementalEncodeFEC::Init().
   static bool EncodeFEC(FileDescriptor* read_fd,
                         FileDescriptor* write_fd,
                         uint64_t data_offset,
@@ -105,7 +121,8 @@ class VerityWriterAndroid : public VerityWriterInterface {
                         uint64_t fec_size,
                         uint32_t fec_roots,
                         uint32_t block_size,
-                        bool verify_mode);
+                        bool verify_mode,
+                        size_t threads = 0);
   static bool EncodeFEC(const std::string& path,
                         uint64_t data_offset,
                         uint64_t data_size,
@@ -113,15 +130,27 @@ class VerityWriterAndroid : public VerityWriterInterface {
                         uint64_t fec_size,
                         uint32_t fec_roots,
                         uint32_t block_size,
-                        bool verify_mode);
+                        bool verify_mode,
+                        size_t threads = 0);
 
  private:
+  // Feed |size| bytes of |data| to the hash tree builder.
+  bool UpdateHashTree(const uint8_t* data, size_t size);
+  // Build the hash tree, if any, and write it to |write_fd|.
+  bool WriteHashTree(FileDescriptor* write_fd);
+
   // stores the state of EncodeFEC
   IncrementalEncodeFEC encodeFEC_;
   bool hash_tree_written_ = false;
   const InstallPlan::Partition* partition_ = nullptr;
 
+  // Number of threads hashing the hash tree, see parallel_hash_tree_builder.h.
+  // 0 or 1 builds the tree with |hash_tree_builder_|.
+  size_t hash_tree_threads_ = 0;
+  // Number of threads encoding the FEC, see IncrementalEncodeFEC::Init().
+  size_t fec_threads_ = 0;
   std::unique_ptr<HashTreeBuilder> hash_tree_builder_;
+  std::unique_ptr<ParallelHashTreeBuilder> parallel_hash_tree_builder_;
   uint64_t total_offset_ = 0;
   DISALLOW_COPY_AND_ASSIGN(VerityWriterAndroid);
 };
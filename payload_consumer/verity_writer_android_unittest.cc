@@ -144,6 +144,38 @@ TEST_F(VerityWriterAndroidTest, NonZeroOffsetSHA256Test) {
   ASSERT_EQ(part_data, actual_part);
 }
 
+TEST_F(VerityWriterAndroidTest, ParallelHashTreeTest) {
+  partition_.hash_tree_algorithm = "sha256";
+  partition_.hash_tree_data_size = 300 * 4096;
+  partition_.hash_tree_offset = partition_.hash_tree_data_size;
+  // 300 sha256 digests take 3 blocks, hashed by 1 more block.
+  partition_.hash_tree_size = 4 * 4096;
+  brillo::Blob part_data(partition_.hash_tree_offset +
+                         partition_.hash_tree_size);
+  for (size_t i = 0; i < partition_.hash_tree_data_size; i++) {
+    part_data[i] = (i * 7 + i / 4096) & 0xff;
+  }
+  partition_.hash_tree_salt = {0xde, 0xad, 0xbe, 0xef};
+
+  brillo::Blob parts_written[2];
+  for (size_t threads : {1, 4}) {
+    test_utils::WriteFileVector(partition_.target_path, part_data);
+    VerityWriterAndroid verity_writer;
+    verity_writer.SetHashTreeThreads(threads);
+    ASSERT_TRUE(verity_writer.Init(partition_));
+    ASSERT_TRUE(verity_writer.Update(0, part_data.data(), 1000));
+    ASSERT_TRUE(verity_writer.Update(
+        1000, part_data.data() + 1000, partition_.hash_tree_data_size - 1000));
+    ASSERT_TRUE(
+        verity_writer.Finalize(partition_fd_.get(), partition_fd_.get()));
+    ASSERT_TRUE(utils::ReadFile(partition_.target_path,
+                                &parts_written[threads > 1]));
+  }
+  ASSERT_EQ(part_data.size(), parts_written[1].size());
+  ASSERT_NE(part_data, parts_written[0]);
+  ASSERT_EQ(parts_written[0], parts_written[1]);
+}
+
 TEST_F(VerityWriterAndroidTest, FECTest) {
   partition_.fec_data_offset = 0;
   partition_.fec_data_size = 4096;
@@ -165,6 +197,50 @@ TEST_F(VerityWriterAndroidTest, FECTest) {
   ASSERT_EQ(part_data, actual_part);
 }
 
+TEST_F(VerityWriterAndroidTest, VectorizedFECTest) {
+  partition_.hash_tree_size = 0;
+  partition_.hash_tree_data_size = 0;
+  partition_.hash_tree_offset = 0;
+  partition_.hash_tree_data_offset = 0;
+
+  // 600 blocks take 3 rounds of 253 blocks.
+  partition_.fec_data_offset = 0;
+  partition_.fec_data_size = 600 * 4096;
+  partition_.fec_offset = partition_.fec_data_size;
+  partition_.fec_size = 3 * 2 * 4096;
+  brillo::Blob part_data(partition_.fec_offset + partition_.fec_size);
+  for (size_t i = 0; i < partition_.fec_data_size; i++) {
+    part_data[i] = (i * 13 + i / 4096) & 0xff;
+  }
+
+  brillo::Blob parts_written[2];
+  for (size_t threads : {0, 2}) {
+    test_utils::WriteFileVector(partition_.target_path, part_data);
+    VerityWriterAndroid verity_writer;
+    verity_writer.SetFecThreads(threads);
+    ASSERT_TRUE(verity_writer.Init(partition_));
+    ASSERT_TRUE(verity_writer.Update(0, part_data.data(), part_data.size()));
+    while (!verity_writer.FECFinished()) {
+      ASSERT_TRUE(verity_writer.IncrementalFinalize(partition_fd_.get(),
+                                                    partition_fd_.get()));
+    }
+    ASSERT_EQ(1.0, verity_writer.GetProgress());
+    ASSERT_TRUE(utils::ReadFile(partition_.target_path,
+                                &parts_written[threads > 0]));
+  }
+  ASSERT_NE(part_data, parts_written[0]);
+  ASSERT_EQ(parts_written[0], parts_written[1]);
+  ASSERT_TRUE(VerityWriterAndroid::EncodeFEC(partition_.target_path,
+                                             partition_.fec_data_offset,
+                                             partition_.fec_data_size,
+                                             partition_.fec_offset,
+                                             partition_.fec_size,
+                                             partition_.fec_roots,
+                                             partition_.block_size,
+                                             true /* verify_mode */,
+                                             4 /* threads */));
+}
+
 TEST_F(VerityWriterAndroidTest, HashTreeDisabled) {
   partition_.hash_tree_size = 0;
   partition_.hash_tree_data_size = 0;
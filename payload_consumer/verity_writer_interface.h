@@ -32,6 +32,12 @@ class VerityWriterInterface {
  public:
   virtual ~VerityWriterInterface() = default;
 
+  // Sets the number of threads building the hash tree, taking effect at the
+  // next Init(). Writers not supporting it ignore it.
+  virtual void SetHashTreeThreads(size_t /* threads */) {}
+  // Same as SetHashTreeThreads() for the threads encoding the FEC data.
+  virtual void SetFecThreads(size_t /* threads */) {}
+
   virtual bool Init(const InstallPlan::Partition& partition) = 0;
   // Update partition data at [offset : offset + size) stored in |buffer|.
   // Data not in |hash_tree_data_extent| or |fec_data_extent| is ignored.
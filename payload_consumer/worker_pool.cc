@@ -0,0 +1,106 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/worker_pool.h"
+
+#include "update_engine/common/cpu_topology.h"
+#include "update_engine/payload_consumer/parallel_operation_applier.h"
+
+namespace chromeos_update_engine {
+
+WorkerPool::WorkerPool(size_t num_threads) {
+  for (size_t i = 1; i < num_threads; i++) {
+    workers_.emplace_back(&WorkerPool::WorkerMain, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+bool WorkerPool::ParallelFor(size_t count,
+                             const std::function<bool(size_t)>& task) {
+  if (workers_.empty() || count <= 1) {
+    bool success = true;
+    for (size_t i = 0; i < count; i++) {
+      success = task(i) && success;
+    }
+    return success;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ = &task;
+    task_count_ = count;
+    next_task_ = 0;
+    failed_ = false;
+    busy_workers_ = workers_.size();
+    generation_++;
+  }
+  cv_.notify_all();
+  RunTasks();
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] { return busy_workers_ == 0; });
+  task_ = nullptr;
+  return !failed_;
+}
+
+void WorkerPool::RunTasks() {
+  while (true) {
+    const size_t index = next_task_.fetch_add(1);
+    if (index >= task_count_) {
+      return;
+    }
+    if (!(*task_)(index)) {
+      failed_ = true;
+    }
+  }
+}
+
+void WorkerPool::WorkerMain() {
+  uint64_t generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this, generation] {
+        return stopping_ || generation_ != generation;
+      });
+      if (stopping_) {
+        return;
+      }
+      generation = generation_;
+    }
+    PlaceWorkerThread();
+    ParallelOperationApplier::ApplyIoPriority();
+    RunTasks();
+    bool last;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      last = --busy_workers_ == 0;
+    }
+    if (last) {
+      cv_.notify_all();
+    }
+  }
+}
+
+}  // namespace chromeos_update_engine
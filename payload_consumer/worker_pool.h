@@ -0,0 +1,77 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_WORKER_POOL_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <base/macros.h>
+
+namespace chromeos_update_engine {
+
+// A fixed set of threads running independent tasks in parallel, fork-join
+// style: ParallelFor() hands out the tasks, one at a time, to the threads of
+// the pool and to the calling thread, and returns once all of them ran. The
+// threads are kept across calls, so small batches of work are cheap to
+// dispatch. The workers follow the process wide CpuPlacement.
+class WorkerPool {
+ public:
+  // Runs the tasks on |num_threads| threads, the calling one included, so one
+  // fewer thread is started. 0 is the same as 1.
+  explicit WorkerPool(size_t num_threads);
+  ~WorkerPool();
+
+  size_t num_threads() const { return workers_.size() + 1; }
+
+  // Runs |task(i)| for every |i| in [0, |count|), in any order and on any of
+  // the threads. Returns whether all the calls returned true; the remaining
+  // tasks still run after a failure. Must not be called concurrently.
+  bool ParallelFor(size_t count, const std::function<bool(size_t)>& task);
+
+ private:
+  // Runs the tasks of the current call until none is left.
+  void RunTasks();
+  void WorkerMain();
+
+  // The current call, set while no worker runs tasks.
+  const std::function<bool(size_t)>* task_{nullptr};
+  size_t task_count_{0};
+  std::atomic<size_t> next_task_{0};
+  std::atomic<bool> failed_{false};
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // Incremented with each call, for the workers to pick it up once.
+  uint64_t generation_{0};
+  // Number of workers still running tasks of the current call.
+  size_t busy_workers_{0};
+  bool stopping_{false};
+  std::vector<std::thread> workers_;
+
+  DISALLOW_COPY_AND_ASSIGN(WorkerPool);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_WORKER_POOL_H_
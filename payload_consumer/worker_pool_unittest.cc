@@ -0,0 +1,94 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/worker_pool.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_consumer/parallel_operation_applier.h"
+
+namespace chromeos_update_engine {
+
+class WorkerPoolTest : public ::testing::TestWithParam<size_t> {
+ protected:
+  WorkerPool pool_{GetParam()};
+};
+
+TEST_P(WorkerPoolTest, RunsEveryTaskOnceTest) {
+  EXPECT_EQ(std::max<size_t>(GetParam(), 1), pool_.num_threads());
+  // Several calls, to check the workers pick up each of them.
+  for (size_t count : {0, 1, 5, 100, 1000}) {
+    std::vector<std::atomic<int>> runs(count);
+    ASSERT_TRUE(pool_.ParallelFor(count, [&runs](size_t i) {
+      runs[i]++;
+      return true;
+    }));
+    for (size_t i = 0; i < count; i++) {
+      EXPECT_EQ(1, runs[i].load()) << "task " << i << " of " << count;
+    }
+  }
+}
+
+TEST_P(WorkerPoolTest, FailureTest) {
+  std::atomic<size_t> runs{0};
+  ASSERT_FALSE(pool_.ParallelFor(50, [&runs](size_t i) {
+    runs++;
+    return i != 7;
+  }));
+  // The other tasks still run.
+  EXPECT_EQ(50u, runs.load());
+  // The failure doesn't stick to the next call.
+  ASSERT_TRUE(pool_.ParallelFor(10, [](size_t) { return true; }));
+}
+
+INSTANTIATE_TEST_CASE_P(WorkerPoolTestInstance,
+                        WorkerPoolTest,
+                        ::testing::Values(0, 1, 4));
+
+TEST(WorkerPoolIoPriorityTest, WorkersTakeTheThrottledIoPriorityTest) {
+  // IOPRIO_WHO_PROCESS and the best-effort class of ioprio_get().
+  constexpr int kIoprioWhoProcess = 1;
+  constexpr int kBestEffortLevel6 = (2 << 13) | 6;
+  ParallelOperationApplier::SetIoPriority(6);
+  WorkerPool pool(2);
+  const std::thread::id caller = std::this_thread::get_id();
+  std::atomic<size_t> started{0};
+  std::atomic<int> worker_priority{-1};
+  ASSERT_TRUE(pool.ParallelFor(2, [&](size_t) {
+    // Each task waits for the other one to start, so the worker runs one.
+    started++;
+    while (started < 2) {
+      std::this_thread::yield();
+    }
+    if (std::this_thread::get_id() != caller) {
+      worker_priority = syscall(SYS_ioprio_get, kIoprioWhoProcess, 0);
+    }
+    return true;
+  }));
+  EXPECT_EQ(kBestEffortLevel6, worker_priority.load());
+  // Back to the default best-effort level, for the other tests.
+  ParallelOperationApplier::SetIoPriority(4);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,99 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/write_path_hasher.h"
+
+#include <algorithm>
+
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+// Size of the buffer of zeros hashed at once.
+constexpr uint64_t kZeroBufferSize = 1024 * 1024;
+}  // namespace
+
+WritePathHasher::WritePathHasher(uint64_t target_size)
+    : target_size_(target_size) {}
+
+void WritePathHasher::Update(uint64_t offset, const void* data, size_t size) {
+  if (!trusted_ || offset >= target_size_) {
+    return;
+  }
+  if (offset != next_offset_) {
+    LOG(INFO) << "Write at offset " << offset << " instead of " << next_offset_
+              << ", the partition will be read back to be verified.";
+    Invalidate();
+    return;
+  }
+  const size_t hashed_size = std::min<uint64_t>(size, target_size_ - offset);
+  if (!hash_calculator_.Update(data, hashed_size)) {
+    Invalidate();
+    return;
+  }
+  next_offset_ += hashed_size;
+}
+
+void WritePathHasher::UpdateZeros(uint64_t offset, uint64_t size) {
+  const brillo::Blob zeros(std::min(size, kZeroBufferSize));
+  for (uint64_t done = 0; done < size && trusted_; done += zeros.size()) {
+    Update(offset + done, zeros.data(), std::min(size - done, kZeroBufferSize));
+  }
+}
+
+void WritePathHasher::Invalidate() {
+  trusted_ = false;
+}
+
+std::string WritePathHasher::GetContext() const {
+  if (!trusted_) {
+    return "";
+  }
+  return base::NumberToString(next_offset_) + ":" +
+         hash_calculator_.GetContext();
+}
+
+bool WritePathHasher::SetContext(const std::string& context) {
+  const size_t separator = context.find(':');
+  uint64_t next_offset = 0;
+  if (separator == std::string::npos ||
+      !base::StringToUint64(context.substr(0, separator), &next_offset) ||
+      next_offset > target_size_ ||
+      !hash_calculator_.SetContext(context.substr(separator + 1))) {
+    LOG(WARNING) << "Invalid write path hash context, the partition will be "
+                    "read back to be verified.";
+    Invalidate();
+    return false;
+  }
+  next_offset_ = next_offset;
+  trusted_ = true;
+  return true;
+}
+
+bool WritePathHasher::Finalize(brillo::Blob* hash) {
+  if (!trusted_ || next_offset_ != target_size_) {
+    return false;
+  }
+  TEST_AND_RETURN_FALSE(hash_calculator_.Finalize());
+  *hash = hash_calculator_.raw_hash();
+  return true;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,76 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_WRITE_PATH_HASHER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_WRITE_PATH_HASHER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/hash_calculator.h"
+
+namespace chromeos_update_engine {
+
+// Hashes the data of a target partition as it is written, so that the
+// partition doesn't need to be read back to be verified. The hash is only
+// trusted if the writes cover the partition, up to its target size, exactly
+// once and in order: a write anywhere else than right after the previous one,
+// or of unknown content, invalidates it. Writes past the target size aren't
+// part of the hash and are ignored.
+class WritePathHasher {
+ public:
+  explicit WritePathHasher(uint64_t target_size);
+
+  // Records that the |size| bytes of |data| are written at |offset|.
+  void Update(uint64_t offset, const void* data, size_t size);
+
+  // Records that |size| zero bytes are written at |offset|.
+  void UpdateZeros(uint64_t offset, uint64_t size);
+
+  // Records a write whose content isn't known, e.g. a discard.
+  void Invalidate();
+
+  bool trusted() const { return trusted_; }
+  uint64_t next_offset() const { return next_offset_; }
+
+  // Gets the state of the hashing, to be restored with SetContext() when
+  // resuming the writes from next_offset(). Empty if the hash is not trusted.
+  std::string GetContext() const;
+
+  // Restores a state returned by GetContext(). Returns false, and invalidates
+  // the hash, if |context| isn't valid for this partition.
+  bool SetContext(const std::string& context);
+
+  // Sets |hash| to the hash of the partition. Returns false if the hash is not
+  // trusted or doesn't cover the whole partition.
+  bool Finalize(brillo::Blob* hash);
+
+ private:
+  const uint64_t target_size_;
+  uint64_t next_offset_{0};
+  bool trusted_{true};
+  HashCalculator hash_calculator_;
+
+  DISALLOW_COPY_AND_ASSIGN(WritePathHasher);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_WRITE_PATH_HASHER_H_
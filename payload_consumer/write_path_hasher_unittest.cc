@@ -0,0 +1,139 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/write_path_hasher.h"
+
+#include <string>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/hash_calculator.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr size_t kTargetSize = 3 * 4096 + 100;
+}  // namespace
+
+class WritePathHasherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    data_.resize(kTargetSize);
+    for (size_t i = 0; i < data_.size(); i++) {
+      data_[i] = static_cast<uint8_t>(i * 31 + 7);
+    }
+    ASSERT_TRUE(HashCalculator::RawHashOfData(data_, &expected_hash_));
+  }
+
+  void Write(WritePathHasher* hasher, size_t offset, size_t size) {
+    hasher->Update(offset, data_.data() + offset, size);
+  }
+
+  brillo::Blob data_;
+  brillo::Blob expected_hash_;
+  WritePathHasher hasher_{kTargetSize};
+};
+
+TEST_F(WritePathHasherTest, InOrderTest) {
+  Write(&hasher_, 0, 4096);
+  Write(&hasher_, 4096, 1);
+  Write(&hasher_, 4097, kTargetSize - 4097);
+  EXPECT_TRUE(hasher_.trusted());
+  EXPECT_EQ(kTargetSize, hasher_.next_offset());
+  brillo::Blob hash;
+  ASSERT_TRUE(hasher_.Finalize(&hash));
+  EXPECT_EQ(expected_hash_, hash);
+}
+
+TEST_F(WritePathHasherTest, OutOfOrderTest) {
+  Write(&hasher_, 4096, 4096);
+  Write(&hasher_, 0, 4096);
+  EXPECT_FALSE(hasher_.trusted());
+  brillo::Blob hash;
+  EXPECT_FALSE(hasher_.Finalize(&hash));
+}
+
+TEST_F(WritePathHasherTest, RewriteTest) {
+  Write(&hasher_, 0, 8192);
+  Write(&hasher_, 4096, kTargetSize - 4096);
+  EXPECT_FALSE(hasher_.trusted());
+}
+
+TEST_F(WritePathHasherTest, IncompleteTest) {
+  Write(&hasher_, 0, kTargetSize - 1);
+  EXPECT_TRUE(hasher_.trusted());
+  brillo::Blob hash;
+  EXPECT_FALSE(hasher_.Finalize(&hash));
+}
+
+TEST_F(WritePathHasherTest, PastTargetSizeTest) {
+  // The tail of the partition isn't part of the hash.
+  brillo::Blob data = data_;
+  data.resize(kTargetSize + 4096);
+  hasher_.Update(0, data.data(), data.size());
+  hasher_.Update(kTargetSize + 8192, data.data(), 4096);
+  brillo::Blob hash;
+  ASSERT_TRUE(hasher_.Finalize(&hash));
+  EXPECT_EQ(expected_hash_, hash);
+}
+
+TEST_F(WritePathHasherTest, ZerosTest) {
+  data_.assign(kTargetSize, 0);
+  ASSERT_TRUE(HashCalculator::RawHashOfData(data_, &expected_hash_));
+  hasher_.UpdateZeros(0, 4096);
+  Write(&hasher_, 4096, 4096);
+  hasher_.UpdateZeros(8192, kTargetSize - 8192);
+  brillo::Blob hash;
+  ASSERT_TRUE(hasher_.Finalize(&hash));
+  EXPECT_EQ(expected_hash_, hash);
+}
+
+TEST_F(WritePathHasherTest, InvalidateTest) {
+  Write(&hasher_, 0, 4096);
+  hasher_.Invalidate();
+  Write(&hasher_, 4096, kTargetSize - 4096);
+  EXPECT_FALSE(hasher_.trusted());
+  EXPECT_TRUE(hasher_.GetContext().empty());
+}
+
+TEST_F(WritePathHasherTest, ResumeFromContextTest) {
+  Write(&hasher_, 0, 5000);
+  const std::string context = hasher_.GetContext();
+  ASSERT_FALSE(context.empty());
+
+  WritePathHasher resumed(kTargetSize);
+  ASSERT_TRUE(resumed.SetContext(context));
+  EXPECT_EQ(5000u, resumed.next_offset());
+  Write(&resumed, 5000, kTargetSize - 5000);
+  brillo::Blob hash;
+  ASSERT_TRUE(resumed.Finalize(&hash));
+  EXPECT_EQ(expected_hash_, hash);
+}
+
+TEST_F(WritePathHasherTest, InvalidContextTest) {
+  EXPECT_FALSE(hasher_.SetContext(""));
+  EXPECT_FALSE(hasher_.trusted());
+
+  WritePathHasher small(100);
+  EXPECT_FALSE(small.SetContext("5000:" + HashCalculator().GetContext()));
+  EXPECT_FALSE(small.trusted());
+  WritePathHasher garbage(kTargetSize);
+  EXPECT_FALSE(garbage.SetContext("12:garbage"));
+  EXPECT_FALSE(garbage.SetContext("no separator"));
+}
+
+}  // namespace chromeos_update_engine
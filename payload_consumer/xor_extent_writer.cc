@@ -18,6 +18,7 @@
 #include <optional>
 #include <vector>
 
+#include "update_engine/common/simd_utils.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/xor_extent_writer.h"
 #include "update_engine/payload_generator/extent_ranges.h"
@@ -44,11 +45,7 @@ bool XORExtentWriter::WriteXorCowOp(const uint8_t* bytes,
     return false;
   }
 
-  std::transform(xor_block_data.cbegin(),
-                 xor_block_data.cbegin() + xor_block_data.size(),
-                 bytes,
-                 xor_block_data.begin(),
-                 std::bit_xor<unsigned char>{});
+  simd_utils::Xor(xor_block_data.data(), bytes, xor_block_data.size());
   TEST_AND_RETURN_FALSE(cow_writer_->AddXorBlocks(xor_ext.start_block(),
                                                   xor_block_data.data(),
                                                   xor_block_data.size(),
@@ -109,73 +106,55 @@ bool XORExtentWriter::WriteXorExtent(const uint8_t* bytes,
 bool XORExtentWriter::WriteExtent(const void* bytes,
                                   const Extent& extent,
                                   const size_t size) {
-  const auto xor_extents = xor_map_.GetIntersectingExtents(extent);
-  for (const auto& xor_ext : xor_extents) {
-    const auto merge_op_opt = xor_map_.Get(xor_ext);
-    if (!merge_op_opt.has_value()) {
-      // If a file in the target build contains duplicate blocks, e.g.
-      // [120503-120514], [120503-120503], we can end up here. If that's the
-      // case then there's no bug, just some annoying edge cases.
-      LOG(ERROR)
-          << xor_ext
-          << " isn't in XOR map but it's returned by GetIntersectingExtents(), "
-             "this is either a bug inside GetIntersectingExtents, or some "
-             "duplicate blocks are present in target build. OTA extent: "
-          << extent;
-      return false;
-    }
-
-    const auto merge_op = merge_op_opt.value();
-    TEST_AND_RETURN_FALSE(merge_op->has_src_extent());
-    TEST_AND_RETURN_FALSE(merge_op->has_dst_extent());
-    if (!ExtentContains(extent, xor_ext)) {
-      LOG(ERROR) << "CowXor merge op extent should be completely inside "
-                    "InstallOp's extent. merge op extent: "
-                 << xor_ext << " InstallOp extent: " << extent;
-      return false;
-    }
-    if (!ExtentContains(merge_op->dst_extent(), xor_ext)) {
-      LOG(ERROR) << "CowXor op extent should be completely inside "
-                    "xor_map's extent. merge op extent: "
-                 << xor_ext << " xor_map extent: " << merge_op->dst_extent();
-      return false;
-    }
-    const auto i = xor_ext.start_block() - extent.start_block();
-    const auto dst_block_data =
-        static_cast<const unsigned char*>(bytes) + i * BlockSize();
-    if (!WriteXorExtent(dst_block_data,
-                        xor_ext.num_blocks() * BlockSize(),
-                        xor_ext,
-                        merge_op)) {
-      LOG(ERROR) << "Failed to write XOR extent " << xor_ext;
-      return false;
-    }
-  }
-  const auto replace_extents = xor_map_.GetNonIntersectingExtents(extent);
-  return WriteReplaceExtents(replace_extents, extent, bytes, size);
+  // The XOR parts of |extent| are written first, then the others, in a
+  // second walk of the map rather than from a list of them.
+  const bool xor_written = xor_map_.ForEachPart(
+      extent,
+      [&](const Extent& xor_ext, const CowMergeOperation* const* entry) {
+        return !entry || WriteXorPart(bytes, extent, xor_ext, *entry);
+      });
+  TEST_AND_RETURN_FALSE(xor_written);
+  return xor_map_.ForEachPart(
+      extent,
+      [&](const Extent& replace_ext, const CowMergeOperation* const* entry) {
+        return entry || WriteReplaceExtent(replace_ext, extent, bytes);
+      });
 }
 
-bool XORExtentWriter::WriteReplaceExtents(
-    const std::vector<Extent>& replace_extents,
-    const Extent& extent,
-    const void* bytes,
-    size_t size) {
-  const uint64_t new_block_start = extent.start_block();
-  for (const auto& ext : replace_extents) {
-    if (ext.start_block() + ext.num_blocks() >
-        extent.start_block() + extent.num_blocks()) {
-      LOG(ERROR) << "CowReplace merge op extent should be completely inside "
-                    "InstallOp's extent. merge op extent: "
-                 << ext << " InstallOp extent: " << extent;
-      return false;
-    }
-    const auto i = ext.start_block() - new_block_start;
-    const auto dst_block_data =
-        static_cast<const unsigned char*>(bytes) + i * BlockSize();
-    TEST_AND_RETURN_FALSE(cow_writer_->AddRawBlocks(
-        ext.start_block(), dst_block_data, ext.num_blocks() * BlockSize()));
+bool XORExtentWriter::WriteXorPart(const void* bytes,
+                                   const Extent& extent,
+                                   const Extent& xor_ext,
+                                   const CowMergeOperation* merge_op) {
+  TEST_AND_RETURN_FALSE(merge_op->has_src_extent());
+  TEST_AND_RETURN_FALSE(merge_op->has_dst_extent());
+  if (!ExtentContains(merge_op->dst_extent(), xor_ext)) {
+    LOG(ERROR) << "CowXor op extent should be completely inside "
+                  "xor_map's extent. merge op extent: "
+               << xor_ext << " xor_map extent: " << merge_op->dst_extent();
+    return false;
+  }
+  const auto i = xor_ext.start_block() - extent.start_block();
+  const auto dst_block_data =
+      static_cast<const unsigned char*>(bytes) + i * BlockSize();
+  if (!WriteXorExtent(dst_block_data,
+                      xor_ext.num_blocks() * BlockSize(),
+                      xor_ext,
+                      merge_op)) {
+    LOG(ERROR) << "Failed to write XOR extent " << xor_ext;
+    return false;
   }
   return true;
 }
 
+bool XORExtentWriter::WriteReplaceExtent(const Extent& replace_extent,
+                                         const Extent& extent,
+                                         const void* bytes) {
+  const auto i = replace_extent.start_block() - extent.start_block();
+  const auto dst_block_data =
+      static_cast<const unsigned char*>(bytes) + i * BlockSize();
+  return cow_writer_->AddRawBlocks(replace_extent.start_block(),
+                                   dst_block_data,
+                                   replace_extent.num_blocks() * BlockSize());
+}
+
 }  // namespace chromeos_update_engine
@@ -21,7 +21,7 @@
 
 #include "common/utils.h"
 #include "update_engine/payload_consumer/block_extent_writer.h"
-#include "update_engine/payload_consumer/extent_map.h"
+#include "update_engine/payload_consumer/flat_extent_map.h"
 
 #include <update_engine/update_metadata.pb.h>
 #include <libsnapshot/cow_writer.h>
@@ -35,7 +35,7 @@ class XORExtentWriter : public BlockExtentWriter {
   XORExtentWriter(const InstallOperation& op,
                   FileDescriptorPtr source_fd,
                   android::snapshot::ICowWriter* cow_writer,
-                  const ExtentMap<const CowMergeOperation*>& xor_map,
+                  const FlatExtentMap<const CowMergeOperation*>& xor_map,
                   size_t partition_size)
       : src_extents_(op.src_extents()),
         source_fd_(source_fd),
@@ -52,10 +52,15 @@ class XORExtentWriter : public BlockExtentWriter {
                    size_t size) override;
 
  private:
-  bool WriteReplaceExtents(const std::vector<Extent>& replace_extents,
-                           const Extent& extent,
-                           const void* bytes,
-                           size_t size);
+  // Writes the part |xor_ext| of |extent|, the data of which is at |bytes|,
+  // as XOR blocks against the source of |merge_op|.
+  bool WriteXorPart(const void* bytes,
+                    const Extent& extent,
+                    const Extent& xor_ext,
+                    const CowMergeOperation* merge_op);
+  bool WriteReplaceExtent(const Extent& replace_extent,
+                          const Extent& extent,
+                          const void* bytes);
   bool WriteXorExtent(const uint8_t* bytes,
                       const size_t size,
                       const Extent& xor_ext,
@@ -66,7 +71,7 @@ class XORExtentWriter : public BlockExtentWriter {
                      size_t src_offset);
   const google::protobuf::RepeatedPtrField<Extent>& src_extents_;
   const FileDescriptorPtr source_fd_;
-  const ExtentMap<const CowMergeOperation*>& xor_map_;
+  const FlatExtentMap<const CowMergeOperation*>& xor_map_;
   android::snapshot::ICowWriter* cow_writer_;
   std::vector<uint8_t> xor_block_data;
   const size_t partition_size_;
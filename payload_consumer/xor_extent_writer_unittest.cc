@@ -16,6 +16,8 @@
 
 #include <algorithm>
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include <unistd.h>
 
@@ -24,8 +26,8 @@
 #include <libsnapshot/mock_cow_writer.h>
 
 #include "update_engine/common/utils.h"
-#include "update_engine/payload_consumer/extent_map.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_consumer/flat_extent_map.h"
 #include "update_engine/payload_consumer/xor_extent_writer.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/extent_ranges.h"
@@ -62,7 +64,13 @@ class XorExtentWriterTest : public ::testing::Test {
   }
   InstallOperation op_;
   FileDescriptorPtr source_fd_ = std::make_shared<EintrSafeFileDescriptor>();
-  ExtentMap<const CowMergeOperation*> xor_map_;
+  // The XOR map is immutable, so it is rebuilt with every extent added.
+  void AddXorExtent(const Extent& extent, const CowMergeOperation* merge_op) {
+    xor_entries_.emplace_back(extent, merge_op);
+    xor_map_ = FlatExtentMap<const CowMergeOperation*>(xor_entries_);
+  }
+  std::vector<std::pair<Extent, const CowMergeOperation*>> xor_entries_;
+  FlatExtentMap<const CowMergeOperation*> xor_map_;
   android::snapshot::MockCowWriter cow_writer_;
   TemporaryFile source_part_;
   TemporaryFile target_part_;
@@ -81,19 +89,19 @@ TEST_F(XorExtentWriterTest, StreamTest) {
   ON_CALL(cow_writer_, AddXorBlocks(_, _, _, _, _)).WillByDefault(Return(true));
   const auto op1 = CreateCowMergeOperation(
       ExtentForRange(5, 2), ExtentForRange(5, 2), COW_XOR);
-  ASSERT_TRUE(xor_map_.AddExtent(op1.dst_extent(), &op1));
+  AddXorExtent(op1.dst_extent(), &op1);
   *op_.add_src_extents() = op1.src_extent();
   *op_.add_dst_extents() = op1.dst_extent();
 
   const auto op2 = CreateCowMergeOperation(
       ExtentForRange(45, 2), ExtentForRange(456, 2), COW_XOR);
-  ASSERT_TRUE(xor_map_.AddExtent(op2.dst_extent(), &op2));
+  AddXorExtent(op2.dst_extent(), &op2);
   *op_.add_src_extents() = ExtentForRange(45, 3);
   *op_.add_dst_extents() = ExtentForRange(455, 3);
 
   const auto op3 = CreateCowMergeOperation(
       ExtentForRange(12, 2), ExtentForRange(321, 2), COW_XOR, 777);
-  ASSERT_TRUE(xor_map_.AddExtent(op3.dst_extent(), &op3));
+  AddXorExtent(op3.dst_extent(), &op3);
   *op_.add_src_extents() = ExtentForRange(12, 4);
   *op_.add_dst_extents() = ExtentForRange(320, 4);
   XORExtentWriter writer_{
@@ -140,7 +148,7 @@ TEST_F(XorExtentWriterTest, SubsetExtentTest) {
 
   const auto op3 = CreateCowMergeOperation(
       ExtentForRange(12, 4), ExtentForRange(320, 4), COW_XOR, 777);
-  ASSERT_TRUE(xor_map_.AddExtent(op3.dst_extent(), &op3));
+  AddXorExtent(op3.dst_extent(), &op3);
 
   *op_.add_src_extents() = ExtentForRange(12, 3);
   *op_.add_dst_extents() = ExtentForRange(320, 3);
@@ -181,7 +189,7 @@ TEST_F(XorExtentWriterTest, LastBlockTest) {
 
   const auto op3 = CreateCowMergeOperation(
       ExtentForRange(NUM_BLOCKS - 1, 1), ExtentForRange(2, 1), COW_XOR, 777);
-  ASSERT_TRUE(xor_map_.AddExtent(op3.dst_extent(), &op3));
+  AddXorExtent(op3.dst_extent(), &op3);
 
   *op_.add_src_extents() = ExtentForRange(12, 3);
   *op_.add_dst_extents() = ExtentForRange(320, 3);
@@ -228,7 +236,7 @@ TEST_F(XorExtentWriterTest, LastMultiBlockTest) {
 
   const auto op3 = CreateCowMergeOperation(
       ExtentForRange(NUM_BLOCKS - 4, 4), ExtentForRange(2, 4), COW_XOR, 777);
-  ASSERT_TRUE(xor_map_.AddExtent(op3.dst_extent(), &op3));
+  AddXorExtent(op3.dst_extent(), &op3);
 
   *op_.add_src_extents() = ExtentForRange(NUM_BLOCKS - 4, 4);
   *op_.add_dst_extents() = ExtentForRange(2, 4);
@@ -14,15 +14,25 @@
 // limitations under the License.
 //
 
-#include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/xz_extent_writer.h"
 
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/decoder_pool.h"
+
 using google::protobuf::RepeatedPtrField;
 
 namespace chromeos_update_engine {
 
 namespace {
 const brillo::Blob::size_type kOutputBufferLength = 16 * 1024;
+// The most decoded at once into the buffer of the underlying writer.
+const size_t kMaxInPlaceOutputLength = 1024 * 1024;
 
 // xz uses a variable dictionary size which impacts on the compression ratio
 // and is required to be reconstructed in RAM during decompression. While we
@@ -51,21 +61,286 @@ const char* XzErrorString(enum xz_ret error) {
   }
 #undef __XZ_ERROR_STRING_CASE
 }
+
+// Sizes and magic bytes of the .xz stream header and footer.
+constexpr size_t kXzStreamHeaderSize = 12;
+constexpr size_t kXzStreamFooterSize = 12;
+constexpr uint8_t kXzHeaderMagic[] = {0xFD, '7', 'z', 'X', 'Z', 0x00};
+constexpr uint8_t kXzFooterMagic[] = {'Y', 'Z'};
+// Offset of the stream flags in the header, and in the footer.
+constexpr size_t kXzHeaderFlagsOffset = 6;
+constexpr size_t kXzFooterFlagsOffset = 8;
+constexpr size_t kXzStreamFlagsSize = 2;
+// Maximum size of a variable length integer of the .xz format.
+constexpr size_t kXzMaxVliSize = 9;
+// Blocks larger than this are decoded serially, to bound the memory used by
+// the decoding threads.
+constexpr uint64_t kMaxParallelBlockSize = 16 * 1024 * 1024;
+
+uint32_t ReadLE32(const uint8_t* data) {
+  return data[0] | data[1] << 8 | data[2] << 16 |
+         static_cast<uint32_t>(data[3]) << 24;
+}
+
+void AppendLE32(uint32_t value, brillo::Blob* out) {
+  for (size_t i = 0; i < 4; i++) {
+    out->push_back(value >> (8 * i));
+  }
+}
+
+bool ReadVli(const uint8_t* data, size_t size, size_t* pos, uint64_t* value) {
+  *value = 0;
+  for (size_t i = 0; i < kXzMaxVliSize && *pos < size; i++) {
+    const uint8_t byte = data[(*pos)++];
+    *value |= static_cast<uint64_t>(byte & 0x7F) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      // Only the minimal encoding is valid.
+      return byte != 0 || i == 0;
+    }
+  }
+  return false;
+}
+
+void AppendVli(uint64_t value, brillo::Blob* out) {
+  while (value >= 0x80) {
+    out->push_back((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  out->push_back(value);
+}
+
+// A block of an .xz stream, as listed in its index.
+struct XzBlock {
+  // Offset of the block in the stream.
+  size_t offset;
+  // Size of the block without its padding.
+  uint64_t unpadded_size;
+  uint64_t uncompressed_size;
+};
+
+// Parses the index of the single .xz stream in |data| into |blocks|. Returns
+// false if |data| isn't exactly one complete stream.
+bool ParseXzIndex(const uint8_t* data,
+                  size_t size,
+                  std::vector<XzBlock>* blocks) {
+  if (size < kXzStreamHeaderSize + kXzStreamFooterSize ||
+      memcmp(data, kXzHeaderMagic, sizeof(kXzHeaderMagic)) != 0 ||
+      memcmp(data + size - sizeof(kXzFooterMagic),
+             kXzFooterMagic,
+             sizeof(kXzFooterMagic)) != 0) {
+    return false;
+  }
+  const uint8_t* footer = data + size - kXzStreamFooterSize;
+  if (memcmp(data + kXzHeaderFlagsOffset,
+             footer + kXzFooterFlagsOffset,
+             kXzStreamFlagsSize) != 0) {
+    return false;
+  }
+  const uint64_t index_size = (ReadLE32(footer + 4) + 1ULL) * 4;
+  if (index_size > size - kXzStreamHeaderSize - kXzStreamFooterSize) {
+    return false;
+  }
+  const size_t index_start = size - kXzStreamFooterSize - index_size;
+  const size_t index_end = size - kXzStreamFooterSize;
+  // The index ends with its CRC32.
+  const size_t crc_offset = index_end - 4;
+  if (xz_crc32(data + index_start, crc_offset - index_start, 0) !=
+      ReadLE32(data + crc_offset)) {
+    return false;
+  }
+
+  size_t pos = index_start;
+  uint64_t num_blocks = 0;
+  if (data[pos++] != 0 || !ReadVli(data, crc_offset, &pos, &num_blocks)) {
+    return false;
+  }
+  blocks->clear();
+  size_t block_offset = kXzStreamHeaderSize;
+  for (uint64_t i = 0; i < num_blocks; i++) {
+    XzBlock block{block_offset, 0, 0};
+    if (!ReadVli(data, crc_offset, &pos, &block.unpadded_size) ||
+        !ReadVli(data, crc_offset, &pos, &block.uncompressed_size) ||
+        block.unpadded_size == 0 ||
+        block.unpadded_size > index_start - block_offset) {
+      return false;
+    }
+    block_offset += utils::RoundUp(block.unpadded_size, 4);
+    blocks->push_back(block);
+  }
+  // The blocks must be followed by the index, and the records by padding.
+  return block_offset == index_start && utils::RoundUp(pos, 4) == crc_offset;
+}
+
+// Reads the dictionary size of the LZMA2 filter of the first block of the .xz
+// stream starting in |data| into |dict_size|. Returns false if the block
+// header isn't entirely in |data| or has no LZMA2 filter.
+bool ReadXzDictSize(const uint8_t* data, size_t size, uint32_t* dict_size) {
+  constexpr uint64_t kLzma2FilterId = 0x21;
+  constexpr uint8_t kLzma2MaxDictProps = 40;
+  if (size <= kXzStreamHeaderSize ||
+      memcmp(data, kXzHeaderMagic, sizeof(kXzHeaderMagic)) != 0) {
+    return false;
+  }
+  if (data[kXzStreamHeaderSize] == 0) {
+    // The stream has no blocks.
+    *dict_size = 0;
+    return true;
+  }
+  const size_t header_end =
+      kXzStreamHeaderSize + (data[kXzStreamHeaderSize] + 1) * 4;
+  if (header_end > size) {
+    return false;
+  }
+  const uint8_t flags = data[kXzStreamHeaderSize + 1];
+  size_t pos = kXzStreamHeaderSize + 2;
+  uint64_t value;
+  if (((flags & 0x40) && !ReadVli(data, header_end, &pos, &value)) ||
+      ((flags & 0x80) && !ReadVli(data, header_end, &pos, &value))) {
+    return false;
+  }
+  for (size_t i = 0; i <= (flags & 0x03u); i++) {
+    uint64_t filter_id, props_size;
+    if (!ReadVli(data, header_end, &pos, &filter_id) ||
+        !ReadVli(data, header_end, &pos, &props_size) ||
+        props_size > header_end - pos) {
+      return false;
+    }
+    if (filter_id == kLzma2FilterId) {
+      const uint8_t props = data[pos];
+      if (props_size != 1 || props > kLzma2MaxDictProps) {
+        return false;
+      }
+      *dict_size = props == kLzma2MaxDictProps
+                       ? UINT32_MAX
+                       : (2u | (props & 1u)) << (props / 2 + 11);
+      return true;
+    }
+    pos += props_size;
+  }
+  return false;
+}
+
+// Decodes |block| of the .xz stream in |data| into |output|. xz-embedded
+// doesn't decode individual blocks, so the block is wrapped in a stream of its
+// own, with the header of the original stream and an index for the block.
+bool DecodeXzBlock(const uint8_t* data,
+                   const XzBlock& block,
+                   brillo::Blob* output) {
+  brillo::Blob index{0x00};
+  AppendVli(1, &index);
+  AppendVli(block.unpadded_size, &index);
+  AppendVli(block.uncompressed_size, &index);
+  index.resize(utils::RoundUp(index.size(), 4), 0);
+  AppendLE32(xz_crc32(index.data(), index.size(), 0), &index);
+
+  brillo::Blob footer;
+  AppendLE32(index.size() / 4 - 1, &footer);
+  footer.insert(footer.end(),
+                data + kXzHeaderFlagsOffset,
+                data + kXzHeaderFlagsOffset + kXzStreamFlagsSize);
+  brillo::Blob stream(data, data + kXzStreamHeaderSize);
+  stream.insert(stream.end(),
+                data + block.offset,
+                data + block.offset + utils::RoundUp(block.unpadded_size, 4));
+  stream.insert(stream.end(), index.begin(), index.end());
+  AppendLE32(xz_crc32(footer.data(), footer.size(), 0), &stream);
+  stream.insert(stream.end(), footer.begin(), footer.end());
+  stream.insert(
+      stream.end(), std::begin(kXzFooterMagic), std::end(kXzFooterMagic));
+
+  // The whole block is decoded at once, so the output buffer doubles as the
+  // dictionary and nothing else needs to be allocated.
+  std::unique_ptr<xz_dec, decltype(&xz_dec_end)> decoder(
+      xz_dec_init(XZ_SINGLE, 0), &xz_dec_end);
+  TEST_AND_RETURN_FALSE(decoder != nullptr);
+  output->resize(block.uncompressed_size);
+  xz_buf request{};
+  request.in = stream.data();
+  request.in_size = stream.size();
+  request.out = output->data();
+  request.out_size = output->size();
+  const xz_ret ret = xz_dec_run(decoder.get(), &request);
+  if (ret != XZ_STREAM_END) {
+    LOG(ERROR) << "xz_dec_run returned " << XzErrorString(ret)
+               << " decoding block at offset " << block.offset;
+    return false;
+  }
+  TEST_AND_RETURN_FALSE(request.out_pos == output->size());
+  return true;
+}
+
+// Decodes |blocks| of the .xz stream in |data| on up to |num_threads| threads
+// of |pool|, and writes them in order to |writer|.
+bool DecodeXzBlocks(const uint8_t* data,
+                    const std::vector<XzBlock>& blocks,
+                    WorkerPool* pool,
+                    size_t num_threads,
+                    ExtentWriter* writer) {
+  // Blocks are decoded by batches of one block per thread, and written once
+  // the whole batch is decoded.
+  num_threads = std::min({num_threads, pool->num_threads(), blocks.size()});
+  std::vector<brillo::Blob> outputs(num_threads);
+  for (size_t batch_start = 0; batch_start < blocks.size();
+       batch_start += num_threads) {
+    const size_t batch_size =
+        std::min(num_threads, blocks.size() - batch_start);
+    TEST_AND_RETURN_FALSE(pool->ParallelFor(batch_size, [&](size_t i) {
+      return DecodeXzBlock(data, blocks[batch_start + i], &outputs[i]);
+    }));
+    for (size_t i = 0; i < batch_size; i++) {
+      TEST_AND_RETURN_FALSE(
+          writer->Write(outputs[i].data(), outputs[i].size()));
+    }
+  }
+  return true;
+}
+
 }  // namespace
 
 XzExtentWriter::~XzExtentWriter() {
-  stream_.reset();
+  DecoderPool::Get()->ReleaseXzDecoder(
+      stream_.release(), kXzMaxDictSize, dict_size_);
   TEST_AND_RETURN(input_buffer_.empty());
 }
 
 bool XzExtentWriter::Init(const RepeatedPtrField<Extent>& extents,
                           uint32_t block_size) {
-  stream_.reset(xz_dec_init(XZ_DYNALLOC, kXzMaxDictSize));
+  stream_.reset(
+      DecoderPool::Get()->AcquireXzDecoder(kXzMaxDictSize, &dict_size_));
   TEST_AND_RETURN_FALSE(stream_ != nullptr);
   return underlying_writer_->Init(extents, block_size);
 }
 
 bool XzExtentWriter::Write(const void* bytes, size_t count) {
+  if (first_write_) {
+    first_write_ = false;
+    std::vector<XzBlock> blocks;
+    // Blocks can only be decoded independently with the whole stream at hand,
+    // which is the case when the operation data is written at once.
+    if (num_threads_ > 1 &&
+        ParseXzIndex(static_cast<const uint8_t*>(bytes), count, &blocks) &&
+        blocks.size() > 1 &&
+        std::all_of(blocks.begin(), blocks.end(), [](const XzBlock& block) {
+          return block.uncompressed_size <= kMaxParallelBlockSize;
+        })) {
+      decoded_in_parallel_ = true;
+      return DecodeXzBlocks(static_cast<const uint8_t*>(bytes),
+                            blocks,
+                            pool_,
+                            num_threads_,
+                            underlying_writer_.get());
+    }
+    // The dictionary the decoder may allocate for the stream, assuming the
+    // largest one when it's unknown.
+    uint32_t dict_size = kXzMaxDictSize;
+    ReadXzDictSize(static_cast<const uint8_t*>(bytes), count, &dict_size);
+    dict_size_ = std::max<size_t>(dict_size_, dict_size);
+  }
+  if (decoded_in_parallel_) {
+    LOG(ERROR) << "Unexpected data after the end of the xz stream.";
+    return false;
+  }
+
   // Copy the input data into |input_buffer_| only if |input_buffer_| already
   // contains unconsumed data. Otherwise, process the data directly from the
   // source.
@@ -81,10 +356,18 @@ bool XzExtentWriter::Write(const void* bytes, size_t count) {
   request.in_pos = 0;
   request.in_size = count;
 
-  brillo::Blob output_buffer(kOutputBufferLength);
-  request.out = output_buffer.data();
-  request.out_size = output_buffer.size();
+  DecoderPool::ScopedBuffer output_buffer(kOutputBufferLength);
   for (;;) {
+    // Decode in place when the underlying writer has a buffer.
+    size_t out_size = kMaxInPlaceOutputLength;
+    uint8_t* out = underlying_writer_->GetBuffer(&out_size);
+    const bool in_place = out != nullptr;
+    if (!in_place) {
+      out = output_buffer->data();
+      out_size = output_buffer->size();
+    }
+    request.out = out;
+    request.out_size = out_size;
     request.out_pos = 0;
 
     xz_ret ret = xz_dec_run(stream_.get(), &request);
@@ -97,13 +380,17 @@ bool XzExtentWriter::Write(const void* bytes, size_t count) {
       break;
 
     TEST_AND_RETURN_FALSE(
-        underlying_writer_->Write(output_buffer.data(), request.out_pos));
+        in_place ? underlying_writer_->CommitBuffer(request.out_pos)
+                 : underlying_writer_->Write(out, request.out_pos));
     if (ret == XZ_STREAM_END)
       CHECK_EQ(request.in_size, request.in_pos);
-    if (request.in_size == request.in_pos)
+    // A full buffer, possibly a small one in place, may leave decoded data
+    // behind even once the input is consumed.
+    if (ret == XZ_STREAM_END ||
+        (request.in_size == request.in_pos &&
+         request.out_pos < request.out_size))
       break;  // No more input to process.
   }
-  output_buffer.clear();
 
   // Store unconsumed data (if any) in |input_buffer_|. Since |input| can point
   // to the existing |input_buffer_| we create a new one before assigning it.
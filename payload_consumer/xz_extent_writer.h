@@ -25,6 +25,7 @@
 #include <brillo/secure_blob.h>
 
 #include "update_engine/payload_consumer/extent_writer.h"
+#include "update_engine/payload_consumer/worker_pool.h"
 
 // XzExtentWriter is a concrete ExtentWriter subclass that xz-decompresses
 // what it's given in Write using xz-embedded. Note that xz-embedded only
@@ -35,12 +36,21 @@ namespace chromeos_update_engine {
 
 class XzExtentWriter : public ExtentWriter {
   struct xz_deleter {
-    constexpr void operator()(xz_dec* p) { xz_dec_end(p); }
+    void operator()(xz_dec* p) { xz_dec_end(p); }
   };
 
  public:
   explicit XzExtentWriter(std::unique_ptr<ExtentWriter> underlying_writer)
-      : underlying_writer_(std::move(underlying_writer)) {}
+      : XzExtentWriter(std::move(underlying_writer), nullptr, 1) {}
+  // When the whole stream is passed to the first Write() and it is made of
+  // several blocks, the blocks are decoded on up to |num_threads| threads of
+  // |pool|, which must outlive this writer.
+  XzExtentWriter(std::unique_ptr<ExtentWriter> underlying_writer,
+                 WorkerPool* pool,
+                 size_t num_threads)
+      : underlying_writer_(std::move(underlying_writer)),
+        pool_(pool),
+        num_threads_(pool ? num_threads : 1) {}
   ~XzExtentWriter() override;
 
   bool Init(const google::protobuf::RepeatedPtrField<Extent>& extents,
@@ -52,7 +62,14 @@ class XzExtentWriter : public ExtentWriter {
   std::unique_ptr<ExtentWriter> underlying_writer_;
   // The opaque xz decompressor struct.
   std::unique_ptr<xz_dec, xz_deleter> stream_{nullptr};
+  // The most memory the dictionary of |stream_| may hold, for DecoderPool.
+  size_t dict_size_{0};
   brillo::Blob input_buffer_;
+  WorkerPool* pool_;
+  size_t num_threads_;
+  bool first_write_{true};
+  // Whether the whole stream was decoded by blocks in the first Write().
+  bool decoded_in_parallel_{false};
 
   DISALLOW_COPY_AND_ASSIGN(XzExtentWriter);
 };
@@ -77,6 +77,26 @@ const uint8_t kCompressed30KiBofA[] = {
     0x02, 0x00, 0x00, 0x00, 0x00, 0x01, 0x59, 0x5a,
 };
 
+// Three blocks of 1 KiB, of 'A', 'B' and 'C', generated with:
+// for c in A B C; do printf "%1024s" | tr ' ' $c; done |
+// xz --check=none --block-size=1024 --lzma2=preset=9,dict=4KiB |
+// hexdump -v -e '"    " 12/1 "0x%02x, " "\n"'
+const uint8_t kCompressedMultiBlock[] = {
+    0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x00, 0xff, 0x12, 0xd9, 0x41,
+    0x03, 0xc0, 0x13, 0x80, 0x08, 0x21, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x73, 0xf8, 0x5d, 0x76, 0xe0, 0x03, 0xff, 0x00, 0x0b, 0x5d, 0x00, 0x20,
+    0xef, 0xfb, 0xbf, 0xfe, 0xa3, 0xb0, 0xde, 0xe0, 0x72, 0x00, 0x00, 0x00,
+    0x03, 0xc0, 0x13, 0x80, 0x08, 0x21, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x73, 0xf8, 0x5d, 0x76, 0xe0, 0x03, 0xff, 0x00, 0x0b, 0x5d, 0x00, 0x21,
+    0x6f, 0xfb, 0xbf, 0xfe, 0xa3, 0xb0, 0xde, 0xe0, 0x72, 0x00, 0x00, 0x00,
+    0x03, 0xc0, 0x13, 0x80, 0x08, 0x21, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x73, 0xf8, 0x5d, 0x76, 0xe0, 0x03, 0xff, 0x00, 0x0b, 0x5d, 0x00, 0x21,
+    0xef, 0xfb, 0xbf, 0xfe, 0xa3, 0xb0, 0xde, 0xe0, 0x72, 0x00, 0x00, 0x00,
+    0x00, 0x03, 0x23, 0x80, 0x08, 0x23, 0x80, 0x08, 0x23, 0x80, 0x08, 0x00,
+    0x07, 0xee, 0x13, 0xb8, 0x0d, 0xd3, 0x56, 0x37, 0x03, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x59, 0x5a,
+};
+
 }  // namespace
 
 class XzExtentWriterTest : public ::testing::Test {
@@ -93,6 +113,8 @@ class XzExtentWriterTest : public ::testing::Test {
     EXPECT_TRUE(fake_extent_writer_->InitCalled());
   }
 
+  // Runs the decoding of the writers decoding blocks in parallel.
+  WorkerPool pool_{2};
   // Owned by |xz_writer_|. This object is invalidated after |xz_writer_| is
   // deleted.
   FakeExtentWriter* fake_extent_writer_{nullptr};
@@ -148,4 +170,46 @@ TEST_F(XzExtentWriterTest, PartialDataIsKept) {
   EXPECT_EQ(expected_data, fake_extent_writer_->WrittenData());
 }
 
+TEST_F(XzExtentWriterTest, MultiBlockDataDecodedInParallel) {
+  fake_extent_writer_ = new FakeExtentWriter();
+  xz_writer_.reset(
+      new XzExtentWriter(base::WrapUnique(fake_extent_writer_), &pool_, 2));
+  brillo::Blob compressed(std::begin(kCompressedMultiBlock),
+                          std::end(kCompressedMultiBlock));
+  WriteAll(compressed);
+  brillo::Blob expected_data;
+  for (char c : {'A', 'B', 'C'}) {
+    expected_data.insert(expected_data.end(), 1024, c);
+  }
+  EXPECT_EQ(expected_data, fake_extent_writer_->WrittenData());
+  // The stream was complete, nothing can follow it.
+  EXPECT_FALSE(xz_writer_->Write(compressed.data(), compressed.size()));
+}
+
+TEST_F(XzExtentWriterTest, CorruptedMultiBlockDataRejected) {
+  fake_extent_writer_ = new FakeExtentWriter();
+  xz_writer_.reset(
+      new XzExtentWriter(base::WrapUnique(fake_extent_writer_), &pool_, 2));
+  brillo::Blob compressed(std::begin(kCompressedMultiBlock),
+                          std::end(kCompressedMultiBlock));
+  // Flip a byte of the compressed data of the second block.
+  compressed[60] ^= 0xFF;
+  EXPECT_TRUE(xz_writer_->Init({}, 1024));
+  EXPECT_FALSE(xz_writer_->Write(compressed.data(), compressed.size()));
+}
+
+TEST_F(XzExtentWriterTest, PartialMultiBlockDataDecodedSerially) {
+  fake_extent_writer_ = new FakeExtentWriter();
+  xz_writer_.reset(
+      new XzExtentWriter(base::WrapUnique(fake_extent_writer_), &pool_, 2));
+  brillo::Blob compressed(std::begin(kCompressedMultiBlock),
+                          std::end(kCompressedMultiBlock));
+  EXPECT_TRUE(xz_writer_->Init({}, 1024));
+  const size_t half = compressed.size() / 2;
+  EXPECT_TRUE(xz_writer_->Write(compressed.data(), half));
+  EXPECT_TRUE(
+      xz_writer_->Write(compressed.data() + half, compressed.size() - half));
+  EXPECT_EQ(3 * 1024U, fake_extent_writer_->WrittenData().size());
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,207 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/zstd_extent_writer.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "update_engine/common/utils.h"
+
+using google::protobuf::RepeatedPtrField;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Frames larger than this are decoded serially, to bound the memory used by
+// the decoding threads.
+constexpr uint64_t kMaxParallelFrameSize = 16 * 1024 * 1024;
+
+// A frame of the zstd data, found from the frame headers.
+struct ZstdFrame {
+  // Offset and size of the compressed frame in the data.
+  size_t offset;
+  size_t compressed_size;
+  uint64_t content_size;
+};
+
+// Splits the zstd data in |data| into its |frames|. Returns false if |data|
+// isn't a sequence of complete frames which all record their content size.
+bool FindZstdFrames(const uint8_t* data,
+                    size_t size,
+                    std::vector<ZstdFrame>* frames) {
+  frames->clear();
+  size_t offset = 0;
+  while (offset < size) {
+    const size_t compressed_size =
+        ZSTD_findFrameCompressedSize(data + offset, size - offset);
+    if (ZSTD_isError(compressed_size))
+      return false;
+    const uint64_t content_size =
+        ZSTD_getFrameContentSize(data + offset, size - offset);
+    if (content_size == ZSTD_CONTENTSIZE_UNKNOWN ||
+        content_size == ZSTD_CONTENTSIZE_ERROR) {
+      return false;
+    }
+    frames->push_back({offset, compressed_size, content_size});
+    offset += compressed_size;
+  }
+  return true;
+}
+
+// Decodes |frame| of the zstd data in |data| into |output|, with |dictionary|
+// unless it's null.
+bool DecodeZstdFrame(const uint8_t* data,
+                     const ZstdFrame& frame,
+                     const ZSTD_DDict* dictionary,
+                     brillo::Blob* output) {
+  std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx(ZSTD_createDCtx(),
+                                                            ZSTD_freeDCtx);
+  TEST_AND_RETURN_FALSE(dctx != nullptr);
+  output->resize(frame.content_size);
+  size_t size;
+  if (dictionary) {
+    size = ZSTD_decompress_usingDDict(dctx.get(),
+                                      output->data(),
+                                      output->size(),
+                                      data + frame.offset,
+                                      frame.compressed_size,
+                                      dictionary);
+  } else {
+    size = ZSTD_decompressDCtx(dctx.get(),
+                               output->data(),
+                               output->size(),
+                               data + frame.offset,
+                               frame.compressed_size);
+  }
+  if (ZSTD_isError(size)) {
+    LOG(ERROR) << "zstd decompression of the frame at offset " << frame.offset
+               << " failed: " << ZSTD_getErrorName(size);
+    return false;
+  }
+  TEST_AND_RETURN_FALSE(size == output->size());
+  return true;
+}
+
+// Decodes |frames| of the zstd data in |data| on up to |num_threads| threads
+// of |pool|, and writes them in order to |writer|.
+bool DecodeZstdFrames(const uint8_t* data,
+                      const std::vector<ZstdFrame>& frames,
+                      const ZSTD_DDict* dictionary,
+                      WorkerPool* pool,
+                      size_t num_threads,
+                      ExtentWriter* writer) {
+  // Frames are decoded by batches of one frame per thread, and written once
+  // the whole batch is decoded.
+  num_threads = std::min({num_threads, pool->num_threads(), frames.size()});
+  std::vector<brillo::Blob> outputs(num_threads);
+  for (size_t batch_start = 0; batch_start < frames.size();
+       batch_start += num_threads) {
+    const size_t batch_size =
+        std::min(num_threads, frames.size() - batch_start);
+    TEST_AND_RETURN_FALSE(pool->ParallelFor(batch_size, [&](size_t i) {
+      return DecodeZstdFrame(
+          data, frames[batch_start + i], dictionary, &outputs[i]);
+    }));
+    for (size_t i = 0; i < batch_size; i++) {
+      TEST_AND_RETURN_FALSE(
+          writer->Write(outputs[i].data(), outputs[i].size()));
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+ZstdExtentWriter::~ZstdExtentWriter() {
+  TEST_AND_RETURN(frame_complete_);
+}
+
+bool ZstdExtentWriter::Init(const RepeatedPtrField<Extent>& extents,
+                            uint32_t block_size) {
+  dctx_.reset(ZSTD_createDCtx());
+  TEST_AND_RETURN_FALSE(dctx_ != nullptr);
+  if (dictionary_) {
+    size_t rc = ZSTD_DCtx_refDDict(dctx_.get(), dictionary_);
+    if (ZSTD_isError(rc)) {
+      LOG(ERROR) << "Failed to set the zstd dictionary: "
+                 << ZSTD_getErrorName(rc);
+      return false;
+    }
+  }
+  output_buffer_.resize(ZSTD_DStreamOutSize());
+  return next_->Init(extents, block_size);
+}
+
+bool ZstdExtentWriter::Write(const void* bytes, size_t count) {
+  if (first_write_) {
+    first_write_ = false;
+    std::vector<ZstdFrame> frames;
+    // Frames can only be decoded independently with the whole data at hand,
+    // which is the case when the operation data is written at once.
+    if (num_threads_ > 1 &&
+        FindZstdFrames(static_cast<const uint8_t*>(bytes), count, &frames) &&
+        frames.size() > 1 &&
+        std::all_of(frames.begin(), frames.end(), [](const ZstdFrame& frame) {
+          return frame.content_size <= kMaxParallelFrameSize;
+        })) {
+      decoded_in_parallel_ = true;
+      return DecodeZstdFrames(static_cast<const uint8_t*>(bytes),
+                              frames,
+                              dictionary_,
+                              pool_,
+                              num_threads_,
+                              next_.get());
+    }
+  }
+  if (decoded_in_parallel_) {
+    LOG(ERROR) << "Unexpected data after the last zstd frame.";
+    return false;
+  }
+
+  ZSTD_inBuffer input = {bytes, count, 0};
+  // Keep going while there is input left, or while the output buffer was
+  // filled up, as the decoder may still hold decompressed data then.
+  bool output_full = false;
+  while (input.pos < input.size || output_full) {
+    // Decode in place when the next writer has a buffer.
+    size_t out_size = output_buffer_.size();
+    uint8_t* out = next_->GetBuffer(&out_size);
+    const bool in_place = out != nullptr;
+    if (!in_place) {
+      out = output_buffer_.data();
+      out_size = output_buffer_.size();
+    }
+    ZSTD_outBuffer output = {out, out_size, 0};
+    size_t rc = ZSTD_decompressStream(dctx_.get(), &output, &input);
+    if (ZSTD_isError(rc)) {
+      LOG(ERROR) << "zstd decompression failed: " << ZSTD_getErrorName(rc);
+      return false;
+    }
+    frame_complete_ = rc == 0;
+    output_full = output.pos == output.size;
+    if (output.pos > 0)
+      TEST_AND_RETURN_FALSE(in_place ? next_->CommitBuffer(output.pos)
+                                     : next_->Write(out, output.pos));
+    else if (input.pos == input.size)
+      break;
+  }
+  return true;
+}
+
+}  // namespace chromeos_update_engine
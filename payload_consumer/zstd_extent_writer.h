@@ -0,0 +1,83 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_ZSTD_EXTENT_WRITER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_ZSTD_EXTENT_WRITER_H_
+
+#include <zstd.h>
+
+#include <memory>
+#include <utility>
+
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_consumer/extent_writer.h"
+#include "update_engine/payload_consumer/worker_pool.h"
+
+// ZstdExtentWriter is a concrete ExtentWriter subclass that zstd-decompresses
+// what it's given in Write, optionally with the dictionary of the partition.
+// The data may be made of several independent frames, which are seekable by
+// their headers. It passes the decompressed data to an underlying
+// ExtentWriter.
+
+namespace chromeos_update_engine {
+
+class ZstdExtentWriter : public ExtentWriter {
+  struct dctx_deleter {
+    void operator()(ZSTD_DCtx* p) { ZSTD_freeDCtx(p); }
+  };
+
+ public:
+  explicit ZstdExtentWriter(std::unique_ptr<ExtentWriter> next)
+      : ZstdExtentWriter(std::move(next), nullptr) {}
+  // |dictionary| may be null, and must outlive this writer otherwise.
+  ZstdExtentWriter(std::unique_ptr<ExtentWriter> next,
+                   const ZSTD_DDict* dictionary)
+      : ZstdExtentWriter(std::move(next), dictionary, nullptr, 1) {}
+  // When the whole data is passed to the first Write() and it is made of
+  // several frames, the frames are decoded on up to |num_threads| threads of
+  // |pool|, which must outlive this writer.
+  ZstdExtentWriter(std::unique_ptr<ExtentWriter> next,
+                   const ZSTD_DDict* dictionary,
+                   WorkerPool* pool,
+                   size_t num_threads)
+      : next_(std::move(next)),
+        dictionary_(dictionary),
+        pool_(pool),
+        num_threads_(pool ? num_threads : 1) {}
+  ~ZstdExtentWriter() override;
+
+  bool Init(const google::protobuf::RepeatedPtrField<Extent>& extents,
+            uint32_t block_size) override;
+  bool Write(const void* bytes, size_t count) override;
+
+ private:
+  std::unique_ptr<ExtentWriter> next_;  // The underlying ExtentWriter.
+  const ZSTD_DDict* dictionary_;
+  std::unique_ptr<ZSTD_DCtx, dctx_deleter> dctx_;
+  brillo::Blob output_buffer_;
+  // Whether the end of the last frame passed to Write() was reached.
+  bool frame_complete_{true};
+  WorkerPool* pool_;
+  size_t num_threads_;
+  bool first_write_{true};
+  // Whether the whole data was decoded by frames in the first Write().
+  bool decoded_in_parallel_{false};
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_ZSTD_EXTENT_WRITER_H_
@@ -0,0 +1,156 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/zstd_extent_writer.h"
+
+#include <fcntl.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+using std::min;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+brillo::Blob Compress(const brillo::Blob& data,
+                      const brillo::Blob& dictionary) {
+  brillo::Blob out(ZSTD_compressBound(data.size()));
+  std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx(ZSTD_createCCtx(),
+                                                            ZSTD_freeCCtx);
+  size_t size = ZSTD_compress_usingDict(cctx.get(),
+                                        out.data(),
+                                        out.size(),
+                                        data.data(),
+                                        data.size(),
+                                        dictionary.data(),
+                                        dictionary.size(),
+                                        3);
+  EXPECT_FALSE(ZSTD_isError(size));
+  out.resize(ZSTD_isError(size) ? 0 : size);
+  return out;
+}
+
+}  // namespace
+
+class ZstdExtentWriterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    fd_.reset(new EintrSafeFileDescriptor);
+    ASSERT_TRUE(fd_->Open(temp_file_.path().c_str(), O_RDWR, 0600));
+    // Larger than the output buffer of the decoder.
+    data_.resize(800 * 1024);
+    for (size_t i = 0; i < data_.size(); ++i)
+      data_[i] = static_cast<uint8_t>("ABC\n"[i % 4] + i / 4096 % 7);
+  }
+  void TearDown() override { fd_->Close(); }
+
+  void ExpectOutput() {
+    brillo::Blob output;
+    EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &output));
+    EXPECT_EQ(data_.size(), output.size());
+    test_utils::ExpectVectorsEq(data_, output);
+  }
+
+  FileDescriptorPtr fd_;
+  ScopedTempFile temp_file_{"ZstdExtentWriterTest-file.XXXXXX"};
+  brillo::Blob data_;
+};
+
+TEST_F(ZstdExtentWriterTest, SimpleTest) {
+  brillo::Blob compressed = Compress(data_, {});
+  vector<Extent> extents = {ExtentForBytes(kBlockSize, 0, data_.size())};
+
+  ZstdExtentWriter zstd_writer(std::make_unique<DirectExtentWriter>(fd_));
+  EXPECT_TRUE(zstd_writer.Init({extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(zstd_writer.Write(compressed.data(), compressed.size()));
+  ExpectOutput();
+}
+
+TEST_F(ZstdExtentWriterTest, ChunkedTest) {
+  brillo::Blob compressed = Compress(data_, {});
+  vector<Extent> extents = {ExtentForBytes(kBlockSize, 0, data_.size())};
+  const size_t kChunkSize = 3;
+
+  ZstdExtentWriter zstd_writer(std::make_unique<DirectExtentWriter>(fd_));
+  EXPECT_TRUE(zstd_writer.Init({extents.begin(), extents.end()}, kBlockSize));
+  for (size_t i = 0; i < compressed.size(); i += kChunkSize) {
+    size_t this_chunk_size = min(kChunkSize, compressed.size() - i);
+    EXPECT_TRUE(zstd_writer.Write(&compressed[i], this_chunk_size));
+  }
+  ExpectOutput();
+}
+
+TEST_F(ZstdExtentWriterTest, DictionaryTest) {
+  // A raw content dictionary made of the start of the data.
+  brillo::Blob dictionary(data_.begin(), data_.begin() + 16 * 1024);
+  brillo::Blob compressed = Compress(data_, dictionary);
+  vector<Extent> extents = {ExtentForBytes(kBlockSize, 0, data_.size())};
+
+  std::unique_ptr<ZSTD_DDict, decltype(&ZSTD_freeDDict)> ddict(
+      ZSTD_createDDict(dictionary.data(), dictionary.size()), ZSTD_freeDDict);
+  ASSERT_NE(nullptr, ddict);
+  ZstdExtentWriter zstd_writer(std::make_unique<DirectExtentWriter>(fd_),
+                               ddict.get());
+  EXPECT_TRUE(zstd_writer.Init({extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(zstd_writer.Write(compressed.data(), compressed.size()));
+  ExpectOutput();
+}
+
+TEST_F(ZstdExtentWriterTest, ParallelFramesTest) {
+  // Independent frames of 64 KiB, decoded on several threads.
+  const size_t kFrameSize = 64 * 1024;
+  brillo::Blob compressed;
+  for (size_t i = 0; i < data_.size(); i += kFrameSize) {
+    brillo::Blob frame(data_.begin() + i,
+                       data_.begin() + min(i + kFrameSize, data_.size()));
+    brillo::Blob compressed_frame = Compress(frame, {});
+    compressed.insert(
+        compressed.end(), compressed_frame.begin(), compressed_frame.end());
+  }
+  vector<Extent> extents = {ExtentForBytes(kBlockSize, 0, data_.size())};
+
+  WorkerPool pool(4);
+  ZstdExtentWriter zstd_writer(
+      std::make_unique<DirectExtentWriter>(fd_), nullptr, &pool, 4);
+  EXPECT_TRUE(zstd_writer.Init({extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_TRUE(zstd_writer.Write(compressed.data(), compressed.size()));
+  ExpectOutput();
+}
+
+TEST_F(ZstdExtentWriterTest, CorruptDataTest) {
+  brillo::Blob compressed = Compress(data_, {});
+  compressed[compressed.size() / 2] ^= 0xff;
+  compressed[0] ^= 0xff;
+  vector<Extent> extents = {ExtentForBytes(kBlockSize, 0, data_.size())};
+
+  ZstdExtentWriter zstd_writer(std::make_unique<DirectExtentWriter>(fd_));
+  EXPECT_TRUE(zstd_writer.Init({extents.begin(), extents.end()}, kBlockSize));
+  EXPECT_FALSE(zstd_writer.Write(compressed.data(), compressed.size()));
+}
+
+}  // namespace chromeos_update_engine
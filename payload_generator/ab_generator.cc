@@ -17,6 +17,10 @@
 #include "update_engine/payload_generator/ab_generator.h"
 
 #include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <string_view>
 #include <utility>
 
 #include <base/strings/stringprintf.h>
@@ -27,6 +31,8 @@
 #include "update_engine/payload_generator/annotated_operation.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/mapped_partition.h"
+#include "update_engine/payload_generator/task_pool.h"
 
 using chromeos_update_engine::diff_utils::IsAReplaceOperation;
 using std::string;
@@ -81,6 +87,11 @@ bool ABGenerator::GenerateOperations(const PayloadGenerationConfig& config,
 void ABGenerator::SortOperationsByDestination(
     vector<AnnotatedOperation>* aops) {
   sort(aops->begin(), aops->end(), diff_utils::CompareAopsByDestination);
+  // The TARGET_COPY operations read blocks written by the others.
+  std::stable_partition(
+      aops->begin(), aops->end(), [](const AnnotatedOperation& aop) {
+        return aop.op.type() != InstallOperation::TARGET_COPY;
+      });
 }
 
 bool ABGenerator::FragmentOperations(const PayloadVersion& version,
@@ -88,7 +99,8 @@ bool ABGenerator::FragmentOperations(const PayloadVersion& version,
                                      const string& target_part_path,
                                      BlobFileWriter* blob_file) {
   vector<AnnotatedOperation> fragmented_aops;
-  for (const AnnotatedOperation& aop : *aops) {
+  fragmented_aops.reserve(aops->size());
+  for (AnnotatedOperation& aop : *aops) {
     // Only do split if the operation has more than one dst extents.
     if (aop.op.dst_extents_size() > 1) {
       if (aop.op.type() == InstallOperation::SOURCE_COPY) {
@@ -101,7 +113,7 @@ bool ABGenerator::FragmentOperations(const PayloadVersion& version,
         continue;
       }
     }
-    fragmented_aops.push_back(aop);
+    fragmented_aops.push_back(std::move(aop));
   }
   *aops = std::move(fragmented_aops);
   return true;
@@ -109,7 +121,7 @@ bool ABGenerator::FragmentOperations(const PayloadVersion& version,
 
 bool ABGenerator::SplitSourceCopy(const AnnotatedOperation& original_aop,
                                   vector<AnnotatedOperation>* result_aops) {
-  InstallOperation original_op = original_aop.op;
+  const InstallOperation& original_op = original_aop.op;
   TEST_AND_RETURN_FALSE(original_op.type() == InstallOperation::SOURCE_COPY);
   // Keeps track of the index of curr_src_ext.
   int curr_src_ext_index = 0;
@@ -117,7 +129,8 @@ bool ABGenerator::SplitSourceCopy(const AnnotatedOperation& original_aop,
   for (int i = 0; i < original_op.dst_extents_size(); i++) {
     const Extent& dst_ext = original_op.dst_extents(i);
     // The new operation which will have only one dst extent.
-    InstallOperation new_op;
+    AnnotatedOperation& new_aop = result_aops->emplace_back();
+    InstallOperation& new_op = new_aop.op;
     uint64_t blocks_left = dst_ext.num_blocks();
     while (blocks_left > 0) {
       if (curr_src_ext.num_blocks() <= blocks_left) {
@@ -144,11 +157,7 @@ bool ABGenerator::SplitSourceCopy(const AnnotatedOperation& original_aop,
     // Fix up our new operation and add it to the results.
     new_op.set_type(InstallOperation::SOURCE_COPY);
     *(new_op.add_dst_extents()) = dst_ext;
-
-    AnnotatedOperation new_aop;
-    new_aop.op = new_op;
     new_aop.name = base::StringPrintf("%s:%d", original_aop.name.c_str(), i);
-    result_aops->push_back(new_aop);
   }
   if (curr_src_ext_index != original_op.src_extents().size() - 1) {
     LOG(FATAL) << "Incorrectly split SOURCE_COPY operation. Did not use all "
@@ -162,15 +171,17 @@ bool ABGenerator::SplitAReplaceOp(const PayloadVersion& version,
                                   const string& target_part_path,
                                   vector<AnnotatedOperation>* result_aops,
                                   BlobFileWriter* blob_file) {
-  InstallOperation original_op = original_aop.op;
+  const InstallOperation& original_op = original_aop.op;
   TEST_AND_RETURN_FALSE(IsAReplaceOperation(original_op.type()));
   const bool is_replace = original_op.type() == InstallOperation::REPLACE;
 
   uint64_t data_offset = original_op.data_offset();
+  vector<AnnotatedOperation> new_aops(original_op.dst_extents_size());
   for (int i = 0; i < original_op.dst_extents_size(); i++) {
     const Extent& dst_ext = original_op.dst_extents(i);
     // Make a new operation with only one dst extent.
-    InstallOperation new_op;
+    AnnotatedOperation& new_aop = new_aops[i];
+    InstallOperation& new_op = new_aop.op;
     *(new_op.add_dst_extents()) = dst_ext;
     uint64_t data_size = dst_ext.num_blocks() * kBlockSize;
     // If this is a REPLACE, attempt to reuse portions of the existing blob.
@@ -180,15 +191,25 @@ bool ABGenerator::SplitAReplaceOp(const PayloadVersion& version,
       new_op.set_data_offset(data_offset);
       data_offset += data_size;
     }
-
-    AnnotatedOperation new_aop;
-    new_aop.op = new_op;
     new_aop.name = base::StringPrintf("%s:%d", original_aop.name.c_str(), i);
-    TEST_AND_RETURN_FALSE(
-        AddDataAndSetType(&new_aop, version, target_part_path, blob_file));
+  }
 
-    result_aops->push_back(new_aop);
+  // The fragments are read and compressed in parallel.
+  std::atomic<bool> success{true};
+  vector<TaskPool::Task> tasks;
+  for (AnnotatedOperation& new_aop : new_aops) {
+    tasks.push_back(
+        [&new_aop, &version, &target_part_path, blob_file, &success] {
+          if (!AddDataAndSetType(
+                  &new_aop, version, target_part_path, blob_file)) {
+            success = false;
+          }
+        });
   }
+  TaskPool::RunTasks(std::move(tasks), diff_utils::GetMaxThreads());
+  TEST_AND_RETURN_FALSE(success);
+
+  std::move(new_aops.begin(), new_aops.end(), std::back_inserter(*result_aops));
   return true;
 }
 
@@ -198,9 +219,12 @@ bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
                                   const string& target_part_path,
                                   BlobFileWriter* blob_file) {
   vector<AnnotatedOperation> new_aops;
-  for (const AnnotatedOperation& curr_aop : *aops) {
+  // The indices in |new_aops| of the merged REPLACE/REPLACE_BZ/REPLACE_XZ
+  // operations whose blob must be generated again.
+  vector<size_t> merged_replace_indices;
+  for (AnnotatedOperation& curr_aop : *aops) {
     if (new_aops.empty()) {
-      new_aops.push_back(curr_aop);
+      new_aops.push_back(std::move(curr_aop));
       continue;
     }
     AnnotatedOperation& last_aop = new_aops.back();
@@ -208,7 +232,7 @@ bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
 
     if (last_aop.op.dst_extents_size() <= 0 ||
         curr_aop.op.dst_extents_size() <= 0) {
-      new_aops.push_back(curr_aop);
+      new_aops.push_back(std::move(curr_aop));
       continue;
     }
     uint32_t last_dst_idx = last_aop.op.dst_extents_size() - 1;
@@ -221,7 +245,8 @@ bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
         curr_aop.op.dst_extents(0).num_blocks();
     bool is_a_replace = IsAReplaceOperation(curr_aop.op.type());
 
-    bool is_delta_op = curr_aop.op.type() == InstallOperation::SOURCE_COPY;
+    bool is_delta_op = curr_aop.op.type() == InstallOperation::SOURCE_COPY ||
+                       curr_aop.op.type() == InstallOperation::TARGET_COPY;
     if (((is_delta_op && (last_aop.op.type() == curr_aop.op.type())) ||
          (is_a_replace && last_is_a_replace)) &&
         last_end_block == curr_start_block &&
@@ -230,8 +255,8 @@ bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
       // merge), are contiguous, are fragmented to have one destination extent,
       // and their combined block count would be less than chunk size, merge
       // them.
-      last_aop.name = base::StringPrintf(
-          "%s,%s", last_aop.name.c_str(), curr_aop.name.c_str());
+      last_aop.name += ",";
+      last_aop.name += curr_aop.name;
 
       if (is_delta_op) {
         ExtendExtents(last_aop.op.mutable_src_extents(),
@@ -239,26 +264,52 @@ bool ABGenerator::MergeOperations(vector<AnnotatedOperation>* aops,
       }
       ExtendExtents(last_aop.op.mutable_dst_extents(),
                     curr_aop.op.dst_extents());
-      // Set the data length to zero so we know to add the blob later.
-      if (is_a_replace)
-        last_aop.op.set_data_length(0);
+      if (is_a_replace) {
+        if (merged_replace_indices.empty() ||
+            merged_replace_indices.back() != new_aops.size() - 1) {
+          merged_replace_indices.push_back(new_aops.size() - 1);
+        }
+        // Uncompressed blobs which follow each other in |blob_file|, like the
+        // fragments of a REPLACE operation, already hold the data of the
+        // merged operation. AddDataAndSetType() only writes it again if it
+        // compresses.
+        if (last_aop.op.type() == InstallOperation::REPLACE &&
+            curr_aop.op.type() == InstallOperation::REPLACE &&
+            last_aop.op.data_length() > 0 && curr_aop.op.data_length() > 0 &&
+            last_aop.op.data_offset() + last_aop.op.data_length() ==
+                curr_aop.op.data_offset()) {
+          last_aop.op.set_data_length(last_aop.op.data_length() +
+                                      curr_aop.op.data_length());
+        } else {
+          // Set the data length to zero so we know to add the blob later.
+          last_aop.op.set_data_length(0);
+        }
+        last_aop.op.clear_data_sha256_hash();
+      }
     } else {
       // Otherwise just include the extent as is.
-      new_aops.push_back(curr_aop);
+      new_aops.push_back(std::move(curr_aop));
     }
   }
 
   // Set the blobs for REPLACE/REPLACE_BZ/REPLACE_XZ operations that have been
-  // merged.
-  for (AnnotatedOperation& curr_aop : new_aops) {
-    if (curr_aop.op.data_length() == 0 &&
-        IsAReplaceOperation(curr_aop.op.type())) {
-      TEST_AND_RETURN_FALSE(
-          AddDataAndSetType(&curr_aop, version, target_part_path, blob_file));
-    }
+  // merged. They are read and compressed in parallel.
+  std::atomic<bool> success{true};
+  vector<TaskPool::Task> tasks;
+  for (size_t index : merged_replace_indices) {
+    AnnotatedOperation* curr_aop = &new_aops[index];
+    tasks.push_back(
+        [curr_aop, &version, &target_part_path, blob_file, &success] {
+          if (!AddDataAndSetType(
+                  curr_aop, version, target_part_path, blob_file)) {
+            success = false;
+          }
+        });
   }
+  TaskPool::RunTasks(std::move(tasks), diff_utils::GetMaxThreads());
+  TEST_AND_RETURN_FALSE(success);
 
-  *aops = new_aops;
+  *aops = std::move(new_aops);
   return true;
 }
 
@@ -270,14 +321,14 @@ bool ABGenerator::AddDataAndSetType(AnnotatedOperation* aop,
 
   vector<Extent> dst_extents;
   ExtentsToVector(aop->op.dst_extents(), &dst_extents);
-  brillo::Blob data(utils::BlocksInExtents(dst_extents) * kBlockSize);
-  TEST_AND_RETURN_FALSE(utils::ReadExtents(
-      target_part_path, dst_extents, &data, data.size(), kBlockSize));
+  brillo::Blob data;
+  TEST_AND_RETURN_FALSE(
+      MappedPartitions::ReadExtents(target_part_path, dst_extents, &data));
 
   brillo::Blob blob;
   InstallOperation::Type op_type;
-  TEST_AND_RETURN_FALSE(
-      diff_utils::GenerateBestFullOperation(data, version, &blob, &op_type));
+  TEST_AND_RETURN_FALSE(diff_utils::GenerateBestFullOperation(
+      data, target_part_path, version, &blob, &op_type));
 
   // If the operation doesn't point to a data blob or points to a data blob of
   // a different type then we add it.
@@ -289,25 +340,97 @@ bool ABGenerator::AddDataAndSetType(AnnotatedOperation* aop,
   return true;
 }
 
+namespace {
+
+// The number of bytes of the source of |op|.
+uint64_t SourceLength(const InstallOperation& op) {
+  return op.has_src_length()
+             ? op.src_length()
+             : utils::BlocksInExtents(op.src_extents()) * kBlockSize;
+}
+
+// Reads the source of the operations of |batch| from |source_part|, or from
+// |source_part_path| if it isn't mapped, and sets their source hash.
+bool HashSourceBatch(const vector<AnnotatedOperation*>& batch,
+                     const MappedPartition* source_part,
+                     const string& source_part_path) {
+  vector<brillo::Blob> batch_data(batch.size());
+  vector<std::string_view> inputs(batch.size());
+  for (size_t i = 0; i < batch.size(); i++) {
+    const InstallOperation& op = batch[i]->op;
+    vector<Extent> src_extents;
+    ExtentsToVector(op.src_extents(), &src_extents);
+    if (source_part) {
+      TEST_AND_RETURN_FALSE(source_part->GetExtents(
+          src_extents, SourceLength(op), &batch_data[i], &inputs[i]));
+      continue;
+    }
+    TEST_AND_RETURN_FALSE(utils::ReadExtents(source_part_path,
+                                             src_extents,
+                                             &batch_data[i],
+                                             SourceLength(op),
+                                             kBlockSize));
+    inputs[i] = ToStringView(batch_data[i]);
+  }
+  vector<brillo::Blob> src_hashes;
+  TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfBatch(inputs, &src_hashes));
+  for (size_t i = 0; i < batch.size(); i++) {
+    batch[i]->op.set_src_sha256_hash(src_hashes[i].data(),
+                                     src_hashes[i].size());
+  }
+  return true;
+}
+
+}  // namespace
+
 bool ABGenerator::AddSourceHash(vector<AnnotatedOperation>* aops,
                                 const string& source_part_path) {
+  // The source data is hashed in batches, so that the hashes of several
+  // operations are computed at once when the CPU supports it. The batches are
+  // read and hashed in parallel on the TaskPool.
+  constexpr size_t kMaxBatchOperations = 64;
+  constexpr uint64_t kMaxBatchBytes = 32 * 1024 * 1024;
+
+  vector<vector<AnnotatedOperation*>> batches(1);
+  uint64_t batch_bytes = 0;
   for (AnnotatedOperation& aop : *aops) {
-    if (aop.op.src_extents_size() == 0)
+    // The source of TARGET_COPY operations is the target partition.
+    if (aop.op.src_extents_size() == 0 ||
+        aop.op.type() == InstallOperation::TARGET_COPY)
       continue;
+    batches.back().push_back(&aop);
+    batch_bytes += SourceLength(aop.op);
+    if (batches.back().size() == kMaxBatchOperations ||
+        batch_bytes >= kMaxBatchBytes) {
+      batches.emplace_back();
+      batch_bytes = 0;
+    }
+  }
 
-    vector<Extent> src_extents;
-    ExtentsToVector(aop.op.src_extents(), &src_extents);
-    brillo::Blob src_data, src_hash;
-    uint64_t src_length =
-        aop.op.has_src_length()
-            ? aop.op.src_length()
-            : utils::BlocksInExtents(aop.op.src_extents()) * kBlockSize;
-    TEST_AND_RETURN_FALSE(utils::ReadExtents(
-        source_part_path, src_extents, &src_data, src_length, kBlockSize));
-    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(src_data, &src_hash));
-    aop.op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+  // The source partition is mapped for this pass if it isn't for the whole
+  // generation.
+  MappedPartitions* partitions = MappedPartitions::Get();
+  const MappedPartition* source_part =
+      partitions ? partitions->Find(source_part_path) : nullptr;
+  std::unique_ptr<MappedPartition> mapped_source_part;
+  if (!source_part) {
+    mapped_source_part = MappedPartition::Map(source_part_path);
+    source_part = mapped_source_part.get();
   }
-  return true;
+
+  std::atomic<bool> success{true};
+  vector<TaskPool::Task> tasks;
+  for (const auto& batch : batches) {
+    if (batch.empty())
+      continue;
+    tasks.push_back([&batch, source_part, &source_part_path, &success] {
+      if (!HashSourceBatch(batch, source_part, source_part_path)) {
+        success = false;
+      }
+    });
+  }
+  TaskPool::RunTasks(std::move(tasks), diff_utils::GetMaxThreads());
+  return success;
 }
 
 }  // namespace chromeos_update_engine
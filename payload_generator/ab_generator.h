@@ -67,8 +67,9 @@ class ABGenerator : public OperationsGenerator {
                                  BlobFileWriter* blob_file);
 
   // Takes a vector of AnnotatedOperations |aops| and sorts them by the first
-  // start block in their destination extents. Sets |aops| to a vector of the
-  // sorted operations.
+  // start block in their destination extents, except for the TARGET_COPY
+  // operations which are moved after the others. Sets |aops| to a vector of
+  // the sorted operations.
   static void SortOperationsByDestination(
       std::vector<AnnotatedOperation>* aops);
 
@@ -98,11 +99,13 @@ class ABGenerator : public OperationsGenerator {
   // and merges SOURCE_COPY, REPLACE, REPLACE_BZ and REPLACE_XZ, operations in
   // that vector.
   // It will merge two operations if:
-  //   - They are both REPLACE_*, or they are both SOURCE_COPY,
+  //   - They are both REPLACE_*, both SOURCE_COPY or both TARGET_COPY,
   //   - Their destination blocks are contiguous.
   //   - Their combined blocks do not exceed |chunk_blocks| blocks.
   // Note that unlike other methods, you can't pass a negative number in
-  // |chunk_blocks|.
+  // |chunk_blocks|. The merged REPLACE operations whose uncompressed blobs
+  // follow each other in |blob_file| keep using them unless the merged data
+  // compresses.
   static bool MergeOperations(std::vector<AnnotatedOperation>* aops,
                               const PayloadVersion& version,
                               size_t chunk_blocks,
@@ -110,7 +113,7 @@ class ABGenerator : public OperationsGenerator {
                               BlobFileWriter* blob_file);
 
   // Takes a vector of AnnotatedOperations |aops|, adds source hash to all
-  // operations that have src_extents.
+  // operations that have src_extents in the source partition.
   static bool AddSourceHash(std::vector<AnnotatedOperation>* aops,
                             const std::string& source_part_path);
 
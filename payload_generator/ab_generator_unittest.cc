@@ -304,8 +304,14 @@ void TestMergeReplaceOrReplaceXzOperations(InstallOperation::Type orig_type,
     expected_blob = expected_data;
   }
   ASSERT_EQ(expected_blob.size(), new_op.data_length());
-  ASSERT_EQ(blob_data.size() + expected_blob.size(),
-            static_cast<size_t>(data_file_size));
+  if (orig_type == InstallOperation::REPLACE && !compressible) {
+    // The blobs of the merged operations are reused as they are.
+    EXPECT_EQ(0U, new_op.data_offset());
+    ASSERT_EQ(blob_data.size(), static_cast<size_t>(data_file_size));
+  } else {
+    ASSERT_EQ(blob_data.size() + expected_blob.size(),
+              static_cast<size_t>(data_file_size));
+  }
   brillo::Blob new_op_blob(new_op.data_length());
   ssize_t bytes_read;
   ASSERT_TRUE(utils::PReadAll(data_fd,
@@ -428,6 +434,30 @@ TEST_F(ABGeneratorTest, SortOperationsByDestinationTest) {
   EXPECT_EQ(second_aop.name, aops[2].name);
 }
 
+TEST_F(ABGeneratorTest, SortOperationsByDestinationTargetCopyTest) {
+  vector<AnnotatedOperation> aops(4);
+  aops[0].name = "copy-first";
+  aops[0].op.set_type(InstallOperation::TARGET_COPY);
+  *(aops[0].op.add_dst_extents()) = ExtentForRange(2, 1);
+  aops[1].name = "replace-last";
+  aops[1].op.set_type(InstallOperation::REPLACE);
+  *(aops[1].op.add_dst_extents()) = ExtentForRange(8, 1);
+  aops[2].name = "copy-last";
+  aops[2].op.set_type(InstallOperation::TARGET_COPY);
+  *(aops[2].op.add_dst_extents()) = ExtentForRange(6, 1);
+  aops[3].name = "replace-first";
+  aops[3].op.set_type(InstallOperation::REPLACE);
+  *(aops[3].op.add_dst_extents()) = ExtentForRange(0, 1);
+
+  // The TARGET_COPY operations come after the ones writing their source.
+  ABGenerator::SortOperationsByDestination(&aops);
+  ASSERT_EQ(4U, aops.size());
+  EXPECT_EQ("replace-first", aops[0].name);
+  EXPECT_EQ("replace-last", aops[1].name);
+  EXPECT_EQ("copy-first", aops[2].name);
+  EXPECT_EQ("copy-last", aops[3].name);
+}
+
 TEST_F(ABGeneratorTest, MergeSourceCopyOperationsTest) {
   vector<AnnotatedOperation> aops;
   InstallOperation first_op;
@@ -573,4 +603,60 @@ TEST_F(ABGeneratorTest, AddSourceHashTest) {
   EXPECT_EQ(expected_hash, result_hash);
 }
 
+TEST_F(ABGeneratorTest, AddSourceHashManyOperationsTest) {
+  // More operations than hashed in a single batch.
+  constexpr size_t kNumOps = 150;
+  ScopedTempFile src_part_file("AddSourceHashTest_src_part.XXXXXX");
+  brillo::Blob src_data(kNumOps * kBlockSize);
+  test_utils::FillWithData(&src_data);
+  ASSERT_TRUE(test_utils::WriteFileVector(src_part_file.path(), src_data));
+
+  vector<AnnotatedOperation> aops(kNumOps);
+  for (size_t i = 0; i < kNumOps; i++) {
+    aops[i].op.set_type(InstallOperation::SOURCE_COPY);
+    *(aops[i].op.add_src_extents()) = ExtentForRange(i, 1);
+  }
+  EXPECT_TRUE(ABGenerator::AddSourceHash(&aops, src_part_file.path()));
+
+  for (size_t i = 0; i < kNumOps; i++) {
+    brillo::Blob expected_hash;
+    EXPECT_TRUE(HashCalculator::RawHashOfBytes(
+        src_data.data() + i * kBlockSize, kBlockSize, &expected_hash));
+    brillo::Blob result_hash(aops[i].op.src_sha256_hash().begin(),
+                             aops[i].op.src_sha256_hash().end());
+    EXPECT_EQ(expected_hash, result_hash) << "operation " << i;
+  }
+}
+
+TEST_F(ABGeneratorTest, AddSourceHashSeveralExtentsTest) {
+  ScopedTempFile src_part_file("AddSourceHashTest_src_part.XXXXXX");
+  brillo::Blob src_data(4 * kBlockSize);
+  test_utils::FillWithData(&src_data);
+  ASSERT_TRUE(test_utils::WriteFileVector(src_part_file.path(), src_data));
+
+  // The source of the operation isn't contiguous and ends in the middle of a
+  // block.
+  vector<AnnotatedOperation> aops(1);
+  aops[0].op.set_type(InstallOperation::SOURCE_BSDIFF);
+  aops[0].op.set_src_length(kBlockSize + 100);
+  *(aops[0].op.add_src_extents()) = ExtentForRange(3, 1);
+  *(aops[0].op.add_src_extents()) = ExtentForRange(1, 1);
+  EXPECT_TRUE(ABGenerator::AddSourceHash(&aops, src_part_file.path()));
+
+  brillo::Blob expected_data(src_data.begin() + 3 * kBlockSize, src_data.end());
+  expected_data.insert(expected_data.end(),
+                       src_data.begin() + kBlockSize,
+                       src_data.begin() + kBlockSize + 100);
+  brillo::Blob expected_hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfData(expected_data, &expected_hash));
+  brillo::Blob result_hash(aops[0].op.src_sha256_hash().begin(),
+                           aops[0].op.src_sha256_hash().end());
+  EXPECT_EQ(expected_hash, result_hash);
+
+  // Sources past the end of the partition are an error.
+  *(aops[0].op.add_src_extents()) = ExtentForRange(4, 1);
+  aops[0].op.set_src_length(3 * kBlockSize);
+  EXPECT_FALSE(ABGenerator::AddSourceHash(&aops, src_part_file.path()));
+}
+
 }  // namespace chromeos_update_engine
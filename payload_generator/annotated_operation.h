@@ -19,6 +19,7 @@
 
 #include <ostream>  // NOLINT(readability/streams)
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include <brillo/secure_blob.h>
@@ -43,10 +44,14 @@ struct AnnotatedOperation {
 
   // Writes |blob| to the end of |blob_file|. It sets the data_offset and
   // data_length in AnnotatedOperation to match the offset and size of |blob|
-  // in |blob_file|.
+  // in |blob_file|, and its data_sha256_hash.
   bool SetOperationBlob(const brillo::Blob& blob, BlobFileWriter* blob_file);
 };
 
+// The generator moves millions of operations through its passes and sorts.
+// The vectors holding them only move them when they grow if this holds.
+static_assert(std::is_nothrow_move_constructible_v<AnnotatedOperation>);
+
 // For logging purposes.
 std::ostream& operator<<(std::ostream& os, const AnnotatedOperation& aop);
 
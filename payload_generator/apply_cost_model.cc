@@ -0,0 +1,286 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/apply_cost_model.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <utility>
+
+#include <android-base/strings.h>
+#include <base/logging.h>
+#include <base/strings/stringprintf.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr double kMiB = 1024 * 1024;
+
+// Parses the name of an operation type, as logged by ApplyStats or as named
+// in update_metadata.proto.
+bool ParseOperationType(const std::string& name, int* type) {
+  for (int t = InstallOperation::Type_MIN; t <= InstallOperation::Type_MAX;
+       t++) {
+    if (!InstallOperation::Type_IsValid(t) || t == InstallOperation::MOVE ||
+        t == InstallOperation::BSDIFF) {
+      continue;
+    }
+    const auto op_type = static_cast<InstallOperation::Type>(t);
+    if (name == InstallOperationTypeName(op_type) ||
+        name == InstallOperation::Type_Name(op_type)) {
+      *type = t;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Parses the MiB/s following |key| in |line|, e.g. "verify 12.5 MiB/s".
+bool ParseLoggedThroughput(const std::string& line,
+                           const std::string& key,
+                           double* throughput) {
+  const size_t pos = line.find(key + " ");
+  return pos != std::string::npos &&
+         sscanf(line.c_str() + pos + key.size(), " %lf MiB/s", throughput) ==
+             1;
+}
+
+// Parses a line of ApplyStats::ToString() into |type| and |stats|.
+bool ParseApplyStatsLine(const std::string& line,
+                         int* type,
+                         OperationTypeStats* stats) {
+  const size_t operations = line.find(" operations, ");
+  if (operations == std::string::npos) {
+    return false;
+  }
+  const size_t colon = line.rfind(": ", operations);
+  if (colon == std::string::npos) {
+    return false;
+  }
+  const size_t name_start = line.find_last_of(' ', colon);
+  const size_t start = name_start == std::string::npos ? 0 : name_start + 1;
+  if (!ParseOperationType(line.substr(start, colon - start), type)) {
+    return false;
+  }
+  int64_t wall_ms = 0;
+  int64_t cpu_ms = 0;
+  if (sscanf(line.c_str() + colon + 2,
+             "%" SCNu64 " operations, %" SCNd64 " ms wall time, %" SCNd64
+             " ms cpu time, %" SCNu64 " bytes of data, %" SCNu64
+             " bytes read, %" SCNu64 " bytes written",
+             &stats->count,
+             &wall_ms,
+             &cpu_ms,
+             &stats->data_bytes,
+             &stats->bytes_read,
+             &stats->bytes_written) != 6) {
+    return false;
+  }
+  stats->wall_time = base::TimeDelta::FromMilliseconds(wall_ms);
+  stats->cpu_time = base::TimeDelta::FromMilliseconds(cpu_ms);
+  return true;
+}
+
+base::TimeDelta TimeAt(uint64_t bytes, double throughput) {
+  if (throughput <= 0) {
+    return base::TimeDelta();
+  }
+  return base::TimeDelta::FromSecondsD(bytes / throughput);
+}
+
+}  // namespace
+
+double DeviceProfile::GetApplyThroughput(int type) const {
+  const auto it = apply_throughput.find(type);
+  if (it != apply_throughput.end()) {
+    return it->second;
+  }
+  // The harmonic mean, as if the types measured wrote as many bytes each.
+  double seconds_per_byte = 0;
+  for (const auto& [unused_type, throughput] : apply_throughput) {
+    seconds_per_byte += 1 / throughput;
+  }
+  return seconds_per_byte > 0 ? apply_throughput.size() / seconds_per_byte
+                              : 0;
+}
+
+bool ParseDeviceProfile(const std::string& text, DeviceProfile* profile) {
+  ApplyStats logged_stats;
+  std::map<int, OperationTypeStats> logged_by_type;
+  std::map<std::string, std::vector<double>> logged_throughputs;
+  std::map<std::string, double> explicit_throughputs;
+  for (const auto& raw_line : android::base::Split(text, "\n")) {
+    const std::string line = android::base::Trim(raw_line);
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    int type = 0;
+    OperationTypeStats stats;
+    if (ParseApplyStatsLine(line, &type, &stats)) {
+      logged_by_type[type].Merge(stats);
+      continue;
+    }
+    double download = 0;
+    double verify = 0;
+    if (ParseLoggedThroughput(line, "download", &download) &&
+        ParseLoggedThroughput(line, "verify", &verify)) {
+      logged_throughputs["download"].push_back(download);
+      logged_throughputs["verify"].push_back(verify);
+      continue;
+    }
+    const auto fields = android::base::Tokenize(line, " \t");
+    double throughput = 0;
+    if (fields.size() != 2 ||
+        sscanf(fields[1].c_str(), "%lf", &throughput) != 1 || throughput < 0) {
+      LOG(ERROR) << "Invalid device profile line: " << line;
+      return false;
+    }
+    if (fields[0] != "download" && fields[0] != "verify" &&
+        fields[0] != "merge" && !ParseOperationType(fields[0], &type)) {
+      LOG(ERROR) << "Unknown throughput in the device profile: " << fields[0];
+      return false;
+    }
+    explicit_throughputs[fields[0]] = throughput * kMiB;
+  }
+
+  for (const auto& [type, stats] : logged_by_type) {
+    if (stats.wall_time > base::TimeDelta()) {
+      profile->apply_throughput[type] =
+          stats.bytes_written / stats.wall_time.InSecondsF();
+    }
+  }
+  for (const auto& [key, throughputs] : logged_throughputs) {
+    double sum = 0;
+    for (double throughput : throughputs) {
+      sum += throughput;
+    }
+    explicit_throughputs.emplace(key, sum / throughputs.size() * kMiB);
+  }
+  for (const auto& [key, throughput] : explicit_throughputs) {
+    int type = 0;
+    if (key == "download") {
+      profile->download_throughput = throughput;
+    } else if (key == "verify") {
+      profile->verify_throughput = throughput;
+    } else if (key == "merge") {
+      profile->merge_throughput = throughput;
+    } else if (ParseOperationType(key, &type)) {
+      profile->apply_throughput[type] = throughput;
+    }
+  }
+  return true;
+}
+
+std::string ApplyStatsToProfile(const ApplyStats& stats) {
+  std::string result;
+  for (const auto& [type, type_stats] : stats.by_type()) {
+    if (type_stats.wall_time <= base::TimeDelta()) {
+      continue;
+    }
+    base::StringAppendF(
+        &result,
+        "%s %.2f\n",
+        InstallOperationTypeName(static_cast<InstallOperation::Type>(type)),
+        type_stats.bytes_written / type_stats.wall_time.InSecondsF() / kMiB);
+  }
+  return result;
+}
+
+void PartitionCostEstimate::Add(const PartitionCostEstimate& other) {
+  download_bytes += other.download_bytes;
+  apply_bytes += other.apply_bytes;
+  verify_bytes += other.verify_bytes;
+  merge_bytes += other.merge_bytes;
+  download_time += other.download_time;
+  apply_time += other.apply_time;
+  verify_time += other.verify_time;
+  merge_time += other.merge_time;
+  peak_memory = std::max(peak_memory, other.peak_memory);
+}
+
+PartitionCostEstimate EstimatePartitionCost(const PartitionUpdate& partition,
+                                            size_t block_size,
+                                            bool snapshot_enabled,
+                                            const DeviceProfile& profile) {
+  PartitionCostEstimate estimate;
+  estimate.partition_name = partition.partition_name();
+  for (const auto& op : partition.operations()) {
+    const uint64_t dst_bytes =
+        utils::BlocksInExtents(op.dst_extents()) * block_size;
+    estimate.download_bytes += op.data_length();
+    estimate.apply_bytes += dst_bytes;
+    estimate.apply_time +=
+        TimeAt(dst_bytes, profile.GetApplyThroughput(op.type()));
+    uint64_t memory = op.data_length();
+    if (!diff_utils::IsNoSourceOperation(op.type()) &&
+        op.type() != InstallOperation::SOURCE_COPY &&
+        op.type() != InstallOperation::TARGET_COPY) {
+      memory += utils::BlocksInExtents(op.src_extents()) * block_size +
+                dst_bytes;
+    }
+    estimate.peak_memory = std::max(estimate.peak_memory, memory);
+  }
+  estimate.download_time =
+      TimeAt(estimate.download_bytes, profile.download_throughput);
+  estimate.verify_bytes = partition.new_partition_info().size();
+  estimate.verify_time =
+      TimeAt(estimate.verify_bytes, profile.verify_throughput);
+  if (snapshot_enabled) {
+    estimate.merge_bytes = estimate.apply_bytes;
+    estimate.merge_time =
+        TimeAt(estimate.merge_bytes, profile.merge_throughput);
+  }
+  return estimate;
+}
+
+std::string FormatCostEstimates(
+    const std::vector<PartitionCostEstimate>& estimates) {
+  std::string result = base::StringPrintf("%-20s %10s %10s %10s %10s %10s\n",
+                                          "partition",
+                                          "download",
+                                          "apply",
+                                          "verify",
+                                          "merge",
+                                          "memory");
+  const auto append_line = [&result](const PartitionCostEstimate& estimate,
+                                     const std::string& name) {
+    base::StringAppendF(&result,
+                        "%-20s %9.1fs %9.1fs %9.1fs %9.1fs %7.1fMiB\n",
+                        name.c_str(),
+                        estimate.download_time.InSecondsF(),
+                        estimate.apply_time.InSecondsF(),
+                        estimate.verify_time.InSecondsF(),
+                        estimate.merge_time.InSecondsF(),
+                        estimate.peak_memory / kMiB);
+  };
+  PartitionCostEstimate total;
+  for (const auto& estimate : estimates) {
+    append_line(estimate, estimate.partition_name);
+    total.Add(estimate);
+  }
+  append_line(total, "total");
+  return result;
+}
+
+}  // namespace chromeos_update_engine
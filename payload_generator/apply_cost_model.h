@@ -0,0 +1,98 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_APPLY_COST_MODEL_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_APPLY_COST_MODEL_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <base/time/time.h>
+
+#include "update_engine/payload_consumer/apply_stats.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// The throughputs of a device class, in bytes per second, as measured by the
+// instrumentation of update_engine on the devices. 0 if unknown.
+struct DeviceProfile {
+  double download_throughput{0};
+  double verify_throughput{0};
+  double merge_throughput{0};
+  // Bytes written per second by the operations, by InstallOperation::Type.
+  std::map<int, double> apply_throughput;
+
+  // The throughput of the operations of |type|, or of all the operations
+  // together for the types not measured.
+  double GetApplyThroughput(int type) const;
+};
+
+// Parses a device profile, one throughput in MiB/s per line:
+//     download|verify|merge|<operation type> <MiB/s>
+// The lines logged by update_engine on the device can be used as they are,
+// logcat prefix included: the lines of ApplyStats::ToString(), whose
+// operations are added up by type, and those of
+// PartitionThroughputStats::ToString(), whose download and verify
+// throughputs are averaged. Explicit throughputs take precedence. Empty
+// lines and the ones starting with '#' are ignored. Returns false on any
+// other line.
+bool ParseDeviceProfile(const std::string& text, DeviceProfile* profile);
+
+// Returns the profile lines of the throughputs of |stats|, by operation type.
+std::string ApplyStatsToProfile(const ApplyStats& stats);
+
+// The estimated cost of updating a partition on a device.
+struct PartitionCostEstimate {
+  std::string partition_name;
+
+  // The data of the operations downloaded, the bytes they write, hashed by
+  // FilesystemVerifierAction, and merged after the reboot for Virtual A/B.
+  uint64_t download_bytes{0};
+  uint64_t apply_bytes{0};
+  uint64_t verify_bytes{0};
+  uint64_t merge_bytes{0};
+
+  base::TimeDelta download_time;
+  base::TimeDelta apply_time;
+  base::TimeDelta verify_time;
+  base::TimeDelta merge_time;
+
+  // The largest buffers needed by a single operation: its data, plus the
+  // source and target of the diff operations, which are patched in memory.
+  uint64_t peak_memory{0};
+
+  // Adds the bytes and times of |other|, and keeps the largest peak memory.
+  void Add(const PartitionCostEstimate& other);
+};
+
+// Estimates the cost of applying the operations of |partition|, already
+// loaded, on a device with |profile|. The blocks written are merged if
+// |snapshot_enabled|.
+PartitionCostEstimate EstimatePartitionCost(const PartitionUpdate& partition,
+                                            size_t block_size,
+                                            bool snapshot_enabled,
+                                            const DeviceProfile& profile);
+
+// A table of |estimates|, one line per partition, then their total.
+std::string FormatCostEstimates(
+    const std::vector<PartitionCostEstimate>& estimates);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_APPLY_COST_MODEL_H_
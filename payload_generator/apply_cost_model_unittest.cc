@@ -0,0 +1,146 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/apply_cost_model.h"
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_generator/extent_ranges.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr size_t kBlockSize = 4096;
+constexpr double kMiB = 1024 * 1024;
+}  // namespace
+
+TEST(ApplyCostModelTest, ParseExplicitThroughputs) {
+  DeviceProfile profile;
+  ASSERT_TRUE(ParseDeviceProfile(
+      "# A device\n\ndownload 10\nverify 200\nmerge 50\n"
+      "REPLACE 100\nSOURCE_BSDIFF 25.5\n",
+      &profile));
+  ASSERT_DOUBLE_EQ(profile.download_throughput, 10 * kMiB);
+  ASSERT_DOUBLE_EQ(profile.verify_throughput, 200 * kMiB);
+  ASSERT_DOUBLE_EQ(profile.merge_throughput, 50 * kMiB);
+  ASSERT_DOUBLE_EQ(profile.GetApplyThroughput(InstallOperation::REPLACE),
+                   100 * kMiB);
+  ASSERT_DOUBLE_EQ(profile.GetApplyThroughput(InstallOperation::SOURCE_BSDIFF),
+                   25.5 * kMiB);
+  // The types not measured run at the harmonic mean of the others.
+  ASSERT_DOUBLE_EQ(profile.GetApplyThroughput(InstallOperation::PUFFDIFF),
+                   2 / (1 / (100 * kMiB) + 1 / (25.5 * kMiB)));
+
+  ASSERT_FALSE(ParseDeviceProfile("download\n", &profile));
+  ASSERT_FALSE(ParseDeviceProfile("upload 10\n", &profile));
+  ASSERT_FALSE(ParseDeviceProfile("REPLACE fast\n", &profile));
+}
+
+TEST(ApplyCostModelTest, ParseLoggedStats) {
+  InstallOperation op;
+  op.set_type(InstallOperation::REPLACE_XZ);
+  op.set_data_length(256 * kBlockSize);
+  *op.add_dst_extents() = ExtentForRange(0, 1024);
+  ApplyStats stats;
+  for (int i = 0; i < 2; i++) {
+    stats.Record(op,
+                 kBlockSize,
+                 base::TimeDelta::FromSeconds(1),
+                 base::TimeDelta::FromMilliseconds(500));
+  }
+  PartitionThroughputStats throughput;
+  throughput.download_bytes = 8 * kMiB;
+  throughput.download_time = base::TimeDelta::FromSeconds(2);
+  throughput.verify_bytes = 30 * kMiB;
+  throughput.verify_time = base::TimeDelta::FromSeconds(1);
+  const std::string logged = "I update_engine: Apply stats: " +
+                             stats.ToString() +
+                             "I update_engine: Throughput of system: " +
+                             throughput.ToString(stats) + "\nREPLACE_XZ 1\n";
+
+  DeviceProfile profile;
+  ASSERT_TRUE(ParseDeviceProfile(logged, &profile));
+  ASSERT_DOUBLE_EQ(profile.download_throughput, 4 * kMiB);
+  ASSERT_DOUBLE_EQ(profile.verify_throughput, 30 * kMiB);
+  // The explicit throughput overrides the logged one.
+  ASSERT_DOUBLE_EQ(profile.GetApplyThroughput(InstallOperation::REPLACE_XZ),
+                   kMiB);
+
+  ASSERT_TRUE(ParseDeviceProfile(stats.ToString(), &profile));
+  ASSERT_DOUBLE_EQ(profile.GetApplyThroughput(InstallOperation::REPLACE_XZ),
+                   4 * kMiB);
+  ASSERT_EQ(ApplyStatsToProfile(stats), "REPLACE_XZ 4.00\n");
+}
+
+TEST(ApplyCostModelTest, EstimatePartitionCost) {
+  PartitionUpdate partition;
+  partition.set_partition_name("system");
+  partition.mutable_new_partition_info()->set_size(512 * kBlockSize);
+  auto* replace = partition.add_operations();
+  replace->set_type(InstallOperation::REPLACE_XZ);
+  replace->set_data_length(64 * kBlockSize);
+  *replace->add_dst_extents() = ExtentForRange(0, 256);
+  auto* diff = partition.add_operations();
+  diff->set_type(InstallOperation::SOURCE_BSDIFF);
+  diff->set_data_length(16 * kBlockSize);
+  *diff->add_src_extents() = ExtentForRange(0, 128);
+  *diff->add_dst_extents() = ExtentForRange(256, 128);
+  auto* copy = partition.add_operations();
+  copy->set_type(InstallOperation::SOURCE_COPY);
+  *copy->add_src_extents() = ExtentForRange(128, 128);
+  *copy->add_dst_extents() = ExtentForRange(384, 128);
+
+  DeviceProfile profile;
+  profile.download_throughput = 80 * kBlockSize;
+  profile.verify_throughput = 1024 * kBlockSize;
+  profile.merge_throughput = 256 * kBlockSize;
+  profile.apply_throughput[InstallOperation::REPLACE_XZ] = 256 * kBlockSize;
+  profile.apply_throughput[InstallOperation::SOURCE_BSDIFF] = 64 * kBlockSize;
+  profile.apply_throughput[InstallOperation::SOURCE_COPY] = 128 * kBlockSize;
+
+  auto estimate = EstimatePartitionCost(partition, kBlockSize, true, profile);
+  ASSERT_EQ(estimate.partition_name, "system");
+  ASSERT_EQ(estimate.download_bytes, 80 * kBlockSize);
+  ASSERT_EQ(estimate.apply_bytes, 512 * kBlockSize);
+  ASSERT_EQ(estimate.verify_bytes, 512 * kBlockSize);
+  ASSERT_EQ(estimate.merge_bytes, 512 * kBlockSize);
+  ASSERT_EQ(estimate.download_time, base::TimeDelta::FromSeconds(1));
+  ASSERT_EQ(estimate.apply_time, base::TimeDelta::FromSeconds(4));
+  ASSERT_EQ(estimate.verify_time, base::TimeDelta::FromMilliseconds(500));
+  ASSERT_EQ(estimate.merge_time, base::TimeDelta::FromSeconds(2));
+  // The diff needs its data, source and target in memory.
+  ASSERT_EQ(estimate.peak_memory, (16 + 128 + 128) * kBlockSize);
+
+  estimate = EstimatePartitionCost(partition, kBlockSize, false, profile);
+  ASSERT_EQ(estimate.merge_bytes, 0U);
+  ASSERT_EQ(estimate.merge_time, base::TimeDelta());
+
+  // Nothing is known about an empty profile.
+  estimate =
+      EstimatePartitionCost(partition, kBlockSize, true, DeviceProfile());
+  ASSERT_EQ(estimate.apply_bytes, 512 * kBlockSize);
+  ASSERT_EQ(estimate.apply_time, base::TimeDelta());
+
+  PartitionCostEstimate total;
+  total.Add(estimate);
+  total.Add(estimate);
+  ASSERT_EQ(total.apply_bytes, 1024 * kBlockSize);
+  ASSERT_EQ(total.peak_memory, estimate.peak_memory);
+  ASSERT_NE(FormatCostEstimates({estimate}).find("total"), std::string::npos);
+}
+
+}  // namespace chromeos_update_engine
@@ -16,31 +16,136 @@
 
 #include "update_engine/payload_generator/blob_file_writer.h"
 
+#include <algorithm>
+#include <vector>
+
+#include <base/logging.h>
+
 #include "update_engine/common/utils.h"
 
 namespace chromeos_update_engine {
 
+BlobFileWriter::BlobFileWriter(int blob_fd,
+                               off_t* blob_file_size,
+                               size_t max_queued_bytes)
+    : blob_fd_(blob_fd),
+      next_offset_(blob_file_size ? *blob_file_size : 0),
+      blob_file_size_(blob_file_size),
+      max_queued_bytes_(max_queued_bytes) {
+  if (max_queued_bytes_ > 0)
+    writer_ = std::thread(&BlobFileWriter::WriterMain, this);
+}
+
+BlobFileWriter::~BlobFileWriter() {
+  if (!writer_.joinable())
+    return;
+  if (!Flush())
+    LOG(ERROR) << "Failed to write some of the blobs.";
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    stopping_ = true;
+  }
+  queue_cv_.notify_all();
+  writer_.join();
+}
+
 off_t BlobFileWriter::StoreBlob(const brillo::Blob& blob) {
-  base::AutoLock auto_lock(blob_mutex_);
-  if (!utils::PWriteAll(blob_fd_, blob.data(), blob.size(), *blob_file_size_))
+  if (failed_)
     return -1;
+  off_t offset = next_offset_.fetch_add(blob.size());
 
-  off_t result = *blob_file_size_;
-  *blob_file_size_ += blob.size();
+  if (max_queued_bytes_ == 0) {
+    if (!utils::PWriteAll(blob_fd_, blob.data(), blob.size(), offset)) {
+      failed_ = true;
+      return -1;
+    }
+    BlobStored(offset, blob.size());
+    return offset;
+  }
 
-  stored_blobs_++;
-  if (total_blobs_ > 0 && (10 * (stored_blobs_ - 1) / total_blobs_) !=
-                              (10 * stored_blobs_ / total_blobs_)) {
-    LOG(INFO) << (100 * stored_blobs_ / total_blobs_) << "% complete "
-              << stored_blobs_ << "/" << total_blobs_
-              << " ops (output size: " << *blob_file_size_ << ")";
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    // Let a blob bigger than the limit in when the queue is empty.
+    queue_cv_.wait(lock, [this, &blob] {
+      return failed_ || queued_bytes_ == 0 ||
+             queued_bytes_ + blob.size() <= max_queued_bytes_;
+    });
+    if (failed_)
+      return -1;
+    queue_.emplace_back(offset, blob);
+    queued_bytes_ += blob.size();
+  }
+  queue_cv_.notify_all();
+  return offset;
+}
+
+bool BlobFileWriter::Flush() {
+  if (writer_.joinable()) {
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    queue_cv_.wait(lock, [this] {
+      return failed_ || (queue_.empty() && writing_blobs_ == 0);
+    });
   }
-  return result;
+  return !failed_;
 }
 
 void BlobFileWriter::IncTotalBlobs(size_t increment) {
-  base::AutoLock auto_lock(blob_mutex_);
   total_blobs_ += increment;
 }
 
+void BlobFileWriter::BlobStored(off_t offset, size_t size) {
+  std::lock_guard<std::mutex> lock(stored_mutex_);
+  if (blob_file_size_)
+    *blob_file_size_ = std::max<off_t>(*blob_file_size_, offset + size);
+
+  stored_blobs_++;
+  size_t total_blobs = total_blobs_;
+  if (total_blobs > 0 && (10 * (stored_blobs_ - 1) / total_blobs) !=
+                             (10 * stored_blobs_ / total_blobs)) {
+    LOG(INFO) << (100 * stored_blobs_ / total_blobs) << "% complete "
+              << stored_blobs_ << "/" << total_blobs
+              << " ops (output size: " << *blob_file_size_ << ")";
+  }
+}
+
+void BlobFileWriter::WriterMain() {
+  std::vector<std::pair<off_t, brillo::Blob>> batch;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(queue_mutex_);
+      writing_blobs_ = 0;
+      queue_cv_.notify_all();
+      queue_cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+      if (queue_.empty())
+        return;
+      batch.assign(std::make_move_iterator(queue_.begin()),
+                   std::make_move_iterator(queue_.end()));
+      queue_.clear();
+      writing_blobs_ = batch.size();
+      // The blobs are only freed from the queue budget once written, so that
+      // the memory used stays bounded.
+    }
+    // Write the batch in file order, the workers may queue their blobs out of
+    // order.
+    std::sort(batch.begin(), batch.end(), [](const auto& a, const auto& b) {
+      return a.first < b.first;
+    });
+    size_t written_bytes = 0;
+    for (const auto& [offset, blob] : batch) {
+      if (!failed_ &&
+          !utils::PWriteAll(blob_fd_, blob.data(), blob.size(), offset)) {
+        PLOG(ERROR) << "Failed to write a blob of " << blob.size()
+                    << " bytes at offset " << offset;
+        failed_ = true;
+      }
+      if (!failed_)
+        BlobStored(offset, blob.size());
+      written_bytes += blob.size();
+    }
+    batch.clear();
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    queued_bytes_ -= written_bytes;
+  }
+}
+
 }  // namespace chromeos_update_engine
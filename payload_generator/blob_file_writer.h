@@ -17,36 +17,80 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOB_FILE_WRITER_H_
 #define UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOB_FILE_WRITER_H_
 
-#include <base/macros.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
 
-#include <base/synchronization/lock.h>
+#include <base/macros.h>
 #include <brillo/secure_blob.h>
 
 namespace chromeos_update_engine {
 
+// Stores the blobs of the operations to a file, in a thread safe way. The
+// callers reserve the offset of their blob atomically and write it at that
+// offset, so that they don't wait for each other's writes.
 class BlobFileWriter {
  public:
   // Create the BlobFileWriter object that will manage the blobs stored to
-  // |blob_fd| in a thread safe way.
+  // |blob_fd| after its first |*blob_file_size| bytes, updating
+  // |*blob_file_size| as they are stored. The blobs are written by the
+  // threads storing them.
   BlobFileWriter(int blob_fd, off_t* blob_file_size)
-      : blob_fd_(blob_fd), blob_file_size_(blob_file_size) {}
+      : BlobFileWriter(blob_fd, blob_file_size, 0) {}
+
+  // Same, but if |max_queued_bytes| is not 0 the blobs are queued and written
+  // by a dedicated thread. StoreBlob() only blocks while the queued blobs take
+  // more than |max_queued_bytes|, and the blobs are only in the file once
+  // Flush() returned.
+  BlobFileWriter(int blob_fd, off_t* blob_file_size, size_t max_queued_bytes);
+  ~BlobFileWriter();
 
   // Store the passed |blob| in the blob file. Returns the offset at which it
   // was stored, or -1 in case of failure.
   off_t StoreBlob(const brillo::Blob& blob);
 
+  // Waits for the queued blobs to be written. Returns whether all the blobs
+  // were written successfully.
+  bool Flush();
+
   // Increase |total_blobs| by |increment|. Thread safe.
   void IncTotalBlobs(size_t increment);
 
  private:
-  size_t total_blobs_{0};
-  size_t stored_blobs_{0};
+  // Records that the |size| bytes at |offset| were stored, logging the
+  // progress.
+  void BlobStored(off_t offset, size_t size);
+
+  void WriterMain();
+
+  std::atomic<size_t> total_blobs_{0};
 
-  // The file and its size are protected with the |blob_mutex_|.
   int blob_fd_;
+  // The end of the last blob reserved.
+  std::atomic<off_t> next_offset_;
+
+  // The size of the file and the blobs stored are protected with
+  // |stored_mutex_|.
+  std::mutex stored_mutex_;
   off_t* blob_file_size_;
+  size_t stored_blobs_{0};
+
+  std::atomic<bool> failed_{false};
 
-  base::Lock blob_mutex_;
+  // The queue of blobs to write and its size in bytes, protected with
+  // |queue_mutex_|, if |max_queued_bytes_| is not 0.
+  const size_t max_queued_bytes_;
+  std::mutex queue_mutex_;
+  std::condition_variable queue_cv_;
+  std::deque<std::pair<off_t, brillo::Blob>> queue_;
+  size_t queued_bytes_{0};
+  // The number of blobs popped from |queue_| but not written yet.
+  size_t writing_blobs_{0};
+  bool stopping_{false};
+  std::thread writer_;
 
   DISALLOW_COPY_AND_ASSIGN(BlobFileWriter);
 };
@@ -17,6 +17,8 @@
 #include "update_engine/payload_generator/blob_file_writer.h"
 
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -49,4 +51,45 @@ TEST(BlobFileWriterTest, SimpleTest) {
   EXPECT_EQ(blob, stored_blob);
 }
 
+TEST(BlobFileWriterTest, QueuedConcurrentStoresTest) {
+  ScopedTempFile blob_file("BlobFileWriterTest.XXXXXX", true);
+  off_t blob_file_size = 0;
+  const size_t kBlobSize = 1000;
+  // Less than the blobs stored, so that the threads wait for the writer.
+  BlobFileWriter blob_file_writer(blob_file.fd(), &blob_file_size, 8000);
+
+  const size_t kNumThreads = 4;
+  const size_t kBlobsPerThread = 25;
+  std::vector<std::vector<off_t>> offsets(kNumThreads);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([&, i] {
+      for (size_t j = 0; j < kBlobsPerThread; j++) {
+        brillo::Blob blob(kBlobSize, static_cast<uint8_t>(i));
+        offsets[i].push_back(blob_file_writer.StoreBlob(blob));
+      }
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+  ASSERT_TRUE(blob_file_writer.Flush());
+  EXPECT_EQ(static_cast<off_t>(kNumThreads * kBlobsPerThread * kBlobSize),
+            blob_file_size);
+
+  for (size_t i = 0; i < kNumThreads; i++) {
+    for (off_t offset : offsets[i]) {
+      ASSERT_GE(offset, 0);
+      brillo::Blob stored_blob(kBlobSize);
+      ssize_t bytes_read;
+      ASSERT_TRUE(utils::PReadAll(blob_file.fd(),
+                                  stored_blob.data(),
+                                  kBlobSize,
+                                  offset,
+                                  &bytes_read));
+      EXPECT_EQ(brillo::Blob(kBlobSize, static_cast<uint8_t>(i)),
+                stored_blob);
+    }
+  }
+}
+
 }  // namespace chromeos_update_engine
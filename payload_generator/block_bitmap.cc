@@ -0,0 +1,356 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/block_bitmap.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr uint32_t kWordBits = 64;
+constexpr uint32_t kBitmapWords = BlockBitmap::kChunkBlocks / kWordBits;
+// Beyond this many runs, the bitmap of the chunk is smaller.
+constexpr size_t kMaxRuns = kBitmapWords * sizeof(uint64_t) / 4;
+
+// The encoding, all integers in little endian: uint32 version, uint32 number
+// of chunks, then for every chunk, in order: uint32 chunk index, uint8
+// representation, and either uint32 number of runs followed by every run as
+// uint16 first and last block, or the kBitmapWords uint64 of the bitmap.
+constexpr uint32_t kVersion = 1;
+constexpr uint8_t kRunsChunk = 0;
+constexpr uint8_t kBitmapChunk = 1;
+
+// Bits |bit| to |bit| + |count| excluded of a word.
+uint64_t WordMask(uint32_t bit, uint32_t count) {
+  return (count == kWordBits ? ~uint64_t{0} : (uint64_t{1} << count) - 1)
+         << bit;
+}
+
+void AppendLE(uint64_t value, size_t size, std::string* out) {
+  for (size_t i = 0; i < size; i++) {
+    out->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+bool ReadLE(std::string_view* data, size_t size, uint64_t* value) {
+  if (data->size() < size) {
+    return false;
+  }
+  *value = 0;
+  for (size_t i = 0; i < size; i++) {
+    *value |= uint64_t{static_cast<uint8_t>((*data)[i])} << (8 * i);
+  }
+  data->remove_prefix(size);
+  return true;
+}
+
+}  // namespace
+
+void BlockBitmap::AddRange(uint64_t start_block, uint64_t num_blocks) {
+  while (num_blocks > 0) {
+    const uint64_t begin = start_block % kChunkBlocks;
+    const uint64_t end = std::min(kChunkBlocks, begin + num_blocks);
+    blocks_ += AddToChunk(&chunks_[start_block / kChunkBlocks], begin, end);
+    start_block += end - begin;
+    num_blocks -= end - begin;
+  }
+}
+
+void BlockBitmap::AddExtent(const Extent& extent) {
+  if (extent.start_block() != kSparseHole) {
+    AddRange(extent.start_block(), extent.num_blocks());
+  }
+}
+
+bool BlockBitmap::ContainsBlock(uint64_t block) const {
+  return ContainsRange(block, 1);
+}
+
+bool BlockBitmap::ContainsExtent(const Extent& extent) const {
+  return extent.start_block() != kSparseHole &&
+         ContainsRange(extent.start_block(), extent.num_blocks());
+}
+
+bool BlockBitmap::ContainsRange(uint64_t start_block,
+                                uint64_t num_blocks) const {
+  while (num_blocks > 0) {
+    const uint64_t begin = start_block % kChunkBlocks;
+    const uint64_t end = std::min(kChunkBlocks, begin + num_blocks);
+    const auto it = chunks_.find(start_block / kChunkBlocks);
+    if (it == chunks_.end() || !ChunkContains(it->second, begin, end)) {
+      return false;
+    }
+    start_block += end - begin;
+    num_blocks -= end - begin;
+  }
+  return true;
+}
+
+std::vector<Extent> BlockBitmap::GetExtents() const {
+  std::vector<Extent> extents;
+  for (const auto& [index, chunk] : chunks_) {
+    for (const Run& run : GetRuns(chunk)) {
+      const uint64_t start = index * kChunkBlocks + run.start;
+      const uint64_t num_blocks = run.last - run.start + 1;
+      if (!extents.empty() && extents.back().start_block() +
+                                      extents.back().num_blocks() ==
+                                  start) {
+        extents.back().set_num_blocks(extents.back().num_blocks() +
+                                      num_blocks);
+      } else {
+        extents.push_back(ExtentForRange(start, num_blocks));
+      }
+    }
+  }
+  return extents;
+}
+
+size_t BlockBitmap::MemoryUsage() const {
+  size_t size = 0;
+  for (const auto& [index, chunk] : chunks_) {
+    size += sizeof(index) + sizeof(chunk) +
+            chunk.runs.capacity() * sizeof(Run) +
+            chunk.bits.capacity() * sizeof(uint64_t);
+  }
+  return size;
+}
+
+void BlockBitmap::Clear() {
+  chunks_.clear();
+  blocks_ = 0;
+}
+
+std::string BlockBitmap::Serialize() const {
+  std::string data;
+  AppendLE(kVersion, sizeof(uint32_t), &data);
+  AppendLE(chunks_.size(), sizeof(uint32_t), &data);
+  for (const auto& [index, chunk] : chunks_) {
+    AppendLE(index, sizeof(uint32_t), &data);
+    if (chunk.bits.empty()) {
+      AppendLE(kRunsChunk, sizeof(uint8_t), &data);
+      AppendLE(chunk.runs.size(), sizeof(uint32_t), &data);
+      for (const Run& run : chunk.runs) {
+        AppendLE(run.start, sizeof(uint16_t), &data);
+        AppendLE(run.last, sizeof(uint16_t), &data);
+      }
+    } else {
+      AppendLE(kBitmapChunk, sizeof(uint8_t), &data);
+      for (uint64_t word : chunk.bits) {
+        AppendLE(word, sizeof(uint64_t), &data);
+      }
+    }
+  }
+  return data;
+}
+
+bool BlockBitmap::Parse(std::string_view data) {
+  uint64_t version = 0;
+  uint64_t num_chunks = 0;
+  if (!ReadLE(&data, sizeof(uint32_t), &version) || version != kVersion ||
+      !ReadLE(&data, sizeof(uint32_t), &num_chunks)) {
+    return false;
+  }
+  std::map<uint64_t, Chunk> chunks;
+  uint64_t blocks = 0;
+  for (uint64_t i = 0; i < num_chunks; i++) {
+    uint64_t index = 0;
+    uint64_t type = 0;
+    if (!ReadLE(&data, sizeof(uint32_t), &index) ||
+        (!chunks.empty() && index <= chunks.rbegin()->first) ||
+        !ReadLE(&data, sizeof(uint8_t), &type)) {
+      return false;
+    }
+    Chunk chunk;
+    if (type == kRunsChunk) {
+      uint64_t num_runs = 0;
+      if (!ReadLE(&data, sizeof(uint32_t), &num_runs) || num_runs == 0 ||
+          num_runs > kMaxRuns) {
+        return false;
+      }
+      for (uint64_t j = 0; j < num_runs; j++) {
+        uint64_t start = 0;
+        uint64_t last = 0;
+        // The runs are ordered, and separated by blocks not in the set.
+        if (!ReadLE(&data, sizeof(uint16_t), &start) ||
+            !ReadLE(&data, sizeof(uint16_t), &last) || start > last ||
+            (!chunk.runs.empty() &&
+             start <= uint64_t{chunk.runs.back().last} + 1)) {
+          return false;
+        }
+        chunk.runs.push_back(
+            {static_cast<uint16_t>(start), static_cast<uint16_t>(last)});
+        chunk.blocks += last - start + 1;
+      }
+    } else if (type == kBitmapChunk) {
+      chunk.bits.resize(kBitmapWords);
+      for (uint64_t& word : chunk.bits) {
+        if (!ReadLE(&data, sizeof(uint64_t), &word)) {
+          return false;
+        }
+        chunk.blocks += __builtin_popcountll(word);
+      }
+      if (chunk.blocks == 0) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+    blocks += chunk.blocks;
+    chunks.emplace(index, std::move(chunk));
+  }
+  if (!data.empty()) {
+    return false;
+  }
+  chunks_ = std::move(chunks);
+  blocks_ = blocks;
+  return true;
+}
+
+bool BlockBitmap::operator==(const BlockBitmap& that) const {
+  return blocks_ == that.blocks_ && GetExtents() == that.GetExtents();
+}
+
+uint32_t BlockBitmap::AddToChunk(Chunk* chunk, uint32_t begin, uint32_t end) {
+  uint32_t added = 0;
+  if (!chunk->bits.empty()) {
+    for (uint32_t block = begin; block < end;) {
+      const uint32_t bit = block % kWordBits;
+      const uint32_t count = std::min(kWordBits - bit, end - block);
+      uint64_t& word = chunk->bits[block / kWordBits];
+      const uint64_t mask = WordMask(bit, count);
+      added += __builtin_popcountll(mask & ~word);
+      word |= mask;
+      block += count;
+    }
+    chunk->blocks += added;
+    // A full chunk is a single run.
+    if (chunk->blocks == kChunkBlocks) {
+      Compact(chunk);
+    }
+    return added;
+  }
+
+  // Merges the runs overlapping or touching the new one.
+  auto& runs = chunk->runs;
+  auto first =
+      std::lower_bound(runs.begin(),
+                       runs.end(),
+                       begin,
+                       [](const Run& run, uint32_t block) {
+                         return uint32_t{run.last} + 1 < block;
+                       });
+  uint32_t start = begin;
+  uint32_t last = end - 1;
+  uint32_t merged = 0;
+  auto it = first;
+  for (; it != runs.end() && it->start <= end; it++) {
+    start = std::min<uint32_t>(start, it->start);
+    last = std::max<uint32_t>(last, it->last);
+    merged += it->last - it->start + 1;
+  }
+  added = last - start + 1 - merged;
+  first = runs.erase(first, it);
+  runs.insert(first,
+              {static_cast<uint16_t>(start), static_cast<uint16_t>(last)});
+  chunk->blocks += added;
+  if (runs.size() > kMaxRuns) {
+    Compact(chunk);
+  }
+  return added;
+}
+
+bool BlockBitmap::ChunkContains(const Chunk& chunk,
+                                uint32_t begin,
+                                uint32_t end) {
+  if (!chunk.bits.empty()) {
+    for (uint32_t block = begin; block < end;) {
+      const uint32_t bit = block % kWordBits;
+      const uint32_t count = std::min(kWordBits - bit, end - block);
+      const uint64_t mask = WordMask(bit, count);
+      if ((chunk.bits[block / kWordBits] & mask) != mask) {
+        return false;
+      }
+      block += count;
+    }
+    return true;
+  }
+  // The last run starting at or before |begin| must cover the range.
+  const auto it = std::upper_bound(
+      chunk.runs.begin(),
+      chunk.runs.end(),
+      begin,
+      [](uint32_t block, const Run& run) { return block < run.start; });
+  return it != chunk.runs.begin() && uint32_t{std::prev(it)->last} >= end - 1;
+}
+
+std::vector<BlockBitmap::Run> BlockBitmap::GetRuns(const Chunk& chunk) {
+  if (chunk.bits.empty()) {
+    return chunk.runs;
+  }
+  std::vector<Run> runs;
+  uint32_t block = 0;
+  while (block < kChunkBlocks) {
+    // The next block in the set, then the next one not in it.
+    uint32_t word = block / kWordBits;
+    uint64_t bits = chunk.bits[word] & ~WordMask(0, block % kWordBits);
+    while (bits == 0 && ++word < kBitmapWords) {
+      bits = chunk.bits[word];
+    }
+    if (word == kBitmapWords) {
+      break;
+    }
+    const uint32_t start = word * kWordBits + __builtin_ctzll(bits);
+    bits = ~chunk.bits[word] & ~WordMask(0, start % kWordBits);
+    while (bits == 0 && ++word < kBitmapWords) {
+      bits = ~chunk.bits[word];
+    }
+    block = word == kBitmapWords ? kChunkBlocks
+                                 : word * kWordBits + __builtin_ctzll(bits);
+    runs.push_back(
+        {static_cast<uint16_t>(start), static_cast<uint16_t>(block - 1)});
+  }
+  return runs;
+}
+
+void BlockBitmap::Compact(Chunk* chunk) {
+  std::vector<Run> runs = GetRuns(*chunk);
+  if (runs.size() <= kMaxRuns) {
+    chunk->runs = std::move(runs);
+    chunk->runs.shrink_to_fit();
+    chunk->bits = std::vector<uint64_t>();
+    return;
+  }
+  chunk->bits.assign(kBitmapWords, 0);
+  for (const Run& run : runs) {
+    for (uint32_t block = run.start; block <= run.last;) {
+      const uint32_t bit = block % kWordBits;
+      const uint32_t count =
+          std::min<uint32_t>(kWordBits - bit, run.last + 1 - block);
+      chunk->bits[block / kWordBits] |= WordMask(bit, count);
+      block += count;
+    }
+  }
+  chunk->runs = std::vector<Run>();
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,109 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_BITMAP_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_BITMAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// A set of blocks stored as a compressed bitmap, in the style of Roaring
+// bitmaps: the blocks are grouped in chunks of kChunkBlocks, each stored as
+// the sorted runs of blocks it holds, or as a plain bitmap once the runs would
+// take more space. Blocks added by extents take a few bytes per run, and a
+// partition of millions of blocks takes a few hundred KB at worst, unlike an
+// ExtentRanges of scattered blocks. Sparse hole extents are ignored.
+class BlockBitmap {
+ public:
+  static constexpr uint64_t kChunkBlocks = 1 << 16;
+
+  void AddBlock(uint64_t block) { AddRange(block, 1); }
+  void AddRange(uint64_t start_block, uint64_t num_blocks);
+  void AddExtent(const Extent& extent);
+  template <typename T>
+  void AddExtents(const T& extents) {
+    for (const Extent& extent : extents) {
+      AddExtent(extent);
+    }
+  }
+
+  bool ContainsBlock(uint64_t block) const;
+  // Returns whether all the blocks of |extent| are in the set.
+  bool ContainsExtent(const Extent& extent) const;
+
+  // Number of blocks in the set.
+  uint64_t blocks() const { return blocks_; }
+
+  // The blocks in the set, as ordered maximal extents.
+  std::vector<Extent> GetExtents() const;
+
+  // Bytes taken by the runs and bitmaps of the chunks.
+  size_t MemoryUsage() const;
+
+  void Clear();
+
+  // Encodes the set, to be restored with Parse().
+  std::string Serialize() const;
+  // Replaces the set with the one encoded by Serialize() in |data|. Returns
+  // false, leaving the set unchanged, if |data| isn't valid.
+  bool Parse(std::string_view data);
+
+  bool operator==(const BlockBitmap& that) const;
+
+ private:
+  // A run of blocks of a chunk, from |start| to |last| included.
+  struct Run {
+    uint16_t start;
+    uint16_t last;
+  };
+
+  // The blocks of a chunk, relative to its first block. Either |runs| or
+  // |bits|, with kChunkBlocks bits, is used.
+  struct Chunk {
+    std::vector<Run> runs;
+    std::vector<uint64_t> bits;
+    uint32_t blocks{0};
+  };
+
+  bool ContainsRange(uint64_t start_block, uint64_t num_blocks) const;
+
+  // Adds the blocks from |begin| to |end| excluded to |chunk|. Returns the
+  // number of blocks which weren't in it.
+  static uint32_t AddToChunk(Chunk* chunk, uint32_t begin, uint32_t end);
+  // Returns whether the blocks from |begin| to |end| excluded are in |chunk|.
+  static bool ChunkContains(const Chunk& chunk, uint32_t begin, uint32_t end);
+  // Returns the runs of |chunk|, whichever its representation.
+  static std::vector<Run> GetRuns(const Chunk& chunk);
+  // Stores |chunk| with the smallest representation.
+  static void Compact(Chunk* chunk);
+
+  // The non-empty chunks by index.
+  std::map<uint64_t, Chunk> chunks_;
+  uint64_t blocks_{0};
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_BITMAP_H_
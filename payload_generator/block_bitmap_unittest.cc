@@ -0,0 +1,123 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/block_bitmap.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+namespace chromeos_update_engine {
+
+TEST(BlockBitmapTest, AddMergesRuns) {
+  BlockBitmap bitmap;
+  bitmap.AddExtent(ExtentForRange(10, 5));
+  bitmap.AddExtent(ExtentForRange(20, 5));
+  bitmap.AddExtent(ExtentForRange(kSparseHole, 5));
+  ASSERT_EQ(bitmap.blocks(), 10U);
+  // Touching both runs.
+  bitmap.AddExtent(ExtentForRange(15, 5));
+  // Overlapping.
+  bitmap.AddExtent(ExtentForRange(22, 8));
+  ASSERT_EQ(bitmap.blocks(), 20U);
+  ASSERT_EQ(bitmap.GetExtents(),
+            std::vector<Extent>{ExtentForRange(10, 20)});
+  ASSERT_TRUE(bitmap.ContainsBlock(10));
+  ASSERT_TRUE(bitmap.ContainsBlock(29));
+  ASSERT_FALSE(bitmap.ContainsBlock(9));
+  ASSERT_FALSE(bitmap.ContainsBlock(30));
+  ASSERT_TRUE(bitmap.ContainsExtent(ExtentForRange(12, 10)));
+  ASSERT_FALSE(bitmap.ContainsExtent(ExtentForRange(25, 10)));
+}
+
+TEST(BlockBitmapTest, ExtentsAcrossChunks) {
+  constexpr uint64_t kChunk = BlockBitmap::kChunkBlocks;
+  BlockBitmap bitmap;
+  bitmap.AddExtent(ExtentForRange(kChunk - 10, 3 * kChunk));
+  bitmap.AddBlock(5 * kChunk);
+  ASSERT_EQ(bitmap.blocks(), 3 * kChunk + 1);
+  ASSERT_EQ(bitmap.GetExtents(),
+            (std::vector<Extent>{ExtentForRange(kChunk - 10, 3 * kChunk),
+                                 ExtentForRange(5 * kChunk, 1)}));
+  ASSERT_TRUE(bitmap.ContainsExtent(ExtentForRange(kChunk, 2 * kChunk)));
+  ASSERT_FALSE(bitmap.ContainsExtent(ExtentForRange(kChunk - 11, 2)));
+  // Full chunks are single runs.
+  ASSERT_LT(bitmap.MemoryUsage(), 1024U);
+}
+
+TEST(BlockBitmapTest, MatchesExtentRanges) {
+  // Scattered blocks switch the chunks to bitmaps, then filling them up
+  // switches them back to runs.
+  std::mt19937 gen(0);
+  BlockBitmap bitmap;
+  ExtentRanges ranges;
+  constexpr uint64_t kNumBlocks = 3 * BlockBitmap::kChunkBlocks;
+  for (size_t i = 0; i < 20000; i++) {
+    const Extent extent = ExtentForRange(gen() % kNumBlocks, 1 + gen() % 8);
+    bitmap.AddExtent(extent);
+    ranges.AddExtent(extent);
+  }
+  ASSERT_EQ(bitmap.blocks(), ranges.blocks());
+  ASSERT_EQ(bitmap.GetExtents(),
+            ranges.GetExtentsForBlockCount(ranges.blocks()));
+  for (size_t i = 0; i < 1000; i++) {
+    const Extent extent = ExtentForRange(gen() % kNumBlocks, 1 + gen() % 4);
+    ExtentRanges missing;
+    missing.AddExtent(extent);
+    missing.SubtractRanges(ranges);
+    ASSERT_EQ(bitmap.ContainsExtent(extent), missing.blocks() == 0);
+  }
+  // At most a bitmap per chunk.
+  ASSERT_LT(bitmap.MemoryUsage(), 3 * 9 * 1024U);
+
+  bitmap.AddRange(0, kNumBlocks + 7);
+  ASSERT_EQ(bitmap.blocks(), kNumBlocks + 7);
+  ASSERT_EQ(bitmap.GetExtents(),
+            std::vector<Extent>{ExtentForRange(0, kNumBlocks + 7)});
+  ASSERT_LT(bitmap.MemoryUsage(), 1024U);
+}
+
+TEST(BlockBitmapTest, SerializeParse) {
+  std::mt19937 gen(1);
+  BlockBitmap bitmap;
+  bitmap.AddExtent(ExtentForRange(100, 1000));
+  for (size_t i = 0; i < 10000; i++) {
+    bitmap.AddBlock(BlockBitmap::kChunkBlocks + gen() % 50000);
+  }
+  const std::string data = bitmap.Serialize();
+  BlockBitmap parsed;
+  ASSERT_TRUE(parsed.Parse(data));
+  ASSERT_EQ(parsed, bitmap);
+  ASSERT_EQ(parsed.blocks(), bitmap.blocks());
+
+  ASSERT_TRUE(parsed.Parse(BlockBitmap().Serialize()));
+  ASSERT_EQ(parsed.blocks(), 0U);
+
+  // Invalid data leaves the set unchanged.
+  parsed.AddBlock(7);
+  ASSERT_FALSE(parsed.Parse(data.substr(0, data.size() - 1)));
+  ASSERT_FALSE(parsed.Parse(data + "x"));
+  ASSERT_FALSE(parsed.Parse(""));
+  ASSERT_EQ(parsed.GetExtents(), std::vector<Extent>{ExtentForRange(7, 1)});
+}
+
+}  // namespace chromeos_update_engine
@@ -20,29 +20,45 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
+#include <atomic>
 #include <functional>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
+#include "update_engine/common/simd_utils.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/huge_pages.h"
+#include "update_engine/payload_generator/task_pool.h"
 
 using std::string;
 using std::vector;
 
 namespace {
 
-size_t HashValue(const brillo::Blob& blob) {
-  std::hash<string> hash_fn;
-  return hash_fn(string(blob.begin(), blob.end()));
+uint64_t HashValue(const uint8_t* data, size_t size) {
+  return std::hash<std::string_view>{}(
+      std::string_view(reinterpret_cast<const char*>(data), size));
 }
 
+// The number of bytes AddManyDiskBlocks() reads and hashes in a single task.
+constexpr size_t kBytesPerTask = 1024 * 1024;
+
+// The unique blocks MapPartitionBlocks() keeps in memory at most.
+constexpr size_t kMaxCachedBytes = 256 * 1024 * 1024;
+
 }  // namespace
 
 namespace chromeos_update_engine {
 
 BlockMapping::BlockId BlockMapping::AddBlock(const brillo::Blob& block_data) {
-  return AddBlock(-1, 0, block_data);
+  if (block_data.size() != block_size_)
+    return -1;
+  return AddBlock(
+      -1, 0, block_data.data(), HashValue(block_data.data(), block_size_));
 }
 
 BlockMapping::BlockId BlockMapping::AddDiskBlock(int fd, off_t byte_offset) {
@@ -52,79 +68,160 @@ BlockMapping::BlockId BlockMapping::AddDiskBlock(int fd, off_t byte_offset) {
     return -1;
   if (static_cast<size_t>(bytes_read) != block_size_)
     return -1;
-  return AddBlock(fd, byte_offset, blob);
+  return AddBlock(
+      fd, byte_offset, blob.data(), HashValue(blob.data(), block_size_));
 }
 
 bool BlockMapping::AddManyDiskBlocks(int fd,
                                      off_t initial_byte_offset,
                                      size_t num_blocks,
                                      vector<BlockId>* block_ids) {
-  bool ret = true;
-  block_ids->resize(num_blocks);
-  for (size_t block = 0; block < num_blocks; block++) {
-    (*block_ids)[block] =
-        AddDiskBlock(fd, initial_byte_offset + block * block_size_);
-    ret = ret && (*block_ids)[block] != -1;
+  ReserveHugePages(block_ids, num_blocks);
+  block_ids->assign(num_blocks, -1);
+  const size_t task_blocks = std::max<size_t>(1, kBytesPerTask / block_size_);
+  const size_t num_threads =
+      TaskPool::Get() ? TaskPool::Get()->num_threads()
+                      : diff_utils::GetMaxThreads();
+  // The blocks are read and hashed one round of |num_threads| tasks at a time
+  // to bound the memory used, and then added in order.
+  const size_t round_blocks = task_blocks * num_threads;
+  brillo::Blob round_data;
+  vector<uint64_t> round_hashes;
+  // Whether each block of the round is all zeros. These are not hashed, but
+  // get |zero_block_id_| once the id of the zero block is known.
+  vector<uint8_t> round_zeros;
+  for (size_t round_start = 0; round_start < num_blocks;
+       round_start += round_blocks) {
+    const size_t round_end = std::min(num_blocks, round_start + round_blocks);
+    round_data.resize((round_end - round_start) * block_size_);
+    round_hashes.resize(round_end - round_start);
+    round_zeros.resize(round_end - round_start);
+    std::atomic<bool> read_ok{true};
+    vector<TaskPool::Task> tasks;
+    for (size_t start = round_start; start < round_end; start += task_blocks) {
+      const size_t end = std::min(round_end, start + task_blocks);
+      tasks.push_back([&, start, end] {
+        uint8_t* data = round_data.data() + (start - round_start) * block_size_;
+        const size_t size = (end - start) * block_size_;
+        ssize_t bytes_read = 0;
+        if (!utils::PReadAll(fd,
+                             data,
+                             size,
+                             initial_byte_offset + start * block_size_,
+                             &bytes_read) ||
+            static_cast<size_t>(bytes_read) != size) {
+          read_ok = false;
+          return;
+        }
+        for (size_t block = start; block < end; block++) {
+          const uint8_t* block_data =
+              round_data.data() + (block - round_start) * block_size_;
+          round_zeros[block - round_start] =
+              simd_utils::IsZero(block_data, block_size_);
+          if (!round_zeros[block - round_start])
+            round_hashes[block - round_start] =
+                HashValue(block_data, block_size_);
+        }
+      });
+    }
+    TaskPool::RunTasks(std::move(tasks), num_threads);
+    TEST_AND_RETURN_FALSE(read_ok);
+
+    for (size_t block = round_start; block < round_end; block++) {
+      const uint8_t* block_data =
+          round_data.data() + (block - round_start) * block_size_;
+      const bool is_zero = round_zeros[block - round_start];
+      if (is_zero && zero_block_id_ != -1) {
+        (*block_ids)[block] = zero_block_id_;
+        continue;
+      }
+      const uint64_t hash = is_zero ? HashValue(block_data, block_size_)
+                                    : round_hashes[block - round_start];
+      (*block_ids)[block] = AddBlock(
+          fd, initial_byte_offset + block * block_size_, block_data, hash);
+      TEST_AND_RETURN_FALSE((*block_ids)[block] != -1);
+      if (is_zero)
+        zero_block_id_ = (*block_ids)[block];
+    }
   }
-  return ret;
+  return true;
 }
 
 BlockMapping::BlockId BlockMapping::AddBlock(int fd,
                                              off_t byte_offset,
-                                             const brillo::Blob& block_data) {
-  if (block_data.size() != block_size_)
-    return -1;
-  size_t h = HashValue(block_data);
-
-  // We either reuse a UniqueBlock or create a new one. If we need a new
-  // UniqueBlock it could also be part of a new or existing bucket (if there is
-  // a hash collision).
-  vector<UniqueBlock>* bucket = nullptr;
-
-  auto mapping_it = mapping_.find(h);
-  if (mapping_it == mapping_.end()) {
-    bucket = &mapping_[h];
-  } else {
-    for (UniqueBlock& existing_block : mapping_it->second) {
-      bool equals = false;
-      if (!existing_block.CompareData(block_data, &equals))
-        return -1;
-      if (equals)
-        return existing_block.block_id;
-    }
-    bucket = &mapping_it->second;
+                                             const uint8_t* block_data,
+                                             uint64_t hash) {
+  // Keep the table at most half full so the probe sequences stay short.
+  if (2 * (blocks_.size() + 1) > slots_.size())
+    GrowSlots();
+
+  // Blocks with the same hash are in the slots following the slot of the hash,
+  // up to the first empty one, so a new block goes in that empty slot.
+  const size_t mask = slots_.size() - 1;
+  size_t slot = hash & mask;
+  for (; slots_[slot].block_id != kEmptySlot; slot = (slot + 1) & mask) {
+    if (slots_[slot].hash != hash)
+      continue;
+    UniqueBlock& existing_block = blocks_[slots_[slot].block_id];
+    bool equals = false;
+    if (!existing_block.CompareData(block_data, block_size_, &equals))
+      return -1;
+    if (equals)
+      return existing_block.block_id;
   }
 
   // No existing block was found at this point, so we create and fill in a new
   // one.
-  bucket->emplace_back();
-  UniqueBlock* new_ublock = &bucket->back();
+  const BlockId block_id = used_block_ids++;
+  slots_[slot] = {hash, block_id};
+  blocks_.emplace_back();
+  UniqueBlock* new_ublock = &blocks_.back();
 
   new_ublock->times_read = 1;
   new_ublock->fd = fd;
   new_ublock->byte_offset = byte_offset;
-  new_ublock->block_id = used_block_ids++;
-  // We need to cache blocks that are not referencing any disk location.
-  if (fd == -1)
-    new_ublock->block_data = block_data;
+  new_ublock->block_id = block_id;
+  // We need to cache blocks that are not referencing any disk location, and
+  // we keep the others while they fit in |max_cached_bytes_|.
+  if (fd == -1 || cached_bytes_ + block_size_ <= max_cached_bytes_) {
+    new_ublock->block_data.assign(block_data, block_data + block_size_);
+    if (fd != -1)
+      cached_bytes_ += block_size_;
+  }
+
+  return block_id;
+}
 
-  return new_ublock->block_id;
+void BlockMapping::GrowSlots() {
+  vector<Slot> old_slots = std::move(slots_);
+  const size_t num_slots = std::max<size_t>(16, 2 * old_slots.size());
+  ReserveHugePages(&slots_, num_slots);
+  slots_.assign(num_slots, Slot());
+  const size_t mask = slots_.size() - 1;
+  for (const Slot& old_slot : old_slots) {
+    if (old_slot.block_id == kEmptySlot)
+      continue;
+    size_t slot = old_slot.hash & mask;
+    while (slots_[slot].block_id != kEmptySlot)
+      slot = (slot + 1) & mask;
+    slots_[slot] = old_slot;
+  }
 }
 
-bool BlockMapping::UniqueBlock::CompareData(const brillo::Blob& other_block,
+bool BlockMapping::UniqueBlock::CompareData(const uint8_t* other_block,
+                                            size_t block_size,
                                             bool* equals) {
   if (!block_data.empty()) {
-    *equals = block_data == other_block;
+    *equals = simd_utils::Equal(block_data.data(), other_block, block_size);
     return true;
   }
-  const size_t block_size = other_block.size();
   brillo::Blob blob(block_size);
   ssize_t bytes_read = 0;
   if (!utils::PReadAll(fd, blob.data(), block_size, byte_offset, &bytes_read))
     return false;
   if (static_cast<size_t>(bytes_read) != block_size)
     return false;
-  *equals = blob == other_block;
+  *equals = simd_utils::Equal(blob.data(), other_block, block_size);
 
   // We increase the number of times we had to read this block from disk and
   // we cache this block based on that. This caching method is optimized for
@@ -144,7 +241,7 @@ bool MapPartitionBlocks(const string& old_part,
                         size_t block_size,
                         vector<BlockMapping::BlockId>* old_block_ids,
                         vector<BlockMapping::BlockId>* new_block_ids) {
-  BlockMapping mapping(block_size);
+  BlockMapping mapping(block_size, kMaxCachedBytes);
   if (mapping.AddBlock(brillo::Blob(block_size, '\0')) != 0)
     return false;
   int old_fd = HANDLE_EINTR(open(old_part.c_str(), O_RDONLY));
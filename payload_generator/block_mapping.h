@@ -17,7 +17,6 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_MAPPING_H_
 #define UPDATE_ENGINE_PAYLOAD_GENERATOR_BLOCK_MAPPING_H_
 
-#include <map>
 #include <string>
 #include <vector>
 
@@ -33,11 +32,18 @@ namespace chromeos_update_engine {
 // hash function in that two blocks with the same data will have the same id but
 // also two blocks with the same id will have the same data. This is only valid
 // in the context of the same BlockMapping instance.
+//
+// The blocks are looked up by a 64-bit hash of their data in an open
+// addressing hash table, and blocks with the same hash are compared byte by
+// byte to tell the hash collisions apart.
 class BlockMapping {
  public:
   using BlockId = int64_t;
 
-  explicit BlockMapping(size_t block_size) : block_size_(block_size) {}
+  // Up to |max_cached_bytes| of the unique blocks added from disk are kept in
+  // memory, so that comparing them doesn't read them back from disk.
+  explicit BlockMapping(size_t block_size, size_t max_cached_bytes = 0)
+      : block_size_(block_size), max_cached_bytes_(max_cached_bytes) {}
 
   // Add a single data block to the mapping. Returns its unique block id.
   // In case of error returns -1.
@@ -52,7 +58,9 @@ class BlockMapping {
   // This is a helper method to add |num_blocks| contiguous blocks reading them
   // from the file descriptor |fd| starting at offset |initial_byte_offset|.
   // Returns whether it succeeded to add all the disk blocks and stores in
-  // |block_ids| the block id for each one of the added blocks.
+  // |block_ids| the block id for each one of the added blocks. The blocks are
+  // read and hashed on several threads, but get the same ids as if added one
+  // by one.
   bool AddManyDiskBlocks(int fd,
                          off_t initial_byte_offset,
                          size_t num_blocks,
@@ -60,16 +68,29 @@ class BlockMapping {
 
  private:
   FRIEND_TEST(BlockMappingTest, BlocksAreNotKeptInMemory);
+  FRIEND_TEST(BlockMappingTest, CachedBlocksAreNotReadAgain);
+
+  // Add a single block passed in |block_data|, whose HashValue() is |hash|.
+  // If |fd| is not -1, the block can be discarded to save RAM and retrieved
+  // later from |fd| at the position |byte_offset|.
+  BlockId AddBlock(int fd,
+                   off_t byte_offset,
+                   const uint8_t* block_data,
+                   uint64_t hash);
 
-  // Add a single block passed in |block_data|. If |fd| is not -1, the block
-  // can be discarded to save RAM and retrieved later from |fd| at the position
-  // |byte_offset|.
-  BlockId AddBlock(int fd, off_t byte_offset, const brillo::Blob& block_data);
+  // Doubles the size of |slots_|.
+  void GrowSlots();
 
   size_t block_size_;
+  size_t max_cached_bytes_;
+  size_t cached_bytes_{0};
 
   BlockId used_block_ids{0};
 
+  // The id of the block of all zeros, or -1 if AddManyDiskBlocks() didn't
+  // find it yet.
+  BlockId zero_block_id_{-1};
+
   // The UniqueBlock represents the data of a block associated to a unique
   // block id.
   struct UniqueBlock {
@@ -85,14 +106,27 @@ class BlockMapping {
     // Number of times we have seen this data block. Used for caching.
     uint32_t times_read{0};
 
-    // Compares the UniqueBlock data with the other_block data and stores if
-    // they are equal in |equals|. Returns whether there was an error reading
-    // the block from disk while comparing it.
-    bool CompareData(const brillo::Blob& other_block, bool* equals);
+    // Compares the UniqueBlock data with the |block_size| bytes of
+    // |other_block| and stores if they are equal in |equals|. Returns whether
+    // there was an error reading the block from disk while comparing it.
+    bool CompareData(const uint8_t* other_block,
+                     size_t block_size,
+                     bool* equals);
   };
 
-  // A mapping from hash values to possible block ids.
-  std::map<size_t, std::vector<UniqueBlock>> mapping_;
+  // The unique blocks, indexed by block id.
+  std::vector<UniqueBlock> blocks_;
+
+  // A slot of the hash table, mapping the hash of a block to its block id.
+  struct Slot {
+    uint64_t hash{0};
+    // kEmptySlot if the slot is free.
+    BlockId block_id{kEmptySlot};
+  };
+  static constexpr BlockId kEmptySlot = -1;
+  // The hash table, probed linearly from the slot of the hash modulo its
+  // size, which is a power of two.
+  std::vector<Slot> slots_;
 };
 
 // Maps the blocks of the old and new partitions |old_part| and |new_part| whose
@@ -27,6 +27,7 @@
 
 #include "update_engine/common/test_utils.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/task_pool.h"
 
 using std::string;
 using std::vector;
@@ -62,10 +63,8 @@ TEST_F(BlockMappingTest, BlocksAreNotKeptInMemory) {
 
   // Check that the block_data is not stored on memory if we just used the block
   // once.
-  for (const auto& it : bm_.mapping_) {
-    for (const BlockMapping::UniqueBlock& ublock : it.second) {
-      EXPECT_TRUE(ublock.block_data.empty());
-    }
+  for (const BlockMapping::UniqueBlock& ublock : bm_.blocks_) {
+    EXPECT_TRUE(ublock.block_data.empty());
   }
 
   brillo::Blob block(block_size_, 'a');
@@ -74,16 +73,60 @@ TEST_F(BlockMappingTest, BlocksAreNotKeptInMemory) {
     EXPECT_EQ(0, bm_.AddBlock(block));
   }
 
-  for (const auto& it : bm_.mapping_) {
-    for (const BlockMapping::UniqueBlock& ublock : it.second) {
-      EXPECT_FALSE(ublock.block_data.empty());
-      // The block was loaded from disk only 4 times, and after that the counter
-      // is not updated anymore.
-      EXPECT_EQ(4U, ublock.times_read);
-    }
+  for (const BlockMapping::UniqueBlock& ublock : bm_.blocks_) {
+    EXPECT_FALSE(ublock.block_data.empty());
+    // The block was loaded from disk only 4 times, and after that the counter
+    // is not updated anymore.
+    EXPECT_EQ(4U, ublock.times_read);
   }
 }
 
+TEST_F(BlockMappingTest, CachedBlocksAreNotReadAgain) {
+  test_utils::WriteFileString(old_part_.path(), string(2 * block_size_, 'a'));
+  int old_fd = HANDLE_EINTR(open(old_part_.path().c_str(), O_RDONLY));
+  ScopedFdCloser old_fd_closer(&old_fd);
+
+  BlockMapping bm(block_size_, block_size_);
+  EXPECT_EQ(0, bm.AddDiskBlock(old_fd, 0));
+  EXPECT_EQ(0, bm.AddDiskBlock(old_fd, block_size_));
+  ASSERT_EQ(1U, bm.blocks_.size());
+  EXPECT_FALSE(bm.blocks_[0].block_data.empty());
+  EXPECT_EQ(1U, bm.blocks_[0].times_read);
+}
+
+TEST_F(BlockMappingTest, AddManyDiskBlocksMatchesAddDiskBlock) {
+  // Enough blocks for several tasks and rounds, repeating every 7 blocks.
+  const size_t num_blocks = 5000;
+  string contents(num_blocks * block_size_, '\0');
+  for (size_t i = 0; i < contents.size(); ++i)
+    contents[i] = (i / block_size_) % 7;
+  test_utils::WriteFileString(old_part_.path(), contents);
+  int old_fd = HANDLE_EINTR(open(old_part_.path().c_str(), O_RDONLY));
+  ScopedFdCloser old_fd_closer(&old_fd);
+
+  TaskPool pool(2);
+  TaskPool::Set(&pool);
+  vector<BlockMapping::BlockId> block_ids;
+  EXPECT_TRUE(bm_.AddManyDiskBlocks(old_fd, 0, num_blocks, &block_ids));
+  TaskPool::Set(nullptr);
+
+  BlockMapping bm(block_size_);
+  ASSERT_EQ(num_blocks, block_ids.size());
+  for (size_t i = 0; i < num_blocks; ++i) {
+    EXPECT_EQ(bm.AddDiskBlock(old_fd, i * block_size_), block_ids[i]);
+    EXPECT_EQ(static_cast<BlockMapping::BlockId>(i % 7), block_ids[i]);
+  }
+}
+
+TEST_F(BlockMappingTest, AddManyDiskBlocksFailsOnShortRead) {
+  test_utils::WriteFileString(old_part_.path(), string(block_size_, 'a'));
+  int old_fd = HANDLE_EINTR(open(old_part_.path().c_str(), O_RDONLY));
+  ScopedFdCloser old_fd_closer(&old_fd);
+
+  vector<BlockMapping::BlockId> block_ids;
+  EXPECT_FALSE(bm_.AddManyDiskBlocks(old_fd, 0, 2, &block_ids));
+}
+
 TEST_F(BlockMappingTest, MapPartitionBlocks) {
   // A string with 10 blocks where all the blocks are different.
   string old_contents(10 * block_size_, '\0');
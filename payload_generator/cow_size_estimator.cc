@@ -16,7 +16,11 @@
 
 #include "update_engine/payload_generator/cow_size_estimator.h"
 
+#include <fcntl.h>
+
 #include <algorithm>
+#include <functional>
+#include <iterator>
 #include <string>
 #include <utility>
 #include <vector>
@@ -26,6 +30,7 @@
 #include <libsnapshot/cow_format.h>
 
 #include "update_engine/payload_consumer/block_extent_writer.h"
+#include "update_engine/payload_consumer/flat_extent_map.h"
 #include "update_engine/payload_consumer/snapshot_extent_writer.h"
 #include "update_engine/payload_consumer/xor_extent_writer.h"
 #include "update_engine/common/utils.h"
@@ -38,43 +43,39 @@ namespace chromeos_update_engine {
 using android::snapshot::CreateCowEstimator;
 using android::snapshot::ICowWriter;
 // Compute XOR map, a map from dst extent to corresponding merge operation
-static ExtentMap<const CowMergeOperation*, ExtentLess> ComputeXorMap(
+static FlatExtentMap<const CowMergeOperation*> ComputeXorMap(
     const google::protobuf::RepeatedPtrField<CowMergeOperation>& merge_ops) {
-  ExtentMap<const CowMergeOperation*, ExtentLess> xor_map;
+  std::vector<std::pair<Extent, const CowMergeOperation*>> entries;
   for (const auto& merge_op : merge_ops) {
     if (merge_op.type() == CowMergeOperation::COW_XOR) {
-      xor_map.AddExtent(merge_op.dst_extent(), &merge_op);
+      entries.emplace_back(merge_op.dst_extent(), &merge_op);
     }
   }
-  return xor_map;
+  return FlatExtentMap<const CowMergeOperation*>(std::move(entries));
 }
 
-bool CowDryRun(
+namespace {
+
+using OperationIterator =
+    google::protobuf::RepeatedPtrField<InstallOperation>::const_iterator;
+
+// Converts the operations in [|begin|, |end|) to CowOps and applies them to
+// |cow_writer|, adding their dst extents to |visited|.
+bool DryRunOperations(
     FileDescriptorPtr source_fd,
     FileDescriptorPtr target_fd,
-    const google::protobuf::RepeatedPtrField<InstallOperation>& operations,
-    const google::protobuf::RepeatedPtrField<CowMergeOperation>&
-        merge_operations,
+    OperationIterator begin,
+    OperationIterator end,
+    const FlatExtentMap<const CowMergeOperation*>& xor_map,
+    const ExtentRanges& copy_blocks,
     const size_t block_size,
-    android::snapshot::ICowWriter* cow_writer,
-    const size_t new_partition_size,
+    ICowWriter* cow_writer,
     const size_t old_partition_size,
-    const bool xor_enabled) {
-  CHECK_NE(target_fd, nullptr);
-  CHECK(target_fd->IsOpen());
-  VABCPartitionWriter::WriteMergeSequence(merge_operations, cow_writer);
-  ExtentRanges visited;
+    const bool xor_enabled,
+    ExtentRanges* visited) {
   SnapshotExtentWriter extent_writer(cow_writer);
-  ExtentMap<const CowMergeOperation*, ExtentLess> xor_map =
-      ComputeXorMap(merge_operations);
-  ExtentRanges copy_blocks;
-  for (const auto& cow_op : merge_operations) {
-    if (cow_op.type() != CowMergeOperation::COW_COPY) {
-      continue;
-    }
-    copy_blocks.AddExtent(cow_op.dst_extent());
-  }
-  for (const auto& op : operations) {
+  for (auto it = begin; it != end; it++) {
+    const InstallOperation& op = *it;
     switch (op.type()) {
       case InstallOperation::SOURCE_BSDIFF:
       case InstallOperation::BROTLI_BSDIFF:
@@ -88,7 +89,7 @@ bool CowDryRun(
                   op, source_fd, cow_writer, xor_map, old_partition_size);
           TEST_AND_RETURN_FALSE(writer->Init(op.dst_extents(), block_size));
           for (const auto& ext : op.dst_extents()) {
-            visited.AddExtent(ext);
+            visited->AddExtent(ext);
             ssize_t bytes_read = 0;
             std::vector<unsigned char> new_data(ext.num_blocks() * block_size);
             if (!utils::PReadAll(target_fd,
@@ -113,10 +114,11 @@ bool CowDryRun(
       }
       case InstallOperation::REPLACE:
       case InstallOperation::REPLACE_BZ:
-      case InstallOperation::REPLACE_XZ: {
+      case InstallOperation::REPLACE_XZ:
+      case InstallOperation::REPLACE_ZSTD: {
         TEST_AND_RETURN_FALSE(extent_writer.Init(op.dst_extents(), block_size));
         for (const auto& ext : op.dst_extents()) {
-          visited.AddExtent(ext);
+          visited->AddExtent(ext);
           std::vector<unsigned char> data(ext.num_blocks() * block_size);
           ssize_t bytes_read = 0;
           if (!utils::PReadAll(target_fd,
@@ -139,7 +141,7 @@ bool CowDryRun(
       case InstallOperation::ZERO:
       case InstallOperation::DISCARD: {
         for (const auto& ext : op.dst_extents()) {
-          visited.AddExtent(ext);
+          visited->AddExtent(ext);
           cow_writer->AddZeroBlocks(ext.start_block(), ext.num_blocks());
         }
         cow_writer->AddLabel(0);
@@ -147,7 +149,7 @@ bool CowDryRun(
       }
       case InstallOperation::SOURCE_COPY: {
         for (const auto& ext : op.dst_extents()) {
-          visited.AddExtent(ext);
+          visited->AddExtent(ext);
         }
         if (!VABCPartitionWriter::ProcessSourceCopyOperation(
                 op, block_size, copy_blocks, source_fd, cow_writer, true)) {
@@ -163,6 +165,16 @@ bool CowDryRun(
     }
   }
 
+  return true;
+}
+
+// Writes the blocks of the new partition not in |visited| as raw blocks to
+// |cow_writer|.
+bool DryRunUnvisitedBlocks(FileDescriptorPtr target_fd,
+                           const ExtentRanges& visited,
+                           const size_t block_size,
+                           ICowWriter* cow_writer,
+                           const size_t new_partition_size) {
   const size_t last_block = new_partition_size / block_size;
   const auto unvisited_extents =
       FilterExtentRanges({ExtentForRange(0, last_block)}, visited);
@@ -191,6 +203,54 @@ bool CowDryRun(
     cow_writer->AddLabel(0);
   }
 
+  return true;
+}
+
+// Returns the COW_COPY dst blocks of |merge_operations|.
+ExtentRanges ComputeCopyBlocks(
+    const google::protobuf::RepeatedPtrField<CowMergeOperation>&
+        merge_operations) {
+  ExtentRanges copy_blocks;
+  for (const auto& cow_op : merge_operations) {
+    if (cow_op.type() != CowMergeOperation::COW_COPY) {
+      continue;
+    }
+    copy_blocks.AddExtent(cow_op.dst_extent());
+  }
+  return copy_blocks;
+}
+
+}  // namespace
+
+bool CowDryRun(
+    FileDescriptorPtr source_fd,
+    FileDescriptorPtr target_fd,
+    const google::protobuf::RepeatedPtrField<InstallOperation>& operations,
+    const google::protobuf::RepeatedPtrField<CowMergeOperation>&
+        merge_operations,
+    const size_t block_size,
+    android::snapshot::ICowWriter* cow_writer,
+    const size_t new_partition_size,
+    const size_t old_partition_size,
+    const bool xor_enabled) {
+  CHECK_NE(target_fd, nullptr);
+  CHECK(target_fd->IsOpen());
+  VABCPartitionWriter::WriteMergeSequence(merge_operations, cow_writer);
+  ExtentRanges visited;
+  TEST_AND_RETURN_FALSE(DryRunOperations(source_fd,
+                                         target_fd,
+                                         operations.begin(),
+                                         operations.end(),
+                                         ComputeXorMap(merge_operations),
+                                         ComputeCopyBlocks(merge_operations),
+                                         block_size,
+                                         cow_writer,
+                                         old_partition_size,
+                                         xor_enabled,
+                                         &visited));
+  TEST_AND_RETURN_FALSE(DryRunUnvisitedBlocks(
+      target_fd, visited, block_size, cow_writer, new_partition_size));
+
   TEST_AND_RETURN_FALSE(cow_writer->Finalize());
 
   return true;
@@ -228,4 +288,128 @@ android::snapshot::CowSizeInfo EstimateCowSizeInfo(
   return cow_writer->GetCowSizeInfo();
 }
 
+android::snapshot::CowSizeInfo EstimateCowSizeInfoConcurrently(
+    const std::string& source_path,
+    const std::string& target_path,
+    const google::protobuf::RepeatedPtrField<InstallOperation>& operations,
+    const google::protobuf::RepeatedPtrField<CowMergeOperation>&
+        merge_operations,
+    const size_t block_size,
+    const std::string& compression,
+    const size_t new_partition_size,
+    const size_t old_partition_size,
+    const bool xor_enabled,
+    uint32_t cow_version,
+    uint64_t compression_factor,
+    size_t num_chunks,
+    const std::function<void(std::vector<std::function<void()>>)>&
+        run_tasks) {
+  auto open_fd = [](const std::string& path) {
+    FileDescriptorPtr fd = std::make_shared<EintrSafeFileDescriptor>();
+    fd->Open(path.c_str(), O_RDONLY);
+    return fd;
+  };
+  num_chunks = std::max<size_t>(
+      1, std::min<size_t>(num_chunks, operations.size()));
+  if (num_chunks == 1) {
+    return EstimateCowSizeInfo(open_fd(source_path),
+                               open_fd(target_path),
+                               operations,
+                               merge_operations,
+                               block_size,
+                               compression,
+                               new_partition_size,
+                               old_partition_size,
+                               xor_enabled,
+                               cow_version,
+                               compression_factor);
+  }
+
+  // Split the operations in chunks of about the same number of blocks
+  // written.
+  uint64_t total_blocks = 0;
+  for (const auto& op : operations) {
+    total_blocks += utils::BlocksInExtents(op.dst_extents());
+  }
+  std::vector<OperationIterator> chunk_ends;
+  uint64_t blocks = 0;
+  for (auto it = operations.begin(); it != operations.end(); it++) {
+    blocks += utils::BlocksInExtents(it->dst_extents());
+    if (blocks * num_chunks >= total_blocks * (chunk_ends.size() + 1) &&
+        chunk_ends.size() + 1 < num_chunks) {
+      chunk_ends.push_back(std::next(it));
+    }
+  }
+  chunk_ends.push_back(operations.end());
+
+  const auto xor_map = ComputeXorMap(merge_operations);
+  const auto copy_blocks = ComputeCopyBlocks(merge_operations);
+  ExtentRanges visited;
+  for (const auto& op : operations) {
+    visited.AddRepeatedExtents(op.dst_extents());
+  }
+
+  // Each chunk, and the blocks not written by any operation, is dry run on
+  // its own COW estimator and file descriptors. The first one also has the
+  // merge sequence. Their sizes add up, with the few bytes of the COW header
+  // and footer counted once per chunk.
+  std::vector<android::snapshot::CowSizeInfo> chunk_infos(chunk_ends.size() +
+                                                          1);
+  std::vector<bool> chunk_succeeded(chunk_infos.size(), false);
+  std::vector<std::function<void()>> tasks;
+  for (size_t i = 0; i < chunk_infos.size(); i++) {
+    tasks.push_back([&, i] {
+      android::snapshot::CowOptions options{
+          .block_size = static_cast<uint32_t>(block_size),
+          .compression = compression,
+          .max_blocks = (new_partition_size / block_size),
+          .compression_factor = compression_factor};
+      auto cow_writer = CreateCowEstimator(cow_version, options);
+      CHECK_NE(cow_writer, nullptr) << "Could not create cow estimator";
+      FileDescriptorPtr target_fd = open_fd(target_path);
+      CHECK(target_fd->IsOpen());
+      bool success;
+      if (i < chunk_ends.size()) {
+        if (i == 0) {
+          VABCPartitionWriter::WriteMergeSequence(merge_operations,
+                                                  cow_writer.get());
+        }
+        const OperationIterator chunk_begin =
+            i == 0 ? operations.begin() : chunk_ends[i - 1];
+        ExtentRanges chunk_visited;
+        success = DryRunOperations(open_fd(source_path),
+                                   target_fd,
+                                   chunk_begin,
+                                   chunk_ends[i],
+                                   xor_map,
+                                   copy_blocks,
+                                   block_size,
+                                   cow_writer.get(),
+                                   old_partition_size,
+                                   xor_enabled,
+                                   &chunk_visited);
+      } else {
+        success = DryRunUnvisitedBlocks(target_fd,
+                                        visited,
+                                        block_size,
+                                        cow_writer.get(),
+                                        new_partition_size);
+      }
+      if (success && cow_writer->Finalize()) {
+        chunk_infos[i] = cow_writer->GetCowSizeInfo();
+        chunk_succeeded[i] = true;
+      }
+    });
+  }
+  run_tasks(std::move(tasks));
+
+  android::snapshot::CowSizeInfo cow_info{};
+  for (size_t i = 0; i < chunk_infos.size(); i++) {
+    CHECK(chunk_succeeded[i]) << "Failed to estimate the COW size";
+    cow_info.cow_size += chunk_infos[i].cow_size;
+    cow_info.op_count_max += chunk_infos[i].op_count_max;
+  }
+  return cow_info;
+}
+
 }  // namespace chromeos_update_engine
@@ -14,7 +14,9 @@
 // limitations under the License.
 //
 #include <cstddef>
+#include <functional>
 #include <string>
+#include <vector>
 
 #include <libsnapshot/cow_writer.h>
 #include <update_engine/update_metadata.pb.h>
@@ -42,6 +44,27 @@ android::snapshot::CowSizeInfo EstimateCowSizeInfo(
     uint32_t cow_version,
     uint64_t compression_factor);
 
+// Same as EstimateCowSizeInfo(), but split in up to |num_chunks| dry runs of
+// consecutive operations, each on its own COW estimator and file descriptors
+// opened from |source_path| and |target_path|, which |run_tasks| runs
+// concurrently. The sizes of the chunks are summed, which overestimates the
+// size by a COW header and footer per chunk.
+android::snapshot::CowSizeInfo EstimateCowSizeInfoConcurrently(
+    const std::string& source_path,
+    const std::string& target_path,
+    const google::protobuf::RepeatedPtrField<InstallOperation>& operations,
+    const google::protobuf::RepeatedPtrField<CowMergeOperation>&
+        merge_operations,
+    const size_t block_size,
+    const std::string& compression,
+    const size_t new_partition_size,
+    const size_t old_partition_size,
+    bool xor_enabled,
+    uint32_t cow_version,
+    uint64_t compression_factor,
+    size_t num_chunks,
+    const std::function<void(std::vector<std::function<void()>>)>& run_tasks);
+
 // Convert InstallOps to CowOps and apply the converted cow op to |cow_writer|
 bool CowDryRun(
     FileDescriptorPtr source_fd,
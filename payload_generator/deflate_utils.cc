@@ -17,6 +17,10 @@
 #include "update_engine/payload_generator/deflate_utils.h"
 
 #include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <map>
+#include <mutex>
 #include <string>
 #include <utility>
 
@@ -24,11 +28,14 @@
 #include <base/logging.h>
 #include <base/strings/string_util.h>
 
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
 #include "update_engine/payload_generator/squashfs_filesystem.h"
+#include "update_engine/payload_generator/task_pool.h"
 #include "update_engine/update_metadata.pb.h"
 
 using puffin::BitExtent;
@@ -49,6 +56,38 @@ constexpr std::ostream& operator<<(std::ostream& out,
 // The minimum size for a squashfs image to be processed.
 const uint64_t kMinimumSquashfsImageSize = 1 * 1024 * 1024;  // bytes
 
+// The maximum number of files whose deflates are kept in the cache.
+constexpr size_t kMaxDeflateCacheFiles = 64 * 1024;
+
+// The deflates located in the zip and gzip files, by the hash of their data
+// and whether it's a zip archive, so that the files identical in the source
+// and target partitions, like most APKs, are only parsed once.
+std::mutex deflate_cache_mutex;
+std::map<brillo::Blob, vector<BitExtent>> deflate_cache;
+
+// Same as DeflatePreprocessFileData(), using |deflate_cache|.
+bool CachedDeflatePreprocessFileData(const std::string_view filename,
+                                     const brillo::Blob& data,
+                                     vector<BitExtent>* deflates) {
+  brillo::Blob key;
+  TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(data, &key));
+  key.push_back(IsFileExtensions(
+      filename, {".apk", ".zip", ".jar", ".zvoice", ".apex", "capex"}));
+  {
+    std::lock_guard<std::mutex> lock(deflate_cache_mutex);
+    auto it = deflate_cache.find(key);
+    if (it != deflate_cache.end()) {
+      *deflates = it->second;
+      return true;
+    }
+  }
+  TEST_AND_RETURN_FALSE(DeflatePreprocessFileData(filename, data, deflates));
+  std::lock_guard<std::mutex> lock(deflate_cache_mutex);
+  if (deflate_cache.size() < kMaxDeflateCacheFiles)
+    deflate_cache.emplace(std::move(key), *deflates);
+  return true;
+}
+
 // TODO(*): Optimize this so we don't have to read all extents into memory in
 // case it is large.
 bool CopyExtentsToFile(const string& in_path,
@@ -308,85 +347,123 @@ bool DeflatePreprocessFileData(const std::string_view filename,
   return true;
 }
 
-bool PreprocessPartitionFiles(const PartitionConfig& part,
-                              vector<FilesystemInterface::File>* result_files,
-                              bool extract_deflates) {
-  // Get the file system files.
-  vector<FilesystemInterface::File> tmp_files;
-  part.fs_interface->GetFiles(&tmp_files);
-  result_files->reserve(tmp_files.size());
-
-  for (auto& file : tmp_files) {
-    auto is_regular_file = IsRegularFile(file);
+namespace {
 
-    if (is_regular_file && IsSquashfsImage(part.path, file)) {
-      // Read the image into a file.
-      base::FilePath path;
-      TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&path));
-      ScopedPathUnlinker old_unlinker(path.value());
-      TEST_AND_RETURN_FALSE(
-          CopyExtentsToFile(part.path, file.extents, path.value(), kBlockSize));
-      // Test if it is actually a Squashfs file.
-      auto sqfs =
-          SquashfsFilesystem::CreateFromFile(path.value(), extract_deflates);
-      if (sqfs) {
-        // It is an squashfs file. Get its files to replace with itself.
-        vector<FilesystemInterface::File> files;
-        sqfs->GetFiles(&files);
-
-        // Replace squashfs file with its files only if |files| has at least two
-        // files or if it has some deflates (since it is better to replace it to
-        // take advantage of the deflates.)
-        if (files.size() > 1 ||
-            (files.size() == 1 && !files[0].deflates.empty())) {
-          TEST_AND_RETURN_FALSE(RealignSplittedFiles(file, &files));
-          result_files->insert(result_files->end(), files.begin(), files.end());
-          continue;
-        }
-      } else {
-        LOG(WARNING) << "We thought file: " << file.name
-                     << " was a Squashfs file, but it was not.";
+// Sets |result_files| to the files |file| of |part| is preprocessed into.
+bool PreprocessPartitionFile(const PartitionConfig& part,
+                             FilesystemInterface::File file,
+                             bool extract_deflates,
+                             vector<FilesystemInterface::File>* result_files) {
+  auto is_regular_file = IsRegularFile(file);
+
+  if (is_regular_file && IsSquashfsImage(part.path, file)) {
+    // Read the image into a file.
+    base::FilePath path;
+    TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&path));
+    ScopedPathUnlinker old_unlinker(path.value());
+    TEST_AND_RETURN_FALSE(
+        CopyExtentsToFile(part.path, file.extents, path.value(), kBlockSize));
+    // Test if it is actually a Squashfs file.
+    auto sqfs =
+        SquashfsFilesystem::CreateFromFile(path.value(), extract_deflates);
+    if (sqfs) {
+      // It is an squashfs file. Get its files to replace with itself.
+      vector<FilesystemInterface::File> files;
+      sqfs->GetFiles(&files);
+
+      // Replace squashfs file with its files only if |files| has at least two
+      // files or if it has some deflates (since it is better to replace it to
+      // take advantage of the deflates.)
+      if (files.size() > 1 ||
+          (files.size() == 1 && !files[0].deflates.empty())) {
+        TEST_AND_RETURN_FALSE(RealignSplittedFiles(file, &files));
+        *result_files = std::move(files);
+        return true;
       }
+    } else {
+      LOG(WARNING) << "We thought file: " << file.name
+                   << " was a Squashfs file, but it was not.";
     }
+  }
 
-    if (is_regular_file && extract_deflates && !file.is_compressed) {
-      // Search for deflates if the file is in zip or gzip format.
-      // .zvoice files may eventually move out of rootfs. If that happens,
-      // remove ".zvoice" (crbug.com/782918).
-      bool is_zip = IsFileExtensions(
-          file.name, {".apk", ".zip", ".jar", ".zvoice", ".apex", "capex"});
-      bool is_gzip = IsFileExtensions(file.name, {".gz", ".gzip", ".tgz"});
-      if (is_zip || is_gzip) {
-        brillo::Blob data;
-        TEST_AND_RETURN_FALSE(utils::ReadExtents(
-            part.path,
-            file.extents,
-            &data,
-            kBlockSize * utils::BlocksInExtents(file.extents),
-            kBlockSize));
-        // |data| read from disk always has size multiple of kBlockSize. So it
-        // might contain trailing garbage data and confuse the gzip/zip
-        // processors. Trim them.
-        if (file.file_stat.st_size > 0 &&
-            static_cast<size_t>(file.file_stat.st_size) < data.size()) {
-          data.resize(file.file_stat.st_size);
-        }
-        vector<puffin::BitExtent> deflates;
-        if (!DeflatePreprocessFileData(file.name, data, &deflates)) {
-          LOG(ERROR) << "Failed to preprocess deflate data in partition "
-                     << part.name;
-          return false;
-        }
-        // Shift the deflate's extent to the offset starting from the beginning
-        // of the current partition; and the delta processor will align the
-        // extents in a continuous buffer later.
-        TEST_AND_RETURN_FALSE(
-            ShiftBitExtentsOverExtents(file.extents, &deflates));
-        file.deflates = std::move(deflates);
+  if (is_regular_file && extract_deflates && !file.is_compressed) {
+    // Search for deflates if the file is in zip or gzip format.
+    // .zvoice files may eventually move out of rootfs. If that happens,
+    // remove ".zvoice" (crbug.com/782918).
+    bool is_zip = IsFileExtensions(
+        file.name, {".apk", ".zip", ".jar", ".zvoice", ".apex", "capex"});
+    bool is_gzip = IsFileExtensions(file.name, {".gz", ".gzip", ".tgz"});
+    if (is_zip || is_gzip) {
+      brillo::Blob data;
+      TEST_AND_RETURN_FALSE(utils::ReadExtents(
+          part.path,
+          file.extents,
+          &data,
+          kBlockSize * utils::BlocksInExtents(file.extents),
+          kBlockSize));
+      // |data| read from disk always has size multiple of kBlockSize. So it
+      // might contain trailing garbage data and confuse the gzip/zip
+      // processors. Trim them.
+      if (file.file_stat.st_size > 0 &&
+          static_cast<size_t>(file.file_stat.st_size) < data.size()) {
+        data.resize(file.file_stat.st_size);
+      }
+      vector<puffin::BitExtent> deflates;
+      if (!CachedDeflatePreprocessFileData(file.name, data, &deflates)) {
+        LOG(ERROR) << "Failed to preprocess deflate data in partition "
+                   << part.name;
+        return false;
       }
+      // Shift the deflate's extent to the offset starting from the beginning
+      // of the current partition; and the delta processor will align the
+      // extents in a continuous buffer later.
+      TEST_AND_RETURN_FALSE(
+          ShiftBitExtentsOverExtents(file.extents, &deflates));
+      file.deflates = std::move(deflates);
     }
+  }
+
+  result_files->push_back(std::move(file));
+  return true;
+}
+
+}  // namespace
 
-    result_files->push_back(file);
+bool PreprocessPartitionFiles(const PartitionConfig& part,
+                              vector<FilesystemInterface::File>* result_files,
+                              bool extract_deflates) {
+  // Get the file system files.
+  vector<FilesystemInterface::File> tmp_files;
+  part.fs_interface->GetFiles(&tmp_files);
+
+  // The files are preprocessed in parallel on the TaskPool, and their results
+  // appended in order.
+  vector<vector<FilesystemInterface::File>> files_results(tmp_files.size());
+  std::atomic<bool> success{true};
+  vector<TaskPool::Task> tasks;
+  tasks.reserve(tmp_files.size());
+  for (size_t i = 0; i < tmp_files.size(); i++) {
+    tasks.push_back(
+        [&part, &tmp_files, &files_results, extract_deflates, &success, i] {
+          if (!success)
+            return;
+          if (!PreprocessPartitionFile(part,
+                                       std::move(tmp_files[i]),
+                                       extract_deflates,
+                                       &files_results[i])) {
+            success = false;
+          }
+        });
+  }
+  TaskPool::RunTasks(std::move(tasks), diff_utils::GetMaxThreads());
+  TEST_AND_RETURN_FALSE(success);
+
+  size_t num_files = 0;
+  for (const auto& files : files_results)
+    num_files += files.size();
+  result_files->reserve(result_files->size() + num_files);
+  for (auto& files : files_results) {
+    std::move(files.begin(), files.end(), std::back_inserter(*result_files));
   }
   return true;
 }
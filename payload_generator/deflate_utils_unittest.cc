@@ -19,6 +19,8 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -28,6 +30,7 @@
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/fake_filesystem.h"
 
 using puffin::BitExtent;
 using puffin::ByteExtent;
@@ -186,5 +189,24 @@ TEST(DeflateUtilsTest, CompactBoundaryTest) {
   EXPECT_EQ(out_deflates, expected_out_deflates);
 }
 
+TEST(DeflateUtilsTest, PreprocessPartitionFilesKeepsOrderTest) {
+  // Enough files to be preprocessed by several threads.
+  constexpr size_t kNumFiles = 100;
+  auto fs = std::make_unique<FakeFilesystem>(kBlockSize, kNumFiles);
+  for (size_t i = 0; i < kNumFiles; i++) {
+    fs->AddFile("/file" + std::to_string(i), {ExtentForRange(i, 1)});
+  }
+  PartitionConfig part("part");
+  part.fs_interface = std::move(fs);
+
+  vector<FilesystemInterface::File> files;
+  ASSERT_TRUE(PreprocessPartitionFiles(part, &files, true));
+  ASSERT_EQ(kNumFiles, files.size());
+  for (size_t i = 0; i < kNumFiles; i++) {
+    EXPECT_EQ("/file" + std::to_string(i), files[i].name);
+    EXPECT_EQ(vector<Extent>{ExtentForRange(i, 1)}, files[i].extents);
+  }
+}
+
 }  // namespace deflate_utils
 }  // namespace chromeos_update_engine
@@ -33,7 +33,6 @@
 
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/delta_performer.h"
-#include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_generator/ab_generator.h"
 #include "update_engine/payload_generator/annotated_operation.h"
@@ -41,8 +40,15 @@
 #include "update_engine/payload_generator/cow_size_estimator.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/full_update_generator.h"
+#include "update_engine/payload_generator/generation_profiler.h"
 #include "update_engine/payload_generator/merge_sequence_generator.h"
 #include "update_engine/payload_generator/payload_file.h"
+#include "update_engine/payload_generator/lz4diff_source_cache.h"
+#include "update_engine/payload_generator/mapped_partition.h"
+#include "update_engine/payload_generator/memory_budget.h"
+#include "update_engine/payload_generator/suffix_array_cache.h"
+#include "update_engine/payload_generator/task_pool.h"
+#include "update_engine/payload_generator/zstd.h"
 #include "update_engine/update_metadata.pb.h"
 
 using std::string;
@@ -54,6 +60,13 @@ namespace chromeos_update_engine {
 // bytes
 const size_t kRootFSPartitionSize = static_cast<size_t>(2) * 1024 * 1024 * 1024;
 
+// The most bytes of blobs waiting to be written to the data file before the
+// threads generating the operations wait for the disk.
+const size_t kMaxQueuedBlobBytes = 128 * 1024 * 1024;
+
+// The least new partition data dry run by each task estimating the COW size.
+const size_t kCowEstimationChunkSize = 256 * 1024 * 1024;
+
 class PartitionProcessor : public base::DelegateSimpleThread::Delegate {
   bool IsDynamicPartition(const std::string& partition_name) {
     for (const auto& group :
@@ -90,6 +103,8 @@ class PartitionProcessor : public base::DelegateSimpleThread::Delegate {
   void Run() override {
     LOG(INFO) << "Started an async task to process partition "
               << new_part_.name;
+    GenerationProfiler::ScopedFile profile(
+        new_part_.name, "", new_part_.size / config_.block_size);
     bool success = strategy_->GenerateOperations(
         config_, old_part_, new_part_, file_writer_, aops_);
     if (!success) {
@@ -117,24 +132,22 @@ class PartitionProcessor : public base::DelegateSimpleThread::Delegate {
     }
 
     LOG(INFO) << "Estimating COW size for partition: " << new_part_.name;
-    // Need the contents of source/target image bytes when doing
-    // dry run.
-    auto target_fd = std::make_unique<EintrSafeFileDescriptor>();
-    target_fd->Open(new_part_.path.c_str(), O_RDONLY);
-
     google::protobuf::RepeatedPtrField<InstallOperation> operations;
 
     for (const AnnotatedOperation& aop : *aops_) {
       *operations.Add() = aop.op;
     }
 
-    FileDescriptorPtr source_fd = std::make_shared<EintrSafeFileDescriptor>();
-    source_fd->Open(old_part_.path.c_str(), O_RDONLY);
-
-    *cow_info_ = EstimateCowSizeInfo(
-        std::move(source_fd),
-        std::move(target_fd),
-        std::move(operations),
+    // Need the contents of source/target image bytes when doing dry run. The
+    // partition is dry run in chunks on the shared pool, each reading the
+    // images with its own file descriptors.
+    const size_t num_chunks = std::min<size_t>(
+        TaskPool::Get()->num_threads(),
+        utils::DivRoundUp(new_part_.size, kCowEstimationChunkSize));
+    *cow_info_ = EstimateCowSizeInfoConcurrently(
+        old_part_.path,
+        new_part_.path,
+        operations,
         {cow_merge_sequence_->begin(), cow_merge_sequence_->end()},
         config_.block_size,
         config_.target.dynamic_partition_metadata->vabc_compression_param(),
@@ -142,7 +155,11 @@ class PartitionProcessor : public base::DelegateSimpleThread::Delegate {
         old_part_.size,
         config_.enable_vabc_xor,
         config_.target.dynamic_partition_metadata->cow_version(),
-        config_.target.dynamic_partition_metadata->compression_factor());
+        config_.target.dynamic_partition_metadata->compression_factor(),
+        num_chunks,
+        [](std::vector<TaskPool::Task> tasks) {
+          TaskPool::Get()->Run(std::move(tasks));
+        });
 
     // add a 1% overhead to our estimation
     cow_info_->cow_size = cow_info_->cow_size * 1.01;
@@ -170,7 +187,10 @@ class PartitionProcessor : public base::DelegateSimpleThread::Delegate {
 bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
                                const string& output_path,
                                const string& private_key_path,
-                               uint64_t* metadata_size) {
+                               uint64_t* metadata_size,
+                               brillo::Blob* payload_hash,
+                               brillo::Blob* metadata_hash,
+                               brillo::Blob* file_hash) {
   if (!config.version.Validate()) {
     LOG(ERROR) << "Unsupported major.minor version: " << config.version.major
                << "." << config.version.minor;
@@ -184,7 +204,8 @@ bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
   ScopedTempFile data_file("CrAU_temp_data.XXXXXX", true);
   {
     off_t data_file_size = 0;
-    BlobFileWriter blob_file(data_file.fd(), &data_file_size);
+    BlobFileWriter blob_file(
+        data_file.fd(), &data_file_size, kMaxQueuedBlobBytes);
     if (config.is_delta) {
       TEST_AND_RETURN_FALSE(config.source.partitions.size() ==
                             config.target.partitions.size());
@@ -199,15 +220,101 @@ bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
     std::vector<android::snapshot::CowSizeInfo> all_cow_info(
         config.target.partitions.size());
 
+    // The images are mapped once for all the stages of the generation which
+    // read them.
+    std::unique_ptr<MappedPartitions> mapped_partitions;
+    if (!MappedPartitions::Get()) {
+      mapped_partitions = std::make_unique<MappedPartitions>();
+      for (const PartitionConfig& part : config.target.partitions)
+        mapped_partitions->Add(part.path);
+      if (config.is_delta) {
+        for (const PartitionConfig& part : config.source.partitions)
+          mapped_partitions->Add(part.path);
+      }
+      MappedPartitions::Set(mapped_partitions.get());
+    }
+    DEFER {
+      if (mapped_partitions) {
+        MappedPartitions::Set(nullptr);
+      }
+    };
+
     std::vector<PartitionProcessor> partition_tasks{};
-    auto thread_count = std::min<int>(diff_utils::GetMaxThreads(),
-                                      config.target.partitions.size());
-    base::DelegateSimpleThreadPool thread_pool{"partition-thread-pool",
-                                               thread_count};
+    // The partitions and all the parallel work within them share a single
+    // pool, so that --max_threads is honored across partitions and the cores
+    // finishing early pick up the files of the partitions still running.
+    std::unique_ptr<TaskPool> task_pool;
+    if (!TaskPool::Get()) {
+      task_pool = std::make_unique<TaskPool>(config.max_threads > 0
+                                                 ? config.max_threads
+                                                 : diff_utils::GetMaxThreads());
+      TaskPool::Set(task_pool.get());
+    }
+    DEFER {
+      if (task_pool) {
+        TaskPool::Set(nullptr);
+      }
+    };
+    std::unique_ptr<MemoryBudget> memory_budget;
+    if (config.max_memory_bytes > 0 && !MemoryBudget::Get()) {
+      memory_budget = std::make_unique<MemoryBudget>(config.max_memory_bytes);
+      MemoryBudget::Set(memory_budget.get());
+    }
+    DEFER {
+      if (memory_budget) {
+        MemoryBudget::Set(nullptr);
+      }
+    };
+    std::unique_ptr<SuffixArrayCache> suffix_array_cache;
+    if (config.suffix_array_cache_bytes > 0 && !SuffixArrayCache::Get()) {
+      suffix_array_cache =
+          std::make_unique<SuffixArrayCache>(config.suffix_array_cache_bytes);
+      SuffixArrayCache::Set(suffix_array_cache.get());
+    }
+    DEFER {
+      if (suffix_array_cache) {
+        SuffixArrayCache::Set(nullptr);
+      }
+    };
+    std::unique_ptr<Lz4diffSourceCache> lz4diff_source_cache;
+    if (config.lz4diff_source_cache_bytes > 0 && !Lz4diffSourceCache::Get()) {
+      lz4diff_source_cache = std::make_unique<Lz4diffSourceCache>(
+          config.lz4diff_source_cache_bytes);
+      Lz4diffSourceCache::Set(lz4diff_source_cache.get());
+    }
+    DEFER {
+      if (lz4diff_source_cache) {
+        Lz4diffSourceCache::Set(nullptr);
+      }
+    };
+    // The dictionaries are trained on the mapped images before any operation
+    // is generated, and shipped with the partitions which use them.
+    std::unique_ptr<ZstdDictionaries> zstd_dictionaries;
+    if (config.enable_zstd && !ZstdDictionaries::Get()) {
+      zstd_dictionaries = std::make_unique<ZstdDictionaries>();
+      if (config.zstd_dictionary_size > 0)
+        zstd_dictionaries->TrainAll(config, config.zstd_dictionary_size);
+      ZstdDictionaries::Set(zstd_dictionaries.get());
+    }
+    DEFER {
+      if (zstd_dictionaries) {
+        ZstdDictionaries::Set(nullptr);
+      }
+    };
+    // The device keeps the partitions left out of a partial update as they
+    // are, so the unchanged ones are left out unless they run postinstall.
+    std::vector<char> omitted(config.target.partitions.size(), false);
     for (size_t i = 0; i < config.target.partitions.size(); i++) {
       const PartitionConfig& old_part =
           config.is_delta ? config.source.partitions[i] : empty_part;
       const PartitionConfig& new_part = config.target.partitions[i];
+      if (config.is_partial_update && new_part.postinstall.IsEmpty() &&
+          diff_utils::PartitionsIdentical(old_part.path, new_part.path)) {
+        LOG(INFO) << "Leaving the unchanged partition " << new_part.name
+                  << " out of the partial update";
+        omitted[i] = true;
+        continue;
+      }
       LOG(INFO) << "Partition name: " << new_part.name;
       LOG(INFO) << "Partition size: " << new_part.size;
       LOG(INFO) << "Block count: " << new_part.size / config.block_size;
@@ -235,16 +342,21 @@ bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
                                                    &all_cow_info[i],
                                                    std::move(strategy)));
     }
-    thread_pool.Start();
+    std::vector<base::DelegateSimpleThread::Delegate*> tasks;
     for (auto& processor : partition_tasks) {
-      thread_pool.AddWork(&processor);
+      tasks.push_back(&processor);
     }
-    thread_pool.JoinAll();
+    TaskPool::Get()->Run(tasks);
+    TEST_AND_RETURN_FALSE(blob_file.Flush());
 
     for (size_t i = 0; i < config.target.partitions.size(); i++) {
       const PartitionConfig& old_part =
           config.is_delta ? config.source.partitions[i] : empty_part;
       const PartitionConfig& new_part = config.target.partitions[i];
+      if (omitted[i]) {
+        payload.OmitPartition(new_part.name);
+        continue;
+      }
       TEST_AND_RETURN_FALSE(
           payload.AddPartition(old_part,
                                new_part,
@@ -257,8 +369,13 @@ bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
 
   LOG(INFO) << "Writing payload file...";
   // Write payload file to disk.
-  TEST_AND_RETURN_FALSE(payload.WritePayload(
-      output_path, data_file.path(), private_key_path, metadata_size));
+  TEST_AND_RETURN_FALSE(payload.WritePayload(output_path,
+                                             data_file.path(),
+                                             private_key_path,
+                                             metadata_size,
+                                             payload_hash,
+                                             metadata_hash,
+                                             file_hash));
 
   LOG(INFO) << "All done. Successfully created delta file with "
             << "metadata size = " << *metadata_size;
@@ -19,6 +19,8 @@
 
 #include <string>
 
+#include <brillo/secure_blob.h>
+
 #include "update_engine/payload_generator/payload_generation_config.h"
 
 namespace chromeos_update_engine {
@@ -36,11 +38,16 @@ extern const size_t kRootFSPartitionSize;
 // Pass empty string to not sign the update.
 // |output_path| is the filename where the delta update should be written.
 // Returns true on success. Also writes the size of the metadata into
-// |metadata_size|.
+// |metadata_size|, and the payload and metadata hashes for signing, computed
+// while writing the payload, into |payload_hash| and |metadata_hash| if not
+// null, and the hash of the whole payload file into |file_hash| if not null.
 bool GenerateUpdatePayloadFile(const PayloadGenerationConfig& config,
                                const std::string& output_path,
                                const std::string& private_key_path,
-                               uint64_t* metadata_size);
+                               uint64_t* metadata_size,
+                               brillo::Blob* payload_hash = nullptr,
+                               brillo::Blob* metadata_hash = nullptr,
+                               brillo::Blob* file_hash = nullptr);
 
 };  // namespace chromeos_update_engine
 
@@ -30,12 +30,15 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <functional>
 #include <limits>
 #include <list>
 #include <map>
 #include <memory>
 #include <numeric>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -57,6 +60,7 @@
 #include <zucchini/zucchini.h>
 
 #include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/simd_utils.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/lz4diff/lz4diff.h"
 #include "update_engine/payload_consumer/payload_constants.h"
@@ -65,9 +69,19 @@
 #include "update_engine/payload_generator/bzip.h"
 #include "update_engine/payload_generator/deflate_utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/diff_cache.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/generation_profiler.h"
+#include "update_engine/payload_generator/lz4diff_source_cache.h"
+#include "update_engine/payload_generator/mapped_partition.h"
+#include "update_engine/payload_generator/memory_budget.h"
+#include "update_engine/payload_generator/payload_reuse.h"
+#include "update_engine/payload_generator/rolling_hash.h"
+#include "update_engine/payload_generator/suffix_array_cache.h"
+#include "update_engine/payload_generator/task_pool.h"
 #include "update_engine/payload_generator/xz.h"
+#include "update_engine/payload_generator/zstd.h"
 
 using std::list;
 using std::map;
@@ -99,15 +113,12 @@ const int kBrotliCompressionQuality = 11;
 // manifest, we need to store an additional src_sha256_hash which is 32 bytes
 // and not compressible, and also src_extents which could use anywhere from a
 // few bytes to hundreds of bytes depending on the number of extents.
-// This function evaluates the overhead tradeoff and determines if it's worth to
-// use a diff operation with data blob of |diff_size| and |num_src_extents|
-// extents over an existing |op| with data blob of |old_blob_size|.
-bool IsDiffOperationBetter(const InstallOperation& op,
-                           size_t old_blob_size,
-                           size_t diff_size,
-                           size_t num_src_extents) {
+// Returns the bytes that a diff operation with |num_src_extents| extents
+// adds to the manifest over the existing |op|.
+size_t DiffOperationOverhead(const InstallOperation& op,
+                             size_t num_src_extents) {
   if (!diff_utils::IsAReplaceOperation(op.type()))
-    return diff_size < old_blob_size;
+    return 0;
 
   // Reference: https://developers.google.com/protocol-buffers/docs/encoding
   // For |src_sha256_hash| we need 1 byte field number/type, 1 byte size and 32
@@ -119,10 +130,160 @@ bool IsDiffOperationBetter(const InstallOperation& op,
   // very small.
   constexpr size_t kDiffOverheadPerExtent = 6;
 
-  return diff_size + kDiffOverhead + num_src_extents * kDiffOverheadPerExtent <
+  return kDiffOverhead + num_src_extents * kDiffOverheadPerExtent;
+}
+
+// This function evaluates the overhead tradeoff and determines if it's worth to
+// use a diff operation with data blob of |diff_size| and |num_src_extents|
+// extents over an existing |op| with data blob of |old_blob_size|.
+bool IsDiffOperationBetter(const InstallOperation& op,
+                           size_t old_blob_size,
+                           size_t diff_size,
+                           size_t num_src_extents) {
+  return diff_size + DiffOperationOverhead(op, num_src_extents) <
          old_blob_size;
 }
 
+// Same as above, but comparing the costs in |cost_model| of |op| and of the
+// diff operation of |diff_type|, both writing |dst_size| bytes.
+bool IsDiffOperationBetter(const ApplyCostModel& cost_model,
+                           const InstallOperation& op,
+                           size_t old_blob_size,
+                           InstallOperation::Type diff_type,
+                           size_t diff_size,
+                           size_t num_src_extents,
+                           uint64_t dst_size) {
+  return cost_model.Cost(diff_type, diff_size, dst_size) +
+             DiffOperationOverhead(op, num_src_extents) <
+         cost_model.Cost(op.type(), old_blob_size, dst_size);
+}
+
+// Whether zucchini is tried on the file |name|. zip files are ignored for now,
+// we expect puffin to perform better on those.
+// Investigate whether puffin over zucchini yields better results on those.
+bool IsZucchiniFile(const string& name) {
+  return deflate_utils::IsFileExtensions(
+      name,
+      {".ko",
+       ".so",
+       ".art",
+       ".odex",
+       ".vdex",
+       "<kernel>",
+       "<modem-partition>",
+       /*, ".capex",".jar", ".apk", ".apex"*/});
+}
+
+// Relative cost per block of generating the operations of a file, by the
+// algorithms tried on it. Only the ordering of the files matters.
+constexpr uint64_t kFullOperationCost = 1;
+constexpr uint64_t kLz4diffCost = 4;
+constexpr uint64_t kBsdiffCost = 4;
+constexpr uint64_t kPuffdiffCost = 8;
+constexpr uint64_t kZucchiniCost = 4;
+
+// The parameters of PayloadGenerationConfig::fast_algorithm_selection.
+// The bytes of the new data sampled to estimate its entropy.
+constexpr size_t kEntropySampleSize = 64 * 1024;
+// The data with more bits of entropy per byte, like most compressed data, is
+// not compressed further.
+constexpr double kIncompressibleEntropy = 7.9;
+// Once a patch is smaller than the new data divided by this, the other diff
+// algorithms are not tried, since they could save little.
+constexpr size_t kSmallPatchRatio = 64;
+
+// The parameters of PayloadGenerationConfig::adaptive_chunk_apply_memory_bytes.
+// The blocks of a file sampled to estimate its entropy.
+constexpr size_t kChunkSampleBlocks = 16;
+// The files with fewer bits of entropy per byte get the largest chunks.
+constexpr double kCompressibleEntropy = 6.0;
+// The memory needed to apply an operation is at most this many times the
+// size of its chunk, for a LZ4DIFF_PUFFDIFF holding its source and target
+// both compressed and decompressed.
+constexpr uint64_t kChunkApplyMemoryFactor = 4;
+
+// Estimates the cost of generating the operations of |num_blocks| blocks of
+// |new_file| from |old_file|, mirroring the algorithms
+// BestDiffGenerator::GenerateBestDiffOperation() tries.
+uint64_t EstimateDeltaCost(const FilesystemInterface::File& old_file,
+                           const FilesystemInterface::File& new_file,
+                           uint64_t num_blocks,
+                           const PayloadGenerationConfig& config) {
+  uint64_t cost = kFullOperationCost;
+  if (!old_file.extents.empty()) {
+    const uint64_t bytes = num_blocks * kBlockSize;
+    if (!old_file.compressed_file_info.blocks.empty() &&
+        !new_file.compressed_file_info.blocks.empty() &&
+        config.OperationEnabled(InstallOperation::LZ4DIFF_BSDIFF) &&
+        config.OperationEnabled(InstallOperation::LZ4DIFF_PUFFDIFF)) {
+      cost += kLz4diffCost;
+    } else {
+      if (config.OperationEnabled(InstallOperation::SOURCE_BSDIFF) &&
+          bytes <= kMaxBsdiffDestinationSize) {
+        cost += kBsdiffCost;
+      }
+      if (config.OperationEnabled(InstallOperation::PUFFDIFF) &&
+          bytes <= kMaxPuffdiffDestinationSize &&
+          !old_file.deflates.empty() && !new_file.deflates.empty()) {
+        cost += kPuffdiffCost;
+      }
+      if (config.OperationEnabled(InstallOperation::ZUCCHINI) &&
+          bytes <= kMaxZucchiniDestinationSize &&
+          IsZucchiniFile(new_file.name)) {
+        cost += kZucchiniCost;
+      }
+    }
+  }
+  return cost * num_blocks;
+}
+
+// Rough memory used by the algorithms, by input byte: one suffix array index
+// by source byte for bsdiff and zucchini, and the expansion of the deflate and
+// LZ4 data puffdiff and lz4diff decompress before diffing it.
+constexpr uint64_t kSuffixArrayBytesPerByte = 8;
+constexpr uint64_t kDeflateExpansionRatio = 3;
+constexpr uint64_t kLz4ExpansionRatio = 2;
+
+// Estimates the memory used to generate the operations of a chunk of
+// |new_bytes| of |new_file| from |old_bytes| of |old_file|, mirroring the
+// algorithms EstimateDeltaCost() accounts for: both data and the compressed
+// new data, plus the working memory of the diff algorithms, which run one at a
+// time.
+uint64_t EstimateDeltaMemory(const FilesystemInterface::File& old_file,
+                             const FilesystemInterface::File& new_file,
+                             uint64_t old_bytes,
+                             uint64_t new_bytes,
+                             const PayloadGenerationConfig& config) {
+  const uint64_t data_bytes = old_bytes + 2 * new_bytes;
+  if (old_file.extents.empty())
+    return data_bytes;
+  uint64_t diff_bytes = 0;
+  if (!old_file.compressed_file_info.blocks.empty() &&
+      !new_file.compressed_file_info.blocks.empty() &&
+      config.OperationEnabled(InstallOperation::LZ4DIFF_BSDIFF) &&
+      config.OperationEnabled(InstallOperation::LZ4DIFF_PUFFDIFF)) {
+    diff_bytes = kLz4ExpansionRatio * (old_bytes + new_bytes) +
+                 kSuffixArrayBytesPerByte * kLz4ExpansionRatio * old_bytes;
+  } else {
+    if ((config.OperationEnabled(InstallOperation::SOURCE_BSDIFF) &&
+         new_bytes <= kMaxBsdiffDestinationSize) ||
+        (config.OperationEnabled(InstallOperation::ZUCCHINI) &&
+         new_bytes <= kMaxZucchiniDestinationSize &&
+         IsZucchiniFile(new_file.name))) {
+      diff_bytes = kSuffixArrayBytesPerByte * old_bytes;
+    }
+    if (config.OperationEnabled(InstallOperation::PUFFDIFF) &&
+        new_bytes <= kMaxPuffdiffDestinationSize &&
+        !old_file.deflates.empty() && !new_file.deflates.empty()) {
+      diff_bytes = std::max(
+          diff_bytes,
+          kDeflateExpansionRatio * (old_bytes + new_bytes) +
+              kSuffixArrayBytesPerByte * kDeflateExpansionRatio * old_bytes);
+    }
+  }
+  return data_bytes + diff_bytes;
+}
+
 // Returns the levenshtein distance between string |a| and |b|.
 // https://en.wikipedia.org/wiki/Levenshtein_distance
 int LevenshteinDistance(const string& a, const string& b) {
@@ -187,6 +348,237 @@ void AppendXorBlock(std::vector<CowMergeOperation>* ops,
   }
 }
 
+// Returns the entropy in bits per byte of the byte values of evenly spaced
+// runs of |data|, sampling at most kEntropySampleSize bytes.
+double SampleEntropy(const brillo::Blob& data) {
+  constexpr size_t kNumRuns = 16;
+  const size_t run_size = std::min(data.size(), kEntropySampleSize) / kNumRuns;
+  size_t counts[256] = {};
+  size_t total = 0;
+  if (run_size == 0) {
+    for (uint8_t byte : data)
+      counts[byte]++;
+    total = data.size();
+  } else {
+    const size_t stride = (data.size() - run_size) / (kNumRuns - 1);
+    for (size_t run = 0; run < kNumRuns; run++) {
+      const uint8_t* begin = data.data() + run * stride;
+      for (const uint8_t* byte = begin; byte < begin + run_size; byte++)
+        counts[*byte]++;
+    }
+    total = run_size * kNumRuns;
+  }
+  double entropy = 0;
+  for (size_t count : counts) {
+    if (count > 0) {
+      const double p = static_cast<double>(count) / total;
+      entropy -= p * std::log2(p);
+    }
+  }
+  return entropy;
+}
+
+// Implements diff_utils::GenerateBestFullOperation(), skipping the
+// compressors unlikely to produce a smaller blob if |fast| and comparing the
+// operations by their cost in |cost_model|.
+bool BestFullOperation(const brillo::Blob& new_data,
+                       const std::string& new_part,
+                       const PayloadVersion& version,
+                       bool fast,
+                       const ApplyCostModel& cost_model,
+                       brillo::Blob* out_blob,
+                       InstallOperation::Type* out_type) {
+  if (new_data.empty())
+    return false;
+
+  if (version.OperationAllowed(InstallOperation::ZERO) &&
+      simd_utils::IsZero(new_data.data(), new_data.size())) {
+    // The read buffer is all zeros, so produce a ZERO operation. No need to
+    // check other types of operations in this case.
+    *out_blob = brillo::Blob();
+    *out_type = InstallOperation::ZERO;
+    return true;
+  }
+
+  bool out_blob_set = false;
+  // Most already compressed data doesn't compress any further.
+  const bool compress =
+      !fast || SampleEntropy(new_data) <= kIncompressibleEntropy;
+
+  // Try compressing |new_data| with zstd first if it's enabled, which is much
+  // faster to decompress than the others, with the dictionary of |new_part|.
+  const ZstdDictionaries* zstd_dictionaries = ZstdDictionaries::Get();
+  if (compress && zstd_dictionaries &&
+      version.OperationAllowed(InstallOperation::REPLACE_ZSTD)) {
+    brillo::Blob new_data_zstd;
+    GenerationProfiler::ScopedAlgorithm profile("zstd", new_data.size());
+    if (ZstdCompress(new_data,
+                     zstd_dictionaries->Find(new_part),
+                     &new_data_zstd) &&
+        !new_data_zstd.empty()) {
+      profile.set_output_bytes(new_data_zstd.size());
+      *out_type = InstallOperation::REPLACE_ZSTD;
+      *out_blob = std::move(new_data_zstd);
+      out_blob_set = true;
+    }
+  }
+  // Without an apply cost model to weigh the smaller xz and bzip2 blobs
+  // against their slower decompression, zstd wins when enabled.
+  const bool try_slow_compressors = !out_blob_set || !cost_model.IsEmpty();
+
+  // Try compressing |new_data| with xz.
+  if (compress && try_slow_compressors &&
+      version.OperationAllowed(InstallOperation::REPLACE_XZ)) {
+    brillo::Blob new_data_xz;
+    GenerationProfiler::ScopedAlgorithm profile("xz", new_data.size());
+    const bool compressed = XzCompress(new_data, &new_data_xz);
+    profile.set_output_bytes(new_data_xz.size());
+    if (compressed && !new_data_xz.empty() &&
+        (!out_blob_set ||
+         cost_model.Cost(*out_type, out_blob->size(), new_data.size()) >
+             cost_model.Cost(InstallOperation::REPLACE_XZ,
+                             new_data_xz.size(),
+                             new_data.size()))) {
+      *out_type = InstallOperation::REPLACE_XZ;
+      *out_blob = std::move(new_data_xz);
+      out_blob_set = true;
+    }
+  }
+
+  // Try compressing it with bzip2, which rarely beats xz by much.
+  if (compress && try_slow_compressors && !(fast && out_blob_set) &&
+      version.OperationAllowed(InstallOperation::REPLACE_BZ)) {
+    brillo::Blob new_data_bz;
+    GenerationProfiler::ScopedAlgorithm profile("bz2", new_data.size());
+    const bool compressed = BzipCompress(new_data, &new_data_bz);
+    profile.set_output_bytes(new_data_bz.size());
+    if (compressed && !new_data_bz.empty() &&
+        (!out_blob_set ||
+         cost_model.Cost(*out_type, out_blob->size(), new_data.size()) >
+             cost_model.Cost(InstallOperation::REPLACE_BZ,
+                             new_data_bz.size(),
+                             new_data.size()))) {
+      // A REPLACE_BZ is better or nothing else was set.
+      *out_type = InstallOperation::REPLACE_BZ;
+      *out_blob = std::move(new_data_bz);
+      out_blob_set = true;
+    }
+  }
+
+  // If nothing else worked or it was badly compressed we try a REPLACE.
+  if (!out_blob_set ||
+      cost_model.Cost(*out_type, out_blob->size(), new_data.size()) >=
+          cost_model.Cost(
+              InstallOperation::REPLACE, new_data.size(), new_data.size())) {
+    *out_type = InstallOperation::REPLACE;
+    // This needs to make a copy of the data in the case the compressors didn't
+    // compress well, which is not the common case so the performance hit is
+    // low.
+    *out_blob = new_data;
+  }
+  return true;
+}
+
+// Appends operations of |type| copying the blocks |src_blocks| to the blocks
+// |dst_blocks|, one block for one block, split at the extents of
+// |dst_blocks| and every |chunk_blocks| blocks. Returns the number of blocks
+// copied.
+uint64_t AddCopyOperations(InstallOperation::Type type,
+                           const string& name,
+                           const vector<Extent>& src_blocks,
+                           const vector<Extent>& dst_blocks,
+                           uint64_t chunk_blocks,
+                           vector<AnnotatedOperation>* aops) {
+  uint64_t used_blocks = 0;
+  for (const Extent& extent : dst_blocks) {
+    // We split the operation at the extent boundary or when bigger than
+    // chunk_blocks.
+    for (uint64_t op_block_offset = 0; op_block_offset < extent.num_blocks();
+         op_block_offset += chunk_blocks) {
+      aops->emplace_back();
+      AnnotatedOperation* aop = &aops->back();
+      aop->name = name;
+      aop->op.set_type(type);
+
+      uint64_t chunk_num_blocks =
+          std::min(static_cast<uint64_t>(extent.num_blocks()) - op_block_offset,
+                   chunk_blocks);
+
+      // The current operation represents the copy operation for the sublist
+      // starting at |used_blocks| of length |chunk_num_blocks| where the src
+      // and dst are from |src_blocks| and |dst_blocks| respectively.
+      StoreExtents(ExtentsSublist(src_blocks, used_blocks, chunk_num_blocks),
+                   aop->op.mutable_src_extents());
+
+      Extent* op_dst_extent = aop->op.add_dst_extents();
+      op_dst_extent->set_start_block(extent.start_block() + op_block_offset);
+      op_dst_extent->set_num_blocks(chunk_num_blocks);
+      CHECK(vector<Extent>{*op_dst_extent} ==  // NOLINT(whitespace/braces)
+            ExtentsSublist(dst_blocks, used_blocks, chunk_num_blocks));
+
+      used_blocks += chunk_num_blocks;
+    }
+  }
+  return used_blocks;
+}
+
+// The partition images are compared and scanned for zeroed blocks in chunks of
+// this many blocks when looking for unchanged partitions.
+constexpr uint64_t kUnchangedCompareBlocks = 8192;
+
+// The windows hashed to find the shifted data, and how many of them must
+// match for the shift to be used.
+constexpr size_t kShiftWindowSize = 64;
+constexpr size_t kMinShiftMatches = 16;
+
+// Finds the old chunk the data of the new chunk of |chunk_blocks| blocks at
+// |block_offset| in |new_extents| moved from, among the old chunks at the
+// same offset in |old_extents| and next to it, typically by a number of
+// bytes which isn't a multiple of the block size. Returns the old extents to
+// diff the new chunk against, one block longer than a chunk so that they hold
+// the whole shifted data, or an empty list if the data didn't shift.
+vector<Extent> FindShiftedOldChunk(const string& old_part,
+                                   const string& new_part,
+                                   const vector<Extent>& old_extents,
+                                   const vector<Extent>& new_extents,
+                                   uint64_t block_offset,
+                                   uint64_t chunk_blocks) {
+  const uint64_t old_blocks = utils::BlocksInExtents(old_extents);
+  const uint64_t nearby_start =
+      block_offset > chunk_blocks ? block_offset - chunk_blocks : 0;
+  if (nearby_start >= old_blocks) {
+    return {};
+  }
+  const uint64_t nearby_blocks =
+      std::min(block_offset + 2 * chunk_blocks - nearby_start,
+               old_blocks - nearby_start);
+  brillo::Blob old_data, new_data;
+  if (!MappedPartitions::ReadExtents(
+          old_part,
+          ExtentsSublist(old_extents, nearby_start, nearby_blocks),
+          &old_data) ||
+      !MappedPartitions::ReadExtents(
+          new_part,
+          ExtentsSublist(new_extents, block_offset, chunk_blocks),
+          &new_data)) {
+    return {};
+  }
+  const auto shift =
+      FindDataShift(old_data, new_data, kShiftWindowSize, kMinShiftMatches);
+  if (!shift || *shift == 0) {
+    return {};
+  }
+  // The new chunk starts at this offset in |old_data|.
+  const int64_t old_offset =
+      static_cast<int64_t>((block_offset - nearby_start) * kBlockSize) - *shift;
+  const uint64_t start_block =
+      std::min<uint64_t>(std::max<int64_t>(old_offset, 0) / kBlockSize,
+                         nearby_blocks - 1);
+  const uint64_t num_blocks =
+      std::min(chunk_blocks + 1, nearby_blocks - start_block);
+  return ExtentsSublist(old_extents, nearby_start + start_block, num_blocks);
+}
+
 }  // namespace
 
 namespace diff_utils {
@@ -198,7 +590,117 @@ bool BestDiffGenerator::GenerateBestDiffOperation(AnnotatedOperation* aop,
       {InstallOperation::ZUCCHINI, kMaxZucchiniDestinationSize},
   };
 
-  return GenerateBestDiffOperation(diff_candidates, aop, data_blob);
+  if (config_.diff_cache_dir.empty())
+    return GenerateBestDiffOperation(diff_candidates, aop, data_blob);
+
+  // The full operation in |aop| and |data_blob| is the result if no diff is
+  // better, so it's part of the key.
+  const DiffCache cache(config_.diff_cache_dir);
+  const brillo::Blob key = DiffCacheKey(*aop, *data_blob);
+  InstallOperation::Type cached_type{};
+  brillo::Blob cached_patch;
+  if (cache.Lookup(key, &cached_type, &cached_patch)) {
+    GenerationProfiler::ScopedAlgorithm profile("diff_cache",
+                                                new_data_.size());
+    profile.set_output_bytes(cached_patch.size());
+    if (cached_type == aop->op.type())
+      return true;
+    aop->op.set_type(cached_type);
+    *data_blob = std::move(cached_patch);
+    if (config_.enable_vabc_xor &&
+        (cached_type == InstallOperation::SOURCE_BSDIFF ||
+         cached_type == InstallOperation::BROTLI_BSDIFF)) {
+      StoreExtents(src_extents_, aop->op.mutable_src_extents());
+      diff_utils::PopulateXorOps(aop, *data_blob);
+    }
+    return true;
+  }
+
+  // The diffs of the other shards are computed by other generators.
+  if (!DiffCache::InShard(
+          key, config_.diff_cache_shard, config_.diff_cache_shards)) {
+    return true;
+  }
+
+  const InstallOperation::Type full_type = aop->op.type();
+  TEST_AND_RETURN_FALSE(
+      GenerateBestDiffOperation(diff_candidates, aop, data_blob));
+  // The XOR operations are only recomputed for a cached bsdiff, so don't cache
+  // the other operations that have some.
+  const InstallOperation::Type type = aop->op.type();
+  if (aop->xor_ops.empty() || type == InstallOperation::SOURCE_BSDIFF ||
+      type == InstallOperation::BROTLI_BSDIFF) {
+    if (!cache.Store(
+            key, type, type == full_type ? brillo::Blob() : *data_blob)) {
+      LOG(WARNING) << "Failed to cache the diff of " << aop->name;
+    }
+  }
+  return true;
+}
+
+brillo::Blob BestDiffGenerator::DiffCacheKey(
+    const AnnotatedOperation& aop, const brillo::Blob& data_blob) const {
+  HashCalculator hasher;
+  auto update = [&hasher](const auto& value) {
+    hasher.Update(&value, sizeof(value));
+  };
+  auto update_blob = [&hasher, &update](const brillo::Blob& blob) {
+    update(blob.size());
+    hasher.Update(blob.data(), blob.size());
+  };
+  auto update_string = [&hasher, &update](const string& value) {
+    update(value.size());
+    hasher.Update(value.data(), value.size());
+  };
+  update_blob(old_data_);
+  update_blob(new_data_);
+  update(aop.op.type());
+  update_blob(data_blob);
+
+  update(config_.version.major);
+  update(config_.version.minor);
+  update(config_.enable_vabc_xor);
+  update(config_.fast_algorithm_selection);
+  const ApplyCostModel& cost_model = config_.apply_cost_model;
+  update(cost_model.download_bytes_per_second);
+  for (const auto& [type, ms_per_mib] : cost_model.apply_ms_per_mib) {
+    update(type);
+    update(ms_per_mib);
+  }
+  for (int type = InstallOperation::Type_MIN;
+       type <= InstallOperation::Type_MAX;
+       type++) {
+    if (InstallOperation::Type_IsValid(type)) {
+      update(config_.OperationEnabled(
+          static_cast<InstallOperation::Type>(type)));
+    }
+  }
+  for (const bsdiff::CompressorType compressor : config_.compressors)
+    update(compressor);
+  // Zucchini is only tried on some files.
+  update(IsZucchiniFile(aop.name));
+
+  for (const vector<puffin::BitExtent>* deflates :
+       {&old_deflates_, &new_deflates_}) {
+    update(deflates->size());
+    for (const puffin::BitExtent& deflate : *deflates) {
+      update(deflate.offset);
+      update(deflate.length);
+    }
+  }
+  for (const CompressedFile* block_info :
+       {&old_block_info_, &new_block_info_}) {
+    update(block_info->blocks.size());
+    for (const CompressedBlock& block : block_info->blocks) {
+      update(block.uncompressed_offset);
+      update(block.compressed_length);
+      update(block.uncompressed_length);
+    }
+    update_string(block_info->algo.SerializeAsString());
+    update(block_info->zero_padding_enabled);
+  }
+  CHECK(hasher.Finalize());
+  return hasher.raw_hash();
 }
 
 std::vector<bsdiff::CompressorType>
@@ -218,12 +720,25 @@ bool BestDiffGenerator::GenerateBestDiffOperation(
       config_.OperationEnabled(InstallOperation::LZ4DIFF_PUFFDIFF)) {
     brillo::Blob patch;
     InstallOperation::Type op_type{};
-    if (Lz4Diff(old_data_,
-                new_data_,
-                old_block_info_,
-                new_block_info_,
-                &patch,
-                &op_type)) {
+    GenerationProfiler::ScopedAlgorithm profile("lz4diff", new_data_.size());
+    const std::shared_ptr<const brillo::Blob> decompressed_old_data =
+        Lz4diffSourceCache::RunDecompress(
+            old_partition_path_, src_extents_, old_data_, old_block_info_);
+    // The blocks of the new file are recompressed by the threads of the pool,
+    // or by this thread if there is none.
+    TaskPool* pool = TaskPool::Get();
+    if (Lz4DiffDecompressedSource(
+            *decompressed_old_data,
+            ToStringView(new_data_),
+            old_block_info_,
+            new_block_info_,
+            pool ? pool->num_threads() : 1,
+            [pool](std::vector<TaskPool::Task> tasks) {
+              pool->Run(std::move(tasks));
+            },
+            &patch,
+            &op_type)) {
+      profile.set_output_bytes(patch.size());
       aop->op.set_type(op_type);
       // LZ4DIFF is likely significantly better than BSDIFF/PUFFDIFF when
       // working with EROFS. So no need to even try other diffing algorithms.
@@ -241,6 +756,13 @@ bool BestDiffGenerator::GenerateBestDiffOperation(
       continue;
     }
 
+    // The operation is already small enough that the other algorithms could
+    // save little.
+    if (config_.fast_algorithm_selection &&
+        data_blob->size() * kSmallPatchRatio < new_data_.size()) {
+      break;
+    }
+
     // Disable the specific diff algorithm when the data is too big.
     if (input_bytes > limit) {
       LOG(INFO) << op_type << " ignored, file " << aop->name
@@ -291,21 +813,25 @@ bool BestDiffGenerator::TryBsdiffAndUpdateOperation(
   }
 
   brillo::Blob bsdiff_delta;
-  TEST_AND_RETURN_FALSE(0 == bsdiff::bsdiff(old_data_.data(),
-                                            old_data_.size(),
-                                            new_data_.data(),
-                                            new_data_.size(),
-                                            bsdiff_patch_writer.get(),
-                                            nullptr));
+  GenerationProfiler::ScopedAlgorithm profile(
+      operation_type == InstallOperation::BROTLI_BSDIFF ? "brotli_bsdiff"
+                                                        : "bsdiff",
+      new_data_.size());
+  TEST_AND_RETURN_FALSE(SuffixArrayCache::RunBsdiff(
+      old_data_, new_data_, bsdiff_patch_writer.get()));
 
   TEST_AND_RETURN_FALSE(utils::ReadFile(patch.value(), &bsdiff_delta));
   TEST_AND_RETURN_FALSE(!bsdiff_delta.empty());
+  profile.set_output_bytes(bsdiff_delta.size());
 
   InstallOperation& operation = aop->op;
-  if (IsDiffOperationBetter(operation,
+  if (IsDiffOperationBetter(config_.apply_cost_model,
+                            operation,
                             data_blob->size(),
+                            operation_type,
                             bsdiff_delta.size(),
-                            src_extents_.size())) {
+                            src_extents_.size(),
+                            new_data_.size())) {
     // VABC XOR won't work with compressed files just yet.
     if (config_.enable_vabc_xor) {
       StoreExtents(src_extents_, operation.mutable_src_extents());
@@ -323,6 +849,7 @@ bool BestDiffGenerator::TryPuffdiffAndUpdateOperation(AnnotatedOperation* aop,
   if (!old_deflates_.empty() && !new_deflates_.empty()) {
     brillo::Blob puffdiff_delta;
     ScopedTempFile temp_file("puffdiff-delta.XXXXXX");
+    GenerationProfiler::ScopedAlgorithm profile("puffdiff", new_data_.size());
     // Perform PuffDiff operation.
     TEST_AND_RETURN_FALSE(puffin::PuffDiff(old_data_,
                                            new_data_,
@@ -332,12 +859,16 @@ bool BestDiffGenerator::TryPuffdiffAndUpdateOperation(AnnotatedOperation* aop,
                                            temp_file.path(),
                                            &puffdiff_delta));
     TEST_AND_RETURN_FALSE(!puffdiff_delta.empty());
+    profile.set_output_bytes(puffdiff_delta.size());
 
     InstallOperation& operation = aop->op;
-    if (IsDiffOperationBetter(operation,
+    if (IsDiffOperationBetter(config_.apply_cost_model,
+                              operation,
                               data_blob->size(),
+                              InstallOperation::PUFFDIFF,
                               puffdiff_delta.size(),
-                              src_extents_.size())) {
+                              src_extents_.size(),
+                              new_data_.size())) {
       operation.set_type(InstallOperation::PUFFDIFF);
       *data_blob = std::move(puffdiff_delta);
     }
@@ -347,20 +878,10 @@ bool BestDiffGenerator::TryPuffdiffAndUpdateOperation(AnnotatedOperation* aop,
 
 bool BestDiffGenerator::TryZucchiniAndUpdateOperation(AnnotatedOperation* aop,
                                                       brillo::Blob* data_blob) {
-  // zip files are ignored for now. We expect puffin to perform better on those.
-  // Investigate whether puffin over zucchini yields better results on those.
-  if (!deflate_utils::IsFileExtensions(
-          aop->name,
-          {".ko",
-           ".so",
-           ".art",
-           ".odex",
-           ".vdex",
-           "<kernel>",
-           "<modem-partition>",
-           /*, ".capex",".jar", ".apk", ".apex"*/})) {
+  if (!IsZucchiniFile(aop->name)) {
     return true;
   }
+  GenerationProfiler::ScopedAlgorithm profile("zucchini", new_data_.size());
   zucchini::ConstBufferView src_bytes(old_data_.data(), old_data_.size());
   zucchini::ConstBufferView dst_bytes(new_data_.data(), new_data_.size());
 
@@ -377,12 +898,16 @@ bool BestDiffGenerator::TryZucchiniAndUpdateOperation(AnnotatedOperation* aop,
   brillo::Blob compressed_delta;
   TEST_AND_RETURN_FALSE(puffin::BrotliEncode(
       zucchini_delta.data(), zucchini_delta.size(), &compressed_delta));
+  profile.set_output_bytes(compressed_delta.size());
 
   InstallOperation& operation = aop->op;
-  if (IsDiffOperationBetter(operation,
+  if (IsDiffOperationBetter(config_.apply_cost_model,
+                            operation,
                             data_blob->size(),
+                            InstallOperation::ZUCCHINI,
                             compressed_delta.size(),
-                            src_extents_.size())) {
+                            src_extents_.size(),
+                            new_data_.size())) {
     operation.set_type(InstallOperation::ZUCCHINI);
     *data_blob = std::move(compressed_delta);
   }
@@ -390,35 +915,65 @@ bool BestDiffGenerator::TryZucchiniAndUpdateOperation(AnnotatedOperation* aop,
   return true;
 }
 
+// Number of blocks of the |num_chunks| chunks of |chunk_blocks| blocks
+// starting at |first_chunk| in a file of |total_blocks| blocks.
+uint64_t ChunksBlocks(uint64_t total_blocks,
+                      ssize_t chunk_blocks,
+                      size_t first_chunk,
+                      size_t num_chunks) {
+  if (chunk_blocks <= 0)
+    return total_blocks;
+  const uint64_t first_block = first_chunk * chunk_blocks;
+  if (first_block >= total_blocks)
+    return 0;
+  if (num_chunks >= (total_blocks - first_block) / chunk_blocks + 1)
+    return total_blocks - first_block;
+  return num_chunks * chunk_blocks;
+}
+
 // This class encapsulates a file delta processing thread work. The
-// processor computes the delta between the source and target files;
-// and write the compressed delta to the blob.
+// processor computes the delta between the source and target files, or the
+// |num_chunks| chunks of them starting at |first_chunk|, and write the
+// compressed delta to the blob.
 class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
  public:
-  FileDeltaProcessor(const string& old_part,
+  FileDeltaProcessor(const string& partition_name,
+                     const string& old_part,
                      const string& new_part,
                      const PayloadGenerationConfig& config,
                      const File& old_extents,
                      const File& new_extents,
                      const string& name,
                      ssize_t chunk_blocks,
+                     size_t first_chunk,
+                     size_t num_chunks,
                      BlobFileWriter* blob_file)
-      : old_part_(old_part),
+      : partition_name_(partition_name),
+        old_part_(old_part),
         new_part_(new_part),
         config_(config),
         old_extents_(old_extents),
         new_extents_(new_extents),
-        new_extents_blocks_(utils::BlocksInExtents(new_extents.extents)),
+        new_extents_blocks_(ChunksBlocks(utils::BlocksInExtents(
+                                             new_extents.extents),
+                                         chunk_blocks,
+                                         first_chunk,
+                                         num_chunks)),
         name_(name),
         chunk_blocks_(chunk_blocks),
+        first_chunk_(first_chunk),
+        num_chunks_(num_chunks),
+        cost_(EstimateDeltaCost(
+            old_extents, new_extents, new_extents_blocks_, config)),
+        memory_(EstimateMemory()),
         blob_file_(blob_file) {}
 
-  bool operator>(const FileDeltaProcessor& other) const {
-    return new_extents_blocks_ > other.new_extents_blocks_;
-  }
-
   ~FileDeltaProcessor() override = default;
 
+  // The estimated cost of Run(), used to start the most expensive processors
+  // first.
+  uint64_t cost() const { return cost_; }
+
   // Overrides DelegateSimpleThread::Delegate.
   // Calculate the list of operations and write their corresponding deltas to
   // the blob_file.
@@ -428,6 +983,10 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
   bool MergeOperation(vector<AnnotatedOperation>* aops);
 
  private:
+  // Estimates the memory used by Run() to process its largest chunk.
+  uint64_t EstimateMemory() const;
+
+  const string& partition_name_;  // NOLINT(runtime/member_string_references)
   const string& old_part_;  // NOLINT(runtime/member_string_references)
   const string& new_part_;  // NOLINT(runtime/member_string_references)
   const PayloadGenerationConfig& config_;
@@ -439,6 +998,11 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
   const string name_;
   // Block limit of one aop.
   const ssize_t chunk_blocks_;
+  const size_t first_chunk_;
+  const size_t num_chunks_;
+  const uint64_t cost_;
+  // The memory reserved from the installed MemoryBudget while running.
+  const uint64_t memory_;
   BlobFileWriter* blob_file_;
 
   // The list of ops to reach the new file from the old file.
@@ -449,18 +1013,40 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
   DISALLOW_COPY_AND_ASSIGN(FileDeltaProcessor);
 };
 
+uint64_t FileDeltaProcessor::EstimateMemory() const {
+  uint64_t new_blocks = new_extents_blocks_;
+  uint64_t old_blocks = utils::BlocksInExtents(old_extents_.extents);
+  if (chunk_blocks_ > 0) {
+    new_blocks = std::min<uint64_t>(new_blocks, chunk_blocks_);
+    if (!config_.diff_chunks_against_whole_file)
+      old_blocks = std::min<uint64_t>(old_blocks, chunk_blocks_);
+  }
+  return EstimateDeltaMemory(old_extents_,
+                             new_extents_,
+                             old_blocks * kBlockSize,
+                             new_blocks * kBlockSize,
+                             config_);
+}
+
 void FileDeltaProcessor::Run() {
   TEST_AND_RETURN(blob_file_ != nullptr);
+  // Waits for the memory of the largest chunk, so that the large files are
+  // delayed instead of running out of memory together.
+  MemoryBudget::ScopedReservation memory_reservation(memory_);
   base::TimeTicks start = base::TimeTicks::Now();
-
-  if (!DeltaReadFile(&file_aops_,
-                     old_part_,
-                     new_part_,
-                     old_extents_,
-                     new_extents_,
-                     chunk_blocks_,
-                     config_,
-                     blob_file_)) {
+  GenerationProfiler::ScopedFile profile(
+      partition_name_, name_, new_extents_blocks_);
+
+  if (!DeltaReadFileChunks(&file_aops_,
+                           old_part_,
+                           new_part_,
+                           old_extents_,
+                           new_extents_,
+                           chunk_blocks_,
+                           first_chunk_,
+                           num_chunks_,
+                           config_,
+                           blob_file_)) {
     LOG(ERROR) << "Failed to generate delta for " << name_ << " ("
                << new_extents_blocks_ << " blocks)";
     failed_ = true;
@@ -474,8 +1060,21 @@ void FileDeltaProcessor::Run() {
     return;
   }
 
-  LOG(INFO) << "Encoded file " << name_ << " (" << new_extents_blocks_
-            << " blocks) in " << (base::TimeTicks::Now() - start);
+  if (config_.adaptive_chunk_apply_memory_bytes > 0 &&
+      num_chunks_ != kAllChunks) {
+    for (AnnotatedOperation& aop : file_aops_)
+      aop.op.set_chunk_size(chunk_blocks_ * kBlockSize);
+  }
+
+  if (num_chunks_ == kAllChunks) {
+    LOG(INFO) << "Encoded file " << name_ << " (" << new_extents_blocks_
+              << " blocks) in " << (base::TimeTicks::Now() - start);
+  } else {
+    LOG(INFO) << "Encoded chunks " << first_chunk_ << " to "
+              << first_chunk_ + num_chunks_ - 1 << " of file " << name_ << " ("
+              << new_extents_blocks_ << " blocks) in "
+              << (base::TimeTicks::Now() - start);
+  }
 }
 
 bool FileDeltaProcessor::MergeOperation(vector<AnnotatedOperation>* aops) {
@@ -485,32 +1084,201 @@ bool FileDeltaProcessor::MergeOperation(vector<AnnotatedOperation>* aops) {
   return true;
 }
 
+ssize_t AdaptiveChunkBlocks(const string& new_part,
+                            const File& new_file,
+                            ssize_t chunk_blocks,
+                            const PayloadGenerationConfig& config) {
+  const uint64_t total_blocks = utils::BlocksInExtents(new_file.extents);
+  const uint64_t max_blocks = config.adaptive_chunk_apply_memory_bytes /
+                              (kChunkApplyMemoryFactor * kBlockSize);
+  // Keep the file spread over the threads.
+  const uint64_t spread_blocks =
+      std::min(max_blocks, total_blocks / GetMaxThreads());
+  if (spread_blocks <= static_cast<uint64_t>(chunk_blocks))
+    return chunk_blocks;
+
+  vector<Extent> sample_extents;
+  for (size_t i = 0; i < kChunkSampleBlocks; i++) {
+    const auto extents = ExtentsSublist(
+        new_file.extents, i * total_blocks / kChunkSampleBlocks, 1);
+    sample_extents.insert(sample_extents.end(), extents.begin(), extents.end());
+  }
+  brillo::Blob sample;
+  if (!MappedPartitions::ReadExtents(new_part, sample_extents, &sample))
+    return chunk_blocks;
+  if (SampleEntropy(sample) >= kCompressibleEntropy)
+    return chunk_blocks;
+  // A multiple of |chunk_blocks|, so that the chunks stay aligned.
+  return spread_blocks / chunk_blocks * chunk_blocks;
+}
+
+// Adds the processors of the file |name| to |processors|. Files with more than
+// one chunk get one processor per chunk, so that they are spread over the
+// threads instead of making a single thread finish last.
+void AddFileDeltaProcessors(const string& partition_name,
+                            const string& old_part,
+                            const string& new_part,
+                            const PayloadGenerationConfig& config,
+                            const File& old_file,
+                            const File& new_file,
+                            const string& name,
+                            ssize_t chunk_blocks,
+                            BlobFileWriter* blob_file,
+                            list<FileDeltaProcessor>* processors) {
+  const uint64_t total_blocks = utils::BlocksInExtents(new_file.extents);
+  if (config.adaptive_chunk_apply_memory_bytes > 0 && chunk_blocks > 0 &&
+      total_blocks > static_cast<uint64_t>(chunk_blocks)) {
+    chunk_blocks =
+        AdaptiveChunkBlocks(new_part, new_file, chunk_blocks, config);
+  }
+  if (chunk_blocks == -1 ||
+      total_blocks <= static_cast<uint64_t>(chunk_blocks)) {
+    processors->emplace_back(partition_name,
+                             old_part,
+                             new_part,
+                             config,
+                             old_file,
+                             new_file,
+                             name,
+                             chunk_blocks,
+                             0,
+                             kAllChunks,
+                             blob_file);
+    return;
+  }
+  const size_t num_chunks = (total_blocks + chunk_blocks - 1) / chunk_blocks;
+  for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+    processors->emplace_back(partition_name,
+                             old_part,
+                             new_part,
+                             config,
+                             old_file,
+                             new_file,
+                             name,
+                             chunk_blocks,
+                             chunk,
+                             1,
+                             blob_file);
+  }
+}
+
 FilesystemInterface::File GetOldFile(
     const map<string, FilesystemInterface::File>& old_files_map,
     const string& new_file_name) {
   if (old_files_map.empty())
     return {};
 
-  auto old_file_iter = old_files_map.find(new_file_name);
-  if (old_file_iter != old_files_map.end())
+  return OldFileIndex(old_files_map).Find(new_file_name);
+}
+
+OldFileIndex::OldFileIndex(const map<string, File>& old_files_map)
+    : old_files_map_(old_files_map) {
+  nodes_.reserve(old_files_map.size());
+  for (const auto& [name, file] : old_files_map) {
+    nodes_.push_back({&name, &file, {}});
+    if (nodes_.size() == 1)
+      continue;
+    size_t node = 0;
+    while (true) {
+      const int distance = LevenshteinDistance(name, *nodes_[node].name);
+      auto [child, inserted] =
+          nodes_[node].children.emplace(distance, nodes_.size() - 1);
+      if (inserted)
+        break;
+      node = child->second;
+    }
+  }
+}
+
+File OldFileIndex::Find(const string& new_file_name) const {
+  if (nodes_.empty())
+    return {};
+
+  auto old_file_iter = old_files_map_.find(new_file_name);
+  if (old_file_iter != old_files_map_.end())
     return old_file_iter->second;
 
   // No old file matches the new file name. Use a similar file with the
   // shortest levenshtein distance instead.
   // This works great if the file has version number in it, but even for
   // a completely new file, using a similar file can still help.
-  int min_distance =
-      LevenshteinDistance(new_file_name, old_files_map.begin()->first);
-  const FilesystemInterface::File* old_file = &old_files_map.begin()->second;
-  for (const auto& pair : old_files_map) {
-    int distance = LevenshteinDistance(new_file_name, pair.first);
-    if (distance < min_distance) {
+  // By the triangle inequality, the subtree of a child at |key| from a node
+  // at |distance| only has names at least |distance - key| away, so it is
+  // skipped unless that's within the best distance found. The ties go to the
+  // first name in order, like in |old_files_map_|.
+  int min_distance = std::numeric_limits<int>::max();
+  const Node* best = nullptr;
+  vector<size_t> pending{0};
+  while (!pending.empty()) {
+    const Node& node = nodes_[pending.back()];
+    pending.pop_back();
+    const int distance = LevenshteinDistance(new_file_name, *node.name);
+    if (distance < min_distance ||
+        (distance == min_distance && *node.name < *best->name)) {
       min_distance = distance;
-      old_file = &pair.second;
+      best = &node;
+    }
+    for (auto child = node.children.lower_bound(distance - min_distance);
+         child != node.children.end() &&
+         child->first <= distance + min_distance;
+         child++) {
+      pending.push_back(child->second);
     }
   }
-  LOG(INFO) << "Using " << old_file->name << " as source for " << new_file_name;
-  return *old_file;
+  LOG(INFO) << "Using " << best->file->name << " as source for "
+            << new_file_name;
+  return *best->file;
+}
+
+void OldFileIndex::IndexBlocks(
+    const vector<BlockMapping::BlockId>& old_block_ids) {
+  for (size_t node = 0; node < nodes_.size(); node++) {
+    for (const Extent& extent : nodes_[node].file->extents) {
+      for (uint64_t block = extent.start_block();
+           block < extent.start_block() + extent.num_blocks() &&
+           block < old_block_ids.size();
+           block++) {
+        if (old_block_ids[block] != 0)
+          block_nodes_.emplace(old_block_ids[block], node);
+      }
+    }
+  }
+}
+
+File OldFileIndex::Find(
+    const File& new_file,
+    const vector<BlockMapping::BlockId>& new_block_ids) const {
+  if (block_nodes_.empty() || old_files_map_.count(new_file.name))
+    return Find(new_file.name);
+
+  // The number of blocks of |new_file| in each old file.
+  map<size_t, uint64_t> shared_blocks;
+  uint64_t num_blocks = 0;
+  for (const Extent& extent : new_file.extents) {
+    for (uint64_t block = extent.start_block();
+         block < extent.start_block() + extent.num_blocks() &&
+         block < new_block_ids.size();
+         block++) {
+      if (new_block_ids[block] == 0)
+        continue;
+      num_blocks++;
+      const auto it = block_nodes_.find(new_block_ids[block]);
+      if (it != block_nodes_.end())
+        shared_blocks[it->second]++;
+    }
+  }
+  // The ties go to the first name in order.
+  const auto best = std::max_element(
+      shared_blocks.begin(),
+      shared_blocks.end(),
+      [](const auto& a, const auto& b) { return a.second < b.second; });
+  if (best == shared_blocks.end() || 2 * best->second < num_blocks)
+    return Find(new_file.name);
+  const File& old_file = *nodes_[best->first].file;
+  LOG(INFO) << "Using " << old_file.name << " as source for " << new_file.name
+            << ", which has " << best->second << " of its " << num_blocks
+            << " blocks";
+  return old_file;
 }
 
 std::vector<Extent> RemoveDuplicateBlocks(const std::vector<Extent>& extents) {
@@ -538,15 +1306,38 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
   ExtentRanges new_visited_blocks;
 
   // If verity is enabled, mark those blocks as visited to skip generating
-  // operations for them.
+  // operations for them, unless they are shipped in the payload.
   if (version.minor >= kVerityMinorPayloadVersion &&
       !new_part.verity.IsEmpty()) {
-    LOG(INFO) << "Skipping verity hash tree blocks: "
-              << ExtentsToString({new_part.verity.hash_tree_extent});
-    new_visited_blocks.AddExtent(new_part.verity.hash_tree_extent);
-    LOG(INFO) << "Skipping verity FEC blocks: "
-              << ExtentsToString({new_part.verity.fec_extent});
-    new_visited_blocks.AddExtent(new_part.verity.fec_extent);
+    if (!new_part.verity.hash_tree_in_payload) {
+      LOG(INFO) << "Skipping verity hash tree blocks: "
+                << ExtentsToString({new_part.verity.hash_tree_extent});
+      new_visited_blocks.AddExtent(new_part.verity.hash_tree_extent);
+    }
+    if (!new_part.verity.fec_in_payload) {
+      LOG(INFO) << "Skipping verity FEC blocks: "
+                << ExtentsToString({new_part.verity.fec_extent});
+      new_visited_blocks.AddExtent(new_part.verity.fec_extent);
+    }
+  }
+
+  // The blocks written by the operations reused from a previous payload are
+  // not diffed again.
+  TEST_AND_RETURN_FALSE(ReusePreviousOperations(
+      old_part, new_part, config, blob_file, aops, &new_visited_blocks));
+
+  // An unchanged partition is copied in place, without looking at its files
+  // or mapping its blocks.
+  if (PartitionsIdentical(old_part.path, new_part.path)) {
+    LOG(INFO) << "Partition " << new_part.name << " is unchanged";
+    return DeltaUnchangedPartition(aops,
+                                   old_part.path,
+                                   new_part.path,
+                                   new_part.size / kBlockSize,
+                                   soft_chunk_blocks,
+                                   config,
+                                   blob_file,
+                                   new_visited_blocks);
   }
 
   const bool puffdiff_allowed =
@@ -558,6 +1349,8 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
       new_part, &new_files, puffdiff_allowed));
 
   ExtentRanges old_zero_blocks;
+  vector<BlockMapping::BlockId> old_block_ids;
+  vector<BlockMapping::BlockId> new_block_ids;
   // Prematurely removing moved blocks will render compression info useless.
   // Even if a single block inside a 100MB file is filtered out, the entire
   // 100MB file can't be decompressed. In this case we will fallback to BSDIFF,
@@ -580,7 +1373,9 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
                                                   blob_file,
                                                   &old_visited_blocks,
                                                   &new_visited_blocks,
-                                                  &old_zero_blocks));
+                                                  &old_zero_blocks,
+                                                  &old_block_ids,
+                                                  &new_block_ids));
   }
 
   map<string, FilesystemInterface::File> old_files_map;
@@ -591,6 +1386,25 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
     for (const FilesystemInterface::File& file : old_files)
       old_files_map[file.name] = file;
   }
+  OldFileIndex old_file_index(old_files_map);
+  // The renamed and moved files are matched with their old version by their
+  // data, reusing the block ids of DeltaMovedAndZeroBlocks() if it ran.
+  const bool renamed_files =
+      std::any_of(new_files.begin(), new_files.end(), [&](const File& file) {
+        return old_files_map.count(file.name) == 0;
+      });
+  if (!old_files_map.empty() && renamed_files) {
+    if (new_block_ids.empty()) {
+      TEST_AND_RETURN_FALSE(MapPartitionBlocks(old_part.path,
+                                               new_part.path,
+                                               old_part.size,
+                                               new_part.size,
+                                               kBlockSize,
+                                               &old_block_ids,
+                                               &new_block_ids));
+    }
+    old_file_index.IndexBlocks(old_block_ids);
+  }
 
   list<FileDeltaProcessor> file_delta_processors;
 
@@ -614,7 +1428,7 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
       continue;
 
     FilesystemInterface::File old_file =
-        GetOldFile(old_files_map, new_file.name);
+        old_file_index.Find(new_file, new_block_ids);
     old_visited_blocks.AddExtents(old_file.extents);
 
     // TODO(b/177104308) Filtering |new_file_extents| might confuse puffdiff, as
@@ -634,14 +1448,16 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
     // whatsoever.
     auto filtered_new_file = new_file;
     filtered_new_file.extents = RemoveDuplicateBlocks(new_file_extents);
-    file_delta_processors.emplace_back(old_part.path,
-                                       new_part.path,
-                                       config,
-                                       std::move(old_file),
-                                       std::move(filtered_new_file),
-                                       new_file.name,  // operation name
-                                       hard_chunk_blocks,
-                                       blob_file);
+    AddFileDeltaProcessors(new_part.name,
+                           old_part.path,
+                           new_part.path,
+                           config,
+                           old_file,
+                           filtered_new_file,
+                           new_file.name,  // operation name
+                           hard_chunk_blocks,
+                           blob_file,
+                           &file_delta_processors);
   }
   // Process all the blocks not included in any file. We provided all the unused
   // blocks in the old partition as available data.
@@ -665,14 +1481,16 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
     old_file.extents = old_unvisited;
     File new_file;
     new_file.extents = RemoveDuplicateBlocks(new_unvisited);
-    file_delta_processors.emplace_back(old_part.path,
-                                       new_part.path,
-                                       config,
-                                       old_file,
-                                       new_file,
-                                       "<non-file-data>",  // operation name
-                                       soft_chunk_blocks,
-                                       blob_file);
+    AddFileDeltaProcessors(new_part.name,
+                           old_part.path,
+                           new_part.path,
+                           config,
+                           old_file,
+                           new_file,
+                           "<non-file-data>",  // operation name
+                           soft_chunk_blocks,
+                           blob_file,
+                           &file_delta_processors);
   }
 
   size_t max_threads = GetMaxThreads();
@@ -681,19 +1499,33 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
     max_threads = config.max_threads;
   }
 
-  // Sort the files in descending order based on number of new blocks to make
-  // sure we start the largest ones first.
-  if (file_delta_processors.size() > max_threads) {
-    file_delta_processors.sort(std::greater<FileDeltaProcessor>());
+  // The idle threads pick the next processor from the pool's queue, which is
+  // filled in descending order of estimated cost so that the most expensive
+  // files start first and the cheap ones fill the tail. The operations are
+  // still merged in file order.
+  vector<FileDeltaProcessor*> schedule;
+  schedule.reserve(file_delta_processors.size());
+  for (auto& processor : file_delta_processors) {
+    schedule.push_back(&processor);
   }
+  std::stable_sort(
+      schedule.begin(),
+      schedule.end(),
+      [](const FileDeltaProcessor* a, const FileDeltaProcessor* b) {
+        return a->cost() > b->cost();
+      });
 
-  base::DelegateSimpleThreadPool thread_pool("incremental-update-generator",
-                                             max_threads);
-  thread_pool.Start();
-  for (auto& processor : file_delta_processors) {
-    thread_pool.AddWork(&processor);
+  vector<TaskPool::Task> tasks;
+  tasks.reserve(schedule.size());
+  for (FileDeltaProcessor* processor : schedule) {
+    tasks.push_back([processor] { processor->Run(); });
+  }
+  const base::TimeTicks pool_start = base::TimeTicks::Now();
+  const size_t threads = TaskPool::RunTasks(std::move(tasks), max_threads);
+  if (GenerationProfiler* profiler = GenerationProfiler::Get()) {
+    profiler->RecordThreadPool(
+        new_part.name, threads, base::TimeTicks::Now() - pool_start);
   }
-  thread_pool.JoinAll();
 
   for (auto& processor : file_delta_processors) {
     TEST_AND_RETURN_FALSE(processor.MergeOperation(aops));
@@ -702,6 +1534,150 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
   return true;
 }
 
+// Produces operations for the zeroed blocks |new_zeros| of |new_part|, split
+// per extent and in chunks of |chunk_blocks| blocks.
+bool DeltaZeroBlocks(vector<AnnotatedOperation>* aops,
+                     const string& new_part,
+                     const vector<Extent>& new_zeros,
+                     uint64_t chunk_blocks,
+                     const PayloadGenerationConfig& config,
+                     BlobFileWriter* blob_file) {
+  const size_t num_ops = aops->size();
+  for (const Extent& extent : new_zeros) {
+    if (config.OperationEnabled(InstallOperation::ZERO)) {
+      for (uint64_t offset = 0; offset < extent.num_blocks();
+           offset += chunk_blocks) {
+        uint64_t num_blocks =
+            std::min(static_cast<uint64_t>(extent.num_blocks()) - offset,
+                     chunk_blocks);
+        InstallOperation operation;
+        operation.set_type(InstallOperation::ZERO);
+        *(operation.add_dst_extents()) =
+            ExtentForRange(extent.start_block() + offset, num_blocks);
+        aops->push_back({.name = "<zeros>", .op = std::move(operation)});
+      }
+    } else {
+      File old_file;
+      File new_file;
+      new_file.name = "<zeros>";
+      new_file.extents = {extent};
+      TEST_AND_RETURN_FALSE(DeltaReadFile(aops,
+                                          "",
+                                          new_part,
+                                          old_file,  // old_extents
+                                          new_file,  // new_extents
+                                          chunk_blocks,
+                                          config,
+                                          blob_file));
+    }
+  }
+  LOG(INFO) << "Produced " << (aops->size() - num_ops) << " operations for "
+            << utils::BlocksInExtents(new_zeros) << " zeroed blocks";
+  return true;
+}
+
+bool PartitionsIdentical(const string& old_part, const string& new_part) {
+  if (old_part.empty() || new_part.empty())
+    return false;
+  const off_t size = utils::FileSize(new_part);
+  if (size <= 0 || size % kBlockSize != 0 || utils::FileSize(old_part) != size)
+    return false;
+  const uint64_t num_blocks = size / kBlockSize;
+  std::atomic<bool> identical{true};
+  vector<TaskPool::Task> tasks;
+  for (uint64_t start = 0; start < num_blocks;
+       start += kUnchangedCompareBlocks) {
+    tasks.push_back([&, start] {
+      if (!identical)
+        return;
+      const vector<Extent> extents = {ExtentForRange(
+          start, std::min(kUnchangedCompareBlocks, num_blocks - start))};
+      const uint64_t length = extents[0].num_blocks() * kBlockSize;
+      brillo::Blob old_buffer, new_buffer;
+      std::string_view old_view, new_view;
+      if (!MappedPartitions::GetExtents(
+              old_part, extents, length, &old_buffer, &old_view) ||
+          !MappedPartitions::GetExtents(
+              new_part, extents, length, &new_buffer, &new_view) ||
+          old_view != new_view) {
+        identical = false;
+      }
+    });
+  }
+  TaskPool::RunTasks(std::move(tasks), GetMaxThreads());
+  return identical;
+}
+
+bool DeltaUnchangedPartition(vector<AnnotatedOperation>* aops,
+                             const string& old_part,
+                             const string& new_part,
+                             size_t num_blocks,
+                             ssize_t chunk_blocks,
+                             const PayloadGenerationConfig& config,
+                             BlobFileWriter* blob_file,
+                             const ExtentRanges& new_visited_blocks) {
+  // The zeroed blocks aren't read from the old partition, see
+  // DeltaMovedAndZeroBlocks().
+  const size_t num_tasks =
+      utils::DivRoundUp(num_blocks, kUnchangedCompareBlocks);
+  vector<vector<Extent>> task_zeros(num_tasks);
+  std::atomic<bool> read_ok{true};
+  vector<TaskPool::Task> tasks;
+  for (size_t i = 0; i < num_tasks; i++) {
+    tasks.push_back([&, i] {
+      const uint64_t start = i * kUnchangedCompareBlocks;
+      const vector<Extent> extents = {ExtentForRange(
+          start,
+          std::min<uint64_t>(kUnchangedCompareBlocks, num_blocks - start))};
+      brillo::Blob buffer;
+      std::string_view view;
+      if (!MappedPartitions::GetExtents(new_part,
+                                        extents,
+                                        extents[0].num_blocks() * kBlockSize,
+                                        &buffer,
+                                        &view)) {
+        read_ok = false;
+        return;
+      }
+      for (uint64_t block = 0; block < extents[0].num_blocks(); block++) {
+        if (simd_utils::IsZero(
+                reinterpret_cast<const uint8_t*>(view.data()) +
+                    block * kBlockSize,
+                kBlockSize))
+          AppendBlockToExtents(&task_zeros[i], start + block);
+      }
+    });
+  }
+  TaskPool::RunTasks(std::move(tasks), GetMaxThreads());
+  TEST_AND_RETURN_FALSE(read_ok);
+
+  vector<Extent> zeros;
+  for (const vector<Extent>& extents : task_zeros)
+    zeros.insert(zeros.end(), extents.begin(), extents.end());
+  NormalizeExtents(&zeros);
+  const vector<Extent> new_zeros =
+      FilterExtentRanges(zeros, new_visited_blocks);
+  ExtentRanges skipped_blocks = new_visited_blocks;
+  skipped_blocks.AddExtents(zeros);
+  const vector<Extent> new_data = FilterExtentRanges(
+      {ExtentForRange(0, num_blocks)}, skipped_blocks);
+
+  if (chunk_blocks == -1)
+    chunk_blocks = num_blocks;
+  TEST_AND_RETURN_FALSE(DeltaZeroBlocks(
+      aops, new_part, new_zeros, chunk_blocks, config, blob_file));
+  const size_t num_ops = aops->size();
+  const uint64_t used_blocks = AddCopyOperations(InstallOperation::SOURCE_COPY,
+                                                 "<unchanged-blocks>",
+                                                 new_data,
+                                                 new_data,
+                                                 chunk_blocks,
+                                                 aops);
+  LOG(INFO) << "Produced " << (aops->size() - num_ops) << " operations for "
+            << used_blocks << " unchanged blocks";
+  return true;
+}
+
 bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
                              const string& old_part,
                              const string& new_part,
@@ -712,7 +1688,9 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
                              BlobFileWriter* blob_file,
                              ExtentRanges* old_visited_blocks,
                              ExtentRanges* new_visited_blocks,
-                             ExtentRanges* old_zero_blocks) {
+                             ExtentRanges* old_zero_blocks,
+                             vector<BlockMapping::BlockId>* old_block_ids_out,
+                             vector<BlockMapping::BlockId>* new_block_ids_out) {
   vector<BlockMapping::BlockId> old_block_ids;
   vector<BlockMapping::BlockId> new_block_ids;
   TEST_AND_RETURN_FALSE(MapPartitionBlocks(old_part,
@@ -751,6 +1729,15 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
   vector<Extent> old_identical_blocks;
   vector<Extent> new_identical_blocks;
 
+  // The first block of the new partition with each block id not found in the
+  // old partition, which is written by another operation. The following
+  // blocks with the same id are copied from it with TARGET_COPY.
+  const bool target_copy_enabled =
+      config.OperationEnabled(InstallOperation::TARGET_COPY);
+  map<BlockMapping::BlockId, uint64_t> new_first_blocks;
+  vector<Extent> new_first_duplicate_blocks;
+  vector<Extent> new_duplicate_blocks;
+
   for (uint64_t block = 0; block < new_num_blocks; block++) {
     // Only produce operations for blocks that were not yet visited.
     if (new_visited_blocks->ContainsBlock(block))
@@ -763,8 +1750,17 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
     auto old_blocks_map_it = old_blocks_map.find(new_block_ids[block]);
     // Check if the block exists in the old partition at all.
     if (old_blocks_map_it == old_blocks_map.end() ||
-        old_blocks_map_it->second.empty())
+        old_blocks_map_it->second.empty()) {
+      if (target_copy_enabled) {
+        auto [it, inserted] =
+            new_first_blocks.emplace(new_block_ids[block], block);
+        if (!inserted) {
+          AppendBlockToExtents(&new_first_duplicate_blocks, it->second);
+          AppendBlockToExtents(&new_duplicate_blocks, block);
+        }
+      }
       continue;
+    }
 
     AppendBlockToExtents(&old_identical_blocks,
                          old_blocks_map_it->second.back());
@@ -774,80 +1770,43 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
   if (chunk_blocks == -1)
     chunk_blocks = new_num_blocks;
 
-  // Produce operations for the zero blocks split per output extent.
-  size_t num_ops = aops->size();
   new_visited_blocks->AddExtents(new_zeros);
-  for (const Extent& extent : new_zeros) {
-    if (config.OperationEnabled(InstallOperation::ZERO)) {
-      for (uint64_t offset = 0; offset < extent.num_blocks();
-           offset += chunk_blocks) {
-        uint64_t num_blocks =
-            std::min(static_cast<uint64_t>(extent.num_blocks()) - offset,
-                     static_cast<uint64_t>(chunk_blocks));
-        InstallOperation operation;
-        operation.set_type(InstallOperation::ZERO);
-        *(operation.add_dst_extents()) =
-            ExtentForRange(extent.start_block() + offset, num_blocks);
-        aops->push_back({.name = "<zeros>", .op = operation});
-      }
-    } else {
-      File old_file;
-      File new_file;
-      new_file.name = "<zeros>";
-      new_file.extents = {extent};
-      TEST_AND_RETURN_FALSE(DeltaReadFile(aops,
-                                          "",
-                                          new_part,
-                                          old_file,  // old_extents
-                                          new_file,  // new_extents
-                                          chunk_blocks,
-                                          config,
-                                          blob_file));
-    }
-  }
-  LOG(INFO) << "Produced " << (aops->size() - num_ops) << " operations for "
-            << utils::BlocksInExtents(new_zeros) << " zeroed blocks";
+  TEST_AND_RETURN_FALSE(DeltaZeroBlocks(
+      aops, new_part, new_zeros, chunk_blocks, config, blob_file));
 
   // Produce MOVE/SOURCE_COPY operations for the moved blocks.
-  num_ops = aops->size();
-  uint64_t used_blocks = 0;
+  size_t num_ops = aops->size();
   old_visited_blocks->AddExtents(old_identical_blocks);
   new_visited_blocks->AddExtents(new_identical_blocks);
-  for (const Extent& extent : new_identical_blocks) {
-    // We split the operation at the extent boundary or when bigger than
-    // chunk_blocks.
-    for (uint64_t op_block_offset = 0; op_block_offset < extent.num_blocks();
-         op_block_offset += chunk_blocks) {
-      aops->emplace_back();
-      AnnotatedOperation* aop = &aops->back();
-      aop->name = "<identical-blocks>";
-      aop->op.set_type(InstallOperation::SOURCE_COPY);
-
-      uint64_t chunk_num_blocks =
-          std::min(static_cast<uint64_t>(extent.num_blocks()) - op_block_offset,
-                   static_cast<uint64_t>(chunk_blocks));
-
-      // The current operation represents the move/copy operation for the
-      // sublist starting at |used_blocks| of length |chunk_num_blocks| where
-      // the src and dst are from |old_identical_blocks| and
-      // |new_identical_blocks| respectively.
-      StoreExtents(
-          ExtentsSublist(old_identical_blocks, used_blocks, chunk_num_blocks),
-          aop->op.mutable_src_extents());
-
-      Extent* op_dst_extent = aop->op.add_dst_extents();
-      op_dst_extent->set_start_block(extent.start_block() + op_block_offset);
-      op_dst_extent->set_num_blocks(chunk_num_blocks);
-      CHECK(
-          vector<Extent>{*op_dst_extent} ==  // NOLINT(whitespace/braces)
-          ExtentsSublist(new_identical_blocks, used_blocks, chunk_num_blocks));
-
-      used_blocks += chunk_num_blocks;
-    }
-  }
+  uint64_t used_blocks = AddCopyOperations(InstallOperation::SOURCE_COPY,
+                                           "<identical-blocks>",
+                                           old_identical_blocks,
+                                           new_identical_blocks,
+                                           chunk_blocks,
+                                           aops);
   LOG(INFO) << "Produced " << (aops->size() - num_ops) << " operations for "
             << used_blocks << " identical blocks moved";
 
+  // Produce TARGET_COPY operations for the blocks repeated in the new
+  // partition. Their first copy is written by the operations produced later.
+  if (!new_duplicate_blocks.empty()) {
+    num_ops = aops->size();
+    new_visited_blocks->AddExtents(new_duplicate_blocks);
+    used_blocks = AddCopyOperations(InstallOperation::TARGET_COPY,
+                                    "<duplicate-blocks>",
+                                    new_first_duplicate_blocks,
+                                    new_duplicate_blocks,
+                                    chunk_blocks,
+                                    aops);
+    LOG(INFO) << "Produced " << (aops->size() - num_ops)
+              << " operations for " << used_blocks
+              << " blocks repeated in the new partition";
+  }
+
+  if (old_block_ids_out)
+    *old_block_ids_out = std::move(old_block_ids);
+  if (new_block_ids_out)
+    *new_block_ids_out = std::move(new_block_ids);
   return true;
 }
 
@@ -859,6 +1818,28 @@ bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
                    ssize_t chunk_blocks,
                    const PayloadGenerationConfig& config,
                    BlobFileWriter* blob_file) {
+  return DeltaReadFileChunks(aops,
+                             old_part,
+                             new_part,
+                             old_file,
+                             new_file,
+                             chunk_blocks,
+                             0,
+                             kAllChunks,
+                             config,
+                             blob_file);
+}
+
+bool DeltaReadFileChunks(std::vector<AnnotatedOperation>* aops,
+                         const std::string& old_part,
+                         const std::string& new_part,
+                         const File& old_file,
+                         const File& new_file,
+                         ssize_t chunk_blocks,
+                         size_t first_chunk,
+                         size_t num_chunks,
+                         const PayloadGenerationConfig& config,
+                         BlobFileWriter* blob_file) {
   const auto& old_extents = old_file.extents;
   const auto& new_extents = new_file.extents;
   const auto& name = new_file.name;
@@ -874,16 +1855,39 @@ bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
   if (chunk_blocks == -1)
     chunk_blocks = total_blocks;
 
-  for (uint64_t block_offset = 0; block_offset < total_blocks;
+  const uint64_t first_block =
+      std::min<uint64_t>(first_chunk * chunk_blocks, total_blocks);
+  const uint64_t end_block =
+      first_block +
+      ChunksBlocks(total_blocks, chunk_blocks, first_chunk, num_chunks);
+  const bool whole_old_file =
+      config.diff_chunks_against_whole_file &&
+      static_cast<uint64_t>(chunk_blocks) < total_blocks;
+  for (uint64_t block_offset = first_block; block_offset < end_block;
        block_offset += chunk_blocks) {
     // Split the old/new file in the same chunks. Note that this could drop
     // some information from the old file used for the new chunk. If the old
     // file is smaller (or even empty when there's no old file) the chunk will
-    // also be empty.
+    // also be empty. With |config.diff_chunks_against_whole_file| the chunks
+    // are all diffed against the whole old file instead.
     vector<Extent> old_extents_chunk =
-        ExtentsSublist(old_extents, block_offset, chunk_blocks);
+        whole_old_file
+            ? old_extents
+            : ExtentsSublist(old_extents, block_offset, chunk_blocks);
     vector<Extent> new_extents_chunk =
         ExtentsSublist(new_extents, block_offset, chunk_blocks);
+    if (!whole_old_file && config.find_shifted_chunks &&
+        static_cast<uint64_t>(chunk_blocks) < total_blocks) {
+      auto shifted_extents_chunk = FindShiftedOldChunk(old_part,
+                                                       new_part,
+                                                       old_extents,
+                                                       new_extents,
+                                                       block_offset,
+                                                       chunk_blocks);
+      if (!shifted_extents_chunk.empty()) {
+        old_extents_chunk = std::move(shifted_extents_chunk);
+      }
+    }
     NormalizeExtents(&old_extents_chunk);
     NormalizeExtents(&new_extents_chunk);
 
@@ -913,63 +1917,37 @@ bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
 
     // Write the data
     TEST_AND_RETURN_FALSE(aop.SetOperationBlob(data, blob_file));
-    aops->emplace_back(aop);
+    aops->push_back(std::move(aop));
   }
   return true;
 }
 
 bool GenerateBestFullOperation(const brillo::Blob& new_data,
+                               const std::string& new_part,
                                const PayloadVersion& version,
                                brillo::Blob* out_blob,
                                InstallOperation::Type* out_type) {
-  if (new_data.empty())
-    return false;
-
-  if (version.OperationAllowed(InstallOperation::ZERO) &&
-      std::all_of(
-          new_data.begin(), new_data.end(), [](uint8_t x) { return x == 0; })) {
-    // The read buffer is all zeros, so produce a ZERO operation. No need to
-    // check other types of operations in this case.
-    *out_blob = brillo::Blob();
-    *out_type = InstallOperation::ZERO;
-    return true;
-  }
-
-  bool out_blob_set = false;
-
-  // Try compressing |new_data| with xz first.
-  if (version.OperationAllowed(InstallOperation::REPLACE_XZ)) {
-    brillo::Blob new_data_xz;
-    if (XzCompress(new_data, &new_data_xz) && !new_data_xz.empty()) {
-      *out_type = InstallOperation::REPLACE_XZ;
-      *out_blob = std::move(new_data_xz);
-      out_blob_set = true;
-    }
-  }
-
-  // Try compressing it with bzip2.
-  if (version.OperationAllowed(InstallOperation::REPLACE_BZ)) {
-    brillo::Blob new_data_bz;
-    // TODO(deymo): Implement some heuristic to determine if it is worth trying
-    // to compress the blob with bzip2 if we already have a good REPLACE_XZ.
-    if (BzipCompress(new_data, &new_data_bz) && !new_data_bz.empty() &&
-        (!out_blob_set || out_blob->size() > new_data_bz.size())) {
-      // A REPLACE_BZ is better or nothing else was set.
-      *out_type = InstallOperation::REPLACE_BZ;
-      *out_blob = std::move(new_data_bz);
-      out_blob_set = true;
-    }
-  }
+  return BestFullOperation(new_data,
+                           new_part,
+                           version,
+                           false,
+                           ApplyCostModel(),
+                           out_blob,
+                           out_type);
+}
 
-  // If nothing else worked or it was badly compressed we try a REPLACE.
-  if (!out_blob_set || out_blob->size() >= new_data.size()) {
-    *out_type = InstallOperation::REPLACE;
-    // This needs to make a copy of the data in the case bzip or xz didn't
-    // compress well, which is not the common case so the performance hit is
-    // low.
-    *out_blob = new_data;
-  }
-  return true;
+bool GenerateBestFullOperation(const brillo::Blob& new_data,
+                               const std::string& new_part,
+                               const PayloadGenerationConfig& config,
+                               brillo::Blob* out_blob,
+                               InstallOperation::Type* out_type) {
+  return BestFullOperation(new_data,
+                           new_part,
+                           config.version,
+                           config.fast_algorithm_selection,
+                           config.apply_cost_model,
+                           out_blob,
+                           out_type);
 }
 
 // Decide which blocks are similar from bsdiff patch.
@@ -1060,11 +2038,8 @@ bool ReadExtentsToDiff(const string& old_part,
 
   // Read in bytes from new data.
   brillo::Blob new_data;
-  TEST_AND_RETURN_FALSE(utils::ReadExtents(new_part,
-                                           dst_extents,
-                                           &new_data,
-                                           kBlockSize * blocks_to_write,
-                                           kBlockSize));
+  TEST_AND_RETURN_FALSE(
+      MappedPartitions::ReadExtents(new_part, dst_extents, &new_data));
   TEST_AND_RETURN_FALSE(!new_data.empty());
 
   // Data blob that will be written to delta file.
@@ -1073,19 +2048,22 @@ bool ReadExtentsToDiff(const string& old_part,
   // Try generating a full operation for the given new data, regardless of the
   // old_data.
   InstallOperation::Type op_type{};
-  TEST_AND_RETURN_FALSE(
-      GenerateBestFullOperation(new_data, version, &data_blob, &op_type));
+  TEST_AND_RETURN_FALSE(GenerateBestFullOperation(
+      new_data, new_part, config, &data_blob, &op_type));
   operation.set_type(op_type);
 
   if (blocks_to_read > 0) {
+    // Read old data. It is only copied out of the mapped partition if it is
+    // diffed.
     brillo::Blob old_data;
-    // Read old data.
-    TEST_AND_RETURN_FALSE(utils::ReadExtents(old_part,
-                                             src_extents,
-                                             &old_data,
-                                             kBlockSize * blocks_to_read,
-                                             kBlockSize));
-    if (old_data == new_data) {
+    std::string_view old_view;
+    TEST_AND_RETURN_FALSE(MappedPartitions::GetExtents(old_part,
+                                                       src_extents,
+                                                       kBlockSize *
+                                                           blocks_to_read,
+                                                       &old_data,
+                                                       &old_view));
+    if (old_view == ToStringView(new_data)) {
       // No change in data.
       operation.set_type(InstallOperation::SOURCE_COPY);
       data_blob = brillo::Blob();
@@ -1093,6 +2071,8 @@ bool ReadExtentsToDiff(const string& old_part,
                    operation, data_blob.size(), 0, src_extents.size())) {
       // No point in trying diff if zero blob size diff operation is
       // still worse than replace.
+      if (old_data.empty())
+        old_data.assign(old_view.begin(), old_view.end());
 
       BestDiffGenerator best_diff_generator(old_data,
                                             new_data,
@@ -1101,6 +2081,7 @@ bool ReadExtentsToDiff(const string& old_part,
                                             old_file,
                                             new_file,
                                             config);
+      best_diff_generator.set_old_partition_path(old_part);
       if (!best_diff_generator.GenerateBestDiffOperation(&aop, &data_blob)) {
         LOG(INFO) << "Failed to generate diff for " << new_file.name;
         return false;
@@ -1138,7 +2119,8 @@ bool ReadExtentsToDiff(const string& old_part,
 bool IsAReplaceOperation(InstallOperation::Type op_type) {
   return (op_type == InstallOperation::REPLACE ||
           op_type == InstallOperation::REPLACE_BZ ||
-          op_type == InstallOperation::REPLACE_XZ);
+          op_type == InstallOperation::REPLACE_XZ ||
+          op_type == InstallOperation::REPLACE_ZSTD);
 }
 
 bool IsNoSourceOperation(InstallOperation::Type op_type) {
@@ -17,8 +17,10 @@
 #ifndef PAYLOAD_GENERATOR_DELTA_DIFF_UTILS_H_
 #define PAYLOAD_GENERATOR_DELTA_DIFF_UTILS_H_
 
+#include <limits>
 #include <map>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -27,6 +29,7 @@
 
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_generator/annotated_operation.h"
+#include "update_engine/payload_generator/block_mapping.h"
 #include "update_engine/payload_generator/deflate_utils.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
@@ -55,6 +58,27 @@ bool DeltaReadPartition(std::vector<AnnotatedOperation>* aops,
                         const PayloadGenerationConfig& version,
                         BlobFileWriter* blob_file);
 
+// Returns whether the partition images |old_part| and |new_part| have the same
+// size and contents. They are compared in chunks on the shared task pool,
+// which stop at the first difference.
+bool PartitionsIdentical(const std::string& old_part,
+                         const std::string& new_part);
+
+// Create operations in |aops| for the first |num_blocks| blocks of the
+// partition |new_part| whose image is identical to |old_part|: SOURCE_COPY
+// operations copying its data in place and operations for its zeroed blocks,
+// of at most |chunk_blocks| blocks, or unlimited if |chunk_blocks| is -1. The
+// blocks in |new_visited_blocks| are skipped. The blobs of the produced
+// operations are stored in the |blob_file|.
+bool DeltaUnchangedPartition(std::vector<AnnotatedOperation>* aops,
+                             const std::string& old_part,
+                             const std::string& new_part,
+                             size_t num_blocks,
+                             ssize_t chunk_blocks,
+                             const PayloadGenerationConfig& config,
+                             BlobFileWriter* blob_file,
+                             const ExtentRanges& new_visited_blocks);
+
 // Create operations in |aops| for identical blocks that moved around in the old
 // and new partition and also handle zeroed blocks. The old and new partition
 // are stored in the |old_part| and |new_part| files and have |old_num_blocks|
@@ -64,18 +88,22 @@ bool DeltaReadPartition(std::vector<AnnotatedOperation>* aops,
 // The collections |old_visited_blocks| and |new_visited_blocks| state what
 // blocks already have operations reading or writing them and only operations
 // for unvisited blocks are produced by this function updating both collections
-// with the used blocks.
-bool DeltaMovedAndZeroBlocks(std::vector<AnnotatedOperation>* aops,
-                             const std::string& old_part,
-                             const std::string& new_part,
-                             size_t old_num_blocks,
-                             size_t new_num_blocks,
-                             ssize_t chunk_blocks,
-                             const PayloadGenerationConfig& version,
-                             BlobFileWriter* blob_file,
-                             ExtentRanges* old_visited_blocks,
-                             ExtentRanges* new_visited_blocks,
-                             ExtentRanges* old_zero_blocks);
+// with the used blocks. If not null, |old_block_ids| and |new_block_ids| get
+// the ids of the blocks of both partitions, see MapPartitionBlocks().
+bool DeltaMovedAndZeroBlocks(
+    std::vector<AnnotatedOperation>* aops,
+    const std::string& old_part,
+    const std::string& new_part,
+    size_t old_num_blocks,
+    size_t new_num_blocks,
+    ssize_t chunk_blocks,
+    const PayloadGenerationConfig& version,
+    BlobFileWriter* blob_file,
+    ExtentRanges* old_visited_blocks,
+    ExtentRanges* new_visited_blocks,
+    ExtentRanges* old_zero_blocks,
+    std::vector<BlockMapping::BlockId>* old_block_ids = nullptr,
+    std::vector<BlockMapping::BlockId>* new_block_ids = nullptr);
 
 // For a given file |name| append operations to |aops| to produce it in the
 // |new_part|. The file will be split in chunks of |chunk_blocks| blocks each
@@ -94,6 +122,23 @@ bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
                    const PayloadGenerationConfig& config,
                    BlobFileWriter* blob_file);
 
+// Number of chunks passed to DeltaReadFileChunks() to read the whole file.
+constexpr size_t kAllChunks = std::numeric_limits<size_t>::max();
+
+// Like DeltaReadFile(), but only appends the operations of the |num_chunks|
+// chunks of the file starting at chunk |first_chunk|, named as the whole file
+// would be. Chunks of the same file can be generated concurrently.
+bool DeltaReadFileChunks(std::vector<AnnotatedOperation>* aops,
+                         const std::string& old_part,
+                         const std::string& new_part,
+                         const File& old_file,
+                         const File& new_file,
+                         ssize_t chunk_blocks,
+                         size_t first_chunk,
+                         size_t num_chunks,
+                         const PayloadGenerationConfig& config,
+                         BlobFileWriter* blob_file);
+
 // Reads the blocks |old_extents| from |old_part| (if it exists) and the
 // |new_extents| from |new_part| and determines the smallest way to encode
 // this |new_extents| for the diff. It stores necessary data in |out_data| and
@@ -115,14 +160,26 @@ bool ReadExtentsToDiff(const std::string& old_part,
                        AnnotatedOperation* out_op);
 
 // Generates the best allowed full operation to produce |new_data|. The allowed
-// operations are based on |payload_version|. The operation blob will be stored
-// in |out_blob| and the resulting operation type in |out_type|. Returns whether
-// a valid full operation was generated.
+// operations are based on |payload_version|, and include REPLACE_ZSTD with the
+// dictionary of the partition image |new_part| when ZstdDictionaries are
+// installed. The operation blob will be stored in |out_blob| and the resulting
+// operation type in |out_type|. Returns whether a valid full operation was
+// generated.
 bool GenerateBestFullOperation(const brillo::Blob& new_data,
+                               const std::string& new_part,
                                const PayloadVersion& version,
                                brillo::Blob* out_blob,
                                InstallOperation::Type* out_type);
 
+// Same as above with the operations allowed in |config.version|, skipping the
+// compressors unlikely to produce a smaller blob with
+// |config.fast_algorithm_selection|.
+bool GenerateBestFullOperation(const brillo::Blob& new_data,
+                               const std::string& new_part,
+                               const PayloadGenerationConfig& config,
+                               brillo::Blob* out_blob,
+                               InstallOperation::Type* out_type);
+
 // Returns whether |op_type| is one of the REPLACE full operations.
 bool IsAReplaceOperation(InstallOperation::Type op_type);
 
@@ -145,12 +202,59 @@ bool IsExtFilesystem(const std::string& device);
 // Returns the max number of threads to process the files(chunks) in parallel.
 size_t GetMaxThreads();
 
+// Returns the number of blocks of the chunks to split |new_file| in, from
+// |chunk_blocks| up to the limit of |config.adaptive_chunk_apply_memory_bytes|
+// for compressible data.
+ssize_t AdaptiveChunkBlocks(const std::string& new_part,
+                            const FilesystemInterface::File& new_file,
+                            ssize_t chunk_blocks,
+                            const PayloadGenerationConfig& config);
+
 // Returns the old file which file name has the shortest levenshtein distance to
 // |new_file_name|.
 FilesystemInterface::File GetOldFile(
     const std::map<std::string, FilesystemInterface::File>& old_files_map,
     const std::string& new_file_name);
 
+// An index of the names of the old files of a partition, in a BK-tree, to
+// find the one closest to a new file name without computing its levenshtein
+// distance to all of them. Built once per partition.
+class OldFileIndex {
+ public:
+  // Indexes |old_files_map|, which must outlive the index.
+  explicit OldFileIndex(
+      const std::map<std::string, FilesystemInterface::File>& old_files_map);
+
+  // Same as GetOldFile() on the indexed files.
+  FilesystemInterface::File Find(const std::string& new_file_name) const;
+
+  // Indexes the data of the old files by the ids of their blocks in
+  // |old_block_ids|, from MapPartitionBlocks().
+  void IndexBlocks(const std::vector<BlockMapping::BlockId>& old_block_ids);
+
+  // Returns the old file with the name of |new_file|, otherwise the indexed
+  // old file with at least half of the non-zero blocks of |new_file|, whose
+  // ids are in |new_block_ids|, so that renamed and moved files are diffed
+  // against their old version, otherwise Find() of its name.
+  FilesystemInterface::File Find(
+      const FilesystemInterface::File& new_file,
+      const std::vector<BlockMapping::BlockId>& new_block_ids) const;
+
+ private:
+  struct Node {
+    const std::string* name;
+    const FilesystemInterface::File* file;
+    // The children by their distance to |name|.
+    std::map<int, size_t> children;
+  };
+
+  const std::map<std::string, FilesystemInterface::File>& old_files_map_;
+  // The root is the first node.
+  std::vector<Node> nodes_;
+  // The first node of the files with each block id, once indexed.
+  std::unordered_map<BlockMapping::BlockId, size_t> block_nodes_;
+};
+
 // Read BSDIFF patch data in |data|, compute list of blocks that can be COW_XOR,
 // store these blocks in |aop|.
 bool PopulateXorOps(AnnotatedOperation* aop, const uint8_t* data, size_t size);
@@ -220,8 +324,19 @@ class BestDiffGenerator {
       AnnotatedOperation* aop,
       brillo::Blob* data_blob);
 
+  // Sets the path of the old partition the old data is read from, so that the
+  // decompressed old data is shared with the other operations diffing from
+  // the same extents through the installed Lz4diffSourceCache.
+  void set_old_partition_path(const std::string& path) {
+    old_partition_path_ = path;
+  }
+
  private:
   std::vector<bsdiff::CompressorType> GetUsableCompressorTypes() const;
+  // Returns the DiffCache key of the operation generated from |aop| and
+  // |data_blob|, the full operation of the new data.
+  brillo::Blob DiffCacheKey(const AnnotatedOperation& aop,
+                            const brillo::Blob& data_blob) const;
   bool TryBsdiffAndUpdateOperation(InstallOperation_Type operation_type,
                                    AnnotatedOperation* aop,
                                    brillo::Blob* data_blob);
@@ -239,6 +354,7 @@ class BestDiffGenerator {
   const CompressedFile& old_block_info_;
   const CompressedFile& new_block_info_;
   const PayloadGenerationConfig& config_;
+  std::string old_partition_path_;
 };
 
 }  // namespace diff_utils
@@ -36,6 +36,7 @@
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
 #include "update_engine/payload_generator/fake_filesystem.h"
+#include "update_engine/payload_generator/zstd.h"
 
 using std::string;
 using std::vector;
@@ -127,7 +128,8 @@ class DeltaDiffUtilsTest : public ::testing::Test {
   // Helper function to call DeltaMovedAndZeroBlocks() using this class' data
   // members. This simply avoids repeating all the arguments that never change.
   bool RunDeltaMovedAndZeroBlocks(ssize_t chunk_blocks,
-                                  uint32_t minor_version) {
+                                  uint32_t minor_version,
+                                  bool enable_target_copy = false) {
     BlobFileWriter blob_file(tmp_blob_file_.fd(), &blob_size_);
     PayloadVersion version(kBrilloMajorPayloadVersion, minor_version);
     ExtentRanges old_zero_blocks;
@@ -137,7 +139,9 @@ class DeltaDiffUtilsTest : public ::testing::Test {
                                                old_part_.size / block_size_,
                                                new_part_.size / block_size_,
                                                chunk_blocks,
-                                               {.version = version},
+                                               {.version = version,
+                                                .enable_target_copy =
+                                                    enable_target_copy},
                                                &blob_file,
                                                &old_visited_blocks_,
                                                &new_visited_blocks_,
@@ -240,6 +244,139 @@ TEST_F(DeltaDiffUtilsTest, ReplaceSmallTest) {
   }
 }
 
+TEST_F(DeltaDiffUtilsTest, GenerateBestFullOperationFastTest) {
+  const PayloadGenerationConfig config{
+      .version = PayloadVersion(kBrilloMajorPayloadVersion,
+                                kMaxSupportedMinorPayloadVersion),
+      .fast_algorithm_selection = true};
+
+  // Random data isn't compressed at all.
+  brillo::Blob random_data;
+  std::mt19937 gen(12345);
+  std::uniform_int_distribution<uint16_t> dis(0, 255);
+  for (uint32_t i = 0; i < 16 * kBlockSize; i++) {
+    random_data.push_back(static_cast<uint8_t>(dis(gen)));
+  }
+  brillo::Blob blob;
+  InstallOperation::Type type{};
+  ASSERT_TRUE(diff_utils::GenerateBestFullOperation(
+      random_data, "", config, &blob, &type));
+  EXPECT_EQ(InstallOperation::REPLACE, type);
+  EXPECT_EQ(random_data, blob);
+
+  // Compressible data only uses xz.
+  brillo::Blob data(16 * kBlockSize);
+  test_utils::FillWithData(&data);
+  ASSERT_TRUE(
+      diff_utils::GenerateBestFullOperation(data, "", config, &blob, &type));
+  EXPECT_EQ(InstallOperation::REPLACE_XZ, type);
+  EXPECT_LT(blob.size(), data.size());
+}
+
+TEST_F(DeltaDiffUtilsTest, GenerateBestFullOperationApplyCostTest) {
+  PayloadGenerationConfig config{.version = PayloadVersion(
+                                     kBrilloMajorPayloadVersion,
+                                     kMaxSupportedMinorPayloadVersion)};
+  brillo::Blob data(16 * kBlockSize);
+  test_utils::FillWithData(&data);
+  brillo::Blob blob;
+  InstallOperation::Type type{};
+  ASSERT_TRUE(
+      diff_utils::GenerateBestFullOperation(data, "", config, &blob, &type));
+  EXPECT_EQ(InstallOperation::REPLACE_XZ, type);
+
+  // Decompressing is too slow for the data saved to be worth it.
+  config.apply_cost_model.download_bytes_per_second = 1024 * 1024 * 1024;
+  config.apply_cost_model.apply_ms_per_mib[InstallOperation::REPLACE_XZ] = 100;
+  config.apply_cost_model.apply_ms_per_mib[InstallOperation::REPLACE_BZ] = 100;
+  ASSERT_TRUE(
+      diff_utils::GenerateBestFullOperation(data, "", config, &blob, &type));
+  EXPECT_EQ(InstallOperation::REPLACE, type);
+  EXPECT_EQ(data, blob);
+}
+
+TEST_F(DeltaDiffUtilsTest, GenerateBestFullOperationZstdTest) {
+  PayloadGenerationConfig config{.version = PayloadVersion(
+                                     kBrilloMajorPayloadVersion,
+                                     kMaxSupportedMinorPayloadVersion)};
+  brillo::Blob data(16 * kBlockSize);
+  test_utils::FillWithData(&data);
+  ZstdDictionaries dictionaries;
+  ZstdDictionaries::Set(&dictionaries);
+  DEFER {
+    ZstdDictionaries::Set(nullptr);
+  };
+
+  // zstd is preferred to the smaller xz blobs without an apply cost model.
+  brillo::Blob blob;
+  InstallOperation::Type type{};
+  ASSERT_TRUE(
+      diff_utils::GenerateBestFullOperation(data, "", config, &blob, &type));
+  EXPECT_EQ(InstallOperation::REPLACE_ZSTD, type);
+  EXPECT_LT(blob.size(), data.size());
+
+  // Older minor versions can't use it.
+  config.version.minor = kLZ4DIFFMinorPayloadVersion;
+  ASSERT_TRUE(
+      diff_utils::GenerateBestFullOperation(data, "", config, &blob, &type));
+  EXPECT_EQ(InstallOperation::REPLACE_XZ, type);
+}
+
+TEST_F(DeltaDiffUtilsTest, DeltaReadFileChunksTest) {
+  ASSERT_TRUE(InitializePartitionWithUniqueBlocks(new_part_, block_size_, 42));
+  diff_utils::File old_file;
+  diff_utils::File new_file;
+  new_file.name = "file";
+  new_file.extents = {ExtentForRange(10, 10)};
+
+  BlobFileWriter blob_file(tmp_blob_file_.fd(), &blob_size_);
+  const PayloadGenerationConfig config{
+      .version = PayloadVersion(kBrilloMajorPayloadVersion,
+                                kSourceMinorPayloadVersion)};
+  ASSERT_TRUE(diff_utils::DeltaReadFileChunks(&aops_,
+                                              old_part_.path,
+                                              new_part_.path,
+                                              old_file,
+                                              new_file,
+                                              4,  // chunk_blocks
+                                              1,  // first_chunk
+                                              2,  // num_chunks
+                                              config,
+                                              &blob_file));
+  // The last chunk only has the 2 remaining blocks, and the chunks are named
+  // as when the whole file is read.
+  ASSERT_EQ(2u, aops_.size());
+  EXPECT_EQ("file:1", aops_[0].name);
+  ASSERT_EQ(1, aops_[0].op.dst_extents_size());
+  EXPECT_EQ(ExtentForRange(14, 4), aops_[0].op.dst_extents(0));
+  EXPECT_EQ("file:2", aops_[1].name);
+  ASSERT_EQ(1, aops_[1].op.dst_extents_size());
+  EXPECT_EQ(ExtentForRange(18, 2), aops_[1].op.dst_extents(0));
+}
+
+TEST_F(DeltaDiffUtilsTest, AdaptiveChunkBlocksTest) {
+  diff_utils::File new_file;
+  new_file.extents = {ExtentForRange(0, kDefaultBlockCount)};
+  PayloadGenerationConfig config;
+  // Chunks of up to 32 blocks.
+  config.adaptive_chunk_apply_memory_bytes = 32 * 4 * block_size_;
+  const ssize_t spread_blocks =
+      std::min<ssize_t>(32, kDefaultBlockCount / diff_utils::GetMaxThreads());
+  const ssize_t expected_blocks = spread_blocks > 4 ? spread_blocks / 4 * 4 : 4;
+
+  // The zeros of the new partition are compressible.
+  EXPECT_EQ(
+      expected_blocks,
+      diff_utils::AdaptiveChunkBlocks(new_part_.path, new_file, 4, config));
+
+  brillo::Blob random_data(new_part_.size);
+  std::mt19937 gen(0);
+  std::generate(random_data.begin(), random_data.end(), gen);
+  ASSERT_TRUE(test_utils::WriteFileVector(new_part_.path, random_data));
+  EXPECT_EQ(
+      4, diff_utils::AdaptiveChunkBlocks(new_part_.path, new_file, 4, config));
+}
+
 TEST_F(DeltaDiffUtilsTest, SourceCopyTest) {
   // Makes sure SOURCE_COPY operations are emitted whenever src_ops_allowed
   // is true. It is the same setup as MoveSmallTest, which checks that
@@ -581,6 +718,48 @@ TEST_F(DeltaDiffUtilsTest, IdenticalBlocksAreCopiedInOder) {
   ASSERT_EQ(0, blob_size_);
 }
 
+// Test that the blocks repeated in the new partition, but not found in the old
+// one, are copied from their first copy with TARGET_COPY operations.
+TEST_F(DeltaDiffUtilsTest, DuplicateBlocksAreCopiedFromTarget) {
+  old_part_.size = block_size_ * 20;
+  new_part_.size = block_size_ * 20;
+  InitializePartitionWithUniqueBlocks(old_part_, block_size_, 42);
+  InitializePartitionWithUniqueBlocks(new_part_, block_size_, 5);
+
+  brillo::Blob duplicate_data(block_size_ * 3, 'b');
+  duplicate_data[block_size_] = 'c';
+  duplicate_data[2 * block_size_] = 'd';
+  const vector<Extent> first_copy = {ExtentForRange(2, 3)};
+  const vector<Extent> second_copy = {ExtentForRange(10, 3)};
+  ASSERT_TRUE(
+      WriteExtents(new_part_.path, first_copy, block_size_, duplicate_data));
+  ASSERT_TRUE(
+      WriteExtents(new_part_.path, second_copy, block_size_, duplicate_data));
+
+  // Without TARGET_COPY, they are left for the files.
+  ASSERT_TRUE(RunDeltaMovedAndZeroBlocks(-1,  // chunk_blocks
+                                         kTargetCopyMinorPayloadVersion));
+  ASSERT_TRUE(aops_.empty());
+  ASSERT_EQ(0U, new_visited_blocks_.blocks());
+
+  ASSERT_TRUE(RunDeltaMovedAndZeroBlocks(-1,  // chunk_blocks
+                                         kTargetCopyMinorPayloadVersion,
+                                         true));  // enable_target_copy
+  ASSERT_EQ(1U, aops_.size());
+  const AnnotatedOperation& aop = aops_[0];
+  EXPECT_EQ(InstallOperation::TARGET_COPY, aop.op.type());
+  ASSERT_EQ(1, aop.op.src_extents_size());
+  EXPECT_EQ(first_copy[0], aop.op.src_extents(0));
+  ASSERT_EQ(1, aop.op.dst_extents_size());
+  EXPECT_EQ(second_copy[0], aop.op.dst_extents(0));
+  EXPECT_FALSE(aop.op.has_src_sha256_hash());
+
+  // The first copy is still written by the operations of the files.
+  EXPECT_EQ(second_copy, new_visited_blocks_.GetExtentsForBlockCount(3));
+  EXPECT_EQ(0U, old_visited_blocks_.blocks());
+  EXPECT_EQ(0, blob_size_);
+}
+
 // Test that all blocks with zeros are handled separately using REPLACE_BZ
 // operations unless they are not moved.
 TEST_F(DeltaDiffUtilsTest, ZeroBlocksUseReplaceBz) {
@@ -638,6 +817,58 @@ TEST_F(DeltaDiffUtilsTest, ZeroBlocksUseReplaceBz) {
   ASSERT_NE(0, blob_size_);
 }
 
+TEST_F(DeltaDiffUtilsTest, UnchangedPartitionIsCopiedInPlace) {
+  old_part_.size = block_size_ * 50;
+  new_part_.size = block_size_ * 50;
+  InitializePartitionWithUniqueBlocks(old_part_, block_size_, 42);
+  InitializePartitionWithUniqueBlocks(new_part_, block_size_, 42);
+  vector<Extent> zeros = {ExtentForRange(10, 5)};
+  brillo::Blob zeros_data(5 * block_size_, '\0');
+  ASSERT_TRUE(WriteExtents(old_part_.path, zeros, block_size_, zeros_data));
+  ASSERT_TRUE(WriteExtents(new_part_.path, zeros, block_size_, zeros_data));
+  ASSERT_TRUE(diff_utils::PartitionsIdentical(old_part_.path, new_part_.path));
+
+  // Mark some of the blocks as already visited.
+  new_visited_blocks_.AddExtent(ExtentForRange(40, 10));
+  BlobFileWriter blob_file(tmp_blob_file_.fd(), &blob_size_);
+  PayloadVersion version(kBrilloMajorPayloadVersion,
+                         kBrotliBsdiffMinorPayloadVersion);
+  ASSERT_TRUE(diff_utils::DeltaUnchangedPartition(&aops_,
+                                                  old_part_.path,
+                                                  new_part_.path,
+                                                  50,
+                                                  20,  // chunk_blocks
+                                                  {.version = version},
+                                                  &blob_file,
+                                                  new_visited_blocks_));
+
+  ASSERT_EQ(4U, aops_.size());
+  ASSERT_EQ(InstallOperation::ZERO, aops_[0].op.type());
+  ASSERT_EQ(1, aops_[0].op.dst_extents_size());
+  ASSERT_EQ(ExtentForRange(10, 5), aops_[0].op.dst_extents(0));
+  vector<Extent> expected_copies = {ExtentForRange(0, 10),
+                                    ExtentForRange(15, 20),
+                                    ExtentForRange(35, 5)};
+  for (size_t i = 0; i < expected_copies.size(); ++i) {
+    SCOPED_TRACE(base::StringPrintf("Failed on operation number %" PRIuS, i));
+    const AnnotatedOperation& aop = aops_[i + 1];
+    ASSERT_EQ(InstallOperation::SOURCE_COPY, aop.op.type());
+    ASSERT_EQ(1, aop.op.src_extents_size());
+    ASSERT_EQ(expected_copies[i], aop.op.src_extents(0));
+    ASSERT_EQ(1, aop.op.dst_extents_size());
+    ASSERT_EQ(expected_copies[i], aop.op.dst_extents(0));
+  }
+  ASSERT_EQ(0, blob_size_);
+
+  // A single different byte makes the partitions differ.
+  ASSERT_TRUE(WriteExtents(new_part_.path,
+                           {ExtentForRange(49, 1)},
+                           block_size_,
+                           brillo::Blob(block_size_, 'a')));
+  ASSERT_FALSE(
+      diff_utils::PartitionsIdentical(old_part_.path, new_part_.path));
+}
+
 TEST_F(DeltaDiffUtilsTest, ShuffledBlocksAreTracked) {
   vector<uint64_t> permutation = {0, 1, 5, 6, 7, 2, 3, 4, 9, 10, 11, 12, 8};
   vector<Extent> perm_extents;
@@ -727,6 +958,31 @@ TEST_F(DeltaDiffUtilsTest, GetOldFileTest) {
   ASSERT_EQ(diff_utils::GetOldFile(old_files_map, "a").name, "filename");
 }
 
+TEST_F(DeltaDiffUtilsTest, OldFileIndexFindsRenamedFilesTest) {
+  std::map<string, FilesystemInterface::File> old_files_map;
+  for (const auto& [name, extent] :
+       {std::make_pair("lib/libfoo.so", ExtentForRange(0, 4)),
+        std::make_pair("lib/libfoo2.so", ExtentForRange(4, 4))}) {
+    FilesystemInterface::File file;
+    file.name = name;
+    file.extents = {extent};
+    old_files_map.emplace(name, file);
+  }
+  diff_utils::OldFileIndex index(old_files_map);
+  index.IndexBlocks({1, 2, 3, 4, 5, 6, 7, 8});
+
+  // The file moved to another directory with 3 of its 4 blocks unchanged.
+  FilesystemInterface::File new_file;
+  new_file.name = "lib64/libfoo2.so";
+  new_file.extents = {ExtentForRange(0, 4)};
+  const vector<BlockMapping::BlockId> new_block_ids{1, 2, 3, 9, 10, 11};
+  EXPECT_EQ("lib/libfoo.so", index.Find(new_file, new_block_ids).name);
+
+  // Too few blocks in common, the most similar name is used.
+  new_file.extents = {ExtentForRange(2, 4)};
+  EXPECT_EQ("lib/libfoo2.so", index.Find(new_file, new_block_ids).name);
+}
+
 TEST_F(DeltaDiffUtilsTest, XorOpsSourceNotAligned) {
   ScopedTempFile patch_file;
   bsdiff::BsdiffPatchWriter writer{patch_file.path()};
@@ -0,0 +1,113 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/diff_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+
+#include "update_engine/common/utils.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The entries start with this magic and format version, followed by the
+// operation type as a little-endian uint32_t and the operation data.
+constexpr char kEntryMagic[] = {'U', 'E', 'D', 'C', '1'};
+constexpr size_t kHeaderSize = sizeof(kEntryMagic) + sizeof(uint32_t);
+
+}  // namespace
+
+string DiffCache::EntryPath(const brillo::Blob& key) const {
+  return base::FilePath(dir_)
+      .Append(base::HexEncode(key.data(), key.size()))
+      .value();
+}
+
+bool DiffCache::Lookup(const brillo::Blob& key,
+                       InstallOperation::Type* type,
+                       brillo::Blob* patch) const {
+  brillo::Blob entry;
+  const string path = EntryPath(key);
+  if (!utils::FileExists(path.c_str()) || !utils::ReadFile(path, &entry))
+    return false;
+  if (entry.size() < kHeaderSize ||
+      memcmp(entry.data(), kEntryMagic, sizeof(kEntryMagic)) != 0) {
+    LOG(WARNING) << "Ignoring the invalid diff cache entry " << path;
+    return false;
+  }
+  uint32_t type_value = 0;
+  for (size_t i = 0; i < sizeof(type_value); i++) {
+    type_value |= static_cast<uint32_t>(entry[sizeof(kEntryMagic) + i])
+                  << (8 * i);
+  }
+  if (!InstallOperation::Type_IsValid(type_value)) {
+    LOG(WARNING) << "Ignoring the invalid diff cache entry " << path;
+    return false;
+  }
+  *type = static_cast<InstallOperation::Type>(type_value);
+  patch->assign(entry.begin() + kHeaderSize, entry.end());
+  return true;
+}
+
+bool DiffCache::Store(const brillo::Blob& key,
+                      InstallOperation::Type type,
+                      const brillo::Blob& patch) const {
+  brillo::Blob entry(kEntryMagic, kEntryMagic + sizeof(kEntryMagic));
+  const uint32_t type_value = type;
+  for (size_t i = 0; i < sizeof(type_value); i++)
+    entry.push_back(static_cast<uint8_t>(type_value >> (8 * i)));
+  entry.insert(entry.end(), patch.begin(), patch.end());
+
+  base::FilePath temp_path;
+  TEST_AND_RETURN_FALSE(
+      base::CreateTemporaryFileInDir(base::FilePath(dir_), &temp_path));
+  ScopedPathUnlinker unlinker(temp_path.value());
+  TEST_AND_RETURN_FALSE(
+      utils::WriteFile(temp_path.value().c_str(), entry.data(), entry.size()));
+  // A concurrent Store() of the same key writes the same entry, so it doesn't
+  // matter which rename wins.
+  if (rename(temp_path.value().c_str(), EntryPath(key).c_str()) != 0) {
+    PLOG(ERROR) << "Failed to store the diff cache entry " << EntryPath(key);
+    return false;
+  }
+  unlinker.set_should_remove(false);
+  return true;
+}
+
+bool DiffCache::InShard(const brillo::Blob& key,
+                        uint32_t shard,
+                        uint32_t num_shards) {
+  if (num_shards <= 1)
+    return true;
+  uint64_t value = 0;
+  for (size_t i = 0; i < sizeof(value) && i < key.size(); i++)
+    value |= static_cast<uint64_t>(key[i]) << (8 * i);
+  return value % num_shards == shard;
+}
+
+}  // namespace chromeos_update_engine
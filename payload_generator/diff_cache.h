@@ -0,0 +1,69 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_DIFF_CACHE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_DIFF_CACHE_H_
+
+#include <cstdint>
+#include <string>
+
+#include <brillo/secure_blob.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// An on-disk cache of the diff operations generated for a source and target
+// data, so that generating payloads from several source builds to the same
+// target doesn't run the same diff algorithms on the unchanged files again.
+//
+// The entries are files in a directory, named after their key, which is a
+// hash of everything the diff depends on: see
+// BestDiffGenerator::GenerateBestDiffOperation(). Entries are written to a
+// temporary file first and renamed, so several generators may share the
+// directory. Nothing is ever evicted.
+class DiffCache {
+ public:
+  explicit DiffCache(const std::string& dir) : dir_(dir) {}
+
+  // Returns whether there is an entry for |key|, and if so stores the type of
+  // the cached operation in |type| and its data in |patch|.
+  bool Lookup(const brillo::Blob& key,
+              InstallOperation::Type* type,
+              brillo::Blob* patch) const;
+
+  // Stores the operation of |type| with data |patch| as the entry of |key|.
+  bool Store(const brillo::Blob& key,
+             InstallOperation::Type type,
+             const brillo::Blob& patch) const;
+
+  // Returns whether the entry of |key| belongs to the shard |shard| out of
+  // |num_shards|. The keys are hashes, so the shards have about the same
+  // number of entries, and every key belongs to exactly one of them.
+  static bool InShard(const brillo::Blob& key,
+                      uint32_t shard,
+                      uint32_t num_shards);
+
+ private:
+  std::string EntryPath(const brillo::Blob& key) const;
+
+  std::string dir_;
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_DIFF_CACHE_H_
@@ -0,0 +1,101 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/diff_cache.h"
+
+#include <string>
+
+#include <base/files/file_enumerator.h>
+#include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+class DiffCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    patch_.resize(10000);
+    test_utils::FillWithData(&patch_);
+  }
+
+  base::ScopedTempDir temp_dir_;
+  const brillo::Blob key_{1, 2, 3, 4};
+  brillo::Blob patch_;
+};
+
+TEST_F(DiffCacheTest, StoreAndLookupTest) {
+  DiffCache cache(temp_dir_.GetPath().value());
+  InstallOperation::Type type{};
+  brillo::Blob patch;
+  EXPECT_FALSE(cache.Lookup(key_, &type, &patch));
+
+  ASSERT_TRUE(cache.Store(key_, InstallOperation::PUFFDIFF, patch_));
+  ASSERT_TRUE(cache.Lookup(key_, &type, &patch));
+  EXPECT_EQ(InstallOperation::PUFFDIFF, type);
+  EXPECT_EQ(patch_, patch);
+
+  // Another key is a miss, and the entries are shared by the caches of the
+  // same directory.
+  EXPECT_FALSE(cache.Lookup({1, 2, 3, 5}, &type, &patch));
+  DiffCache other_cache(temp_dir_.GetPath().value());
+  EXPECT_TRUE(other_cache.Lookup(key_, &type, &patch));
+}
+
+TEST_F(DiffCacheTest, EmptyPatchTest) {
+  DiffCache cache(temp_dir_.GetPath().value());
+  ASSERT_TRUE(cache.Store(key_, InstallOperation::REPLACE_XZ, {}));
+  InstallOperation::Type type{};
+  brillo::Blob patch = patch_;
+  ASSERT_TRUE(cache.Lookup(key_, &type, &patch));
+  EXPECT_EQ(InstallOperation::REPLACE_XZ, type);
+  EXPECT_TRUE(patch.empty());
+}
+
+TEST_F(DiffCacheTest, InvalidEntryIsIgnoredTest) {
+  DiffCache cache(temp_dir_.GetPath().value());
+  ASSERT_TRUE(cache.Store(key_, InstallOperation::ZUCCHINI, patch_));
+  // Overwrite the only entry with something that is not an entry.
+  base::FileEnumerator entries(
+      temp_dir_.GetPath(), false, base::FileEnumerator::FILES);
+  const base::FilePath entry = entries.Next();
+  ASSERT_FALSE(entry.empty());
+  EXPECT_TRUE(entries.Next().empty());
+  ASSERT_TRUE(test_utils::WriteFileString(entry.value(), "garbage"));
+
+  InstallOperation::Type type{};
+  brillo::Blob patch;
+  EXPECT_FALSE(cache.Lookup(key_, &type, &patch));
+}
+
+TEST_F(DiffCacheTest, InShardTest) {
+  EXPECT_TRUE(DiffCache::InShard(key_, 0, 1));
+  for (uint8_t i = 0; i < 100; i++) {
+    const brillo::Blob key{i, 2, 3, 4, 5, 6, 7, 8, 9};
+    int shards = 0;
+    for (uint32_t shard = 0; shard < 3; shard++)
+      shards += DiffCache::InShard(key, shard, 3);
+    EXPECT_EQ(1, shards);
+  }
+}
+
+}  // namespace chromeos_update_engine
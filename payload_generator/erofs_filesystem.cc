@@ -20,9 +20,13 @@
 #include <fcntl.h>
 #include <time.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <iterator>
 #include <string>
-#include <mutex>
+#include <utility>
+#include <vector>
 
 #include <android-base/unique_fd.h>
 #include <erofs/dir.h>
@@ -35,14 +39,19 @@
 #include "lz4diff/lz4patch.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
 #include "update_engine/payload_generator/filesystem_interface.h"
+#include "update_engine/payload_generator/task_pool.h"
 
 namespace chromeos_update_engine {
 
 namespace {
 
+// The number of files whose extents a task maps.
+constexpr size_t kFilesPerChunk = 256;
+
 static constexpr int GetOccupiedSize(const struct erofs_inode* inode,
                                      size_t block_size,
                                      erofs_off_t* size) {
@@ -217,58 +226,90 @@ bool ErofsFilesystem::GetFiles(struct erofs_sb_info* sbi,
                                const std::string& filename,
                                std::vector<File>* files,
                                const CompressionAlgorithm& algo) {
-  size_t unaligned_bytes = 0;
   const auto block_size = 1UL << sbi->blkszbits;
+  // The directory walk only collects the regular files, their extents are
+  // mapped below in parallel. Reading inodes and mapping blocks only read the
+  // image through |sbi| with pread(), and all the state of a mapping lives in
+  // its inode and erofs_map_blocks, so workers can share |sbi|.
+  std::vector<std::pair<std::string, erofs_nid_t>> entries;
   const auto err = erofs_iterate_root_dir(
       sbi, [&](struct erofs_iterate_dir_context* p_info) {
         const auto& info = *p_info;
-        if (info.ctx.de_ftype != EROFS_FT_REG_FILE) {
-          return 0;
+        if (info.ctx.de_ftype == EROFS_FT_REG_FILE) {
+          entries.emplace_back(info.path, info.ctx.de_nid);
         }
+        return 0;
+      });
+  if (err) {
+    LOG(ERROR) << "EROFS files iteration filed " << strerror(-err);
+    return false;
+  }
+
+  // Files with no data are skipped, so each chunk fills its own list and the
+  // lists are concatenated in the order of the walk.
+  const size_t num_chunks =
+      std::max<size_t>(1, utils::DivRoundUp(entries.size(), kFilesPerChunk));
+  std::vector<std::vector<File>> chunk_files(num_chunks);
+  std::vector<size_t> chunk_unaligned_bytes(num_chunks);
+  std::atomic<bool> failed{false};
+  std::vector<TaskPool::Task> tasks;
+  tasks.reserve(num_chunks);
+  for (size_t i = 0; i < num_chunks; i++) {
+    tasks.push_back([&, i] {
+      const size_t end = std::min(entries.size(), (i + 1) * kFilesPerChunk);
+      for (size_t j = i * kFilesPerChunk; j < end && !failed; j++) {
         struct erofs_inode inode {};
-        inode.nid = info.ctx.de_nid;
+        inode.nid = entries[j].second;
         inode.sbi = sbi;
         int err = erofs_read_inode_from_disk(&inode);
         if (err) {
           LOG(ERROR) << "Failed to read inode " << inode.nid;
-          return err;
+          failed = true;
+          return;
         }
         const auto uncompressed_size = inode.i_size;
         erofs_off_t compressed_size = 0;
         if (uncompressed_size == 0) {
-          return 0;
+          continue;
         }
         err = GetOccupiedSize(&inode, block_size, &compressed_size);
         if (err) {
           LOG(FATAL) << "Failed to get occupied size for " << filename;
-          return err;
+          failed = true;
+          return;
         }
         // For EROFS_INODE_FLAT_INLINE , most blocks are stored on aligned
         // addresses. Except the last block, which is stored right after the
-        // inode. These nodes will have a slight amount of data unaligned, which
-        // is fine.
+        // inode. These nodes will have a slight amount of data unaligned,
+        // which is fine.
 
         File file;
-        file.name = info.path;
+        file.name = std::move(entries[j].first);
         file.compressed_file_info.zero_padding_enabled =
             erofs_sb_has_lz4_0padding(sbi);
         file.is_compressed = compressed_size != uncompressed_size;
 
         file.file_stat.st_size = uncompressed_size;
         file.file_stat.st_ino = inode.nid;
-        FillExtentInfo(&file, filename, &inode, &unaligned_bytes);
+        FillExtentInfo(&file, filename, &inode, &chunk_unaligned_bytes[i]);
         file.compressed_file_info.algo = algo;
+        NormalizeExtents(&file.extents);
 
-        files->emplace_back(std::move(file));
-        return 0;
-      });
-  if (err) {
-    LOG(ERROR) << "EROFS files iteration filed " << strerror(-err);
+        chunk_files[i].emplace_back(std::move(file));
+      }
+    });
+  }
+  TaskPool::RunTasks(std::move(tasks), diff_utils::GetMaxThreads());
+  if (failed) {
     return false;
   }
 
-  for (auto& file : *files) {
-    NormalizeExtents(&file.extents);
+  size_t unaligned_bytes = 0;
+  for (size_t i = 0; i < num_chunks; i++) {
+    unaligned_bytes += chunk_unaligned_bytes[i];
+    std::move(chunk_files[i].begin(),
+              chunk_files[i].end(),
+              std::back_inserter(*files));
   }
   LOG(INFO) << "EROFS image " << filename << " has " << unaligned_bytes
             << " unaligned bytes, which is "
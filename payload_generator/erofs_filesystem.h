@@ -27,10 +27,10 @@ namespace chromeos_update_engine {
 class ErofsFilesystem final : public FilesystemInterface {
  public:
   // Creates an ErofsFilesystem from a erofs formatted filesystem stored in a
-  // file. The file doesn't need to be loop-back mounted. Since erofs-utils
-  // library functions are not concurrency safe(can't be used in multi-threaded
-  // context, can't even work with multiple EROFS images concurrently on 1
-  // thread), this function takes a global mutex.
+  // file. The file doesn't need to be loop-back mounted. All the erofs-utils
+  // state of an image lives in its own erofs_sb_info, so several images can be
+  // parsed concurrently, and the extents of the files of an image are mapped
+  // on the installed TaskPool.
   static std::unique_ptr<ErofsFilesystem> CreateFromFile(
       const std::string& filename,
       const CompressionAlgorithm& algo =
@@ -28,6 +28,7 @@
 #pragma clang diagnostic pop
 #endif
 
+#include <algorithm>
 #include <map>
 #include <set>
 
@@ -35,8 +36,10 @@
 #include <base/strings/stringprintf.h>
 
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/task_pool.h"
 #include "update_engine/update_metadata.pb.h"
 
 using std::set;
@@ -124,75 +127,52 @@ int UpdateFileAndAppend(ext2_ino_t dir,
   return 0;
 }
 
-}  // namespace
-
-unique_ptr<Ext2Filesystem> Ext2Filesystem::CreateFromFile(
-    const string& filename) {
-  if (filename.empty())
-    return nullptr;
-  unique_ptr<Ext2Filesystem> result(new Ext2Filesystem());
-  result->filename_ = filename;
-
-  errcode_t err = ext2fs_open(filename.c_str(),
-                              0,  // flags (read only)
-                              0,  // superblock block number
-                              0,  // block_size (autodetect)
-                              unix_io_manager,
-                              &result->filsys_);
-  if (err) {
-    LOG(ERROR) << "Opening ext2fs " << filename;
-    return nullptr;
-  }
-  return result;
-}
-
-Ext2Filesystem::~Ext2Filesystem() {
-  ext2fs_free(filsys_);
-}
-
-size_t Ext2Filesystem::GetBlockSize() const {
-  return filsys_->blocksize;
-}
-
-size_t Ext2Filesystem::GetBlockCount() const {
-  return ext2fs_blocks_count(filsys_->super);
-}
+// The inodes of a range of block groups, see ScanBlockGroups().
+struct InodeScan {
+  std::map<ext2_ino_t, FilesystemInterface::File> inodes;
+  vector<ext2_ino_t> directories;
+  set<uint64_t> inode_blocks;
+};
 
-bool Ext2Filesystem::GetFiles(vector<File>* files) const {
-  TEST_AND_RETURN_FALSE_ERRCODE(ext2fs_read_inode_bitmap(filsys_));
+// Scans the inodes of the block groups [|first_group|, |end_group|) of
+// |filsys| into |scan|.
+bool ScanBlockGroups(ext2_filsys filsys,
+                     dgrp_t first_group,
+                     dgrp_t end_group,
+                     InodeScan* scan) {
+  TEST_AND_RETURN_FALSE_ERRCODE(ext2fs_read_inode_bitmap(filsys));
 
   ext2_inode_scan iscan;
   TEST_AND_RETURN_FALSE_ERRCODE(
-      ext2fs_open_inode_scan(filsys_, 0 /* buffer_blocks */, &iscan));
-
-  std::map<ext2_ino_t, File> inodes;
-
-  // List of directories. We need to first parse all the files in a directory
-  // to later fix the absolute paths.
-  vector<ext2_ino_t> directories;
-
-  set<uint64_t> inode_blocks;
+      ext2fs_open_inode_scan(filsys, 0 /* buffer_blocks */, &iscan));
+  const ext2_ino_t last_ino = end_group * filsys->super->s_inodes_per_group;
 
   // Iterator
   ext2_ino_t it_ino;
   ext2_inode it_inode;
 
   bool ok = true;
-  while (true) {
-    errcode_t error = ext2fs_get_next_inode(iscan, &it_ino, &it_inode);
+  errcode_t error = ext2fs_inode_scan_goto_blockgroup(iscan, first_group);
+  if (error) {
+    LOG(ERROR) << "Failed to go to block group " << first_group << " ("
+               << error << ")";
+    ok = false;
+  }
+  while (ok) {
+    error = ext2fs_get_next_inode(iscan, &it_ino, &it_inode);
     if (error) {
       LOG(ERROR) << "Failed to retrieve next inode (" << error << ")";
       ok = false;
       break;
     }
-    if (it_ino == 0)
+    if (it_ino == 0 || it_ino > last_ino)
       break;
 
     // Skip inodes that are not in use.
-    if (!ext2fs_test_inode_bitmap(filsys_->inode_map, it_ino))
+    if (!ext2fs_test_inode_bitmap(filsys->inode_map, it_ino))
       continue;
 
-    File& file = inodes[it_ino];
+    FilesystemInterface::File& file = scan->inodes[it_ino];
     if (it_ino == EXT2_RESIZE_INO) {
       file.name = "<group-descriptors>";
     } else {
@@ -206,15 +186,15 @@ bool Ext2Filesystem::GetFiles(vector<File>* files) const {
     file.file_stat.st_uid = it_inode.i_uid;
     file.file_stat.st_gid = it_inode.i_gid;
     file.file_stat.st_size = it_inode.i_size;
-    file.file_stat.st_blksize = filsys_->blocksize;
+    file.file_stat.st_blksize = filsys->blocksize;
     file.file_stat.st_blocks = it_inode.i_blocks;
     file.file_stat.st_atime = it_inode.i_atime;
     file.file_stat.st_mtime = it_inode.i_mtime;
     file.file_stat.st_ctime = it_inode.i_ctime;
 
-    bool is_dir = (ext2fs_check_directory(filsys_, it_ino) == 0);
+    bool is_dir = (ext2fs_check_directory(filsys, it_ino) == 0);
     if (is_dir)
-      directories.push_back(it_ino);
+      scan->directories.push_back(it_ino);
 
     if (!ext2fs_inode_has_valid_blocks(&it_inode))
       continue;
@@ -224,7 +204,7 @@ bool Ext2Filesystem::GetFiles(vector<File>* files) const {
     // and triple indirect blocks (no data blocks). For directories and
     // the journal, all blocks are considered metadata blocks.
     int flags = it_ino < EXT2_GOOD_OLD_FIRST_INO ? 0 : BLOCK_FLAG_DATA_ONLY;
-    error = ext2fs_block_iterate2(filsys_,
+    error = ext2fs_block_iterate2(filsys,
                                   it_ino,
                                   flags,
                                   nullptr,  // block_buf
@@ -238,12 +218,92 @@ bool Ext2Filesystem::GetFiles(vector<File>* files) const {
     }
     if (it_ino >= EXT2_GOOD_OLD_FIRST_INO) {
       ext2fs_block_iterate2(
-          filsys_, it_ino, 0, nullptr, AddMetadataBlocks, &inode_blocks);
+          filsys, it_ino, 0, nullptr, AddMetadataBlocks, &scan->inode_blocks);
     }
   }
   ext2fs_close_inode_scan(iscan);
-  if (!ok)
-    return false;
+  return ok;
+}
+
+}  // namespace
+
+unique_ptr<Ext2Filesystem> Ext2Filesystem::CreateFromFile(
+    const string& filename) {
+  if (filename.empty())
+    return nullptr;
+  unique_ptr<Ext2Filesystem> result(new Ext2Filesystem());
+  result->filename_ = filename;
+
+  errcode_t err = ext2fs_open(filename.c_str(),
+                              0,  // flags (read only)
+                              0,  // superblock block number
+                              0,  // block_size (autodetect)
+                              unix_io_manager,
+                              &result->filsys_);
+  if (err) {
+    LOG(ERROR) << "Opening ext2fs " << filename;
+    return nullptr;
+  }
+  return result;
+}
+
+Ext2Filesystem::~Ext2Filesystem() {
+  ext2fs_free(filsys_);
+}
+
+size_t Ext2Filesystem::GetBlockSize() const {
+  return filsys_->blocksize;
+}
+
+size_t Ext2Filesystem::GetBlockCount() const {
+  return ext2fs_blocks_count(filsys_->super);
+}
+
+bool Ext2Filesystem::GetFiles(vector<File>* files) const {
+  // The inode tables of the block groups are split in ranges scanned by
+  // their own thread and filesystem handle, as libext2fs handles aren't
+  // thread safe.
+  const dgrp_t num_groups = filsys_->group_desc_count;
+  const size_t num_ranges =
+      std::max<size_t>(1, std::min<size_t>(GetMaxThreads(), num_groups));
+  vector<InodeScan> scans(num_ranges);
+  vector<char> results(num_ranges);
+  vector<TaskPool::Task> tasks;
+  for (size_t i = 0; i < num_ranges; i++) {
+    tasks.push_back([this, i, num_ranges, num_groups, &scans, &results] {
+      const dgrp_t first_group = num_groups * i / num_ranges;
+      const dgrp_t end_group = num_groups * (i + 1) / num_ranges;
+      ext2_filsys filsys = filsys_;
+      if (i > 0) {
+        errcode_t err = ext2fs_open(
+            filename_.c_str(), 0, 0, 0, unix_io_manager, &filsys);
+        if (err) {
+          LOG(ERROR) << "Opening ext2fs " << filename_ << " (" << err << ")";
+          return;
+        }
+      }
+      results[i] = ScanBlockGroups(filsys, first_group, end_group, &scans[i]);
+      if (filsys != filsys_) {
+        ext2fs_free(filsys);
+      }
+    });
+  }
+  TaskPool::RunTasks(std::move(tasks), num_ranges);
+  TEST_AND_RETURN_FALSE(std::all_of(
+      results.begin(), results.end(), [](char result) { return result; }));
+
+  // The ranges are in inode order, so are the merged |directories|.
+  std::map<ext2_ino_t, File> inodes;
+  // List of directories. We need to first parse all the files in a directory
+  // to later fix the absolute paths.
+  vector<ext2_ino_t> directories;
+  set<uint64_t> inode_blocks;
+  for (auto& scan : scans) {
+    inodes.merge(scan.inodes);
+    directories.insert(
+        directories.end(), scan.directories.begin(), scan.directories.end());
+    inode_blocks.merge(scan.inode_blocks);
+  }
 
   // The set of inodes already added to the output. There can be less elements
   // here than in files since the later can contain repeated inodes due to
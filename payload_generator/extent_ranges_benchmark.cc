@@ -0,0 +1,136 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+// Compares ExtentRanges and FlatExtentRanges on the extents of the operations
+// of a manifest, doing what the generator does with them: collecting the
+// blocks written and read by each partition, subtracting one from the other
+// and filtering and intersecting the extents of each operation.
+//
+// Runs on a synthetic manifest, and on the manifests of the payloads passed as
+// arguments after the benchmark flags.
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <base/files/file_path.h>
+#include <base/logging.h>
+#include <benchmark/benchmark.h>
+
+#include "update_engine/payload_consumer/payload_metadata.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/flat_extent_ranges.h"
+#include "update_engine/update_metadata.pb.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// A partition of about 4 GiB of 4 KiB blocks, with operations of a few
+// extents scattered over it, as a partition of fragmented files would have.
+DeltaArchiveManifest SyntheticManifest() {
+  constexpr uint64_t kPartitionBlocks = 1024 * 1024;
+  constexpr size_t kNumOperations = 20000;
+  std::mt19937 gen(12345);
+  std::uniform_int_distribution<uint64_t> start(0, kPartitionBlocks - 64);
+  std::uniform_int_distribution<uint64_t> num_blocks(1, 64);
+  std::uniform_int_distribution<size_t> num_extents(1, 4);
+  DeltaArchiveManifest manifest;
+  PartitionUpdate* partition = manifest.add_partitions();
+  partition->set_partition_name("system");
+  for (size_t i = 0; i < kNumOperations; i++) {
+    InstallOperation* op = partition->add_operations();
+    op->set_type(InstallOperation::SOURCE_BSDIFF);
+    for (size_t j = num_extents(gen); j > 0; j--)
+      *op->add_src_extents() = ExtentForRange(start(gen), num_blocks(gen));
+    for (size_t j = num_extents(gen); j > 0; j--)
+      *op->add_dst_extents() = ExtentForRange(start(gen), num_blocks(gen));
+  }
+  return manifest;
+}
+
+template <typename Ranges>
+void BM_ManifestExtents(benchmark::State& state,
+                        const DeltaArchiveManifest& manifest) {
+  size_t num_extents = 0;
+  for (auto _ : state) {
+    for (const PartitionUpdate& partition : manifest.partitions()) {
+      Ranges written;
+      Ranges read;
+      for (const InstallOperation& op : partition.operations()) {
+        written.AddRepeatedExtents(op.dst_extents());
+        read.AddRepeatedExtents(op.src_extents());
+      }
+      Ranges read_only = read;
+      read_only.SubtractRanges(written);
+      for (const InstallOperation& op : partition.operations()) {
+        const vector<Extent> src_extents(op.src_extents().begin(),
+                                         op.src_extents().end());
+        benchmark::DoNotOptimize(FilterExtentRanges(src_extents, written));
+        for (const Extent& extent : op.dst_extents())
+          benchmark::DoNotOptimize(read.GetIntersectingExtents(extent));
+      }
+      benchmark::DoNotOptimize(read_only.blocks());
+    }
+  }
+  for (const PartitionUpdate& partition : manifest.partitions()) {
+    for (const InstallOperation& op : partition.operations())
+      num_extents += op.src_extents_size() + op.dst_extents_size();
+  }
+  state.SetItemsProcessed(state.iterations() * num_extents);
+}
+
+void RegisterManifest(const string& name,
+                      const DeltaArchiveManifest& manifest) {
+  benchmark::RegisterBenchmark(
+      ("BM_ManifestExtents<ExtentRanges>/" + name).c_str(),
+      BM_ManifestExtents<ExtentRanges>,
+      manifest)
+      ->Unit(benchmark::kMillisecond);
+  benchmark::RegisterBenchmark(
+      ("BM_ManifestExtents<FlatExtentRanges>/" + name).c_str(),
+      BM_ManifestExtents<FlatExtentRanges>,
+      manifest)
+      ->Unit(benchmark::kMillisecond);
+}
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+int main(int argc, char** argv) {
+  using chromeos_update_engine::DeltaArchiveManifest;
+  benchmark::Initialize(&argc, argv);
+  chromeos_update_engine::RegisterManifest(
+      "synthetic", chromeos_update_engine::SyntheticManifest());
+  for (int i = 1; i < argc; i++) {
+    DeltaArchiveManifest manifest;
+    if (!chromeos_update_engine::PayloadMetadata().ParsePayloadFile(
+            argv[i], &manifest, nullptr)) {
+      LOG(ERROR) << "Failed to parse the payload " << argv[i];
+      return 1;
+    }
+    chromeos_update_engine::RegisterManifest(
+        base::FilePath(argv[i]).BaseName().value(), manifest);
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -0,0 +1,325 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/flat_extent_ranges.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Below this many extents, adding or subtracting them one at a time is cheaper
+// than a pass over all the ranges.
+constexpr size_t kMinBulkExtents = 16;
+
+}  // namespace
+
+template <typename Extents>
+vector<FlatExtentRanges::BlockRange> FlatExtentRanges::SortedRanges(
+    const Extents& extents) {
+  vector<BlockRange> ranges;
+  ranges.reserve(extents.size());
+  for (const Extent& extent : extents) {
+    if (extent.start_block() == kSparseHole || extent.num_blocks() == 0)
+      continue;
+    ranges.push_back(
+        {extent.start_block(), extent.start_block() + extent.num_blocks()});
+  }
+  std::sort(ranges.begin(), ranges.end(), [](const auto& a, const auto& b) {
+    return a.start < b.start || (a.start == b.start && a.end < b.end);
+  });
+  return ranges;
+}
+
+size_t FlatExtentRanges::FirstEndingAfter(uint64_t block) const {
+  // The ranges don't overlap, so their ends are sorted too.
+  return std::partition_point(
+             ranges_.begin(),
+             ranges_.end(),
+             [block](const BlockRange& range) { return range.end <= block; }) -
+         ranges_.begin();
+}
+
+void FlatExtentRanges::AddBlock(uint64_t block) {
+  AddExtent(ExtentForRange(block, 1));
+}
+
+void FlatExtentRanges::SubtractBlock(uint64_t block) {
+  SubtractExtent(ExtentForRange(block, 1));
+}
+
+void FlatExtentRanges::AddExtent(const Extent& extent) {
+  if (extent.start_block() == kSparseHole || extent.num_blocks() == 0)
+    return;
+  BlockRange added{extent.start_block(),
+                   extent.start_block() + extent.num_blocks()};
+
+  // The ranges in [first, last) overlap, or touch, the added one.
+  const auto first = std::partition_point(
+      ranges_.begin(), ranges_.end(), [this, &added](const BlockRange& range) {
+        return merge_touching_extents_ ? range.end < added.start
+                                       : range.end <= added.start;
+      });
+  const auto last = std::partition_point(
+      first, ranges_.end(), [this, &added](const BlockRange& range) {
+        return merge_touching_extents_ ? range.start <= added.end
+                                       : range.start < added.end;
+      });
+  if (first == last) {
+    ranges_.insert(first, added);
+    blocks_ += added.end - added.start;
+    return;
+  }
+  for (auto it = first; it != last; ++it)
+    blocks_ -= it->end - it->start;
+  added.start = std::min(added.start, first->start);
+  added.end = std::max(added.end, (last - 1)->end);
+  blocks_ += added.end - added.start;
+  *first = added;
+  ranges_.erase(first + 1, last);
+}
+
+void FlatExtentRanges::SubtractExtent(const Extent& extent) {
+  if (extent.start_block() == kSparseHole || extent.num_blocks() == 0)
+    return;
+  const uint64_t start = extent.start_block();
+  const uint64_t end = start + extent.num_blocks();
+
+  // The ranges in [first, last) overlap the subtracted one.
+  const auto first = ranges_.begin() + FirstEndingAfter(start);
+  const auto last = std::partition_point(
+      first, ranges_.end(), [end](const BlockRange& range) {
+        return range.start < end;
+      });
+  if (first == last)
+    return;
+  for (auto it = first; it != last; ++it)
+    blocks_ -= it->end - it->start;
+  // What is left of the first and last ranges.
+  BlockRange left[2];
+  size_t num_left = 0;
+  if (first->start < start)
+    left[num_left++] = {first->start, start};
+  if ((last - 1)->end > end)
+    left[num_left++] = {end, (last - 1)->end};
+  for (size_t i = 0; i < num_left; i++)
+    blocks_ += left[i].end - left[i].start;
+  const auto it = ranges_.erase(first, last);
+  ranges_.insert(it, left, left + num_left);
+}
+
+void FlatExtentRanges::MergeRanges(const vector<BlockRange>& ranges) {
+  vector<BlockRange> merged;
+  merged.reserve(ranges_.size() + ranges.size());
+  blocks_ = 0;
+  auto append = [this, &merged](const BlockRange& range) {
+    if (!merged.empty() &&
+        (range.start < merged.back().end ||
+         (merge_touching_extents_ && range.start == merged.back().end))) {
+      if (range.end > merged.back().end) {
+        blocks_ += range.end - merged.back().end;
+        merged.back().end = range.end;
+      }
+      return;
+    }
+    merged.push_back(range);
+    blocks_ += range.end - range.start;
+  };
+  auto it = ranges_.begin();
+  auto jt = ranges.begin();
+  while (it != ranges_.end() || jt != ranges.end()) {
+    if (jt == ranges.end() || (it != ranges_.end() && it->start <= jt->start))
+      append(*it++);
+    else
+      append(*jt++);
+  }
+  ranges_ = std::move(merged);
+}
+
+void FlatExtentRanges::SubtractSortedRanges(const vector<BlockRange>& ranges) {
+  vector<BlockRange> left;
+  left.reserve(ranges_.size());
+  blocks_ = 0;
+  auto keep = [this, &left](uint64_t start, uint64_t end) {
+    left.push_back({start, end});
+    blocks_ += end - start;
+  };
+  // The subtracted ranges before |next| end before the current range.
+  auto next = ranges.begin();
+  for (const BlockRange& range : ranges_) {
+    while (next != ranges.end() && next->end <= range.start)
+      ++next;
+    uint64_t start = range.start;
+    for (auto it = next; it != ranges.end() && it->start < range.end; ++it) {
+      if (it->start > start)
+        keep(start, it->start);
+      start = std::max(start, it->end);
+    }
+    if (start < range.end)
+      keep(start, range.end);
+  }
+  ranges_ = std::move(left);
+}
+
+template <typename Extents>
+void FlatExtentRanges::AddMany(const Extents& extents) {
+  if (static_cast<size_t>(extents.size()) < kMinBulkExtents) {
+    for (const Extent& extent : extents)
+      AddExtent(extent);
+    return;
+  }
+  MergeRanges(SortedRanges(extents));
+}
+
+template <typename Extents>
+void FlatExtentRanges::SubtractMany(const Extents& extents) {
+  if (static_cast<size_t>(extents.size()) < kMinBulkExtents) {
+    for (const Extent& extent : extents)
+      SubtractExtent(extent);
+    return;
+  }
+  SubtractSortedRanges(SortedRanges(extents));
+}
+
+void FlatExtentRanges::AddExtents(const vector<Extent>& extents) {
+  AddMany(extents);
+}
+
+void FlatExtentRanges::SubtractExtents(const vector<Extent>& extents) {
+  SubtractMany(extents);
+}
+
+void FlatExtentRanges::AddRepeatedExtents(
+    const ::google::protobuf::RepeatedPtrField<Extent>& exts) {
+  AddMany(exts);
+}
+
+void FlatExtentRanges::SubtractRepeatedExtents(
+    const ::google::protobuf::RepeatedPtrField<Extent>& exts) {
+  SubtractMany(exts);
+}
+
+void FlatExtentRanges::AddRanges(const FlatExtentRanges& ranges) {
+  MergeRanges(ranges.ranges_);
+}
+
+void FlatExtentRanges::SubtractRanges(const FlatExtentRanges& ranges) {
+  SubtractSortedRanges(ranges.ranges_);
+}
+
+bool FlatExtentRanges::OverlapsWithExtent(const Extent& extent) const {
+  if (extent.start_block() == kSparseHole)
+    return false;
+  // Like ExtentRanges, an empty extent overlaps the range containing its
+  // start block.
+  const uint64_t end =
+      extent.start_block() + std::max<uint64_t>(extent.num_blocks(), 1);
+  const size_t i = FirstEndingAfter(extent.start_block());
+  return i < ranges_.size() && ranges_[i].start < end;
+}
+
+bool FlatExtentRanges::ContainsBlock(uint64_t block) const {
+  const size_t i = FirstEndingAfter(block);
+  return i < ranges_.size() && ranges_[i].start <= block;
+}
+
+void FlatExtentRanges::Dump() const {
+  LOG(INFO) << "FlatExtentRanges Dump. blocks: " << blocks_;
+  for (const BlockRange& range : ranges_) {
+    LOG(INFO) << "{" << range.start << ", " << range.end - range.start << "}";
+  }
+}
+
+vector<Extent> FlatExtentRanges::GetExtents() const {
+  vector<Extent> extents;
+  extents.reserve(ranges_.size());
+  for (const BlockRange& range : ranges_)
+    extents.push_back(ExtentForRange(range.start, range.end - range.start));
+  return extents;
+}
+
+vector<Extent> FlatExtentRanges::GetExtentsForBlockCount(uint64_t count) const {
+  vector<Extent> out;
+  if (count == 0)
+    return out;
+  CHECK(count <= blocks_);
+  for (const BlockRange& range : ranges_) {
+    const uint64_t blocks = std::min(count, range.end - range.start);
+    out.push_back(ExtentForRange(range.start, blocks));
+    count -= blocks;
+    if (count == 0)
+      break;
+  }
+  return out;
+}
+
+vector<Extent> FlatExtentRanges::GetIntersectingExtents(
+    const Extent& extent) const {
+  vector<Extent> result;
+  if (extent.start_block() == kSparseHole)
+    return result;
+  const uint64_t start = extent.start_block();
+  const uint64_t end = start + extent.num_blocks();
+  for (size_t i = FirstEndingAfter(start);
+       i < ranges_.size() && ranges_[i].start < end;
+       i++) {
+    const uint64_t first_block = std::max(start, ranges_[i].start);
+    const uint64_t end_block = std::min(end, ranges_[i].end);
+    result.push_back(ExtentForRange(first_block, end_block - first_block));
+  }
+  return result;
+}
+
+vector<Extent> FilterExtentRanges(const vector<Extent>& extents,
+                                  const FlatExtentRanges& ranges) {
+  vector<Extent> result;
+  for (const Extent& extent : extents) {
+    if (extent.num_blocks() == 0)
+      continue;
+    if (extent.start_block() == kSparseHole) {
+      result.push_back(extent);
+      continue;
+    }
+    // Keep the parts of |extent| between the ranges overlapping it.
+    uint64_t start = extent.start_block();
+    const uint64_t end = start + extent.num_blocks();
+    for (size_t i = ranges.FirstEndingAfter(start);
+         i < ranges.ranges_.size() && ranges.ranges_[i].start < end;
+         i++) {
+      if (ranges.ranges_[i].start > start) {
+        result.push_back(
+            ExtentForRange(start, ranges.ranges_[i].start - start));
+      }
+      start = ranges.ranges_[i].end;
+    }
+    if (start < end)
+      result.push_back(ExtentForRange(start, end - start));
+  }
+  return result;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,121 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_FLAT_EXTENT_RANGES_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_FLAT_EXTENT_RANGES_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// A FlatExtentRanges is an ExtentRanges backed by a sorted vector of block
+// ranges instead of a std::set of Extents. Adding or subtracting a single
+// extent is a binary search and a move of the ranges after it, and adding or
+// subtracting many extents at once merges them in a single pass over the
+// ranges, in linear time. This suits sets that are mostly built and queried
+// in bulk, like the blocks of a whole partition.
+//
+// It has the same semantics as ExtentRanges, which the unittests check
+// against. The extents are returned by GetExtents() rather than exposed as an
+// ExtentSet.
+class FlatExtentRanges {
+ public:
+  FlatExtentRanges() = default;
+  // See ExtentRanges(bool).
+  explicit FlatExtentRanges(bool merge_touching_extents)
+      : merge_touching_extents_(merge_touching_extents) {}
+
+  void AddBlock(uint64_t block);
+  void SubtractBlock(uint64_t block);
+  void AddExtent(const Extent& extent);
+  void SubtractExtent(const Extent& extent);
+  void AddExtents(const std::vector<Extent>& extents);
+  void SubtractExtents(const std::vector<Extent>& extents);
+  void AddRepeatedExtents(
+      const ::google::protobuf::RepeatedPtrField<Extent>& exts);
+  void SubtractRepeatedExtents(
+      const ::google::protobuf::RepeatedPtrField<Extent>& exts);
+  void AddRanges(const FlatExtentRanges& ranges);
+  void SubtractRanges(const FlatExtentRanges& ranges);
+
+  // Returns true if the input extent overlaps with the current ranges.
+  bool OverlapsWithExtent(const Extent& extent) const;
+
+  // Returns whether the block |block| is in the ranges.
+  bool ContainsBlock(uint64_t block) const;
+
+  // Dumps contents to the log file. Useful for debugging.
+  void Dump() const;
+
+  uint64_t blocks() const { return blocks_; }
+  size_t num_extents() const { return ranges_.size(); }
+
+  // Returns the extents of the ranges, ordered by start block.
+  std::vector<Extent> GetExtents() const;
+
+  // See ExtentRanges::GetExtentsForBlockCount().
+  std::vector<Extent> GetExtentsForBlockCount(uint64_t count) const;
+
+  // See ExtentRanges::GetIntersectingExtents().
+  std::vector<Extent> GetIntersectingExtents(const Extent& extent) const;
+
+ private:
+  friend std::vector<Extent> FilterExtentRanges(
+      const std::vector<Extent>& extents, const FlatExtentRanges& ranges);
+
+  // The blocks [start, end).
+  struct BlockRange {
+    uint64_t start;
+    uint64_t end;
+  };
+
+  // Returns the ranges of |extents|, without the sparse holes and empty
+  // extents, sorted by start block.
+  template <typename Extents>
+  static std::vector<BlockRange> SortedRanges(const Extents& extents);
+
+  // Adds or subtracts |ranges|, sorted by start block, in a single pass.
+  void MergeRanges(const std::vector<BlockRange>& ranges);
+  void SubtractSortedRanges(const std::vector<BlockRange>& ranges);
+
+  template <typename Extents>
+  void AddMany(const Extents& extents);
+  template <typename Extents>
+  void SubtractMany(const Extents& extents);
+
+  // Returns the index of the first range ending after |block|.
+  size_t FirstEndingAfter(uint64_t block) const;
+
+  // Sorted by start block. Ranges never overlap, and only touch if
+  // |merge_touching_extents_| is false.
+  std::vector<BlockRange> ranges_;
+  uint64_t blocks_ = 0;
+  bool merge_touching_extents_ = true;
+};
+
+// See FilterExtentRanges(const std::vector<Extent>&, const ExtentRanges&).
+std::vector<Extent> FilterExtentRanges(const std::vector<Extent>& extents,
+                                       const FlatExtentRanges& ranges);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_FLAT_EXTENT_RANGES_H_
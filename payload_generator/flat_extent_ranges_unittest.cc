@@ -0,0 +1,148 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/flat_extent_ranges.h"
+
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/extent_utils.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+vector<Extent> ExtentSetToVector(const ExtentRanges& ranges) {
+  return {ranges.extent_set().begin(), ranges.extent_set().end()};
+}
+
+vector<Extent> RandomExtents(std::mt19937* gen, size_t count) {
+  std::uniform_int_distribution<uint64_t> start(0, 1000);
+  std::uniform_int_distribution<uint64_t> num_blocks(1, 20);
+  vector<Extent> extents;
+  for (size_t i = 0; i < count; i++)
+    extents.push_back(ExtentForRange(start(*gen), num_blocks(*gen)));
+  return extents;
+}
+
+void ExpectSameRanges(const ExtentRanges& expected,
+                      const FlatExtentRanges& ranges) {
+  ASSERT_EQ(expected.blocks(), ranges.blocks());
+  ASSERT_EQ(ExtentSetToVector(expected), ranges.GetExtents());
+}
+
+}  // namespace
+
+class FlatExtentRangesTest : public ::testing::TestWithParam<bool> {};
+
+TEST_P(FlatExtentRangesTest, MatchesExtentRangesTest) {
+  const bool merge_touching_extents = GetParam();
+  ExtentRanges expected(merge_touching_extents);
+  FlatExtentRanges ranges(merge_touching_extents);
+  std::mt19937 gen(12345);
+  for (size_t round = 0; round < 200; round++) {
+    // Both the one at a time and the bulk paths.
+    const size_t count = round % 2 ? 3 : 40;
+    const vector<Extent> extents = RandomExtents(&gen, count);
+    if (round % 3 == 2) {
+      expected.SubtractExtents(extents);
+      ranges.SubtractExtents(extents);
+    } else {
+      expected.AddExtents(extents);
+      ranges.AddExtents(extents);
+    }
+    ASSERT_NO_FATAL_FAILURE(ExpectSameRanges(expected, ranges));
+
+    for (const Extent& extent : RandomExtents(&gen, 10)) {
+      EXPECT_EQ(expected.ContainsBlock(extent.start_block()),
+                ranges.ContainsBlock(extent.start_block()));
+      EXPECT_EQ(expected.OverlapsWithExtent(extent),
+                ranges.OverlapsWithExtent(extent));
+      EXPECT_EQ(expected.GetIntersectingExtents(extent),
+                ranges.GetIntersectingExtents(extent));
+    }
+    const vector<Extent> filtered = RandomExtents(&gen, 10);
+    EXPECT_EQ(FilterExtentRanges(filtered, expected),
+              FilterExtentRanges(filtered, ranges));
+    EXPECT_EQ(expected.GetExtentsForBlockCount(expected.blocks() / 2),
+              ranges.GetExtentsForBlockCount(ranges.blocks() / 2));
+  }
+}
+
+TEST_P(FlatExtentRangesTest, AddAndSubtractRangesTest) {
+  const bool merge_touching_extents = GetParam();
+  std::mt19937 gen(54321);
+  for (size_t round = 0; round < 50; round++) {
+    const vector<Extent> a = RandomExtents(&gen, 30);
+    const vector<Extent> b = RandomExtents(&gen, 30);
+    ExtentRanges expected_a(merge_touching_extents);
+    ExtentRanges expected_b(merge_touching_extents);
+    FlatExtentRanges ranges_a(merge_touching_extents);
+    FlatExtentRanges ranges_b(merge_touching_extents);
+    expected_a.AddExtents(a);
+    expected_b.AddExtents(b);
+    ranges_a.AddExtents(a);
+    ranges_b.AddExtents(b);
+
+    ExtentRanges expected_union = expected_a;
+    FlatExtentRanges ranges_union = ranges_a;
+    expected_union.AddRanges(expected_b);
+    ranges_union.AddRanges(ranges_b);
+    ASSERT_NO_FATAL_FAILURE(ExpectSameRanges(expected_union, ranges_union));
+
+    expected_a.SubtractRanges(expected_b);
+    ranges_a.SubtractRanges(ranges_b);
+    ASSERT_NO_FATAL_FAILURE(ExpectSameRanges(expected_a, ranges_a));
+  }
+}
+
+TEST_P(FlatExtentRangesTest, SingleBlocksTest) {
+  FlatExtentRanges ranges(GetParam());
+  ranges.AddBlock(0);
+  ranges.AddBlock(2);
+  ranges.AddBlock(1);
+  EXPECT_EQ(3U, ranges.blocks());
+  EXPECT_EQ(GetParam() ? 1U : 3U, ranges.num_extents());
+  ranges.SubtractBlock(1);
+  EXPECT_EQ(2U, ranges.blocks());
+  EXPECT_EQ((vector<Extent>{ExtentForRange(0, 1), ExtentForRange(2, 1)}),
+            ranges.GetExtents());
+  EXPECT_TRUE(ranges.ContainsBlock(0));
+  EXPECT_FALSE(ranges.ContainsBlock(1));
+}
+
+TEST_P(FlatExtentRangesTest, SparseHolesAreIgnoredTest) {
+  FlatExtentRanges ranges(GetParam());
+  ranges.AddExtent(ExtentForRange(kSparseHole, 10));
+  ranges.AddExtent(ExtentForRange(5, 0));
+  EXPECT_EQ(0U, ranges.blocks());
+  EXPECT_EQ(0U, ranges.num_extents());
+  const vector<Extent> hole = {ExtentForRange(kSparseHole, 10)};
+  EXPECT_EQ(hole, FilterExtentRanges(hole, ranges));
+}
+
+INSTANTIATE_TEST_CASE_P(MergeTouchingExtents,
+                        FlatExtentRangesTest,
+                        ::testing::Bool());
+
+}  // namespace chromeos_update_engine
@@ -21,7 +21,11 @@
 
 #include <algorithm>
 #include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
 
 #include <base/format_macros.h>
 #include <base/strings/string_util.h>
@@ -30,9 +34,13 @@
 #include <base/threading/simple_thread.h>
 #include <brillo/secure_blob.h>
 
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/generation_profiler.h"
+#include "update_engine/payload_generator/task_pool.h"
 
+using std::string;
 using std::vector;
 
 namespace chromeos_update_engine {
@@ -40,24 +48,82 @@ namespace chromeos_update_engine {
 namespace {
 
 const size_t kDefaultFullChunkSize = 1024 * 1024;  // 1 MiB
+// The file the chunks are profiled under.
+const char kChunksProfileName[] = "<full-chunks>";
+
+// Stores the blobs of the chunks of a partition in the order of the chunks, so
+// that they are contiguous and in the order of their operations in the blob
+// file whatever the order the chunks complete in, and PayloadFile doesn't
+// need to reorder them. The blobs of the chunks stored out of order are held
+// until the previous chunks are, which the pool running the chunks in order
+// bounds to about one blob per thread.
+class OrderedBlobStore {
+ public:
+  explicit OrderedBlobStore(BlobFileWriter* blob_file)
+      : blob_file_(blob_file) {}
+
+  // Stores |blob|, hashed in |aop|, as the blob of |aop|, the operation of the
+  // chunk |index|, after those of the previous chunks. A failed chunk stores
+  // no blob, with a null |aop|.
+  bool StoreBlob(size_t index, AnnotatedOperation* aop, brillo::Blob blob) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.emplace(index, std::make_pair(aop, std::move(blob)));
+    while (!pending_.empty() && pending_.begin()->first == next_index_) {
+      auto [next_aop, next_blob] = std::move(pending_.begin()->second);
+      pending_.erase(pending_.begin());
+      next_index_++;
+      if (!next_aop)
+        continue;
+      if (next_blob.empty()) {
+        next_aop->op.clear_data_offset();
+        next_aop->op.clear_data_length();
+        continue;
+      }
+      off_t data_offset = blob_file_->StoreBlob(next_blob);
+      if (data_offset == -1) {
+        failed_ = true;
+        continue;
+      }
+      next_aop->op.set_data_offset(data_offset);
+      next_aop->op.set_data_length(next_blob.size());
+    }
+    return !failed_;
+  }
+
+ private:
+  BlobFileWriter* blob_file_;
+
+  std::mutex mutex_;
+  // The chunks completed after a chunk before them, by index.
+  std::map<size_t, std::pair<AnnotatedOperation*, brillo::Blob>> pending_;
+  size_t next_index_{0};
+  bool failed_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(OrderedBlobStore);
+};
 
 // This class encapsulates a full update chunk processing thread work. The
 // processor reads a chunk of data from the input file descriptor and compresses
 // it. The processor will destroy itself when the work is done.
 class ChunkProcessor : public base::DelegateSimpleThread::Delegate {
  public:
-  // Read a chunk of |size| bytes from |fd| starting at offset |offset|.
-  ChunkProcessor(const PayloadVersion& version,
+  // Read a chunk of |size| bytes from |fd| starting at offset |offset|, the
+  // chunk |index| of the partition |new_part|.
+  ChunkProcessor(const PartitionConfig& new_part,
+                 const PayloadGenerationConfig& config,
                  int fd,
+                 size_t index,
                  off_t offset,
                  size_t size,
-                 BlobFileWriter* blob_file,
+                 OrderedBlobStore* blob_store,
                  AnnotatedOperation* aop)
-      : version_(version),
+      : new_part_(new_part),
+        config_(config),
         fd_(fd),
+        index_(index),
         offset_(offset),
         size_(size),
-        blob_file_(blob_file),
+        blob_store_(blob_store),
         aop_(aop) {}
   // We use a default move constructor since all the data members are POD types.
   ChunkProcessor(ChunkProcessor&&) = default;
@@ -67,33 +133,47 @@ class ChunkProcessor : public base::DelegateSimpleThread::Delegate {
   // Run() handles the read from |fd| in a thread-safe way, and stores the
   // new operation to generate the region starting at |offset| of size |size|
   // in the output operation |aop|. The associated blob data is stored in
-  // |blob_fd| and |blob_file_size| is updated.
+  // |blob_store|.
   void Run() override;
 
  private:
-  bool ProcessChunk();
+  // Sets the type of |aop_| and its blob in |op_blob|, which is hashed.
+  bool ProcessChunk(brillo::Blob* op_blob);
 
   // Work parameters.
-  const PayloadVersion& version_;
+  const PartitionConfig& new_part_;
+  const PayloadGenerationConfig& config_;
   int fd_;
+  size_t index_;
   off_t offset_;
   size_t size_;
-  BlobFileWriter* blob_file_;
+  OrderedBlobStore* blob_store_;
   AnnotatedOperation* aop_;
 
   DISALLOW_COPY_AND_ASSIGN(ChunkProcessor);
 };
 
 void ChunkProcessor::Run() {
-  if (!ProcessChunk()) {
+  GenerationProfiler::ScopedFile profile(
+      new_part_.name, kChunksProfileName, size_ / kBlockSize);
+  brillo::Blob op_blob;
+  if (!ProcessChunk(&op_blob)) {
     LOG(ERROR) << "Error processing region at " << offset_ << " of size "
                << size_;
+    // Let the next chunks store their blobs, the operation without a type
+    // fails the generation.
+    aop_->op.clear_type();
+    blob_store_->StoreBlob(index_, nullptr, {});
+    return;
+  }
+  if (!blob_store_->StoreBlob(index_, aop_, std::move(op_blob))) {
+    LOG(ERROR) << "Error storing the blob of the region at " << offset_;
+    aop_->op.clear_type();
   }
 }
 
-bool ChunkProcessor::ProcessChunk() {
+bool ChunkProcessor::ProcessChunk(brillo::Blob* op_blob) {
   brillo::Blob buffer_in_(size_);
-  brillo::Blob op_blob;
   ssize_t bytes_read = -1;
   TEST_AND_RETURN_FALSE(utils::PReadAll(
       fd_, buffer_in_.data(), buffer_in_.size(), offset_, &bytes_read));
@@ -101,10 +181,15 @@ bool ChunkProcessor::ProcessChunk() {
 
   InstallOperation::Type op_type;
   TEST_AND_RETURN_FALSE(diff_utils::GenerateBestFullOperation(
-      buffer_in_, version_, &op_blob, &op_type));
+      buffer_in_, new_part_.path, config_, op_blob, &op_type));
 
+  // The blob is hashed in this thread, only storing it is serialized.
+  if (!op_blob->empty()) {
+    brillo::Blob hash;
+    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(*op_blob, &hash));
+    aop_->op.set_data_sha256_hash(hash.data(), hash.size());
+  }
   aop_->op.set_type(op_type);
-  TEST_AND_RETURN_FALSE(aop_->SetOperationBlob(op_blob, blob_file_));
   return true;
 }
 
@@ -136,7 +221,11 @@ bool FullUpdateGenerator::GenerateOperations(
   TEST_AND_RETURN_FALSE(full_chunk_size % config.block_size == 0);
 
   size_t chunk_blocks = full_chunk_size / config.block_size;
-  size_t max_threads = diff_utils::GetMaxThreads();
+  size_t max_threads = config.max_threads > 0 ? config.max_threads
+                                              : diff_utils::GetMaxThreads();
+  if (TaskPool* pool = TaskPool::Get()) {
+    max_threads = pool->num_threads();
+  }
   LOG(INFO) << "Compressing partition " << new_part.name << " from "
             << new_part.path << " splitting in chunks of " << chunk_blocks
             << " blocks (" << config.block_size << " bytes each) using "
@@ -154,6 +243,7 @@ bool FullUpdateGenerator::GenerateOperations(
   vector<ChunkProcessor> chunk_processors;
   chunk_processors.reserve(num_chunks);
   blob_file->IncTotalBlobs(num_chunks);
+  OrderedBlobStore blob_store(blob_file);
 
   for (size_t i = 0; i < num_chunks; ++i) {
     size_t start_block = i * chunk_blocks;
@@ -171,21 +261,26 @@ bool FullUpdateGenerator::GenerateOperations(
     dst_extent->set_num_blocks(num_blocks);
 
     chunk_processors.emplace_back(
-        config.version,
+        new_part,
+        config,
         in_fd,
+        i,
         static_cast<off_t>(start_block) * config.block_size,
         num_blocks * config.block_size,
-        blob_file,
+        &blob_store,
         aop);
   }
 
-  // Thread pool used for worker threads.
-  base::DelegateSimpleThreadPool thread_pool("full-update-generator",
-                                             max_threads);
-  thread_pool.Start();
+  vector<TaskPool::Task> tasks;
+  tasks.reserve(chunk_processors.size());
   for (ChunkProcessor& processor : chunk_processors)
-    thread_pool.AddWork(&processor);
-  thread_pool.JoinAll();
+    tasks.push_back([&processor] { processor.Run(); });
+  const base::TimeTicks pool_start = base::TimeTicks::Now();
+  max_threads = TaskPool::RunTasks(std::move(tasks), max_threads);
+  if (GenerationProfiler* profiler = GenerationProfiler::Get()) {
+    profiler->RecordThreadPool(
+        new_part.name, max_threads, base::TimeTicks::Now() - pool_start);
+  }
 
   // All the operations must have a type set at this point. Otherwise, a
   // ChunkProcessor failed to complete.
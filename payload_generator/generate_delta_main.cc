@@ -14,8 +14,11 @@
 // limitations under the License.
 //
 
+#include <sys/resource.h>
+
 #include <cstring>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -23,10 +26,12 @@
 #include <base/bind.h>
 #include <base/files/file_path.h>
 #include <base/files/file_util.h>
+#include <base/json/json_writer.h>
 #include <base/logging.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_split.h>
 #include <base/strings/string_util.h>
+#include <base/values.h>
 #include <brillo/key_value_store.h>
 #include <brillo/message_loops/base_message_loop.h>
 #include <unistd.h>
@@ -40,13 +45,22 @@
 #include "update_engine/common/prefs.h"
 #include "update_engine/common/terminator.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/apply_trace.h"
+#include "update_engine/payload_consumer/delta_performer.h"
 #include "update_engine/payload_consumer/filesystem_verifier_action.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/generation_profiler.h"
+#include "update_engine/payload_generator/huge_pages.h"
+#include "update_engine/payload_generator/payload_checker.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
 #include "update_engine/payload_generator/payload_properties.h"
 #include "update_engine/payload_generator/payload_signer.h"
+#include "update_engine/payload_generator/raw_filesystem.h"
+#include "update_engine/payload_generator/task_pool.h"
 #include "update_engine/payload_generator/xz.h"
+#include "update_engine/payload_generator/zstd.h"
 #include "update_engine/update_metadata.pb.h"
 
 // This file contains a simple program that takes an old path, a new path,
@@ -168,7 +182,46 @@ class ApplyPayloadProcessorDelegate : public ActionProcessorDelegate {
   void ProcessingStopped(const ActionProcessor* processor) override {
     brillo::MessageLoop::current()->BreakLoop();
   }
+  // Records the time of each action, they run one after the other.
+  void ActionCompleted(ActionProcessor* processor,
+                       AbstractAction* action,
+                       ErrorCode code) override {
+    const base::TimeTicks now = base::TimeTicks::Now();
+    phase_times_[action->Type()] += now - phase_start_;
+    phase_start_ = now;
+  }
+
+  // Writes the time of every action, the total one and the memory
+  // high-water mark of the process as JSON to |path|.
+  bool WriteProfile(const string& path) const {
+    base::DictionaryValue profile;
+    profile.SetDouble("wall_time_ms",
+                      (base::TimeTicks::Now() - start_).InMillisecondsF());
+    struct rusage usage {};
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+      // ru_maxrss is in KiB on Linux.
+      profile.SetDouble("peak_rss_bytes", usage.ru_maxrss * 1024.0);
+    }
+    auto phases = std::make_unique<base::DictionaryValue>();
+    for (const auto& [phase, time] : phase_times_) {
+      phases->SetDouble(phase, time.InMillisecondsF());
+    }
+    profile.Set("phase_time_ms", std::move(phases));
+    string json;
+    TEST_AND_RETURN_FALSE(base::JSONWriter::WriteWithOptions(
+        profile, base::JSONWriter::OPTIONS_PRETTY_PRINT, &json));
+    TEST_AND_RETURN_FALSE(
+        utils::WriteFile(path.c_str(), json.data(), json.size()));
+    LOG(INFO) << "Wrote the apply profile to " << path;
+    return true;
+  }
+
   ErrorCode code_{};
+
+ private:
+  const base::TimeTicks start_{base::TimeTicks::Now()};
+  base::TimeTicks phase_start_{start_};
+  std::map<string, base::TimeDelta> phase_times_;
 };
 
 // TODO(deymo): Move this function to a new file and make the delta_performer
@@ -176,7 +229,10 @@ class ApplyPayloadProcessorDelegate : public ActionProcessorDelegate {
 bool ApplyPayload(const string& payload_file,
                   // Simply reuses the payload config used for payload
                   // generation.
-                  const PayloadGenerationConfig& config) {
+                  const PayloadGenerationConfig& config,
+                  const string& profile_output,
+                  const string& replay_trace,
+                  double replay_time_scale) {
   LOG(INFO) << "Applying delta.";
   FakeBootControl fake_boot_control;
   FakeHardware fake_hardware;
@@ -222,6 +278,24 @@ bool ApplyPayload(const string& payload_file,
   xz_crc32_init();
   brillo::BaseMessageLoop loop;
   loop.SetAsCurrent();
+  if (!replay_trace.empty()) {
+    // The payload goes straight to the DeltaPerformer, as it arrived on the
+    // device where the trace was recorded.
+    ApplyTrace trace;
+    TEST_AND_RETURN_FALSE(trace.Load(replay_trace));
+    ApplyTrace::Set(&trace);
+    DeltaPerformer performer(&prefs,
+                             &fake_boot_control,
+                             &fake_hardware,
+                             nullptr,
+                             &install_plan,
+                             &install_plan.payloads[0],
+                             true /* interactive */);
+    const bool success =
+        trace.Replay(payload_file, replay_time_scale, &performer);
+    ApplyTrace::Set(nullptr);
+    return success;
+  }
   auto install_plan_action = std::make_unique<InstallPlanAction>(install_plan);
   auto download_action =
       std::make_unique<DownloadAction>(&prefs,
@@ -245,16 +319,20 @@ bool ApplyPayload(const string& payload_file,
                            base::Unretained(&processor)));
   loop.Run();
   CHECK_EQ(delegate.code_, ErrorCode::kSuccess);
+  if (!profile_output.empty()) {
+    TEST_AND_RETURN_FALSE(delegate.WriteProfile(profile_output));
+  }
   LOG(INFO) << "Completed applying " << (config.is_delta ? "delta" : "full")
             << " payload.";
   return true;
 }
 
 bool ExtractProperties(const string& payload_path,
+                       const string& hashes_file,
                        const string& props_file,
                        const string& props_format) {
   string properties;
-  PayloadProperties payload_props(payload_path);
+  PayloadProperties payload_props(payload_path, hashes_file);
   if (props_format == kPayloadPropertiesFormatKeyValue) {
     TEST_AND_RETURN_FALSE(payload_props.GetPropertiesAsKeyValue(&properties));
   } else if (props_format == kPayloadPropertiesFormatJson) {
@@ -273,6 +351,19 @@ bool ExtractProperties(const string& payload_path,
   return true;
 }
 
+bool CheckPayload(const string& payload_path,
+                  const PayloadChecker::Options& options) {
+  LOG_IF(FATAL, payload_path.empty())
+      << "Must pass --in_file to check the payload.";
+  vector<string> errors;
+  if (!PayloadChecker(options).Check(payload_path, &errors)) {
+    LOG(ERROR) << "Found " << errors.size() << " errors in " << payload_path;
+    return false;
+  }
+  LOG(INFO) << payload_path << " is valid.";
+  return true;
+}
+
 template <typename Key, typename Val>
 string ToString(const map<Key, Val>& map) {
   vector<string> result;
@@ -344,9 +435,17 @@ DEFINE_string(in_file,
               "Path to input delta payload file used to hash/sign payloads "
               "and apply delta over old_image (for debugging)");
 DEFINE_string(out_file, "", "Path to output delta payload file");
-DEFINE_string(out_hash_file, "", "Path to output hash file");
+DEFINE_string(out_hash_file,
+              "",
+              "Path to output hash file. Without --in_file, the hash of the "
+              "payload generated, computed while writing it, which is the "
+              "hash for signing if --signature_size is passed too.");
 DEFINE_string(out_metadata_hash_file, "", "Path to output metadata hash file");
 DEFINE_string(out_metadata_size_file, "", "Path to output metadata size file");
+DEFINE_string(out_payload_hashes_file,
+              "",
+              "Path to output the hashes of the payload generated, computed "
+              "while writing it, for use with --payload_hashes_file.");
 DEFINE_string(private_key, "", "Path to private key in .pem format");
 DEFINE_string(public_key, "", "Path to public key in .pem format");
 DEFINE_int32(public_key_version,
@@ -388,6 +487,25 @@ DEFINE_string(properties_file,
               "",
               "If passed, dumps the payload properties of the payload passed "
               "in --in_file and exits. Look at --properties_format.");
+DEFINE_bool(check_payload,
+            false,
+            "If passed, checks the payload passed in --in_file like "
+            "scripts/paycheck.py, on --max_threads threads, and exits. The "
+            "signatures must verify with --public_key if passed.");
+DEFINE_bool(check_apply,
+            false,
+            "With --check_payload, also applies the payload and checks the "
+            "partitions written. The source images of delta payloads are "
+            "passed in --old_partitions, in the order of --partition_names.");
+DEFINE_bool(allow_unhashed,
+            false,
+            "With --check_payload, allows the data of the operations to come "
+            "without a hash.");
+DEFINE_string(payload_hashes_file,
+              "",
+              "The file from --out_payload_hashes_file for the payload in "
+              "--in_file, used with --properties_file to skip hashing the "
+              "payload. Ignored if the payload changed since.");
 DEFINE_string(properties_format,
               kPayloadPropertiesFormatKeyValue,
               "Defines the format of the --properties_file. The acceptable "
@@ -450,6 +568,50 @@ DEFINE_bool(enable_puffdiff,
             "Whether to enable puffdiff feature. Enabling puffdiff will take "
             "longer but generated OTA will be smaller.");
 
+DEFINE_bool(add_dst_hashes,
+            false,
+            "Whether to record the SHA 256 hash of the data written by each "
+            "operation, letting clients skip the operations already applied.");
+
+DEFINE_int64(max_shared_blobs_mb,
+             0,
+             "The REPLACE operations with the same data as an earlier one, "
+             "e.g. in another partition, share its blob as long as the blobs "
+             "shared total at most this many MiB, up to 64. Clients without "
+             "support for it can't apply the payload. 0 doesn't share blobs.");
+
+DEFINE_bool(operations_segments,
+            false,
+            "Whether to store the operations of each partition right before "
+            "their data instead of in the manifest, so that clients start "
+            "applying the payload sooner. Clients without support for it "
+            "can't apply the payload.");
+
+DEFINE_bool(enable_zstd,
+            false,
+            "Whether to compress the full operations with zstd, which is much "
+            "faster to decompress than xz, preferring it to xz and bzip2 "
+            "unless --apply_cost_profile is given. Clients without support "
+            "for it can't apply the payload.");
+DEFINE_int64(zstd_dictionary_kb,
+             0,
+             "With --enable_zstd, the maximum size in KiB of the zstd "
+             "dictionary trained on each partition, which is shipped with it "
+             "and improves the compression of the small operations. 0 "
+             "doesn't train dictionaries.");
+DEFINE_bool(enable_target_copy,
+            false,
+            "Whether to copy the blocks repeated within a new partition from "
+            "their first copy in the target with TARGET_COPY operations. Not "
+            "supported with Virtual A/B compression. Clients without support "
+            "for it can't apply the payload.");
+
+DEFINE_bool(add_apply_hints,
+            false,
+            "Whether to record the estimated CPU cost and memory needed to "
+            "apply each operation, used by clients for the progress. The CPU "
+            "costs are based on --apply_cost_profile if given.");
+
 DEFINE_bool(
     enable_zucchini,
     true,
@@ -465,6 +627,129 @@ DEFINE_int64(max_threads,
              "The maximum number of threads allowed for generating "
              "ota.");
 
+DEFINE_int64(max_memory_mb,
+             0,
+             "The memory in MiB the files diffed at once may be estimated to "
+             "use. The files which don't fit are delayed until enough "
+             "memory is released, the ones larger than this run alone. The "
+             "caches are not counted. 0 doesn't limit it.");
+
+DEFINE_int64(xz_block_size,
+             0,
+             "Split the data of REPLACE_XZ operations into independent xz "
+             "blocks of this many uncompressed bytes, which are compressed and "
+             "can be decoded in parallel. 0 uses a single block.");
+
+DEFINE_int64(zstd_frame_size,
+             0,
+             "Split the data of REPLACE_ZSTD operations into independent zstd "
+             "frames of this many uncompressed bytes, which can be decoded in "
+             "parallel. 0 uses a single frame.");
+
+DEFINE_string(diff_cache_dir,
+              "",
+              "Directory where the diff operations are cached, to be reused "
+              "when generating another payload with the same source and "
+              "target files. Clear it when updating delta_generator.");
+DEFINE_int32(diff_cache_shards,
+             1,
+             "Split the diffs of --diff_cache_dir in this many shards, to "
+             "generate a payload on several hosts: one generator per shard "
+             "fills the shared cache with the diffs of --diff_cache_shard "
+             "only, writing a payload which isn't meant to be used, then a "
+             "generator without shards writes the payload from the cache.");
+DEFINE_int32(diff_cache_shard,
+             0,
+             "The shard of --diff_cache_shards whose diffs are computed.");
+
+DEFINE_int64(suffix_array_cache_mb,
+             0,
+             "Memory in MiB used to cache the suffix arrays of the bsdiff "
+             "sources, so that the source data diffed by several operations "
+             "is sorted once. 0 disables the cache.");
+DEFINE_int64(lz4diff_source_cache_mb,
+             256,
+             "Memory in MiB used to cache the decompressed sources of the "
+             "lz4diff operations, so that an EROFS file diffed by several "
+             "operations is decompressed once. 0 disables the cache.");
+DEFINE_bool(diff_chunks_against_whole_file,
+            false,
+            "Diff each chunk of the files split in several operations against "
+            "the whole old file rather than the old chunk at the same offset. "
+            "Smaller patches, but each operation reads the whole old file on "
+            "the device. Best used with --suffix_array_cache_mb.");
+DEFINE_bool(find_shifted_chunks,
+            false,
+            "Diff each chunk of the files split in several operations against "
+            "the old chunk its data moved from when it moved by a few bytes, "
+            "found with a rolling hash of the nearby old chunks.");
+DEFINE_int64(adaptive_chunk_apply_mb,
+             0,
+             "Size the chunks the files are split in for each file, from "
+             "--chunk_size up to the size whose operations need this many MiB "
+             "to apply on the device, using larger chunks for compressible "
+             "data. 0 uses --chunk_size for every file.");
+
+DEFINE_bool(fast_algorithm_selection,
+            false,
+            "Skip the compressors and diff algorithms unlikely to produce a "
+            "smaller operation, instead of trying all of them. Trades a "
+            "slightly larger payload for a faster generation.");
+
+DEFINE_string(apply_cost_profile,
+              "",
+              "Path to a key-value file with the download throughput of the "
+              "target devices and the time they take to apply each operation "
+              "type, to choose the operations that are the fastest to "
+              "download and apply rather than the smallest. See "
+              "ApplyCostModel::Load for the format.");
+
+DEFINE_bool(choose_verity_computation,
+            false,
+            "Whether to ship the verity hash tree and FEC data of each "
+            "partition in the payload when the devices would take longer to "
+            "compute them than to download them, according to "
+            "--apply_cost_profile. Only used for delta payloads.");
+
+DEFINE_string(previous_payload,
+              "",
+              "Path to a payload previously generated from the same source "
+              "partitions to the --previous_new_partitions, whose operations "
+              "writing unchanged blocks are reused instead of diffing them "
+              "again. Only used for delta payloads.");
+DEFINE_string(previous_new_partitions,
+              "",
+              "Colon-separated list of the target partitions of "
+              "--previous_payload, in the order of --partition_names. Empty "
+              "entries reuse nothing from the previous payload.");
+
+DEFINE_string(profile_output,
+              "",
+              "Path to write a JSON profile of the generation to: the time "
+              "of each diff and compression algorithm per partition and "
+              "file, the memory high-water mark and the thread utilization. "
+              "With --in_file, the time of each phase of the apply and its "
+              "memory high-water mark.");
+
+DEFINE_string(replay_apply_trace,
+              "",
+              "With --in_file, path to a trace recorded on a device with the "
+              "RECORD_APPLY_TRACE header. The payload is applied in the "
+              "chunks and at the times recorded, and the writes to the "
+              "target partitions are delayed up to their recorded latency.");
+DEFINE_double(replay_time_scale,
+              1.0,
+              "With --replay_apply_trace, the factor applied to the times "
+              "the payload chunks were received, 0 to apply them as fast as "
+              "possible.");
+
+DEFINE_bool(use_hugepages,
+            false,
+            "Back the large working sets of the generation, like the block "
+            "hash tables, the data diffed and the cached suffix array "
+            "sources, with transparent huge pages. --profile_output records "
+            "the page faults and the bytes advised to compare the runs.");
+
 void RoundDownPartitions(const ImageConfig& config) {
   for (const auto& part : config.partitions) {
     if (part.path.empty()) {
@@ -522,6 +807,10 @@ int Main(int argc, char** argv) {
 
   // Initialize the Xz compressor.
   XzCompressInit();
+  LOG_IF(FATAL, FLAGS_xz_block_size < 0) << "Invalid --xz_block_size.";
+  XzCompressSetBlockSize(FLAGS_xz_block_size);
+  LOG_IF(FATAL, FLAGS_zstd_frame_size < 0) << "Invalid --zstd_frame_size.";
+  ZstdCompressSetFrameSize(FLAGS_zstd_frame_size);
 
   if (!FLAGS_out_maximum_signature_size_file.empty()) {
     LOG_IF(FATAL, FLAGS_private_key.empty())
@@ -552,7 +841,9 @@ int Main(int argc, char** argv) {
     ParseSignatureSizes(FLAGS_signature_size, &signature_sizes);
   }
 
-  if (!FLAGS_out_hash_file.empty() || !FLAGS_out_metadata_hash_file.empty()) {
+  // Without --in_file, the hashes are those of the payload generated.
+  if ((!FLAGS_out_hash_file.empty() || !FLAGS_out_metadata_hash_file.empty()) &&
+      !FLAGS_in_file.empty()) {
     CHECK(FLAGS_out_metadata_size_file.empty());
     CalculateHashForSigning(signature_sizes,
                             FLAGS_out_hash_file,
@@ -569,14 +860,38 @@ int Main(int argc, char** argv) {
                 FLAGS_out_metadata_size_file);
     return 0;
   }
+  if (FLAGS_check_payload) {
+    PayloadChecker::Options options;
+    options.public_key_path = FLAGS_public_key;
+    options.allow_unhashed = FLAGS_allow_unhashed;
+    options.apply = FLAGS_check_apply;
+    options.num_threads = std::max<int64_t>(FLAGS_max_threads, 0);
+    if (!FLAGS_old_partitions.empty()) {
+      const vector<string> names = base::SplitString(FLAGS_partition_names,
+                                                     ":",
+                                                     base::TRIM_WHITESPACE,
+                                                     base::SPLIT_WANT_ALL);
+      const vector<string> paths = base::SplitString(FLAGS_old_partitions,
+                                                     ":",
+                                                     base::TRIM_WHITESPACE,
+                                                     base::SPLIT_WANT_ALL);
+      CHECK_EQ(names.size(), paths.size());
+      for (size_t i = 0; i < names.size(); i++) {
+        options.source_paths[names[i]] = paths[i];
+      }
+    }
+    return CheckPayload(FLAGS_in_file, options) ? 0 : 1;
+  }
   if (!FLAGS_public_key.empty()) {
     LOG_IF(WARNING, FLAGS_public_key_version != -1)
         << "--public_key_version is deprecated and ignored.";
     return VerifySignedPayload(FLAGS_in_file, FLAGS_public_key);
   }
   if (!FLAGS_properties_file.empty()) {
-    return ExtractProperties(
-               FLAGS_in_file, FLAGS_properties_file, FLAGS_properties_format)
+    return ExtractProperties(FLAGS_in_file,
+                             FLAGS_payload_hashes_file,
+                             FLAGS_properties_file,
+                             FLAGS_properties_format)
                ? 0
                : 1;
   }
@@ -618,6 +933,15 @@ int Main(int argc, char** argv) {
   payload_config.enable_lz4diff = FLAGS_enable_lz4diff;
   payload_config.enable_zucchini = FLAGS_enable_zucchini;
   payload_config.enable_puffdiff = FLAGS_enable_puffdiff;
+  payload_config.add_dst_hashes = FLAGS_add_dst_hashes;
+  payload_config.add_apply_hints = FLAGS_add_apply_hints;
+  payload_config.max_shared_blobs_size = FLAGS_max_shared_blobs_mb << 20;
+  payload_config.operations_segments = FLAGS_operations_segments;
+  payload_config.enable_zstd = FLAGS_enable_zstd;
+  LOG_IF(FATAL, FLAGS_zstd_dictionary_kb < 0)
+      << "Invalid --zstd_dictionary_kb.";
+  payload_config.zstd_dictionary_size = FLAGS_zstd_dictionary_kb << 10;
+  payload_config.enable_target_copy = FLAGS_enable_target_copy;
 
   payload_config.ParseCompressorTypes(FLAGS_compressor_types);
 
@@ -658,6 +982,21 @@ int Main(int argc, char** argv) {
       payload_config.target.partitions.back().mapfile_path = new_mapfiles[i];
   }
 
+  if (!FLAGS_previous_payload.empty()) {
+    const vector<string> previous_partitions =
+        base::SplitString(FLAGS_previous_new_partitions,
+                          ":",
+                          base::TRIM_WHITESPACE,
+                          base::SPLIT_WANT_ALL);
+    CHECK_EQ(partition_names.size(), previous_partitions.size())
+        << "--previous_payload requires --previous_new_partitions.";
+    payload_config.previous_payload = FLAGS_previous_payload;
+    for (size_t i = 0; i < partition_names.size(); i++) {
+      payload_config.target.partitions[i].previous_path =
+          previous_partitions[i];
+    }
+  }
+
   if (payload_config.is_delta) {
     if (!FLAGS_old_partitions.empty()) {
       old_partitions = base::SplitString(FLAGS_old_partitions,
@@ -683,7 +1022,13 @@ int Main(int argc, char** argv) {
   }
 
   if (!FLAGS_in_file.empty()) {
-    return ApplyPayload(FLAGS_in_file, payload_config) ? 0 : 1;
+    return ApplyPayload(FLAGS_in_file,
+                        payload_config,
+                        FLAGS_profile_output,
+                        FLAGS_replay_apply_trace,
+                        FLAGS_replay_time_scale)
+               ? 0
+               : 1;
   }
 
   if (!FLAGS_new_postinstall_config_file.empty()) {
@@ -722,12 +1067,46 @@ int Main(int argc, char** argv) {
 
   payload_config.rootfs_partition_size = FLAGS_rootfs_partition_size;
 
+  // Parsing the filesystems and generating the payload share a single pool.
+  TaskPool task_pool(FLAGS_max_threads > 0 ? FLAGS_max_threads
+                                           : diff_utils::GetMaxThreads());
+  TaskPool::Set(&task_pool);
+  DEFER {
+    TaskPool::Set(nullptr);
+  };
+
   if (payload_config.is_delta) {
-    // Avoid opening the filesystem interface for full payloads.
-    for (PartitionConfig& part : payload_config.target.partitions)
-      CHECK(part.OpenFilesystem());
-    for (PartitionConfig& part : payload_config.source.partitions)
-      CHECK(part.OpenFilesystem());
+    // Avoid opening the filesystem interface for full payloads. The
+    // filesystems are parsed concurrently, each of them on its own files.
+    // The unchanged partitions are copied in place without looking at their
+    // files, so they aren't parsed.
+    std::vector<PartitionConfig*> parts;
+    for (size_t i = 0; i < payload_config.target.partitions.size(); i++) {
+      PartitionConfig& source = payload_config.source.partitions[i];
+      PartitionConfig& target = payload_config.target.partitions[i];
+      if (diff_utils::PartitionsIdentical(source.path, target.path)) {
+        LOG(INFO) << "Partition " << target.name
+                  << " is unchanged, not parsing its filesystem";
+        for (PartitionConfig* part : {&source, &target}) {
+          part->fs_interface =
+              RawFilesystem::Create("<" + part->name + "-partition>",
+                                    kBlockSize,
+                                    part->size / kBlockSize);
+        }
+        continue;
+      }
+      parts.push_back(&target);
+      parts.push_back(&source);
+    }
+    std::vector<char> opened(parts.size(), false);
+    std::vector<TaskPool::Task> tasks;
+    for (size_t i = 0; i < parts.size(); i++) {
+      tasks.push_back([&, i] { opened[i] = parts[i]->OpenFilesystem(); });
+    }
+    task_pool.Run(std::move(tasks));
+    for (size_t i = 0; i < parts.size(); i++)
+      CHECK(opened[i]) << "Failed to open the filesystem of "
+                       << parts[i]->path;
   }
 
   payload_config.version.major = FLAGS_major_version;
@@ -765,6 +1144,34 @@ int Main(int argc, char** argv) {
   payload_config.security_patch_level = FLAGS_security_patch_level;
 
   payload_config.max_threads = FLAGS_max_threads;
+  payload_config.max_memory_bytes = FLAGS_max_memory_mb << 20;
+  payload_config.signature_sizes = signature_sizes;
+
+  if (!FLAGS_diff_cache_dir.empty()) {
+    CHECK(base::CreateDirectory(base::FilePath(FLAGS_diff_cache_dir)))
+        << "Failed to create " << FLAGS_diff_cache_dir;
+    payload_config.diff_cache_dir = FLAGS_diff_cache_dir;
+    CHECK(FLAGS_diff_cache_shard >= 0 &&
+          FLAGS_diff_cache_shard < FLAGS_diff_cache_shards)
+        << "Invalid --diff_cache_shard " << FLAGS_diff_cache_shard;
+    payload_config.diff_cache_shard = FLAGS_diff_cache_shard;
+    payload_config.diff_cache_shards = FLAGS_diff_cache_shards;
+  }
+  payload_config.suffix_array_cache_bytes = FLAGS_suffix_array_cache_mb << 20;
+  payload_config.lz4diff_source_cache_bytes = FLAGS_lz4diff_source_cache_mb
+                                              << 20;
+  payload_config.diff_chunks_against_whole_file =
+      FLAGS_diff_chunks_against_whole_file;
+  payload_config.find_shifted_chunks = FLAGS_find_shifted_chunks;
+  payload_config.adaptive_chunk_apply_memory_bytes =
+      FLAGS_adaptive_chunk_apply_mb << 20;
+  payload_config.fast_algorithm_selection = FLAGS_fast_algorithm_selection;
+
+  if (!FLAGS_apply_cost_profile.empty()) {
+    brillo::KeyValueStore store;
+    CHECK(store.Load(base::FilePath(FLAGS_apply_cost_profile)));
+    CHECK(payload_config.apply_cost_model.Load(store));
+  }
 
   if (!FLAGS_partition_timestamps.empty()) {
     CHECK(ParsePerPartitionTimestamps(FLAGS_partition_timestamps,
@@ -786,6 +1193,11 @@ int Main(int argc, char** argv) {
         payload_config.target.partitions[i].verity.Clear();
       }
     }
+    if (FLAGS_choose_verity_computation) {
+      LOG_IF(FATAL, payload_config.apply_cost_model.IsEmpty())
+          << "--choose_verity_computation requires --apply_cost_profile.";
+      payload_config.ChooseVerityDataInPayload();
+    }
   }
 
   LOG(INFO) << "Generating " << (payload_config.is_delta ? "delta" : "full")
@@ -797,9 +1209,23 @@ int Main(int argc, char** argv) {
     return 1;
   }
 
+  SetUseHugePages(FLAGS_use_hugepages);
+  GenerationProfiler profiler;
+  if (!FLAGS_profile_output.empty())
+    GenerationProfiler::Set(&profiler);
   uint64_t metadata_size{};
-  if (!GenerateUpdatePayloadFile(
-          payload_config, FLAGS_out_file, FLAGS_private_key, &metadata_size)) {
+  brillo::Blob payload_hash, metadata_hash, file_hash;
+  const bool generated = GenerateUpdatePayloadFile(payload_config,
+                                                   FLAGS_out_file,
+                                                   FLAGS_private_key,
+                                                   &metadata_size,
+                                                   &payload_hash,
+                                                   &metadata_hash,
+                                                   &file_hash);
+  GenerationProfiler::Set(nullptr);
+  if (!FLAGS_profile_output.empty())
+    CHECK(profiler.WriteJson(FLAGS_profile_output));
+  if (!generated) {
     return 1;
   }
   if (!FLAGS_out_metadata_size_file.empty()) {
@@ -808,6 +1234,23 @@ int Main(int argc, char** argv) {
                            metadata_size_string.data(),
                            metadata_size_string.size()));
   }
+  if (!FLAGS_out_hash_file.empty()) {
+    CHECK(utils::WriteFile(FLAGS_out_hash_file.c_str(),
+                           payload_hash.data(),
+                           payload_hash.size()));
+  }
+  if (!FLAGS_out_metadata_hash_file.empty()) {
+    CHECK(utils::WriteFile(FLAGS_out_metadata_hash_file.c_str(),
+                           metadata_hash.data(),
+                           metadata_hash.size()));
+  }
+  if (!FLAGS_out_payload_hashes_file.empty()) {
+    CHECK(WritePayloadHashesFile(FLAGS_out_payload_hashes_file,
+                                 FLAGS_out_file,
+                                 metadata_size,
+                                 metadata_hash,
+                                 file_hash));
+  }
   return 0;
 }
 
@@ -0,0 +1,272 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/generation_profiler.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+#include <base/json/json_writer.h>
+#include <base/logging.h>
+#include <base/values.h>
+
+#include "update_engine/common/utils.h"
+
+using std::string;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+std::atomic<GenerationProfiler*> installed_profiler{nullptr};
+
+// The partition and file of the innermost ScopedFile of the thread.
+thread_local const string* current_partition = nullptr;
+thread_local const string* current_file = nullptr;
+
+const string& EmptyString() {
+  static const string* empty = new string();
+  return *empty;
+}
+
+struct ProcessUsage {
+  uint64_t peak_rss_bytes{0};
+  uint64_t minor_page_faults{0};
+  uint64_t major_page_faults{0};
+};
+
+ProcessUsage GetProcessUsage() {
+  struct rusage usage {};
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    PLOG(WARNING) << "getrusage() failed";
+    return {};
+  }
+  // ru_maxrss is in KiB on Linux.
+  return {static_cast<uint64_t>(usage.ru_maxrss) * 1024,
+          static_cast<uint64_t>(usage.ru_minflt),
+          static_cast<uint64_t>(usage.ru_majflt)};
+}
+
+double ToMilliseconds(base::TimeDelta time) {
+  return time.InMillisecondsF();
+}
+
+void Merge(const GenerationProfiler::AlgorithmStats& from,
+           GenerationProfiler::AlgorithmStats* to) {
+  to->count += from.count;
+  to->time += from.time;
+  to->input_bytes += from.input_bytes;
+  to->output_bytes += from.output_bytes;
+}
+
+std::unique_ptr<base::DictionaryValue> AlgorithmsToValue(
+    const std::map<string, GenerationProfiler::AlgorithmStats>& algorithms) {
+  auto value = std::make_unique<base::DictionaryValue>();
+  for (const auto& [name, stats] : algorithms) {
+    auto algorithm = std::make_unique<base::DictionaryValue>();
+    algorithm->SetInteger("count", static_cast<int>(stats.count));
+    algorithm->SetDouble("time_ms", ToMilliseconds(stats.time));
+    algorithm->SetDouble("input_bytes", stats.input_bytes);
+    algorithm->SetDouble("output_bytes", stats.output_bytes);
+    value->SetWithoutPathExpansion(name, std::move(algorithm));
+  }
+  return value;
+}
+
+}  // namespace
+
+GenerationProfiler::GenerationProfiler() : start_(base::TimeTicks::Now()) {}
+
+GenerationProfiler* GenerationProfiler::Get() {
+  return installed_profiler.load(std::memory_order_acquire);
+}
+
+void GenerationProfiler::Set(GenerationProfiler* profiler) {
+  installed_profiler.store(profiler, std::memory_order_release);
+}
+
+GenerationProfiler::ScopedFile::ScopedFile(const string& partition,
+                                           const string& file,
+                                           size_t blocks)
+    : profiler_(GenerationProfiler::Get()),
+      previous_partition_(current_partition),
+      previous_file_(current_file),
+      blocks_(blocks) {
+  if (!profiler_)
+    return;
+  partition_ = partition;
+  file_ = file;
+  current_partition = &partition_;
+  current_file = &file_;
+  start_ = base::TimeTicks::Now();
+}
+
+GenerationProfiler::ScopedFile::~ScopedFile() {
+  if (!profiler_)
+    return;
+  profiler_->RecordFile(
+      partition_, file_, blocks_, base::TimeTicks::Now() - start_);
+  current_partition = previous_partition_;
+  current_file = previous_file_;
+}
+
+GenerationProfiler::ScopedAlgorithm::ScopedAlgorithm(const char* algorithm,
+                                                     size_t input_bytes)
+    : profiler_(GenerationProfiler::Get()),
+      algorithm_(algorithm),
+      input_bytes_(input_bytes) {
+  if (profiler_)
+    start_ = base::TimeTicks::Now();
+}
+
+GenerationProfiler::ScopedAlgorithm::~ScopedAlgorithm() {
+  if (!profiler_)
+    return;
+  profiler_->RecordAlgorithm(
+      algorithm_, input_bytes_, output_bytes_, base::TimeTicks::Now() - start_);
+}
+
+void GenerationProfiler::RecordFile(const string& partition,
+                                    const string& file,
+                                    size_t blocks,
+                                    base::TimeDelta time) {
+  base::AutoLock lock(lock_);
+  PartitionStats* stats = &partitions_[partition];
+  if (file.empty()) {
+    stats->time += time;
+    const ProcessUsage usage = GetProcessUsage();
+    stats->peak_rss_bytes = usage.peak_rss_bytes;
+    stats->minor_page_faults = usage.minor_page_faults;
+    stats->major_page_faults = usage.major_page_faults;
+    return;
+  }
+  FileStats* file_stats = &stats->files[file];
+  file_stats->time += time;
+  file_stats->blocks += blocks;
+}
+
+void GenerationProfiler::RecordAlgorithm(const char* algorithm,
+                                         size_t input_bytes,
+                                         size_t output_bytes,
+                                         base::TimeDelta time) {
+  const string& partition =
+      current_partition ? *current_partition : EmptyString();
+  const string& file = current_file ? *current_file : EmptyString();
+  base::AutoLock lock(lock_);
+  AlgorithmStats* stats =
+      &partitions_[partition].files[file].algorithms[algorithm];
+  stats->count++;
+  stats->time += time;
+  stats->input_bytes += input_bytes;
+  stats->output_bytes += output_bytes;
+}
+
+void GenerationProfiler::RecordThreadPool(const string& partition,
+                                          size_t threads,
+                                          base::TimeDelta wall_time) {
+  base::AutoLock lock(lock_);
+  PartitionStats* stats = &partitions_[partition];
+  stats->threads = std::max(stats->threads, threads);
+  stats->pool_time += wall_time;
+}
+
+void GenerationProfiler::RecordHugePages(uint64_t bytes) {
+  base::AutoLock lock(lock_);
+  huge_page_bytes_ += bytes;
+}
+
+GenerationProfiler::PartitionStats GenerationProfiler::GetPartitionStats(
+    const string& partition) const {
+  base::AutoLock lock(lock_);
+  auto it = partitions_.find(partition);
+  return it == partitions_.end() ? PartitionStats() : it->second;
+}
+
+string GenerationProfiler::ToJson() const {
+  base::AutoLock lock(lock_);
+  base::DictionaryValue profile;
+  profile.SetDouble("wall_time_ms",
+                    ToMilliseconds(base::TimeTicks::Now() - start_));
+  const ProcessUsage usage = GetProcessUsage();
+  profile.SetDouble("peak_rss_bytes", usage.peak_rss_bytes);
+  profile.SetDouble("minor_page_faults", usage.minor_page_faults);
+  profile.SetDouble("major_page_faults", usage.major_page_faults);
+  profile.SetDouble("huge_page_bytes", huge_page_bytes_);
+
+  std::map<string, AlgorithmStats> all_algorithms;
+  auto partitions = std::make_unique<base::ListValue>();
+  for (const auto& [name, stats] : partitions_) {
+    auto partition = std::make_unique<base::DictionaryValue>();
+    partition->SetString("name", name);
+    partition->SetDouble("time_ms", ToMilliseconds(stats.time));
+    partition->SetDouble("peak_rss_bytes", stats.peak_rss_bytes);
+    partition->SetDouble("minor_page_faults", stats.minor_page_faults);
+    partition->SetDouble("major_page_faults", stats.major_page_faults);
+
+    std::map<string, AlgorithmStats> algorithms;
+    base::TimeDelta busy_time;
+    auto files = std::make_unique<base::ListValue>();
+    for (const auto& [file_name, file_stats] : stats.files) {
+      for (const auto& [algorithm, algorithm_stats] : file_stats.algorithms) {
+        Merge(algorithm_stats, &algorithms[algorithm]);
+        Merge(algorithm_stats, &all_algorithms[algorithm]);
+      }
+      if (file_name.empty())
+        continue;
+      busy_time += file_stats.time;
+      auto file = std::make_unique<base::DictionaryValue>();
+      file->SetString("name", file_name);
+      file->SetDouble("time_ms", ToMilliseconds(file_stats.time));
+      file->SetDouble("blocks", file_stats.blocks);
+      file->Set("algorithms", AlgorithmsToValue(file_stats.algorithms));
+      files->Append(std::move(file));
+    }
+    partition->Set("algorithms", AlgorithmsToValue(algorithms));
+    partition->SetInteger("threads", static_cast<int>(stats.threads));
+    partition->SetDouble("thread_pool_time_ms",
+                         ToMilliseconds(stats.pool_time));
+    // The share of the pool's thread time spent generating files.
+    if (stats.threads > 0 && !stats.pool_time.is_zero()) {
+      partition->SetDouble("thread_utilization",
+                           busy_time.InMicrosecondsF() /
+                               (stats.pool_time.InMicrosecondsF() *
+                                stats.threads));
+    }
+    partition->Set("files", std::move(files));
+    partitions->Append(std::move(partition));
+  }
+  profile.Set("algorithms", AlgorithmsToValue(all_algorithms));
+  profile.Set("partitions", std::move(partitions));
+
+  string json;
+  base::JSONWriter::WriteWithOptions(
+      profile, base::JSONWriter::OPTIONS_PRETTY_PRINT, &json);
+  return json;
+}
+
+bool GenerationProfiler::WriteJson(const string& path) const {
+  const string json = ToJson();
+  TEST_AND_RETURN_FALSE(
+      utils::WriteFile(path.c_str(), json.data(), json.size()));
+  LOG(INFO) << "Wrote the generation profile to " << path;
+  return true;
+}
+
+}  // namespace chromeos_update_engine
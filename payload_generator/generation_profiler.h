@@ -0,0 +1,149 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_GENERATION_PROFILER_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_GENERATION_PROFILER_H_
+
+#include <map>
+#include <string>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <base/time/time.h>
+
+namespace chromeos_update_engine {
+
+// Records where the payload generation time goes: the time of every diff and
+// compression algorithm tried, per file and partition, the memory high-water
+// mark, the page faults and the utilization of the worker threads. The
+// recording helpers below do nothing unless a profiler is installed with
+// Set(). Thread safe.
+class GenerationProfiler {
+ public:
+  GenerationProfiler();
+  ~GenerationProfiler() = default;
+
+  // Returns the installed profiler, or nullptr.
+  static GenerationProfiler* Get();
+  // Installs |profiler|, which must outlive the generation, or none.
+  static void Set(GenerationProfiler* profiler);
+
+  // Records the algorithms run on the calling thread during its lifetime
+  // under |partition| and |file|, and the time it lived as the time spent
+  // generating the file. With an empty |file|, records the time spent on the
+  // whole partition and the memory high-water mark once done.
+  class ScopedFile {
+   public:
+    ScopedFile(const std::string& partition,
+               const std::string& file,
+               size_t blocks);
+    ~ScopedFile();
+
+   private:
+    GenerationProfiler* profiler_;
+    const std::string* previous_partition_;
+    const std::string* previous_file_;
+    std::string partition_;
+    std::string file_;
+    size_t blocks_;
+    base::TimeTicks start_;
+
+    DISALLOW_COPY_AND_ASSIGN(ScopedFile);
+  };
+
+  // Records a run of |algorithm| over |input_bytes| during its lifetime, for
+  // the file of the calling thread.
+  class ScopedAlgorithm {
+   public:
+    ScopedAlgorithm(const char* algorithm, size_t input_bytes);
+    ~ScopedAlgorithm();
+
+    void set_output_bytes(size_t output_bytes) { output_bytes_ = output_bytes; }
+
+   private:
+    GenerationProfiler* profiler_;
+    const char* algorithm_;
+    size_t input_bytes_;
+    size_t output_bytes_{0};
+    base::TimeTicks start_;
+
+    DISALLOW_COPY_AND_ASSIGN(ScopedAlgorithm);
+  };
+
+  // Records that the files of |partition| were generated by a pool of
+  // |threads| threads running for |wall_time|.
+  void RecordThreadPool(const std::string& partition,
+                        size_t threads,
+                        base::TimeDelta wall_time);
+
+  // Records that |bytes| were advised to use huge pages, see huge_pages.h.
+  void RecordHugePages(uint64_t bytes);
+
+  // Returns the profile recorded so far as JSON.
+  std::string ToJson() const;
+  // Writes ToJson() to |path|. Returns whether it succeeded.
+  bool WriteJson(const std::string& path) const;
+
+  struct AlgorithmStats {
+    size_t count{0};
+    base::TimeDelta time;
+    uint64_t input_bytes{0};
+    uint64_t output_bytes{0};
+  };
+  struct FileStats {
+    base::TimeDelta time;
+    size_t blocks{0};
+    std::map<std::string, AlgorithmStats> algorithms;
+  };
+  struct PartitionStats {
+    base::TimeDelta time;
+    // The process-wide peak resident set size and page faults when the
+    // partition was done.
+    uint64_t peak_rss_bytes{0};
+    uint64_t minor_page_faults{0};
+    uint64_t major_page_faults{0};
+    size_t threads{0};
+    base::TimeDelta pool_time;
+    // The files of the partition. The algorithms run outside of any file
+    // are under "".
+    std::map<std::string, FileStats> files;
+  };
+
+  // Returns a copy of the stats of |partition|.
+  PartitionStats GetPartitionStats(const std::string& partition) const;
+
+ private:
+  void RecordFile(const std::string& partition,
+                  const std::string& file,
+                  size_t blocks,
+                  base::TimeDelta time);
+  void RecordAlgorithm(const char* algorithm,
+                       size_t input_bytes,
+                       size_t output_bytes,
+                       base::TimeDelta time);
+
+  const base::TimeTicks start_;
+
+  mutable base::Lock lock_;
+  std::map<std::string, PartitionStats> partitions_;
+  uint64_t huge_page_bytes_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(GenerationProfiler);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_GENERATION_PROFILER_H_
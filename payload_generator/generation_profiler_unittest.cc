@@ -0,0 +1,98 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/generation_profiler.h"
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+class GenerationProfilerTest : public ::testing::Test {
+ protected:
+  void SetUp() override { GenerationProfiler::Set(&profiler_); }
+  void TearDown() override { GenerationProfiler::Set(nullptr); }
+
+  GenerationProfiler profiler_;
+};
+
+TEST_F(GenerationProfilerTest, NothingRecordedWithoutProfiler) {
+  GenerationProfiler::Set(nullptr);
+  {
+    GenerationProfiler::ScopedFile file("system", "lib.so", 4);
+    GenerationProfiler::ScopedAlgorithm algorithm("bsdiff", 100);
+  }
+  EXPECT_TRUE(profiler_.GetPartitionStats("system").files.empty());
+}
+
+TEST_F(GenerationProfilerTest, RecordsAlgorithmsPerFile) {
+  {
+    GenerationProfiler::ScopedFile file("system", "lib.so", 4);
+    for (int i = 0; i < 2; i++) {
+      GenerationProfiler::ScopedAlgorithm algorithm("bsdiff", 100);
+      algorithm.set_output_bytes(10);
+    }
+    GenerationProfiler::ScopedAlgorithm algorithm("zucchini", 100);
+  }
+  const auto stats = profiler_.GetPartitionStats("system");
+  ASSERT_EQ(1u, stats.files.count("lib.so"));
+  const auto& file = stats.files.at("lib.so");
+  EXPECT_EQ(4u, file.blocks);
+  ASSERT_EQ(1u, file.algorithms.count("bsdiff"));
+  EXPECT_EQ(2u, file.algorithms.at("bsdiff").count);
+  EXPECT_EQ(200u, file.algorithms.at("bsdiff").input_bytes);
+  EXPECT_EQ(20u, file.algorithms.at("bsdiff").output_bytes);
+  ASSERT_EQ(1u, file.algorithms.count("zucchini"));
+  EXPECT_EQ(0u, file.algorithms.at("zucchini").output_bytes);
+}
+
+TEST_F(GenerationProfilerTest, NestedFilesRestoreTheOuterFile) {
+  {
+    GenerationProfiler::ScopedFile partition("system", "", 8);
+    {
+      GenerationProfiler::ScopedFile file("system", "lib.so", 4);
+      GenerationProfiler::ScopedAlgorithm algorithm("bsdiff", 100);
+    }
+    GenerationProfiler::ScopedAlgorithm algorithm("xz", 100);
+  }
+  const auto stats = profiler_.GetPartitionStats("system");
+  EXPECT_EQ(1u, stats.files.at("lib.so").algorithms.count("bsdiff"));
+  EXPECT_EQ(1u, stats.files.at("").algorithms.count("xz"));
+  EXPECT_GT(stats.peak_rss_bytes, 0u);
+  EXPECT_GT(stats.minor_page_faults, 0u);
+}
+
+TEST_F(GenerationProfilerTest, ToJson) {
+  {
+    GenerationProfiler::ScopedFile file("system", "lib.so", 4);
+    GenerationProfiler::ScopedAlgorithm algorithm("puffdiff", 100);
+  }
+  profiler_.RecordThreadPool("system", 2, base::TimeDelta::FromSeconds(1));
+  EXPECT_EQ(2u, profiler_.GetPartitionStats("system").threads);
+  profiler_.RecordHugePages(4096);
+
+  const std::string json = profiler_.ToJson();
+  EXPECT_NE(std::string::npos, json.find("\"system\""));
+  EXPECT_NE(std::string::npos, json.find("\"lib.so\""));
+  EXPECT_NE(std::string::npos, json.find("\"puffdiff\""));
+  EXPECT_NE(std::string::npos, json.find("\"thread_utilization\""));
+  EXPECT_NE(std::string::npos, json.find("\"peak_rss_bytes\""));
+  EXPECT_NE(std::string::npos, json.find("\"minor_page_faults\""));
+  EXPECT_NE(std::string::npos, json.find("\"huge_page_bytes\": 4096"));
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,75 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/huge_pages.h"
+
+#include <sys/mman.h>
+
+#include <atomic>
+
+#include <base/logging.h>
+
+#include "update_engine/payload_generator/generation_profiler.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+std::atomic<bool> use_huge_pages{false};
+std::atomic<bool> warned_unsupported{false};
+
+}  // namespace
+
+void SetUseHugePages(bool enabled) {
+  use_huge_pages.store(enabled, std::memory_order_relaxed);
+}
+
+bool UseHugePages() {
+  return use_huge_pages.load(std::memory_order_relaxed);
+}
+
+void GetHugePageRange(const void* addr,
+                      size_t size,
+                      uintptr_t* begin,
+                      uintptr_t* end) {
+  const uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+  *begin = (start + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  *end = (start + size) & ~(kHugePageSize - 1);
+  if (*end < *begin)
+    *end = *begin;
+}
+
+size_t AdviseHugePages(const void* addr, size_t size) {
+  if (!UseHugePages() || size < kMinHugePageAllocation)
+    return 0;
+  uintptr_t begin, end;
+  GetHugePageRange(addr, size, &begin, &end);
+  if (begin == end)
+    return 0;
+  if (madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE) !=
+      0) {
+    // Without transparent huge page support every call fails the same way.
+    PLOG_IF(WARNING, !warned_unsupported.exchange(true))
+        << "Failed to advise huge pages";
+    return 0;
+  }
+  if (GenerationProfiler* profiler = GenerationProfiler::Get())
+    profiler->RecordHugePages(end - begin);
+  return end - begin;
+}
+
+}  // namespace chromeos_update_engine
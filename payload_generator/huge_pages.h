@@ -0,0 +1,68 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_HUGE_PAGES_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_HUGE_PAGES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace chromeos_update_engine {
+
+// The payload generation walks some multi-GB working sets, like the hash
+// table of BlockMapping, the whole files and partitions it diffs and the
+// sources of the cached suffix arrays, in random order. When enabled, these
+// are backed with transparent huge pages to cut their TLB misses.
+
+constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+// Allocations smaller than this aren't advised to use huge pages.
+constexpr size_t kMinHugePageAllocation = 4 * kHugePageSize;
+
+// Enables or disables the huge pages, disabled by default.
+void SetUseHugePages(bool enabled);
+bool UseHugePages();
+
+// Returns the range of the whole huge pages within the |size| bytes at
+// |addr| as |begin| and |end|, which are equal if there is none.
+void GetHugePageRange(const void* addr,
+                      size_t size,
+                      uintptr_t* begin,
+                      uintptr_t* end);
+
+// If huge pages are enabled and |size| is at least kMinHugePageAllocation,
+// advises the kernel to back the whole huge pages within the |size| bytes at
+// |addr| with huge pages. This is best done before they are first touched.
+// Returns the number of bytes advised.
+size_t AdviseHugePages(const void* addr, size_t size);
+
+// If huge pages are enabled, makes room for |size| elements in |vec| and
+// advises huge pages for it before its memory is touched. Does nothing
+// otherwise.
+template <typename T>
+void ReserveHugePages(std::vector<T>* vec, size_t size) {
+  if (!UseHugePages() || size * sizeof(T) < kMinHugePageAllocation)
+    return;
+  vec->reserve(size);
+  AdviseHugePages(vec->data(), vec->capacity() * sizeof(T));
+}
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_HUGE_PAGES_H_
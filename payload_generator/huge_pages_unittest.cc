@@ -0,0 +1,69 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/huge_pages.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+class HugePagesTest : public ::testing::Test {
+ protected:
+  void TearDown() override { SetUseHugePages(false); }
+};
+
+TEST_F(HugePagesTest, GetHugePageRange) {
+  uintptr_t begin, end;
+  const auto* base = reinterpret_cast<const uint8_t*>(16 * kHugePageSize);
+  GetHugePageRange(base, 3 * kHugePageSize, &begin, &end);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(base), begin);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(base) + 3 * kHugePageSize, end);
+
+  // Only the whole huge pages within the range.
+  GetHugePageRange(base + 1, 3 * kHugePageSize, &begin, &end);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(base) + kHugePageSize, begin);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(base) + 3 * kHugePageSize, end);
+
+  GetHugePageRange(base + 1, kHugePageSize, &begin, &end);
+  EXPECT_EQ(begin, end);
+}
+
+TEST_F(HugePagesTest, DisabledByDefault) {
+  EXPECT_FALSE(UseHugePages());
+  std::vector<uint8_t> data;
+  ReserveHugePages(&data, kMinHugePageAllocation);
+  EXPECT_EQ(0u, data.capacity());
+  EXPECT_EQ(0u, AdviseHugePages(data.data(), kMinHugePageAllocation));
+}
+
+TEST_F(HugePagesTest, ReserveHugePages) {
+  SetUseHugePages(true);
+  std::vector<uint64_t> small;
+  ReserveHugePages(&small, 1024);
+  EXPECT_EQ(0u, small.capacity());
+
+  std::vector<uint64_t> large;
+  ReserveHugePages(&large, kMinHugePageAllocation / sizeof(uint64_t));
+  EXPECT_GE(large.capacity(), kMinHugePageAllocation / sizeof(uint64_t));
+  // Advising huge pages depends on the kernel, but never breaks the data.
+  large.assign(large.capacity(), 42);
+  EXPECT_EQ(42u, large.back());
+}
+
+}  // namespace chromeos_update_engine
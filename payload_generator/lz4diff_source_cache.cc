@@ -0,0 +1,138 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/lz4diff_source_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/lz4diff/lz4diff_compress.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+std::atomic<Lz4diffSourceCache*> installed_cache{nullptr};
+
+// Returns the key of the source at |extents| of |partition_path|.
+std::string SourceKey(const std::string& partition_path,
+                      const std::vector<Extent>& extents) {
+  std::string key = partition_path;
+  key.push_back('\0');
+  for (const Extent& extent : extents) {
+    const uint64_t range[] = {extent.start_block(), extent.num_blocks()};
+    key.append(reinterpret_cast<const char*>(range), sizeof(range));
+  }
+  return key;
+}
+
+std::shared_ptr<const brillo::Blob> DecompressUncached(
+    const brillo::Blob& data, const CompressedFile& file_info) {
+  return std::make_shared<const brillo::Blob>(TryDecompressBlob(
+      data, file_info.blocks, file_info.zero_padding_enabled));
+}
+
+}  // namespace
+
+Lz4diffSourceCache::Lz4diffSourceCache(size_t max_bytes)
+    : max_bytes_(max_bytes) {}
+
+Lz4diffSourceCache::~Lz4diffSourceCache() = default;
+
+size_t Lz4diffSourceCache::cached_bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return cached_bytes_;
+}
+
+std::shared_ptr<Lz4diffSourceCache::Entry> Lz4diffSourceCache::GetEntry(
+    const std::string& key, size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second->lru_it);
+    return it->second;
+  }
+  if (bytes > max_bytes_)
+    return nullptr;
+  // The evicted sources stay alive until the diffs using them finish.
+  while (cached_bytes_ + bytes > max_bytes_) {
+    auto evicted = entries_.find(lru_.back());
+    cached_bytes_ -= evicted->second->bytes;
+    entries_.erase(evicted);
+    lru_.pop_back();
+  }
+  auto entry = std::make_shared<Entry>();
+  entry->bytes = bytes;
+  entry->lru_it = lru_.insert(lru_.begin(), key);
+  entries_.emplace(key, entry);
+  cached_bytes_ += bytes;
+  return entry;
+}
+
+std::shared_ptr<const brillo::Blob> Lz4diffSourceCache::Decompress(
+    const std::string& partition_path,
+    const std::vector<Extent>& extents,
+    const brillo::Blob& data,
+    const CompressedFile& file_info) {
+  // The decompressed size is known from the block info, and any data after
+  // the last block is copied as is.
+  size_t uncompressed_size = 0;
+  size_t compressed_size = 0;
+  for (const CompressedBlock& block : file_info.blocks) {
+    uncompressed_size += block.uncompressed_length;
+    compressed_size += block.compressed_length;
+  }
+  const size_t bytes =
+      uncompressed_size + data.size() - std::min(data.size(), compressed_size);
+  std::shared_ptr<Entry> entry =
+      GetEntry(SourceKey(partition_path, extents), bytes);
+  if (!entry)
+    return DecompressUncached(data, file_info);
+
+  // The other diffs from the same source wait for the first one to
+  // decompress it.
+  std::lock_guard<std::mutex> lock(entry->mutex);
+  if (!entry->data) {
+    entry->data = DecompressUncached(data, file_info);
+  }
+  return entry->data;
+}
+
+Lz4diffSourceCache* Lz4diffSourceCache::Get() {
+  return installed_cache.load(std::memory_order_acquire);
+}
+
+void Lz4diffSourceCache::Set(Lz4diffSourceCache* cache) {
+  installed_cache.store(cache, std::memory_order_release);
+}
+
+std::shared_ptr<const brillo::Blob> Lz4diffSourceCache::RunDecompress(
+    const std::string& partition_path,
+    const std::vector<Extent>& extents,
+    const brillo::Blob& data,
+    const CompressedFile& file_info) {
+  Lz4diffSourceCache* cache = Get();
+  if (cache && !partition_path.empty())
+    return cache->Decompress(partition_path, extents, data, file_info);
+  return DecompressUncached(data, file_info);
+}
+
+}  // namespace chromeos_update_engine
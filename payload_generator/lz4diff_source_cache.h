@@ -0,0 +1,100 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_LZ4DIFF_SOURCE_CACHE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_LZ4DIFF_SOURCE_CACHE_H_
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/lz4diff/lz4diff_format.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// A cache of the decompressed sources of the LZ4DIFF operations, shared by
+// the operations of a payload generation, so that an old file which is the
+// source of several new files is only decompressed once. A source is
+// identified by its partition and extents rather than by a hash of its data,
+// which would cost about as much as decompressing it. The cache holds about
+// |max_bytes| of decompressed data, evicting the least recently used sources.
+// All the methods may be called concurrently.
+class Lz4diffSourceCache {
+ public:
+  explicit Lz4diffSourceCache(size_t max_bytes);
+  ~Lz4diffSourceCache();
+
+  // Returns |data|, the file |file_info| at |extents| of the partition
+  // |partition_path|, decompressed by TryDecompressBlob(), using the cached
+  // one if any. Returns an empty blob on error.
+  std::shared_ptr<const brillo::Blob> Decompress(
+      const std::string& partition_path,
+      const std::vector<Extent>& extents,
+      const brillo::Blob& data,
+      const CompressedFile& file_info);
+
+  // The number of bytes currently held by the cache.
+  size_t cached_bytes() const;
+
+  // Returns the installed cache, or nullptr.
+  static Lz4diffSourceCache* Get();
+  // Installs |cache|, which must outlive its use, or none.
+  static void Set(Lz4diffSourceCache* cache);
+
+  // Decompresses |data| with the installed cache if any and |partition_path|
+  // is not empty, otherwise without caching.
+  static std::shared_ptr<const brillo::Blob> RunDecompress(
+      const std::string& partition_path,
+      const std::vector<Extent>& extents,
+      const brillo::Blob& data,
+      const CompressedFile& file_info);
+
+ private:
+  struct Entry {
+    // Held while |data| is decompressed.
+    std::mutex mutex;
+    std::shared_ptr<const brillo::Blob> data;
+    size_t bytes{0};
+    // The position in |lru_|.
+    std::list<std::string>::iterator lru_it;
+  };
+
+  // Returns the entry of the source |key|, adding an empty one of |bytes|
+  // bytes if none, or nullptr if it doesn't fit.
+  std::shared_ptr<Entry> GetEntry(const std::string& key, size_t bytes);
+
+  const size_t max_bytes_;
+
+  mutable std::mutex mutex_;
+  std::map<std::string, std::shared_ptr<Entry>> entries_;
+  // The keys of |entries_|, most recently used first.
+  std::list<std::string> lru_;
+  size_t cached_bytes_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(Lz4diffSourceCache);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_LZ4DIFF_SOURCE_CACHE_H_
@@ -0,0 +1,116 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/lz4diff_source_cache.h"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <lz4.h>
+
+#include "update_engine/lz4diff/lz4diff_compress.h"
+#include "update_engine/payload_generator/extent_utils.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+class Lz4diffSourceCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // 16 lz4 blocks of 4 KiB each.
+    for (size_t i = 0; i < 16; i++) {
+      std::string block;
+      while (block.size() < 4096) {
+        block += "block " + std::to_string(i) + " line " +
+                 std::to_string(block.size()) + "\n";
+      }
+      block.resize(4096);
+      uncompressed_.insert(uncompressed_.end(), block.begin(), block.end());
+      brillo::Blob compressed(LZ4_compressBound(block.size()));
+      const int size = LZ4_compress_default(
+          block.data(),
+          reinterpret_cast<char*>(compressed.data()),
+          block.size(),
+          compressed.size());
+      ASSERT_GT(size, 0);
+      file_info_.blocks.emplace_back(i * 4096, size, 4096);
+      data_.insert(data_.end(), compressed.begin(), compressed.begin() + size);
+    }
+  }
+
+  brillo::Blob uncompressed_;
+  brillo::Blob data_;
+  CompressedFile file_info_;
+  const vector<Extent> extents_{ExtentForRange(10, 4)};
+};
+
+TEST_F(Lz4diffSourceCacheTest, CachesDecompressedSourceTest) {
+  Lz4diffSourceCache cache(1024 * 1024);
+  auto decompressed = cache.Decompress("old", extents_, data_, file_info_);
+  ASSERT_NE(nullptr, decompressed);
+  EXPECT_EQ(uncompressed_, *decompressed);
+  EXPECT_EQ(uncompressed_.size(), cache.cached_bytes());
+
+  // The same source is returned from the cache, even if the data passed is
+  // not read again.
+  EXPECT_EQ(decompressed,
+            cache.Decompress("old", extents_, brillo::Blob(), file_info_));
+  EXPECT_EQ(uncompressed_.size(), cache.cached_bytes());
+
+  // Other partitions or extents are other sources.
+  EXPECT_NE(decompressed,
+            cache.Decompress("other", extents_, data_, file_info_));
+  EXPECT_NE(
+      decompressed,
+      cache.Decompress("old", {ExtentForRange(20, 4)}, data_, file_info_));
+  EXPECT_EQ(uncompressed_.size() * 3, cache.cached_bytes());
+}
+
+TEST_F(Lz4diffSourceCacheTest, SourceLargerThanCacheNotCachedTest) {
+  Lz4diffSourceCache cache(uncompressed_.size() - 1);
+  auto decompressed = cache.Decompress("old", extents_, data_, file_info_);
+  ASSERT_NE(nullptr, decompressed);
+  EXPECT_EQ(uncompressed_, *decompressed);
+  EXPECT_EQ(0u, cache.cached_bytes());
+}
+
+TEST_F(Lz4diffSourceCacheTest, EvictsLeastRecentlyUsedTest) {
+  // Room for two sources.
+  Lz4diffSourceCache cache(uncompressed_.size() * 2);
+  const vector<Extent> other_extents = {ExtentForRange(20, 4)};
+  const vector<Extent> third_extents = {ExtentForRange(30, 4)};
+  auto first = cache.Decompress("old", extents_, data_, file_info_);
+  auto second = cache.Decompress("old", other_extents, data_, file_info_);
+  // Uses the first source again, so the second one is evicted.
+  EXPECT_EQ(first, cache.Decompress("old", extents_, data_, file_info_));
+  cache.Decompress("old", third_extents, data_, file_info_);
+  EXPECT_EQ(uncompressed_.size() * 2, cache.cached_bytes());
+  EXPECT_EQ(first, cache.Decompress("old", extents_, data_, file_info_));
+  EXPECT_NE(second, cache.Decompress("old", other_extents, data_, file_info_));
+}
+
+TEST_F(Lz4diffSourceCacheTest, RunDecompressWithoutCacheTest) {
+  ASSERT_EQ(nullptr, Lz4diffSourceCache::Get());
+  auto decompressed =
+      Lz4diffSourceCache::RunDecompress("old", extents_, data_, file_info_);
+  ASSERT_NE(nullptr, decompressed);
+  EXPECT_EQ(uncompressed_, *decompressed);
+}
+
+}  // namespace chromeos_update_engine
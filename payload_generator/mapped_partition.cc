@@ -0,0 +1,169 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/mapped_partition.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+#include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/huge_pages.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+std::atomic<MappedPartitions*> installed_partitions{nullptr};
+
+}  // namespace
+
+MappedPartition::MappedPartition(const uint8_t* data, uint64_t size)
+    : data_(data), size_(size) {}
+
+MappedPartition::~MappedPartition() {
+  munmap(const_cast<uint8_t*>(data_), size_);
+}
+
+std::unique_ptr<MappedPartition> MappedPartition::Map(const std::string& path) {
+  int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0)
+    return nullptr;
+  ScopedFdCloser fd_closer(&fd);
+  struct stat st {};
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+      static_cast<uint64_t>(st.st_size) > std::numeric_limits<size_t>::max()) {
+    return nullptr;
+  }
+  void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    PLOG(WARNING) << "Failed to map " << path << ", reading it instead";
+    return nullptr;
+  }
+  AdviseHugePages(mapping, st.st_size);
+  return std::unique_ptr<MappedPartition>(
+      new MappedPartition(static_cast<const uint8_t*>(mapping), st.st_size));
+}
+
+bool MappedPartition::GetExtents(const std::vector<Extent>& extents,
+                                 uint64_t length,
+                                 brillo::Blob* buffer,
+                                 std::string_view* view) const {
+  buffer->clear();
+  uint64_t bytes_left = length;
+  for (const Extent& extent : extents) {
+    if (bytes_left == 0)
+      break;
+    const uint64_t offset = extent.start_block() * kBlockSize;
+    const uint64_t bytes =
+        std::min(bytes_left, extent.num_blocks() * kBlockSize);
+    TEST_AND_RETURN_FALSE(offset <= size_ && bytes <= size_ - offset);
+    if (bytes == length) {
+      *view = ToStringView(data_ + offset, bytes);
+      return true;
+    }
+    if (buffer->empty())
+      ReserveHugePages(buffer, length);
+    buffer->insert(buffer->end(), data_ + offset, data_ + offset + bytes);
+    bytes_left -= bytes;
+  }
+  TEST_AND_RETURN_FALSE(bytes_left == 0);
+  *view = ToStringView(*buffer);
+  return true;
+}
+
+bool MappedPartition::ReadExtents(const std::vector<Extent>& extents,
+                                  brillo::Blob* data) const {
+  brillo::Blob buffer;
+  std::string_view view;
+  TEST_AND_RETURN_FALSE(GetExtents(extents,
+                                   utils::BlocksInExtents(extents) * kBlockSize,
+                                   &buffer,
+                                   &view));
+  if (view.data() == reinterpret_cast<const char*>(buffer.data())) {
+    *data = std::move(buffer);
+  } else {
+    data->clear();
+    ReserveHugePages(data, view.size());
+    data->assign(view.begin(), view.end());
+  }
+  return true;
+}
+
+void MappedPartitions::Add(const std::string& path) {
+  if (path.empty() || partitions_.count(path))
+    return;
+  std::unique_ptr<MappedPartition> partition = MappedPartition::Map(path);
+  if (partition)
+    partitions_.emplace(path, std::move(partition));
+}
+
+const MappedPartition* MappedPartitions::Find(const std::string& path) const {
+  auto it = partitions_.find(path);
+  return it == partitions_.end() ? nullptr : it->second.get();
+}
+
+MappedPartitions* MappedPartitions::Get() {
+  return installed_partitions.load(std::memory_order_acquire);
+}
+
+void MappedPartitions::Set(MappedPartitions* partitions) {
+  installed_partitions.store(partitions, std::memory_order_release);
+}
+
+bool MappedPartitions::GetExtents(const std::string& path,
+                                  const std::vector<Extent>& extents,
+                                  uint64_t length,
+                                  brillo::Blob* buffer,
+                                  std::string_view* view) {
+  MappedPartitions* partitions = Get();
+  if (const MappedPartition* partition =
+          partitions ? partitions->Find(path) : nullptr) {
+    return partition->GetExtents(extents, length, buffer, view);
+  }
+  TEST_AND_RETURN_FALSE(utils::ReadExtents(path,
+                                           extents,
+                                           buffer,
+                                           utils::BlocksInExtents(extents) *
+                                               kBlockSize,
+                                           kBlockSize));
+  TEST_AND_RETURN_FALSE(length <= buffer->size());
+  buffer->resize(length);
+  *view = ToStringView(*buffer);
+  return true;
+}
+
+bool MappedPartitions::ReadExtents(const std::string& path,
+                                   const std::vector<Extent>& extents,
+                                   brillo::Blob* data) {
+  MappedPartitions* partitions = Get();
+  if (const MappedPartition* partition =
+          partitions ? partitions->Find(path) : nullptr) {
+    return partition->ReadExtents(extents, data);
+  }
+  return utils::ReadExtents(path, extents, data, kBlockSize);
+}
+
+}  // namespace chromeos_update_engine
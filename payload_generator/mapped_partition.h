@@ -0,0 +1,109 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_MAPPED_PARTITION_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_MAPPED_PARTITION_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// A partition image mapped read-only in memory. The data of its extents is
+// handed out in place when it is contiguous, and gathered from the mapping
+// otherwise, so that the blocks read several times share the page cache
+// instead of being read again. All the methods may be called concurrently.
+class MappedPartition {
+ public:
+  ~MappedPartition();
+
+  // Maps the regular file |path|, or returns nullptr if it can't be mapped.
+  static std::unique_ptr<MappedPartition> Map(const std::string& path);
+
+  uint64_t size() const { return size_; }
+
+  // Sets |view| to the first |length| bytes of |extents|, which points in the
+  // mapping if they are within the first extent, otherwise in |buffer| where
+  // they are gathered. Returns false if they aren't all in the image.
+  bool GetExtents(const std::vector<Extent>& extents,
+                  uint64_t length,
+                  brillo::Blob* buffer,
+                  std::string_view* view) const;
+
+  // Copies the data of |extents| in |data|.
+  bool ReadExtents(const std::vector<Extent>& extents,
+                   brillo::Blob* data) const;
+
+ private:
+  MappedPartition(const uint8_t* data, uint64_t size);
+
+  const uint8_t* const data_;
+  const uint64_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedPartition);
+};
+
+// The partition images mapped for a payload generation, shared by all its
+// stages: the moved blocks, the diffs, the merge of the operations and their
+// source hashes. The images are added before this is installed, after which
+// they may be looked up concurrently.
+class MappedPartitions {
+ public:
+  MappedPartitions() = default;
+
+  // Maps the image at |path|, unless it's already mapped or it can't be, in
+  // which case it's read from the file instead.
+  void Add(const std::string& path);
+
+  // Returns the mapped image at |path|, or nullptr.
+  const MappedPartition* Find(const std::string& path) const;
+
+  // Returns the installed images, or nullptr.
+  static MappedPartitions* Get();
+  // Installs |partitions|, which must outlive their use, or none.
+  static void Set(MappedPartitions* partitions);
+
+  // Same as MappedPartition::GetExtents() and ReadExtents() on the image at
+  // |path| if it's installed, otherwise reading it from the file.
+  static bool GetExtents(const std::string& path,
+                         const std::vector<Extent>& extents,
+                         uint64_t length,
+                         brillo::Blob* buffer,
+                         std::string_view* view);
+  static bool ReadExtents(const std::string& path,
+                          const std::vector<Extent>& extents,
+                          brillo::Blob* data);
+
+ private:
+  std::map<std::string, std::unique_ptr<MappedPartition>> partitions_;
+
+  DISALLOW_COPY_AND_ASSIGN(MappedPartitions);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_MAPPED_PARTITION_H_
@@ -0,0 +1,124 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/mapped_partition.h"
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+class MappedPartitionTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    data_.resize(8 * kBlockSize);
+    test_utils::FillWithData(&data_);
+    ASSERT_TRUE(test_utils::WriteFileVector(part_file_.path(), data_));
+  }
+
+  brillo::Blob data_;
+  ScopedTempFile part_file_{"MappedPartitionTest.XXXXXX"};
+};
+
+TEST_F(MappedPartitionTest, ContiguousExtentsInPlaceTest) {
+  std::unique_ptr<MappedPartition> partition =
+      MappedPartition::Map(part_file_.path());
+  ASSERT_NE(nullptr, partition);
+  EXPECT_EQ(data_.size(), partition->size());
+
+  brillo::Blob buffer;
+  std::string_view view;
+  EXPECT_TRUE(partition->GetExtents(
+      {ExtentForRange(2, 3)}, 2 * kBlockSize + 10, &buffer, &view));
+  EXPECT_TRUE(buffer.empty());
+  EXPECT_EQ(ToStringView(data_.data() + 2 * kBlockSize, 2 * kBlockSize + 10),
+            view);
+}
+
+TEST_F(MappedPartitionTest, GatherExtentsTest) {
+  std::unique_ptr<MappedPartition> partition =
+      MappedPartition::Map(part_file_.path());
+  ASSERT_NE(nullptr, partition);
+
+  const vector<Extent> extents = {ExtentForRange(5, 1), ExtentForRange(1, 2)};
+  brillo::Blob expected(data_.begin() + 5 * kBlockSize,
+                        data_.begin() + 6 * kBlockSize);
+  expected.insert(expected.end(),
+                  data_.begin() + kBlockSize,
+                  data_.begin() + 3 * kBlockSize);
+  brillo::Blob buffer;
+  std::string_view view;
+  EXPECT_TRUE(
+      partition->GetExtents(extents, 3 * kBlockSize, &buffer, &view));
+  EXPECT_EQ(expected, buffer);
+  EXPECT_EQ(ToStringView(expected), view);
+
+  brillo::Blob data;
+  EXPECT_TRUE(partition->ReadExtents(extents, &data));
+  EXPECT_EQ(expected, data);
+  EXPECT_TRUE(partition->ReadExtents({ExtentForRange(0, 8)}, &data));
+  EXPECT_EQ(data_, data);
+}
+
+TEST_F(MappedPartitionTest, ExtentsPastTheEndTest) {
+  std::unique_ptr<MappedPartition> partition =
+      MappedPartition::Map(part_file_.path());
+  ASSERT_NE(nullptr, partition);
+  brillo::Blob data;
+  EXPECT_FALSE(partition->ReadExtents({ExtentForRange(7, 2)}, &data));
+  EXPECT_FALSE(partition->ReadExtents({ExtentForRange(9, 1)}, &data));
+}
+
+TEST_F(MappedPartitionTest, MapMissingFileTest) {
+  EXPECT_EQ(nullptr, MappedPartition::Map("/a/file/that/does/not/exist"));
+}
+
+TEST_F(MappedPartitionTest, InstalledPartitionsTest) {
+  const vector<Extent> extents = {ExtentForRange(6, 2), ExtentForRange(0, 1)};
+  brillo::Blob read_data;
+  EXPECT_TRUE(
+      MappedPartitions::ReadExtents(part_file_.path(), extents, &read_data));
+
+  MappedPartitions partitions;
+  partitions.Add(part_file_.path());
+  ASSERT_NE(nullptr, partitions.Find(part_file_.path()));
+  EXPECT_EQ(nullptr, partitions.Find("/a/file/that/does/not/exist"));
+  MappedPartitions::Set(&partitions);
+  brillo::Blob mapped_data;
+  EXPECT_TRUE(
+      MappedPartitions::ReadExtents(part_file_.path(), extents, &mapped_data));
+  brillo::Blob buffer;
+  std::string_view view;
+  EXPECT_TRUE(MappedPartitions::GetExtents(
+      part_file_.path(), extents, 3 * kBlockSize, &buffer, &view));
+  MappedPartitions::Set(nullptr);
+
+  EXPECT_EQ(read_data, mapped_data);
+  EXPECT_EQ(ToStringView(read_data), view);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,84 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/memory_budget.h"
+
+#include <atomic>
+
+#include <base/logging.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+
+std::atomic<MemoryBudget*> installed_budget{nullptr};
+
+// The number of reservations held by the calling thread.
+thread_local size_t thread_reservations = 0;
+
+}  // namespace
+
+MemoryBudget::MemoryBudget(uint64_t max_bytes) : max_bytes_(max_bytes) {}
+
+uint64_t MemoryBudget::reserved_bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return reserved_bytes_;
+}
+
+void MemoryBudget::Reserve(uint64_t bytes) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (thread_reservations == 0) {
+    cv_.wait(lock, [this, bytes] {
+      return reserved_bytes_ == 0 || (reserved_bytes_ <= max_bytes_ &&
+                                      bytes <= max_bytes_ - reserved_bytes_);
+    });
+  }
+  reserved_bytes_ += bytes;
+  thread_reservations++;
+}
+
+void MemoryBudget::Release(uint64_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CHECK_GE(reserved_bytes_, bytes);
+    CHECK_GT(thread_reservations, 0U);
+    reserved_bytes_ -= bytes;
+    thread_reservations--;
+  }
+  cv_.notify_all();
+}
+
+MemoryBudget* MemoryBudget::Get() {
+  return installed_budget.load(std::memory_order_acquire);
+}
+
+void MemoryBudget::Set(MemoryBudget* budget) {
+  installed_budget.store(budget, std::memory_order_release);
+}
+
+MemoryBudget::ScopedReservation::ScopedReservation(uint64_t bytes)
+    : budget_(Get()), bytes_(bytes) {
+  if (budget_)
+    budget_->Reserve(bytes_);
+}
+
+MemoryBudget::ScopedReservation::~ScopedReservation() {
+  if (budget_)
+    budget_->Release(bytes_);
+}
+
+}  // namespace chromeos_update_engine
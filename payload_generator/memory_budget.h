@@ -0,0 +1,82 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_MEMORY_BUDGET_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_MEMORY_BUDGET_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+
+#include <base/macros.h>
+
+namespace chromeos_update_engine {
+
+// Limits the memory the tasks of a payload generation are estimated to use at
+// once. A task reserves its estimate before it starts, waiting until it fits
+// in the budget, so that the large files are delayed or serialized instead of
+// running the generation out of memory. All the methods may be called
+// concurrently.
+class MemoryBudget {
+ public:
+  explicit MemoryBudget(uint64_t max_bytes);
+
+  uint64_t max_bytes() const { return max_bytes_; }
+
+  // The number of bytes currently reserved.
+  uint64_t reserved_bytes() const;
+
+  // Reserves |bytes| of the budget, waiting until they fit. A reservation
+  // larger than the whole budget waits until nothing else is reserved. A
+  // thread which already holds a reservation doesn't wait, since it may be
+  // running a task of the pool while its own task waits for its subtasks.
+  void Reserve(uint64_t bytes);
+  // Releases |bytes| reserved by the calling thread with Reserve().
+  void Release(uint64_t bytes);
+
+  // Returns the installed budget, or nullptr.
+  static MemoryBudget* Get();
+  // Installs |budget|, which must outlive its use, or none.
+  static void Set(MemoryBudget* budget);
+
+  // Reserves |bytes| of the installed budget, if any, for its lifetime.
+  class ScopedReservation {
+   public:
+    explicit ScopedReservation(uint64_t bytes);
+    ~ScopedReservation();
+
+   private:
+    MemoryBudget* const budget_;
+    const uint64_t bytes_;
+
+    DISALLOW_COPY_AND_ASSIGN(ScopedReservation);
+  };
+
+ private:
+  const uint64_t max_bytes_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  uint64_t reserved_bytes_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(MemoryBudget);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_MEMORY_BUDGET_H_
@@ -0,0 +1,103 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/memory_budget.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+class MemoryBudgetTest : public ::testing::Test {};
+
+TEST_F(MemoryBudgetTest, ReservationsWithinBudgetDontWait) {
+  MemoryBudget budget(100);
+  budget.Reserve(40);
+  uint64_t reserved_bytes = 0;
+  std::thread thread([&budget, &reserved_bytes] {
+    budget.Reserve(60);
+    reserved_bytes = budget.reserved_bytes();
+    budget.Release(60);
+  });
+  thread.join();
+  EXPECT_EQ(100U, reserved_bytes);
+  budget.Release(40);
+  EXPECT_EQ(0U, budget.reserved_bytes());
+}
+
+TEST_F(MemoryBudgetTest, ReservationWaitsForRelease) {
+  MemoryBudget budget(100);
+  budget.Reserve(60);
+  std::atomic<bool> reserved{false};
+  std::thread thread([&budget, &reserved] {
+    budget.Reserve(60);
+    reserved = true;
+    budget.Release(60);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(reserved);
+  budget.Release(60);
+  thread.join();
+  EXPECT_TRUE(reserved);
+  EXPECT_EQ(0U, budget.reserved_bytes());
+}
+
+TEST_F(MemoryBudgetTest, LargerThanBudgetRunsAlone) {
+  MemoryBudget budget(100);
+  budget.Reserve(500);
+  EXPECT_EQ(500U, budget.reserved_bytes());
+  std::atomic<bool> reserved{false};
+  std::thread thread([&budget, &reserved] {
+    budget.Reserve(1);
+    reserved = true;
+    budget.Release(1);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(reserved);
+  budget.Release(500);
+  thread.join();
+  EXPECT_TRUE(reserved);
+}
+
+TEST_F(MemoryBudgetTest, NestedReservationDoesntWait) {
+  MemoryBudget budget(100);
+  budget.Reserve(100);
+  budget.Reserve(100);
+  EXPECT_EQ(200U, budget.reserved_bytes());
+  budget.Release(100);
+  budget.Release(100);
+  EXPECT_EQ(0U, budget.reserved_bytes());
+}
+
+TEST_F(MemoryBudgetTest, ScopedReservationUsesInstalledBudget) {
+  {
+    MemoryBudget::ScopedReservation reservation(100);
+  }
+  MemoryBudget budget(100);
+  MemoryBudget::Set(&budget);
+  {
+    MemoryBudget::ScopedReservation reservation(30);
+    EXPECT_EQ(30U, budget.reserved_bytes());
+  }
+  EXPECT_EQ(0U, budget.reserved_bytes());
+  MemoryBudget::Set(nullptr);
+}
+
+}  // namespace chromeos_update_engine
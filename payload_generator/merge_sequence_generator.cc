@@ -18,6 +18,8 @@
 
 #include <algorithm>
 #include <limits>
+#include <set>
+#include <utility>
 
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
@@ -196,114 +198,226 @@ std::unique_ptr<MergeSequenceGenerator> MergeSequenceGenerator::Create(
       new MergeSequenceGenerator(sequence, partition_name));
 }
 
-template <typename T>
-CowMergeOperation MaxOutDegree(
-    const T& nodes,
-    const std::map<CowMergeOperation, std::set<CowMergeOperation>>&
-        merge_after) {
-  // Rationale for this algorithm:
-  // We only need to remove nodes from the graph if the graph contains a cycle.
-  // Any graph of N nodes has cycle iff number of edges >= N.
-  // So, to restore the graph back to an acyclic state, we need to keep removing
-  // edges until we have <N edges left. To minimize the number of nodes removed,
-  // we always remove the node with maximum out degree.
-  CowMergeOperation best;
-  size_t max_out_degree = 0;
-  const auto has_xor =
-      std::any_of(nodes.begin(),
-                  nodes.end(),
-                  [&merge_after](const CowMergeOperation& node) {
-                    if (node.type() != CowMergeOperation::COW_XOR) {
-                      return false;
-                    }
-                    auto it = merge_after.find(node);
-                    if (it == merge_after.end()) {
-                      return false;
-                    }
-                    return it->second.size() > 0;
-                  });
-  for (const auto& op : nodes) {
-    if (has_xor && op.type() != CowMergeOperation::COW_XOR) {
+namespace {
+
+// Returns the strongly connected components of more than one node of the graph
+// of the |remaining| nodes, whose outgoing edges are in |merge_after|. These
+// are the cycles of the graph, or groups of cycles sharing nodes. Uses an
+// iterative Tarjan's algorithm, so that long chains of operations don't
+// overflow the stack.
+std::vector<std::vector<size_t>> FindCycles(
+    const std::vector<std::vector<size_t>>& merge_after,
+    const std::vector<bool>& remaining) {
+  constexpr size_t kUnvisited = std::numeric_limits<size_t>::max();
+  const size_t num_nodes = merge_after.size();
+  std::vector<size_t> index(num_nodes, kUnvisited);
+  std::vector<size_t> low_link(num_nodes);
+  std::vector<bool> on_stack(num_nodes, false);
+  std::vector<size_t> stack;
+  // The nodes being visited, with the index of their next edge to follow.
+  std::vector<std::pair<size_t, size_t>> visiting;
+  size_t next_index = 0;
+  std::vector<std::vector<size_t>> cycles;
+
+  auto visit = [&](size_t node) {
+    index[node] = low_link[node] = next_index++;
+    stack.push_back(node);
+    on_stack[node] = true;
+    visiting.emplace_back(node, 0);
+  };
+  for (size_t root = 0; root < num_nodes; root++) {
+    if (!remaining[root] || index[root] != kUnvisited)
       continue;
+    visit(root);
+    while (!visiting.empty()) {
+      const size_t node = visiting.back().first;
+      const size_t edge = visiting.back().second;
+      if (edge < merge_after[node].size()) {
+        visiting.back().second++;
+        const size_t next = merge_after[node][edge];
+        if (!remaining[next])
+          continue;
+        if (index[next] == kUnvisited) {
+          visit(next);
+        } else if (on_stack[next]) {
+          low_link[node] = std::min(low_link[node], index[next]);
+        }
+        continue;
+      }
+
+      visiting.pop_back();
+      if (!visiting.empty()) {
+        const size_t parent = visiting.back().first;
+        low_link[parent] = std::min(low_link[parent], low_link[node]);
+      }
+      if (low_link[node] != index[node])
+        continue;
+      std::vector<size_t> component;
+      size_t member;
+      do {
+        member = stack.back();
+        stack.pop_back();
+        on_stack[member] = false;
+        component.push_back(member);
+      } while (member != node);
+      if (component.size() > 1)
+        cycles.push_back(std::move(component));
     }
-    const auto out_degree = merge_after.at(op).size();
-    if (out_degree > max_out_degree) {
-      best = op;
-      max_out_degree = out_degree;
-    } else if (out_degree == max_out_degree) {
-      if (op.src_extent().num_blocks() < best.src_extent().num_blocks()) {
-        best = op;
+  }
+  return cycles;
+}
+
+// Given a potentially cyclic graph, returns the nodes to remove to break its
+// cycles. |remaining| are the nodes still in the graph, and |merge_after| is
+// an outgoing edge list. For example, |merge_after[a]| returns all nodes which
+// `a` has an out going edge to.
+// Caller will keep removing the nodes returned by this function until the
+// graph has no cycles. However, the choice of which nodes to remove can
+// greatly impact COW sizes. Nodes removed from the graph will be converted to
+// a COW_REPLACE operation, taking more disk space. As every strongly connected
+// component needs at least one node removed, one node is picked in each: the
+// one with the most edges within its component per block, so that it breaks
+// the most cycles for the fewest blocks written raw. COW_XOR operations are
+// preferred, as they already take space in the COW.
+std::vector<size_t> PickConvertToRaw(
+    const std::vector<CowMergeOperation>& operations,
+    const std::vector<std::vector<size_t>>& merge_after,
+    const std::vector<bool>& remaining) {
+  std::vector<size_t> result;
+  std::vector<bool> in_component(operations.size(), false);
+  for (auto& component : FindCycles(merge_after, remaining)) {
+    // Visit the nodes in block order, so that the choice is deterministic.
+    std::sort(component.begin(), component.end());
+    for (size_t node : component)
+      in_component[node] = true;
+    const auto has_xor = std::any_of(
+        component.begin(), component.end(), [&operations](size_t node) {
+          return operations[node].type() == CowMergeOperation::COW_XOR;
+        });
+    size_t best = 0;
+    size_t max_out_degree = 0;
+    for (size_t node : component) {
+      const auto& op = operations[node];
+      if (has_xor && op.type() != CowMergeOperation::COW_XOR)
+        continue;
+      const auto out_degree = static_cast<size_t>(
+          std::count_if(merge_after[node].begin(),
+                        merge_after[node].end(),
+                        [&in_component](size_t next) {
+                          return in_component[next];
+                        }));
+      // Compare out_degree / num_blocks with the best one's.
+      const uint64_t num_blocks = op.dst_extent().num_blocks();
+      const uint64_t best_num_blocks =
+          operations[best].dst_extent().num_blocks();
+      if (max_out_degree == 0 ||
+          out_degree * best_num_blocks > max_out_degree * num_blocks ||
+          (out_degree * best_num_blocks == max_out_degree * num_blocks &&
+           num_blocks < best_num_blocks)) {
+        best = node;
+        max_out_degree = out_degree;
       }
     }
+    // Every node of a component has an edge within it.
+    CHECK_NE(max_out_degree, 0UL);
+    result.push_back(best);
+    for (size_t node : component)
+      in_component[node] = false;
   }
-  CHECK_NE(max_out_degree, 0UL);
-  return best;
+  std::sort(result.begin(), result.end());
+  return result;
 }
 
-template <typename T>
-struct MapKeyIterator {
-  MapKeyIterator<T>& operator++() {
-    ++it;
-    return *this;
+// Returns whether |next| continues |op| in both src and dst blocks, so that
+// snapuserd can merge them in one go. The src extent of a COW_XOR operation
+// with a |src_offset| has an extra block, which |next| may read again.
+bool IsContinuation(const CowMergeOperation& op,
+                    const CowMergeOperation& next) {
+  return op.type() == next.type() &&
+         next.dst_extent().start_block() ==
+             op.dst_extent().start_block() + op.dst_extent().num_blocks() &&
+         next.src_extent().start_block() ==
+             op.src_extent().start_block() + op.dst_extent().num_blocks();
+}
+
+// Breaking the cycles one node per strongly connected component at a time
+// may convert to raw nodes whose cycles were all broken by nodes picked
+// later. Puts those back in |merge_order|, largest first, where they merge
+// after the operations which read their dst blocks and before the ones which
+// write their src blocks. The operations converted to raw don't constrain
+// the order, as their blocks are written after all the merge operations.
+void ReadmitConvertedToRaw(const std::vector<CowMergeOperation>& operations,
+                           const std::vector<std::vector<size_t>>& merge_after,
+                           std::vector<size_t>* merge_order,
+                           std::vector<size_t>* convert_to_raw) {
+  if (convert_to_raw->empty()) {
+    return;
   }
-  MapKeyIterator<T>& operator--() {
-    --it;
-    return *this;
+  constexpr size_t kNotMerged = std::numeric_limits<size_t>::max();
+  std::vector<size_t> position(operations.size(), kNotMerged);
+  for (size_t i = 0; i < merge_order->size(); i++) {
+    position[(*merge_order)[i]] = i;
   }
-  bool operator==(const MapKeyIterator<T>& rhs) const { return it == rhs.it; }
-  bool operator!=(const MapKeyIterator<T>& rhs) const { return it != rhs.it; }
-  auto&& operator->() const { return it->first; }
-  auto&& operator*() const { return it->first; }
-  T it;
-};
-
-template <typename T, typename U>
-struct MapKeyRange {
-  auto begin() const {
-    return MapKeyIterator<typename std::map<T, U>::const_iterator>{map.begin()};
+  std::vector<std::vector<size_t>> merge_before(operations.size());
+  for (size_t op = 0; op < operations.size(); op++) {
+    for (size_t blocked : merge_after[op]) {
+      merge_before[blocked].push_back(op);
+    }
   }
-  auto end() const {
-    return MapKeyIterator<typename std::map<T, U>::const_iterator>{map.end()};
+
+  std::stable_sort(convert_to_raw->begin(),
+                   convert_to_raw->end(),
+                   [&operations](size_t op1, size_t op2) {
+                     return operations[op1].dst_extent().num_blocks() >
+                            operations[op2].dst_extent().num_blocks();
+                   });
+  std::vector<size_t> still_raw;
+  for (size_t op : *convert_to_raw) {
+    // The first valid position, and one past the last.
+    size_t begin = 0;
+    size_t end = merge_order->size();
+    for (size_t reader : merge_before[op]) {
+      if (position[reader] != kNotMerged) {
+        begin = std::max(begin, position[reader] + 1);
+      }
+    }
+    for (size_t writer : merge_after[op]) {
+      if (position[writer] != kNotMerged) {
+        end = std::min(end, position[writer]);
+      }
+    }
+    if (begin > end) {
+      still_raw.push_back(op);
+      continue;
+    }
+    // Continue the run of the operation before it in dst blocks if possible.
+    size_t insert_at = begin;
+    if (op > 0 && position[op - 1] != kNotMerged &&
+        position[op - 1] + 1 >= begin && position[op - 1] + 1 <= end) {
+      insert_at = position[op - 1] + 1;
+    }
+    LOG(INFO) << "Merging operation converted to raw " << operations[op];
+    merge_order->insert(merge_order->begin() + insert_at, op);
+    for (size_t i = insert_at; i < merge_order->size(); i++) {
+      position[(*merge_order)[i]] = i;
+    }
   }
-  std::map<T, U> map;
-};
-
-CowMergeOperation MaxOutDegree(
-    const std::map<CowMergeOperation, int>& incoming_edges,
-    const std::map<CowMergeOperation, std::set<CowMergeOperation>>&
-        merge_after) {
-  return MaxOutDegree(MapKeyRange<CowMergeOperation, int>{incoming_edges},
-                      merge_after);
+  std::sort(still_raw.begin(), still_raw.end());
+  *convert_to_raw = std::move(still_raw);
 }
 
-// Given a potentially cyclic graph, return a node to remove to break cycles
-// |incoming_edges| stores nodes' in degree, and |merge_after| is an outgoing
-// edge list. For example, |merge_after[a]| returns all nodes which `a` has an
-// out going edge to.
-// The only requirement of this function is to return a node which is in
-// |incoming_edges| . As long as this is satisfied, merge sequence generation
-// will work. Caller will keep removing nodes returned by this function until
-// the graph has no cycles. However, the choice of which node to remove can
-// greatly impact COW sizes. Nodes removed from the graph will be converted to a
-// COW_REPLACE operation, taking more disk space. So this function should try to
-// pick a node which minimizes number of nodes we have to remove. (Modulo the
-// weight of each node, which is how many blocks a CowMergeOperation touches)
-CowMergeOperation PickConvertToRaw(
-    const std::map<CowMergeOperation, int>& incoming_edges,
-    const std::map<CowMergeOperation, std::set<CowMergeOperation>>&
-        merge_after) {
-  return MaxOutDegree(incoming_edges, merge_after);
-}
+}  // namespace
 
-std::map<CowMergeOperation, std::set<CowMergeOperation>>
-MergeSequenceGenerator::FindDependency(
+std::vector<std::vector<size_t>> MergeSequenceGenerator::FindDependencyIndices(
     const std::vector<CowMergeOperation>& operations) {
   LOG(INFO) << "Finding dependencies";
 
   // Since the OTA operation may reuse some source blocks, use the binary
-  // search on sorted dst extents to find overlaps.
-  std::map<CowMergeOperation, std::set<CowMergeOperation>> merge_after;
-  for (const auto& op : operations) {
+  // search on sorted dst extents to find overlaps. The dst extents don't
+  // overlap, so their end blocks are sorted too.
+  std::vector<std::vector<size_t>> merge_after(operations.size());
+  for (size_t i = 0; i < operations.size(); i++) {
+    const auto& op = operations[i];
     // lower bound (inclusive): dst extent's end block >= src extent's start
     // block.
     const auto lower_it = std::lower_bound(
@@ -326,27 +440,50 @@ MergeSequenceGenerator::FindDependency(
           return src_end_block < it.dst_extent().start_block();
         });
 
-    // TODO(xunchang) skip inserting the empty set to merge_after.
-    if (lower_it == upper_it) {
-      merge_after.insert({op, {}});
-    } else {
-      std::set<CowMergeOperation> operations(lower_it, upper_it);
-      auto it = operations.find(op);
-      if (it != operations.end()) {
+    merge_after[i].reserve(upper_it - lower_it);
+    for (auto it = lower_it; it != upper_it; it++) {
+      const size_t blocked = it - operations.begin();
+      if (blocked == i) {
         LOG(INFO) << "Self overlapping " << op;
-        operations.erase(it);
+        continue;
       }
-      auto ret = merge_after.emplace(op, std::move(operations));
-      // Check the insertion indeed happens.
-      CHECK(ret.second) << op;
+      merge_after[i].push_back(blocked);
     }
   }
 
   return merge_after;
 }
 
+std::map<CowMergeOperation, std::set<CowMergeOperation>>
+MergeSequenceGenerator::FindDependency(
+    const std::vector<CowMergeOperation>& operations) {
+  const auto merge_after_indices = FindDependencyIndices(operations);
+  std::map<CowMergeOperation, std::set<CowMergeOperation>> merge_after;
+  for (size_t i = 0; i < operations.size(); i++) {
+    std::set<CowMergeOperation> blocked_operations;
+    for (size_t blocked : merge_after_indices[i])
+      blocked_operations.insert(operations[blocked]);
+    auto ret =
+        merge_after.emplace(operations[i], std::move(blocked_operations));
+    // Check the insertion indeed happens.
+    CHECK(ret.second) << operations[i];
+  }
+  return merge_after;
+}
+
+std::map<CowMergeOperation, std::set<CowMergeOperation>>
+MergeSequenceGenerator::GetDependencyMap() const {
+  std::map<CowMergeOperation, std::set<CowMergeOperation>> merge_after;
+  for (size_t i = 0; i < operations_.size(); i++) {
+    auto& blocked_operations = merge_after[operations_[i]];
+    for (size_t blocked : merge_after_[i])
+      blocked_operations.insert(operations_[blocked]);
+  }
+  return merge_after;
+}
+
 bool MergeSequenceGenerator::Generate(
-    std::vector<CowMergeOperation>* sequence) const {
+    std::vector<CowMergeOperation>* sequence, MergeSequenceStats* stats) const {
   sequence->clear();
 
   LOG(INFO) << "Generating sequence";
@@ -354,106 +491,157 @@ bool MergeSequenceGenerator::Generate(
   // Use the non-DFS version of the topology sort. So we can control the
   // operations to discard to break cycles; thus yielding a deterministic
   // sequence.
-  std::map<CowMergeOperation, int> incoming_edges;
-  for (const auto& it : merge_after_) {
-    for (const auto& blocked : it.second) {
-      // Value is default initialized to 0.
+  const size_t num_operations = operations_.size();
+  std::vector<size_t> incoming_edges(num_operations, 0);
+  for (const auto& blocked_operations : merge_after_) {
+    for (size_t blocked : blocked_operations) {
       incoming_edges[blocked] += 1;
     }
   }
 
-  // Technically, we can use std::unordered_set or just a std::vector. but
-  // std::set gives the benefit where operations are sorted by dst blocks. This
-  // will ensure that operations that do not have dependency constraints appear
-  // in increasing block order. Such order would help snapuserd batch merges and
-  // improve boot time, but isn't strictly needed for correctness.
-  std::set<CowMergeOperation> free_operations;
-  for (const auto& op : operations_) {
-    if (incoming_edges.find(op) == incoming_edges.end()) {
-      free_operations.insert(op);
+  // The free operations are kept sorted by dst blocks, like |operations_|.
+  // The next operation merged is the first free one after the previous one,
+  // sweeping the blocks in increasing order and starting over at the end, so
+  // that runs of contiguous operations stay together even when operations
+  // before them get freed. This order helps snapuserd batch merges and
+  // improves boot time, but isn't strictly needed for correctness.
+  std::set<size_t> free_operations;
+  for (size_t i = 0; i < num_operations; i++) {
+    if (incoming_edges[i] == 0) {
+      free_operations.insert(i);
     }
   }
 
-  std::vector<CowMergeOperation> merge_sequence;
-  std::set<CowMergeOperation> convert_to_raw;
-  while (!incoming_edges.empty()) {
-    if (!free_operations.empty()) {
-      merge_sequence.insert(
-          merge_sequence.end(), free_operations.begin(), free_operations.end());
-    } else {
-      auto to_convert = PickConvertToRaw(incoming_edges, merge_after_);
-      // The operation we pick must be one of the nodes not already in merge
-      // sequence.
-      CHECK(incoming_edges.find(to_convert) != incoming_edges.end());
-
-      free_operations.insert(to_convert);
-      convert_to_raw.insert(to_convert);
-      LOG(INFO) << "Converting operation to raw " << to_convert;
+  std::vector<bool> remaining(num_operations, true);
+  size_t num_remaining = num_operations;
+  auto remove_operation = [&](size_t op) {
+    remaining[op] = false;
+    num_remaining--;
+    // Now that this particular operation is merged, other operations blocked
+    // by this one may be free.
+    for (size_t blocked : merge_after_[op]) {
+      if (!remaining[blocked]) {
+        continue;
+      }
+      if (incoming_edges[blocked] == 0) {
+        LOG(ERROR) << "Unexpected count in merge after map";
+        return false;
+      }
+      if (--incoming_edges[blocked] == 0) {
+        free_operations.insert(blocked);
+      }
     }
-
-    std::set<CowMergeOperation> next_free_operations;
-    for (const auto& op : free_operations) {
-      incoming_edges.erase(op);
-
-      // Now that this particular operation is merged, other operations
-      // blocked by this one may be free. Decrement the count of blocking
-      // operations, and set up the free operations for the next iteration.
-      for (const auto& blocked : merge_after_.at(op)) {
-        auto it = incoming_edges.find(blocked);
-        if (it == incoming_edges.end()) {
-          continue;
-        }
-
-        auto blocking_transfer_count = &it->second;
-        if (*blocking_transfer_count <= 0) {
-          LOG(ERROR) << "Unexpected count in merge after map "
-                     << blocking_transfer_count;
-          return false;
-        }
-        // This operation is no longer blocked by anyone. Add it to the merge
-        // sequence in the next iteration.
-        *blocking_transfer_count -= 1;
-        if (*blocking_transfer_count == 0) {
-          next_free_operations.insert(blocked);
-        }
+    return true;
+  };
+
+  std::vector<size_t> merge_order;
+  std::vector<size_t> convert_to_raw;
+  while (num_remaining > 0) {
+    if (free_operations.empty()) {
+      const auto picked =
+          PickConvertToRaw(operations_, merge_after_, remaining);
+      // Every remaining operation is blocked, so there is a cycle.
+      CHECK(!picked.empty());
+      for (size_t op : picked) {
+        convert_to_raw.push_back(op);
+        LOG(INFO) << "Converting operation to raw " << operations_[op];
+        TEST_AND_RETURN_FALSE(remove_operation(op));
       }
+      continue;
     }
-
-    LOG(INFO) << "Remaining transfers " << incoming_edges.size()
-              << ", free transfers " << free_operations.size()
-              << ", merge_sequence size " << merge_sequence.size();
-    free_operations = std::move(next_free_operations);
-  }
-
-  if (!free_operations.empty()) {
-    merge_sequence.insert(
-        merge_sequence.end(), free_operations.begin(), free_operations.end());
+    size_t op = *free_operations.begin();
+    if (!merge_order.empty()) {
+      const auto next = free_operations.upper_bound(merge_order.back());
+      if (next != free_operations.end()) {
+        op = *next;
+      }
+    }
+    free_operations.erase(op);
+    merge_order.push_back(op);
+    TEST_AND_RETURN_FALSE(remove_operation(op));
   }
 
-  CHECK_EQ(operations_.size(), merge_sequence.size() + convert_to_raw.size());
+  CHECK_EQ(operations_.size(), merge_order.size() + convert_to_raw.size());
+  ReadmitConvertedToRaw(operations_, merge_after_, &merge_order,
+                        &convert_to_raw);
 
-  size_t blocks_in_sequence = 0;
-  for (const CowMergeOperation& transfer : merge_sequence) {
-    blocks_in_sequence += transfer.dst_extent().num_blocks();
+  std::vector<CowMergeOperation> merge_sequence;
+  merge_sequence.reserve(merge_order.size());
+  for (size_t op : merge_order) {
+    merge_sequence.push_back(operations_[op]);
   }
+  const size_t uncoalesced_size = merge_sequence.size();
+  CoalesceSequence(&merge_sequence);
 
-  size_t blocks_in_raw = 0;
-  for (const CowMergeOperation& transfer : convert_to_raw) {
-    blocks_in_raw += transfer.dst_extent().num_blocks();
+  uint64_t blocks_in_raw = 0;
+  for (size_t transfer : convert_to_raw) {
+    blocks_in_raw += operations_[transfer].dst_extent().num_blocks();
   }
-
-  LOG(INFO) << "Blocks in merge sequence " << blocks_in_sequence
-            << ", blocks in raw " << blocks_in_raw << ", partition "
-            << partition_name_;
+  const MergeSequenceStats sequence_stats =
+      GetStats(merge_sequence, blocks_in_raw);
+
+  LOG(INFO) << "Blocks in merge sequence " << sequence_stats.blocks_in_sequence
+            << ", blocks in raw " << sequence_stats.blocks_in_raw
+            << ", operations " << sequence_stats.num_operations << " (from "
+            << uncoalesced_size << "), sequential runs "
+            << sequence_stats.num_runs << ", partition " << partition_name_;
   if (!ValidateSequence(merge_sequence)) {
     LOG(ERROR) << "Invalid Sequence";
     return false;
   }
 
   *sequence = std::move(merge_sequence);
+  if (stats) {
+    *stats = sequence_stats;
+  }
   return true;
 }
 
+void MergeSequenceGenerator::CoalesceSequence(
+    std::vector<CowMergeOperation>* sequence) {
+  if (sequence->empty()) {
+    return;
+  }
+  size_t last = 0;
+  for (size_t i = 1; i < sequence->size(); i++) {
+    auto& previous = (*sequence)[last];
+    const auto& op = (*sequence)[i];
+    if (previous.type() == CowMergeOperation::COW_COPY &&
+        IsContinuation(previous, op)) {
+      // The src and dst of the coalesced operation are |distance| blocks
+      // apart, so it overlaps itself unless it is an in place copy.
+      const uint64_t num_blocks =
+          previous.dst_extent().num_blocks() + op.dst_extent().num_blocks();
+      const uint64_t distance =
+          GetDifference(previous.src_extent().start_block(),
+                        previous.dst_extent().start_block());
+      if (distance == 0 || distance >= num_blocks) {
+        previous.mutable_src_extent()->set_num_blocks(num_blocks);
+        previous.mutable_dst_extent()->set_num_blocks(num_blocks);
+        continue;
+      }
+    }
+    if (++last != i) {
+      (*sequence)[last] = op;
+    }
+  }
+  sequence->resize(last + 1);
+}
+
+MergeSequenceStats MergeSequenceGenerator::GetStats(
+    const std::vector<CowMergeOperation>& sequence, uint64_t blocks_in_raw) {
+  MergeSequenceStats stats;
+  stats.num_operations = sequence.size();
+  stats.blocks_in_raw = blocks_in_raw;
+  for (size_t i = 0; i < sequence.size(); i++) {
+    stats.blocks_in_sequence += sequence[i].dst_extent().num_blocks();
+    if (i == 0 || !IsContinuation(sequence[i - 1], sequence[i])) {
+      stats.num_runs++;
+    }
+  }
+  return stats;
+}
+
 bool MergeSequenceGenerator::ValidateSequence(
     const std::vector<CowMergeOperation>& sequence) {
   LOG(INFO) << "Validating merge sequence";
@@ -51,6 +51,16 @@ T&& Sort(T&& container) {
   return container;
 }
 
+// Statistics of a merge sequence. snapuserd merges a run of operations which
+// are contiguous in both their source and destination blocks in one go, so
+// fewer runs and fewer blocks converted to raw make for faster merges.
+struct MergeSequenceStats {
+  size_t num_operations = 0;
+  size_t num_runs = 0;
+  uint64_t blocks_in_sequence = 0;
+  uint64_t blocks_in_raw = 0;
+};
+
 class MergeSequenceGenerator {
  public:
   // Creates an object from a list of OTA InstallOperations. Returns nullptr
@@ -61,22 +71,33 @@ class MergeSequenceGenerator {
   explicit MergeSequenceGenerator(std::vector<CowMergeOperation> transfers,
                                   std::string_view partition_name)
       : operations_(std::move(Sort(transfers))),
-        merge_after_(FindDependency(operations_)),
+        merge_after_(FindDependencyIndices(operations_)),
         partition_name_(partition_name) {}
   // Checks that no read after write happens in the given sequence.
   static bool ValidateSequence(const std::vector<CowMergeOperation>& sequence);
 
   // Generates a merge sequence from |operations_|, puts the result in
-  // |sequence|. Returns false on failure.
-  bool Generate(std::vector<CowMergeOperation>* sequence) const;
+  // |sequence| and its statistics in |stats| if not null. The sequence keeps
+  // runs of contiguous operations together and coalesces the COW_COPY ones.
+  // Returns false on failure.
+  bool Generate(std::vector<CowMergeOperation>* sequence,
+                MergeSequenceStats* stats = nullptr) const;
+
+  // Merges the adjacent COW_COPY operations of |sequence| which are
+  // contiguous in both source and destination, unless the result would
+  // overlap itself.
+  static void CoalesceSequence(std::vector<CowMergeOperation>* sequence);
+
+  // Returns the statistics of |sequence|, with |blocks_in_raw| blocks
+  // converted to raw.
+  static MergeSequenceStats GetStats(
+      const std::vector<CowMergeOperation>& sequence, uint64_t blocks_in_raw);
 
   const std::vector<CowMergeOperation>& GetOperations() const {
     return operations_;
   }
-  const std::map<CowMergeOperation, std::set<CowMergeOperation>>&
-  GetDependencyMap() const {
-    return merge_after_;
-  }
+  std::map<CowMergeOperation, std::set<CowMergeOperation>> GetDependencyMap()
+      const;
 
  private:
   friend class MergeSequenceGeneratorTest;
@@ -85,9 +106,15 @@ class MergeSequenceGenerator {
   // after myself. Put the result in |merge_after|. |operations| must be sorted
   static std::map<CowMergeOperation, std::set<CowMergeOperation>>
   FindDependency(const std::vector<CowMergeOperation>& operations);
+  // Same, with the operations as indices in |operations|, which are cheaper
+  // to store and compare than the CowMergeOperations for large partitions.
+  static std::vector<std::vector<size_t>> FindDependencyIndices(
+      const std::vector<CowMergeOperation>& operations);
   // The list of CowMergeOperations to sort.
   const std::vector<CowMergeOperation> operations_;
-  const std::map<CowMergeOperation, std::set<CowMergeOperation>> merge_after_;
+  // The indices of the operations that should merge after each operation of
+  // |operations_|.
+  const std::vector<std::vector<size_t>> merge_after_;
   const std::string_view partition_name_;
 };
 
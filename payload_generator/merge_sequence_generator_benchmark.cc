@@ -0,0 +1,109 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Measures MergeSequenceGenerator on synthetic merge operations of a VABC
+// partition: copies of blocks moved around the partition, with many cycles
+// to break, and disjoint swaps of extents, each a cycle of its own.
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <base/logging.h>
+#include <benchmark/benchmark.h>
+
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/merge_sequence_generator.h"
+#include "update_engine/update_metadata.pb.h"
+
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// |num_operations| extents of 1 to 8 blocks laid out after each other, mostly
+// copied from close by with a few copied from anywhere in the partition, as
+// files shifted by the changes before them would be.
+vector<CowMergeOperation> MovedExtents(size_t num_operations) {
+  std::mt19937 gen(num_operations);
+  vector<Extent> dst_extents;
+  uint64_t num_blocks = 0;
+  for (size_t i = 0; i < num_operations; i++) {
+    const uint64_t extent_blocks = 1 + gen() % 8;
+    dst_extents.push_back(ExtentForRange(num_blocks, extent_blocks));
+    num_blocks += extent_blocks;
+  }
+  vector<CowMergeOperation> operations;
+  for (size_t i = 0; i < num_operations; i++) {
+    const size_t src =
+        gen() % 4 == 0 ? gen() % num_operations
+                       : std::min(num_operations - 1, i + gen() % 3);
+    const uint64_t extent_blocks = dst_extents[i].num_blocks();
+    const uint64_t src_start = std::min(dst_extents[src].start_block(),
+                                        num_blocks - extent_blocks);
+    operations.push_back(
+        CreateCowMergeOperation(ExtentForRange(src_start, extent_blocks),
+                                dst_extents[i],
+                                gen() % 10 == 0 ? CowMergeOperation::COW_XOR
+                                                : CowMergeOperation::COW_COPY));
+  }
+  return operations;
+}
+
+// |num_operations| / 2 pairs of adjacent extents swapped with each other.
+vector<CowMergeOperation> SwappedExtents(size_t num_operations) {
+  vector<CowMergeOperation> operations;
+  for (uint64_t i = 0; i < num_operations / 2; i++) {
+    operations.push_back(
+        CreateCowMergeOperation(ExtentForRange(4 * i + 2, 2),
+                                ExtentForRange(4 * i, 2),
+                                CowMergeOperation::COW_COPY));
+    operations.push_back(
+        CreateCowMergeOperation(ExtentForRange(4 * i, 2),
+                                ExtentForRange(4 * i + 2, 2),
+                                CowMergeOperation::COW_COPY));
+  }
+  return operations;
+}
+
+void BM_Generate(benchmark::State& state,
+                 vector<CowMergeOperation> (*operations_generator)(size_t)) {
+  const vector<CowMergeOperation> operations =
+      operations_generator(state.range(0));
+  for (auto _ : state) {
+    MergeSequenceGenerator generator(operations, "");
+    vector<CowMergeOperation> sequence;
+    CHECK(generator.Generate(&sequence));
+    benchmark::DoNotOptimize(sequence);
+  }
+  state.SetItemsProcessed(state.iterations() * operations.size());
+}
+
+BENCHMARK_CAPTURE(BM_Generate, MovedExtents, MovedExtents)
+    ->RangeMultiplier(8)
+    ->Range(1 << 10, 1 << 19)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Generate, SwappedExtents, SwappedExtents)
+    ->RangeMultiplier(8)
+    ->Range(1 << 10, 1 << 19)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+}  // namespace chromeos_update_engine
+
+BENCHMARK_MAIN();
@@ -206,6 +206,103 @@ TEST_F(MergeSequenceGeneratorTest, GenerateSequenceMultipleCycles) {
   GenerateSequence(transfers);
 }
 
+TEST_F(MergeSequenceGeneratorTest, GenerateSequenceConvertsFewestBlocks) {
+  std::vector<CowMergeOperation> transfers = {
+      // A cycle of 10 and 1 blocks, in which the 10 block operation also
+      // blocks an operation out of the cycle.
+      CreateCowMergeOperation(ExtentForRange(20, 10), ExtentForRange(0, 10)),
+      CreateCowMergeOperation(ExtentForRange(5, 1), ExtentForRange(20, 1)),
+      CreateCowMergeOperation(ExtentForRange(100, 1), ExtentForRange(25, 1)),
+  };
+  std::sort(transfers.begin(), transfers.end());
+  MergeSequenceGenerator generator(transfers, "");
+  std::vector<CowMergeOperation> sequence;
+  ASSERT_TRUE(generator.Generate(&sequence));
+  // Only the 1 block operation is converted to raw.
+  std::vector<CowMergeOperation> expected = {
+      CreateCowMergeOperation(ExtentForRange(20, 10), ExtentForRange(0, 10)),
+      CreateCowMergeOperation(ExtentForRange(100, 1), ExtentForRange(25, 1)),
+  };
+  ASSERT_EQ(expected, sequence);
+}
+
+TEST_F(MergeSequenceGeneratorTest, GenerateSequenceKeepsRunsTogether) {
+  std::vector<CowMergeOperation> transfers = {
+      CreateCowMergeOperation(ExtentForRange(100, 5), ExtentForRange(0, 5)),
+      // Must merge before the first operation, and is continued by the next
+      // one, which is free too.
+      CreateCowMergeOperation(ExtentForRange(0, 5), ExtentForRange(10, 5)),
+      CreateCowMergeOperation(ExtentForRange(5, 5), ExtentForRange(15, 5)),
+  };
+  std::sort(transfers.begin(), transfers.end());
+  MergeSequenceGenerator generator(transfers, "");
+  std::vector<CowMergeOperation> sequence;
+  MergeSequenceStats stats;
+  ASSERT_TRUE(generator.Generate(&sequence, &stats));
+  // The run is kept together and coalesced.
+  std::vector<CowMergeOperation> expected = {
+      CreateCowMergeOperation(ExtentForRange(0, 10), ExtentForRange(10, 10)),
+      CreateCowMergeOperation(ExtentForRange(100, 5), ExtentForRange(0, 5)),
+  };
+  ASSERT_EQ(expected, sequence);
+  ASSERT_EQ(stats.num_operations, 2UL);
+  ASSERT_EQ(stats.num_runs, 2UL);
+  ASSERT_EQ(stats.blocks_in_sequence, 15UL);
+  ASSERT_EQ(stats.blocks_in_raw, 0UL);
+}
+
+TEST_F(MergeSequenceGeneratorTest, CoalesceSequence) {
+  std::vector<CowMergeOperation> sequence = {
+      CreateCowMergeOperation(ExtentForRange(20, 5), ExtentForRange(0, 5)),
+      CreateCowMergeOperation(ExtentForRange(25, 5), ExtentForRange(5, 5)),
+      // Would overlap itself once coalesced.
+      CreateCowMergeOperation(ExtentForRange(30, 15), ExtentForRange(10, 15)),
+      // XOR operations are kept as they are.
+      CreateCowMergeOperation(ExtentForRange(60, 5),
+                              ExtentForRange(50, 5),
+                              CowMergeOperation::COW_XOR),
+      CreateCowMergeOperation(ExtentForRange(65, 5),
+                              ExtentForRange(55, 5),
+                              CowMergeOperation::COW_XOR),
+  };
+  MergeSequenceGenerator::CoalesceSequence(&sequence);
+  std::vector<CowMergeOperation> expected = {
+      CreateCowMergeOperation(ExtentForRange(20, 10), ExtentForRange(0, 10)),
+      CreateCowMergeOperation(ExtentForRange(30, 15), ExtentForRange(10, 15)),
+      CreateCowMergeOperation(ExtentForRange(60, 5),
+                              ExtentForRange(50, 5),
+                              CowMergeOperation::COW_XOR),
+      CreateCowMergeOperation(ExtentForRange(65, 5),
+                              ExtentForRange(55, 5),
+                              CowMergeOperation::COW_XOR),
+  };
+  ASSERT_EQ(expected, sequence);
+  ASSERT_TRUE(MergeSequenceGenerator::ValidateSequence(sequence));
+  const auto stats = MergeSequenceGenerator::GetStats(sequence, 0);
+  ASSERT_EQ(stats.num_operations, 4UL);
+  ASSERT_EQ(stats.num_runs, 2UL);
+}
+
+TEST_F(MergeSequenceGeneratorTest, GenerateSequenceReadmitsConvertedToRaw) {
+  std::vector<CowMergeOperation> transfers = {
+      // The XOR operation is converted to raw first to break the cycles, then
+      // the 2 block operation to break the one left, which was enough.
+      CreateCowMergeOperation(ExtentForRange(20, 10),
+                              ExtentForRange(0, 10),
+                              CowMergeOperation::COW_XOR),
+      CreateCowMergeOperation(ExtentForRange(21, 10), ExtentForRange(10, 10)),
+      CreateCowMergeOperation(ExtentForRange(9, 2), ExtentForRange(20, 2)),
+  };
+  std::sort(transfers.begin(), transfers.end());
+  MergeSequenceGenerator generator(transfers, "");
+  std::vector<CowMergeOperation> sequence;
+  MergeSequenceStats stats;
+  ASSERT_TRUE(generator.Generate(&sequence, &stats));
+  std::vector<CowMergeOperation> expected = {transfers[0], transfers[1]};
+  ASSERT_EQ(expected, sequence);
+  ASSERT_EQ(stats.blocks_in_raw, 2UL);
+}
+
 void ValidateSplitSequence(const Extent& src_extent, const Extent& dst_extent) {
   std::vector<CowMergeOperation> sequence;
   SplitSelfOverlapping(src_extent, dst_extent, &sequence);
@@ -0,0 +1,683 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/payload_checker.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <utility>
+
+#include <base/files/file_path.h>
+#include <base/files/memory_mapped_file.h>
+#include <base/logging.h>
+#include <base/strings/stringprintf.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/extent_writer.h"
+#include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_consumer/file_descriptor_utils.h"
+#include "update_engine/payload_consumer/install_operation_executor.h"
+#include "update_engine/payload_consumer/install_plan.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_consumer/payload_metadata.h"
+#include "update_engine/payload_consumer/verity_writer_android.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/payload_signer.h"
+#include "update_engine/payload_generator/task_pool.h"
+
+using base::StringPrintf;
+using google::protobuf::RepeatedPtrField;
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The data of the operations is hashed in tasks of about this many bytes.
+constexpr uint64_t kHashTaskSize = 64 * 1024 * 1024;
+
+// The size of the reads computing the verity data of an applied partition.
+constexpr size_t kVerityBufferSize = 512 * 1024;
+
+using ErrorCallback = std::function<void(const string&)>;
+
+string OperationName(const PartitionUpdate& partition, int index) {
+  return StringPrintf(
+      "%s operation %d (%s)",
+      partition.partition_name().c_str(),
+      index,
+      InstallOperationTypeName(partition.operations(index).type()));
+}
+
+// Checks that the |kind| |extents| of an operation are within |num_blocks|
+// blocks and adds their blocks to |total_blocks|.
+void CheckExtents(const char* kind,
+                  const RepeatedPtrField<Extent>& extents,
+                  uint64_t num_blocks,
+                  uint64_t* total_blocks,
+                  const ErrorCallback& error) {
+  for (int i = 0; i < extents.size(); i++) {
+    const Extent& extent = extents[i];
+    if (extent.num_blocks() == 0) {
+      error(StringPrintf("%s extent %d is empty.", kind, i));
+    } else if (extent.start_block() > num_blocks ||
+               extent.num_blocks() > num_blocks - extent.start_block()) {
+      error(StringPrintf("%s extent %d (%" PRIu64 ", %" PRIu64
+                         ") ends beyond the %" PRIu64 " blocks.",
+                         kind,
+                         i,
+                         extent.start_block(),
+                         extent.num_blocks(),
+                         num_blocks));
+    }
+    *total_blocks += extent.num_blocks();
+  }
+}
+
+bool ExtentsContain(std::initializer_list<const Extent*> extents,
+                    uint64_t block) {
+  return std::any_of(extents.begin(), extents.end(), [block](auto* extent) {
+    return block >= extent->start_block() &&
+           block - extent->start_block() < extent->num_blocks();
+  });
+}
+
+// The file descriptors and the executor of a thread applying operations.
+struct OperationWorker {
+  FileDescriptorPtr target_fd;
+  FileDescriptorPtr source_fd;
+  InstallOperationExecutor executor;
+};
+
+// Applies |op| with its |data|, on a target whose blocks not written yet read
+// as zeros.
+bool ApplyOperation(const InstallOperation& op,
+                    const uint8_t* data,
+                    size_t block_size,
+                    OperationWorker* worker) {
+  if (op.has_src_sha256_hash()) {
+    brillo::Blob hash;
+    TEST_AND_RETURN_FALSE(fd_utils::ReadAndHashExtents(
+        op.type() == InstallOperation::TARGET_COPY ? worker->target_fd
+                                                   : worker->source_fd,
+        op.src_extents(),
+        block_size,
+        &hash));
+    TEST_AND_RETURN_FALSE(ToStringView(hash) == op.src_sha256_hash());
+  }
+  auto writer = std::make_unique<DirectExtentWriter>(worker->target_fd);
+  InstallOperationExecutor& executor = worker->executor;
+  switch (op.type()) {
+    case InstallOperation::ZERO:
+    case InstallOperation::DISCARD:
+      return true;
+    case InstallOperation::REPLACE:
+    case InstallOperation::REPLACE_BZ:
+    case InstallOperation::REPLACE_XZ:
+    case InstallOperation::REPLACE_ZSTD:
+      return executor.ExecuteReplaceOperation(op, std::move(writer), data);
+    case InstallOperation::SOURCE_COPY:
+      return executor.ExecuteSourceCopyOperation(
+          op, std::move(writer), worker->source_fd);
+    case InstallOperation::TARGET_COPY:
+      return executor.ExecuteSourceCopyOperation(
+          op, std::move(writer), worker->target_fd);
+    default:
+      return executor.ExecuteDiffOperation(
+          op, std::move(writer), worker->source_fd, data, op.data_length());
+  }
+}
+
+// Computes the hash tree and FEC data of |partition| into |fd|, like the
+// clients do after applying the operations.
+bool WriteVerity(const PartitionUpdate& partition,
+                 size_t block_size,
+                 const FileDescriptorPtr& fd) {
+  if (partition.hash_tree_extent().num_blocks() == 0 &&
+      partition.fec_extent().num_blocks() == 0) {
+    return true;
+  }
+  InstallPlan::Partition install_part;
+  install_part.block_size = block_size;
+  TEST_AND_RETURN_FALSE(install_part.ParseVerityConfig(partition));
+  VerityWriterAndroid writer;
+  TEST_AND_RETURN_FALSE(writer.Init(install_part));
+  brillo::Blob buffer(kVerityBufferSize);
+  const uint64_t data_size =
+      install_part.hash_tree_data_offset + install_part.hash_tree_data_size;
+  for (uint64_t offset = 0; offset < data_size;) {
+    const size_t size = std::min<uint64_t>(buffer.size(), data_size - offset);
+    ssize_t bytes_read = 0;
+    TEST_AND_RETURN_FALSE(
+        utils::ReadAll(fd, buffer.data(), size, offset, &bytes_read));
+    TEST_AND_RETURN_FALSE(static_cast<size_t>(bytes_read) == size);
+    TEST_AND_RETURN_FALSE(writer.Update(offset, buffer.data(), size));
+    offset += size;
+  }
+  return writer.Finalize(fd.get(), fd.get());
+}
+
+}  // namespace
+
+bool PayloadChecker::Check(const string& payload_path, vector<string>* errors) {
+  errors_.clear();
+  partitions_.clear();
+  base::MemoryMappedFile payload;
+  if (!payload.Initialize(base::FilePath(payload_path))) {
+    *errors = {"Failed to read " + payload_path};
+    return false;
+  }
+  payload_ = payload.data();
+  payload_size_ = payload.length();
+  PayloadMetadata metadata;
+  ErrorCode error;
+  if (metadata.ParsePayloadHeader(payload_, payload_size_, &error) !=
+          MetadataParseResult::kSuccess ||
+      payload_size_ <
+          metadata.GetMetadataSize() + metadata.GetMetadataSignatureSize() ||
+      !metadata.GetManifest(payload_, payload_size_, &manifest_) ||
+      manifest_.block_size() == 0) {
+    *errors = {"The payload header or manifest is invalid."};
+    return false;
+  }
+  metadata_size_ = metadata.GetMetadataSize();
+  metadata_signature_size_ = metadata.GetMetadataSignatureSize();
+  data_begin_ = metadata_size_ + metadata_signature_size_;
+  version_ = PayloadVersion(metadata.GetMajorVersion(),
+                            manifest_.minor_version());
+  is_delta_ = std::any_of(manifest_.partitions().begin(),
+                          manifest_.partitions().end(),
+                          [](const PartitionUpdate& partition) {
+                            return partition.has_old_partition_info();
+                          });
+  if (is_delta_ ? version_.minor == kFullPayloadMinorVersion ||
+                      version_.minor > kMaxSupportedMinorPayloadVersion
+                : version_.minor != kFullPayloadMinorVersion) {
+    AddError(StringPrintf("Minor version %u is invalid for a %s payload.",
+                          version_.minor,
+                          is_delta_ ? "delta" : "full"));
+  }
+
+  const size_t num_threads = options_.num_threads > 0
+                                 ? options_.num_threads
+                                 : diff_utils::GetMaxThreads();
+  std::unique_ptr<TaskPool> task_pool;
+  if (TaskPool::Get() == nullptr) {
+    task_pool = std::make_unique<TaskPool>(num_threads);
+    TaskPool::Set(task_pool.get());
+  }
+  DEFER {
+    if (task_pool) {
+      TaskPool::Set(nullptr);
+    }
+  };
+
+  // Check the operations of every partition, loading them from their segment
+  // if needed.
+  partitions_.assign(manifest_.partitions().begin(),
+                     manifest_.partitions().end());
+  vector<TaskPool::Task> tasks;
+  for (PartitionUpdate& partition : partitions_) {
+    tasks.push_back([this, &partition] {
+      if (partition.has_operations_segment()) {
+        const OperationsSegment& segment = partition.operations_segment();
+        const uint64_t offset = data_begin_ + segment.data_offset();
+        if (offset > payload_size_ ||
+            segment.data_length() > payload_size_ - offset ||
+            !PayloadMetadata::ParseOperationsSegment(
+                payload_ + offset, segment.data_length(), &partition)) {
+          AddError(partition.partition_name() +
+                   ": the operations segment is invalid.");
+          return;
+        }
+      }
+      CheckOperations(partition);
+    });
+  }
+  TaskPool::RunTasks(std::move(tasks), num_threads);
+
+  CheckDataLayout();
+
+  // Hash the data of the operations in tasks of similar sizes, and the whole
+  // payload for the signatures alongside.
+  tasks.clear();
+  tasks.push_back([this, &payload_path] { CheckSignatures(payload_path); });
+  for (const PartitionUpdate& partition : partitions_) {
+    uint64_t size = 0;
+    int begin = 0;
+    for (int i = 0; i < partition.operations_size(); i++) {
+      size += partition.operations(i).data_length();
+      if (size >= kHashTaskSize || i + 1 == partition.operations_size()) {
+        tasks.push_back([this, &partition, begin, end = i + 1] {
+          CheckDataHashes(partition, begin, end);
+        });
+        begin = i + 1;
+        size = 0;
+      }
+    }
+  }
+  TaskPool::RunTasks(std::move(tasks), num_threads);
+
+  if (options_.apply) {
+    if (errors_.empty()) {
+      // The partitions are applied at once, each of them on all the threads,
+      // which the pool shares between them.
+      tasks.clear();
+      for (const PartitionUpdate& partition : partitions_) {
+        tasks.push_back([this, &partition, num_threads] {
+          ApplyPartition(partition, num_threads);
+        });
+      }
+      TaskPool::RunTasks(std::move(tasks), num_threads);
+    } else {
+      LOG(WARNING) << "Not applying the invalid payload.";
+    }
+  }
+
+  // The checks run in parallel, sort their errors to report them the same
+  // way every time.
+  std::sort(errors_.begin(), errors_.end());
+  *errors = std::move(errors_);
+  errors_.clear();
+  payload_ = nullptr;
+  return errors->empty();
+}
+
+void PayloadChecker::CheckOperations(const PartitionUpdate& partition) {
+  const string& name = partition.partition_name();
+  const uint64_t block_size = manifest_.block_size();
+  const uint64_t new_blocks =
+      utils::DivRoundUp(partition.new_partition_info().size(), block_size);
+  const uint64_t old_blocks =
+      utils::DivRoundUp(partition.old_partition_info().size(), block_size);
+  if (partition.new_partition_info().hash().size() != kSHA256Size) {
+    AddError(name + ": the new partition has no hash.");
+  }
+  if (partition.has_old_partition_info() &&
+      partition.old_partition_info().hash().size() != kSHA256Size) {
+    AddError(name + ": the old partition has no hash.");
+  }
+
+  vector<bool> written(new_blocks);
+  for (int i = 0; i < partition.operations_size(); i++) {
+    const InstallOperation& op = partition.operations(i);
+    const string op_name = OperationName(partition, i);
+    const ErrorCallback error = [this, &op_name](const string& message) {
+      AddError(op_name + ": " + message);
+    };
+    if (!version_.OperationAllowed(op.type())) {
+      error(StringPrintf("not allowed in minor version %u.", version_.minor));
+    }
+    if (op.has_data_offset() != op.has_data_length()) {
+      error("the data offset and length must be set together.");
+    }
+    if (op.dst_extents().empty()) {
+      error("no dst extents.");
+    }
+    uint64_t dst_blocks = 0;
+    uint64_t src_blocks = 0;
+    CheckExtents("dst", op.dst_extents(), new_blocks, &dst_blocks, error);
+    CheckExtents("src",
+                 op.src_extents(),
+                 op.type() == InstallOperation::TARGET_COPY ? new_blocks
+                                                            : old_blocks,
+                 &src_blocks,
+                 error);
+    for (const Extent& extent : op.dst_extents()) {
+      const uint64_t end =
+          std::min(extent.start_block() + extent.num_blocks(), new_blocks);
+      for (uint64_t block = extent.start_block(); block < end; block++) {
+        if (written[block]) {
+          error(StringPrintf("block %" PRIu64 " is written more than once.",
+                             block));
+          break;
+        }
+        written[block] = true;
+      }
+    }
+
+    const uint64_t dst_size = dst_blocks * block_size;
+    const uint64_t data_length = op.data_length();
+    switch (op.type()) {
+      case InstallOperation::REPLACE:
+      case InstallOperation::REPLACE_BZ:
+      case InstallOperation::REPLACE_XZ:
+      case InstallOperation::REPLACE_ZSTD:
+        // Compressing the data must pay off.
+        if (op.type() == InstallOperation::REPLACE
+                ? data_length != dst_size
+                : data_length == 0 || data_length >= dst_size) {
+          error(StringPrintf("%" PRIu64 " bytes of data for %" PRIu64
+                             " dst bytes.",
+                             data_length,
+                             dst_size));
+        }
+        break;
+      case InstallOperation::ZERO:
+      case InstallOperation::DISCARD:
+      case InstallOperation::SOURCE_COPY:
+      case InstallOperation::TARGET_COPY:
+        if (op.has_data_offset() || data_length > 0) {
+          error("unexpected data.");
+        }
+        if (!diff_utils::IsNoSourceOperation(op.type()) &&
+            src_blocks != dst_blocks) {
+          error(StringPrintf("copies %" PRIu64 " src blocks to %" PRIu64
+                             " dst blocks.",
+                             src_blocks,
+                             dst_blocks));
+        }
+        break;
+      default:
+        if (data_length == 0 || data_length >= dst_size) {
+          error(StringPrintf("%" PRIu64 " bytes of patch for %" PRIu64
+                             " dst bytes.",
+                             data_length,
+                             dst_size));
+        }
+        break;
+    }
+    if (diff_utils::IsNoSourceOperation(op.type())) {
+      if (!op.src_extents().empty()) {
+        error("unexpected src extents.");
+      }
+    } else if (op.type() != InstallOperation::TARGET_COPY) {
+      if (src_blocks == 0) {
+        error("no src extents.");
+      }
+      if (version_.minor >= kOpSrcHashMinorPayloadVersion &&
+          op.src_sha256_hash().size() != kSHA256Size) {
+        error("no src hash.");
+      }
+    }
+  }
+
+  // Full payloads write every block, except for the verity data the clients
+  // compute.
+  if (!is_delta_) {
+    const Extent none;
+    const Extent& hash_tree = partition.hash_tree_in_payload()
+                                  ? none
+                                  : partition.hash_tree_extent();
+    const Extent& fec =
+        partition.fec_in_payload() ? none : partition.fec_extent();
+    uint64_t missing = 0;
+    for (uint64_t block = 0; block < new_blocks; block++) {
+      if (!written[block] && !ExtentsContain({&hash_tree, &fec}, block)) {
+        missing++;
+      }
+    }
+    if (missing > 0) {
+      AddError(StringPrintf("%s: %" PRIu64 " blocks are never written.",
+                            name.c_str(),
+                            missing));
+    }
+  }
+}
+
+void PayloadChecker::CheckDataLayout() {
+  // The offset and length of the blobs, which the operations may point back
+  // to when the payload shares them.
+  std::map<uint64_t, uint64_t> blobs;
+  uint64_t next_offset = 0;
+  for (const PartitionUpdate& partition : partitions_) {
+    const string& name = partition.partition_name();
+    const uint64_t begin = next_offset;
+    if (partition.has_operations_segment()) {
+      const OperationsSegment& segment = partition.operations_segment();
+      if (segment.data_offset() != next_offset) {
+        AddError(StringPrintf("%s: the operations segment is at %" PRIu64
+                              " instead of %" PRIu64 ".",
+                              name.c_str(),
+                              segment.data_offset(),
+                              next_offset));
+      }
+      next_offset = segment.data_offset() + segment.data_length();
+    }
+    for (int i = 0; i < partition.operations_size(); i++) {
+      const InstallOperation& op = partition.operations(i);
+      if (!op.has_data_offset()) {
+        continue;
+      }
+      if (manifest_.shared_blobs_size() > 0 &&
+          op.data_offset() + op.data_length() <= next_offset) {
+        const auto blob = blobs.find(op.data_offset());
+        if (blob == blobs.end() || blob->second != op.data_length()) {
+          AddError(OperationName(partition, i) +
+                   ": the data points to no earlier blob.");
+        }
+        continue;
+      }
+      if (op.data_offset() != next_offset) {
+        AddError(StringPrintf("%s: the data is at %" PRIu64
+                              " instead of %" PRIu64 ".",
+                              OperationName(partition, i).c_str(),
+                              op.data_offset(),
+                              next_offset));
+      }
+      blobs[op.data_offset()] = op.data_length();
+      next_offset = op.data_offset() + op.data_length();
+    }
+    if (partition.has_data_range() &&
+        (partition.data_range().data_offset() != begin ||
+         partition.data_range().data_length() != next_offset - begin)) {
+      AddError(StringPrintf("%s: the data range (%" PRIu64 ", %" PRIu64
+                            ") doesn't match the data at (%" PRIu64
+                            ", %" PRIu64 ").",
+                            name.c_str(),
+                            partition.data_range().data_offset(),
+                            partition.data_range().data_length(),
+                            begin,
+                            next_offset - begin));
+    }
+  }
+
+  uint64_t used_size = data_begin_ + next_offset;
+  if (manifest_.has_signatures_offset() != manifest_.has_signatures_size()) {
+    AddError("The signatures offset and size must be set together.");
+  }
+  if (manifest_.has_signatures_offset()) {
+    if (manifest_.signatures_offset() != next_offset) {
+      AddError(StringPrintf("The signatures are at %" PRIu64
+                            " instead of %" PRIu64 ".",
+                            manifest_.signatures_offset(),
+                            next_offset));
+    }
+    used_size = data_begin_ + manifest_.signatures_offset() +
+                manifest_.signatures_size();
+  }
+  if (used_size != payload_size_) {
+    AddError(StringPrintf("The payload uses %" PRIu64 " of its %" PRIu64
+                          " bytes.",
+                          used_size,
+                          payload_size_));
+  }
+}
+
+void PayloadChecker::CheckSignatures(const string& payload_path) {
+  if (metadata_signature_size_ > 0) {
+    Signatures signatures;
+    if (!signatures.ParseFromArray(payload_ + metadata_size_,
+                                   metadata_signature_size_) ||
+        signatures.signatures().empty()) {
+      AddError("The metadata signatures are invalid.");
+    }
+  }
+  if (!manifest_.has_signatures_offset()) {
+    if (!options_.public_key_path.empty()) {
+      AddError("The payload isn't signed.");
+    }
+    return;
+  }
+  // Otherwise CheckDataLayout() reports where the signatures are.
+  const uint64_t offset = data_begin_ + manifest_.signatures_offset();
+  if (offset > payload_size_ ||
+      manifest_.signatures_size() != payload_size_ - offset) {
+    return;
+  }
+  Signatures signatures;
+  if (!signatures.ParseFromArray(payload_ + offset,
+                                 manifest_.signatures_size()) ||
+      signatures.signatures().empty()) {
+    AddError("The payload signatures are invalid.");
+    return;
+  }
+  if (!options_.public_key_path.empty() &&
+      !PayloadSigner::VerifySignedPayload(payload_path,
+                                          options_.public_key_path)) {
+    AddError("The signatures don't verify with " + options_.public_key_path);
+  }
+}
+
+void PayloadChecker::CheckDataHashes(const PartitionUpdate& partition,
+                                     int begin,
+                                     int end) {
+  for (int i = begin; i < end; i++) {
+    const InstallOperation& op = partition.operations(i);
+    if (op.data_length() == 0) {
+      continue;
+    }
+    if (!op.has_data_sha256_hash()) {
+      if (!options_.allow_unhashed) {
+        AddError(OperationName(partition, i) + ": the data has no hash.");
+      }
+      continue;
+    }
+    const uint64_t offset = data_begin_ + op.data_offset();
+    if (offset > payload_size_ || op.data_length() > payload_size_ - offset) {
+      AddError(OperationName(partition, i) + ": the data is out of bounds.");
+      continue;
+    }
+    brillo::Blob hash;
+    if (!HashCalculator::RawHashOfBytes(
+            payload_ + offset, op.data_length(), &hash) ||
+        ToStringView(hash) != op.data_sha256_hash()) {
+      AddError(OperationName(partition, i) +
+               ": the data doesn't match its hash.");
+    }
+  }
+}
+
+void PayloadChecker::ApplyPartition(const PartitionUpdate& partition,
+                                    size_t num_threads) {
+  const string& name = partition.partition_name();
+  const uint64_t block_size = manifest_.block_size();
+  string source_path;
+  if (partition.has_old_partition_info()) {
+    const auto source = options_.source_paths.find(name);
+    if (source == options_.source_paths.end()) {
+      AddError(name + ": no source image to apply the operations on.");
+      return;
+    }
+    source_path = source->second;
+    const off_t size = partition.old_partition_info().size();
+    brillo::Blob hash;
+    if (HashCalculator::RawHashOfFile(source_path, size, &hash) != size ||
+        ToStringView(hash) != partition.old_partition_info().hash()) {
+      AddError(name + ": the source image " + source_path +
+               " doesn't match the old partition.");
+      return;
+    }
+  }
+
+  // The target starts as a hole, so the ZERO and DISCARD operations are
+  // skipped.
+  ScopedTempFile target_file("CrAU_temp_check." + name + ".XXXXXX");
+  const uint64_t size = partition.new_partition_info().size();
+  if (truncate64(target_file.path().c_str(), size) != 0) {
+    PLOG(ERROR) << "Failed to truncate " << target_file.path();
+    AddError(name + ": failed to create the target image.");
+    return;
+  }
+  const size_t num_workers = std::max<size_t>(
+      1, std::min<size_t>(num_threads, partition.operations_size()));
+  vector<OperationWorker> workers;
+  for (size_t i = 0; i < num_workers; i++) {
+    workers.push_back({std::make_shared<EintrSafeFileDescriptor>(),
+                       std::make_shared<EintrSafeFileDescriptor>(),
+                       InstallOperationExecutor(block_size)});
+    OperationWorker& worker = workers.back();
+    if (!worker.target_fd->Open(target_file.path().c_str(), O_RDWR) ||
+        (!source_path.empty() &&
+         !worker.source_fd->Open(source_path.c_str(), O_RDONLY)) ||
+        !worker.executor.SetZstdDictionary(partition.zstd_dictionary())) {
+      AddError(name + ": failed to set up applying the operations.");
+      return;
+    }
+  }
+
+  // The operations write disjoint blocks, so they are applied in any order,
+  // except for the TARGET_COPY ones which read the blocks written by the
+  // others.
+  vector<int> ops;
+  vector<int> target_copy_ops;
+  for (int i = 0; i < partition.operations_size(); i++) {
+    (partition.operations(i).type() == InstallOperation::TARGET_COPY
+         ? target_copy_ops
+         : ops)
+        .push_back(i);
+  }
+  std::atomic<bool> failed{false};
+  for (const vector<int>* phase_ops : {&ops, &target_copy_ops}) {
+    vector<TaskPool::Task> tasks;
+    for (size_t w = 0; w < workers.size(); w++) {
+      tasks.push_back([&, w] {
+        for (size_t j = w; j < phase_ops->size() && !failed;
+             j += workers.size()) {
+          const int index = (*phase_ops)[j];
+          const InstallOperation& op = partition.operations(index);
+          if (!ApplyOperation(op,
+                              payload_ + data_begin_ + op.data_offset(),
+                              block_size,
+                              &workers[w])) {
+            AddError(OperationName(partition, index) + ": failed to apply.");
+            failed = true;
+          }
+        }
+      });
+    }
+    TaskPool::RunTasks(std::move(tasks), workers.size());
+    if (failed) {
+      return;
+    }
+  }
+
+  brillo::Blob hash;
+  if (!WriteVerity(partition, block_size, workers[0].target_fd)) {
+    AddError(name + ": failed to compute the verity data.");
+  } else if (HashCalculator::RawHashOfFile(target_file.path(), size, &hash) !=
+                 static_cast<off_t>(size) ||
+             ToStringView(hash) != partition.new_partition_info().hash()) {
+    AddError(name + ": the partition applied doesn't match its hash.");
+  }
+}
+
+void PayloadChecker::AddError(const string& error) {
+  LOG(ERROR) << error;
+  std::lock_guard<std::mutex> lock(errors_mutex_);
+  errors_.push_back(error);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,113 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_CHECKER_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_CHECKER_H_
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <base/macros.h>
+
+#include "update_engine/payload_generator/payload_generation_config.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Checks a payload like scripts/paycheck.py, with the same verdicts, but
+// natively and on all the cores, so that checking multi-GB payloads takes
+// minutes rather than tens of minutes:
+//  - the header, the manifest and the operations segments parse;
+//  - the operations are of types the payload version allows, with the data,
+//    extents and hashes their type requires;
+//  - the extents are within the partitions, no block is written twice and
+//    full payloads write every block;
+//  - the data blobs follow each other, or point back to an earlier blob when
+//    the payload shares them, match their hashes and, with the signatures,
+//    make up the whole payload;
+//  - the signatures verify with the public key, if any.
+// The operations can also be applied with the InstallOperationExecutor of
+// the clients, checking the hashes of the source and target partitions.
+class PayloadChecker {
+ public:
+  struct Options {
+    // The public key in PEM format the signatures must verify with. Without
+    // it, the signatures are only checked to parse.
+    std::string public_key_path;
+    // Whether the data of the operations may come without a hash.
+    bool allow_unhashed = false;
+    // Whether to apply the operations on the source images.
+    bool apply = false;
+    // The source images of the partitions of delta payloads, by name.
+    std::map<std::string, std::string> source_paths;
+    // The number of threads to check with, 0 uses one per CPU.
+    size_t num_threads = 0;
+  };
+
+  explicit PayloadChecker(Options options) : options_(std::move(options)) {}
+
+  // Checks the payload at |payload_path|. Returns whether it is valid,
+  // otherwise |errors| tells why.
+  bool Check(const std::string& payload_path, std::vector<std::string>* errors);
+
+ private:
+  // Checks the operations of |partition| on their own.
+  void CheckOperations(const PartitionUpdate& partition);
+
+  // Checks that the data blobs of the partitions and the signatures follow
+  // each other up to the end of the payload.
+  void CheckDataLayout();
+
+  // Checks the signatures of the payload at |payload_path|.
+  void CheckSignatures(const std::string& payload_path);
+
+  // Checks the hashes of the data of the operations |begin| to |end| - 1 of
+  // |partition|.
+  void CheckDataHashes(const PartitionUpdate& partition, int begin, int end);
+
+  // Applies the operations of |partition| on |num_threads| threads and
+  // checks the partitions read and written.
+  void ApplyPartition(const PartitionUpdate& partition, size_t num_threads);
+
+  void AddError(const std::string& error);
+
+  const Options options_;
+
+  // The payload being checked, mapped in memory.
+  const uint8_t* payload_{nullptr};
+  uint64_t payload_size_{0};
+  uint64_t metadata_size_{0};
+  uint32_t metadata_signature_size_{0};
+  // The offset of the data blobs in the payload.
+  uint64_t data_begin_{0};
+  DeltaArchiveManifest manifest_;
+  PayloadVersion version_;
+  // The partitions of |manifest_|, with the operations of their segment.
+  std::vector<PartitionUpdate> partitions_;
+  bool is_delta_{false};
+
+  std::mutex errors_mutex_;
+  std::vector<std::string> errors_;
+
+  DISALLOW_COPY_AND_ASSIGN(PayloadChecker);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_CHECKER_H_
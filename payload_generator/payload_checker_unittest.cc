@@ -0,0 +1,147 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/payload_checker.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/testing_constants.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_consumer/payload_metadata.h"
+#include "update_engine/payload_generator/blob_file_writer.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/full_update_generator.h"
+#include "update_engine/payload_generator/payload_file.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+using test_utils::GetBuildArtifactsPath;
+
+namespace {
+constexpr size_t kPartitionBlocks = 64;
+}  // namespace
+
+class PayloadCheckerTest : public ::testing::Test {
+ protected:
+  // Writes a signed full payload of a single partition, with several
+  // operations.
+  void SetUp() override {
+    PayloadGenerationConfig config;
+    config.version.major = kBrilloMajorPayloadVersion;
+    config.version.minor = kFullPayloadMinorVersion;
+    config.block_size = kBlockSize;
+    config.hard_chunk_size = 16 * kBlockSize;
+    PayloadFile payload;
+    ASSERT_TRUE(payload.Init(config));
+
+    brillo::Blob data(kPartitionBlocks * kBlockSize);
+    test_utils::FillWithData(&data);
+    ASSERT_TRUE(test_utils::WriteFileVector(new_part_file_.path(), data));
+    PartitionConfig old_part(kPartitionNameRoot);
+    PartitionConfig new_part(kPartitionNameRoot);
+    new_part.path = new_part_file_.path();
+    new_part.size = data.size();
+
+    vector<AnnotatedOperation> aops;
+    off_t data_file_size = 0;
+    ScopedTempFile data_file("temp_data.XXXXXX", true);
+    BlobFileWriter blob_file_writer(data_file.fd(), &data_file_size);
+    ASSERT_TRUE(FullUpdateGenerator().GenerateOperations(
+        config, old_part, new_part, &blob_file_writer, &aops));
+    ASSERT_GT(aops.size(), 1U);
+    ASSERT_TRUE(
+        payload.AddPartition(old_part, new_part, std::move(aops), {}, {}));
+    uint64_t metadata_size = 0;
+    ASSERT_TRUE(payload.WritePayload(
+        payload_file_.path(),
+        data_file.path(),
+        GetBuildArtifactsPath(kUnittestPrivateKeyPath),
+        &metadata_size));
+    options_.public_key_path = GetBuildArtifactsPath(kUnittestPublicKeyPath);
+    options_.num_threads = 4;
+  }
+
+  bool Check() {
+    return PayloadChecker(options_).Check(payload_file_.path(), &errors_);
+  }
+
+  // Returns whether one of the errors contains |message|.
+  bool HasError(const string& message) const {
+    for (const string& error : errors_) {
+      if (error.find(message) != string::npos) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  ScopedTempFile new_part_file_{"new_part.XXXXXX"};
+  ScopedTempFile payload_file_{"payload_file.XXXXXX"};
+  PayloadChecker::Options options_;
+  vector<string> errors_;
+};
+
+TEST_F(PayloadCheckerTest, ValidPayloadTest) {
+  options_.apply = true;
+  EXPECT_TRUE(Check());
+  EXPECT_TRUE(errors_.empty());
+}
+
+TEST_F(PayloadCheckerTest, CorruptedDataTest) {
+  PayloadMetadata metadata;
+  DeltaArchiveManifest manifest;
+  Signatures metadata_signatures;
+  ASSERT_TRUE(metadata.ParsePayloadFile(
+      payload_file_.path(), &manifest, &metadata_signatures));
+  brillo::Blob payload;
+  ASSERT_TRUE(utils::ReadFile(payload_file_.path(), &payload));
+  const InstallOperation& op = manifest.partitions(0).operations(1);
+  payload[metadata.GetMetadataSize() + metadata.GetMetadataSignatureSize() +
+          op.data_offset()] ^= 1;
+  ASSERT_TRUE(test_utils::WriteFileVector(payload_file_.path(), payload));
+
+  EXPECT_FALSE(Check());
+  EXPECT_TRUE(HasError("operation 1"));
+  EXPECT_TRUE(HasError("doesn't match its hash"));
+  EXPECT_TRUE(HasError("don't verify"));
+}
+
+TEST_F(PayloadCheckerTest, TruncatedPayloadTest) {
+  brillo::Blob payload;
+  ASSERT_TRUE(utils::ReadFile(payload_file_.path(), &payload));
+  payload.pop_back();
+  ASSERT_TRUE(test_utils::WriteFileVector(payload_file_.path(), payload));
+
+  EXPECT_FALSE(Check());
+  EXPECT_TRUE(HasError("The payload uses"));
+}
+
+TEST_F(PayloadCheckerTest, WrongPublicKeyTest) {
+  options_.public_key_path = GetBuildArtifactsPath(kUnittestPublicKey2Path);
+  EXPECT_FALSE(Check());
+  EXPECT_TRUE(HasError("don't verify"));
+}
+
+}  // namespace chromeos_update_engine
@@ -17,9 +17,13 @@
 #include "update_engine/payload_generator/payload_file.h"
 
 #include <endian.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
 #include <map>
+#include <set>
 #include <utility>
 
 #include <base/strings/stringprintf.h>
@@ -31,6 +35,8 @@
 #include "update_engine/payload_generator/annotated_operation.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/payload_signer.h"
+#include "update_engine/payload_generator/task_pool.h"
+#include "update_engine/payload_generator/zstd.h"
 
 using std::string;
 using std::vector;
@@ -50,12 +56,47 @@ struct DeltaObject {
   off_t size;
 };
 
-// Writes the uint64_t passed in in host-endian to the file as big-endian.
-// Returns true on success.
-bool WriteUint64AsBigEndian(FileWriter* writer, const uint64_t value) {
+// Returns the estimated peak memory needed to apply |op|, besides its data.
+uint64_t ApplyMemoryBytes(const InstallOperation& op, size_t block_size) {
+  // The dictionary of REPLACE_XZ and the window of REPLACE_ZSTD are reduced to
+  // the size of the data, and the brotli window of BROTLI_BSDIFF is at most 16
+  // MiB.
+  constexpr uint64_t kXzMaxDictionarySize = 8 * 1024 * 1024;
+  constexpr uint64_t kZstdMaxWindowSize = 8 * 1024 * 1024;
+  constexpr uint64_t kBzipMemory = 4 * 1024 * 1024;
+  constexpr uint64_t kBrotliMaxWindowSize = 16 * 1024 * 1024;
+  const uint64_t src_size =
+      utils::BlocksInExtents(op.src_extents()) * block_size;
+  const uint64_t dst_size =
+      utils::BlocksInExtents(op.dst_extents()) * block_size;
+  switch (op.type()) {
+    case InstallOperation::REPLACE_XZ:
+      return std::min(dst_size, kXzMaxDictionarySize);
+    case InstallOperation::REPLACE_ZSTD:
+      return std::min(dst_size, kZstdMaxWindowSize);
+    case InstallOperation::REPLACE_BZ:
+      return kBzipMemory;
+    case InstallOperation::BSDIFF:
+    case InstallOperation::SOURCE_BSDIFF:
+      return src_size;
+    case InstallOperation::BROTLI_BSDIFF:
+      return src_size + std::min(dst_size, kBrotliMaxWindowSize);
+    case InstallOperation::PUFFDIFF:
+    case InstallOperation::ZUCCHINI:
+      return src_size + dst_size;
+    case InstallOperation::LZ4DIFF_BSDIFF:
+    case InstallOperation::LZ4DIFF_PUFFDIFF:
+      // The source and target are also held decompressed.
+      return 2 * (src_size + dst_size);
+    default:
+      return 0;
+  }
+}
+
+// Appends the uint64_t passed in in host-endian to |out| as big-endian.
+void AppendUint64AsBigEndian(const uint64_t value, string* out) {
   uint64_t value_be = htobe64(value);
-  TEST_AND_RETURN_FALSE(writer->Write(&value_be, sizeof(value_be)));
-  return true;
+  out->append(reinterpret_cast<const char*>(&value_be), sizeof(value_be));
 }
 
 }  // namespace
@@ -66,6 +107,12 @@ bool PayloadFile::Init(const PayloadGenerationConfig& config) {
   manifest_.set_minor_version(config.version.minor);
   manifest_.set_block_size(config.block_size);
   manifest_.set_max_timestamp(config.max_timestamp);
+  add_dst_hashes_ = config.add_dst_hashes;
+  add_apply_hints_ = config.add_apply_hints;
+  max_shared_blobs_size_ = config.max_shared_blobs_size;
+  operations_segments_ = config.operations_segments;
+  apply_cost_model_ = config.apply_cost_model;
+  signature_sizes_ = config.signature_sizes;
   if (!config.security_patch_level.empty()) {
     manifest_.set_security_patch_level(config.security_patch_level);
   }
@@ -94,11 +141,28 @@ bool PayloadFile::Init(const PayloadGenerationConfig& config) {
   return true;
 }
 
+void PayloadFile::OmitPartition(const string& name) {
+  if (!manifest_.has_dynamic_partition_metadata())
+    return;
+  for (auto& group :
+       *manifest_.mutable_dynamic_partition_metadata()->mutable_groups()) {
+    auto* names = group.mutable_partition_names();
+    names->erase(std::remove(names->begin(), names->end(), name),
+                 names->end());
+  }
+}
+
 bool PayloadFile::AddPartition(const PartitionConfig& old_conf,
                                const PartitionConfig& new_conf,
                                vector<AnnotatedOperation> aops,
                                vector<CowMergeOperation> merge_sequence,
                                const android::snapshot::CowSizeInfo& cow_info) {
+  if (add_dst_hashes_) {
+    TEST_AND_RETURN_FALSE(
+        AddDstHashes(new_conf, manifest_.block_size(), &aops));
+  }
+  if (add_apply_hints_)
+    AddApplyHints(apply_cost_model_, manifest_.block_size(), &aops);
   Partition part;
   part.name = new_conf.name;
   part.aops = std::move(aops);
@@ -107,6 +171,18 @@ bool PayloadFile::AddPartition(const PartitionConfig& old_conf,
   part.verity = new_conf.verity;
   part.version = new_conf.version;
   part.cow_info = cow_info;
+  // The dictionary is only shipped if an operation of the partition uses it.
+  const ZstdDictionaries* zstd_dictionaries = ZstdDictionaries::Get();
+  if (const ZstdDictionary* dictionary =
+          zstd_dictionaries ? zstd_dictionaries->Find(new_conf.path)
+                            : nullptr) {
+    for (const AnnotatedOperation& aop : part.aops) {
+      if (aop.op.type() == InstallOperation::REPLACE_ZSTD) {
+        part.zstd_dictionary = dictionary->data();
+        break;
+      }
+    }
+  }
   // Initialize the PartitionInfo objects if present.
   if (!old_conf.path.empty())
     TEST_AND_RETURN_FALSE(
@@ -117,21 +193,75 @@ bool PayloadFile::AddPartition(const PartitionConfig& old_conf,
   return true;
 }
 
+bool PayloadFile::AddDstHashes(const PartitionConfig& new_conf,
+                               size_t block_size,
+                               vector<AnnotatedOperation>* aops) {
+  FileDescriptorPtr fd = std::make_shared<EintrSafeFileDescriptor>();
+  TEST_AND_RETURN_FALSE(fd->Open(new_conf.path.c_str(), O_RDONLY));
+  brillo::Blob data;
+  for (AnnotatedOperation& aop : *aops) {
+    if (aop.op.dst_extents_size() == 0)
+      continue;
+    TEST_AND_RETURN_FALSE(
+        utils::ReadExtents(fd, aop.op.dst_extents(), &data, block_size));
+    brillo::Blob hash;
+    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(data, &hash));
+    aop.op.set_dst_sha256_hash(hash.data(), hash.size());
+  }
+  return true;
+}
+
+void PayloadFile::AddApplyHints(const ApplyCostModel& cost_model,
+                                size_t block_size,
+                                vector<AnnotatedOperation>* aops) {
+  for (AnnotatedOperation& aop : *aops) {
+    InstallOperation& op = aop.op;
+    op.set_apply_cost(cost_model.ApplyMicros(
+        op.type(), utils::BlocksInExtents(op.dst_extents()) * block_size));
+    op.set_apply_memory_bytes(ApplyMemoryBytes(op, block_size));
+  }
+}
+
 bool PayloadFile::WritePayload(const string& payload_file,
                                const string& data_blobs_path,
                                const string& private_key_path,
-                               uint64_t* metadata_size_out) {
-  // Reorder the data blobs with the manifest_.
+                               uint64_t* metadata_size_out,
+                               brillo::Blob* out_payload_hash,
+                               brillo::Blob* out_metadata_hash,
+                               brillo::Blob* out_file_hash) {
+  // Reorder the data blobs with the manifest_, unless they were already
+  // stored in order, like those of a full payload of a single partition, in
+  // which case they are used in place. Identical blobs can only be shared
+  // when reordering them.
   ScopedTempFile ordered_blobs_file("CrAU_temp_data.ordered.XXXXXX");
-  TEST_AND_RETURN_FALSE(
-      ReorderDataBlobs(data_blobs_path, ordered_blobs_file.path()));
+  string ordered_blobs_path = ordered_blobs_file.path();
+  struct stat blobs_stat {};
+  TEST_AND_RETURN_FALSE_ERRNO(stat(data_blobs_path.c_str(), &blobs_stat) == 0);
+  if (max_shared_blobs_size_ == 0 && BlobsInOrder(blobs_stat.st_size)) {
+    LOG(INFO) << "The data blobs are already in order.";
+    int blobs_fd = open(data_blobs_path.c_str(), O_RDONLY, 0);
+    TEST_AND_RETURN_FALSE_ERRNO(blobs_fd >= 0);
+    ScopedFdCloser blobs_fd_closer(&blobs_fd);
+    TEST_AND_RETURN_FALSE(HashUnhashedBlobs(blobs_fd));
+    ordered_blobs_path = data_blobs_path;
+  } else {
+    TEST_AND_RETURN_FALSE(
+        ReorderDataBlobs(data_blobs_path, ordered_blobs_file.path()));
+  }
 
   // Check that install op blobs are in order.
   uint64_t next_blob_offset = 0;
+  vector<uint64_t> part_blob_offsets;
   for (const auto& part : part_vec_) {
+    part_blob_offsets.push_back(next_blob_offset);
     for (const auto& aop : part.aops) {
       if (!aop.op.has_data_offset())
         continue;
+      // The operations sharing the blob of an earlier one point back to it.
+      if (shared_blobs_size_ > 0 &&
+          aop.op.data_offset() + aop.op.data_length() <= next_blob_offset) {
+        continue;
+      }
       if (aop.op.data_offset() != next_blob_offset) {
         LOG(FATAL) << "bad blob offset! " << aop.op.data_offset()
                    << " != " << next_blob_offset;
@@ -142,12 +272,19 @@ bool PayloadFile::WritePayload(const string& payload_file,
 
   // Copy the operations and partition info from the part_vec_ to the manifest.
   manifest_.clear_partitions();
+  if (shared_blobs_size_ > 0) {
+    manifest_.set_shared_blobs_size(shared_blobs_size_);
+  }
   for (const auto& part : part_vec_) {
     PartitionUpdate* partition = manifest_.add_partitions();
     partition->set_partition_name(part.name);
     if (!part.version.empty()) {
       partition->set_version(part.version);
     }
+    if (!part.zstd_dictionary.empty()) {
+      partition->set_zstd_dictionary(part.zstd_dictionary.data(),
+                                     part.zstd_dictionary.size());
+    }
     if (part.cow_info.cow_size > 0) {
       partition->set_estimate_cow_size(part.cow_info.cow_size);
     }
@@ -171,16 +308,34 @@ bool PayloadFile::WritePayload(const string& payload_file,
         if (!part.verity.hash_tree_salt.empty())
           partition->set_hash_tree_salt(part.verity.hash_tree_salt.data(),
                                         part.verity.hash_tree_salt.size());
+        if (part.verity.hash_tree_in_payload)
+          partition->set_hash_tree_in_payload(true);
       }
       if (part.verity.fec_extent.num_blocks() != 0) {
         *partition->mutable_fec_data_extent() = part.verity.fec_data_extent;
         *partition->mutable_fec_extent() = part.verity.fec_extent;
         partition->set_fec_roots(part.verity.fec_roots);
+        if (part.verity.fec_in_payload)
+          partition->set_fec_in_payload(true);
       }
     }
+    partition->mutable_operations()->Reserve(part.aops.size());
     for (const AnnotatedOperation& aop : part.aops) {
       *partition->add_operations() = aop.op;
     }
+    if (add_apply_hints_) {
+      uint64_t apply_cost = 0;
+      uint64_t max_apply_memory_bytes = 0;
+      for (const AnnotatedOperation& aop : part.aops) {
+        apply_cost += aop.op.apply_cost();
+        max_apply_memory_bytes =
+            std::max(max_apply_memory_bytes, aop.op.apply_memory_bytes());
+      }
+      partition->set_apply_cost(apply_cost);
+      partition->set_max_apply_memory_bytes(max_apply_memory_bytes);
+    }
+    partition->mutable_merge_operations()->Reserve(
+        part.cow_merge_sequence.size());
     for (const auto& merge_op : part.cow_merge_sequence) {
       *partition->add_merge_operations() = merge_op;
     }
@@ -191,6 +346,32 @@ bool PayloadFile::WritePayload(const string& payload_file,
       *(partition->mutable_new_partition_info()) = part.new_info;
   }
 
+  ScopedTempFile segmented_blobs_file("CrAU_temp_data.segmented.XXXXXX");
+  const uint64_t unsegmented_blobs_size = next_blob_offset;
+  if (operations_segments_) {
+    TEST_AND_RETURN_FALSE(InsertOperationsSegments(ordered_blobs_path,
+                                                   part_blob_offsets,
+                                                   segmented_blobs_file.path(),
+                                                   &next_blob_offset));
+    ordered_blobs_path = segmented_blobs_file.path();
+  }
+
+  // Index the data of each partition, which starts with its segment.
+  uint64_t segments_size = 0;
+  for (int i = 0; i < manifest_.partitions_size(); i++) {
+    PartitionUpdate* partition = manifest_.mutable_partitions(i);
+    const uint64_t begin = part_blob_offsets[i] + segments_size;
+    segments_size += partition->operations_segment().data_length();
+    const uint64_t end = (static_cast<size_t>(i + 1) < part_blob_offsets.size()
+                              ? part_blob_offsets[i + 1]
+                              : unsegmented_blobs_size) +
+                         segments_size;
+    PartitionDataRange* data_range = partition->mutable_data_range();
+    data_range->set_data_offset(begin);
+    data_range->set_data_length(end - begin);
+    data_range->set_num_operations(part_vec_[i].aops.size());
+  }
+
   // Signatures appear at the end of the blobs. Note the offset in the
   // |manifest_|.
   uint64_t signature_blob_length = 0;
@@ -199,13 +380,23 @@ bool PayloadFile::WritePayload(const string& payload_file,
         {private_key_path}, &signature_blob_length));
     PayloadSigner::AddSignatureToManifest(
         next_blob_offset, signature_blob_length, &manifest_);
+  } else if (!signature_sizes_.empty()) {
+    string placeholder_signature;
+    TEST_AND_RETURN_FALSE(PayloadSigner::PlaceholderSignatureBlob(
+        signature_sizes_, &placeholder_signature));
+    PayloadSigner::AddSignatureToManifest(
+        next_blob_offset, placeholder_signature.size(), &manifest_);
   }
-  WritePayload(payload_file,
-               ordered_blobs_file.path(),
-               private_key_path,
-               major_version_,
-               manifest_,
-               metadata_size_out);
+  TEST_AND_RETURN_FALSE(WritePayload(payload_file,
+                                     ordered_blobs_path,
+                                     private_key_path,
+                                     major_version_,
+                                     manifest_,
+                                     metadata_size_out,
+                                     signature_sizes_,
+                                     out_payload_hash,
+                                     out_metadata_hash,
+                                     out_file_hash));
 
   ReportPayloadUsage(*metadata_size_out);
   return true;
@@ -216,12 +407,14 @@ bool PayloadFile::WritePayload(const std::string& payload_file,
                                const std::string& private_key_path,
                                uint64_t major_version_,
                                const DeltaArchiveManifest& manifest,
-                               uint64_t* metadata_size_out) {
+                               uint64_t* metadata_size_out,
+                               const vector<size_t>& signature_sizes,
+                               brillo::Blob* out_payload_hash,
+                               brillo::Blob* out_metadata_hash,
+                               brillo::Blob* out_file_hash) {
   std::string serialized_manifest;
 
   TEST_AND_RETURN_FALSE(manifest.SerializeToString(&serialized_manifest));
-  uint64_t metadata_size =
-      sizeof(kDeltaMagic) + 2 * sizeof(uint64_t) + serialized_manifest.size();
   LOG(INFO) << "Writing final delta file header...";
   DirectFileWriter writer;
   TEST_AND_RETURN_FALSE_ERRNO(writer.Open(payload_file.c_str(),
@@ -229,15 +422,16 @@ bool PayloadFile::WritePayload(const std::string& payload_file,
                                           0644) == 0);
   ScopedFileWriterCloser writer_closer(&writer);
 
+  // The metadata is assembled in memory, and it and the data blobs are hashed
+  // as they are written, so that the payload isn't read back for signing.
   // Write header
-  TEST_AND_RETURN_FALSE_ERRNO(writer.Write(kDeltaMagic, sizeof(kDeltaMagic)));
+  string metadata(kDeltaMagic, sizeof(kDeltaMagic));
 
   // Write major version number
-  TEST_AND_RETURN_FALSE(WriteUint64AsBigEndian(&writer, major_version_));
+  AppendUint64AsBigEndian(major_version_, &metadata);
 
   // Write protobuf length
-  TEST_AND_RETURN_FALSE(
-      WriteUint64AsBigEndian(&writer, serialized_manifest.size()));
+  AppendUint64AsBigEndian(serialized_manifest.size(), &metadata);
 
   // Metadata signature has the same size as payload signature, because they
   // are both the same kind of signature for the same kind of hash.
@@ -247,27 +441,51 @@ bool PayloadFile::WritePayload(const std::string& payload_file,
   // endianess.
   {
     const uint32_t metadata_signature_size = htobe32(signature_blob_length);
-    TEST_AND_RETURN_FALSE_ERRNO(writer.Write(&metadata_signature_size,
-                                             sizeof(metadata_signature_size)));
-    metadata_size += sizeof(metadata_signature_size);
+    metadata.append(reinterpret_cast<const char*>(&metadata_signature_size),
+                    sizeof(metadata_signature_size));
   }
 
   // Write protobuf
   LOG(INFO) << "Writing final delta file protobuf... "
             << serialized_manifest.size();
-  TEST_AND_RETURN_FALSE_ERRNO(
-      writer.Write(serialized_manifest.data(), serialized_manifest.size()));
+  metadata.append(serialized_manifest);
+  const uint64_t metadata_size = metadata.size();
+  TEST_AND_RETURN_FALSE_ERRNO(writer.Write(metadata.data(), metadata.size()));
+
+  brillo::Blob metadata_hash;
+  TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfBytes(
+      metadata.data(), metadata.size(), &metadata_hash));
+  // The payload hash skips the metadata signature and the payload signature.
+  HashCalculator payload_hasher;
+  TEST_AND_RETURN_FALSE(
+      payload_hasher.Update(metadata.data(), metadata.size()));
+  // The file hash covers everything written.
+  HashCalculator file_hasher;
+  TEST_AND_RETURN_FALSE(file_hasher.Update(metadata.data(), metadata.size()));
+
+  // Without a key, the signatures reserved are filled with zeros.
+  string placeholder_signature;
+  if (private_key_path.empty() && !signature_sizes.empty()) {
+    TEST_AND_RETURN_FALSE(PayloadSigner::PlaceholderSignatureBlob(
+        signature_sizes, &placeholder_signature));
+    TEST_AND_RETURN_FALSE(placeholder_signature.size() ==
+                          signature_blob_length);
+  }
 
   // Write metadata signature blob.
   if (!private_key_path.empty()) {
-    brillo::Blob metadata_hash;
-    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfFile(
-        payload_file, metadata_size, &metadata_hash));
     string metadata_signature;
     TEST_AND_RETURN_FALSE(PayloadSigner::SignHashWithKeys(
         metadata_hash, {private_key_path}, &metadata_signature));
     TEST_AND_RETURN_FALSE_ERRNO(
         writer.Write(metadata_signature.data(), metadata_signature.size()));
+    TEST_AND_RETURN_FALSE(file_hasher.Update(metadata_signature.data(),
+                                             metadata_signature.size()));
+  } else {
+    TEST_AND_RETURN_FALSE_ERRNO(writer.Write(placeholder_signature.data(),
+                                             placeholder_signature.size()));
+    TEST_AND_RETURN_FALSE(file_hasher.Update(placeholder_signature.data(),
+                                             placeholder_signature.size()));
   }
 
   // Append the data blobs.
@@ -275,8 +493,9 @@ bool PayloadFile::WritePayload(const std::string& payload_file,
   int blobs_fd = open(ordered_blobs_file.c_str(), O_RDONLY, 0);
   ScopedFdCloser blobs_fd_closer(&blobs_fd);
   TEST_AND_RETURN_FALSE(blobs_fd >= 0);
+  uint64_t blobs_size = 0;
+  vector<char> buf(1024 * 1024);
   for (;;) {
-    vector<char> buf(1024 * 1024);
     ssize_t rc = read(blobs_fd, buf.data(), buf.size());
     if (0 == rc) {
       // EOF
@@ -284,24 +503,45 @@ bool PayloadFile::WritePayload(const std::string& payload_file,
     }
     TEST_AND_RETURN_FALSE_ERRNO(rc > 0);
     TEST_AND_RETURN_FALSE_ERRNO(writer.Write(buf.data(), rc));
+    TEST_AND_RETURN_FALSE(payload_hasher.Update(buf.data(), rc));
+    TEST_AND_RETURN_FALSE(file_hasher.Update(buf.data(), rc));
+    blobs_size += rc;
+  }
+  TEST_AND_RETURN_FALSE(payload_hasher.Finalize());
+  // The signatures must directly follow the data blobs for the payload hash
+  // to be the one signed.
+  if (manifest.has_signatures_offset()) {
+    TEST_AND_RETURN_FALSE(blobs_size == manifest.signatures_offset());
   }
   // Write payload signature blob.
   if (!private_key_path.empty()) {
     LOG(INFO) << "Signing the update...";
     string signature;
-    TEST_AND_RETURN_FALSE(PayloadSigner::SignPayload(
-        payload_file,
-        {private_key_path},
-        metadata_size,
-        signature_blob_length,
-        metadata_size + signature_blob_length + manifest.signatures_offset(),
-        &signature));
+    TEST_AND_RETURN_FALSE(PayloadSigner::SignHashWithKeys(
+        payload_hasher.raw_hash(), {private_key_path}, &signature));
     TEST_AND_RETURN_FALSE_ERRNO(
         writer.Write(signature.data(), signature.size()));
+    TEST_AND_RETURN_FALSE(
+        file_hasher.Update(signature.data(), signature.size()));
+  } else {
+    TEST_AND_RETURN_FALSE_ERRNO(writer.Write(placeholder_signature.data(),
+                                             placeholder_signature.size()));
+    TEST_AND_RETURN_FALSE(file_hasher.Update(placeholder_signature.data(),
+                                             placeholder_signature.size()));
   }
+  TEST_AND_RETURN_FALSE(file_hasher.Finalize());
   if (metadata_size_out) {
     *metadata_size_out = metadata_size;
   }
+  if (out_payload_hash) {
+    *out_payload_hash = payload_hasher.raw_hash();
+  }
+  if (out_metadata_hash) {
+    *out_metadata_hash = std::move(metadata_hash);
+  }
+  if (out_file_hash) {
+    *out_file_hash = file_hasher.raw_hash();
+  }
   return true;
 }
 
@@ -311,33 +551,192 @@ bool PayloadFile::ReorderDataBlobs(const string& data_blobs_path,
   TEST_AND_RETURN_FALSE_ERRNO(in_fd >= 0);
   ScopedFdCloser in_fd_closer(&in_fd);
 
-  DirectFileWriter writer;
-  int rc = writer.Open(
-      new_data_blobs_path.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0644);
-  if (rc != 0) {
+  int out_fd =
+      open(new_data_blobs_path.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0644);
+  if (out_fd < 0) {
     PLOG(ERROR) << "Error creating " << new_data_blobs_path;
     return false;
   }
-  ScopedFileWriterCloser writer_closer(&writer);
-  uint64_t out_file_size = 0;
+  ScopedFdCloser out_fd_closer(&out_fd);
+
+  TEST_AND_RETURN_FALSE(HashUnhashedBlobs(in_fd));
 
+  // Write the new layout sequentially. The blobs which follow each other in
+  // both layouts, like those of the chunks of a full partition, are copied
+  // together.
+  bool use_copy_file_range = true;
+  uint64_t out_file_size = 0;
+  uint64_t run_offset = 0;
+  uint64_t run_length = 0;
+  // The first REPLACE operation with each blob, by data hash, and the blobs
+  // already shared, by offset in the new layout.
+  std::map<string, const InstallOperation*> replace_blobs;
+  std::set<uint64_t> shared_blobs;
+  shared_blobs_size_ = 0;
   for (auto& part : part_vec_) {
     for (AnnotatedOperation& aop : part.aops) {
       if (!aop.op.has_data_offset())
         continue;
       CHECK(aop.op.has_data_length());
-      brillo::Blob buf(aop.op.data_length());
-      ssize_t rc = pread(in_fd, buf.data(), buf.size(), aop.op.data_offset());
-      TEST_AND_RETURN_FALSE(rc == static_cast<ssize_t>(buf.size()));
+      if (max_shared_blobs_size_ > 0 &&
+          diff_utils::IsAReplaceOperation(aop.op.type()) &&
+          aop.op.data_length() > 0) {
+        auto [blob, inserted] =
+            replace_blobs.emplace(aop.op.data_sha256_hash(), &aop.op);
+        const InstallOperation& first_op = *blob->second;
+        if (!inserted && first_op.type() == aop.op.type() &&
+            first_op.data_length() == aop.op.data_length() &&
+            (shared_blobs.count(first_op.data_offset()) > 0 ||
+             shared_blobs_size_ + aop.op.data_length() <=
+                 max_shared_blobs_size_)) {
+          if (shared_blobs.insert(first_op.data_offset()).second)
+            shared_blobs_size_ += aop.op.data_length();
+          aop.op.set_data_offset(first_op.data_offset());
+          continue;
+        }
+      }
+      if (aop.op.data_offset() != run_offset + run_length) {
+        TEST_AND_RETURN_FALSE(utils::CopyFileRange(in_fd,
+                                                   run_offset,
+                                                   out_fd,
+                                                   out_file_size - run_length,
+                                                   run_length,
+                                                   &use_copy_file_range));
+        run_offset = aop.op.data_offset();
+        run_length = 0;
+      }
+      run_length += aop.op.data_length();
+      aop.op.set_data_offset(out_file_size);
+      out_file_size += aop.op.data_length();
+    }
+  }
+  TEST_AND_RETURN_FALSE(utils::CopyFileRange(in_fd,
+                                             run_offset,
+                                             out_fd,
+                                             out_file_size - run_length,
+                                             run_length,
+                                             &use_copy_file_range));
+  LOG_IF(INFO, shared_blobs_size_ > 0)
+      << "Shared " << shared_blobs.size() << " REPLACE blobs of "
+      << shared_blobs_size_ << " bytes between operations.";
+  return true;
+}
 
-      // Add the hash of the data blobs for this operation
-      TEST_AND_RETURN_FALSE(AddOperationHash(&aop.op, buf));
+bool PayloadFile::InsertOperationsSegments(
+    const string& blobs_path,
+    const vector<uint64_t>& part_blob_offsets,
+    const string& new_blobs_path,
+    uint64_t* blobs_size) {
+  int in_fd = open(blobs_path.c_str(), O_RDONLY, 0);
+  TEST_AND_RETURN_FALSE_ERRNO(in_fd >= 0);
+  ScopedFdCloser in_fd_closer(&in_fd);
+  int out_fd = open(new_blobs_path.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0644);
+  TEST_AND_RETURN_FALSE_ERRNO(out_fd >= 0);
+  ScopedFdCloser out_fd_closer(&out_fd);
+
+  bool use_copy_file_range = true;
+  uint64_t in_offset = 0;
+  uint64_t segments_size = 0;
+  for (int i = 0; i < manifest_.partitions_size(); i++) {
+    PartitionUpdate* partition = manifest_.mutable_partitions(i);
+    if (partition->operations_size() == 0)
+      continue;
+    const uint64_t blob_offset = part_blob_offsets[i];
+    TEST_AND_RETURN_FALSE(utils::CopyFileRange(in_fd,
+                                               in_offset,
+                                               out_fd,
+                                               in_offset + segments_size,
+                                               blob_offset - in_offset,
+                                               &use_copy_file_range));
+    in_offset = blob_offset;
+
+    // The data offsets of the operations depend on the size of the segment
+    // in front of their data, which depends on their encoded size. The size
+    // only grows with the offsets, so this converges.
+    PartitionOperations operations;
+    string data;
+    size_t segment_size;
+    do {
+      segment_size = data.size();
+      *operations.mutable_operations() = partition->operations();
+      for (InstallOperation& op : *operations.mutable_operations()) {
+        if (!op.has_data_offset())
+          continue;
+        TEST_AND_RETURN_FALSE(op.data_offset() >= blob_offset);
+        op.set_data_offset(op.data_offset() + segments_size + segment_size);
+      }
+      TEST_AND_RETURN_FALSE(operations.SerializeToString(&data));
+    } while (data.size() != segment_size);
+    TEST_AND_RETURN_FALSE(utils::PWriteAll(
+        out_fd, data.data(), data.size(), blob_offset + segments_size));
 
-      aop.op.set_data_offset(out_file_size);
-      TEST_AND_RETURN_FALSE_ERRNO(writer.Write(buf.data(), buf.size()));
-      out_file_size += buf.size();
+    brillo::Blob hash;
+    TEST_AND_RETURN_FALSE(
+        HashCalculator::RawHashOfBytes(data.data(), data.size(), &hash));
+    OperationsSegment* segment = partition->mutable_operations_segment();
+    segment->set_data_offset(blob_offset + segments_size);
+    segment->set_data_length(data.size());
+    segment->set_sha256_hash(hash.data(), hash.size());
+    segment->set_num_operations(partition->operations_size());
+    partition->clear_operations();
+    segments_size += data.size();
+  }
+  TEST_AND_RETURN_FALSE(utils::CopyFileRange(in_fd,
+                                             in_offset,
+                                             out_fd,
+                                             in_offset + segments_size,
+                                             *blobs_size - in_offset,
+                                             &use_copy_file_range));
+  *blobs_size += segments_size;
+  LOG(INFO) << "Moved the operations of the partitions to segments of "
+            << segments_size << " bytes in total.";
+  return true;
+}
+
+bool PayloadFile::BlobsInOrder(uint64_t blobs_size) const {
+  uint64_t next_blob_offset = 0;
+  for (const auto& part : part_vec_) {
+    for (const AnnotatedOperation& aop : part.aops) {
+      if (!aop.op.has_data_offset())
+        continue;
+      if (aop.op.data_offset() != next_blob_offset)
+        return false;
+      next_blob_offset += aop.op.data_length();
     }
   }
+  return next_blob_offset == blobs_size;
+}
+
+bool PayloadFile::HashUnhashedBlobs(int blobs_fd) {
+  // The blobs are normally hashed when stored, only the operations reusing
+  // part of another blob are hashed here, in parallel.
+  vector<InstallOperation*> unhashed_ops;
+  for (auto& part : part_vec_) {
+    for (AnnotatedOperation& aop : part.aops) {
+      if (aop.op.has_data_offset() && !aop.op.has_data_sha256_hash())
+        unhashed_ops.push_back(&aop.op);
+    }
+  }
+  std::atomic<bool> hash_failed{false};
+  vector<TaskPool::Task> tasks;
+  for (InstallOperation* op : unhashed_ops) {
+    tasks.push_back([blobs_fd, op, &hash_failed] {
+      CHECK(op->has_data_length());
+      brillo::Blob buf(op->data_length());
+      ssize_t bytes_read;
+      if (!utils::PReadAll(blobs_fd,
+                           buf.data(),
+                           buf.size(),
+                           op->data_offset(),
+                           &bytes_read) ||
+          bytes_read != static_cast<ssize_t>(buf.size()) ||
+          !AddOperationHash(op, buf)) {
+        hash_failed = true;
+      }
+    });
+  }
+  TaskPool::RunTasks(std::move(tasks), diff_utils::GetMaxThreads());
+  TEST_AND_RETURN_FALSE(!hash_failed);
   return true;
 }
 
@@ -49,24 +49,56 @@ class PayloadFile {
                     std::vector<CowMergeOperation> merge_sequence,
                     const android::snapshot::CowSizeInfo& cow_info);
 
+  // Removes the partition |name| left out of a partial update from the groups
+  // of the dynamic partition metadata, which may only list the partitions in
+  // the payload.
+  void OmitPartition(const std::string& name);
+
   // Write the payload to the |payload_file| file. The operations reference
   // blobs in the |data_blobs_path| file and the blobs will be reordered in the
   // payload file to match the order of the operations. The size of the metadata
-  // section of the payload is stored in |metadata_size_out|.
+  // section of the payload is stored in |metadata_size_out|. The payload and
+  // metadata hashes for signing are computed as the payload is written and
+  // stored in |out_payload_hash| and |out_metadata_hash| if not null. Unless
+  // the payload is signed with |private_key_path|, they match the ones
+  // PayloadSigner::HashPayloadForSigning() computes only if the config had the
+  // same |signature_sizes|. The hash of the whole payload file, signatures
+  // included, is stored in |out_file_hash| if not null.
   bool WritePayload(const std::string& payload_file,
                     const std::string& data_blobs_path,
                     const std::string& private_key_path,
-                    uint64_t* metadata_size_out);
-
+                    uint64_t* metadata_size_out,
+                    brillo::Blob* out_payload_hash = nullptr,
+                    brillo::Blob* out_metadata_hash = nullptr,
+                    brillo::Blob* out_file_hash = nullptr);
+
+  // Same, for a |manifest| whose blobs are in |ordered_blobs_file| in order.
+  // Without |private_key_path|, the signatures of the |manifest| are filled
+  // with placeholders of |signature_sizes|.
   static bool WritePayload(const std::string& payload_file,
                            const std::string& ordered_blobs_file,
                            const std::string& private_key_path,
                            uint64_t major_version_,
                            const DeltaArchiveManifest& manifest,
-                           uint64_t* out_metadata_size);
+                           uint64_t* out_metadata_size,
+                           const std::vector<size_t>& signature_sizes = {},
+                           brillo::Blob* out_payload_hash = nullptr,
+                           brillo::Blob* out_metadata_hash = nullptr,
+                           brillo::Blob* out_file_hash = nullptr);
+
+  // Sets the |apply_cost| and |apply_memory_bytes| hints of the operations in
+  // |aops| from |cost_model|.
+  static void AddApplyHints(const ApplyCostModel& cost_model,
+                            size_t block_size,
+                            std::vector<AnnotatedOperation>* aops);
 
  private:
+  FRIEND_TEST(PayloadFileTest, AddApplyHintsTest);
+  FRIEND_TEST(PayloadFileTest, AddDstHashesTest);
   FRIEND_TEST(PayloadFileTest, ReorderBlobsTest);
+  FRIEND_TEST(PayloadFileTest, ReorderSharesBlobsTest);
+  FRIEND_TEST(PayloadFileTest, BlobsInOrderTest);
+  FRIEND_TEST(PayloadFileTest, InsertOperationsSegmentsTest);
 
   // Computes a SHA256 hash of the given buf and sets the hash value in the
   // operation so that update_engine could verify. This hash should be set
@@ -82,16 +114,63 @@ class PayloadFile {
   // operations in the manifest. E.g. if manifest[0] has a data blob
   // "X" at offset 1, manifest[1] has a data blob "Y" at offset 0,
   // and data_blobs_path's file contains "YX", new_data_blobs_path
-  // will set to be a file that contains "XY".
+  // will set to be a file that contains "XY". With |max_shared_blobs_size_|,
+  // the REPLACE operations with the same blob as an earlier one reference it
+  // instead of a copy, as long as the blobs shared fit in that size.
   bool ReorderDataBlobs(const std::string& data_blobs_path,
                         const std::string& new_data_blobs_path);
 
+  // Moves the operations of the partitions of |manifest_| to segments written
+  // in front of their data, which starts at |part_blob_offsets| in the
+  // |*blobs_size| bytes of |blobs_path|, and writes the resulting data blobs
+  // to |new_blobs_path|. Updates the data offsets of the operations and
+  // |*blobs_size| accordingly.
+  bool InsertOperationsSegments(const std::string& blobs_path,
+                                const std::vector<uint64_t>& part_blob_offsets,
+                                const std::string& new_blobs_path,
+                                uint64_t* blobs_size);
+
+  // Returns whether the |blobs_size| bytes of data blobs are exactly the ones
+  // of the operations, in their order, so that they don't need reordering.
+  bool BlobsInOrder(uint64_t blobs_size) const;
+
+  // Sets the data hash of the operations whose blob in |blobs_fd| isn't
+  // hashed yet.
+  bool HashUnhashedBlobs(int blobs_fd);
+
   // Print in stderr the Payload usage report.
   void ReportPayloadUsage(uint64_t metadata_size) const;
 
+  // Sets the |dst_sha256_hash| of the operations in |aops| from the data in
+  // |new_conf|.
+  static bool AddDstHashes(const PartitionConfig& new_conf,
+                           size_t block_size,
+                           std::vector<AnnotatedOperation>* aops);
+
   // The major_version of the requested payload.
   uint64_t major_version_;
 
+  // Whether to add the |dst_sha256_hash| of the operations.
+  bool add_dst_hashes_{false};
+
+  // The maximum and actual total size of the blobs shared by several REPLACE
+  // operations, see |shared_blobs_size| in the manifest.
+  uint64_t max_shared_blobs_size_{0};
+  uint64_t shared_blobs_size_{0};
+
+  // Whether to move the operations of the partitions out of the manifest, see
+  // |operations_segment| in the manifest.
+  bool operations_segments_{false};
+
+  // Whether to add the apply cost hints of the operations and partitions,
+  // estimated from |apply_cost_model_|.
+  bool add_apply_hints_{false};
+  ApplyCostModel apply_cost_model_;
+
+  // The sizes of the placeholder signatures reserved when there is no key to
+  // sign the payload with.
+  std::vector<size_t> signature_sizes_;
+
   DeltaArchiveManifest manifest_;
 
   // Struct has necessary information to write PartitionUpdate in protobuf.
@@ -111,6 +190,8 @@ class PayloadFile {
     // Per partition timestamp.
     std::string version;
     android::snapshot::CowSizeInfo cow_info;
+    // The zstd dictionary of the REPLACE_ZSTD operations, if any.
+    brillo::Blob zstd_dictionary;
   };
 
   std::vector<Partition> part_vec_;
@@ -22,6 +22,7 @@
 
 #include <gtest/gtest.h>
 
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/test_utils.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 
@@ -35,6 +36,45 @@ class PayloadFileTest : public ::testing::Test {
   PayloadFile payload_;
 };
 
+TEST_F(PayloadFileTest, AddDstHashesTest) {
+  ScopedTempFile new_part("AddDstHashesTest.new.XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileString(new_part.path(), "aabbccdd"));
+  PartitionConfig new_conf("part");
+  new_conf.path = new_part.path();
+
+  vector<AnnotatedOperation> aops(2);
+  *aops[0].op.add_dst_extents() = ExtentForRange(1, 1);
+  *aops[0].op.add_dst_extents() = ExtentForRange(3, 1);
+  EXPECT_TRUE(PayloadFile::AddDstHashes(new_conf, 2, &aops));
+
+  brillo::Blob expected_hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfData({'b', 'b', 'd', 'd'},
+                                            &expected_hash));
+  EXPECT_EQ(expected_hash,
+            brillo::Blob(aops[0].op.dst_sha256_hash().begin(),
+                         aops[0].op.dst_sha256_hash().end()));
+  // Operations which don't write anything have no hash.
+  EXPECT_FALSE(aops[1].op.has_dst_sha256_hash());
+}
+
+TEST_F(PayloadFileTest, AddApplyHintsTest) {
+  vector<AnnotatedOperation> aops(2);
+  aops[0].op.set_type(InstallOperation::REPLACE_XZ);
+  *aops[0].op.add_dst_extents() = ExtentForRange(0, 256);
+  aops[1].op.set_type(InstallOperation::PUFFDIFF);
+  *aops[1].op.add_src_extents() = ExtentForRange(0, 128);
+  *aops[1].op.add_dst_extents() = ExtentForRange(256, 256);
+  ApplyCostModel cost_model;
+  cost_model.apply_ms_per_mib[InstallOperation::PUFFDIFF] = 20;
+  PayloadFile::AddApplyHints(cost_model, 4096, &aops);
+
+  EXPECT_EQ(cost_model.ApplyMicros(InstallOperation::REPLACE_XZ, 1048576),
+            aops[0].op.apply_cost());
+  EXPECT_EQ(1048576u, aops[0].op.apply_memory_bytes());
+  EXPECT_EQ(20000u, aops[1].op.apply_cost());
+  EXPECT_EQ(1048576u + 524288, aops[1].op.apply_memory_bytes());
+}
+
 TEST_F(PayloadFileTest, ReorderBlobsTest) {
   ScopedTempFile orig_blobs("ReorderBlobsTest.orig.XXXXXX");
 
@@ -82,6 +122,144 @@ TEST_F(PayloadFileTest, ReorderBlobsTest) {
   EXPECT_EQ(1U, part1_aops.size());
   EXPECT_EQ(4U, part1_aops[0].op.data_offset());
   EXPECT_EQ(6U, part1_aops[0].op.data_length());
+
+  // The blobs which weren't hashed when stored are hashed.
+  brillo::Blob hash;
+  ASSERT_TRUE(
+      HashCalculator::RawHashOfData(brillo::Blob{'k', 'e', 'r', 'n', 'e', 'l'},
+                                    &hash));
+  EXPECT_EQ(string(hash.begin(), hash.end()),
+            part1_aops[0].op.data_sha256_hash());
+}
+
+TEST_F(PayloadFileTest, ReorderSharesBlobsTest) {
+  ScopedTempFile orig_blobs("ReorderSharesBlobsTest.orig.XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileString(orig_blobs.path(), "xyzxyzab"));
+  ScopedTempFile new_blobs("ReorderSharesBlobsTest.new.XXXXXX");
+
+  // Both partitions write "xyz" twice, the second partition once with another
+  // type of operation.
+  auto add_operations = [this] {
+    payload_.part_vec_.clear();
+    payload_.part_vec_.resize(2);
+    AnnotatedOperation aop;
+    aop.op.set_type(InstallOperation::REPLACE);
+    aop.op.set_data_offset(0);
+    aop.op.set_data_length(3);
+    payload_.part_vec_[0].aops.push_back(aop);
+    aop.op.set_data_offset(3);
+    payload_.part_vec_[0].aops.push_back(aop);
+    aop.op.set_data_offset(6);
+    aop.op.set_data_length(2);
+    payload_.part_vec_[1].aops.push_back(aop);
+    aop.op.set_data_offset(0);
+    aop.op.set_data_length(3);
+    payload_.part_vec_[1].aops.push_back(aop);
+    aop.op.set_type(InstallOperation::SOURCE_BSDIFF);
+    payload_.part_vec_[1].aops.push_back(aop);
+  };
+
+  add_operations();
+  payload_.max_shared_blobs_size_ = 3;
+  EXPECT_TRUE(payload_.ReorderDataBlobs(orig_blobs.path(), new_blobs.path()));
+  string new_data;
+  EXPECT_TRUE(utils::ReadFile(new_blobs.path(), &new_data));
+  EXPECT_EQ("xyzabxyz", new_data);
+  EXPECT_EQ(3u, payload_.shared_blobs_size_);
+  const vector<AnnotatedOperation>& part0_aops = payload_.part_vec_[0].aops;
+  const vector<AnnotatedOperation>& part1_aops = payload_.part_vec_[1].aops;
+  EXPECT_EQ(0u, part0_aops[0].op.data_offset());
+  EXPECT_EQ(0u, part0_aops[1].op.data_offset());
+  EXPECT_EQ(3u, part1_aops[0].op.data_offset());
+  EXPECT_EQ(0u, part1_aops[1].op.data_offset());
+  EXPECT_EQ(3u, part1_aops[1].op.data_length());
+  EXPECT_EQ(5u, part1_aops[2].op.data_offset());
+
+  // The blobs which don't fit aren't shared.
+  add_operations();
+  payload_.max_shared_blobs_size_ = 2;
+  EXPECT_TRUE(payload_.ReorderDataBlobs(orig_blobs.path(), new_blobs.path()));
+  EXPECT_TRUE(utils::ReadFile(new_blobs.path(), &new_data));
+  EXPECT_EQ("xyzxyzabxyzxyz", new_data);
+  EXPECT_EQ(0u, payload_.shared_blobs_size_);
+}
+
+TEST_F(PayloadFileTest, BlobsInOrderTest) {
+  payload_.part_vec_.resize(2);
+  AnnotatedOperation aop;
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(3);
+  payload_.part_vec_[0].aops.push_back(aop);
+  // Operations without a blob are skipped.
+  payload_.part_vec_[0].aops.emplace_back();
+  aop.op.set_data_offset(3);
+  aop.op.set_data_length(5);
+  payload_.part_vec_[1].aops.push_back(aop);
+  EXPECT_TRUE(payload_.BlobsInOrder(8));
+  // Blobs not referenced by any operation must be dropped.
+  EXPECT_FALSE(payload_.BlobsInOrder(9));
+
+  std::swap(payload_.part_vec_[0], payload_.part_vec_[1]);
+  EXPECT_FALSE(payload_.BlobsInOrder(8));
+}
+
+TEST_F(PayloadFileTest, InsertOperationsSegmentsTest) {
+  ScopedTempFile orig_blobs("InsertOperationsSegmentsTest.orig.XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileString(orig_blobs.path(), "xyzabcde"));
+  ScopedTempFile new_blobs("InsertOperationsSegmentsTest.new.XXXXXX");
+
+  // The second partition has no operations, the third one an operation
+  // without data.
+  for (int i = 0; i < 3; i++) {
+    payload_.manifest_.add_partitions()->set_partition_name(
+        "part" + std::to_string(i));
+  }
+  InstallOperation* op =
+      payload_.manifest_.mutable_partitions(0)->add_operations();
+  op->set_type(InstallOperation::REPLACE);
+  op->set_data_offset(0);
+  op->set_data_length(3);
+  payload_.manifest_.mutable_partitions(2)->add_operations()->set_type(
+      InstallOperation::ZERO);
+  op = payload_.manifest_.mutable_partitions(2)->add_operations();
+  op->set_type(InstallOperation::REPLACE);
+  op->set_data_offset(3);
+  op->set_data_length(5);
+
+  uint64_t blobs_size = 8;
+  EXPECT_TRUE(payload_.InsertOperationsSegments(
+      orig_blobs.path(), {0, 3, 3}, new_blobs.path(), &blobs_size));
+  string new_data;
+  EXPECT_TRUE(utils::ReadFile(new_blobs.path(), &new_data));
+  EXPECT_EQ(blobs_size, new_data.size());
+  EXPECT_FALSE(payload_.manifest_.partitions(1).has_operations_segment());
+
+  uint64_t expected_offset = 0;
+  for (int i : {0, 2}) {
+    const PartitionUpdate& partition = payload_.manifest_.partitions(i);
+    EXPECT_EQ(0, partition.operations_size());
+    const OperationsSegment& segment = partition.operations_segment();
+    EXPECT_EQ(expected_offset, segment.data_offset());
+    const string data =
+        new_data.substr(segment.data_offset(), segment.data_length());
+    brillo::Blob hash;
+    EXPECT_TRUE(
+        HashCalculator::RawHashOfBytes(data.data(), data.size(), &hash));
+    EXPECT_EQ(ToStringView(hash), segment.sha256_hash());
+
+    PartitionOperations operations;
+    EXPECT_TRUE(operations.ParseFromString(data));
+    EXPECT_EQ(segment.num_operations(), operations.operations_size());
+    // The data of the operations directly follows the segment.
+    const InstallOperation& last_op =
+        operations.operations(operations.operations_size() - 1);
+    EXPECT_EQ(segment.data_offset() + segment.data_length(),
+              last_op.data_offset());
+    EXPECT_EQ(i == 0 ? "xyz" : "abcde",
+              new_data.substr(last_op.data_offset(), last_op.data_length()));
+    expected_offset = last_op.data_offset() + last_op.data_length();
+  }
+  EXPECT_EQ(blobs_size, expected_offset);
 }
 
 }  // namespace chromeos_update_engine
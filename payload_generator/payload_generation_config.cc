@@ -29,6 +29,7 @@
 #include "bsdiff/constants.h"
 #include "payload_consumer/payload_constants.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/shared_blobs.h"
 #include "update_engine/payload_generator/boot_img_filesystem.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/delta_diff_utils.h"
@@ -62,6 +63,8 @@ void VerityConfig::Clear() {
   fec_data_extent.Clear();
   fec_extent.Clear();
   fec_roots = 0;
+  hash_tree_in_payload = false;
+  fec_in_payload = false;
 }
 
 bool PartitionConfig::ValidateExists() const {
@@ -282,6 +285,119 @@ PayloadVersion::PayloadVersion(uint64_t major_version, uint32_t minor_version) {
   minor = minor_version;
 }
 
+bool ApplyCostModel::Load(const brillo::KeyValueStore& store) {
+  string value;
+  if (!store.GetString("DOWNLOAD_BYTES_PER_SECOND", &value) ||
+      !base::StringToUint64(value, &download_bytes_per_second) ||
+      download_bytes_per_second == 0) {
+    LOG(ERROR) << "Invalid or missing DOWNLOAD_BYTES_PER_SECOND in the apply "
+                  "cost profile.";
+    return false;
+  }
+  apply_ms_per_mib.clear();
+  for (int type = InstallOperation::Type_MIN;
+       type <= InstallOperation::Type_MAX;
+       type++) {
+    if (!InstallOperation::Type_IsValid(type))
+      continue;
+    const string key =
+        "APPLY_MS_PER_MIB_" +
+        InstallOperation::Type_Name(static_cast<InstallOperation::Type>(type));
+    if (!store.GetString(key, &value))
+      continue;
+    double ms_per_mib{};
+    if (!base::StringToDouble(value, &ms_per_mib) || ms_per_mib < 0) {
+      LOG(ERROR) << key << " = " << value << " is not a valid apply time.";
+      return false;
+    }
+    apply_ms_per_mib[static_cast<InstallOperation::Type>(type)] = ms_per_mib;
+  }
+  for (const auto& [key, ms_per_mib] :
+       {std::make_pair("VERITY_HASH_TREE_MS_PER_MIB",
+                       &verity_hash_tree_ms_per_mib),
+        std::make_pair("VERITY_FEC_MS_PER_MIB", &verity_fec_ms_per_mib)}) {
+    if (store.GetString(key, &value) &&
+        (!base::StringToDouble(value, ms_per_mib) || *ms_per_mib < 0)) {
+      LOG(ERROR) << key << " = " << value << " is not a valid compute time.";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ApplyCostModel::IsEmpty() const {
+  return download_bytes_per_second == 0;
+}
+
+uint64_t ApplyCostModel::Cost(InstallOperation::Type type,
+                              uint64_t blob_size,
+                              uint64_t dst_size) const {
+  if (IsEmpty())
+    return blob_size;
+  return blob_size + ApplyMicros(type, dst_size) * download_bytes_per_second /
+                         1000000;
+}
+
+uint64_t ApplyCostModel::ApplyMicros(InstallOperation::Type type,
+                                     uint64_t dst_size) const {
+  double ms_per_mib{};
+  const auto it = apply_ms_per_mib.find(type);
+  if (it != apply_ms_per_mib.end()) {
+    ms_per_mib = it->second;
+  } else {
+    // Typical times on a mid-range device.
+    switch (type) {
+      case InstallOperation::ZERO:
+      case InstallOperation::DISCARD:
+        ms_per_mib = 1;
+        break;
+      case InstallOperation::REPLACE:
+        ms_per_mib = 2;
+        break;
+      case InstallOperation::REPLACE_ZSTD:
+        ms_per_mib = 5;
+        break;
+      case InstallOperation::MOVE:
+      case InstallOperation::SOURCE_COPY:
+      case InstallOperation::TARGET_COPY:
+        ms_per_mib = 4;
+        break;
+      case InstallOperation::REPLACE_XZ:
+        ms_per_mib = 25;
+        break;
+      case InstallOperation::BSDIFF:
+      case InstallOperation::SOURCE_BSDIFF:
+        ms_per_mib = 30;
+        break;
+      case InstallOperation::BROTLI_BSDIFF:
+        ms_per_mib = 35;
+        break;
+      case InstallOperation::REPLACE_BZ:
+        ms_per_mib = 60;
+        break;
+      case InstallOperation::LZ4DIFF_BSDIFF:
+        ms_per_mib = 100;
+        break;
+      case InstallOperation::ZUCCHINI:
+        ms_per_mib = 150;
+        break;
+      case InstallOperation::PUFFDIFF:
+        ms_per_mib = 250;
+        break;
+      case InstallOperation::LZ4DIFF_PUFFDIFF:
+        ms_per_mib = 300;
+        break;
+    }
+  }
+  return static_cast<uint64_t>(ms_per_mib * 1000 * dst_size / (1024 * 1024));
+}
+
+uint64_t ApplyCostModel::VerityMicros(bool fec, uint64_t data_size) const {
+  const double ms_per_mib =
+      fec ? verity_fec_ms_per_mib : verity_hash_tree_ms_per_mib;
+  return static_cast<uint64_t>(ms_per_mib * 1000 * data_size / (1024 * 1024));
+}
+
 bool PayloadVersion::Validate() const {
   TEST_AND_RETURN_FALSE(major == kBrilloMajorPayloadVersion);
   TEST_AND_RETURN_FALSE(minor == kFullPayloadMinorVersion ||
@@ -292,7 +408,9 @@ bool PayloadVersion::Validate() const {
                         minor == kVerityMinorPayloadVersion ||
                         minor == kPartialUpdateMinorPayloadVersion ||
                         minor == kZucchiniMinorPayloadVersion ||
-                        minor == kLZ4DIFFMinorPayloadVersion);
+                        minor == kLZ4DIFFMinorPayloadVersion ||
+                        minor == kZstdMinorPayloadVersion ||
+                        minor == kTargetCopyMinorPayloadVersion);
   return true;
 }
 
@@ -330,6 +448,16 @@ bool PayloadVersion::OperationAllowed(InstallOperation::Type operation) const {
     case InstallOperation::LZ4DIFF_PUFFDIFF:
       return minor >= kLZ4DIFFMinorPayloadVersion;
 
+    case InstallOperation::REPLACE_ZSTD:
+      // Full payloads don't tell the clients' version, they are only
+      // generated with it when asked to, see
+      // PayloadGenerationConfig::enable_zstd.
+      return minor >= kZstdMinorPayloadVersion ||
+             minor == kFullPayloadMinorVersion;
+
+    case InstallOperation::TARGET_COPY:
+      return minor >= kTargetCopyMinorPayloadVersion;
+
     case InstallOperation::MOVE:
     case InstallOperation::BSDIFF:
       NOTREACHED();
@@ -378,6 +506,31 @@ bool PayloadGenerationConfig::Validate() const {
   TEST_AND_RETURN_FALSE(soft_chunk_size % block_size == 0);
 
   TEST_AND_RETURN_FALSE(rootfs_partition_size % block_size == 0);
+  TEST_AND_RETURN_FALSE(diff_cache_shard < diff_cache_shards);
+  TEST_AND_RETURN_FALSE(diff_cache_shards == 1 || !diff_cache_dir.empty());
+  TEST_AND_RETURN_FALSE(max_shared_blobs_size <= kMaxSharedBlobsSize);
+  if (operations_segments) {
+    // The blobs of a segmented partition can't reference earlier ones.
+    TEST_AND_RETURN_FALSE(max_shared_blobs_size == 0);
+    // Virtual A/B without compression sizes the snapshots from the operations
+    // in the manifest.
+    const auto& metadata = target.dynamic_partition_metadata;
+    TEST_AND_RETURN_FALSE(!metadata || !metadata->snapshot_enabled() ||
+                          metadata->vabc_enabled());
+  }
+  if (enable_zstd) {
+    TEST_AND_RETURN_FALSE(
+        version.OperationAllowed(InstallOperation::REPLACE_ZSTD));
+  } else {
+    TEST_AND_RETURN_FALSE(zstd_dictionary_size == 0);
+  }
+  if (enable_target_copy) {
+    TEST_AND_RETURN_FALSE(
+        version.OperationAllowed(InstallOperation::TARGET_COPY));
+    // The COW of Virtual A/B compression can't be read back before the merge.
+    const auto& metadata = target.dynamic_partition_metadata;
+    TEST_AND_RETURN_FALSE(!metadata || !metadata->vabc_enabled());
+  }
 
   return true;
 }
@@ -401,6 +554,35 @@ void PayloadGenerationConfig::ParseCompressorTypes(
   }
 }
 
+void PayloadGenerationConfig::ChooseVerityDataInPayload() {
+  // The data is assumed not to compress nor diff, so that the estimated
+  // download time is an upper bound.
+  const auto in_payload = [this](const PartitionConfig& part,
+                                 bool fec,
+                                 const Extent& data_extent,
+                                 const Extent& extent) {
+    if (extent.num_blocks() == 0) {
+      return false;
+    }
+    const uint64_t compute_bytes =
+        apply_cost_model.VerityMicros(fec,
+                                      data_extent.num_blocks() * block_size) *
+        apply_cost_model.download_bytes_per_second / 1000000;
+    const uint64_t size = extent.num_blocks() * block_size;
+    LOG(INFO) << "Computing the verity " << (fec ? "FEC" : "hash tree")
+              << " of " << part.name << " takes as long as downloading "
+              << compute_bytes << " bytes, it has " << size << " bytes.";
+    return compute_bytes > size;
+  };
+  for (PartitionConfig& part : target.partitions) {
+    VerityConfig& verity = part.verity;
+    verity.hash_tree_in_payload = in_payload(
+        part, false, verity.hash_tree_data_extent, verity.hash_tree_extent);
+    verity.fec_in_payload =
+        in_payload(part, true, verity.fec_data_extent, verity.fec_extent);
+  }
+}
+
 bool PayloadGenerationConfig::OperationEnabled(
     InstallOperation::Type op) const noexcept {
   if (!version.OperationAllowed(op)) {
@@ -414,6 +596,10 @@ bool PayloadGenerationConfig::OperationEnabled(
       return enable_lz4diff;
     case InstallOperation::PUFFDIFF:
       return enable_puffdiff;
+    case InstallOperation::REPLACE_ZSTD:
+      return enable_zstd;
+    case InstallOperation::TARGET_COPY:
+      return enable_target_copy;
     default:
       return true;
   }
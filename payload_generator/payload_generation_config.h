@@ -19,6 +19,7 @@
 
 #include <cstddef>
 
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -81,6 +82,11 @@ struct VerityConfig {
 
   // The number of FEC roots.
   uint32_t fec_roots = 0;
+
+  // Whether the hash tree and the FEC data, respectively, are written by the
+  // operations of the partition instead of being computed on the device.
+  bool hash_tree_in_payload = false;
+  bool fec_in_payload = false;
 };
 
 struct PartitionConfig {
@@ -110,6 +116,10 @@ struct PartitionConfig {
   // filesystem and describes the blocks used by each file.
   std::string mapfile_path;
 
+  // The path to this partition in the target of
+  // PayloadGenerationConfig::previous_payload, if any.
+  std::string previous_path;
+
   // The size of the data in |path|. If rootfs verification is used (verity)
   // this value should match the size of the verity device for the rootfs, and
   // the size of the whole kernel. This value could be smaller than the
@@ -192,6 +202,47 @@ struct PayloadVersion {
   uint32_t minor;
 };
 
+// A model of the time the devices take to apply the operations, used to
+// choose between the candidate operations by the estimated time to download
+// and apply them rather than by their size only.
+struct ApplyCostModel {
+  // Loads the model from a device profile with the download throughput of the
+  // devices in bytes per second in DOWNLOAD_BYTES_PER_SECOND and the time to
+  // apply each operation type in milliseconds per MiB written in
+  // APPLY_MS_PER_MIB_<type>, like APPLY_MS_PER_MIB_PUFFDIFF=200. The types
+  // missing from the profile take a typical time relative to the others.
+  // The time to compute the verity hash tree and FEC data, in milliseconds per
+  // MiB of data they cover, can be given in VERITY_HASH_TREE_MS_PER_MIB and
+  // VERITY_FEC_MS_PER_MIB.
+  bool Load(const brillo::KeyValueStore& store);
+
+  // Whether no profile was loaded, in which case the cost of an operation is
+  // the size of its data.
+  bool IsEmpty() const;
+
+  // Returns the cost of an operation of |type| with |blob_size| bytes of data
+  // writing |dst_size| bytes, as the bytes downloaded in the time it takes.
+  uint64_t Cost(InstallOperation::Type type,
+                uint64_t blob_size,
+                uint64_t dst_size) const;
+
+  // Returns the estimated time in microseconds to apply an operation of |type|
+  // writing |dst_size| bytes, also if no profile was loaded.
+  uint64_t ApplyMicros(InstallOperation::Type type, uint64_t dst_size) const;
+
+  // Returns the estimated time in microseconds to compute the verity hash tree
+  // or, if |fec|, the FEC data of |data_size| bytes on the device.
+  uint64_t VerityMicros(bool fec, uint64_t data_size) const;
+
+  uint64_t download_bytes_per_second = 0;
+
+  std::map<InstallOperation::Type, double> apply_ms_per_mib;
+
+  // Typical times on a low-end device, where the FEC takes minutes.
+  double verity_hash_tree_ms_per_mib = 5;
+  double verity_fec_ms_per_mib = 40;
+};
+
 // The PayloadGenerationConfig struct encapsulates all the configuration to
 // build the requested payload. This includes information about the old and new
 // image as well as the restrictions applied to the payload (like minor-version
@@ -202,6 +253,11 @@ struct PayloadGenerationConfig {
 
   void ParseCompressorTypes(const std::string& compressor_types);
 
+  // Ships the verity hash tree and FEC data of the target partitions in the
+  // payload when the devices described by |apply_cost_model| would take
+  // longer to compute them than to download them.
+  void ChooseVerityDataInPayload();
+
   // Image information about the new image that's the target of this payload.
   ImageConfig target;
 
@@ -264,10 +320,115 @@ struct PayloadGenerationConfig {
   // Whether to enable puffdiff ops
   bool enable_puffdiff = true;
 
+  // Whether to record the hash of the data each operation writes, so that
+  // clients can skip the operations whose target data is already correct.
+  bool add_dst_hashes = false;
+
+  // Whether to record the estimated CPU cost and memory needed to apply each
+  // operation and partition, see |apply_cost_model|.
+  bool add_apply_hints = false;
+
+  // The REPLACE operations with the same data blob as an earlier one, e.g. in
+  // another partition, reference its blob instead of another copy, as long
+  // as the blobs shared total at most this many bytes, which the clients
+  // keep in memory. Clients without support for it can't apply the payload.
+  // 0 doesn't share blobs.
+  uint64_t max_shared_blobs_size = 0;
+
+  // Whether to store the operations of each partition in a segment of the data
+  // blobs right before their data, referenced from the manifest, so that
+  // clients start applying the payload without downloading all of them first.
+  // Clients without support for it can't apply the payload. Can't be combined
+  // with |max_shared_blobs_size|.
+  bool operations_segments = false;
+
+  // Whether the full operations may be REPLACE_ZSTD, which is much faster to
+  // decompress than REPLACE_XZ. Without an |apply_cost_model| it is preferred
+  // to the other compressors. Clients without support for it can't apply the
+  // payload.
+  bool enable_zstd = false;
+
+  // With |enable_zstd|, the maximum size of the zstd dictionary trained on
+  // each partition and shipped with it. 0 doesn't train dictionaries.
+  size_t zstd_dictionary_size = 0;
+
+  // Whether the blocks repeated within a new partition may be copied with
+  // TARGET_COPY from the first copy written instead of being diffed again.
+  // Virtual A/B compression can't read the target back, so it can't be
+  // combined with it.
+  bool enable_target_copy = false;
+
   std::string security_patch_level;
 
+  // The sizes of the signatures to reserve in a payload generated without a
+  // private key, as passed to PayloadSigner::HashPayloadForSigning(), so that
+  // the hashes for signing it are computed while it is written.
+  std::vector<size_t> signature_sizes;
+
   uint32_t max_threads = 0;
 
+  // The memory the files diffed at once are estimated to use is kept under
+  // this many bytes by delaying the files which don't fit, see MemoryBudget.
+  // 0 doesn't limit it.
+  uint64_t max_memory_bytes = 0;
+
+  // If not empty, the directory of a DiffCache of the diff operations, shared
+  // by the payloads generated to the same target.
+  std::string diff_cache_dir;
+
+  // With several shards, only the diffs of the DiffCache entries in the shard
+  // |diff_cache_shard| are computed and cached, and the operations of the
+  // other ones missing from the cache are left full. The generators of every
+  // shard, on different hosts sharing |diff_cache_dir|, fill the cache so
+  // that a last generator without shards only reads it, and writes the same
+  // payload as if it computed all the diffs.
+  uint32_t diff_cache_shard = 0;
+  uint32_t diff_cache_shards = 1;
+
+  // The maximum memory used to cache the suffix arrays of the bsdiff sources
+  // across operations, see SuffixArrayCache. 0 disables the cache.
+  size_t suffix_array_cache_bytes = 0;
+
+  // The maximum memory used to cache the decompressed sources of the LZ4DIFF
+  // operations, see Lz4diffSourceCache. 0 disables the cache.
+  size_t lz4diff_source_cache_bytes = 0;
+
+  // Whether the chunks of the files split in several operations are diffed
+  // against the whole old file, rather than its chunk at the same offset.
+  // This finds the data moved across chunks at the cost of reading the whole
+  // old file for every chunk on the device, and is best used with the suffix
+  // array cache so that the old file is sorted once.
+  bool diff_chunks_against_whole_file = false;
+
+  // Whether the chunks of the files split in several operations are diffed
+  // against the old chunk their data moved from when it moved by a number of
+  // bytes which isn't a multiple of the block size, found with a rolling
+  // hash of the nearby old chunks. Ignored with
+  // |diff_chunks_against_whole_file|.
+  bool find_shifted_chunks = false;
+
+  // If not 0, the chunks the files are split in are sized for each file from
+  // its content, from |hard_chunk_size| up to the size whose diff operations
+  // need at most this many bytes of memory to apply on the device: the files
+  // with compressible data get larger chunks, which compress better in fewer
+  // operations, as long as they still spread over the threads.
+  uint64_t adaptive_chunk_apply_memory_bytes = 0;
+
+  // Whether the compressors and diff algorithms unlikely to produce a smaller
+  // operation are skipped, based on the entropy of the new data and on the
+  // size of the best operation found so far. Otherwise all the allowed ones
+  // are tried and the smallest result wins.
+  bool fast_algorithm_selection = false;
+
+  // The apply cost model that the candidate operations are compared with. If
+  // empty, the smallest operation wins.
+  ApplyCostModel apply_cost_model;
+
+  // If not empty, a payload previously generated from the same source, whose
+  // operations still valid for this payload are reused instead of diffing
+  // their blocks again. See ReusePreviousOperations().
+  std::string previous_payload;
+
   std::vector<bsdiff::CompressorType> compressors{
       bsdiff::CompressorType::kBZ2, bsdiff::CompressorType::kBrotli};
 
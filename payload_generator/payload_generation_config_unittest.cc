@@ -20,6 +20,8 @@
 
 #include <gtest/gtest.h>
 
+#include "update_engine/payload_generator/extent_ranges.h"
+
 namespace chromeos_update_engine {
 
 class PayloadGenerationConfigTest : public ::testing::Test {};
@@ -142,4 +144,79 @@ TEST_F(PayloadGenerationConfigTest, ValidateDynamicPartitionMetadataTooBig) {
 
   EXPECT_FALSE(image_config.ValidateDynamicPartitionMetadata());
 }
+
+TEST_F(PayloadGenerationConfigTest, LoadApplyCostModelTest) {
+  ApplyCostModel cost_model;
+  EXPECT_TRUE(cost_model.IsEmpty());
+  EXPECT_EQ(1000u, cost_model.Cost(InstallOperation::PUFFDIFF, 1000, 1000));
+
+  brillo::KeyValueStore store;
+  ASSERT_TRUE(
+      store.LoadFromString("DOWNLOAD_BYTES_PER_SECOND=1048576
+"
+                           "APPLY_MS_PER_MIB_PUFFDIFF=500
+"
+                           "APPLY_MS_PER_MIB_REPLACE=0.5
+"));
+  EXPECT_TRUE(cost_model.Load(store));
+  EXPECT_FALSE(cost_model.IsEmpty());
+  // Writing 2 MiB takes 1 second, as long as downloading 1 MiB.
+  EXPECT_EQ(1000u + 1048576,
+            cost_model.Cost(InstallOperation::PUFFDIFF, 1000, 2 * 1048576));
+  EXPECT_EQ(1000u + 1048,
+            cost_model.Cost(InstallOperation::REPLACE, 1000, 2 * 1048576));
+  // The missing types use the typical times.
+  EXPECT_EQ(50000u, cost_model.ApplyMicros(InstallOperation::REPLACE_XZ,
+                                           2 * 1048576));
+  EXPECT_EQ(1000u + 52428,
+            cost_model.Cost(InstallOperation::REPLACE_XZ, 1000, 2 * 1048576));
+}
+
+TEST_F(PayloadGenerationConfigTest, LoadApplyCostModelInvalidTest) {
+  ApplyCostModel cost_model;
+  brillo::KeyValueStore store;
+  ASSERT_TRUE(store.LoadFromString("APPLY_MS_PER_MIB_PUFFDIFF=500
+"));
+  EXPECT_FALSE(cost_model.Load(store));
+
+  ASSERT_TRUE(
+      store.LoadFromString("DOWNLOAD_BYTES_PER_SECOND=1048576
+"
+                           "APPLY_MS_PER_MIB_PUFFDIFF=slow
+"));
+  EXPECT_FALSE(cost_model.Load(store));
+}
+
+TEST_F(PayloadGenerationConfigTest, ChooseVerityDataInPayloadTest) {
+  PayloadGenerationConfig config;
+  brillo::KeyValueStore store;
+  // 1 MiB/s downloads, 40 ms per MiB to compute the FEC, 1 ms for the tree.
+  ASSERT_TRUE(
+      store.LoadFromString("DOWNLOAD_BYTES_PER_SECOND=1048576\n"
+                           "VERITY_HASH_TREE_MS_PER_MIB=1\n"
+                           "VERITY_FEC_MS_PER_MIB=40\n"));
+  ASSERT_TRUE(config.apply_cost_model.Load(store));
+  EXPECT_EQ(40960000u, config.apply_cost_model.VerityMicros(true, 1 << 30));
+
+  // A 1 GiB partition with an 8 MiB hash tree and FEC data.
+  config.target.partitions.emplace_back("system");
+  VerityConfig& verity = config.target.partitions.back().verity;
+  verity.hash_tree_data_extent = ExtentForRange(0, 262144);
+  verity.hash_tree_extent = ExtentForRange(262144, 2048);
+  verity.fec_data_extent = ExtentForRange(0, 264192);
+  verity.fec_extent = ExtentForRange(264192, 2048);
+  // A partition without verity.
+  config.target.partitions.emplace_back("vendor");
+
+  config.ChooseVerityDataInPayload();
+  EXPECT_FALSE(verity.hash_tree_in_payload);
+  EXPECT_TRUE(verity.fec_in_payload);
+  EXPECT_FALSE(config.target.partitions.back().verity.hash_tree_in_payload);
+  EXPECT_FALSE(config.target.partitions.back().verity.fec_in_payload);
+
+  ASSERT_TRUE(store.LoadFromString("DOWNLOAD_BYTES_PER_SECOND=1048576\n"
+                                   "VERITY_FEC_MS_PER_MIB=fast\n"));
+  EXPECT_FALSE(config.apply_cost_model.Load(store));
+}
+
 }  // namespace chromeos_update_engine
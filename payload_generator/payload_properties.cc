@@ -16,12 +16,16 @@
 
 #include "update_engine/payload_generator/payload_properties.h"
 
+#include <sys/mman.h>
+
 #include <algorithm>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <base/files/memory_mapped_file.h>
 #include <base/json/json_writer.h>
+#include <base/strings/string_number_conversions.h>
 #include <base/strings/string_util.h>
 #include <base/values.h>
 #include <brillo/data_encoding.h>
@@ -51,10 +55,39 @@ const char kPayloadPropertyJsonIsDelta[] = "is_delta";
 // These are JSON specific properties to handle 64-bit sizes (> 53-bits).
 const char kPayloadPropertyJsonMetadataSizeStr[] = "metadata_size_str";
 const char kPayloadPropertyJsonPayloadSizeStr[] = "size_str";
+
+// The modification time of the payload in the hashes file, in nanoseconds.
+const char kPayloadHashesFileMtime[] = "FILE_MTIME_NS";
+
+string MtimeNs(const struct stat& payload_stat) {
+  return std::to_string(static_cast<int64_t>(payload_stat.st_mtim.tv_sec) *
+                            1000000000 +
+                        payload_stat.st_mtim.tv_nsec);
+}
 }  // namespace
 
-PayloadProperties::PayloadProperties(const string& payload_path)
-    : payload_path_(payload_path) {}
+bool WritePayloadHashesFile(const string& hashes_path,
+                            const string& payload_path,
+                            uint64_t metadata_size,
+                            const brillo::Blob& metadata_hash,
+                            const brillo::Blob& file_hash) {
+  struct stat payload_stat;
+  TEST_AND_RETURN_FALSE_ERRNO(stat(payload_path.c_str(), &payload_stat) == 0);
+  brillo::KeyValueStore hashes;
+  hashes.SetString(kPayloadPropertyFileSize,
+                   std::to_string(payload_stat.st_size));
+  hashes.SetString(kPayloadHashesFileMtime, MtimeNs(payload_stat));
+  hashes.SetString(kPayloadPropertyMetadataSize, std::to_string(metadata_size));
+  hashes.SetString(kPayloadPropertyFileHash,
+                   brillo::data_encoding::Base64Encode(file_hash));
+  hashes.SetString(kPayloadPropertyMetadataHash,
+                   brillo::data_encoding::Base64Encode(metadata_hash));
+  return hashes.Save(base::FilePath(hashes_path));
+}
+
+PayloadProperties::PayloadProperties(const string& payload_path,
+                                     const string& hashes_path)
+    : payload_path_(payload_path), hashes_path_(hashes_path) {}
 
 bool PayloadProperties::GetPropertiesAsJson(string* json_str) {
   TEST_AND_RETURN_FALSE(LoadFromPayload());
@@ -89,29 +122,75 @@ bool PayloadProperties::GetPropertiesAsKeyValue(string* key_value_str) {
   return true;
 }
 
+bool PayloadProperties::LoadHashesFile(const struct stat& payload_stat) {
+  brillo::KeyValueStore hashes;
+  if (!hashes.Load(base::FilePath(hashes_path_))) {
+    LOG(WARNING) << "Failed to load the payload hashes from " << hashes_path_;
+    return false;
+  }
+  string file_size, mtime, metadata_size;
+  if (!hashes.GetString(kPayloadPropertyFileSize, &file_size) ||
+      !hashes.GetString(kPayloadHashesFileMtime, &mtime) ||
+      !hashes.GetString(kPayloadPropertyMetadataSize, &metadata_size) ||
+      !hashes.GetString(kPayloadPropertyFileHash, &payload_hash_) ||
+      !hashes.GetString(kPayloadPropertyMetadataHash, &metadata_hash_)) {
+    LOG(WARNING) << "Incomplete payload hashes in " << hashes_path_;
+    return false;
+  }
+  if (file_size != std::to_string(payload_size_) ||
+      mtime != MtimeNs(payload_stat) ||
+      metadata_size != std::to_string(metadata_size_)) {
+    LOG(WARNING) << "The payload hashes in " << hashes_path_
+                 << " are stale, hashing " << payload_path_ << " again.";
+    return false;
+  }
+  return true;
+}
+
 bool PayloadProperties::LoadFromPayload() {
+  if (loaded_) {
+    return true;
+  }
+  base::MemoryMappedFile payload;
+  TEST_AND_RETURN_FALSE(payload.Initialize(base::FilePath(payload_path_)));
+  struct stat payload_stat;
+  TEST_AND_RETURN_FALSE_ERRNO(stat(payload_path_.c_str(), &payload_stat) == 0);
+
   PayloadMetadata payload_metadata;
+  ErrorCode error;
+  TEST_AND_RETURN_FALSE(payload_metadata.ParsePayloadHeader(
+                            payload.data(), payload.length(), &error) ==
+                        MetadataParseResult::kSuccess);
   DeltaArchiveManifest manifest;
-  Signatures metadata_signatures;
-  TEST_AND_RETURN_FALSE(payload_metadata.ParsePayloadFile(
-      payload_path_, &manifest, &metadata_signatures));
-
+  TEST_AND_RETURN_FALSE(payload_metadata.GetManifest(
+      payload.data(), payload.length(), &manifest));
   metadata_size_ = payload_metadata.GetMetadataSize();
-  payload_size_ = utils::FileSize(payload_path_);
-
-  brillo::Blob metadata_hash;
-  TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfFile(
-                            payload_path_, metadata_size_, &metadata_hash) ==
-                        static_cast<off_t>(metadata_size_));
-  metadata_hash_ = brillo::data_encoding::Base64Encode(metadata_hash);
-
-  brillo::Blob payload_hash;
-  TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfFile(
-                            payload_path_, payload_size_, &payload_hash) ==
-                        static_cast<off_t>(payload_size_));
-  payload_hash_ = brillo::data_encoding::Base64Encode(payload_hash);
+  payload_size_ = payload.length();
+  const uint32_t metadata_signature_size =
+      payload_metadata.GetMetadataSignatureSize();
+  TEST_AND_RETURN_FALSE(metadata_size_ + metadata_signature_size <=
+                        payload_size_);
+
+  if (hashes_path_.empty() || !LoadHashesFile(payload_stat)) {
+    // Hash the whole payload in a single pass over the mapping, the metadata
+    // hash being a prefix of it.
+    madvise(const_cast<uint8_t*>(payload.data()),
+            payload.length(),
+            MADV_SEQUENTIAL);
+    brillo::Blob metadata_hash;
+    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfBytes(
+        payload.data(), metadata_size_, &metadata_hash));
+    metadata_hash_ = brillo::data_encoding::Base64Encode(metadata_hash);
+    brillo::Blob payload_hash;
+    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfBytes(
+        payload.data(), payload.length(), &payload_hash));
+    payload_hash_ = brillo::data_encoding::Base64Encode(payload_hash);
+  }
 
-  if (payload_metadata.GetMetadataSignatureSize() > 0) {
+  if (metadata_signature_size > 0) {
+    Signatures metadata_signatures;
+    TEST_AND_RETURN_FALSE(metadata_signatures.ParseFromArray(
+        payload.data() + metadata_size_, metadata_signature_size));
     TEST_AND_RETURN_FALSE(metadata_signatures.signatures_size() > 0);
     vector<string> base64_signatures;
     for (const auto& sig : metadata_signatures.signatures()) {
@@ -126,6 +205,7 @@ bool PayloadProperties::LoadFromPayload() {
                           [](const PartitionUpdate& part) {
                             return part.has_old_partition_info();
                           });
+  loaded_ = true;
   return true;
 }
 
@@ -17,6 +17,8 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_PROPERTIES_H_
 #define UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_PROPERTIES_H_
 
+#include <sys/stat.h>
+
 #include <string>
 
 #include <brillo/key_value_store.h>
@@ -24,12 +26,26 @@
 
 namespace chromeos_update_engine {
 
+// Writes the hashes of the payload at |payload_path|, computed while writing
+// it, into the file |hashes_path|, so that PayloadProperties doesn't need to
+// hash the payload again. The file records the size and modification time of
+// the payload, and is ignored if the payload changes.
+bool WritePayloadHashesFile(const std::string& hashes_path,
+                            const std::string& payload_path,
+                            uint64_t metadata_size,
+                            const brillo::Blob& metadata_hash,
+                            const brillo::Blob& file_hash);
+
 // A class for extracting information about a payload from the payload file
 // itself. Currently the metadata can be exported as a json file or a key/value
 // properties file. But more can be added if required.
 class PayloadProperties {
  public:
-  explicit PayloadProperties(const std::string& payload_path);
+  // If |hashes_path| is not empty, the hashes written there by
+  // WritePayloadHashesFile() are used instead of hashing the payload, as long
+  // as they still match it.
+  explicit PayloadProperties(const std::string& payload_path,
+                             const std::string& hashes_path = "");
   ~PayloadProperties() = default;
 
   // Get the properties in a json format. The json file will be used in
@@ -42,12 +58,21 @@ class PayloadProperties {
 
  private:
   // Does the main job of reading the payload and extracting information from
-  // it.
+  // it. Only reads the payload the first time it's called.
   bool LoadFromPayload();
 
+  // Loads the hashes from |hashes_path_|. Returns false if there are none, or
+  // they don't match the payload.
+  bool LoadHashesFile(const struct stat& payload_stat);
+
   // The path to the payload file.
   std::string payload_path_;
 
+  // The path to the file with the precomputed hashes, if any.
+  std::string hashes_path_;
+
+  bool loaded_{false};
+
   // The version of the metadata json format. If the output json file changes
   // format, this needs to be increased.
   int version_{2};
@@ -90,12 +90,19 @@ class PayloadPropertiesTest : public ::testing::Test {
 
     payload.AddPartition(old_part, new_part, aops, {}, {});
 
-    uint64_t metadata_size;
-    EXPECT_TRUE(payload.WritePayload(
-        payload_file_.path(), data_file.path(), "", &metadata_size));
+    EXPECT_TRUE(payload.WritePayload(payload_file_.path(),
+                                     data_file.path(),
+                                     "",
+                                     &metadata_size_,
+                                     nullptr,
+                                     &metadata_hash_,
+                                     &file_hash_));
   }
 
   ScopedTempFile payload_file_{"payload_file.XXXXXX"};
+  uint64_t metadata_size_;
+  brillo::Blob metadata_hash_;
+  brillo::Blob file_hash_;
 };
 
 // Validate the hash of file exists within the output.
@@ -131,4 +138,39 @@ TEST_F(PayloadPropertiesTest, GetPropertiesAsKeyValueTestHash) {
                                             << key_value;
 }
 
+// The hashes computed while writing the payload match the ones of the file.
+TEST_F(PayloadPropertiesTest, GetPropertiesFromHashesFile) {
+  string expected;
+  EXPECT_TRUE(PayloadProperties{payload_file_.path()}.GetPropertiesAsKeyValue(
+      &expected));
+  ScopedTempFile hashes_file("hashes.XXXXXX");
+  EXPECT_TRUE(WritePayloadHashesFile(hashes_file.path(),
+                                     payload_file_.path(),
+                                     metadata_size_,
+                                     metadata_hash_,
+                                     file_hash_));
+  string key_value;
+  EXPECT_TRUE(PayloadProperties(payload_file_.path(), hashes_file.path())
+                  .GetPropertiesAsKeyValue(&key_value));
+  EXPECT_EQ(expected, key_value);
+
+  // Bogus hashes are used as long as the payload didn't change.
+  EXPECT_TRUE(WritePayloadHashesFile(hashes_file.path(),
+                                     payload_file_.path(),
+                                     metadata_size_,
+                                     file_hash_,
+                                     metadata_hash_));
+  EXPECT_TRUE(PayloadProperties(payload_file_.path(), hashes_file.path())
+                  .GetPropertiesAsKeyValue(&key_value));
+  EXPECT_NE(expected, key_value);
+
+  // Once the payload is modified, they are ignored.
+  EXPECT_TRUE(base::TouchFile(base::FilePath(payload_file_.path()),
+                              base::Time::UnixEpoch(),
+                              base::Time::UnixEpoch()));
+  EXPECT_TRUE(PayloadProperties(payload_file_.path(), hashes_file.path())
+                  .GetPropertiesAsKeyValue(&key_value));
+  EXPECT_EQ(expected, key_value);
+}
+
 }  // namespace chromeos_update_engine
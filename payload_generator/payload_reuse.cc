@@ -0,0 +1,161 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/payload_reuse.h"
+
+#include <string>
+#include <vector>
+
+#include <base/logging.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_metadata.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Returns whether the blocks that |op| writes are the same in the |new_size|
+// bytes of |new_path| and in |previous_path|.
+bool SameTargetData(const InstallOperation& op,
+                    const string& previous_path,
+                    const string& new_path,
+                    uint64_t new_size) {
+  for (const Extent& extent : op.dst_extents()) {
+    if (extent.start_block() + extent.num_blocks() > new_size / kBlockSize)
+      return false;
+  }
+  brillo::Blob previous_data, new_data;
+  const auto& extents = op.dst_extents();
+  return utils::ReadExtents(
+             previous_path, extents, &previous_data, kBlockSize) &&
+         utils::ReadExtents(new_path, extents, &new_data, kBlockSize) &&
+         previous_data == new_data;
+}
+
+// Returns whether the blocks that |op| reads from |old_path| have its source
+// hash.
+bool SameSourceData(const InstallOperation& op, const string& old_path) {
+  if (op.src_extents_size() == 0)
+    return true;
+  if (!op.has_src_sha256_hash())
+    return false;
+  brillo::Blob old_data, hash;
+  const auto& extents = op.src_extents();
+  return utils::ReadExtents(old_path, extents, &old_data, kBlockSize) &&
+         HashCalculator::RawHashOfData(old_data, &hash) &&
+         op.src_sha256_hash() == string(hash.begin(), hash.end());
+}
+
+bool IsBsdiff(InstallOperation::Type type) {
+  return type == InstallOperation::SOURCE_BSDIFF ||
+         type == InstallOperation::BROTLI_BSDIFF;
+}
+
+}  // namespace
+
+bool ReusePreviousOperations(const PartitionConfig& old_part,
+                             const PartitionConfig& new_part,
+                             const PayloadGenerationConfig& config,
+                             BlobFileWriter* blob_file,
+                             vector<AnnotatedOperation>* aops,
+                             ExtentRanges* new_visited_blocks) {
+  if (config.previous_payload.empty() || new_part.previous_path.empty())
+    return true;
+
+  PayloadMetadata metadata;
+  DeltaArchiveManifest manifest;
+  TEST_AND_RETURN_FALSE(
+      metadata.ParsePayloadFile(config.previous_payload, &manifest, nullptr));
+  if (manifest.block_size() != config.block_size ||
+      manifest.minor_version() != config.version.minor) {
+    LOG(WARNING) << "The previous payload " << config.previous_payload
+                 << " has another version or block size, not reusing it.";
+    return true;
+  }
+  const PartitionUpdate* partition = nullptr;
+  for (const PartitionUpdate& previous_partition : manifest.partitions()) {
+    if (previous_partition.partition_name() == new_part.name)
+      partition = &previous_partition;
+  }
+  if (partition == nullptr)
+    return true;
+
+  const uint64_t data_offset =
+      metadata.GetMetadataSize() + metadata.GetMetadataSignatureSize();
+  size_t reused_blocks = 0;
+  size_t num_reused = 0;
+  for (const InstallOperation& op : partition->operations()) {
+    if (!config.OperationEnabled(op.type()) || op.dst_extents_size() == 0 ||
+        (op.src_extents_size() > 0 && !config.is_delta)) {
+      continue;
+    }
+    bool overlaps = false;
+    for (const Extent& extent : op.dst_extents())
+      overlaps = overlaps || new_visited_blocks->OverlapsWithExtent(extent);
+    if (overlaps) {
+      continue;
+    }
+    if (!SameTargetData(
+            op, new_part.previous_path, new_part.path, new_part.size) ||
+        !SameSourceData(op, old_part.path)) {
+      continue;
+    }
+
+    brillo::Blob blob;
+    if (op.data_length() > 0) {
+      TEST_AND_RETURN_FALSE(utils::ReadFileChunk(config.previous_payload,
+                                                 data_offset + op.data_offset(),
+                                                 op.data_length(),
+                                                 &blob));
+      TEST_AND_RETURN_FALSE(blob.size() == op.data_length());
+      if (op.has_data_sha256_hash()) {
+        brillo::Blob hash;
+        TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(blob, &hash));
+        TEST_AND_RETURN_FALSE(op.data_sha256_hash() ==
+                              string(hash.begin(), hash.end()));
+      }
+    }
+
+    AnnotatedOperation aop;
+    aop.name = "<reused>";
+    aop.op = op;
+    aop.op.clear_data_offset();
+    aop.op.clear_data_length();
+    aop.op.clear_data_sha256_hash();
+    if (config.enable_vabc_xor && IsBsdiff(op.type()))
+      TEST_AND_RETURN_FALSE(diff_utils::PopulateXorOps(&aop, blob));
+    TEST_AND_RETURN_FALSE(aop.SetOperationBlob(blob, blob_file));
+    aops->push_back(std::move(aop));
+    new_visited_blocks->AddRepeatedExtents(op.dst_extents());
+    reused_blocks += utils::BlocksInExtents(op.dst_extents());
+    num_reused++;
+  }
+  LOG(INFO) << "Reused " << num_reused << " of "
+            << partition->operations_size() << " operations, writing "
+            << reused_blocks << " blocks, of " << new_part.name
+            << " from the previous payload.";
+  return true;
+}
+
+}  // namespace chromeos_update_engine
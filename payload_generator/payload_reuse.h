@@ -0,0 +1,50 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_REUSE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_REUSE_H_
+
+#include <vector>
+
+#include "update_engine/payload_generator/annotated_operation.h"
+#include "update_engine/payload_generator/blob_file_writer.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
+
+namespace chromeos_update_engine {
+
+// Appends to |aops| the operations of the partition |new_part| in the
+// previous payload |config.previous_payload| that are still valid to update
+// |old_part| to |new_part|, with their data copied to |blob_file|, and adds
+// the blocks they write to |new_visited_blocks| so that they are not diffed
+// again. |new_part.previous_path| is the target partition of the previous
+// payload.
+//
+// An operation is reused when the blocks it writes are the same in both
+// target partitions and don't overlap |new_visited_blocks|, and the blocks it
+// reads from |old_part| still have its source hash. Reuses nothing if the
+// previous payload doesn't have the same version and block size.
+bool ReusePreviousOperations(const PartitionConfig& old_part,
+                             const PartitionConfig& new_part,
+                             const PayloadGenerationConfig& config,
+                             BlobFileWriter* blob_file,
+                             std::vector<AnnotatedOperation>* aops,
+                             ExtentRanges* new_visited_blocks);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_REUSE_H_
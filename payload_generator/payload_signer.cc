@@ -17,11 +17,17 @@
 #include "update_engine/payload_generator/payload_signer.h"
 
 #include <endian.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 
+#include <algorithm>
 #include <memory>
 #include <utility>
 
+#include <base/files/memory_mapped_file.h>
 #include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_split.h>
 #include <base/strings/string_util.h>
@@ -36,6 +42,7 @@
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/payload_metadata.h"
 #include "update_engine/payload_consumer/payload_verifier.h"
+#include "update_engine/payload_generator/task_pool.h"
 #include "update_engine/update_metadata.pb.h"
 
 using std::string;
@@ -76,117 +83,95 @@ bool ConvertSignaturesToProtobuf(const vector<brillo::Blob>& signatures,
   return true;
 }
 
-// Given an unsigned payload under |payload_path| and the |payload_signature|
-// and |metadata_signature| generates an updated payload that includes the
-// signatures. It populates |out_metadata_size| with the size of the final
-// manifest after adding the fake signature operation, and
-// |out_signatures_offset| with the expected offset for the new blob, and
-// |out_metadata_signature_size| which will be size of |metadata_signature|
-// if the payload major version supports metadata signature, 0 otherwise.
-// Returns true on success, false otherwise.
-bool AddSignatureBlobToPayload(const string& payload_path,
-                               const string& payload_signature,
-                               const string& metadata_signature,
-                               brillo::Blob* out_payload,
-                               uint64_t* out_metadata_size,
-                               uint32_t* out_metadata_signature_size,
-                               uint64_t* out_signatures_offset) {
-  uint64_t manifest_offset = 20;
-  const int kProtobufSizeOffset = 12;
-
-  brillo::Blob payload;
-  TEST_AND_RETURN_FALSE(utils::ReadFile(payload_path, &payload));
-  PayloadMetadata payload_metadata;
-  TEST_AND_RETURN_FALSE(payload_metadata.ParsePayloadHeader(payload));
-  uint64_t metadata_size = payload_metadata.GetMetadataSize();
-  uint32_t metadata_signature_size =
-      payload_metadata.GetMetadataSignatureSize();
-  // Write metadata signature size in header.
-  uint32_t metadata_signature_size_be = htobe32(metadata_signature.size());
-  memcpy(payload.data() + manifest_offset,
-         &metadata_signature_size_be,
-         sizeof(metadata_signature_size_be));
-  manifest_offset += sizeof(metadata_signature_size_be);
-  // Replace metadata signature.
-  payload.erase(payload.begin() + metadata_size,
-                payload.begin() + metadata_size + metadata_signature_size);
-  payload.insert(payload.begin() + metadata_size,
-                 metadata_signature.begin(),
-                 metadata_signature.end());
-  metadata_signature_size = metadata_signature.size();
-  LOG(INFO) << "Metadata signature size: " << metadata_signature_size;
+// The metadata of a payload once its signatures are added, and the range of
+// its data blobs, which the signatures don't change.
+struct SignedPayloadLayout {
+  // The header, with the size of the metadata signature, and the manifest,
+  // with the signature blob.
+  brillo::Blob metadata;
+  // Offset and size of the data blobs in the unsigned payload.
+  uint64_t blobs_offset{0};
+  uint64_t blobs_size{0};
+};
+
+// Computes in |layout| the metadata of the |size| bytes |payload| once its
+// signatures are replaced with a metadata signature of
+// |metadata_signature_size| bytes and a payload signature of
+// |payload_signature_size| bytes. Returns true on success, false otherwise.
+bool LayoutSignedPayload(const uint8_t* payload,
+                         size_t size,
+                         uint64_t payload_signature_size,
+                         uint32_t metadata_signature_size,
+                         SignedPayloadLayout* layout) {
+  const size_t kProtobufSizeOffset = 12;
+  const size_t kMetadataSignatureSizeOffset = 20;
 
+  PayloadMetadata payload_metadata;
+  ErrorCode error;
+  TEST_AND_RETURN_FALSE(payload_metadata.ParsePayloadHeader(
+                            payload, size, &error) ==
+                        MetadataParseResult::kSuccess);
   DeltaArchiveManifest manifest;
-  TEST_AND_RETURN_FALSE(payload_metadata.GetManifest(payload, &manifest));
-
-  // Erase existing signatures.
-  if (manifest.has_signatures_offset()) {
-    payload.resize(manifest.signatures_offset() + metadata_size +
-                   metadata_signature_size);
-  }
+  TEST_AND_RETURN_FALSE(payload_metadata.GetManifest(payload, size, &manifest));
+  layout->blobs_offset = payload_metadata.GetMetadataSize() +
+                         payload_metadata.GetMetadataSignatureSize();
+  TEST_AND_RETURN_FALSE(layout->blobs_offset <= size);
+  // Existing signatures are replaced.
+  layout->blobs_size = manifest.has_signatures_offset()
+                           ? manifest.signatures_offset()
+                           : size - layout->blobs_offset;
+  TEST_AND_RETURN_FALSE(layout->blobs_size <= size - layout->blobs_offset);
 
   // Updates the manifest to include the signature operation.
   PayloadSigner::AddSignatureToManifest(
-      payload.size() - metadata_size - metadata_signature_size,
-      payload_signature.size(),
-      &manifest);
-
-  // Updates the payload to include the new manifest.
+      layout->blobs_size, payload_signature_size, &manifest);
   string serialized_manifest;
   TEST_AND_RETURN_FALSE(manifest.AppendToString(&serialized_manifest));
   LOG(INFO) << "Updated protobuf size: " << serialized_manifest.size();
-  payload.erase(payload.begin() + manifest_offset,
-                payload.begin() + metadata_size);
-  payload.insert(payload.begin() + manifest_offset,
-                 serialized_manifest.begin(),
-                 serialized_manifest.end());
 
-  // Updates the protobuf size.
+  layout->metadata.assign(payload, payload + kMetadataSignatureSizeOffset);
   uint64_t size_be = htobe64(serialized_manifest.size());
-  memcpy(&payload[kProtobufSizeOffset], &size_be, sizeof(size_be));
-  metadata_size = serialized_manifest.size() + manifest_offset;
-
-  LOG(INFO) << "Updated payload size: " << payload.size();
-  LOG(INFO) << "Updated metadata size: " << metadata_size;
-  uint64_t signatures_offset =
-      metadata_size + metadata_signature_size + manifest.signatures_offset();
-  LOG(INFO) << "Signature Blob Offset: " << signatures_offset;
-  payload.resize(signatures_offset);
-  payload.insert(payload.begin() + signatures_offset,
-                 payload_signature.begin(),
-                 payload_signature.end());
-
-  *out_payload = std::move(payload);
-  *out_metadata_size = metadata_size;
-  *out_metadata_signature_size = metadata_signature_size;
-  *out_signatures_offset = signatures_offset;
+  memcpy(&layout->metadata[kProtobufSizeOffset], &size_be, sizeof(size_be));
+  uint32_t metadata_signature_size_be = htobe32(metadata_signature_size);
+  const uint8_t* size_bytes =
+      reinterpret_cast<const uint8_t*>(&metadata_signature_size_be);
+  layout->metadata.insert(layout->metadata.end(),
+                          size_bytes,
+                          size_bytes + sizeof(metadata_signature_size_be));
+  layout->metadata.insert(layout->metadata.end(),
+                          serialized_manifest.begin(),
+                          serialized_manifest.end());
+  LOG(INFO) << "Metadata signature size: " << metadata_signature_size;
+  LOG(INFO) << "Updated metadata size: " << layout->metadata.size();
   return true;
 }
 
-// Given a |payload| with correct signature op and metadata signature size in
-// header and |metadata_size|, |metadata_signature_size|, |signatures_offset|,
-// calculate hash for payload and metadata, save it to |out_hash_data| and
-// |out_metadata_hash|.
-bool CalculateHashFromPayload(const brillo::Blob& payload,
+// Given the |size| bytes |payload| with correct signature op and metadata
+// signature size in header and |metadata_size|, |metadata_signature_size|,
+// |signatures_offset|, calculate hash for payload and metadata, save it to
+// |out_hash_data| and |out_metadata_hash|.
+bool CalculateHashFromPayload(const uint8_t* payload,
+                              size_t size,
                               const uint64_t metadata_size,
                               const uint32_t metadata_signature_size,
                               const uint64_t signatures_offset,
                               brillo::Blob* out_hash_data,
                               brillo::Blob* out_metadata_hash) {
+  TEST_AND_RETURN_FALSE(signatures_offset >=
+                            metadata_size + metadata_signature_size &&
+                        signatures_offset <= size);
   if (out_metadata_hash) {
     // Calculates the hash on the manifest.
     TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfBytes(
-        payload.data(), metadata_size, out_metadata_hash));
+        payload, metadata_size, out_metadata_hash));
   }
   if (out_hash_data) {
     // Calculates the hash on the updated payload. Note that we skip metadata
     // signature and payload signature.
     HashCalculator calc;
-    TEST_AND_RETURN_FALSE(calc.Update(payload.data(), metadata_size));
-    TEST_AND_RETURN_FALSE(signatures_offset >=
-                          metadata_size + metadata_signature_size);
+    TEST_AND_RETURN_FALSE(calc.Update(payload, metadata_size));
     TEST_AND_RETURN_FALSE(calc.Update(
-        payload.data() + metadata_size + metadata_signature_size,
+        payload + metadata_size + metadata_signature_size,
         signatures_offset - metadata_size - metadata_signature_size));
     TEST_AND_RETURN_FALSE(calc.Finalize());
     *out_hash_data = calc.raw_hash();
@@ -233,12 +218,17 @@ void PayloadSigner::AddSignatureToManifest(uint64_t signature_blob_offset,
 
 bool PayloadSigner::VerifySignedPayload(const string& payload_path,
                                         const string& public_key_path) {
-  brillo::Blob payload;
-  TEST_AND_RETURN_FALSE(utils::ReadFile(payload_path, &payload));
+  base::MemoryMappedFile payload;
+  TEST_AND_RETURN_FALSE(payload.Initialize(base::FilePath(payload_path)));
   PayloadMetadata payload_metadata;
-  TEST_AND_RETURN_FALSE(payload_metadata.ParsePayloadHeader(payload));
+  ErrorCode error;
+  TEST_AND_RETURN_FALSE(
+      payload_metadata.ParsePayloadHeader(
+          payload.data(), payload.length(), &error) ==
+      MetadataParseResult::kSuccess);
   DeltaArchiveManifest manifest;
-  TEST_AND_RETURN_FALSE(payload_metadata.GetManifest(payload, &manifest));
+  TEST_AND_RETURN_FALSE(payload_metadata.GetManifest(
+      payload.data(), payload.length(), &manifest));
   TEST_AND_RETURN_FALSE(manifest.has_signatures_offset() &&
                         manifest.has_signatures_size());
   uint64_t metadata_size = payload_metadata.GetMetadataSize();
@@ -246,15 +236,17 @@ bool PayloadSigner::VerifySignedPayload(const string& payload_path,
       payload_metadata.GetMetadataSignatureSize();
   uint64_t signatures_offset =
       metadata_size + metadata_signature_size + manifest.signatures_offset();
-  CHECK_EQ(payload.size(), signatures_offset + manifest.signatures_size());
+  CHECK_EQ(payload.length(), signatures_offset + manifest.signatures_size());
   brillo::Blob payload_hash, metadata_hash;
-  TEST_AND_RETURN_FALSE(CalculateHashFromPayload(payload,
+  TEST_AND_RETURN_FALSE(CalculateHashFromPayload(payload.data(),
+                                                 payload.length(),
                                                  metadata_size,
                                                  metadata_signature_size,
                                                  signatures_offset,
                                                  &payload_hash,
                                                  &metadata_hash));
-  string signature(payload.begin() + signatures_offset, payload.end());
+  const char* data = reinterpret_cast<const char*>(payload.data());
+  string signature(data + signatures_offset, data + payload.length());
   string public_key;
   TEST_AND_RETURN_FALSE(utils::ReadFile(public_key_path, &public_key));
   TEST_AND_RETURN_FALSE(payload_hash.size() == kSHA256Size);
@@ -265,8 +257,8 @@ bool PayloadSigner::VerifySignedPayload(const string& payload_path,
   TEST_AND_RETURN_FALSE(
       payload_verifier->VerifySignature(signature, payload_hash));
   if (metadata_signature_size) {
-    signature.assign(payload.begin() + metadata_size,
-                     payload.begin() + metadata_size + metadata_signature_size);
+    signature.assign(data + metadata_size,
+                     data + metadata_size + metadata_signature_size);
     TEST_AND_RETURN_FALSE(metadata_hash.size() == kSHA256Size);
     TEST_AND_RETURN_FALSE(
         payload_verifier->VerifySignature(signature, metadata_hash));
@@ -346,18 +338,23 @@ bool PayloadSigner::SignHash(const brillo::Blob& hash,
 bool PayloadSigner::SignHashWithKeys(const brillo::Blob& hash_data,
                                      const vector<string>& private_key_paths,
                                      string* out_serialized_signature) {
-  vector<brillo::Blob> signatures;
-  vector<size_t> padded_signature_sizes;
-  for (const string& path : private_key_paths) {
-    brillo::Blob signature;
-    TEST_AND_RETURN_FALSE(SignHash(hash_data, path, &signature));
-    signatures.push_back(signature);
-
-    size_t padded_signature_size;
-    TEST_AND_RETURN_FALSE(
-        GetMaximumSignatureSize(path, &padded_signature_size));
-    padded_signature_sizes.push_back(padded_signature_size);
+  // The keys sign concurrently, as each of them may wait on its key store.
+  const size_t num_keys = private_key_paths.size();
+  vector<brillo::Blob> signatures(num_keys);
+  vector<size_t> padded_signature_sizes(num_keys);
+  vector<char> results(num_keys);
+  vector<TaskPool::Task> tasks;
+  for (size_t i = 0; i < num_keys; i++) {
+    tasks.push_back([&, i] {
+      results[i] =
+          SignHash(hash_data, private_key_paths[i], &signatures[i]) &&
+          GetMaximumSignatureSize(private_key_paths[i],
+                                  &padded_signature_sizes[i]);
+    });
   }
+  TaskPool::RunTasks(std::move(tasks), num_keys);
+  TEST_AND_RETURN_FALSE(std::all_of(
+      results.begin(), results.end(), [](char result) { return result; }));
   TEST_AND_RETURN_FALSE(ConvertSignaturesToProtobuf(
       signatures, padded_signature_sizes, out_serialized_signature));
   return true;
@@ -369,10 +366,12 @@ bool PayloadSigner::SignPayload(const string& unsigned_payload_path,
                                 const uint32_t metadata_signature_size,
                                 const uint64_t signatures_offset,
                                 string* out_serialized_signature) {
-  brillo::Blob payload;
-  TEST_AND_RETURN_FALSE(utils::ReadFile(unsigned_payload_path, &payload));
+  base::MemoryMappedFile payload;
+  TEST_AND_RETURN_FALSE(
+      payload.Initialize(base::FilePath(unsigned_payload_path)));
   brillo::Blob hash_data;
-  TEST_AND_RETURN_FALSE(CalculateHashFromPayload(payload,
+  TEST_AND_RETURN_FALSE(CalculateHashFromPayload(payload.data(),
+                                                 payload.length(),
                                                  metadata_size,
                                                  metadata_signature_size,
                                                  signatures_offset,
@@ -395,37 +394,48 @@ bool PayloadSigner::SignatureBlobLength(const vector<string>& private_key_paths,
   return true;
 }
 
+bool PayloadSigner::PlaceholderSignatureBlob(
+    const vector<size_t>& signature_sizes, string* out_serialized_signature) {
+  // Create a signature blob with signatures filled with 0.
+  vector<brillo::Blob> signatures;
+  for (size_t signature_size : signature_sizes) {
+    signatures.emplace_back(signature_size, 0);
+  }
+  return ConvertSignaturesToProtobuf(
+      signatures, signature_sizes, out_serialized_signature);
+}
+
 bool PayloadSigner::HashPayloadForSigning(const string& payload_path,
                                           const vector<size_t>& signature_sizes,
                                           brillo::Blob* out_payload_hash_data,
                                           brillo::Blob* out_metadata_hash) {
-  // Create a signature blob with signatures filled with 0.
   // Will be used for both payload signature and metadata signature.
-  vector<brillo::Blob> signatures;
-  for (int signature_size : signature_sizes) {
-    signatures.emplace_back(signature_size, 0);
-  }
   string signature;
-  TEST_AND_RETURN_FALSE(
-      ConvertSignaturesToProtobuf(signatures, signature_sizes, &signature));
-
-  brillo::Blob payload;
-  uint64_t metadata_size, signatures_offset;
-  uint32_t metadata_signature_size;
-  // Prepare payload for hashing.
-  TEST_AND_RETURN_FALSE(AddSignatureBlobToPayload(payload_path,
-                                                  signature,
-                                                  signature,
-                                                  &payload,
-                                                  &metadata_size,
-                                                  &metadata_signature_size,
-                                                  &signatures_offset));
-  TEST_AND_RETURN_FALSE(CalculateHashFromPayload(payload,
-                                                 metadata_size,
-                                                 metadata_signature_size,
-                                                 signatures_offset,
-                                                 out_payload_hash_data,
-                                                 out_metadata_hash));
+  TEST_AND_RETURN_FALSE(PlaceholderSignatureBlob(signature_sizes, &signature));
+
+  // The payload is hashed as it will be once signed, from the updated metadata
+  // and the data blobs of the mapped payload, without copying them.
+  base::MemoryMappedFile payload;
+  TEST_AND_RETURN_FALSE(payload.Initialize(base::FilePath(payload_path)));
+  SignedPayloadLayout layout;
+  TEST_AND_RETURN_FALSE(LayoutSignedPayload(payload.data(),
+                                            payload.length(),
+                                            signature.size(),
+                                            signature.size(),
+                                            &layout));
+  if (out_metadata_hash) {
+    TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfBytes(
+        layout.metadata.data(), layout.metadata.size(), out_metadata_hash));
+  }
+  if (out_payload_hash_data) {
+    HashCalculator calc;
+    TEST_AND_RETURN_FALSE(
+        calc.Update(layout.metadata.data(), layout.metadata.size()));
+    TEST_AND_RETURN_FALSE(calc.Update(payload.data() + layout.blobs_offset,
+                                      layout.blobs_size));
+    TEST_AND_RETURN_FALSE(calc.Finalize());
+    *out_payload_hash_data = calc.raw_hash();
+  }
   return true;
 }
 
@@ -436,9 +446,6 @@ bool PayloadSigner::AddSignatureToPayload(
     const vector<brillo::Blob>& metadata_signatures,
     const string& signed_payload_path,
     uint64_t* out_metadata_size) {
-  // TODO(petkov): Reduce memory usage -- the payload is manipulated in memory.
-
-  // Loads the payload and adds the signature op to it.
   string payload_signature, metadata_signature;
   TEST_AND_RETURN_FALSE(ConvertSignaturesToProtobuf(
       payload_signatures, padded_signature_sizes, &payload_signature));
@@ -446,20 +453,81 @@ bool PayloadSigner::AddSignatureToPayload(
     TEST_AND_RETURN_FALSE(ConvertSignaturesToProtobuf(
         metadata_signatures, padded_signature_sizes, &metadata_signature));
   }
-  brillo::Blob payload;
-  uint64_t signatures_offset;
-  uint32_t metadata_signature_size;
-  TEST_AND_RETURN_FALSE(AddSignatureBlobToPayload(payload_path,
-                                                  payload_signature,
-                                                  metadata_signature,
-                                                  &payload,
-                                                  out_metadata_size,
-                                                  &metadata_signature_size,
-                                                  &signatures_offset));
-
-  LOG(INFO) << "Signed payload size: " << payload.size();
-  TEST_AND_RETURN_FALSE(utils::WriteFile(
-      signed_payload_path.c_str(), payload.data(), payload.size()));
+  SignedPayloadLayout layout;
+  {
+    base::MemoryMappedFile payload;
+    TEST_AND_RETURN_FALSE(payload.Initialize(base::FilePath(payload_path)));
+    TEST_AND_RETURN_FALSE(LayoutSignedPayload(payload.data(),
+                                              payload.length(),
+                                              payload_signature.size(),
+                                              metadata_signature.size(),
+                                              &layout));
+  }
+  *out_metadata_size = layout.metadata.size();
+  brillo::Blob head = std::move(layout.metadata);
+  head.insert(head.end(), metadata_signature.begin(), metadata_signature.end());
+  const uint64_t signatures_offset = head.size() + layout.blobs_size;
+  LOG(INFO) << "Signature Blob Offset: " << signatures_offset;
+  LOG(INFO) << "Signed payload size: "
+            << signatures_offset + payload_signature.size();
+
+  if (signed_payload_path == payload_path &&
+      head.size() == layout.blobs_offset) {
+    // The data blobs stay where they are, so only the metadata and the
+    // signatures are written, in place.
+    LOG(INFO) << "Signing " << payload_path << " in place.";
+    int fd = HANDLE_EINTR(open(payload_path.c_str(), O_WRONLY | O_CLOEXEC));
+    TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+    ScopedFdCloser fd_closer(&fd);
+    TEST_AND_RETURN_FALSE(utils::PWriteAll(fd, head.data(), head.size(), 0));
+    TEST_AND_RETURN_FALSE(utils::PWriteAll(fd,
+                                           payload_signature.data(),
+                                           payload_signature.size(),
+                                           signatures_offset));
+    TEST_AND_RETURN_FALSE_ERRNO(
+        ftruncate(fd, signatures_offset + payload_signature.size()) == 0);
+    return true;
+  }
+
+  // Otherwise the data blobs are copied, sharing their extents where the file
+  // system allows it. The signed payload replaces the unsigned one only once
+  // complete.
+  int in_fd = HANDLE_EINTR(open(payload_path.c_str(), O_RDONLY | O_CLOEXEC));
+  TEST_AND_RETURN_FALSE_ERRNO(in_fd >= 0);
+  ScopedFdCloser in_fd_closer(&in_fd);
+  string out_path = signed_payload_path;
+  std::unique_ptr<ScopedPathUnlinker> temp_unlinker;
+  int out_fd = -1;
+  if (signed_payload_path == payload_path) {
+    out_path += ".XXXXXX";
+    out_fd = mkstemp(&out_path[0]);
+    TEST_AND_RETURN_FALSE_ERRNO(out_fd >= 0);
+    temp_unlinker = std::make_unique<ScopedPathUnlinker>(out_path);
+    TEST_AND_RETURN_FALSE_ERRNO(fchmod(out_fd, 0644) == 0);
+  } else {
+    out_fd = HANDLE_EINTR(open(out_path.c_str(),
+                               O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                               0644));
+    TEST_AND_RETURN_FALSE_ERRNO(out_fd >= 0);
+  }
+  ScopedFdCloser out_fd_closer(&out_fd);
+  bool use_copy_file_range = true;
+  TEST_AND_RETURN_FALSE(utils::PWriteAll(out_fd, head.data(), head.size(), 0));
+  TEST_AND_RETURN_FALSE(utils::CopyFileRange(in_fd,
+                                             layout.blobs_offset,
+                                             out_fd,
+                                             head.size(),
+                                             layout.blobs_size,
+                                             &use_copy_file_range));
+  TEST_AND_RETURN_FALSE(utils::PWriteAll(out_fd,
+                                         payload_signature.data(),
+                                         payload_signature.size(),
+                                         signatures_offset));
+  if (temp_unlinker) {
+    TEST_AND_RETURN_FALSE_ERRNO(
+        rename(out_path.c_str(), signed_payload_path.c_str()) == 0);
+    temp_unlinker->set_should_remove(false);
+  }
   return true;
 }
 
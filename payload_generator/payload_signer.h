@@ -50,8 +50,8 @@ class PayloadSigner {
                        const std::string& private_key_path,
                        brillo::Blob* out_signature);
 
-  // Sign |hash_data| blob with all private keys in |private_key_paths|, then
-  // convert the signatures to serialized protobuf.
+  // Sign |hash_data| blob with all private keys in |private_key_paths|,
+  // concurrently, then convert the signatures to serialized protobuf.
   static bool SignHashWithKeys(
       const brillo::Blob& hash_data,
       const std::vector<std::string>& private_key_paths,
@@ -76,12 +76,19 @@ class PayloadSigner {
   static bool SignatureBlobLength(
       const std::vector<std::string>& private_key_paths, uint64_t* out_length);
 
+  // Serializes in |out_serialized_signature| a signature blob with signatures
+  // of |signature_sizes| filled with zeros, as reserved for the signatures
+  // before signing. Returns true on success.
+  static bool PlaceholderSignatureBlob(
+      const std::vector<size_t>& signature_sizes,
+      std::string* out_serialized_signature);
+
   // Given an unsigned payload in |payload_path|,
   // this method does two things:
-  // 1. It loads the payload into memory, and inserts placeholder signature
-  //    operations and placeholder metadata signature to make the header and
-  //    the manifest match what the final signed payload will look like based
-  //    on |signatures_sizes|, if needed.
+  // 1. It maps the payload into memory, and computes the header and the
+  //    manifest with placeholder signature operations and placeholder
+  //    metadata signature, to match what the final signed payload will look
+  //    like based on |signatures_sizes|, if needed.
   // 2. It calculates the raw SHA256 hash of the payload and the metadata in
   //    |payload_path| (except signatures) and returns the result in
   //    |out_hash_data| and |out_metadata_hash| respectively.
@@ -96,7 +103,10 @@ class PayloadSigner {
   // and the raw |payload_signatures| and |metadata_signatures| updates the
   // payload to include the signature thus turning it into a signed payload. The
   // new payload is stored in |signed_payload_path|. |payload_path| and
-  // |signed_payload_path| can point to the same file. Populates
+  // |signed_payload_path| can point to the same file, which is then updated in
+  // place if the size of the metadata and its signature doesn't change, and
+  // replaced once the signed payload is written otherwise. The data blobs are
+  // copied with copy_file_range() when written elsewhere. Populates
   // |out_metadata_size| with the size of the metadata after adding the
   // signature operation in the manifest. Returns true on success, false
   // otherwise.
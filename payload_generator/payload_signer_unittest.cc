@@ -174,4 +174,79 @@ TEST_F(PayloadSignerTest, VerifySignedPayloadTest) {
       payload_file.path(), GetBuildArtifactsPath(kUnittestPublicKeyPath)));
 }
 
+TEST_F(PayloadSignerTest, WritePayloadHashesForSigningTest) {
+  // The hashes computed while writing a payload with reserved signatures
+  // match the ones computed from the written payload.
+  ScopedTempFile payload_file("payload.XXXXXX");
+  PayloadGenerationConfig config;
+  config.version.major = kBrilloMajorPayloadVersion;
+  config.signature_sizes = {256, 512};
+  PayloadFile payload;
+  EXPECT_TRUE(payload.Init(config));
+  uint64_t metadata_size;
+  brillo::Blob payload_hash, metadata_hash;
+  EXPECT_TRUE(payload.WritePayload(payload_file.path(),
+                                   "/dev/null",
+                                   "",
+                                   &metadata_size,
+                                   &payload_hash,
+                                   &metadata_hash));
+
+  brillo::Blob expected_payload_hash, expected_metadata_hash;
+  EXPECT_TRUE(PayloadSigner::HashPayloadForSigning(payload_file.path(),
+                                                   config.signature_sizes,
+                                                   &expected_payload_hash,
+                                                   &expected_metadata_hash));
+  EXPECT_EQ(expected_payload_hash, payload_hash);
+  EXPECT_EQ(expected_metadata_hash, metadata_hash);
+}
+
+TEST_F(PayloadSignerTest, AddSignatureToPayloadTest) {
+  const string private_key = GetBuildArtifactsPath(kUnittestPrivateKeyPath);
+  size_t signature_size;
+  ASSERT_TRUE(
+      PayloadSigner::GetMaximumSignatureSize(private_key, &signature_size));
+  // With the signatures reserved, the payload is signed in place; without,
+  // the signed payload is written next to it and replaces it.
+  for (const vector<size_t>& reserved_sizes :
+       {vector<size_t>{signature_size}, vector<size_t>{}}) {
+    ScopedTempFile payload_file("payload.XXXXXX");
+    ScopedTempFile signed_payload_file("signed_payload.XXXXXX");
+    PayloadGenerationConfig config;
+    config.version.major = kBrilloMajorPayloadVersion;
+    config.signature_sizes = reserved_sizes;
+    PayloadFile payload;
+    ASSERT_TRUE(payload.Init(config));
+    uint64_t metadata_size;
+    ASSERT_TRUE(payload.WritePayload(
+        payload_file.path(), "/dev/null", "", &metadata_size));
+
+    brillo::Blob payload_hash, metadata_hash;
+    ASSERT_TRUE(PayloadSigner::HashPayloadForSigning(
+        payload_file.path(), {signature_size}, &payload_hash, &metadata_hash));
+    brillo::Blob payload_signature, metadata_signature;
+    ASSERT_TRUE(
+        PayloadSigner::SignHash(payload_hash, private_key, &payload_signature));
+    ASSERT_TRUE(PayloadSigner::SignHash(
+        metadata_hash, private_key, &metadata_signature));
+
+    for (const string& out_path :
+         {signed_payload_file.path(), payload_file.path()}) {
+      uint64_t signed_metadata_size;
+      ASSERT_TRUE(PayloadSigner::AddSignatureToPayload(payload_file.path(),
+                                                       {signature_size},
+                                                       {payload_signature},
+                                                       {metadata_signature},
+                                                       out_path,
+                                                       &signed_metadata_size));
+      EXPECT_TRUE(PayloadSigner::VerifySignedPayload(
+          out_path, GetBuildArtifactsPath(kUnittestPublicKeyPath)));
+    }
+    brillo::Blob signed_payload, signed_in_place;
+    ASSERT_TRUE(utils::ReadFile(signed_payload_file.path(), &signed_payload));
+    ASSERT_TRUE(utils::ReadFile(payload_file.path(), &signed_in_place));
+    EXPECT_EQ(signed_payload, signed_in_place);
+  }
+}
+
 }  // namespace chromeos_update_engine
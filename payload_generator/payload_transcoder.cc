@@ -0,0 +1,337 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/payload_transcoder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <utility>
+
+#include <base/logging.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/extent_writer.h"
+#include "update_engine/payload_consumer/install_operation_executor.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_consumer/payload_metadata.h"
+#include "update_engine/payload_generator/annotated_operation.h"
+#include "update_engine/payload_generator/blob_file_writer.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/payload_file.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
+#include "update_engine/payload_generator/payload_signer.h"
+#include "update_engine/payload_generator/task_pool.h"
+#include "update_engine/payload_generator/xz.h"
+#include "update_engine/payload_generator/zstd.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The operations of a partition are transcoded in batches of this many per
+// thread, which hold their data in memory.
+constexpr size_t kOperationsPerThread = 4;
+
+// Collects the data written by an operation.
+class BlobExtentWriter : public ExtentWriter {
+ public:
+  explicit BlobExtentWriter(brillo::Blob* data) : data_(data) {}
+
+  bool Init(const google::protobuf::RepeatedPtrField<Extent>& extents,
+            uint32_t block_size) override {
+    data_->reserve(utils::BlocksInExtents(extents) * block_size);
+    return true;
+  }
+  bool Write(const void* bytes, size_t count) override {
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(bytes);
+    data_->insert(data_->end(), data, data + count);
+    return true;
+  }
+
+ private:
+  brillo::Blob* data_;
+};
+
+bool IsReplace(InstallOperation::Type type) {
+  return type == InstallOperation::REPLACE ||
+         type == InstallOperation::REPLACE_BZ ||
+         type == InstallOperation::REPLACE_XZ ||
+         type == InstallOperation::REPLACE_ZSTD;
+}
+
+// Replaces |blob|, the data of the full operation |op|, with its data
+// compressed as |type|, or uncompressed if it's smaller, and updates the
+// type of |op|. The |executor| decoding the data may be shared by threads.
+bool TranscodeBlob(InstallOperation::Type type,
+                   InstallOperationExecutor* executor,
+                   const ZstdDictionary* dictionary,
+                   size_t block_size,
+                   InstallOperation* op,
+                   brillo::Blob* blob) {
+  brillo::Blob data;
+  if (op->type() == InstallOperation::REPLACE) {
+    data = std::move(*blob);
+  } else {
+    TEST_AND_RETURN_FALSE(executor->ExecuteReplaceOperation(
+        *op, std::make_unique<BlobExtentWriter>(&data), blob->data()));
+  }
+  TEST_AND_RETURN_FALSE(data.size() ==
+                        utils::BlocksInExtents(op->dst_extents()) * block_size);
+  brillo::Blob compressed;
+  if (type == InstallOperation::REPLACE_XZ) {
+    TEST_AND_RETURN_FALSE(XzCompress(data, &compressed));
+  } else if (type == InstallOperation::REPLACE_ZSTD) {
+    TEST_AND_RETURN_FALSE(ZstdCompress(data, dictionary, &compressed));
+  }
+  if (type != InstallOperation::REPLACE && compressed.size() < data.size()) {
+    op->set_type(type);
+    *blob = std::move(compressed);
+  } else {
+    op->set_type(InstallOperation::REPLACE);
+    *blob = std::move(data);
+  }
+  return true;
+}
+
+// Recomputes the apply hints of the operations of |partition|, if it has
+// them, with the default cost model, as the model of the payload isn't known.
+void UpdateApplyHints(size_t block_size, PartitionUpdate* partition) {
+  if (!partition->has_apply_cost()) {
+    return;
+  }
+  vector<AnnotatedOperation> aops(partition->operations_size());
+  for (int i = 0; i < partition->operations_size(); i++) {
+    aops[i].op = partition->operations(i);
+  }
+  PayloadFile::AddApplyHints(ApplyCostModel(), block_size, &aops);
+  uint64_t apply_cost = 0;
+  uint64_t max_apply_memory_bytes = 0;
+  for (int i = 0; i < partition->operations_size(); i++) {
+    InstallOperation* op = partition->mutable_operations(i);
+    op->set_apply_cost(aops[i].op.apply_cost());
+    op->set_apply_memory_bytes(aops[i].op.apply_memory_bytes());
+    apply_cost += op->apply_cost();
+    max_apply_memory_bytes =
+        std::max(max_apply_memory_bytes, op->apply_memory_bytes());
+  }
+  partition->set_apply_cost(apply_cost);
+  partition->set_max_apply_memory_bytes(max_apply_memory_bytes);
+}
+
+}  // namespace
+
+bool TranscodePayload(const string& payload_path,
+                      const string& out_path,
+                      const PayloadTranscodeOptions& options) {
+  TEST_AND_RETURN_FALSE(options.type == InstallOperation::REPLACE ||
+                        options.type == InstallOperation::REPLACE_XZ ||
+                        options.type == InstallOperation::REPLACE_ZSTD);
+  PayloadMetadata metadata;
+  DeltaArchiveManifest manifest;
+  TEST_AND_RETURN_FALSE(
+      metadata.ParsePayloadFile(payload_path, &manifest, nullptr));
+  const PayloadVersion version(metadata.GetMajorVersion(),
+                               manifest.minor_version());
+  if (!version.OperationAllowed(options.type)) {
+    LOG(ERROR) << "The clients of the payload don't support "
+               << InstallOperationTypeName(options.type) << ".";
+    return false;
+  }
+  const uint64_t data_offset =
+      metadata.GetMetadataSize() + metadata.GetMetadataSignatureSize();
+  const size_t block_size = manifest.block_size();
+
+  ScopedTempFile blobs_file("CrAU_temp_data.transcoded.XXXXXX", true);
+  off_t blobs_size = 0;
+  BlobFileWriter blob_file(blobs_file.fd(), &blobs_size);
+  // Where the data of the input payload went, by offset, so that the
+  // operations sharing a blob keep sharing it.
+  struct NewBlob {
+    uint64_t data_length;
+    InstallOperation op;
+    size_t uses;
+  };
+  std::map<uint64_t, NewBlob> new_blobs;
+  uint64_t transcoded_bytes = 0;
+  uint64_t new_transcoded_bytes = 0;
+  size_t num_transcoded = 0;
+  const size_t num_threads = diff_utils::GetMaxThreads();
+  const size_t batch_size = num_threads * kOperationsPerThread;
+
+  for (PartitionUpdate& partition : *manifest.mutable_partitions()) {
+    // The operations stored in the data move back to the manifest.
+    if (partition.has_operations_segment()) {
+      const OperationsSegment& segment = partition.operations_segment();
+      brillo::Blob segment_data;
+      TEST_AND_RETURN_FALSE(
+          utils::ReadFileChunk(payload_path,
+                               data_offset + segment.data_offset(),
+                               segment.data_length(),
+                               &segment_data));
+      TEST_AND_RETURN_FALSE(PayloadMetadata::ParseOperationsSegment(
+          segment_data.data(), segment_data.size(), &partition));
+      partition.clear_operations_segment();
+    }
+    // Only reads its state to decode the data, from all the threads.
+    InstallOperationExecutor executor(block_size);
+    TEST_AND_RETURN_FALSE(
+        executor.SetZstdDictionary(partition.zstd_dictionary()));
+    std::unique_ptr<ZstdDictionary> dictionary;
+    if (!partition.zstd_dictionary().empty()) {
+      dictionary = ZstdDictionary::Create(brillo::Blob(
+          partition.zstd_dictionary().begin(),
+          partition.zstd_dictionary().end()));
+      TEST_AND_RETURN_FALSE(dictionary != nullptr);
+    }
+
+    const uint64_t partition_begin = blobs_size;
+    auto* ops = partition.mutable_operations();
+    for (int begin = 0; begin < ops->size(); begin += batch_size) {
+      const int end = std::min<int>(ops->size(), begin + batch_size);
+      vector<brillo::Blob> blobs(end - begin);
+      vector<bool> transcoded(end - begin);
+      std::atomic<bool> success{true};
+      vector<TaskPool::Task> tasks;
+      for (int i = begin; i < end; i++) {
+        InstallOperation* op = ops->Mutable(i);
+        if (op->data_length() == 0 || new_blobs.count(op->data_offset())) {
+          continue;
+        }
+        transcoded[i - begin] =
+            IsReplace(op->type()) && options.from_types.count(op->type());
+        tasks.push_back([&, i, op] {
+          brillo::Blob* blob = &blobs[i - begin];
+          brillo::Blob hash;
+          if (!utils::ReadFileChunk(payload_path,
+                                    data_offset + op->data_offset(),
+                                    op->data_length(),
+                                    blob) ||
+              blob->size() != op->data_length() ||
+              !HashCalculator::RawHashOfData(*blob, &hash) ||
+              (op->has_data_sha256_hash() &&
+               op->data_sha256_hash() != string(hash.begin(), hash.end()))) {
+            LOG(ERROR) << "Failed to read the data of operation " << i
+                       << " of " << partition.partition_name() << ".";
+            success = false;
+            return;
+          }
+          if (transcoded[i - begin] &&
+              !TranscodeBlob(options.type,
+                             &executor,
+                             dictionary.get(),
+                             block_size,
+                             op,
+                             blob)) {
+            LOG(ERROR) << "Failed to transcode operation " << i << " of "
+                       << partition.partition_name() << ".";
+            success = false;
+          }
+        });
+      }
+      TaskPool::RunTasks(std::move(tasks), num_threads);
+      TEST_AND_RETURN_FALSE(success);
+
+      // The blobs are stored in the order of the operations.
+      for (int i = begin; i < end; i++) {
+        InstallOperation* op = ops->Mutable(i);
+        if (op->data_length() == 0) {
+          continue;
+        }
+        auto it = new_blobs.find(op->data_offset());
+        if (it == new_blobs.end()) {
+          const brillo::Blob& blob = blobs[i - begin];
+          brillo::Blob hash;
+          TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(blob, &hash));
+          const off_t offset = blob_file.StoreBlob(blob);
+          TEST_AND_RETURN_FALSE(offset >= 0);
+          NewBlob new_blob{op->data_length(), *op, 0};
+          new_blob.op.set_data_offset(offset);
+          new_blob.op.set_data_length(blob.size());
+          new_blob.op.set_data_sha256_hash(hash.data(), hash.size());
+          if (transcoded[i - begin]) {
+            transcoded_bytes += op->data_length();
+            new_transcoded_bytes += blob.size();
+            num_transcoded++;
+          }
+          it = new_blobs.emplace(op->data_offset(), new_blob).first;
+        }
+        TEST_AND_RETURN_FALSE(it->second.data_length == op->data_length());
+        it->second.uses++;
+        op->set_type(it->second.op.type());
+        op->set_data_offset(it->second.op.data_offset());
+        op->set_data_length(it->second.op.data_length());
+        op->set_data_sha256_hash(it->second.op.data_sha256_hash());
+      }
+    }
+
+    if (partition.has_data_range()) {
+      partition.mutable_data_range()->set_data_offset(partition_begin);
+      partition.mutable_data_range()->set_data_length(blobs_size -
+                                                      partition_begin);
+    }
+    UpdateApplyHints(block_size, &partition);
+  }
+  TEST_AND_RETURN_FALSE(blob_file.Flush());
+
+  if (manifest.has_shared_blobs_size()) {
+    uint64_t shared_blobs_size = 0;
+    for (const auto& [offset, new_blob] : new_blobs) {
+      if (new_blob.uses > 1) {
+        shared_blobs_size += new_blob.op.data_length();
+      }
+    }
+    manifest.set_shared_blobs_size(shared_blobs_size);
+  }
+
+  // The signatures of the input payload don't match anymore.
+  manifest.clear_signatures_offset();
+  manifest.clear_signatures_size();
+  if (!options.private_key_path.empty()) {
+    uint64_t signature_blob_length = 0;
+    TEST_AND_RETURN_FALSE(PayloadSigner::SignatureBlobLength(
+        {options.private_key_path}, &signature_blob_length));
+    PayloadSigner::AddSignatureToManifest(
+        blobs_size, signature_blob_length, &manifest);
+  } else if (!options.signature_sizes.empty()) {
+    string placeholder_signature;
+    TEST_AND_RETURN_FALSE(PayloadSigner::PlaceholderSignatureBlob(
+        options.signature_sizes, &placeholder_signature));
+    PayloadSigner::AddSignatureToManifest(
+        blobs_size, placeholder_signature.size(), &manifest);
+  }
+  uint64_t metadata_size = 0;
+  TEST_AND_RETURN_FALSE(PayloadFile::WritePayload(out_path,
+                                                  blobs_file.path(),
+                                                  options.private_key_path,
+                                                  metadata.GetMajorVersion(),
+                                                  manifest,
+                                                  &metadata_size,
+                                                  options.signature_sizes));
+  LOG(INFO) << "Transcoded " << num_transcoded << " operations from "
+            << transcoded_bytes << " to " << new_transcoded_bytes
+            << " bytes of data, the payload has " << blobs_size
+            << " bytes of data.";
+  return true;
+}
+
+}  // namespace chromeos_update_engine
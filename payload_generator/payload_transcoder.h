@@ -0,0 +1,57 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_TRANSCODER_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_TRANSCODER_H_
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+struct PayloadTranscodeOptions {
+  // The type the data of the rewritten operations is compressed as, one of
+  // REPLACE, REPLACE_XZ and REPLACE_ZSTD. The data which doesn't compress is
+  // stored with REPLACE.
+  InstallOperation::Type type{InstallOperation::REPLACE_ZSTD};
+  // The types of the operations rewritten, among REPLACE, REPLACE_BZ,
+  // REPLACE_XZ and REPLACE_ZSTD.
+  std::set<InstallOperation::Type> from_types{InstallOperation::REPLACE_BZ,
+                                              InstallOperation::REPLACE_XZ};
+  // The payload is signed with this key if set. Otherwise it's unsigned, with
+  // placeholders of |signature_sizes| for the signatures if not empty.
+  std::string private_key_path;
+  std::vector<size_t> signature_sizes;
+};
+
+// Writes to |out_path| the payload at |payload_path| with the data of its full
+// operations of |options.from_types| recompressed to |options.type|, like to
+// retrofit a faster apply onto payloads which can't be regenerated. The diff
+// and copy operations keep their data. The hashes of the data, the apply
+// hints and the data ranges of the partitions in the manifest are updated,
+// the operations stored in the data move to the manifest and the signatures
+// of the input payload are dropped. The data is verified against its hash
+// before it's rewritten.
+bool TranscodePayload(const std::string& payload_path,
+                      const std::string& out_path,
+                      const PayloadTranscodeOptions& options);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_TRANSCODER_H_
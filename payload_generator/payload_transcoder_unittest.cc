@@ -0,0 +1,188 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/payload_transcoder.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/fake_extent_writer.h"
+#include "update_engine/payload_consumer/install_operation_executor.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_consumer/payload_metadata.h"
+#include "update_engine/payload_generator/bzip.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/payload_file.h"
+#include "update_engine/payload_generator/xz.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr size_t kBlockSize = 4096;
+
+// Returns |num_blocks| blocks of compressible data.
+brillo::Blob BlocksData(size_t num_blocks, char seed) {
+  brillo::Blob data(num_blocks * kBlockSize);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = seed + i % 7;
+  }
+  return data;
+}
+
+// Appends to |partition| an operation of |type| writing |dst| with |blob|,
+// stored in |blobs|.
+void AddOperation(InstallOperation::Type type,
+                  const Extent& dst,
+                  const brillo::Blob& blob,
+                  PartitionUpdate* partition,
+                  brillo::Blob* blobs) {
+  InstallOperation* op = partition->add_operations();
+  op->set_type(type);
+  *op->add_dst_extents() = dst;
+  if (type == InstallOperation::SOURCE_COPY) {
+    *op->add_src_extents() = dst;
+    return;
+  }
+  op->set_data_offset(blobs->size());
+  op->set_data_length(blob.size());
+  brillo::Blob hash;
+  ASSERT_TRUE(HashCalculator::RawHashOfData(blob, &hash));
+  op->set_data_sha256_hash(hash.data(), hash.size());
+  blobs->insert(blobs->end(), blob.begin(), blob.end());
+}
+
+// Returns the data written by the operation |op| of |payload|.
+brillo::Blob OperationData(const string& payload,
+                           uint64_t data_offset,
+                           const InstallOperation& op) {
+  brillo::Blob blob;
+  EXPECT_TRUE(utils::ReadFileChunk(
+      payload, data_offset + op.data_offset(), op.data_length(), &blob));
+  brillo::Blob hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfData(blob, &hash));
+  EXPECT_EQ(op.data_sha256_hash(), string(hash.begin(), hash.end()));
+  InstallOperationExecutor executor(kBlockSize);
+  auto writer = std::make_unique<FakeExtentWriter>();
+  FakeExtentWriter* fake_writer = writer.get();
+  EXPECT_TRUE(
+      executor.ExecuteReplaceOperation(op, std::move(writer), blob.data()));
+  return fake_writer->WrittenData();
+}
+
+}  // namespace
+
+TEST(PayloadTranscoderTest, TranscodeTest) {
+  XzCompressInit();
+  DeltaArchiveManifest manifest;
+  manifest.set_block_size(kBlockSize);
+  manifest.set_minor_version(kZstdMinorPayloadVersion);
+  PartitionUpdate* partition = manifest.add_partitions();
+  partition->set_partition_name("system");
+  partition->mutable_new_partition_info()->set_size(7 * kBlockSize);
+
+  const brillo::Blob bz_data = BlocksData(2, 'a');
+  const brillo::Blob xz_data = BlocksData(2, 'b');
+  const brillo::Blob raw_data = BlocksData(1, 'c');
+  brillo::Blob bz_blob, xz_blob, blobs;
+  ASSERT_TRUE(BzipCompress(bz_data, &bz_blob));
+  ASSERT_TRUE(XzCompress(xz_data, &xz_blob));
+  AddOperation(InstallOperation::REPLACE_BZ,
+               ExtentForRange(0, 2),
+               bz_blob,
+               partition,
+               &blobs);
+  AddOperation(InstallOperation::REPLACE_XZ,
+               ExtentForRange(2, 2),
+               xz_blob,
+               partition,
+               &blobs);
+  AddOperation(InstallOperation::SOURCE_COPY,
+               ExtentForRange(4, 2),
+               {},
+               partition,
+               &blobs);
+  AddOperation(InstallOperation::REPLACE,
+               ExtentForRange(6, 1),
+               raw_data,
+               partition,
+               &blobs);
+
+  ScopedTempFile blobs_file("PayloadTranscoderTest.blobs.XXXXXX");
+  ASSERT_TRUE(utils::WriteFile(
+      blobs_file.path().c_str(), blobs.data(), blobs.size()));
+  ScopedTempFile payload("PayloadTranscoderTest.payload.XXXXXX");
+  uint64_t metadata_size = 0;
+  ASSERT_TRUE(PayloadFile::WritePayload(payload.path(),
+                                        blobs_file.path(),
+                                        "",
+                                        kBrilloMajorPayloadVersion,
+                                        manifest,
+                                        &metadata_size));
+
+  ScopedTempFile out("PayloadTranscoderTest.out.XXXXXX");
+  ASSERT_TRUE(TranscodePayload(payload.path(), out.path(), {}));
+
+  PayloadMetadata metadata;
+  DeltaArchiveManifest out_manifest;
+  ASSERT_TRUE(metadata.ParsePayloadFile(out.path(), &out_manifest, nullptr));
+  ASSERT_EQ(out_manifest.partitions_size(), 1);
+  const auto& ops = out_manifest.partitions(0).operations();
+  ASSERT_EQ(ops.size(), 4);
+  const uint64_t data_offset = metadata.GetMetadataSize();
+  EXPECT_EQ(ops[0].type(), InstallOperation::REPLACE_ZSTD);
+  EXPECT_EQ(OperationData(out.path(), data_offset, ops[0]), bz_data);
+  EXPECT_EQ(ops[1].type(), InstallOperation::REPLACE_ZSTD);
+  EXPECT_EQ(OperationData(out.path(), data_offset, ops[1]), xz_data);
+  EXPECT_EQ(ops[1].data_offset(), ops[0].data_length());
+  EXPECT_EQ(ops[2].type(), InstallOperation::SOURCE_COPY);
+  EXPECT_FALSE(ops[2].has_data_length());
+  // REPLACE operations aren't rewritten by default.
+  EXPECT_EQ(ops[3].type(), InstallOperation::REPLACE);
+  EXPECT_EQ(OperationData(out.path(), data_offset, ops[3]), raw_data);
+  EXPECT_EQ(ops[3].data_offset(), ops[1].data_offset() + ops[1].data_length());
+}
+
+TEST(PayloadTranscoderTest, UnsupportedTypeTest) {
+  DeltaArchiveManifest manifest;
+  manifest.set_block_size(kBlockSize);
+  manifest.set_minor_version(kPuffdiffMinorPayloadVersion);
+  ScopedTempFile blobs_file("PayloadTranscoderTest.blobs.XXXXXX");
+  ScopedTempFile payload("PayloadTranscoderTest.payload.XXXXXX");
+  uint64_t metadata_size = 0;
+  ASSERT_TRUE(PayloadFile::WritePayload(payload.path(),
+                                        blobs_file.path(),
+                                        "",
+                                        kBrilloMajorPayloadVersion,
+                                        manifest,
+                                        &metadata_size));
+  // The clients of a minor version 5 payload can't apply REPLACE_ZSTD.
+  ScopedTempFile out("PayloadTranscoderTest.out.XXXXXX");
+  ASSERT_FALSE(TranscodePayload(payload.path(), out.path(), {}));
+  PayloadTranscodeOptions options;
+  options.type = InstallOperation::REPLACE_XZ;
+  ASSERT_TRUE(TranscodePayload(payload.path(), out.path(), options));
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,97 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/rolling_hash.h"
+
+#include <string.h>
+
+#include <cstdlib>
+#include <map>
+#include <unordered_map>
+
+namespace chromeos_update_engine {
+
+RollingHash::RollingHash(const uint8_t* data, size_t window_size)
+    : window_size_(window_size) {
+  for (size_t i = 0; i < window_size; i++) {
+    a_ += data[i];
+    b_ += (window_size - i) * data[i];
+  }
+}
+
+void RollingHash::Roll(uint8_t out, uint8_t in) {
+  a_ += in - out;
+  b_ += a_ - window_size_ * out;
+}
+
+std::optional<int64_t> FindDataShift(const brillo::Blob& old_data,
+                                     const brillo::Blob& new_data,
+                                     size_t window_size,
+                                     size_t min_matches) {
+  if (window_size == 0 || old_data.size() < window_size ||
+      new_data.size() < window_size) {
+    return std::nullopt;
+  }
+  // The first offset of the old windows by hash.
+  std::unordered_map<uint32_t, size_t> old_windows;
+  for (size_t offset = 0; offset + window_size <= old_data.size();
+       offset += window_size) {
+    old_windows.emplace(
+        RollingHash(old_data.data() + offset, window_size).value(), offset);
+  }
+
+  std::map<int64_t, size_t> shifts;
+  RollingHash hash(new_data.data(), window_size);
+  size_t offset = 0;
+  while (true) {
+    const auto it = old_windows.find(hash.value());
+    if (it != old_windows.end() &&
+        memcmp(old_data.data() + it->second,
+               new_data.data() + offset,
+               window_size) == 0) {
+      shifts[static_cast<int64_t>(offset) - static_cast<int64_t>(it->second)]++;
+      // The windows overlapping the match would match at the same shift.
+      offset += window_size;
+      if (offset + window_size > new_data.size()) {
+        break;
+      }
+      hash = RollingHash(new_data.data() + offset, window_size);
+      continue;
+    }
+    if (offset + window_size >= new_data.size()) {
+      break;
+    }
+    hash.Roll(new_data[offset], new_data[offset + window_size]);
+    offset++;
+  }
+
+  // The most common shift, the smallest one among equally common ones.
+  std::optional<int64_t> result;
+  size_t result_matches = 0;
+  for (const auto& [shift, matches] : shifts) {
+    if (matches > result_matches ||
+        (matches == result_matches && std::abs(shift) < std::abs(*result))) {
+      result = shift;
+      result_matches = matches;
+    }
+  }
+  if (result_matches < min_matches) {
+    return std::nullopt;
+  }
+  return result;
+}
+
+}  // namespace chromeos_update_engine
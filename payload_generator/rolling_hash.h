@@ -0,0 +1,62 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_ROLLING_HASH_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_ROLLING_HASH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include <brillo/secure_blob.h>
+
+namespace chromeos_update_engine {
+
+// The rsync weak checksum of a window of bytes, which can be rolled one byte
+// at a time.
+class RollingHash {
+ public:
+  RollingHash(const uint8_t* data, size_t window_size);
+
+  // Moves the window one byte forward, from |out| to |in|.
+  void Roll(uint8_t out, uint8_t in);
+
+  uint32_t value() const { return (b_ << 16) | (a_ & 0xffff); }
+
+ private:
+  size_t window_size_;
+  uint32_t a_{0};
+  uint32_t b_{0};
+};
+
+// Finds by how many bytes the data of |new_data| moved from |old_data|, for
+// data moved by a number of bytes which isn't a multiple of the block size
+// and isn't found by comparing blocks. Like rsync, the windows of
+// |window_size| bytes of |old_data| at every multiple of |window_size| are
+// hashed, and the windows of |new_data| at every byte offset are looked up
+// among them, so any run of 2 * |window_size| common bytes is found.
+//
+// Returns the most common shift, the offset in |new_data| minus the offset in
+// |old_data|, of the matching windows, or nullopt if fewer than
+// |min_matches| windows matched.
+std::optional<int64_t> FindDataShift(const brillo::Blob& old_data,
+                                     const brillo::Blob& new_data,
+                                     size_t window_size,
+                                     size_t min_matches);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_ROLLING_HASH_H_
@@ -0,0 +1,76 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/rolling_hash.h"
+
+#include <random>
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr size_t kWindowSize = 64;
+
+brillo::Blob RandomData(size_t size, uint32_t seed) {
+  std::mt19937 gen(seed);
+  brillo::Blob data(size);
+  for (auto& byte : data) {
+    byte = gen();
+  }
+  return data;
+}
+}  // namespace
+
+TEST(RollingHashTest, RollMatchesHashOfWindow) {
+  const brillo::Blob data = RandomData(1000, 0);
+  RollingHash hash(data.data(), kWindowSize);
+  for (size_t offset = 1; offset + kWindowSize <= data.size(); offset++) {
+    hash.Roll(data[offset - 1], data[offset - 1 + kWindowSize]);
+    ASSERT_EQ(RollingHash(data.data() + offset, kWindowSize).value(),
+              hash.value());
+  }
+}
+
+TEST(RollingHashTest, FindDataShift) {
+  const brillo::Blob old_data = RandomData(64 * 1024, 1);
+  brillo::Blob new_data = old_data;
+  // 100 bytes inserted near the beginning and a few changed bytes.
+  const brillo::Blob inserted = RandomData(100, 2);
+  new_data.insert(new_data.begin() + 1000, inserted.begin(), inserted.end());
+  new_data[30000] ^= 0xff;
+  new_data[50000] ^= 0xff;
+  EXPECT_EQ(100, FindDataShift(old_data, new_data, kWindowSize, 10));
+
+  // 5000 bytes removed.
+  new_data = old_data;
+  new_data.erase(new_data.begin(), new_data.begin() + 5000);
+  EXPECT_EQ(-5000, FindDataShift(old_data, new_data, kWindowSize, 10));
+}
+
+TEST(RollingHashTest, FindDataShiftWithoutMatches) {
+  const brillo::Blob old_data = RandomData(64 * 1024, 1);
+  EXPECT_EQ(std::nullopt,
+            FindDataShift(old_data, RandomData(64 * 1024, 2), kWindowSize, 1));
+  EXPECT_EQ(std::nullopt, FindDataShift(old_data, {}, kWindowSize, 1));
+  // Too few matches.
+  brillo::Blob new_data = RandomData(64 * 1024, 2);
+  std::copy(old_data.begin(), old_data.begin() + 1024, new_data.begin() + 7);
+  EXPECT_EQ(7, FindDataShift(old_data, new_data, kWindowSize, 10));
+  EXPECT_EQ(std::nullopt, FindDataShift(old_data, new_data, kWindowSize, 20));
+}
+
+}  // namespace chromeos_update_engine
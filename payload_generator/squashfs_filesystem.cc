@@ -19,6 +19,9 @@
 #include <fcntl.h>
 
 #include <algorithm>
+#include <limits>
+#include <map>
+#include <set>
 #include <string>
 #include <utility>
 
@@ -28,6 +31,10 @@
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_split.h>
 #include <brillo/streams/file_stream.h>
+#include <lz4.h>
+#include <xz.h>
+#include <zlib.h>
+#include <zstd.h>
 
 #include "update_engine/common/subprocess.h"
 #include "update_engine/common/utils.h"
@@ -50,6 +57,30 @@ namespace {
 constexpr size_t kSquashfsSuperBlockSize = 96;
 constexpr uint64_t kSquashfsCompressedBit = 1 << 24;
 constexpr uint32_t kSquashfsZlibCompression = 1;
+constexpr uint32_t kSquashfsXzCompression = 4;
+constexpr uint32_t kSquashfsLz4Compression = 5;
+constexpr uint32_t kSquashfsZstdCompression = 6;
+
+// Metadata blocks hold up to 8 KiB of the inode and directory tables. Their
+// 16 bit header is the stored size, with this bit set if it is uncompressed.
+constexpr size_t kSquashfsMetadataSize = 8192;
+constexpr uint16_t kSquashfsMetadataUncompressedBit = 1 << 15;
+
+constexpr uint16_t kSquashfsDirType = 1;
+constexpr uint16_t kSquashfsRegType = 2;
+constexpr uint16_t kSquashfsLDirType = 8;
+constexpr uint16_t kSquashfsLRegType = 9;
+
+constexpr uint32_t kSquashfsInvalidFragment = 0xFFFFFFFF;
+constexpr size_t kSquashfsMaxDirEntries = 256;
+constexpr size_t kSquashfsMaxNameSize = 256;
+
+template <typename T>
+T GetLE(const uint8_t* data) {
+  T value;
+  memcpy(&value, data, sizeof(T));
+  return value;
+}
 
 bool ReadSquashfsHeader(const brillo::Blob blob,
                         SquashfsFilesystem::SquashfsHeader* header) {
@@ -89,22 +120,9 @@ bool GetFileMapContent(const string& sqfs_path, string* map) {
   return true;
 }
 
-}  // namespace
-
-bool SquashfsFilesystem::Init(const string& map,
-                              const string& sqfs_path,
-                              size_t size,
-                              const SquashfsHeader& header,
-                              bool extract_deflates) {
-  size_ = size;
-
-  bool is_zlib = header.compression_type == kSquashfsZlibCompression;
-  if (!is_zlib) {
-    LOG(WARNING) << "Filesystem is not Gzipped. Not filling deflates!";
-  }
-  vector<puffin::ByteExtent> zlib_blks;
-
-  // Reading files map. For the format of the file map look at the comments for
+bool ParseFileMap(const string& map,
+                  vector<SquashfsFilesystem::FileMapEntry>* entries) {
+  // For the format of the file map look at the comments for
   // |CreateFromFileMap()|.
   auto lines = base::SplitStringPiece(map,
                                       "\n",
@@ -118,13 +136,324 @@ bool SquashfsFilesystem::Init(const string& map,
                                base::SplitResult::SPLIT_WANT_NONEMPTY);
     // Only filename is invalid.
     TEST_AND_RETURN_FALSE(splits.size() > 1);
-    uint64_t start;
-    TEST_AND_RETURN_FALSE(base::StringToUint64(splits[1], &start));
-    uint64_t cur_offset = start;
-    bool is_compressed = false;
+    SquashfsFilesystem::FileMapEntry entry;
+    entry.name = splits[0].as_string();
+    TEST_AND_RETURN_FALSE(base::StringToUint64(splits[1], &entry.start));
     for (size_t i = 2; i < splits.size(); ++i) {
       uint64_t blk_size;
       TEST_AND_RETURN_FALSE(base::StringToUint64(splits[i], &blk_size));
+      TEST_AND_RETURN_FALSE(blk_size <= std::numeric_limits<uint32_t>::max());
+      entry.block_sizes.push_back(blk_size);
+    }
+    entries->push_back(std::move(entry));
+  }
+  return true;
+}
+
+// Reads the file map of a squashfs image from its inode and directory tables,
+// which is what `unsquashfs -m` prints, without extracting the image. This
+// class uses the definitions found in fs/squashfs/squashfs_fs.h.
+class SquashfsFileMapReader {
+ public:
+  SquashfsFileMapReader(int fd, const brillo::Blob& super_block)
+      : fd_(fd),
+        block_size_(GetLE<uint32_t>(super_block.data() + 12)),
+        compression_(GetLE<uint16_t>(super_block.data() + 20)),
+        root_inode_(GetLE<uint64_t>(super_block.data() + 32)),
+        bytes_used_(GetLE<uint64_t>(super_block.data() + 40)),
+        inode_table_(GetLE<uint64_t>(super_block.data() + 64)),
+        directory_table_(GetLE<uint64_t>(super_block.data() + 72)) {}
+
+  bool Read(vector<SquashfsFilesystem::FileMapEntry>* entries) {
+    TEST_AND_RETURN_FALSE(block_size_ > 0);
+    return ReadDirectory(root_inode_, "", entries);
+  }
+
+ private:
+  // A position in the inode or directory table: the offset of a metadata
+  // block in the image and an offset in its uncompressed data.
+  struct Position {
+    uint64_t block;
+    size_t offset;
+  };
+
+  struct MetadataBlock {
+    brillo::Blob data;
+    // The offset of the next metadata block in the image.
+    uint64_t next;
+  };
+
+  // Sets |block| to the metadata block at |offset| in the image. Blocks are
+  // cached, as consecutive inodes and directories share them.
+  bool GetMetadataBlock(uint64_t offset, const MetadataBlock** block) {
+    auto it = blocks_.find(offset);
+    if (it != blocks_.end()) {
+      *block = &it->second;
+      return true;
+    }
+    uint8_t header[2];
+    ssize_t bytes_read;
+    TEST_AND_RETURN_FALSE(
+        utils::PReadAll(fd_, header, sizeof(header), offset, &bytes_read));
+    TEST_AND_RETURN_FALSE(bytes_read == sizeof(header));
+    const uint16_t stored = GetLE<uint16_t>(header);
+    const size_t size = stored & ~kSquashfsMetadataUncompressedBit;
+    TEST_AND_RETURN_FALSE(size > 0 && size <= kSquashfsMetadataSize);
+    TEST_AND_RETURN_FALSE(offset + sizeof(header) + size <= bytes_used_);
+    brillo::Blob data(size);
+    TEST_AND_RETURN_FALSE(utils::PReadAll(
+        fd_, data.data(), size, offset + sizeof(header), &bytes_read));
+    TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(size));
+
+    MetadataBlock new_block;
+    new_block.next = offset + sizeof(header) + size;
+    if (stored & kSquashfsMetadataUncompressedBit) {
+      new_block.data = std::move(data);
+    } else {
+      TEST_AND_RETURN_FALSE(Decompress(data, &new_block.data));
+    }
+    TEST_AND_RETURN_FALSE(!new_block.data.empty());
+    *block = &blocks_.emplace(offset, std::move(new_block)).first->second;
+    return true;
+  }
+
+  bool Decompress(const brillo::Blob& data, brillo::Blob* out) {
+    out->resize(kSquashfsMetadataSize);
+    switch (compression_) {
+      case kSquashfsZlibCompression: {
+        uLongf size = out->size();
+        TEST_AND_RETURN_FALSE(
+            uncompress(out->data(), &size, data.data(), data.size()) == Z_OK);
+        out->resize(size);
+        return true;
+      }
+      case kSquashfsXzCompression: {
+        std::unique_ptr<xz_dec, decltype(&xz_dec_end)> decoder(
+            xz_dec_init(XZ_SINGLE, 0), &xz_dec_end);
+        TEST_AND_RETURN_FALSE(decoder != nullptr);
+        xz_buf request{};
+        request.in = data.data();
+        request.in_size = data.size();
+        request.out = out->data();
+        request.out_size = out->size();
+        TEST_AND_RETURN_FALSE(xz_dec_run(decoder.get(), &request) ==
+                              XZ_STREAM_END);
+        out->resize(request.out_pos);
+        return true;
+      }
+      case kSquashfsLz4Compression: {
+        const int size =
+            LZ4_decompress_safe(reinterpret_cast<const char*>(data.data()),
+                                reinterpret_cast<char*>(out->data()),
+                                data.size(),
+                                out->size());
+        TEST_AND_RETURN_FALSE(size >= 0);
+        out->resize(size);
+        return true;
+      }
+      case kSquashfsZstdCompression: {
+        const size_t size =
+            ZSTD_decompress(out->data(), out->size(), data.data(), data.size());
+        TEST_AND_RETURN_FALSE(!ZSTD_isError(size));
+        out->resize(size);
+        return true;
+      }
+      default:
+        LOG(WARNING) << "Unsupported squashfs compression " << compression_;
+        return false;
+    }
+  }
+
+  // Reads |size| bytes of the table at |pos| into |out| and advances |pos|.
+  bool ReadMetadata(Position* pos, size_t size, void* out) {
+    uint8_t* data = static_cast<uint8_t*>(out);
+    while (size > 0) {
+      const MetadataBlock* block;
+      TEST_AND_RETURN_FALSE(GetMetadataBlock(pos->block, &block));
+      TEST_AND_RETURN_FALSE(pos->offset < block->data.size());
+      const size_t count = std::min(size, block->data.size() - pos->offset);
+      memcpy(data, block->data.data() + pos->offset, count);
+      data += count;
+      size -= count;
+      pos->offset += count;
+      if (pos->offset == block->data.size()) {
+        pos->block = block->next;
+        pos->offset = 0;
+      }
+    }
+    return true;
+  }
+
+  // Returns the position of the inode referenced by |inode|: the offset of
+  // its metadata block from the inode table, and its offset in the block.
+  Position InodePosition(uint64_t inode) const {
+    return {inode_table_ + (inode >> 16), static_cast<size_t>(inode & 0xFFFF)};
+  }
+
+  // Adds the regular file |inode| to |entries| if it has any data blocks.
+  bool ReadFile(uint64_t inode,
+                const string& path,
+                vector<SquashfsFilesystem::FileMapEntry>* entries) {
+    Position pos = InodePosition(inode);
+    uint8_t base[16];
+    TEST_AND_RETURN_FALSE(ReadMetadata(&pos, sizeof(base), base));
+    const uint16_t type = GetLE<uint16_t>(base);
+    SquashfsFilesystem::FileMapEntry entry;
+    uint64_t file_size;
+    uint32_t fragment;
+    if (type == kSquashfsRegType) {
+      uint8_t reg[16];
+      TEST_AND_RETURN_FALSE(ReadMetadata(&pos, sizeof(reg), reg));
+      entry.start = GetLE<uint32_t>(reg);
+      fragment = GetLE<uint32_t>(reg + 4);
+      file_size = GetLE<uint32_t>(reg + 12);
+    } else if (type == kSquashfsLRegType) {
+      uint8_t lreg[40];
+      TEST_AND_RETURN_FALSE(ReadMetadata(&pos, sizeof(lreg), lreg));
+      entry.start = GetLE<uint64_t>(lreg);
+      file_size = GetLE<uint64_t>(lreg + 8);
+      fragment = GetLE<uint32_t>(lreg + 28);
+    } else {
+      LOG(ERROR) << "Unexpected inode type " << type << " for file " << path;
+      return false;
+    }
+    // The tail of the file is in a fragment, unless its last block is full or
+    // the image was made without fragments.
+    const uint64_t num_blocks = fragment == kSquashfsInvalidFragment
+                                    ? utils::DivRoundUp(file_size, block_size_)
+                                    : file_size / block_size_;
+    if (num_blocks == 0) {
+      return true;
+    }
+    entry.name = path;
+    for (uint64_t i = 0; i < num_blocks; i++) {
+      uint8_t block_size[4];
+      TEST_AND_RETURN_FALSE(
+          ReadMetadata(&pos, sizeof(block_size), block_size));
+      entry.block_sizes.push_back(GetLE<uint32_t>(block_size));
+    }
+    entries->push_back(std::move(entry));
+    return true;
+  }
+
+  // Adds the regular files under the directory |inode| to |entries|.
+  bool ReadDirectory(uint64_t inode,
+                     const string& path,
+                     vector<SquashfsFilesystem::FileMapEntry>* entries) {
+    // Directories can't be hard linked, so this only stops corrupted images
+    // from looping.
+    TEST_AND_RETURN_FALSE(visited_directories_.insert(inode).second);
+    Position pos = InodePosition(inode);
+    uint8_t base[16];
+    TEST_AND_RETURN_FALSE(ReadMetadata(&pos, sizeof(base), base));
+    const uint16_t type = GetLE<uint16_t>(base);
+    uint64_t start, size;
+    size_t offset;
+    if (type == kSquashfsDirType) {
+      uint8_t dir[16];
+      TEST_AND_RETURN_FALSE(ReadMetadata(&pos, sizeof(dir), dir));
+      start = GetLE<uint32_t>(dir);
+      size = GetLE<uint16_t>(dir + 8);
+      offset = GetLE<uint16_t>(dir + 10);
+    } else if (type == kSquashfsLDirType) {
+      uint8_t ldir[24];
+      TEST_AND_RETURN_FALSE(ReadMetadata(&pos, sizeof(ldir), ldir));
+      size = GetLE<uint32_t>(ldir + 4);
+      start = GetLE<uint32_t>(ldir + 8);
+      offset = GetLE<uint16_t>(ldir + 18);
+    } else {
+      LOG(ERROR) << "Unexpected inode type " << type << " for directory "
+                 << path;
+      return false;
+    }
+    // The size counts 3 bytes for the "." and ".." entries, which are not
+    // stored.
+    if (size <= 3) {
+      return true;
+    }
+    size -= 3;
+
+    pos = {directory_table_ + start, offset};
+    while (size > 0) {
+      // Each header is followed by up to 256 entries whose inodes are in the
+      // same metadata block.
+      uint8_t header[12];
+      TEST_AND_RETURN_FALSE(size >= sizeof(header));
+      TEST_AND_RETURN_FALSE(ReadMetadata(&pos, sizeof(header), header));
+      size -= sizeof(header);
+      const uint64_t count = GetLE<uint32_t>(header) + 1ULL;
+      const uint64_t inode_block = GetLE<uint32_t>(header + 4);
+      TEST_AND_RETURN_FALSE(count <= kSquashfsMaxDirEntries);
+      for (uint64_t i = 0; i < count; i++) {
+        uint8_t entry[8];
+        TEST_AND_RETURN_FALSE(size >= sizeof(entry));
+        TEST_AND_RETURN_FALSE(ReadMetadata(&pos, sizeof(entry), entry));
+        size -= sizeof(entry);
+        const uint64_t entry_inode =
+            (inode_block << 16) | GetLE<uint16_t>(entry);
+        const uint16_t entry_type = GetLE<uint16_t>(entry + 4);
+        const size_t name_size = GetLE<uint16_t>(entry + 6) + 1;
+        TEST_AND_RETURN_FALSE(name_size <= kSquashfsMaxNameSize &&
+                              name_size <= size);
+        string name(name_size, '\0');
+        TEST_AND_RETURN_FALSE(ReadMetadata(&pos, name_size, name.data()));
+        size -= name_size;
+
+        const string entry_path = path.empty() ? name : path + "/" + name;
+        if (entry_type == kSquashfsDirType) {
+          TEST_AND_RETURN_FALSE(
+              ReadDirectory(entry_inode, entry_path, entries));
+        } else if (entry_type == kSquashfsRegType) {
+          TEST_AND_RETURN_FALSE(ReadFile(entry_inode, entry_path, entries));
+        }
+      }
+    }
+    return true;
+  }
+
+  const int fd_;
+  const uint32_t block_size_;
+  const uint16_t compression_;
+  const uint64_t root_inode_;
+  const uint64_t bytes_used_;
+  const uint64_t inode_table_;
+  const uint64_t directory_table_;
+
+  std::map<uint64_t, MetadataBlock> blocks_;
+  std::set<uint64_t> visited_directories_;
+
+  DISALLOW_COPY_AND_ASSIGN(SquashfsFileMapReader);
+};
+
+bool ReadFileMap(const string& sqfs_path,
+                 const brillo::Blob& super_block,
+                 vector<SquashfsFilesystem::FileMapEntry>* entries) {
+  int fd = HANDLE_EINTR(open(sqfs_path.c_str(), O_RDONLY));
+  TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+  ScopedFdCloser fd_closer(&fd);
+  return SquashfsFileMapReader(fd, super_block).Read(entries);
+}
+
+}  // namespace
+
+bool SquashfsFilesystem::Init(const vector<FileMapEntry>& entries,
+                              const string& sqfs_path,
+                              size_t size,
+                              const SquashfsHeader& header,
+                              bool extract_deflates) {
+  size_ = size;
+
+  bool is_zlib = header.compression_type == kSquashfsZlibCompression;
+  if (!is_zlib) {
+    LOG(WARNING) << "Filesystem is not Gzipped. Not filling deflates!";
+  }
+  vector<puffin::ByteExtent> zlib_blks;
+
+  for (const auto& entry : entries) {
+    const uint64_t start = entry.start;
+    uint64_t cur_offset = start;
+    bool is_compressed = false;
+    for (uint64_t blk_size : entry.block_sizes) {
       // TODO(ahassani): For puffin push it into a proper list if uncompressed.
       auto new_blk_size = blk_size & ~kSquashfsCompressedBit;
       TEST_AND_RETURN_FALSE(new_blk_size <= header.block_size);
@@ -141,7 +470,7 @@ bool SquashfsFilesystem::Init(const string& map,
     // If size is zero do not add the file.
     if (cur_offset - start > 0) {
       File file;
-      file.name = splits[0].as_string();
+      file.name = entry.name;
       file.extents = {ExtentForBytes(kBlockSize, start, cur_offset - start)};
       file.is_compressed = is_compressed;
       files_.emplace_back(file);
@@ -277,16 +606,22 @@ unique_ptr<SquashfsFilesystem> SquashfsFilesystem::CreateFromFile(
     return nullptr;
   }
 
-  // Read the map file.
-  string filemap;
-  if (!GetFileMapContent(sqfs_path, &filemap)) {
-    LOG(ERROR) << "Failed to produce squashfs map file: " << sqfs_path;
-    return nullptr;
+  vector<FileMapEntry> entries;
+  if (!ReadFileMap(sqfs_path, blob, &entries)) {
+    LOG(WARNING) << "Failed to read the file map of " << sqfs_path
+                 << ", running unsquashfs instead.";
+    entries.clear();
+    string filemap;
+    if (!GetFileMapContent(sqfs_path, &filemap) ||
+        !ParseFileMap(filemap, &entries)) {
+      LOG(ERROR) << "Failed to produce squashfs map file: " << sqfs_path;
+      return nullptr;
+    }
   }
 
   unique_ptr<SquashfsFilesystem> sqfs(new SquashfsFilesystem());
   if (!sqfs->Init(
-          filemap, sqfs_path, sqfs_file->GetSize(), header, extract_deflates)) {
+          entries, sqfs_path, sqfs_file->GetSize(), header, extract_deflates)) {
     LOG(ERROR) << "Failed to initialized the Squashfs file system";
     return nullptr;
   }
@@ -301,8 +636,14 @@ unique_ptr<SquashfsFilesystem> SquashfsFilesystem::CreateFromFileMap(
     return nullptr;
   }
 
+  vector<FileMapEntry> entries;
+  if (!ParseFileMap(filemap, &entries)) {
+    LOG(ERROR) << "Failed to parse the squashfs file map";
+    return nullptr;
+  }
+
   unique_ptr<SquashfsFilesystem> sqfs(new SquashfsFilesystem());
-  if (!sqfs->Init(filemap, "", size, header, false)) {
+  if (!sqfs->Init(entries, "", size, header, false)) {
     LOG(ERROR) << "Failed to initialize the Squashfs file system using filemap";
     return nullptr;
   }
@@ -51,11 +51,23 @@ class SquashfsFilesystem : public FilesystemInterface {
     uint16_t major_version;
   };
 
+  // A regular file of the image: the byte offset of its first data block and
+  // the size of each of its data blocks, as stored in its inode. The 25th bit
+  // of a size is set if the block is uncompressed. The tail of a file stored
+  // in a fragment is not part of its blocks.
+  struct FileMapEntry {
+    std::string name;
+    uint64_t start;
+    std::vector<uint32_t> block_sizes;
+  };
+
   ~SquashfsFilesystem() override = default;
 
   // Creates the file system from the Squashfs file itself. If
   // |extract_deflates| is true, it will process files to find location of all
-  // deflate streams.
+  // deflate streams. The file map is read from the inode and directory tables
+  // of the image, unless its metadata is compressed with an algorithm other
+  // than gzip, xz, lz4 or zstd, in which case `unsquashfs -m` is run.
   static std::unique_ptr<SquashfsFilesystem> CreateFromFile(
       const std::string& sqfs_path, bool extract_deflates);
 
@@ -96,7 +108,7 @@ class SquashfsFilesystem : public FilesystemInterface {
   SquashfsFilesystem() = default;
 
   // Initialize and populates the files in the file system.
-  bool Init(const std::string& map,
+  bool Init(const std::vector<FileMapEntry>& entries,
             const std::string& sqfs_path,
             size_t size,
             const SquashfsHeader& header,
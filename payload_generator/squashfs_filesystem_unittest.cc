@@ -58,6 +58,113 @@ void ExpectBlocksInRange(const vector<Extent>& extents, uint64_t total_blocks) {
   }
 }
 
+template <typename T>
+void AppendLE(T value, brillo::Blob* blob) {
+  const auto* data = reinterpret_cast<const uint8_t*>(&value);
+  blob->insert(blob->end(), data, data + sizeof(T));
+}
+
+// Appends the inode header of |type| to |table|.
+void AppendInodeHeader(uint16_t type, uint32_t number, brillo::Blob* table) {
+  AppendLE<uint16_t>(type, table);
+  AppendLE<uint16_t>(0755, table);  // mode
+  AppendLE<uint16_t>(0, table);     // uid
+  AppendLE<uint16_t>(0, table);     // gid
+  AppendLE<uint32_t>(0, table);     // mtime
+  AppendLE<uint32_t>(number, table);
+}
+
+// Appends a directory entry of |type| for the inode at |offset| in the first
+// metadata block.
+void AppendDirEntry(uint16_t offset,
+                    uint16_t type,
+                    const string& name,
+                    brillo::Blob* table) {
+  AppendLE<uint16_t>(offset, table);
+  AppendLE<uint16_t>(0, table);  // inode number delta
+  AppendLE<uint16_t>(type, table);
+  AppendLE<uint16_t>(name.size() - 1, table);
+  table->insert(table->end(), name.begin(), name.end());
+}
+
+// Returns a two blocks squashfs image with uncompressed metadata holding
+// "dir1/file1", whose single data block is at byte 96, and "dir1/file2",
+// which is only stored in a fragment.
+brillo::Blob GetSimpleImage() {
+  brillo::Blob inodes;
+  // The root directory, at offset 0 of the directory table.
+  AppendInodeHeader(1, 1, &inodes);
+  AppendLE<uint32_t>(0, &inodes);       // start_block
+  AppendLE<uint32_t>(3, &inodes);       // nlink
+  AppendLE<uint16_t>(24 + 3, &inodes);  // file_size
+  AppendLE<uint16_t>(0, &inodes);       // offset
+  AppendLE<uint32_t>(5, &inodes);       // parent_inode
+  // dir1, at offset 24 of the directory table.
+  AppendInodeHeader(1, 2, &inodes);
+  AppendLE<uint32_t>(0, &inodes);
+  AppendLE<uint32_t>(2, &inodes);
+  AppendLE<uint16_t>(38 + 3, &inodes);
+  AppendLE<uint16_t>(24, &inodes);
+  AppendLE<uint32_t>(1, &inodes);
+  // file1 at offset 64.
+  AppendInodeHeader(2, 3, &inodes);
+  AppendLE<uint32_t>(96, &inodes);          // start_block
+  AppendLE<uint32_t>(0xFFFFFFFF, &inodes);  // fragment
+  AppendLE<uint32_t>(0, &inodes);           // offset
+  AppendLE<uint32_t>(4000, &inodes);        // file_size
+  AppendLE<uint32_t>(4000 | (1 << 24), &inodes);
+  // file2 at offset 100.
+  AppendInodeHeader(2, 4, &inodes);
+  AppendLE<uint32_t>(0, &inodes);
+  AppendLE<uint32_t>(0, &inodes);
+  AppendLE<uint32_t>(0, &inodes);
+  AppendLE<uint32_t>(100, &inodes);
+
+  brillo::Blob dirs;
+  AppendLE<uint32_t>(0, &dirs);  // count - 1
+  AppendLE<uint32_t>(0, &dirs);  // start_block
+  AppendLE<uint32_t>(2, &dirs);  // inode_number
+  AppendDirEntry(32, 1, "dir1", &dirs);
+  AppendLE<uint32_t>(1, &dirs);
+  AppendLE<uint32_t>(0, &dirs);
+  AppendLE<uint32_t>(3, &dirs);
+  AppendDirEntry(64, 2, "file1", &dirs);
+  AppendDirEntry(100, 2, "file2", &dirs);
+
+  brillo::Blob image(kTestBlockSize);
+  const uint64_t inode_table = image.size();
+  AppendLE<uint16_t>(inodes.size() | (1 << 15), &image);
+  image.insert(image.end(), inodes.begin(), inodes.end());
+  const uint64_t directory_table = image.size();
+  AppendLE<uint16_t>(dirs.size() | (1 << 15), &image);
+  image.insert(image.end(), dirs.begin(), dirs.end());
+  const uint64_t bytes_used = image.size();
+  image.resize(kTestBlockSize * 2);
+
+  brillo::Blob super_block;
+  AppendLE<uint32_t>(0x73717368, &super_block);  // magic
+  AppendLE<uint32_t>(4, &super_block);           // inodes
+  AppendLE<uint32_t>(0, &super_block);           // mkfs_time
+  AppendLE<uint32_t>(kTestSqfsBlockSize, &super_block);
+  AppendLE<uint32_t>(1, &super_block);   // fragments
+  AppendLE<uint16_t>(1, &super_block);   // compression
+  AppendLE<uint16_t>(15, &super_block);  // block_log
+  AppendLE<uint16_t>(0, &super_block);   // flags
+  AppendLE<uint16_t>(1, &super_block);   // no_ids
+  AppendLE<uint16_t>(4, &super_block);   // major
+  AppendLE<uint16_t>(0, &super_block);   // minor
+  AppendLE<uint64_t>(0, &super_block);   // root_inode
+  AppendLE<uint64_t>(bytes_used, &super_block);
+  AppendLE<uint64_t>(bytes_used, &super_block);  // id_table_start
+  AppendLE<uint64_t>(bytes_used, &super_block);  // xattr_id_table_start
+  AppendLE<uint64_t>(inode_table, &super_block);
+  AppendLE<uint64_t>(directory_table, &super_block);
+  AppendLE<uint64_t>(bytes_used, &super_block);  // fragment_table_start
+  AppendLE<uint64_t>(bytes_used, &super_block);  // lookup_table_start
+  std::copy(super_block.begin(), super_block.end(), image.begin());
+  return image;
+}
+
 SquashfsFilesystem::SquashfsHeader GetSimpleHeader() {
   // These properties are enough for now. Add more as needed.
   return {
@@ -296,6 +403,25 @@ TEST_F(SquashfsFilesystemTest, FailLargerThanBlockSizeTest) {
   EXPECT_FALSE(fs);
 }
 
+TEST_F(SquashfsFilesystemTest, ReadFileMapFromImageTest) {
+  ScopedTempFile image_file("SquashfsFilesystemTest-XXXXXX");
+  const brillo::Blob image = GetSimpleImage();
+  ASSERT_TRUE(
+      utils::WriteFile(image_file.path().c_str(), image.data(), image.size()));
+  unique_ptr<SquashfsFilesystem> fs =
+      SquashfsFilesystem::CreateFromFile(image_file.path(), false);
+  CheckSquashfs(fs);
+
+  vector<FilesystemInterface::File> files;
+  ASSERT_TRUE(fs->GetFiles(&files));
+  ASSERT_EQ(files.size(), 2u);
+  EXPECT_EQ(files[0].name, "dir1/file1");
+  EXPECT_EQ(files[0].extents, vector<Extent>{ExtentForRange(0, 1)});
+  EXPECT_FALSE(files[0].is_compressed);
+  EXPECT_EQ(files[1].name, "<metadata-0>");
+  EXPECT_EQ(files[1].extents, vector<Extent>{ExtentForRange(1, 1)});
+}
+
 // Test is squashfs image.
 TEST_F(SquashfsFilesystemTest, IsSquashfsImageTest) {
   // Some sample from a recent squashfs file.
@@ -0,0 +1,149 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/suffix_array_cache.h"
+
+#include <atomic>
+#include <limits>
+#include <utility>
+
+#include <base/logging.h>
+#include <bsdiff/bsdiff.h>
+#include <bsdiff/suffix_array_index.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/huge_pages.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Sources smaller than this are sorted again rather than hashed and cached.
+constexpr size_t kMinCachedSourceSize = 64 * 1024;
+
+std::atomic<SuffixArrayCache*> installed_cache{nullptr};
+
+// The bytes held by the entry of a source of |size| bytes: the source and
+// a suffix array of 32 bit indices, or 64 bit ones for the largest sources.
+size_t EntryBytes(size_t size) {
+  const size_t index_size =
+      size < std::numeric_limits<int32_t>::max() ? sizeof(int32_t)
+                                                 : sizeof(int64_t);
+  return size + (size + 1) * index_size;
+}
+
+}  // namespace
+
+SuffixArrayCache::Entry::~Entry() = default;
+
+SuffixArrayCache::SuffixArrayCache(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+SuffixArrayCache::~SuffixArrayCache() = default;
+
+size_t SuffixArrayCache::cached_bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return cached_bytes_;
+}
+
+std::shared_ptr<SuffixArrayCache::Entry> SuffixArrayCache::GetEntry(
+    const brillo::Blob& key, size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second->lru_it);
+    return it->second;
+  }
+  if (bytes > max_bytes_)
+    return nullptr;
+  // The evicted entries stay alive until the bsdiff runs using them finish.
+  while (cached_bytes_ + bytes > max_bytes_) {
+    auto evicted = entries_.find(lru_.back());
+    cached_bytes_ -= evicted->second->bytes;
+    entries_.erase(evicted);
+    lru_.pop_back();
+  }
+  auto entry = std::make_shared<Entry>();
+  entry->bytes = bytes;
+  entry->lru_it = lru_.insert(lru_.begin(), key);
+  entries_.emplace(key, entry);
+  cached_bytes_ += bytes;
+  return entry;
+}
+
+bool SuffixArrayCache::Bsdiff(const brillo::Blob& old_data,
+                              const brillo::Blob& new_data,
+                              bsdiff::PatchWriterInterface* patch) {
+  std::shared_ptr<Entry> entry;
+  brillo::Blob key;
+  if (old_data.size() >= kMinCachedSourceSize &&
+      HashCalculator::RawHashOfData(old_data, &key)) {
+    entry = GetEntry(key, EntryBytes(old_data.size()));
+  }
+  if (!entry) {
+    return 0 == bsdiff::bsdiff(old_data.data(),
+                               old_data.size(),
+                               new_data.data(),
+                               new_data.size(),
+                               patch,
+                               nullptr);
+  }
+
+  bsdiff::SuffixArrayIndexInterface* index;
+  {
+    // The other runs from the same source wait for the first one to sort it.
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    if (!entry->index) {
+      ReserveHugePages(&entry->data, old_data.size());
+      entry->data.assign(old_data.begin(), old_data.end());
+      entry->index = bsdiff::CreateSuffixArrayIndex(entry->data.data(),
+                                                    entry->data.size());
+      TEST_AND_RETURN_FALSE(entry->index != nullptr);
+    }
+    index = entry->index.get();
+  }
+  // bsdiff only reads a suffix array passed in, so it is shared by the runs.
+  return 0 == bsdiff::bsdiff(entry->data.data(),
+                             entry->data.size(),
+                             new_data.data(),
+                             new_data.size(),
+                             patch,
+                             &index);
+}
+
+SuffixArrayCache* SuffixArrayCache::Get() {
+  return installed_cache.load(std::memory_order_acquire);
+}
+
+void SuffixArrayCache::Set(SuffixArrayCache* cache) {
+  installed_cache.store(cache, std::memory_order_release);
+}
+
+bool SuffixArrayCache::RunBsdiff(const brillo::Blob& old_data,
+                                 const brillo::Blob& new_data,
+                                 bsdiff::PatchWriterInterface* patch) {
+  if (SuffixArrayCache* cache = Get())
+    return cache->Bsdiff(old_data, new_data, patch);
+  return 0 == bsdiff::bsdiff(old_data.data(),
+                             old_data.size(),
+                             new_data.data(),
+                             new_data.size(),
+                             patch,
+                             nullptr);
+}
+
+}  // namespace chromeos_update_engine
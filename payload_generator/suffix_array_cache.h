@@ -0,0 +1,98 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_SUFFIX_ARRAY_CACHE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_SUFFIX_ARRAY_CACHE_H_
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+#include <bsdiff/patch_writer_interface.h>
+
+namespace bsdiff {
+class SuffixArrayIndexInterface;
+}  // namespace bsdiff
+
+namespace chromeos_update_engine {
+
+// A cache of the suffix arrays bsdiff sorts the source data into, shared by
+// the bsdiff runs of a payload generation, so that the source data diffed
+// more than once, like an old file which is the source of several new files,
+// is only sorted once. The cache holds about |max_bytes| of suffix arrays
+// and of the source data they index, evicting the least recently used ones.
+// All the methods may be called concurrently.
+class SuffixArrayCache {
+ public:
+  explicit SuffixArrayCache(size_t max_bytes);
+  ~SuffixArrayCache();
+
+  // Same as bsdiff::bsdiff() from |old_data| to |new_data|, using the cached
+  // suffix array of |old_data| if any, otherwise caching the one sorted.
+  // Returns whether bsdiff succeeded.
+  bool Bsdiff(const brillo::Blob& old_data,
+              const brillo::Blob& new_data,
+              bsdiff::PatchWriterInterface* patch);
+
+  // The number of bytes currently held by the cache.
+  size_t cached_bytes() const;
+
+  // Returns the installed cache, or nullptr.
+  static SuffixArrayCache* Get();
+  // Installs |cache|, which must outlive its use, or none.
+  static void Set(SuffixArrayCache* cache);
+
+  // Runs bsdiff with the installed cache if any, otherwise without caching.
+  static bool RunBsdiff(const brillo::Blob& old_data,
+                        const brillo::Blob& new_data,
+                        bsdiff::PatchWriterInterface* patch);
+
+ private:
+  // A source and its suffix array, which points into |data|.
+  struct Entry {
+    ~Entry();
+
+    // Held while |index| is sorted.
+    std::mutex mutex;
+    brillo::Blob data;
+    std::unique_ptr<bsdiff::SuffixArrayIndexInterface> index;
+    size_t bytes{0};
+    // The position in |lru_|.
+    std::list<brillo::Blob>::iterator lru_it;
+  };
+
+  // Returns the entry of the source data whose hash is |key|, adding an
+  // empty one of |bytes| bytes if none, or nullptr if it doesn't fit.
+  std::shared_ptr<Entry> GetEntry(const brillo::Blob& key, size_t bytes);
+
+  const size_t max_bytes_;
+
+  mutable std::mutex mutex_;
+  std::map<brillo::Blob, std::shared_ptr<Entry>> entries_;
+  // The keys of |entries_|, most recently used first.
+  std::list<brillo::Blob> lru_;
+  size_t cached_bytes_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(SuffixArrayCache);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_SUFFIX_ARRAY_CACHE_H_
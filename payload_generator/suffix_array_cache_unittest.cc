@@ -0,0 +1,108 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/suffix_array_cache.h"
+
+#include <memory>
+#include <string>
+
+#include <bsdiff/bsdiff.h>
+#include <bsdiff/patch_writer_factory.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+class SuffixArrayCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    old_data_.resize(256 * 1024);
+    test_utils::FillWithData(&old_data_);
+    new_data_ = old_data_;
+    new_data_.erase(new_data_.begin() + 1000, new_data_.begin() + 2000);
+    new_data_[50000] ^= 0xff;
+  }
+
+  // Returns the bsdiff patch from |old_data| to |new_data_| made by |cache|,
+  // or without a cache if nullptr.
+  brillo::Blob Diff(SuffixArrayCache* cache, const brillo::Blob& old_data) {
+    ScopedTempFile patch_file("suffix_array_cache_patch.XXXXXX");
+    auto patch_writer = bsdiff::CreateBsdiffPatchWriter(patch_file.path());
+    if (cache) {
+      EXPECT_TRUE(cache->Bsdiff(old_data, new_data_, patch_writer.get()));
+    } else {
+      EXPECT_EQ(0,
+                bsdiff::bsdiff(old_data.data(),
+                               old_data.size(),
+                               new_data_.data(),
+                               new_data_.size(),
+                               patch_writer.get(),
+                               nullptr));
+    }
+    brillo::Blob patch;
+    EXPECT_TRUE(utils::ReadFile(patch_file.path(), &patch));
+    return patch;
+  }
+
+  brillo::Blob old_data_;
+  brillo::Blob new_data_;
+};
+
+TEST_F(SuffixArrayCacheTest, SamePatchAsUncachedTest) {
+  SuffixArrayCache cache(64 * 1024 * 1024);
+  const brillo::Blob expected = Diff(nullptr, old_data_);
+  EXPECT_EQ(expected, Diff(&cache, old_data_));
+  const size_t cached_bytes = cache.cached_bytes();
+  EXPECT_GT(cached_bytes, old_data_.size());
+
+  // The second diff from the same source uses the cached suffix array.
+  EXPECT_EQ(expected, Diff(&cache, old_data_));
+  EXPECT_EQ(cached_bytes, cache.cached_bytes());
+}
+
+TEST_F(SuffixArrayCacheTest, SmallSourceNotCachedTest) {
+  SuffixArrayCache cache(64 * 1024 * 1024);
+  const brillo::Blob old_data(old_data_.begin(), old_data_.begin() + 1000);
+  EXPECT_EQ(Diff(nullptr, old_data), Diff(&cache, old_data));
+  EXPECT_EQ(0u, cache.cached_bytes());
+}
+
+TEST_F(SuffixArrayCacheTest, SourceLargerThanCacheNotCachedTest) {
+  SuffixArrayCache cache(old_data_.size());
+  EXPECT_EQ(Diff(nullptr, old_data_), Diff(&cache, old_data_));
+  EXPECT_EQ(0u, cache.cached_bytes());
+}
+
+TEST_F(SuffixArrayCacheTest, EvictsLeastRecentlyUsedTest) {
+  // Room for the suffix array of a single source.
+  const size_t max_bytes = old_data_.size() * 8;
+  SuffixArrayCache cache(max_bytes);
+  brillo::Blob other_old_data = old_data_;
+  other_old_data[0] ^= 0xff;
+
+  EXPECT_EQ(Diff(nullptr, old_data_), Diff(&cache, old_data_));
+  const size_t cached_bytes = cache.cached_bytes();
+  EXPECT_GT(cached_bytes, 0u);
+  EXPECT_EQ(Diff(nullptr, other_old_data), Diff(&cache, other_old_data));
+  EXPECT_EQ(cached_bytes, cache.cached_bytes());
+  EXPECT_EQ(Diff(nullptr, old_data_), Diff(&cache, old_data_));
+  EXPECT_LE(cache.cached_bytes(), max_bytes);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,127 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/task_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <utility>
+
+namespace chromeos_update_engine {
+
+namespace {
+std::atomic<TaskPool*> installed_pool{nullptr};
+}  // namespace
+
+TaskPool::TaskPool(size_t num_threads)
+    : num_threads_(std::max<size_t>(num_threads, 1)) {
+  for (size_t i = 1; i < num_threads_; i++) {
+    workers_.emplace_back(&TaskPool::WorkerMain, this);
+  }
+}
+
+TaskPool::~TaskPool() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+    cv_.notify_all();
+  }
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void TaskPool::Run(std::vector<Task> tasks) {
+  if (tasks.empty()) {
+    return;
+  }
+  Batch batch;
+  batch.remaining = tasks.size();
+  std::move(tasks.begin(), tasks.end(), std::back_inserter(batch.queued));
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  batches_.push_back(&batch);
+  cv_.notify_all();
+  while (batch.remaining > 0) {
+    if (!RunNextTaskLocked(&lock, &batch)) {
+      cv_.wait(lock);
+    }
+  }
+}
+
+void TaskPool::Run(
+    const std::vector<base::DelegateSimpleThread::Delegate*>& tasks) {
+  std::vector<Task> functions;
+  functions.reserve(tasks.size());
+  for (base::DelegateSimpleThread::Delegate* task : tasks) {
+    functions.push_back([task] { task->Run(); });
+  }
+  Run(std::move(functions));
+}
+
+TaskPool* TaskPool::Get() {
+  return installed_pool.load(std::memory_order_acquire);
+}
+
+void TaskPool::Set(TaskPool* pool) {
+  installed_pool.store(pool, std::memory_order_release);
+}
+
+size_t TaskPool::RunTasks(std::vector<Task> tasks, size_t num_threads) {
+  if (TaskPool* pool = Get()) {
+    pool->Run(std::move(tasks));
+    return pool->num_threads();
+  }
+  TaskPool pool(num_threads);
+  pool.Run(std::move(tasks));
+  return pool.num_threads();
+}
+
+bool TaskPool::RunNextTaskLocked(std::unique_lock<std::mutex>* lock,
+                                 Batch* preferred) {
+  Batch* batch = preferred;
+  if (!batch || batch->queued.empty()) {
+    if (batches_.empty()) {
+      return false;
+    }
+    batch = batches_.front();
+  }
+  Task task = std::move(batch->queued.front());
+  batch->queued.pop_front();
+  if (batch->queued.empty()) {
+    batches_.remove(batch);
+  }
+  lock->unlock();
+  task();
+  lock->lock();
+  if (--batch->remaining == 0) {
+    cv_.notify_all();
+  }
+  return true;
+}
+
+void TaskPool::WorkerMain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    if (!RunNextTaskLocked(&lock, nullptr)) {
+      cv_.wait(lock);
+    }
+  }
+}
+
+}  // namespace chromeos_update_engine
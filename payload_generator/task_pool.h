@@ -0,0 +1,94 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_TASK_POOL_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_TASK_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/threading/simple_thread.h>
+
+namespace chromeos_update_engine {
+
+// A pool of threads shared by all the parallel work of a payload generation:
+// the partitions, the files of every partition, the chunks of full
+// partitions and the source hashes. Unlike WorkerPool, Run() may be called
+// concurrently and from a task of the pool, in which case the calling thread
+// runs tasks while it waits, so nesting neither deadlocks nor runs more than
+// num_threads() tasks at once.
+//
+// Tasks are run in the order of the Run() calls, and of the tasks in a call,
+// except that a thread waiting in Run() runs the tasks of its own call first.
+class TaskPool {
+ public:
+  using Task = std::function<void()>;
+
+  // |num_threads| counts the thread calling Run(), so one fewer thread is
+  // started. 0 is the same as 1.
+  explicit TaskPool(size_t num_threads);
+  ~TaskPool();
+
+  size_t num_threads() const { return num_threads_; }
+
+  // Runs |tasks| and returns once all of them completed.
+  void Run(std::vector<Task> tasks);
+  void Run(const std::vector<base::DelegateSimpleThread::Delegate*>& tasks);
+
+  // Returns the installed pool, or nullptr.
+  static TaskPool* Get();
+  // Installs |pool|, which must outlive its use, or none.
+  static void Set(TaskPool* pool);
+
+  // Runs |tasks| on the installed pool, or on a pool of |num_threads| threads
+  // created for the call if none is installed. Returns the number of threads
+  // which ran them.
+  static size_t RunTasks(std::vector<Task> tasks, size_t num_threads);
+
+ private:
+  // The tasks of a Run() call.
+  struct Batch {
+    std::deque<Task> queued;
+    size_t remaining{0};
+  };
+
+  // Runs the next queued task of |preferred| if any, otherwise the next one
+  // of the oldest batch. Returns false if no task was queued.
+  bool RunNextTaskLocked(std::unique_lock<std::mutex>* lock, Batch* preferred);
+  void WorkerMain();
+
+  const size_t num_threads_;
+  std::vector<std::thread> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // The batches with queued tasks, oldest first.
+  std::list<Batch*> batches_;
+  bool stopping_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(TaskPool);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_TASK_POOL_H_
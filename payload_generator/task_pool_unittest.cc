@@ -0,0 +1,89 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/task_pool.h"
+
+#include <atomic>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+TEST(TaskPoolTest, RunsAllTasksTest) {
+  TaskPool pool(4);
+  std::atomic<size_t> count{0};
+  std::vector<TaskPool::Task> tasks(100, [&count] { count++; });
+  pool.Run(std::move(tasks));
+  EXPECT_EQ(100u, count);
+}
+
+TEST(TaskPoolTest, SingleThreadRunsInOrderTest) {
+  TaskPool pool(1);
+  std::vector<int> order;
+  std::vector<TaskPool::Task> tasks;
+  for (int i = 0; i < 5; i++) {
+    tasks.push_back([&order, i] { order.push_back(i); });
+  }
+  pool.Run(std::move(tasks));
+  EXPECT_EQ((std::vector<int>{0, 1, 2, 3, 4}), order);
+}
+
+TEST(TaskPoolTest, NestedRunDoesNotExceedThreadsTest) {
+  constexpr size_t kThreads = 3;
+  TaskPool pool(kThreads);
+  std::atomic<size_t> running{0};
+  std::atomic<size_t> max_running{0};
+  std::atomic<size_t> leaves{0};
+  auto leaf = [&] {
+    const size_t now = ++running;
+    size_t max = max_running;
+    while (now > max && !max_running.compare_exchange_weak(max, now)) {
+    }
+    leaves++;
+    running--;
+  };
+  std::vector<TaskPool::Task> outer;
+  for (int i = 0; i < 8; i++) {
+    outer.push_back([&pool, &leaf] {
+      pool.Run(std::vector<TaskPool::Task>(16, leaf));
+    });
+  }
+  pool.Run(std::move(outer));
+  EXPECT_EQ(8u * 16u, leaves);
+  EXPECT_LE(max_running, kThreads);
+}
+
+TEST(TaskPoolTest, RunTasksUsesTheInstalledPoolTest) {
+  std::atomic<size_t> count{0};
+  EXPECT_EQ(2u,
+            TaskPool::RunTasks(std::vector<TaskPool::Task>(4, [&count] {
+                                 count++;
+                               }),
+                               2));
+  TaskPool pool(5);
+  TaskPool::Set(&pool);
+  EXPECT_EQ(5u,
+            TaskPool::RunTasks(std::vector<TaskPool::Task>(4, [&count] {
+                                 count++;
+                               }),
+                               2));
+  TaskPool::Set(nullptr);
+  EXPECT_EQ(8u, count);
+}
+
+}  // namespace chromeos_update_engine
@@ -25,6 +25,12 @@ namespace chromeos_update_engine {
 // XzCompress().
 void XzCompressInit();
 
+// Splits the streams compressed by XzCompress() into independent xz blocks of
+// |block_size| uncompressed bytes, which are compressed in parallel on the
+// installed TaskPool, and which the payload consumer can decode in parallel.
+// 0, the default, compresses each stream as a single block.
+void XzCompressSetBlockSize(size_t block_size);
+
 // Compresses the input buffer |in| into |out| with xz. The compressed stream
 // will be the equivalent of running xz -9 --check=none
 bool XzCompress(const brillo::Blob& in, brillo::Blob* out);
@@ -17,31 +17,51 @@
 #include "update_engine/payload_generator/xz.h"
 
 #include <algorithm>
+#include <vector>
 
 #include <7zCrc.h>
 #include <Xz.h>
 #include <XzEnc.h>
 #include <base/logging.h>
 
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/task_pool.h"
+
 namespace {
 
 bool xz_initialized = false;
 
-// An ISeqInStream implementation that reads all the data from the passed Blob.
+// Uncompressed size of the xz blocks, or 0 for a single block.
+size_t xz_block_size = 0;
+
+// Sizes of the .xz stream header and footer.
+constexpr size_t kXzStreamHeaderSize = 12;
+constexpr size_t kXzStreamFooterSize = 12;
+// Offset of the stream flags in the header.
+constexpr size_t kXzHeaderFlagsOffset = 6;
+constexpr size_t kXzStreamFlagsSize = 2;
+constexpr uint8_t kXzFooterMagic[] = {'Y', 'Z'};
+// Maximum size of a variable length integer of the .xz format.
+constexpr size_t kXzMaxVliSize = 9;
+
+// An ISeqInStream implementation that reads all the data from a buffer.
 struct BlobReaderStream : public ISeqInStream {
-  explicit BlobReaderStream(const brillo::Blob& data) : data_(data) {
+  BlobReaderStream(const uint8_t* data, size_t size)
+      : data_(data), size_(size) {
     Read = &BlobReaderStream::ReadStatic;
   }
 
   static SRes ReadStatic(const ISeqInStream* p, void* buf, size_t* size) {
     auto* self = static_cast<BlobReaderStream*>(const_cast<ISeqInStream*>(p));
-    *size = std::min(*size, self->data_.size() - self->pos_);
-    memcpy(buf, self->data_.data() + self->pos_, *size);
+    *size = std::min(*size, self->size_ - self->pos_);
+    memcpy(buf, self->data_ + self->pos_, *size);
     self->pos_ += *size;
     return SZ_OK;
   }
 
-  const brillo::Blob& data_;
+  const uint8_t* data_;
+  size_t size_;
 
   // The current reader position.
   size_t pos_ = 0;
@@ -65,26 +85,42 @@ struct BlobWriterStream : public ISeqOutStream {
   brillo::Blob* data_;
 };
 
-}  // namespace
+uint32_t ReadLE32(const uint8_t* data) {
+  return data[0] | data[1] << 8 | data[2] << 16 |
+         static_cast<uint32_t>(data[3]) << 24;
+}
 
-namespace chromeos_update_engine {
+void AppendLE32(uint32_t value, brillo::Blob* out) {
+  for (size_t i = 0; i < 4; i++) {
+    out->push_back(value >> (8 * i));
+  }
+}
 
-void XzCompressInit() {
-  if (xz_initialized)
-    return;
-  xz_initialized = true;
-  // Although we don't include a CRC32 for the stream, the xz file header has
-  // a CRC32 of the header itself, which required the CRC table to be
-  // initialized.
-  CrcGenerateTable();
+bool ReadVli(const brillo::Blob& data,
+             size_t end,
+             size_t* pos,
+             uint64_t* value) {
+  *value = 0;
+  for (size_t i = 0; i < kXzMaxVliSize && *pos < end; i++) {
+    const uint8_t byte = data[(*pos)++];
+    *value |= static_cast<uint64_t>(byte & 0x7F) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
 }
 
-bool XzCompress(const brillo::Blob& in, brillo::Blob* out) {
-  CHECK(xz_initialized) << "Initialize XzCompress first";
-  out->clear();
-  if (in.empty())
-    return true;
+void AppendVli(uint64_t value, brillo::Blob* out) {
+  while (value >= 0x80) {
+    out->push_back((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  out->push_back(value);
+}
 
+// Compresses the |size| bytes at |data| into |out| as a single block stream.
+bool CompressStream(const uint8_t* data, size_t size, brillo::Blob* out) {
   // Xz compression properties.
   CXzProps props;
   XzProps_Init(&props);
@@ -101,17 +137,121 @@ bool XzCompress(const brillo::Blob& in, brillo::Blob* out) {
   lzma2Props.lzmaProps.level = 6;
   lzma2Props.lzmaProps.numThreads = 1;
   // The input size data is used to reduce the dictionary size if possible.
-  lzma2Props.lzmaProps.reduceSize = in.size();
+  lzma2Props.lzmaProps.reduceSize = size;
   Lzma2EncProps_Normalize(&lzma2Props);
   props.lzma2Props = lzma2Props;
 
   // We do not use xz's BCJ filters (http://b/329112384).
   props.filterProps.id = 0;
 
+  out->clear();
   BlobWriterStream out_writer(out);
-  BlobReaderStream in_reader(in);
+  BlobReaderStream in_reader(data, size);
   SRes res = Xz_Encode(&out_writer, &in_reader, &props, nullptr /* progress */);
   return res == SZ_OK;
 }
 
+// Appends the block of the single block xz |stream| to |out|, and its index
+// record to |records|.
+bool AppendXzBlock(const brillo::Blob& stream,
+                   brillo::Blob* out,
+                   brillo::Blob* records) {
+  TEST_AND_RETURN_FALSE(stream.size() >=
+                        kXzStreamHeaderSize + kXzStreamFooterSize);
+  const uint8_t* footer = stream.data() + stream.size() - kXzStreamFooterSize;
+  const uint64_t index_size = (ReadLE32(footer + 4) + 1ULL) * 4;
+  TEST_AND_RETURN_FALSE(index_size <= stream.size() - kXzStreamHeaderSize -
+                                          kXzStreamFooterSize);
+  const size_t index_start = stream.size() - kXzStreamFooterSize - index_size;
+  const size_t index_end = stream.size() - kXzStreamFooterSize;
+  size_t pos = index_start;
+  uint64_t num_blocks = 0;
+  TEST_AND_RETURN_FALSE(stream[pos++] == 0 &&
+                        ReadVli(stream, index_end, &pos, &num_blocks) &&
+                        num_blocks == 1);
+  const size_t record_start = pos;
+  uint64_t unpadded_size = 0;
+  uint64_t uncompressed_size = 0;
+  TEST_AND_RETURN_FALSE(ReadVli(stream, index_end, &pos, &unpadded_size) &&
+                        ReadVli(stream, index_end, &pos, &uncompressed_size));
+  // The block and its padding, which keeps the next block aligned.
+  out->insert(out->end(),
+              stream.begin() + kXzStreamHeaderSize,
+              stream.begin() + index_start);
+  records->insert(
+      records->end(), stream.begin() + record_start, stream.begin() + pos);
+  return true;
+}
+
+}  // namespace
+
+namespace chromeos_update_engine {
+
+void XzCompressInit() {
+  if (xz_initialized)
+    return;
+  xz_initialized = true;
+  // Although we don't include a CRC32 for the stream, the xz file header has
+  // a CRC32 of the header itself, which required the CRC table to be
+  // initialized.
+  CrcGenerateTable();
+}
+
+void XzCompressSetBlockSize(size_t block_size) {
+  xz_block_size = block_size;
+}
+
+bool XzCompress(const brillo::Blob& in, brillo::Blob* out) {
+  CHECK(xz_initialized) << "Initialize XzCompress first";
+  out->clear();
+  if (in.empty())
+    return true;
+  if (xz_block_size == 0 || in.size() <= xz_block_size)
+    return CompressStream(in.data(), in.size(), out);
+
+  // The blocks are compressed independently, each as a stream of its own on
+  // the tasks of the pool, and then joined into a single stream. The
+  // dictionary doesn't need to be larger than a block either.
+  const size_t num_blocks = utils::DivRoundUp(in.size(), xz_block_size);
+  std::vector<brillo::Blob> streams(num_blocks);
+  std::vector<char> results(num_blocks);
+  std::vector<TaskPool::Task> tasks;
+  for (size_t i = 0; i < num_blocks; i++) {
+    tasks.push_back([&, i] {
+      const size_t offset = i * xz_block_size;
+      results[i] = CompressStream(in.data() + offset,
+                                  std::min(xz_block_size, in.size() - offset),
+                                  &streams[i]);
+    });
+  }
+  TaskPool::RunTasks(std::move(tasks), diff_utils::GetMaxThreads());
+  TEST_AND_RETURN_FALSE(std::all_of(
+      results.begin(), results.end(), [](char result) { return result; }));
+
+  brillo::Blob index{0x00};
+  AppendVli(num_blocks, &index);
+  out->assign(streams[0].begin(), streams[0].begin() + kXzStreamHeaderSize);
+  for (const auto& stream : streams) {
+    if (!AppendXzBlock(stream, out, &index)) {
+      out->clear();
+      return false;
+    }
+  }
+  index.resize(utils::RoundUp(index.size(), 4), 0);
+  AppendLE32(CrcCalc(index.data(), index.size()), &index);
+  out->insert(out->end(), index.begin(), index.end());
+
+  // The footer has the CRC32 of the index size and of the stream flags, which
+  // are the same in all the streams.
+  brillo::Blob footer;
+  AppendLE32(index.size() / 4 - 1, &footer);
+  footer.insert(footer.end(),
+                out->begin() + kXzHeaderFlagsOffset,
+                out->begin() + kXzHeaderFlagsOffset + kXzStreamFlagsSize);
+  AppendLE32(CrcCalc(footer.data(), footer.size()), out);
+  out->insert(out->end(), footer.begin(), footer.end());
+  out->insert(out->end(), std::begin(kXzFooterMagic), std::end(kXzFooterMagic));
+  return true;
+}
+
 }  // namespace chromeos_update_engine
@@ -23,6 +23,9 @@ namespace chromeos_update_engine {
 
 void XzCompressInit() {}
 
+// liblzma's single-call encoder always produces a single block.
+void XzCompressSetBlockSize(size_t block_size) {}
+
 bool XzCompress(const brillo::Blob& in, brillo::Blob* out) {
   out->clear();
   if (in.empty())
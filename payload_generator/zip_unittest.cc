@@ -27,9 +27,12 @@
 #include "update_engine/common/test_utils.h"
 #include "update_engine/payload_consumer/bzip_extent_writer.h"
 #include "update_engine/payload_consumer/extent_writer.h"
+#include "update_engine/payload_consumer/worker_pool.h"
 #include "update_engine/payload_consumer/xz_extent_writer.h"
+#include "update_engine/payload_consumer/zstd_extent_writer.h"
 #include "update_engine/payload_generator/bzip.h"
 #include "update_engine/payload_generator/xz.h"
+#include "update_engine/payload_generator/zstd.h"
 
 using chromeos_update_engine::test_utils::kRandomString;
 using google::protobuf::RepeatedPtrField;
@@ -111,7 +114,20 @@ class ZipTest<XzTest> : public ::testing::Test {
   }
 };
 
-typedef ::testing::Types<BzipTest, XzTest> ZipTestTypes;
+class ZstdTest {};
+
+template <>
+class ZipTest<ZstdTest> : public ::testing::Test {
+ public:
+  bool ZipCompress(const brillo::Blob& in, brillo::Blob* out) const {
+    return ZstdCompress(in, nullptr, out);
+  }
+  bool ZipDecompress(const brillo::Blob& in, brillo::Blob* out) const {
+    return DecompressWithWriter<ZstdExtentWriter>(in, out);
+  }
+};
+
+typedef ::testing::Types<BzipTest, XzTest, ZstdTest> ZipTestTypes;
 
 TYPED_TEST_CASE(ZipTest, ZipTestTypes);
 
@@ -175,4 +191,78 @@ TYPED_TEST(ZipTest, CompressELFTest) {
   EXPECT_EQ(0, memcmp(in.data(), decompressed.data(), in.size()));
 }
 
+TEST(XzBlocksTest, CompressInBlocksTest) {
+  brillo::Blob in;
+  for (size_t i = 0; i < 16; i++) {
+    in.insert(in.end(), std::begin(kRandomString), std::end(kRandomString));
+    in.push_back(i);
+  }
+  XzCompressSetBlockSize(in.size() / 4);
+  brillo::Blob out;
+  EXPECT_TRUE(XzCompress(in, &out));
+  XzCompressSetBlockSize(0);
+
+  brillo::Blob decompressed;
+  WorkerPool pool(4);
+  std::unique_ptr<ExtentWriter> writer(new XzExtentWriter(
+      std::make_unique<MemoryExtentWriter>(&decompressed), &pool, 4));
+  EXPECT_TRUE(writer->Init({}, 1));
+  EXPECT_TRUE(writer->Write(out.data(), out.size()));
+  EXPECT_EQ(in, decompressed);
+}
+
+TEST(ZstdFramesTest, CompressInFramesTest) {
+  brillo::Blob in;
+  for (size_t i = 0; i < 16; i++) {
+    in.insert(in.end(), std::begin(kRandomString), std::end(kRandomString));
+    in.push_back(i);
+  }
+  ZstdCompressSetFrameSize(in.size() / 4);
+  brillo::Blob out;
+  EXPECT_TRUE(ZstdCompress(in, nullptr, &out));
+  ZstdCompressSetFrameSize(0);
+
+  brillo::Blob decompressed;
+  WorkerPool pool(4);
+  std::unique_ptr<ExtentWriter> writer(new ZstdExtentWriter(
+      std::make_unique<MemoryExtentWriter>(&decompressed), nullptr, &pool, 4));
+  EXPECT_TRUE(writer->Init({}, 1));
+  EXPECT_TRUE(writer->Write(out.data(), out.size()));
+  EXPECT_EQ(in, decompressed);
+}
+
+TEST(ZstdDictionaryTest, CompressWithDictionaryTest) {
+  // Small records sharing most of their content, like the blocks of a
+  // partition, compress much better with a dictionary trained on them.
+  std::vector<brillo::Blob> samples;
+  for (size_t i = 0; i < 200; i++) {
+    string sample = "record " + std::to_string(i * 7919 % 1000) +
+                    ": the quick brown fox jumps over the lazy dog, value=" +
+                    std::to_string(i * 31) + ", flags=0x" +
+                    std::to_string(i % 16) + ";\n";
+    samples.emplace_back(sample.begin(), sample.end());
+  }
+  std::unique_ptr<ZstdDictionary> dictionary =
+      ZstdDictionary::Train(samples, 4096);
+  ASSERT_NE(nullptr, dictionary);
+  EXPECT_GT(dictionary->data().size(), 0U);
+
+  const brillo::Blob& in = samples[42];
+  brillo::Blob out, out_no_dictionary;
+  EXPECT_TRUE(ZstdCompress(in, dictionary.get(), &out));
+  EXPECT_TRUE(ZstdCompress(in, nullptr, &out_no_dictionary));
+  EXPECT_LT(out.size(), out_no_dictionary.size());
+
+  std::unique_ptr<ZSTD_DDict, decltype(&ZSTD_freeDDict)> ddict(
+      ZSTD_createDDict(dictionary->data().data(), dictionary->data().size()),
+      ZSTD_freeDDict);
+  ASSERT_NE(nullptr, ddict);
+  brillo::Blob decompressed;
+  std::unique_ptr<ExtentWriter> writer(new ZstdExtentWriter(
+      std::make_unique<MemoryExtentWriter>(&decompressed), ddict.get()));
+  EXPECT_TRUE(writer->Init({}, 1));
+  EXPECT_TRUE(writer->Write(out.data(), out.size()));
+  EXPECT_EQ(in, decompressed);
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,224 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/zstd.h"
+
+#include <zdict.h>
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+#include <base/logging.h>
+
+#include "update_engine/common/simd_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/mapped_partition.h"
+#include "update_engine/payload_generator/task_pool.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The level the REPLACE_ZSTD data is compressed at. The decompression speed
+// barely depends on it.
+constexpr int kZstdCompressionLevel = 19;
+
+// The size of the samples a dictionary is trained on, and how many times the
+// size of the dictionary they total at most, as recommended by zstd.
+constexpr size_t kSampleBlocks = 4;
+constexpr size_t kSamplesPerDictionarySize = 100;
+
+std::atomic<ZstdDictionaries*> installed_dictionaries{nullptr};
+
+// Uncompressed size of the zstd frames, or 0 for a single frame.
+size_t zstd_frame_size = 0;
+
+// Appends |size| bytes at |data| compressed as a single frame to |out|.
+bool CompressFrame(ZSTD_CCtx* cctx,
+                   const uint8_t* data,
+                   size_t size,
+                   const ZstdDictionary* dictionary,
+                   brillo::Blob* out) {
+  const size_t offset = out->size();
+  out->resize(offset + ZSTD_compressBound(size));
+  size_t compressed_size;
+  if (dictionary) {
+    compressed_size = ZSTD_compress_usingCDict(cctx,
+                                               out->data() + offset,
+                                               out->size() - offset,
+                                               data,
+                                               size,
+                                               dictionary->cdict());
+  } else {
+    compressed_size = ZSTD_compressCCtx(cctx,
+                                        out->data() + offset,
+                                        out->size() - offset,
+                                        data,
+                                        size,
+                                        kZstdCompressionLevel);
+  }
+  if (ZSTD_isError(compressed_size)) {
+    LOG(ERROR) << "zstd compression failed: "
+               << ZSTD_getErrorName(compressed_size);
+    return false;
+  }
+  out->resize(offset + compressed_size);
+  return true;
+}
+
+}  // namespace
+
+ZstdDictionary::ZstdDictionary(brillo::Blob data, ZSTD_CDict* cdict)
+    : data_(std::move(data)), cdict_(cdict) {}
+
+ZstdDictionary::~ZstdDictionary() {
+  ZSTD_freeCDict(cdict_);
+}
+
+std::unique_ptr<ZstdDictionary> ZstdDictionary::Train(
+    const std::vector<brillo::Blob>& samples, size_t max_size) {
+  brillo::Blob buffer;
+  std::vector<size_t> sample_sizes;
+  for (const brillo::Blob& sample : samples) {
+    buffer.insert(buffer.end(), sample.begin(), sample.end());
+    sample_sizes.push_back(sample.size());
+  }
+  brillo::Blob data(max_size);
+  size_t size = ZDICT_trainFromBuffer(data.data(),
+                                      data.size(),
+                                      buffer.data(),
+                                      sample_sizes.data(),
+                                      sample_sizes.size());
+  if (ZDICT_isError(size)) {
+    LOG(WARNING) << "Failed to train a zstd dictionary on " << samples.size()
+                 << " samples: " << ZDICT_getErrorName(size);
+    return nullptr;
+  }
+  data.resize(size);
+  ZSTD_CDict* cdict =
+      ZSTD_createCDict(data.data(), data.size(), kZstdCompressionLevel);
+  TEST_AND_RETURN_VAL(nullptr, cdict != nullptr);
+  return std::unique_ptr<ZstdDictionary>(
+      new ZstdDictionary(std::move(data), cdict));
+}
+
+std::unique_ptr<ZstdDictionary> ZstdDictionary::Create(brillo::Blob data) {
+  ZSTD_CDict* cdict =
+      ZSTD_createCDict(data.data(), data.size(), kZstdCompressionLevel);
+  TEST_AND_RETURN_VAL(nullptr, cdict != nullptr);
+  return std::unique_ptr<ZstdDictionary>(
+      new ZstdDictionary(std::move(data), cdict));
+}
+
+std::unique_ptr<ZstdDictionary> ZstdDictionary::TrainOnPartition(
+    const PartitionConfig& part, size_t block_size, size_t max_size) {
+  const uint64_t num_blocks = part.size / block_size;
+  const uint64_t num_samples =
+      std::min<uint64_t>(num_blocks / kSampleBlocks,
+                         kSamplesPerDictionarySize * max_size /
+                             (kSampleBlocks * block_size));
+  if (num_samples == 0)
+    return nullptr;
+  // The samples start at evenly spaced blocks, the zero ones are skipped.
+  const uint64_t stride = num_blocks / num_samples;
+  std::vector<brillo::Blob> samples;
+  for (uint64_t i = 0; i < num_samples; i++) {
+    brillo::Blob sample;
+    TEST_AND_RETURN_VAL(
+        nullptr,
+        MappedPartitions::ReadExtents(
+            part.path, {ExtentForRange(i * stride, kSampleBlocks)}, &sample));
+    if (!simd_utils::IsZero(sample.data(), sample.size()))
+      samples.push_back(std::move(sample));
+  }
+  std::unique_ptr<ZstdDictionary> dictionary = Train(samples, max_size);
+  if (dictionary) {
+    LOG(INFO) << "Trained a zstd dictionary of " << dictionary->data().size()
+              << " bytes for " << part.name << " on " << samples.size()
+              << " samples.";
+  }
+  return dictionary;
+}
+
+void ZstdCompressSetFrameSize(size_t frame_size) {
+  zstd_frame_size = frame_size;
+}
+
+void ZstdDictionaries::TrainAll(const PayloadGenerationConfig& config,
+                                size_t max_size) {
+  const auto& parts = config.target.partitions;
+  std::vector<std::unique_ptr<ZstdDictionary>> trained(parts.size());
+  std::vector<TaskPool::Task> tasks;
+  for (size_t i = 0; i < parts.size(); i++) {
+    tasks.push_back([&, i] {
+      trained[i] = ZstdDictionary::TrainOnPartition(
+          parts[i], config.block_size, max_size);
+    });
+  }
+  TaskPool::RunTasks(std::move(tasks), diff_utils::GetMaxThreads());
+  for (size_t i = 0; i < parts.size(); i++) {
+    if (trained[i])
+      Add(parts[i].path, std::move(trained[i]));
+  }
+}
+
+void ZstdDictionaries::Add(const std::string& path,
+                           std::unique_ptr<ZstdDictionary> dictionary) {
+  dictionaries_[path] = std::move(dictionary);
+}
+
+const ZstdDictionary* ZstdDictionaries::Find(const std::string& path) const {
+  auto it = dictionaries_.find(path);
+  return it == dictionaries_.end() ? nullptr : it->second.get();
+}
+
+ZstdDictionaries* ZstdDictionaries::Get() {
+  return installed_dictionaries.load(std::memory_order_acquire);
+}
+
+void ZstdDictionaries::Set(ZstdDictionaries* dictionaries) {
+  installed_dictionaries.store(dictionaries, std::memory_order_release);
+}
+
+bool ZstdCompress(const brillo::Blob& in,
+                  const ZstdDictionary* dictionary,
+                  brillo::Blob* out) {
+  out->clear();
+  if (in.empty())
+    return true;
+  std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx(ZSTD_createCCtx(),
+                                                            ZSTD_freeCCtx);
+  TEST_AND_RETURN_FALSE(cctx != nullptr);
+  // Every frame records its content size, so that the consumer finds the
+  // frames and their output offsets from their headers alone.
+  const size_t frame_size = zstd_frame_size > 0 ? zstd_frame_size : in.size();
+  for (size_t offset = 0; offset < in.size(); offset += frame_size) {
+    if (!CompressFrame(cctx.get(),
+                       in.data() + offset,
+                       std::min(frame_size, in.size() - offset),
+                       dictionary,
+                       out)) {
+      out->clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace chromeos_update_engine
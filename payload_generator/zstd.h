@@ -0,0 +1,110 @@
+//
+// Copyright (C) 2026 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_ZSTD_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_ZSTD_H_
+
+#include <zstd.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_generator/payload_generation_config.h"
+
+namespace chromeos_update_engine {
+
+// A zstd dictionary trained on the data of a partition, which is shipped in
+// its PartitionUpdate and used by all its REPLACE_ZSTD operations.
+class ZstdDictionary {
+ public:
+  ~ZstdDictionary();
+
+  // Trains a dictionary of up to |max_size| bytes on |samples|. Returns
+  // nullptr if it can't be trained, like when there are too few samples.
+  static std::unique_ptr<ZstdDictionary> Train(
+      const std::vector<brillo::Blob>& samples, size_t max_size);
+
+  // Trains a dictionary of up to |max_size| bytes on chunks evenly spread
+  // over the non-zero data of |part|.
+  static std::unique_ptr<ZstdDictionary> TrainOnPartition(
+      const PartitionConfig& part, size_t block_size, size_t max_size);
+
+  // Loads the dictionary |data| of an existing payload. Returns nullptr if it
+  // can't be loaded.
+  static std::unique_ptr<ZstdDictionary> Create(brillo::Blob data);
+
+  const brillo::Blob& data() const { return data_; }
+  const ZSTD_CDict* cdict() const { return cdict_; }
+
+ private:
+  ZstdDictionary(brillo::Blob data, ZSTD_CDict* cdict);
+
+  const brillo::Blob data_;
+  ZSTD_CDict* const cdict_;
+
+  DISALLOW_COPY_AND_ASSIGN(ZstdDictionary);
+};
+
+// The zstd dictionaries of the partitions of a payload generation, keyed by
+// the path of the new partition image. Installing them enables REPLACE_ZSTD
+// in the full operations of the partitions allowing it, with the dictionary
+// of the partition if it has one. The dictionaries are added before this is
+// installed, after which they may be looked up concurrently.
+class ZstdDictionaries {
+ public:
+  ZstdDictionaries() = default;
+
+  // Trains the dictionaries of up to |max_size| bytes of the new partitions
+  // of |config| in parallel.
+  void TrainAll(const PayloadGenerationConfig& config, size_t max_size);
+
+  void Add(const std::string& path,
+           std::unique_ptr<ZstdDictionary> dictionary);
+
+  // Returns the dictionary of the partition at |path|, or nullptr.
+  const ZstdDictionary* Find(const std::string& path) const;
+
+  // Returns the installed dictionaries, or nullptr.
+  static ZstdDictionaries* Get();
+  // Installs |dictionaries|, which must outlive their use, or none.
+  static void Set(ZstdDictionaries* dictionaries);
+
+ private:
+  std::map<std::string, std::unique_ptr<ZstdDictionary>> dictionaries_;
+
+  DISALLOW_COPY_AND_ASSIGN(ZstdDictionaries);
+};
+
+// Splits the data compressed by ZstdCompress() into independent zstd frames of
+// |frame_size| uncompressed bytes, which the payload consumer can decode in
+// parallel. 0, the default, compresses the data as a single frame.
+void ZstdCompressSetFrameSize(size_t frame_size);
+
+// Compresses the input buffer |in| into |out| with zstd at a high level,
+// with |dictionary| unless it's nullptr. An empty |in| is compressed to an
+// empty |out|.
+bool ZstdCompress(const brillo::Blob& in,
+                  const ZstdDictionary* dictionary,
+                  brillo::Blob* out);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_ZSTD_H_
@@ -0,0 +1,147 @@
+#!/bin/bash
+#
+# Copyright (C) 2026 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# This script measures the apply of the full and delta payloads of the images
+# in sample_images.tar.bz2 onto loop devices with delta_generator --in_file,
+# and fails if the time of an apply phase or the peak RSS regressed by more
+# than a tolerance against the baselines file. With --update_baselines, it
+# records the measurements as the new baselines instead. Must run as root to
+# attach the loop devices.
+#
+# Usage: benchmark_apply.sh [--update_baselines] [baselines_file]
+#                           [tolerance_percent]
+
+set -e
+
+UPDATE_BASELINES=false
+if [[ "$1" == "--update_baselines" ]]; then
+  UPDATE_BASELINES=true
+  shift
+fi
+BASELINES="${1:-$(dirname "$0")/apply_baselines.txt}"
+TOLERANCE="${2:-20}"
+
+TEMP_IMG_DIR=$(mktemp -d)
+LOOP_DEVICES=()
+cleanup() {
+  for device in "${LOOP_DEVICES[@]}"; do
+    losetup -d "${device}" || true
+  done
+  rm -rf "${TEMP_IMG_DIR}"
+}
+trap cleanup EXIT
+OLD_KERNEL="${TEMP_IMG_DIR}/disk_ext2_4k_empty.img"
+OLD_ROOT="${TEMP_IMG_DIR}/disk_sqfs_empty.img"
+NEW_KERNEL="${TEMP_IMG_DIR}/disk_ext2_4k.img"
+NEW_ROOT="${TEMP_IMG_DIR}/disk_sqfs_default.img"
+
+tar -xf "$(dirname "$0")/sample_images.tar.bz2" -C "${TEMP_IMG_DIR}"
+
+# Attaches a loop device to a copy of the image $2, or to an empty image of the
+# size of $2 if $3 is "empty", and stores its path in the variable named $1.
+attach_loop_device() {
+  local image="${TEMP_IMG_DIR}/loop${#LOOP_DEVICES[@]}_$(basename "$2")"
+  if [[ "$3" == "empty" ]]; then
+    truncate -s "$(stat -c %s "$2")" "${image}"
+  else
+    cp "$2" "${image}"
+  fi
+  local device
+  device=$(losetup --find --show "${image}")
+  LOOP_DEVICES+=("${device}")
+  printf -v "$1" '%s' "${device}"
+}
+
+# Applies the payload $1 of type $2 and appends its measurements to
+# ${TEMP_IMG_DIR}/measurements.txt.
+apply_payload() {
+  local old_partitions=()
+  if [[ "$2" == "delta" ]]; then
+    attach_loop_device old_kernel "${OLD_KERNEL}"
+    attach_loop_device old_root "${OLD_ROOT}"
+    old_partitions=(--old_partitions="${old_kernel}":"${old_root}")
+  fi
+  attach_loop_device new_kernel "${NEW_KERNEL}" empty
+  attach_loop_device new_root "${NEW_ROOT}" empty
+  echo "Applying the $2 payload"
+  delta_generator --in_file="$1" \
+                  --partition_names=kernel:root \
+                  --new_partitions="${new_kernel}":"${new_root}" \
+                  "${old_partitions[@]}" \
+                  --profile_output="${TEMP_IMG_DIR}/$2_profile.json"
+  cmp "${new_kernel}" "${NEW_KERNEL}"
+  cmp "${new_root}" "${NEW_ROOT}"
+  python3 - "$2" "${TEMP_IMG_DIR}/$2_profile.json" \
+      >> "${TEMP_IMG_DIR}/measurements.txt" <<'PYTHON'
+import json
+import sys
+
+payload, profile_path = sys.argv[1:]
+with open(profile_path) as profile_file:
+  profile = json.load(profile_file)
+for phase, time_ms in sorted(profile['phase_time_ms'].items()):
+  print(payload, phase + '_ms', time_ms)
+print(payload, 'wall_time_ms', profile['wall_time_ms'])
+print(payload, 'peak_rss_bytes', profile['peak_rss_bytes'])
+PYTHON
+}
+
+echo "Generating the payloads"
+delta_generator --out_file="${TEMP_IMG_DIR}/full_payload.bin" \
+                --partition_names=kernel:root \
+                --new_partitions="${NEW_KERNEL}":"${NEW_ROOT}"
+delta_generator --out_file="${TEMP_IMG_DIR}/delta_payload.bin" \
+                --partition_names=kernel:root \
+                --new_partitions="${NEW_KERNEL}":"${NEW_ROOT}" \
+                --old_partitions="${OLD_KERNEL}":"${OLD_ROOT}"
+
+apply_payload "${TEMP_IMG_DIR}/full_payload.bin" full
+apply_payload "${TEMP_IMG_DIR}/delta_payload.bin" delta
+
+if [[ "${UPDATE_BASELINES}" == true || ! -f "${BASELINES}" ]]; then
+  cp "${TEMP_IMG_DIR}/measurements.txt" "${BASELINES}"
+  echo "Baselines written to ${BASELINES}"
+  exit 0
+fi
+
+# Compares the measurements with the baselines, the metrics missing from
+# either side aren't compared.
+python3 - "${BASELINES}" "${TEMP_IMG_DIR}/measurements.txt" "${TOLERANCE}" \
+    <<'PYTHON'
+import sys
+
+def load(path):
+  with open(path) as metrics_file:
+    return {(payload, metric): float(value)
+            for payload, metric, value in
+            (line.split() for line in metrics_file if line.strip())}
+
+baselines = load(sys.argv[1])
+measurements = load(sys.argv[2])
+tolerance = float(sys.argv[3]) / 100
+regressed = False
+for key, value in sorted(measurements.items()):
+  baseline = baselines.get(key)
+  if baseline is None:
+    continue
+  status = 'ok'
+  if value > baseline * (1 + tolerance):
+    status = 'REGRESSED'
+    regressed = True
+  print('%s %s: %.1f (baseline %.1f) %s' % (key + (value, baseline, status)))
+sys.exit(1 if regressed else 0)
+PYTHON
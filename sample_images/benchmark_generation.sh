@@ -0,0 +1,60 @@
+#!/bin/bash
+#
+# Copyright (C) 2026 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# This script benchmarks delta_generator on the images in
+# sample_images.tar.bz2: it generates the same full and delta payloads as
+# generate_payloads.sh, at the latest minor version, several times. The
+# --profile_output of every run is kept in the output directory.
+#
+# Usage: benchmark_generation.sh [output_dir] [runs] [max_threads]
+
+set -e
+
+OUT_DIR="${1:-./generation_benchmark}"
+RUNS="${2:-3}"
+MAX_THREADS="${3:-0}"
+
+TEMP_IMG_DIR=$(mktemp -d)
+trap 'rm -rf "${TEMP_IMG_DIR}"' EXIT
+OLD_KERNEL="${TEMP_IMG_DIR}/disk_ext2_4k_empty.img"
+OLD_ROOT="${TEMP_IMG_DIR}/disk_sqfs_empty.img"
+NEW_KERNEL="${TEMP_IMG_DIR}/disk_ext2_4k.img"
+NEW_ROOT="${TEMP_IMG_DIR}/disk_sqfs_default.img"
+
+mkdir -p "${OUT_DIR}"
+tar -xf "$(dirname "$0")/sample_images.tar.bz2" -C "${TEMP_IMG_DIR}"
+
+for run in $(seq 1 "${RUNS}"); do
+  echo "Run ${run}/${RUNS}: full payload"
+  /usr/bin/time -f "%e s, %M KiB peak" \
+  delta_generator --out_file="${TEMP_IMG_DIR}/full_payload.bin" \
+                  --partition_names=kernel:root \
+                  --new_partitions="${NEW_KERNEL}":"${NEW_ROOT}" \
+                  --max_threads="${MAX_THREADS}" \
+                  --profile_output="${OUT_DIR}/full_${run}.json"
+
+  echo "Run ${run}/${RUNS}: delta payload"
+  /usr/bin/time -f "%e s, %M KiB peak" \
+  delta_generator --out_file="${TEMP_IMG_DIR}/delta_payload.bin" \
+                  --partition_names=kernel:root \
+                  --new_partitions="${NEW_KERNEL}":"${NEW_ROOT}" \
+                  --old_partitions="${OLD_KERNEL}":"${OLD_ROOT}" \
+                  --max_threads="${MAX_THREADS}" \
+                  --profile_output="${OUT_DIR}/delta_${run}.json"
+done
+
+echo "Profiles written to ${OUT_DIR}"
@@ -21,6 +21,11 @@
 
 // To use this, simply make an HTTP connection to localhost:port and
 // GET a url.
+//
+// GET /shaped/<length>/<bytes_per_second>/<rtt_ms>/<drop_offset> emulates
+// the bandwidth, latency and connection drops of a network link to measure
+// the download throughput and resume behavior of the fetchers, see
+// HandleShapedGet().
 
 #include <err.h>
 #include <errno.h>
@@ -37,7 +42,9 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <chrono>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <base/logging.h>
@@ -58,6 +65,10 @@ namespace chromeos_update_engine {
 
 static const char* kListeningMsgPrefix = "listening on port ";
 
+// The bandwidth of the shaped responses is enforced over slices of this
+// length.
+static const int kShapingSliceMs = 10;
+
 enum {
   RC_OK = 0,
   RC_BAD_ARGS,
@@ -282,6 +293,34 @@ inline size_t WritePayload(int fd,
   return WritePayload(fd, start_offset, end_offset, 'a', 10);
 }
 
+// Writes the default payload from |start_offset| to |end_offset| at
+// |bytes_per_second| at most, 0 meaning no limit. The slices are paced against
+// a deadline, so that the rate doesn't drift with the latency of the writes.
+// Returns the number of successfully written bytes.
+size_t WriteShapedPayload(int fd,
+                          const off_t start_offset,
+                          const off_t end_offset,
+                          const size_t bytes_per_second) {
+  if (bytes_per_second == 0)
+    return WritePayload(fd, start_offset, end_offset);
+
+  const size_t slice_len =
+      std::max<size_t>(1, bytes_per_second * kShapingSliceMs / 1000);
+  auto deadline = std::chrono::steady_clock::now();
+  off_t offset = start_offset;
+  while (offset < end_offset) {
+    const off_t slice_end =
+        std::min<off_t>(end_offset, offset + static_cast<off_t>(slice_len));
+    const size_t written = WritePayload(fd, offset, slice_end);
+    offset += written;
+    if (offset < slice_end)
+      break;
+    deadline += std::chrono::milliseconds(kShapingSliceMs);
+    std::this_thread::sleep_until(deadline);
+  }
+  return offset - start_offset;
+}
+
 // Send an empty response, then kill the server.
 void HandleQuit(int fd) {
   WriteHeaders(fd, 0, 0, kHttpResponseOk);
@@ -385,6 +424,49 @@ ssize_t HandleGet(int fd,
   return HandleGet(fd, request, total_length, 0, 0, 0);
 }
 
+// Generates an HTTP response like HandleGet(), emulating a network link: the
+// response starts |rtt_ms| after the request and its payload is sent at
+// |bytes_per_second| at most. If |drop_offset| is within the requested range,
+// the connection is closed once the payload reached it, so that a client
+// resuming from where it stopped gets the rest. Returns the total number of
+// bytes delivered or -1 for error.
+ssize_t HandleShapedGet(int fd,
+                        const HttpRequest& request,
+                        const size_t total_length,
+                        const size_t bytes_per_second,
+                        const int rtt_ms,
+                        const size_t drop_offset) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(rtt_ms));
+
+  const size_t start_offset = request.start_offset;
+  if (start_offset >= total_length) {
+    return WriteHeaders(
+        fd, total_length, total_length, kHttpResponseReqRangeNotSat);
+  }
+  size_t end_offset = std::min<size_t>(
+      request.end_offset > 0 ? request.end_offset : total_length,
+      total_length);
+  if (end_offset < start_offset)
+    return WriteHeaders(fd, 0, 0, kHttpResponseBadRequest);
+
+  ssize_t ret{};
+  if ((ret = WriteHeaders(fd, start_offset, end_offset, request.return_code)) <
+      0)
+    return -1;
+  size_t written = ret;
+
+  if (drop_offset > start_offset && drop_offset < end_offset) {
+    LOG(INFO) << "dropping the connection at offset " << drop_offset;
+    end_offset = drop_offset;
+  }
+  LOG(INFO) << "generating shaped response payload: range=" << start_offset
+            << "-" << (end_offset - 1) << ", " << bytes_per_second
+            << " bytes/s, rtt=" << rtt_ms << " ms";
+  written +=
+      WriteShapedPayload(fd, start_offset, end_offset, bytes_per_second);
+  return written;
+}
+
 // Handles /redirect/<code>/<url> requests by returning the specified
 // redirect <code> with a location pointing to /<url>.
 void HandleRedirect(int fd, const HttpRequest& request) {
@@ -543,6 +625,21 @@ void HandleConnection(int fd) {
               terms.GetSizeT(2),
               terms.GetInt(3),
               terms.GetInt(4));
+  } else if (base::StartsWith(url, "/shaped/", base::CompareCase::SENSITIVE)) {
+    const UrlTerms terms(url, 5);
+    // Served by a child process, so that concurrent connections are shaped
+    // independently like parallel connections to a server.
+    const pid_t pid = fork();
+    if (pid <= 0) {
+      HandleShapedGet(fd,
+                      request,
+                      terms.GetSizeT(1),
+                      terms.GetSizeT(2),
+                      terms.GetInt(3),
+                      terms.GetSizeT(4));
+      if (pid == 0)
+        exit(RC_OK);
+    }
   } else if (url.find("/redirect/") == 0) {
     HandleRedirect(fd, request);
   } else if (url == "/error") {
@@ -594,6 +691,8 @@ int main(int argc, char** argv) {
 
   // Ignore SIGPIPE on write() to sockets.
   signal(SIGPIPE, SIG_IGN);
+  // Don't leave zombies of the children serving shaped responses.
+  signal(SIGCHLD, SIG_IGN);
 
   int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
   if (listen_fd < 0)